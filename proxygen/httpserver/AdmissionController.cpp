@@ -0,0 +1,95 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/httpserver/AdmissionController.h>
+
+#include <algorithm>
+#include <glog/logging.h>
+
+using std::chrono::steady_clock;
+
+namespace proxygen {
+
+AdmissionController::AdmissionController(const Options& options)
+    : options_(options),
+      limit_(options.initialLimit) {
+  CHECK_GT(options_.numPriorities, 0);
+  CHECK_LE(options_.minLimit, options_.maxLimit);
+  CHECK_GT(options_.minLimit, 0);
+  limit_ = std::min<double>(std::max<double>(limit_, options_.minLimit),
+                            options_.maxLimit);
+}
+
+void AdmissionController::attachEventBase(folly::EventBase* eventBase) {
+  loopLagProbe_.reset(new LoopLagProbe(eventBase, this));
+  loopLagProbe_->schedule();
+}
+
+uint8_t AdmissionController::getPriority(const HTTPMessage& msg) const {
+  if (!options_.classifier) {
+    return 0;
+  }
+  return std::min<uint8_t>(options_.classifier(msg),
+                           options_.numPriorities - 1);
+}
+
+bool AdmissionController::admit(const HTTPMessage& msg) {
+  auto priority = getPriority(msg);
+  double share = limit_ * (options_.numPriorities - priority) /
+    options_.numPriorities;
+  if (inflight_ >= std::max<double>(share, 1)) {
+    VLOG(4) << "Shedding request of priority " << unsigned(priority)
+            << ", " << inflight_ << " in flight of " << getLimit();
+    return false;
+  }
+  inflight_++;
+  return true;
+}
+
+void AdmissionController::onRequestDone(steady_clock::duration latency) {
+  CHECK_GT(inflight_, 0);
+  inflight_--;
+  if (latency > options_.targetLatency) {
+    backoff();
+  } else {
+    limit_ = std::min<double>(limit_ + 1 / limit_, options_.maxLimit);
+  }
+}
+
+void AdmissionController::backoff() {
+  // Back off once per targetLatency at most, as the requests done
+  // meanwhile were most likely slow for the same reason
+  auto now = steady_clock::now();
+  if (now - lastBackoff_ < options_.targetLatency) {
+    return;
+  }
+  lastBackoff_ = now;
+  limit_ = std::max<double>(limit_ * options_.backoffRatio,
+                            options_.minLimit);
+  VLOG(3) << "Admission limit backed off to " << getLimit();
+}
+
+void AdmissionController::LoopLagProbe::schedule() {
+  scheduled_ = steady_clock::now();
+  scheduleTimeout(parent_->options_.loopLagProbeInterval.count());
+}
+
+void AdmissionController::LoopLagProbe::timeoutExpired() noexcept {
+  auto late = steady_clock::now() - scheduled_ -
+    parent_->options_.loopLagProbeInterval;
+  parent_->loopLag_ = std::max(
+    std::chrono::microseconds(0),
+    std::chrono::duration_cast<std::chrono::microseconds>(late));
+  if (parent_->loopLag_ > parent_->options_.maxLoopLag) {
+    parent_->backoff();
+  }
+  schedule();
+}
+
+}
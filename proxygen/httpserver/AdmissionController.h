@@ -0,0 +1,141 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <chrono>
+#include <folly/io/async/AsyncTimeout.h>
+#include <functional>
+#include <proxygen/httpserver/Filters.h>
+#include <proxygen/lib/http/HTTPMessage.h>
+
+namespace proxygen {
+
+/**
+ * Decides whether a worker takes on a new request or turns it away with a
+ * 503 before any handler is created, so that an overloaded server still
+ * completes the requests it does take on time.
+ *
+ * The requests in flight are capped by a limit that adapts the way TCP
+ * congestion windows do (AIMD): it grows by one for every limit requests
+ * that complete within targetLatency, and shrinks by backoffRatio, at most
+ * once per targetLatency, when one takes longer or the event loop lags
+ * behind by more than maxLoopLag.
+ *
+ * The classifier ranks requests from priority 0, the most important, to
+ * numPriorities - 1. Priority p may only use the first
+ * (numPriorities - p) / numPriorities of the limit, so that the least
+ * important requests are shed first.
+ *
+ * Every worker has its own, used from its EventBase only.
+ */
+class AdmissionController {
+ public:
+  using Classifier = std::function<uint8_t(const HTTPMessage&)>;
+
+  struct Options {
+    bool enabled{false};
+    Classifier classifier;
+    uint8_t numPriorities{1};
+    size_t initialLimit{100};
+    size_t minLimit{10};
+    size_t maxLimit{10000};
+    std::chrono::milliseconds targetLatency{1000};
+    std::chrono::milliseconds maxLoopLag{100};
+    std::chrono::milliseconds loopLagProbeInterval{50};
+    double backoffRatio{0.9};
+  };
+
+  explicit AdmissionController(const Options& options);
+
+  /**
+   * Start probing the lag of the event loop the requests run on
+   */
+  void attachEventBase(folly::EventBase* eventBase);
+
+  /**
+   * Whether to take on the request. If so, onRequestDone() must be called
+   * once it is done.
+   */
+  bool admit(const HTTPMessage& msg);
+
+  void onRequestDone(std::chrono::steady_clock::duration latency);
+
+  uint8_t getPriority(const HTTPMessage& msg) const;
+
+  size_t getLimit() const {
+    return size_t(limit_);
+  }
+
+  size_t getInflight() const {
+    return inflight_;
+  }
+
+  std::chrono::microseconds getLoopLag() const {
+    return loopLag_;
+  }
+
+ private:
+  class LoopLagProbe: public folly::AsyncTimeout {
+   public:
+    LoopLagProbe(folly::EventBase* eventBase, AdmissionController* parent):
+        folly::AsyncTimeout(eventBase),
+        parent_(parent) {}
+
+    void schedule();
+
+    void timeoutExpired() noexcept override;
+
+   private:
+    AdmissionController* parent_;
+    std::chrono::steady_clock::time_point scheduled_;
+  };
+
+  void backoff();
+
+  const Options options_;
+  double limit_;
+  size_t inflight_{0};
+  std::chrono::microseconds loopLag_{0};
+  std::chrono::steady_clock::time_point lastBackoff_;
+  std::unique_ptr<LoopLagProbe> loopLagProbe_;
+};
+
+/**
+ * Reports a request admitted by an AdmissionController back to it once
+ * done. HTTPServerAcceptor inserts it at the client end of the chain.
+ */
+class AdmissionFilter: public Filter {
+ public:
+  AdmissionFilter(RequestHandler* upstream, AdmissionController* controller)
+      : Filter(upstream),
+        controller_(controller),
+        start_(std::chrono::steady_clock::now()) {
+  }
+
+  void requestComplete() noexcept override {
+    done();
+    Filter::requestComplete();
+  }
+
+  void onError(ProxygenError err) noexcept override {
+    done();
+    Filter::onError(err);
+  }
+
+ private:
+  void done() {
+    controller_->onRequestDone(std::chrono::steady_clock::now() - start_);
+  }
+
+  AdmissionController* controller_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+}
@@ -0,0 +1,262 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/httpserver/AsyncRequestHandler.h>
+
+#include <folly/Conv.h>
+#include <proxygen/httpserver/ResponseBuilder.h>
+#include <proxygen/lib/http/HTTPException.h>
+
+using folly::IOBuf;
+using std::unique_ptr;
+
+namespace proxygen {
+
+AsyncRequestHandler::AsyncRequestHandler(const Options& options)
+    : options_(options) {
+}
+
+void AsyncRequestHandler::setResponseHandler(
+    ResponseHandler* handler) noexcept {
+  response_.downstream = CHECK_NOTNULL(handler);
+  downstream_ = &response_;
+}
+
+void AsyncRequestHandler::onRequest(unique_ptr<HTTPMessage> request) noexcept {
+  folly::Future<folly::Unit> handled = folly::makeFuture();
+  try {
+    handled = handle(std::move(request));
+  } catch (const std::exception& ex) {
+    handled = folly::makeFuture<folly::Unit>(
+      folly::exception_wrapper(std::current_exception(), ex));
+  }
+  handled.then([this] (folly::Try<folly::Unit>&& result) {
+      onHandled(std::move(result));
+    });
+}
+
+void AsyncRequestHandler::onBody(unique_ptr<IOBuf> body) noexcept {
+  if (reading_) {
+    reading_ = false;
+    readPromise_.setValue(std::move(body));
+    return;
+  }
+  body_.append(std::move(body));
+  if (!ingressPaused_ && body_.chainLength() > options_.maxBufferedBytes) {
+    ingressPaused_ = true;
+    response_.pauseIngress();
+  }
+}
+
+void AsyncRequestHandler::onEOM() noexcept {
+  eom_ = true;
+  if (reading_) {
+    reading_ = false;
+    readPromise_.setValue(nullptr);
+  }
+}
+
+void AsyncRequestHandler::requestComplete() noexcept {
+  finish(kErrorNone);
+}
+
+void AsyncRequestHandler::onError(ProxygenError err) noexcept {
+  finish(err);
+}
+
+void AsyncRequestHandler::onEgressPaused() noexcept {
+  egressPaused_ = true;
+}
+
+void AsyncRequestHandler::onEgressResumed() noexcept {
+  egressPaused_ = false;
+  if (waitingForEgress_) {
+    waitingForEgress_ = false;
+    egressPromise_.setValue();
+  }
+}
+
+folly::Future<unique_ptr<IOBuf>> AsyncRequestHandler::readBody() {
+  CHECK(!reading_);
+  if (!body_.empty()) {
+    if (ingressPaused_) {
+      ingressPaused_ = false;
+      response_.resumeIngress();
+    }
+    return folly::makeFuture(body_.move());
+  }
+  if (eom_) {
+    return folly::makeFuture(unique_ptr<IOBuf>());
+  }
+  if (done_) {
+    return folly::makeFuture<unique_ptr<IOBuf>>(makeError());
+  }
+  reading_ = true;
+  readPromise_ = folly::Promise<unique_ptr<IOBuf>>();
+  return readPromise_.getFuture();
+}
+
+folly::Future<folly::Unit> AsyncRequestHandler::waitForEgress() {
+  CHECK(!waitingForEgress_);
+  if (done_) {
+    return folly::makeFuture<folly::Unit>(makeError());
+  }
+  if (!egressPaused_) {
+    return folly::makeFuture();
+  }
+  waitingForEgress_ = true;
+  egressPromise_ = folly::Promise<folly::Unit>();
+  return egressPromise_.getFuture();
+}
+
+void AsyncRequestHandler::onHandled(folly::Try<folly::Unit>&& result) {
+  handled_ = true;
+  if (!done_ && !response_.eomSent) {
+    if (result.hasException()) {
+      LOG(ERROR) << "Failed to handle request: "
+                 << result.exception().what();
+    }
+    if (!response_.headersSent) {
+      if (result.hasValue()) {
+        LOG(ERROR) << "Request handled without a response";
+      }
+      ResponseBuilder(downstream_)
+        .status(500, "Internal Server Error")
+        .sendWithEOM();
+    } else if (result.hasException()) {
+      response_.sendAbort();
+    } else {
+      response_.sendEOM();
+    }
+  }
+  if (done_) {
+    delete this;
+  }
+}
+
+void AsyncRequestHandler::finish(ProxygenError err) {
+  done_ = true;
+  error_ = err;
+  response_.downstream = nullptr;
+  if (reading_) {
+    reading_ = false;
+    readPromise_.setException(makeError());
+  }
+  if (waitingForEgress_) {
+    waitingForEgress_ = false;
+    egressPromise_.setException(makeError());
+  }
+  if (handled_) {
+    delete this;
+  }
+}
+
+folly::exception_wrapper AsyncRequestHandler::makeError() const {
+  HTTPException ex(HTTPException::Direction::INGRESS_AND_EGRESS,
+                   error_ == kErrorNone ? "Request complete" :
+                   folly::to<std::string>("Request failed: ",
+                                          getErrorString(error_)));
+  ex.setProxygenError(error_);
+  return folly::make_exception_wrapper<HTTPException>(std::move(ex));
+}
+
+void AsyncRequestHandler::Response::sendHeaders(HTTPMessage& msg) noexcept {
+  if (downstream) {
+    headersSent |= msg.getStatusCode() >= 200;
+    downstream->sendHeaders(msg);
+  }
+}
+
+void AsyncRequestHandler::Response::sendHeaders(
+    unique_ptr<HTTPMessage> msg) noexcept {
+  if (downstream) {
+    headersSent |= msg->getStatusCode() >= 200;
+    downstream->sendHeaders(std::move(msg));
+  }
+}
+
+void AsyncRequestHandler::Response::sendChunkHeader(size_t len) noexcept {
+  if (downstream) {
+    downstream->sendChunkHeader(len);
+  }
+}
+
+void AsyncRequestHandler::Response::sendBody(
+    unique_ptr<IOBuf> body) noexcept {
+  if (downstream) {
+    downstream->sendBody(std::move(body));
+  }
+}
+
+bool AsyncRequestHandler::Response::sendFile(int fd, off_t offset,
+                                             size_t length) noexcept {
+  return downstream && downstream->sendFile(fd, offset, length);
+}
+
+void AsyncRequestHandler::Response::sendChunkTerminator() noexcept {
+  if (downstream) {
+    downstream->sendChunkTerminator();
+  }
+}
+
+void AsyncRequestHandler::Response::sendEOM() noexcept {
+  if (downstream) {
+    eomSent = true;
+    downstream->sendEOM();
+  }
+}
+
+void AsyncRequestHandler::Response::sendAbort() noexcept {
+  if (downstream) {
+    eomSent = true;
+    downstream->sendAbort();
+  }
+}
+
+void AsyncRequestHandler::Response::refreshTimeout() noexcept {
+  if (downstream) {
+    downstream->refreshTimeout();
+  }
+}
+
+void AsyncRequestHandler::Response::pauseIngress() noexcept {
+  if (downstream) {
+    downstream->pauseIngress();
+  }
+}
+
+void AsyncRequestHandler::Response::resumeIngress() noexcept {
+  if (downstream) {
+    downstream->resumeIngress();
+  }
+}
+
+ResponseHandler* AsyncRequestHandler::Response::newPushedResponse(
+    PushHandler* pushHandler) noexcept {
+  return downstream ? downstream->newPushedResponse(pushHandler) : nullptr;
+}
+
+folly::SysArena* AsyncRequestHandler::Response::getArena() noexcept {
+  return downstream ? downstream->getArena() : nullptr;
+}
+
+const folly::TransportInfo&
+AsyncRequestHandler::Response::getSetupTransportInfo() const noexcept {
+  static const folly::TransportInfo empty;
+  return downstream ? downstream->getSetupTransportInfo() : empty;
+}
+
+void AsyncRequestHandler::Response::getCurrentTransportInfo(
+    folly::TransportInfo* tinfo) const {
+  if (downstream) {
+    downstream->getCurrentTransportInfo(tinfo);
+  }
+}
+
+}
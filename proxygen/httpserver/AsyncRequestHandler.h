@@ -0,0 +1,138 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/futures/Future.h>
+#include <folly/io/IOBufQueue.h>
+#include <proxygen/httpserver/RequestHandler.h>
+#include <proxygen/httpserver/ResponseHandler.h>
+
+namespace proxygen {
+
+/**
+ * RequestHandler written as a chain of futures instead of callbacks:
+ * subclasses implement handle(), which reads the body with readBody(),
+ * sends the response on downstream_ as any handler would, and waits for
+ * egress with waitForEgress() when it streams.
+ *
+ *   folly::Future<folly::Unit> handle(
+ *       std::unique_ptr<HTTPMessage> request) override {
+ *     return readBody().then([this] (std::unique_ptr<folly::IOBuf> body) {
+ *       ResponseBuilder(downstream_).status(200, "OK").body(std::move(body))
+ *         .sendWithEOM();
+ *     });
+ *   }
+ *
+ * Body that arrives before it is read is buffered, and ingress paused
+ * once more than maxBufferedBytes are, so a slow reader holds back the
+ * client instead of growing memory.
+ *
+ * The response is ended with sendEOM() when the future of handle()
+ * completes, if the handler didn't. If the future fails, with no headers
+ * sent yet the client gets a 500, otherwise the response is aborted.
+ * Once the request completes or fails, the response is sent to nowhere
+ * and the reads and waits fail with an HTTPException, so code still in
+ * flight can carry on safely. The handler deletes itself once the
+ * request is done and the future of handle() completed.
+ *
+ * The futures handle() chains on must complete in the thread of the
+ * request, e.g. with via() its EventBase.
+ */
+class AsyncRequestHandler : public RequestHandler {
+ public:
+  struct Options {
+    size_t maxBufferedBytes{64 * 1024};
+  };
+
+  explicit AsyncRequestHandler(const Options& options = Options());
+
+  virtual folly::Future<folly::Unit> handle(
+    std::unique_ptr<HTTPMessage> request) = 0;
+
+  // RequestHandler
+  void setResponseHandler(ResponseHandler* handler) noexcept override;
+  void onRequest(std::unique_ptr<HTTPMessage> request) noexcept override;
+  void onBody(std::unique_ptr<folly::IOBuf> body) noexcept override;
+  void onUpgrade(UpgradeProtocol protocol) noexcept override {}
+  void onEOM() noexcept override;
+  void requestComplete() noexcept override;
+  void onError(ProxygenError err) noexcept override;
+  void onEgressPaused() noexcept override;
+  void onEgressResumed() noexcept override;
+
+ protected:
+  ~AsyncRequestHandler() override {}
+
+  /**
+   * The body that came in since the last read, waiting for more if none
+   * did; nullptr once all of it was read. One read at a time.
+   */
+  folly::Future<std::unique_ptr<folly::IOBuf>> readBody();
+
+  /**
+   * Completes once the response may take more body: right away unless
+   * egress is paused. One wait at a time.
+   */
+  folly::Future<folly::Unit> waitForEgress();
+
+  // Whether the request completed or failed, and sends go nowhere
+  bool isDone() const { return done_; }
+
+ private:
+  // Passes the response on while the request lasts, noting what was sent
+  class Response : public ResponseHandler {
+   public:
+    explicit Response(RequestHandler* upstream): ResponseHandler(upstream) {}
+
+    using ResponseHandler::sendHeaders;
+    void sendHeaders(HTTPMessage& msg) noexcept override;
+    void sendHeaders(std::unique_ptr<HTTPMessage> msg) noexcept override;
+    void sendChunkHeader(size_t len) noexcept override;
+    void sendBody(std::unique_ptr<folly::IOBuf> body) noexcept override;
+    bool sendFile(int fd, off_t offset, size_t length) noexcept override;
+    void sendChunkTerminator() noexcept override;
+    void sendEOM() noexcept override;
+    void sendAbort() noexcept override;
+    void refreshTimeout() noexcept override;
+    void pauseIngress() noexcept override;
+    void resumeIngress() noexcept override;
+    ResponseHandler* newPushedResponse(
+      PushHandler* pushHandler) noexcept override;
+    folly::SysArena* getArena() noexcept override;
+    const folly::TransportInfo& getSetupTransportInfo() const
+      noexcept override;
+    void getCurrentTransportInfo(folly::TransportInfo* tinfo) const override;
+
+    // nullptr once the request is done
+    ResponseHandler* downstream{nullptr};
+    bool headersSent{false};
+    bool eomSent{false};
+  };
+
+  void onHandled(folly::Try<folly::Unit>&& result);
+  void finish(ProxygenError err);
+  folly::exception_wrapper makeError() const;
+
+  const Options options_;
+  Response response_{this};
+  folly::IOBufQueue body_{folly::IOBufQueue::cacheChainLength()};
+  folly::Promise<std::unique_ptr<folly::IOBuf>> readPromise_;
+  folly::Promise<folly::Unit> egressPromise_;
+  ProxygenError error_{kErrorNone};
+  bool reading_{false};
+  bool waitingForEgress_{false};
+  bool ingressPaused_{false};
+  bool egressPaused_{false};
+  bool eom_{false};
+  bool done_{false};
+  bool handled_{false};
+};
+
+}
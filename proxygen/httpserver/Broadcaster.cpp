@@ -0,0 +1,166 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/httpserver/Broadcaster.h>
+
+#include <folly/Memory.h>
+
+using folly::IOBuf;
+using std::unique_ptr;
+
+namespace proxygen {
+
+void Broadcaster::Subscriber::onEgressPaused() {
+  paused_ = true;
+}
+
+void Broadcaster::Subscriber::onEgressResumed() {
+  paused_ = false;
+  if (!downstream_ || dropped_) {
+    return;
+  }
+  if (!buffered_.empty()) {
+    downstream_->sendBody(buffered_.move());
+  }
+  if (eomPending_) {
+    eomPending_ = false;
+    downstream_->sendEOM();
+  }
+}
+
+void Broadcaster::Subscriber::deliver(const IOBuf& event) {
+  if (!downstream_ || dropped_ || ended_) {
+    return;
+  }
+  if (!paused_) {
+    downstream_->sendBody(event.clone());
+    return;
+  }
+  if (broadcaster_->options_.slowPolicy == SlowPolicy::COALESCE) {
+    if (!buffered_.empty()) {
+      buffered_.move();
+      ++coalesced_;
+    }
+  } else if (buffered_.chainLength() + event.computeChainDataLength() >
+             broadcaster_->options_.maxBufferedBytes) {
+    drop();
+    return;
+  }
+  buffered_.append(event.clone());
+}
+
+void Broadcaster::Subscriber::drop() {
+  VLOG(4) << "dropping slow subscriber " << this;
+  dropped_ = true;
+  buffered_.move();
+  downstream_->sendAbort();
+}
+
+Broadcaster::Broadcaster(const Options& options)
+    : options_(options) {
+}
+
+Broadcaster::~Broadcaster() {
+  for (auto subscriber : subscribers_) {
+    delete subscriber;
+  }
+}
+
+Broadcaster::Subscriber* Broadcaster::subscribe(
+    ResponseHandler* downstream,
+    const HTTPMessage& request,
+    unique_ptr<HTTPMessage> response) {
+  if (!response) {
+    response = folly::make_unique<HTTPMessage>();
+    response->setHTTPVersion(1, 1);
+    response->setStatusCode(200);
+    response->setStatusMessage("OK");
+  }
+  auto& headers = response->getHeaders();
+  headers.remove(HTTP_HEADER_CONTENT_LENGTH);
+  if (!request.getAdvancedProtocolString()) {
+    // HTTP/1.x: to the end of the connection rather than chunked, so that
+    // the events need no framing of their own
+    response->setIsChunked(false);
+    headers.remove(HTTP_HEADER_TRANSFER_ENCODING);
+    headers.set(HTTP_HEADER_CONNECTION, "close");
+  }
+  downstream->sendHeaders(std::move(response));
+
+  auto subscriber = new Subscriber(this, downstream);
+  subscriber->index_ = subscribers_.size();
+  subscribers_.push_back(subscriber);
+  return subscriber;
+}
+
+void Broadcaster::unsubscribe(Subscriber* subscriber) {
+  DCHECK_EQ(subscriber->broadcaster_, this);
+  DCHECK(subscriber->downstream_);
+  subscriber->downstream_ = nullptr;
+  if (iterating_) {
+    ++unsubscribed_;
+    return;
+  }
+  size_t index = subscriber->index_;
+  subscribers_[index] = subscribers_.back();
+  subscribers_[index]->index_ = index;
+  subscribers_.pop_back();
+  delete subscriber;
+}
+
+void Broadcaster::publish(unique_ptr<IOBuf> event) {
+  if (!event) {
+    return;
+  }
+  // Sending may complete or fail requests, which unsubscribe then
+  iterating_ = true;
+  for (size_t i = 0; i < subscribers_.size(); ++i) {
+    subscribers_[i]->deliver(*event);
+  }
+  iterating_ = false;
+  removeUnsubscribed();
+}
+
+void Broadcaster::close() {
+  iterating_ = true;
+  for (size_t i = 0; i < subscribers_.size(); ++i) {
+    auto subscriber = subscribers_[i];
+    if (!subscriber->downstream_ || subscriber->dropped_ ||
+        subscriber->ended_) {
+      continue;
+    }
+    subscriber->ended_ = true;
+    if (!subscriber->buffered_.empty()) {
+      subscriber->eomPending_ = true;
+    } else {
+      subscriber->downstream_->sendEOM();
+    }
+  }
+  iterating_ = false;
+  removeUnsubscribed();
+}
+
+void Broadcaster::removeUnsubscribed() {
+  if (unsubscribed_ == 0) {
+    return;
+  }
+  size_t kept = 0;
+  for (auto subscriber : subscribers_) {
+    if (subscriber->downstream_) {
+      subscriber->index_ = kept;
+      subscribers_[kept++] = subscriber;
+    } else {
+      delete subscriber;
+    }
+  }
+  subscribers_.resize(kept);
+  unsubscribed_ = 0;
+}
+
+}
@@ -0,0 +1,121 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/io/IOBufQueue.h>
+#include <proxygen/httpserver/ResponseHandler.h>
+#include <proxygen/lib/http/HTTPMessage.h>
+
+#include <vector>
+
+namespace proxygen {
+
+/**
+ * Fan-out of events to many streaming responses, such as server-sent
+ * events or long polls, on one thread. An event is published once, as an
+ * IOBuf every subscriber sends a clone of, so that they all share its
+ * bytes instead of a copy each.
+ *
+ * subscribe() sends the response headers too, so that the framing suits
+ * the shared bytes: HTTP/1.x responses are delimited by the end of the
+ * connection, which leaves events unframed on the wire, the same bytes
+ * for every such subscriber. SPDY and HTTP/2 frame them per stream,
+ * since the frame headers carry the stream ID.
+ *
+ * A subscriber whose egress is paused keeps the events until it resumes,
+ * up to maxBufferedBytes, and its response is aborted past them. With
+ * SlowPolicy::COALESCE it keeps only the latest event instead, for
+ * channels where an event supersedes the previous ones.
+ */
+class Broadcaster {
+ public:
+  enum class SlowPolicy : uint8_t {
+    DROP,
+    COALESCE,
+  };
+
+  struct Options {
+    SlowPolicy slowPolicy{SlowPolicy::DROP};
+    // Of events kept by a paused subscriber, with SlowPolicy::DROP
+    size_t maxBufferedBytes{1024 * 1024};
+  };
+
+  class Subscriber {
+   public:
+    // The handler of the subscribed request passes these on
+    void onEgressPaused();
+    void onEgressResumed();
+
+    // Events dropped by coalescing
+    uint64_t getCoalescedEvents() const { return coalesced_; }
+
+    // The response was aborted for being too slow
+    bool isDropped() const { return dropped_; }
+
+   private:
+    friend class Broadcaster;
+
+    Subscriber(Broadcaster* broadcaster, ResponseHandler* downstream)
+        : broadcaster_(broadcaster), downstream_(downstream) {}
+
+    void deliver(const folly::IOBuf& event);
+    void drop();
+
+    Broadcaster* broadcaster_;
+    // nullptr once unsubscribed
+    ResponseHandler* downstream_;
+    size_t index_{0};
+    folly::IOBufQueue buffered_{folly::IOBufQueue::cacheChainLength()};
+    uint64_t coalesced_{0};
+    bool paused_{false};
+    bool dropped_{false};
+    // close() came while events were buffered
+    bool eomPending_{false};
+    bool ended_{false};
+  };
+
+  explicit Broadcaster(const Options& options = Options());
+
+  // Frees the subscribers left, whose handlers shouldn't use them after
+  ~Broadcaster();
+
+  /**
+   * Start a streaming response to request on downstream, with response as
+   * its headers, 200 if nullptr, and send it the events published from
+   * now on. The Subscriber is the caller's to unsubscribe() once the
+   * request completes or fails, also after it was dropped.
+   */
+  Subscriber* subscribe(ResponseHandler* downstream,
+                        const HTTPMessage& request,
+                        std::unique_ptr<HTTPMessage> response = nullptr);
+
+  void unsubscribe(Subscriber* subscriber);
+
+  // Send event to every subscriber
+  void publish(std::unique_ptr<folly::IOBuf> event);
+
+  // End every response, after the events they buffered
+  void close();
+
+  size_t getNumSubscribers() const {
+    return subscribers_.size() - unsubscribed_;
+  }
+
+ private:
+  void removeUnsubscribed();
+
+  Options options_;
+  std::vector<Subscriber*> subscribers_;
+  // Unsubscribed while going through subscribers_, to remove after
+  size_t unsubscribed_{0};
+  bool iterating_{false};
+};
+
+}
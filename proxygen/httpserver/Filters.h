@@ -75,7 +75,13 @@ class Filter : public RequestHandler, public ResponseHandler {
     upstream_->onEgressResumed();
   }
 
+  size_t getBodyBatchSize() const noexcept override {
+    return upstream_->getBodyBatchSize();
+  }
+
   // Response handler
+  using ResponseHandler::sendHeaders;
+
   void sendHeaders(HTTPMessage& msg) noexcept override {
     downstream_->sendHeaders(msg);
   }
@@ -112,6 +118,15 @@ class Filter : public RequestHandler, public ResponseHandler {
     downstream_->resumeIngress();
   }
 
+  ResponseHandler* newPushedResponse(
+      PushHandler* pushHandler) noexcept override {
+    return downstream_->newPushedResponse(pushHandler);
+  }
+
+  folly::SysArena* getArena() noexcept override {
+    return downstream_->getArena();
+  }
+
   const folly::TransportInfo& getSetupTransportInfo() const noexcept override {
     return downstream_->getSetupTransportInfo();
   }
@@ -9,12 +9,27 @@
  */
 #include <proxygen/httpserver/HTTPServer.h>
 
+#include <folly/Baton.h>
+#include <folly/FileUtil.h>
+#include <folly/ScopeGuard.h>
+#include <folly/String.h>
 #include <folly/ThreadName.h>
 #include <folly/io/async/EventBaseManager.h>
 #include <proxygen/httpserver/HTTPServerAcceptor.h>
+#include <proxygen/httpserver/RequestHandlerAdaptor.h>
 #include <proxygen/httpserver/SignalHandler.h>
+#include <proxygen/httpserver/SocketTakeover.h>
 #include <proxygen/httpserver/filters/RejectConnectFilter.h>
+#include <proxygen/httpserver/filters/RequestDecompressionFilter.h>
 #include <proxygen/httpserver/filters/ZlibServerFilter.h>
+#include <proxygen/lib/http/session/HTTPTransaction.h>
+#include <proxygen/lib/services/CPUAffinity.h>
+#include <proxygen/lib/services/WorkerContext.h>
+#include <proxygen/lib/services/WorkerLoadTracker.h>
+#include <proxygen/lib/utils/ReadBufferPool.h>
+#include <proxygen/lib/utils/ThreadLocalFreeList.h>
+#include <mutex>
+#include <unistd.h>
 
 using folly::AsyncServerSocket;
 using folly::EventBase;
@@ -25,23 +40,220 @@ using folly::wangle::ThreadPoolExecutor;
 
 namespace proxygen {
 
+namespace {
+
+// Collects the EventBase of every thread of an IOThreadPoolExecutor
+class WorkerEventBases : public ThreadPoolExecutor::Observer {
+ public:
+  void threadStarted(ThreadPoolExecutor::ThreadHandle* h) override {
+    eventBases.push_back(IOThreadPoolExecutor::getEventBase(h));
+  }
+  void threadStopped(ThreadPoolExecutor::ThreadHandle* h) override {}
+
+  std::vector<EventBase*> eventBases;
+};
+
+std::vector<EventBase*> getEventBases(IOThreadPoolExecutor* exe) {
+  auto observer = std::make_shared<WorkerEventBases>();
+  // invokes threadStarted() for all the running threads
+  exe->addObserver(observer);
+  exe->removeObserver(observer);
+  return observer->eventBases;
+}
+
+// Fills the pools of this thread with what connections take at once
+void warmUpWorkerThread(size_t connections) {
+  ReadBufferPool::reserve(connections);
+  ThreadLocalFreeList<HTTPTransaction>::reserve(connections);
+  ThreadLocalFreeList<HTTPMessage>::reserve(2 * connections);
+  ThreadLocalFreeList<RequestHandlerAdaptor>::reserve(connections);
+}
+
+// The CPUs worker index is pinned to, if any
+std::vector<int> getWorkerCPUs(const HTTPServerOptions& options,
+                               size_t index) {
+  if (!options.pinWorkerThreads) {
+    return {};
+  }
+  if (!options.workerCPUSets.empty()) {
+    return options.workerCPUSets[index % options.workerCPUSets.size()];
+  }
+  size_t numCPUs = std::max(std::thread::hardware_concurrency(), 1u);
+  return {int(index % numCPUs)};
+}
+
+void placeWorkerThread(const std::vector<int>& cpus, bool numaLocal) {
+  if (!setThreadCPUAffinity(cpus)) {
+    LOG(WARNING) << "Failed to pin worker thread to CPUs "
+                 << folly::join(",", cpus);
+    return;
+  }
+  if (numaLocal) {
+    setThreadPreferredNumaNode(getNumaNodeOfCPU(cpus.front()));
+  }
+}
+
+// Run fn in the thread of eventBase, and rethrow whatever it throws
+void runInThreadAndWait(EventBase* eventBase,
+                        const std::function<void()>& fn) {
+  if (eventBase->isInEventBaseThread()) {
+    fn();
+    return;
+  }
+  std::exception_ptr exn;
+  folly::Baton<> done;
+  eventBase->runInEventBaseThread([&] {
+      try {
+        fn();
+      } catch (...) {
+        exn = std::current_exception();
+      }
+      done.post();
+    });
+  done.wait();
+  if (exn) {
+    std::rethrow_exception(exn);
+  }
+}
+
+}
+
+/**
+ * The acceptors of one worker thread, and its listening sockets in
+ * reusePort mode. Only touched from that thread once set up.
+ */
+struct HTTPServer::Worker {
+  explicit Worker(EventBase* evb): eventBase(evb) {}
+
+  EventBase* eventBase;
+  std::vector<AsyncServerSocket::UniquePtr> sockets;
+  std::vector<std::unique_ptr<HTTPServerAcceptor>> acceptors;
+};
+
 class AcceptorFactory : public folly::AcceptorFactory {
  public:
   AcceptorFactory(std::shared_ptr<HTTPServerOptions> options,
-                  AcceptorConfiguration config) :
+                  AcceptorConfiguration config,
+                  std::shared_ptr<WorkerContextSet> workerContexts) :
       options_(options),
-      config_(config)  {}
+      config_(config),
+      workerContexts_(workerContexts) {}
   std::shared_ptr<folly::Acceptor> newAcceptor(
       folly::EventBase* eventBase) override {
     auto acc = std::shared_ptr<HTTPServerAcceptor>(
       HTTPServerAcceptor::make(config_, *options_).release());
+    acc->setWorkerContext(workerContexts_->get(eventBase));
     acc->init(nullptr, eventBase);
+    std::lock_guard<std::mutex> g(acceptorsLock_);
+    acceptors_.emplace_back(eventBase, acc);
     return acc;
   }
 
+  std::vector<std::pair<folly::EventBase*,
+                        std::weak_ptr<HTTPServerAcceptor>>> getAcceptors() {
+    std::lock_guard<std::mutex> g(acceptorsLock_);
+    return acceptors_;
+  }
+
+  void setTLSTicketSeeds(const folly::TLSTicketKeySeeds& seeds) {
+    std::lock_guard<std::mutex> g(acceptorsLock_);
+    for (auto& it: acceptors_) {
+      std::weak_ptr<HTTPServerAcceptor> weakAcc = it.second;
+      it.first->runInEventBaseThread([weakAcc, seeds] {
+          auto acc = weakAcc.lock();
+          if (acc) {
+            acc->setTLSTicketSecrets(seeds.oldSeeds, seeds.currentSeeds,
+                                     seeds.newSeeds);
+          }
+        });
+    }
+  }
+
  private:
   std::shared_ptr<HTTPServerOptions> options_;
   AcceptorConfiguration config_;
+  std::shared_ptr<WorkerContextSet> workerContexts_;
+  // one per worker thread, created from those threads
+  std::mutex acceptorsLock_;
+  std::vector<std::pair<folly::EventBase*,
+                        std::weak_ptr<HTTPServerAcceptor>>> acceptors_;
+};
+
+/**
+ * Hands the connections accepted on one address by the main thread to the
+ * acceptor of the least loaded worker for that address.
+ */
+class LoadAwareDispatcher : public AsyncServerSocket::AcceptCallback {
+ public:
+  LoadAwareDispatcher(WorkerLoadTracker* tracker,
+                      std::vector<std::pair<EventBase*,
+                                            HTTPServerAcceptor*>> acceptors):
+      tracker_(tracker),
+      acceptors_(std::move(acceptors)) {
+    CHECK_EQ(acceptors_.size(), tracker_->getNumWorkers());
+  }
+
+  void connectionAccepted(int fd, const SocketAddress& clientAddr)
+    noexcept override {
+    auto worker = tracker_->pickWorker();
+    auto acceptor = acceptors_[worker].second;
+    auto tracker = tracker_;
+    tracker->onConnectionDispatched(worker);
+    acceptors_[worker].first->runInEventBaseThread(
+      [tracker, worker, acceptor, fd, clientAddr] {
+        acceptor->dispatchConnection(fd, clientAddr);
+        tracker->onConnectionReceived(worker);
+      });
+  }
+
+  void acceptError(const std::exception& ex) noexcept override {
+    LOG(ERROR) << "Error accepting connection: " << ex.what();
+  }
+
+ private:
+  WorkerLoadTracker* tracker_;
+  std::vector<std::pair<EventBase*, HTTPServerAcceptor*>> acceptors_;
+};
+
+/**
+ * Hands our listening sockets to the next server that connects to the
+ * takeover socket, and then drains.
+ */
+class HTTPServer::TakeoverHandler :
+      public AsyncServerSocket::AcceptCallback {
+ public:
+  explicit TakeoverHandler(HTTPServer* server): server_(server) {}
+
+  void connectionAccepted(int fd, const SocketAddress&) noexcept override {
+    SCOPE_EXIT { folly::closeNoInt(fd); };
+    try {
+      // A single small message, which fits in the socket buffer
+      sendSocketFDs(fd, server_->listeningFDs_);
+    } catch (const std::exception& ex) {
+      LOG(ERROR) << "Failed to hand over the listening sockets: "
+                 << ex.what();
+      return;
+    }
+    LOG(INFO) << "Handed over " << server_->listeningFDs_.size()
+              << " listening sockets, draining";
+    server_->drain();
+  }
+
+  void acceptError(const std::exception& ex) noexcept override {
+    LOG(ERROR) << "Error accepting takeover connection: " << ex.what();
+  }
+
+ private:
+  HTTPServer* server_;
+};
+
+struct HTTPServer::DrainState {
+  DrainState(HTTPServer* s, size_t n): server(s), remaining(n) {}
+
+  // Cleared by stop(), so late callbacks leave the server alone
+  std::atomic<HTTPServer*> server;
+  // Acceptors yet to drain
+  std::atomic<size_t> remaining;
 };
 
 HTTPServer::HTTPServer(HTTPServerOptions options):
@@ -57,12 +269,30 @@ HTTPServer::HTTPServer(HTTPServerOptions options):
   // Add Content Compression filter (gzip), if needed. Should be
   // final filter
   if (options_->enableContentCompression) {
+    auto zlibFactory = folly::make_unique<ZlibServerFilterFactory>(
+      options_->contentCompressionLevel,
+      options_->contentCompressionMinimumSize,
+      options_->contentCompressionTypes,
+      options_->contentCompressionEncodings,
+      options_->contentCompressionCacheSize,
+      options_->contentCompressionStreaming);
+    if (options_->contentCompressionAdaptive) {
+      CompressionLevelController::Options levels;
+      levels.minLevel = options_->contentCompressionMinLevel;
+      levels.maxLevel = options_->contentCompressionLevel;
+      zlibFactory->setLevelController(
+        std::make_shared<const CompressionLevelController>(levels));
+    }
+    options_->handlerFactories.insert(
+        options_->handlerFactories.begin(),
+        std::move(zlibFactory));
+  }
+
+  if (options_->enableRequestDecompression) {
     options_->handlerFactories.insert(
         options_->handlerFactories.begin(),
-        folly::make_unique<ZlibServerFilterFactory>(
-          options_->contentCompressionLevel,
-          options_->contentCompressionMinimumSize,
-          options_->contentCompressionTypes));
+        folly::make_unique<RequestDecompressionFilterFactory>(
+          options_->requestDecompressionMaxSize));
   }
 }
 
@@ -101,22 +331,104 @@ class HandlerCallbacks : public ThreadPoolExecutor::Observer {
 void HTTPServer::start(std::function<void()> onSuccess,
                        std::function<void(std::exception_ptr)> onError) {
   mainEventBase_ = EventBaseManager::get()->getEventBase();
+  inline_ = options_->threads == 0;
+  workerContexts_ = std::make_shared<WorkerContextSet>();
+
+  std::shared_ptr<IOThreadPoolExecutor> exe;
+  if (inline_) {
+    // This thread is the only worker
+    auto cpus = getWorkerCPUs(*options_, 0);
+    if (!cpus.empty()) {
+      placeWorkerThread(cpus, options_->numaLocalWorkers);
+    }
+    for (auto& factory: options_->handlerFactories) {
+      factory->onServerStart();
+    }
+    if (options_->warmUpConnections > 0) {
+      warmUpWorkerThread(options_->warmUpConnections);
+    }
+  } else {
+    exe = std::make_shared<IOThreadPoolExecutor>(options_->threads);
+    auto exeObserver = std::make_shared<HandlerCallbacks>(options_);
+    // Observer has to be set before bind(), so onServerStart() callbacks run
+    exe->addObserver(exeObserver);
+
+    if (options_->pinWorkerThreads) {
+      auto eventBases = getEventBases(exe.get());
+      bool numaLocal = options_->numaLocalWorkers;
+      FOR_EACH_RANGE (i, 0, eventBases.size()) {
+        auto cpus = getWorkerCPUs(*options_, i);
+        if (!cpus.empty()) {
+          eventBases[i]->runInEventBaseThread([cpus, numaLocal] {
+              placeWorkerThread(cpus, numaLocal);
+            });
+        }
+      }
+    }
 
-  auto accExe = std::make_shared<IOThreadPoolExecutor>(1);
-  auto exe = std::make_shared<IOThreadPoolExecutor>(options_->threads);
-  auto exeObserver = std::make_shared<HandlerCallbacks>(options_);
-  // Observer has to be set before bind(), so onServerStart() callbacks run
-  exe->addObserver(exeObserver);
+    // After placing the threads, for their memory to be on their node
+    auto eventBases = getEventBases(exe.get());
+    size_t connections = options_->warmUpConnections;
+    if (connections > 0) {
+      for (auto eventBase: eventBases) {
+        eventBase->runInEventBaseThread([connections] {
+            warmUpWorkerThread(connections);
+          });
+      }
+    }
+    // Nothing is accepted before every worker has run onServerStart() and
+    // warmed up, so that onSuccess means the server is ready
+    for (auto eventBase: eventBases) {
+      runInThreadAndWait(eventBase, [] {});
+    }
+  }
 
+  bool reusePort = options_->reusePort && !inline_;
+  bool takeover = !options_->takeoverPath.empty();
   try {
-    FOR_EACH_RANGE (i, 0, addresses_.size()) {
-      auto factory = std::make_shared<AcceptorFactory>(
-        options_,
-        HTTPServerAcceptor::makeConfig(addresses_[i], *options_));
-      bootstrap_.push_back(folly::ServerBootstrap<folly::DefaultPipeline>());
-      bootstrap_[i].childHandler(factory);
-      bootstrap_[i].group(accExe, exe);
-      bootstrap_[i].bind(addresses_[i].address);
+    // With reusePort both servers can listen at once, so the previous one
+    // is only told to drain once we listen
+    if (takeover && !reusePort) {
+      takeOverSockets();
+    }
+    if (inline_) {
+      bindInlineWorker();
+    } else if (reusePort) {
+      workerExecutor_ = exe;
+      bindReusePortWorkers(exe.get());
+    } else if (options_->loadAwareDispatch) {
+      workerExecutor_ = exe;
+      bindDispatchWorkers(exe.get());
+    } else {
+      auto accExe = std::make_shared<IOThreadPoolExecutor>(1);
+      FOR_EACH_RANGE (i, 0, addresses_.size()) {
+        auto factory = std::make_shared<AcceptorFactory>(
+          options_,
+          HTTPServerAcceptor::makeConfig(addresses_[i], *options_),
+          workerContexts_);
+        acceptorFactories_.push_back(factory);
+        bootstrap_.push_back(folly::ServerBootstrap<folly::DefaultPipeline>());
+        bootstrap_[i].childHandler(factory);
+        bootstrap_[i].group(accExe, exe);
+        AsyncServerSocket::UniquePtr socket(new AsyncServerSocket(nullptr));
+        socket->setMaxAcceptAtOnce(options_->maxAcceptAtOnce);
+        int fd = takeover ? getTakenOverSocket(addresses_[i].address) : -1;
+        if (fd >= 0) {
+          socket->useExistingSocket(fd);
+        } else {
+          socket->bind(addresses_[i].address);
+        }
+        if (takeover) {
+          listeningFDs_.push_back(socket->getSocket());
+        }
+        bootstrap_[i].bind(std::move(socket));
+      }
+    }
+    if (takeover) {
+      if (reusePort) {
+        takeOverSockets();
+      }
+      listenForTakeover();
     }
   } catch (const std::exception& ex) {
     stop();
@@ -142,9 +454,305 @@ void HTTPServer::start(std::function<void()> onSuccess,
   mainEventBase_->loopForever();
 }
 
+void HTTPServer::bindReusePortWorkers(IOThreadPoolExecutor* exe) {
+  auto eventBases = getEventBases(exe);
+  FOR_EACH_RANGE (i, 0, eventBases.size()) {
+    auto eventBase = eventBases[i];
+    workers_.emplace_back(new Worker(eventBase));
+    auto worker = workers_.back().get();
+    auto cpus = getWorkerCPUs(*options_, i);
+    bool incomingCPU = options_->numaLocalWorkers && cpus.size() == 1;
+    runInThreadAndWait(eventBase, [&] {
+        for (auto& addr: addresses_) {
+          AsyncServerSocket::UniquePtr socket(
+            new AsyncServerSocket(eventBase));
+          socket->setReusePortEnabled(true);
+          socket->setMaxAcceptAtOnce(options_->maxAcceptAtOnce);
+          socket->bind(addr.address);
+          if (incomingCPU) {
+            setSocketIncomingCPU(socket->getSocket(), cpus.front());
+          }
+          socket->listen(options_->listenBacklog);
+          // If the port was ephemeral, the other workers join this one
+          socket->getAddress(&addr.address);
+
+          auto acceptor = HTTPServerAcceptor::make(
+            HTTPServerAcceptor::makeConfig(addr, *options_), *options_);
+          // The socket's EventBase is the acceptor's, so connections are
+          // accepted straight in this thread
+          acceptor->setWorkerContext(workerContexts_->get(eventBase));
+          acceptor->init(socket.get(), eventBase);
+          socket->startAccepting();
+          worker->sockets.push_back(std::move(socket));
+          worker->acceptors.push_back(std::move(acceptor));
+        }
+      });
+  }
+}
+
+void HTTPServer::bindInlineWorker() {
+  workers_.emplace_back(new Worker(mainEventBase_));
+  auto worker = workers_.back().get();
+  for (auto& addr: addresses_) {
+    AsyncServerSocket::UniquePtr socket(new AsyncServerSocket(mainEventBase_));
+    socket->setMaxAcceptAtOnce(options_->maxAcceptAtOnce);
+    int fd = getTakenOverSocket(addr.address);
+    if (fd >= 0) {
+      socket->useExistingSocket(fd);
+    } else {
+      socket->bind(addr.address);
+    }
+    socket->listen(options_->listenBacklog);
+    socket->getAddress(&addr.address);
+    listeningFDs_.push_back(socket->getSocket());
+
+    auto acceptor = HTTPServerAcceptor::make(
+      HTTPServerAcceptor::makeConfig(addr, *options_), *options_);
+    acceptor->setWorkerContext(workerContexts_->get(mainEventBase_));
+    acceptor->init(socket.get(), mainEventBase_);
+    socket->startAccepting();
+    worker->sockets.push_back(std::move(socket));
+    worker->acceptors.push_back(std::move(acceptor));
+  }
+}
+
+void HTTPServer::bindDispatchWorkers(IOThreadPoolExecutor* exe) {
+  // Bind first, so the acceptors are configured with the final ports
+  for (auto& addr: addresses_) {
+    AsyncServerSocket::UniquePtr socket(new AsyncServerSocket(mainEventBase_));
+    socket->setMaxAcceptAtOnce(options_->maxAcceptAtOnce);
+    int fd = getTakenOverSocket(addr.address);
+    if (fd >= 0) {
+      socket->useExistingSocket(fd);
+    } else {
+      socket->bind(addr.address);
+    }
+    socket->listen(options_->listenBacklog);
+    socket->getAddress(&addr.address);
+    listeningFDs_.push_back(socket->getSocket());
+    dispatchSockets_.push_back(std::move(socket));
+  }
+
+  auto eventBases = getEventBases(exe);
+  loadTracker_.reset(new WorkerLoadTracker(eventBases.size()));
+  FOR_EACH_RANGE (i, 0, eventBases.size()) {
+    workers_.emplace_back(new Worker(eventBases[i]));
+    auto worker = workers_.back().get();
+    runInThreadAndWait(worker->eventBase, [&] {
+        for (auto& addr: addresses_) {
+          auto acceptor = HTTPServerAcceptor::make(
+            HTTPServerAcceptor::makeConfig(addr, *options_), *options_);
+          acceptor->setWorkerContext(
+            workerContexts_->get(worker->eventBase));
+          acceptor->init(nullptr, worker->eventBase);
+          acceptor->setLoadTracker(loadTracker_.get(), i);
+          worker->acceptors.push_back(std::move(acceptor));
+        }
+      });
+  }
+
+  FOR_EACH_RANGE (i, 0, addresses_.size()) {
+    std::vector<std::pair<EventBase*, HTTPServerAcceptor*>> acceptors;
+    for (auto& worker: workers_) {
+      acceptors.emplace_back(worker->eventBase, worker->acceptors[i].get());
+    }
+    dispatchers_.emplace_back(
+      new LoadAwareDispatcher(loadTracker_.get(), std::move(acceptors)));
+    // With no EventBase, connections are dispatched from the accepting
+    // thread itself
+    dispatchSockets_[i]->addAcceptCallback(dispatchers_.back().get(),
+                                           nullptr);
+    dispatchSockets_[i]->startAccepting();
+  }
+}
+
+void HTTPServer::takeOverSockets() {
+  int sock = connectTakeoverSocket(options_->takeoverPath);
+  if (sock < 0) {
+    return;
+  }
+  SCOPE_EXIT { folly::closeNoInt(sock); };
+  for (auto fd: receiveSocketFDs(sock)) {
+    SocketAddress address;
+    try {
+      address.setFromLocalAddress(fd);
+    } catch (const std::exception& ex) {
+      LOG(ERROR) << "Taken over socket has no address: " << ex.what();
+      folly::closeNoInt(fd);
+      continue;
+    }
+    takenOverFDs_.emplace_back(address, fd);
+  }
+  LOG(INFO) << "Took over " << takenOverFDs_.size() << " listening sockets";
+}
+
+int HTTPServer::getTakenOverSocket(const SocketAddress& address) {
+  for (auto it = takenOverFDs_.begin(); it != takenOverFDs_.end(); ++it) {
+    if (it->first == address) {
+      int fd = it->second;
+      takenOverFDs_.erase(it);
+      return fd;
+    }
+  }
+  return -1;
+}
+
+void HTTPServer::listenForTakeover() {
+  // Addresses we were not asked to listen on any more
+  for (auto& it: takenOverFDs_) {
+    folly::closeNoInt(it.second);
+  }
+  takenOverFDs_.clear();
+
+  SocketAddress address;
+  address.setFromPath(options_->takeoverPath);
+  // The previous server is done with it, if it was there at all
+  unlink(options_->takeoverPath.c_str());
+  takeoverSocket_.reset(new AsyncServerSocket(mainEventBase_));
+  takeoverSocket_->bind(address);
+  takeoverSocket_->listen(1);
+  takeoverHandler_.reset(new TakeoverHandler(this));
+  takeoverSocket_->addAcceptCallback(takeoverHandler_.get(), nullptr);
+  takeoverSocket_->startAccepting();
+}
+
+void HTTPServer::drain() {
+  CHECK(mainEventBase_);
+  // Always later, as this may be called from a callback of a socket that
+  // draining destroys
+  mainEventBase_->runInEventBaseThread([this] { startDraining(); });
+}
+
+void HTTPServer::startDraining() {
+  if (drainState_ || !mainEventBase_) {
+    return;
+  }
+  // Any later takeover is the next server's
+  takeoverSocket_.reset();
+  takeoverHandler_.reset();
+
+  std::vector<std::pair<EventBase*, std::weak_ptr<HTTPServerAcceptor>>>
+    factoryAcceptors;
+  for (auto& factory: acceptorFactories_) {
+    auto acceptors = factory->getAcceptors();
+    factoryAcceptors.insert(factoryAcceptors.end(), acceptors.begin(),
+                            acceptors.end());
+  }
+  size_t numAcceptors = factoryAcceptors.size();
+  for (auto& worker: workers_) {
+    numAcceptors += worker->acceptors.size();
+  }
+
+  auto state = std::make_shared<DrainState>(this, numAcceptors);
+  drainState_ = state;
+  auto evb = mainEventBase_;
+  auto stopServer = [state] {
+    auto server = state->server.exchange(nullptr);
+    if (server) {
+      server->stop();
+    }
+  };
+  auto onDrained = [state, evb, stopServer] {
+    if (--state->remaining == 0) {
+      evb->runInEventBaseThread(stopServer);
+    }
+  };
+  evb->runAfterDelay(stopServer, options_->drainTimeout.count());
+  if (numAcceptors == 0) {
+    evb->runInEventBaseThread(stopServer);
+    return;
+  }
+
+  // Acceptors drain once their sockets stop accepting. The completion
+  // callbacks are set first, as the sockets tell them in the same threads
+  for (auto& it: factoryAcceptors) {
+    std::weak_ptr<HTTPServerAcceptor> weakAcc = it.second;
+    it.first->runInEventBaseThread([weakAcc, onDrained] {
+        auto acc = weakAcc.lock();
+        if (acc) {
+          acc->setCompletionCallback(onDrained);
+        } else {
+          onDrained();
+        }
+      });
+  }
+  for (auto& bootstrap: bootstrap_) {
+    for (auto& socket: bootstrap.getSockets()) {
+      socket->getEventBase()->runInEventBaseThread([socket] {
+          socket->stopAccepting();
+        });
+    }
+  }
+
+  // Connections already handed to the workers get there first
+  dispatchSockets_.clear();
+  bool dispatched = !dispatchers_.empty();
+  for (auto& worker: workers_) {
+    auto w = worker.get();
+    w->eventBase->runInEventBaseThread([w, onDrained, dispatched] {
+        for (auto& acceptor: w->acceptors) {
+          acceptor->setCompletionCallback(onDrained);
+          if (dispatched) {
+            acceptor->dispatchStopped();
+          }
+        }
+        w->sockets.clear();
+      });
+  }
+}
+
+void HTTPServer::stopWorkers() {
+  if (!dispatchSockets_.empty()) {
+    // Stop handing out connections before the acceptors go away
+    runInThreadAndWait(mainEventBase_, [&] { dispatchSockets_.clear(); });
+  }
+  for (auto& worker: workers_) {
+    runInThreadAndWait(worker->eventBase, [&] {
+        worker->sockets.clear();
+        for (auto& acceptor: worker->acceptors) {
+          acceptor->dropAllConnections();
+        }
+        worker->acceptors.clear();
+      });
+  }
+  workers_.clear();
+  dispatchers_.clear();
+  if (workerExecutor_) {
+    workerExecutor_->join();
+    workerExecutor_.reset();
+  }
+}
+
+void HTTPServer::updateTLSTicketSeeds(folly::TLSTicketKeySeeds seeds) {
+  for (auto& factory: acceptorFactories_) {
+    factory->setTLSTicketSeeds(seeds);
+  }
+  for (auto& worker: workers_) {
+    auto w = worker.get();
+    w->eventBase->runInEventBaseThread([w, seeds] {
+        for (auto& acceptor: w->acceptors) {
+          acceptor->setTLSTicketSecrets(seeds.oldSeeds, seeds.currentSeeds,
+                                        seeds.newSeeds);
+        }
+      });
+  }
+}
+
 void HTTPServer::stop() {
   CHECK(mainEventBase_);
 
+  if (drainState_) {
+    drainState_->server = nullptr;
+    drainState_.reset();
+  }
+  takeoverSocket_.reset();
+  takeoverHandler_.reset();
+  for (auto& it: takenOverFDs_) {
+    folly::closeNoInt(it.second);
+  }
+  takenOverFDs_.clear();
+  listeningFDs_.clear();
+
   for (auto& bootstrap : bootstrap_) {
     bootstrap.stop();
   }
@@ -153,6 +761,17 @@ void HTTPServer::stop() {
     bootstrap.join();
   }
 
+  stopWorkers();
+  if (inline_) {
+    runInThreadAndWait(mainEventBase_, [&] {
+        for (auto& factory: options_->handlerFactories) {
+          factory->onServerStop();
+        }
+      });
+    inline_ = false;
+  }
+
+  acceptorFactories_.clear();
   signalHandler_.reset();
   mainEventBase_->terminateLoopSoon();
   mainEventBase_ = nullptr;
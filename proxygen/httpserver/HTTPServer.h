@@ -20,6 +20,10 @@ namespace proxygen {
 
 class SignalHandler;
 class HTTPServerAcceptor;
+class AcceptorFactory;
+class LoadAwareDispatcher;
+class WorkerContextSet;
+class WorkerLoadTracker;
 
 /**
  * HTTPServer based on proxygen http libraries
@@ -73,7 +77,10 @@ class HTTPServer final {
    * somebody else is already listening on that socket).
    *
    * `onSuccess` callback will be invoked from the event loop which shows that
-   * all the setup was successfully done.
+   * all the setup was successfully done. The sockets only listen once every
+   * worker thread has run RequestHandlerFactory::onServerStart() and warmed
+   * up (see HTTPServerOptions::warmUpConnections), so that factories can
+   * prepare there, e.g. connect upstream, before the first request.
    *
    * `onError` callback will be invoked if some errors occurs while starting the
    * server instead of throwing exception.
@@ -91,6 +98,19 @@ class HTTPServer final {
    */
   void stop();
 
+  /**
+   * Stop accepting new connections, let the current ones finish, for up to
+   * HTTPServerOptions::drainTimeout, and then stop(). Can be called from
+   * any thread. Called when another server takes over the sockets.
+   */
+  void drain();
+
+  /**
+   * Replace the TLS ticket key seeds of all the worker threads, to rotate
+   * the keys. Can be called from any thread while the server is running.
+   */
+  void updateTLSTicketSeeds(folly::TLSTicketKeySeeds seeds);
+
   /**
    * Get the list of addresses server is listening on. Empty if sockets are not
    * bound yet.
@@ -99,6 +119,15 @@ class HTTPServer final {
     return addresses_;
   }
 
+  /**
+   * In loadAwareDispatch mode, the load of each worker thread and the
+   * imbalance between them, readable from any thread. Null otherwise or
+   * before start().
+   */
+  const WorkerLoadTracker* getWorkerLoadTracker() const {
+    return loadTracker_.get();
+  }
+
  private:
   std::shared_ptr<HTTPServerOptions> options_;
 
@@ -117,6 +146,56 @@ class HTTPServer final {
    */
   std::vector<IPConfig> addresses_;
   std::vector<folly::ServerBootstrap<folly::DefaultPipeline>> bootstrap_;
+  std::vector<std::shared_ptr<AcceptorFactory>> acceptorFactories_;
+
+  /**
+   * The WorkerContext of each worker thread, shared by its acceptors
+   */
+  std::shared_ptr<WorkerContextSet> workerContexts_;
+
+  /**
+   * In reusePort and loadAwareDispatch modes, the worker threads and
+   * their acceptors (and in reusePort mode, what each listens with). With
+   * no threads, the one worker runs in the thread of start(), and listens
+   * for itself.
+   */
+  struct Worker;
+  void bindInlineWorker();
+  void bindReusePortWorkers(folly::wangle::IOThreadPoolExecutor* exe);
+  void bindDispatchWorkers(folly::wangle::IOThreadPoolExecutor* exe);
+  void stopWorkers();
+  std::shared_ptr<folly::wangle::IOThreadPoolExecutor> workerExecutor_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  bool inline_{false};
+
+  /**
+   * In loadAwareDispatch mode, the sockets the main thread accepts with,
+   * and what hands the connections over to the workers
+   */
+  std::vector<folly::AsyncServerSocket::UniquePtr> dispatchSockets_;
+  std::vector<std::unique_ptr<LoadAwareDispatcher>> dispatchers_;
+  std::unique_ptr<WorkerLoadTracker> loadTracker_;
+
+  /**
+   * Socket takeover: the sockets taken over from the previous server until
+   * used, the ones we listen with, to hand over to the next server, and
+   * the Unix socket the next server connects to
+   */
+  class TakeoverHandler;
+  void takeOverSockets();
+  int getTakenOverSocket(const folly::SocketAddress& address);
+  void listenForTakeover();
+  std::vector<std::pair<folly::SocketAddress, int>> takenOverFDs_;
+  std::vector<int> listeningFDs_;
+  folly::AsyncServerSocket::UniquePtr takeoverSocket_;
+  std::unique_ptr<TakeoverHandler> takeoverHandler_;
+
+  /**
+   * While draining, what is left to drain
+   */
+  struct DrainState;
+  void startDraining();
+  std::shared_ptr<DrainState> drainState_;
 };
 
 }
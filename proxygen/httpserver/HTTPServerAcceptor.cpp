@@ -12,7 +12,13 @@
 #include <proxygen/httpserver/RequestHandlerAdaptor.h>
 #include <proxygen/httpserver/RequestHandlerFactory.h>
 #include <proxygen/lib/http/codec/HTTP1xCodec.h>
+#include <proxygen/lib/http/session/HTTPDirectResponseHandler.h>
 #include <proxygen/lib/http/session/HTTPDownstreamSession.h>
+#include <proxygen/proxygen-config.h>
+
+#if PROXYGEN_HAVE_LIBURING
+#include <proxygen/lib/utils/IOUringSocket.h>
+#endif
 
 using folly::SocketAddress;
 
@@ -24,14 +30,31 @@ AcceptorConfiguration HTTPServerAcceptor::makeConfig(
 
   AcceptorConfiguration conf;
   conf.bindAddress = ipConfig.address;
-  conf.connectionIdleTimeout = opts.idleTimeout;
+  conf.connectionIdleTimeout = opts.keepaliveTimeout.count() > 0 ?
+    opts.keepaliveTimeout : opts.idleTimeout;
   conf.transactionIdleTimeout = opts.idleTimeout;
+  conf.headerReadTimeout = opts.requestHeaderTimeout;
+  conf.bodyReadTimeout = opts.requestBodyTimeout;
+  conf.gracefulShutdownTimeout = opts.drainTimeout;
 
   if (ipConfig.protocol == HTTPServer::Protocol::SPDY) {
     conf.plaintextProtocol = "spdy/3.1";
   }
 
   conf.sslContextConfigs = ipConfig.sslConfigs;
+  conf.sslCacheOptions = opts.sslCacheOptions;
+  conf.initialTicketSeeds = opts.ticketSeeds;
+  conf.http1xHeadScanner = opts.http1xHeadScanner;
+  conf.headerArenaBlockSize = opts.headerArenaBlockSize;
+  conf.allowH2C = opts.allowH2C;
+  conf.allowPlaintextSPDY = opts.allowPlaintextSPDY;
+  conf.kernelTLS = opts.kernelTLS;
+  conf.egressCoalesceBytes = opts.egressCoalescingBytes;
+  conf.egressCoalesceDelay = opts.egressCoalescingDelay;
+  conf.egressQuotas = opts.egressQuotas;
+  conf.batchRequestDispatch = opts.batchRequestDispatch;
+  conf.notSentLowWatermark = opts.tcpNotSentLowWatermark;
+  conf.busyPollMicros = opts.socketBusyPollMicros;
   return conf;
 }
 
@@ -46,8 +69,42 @@ std::unique_ptr<HTTPServerAcceptor> HTTPServerAcceptor::make(
   }
   std::reverse(handlerFactories.begin(), handlerFactories.end());
 
-  return std::unique_ptr<HTTPServerAcceptor>(
+  std::unique_ptr<HTTPServerAcceptor> acceptor(
       new HTTPServerAcceptor(conf, handlerFactories));
+  if (opts.memoryAccountant) {
+    acceptor->setMemoryAccountant(opts.memoryAccountant.get());
+  }
+  if (opts.egressAccountant) {
+    acceptor->setEgressAccountant(opts.egressAccountant.get());
+  }
+  if (opts.admissionControl.enabled) {
+    acceptor->setAdmissionController(
+      folly::make_unique<AdmissionController>(opts.admissionControl));
+  }
+  if (opts.concurrentStreamsControl) {
+    acceptor->setConcurrentStreamsControl(*opts.concurrentStreamsControl);
+  }
+  if (opts.drainPacingWindow.count() > 0) {
+    acceptor->setDrainPacing(opts.drainPacingWindow, opts.drainProgress);
+  }
+  if (opts.busyPollSpinTime.count() > 0) {
+    acceptor->setBusyPolling(opts.busyPollSpinTime);
+  }
+  if (opts.traceObserver) {
+    acceptor->traceSampler_ = folly::make_unique<RequestTraceSampler>(
+      opts.traceObserver.get(), opts.traceSampleRate, opts.traceHeader);
+  }
+  acceptor->transportFactory_ = opts.transportFactory;
+#if PROXYGEN_HAVE_LIBURING
+  acceptor->useIOUring_ = opts.ioUring;
+#else
+  LOG_IF(WARNING, opts.ioUring) << "HTTPServerOptions::ioUring is ignored: "
+    << "proxygen was built without --enable-io-uring";
+#endif
+  acceptor->tenantClassifier_ = opts.tenantClassifier;
+  acceptor->tenantWeights_ = opts.tenantWeights;
+  acceptor->tenantSchedulerOptions_ = opts.tenantSchedulerOptions;
+  return acceptor;
 }
 
 HTTPServerAcceptor::HTTPServerAcceptor(
@@ -61,7 +118,49 @@ void HTTPServerAcceptor::setCompletionCallback(std::function<void()> f) {
   completionCallback_ = f;
 }
 
+void HTTPServerAcceptor::init(folly::AsyncServerSocket* serverSocket,
+                              folly::EventBase* eventBase) {
+  HTTPSessionAcceptor::init(serverSocket, eventBase);
+  if (admissionController_) {
+    admissionController_->attachEventBase(eventBase);
+  }
+  if (tenantClassifier_) {
+    tenantScheduler_ = folly::make_unique<TenantScheduler>(
+      eventBase, tenantClassifier_, tenantSchedulerOptions_);
+    for (auto& weight: tenantWeights_) {
+      tenantScheduler_->setWeight(weight.first, weight.second);
+    }
+    setTenantScheduler(tenantScheduler_.get());
+  }
+}
+
 HTTPServerAcceptor::~HTTPServerAcceptor() {
+  if (tenantScheduler_) {
+    // The sessions still around may outlive it
+    setTenantScheduler(nullptr);
+  }
+}
+
+folly::AsyncSocket::UniquePtr HTTPServerAcceptor::makeNewAsyncSocket(
+    folly::EventBase* base,
+    int fd) {
+  if (transportFactory_) {
+    return transportFactory_(base, fd);
+  }
+#if PROXYGEN_HAVE_LIBURING
+  if (useIOUring_) {
+    if (!ioUringContext_) {
+      ioUringContext_ = IOUringContext::create(base);
+    }
+    if (ioUringContext_) {
+      return folly::AsyncSocket::UniquePtr(
+        new IOUringSocket(base, fd, ioUringContext_));
+    }
+    LOG(WARNING) << "Falling back to plain sockets";
+    useIOUring_ = false;
+  }
+#endif
+  return HTTPSessionAcceptor::makeNewAsyncSocket(base, fd);
 }
 
 HTTPTransactionHandler* HTTPServerAcceptor::newHandler(
@@ -74,13 +173,77 @@ HTTPTransactionHandler* HTTPServerAcceptor::newHandler(
   msg->setClientAddress(clientAddr);
   msg->setDstAddress(vipAddr);
 
+  if (admissionController_ && !admissionController_->admit(*msg)) {
+    // Overloaded: answer before any of the handlers get to spend on it,
+    // but keep the connection, as reconnecting would cost more
+    auto handler = new HTTPDirectResponseHandler(
+      503, "Service Unavailable", getErrorPage(clientAddr));
+    handler->forceConnectionClose(false);
+    return handler;
+  }
+
   // Create filters chain
   RequestHandler* h = nullptr;
   for (auto& factory: handlerFactories_) {
     h = factory->onRequest(h, msg);
   }
+  if (admissionController_) {
+    h = new AdmissionFilter(h, admissionController_.get());
+  }
 
-  return new RequestHandlerAdaptor(h);
+  return new RequestHandlerAdaptor(h, traceSampler_.get());
+}
+
+void HTTPServerAcceptor::newHandlers(
+    const std::vector<HTTPTransaction*>& txns,
+    const std::vector<HTTPMessage*>& msgs,
+    std::vector<HTTPTransaction::Handler*>& handlers) noexcept {
+  if (txns.empty()) {
+    return;
+  }
+  // They all come from the one connection
+  SocketAddress clientAddr, vipAddr;
+  txns.front()->getPeerAddress(clientAddr);
+  txns.front()->getLocalAddress(vipAddr);
+
+  // Those admitted go through the filter chain together, factory by
+  // factory, and take the slots of handlers left null here
+  std::vector<HTTPMessage*> admitted;
+  admitted.reserve(msgs.size());
+  size_t first = handlers.size();
+  for (auto msg: msgs) {
+    msg->setClientAddress(clientAddr);
+    msg->setDstAddress(vipAddr);
+    if (admissionController_ && !admissionController_->admit(*msg)) {
+      auto handler = new HTTPDirectResponseHandler(
+        503, "Service Unavailable", getErrorPage(clientAddr));
+      handler->forceConnectionClose(false);
+      handlers.push_back(handler);
+    } else {
+      admitted.push_back(msg);
+      handlers.push_back(nullptr);
+    }
+  }
+  if (admitted.empty()) {
+    return;
+  }
+
+  std::vector<RequestHandler*> hs(admitted.size(), nullptr);
+  for (auto& factory: handlerFactories_) {
+    factory->onRequests(hs, admitted);
+  }
+
+  size_t next = 0;
+  for (size_t i = first; i < handlers.size(); ++i) {
+    if (handlers[i]) {
+      continue;
+    }
+    RequestHandler* h = hs[next++];
+    if (admissionController_) {
+      h = new AdmissionFilter(h, admissionController_.get());
+    }
+    handlers[i] = new RequestHandlerAdaptor(h, traceSampler_.get());
+  }
 }
 
 void HTTPServerAcceptor::onConnectionsDrained() {
@@ -11,10 +11,13 @@
 
 #include <proxygen/httpserver/HTTPServer.h>
 #include <proxygen/httpserver/HTTPServerOptions.h>
+#include <proxygen/httpserver/RequestTraceSampler.h>
 #include <proxygen/lib/http/session/HTTPSessionAcceptor.h>
 
 namespace proxygen {
 
+class IOUringContext;
+
 class HTTPServerAcceptor final : public HTTPSessionAcceptor {
  public:
   static AcceptorConfiguration makeConfig(
@@ -30,19 +33,64 @@ class HTTPServerAcceptor final : public HTTPSessionAcceptor {
    */
   void setCompletionCallback(std::function<void()> f);
 
+  /**
+   * Take over a connection accepted by a socket of another thread. Must be
+   * called from this acceptor's thread.
+   */
+  void dispatchConnection(int fd, const folly::SocketAddress& clientAddr) {
+    connectionAccepted(fd, clientAddr);
+  }
+
+  /**
+   * Tell an acceptor fed by dispatchConnection() that no more connections
+   * are coming, as its own socket would, so it drains. Must be called from
+   * this acceptor's thread.
+   */
+  void dispatchStopped() {
+    static_cast<folly::AsyncServerSocket::AcceptCallback*>(this)
+      ->acceptStopped();
+  }
+
+  void init(folly::AsyncServerSocket* serverSocket,
+            folly::EventBase* eventBase) override;
+
   ~HTTPServerAcceptor() override;
 
  private:
   HTTPServerAcceptor(const AcceptorConfiguration& conf,
                      std::vector<RequestHandlerFactory*> handlerFactories);
 
+  void setAdmissionController(std::unique_ptr<AdmissionController> c) {
+    admissionController_ = std::move(c);
+  }
+
+  // Acceptor
+  folly::AsyncSocket::UniquePtr makeNewAsyncSocket(folly::EventBase* base,
+                                                   int fd) override;
+
   // HTTPSessionAcceptor
   HTTPTransaction::Handler* newHandler(HTTPTransaction& txn,
                                        HTTPMessage* msg) noexcept override;
+  void newHandlers(
+    const std::vector<HTTPTransaction*>& txns,
+    const std::vector<HTTPMessage*>& msgs,
+    std::vector<HTTPTransaction::Handler*>& handlers) noexcept override;
   void onConnectionsDrained() override;
 
   std::function<void()> completionCallback_;
   const std::vector<RequestHandlerFactory*> handlerFactories_{nullptr};
+  std::unique_ptr<AdmissionController> admissionController_;
+  std::unique_ptr<RequestTraceSampler> traceSampler_;
+  std::function<folly::AsyncSocket::UniquePtr(folly::EventBase*, int)>
+    transportFactory_;
+  bool useIOUring_{false};
+  // Created with the first connection, shared with its sockets
+  std::shared_ptr<IOUringContext> ioUringContext_;
+  // Created for the EventBase in init()
+  TenantScheduler::Classifier tenantClassifier_;
+  std::map<std::string, uint32_t> tenantWeights_;
+  TenantScheduler::Options tenantSchedulerOptions_;
+  std::unique_ptr<TenantScheduler> tenantScheduler_;
 };
 
 }
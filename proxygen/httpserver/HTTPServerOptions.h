@@ -9,9 +9,19 @@
  */
 #pragma once
 
+#include <folly/Optional.h>
 #include <folly/SocketAddress.h>
+#include <folly/io/async/AsyncSocket.h>
+#include <folly/wangle/ssl/SSLCacheOptions.h>
+#include <folly/wangle/ssl/TLSTicketKeySeeds.h>
+#include <proxygen/httpserver/AdmissionController.h>
 #include <proxygen/httpserver/Filters.h>
 #include <proxygen/httpserver/RequestHandlerFactory.h>
+#include <proxygen/lib/http/session/ConcurrentStreamsController.h>
+#include <proxygen/lib/http/session/SessionMemoryAccountant.h>
+#include <proxygen/lib/http/session/TenantScheduler.h>
+#include <proxygen/lib/utils/TraceEventObserver.h>
+#include <map>
 #include <signal.h>
 
 namespace proxygen {
@@ -28,10 +38,12 @@ class HTTPServerOptions {
    * Number of threads to start to handle requests. Note that this excludes
    * the thread you call `HTTPServer.start()` in.
    *
+   * If 0, no threads are started: that thread accepts the connections and
+   * handles their requests itself. reusePort and loadAwareDispatch then
+   * do not apply.
+   *
    * XXX: Put some perf numbers to help user decide how many threads to
    *      create.
-   * XXX: Maybe support not creating any more worker threads and doing all
-   *      the work in same thread when `threads == 0`.
    */
   size_t threads = 1;
 
@@ -58,15 +70,281 @@ class HTTPServerOptions {
    * 2. If it takes client more than this time to send request, we fail the
    *    request.
    *
-   * XXX: Maybe have separate time limit for both?
+   * unless overridden by the timeouts below.
    */
   std::chrono::milliseconds idleTimeout{60000};
 
+  /**
+   * If not 0, how long a connection with no requests is kept around,
+   * instead of idleTimeout
+   */
+  std::chrono::milliseconds keepaliveTimeout{0};
+
+  /**
+   * If not 0, how long a request may take to send all of its headers,
+   * from the first byte, and how long it may go without sending any of
+   * its body, instead of idleTimeout
+   */
+  std::chrono::milliseconds requestHeaderTimeout{0};
+  std::chrono::milliseconds requestBodyTimeout{0};
+
+  /**
+   * Server side TLS session ID cache, used on the addresses with
+   * sslConfigs. Every worker thread keeps its own.
+   */
+  folly::SSLCacheOptions sslCacheOptions{
+    std::chrono::seconds(600), 30720, 100};
+
+  /**
+   * Seeds for the keys that encrypt TLS session tickets. All the worker
+   * threads use the same keys, so a ticket issued by one can be resumed by
+   * any other. Rotate them with HTTPServer::updateTLSTicketSeeds().
+   */
+  folly::TLSTicketKeySeeds ticketSeeds;
+
   /**
    * TCP server socket backlog to start with.
    */
   uint32_t listenBacklog{1024};
 
+  /**
+   * How many connections a listening socket accepts each time it is
+   * readable before going back to the event loop. Higher drains a storm
+   * of connections, such as after a failover, in fewer loop iterations;
+   * lower keeps the loop more responsive to the connections it has.
+   */
+  uint32_t maxAcceptAtOnce{30};
+
+  /**
+   * If true, every worker thread listens on each address with a socket of
+   * its own (SO_REUSEPORT) and accepts its connections itself, instead of
+   * one thread accepting for all of them and handing them over. The kernel
+   * spreads new connections over the workers' sockets.
+   */
+  bool reusePort{false};
+
+  /**
+   * If true (and not reusePort), hand each accepted connection to the
+   * least loaded worker thread, by sessions, buffered egress and loop
+   * time, instead of round robin. See HTTPServer::getWorkerLoadTracker().
+   */
+  bool loadAwareDispatch{false};
+
+  /**
+   * If true, pin worker thread i to CPU i (modulo the number of CPUs), or
+   * to workerCPUSets[i] (modulo their number) if there are any.
+   * Linux only.
+   */
+  bool pinWorkerThreads{false};
+
+  /**
+   * The CPUs each worker thread may run on, when pinWorkerThreads. For
+   * instance, the CPUs of one NUMA node each, or parseCPUList() of
+   * /sys/devices/system/node/nodeN/cpulist.
+   */
+  std::vector<std::vector<int>> workerCPUSets;
+
+  /**
+   * If true, pinned worker threads allocate their memory, connection
+   * buffers and all, from the NUMA node of their (first) CPU. In reusePort
+   * mode, the sockets of a worker pinned to a single CPU also get the
+   * connections the kernel receives on that CPU (SO_INCOMING_CPU), so
+   * steering the RX queues of the NIC to the workers' CPUs keeps every
+   * connection on one CPU and node.
+   */
+  bool numaLocalWorkers{false};
+
+  /**
+   * If not 0, before the server listens each worker thread fills its
+   * pools with what this many connections take at once: a read buffer, a
+   * transaction, its two messages and its handler adaptor each, up to the
+   * size of the pools, with their pages faulted in. The first requests after a start then
+   * don't pay for it. With numaLocalWorkers, the memory is the node's.
+   */
+  size_t warmUpConnections{0};
+
+  /**
+   * If not empty, the path of a Unix socket to hand the listening sockets
+   * over through on restarts. start() takes over the sockets of a server
+   * already listening there, instead of binding new ones, and that server
+   * then drains (see HTTPServer::drain()). Addresses it did not listen on
+   * are bound as usual. In reusePort mode nothing is handed over, as both
+   * can listen at once, but the previous server still drains.
+   */
+  std::string takeoverPath;
+
+  /**
+   * How long HTTPServer::drain() lets connections finish before stopping
+   */
+  std::chrono::milliseconds drainTimeout{30000};
+
+  /**
+   * If not 0, each worker thread tells its connections to drain (HTTP/2
+   * and SPDY GOAWAY, Connection: close) a few at a time over this window,
+   * idle ones first, rather than all at once, so that their clients do not
+   * all reconnect to the other servers at the same moment. Keep it well
+   * under drainTimeout, which still stops the server.
+   */
+  std::chrono::milliseconds drainPacingWindow{0};
+
+  /**
+   * If set with drainPacingWindow, told how many of the connections of an
+   * acceptor were told to drain so far, of how many, from the thread of
+   * that acceptor.
+   */
+  std::function<void(size_t drained, size_t total)> drainProgress;
+
+  /**
+   * If true, HTTP/1.x request heads are parsed with a faster scanner that
+   * hands connections with anything out of the ordinary over to the
+   * regular parser. See HTTP1xCodec::setHeadScanner().
+   */
+  bool http1xHeadScanner{false};
+
+  /**
+   * If not 0, HTTP/1.x and HTTP/2 request headers are parsed into shared
+   * blocks of this many bytes, and only copied into strings of their own
+   * once a handler asks for them as strings. See HTTPHeaders::useArena().
+   */
+  size_t headerArenaBlockSize{0};
+
+  /**
+   * If true, plaintext HTTP connections can also speak HTTP/2, by sending
+   * the HTTP/2 connection preface right away or by asking to upgrade
+   * their first request (Upgrade: h2c).
+   */
+  bool allowH2C{false};
+
+  /**
+   * If true, plaintext HTTP connections can also speak SPDY, which is told
+   * from their first bytes, so that one port serves all the protocols.
+   */
+  bool allowPlaintextSPDY{false};
+
+  /**
+   * If true, HTTPS connections are encrypted by the kernel (kTLS) once
+   * their handshake is done, where it supports it and their cipher.
+   */
+  bool kernelTLS{false};
+
+  /**
+   * If not 0, responses smaller than this are held back for up to
+   * egressCoalescingDelay while more requests are pipelined behind them,
+   * so that the responses go out together in fewer writes.
+   */
+  uint32_t egressCoalescingBytes{0};
+  std::chrono::microseconds egressCoalescingDelay{200};
+
+  /**
+   * If set, the memory of all the connections, in their buffers and header
+   * compression state, is accounted to it. While it is under pressure they
+   * stop reading and granting flow control credit, and the oldest of them
+   * are closed or drained until it is not.
+   */
+  std::shared_ptr<SessionMemoryAccountant> memoryAccountant;
+
+  /**
+   * If set, the egress all the connections buffer is accounted to it, as
+   * their budget: while it is under pressure, each connection pauses its
+   * handlers once it buffers a few KB.
+   */
+  std::shared_ptr<SessionMemoryAccountant> egressAccountant;
+
+  /**
+   * If true, a handler is paused once its response buffers more than its
+   * share of the connection's egress buffer, weighted by its HTTP/2
+   * priority, even if the other streams of the connection buffer nothing.
+   */
+  bool egressQuotas{false};
+
+  /**
+   * If true, the handlers of the requests a SPDY or HTTP/2 connection
+   * reads at once are created together, after the read is parsed: each
+   * factory gets all of them in one RequestHandlerFactory::onRequests().
+   */
+  bool batchRequestDispatch{false};
+
+  /**
+   * If set, each worker shares its time between the tenants this derives
+   * from the connections (from their VIP, say) in proportion to
+   * tenantWeights, 1 for those not in it, rather than in proportion to
+   * their connections. See TenantScheduler.
+   */
+  TenantScheduler::Classifier tenantClassifier;
+  std::map<std::string, uint32_t> tenantWeights;
+  TenantScheduler::Options tenantSchedulerOptions;
+
+  /**
+   * If not 0, connections keep about this many unsent bytes in their
+   * kernel send buffer (TCP_NOTSENT_LOWAT) rather than filling it, so
+   * that HTTP/2 and SPDY priorities apply to what is sent next. 16KB is a
+   * good start; too low and the socket drains between loops.
+   */
+  uint32_t tcpNotSentLowWatermark{0};
+
+  /**
+   * If not 0, every worker thread keeps polling for events without
+   * blocking for up to this long after each read or new connection, then
+   * blocks again. Busy workers then skip the wakeup latency of a blocked
+   * epoll_wait, and keep a core spinning; idle ones sleep. A few tens of
+   * microseconds to a few milliseconds, see BusyPoller.
+   */
+  std::chrono::microseconds busyPollSpinTime{0};
+
+  /**
+   * If not 0, the SO_BUSY_POLL of every connection, in microseconds, so
+   * that its reads busy poll the device queue. Raising it above the
+   * net.core.busy_read sysctl needs CAP_NET_ADMIN.
+   */
+  uint32_t socketBusyPollMicros{0};
+
+  /**
+   * If enabled, every worker thread caps its requests in flight by a limit
+   * that adapts to their latency and to its event loop lag, and answers
+   * the requests over it with a 503 before any handler is created. Set
+   * its classifier to shed the less important requests first. See
+   * AdmissionController.
+   */
+  AdmissionController::Options admissionControl;
+
+  /**
+   * If set, every worker thread adapts the concurrent streams its HTTP/2
+   * and SPDY connections allow to its event loop lag and transactions in
+   * flight, so that an overloaded server has its clients wait rather than
+   * queueing their requests. See ConcurrentStreamsController.
+   */
+  folly::Optional<ConcurrentStreamsController::Options>
+    concurrentStreamsControl;
+
+  /**
+   * If set, one in every traceSampleRate requests of each worker thread,
+   * and those with a traceHeader request header if given, are traced to
+   * traceObserver: an HTTPRequestExchange event with the timeline of the
+   * request under it, see RequestHandlerAdaptor. Events come from all the
+   * worker threads, so the observer must be thread safe.
+   */
+  std::shared_ptr<TraceEventObserver> traceObserver;
+  uint32_t traceSampleRate{0};
+  std::string traceHeader;
+
+  /**
+   * If set, makes the transport of every plaintext connection from its
+   * accepted fd, eg. to drive it through another I/O interface such as
+   * io_uring. The transport must be an AsyncSocket, and is used from the
+   * thread of the given EventBase only. TLS connections are unaffected.
+   */
+  std::function<folly::AsyncSocket::UniquePtr(folly::EventBase*, int fd)>
+    transportFactory;
+
+  /**
+   * If true, plaintext connections are driven through one io_uring per
+   * thread (see IOUringSocket) rather than epoll, where the kernel allows
+   * it (Linux 6.0 or later); elsewhere they fall back to plain sockets.
+   * Needs proxygen to be configured with --enable-io-uring. Ignored if
+   * transportFactory is set.
+   */
+  bool ioUring{false};
+
   /**
    * Signals on which to shutdown the server. Mostly you will want
    * {SIGINT, SIGTERM}. Note, if you have multiple deamons running or you want
@@ -98,6 +376,47 @@ class HTTPServerOptions {
    */
   int contentCompressionLevel{-1};
 
+  /**
+   * Content codings to compress with, most preferred first. The client's
+   * q-values in Accept-Encoding take precedence. "br" and "zstd" can be
+   * added when proxygen is built with libbrotlienc and libzstd.
+   */
+  std::vector<std::string> contentCompressionEncodings{"gzip"};
+
+  /**
+   * If not 0, compressed bodies of non-chunked responses with a strong ETag
+   * are cached, up to this many bytes for the whole server, and reused for
+   * later responses with the same ETag. Only for responses whose ETag
+   * changes with their content, such as static assets.
+   */
+  size_t contentCompressionCacheSize{0};
+
+  /**
+   * Compress non-chunked responses as their body is sent, without a
+   * Content-Length, instead of buffering the whole body to compute it.
+   * Lowers memory use and time to first byte for large responses.
+   */
+  bool contentCompressionStreaming{false};
+
+  /**
+   * Lower the compression level from contentCompressionLevel down to
+   * contentCompressionMinLevel as the event loop of a worker gets busy,
+   * soonest for large responses, and send the bodies that look compressed
+   * already as they are. See CompressionLevelController. A minimum level
+   * of 0 stops compressing at full load.
+   */
+  bool contentCompressionAdaptive{false};
+  int contentCompressionMinLevel{1};
+
+  /**
+   * Set to true to inflate request bodies sent with Content-Encoding gzip
+   * or deflate before they reach the handlers, failing the requests that
+   * inflate to more than requestDecompressionMaxSize bytes with 413. See
+   * RequestDecompressionFilter.
+   */
+  bool enableRequestDecompression{false};
+  size_t requestDecompressionMaxSize{16 * 1024 * 1024};
+
   /**
    * Content types to compress, all entries as lowercase
    */
@@ -0,0 +1,42 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <proxygen/httpserver/RequestHandler.h>
+
+namespace proxygen {
+
+/**
+ * RequestHandler of a pushed response, see
+ * ResponseHandler::newPushedResponse(). There is no request to handle, so
+ * it only gets the egress callbacks, and then requestComplete() once the
+ * response is all sent, or onError() if it failed or the client refused
+ * it.
+ */
+class PushHandler : public RequestHandler {
+ public:
+  void onRequest(std::unique_ptr<HTTPMessage> headers) noexcept final {
+    LOG(FATAL) << "push received a request";
+  }
+
+  void onBody(std::unique_ptr<folly::IOBuf> body) noexcept final {
+    LOG(FATAL) << "push received a body";
+  }
+
+  void onUpgrade(proxygen::UpgradeProtocol prot) noexcept final {
+    LOG(FATAL) << "push received an upgrade";
+  }
+
+  void onEOM() noexcept final {
+    LOG(FATAL) << "push received an EOM";
+  }
+};
+
+}
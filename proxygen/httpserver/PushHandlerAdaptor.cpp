@@ -0,0 +1,125 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/httpserver/PushHandlerAdaptor.h>
+
+#include <proxygen/httpserver/PushHandler.h>
+#include <proxygen/lib/http/codec/CodecProtocol.h>
+
+namespace proxygen {
+
+PushHandlerAdaptor::PushHandlerAdaptor(PushHandler* pushHandler)
+    : ResponseHandler(pushHandler) {
+}
+
+void PushHandlerAdaptor::setTransaction(HTTPTransaction* txn) noexcept {
+  txn_ = txn;
+  upstream_->setResponseHandler(this);
+}
+
+void PushHandlerAdaptor::detachTransaction() noexcept {
+  if (err_ == kErrorNone) {
+    upstream_->requestComplete();
+  }
+  delete this;
+}
+
+void PushHandlerAdaptor::onError(const HTTPException& error) noexcept {
+  if (err_ != kErrorNone) {
+    return;
+  }
+  // Only egress can fail, the client sends nothing on a push
+  err_ = error.getProxygenError() == kErrorTimeout ?
+    kErrorTimeout : kErrorWrite;
+  upstream_->onError(err_);
+}
+
+void PushHandlerAdaptor::onEgressPaused() noexcept {
+  upstream_->onEgressPaused();
+}
+
+void PushHandlerAdaptor::onEgressResumed() noexcept {
+  upstream_->onEgressResumed();
+}
+
+void PushHandlerAdaptor::sendHeaders(HTTPMessage& msg) noexcept {
+  if (msg.isRequest()) {
+    if (isSpdyCodecProtocol(txn_->getTransport().getCodec().getProtocol())) {
+      promise_ = folly::make_unique<HTTPMessage>(msg);
+    } else {
+      txn_->sendHeaders(msg);
+    }
+    return;
+  }
+  if (promise_) {
+    // The SYN_STREAM of a SPDY push always says 200
+    LOG_IF(ERROR, msg.getStatusCode() != 200) << "Pushing a "
+      << msg.getStatusCode() << " response as 200 over SPDY";
+    msg.getHeaders().forEach([this] (const std::string& name,
+                                     const std::string& value) {
+        promise_->getHeaders().add(name, value);
+      });
+    txn_->sendHeaders(*promise_);
+    promise_.reset();
+    return;
+  }
+  txn_->sendHeaders(msg);
+}
+
+void PushHandlerAdaptor::sendChunkHeader(size_t len) noexcept {
+  txn_->sendChunkHeader(len);
+}
+
+void PushHandlerAdaptor::sendBody(std::unique_ptr<folly::IOBuf> b) noexcept {
+  txn_->sendBody(std::move(b));
+}
+
+bool PushHandlerAdaptor::sendFile(int fd, off_t offset,
+                                  size_t length) noexcept {
+  return txn_->sendFile(fd, offset, length);
+}
+
+void PushHandlerAdaptor::sendChunkTerminator() noexcept {
+  txn_->sendChunkTerminator();
+}
+
+void PushHandlerAdaptor::sendEOM() noexcept {
+  txn_->sendEOM();
+}
+
+void PushHandlerAdaptor::sendAbort() noexcept {
+  txn_->sendAbort();
+}
+
+void PushHandlerAdaptor::refreshTimeout() noexcept {
+  txn_->refreshTimeout();
+}
+
+void PushHandlerAdaptor::pauseIngress() noexcept {
+  // There is no ingress on a push
+}
+
+void PushHandlerAdaptor::resumeIngress() noexcept {
+}
+
+folly::SysArena* PushHandlerAdaptor::getArena() noexcept {
+  return txn_ ? &txn_->getArena() : nullptr;
+}
+
+const folly::TransportInfo&
+PushHandlerAdaptor::getSetupTransportInfo() const noexcept {
+  return txn_->getSetupTransportInfo();
+}
+
+void PushHandlerAdaptor::getCurrentTransportInfo(
+  folly::TransportInfo* tinfo) const {
+  txn_->getCurrentTransportInfo(tinfo);
+}
+
+}
@@ -0,0 +1,61 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <proxygen/httpserver/ResponseHandler.h>
+#include <proxygen/lib/http/session/HTTPTransaction.h>
+
+namespace proxygen {
+
+class PushHandler;
+
+/**
+ * The ResponseHandler of a pushed response, on the HTTPTransaction of the
+ * push; see ResponseHandler::newPushedResponse().
+ *
+ * The promise, the request the push stands for, goes out right away as a
+ * PUSH_PROMISE on HTTP/2. SPDY has no such frame, so there it is held to
+ * go out with the response headers, in one SYN_STREAM.
+ */
+class PushHandlerAdaptor
+    : public HTTPPushTransactionHandler,
+      public ResponseHandler {
+ public:
+  explicit PushHandlerAdaptor(PushHandler* pushHandler);
+
+ private:
+  // HTTPPushTransactionHandler
+  void setTransaction(HTTPTransaction* txn) noexcept override;
+  void detachTransaction() noexcept override;
+  void onError(const HTTPException& error) noexcept override;
+  void onEgressPaused() noexcept override;
+  void onEgressResumed() noexcept override;
+
+  // ResponseHandler
+  void sendHeaders(HTTPMessage& msg) noexcept override;
+  void sendChunkHeader(size_t len) noexcept override;
+  void sendBody(std::unique_ptr<folly::IOBuf> body) noexcept override;
+  bool sendFile(int fd, off_t offset, size_t length) noexcept override;
+  void sendChunkTerminator() noexcept override;
+  void sendEOM() noexcept override;
+  void sendAbort() noexcept override;
+  void refreshTimeout() noexcept override;
+  void pauseIngress() noexcept override;
+  void resumeIngress() noexcept override;
+  folly::SysArena* getArena() noexcept override;
+  const folly::TransportInfo& getSetupTransportInfo() const noexcept override;
+  void getCurrentTransportInfo(folly::TransportInfo* tinfo) const override;
+
+  HTTPTransaction* txn_{nullptr};
+  std::unique_ptr<HTTPMessage> promise_;
+  ProxygenError err_{kErrorNone};
+};
+
+}
@@ -86,6 +86,17 @@ class RequestHandler {
   virtual void onEgressResumed() noexcept {
   }
 
+  /**
+   * Return non-zero to get the body in batches: onBody() is then invoked
+   * once about this many bytes have arrived, and at the latest at the end
+   * of the event loop iteration they arrived in, with all of them chained
+   * in one IOBuf. Flow control credit is returned as the bytes arrive, not
+   * as they are delivered. Checked once, before onRequest().
+   */
+  virtual size_t getBodyBatchSize() const noexcept {
+    return 0;
+  }
+
   virtual ~RequestHandler() {}
 
  protected:
@@ -10,13 +10,34 @@
 #include <proxygen/httpserver/RequestHandlerAdaptor.h>
 
 #include <boost/algorithm/string.hpp>
+#include <folly/io/async/EventBaseManager.h>
+#include <proxygen/httpserver/PushHandlerAdaptor.h>
 #include <proxygen/httpserver/RequestHandler.h>
+#include <proxygen/httpserver/RequestTraceSampler.h>
 #include <proxygen/httpserver/ResponseBuilder.h>
+#include <proxygen/lib/utils/ThreadLocalFreeList.h>
 
 namespace proxygen {
 
-RequestHandlerAdaptor::RequestHandlerAdaptor(RequestHandler* requestHandler)
-    : ResponseHandler(requestHandler) {
+RequestHandlerAdaptor::RequestHandlerAdaptor(RequestHandler* requestHandler,
+                                             RequestTraceSampler* traceSampler)
+    : ResponseHandler(requestHandler),
+      traceSampler_(traceSampler) {
+}
+
+void* RequestHandlerAdaptor::operator new(size_t size) {
+  if (size != sizeof(RequestHandlerAdaptor)) {
+    return ::operator new(size);
+  }
+  return ThreadLocalFreeList<RequestHandlerAdaptor>::allocate();
+}
+
+void RequestHandlerAdaptor::operator delete(void* p, size_t size) {
+  if (size != sizeof(RequestHandlerAdaptor)) {
+    ::operator delete(p);
+    return;
+  }
+  ThreadLocalFreeList<RequestHandlerAdaptor>::deallocate(p);
 }
 
 void RequestHandlerAdaptor::setTransaction(HTTPTransaction* txn) noexcept {
@@ -24,6 +45,7 @@ void RequestHandlerAdaptor::setTransaction(HTTPTransaction* txn) noexcept {
 
   // We become that transparent layer
   upstream_->setResponseHandler(this);
+  bodyBatchSize_ = upstream_->getBodyBatchSize();
 }
 
 void RequestHandlerAdaptor::detachTransaction() noexcept {
@@ -31,6 +53,15 @@ void RequestHandlerAdaptor::detachTransaction() noexcept {
     upstream_->requestComplete();
   }
 
+  if (trace_) {
+    trace_->exchange.end(getCurrentTime());
+    if (err_ != kErrorNone) {
+      trace_->exchange.addMeta(TraceFieldType::ProxygenError,
+                               getErrorString(err_));
+    }
+    trace_->context.traceEventAvailable(std::move(trace_->exchange));
+  }
+
   // Otherwise we would have got some error call back and invoked onError
   // on RequestHandler
   delete this;
@@ -38,6 +69,10 @@ void RequestHandlerAdaptor::detachTransaction() noexcept {
 
 void RequestHandlerAdaptor::onHeadersComplete(std::unique_ptr<HTTPMessage> msg)
     noexcept {
+  if (traceSampler_ && traceSampler_->sample(*msg)) {
+    startTrace(*msg);
+  }
+
   if (msg->getHeaders().exists(HTTP_HEADER_EXPECT)) {
     auto expectation = msg->getHeaders().getSingleOrEmpty(HTTP_HEADER_EXPECT);
     if (!boost::iequals(expectation, "100-continue")) {
@@ -58,11 +93,81 @@ void RequestHandlerAdaptor::onHeadersComplete(std::unique_ptr<HTTPMessage> msg)
   // Only in case of no error
   if (err_ == kErrorNone) {
     upstream_->onRequest(std::move(msg));
+    if (trace_) {
+      traceStep(TraceEventType::RequestDispatch, trace_->headersTime);
+    }
   }
 }
 
+void RequestHandlerAdaptor::startTrace(const HTTPMessage& msg) noexcept {
+  trace_ = folly::make_unique<Trace>(traceSampler_->getObserver());
+  trace_->headersTime = getCurrentTime();
+  auto start = std::min(msg.getStartTime(), trace_->headersTime);
+  trace_->exchange.start(start);
+  trace_->exchange.addMeta(TraceFieldType::Uri, msg.getURL());
+  trace_->exchange.addMeta(TraceFieldType::IsSecure, msg.isSecure());
+  trace_->exchange.addMeta(TraceFieldType::ReqHeaderSize,
+                           msg.getIngressHeaderSize().compressed);
+
+  // The transaction adds the steps of its own from now on
+  txn_->setTraceEventContext(trace_->context);
+  TraceEvent read(TraceEventType::ReadSocket, trace_->exchange.getID());
+  read.start(start);
+  read.end(trace_->headersTime);
+  read.addMeta(TraceFieldType::StreamID, txn_->getID());
+  read.addMeta(TraceFieldType::ReadBytes,
+               msg.getIngressHeaderSize().compressed);
+  trace_->context.traceEventAvailable(std::move(read));
+}
+
+void RequestHandlerAdaptor::traceBody(size_t length) noexcept {
+  if (trace_->bodyBytes == 0) {
+    trace_->bodyTime = getCurrentTime();
+  }
+  trace_->bodyBytes += length;
+}
+
+void RequestHandlerAdaptor::traceStep(TraceEventType type,
+                                      TimePoint start) noexcept {
+  TraceEvent event(type, trace_->exchange.getID());
+  event.start(start);
+  event.end(getCurrentTime());
+  event.addMeta(TraceFieldType::StreamID, txn_->getID());
+  if (type == TraceEventType::ResponseBody) {
+    event.addMeta(TraceFieldType::RspBodySize, trace_->bodyBytes);
+  }
+  trace_->context.traceEventAvailable(std::move(event));
+}
+
 void RequestHandlerAdaptor::onBody(std::unique_ptr<folly::IOBuf> c) noexcept {
-  upstream_->onBody(std::move(c));
+  if (bodyBatchSize_ == 0) {
+    upstream_->onBody(std::move(c));
+    return;
+  }
+
+  bodyBatch_.append(std::move(c));
+  if (bodyBatch_.chainLength() >= bodyBatchSize_) {
+    flushBody();
+  } else if (!isLoopCallbackScheduled()) {
+    auto evb = folly::EventBaseManager::get()->getExistingEventBase();
+    if (evb) {
+      evb->runInLoop(this);
+    } else {
+      flushBody();
+    }
+  }
+}
+
+void RequestHandlerAdaptor::runLoopCallback() noexcept {
+  flushBody();
+}
+
+void RequestHandlerAdaptor::flushBody() noexcept {
+  cancelLoopCallback();
+  if (bodyBatch_.empty() || err_ != kErrorNone) {
+    return;
+  }
+  upstream_->onBody(bodyBatch_.move());
 }
 
 void RequestHandlerAdaptor::onChunkHeader(size_t length) noexcept {
@@ -77,12 +182,14 @@ void RequestHandlerAdaptor::onTrailers(std::unique_ptr<HTTPHeaders> trailers)
 }
 
 void RequestHandlerAdaptor::onEOM() noexcept {
+  flushBody();
   if (err_ == kErrorNone) {
     upstream_->onEOM();
   }
 }
 
 void RequestHandlerAdaptor::onUpgrade(UpgradeProtocol protocol) noexcept {
+  flushBody();
   upstream_->onUpgrade(protocol);
 }
 
@@ -92,6 +199,10 @@ void RequestHandlerAdaptor::onError(const HTTPException& error) noexcept {
     return;
   }
 
+  // Whatever was batched is lost with the request
+  cancelLoopCallback();
+  bodyBatch_.move();
+
   if (error.getProxygenError() == kErrorTimeout) {
     setError(kErrorTimeout);
 
@@ -131,8 +242,17 @@ void RequestHandlerAdaptor::onEgressResumed() noexcept {
 }
 
 void RequestHandlerAdaptor::sendHeaders(HTTPMessage& msg) noexcept {
-  responseStarted_ = true;
+  // An error response may still follow informational ones
+  if (!msg.is1xxResponse() || msg.getStatusCode() == 101) {
+    responseStarted_ = true;
+  }
   txn_->sendHeaders(msg);
+  if (trace_ && !msg.is1xxResponse() && !trace_->responseHeadersSent) {
+    trace_->responseHeadersSent = true;
+    trace_->exchange.addMeta(TraceFieldType::StatusCode,
+                             msg.getStatusCode());
+    traceStep(TraceEventType::ResponseHeaders, trace_->headersTime);
+  }
 }
 
 void RequestHandlerAdaptor::sendChunkHeader(size_t len) noexcept {
@@ -140,15 +260,74 @@ void RequestHandlerAdaptor::sendChunkHeader(size_t len) noexcept {
 }
 
 void RequestHandlerAdaptor::sendBody(std::unique_ptr<folly::IOBuf> b) noexcept {
+  if (trace_ && b) {
+    traceBody(b->computeChainDataLength());
+  }
   txn_->sendBody(std::move(b));
 }
 
+bool RequestHandlerAdaptor::sendFile(int fd, off_t offset,
+                                     size_t length) noexcept {
+  if (trace_) {
+    traceBody(length);
+  }
+  return txn_->sendFile(fd, offset, length);
+}
+
 void RequestHandlerAdaptor::sendChunkTerminator() noexcept {
   txn_->sendChunkTerminator();
 }
 
 void RequestHandlerAdaptor::sendEOM() noexcept {
   txn_->sendEOM();
+  if (trace_) {
+    traceStep(TraceEventType::ResponseBody,
+              trace_->bodyBytes ? trace_->bodyTime : getCurrentTime());
+  }
+}
+
+void RequestHandlerAdaptor::sendHeadersWithEOM(
+    std::unique_ptr<HTTPMessage> msg) noexcept {
+  if (msg->is1xxResponse()) {
+    ResponseHandler::sendHeadersWithEOM(std::move(msg));
+    return;
+  }
+  responseStarted_ = true;
+  txn_->sendHeadersWithEOM(*msg);
+  if (trace_) {
+    if (!trace_->responseHeadersSent) {
+      trace_->responseHeadersSent = true;
+      trace_->exchange.addMeta(TraceFieldType::StatusCode,
+                               msg->getStatusCode());
+      traceStep(TraceEventType::ResponseHeaders, trace_->headersTime);
+    }
+    traceStep(TraceEventType::ResponseBody, getCurrentTime());
+  }
+}
+
+void RequestHandlerAdaptor::sendHeadersWithBodyAndEOM(
+    std::unique_ptr<HTTPMessage> msg,
+    std::unique_ptr<folly::IOBuf> body) noexcept {
+  if (msg->is1xxResponse()) {
+    ResponseHandler::sendHeadersWithBodyAndEOM(std::move(msg),
+                                               std::move(body));
+    return;
+  }
+  responseStarted_ = true;
+  if (trace_ && body) {
+    traceBody(body->computeChainDataLength());
+  }
+  txn_->sendHeadersWithBodyAndEOM(*msg, std::move(body));
+  if (trace_) {
+    if (!trace_->responseHeadersSent) {
+      trace_->responseHeadersSent = true;
+      trace_->exchange.addMeta(TraceFieldType::StatusCode,
+                               msg->getStatusCode());
+      traceStep(TraceEventType::ResponseHeaders, trace_->headersTime);
+    }
+    traceStep(TraceEventType::ResponseBody,
+              trace_->bodyBytes ? trace_->bodyTime : getCurrentTime());
+  }
 }
 
 void RequestHandlerAdaptor::sendAbort() noexcept {
@@ -167,6 +346,21 @@ void RequestHandlerAdaptor::resumeIngress() noexcept {
   txn_->resumeIngress();
 }
 
+ResponseHandler* RequestHandlerAdaptor::newPushedResponse(
+    PushHandler* pushHandler) noexcept {
+  // The adaptor deletes itself once the push transaction is detached
+  auto pushAdaptor = new PushHandlerAdaptor(pushHandler);
+  if (!txn_->newPushedTransaction(pushAdaptor, txn_->getPriority())) {
+    delete pushAdaptor;
+    return nullptr;
+  }
+  return pushAdaptor;
+}
+
+folly::SysArena* RequestHandlerAdaptor::getArena() noexcept {
+  return txn_ ? &txn_->getArena() : nullptr;
+}
+
 const folly::TransportInfo&
 RequestHandlerAdaptor::getSetupTransportInfo() const noexcept {
   return txn_->getSetupTransportInfo();
@@ -9,12 +9,17 @@
  */
 #pragma once
 
+#include <folly/io/IOBufQueue.h>
+#include <folly/io/async/EventBase.h>
 #include <proxygen/httpserver/ResponseHandler.h>
 #include <proxygen/lib/http/session/HTTPTransaction.h>
+#include <proxygen/lib/utils/TraceEvent.h>
+#include <proxygen/lib/utils/TraceEventContext.h>
 
 namespace proxygen {
 
 class RequestHandler;
+class RequestTraceSampler;
 
 /**
  * An adaptor that converts HTTPTransactionHandler to RequestHandler.
@@ -28,12 +33,33 @@ class RequestHandler;
  *             writing is still possible. Otherwise sends an abort.
  *
  * - Handles 100-continue case for you (by sending Continue response)
+ *
+ * - Batches the body for handlers that ask for it, see
+ *   RequestHandler::getBodyBatchSize()
+ *
+ * - Traces the requests picked by a RequestTraceSampler: an
+ *   HTTPRequestExchange event from the first byte of the request until the
+ *   transaction is detached, with these steps under it, besides those of
+ *   HTTPTransaction::setTraceEventContext()
+ *     read_socket       the request headers, until they were parsed
+ *     request_dispatch  from then until onRequest() returned
+ *     response_headers  from then until the final response headers
+ *     response_body     from the first body until the EOM
  */
 class RequestHandlerAdaptor
     : public HTTPTransactionHandler,
-      public ResponseHandler {
+      public ResponseHandler,
+      private folly::EventBase::LoopCallback {
  public:
-  explicit RequestHandlerAdaptor(RequestHandler* requestHandler);
+  explicit RequestHandlerAdaptor(RequestHandler* requestHandler,
+                                 RequestTraceSampler* traceSampler = nullptr);
+
+  /**
+   * Adaptors get their memory from a ThreadLocalFreeList, as the server
+   * creates and destroys one for every request.
+   */
+  static void* operator new(size_t size);
+  static void operator delete(void* p, size_t size);
 
  private:
   // HTTPTransactionHandler
@@ -54,21 +80,58 @@ class RequestHandlerAdaptor
   void sendHeaders(HTTPMessage& msg) noexcept override;
   void sendChunkHeader(size_t len) noexcept override;
   void sendBody(std::unique_ptr<folly::IOBuf> body) noexcept override;
+  bool sendFile(int fd, off_t offset, size_t length) noexcept override;
   void sendChunkTerminator() noexcept override;
   void sendEOM() noexcept override;
+  void sendHeadersWithEOM(std::unique_ptr<HTTPMessage> msg) noexcept override;
+  void sendHeadersWithBodyAndEOM(
+      std::unique_ptr<HTTPMessage> msg,
+      std::unique_ptr<folly::IOBuf> body) noexcept override;
   void sendAbort() noexcept override;
   void refreshTimeout() noexcept override;
   void pauseIngress() noexcept override;
   void resumeIngress() noexcept override;
+  ResponseHandler* newPushedResponse(
+      PushHandler* pushHandler) noexcept override;
+  folly::SysArena* getArena() noexcept override;
   const folly::TransportInfo& getSetupTransportInfo() const noexcept override;
   void getCurrentTransportInfo(folly::TransportInfo* tinfo) const override;
 
+  // EventBase::LoopCallback
+  void runLoopCallback() noexcept override;
+
   // Helper method
   void setError(ProxygenError err) noexcept;
 
+  // Hands on the batched body, if any
+  void flushBody() noexcept;
+
+  void startTrace(const HTTPMessage& msg) noexcept;
+  void traceBody(size_t length) noexcept;
+  void traceStep(TraceEventType type, TimePoint start) noexcept;
+
   HTTPTransaction* txn_{nullptr};
   ProxygenError err_{kErrorNone};
   bool responseStarted_{false};
+
+  size_t bodyBatchSize_{0};
+  folly::IOBufQueue bodyBatch_{folly::IOBufQueue::cacheChainLength()};
+
+  RequestTraceSampler* const traceSampler_;
+  // The request being traced, and when its steps began
+  struct Trace {
+    explicit Trace(TraceEventObserver* observer)
+        : exchange(TraceEventType::RequestExchange),
+          context(exchange.getID(), observer) {}
+
+    TraceEvent exchange;
+    TraceEventContext context;
+    TimePoint headersTime;
+    TimePoint bodyTime;
+    bool responseHeadersSent{false};
+    uint64_t bodyBytes{0};
+  };
+  std::unique_ptr<Trace> trace_;
 };
 
 }
@@ -10,6 +10,7 @@
 #pragma once
 
 #include <proxygen/httpserver/RequestHandler.h>
+#include <vector>
 
 namespace proxygen {
 
@@ -47,6 +48,20 @@ class RequestHandlerFactory {
    * this will by nullptr.
    */
   virtual RequestHandler* onRequest(RequestHandler*, HTTPMessage*) noexcept = 0;
+
+  /**
+   * onRequest() for all the requests a connection read at once, when
+   * HTTPServerOptions::batchRequestDispatch is set. handlers[i] is the
+   * upstream RequestHandler of msgs[i] and is replaced with the one this
+   * factory makes for it. Override it to handle the requests together,
+   * eg. to allocate their handlers in bulk.
+   */
+  virtual void onRequests(std::vector<RequestHandler*>& handlers,
+                          const std::vector<HTTPMessage*>& msgs) noexcept {
+    for (size_t i = 0; i < msgs.size(); ++i) {
+      handlers[i] = onRequest(handlers[i], msgs[i]);
+    }
+  }
 };
 
 /**
@@ -0,0 +1,56 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <proxygen/lib/http/HTTPMessage.h>
+#include <proxygen/lib/utils/TraceEventObserver.h>
+#include <string>
+
+namespace proxygen {
+
+/**
+ * Picks the requests of a worker thread to trace, see
+ * HTTPServerOptions::traceObserver: one in every sampleRate of them (none
+ * if 0), and any that has the request header named header, if not empty.
+ * Not thread safe, each worker has its own.
+ */
+class RequestTraceSampler {
+ public:
+  RequestTraceSampler(TraceEventObserver* observer,
+                      uint32_t sampleRate,
+                      const std::string& header)
+      : observer_(observer),
+        sampleRate_(sampleRate),
+        header_(header) {}
+
+  bool sample(const HTTPMessage& msg) {
+    if (!header_.empty() && msg.getHeaders().exists(header_)) {
+      return true;
+    }
+    if (sampleRate_ == 0 || ++requests_ < sampleRate_) {
+      return false;
+    }
+    requests_ = 0;
+    return true;
+  }
+
+  TraceEventObserver* getObserver() const {
+    return observer_;
+  }
+
+ private:
+  TraceEventObserver* const observer_;
+  const uint32_t sampleRate_;
+  const std::string header_;
+  // Since the last one sampled
+  uint32_t requests_{0};
+};
+
+}
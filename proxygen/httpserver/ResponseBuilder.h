@@ -11,6 +11,7 @@
 
 #include <folly/ScopeGuard.h>
 #include <proxygen/httpserver/ResponseHandler.h>
+#include <proxygen/lib/http/HeaderTemplate.h>
 
 namespace proxygen {
 
@@ -21,7 +22,7 @@ namespace proxygen {
  *       state machine in HTTPTransaction to tell us when an
  *       error occurs
  *
- * Three expected use cases are
+ * Five expected use cases are
  *
  * 1. Send all response at once. If this is an error
  *    response, most probably you also want 'closeConnection'.
@@ -50,6 +51,13 @@ namespace proxygen {
  *    .body(...)
  *    .sendWithEOM();
  *
+ * The body may also be a file, sent without reading it into memory first
+ *
+ * ResponseBuilder(handler)
+ *    .status(200, "OK")
+ *    .file(fd, 0, size)
+ *    .sendWithEOM();
+ *
  * 3. Accept or reject Upgrade Requests
  *
  * ResponseBuilder(handler)
@@ -60,6 +68,25 @@ namespace proxygen {
  * ResponseBuilder(handler)
  *    .rejectUpgradeRequest() // send '400 Bad Request'
  *
+ * 4. Push a response on a ResponseHandler from newPushedResponse(), before
+ *    sending the body that refers to it
+ *
+ * ResponseBuilder(pushed)
+ *    .promise("/style.css", "www.example.com")
+ *    .send();
+ *
+ * ResponseBuilder(pushed)
+ *    .status(200, "OK")
+ *    .body(...)
+ *    .sendWithEOM();
+ *
+ * 5. Send informational responses ahead of the final one, any of the above
+ *
+ * ResponseBuilder(handler)
+ *    .status(103, "Early Hints")
+ *    .header(HTTP_HEADER_LINK, "</style.css>; rel=preload; as=style")
+ *    .sendInformational();
+ *
  */
 class ResponseBuilder {
  public:
@@ -74,6 +101,19 @@ class ResponseBuilder {
     return *this;
   }
 
+  /**
+   * Start the GET request a pushed response answers, instead of a status;
+   * send() promises it
+   */
+  ResponseBuilder& promise(const std::string& url, const std::string& host) {
+    headers_ = folly::make_unique<HTTPMessage>();
+    headers_->setHTTPVersion(1, 1);
+    headers_->setMethod(HTTPMethod::GET);
+    headers_->setURL(url);
+    headers_->getHeaders().set(HTTP_HEADER_HOST, host);
+    return *this;
+  }
+
   template <typename T>
   ResponseBuilder& header(const std::string& headerIn, const T& value) {
     CHECK(headers_) << "You need to call `status` before adding headers";
@@ -88,6 +128,17 @@ class ResponseBuilder {
     return *this;
   }
 
+  /**
+   * Send the headers of headerTemplate too, the static ones most responses
+   * share, which are rendered once rather than added to each response
+   */
+  ResponseBuilder& headers(
+      std::shared_ptr<const HeaderTemplate> headerTemplate) {
+    CHECK(headers_) << "You need to call `status` before adding headers";
+    headers_->setHeaderTemplate(std::move(headerTemplate));
+    return *this;
+  }
+
   ResponseBuilder& body(std::unique_ptr<folly::IOBuf> bodyIn) {
     if (bodyIn) {
       if (body_) {
@@ -106,6 +157,17 @@ class ResponseBuilder {
         folly::to<std::string>(std::forward<T>(t))));
   }
 
+  /**
+   * Send length bytes of the file fd from offset after the body, see
+   * ResponseHandler::sendFile(). fd may be closed once sent.
+   */
+  ResponseBuilder& file(int fd, off_t offset, size_t length) {
+    fileFd_ = fd;
+    fileOffset_ = offset;
+    fileLength_ = length;
+    return *this;
+  }
+
   ResponseBuilder& closeConnection() {
     return header(HTTP_HEADER_CONNECTION, "close");
   }
@@ -127,23 +189,39 @@ class ResponseBuilder {
       chunked = false;
     }
 
-    if (headers_) {
+    if (headers_ && headers_->isRequest()) {
+      // A push promise
+      txn_->sendHeaders(std::move(headers_));
+    } else if (headers_) {
       // We don't need to add Content-Length or Encoding for 1xx responses
       if (headers_->getStatusCode() >= 200) {
         if (chunked) {
           headers_->setIsChunked(true);
         } else {
-          const auto len = body_ ? body_->computeChainDataLength() : 0;
+          const auto len = (body_ ? body_->computeChainDataLength() : 0) +
+            (fileFd_ >= 0 ? fileLength_ : 0);
           headers_->getHeaders().add(
               HTTP_HEADER_CONTENT_LENGTH,
               folly::to<std::string>(len));
         }
+        if (sendEOM_ && fileFd_ < 0) {
+          // Nothing goes between the headers and the EOM but the body
+          if (body_) {
+            txn_->sendHeadersWithBodyAndEOM(std::move(headers_),
+                                            std::move(body_));
+          } else {
+            txn_->sendHeadersWithEOM(std::move(headers_));
+          }
+          return;
+        }
       }
 
-      txn_->sendHeaders(*headers_);
+      txn_->sendHeaders(std::move(headers_));
     }
 
-    if (body_) {
+    if (fileFd_ >= 0) {
+      sendBodyAndFile(chunked);
+    } else if (body_) {
       if (chunked) {
         txn_->sendChunkHeader(body_->computeChainDataLength());
         txn_->sendBody(std::move(body_));
@@ -158,6 +236,21 @@ class ResponseBuilder {
     }
   }
 
+  /**
+   * Send the 1xx status and the headers given so far, but no body or EOM,
+   * so that the client can act on them, eg. fetch the resources in the
+   * Link headers of a 103 Early Hints, while the final response is still
+   * being made. Start the final response with status() again.
+   *
+   * HTTP/1.0 and SPDY have no room for them, so they are dropped there.
+   */
+  void sendInformational() {
+    CHECK(headers_ && headers_->is1xxResponse())
+      << "You need to call `status` with a 1xx code first";
+    SCOPE_EXIT { headers_.reset(); };
+    txn_->sendHeaders(std::move(headers_));
+  }
+
   enum class UpgradeType {
     CONNECT_REQUEST = 0,
     HTTP_UPGRADE,
@@ -174,22 +267,47 @@ class ResponseBuilder {
       headers_->getHeaders().add(HTTP_HEADER_UPGRADE, upgradeProtocol);
       headers_->getHeaders().add(HTTP_HEADER_CONNECTION, "Upgrade");
     }
-    txn_->sendHeaders(*headers_);
+    txn_->sendHeaders(std::move(headers_));
   }
 
   void rejectUpgradeRequest() {
     headers_ = folly::make_unique<HTTPMessage>();
     headers_->constructDirectResponse({1, 1}, 400, "Bad Request");
-    txn_->sendHeaders(*headers_);
+    txn_->sendHeaders(std::move(headers_));
     txn_->sendEOM();
   }
 
  private:
+  void sendBodyAndFile(bool chunked) {
+    SCOPE_EXIT { fileFd_ = -1; };
+    if (chunked) {
+      txn_->sendChunkHeader(
+        (body_ ? body_->computeChainDataLength() : 0) + fileLength_);
+    }
+    if (body_) {
+      txn_->sendBody(std::move(body_));
+    }
+    if (!txn_->sendFile(fileFd_, fileOffset_, fileLength_)) {
+      // The length is already promised
+      LOG(ERROR) << "Failed to send file body, aborting";
+      txn_->sendAbort();
+      sendEOM_ = false;
+      return;
+    }
+    if (chunked) {
+      txn_->sendChunkTerminator();
+    }
+  }
+
   ResponseHandler* const txn_{nullptr};
 
   std::unique_ptr<HTTPMessage> headers_;
   std::unique_ptr<folly::IOBuf> body_;
 
+  int fileFd_{-1};
+  off_t fileOffset_{0};
+  size_t fileLength_{0};
+
   // If true, sends EOM.
   bool sendEOM_{false};
 };
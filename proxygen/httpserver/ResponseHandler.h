@@ -10,9 +10,11 @@
 #pragma once
 
 #include <proxygen/lib/http/session/HTTPTransaction.h>
+#include <proxygen/lib/utils/FileRange.h>
 
 namespace proxygen {
 
+class PushHandler;
 class RequestHandler;
 
 /**
@@ -53,17 +55,76 @@ class ResponseHandler {
    *       if they want to.
    *
    *       eg. a compression filter might want to change the content-encoding
+   *
+   *       It may be called with informational (1xx) responses before the
+   *       final one, see ResponseBuilder::sendInformational(); filters
+   *       should pass those on as they are.
    */
   virtual void sendHeaders(HTTPMessage& msg) noexcept = 0;
 
+  /**
+   * Same, but handing the message on, so that a filter which has to keep
+   * it, eg. to send it from another thread or once the body is known, can
+   * do so without a copy. By default it's sent as with the reference;
+   * filters that want it should override both.
+   */
+  virtual void sendHeaders(std::unique_ptr<HTTPMessage> msg) noexcept {
+    sendHeaders(*msg);
+  }
+
   virtual void sendChunkHeader(size_t len) noexcept = 0;
 
   virtual void sendBody(std::unique_ptr<folly::IOBuf> body) noexcept = 0;
 
+  /**
+   * Send length bytes of the file fd from offset as body. fd may be closed
+   * right after. Returns false, sending nothing, if the file can't be
+   * sent.
+   *
+   * By default the range is mapped and passed to sendBody(), so filters see
+   * it as any other body. RequestHandlerAdaptor has HTTPTransaction map it
+   * as egress drains instead; filters that leave the body alone can pass
+   * it on to their downstream to get the same.
+   */
+  virtual bool sendFile(int fd, off_t offset, size_t length) noexcept {
+    auto body = mapFileRange(fd, offset, length);
+    if (!body) {
+      return false;
+    }
+    sendBody(std::move(body));
+    return true;
+  }
+
   virtual void sendChunkTerminator() noexcept = 0;
 
   virtual void sendEOM() noexcept = 0;
 
+  /**
+   * The whole of a response without a body. By default it's sent with
+   * sendHeaders() and sendEOM(), so filters see it as any other response.
+   * RequestHandlerAdaptor has HTTPTransaction frame both at once instead;
+   * filters that leave the headers alone can pass it on to their
+   * downstream to get the same.
+   */
+  virtual void sendHeadersWithEOM(std::unique_ptr<HTTPMessage> msg) noexcept {
+    sendHeaders(std::move(msg));
+    sendEOM();
+  }
+
+  /**
+   * The whole of a response with a Content-Length body, likewise sent
+   * as sendHeaders(), sendBody() and sendEOM() by default. Through
+   * RequestHandlerAdaptor it goes out in one write when the send windows
+   * have room for the body.
+   */
+  virtual void sendHeadersWithBodyAndEOM(
+      std::unique_ptr<HTTPMessage> msg,
+      std::unique_ptr<folly::IOBuf> body) noexcept {
+    sendHeaders(std::move(msg));
+    sendBody(std::move(body));
+    sendEOM();
+  }
+
   virtual void sendAbort() noexcept = 0;
 
   virtual void refreshTimeout() noexcept = 0;
@@ -72,6 +133,34 @@ class ResponseHandler {
 
   virtual void resumeIngress() noexcept = 0;
 
+  /**
+   * Start pushing a response the client will want next, eg. a stylesheet
+   * of the page being sent. Returns the ResponseHandler to send it on, or
+   * nullptr if it can't be pushed: the protocol has no push, the client
+   * turned it off or has as many streams from us as it allows, or this
+   * response is complete already. pushHandler gets its callbacks.
+   *
+   * The first sendHeaders() on it takes the request the push answers, see
+   * ResponseBuilder::promise(), then the response follows as usual. Promise
+   * pushes before the body that refers to them, or the client may request
+   * them itself. They go out right away, skipping the filters in between.
+   */
+  virtual ResponseHandler* newPushedResponse(
+      PushHandler* pushHandler) noexcept {
+    return nullptr;
+  }
+
+  /**
+   * Memory that lives until the request is complete, for request state
+   * that would otherwise take an allocation each, see
+   * HTTPTransaction::getArena(). It is freed in one go after
+   * requestComplete() or onError(), without running destructors. nullptr
+   * if there isn't one.
+   */
+  virtual folly::SysArena* getArena() noexcept {
+    return nullptr;
+  }
+
   // Accessors for Transport/Connection information
   virtual const folly::TransportInfo& getSetupTransportInfo() const noexcept = 0;
 
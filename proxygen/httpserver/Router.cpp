@@ -0,0 +1,318 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/httpserver/Router.h>
+
+#include <algorithm>
+#include <folly/Conv.h>
+#include <limits>
+#include <proxygen/httpserver/RequestHandler.h>
+#include <proxygen/httpserver/ResponseBuilder.h>
+#include <stdexcept>
+
+using folly::StringPiece;
+
+namespace proxygen {
+
+namespace {
+
+// Answers the request with an empty response of code
+class RouteErrorHandler : public RequestHandler {
+ public:
+  RouteErrorHandler(uint16_t code, const char* message,
+                    std::string allow = "")
+      : code_(code),
+        message_(message),
+        allow_(std::move(allow)) {
+  }
+
+  void onRequest(std::unique_ptr<HTTPMessage> headers) noexcept override {
+  }
+
+  void onBody(std::unique_ptr<folly::IOBuf> body) noexcept override {
+  }
+
+  void onUpgrade(UpgradeProtocol prot) noexcept override {
+  }
+
+  void onEOM() noexcept override {
+    ResponseBuilder response(downstream_);
+    response.status(code_, message_);
+    if (!allow_.empty()) {
+      response.header(HTTP_HEADER_ALLOW, allow_);
+    }
+    response.sendWithEOM();
+  }
+
+  void requestComplete() noexcept override {
+    delete this;
+  }
+
+  void onError(ProxygenError err) noexcept override {
+    delete this;
+  }
+
+ private:
+  const uint16_t code_;
+  const char* message_;
+  std::string allow_;
+};
+
+bool firstCharLess(const std::pair<std::string, uint32_t>& edge, char c) {
+  return edge.first[0] < c;
+}
+
+}
+
+const uint32_t Router::kNone = std::numeric_limits<uint32_t>::max();
+
+Router::Router() {
+  // The root, for the path before its first character
+  newNode();
+}
+
+void Router::add(StringPiece pattern, Target target) {
+  addRoute(nullptr, pattern, std::move(target));
+}
+
+void Router::add(HTTPMethod method, StringPiece pattern, Target target) {
+  addRoute(&method, pattern, std::move(target));
+}
+
+void Router::addRoute(const HTTPMethod* method, StringPiece pattern,
+                      Target target) {
+  if (pattern.empty() || pattern[0] != '/') {
+    throw std::invalid_argument(
+      folly::to<std::string>("route pattern not a path: ", pattern));
+  }
+  uint32_t node = 0;
+  size_t numParams = 0;
+  // The literal part of the pattern since the last parameter
+  std::string literal;
+  StringPiece rest = pattern;
+  while (!rest.empty()) {
+    // rest starts with the '/' before a segment
+    literal.push_back('/');
+    rest.advance(1);
+    auto segment = rest.subpiece(0, rest.find('/'));
+    rest.advance(segment.size());
+    if (segment.empty() ||
+        (segment[0] != ':' && !(segment == "*"))) {
+      literal.append(segment.data(), segment.size());
+      continue;
+    }
+    if (++numParams > RouteParams::kMaxParams) {
+      throw std::invalid_argument(
+        folly::to<std::string>("too many parameters in route ", pattern));
+    }
+    node = addLiteral(node, literal);
+    literal.clear();
+    if (segment == "*") {
+      if (!rest.empty()) {
+        throw std::invalid_argument(
+          folly::to<std::string>("* not last in route ", pattern));
+      }
+      if (nodes_[node].rest == kNone) {
+        auto restNode = newNode();
+        nodes_[node].rest = restNode;
+      }
+      node = nodes_[node].rest;
+      break;
+    }
+    auto name = segment.subpiece(1);
+    if (name.empty()) {
+      throw std::invalid_argument(
+        folly::to<std::string>("unnamed parameter in route ", pattern));
+    }
+    if (nodes_[node].param == kNone) {
+      auto paramNode = newNode();
+      nodes_[node].param = paramNode;
+      nodes_[node].paramName = name.str();
+    } else if (nodes_[node].paramName != name) {
+      throw std::invalid_argument(
+        folly::to<std::string>("parameter :", name, " of route ", pattern,
+                               " is :", nodes_[node].paramName,
+                               " in another route"));
+    }
+    node = nodes_[node].param;
+  }
+  node = addLiteral(node, literal);
+
+  auto& endpoint = nodes_[node];
+  uint32_t* slot = &endpoint.anyMethod;
+  if (method) {
+    for (auto& entry: endpoint.methods) {
+      if (entry.first == *method) {
+        slot = &entry.second;
+        break;
+      }
+    }
+    if (slot == &endpoint.anyMethod) {
+      endpoint.methods.emplace_back(*method, kNone);
+      slot = &endpoint.methods.back().second;
+    }
+  }
+  if (*slot != kNone) {
+    throw std::invalid_argument(
+      folly::to<std::string>("route ", pattern, " added twice"));
+  }
+  *slot = targets_.size();
+  targets_.push_back(std::move(target));
+}
+
+uint32_t Router::addLiteral(uint32_t node, StringPiece literal) {
+  while (!literal.empty()) {
+    auto& literals = nodes_[node].literals;
+    auto it = std::lower_bound(literals.begin(), literals.end(), literal[0],
+                               firstCharLess);
+    size_t pos = it - literals.begin();
+    if (it == literals.end() || it->first[0] != literal[0]) {
+      auto child = newNode();
+      auto& edges = nodes_[node].literals;
+      edges.insert(edges.begin() + pos,
+                   std::make_pair(literal.str(), child));
+      return child;
+    }
+    auto label = it->first;
+    auto child = it->second;
+    size_t common = 1;
+    while (common < label.size() && common < literal.size() &&
+           label[common] == literal[common]) {
+      common++;
+    }
+    if (common < label.size()) {
+      // Split the edge where the literal leaves it
+      auto mid = newNode();
+      nodes_[mid].literals.emplace_back(label.substr(common), child);
+      auto& edge = nodes_[node].literals[pos];
+      edge.first = label.substr(0, common);
+      edge.second = mid;
+      child = mid;
+    }
+    node = child;
+    literal.advance(common);
+  }
+  return node;
+}
+
+uint32_t Router::newNode() {
+  nodes_.emplace_back();
+  return nodes_.size() - 1;
+}
+
+uint32_t Router::findNode(uint32_t n, StringPiece path,
+                          RouteParams& params) const {
+  const auto& node = nodes_[n];
+  if (path.empty()) {
+    if (node.anyMethod != kNone || !node.methods.empty()) {
+      return n;
+    }
+  } else {
+    auto it = std::lower_bound(node.literals.begin(), node.literals.end(),
+                               path[0], firstCharLess);
+    if (it != node.literals.end() && path.startsWith(it->first)) {
+      auto found = findNode(it->second, path.subpiece(it->first.size()),
+                            params);
+      if (found != kNone) {
+        return found;
+      }
+    }
+    if (node.param != kNone) {
+      auto segment = path.subpiece(0, path.find('/'));
+      if (!segment.empty()) {
+        auto size = params.size_;
+        params.params_[params.size_++] =
+          std::make_pair(StringPiece(node.paramName), segment);
+        auto found = findNode(node.param, path.subpiece(segment.size()),
+                              params);
+        if (found != kNone) {
+          return found;
+        }
+        params.size_ = size;
+      }
+    }
+  }
+  if (node.rest != kNone) {
+    params.params_[params.size_++] = std::make_pair(StringPiece("*"), path);
+    return node.rest;
+  }
+  return kNone;
+}
+
+Router::Match Router::match(const boost::optional<HTTPMethod>& method,
+                            StringPiece path,
+                            const Target** target,
+                            RouteParams& params,
+                            std::vector<HTTPMethod>* allowed) const {
+  params.size_ = 0;
+  auto n = findNode(0, path, params);
+  if (n == kNone) {
+    return Match::NOT_FOUND;
+  }
+  const auto& node = nodes_[n];
+  if (method) {
+    // HEAD goes where GET does, unless routed itself
+    const uint32_t* get = nullptr;
+    for (const auto& entry: node.methods) {
+      if (entry.first == *method) {
+        *target = &targets_[entry.second];
+        return Match::FOUND;
+      }
+      if (entry.first == HTTPMethod::GET) {
+        get = &entry.second;
+      }
+    }
+    if (get && *method == HTTPMethod::HEAD) {
+      *target = &targets_[*get];
+      return Match::FOUND;
+    }
+  }
+  if (node.anyMethod != kNone) {
+    *target = &targets_[node.anyMethod];
+    return Match::FOUND;
+  }
+  params.size_ = 0;
+  if (allowed) {
+    for (const auto& entry: node.methods) {
+      allowed->push_back(entry.first);
+    }
+  }
+  return Match::METHOD_NOT_ALLOWED;
+}
+
+RequestHandler* Router::onRequest(RequestHandler*, HTTPMessage* msg)
+    noexcept {
+  const Target* target = nullptr;
+  RouteParams params;
+  std::vector<HTTPMethod> allowed;
+  switch (match(msg->getMethod(), msg->getPath(), &target, params,
+                &allowed)) {
+    case Match::FOUND:
+      return (*target)(msg, params);
+    case Match::METHOD_NOT_ALLOWED: {
+      std::string allow;
+      for (auto method: allowed) {
+        if (!allow.empty()) {
+          allow += ", ";
+        }
+        allow += methodToString(method);
+      }
+      return new RouteErrorHandler(405, "Method Not Allowed",
+                                   std::move(allow));
+    }
+    case Match::NOT_FOUND:
+      break;
+  }
+  if (notFound_) {
+    return notFound_(msg, params);
+  }
+  return new RouteErrorHandler(404, "Not Found");
+}
+
+}
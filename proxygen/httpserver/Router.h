@@ -0,0 +1,161 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <array>
+#include <folly/Range.h>
+#include <functional>
+#include <proxygen/httpserver/RequestHandlerFactory.h>
+#include <proxygen/lib/http/HTTPMethod.h>
+#include <string>
+#include <vector>
+
+namespace proxygen {
+
+/**
+ * The parameters a route pattern matched in a path, in the order of the
+ * pattern. Names and values are views, of the router and of the path of
+ * the request: copy what needs to outlive RequestHandlerFactory::onRequest().
+ */
+class RouteParams {
+ public:
+  static const size_t kMaxParams = 8;
+
+  size_t size() const {
+    return size_;
+  }
+
+  folly::StringPiece getName(size_t i) const {
+    return params_[i].first;
+  }
+
+  folly::StringPiece getValue(size_t i) const {
+    return params_[i].second;
+  }
+
+  // The value of the parameter called name, or empty if there is none
+  folly::StringPiece get(folly::StringPiece name) const {
+    for (size_t i = 0; i < size_; i++) {
+      if (params_[i].first == name) {
+        return params_[i].second;
+      }
+    }
+    return folly::StringPiece();
+  }
+
+ private:
+  friend class Router;
+
+  std::array<std::pair<folly::StringPiece, folly::StringPiece>, kMaxParams>
+    params_;
+  size_t size_{0};
+};
+
+/**
+ * A RequestHandlerFactory for the end of the chain that picks the handler
+ * of each request by its path and method, from the routes added to it.
+ * A route pattern is a path whose segments may be
+ *
+ *   users    a literal, matched as is
+ *   :id      a parameter, matching one non-empty segment, as "id"
+ *   *        only as the last segment, the rest of the path, maybe empty,
+ *            as the parameter "*"
+ *
+ * as in "/users/:id/posts", or "/static/" and a "*" for all under it.
+ * The patterns are compiled into a radix trie, with the literal parts of
+ * paths shared, which is matched in one pass over the path without
+ * allocating. Where more than one route could match, literals win over
+ * parameters and parameters over a rest. A path that matches but is not
+ * routed for its method gets a 405, one that matches nothing a 404 or
+ * what setNotFound() says.
+ *
+ * Add all the routes before the server starts; matching is then safe from
+ * any number of threads.
+ */
+class Router : public RequestHandlerFactory {
+ public:
+  using Target =
+    std::function<RequestHandler*(HTTPMessage*, const RouteParams&)>;
+
+  enum class Match {
+    FOUND,
+    NOT_FOUND,
+    METHOD_NOT_ALLOWED,
+  };
+
+  Router();
+
+  /**
+   * Route requests of any method (or of method) matching pattern to
+   * target. Throws std::invalid_argument on a malformed pattern, too many
+   * parameters in it, or a parameter named differently from another one
+   * in the same place.
+   */
+  void add(folly::StringPiece pattern, Target target);
+  void add(HTTPMethod method, folly::StringPiece pattern, Target target);
+
+  /**
+   * Where requests that match no route go, instead of a 404
+   */
+  void setNotFound(Target target) {
+    notFound_ = std::move(target);
+  }
+
+  /**
+   * The target for method and path, and its parameters, if FOUND. The
+   * methods routed for the path, if METHOD_NOT_ALLOWED, go to allowed.
+   */
+  Match match(const boost::optional<HTTPMethod>& method,
+              folly::StringPiece path,
+              const Target** target,
+              RouteParams& params,
+              std::vector<HTTPMethod>* allowed = nullptr) const;
+
+  // RequestHandlerFactory
+  void onServerStart() noexcept override {}
+
+  void onServerStop() noexcept override {}
+
+  RequestHandler* onRequest(RequestHandler*, HTTPMessage* msg)
+    noexcept override;
+
+ private:
+  static const uint32_t kNone;
+
+  struct Node {
+    // The literal edges out of the node, in the order of their first
+    // character, which is different for each
+    std::vector<std::pair<std::string, uint32_t>> literals;
+    // The edge for a parameter segment, and its name
+    uint32_t param{kNone};
+    std::string paramName;
+    // The node of a rest of the path from here
+    uint32_t rest{kNone};
+    // The targets of the routes ending here, by method and for any
+    std::vector<std::pair<HTTPMethod, uint32_t>> methods;
+    uint32_t anyMethod{kNone};
+  };
+
+  void addRoute(const HTTPMethod* method, folly::StringPiece pattern,
+                Target target);
+
+  uint32_t addLiteral(uint32_t node, folly::StringPiece literal);
+
+  uint32_t newNode();
+
+  uint32_t findNode(uint32_t node, folly::StringPiece path,
+                    RouteParams& params) const;
+
+  std::vector<Node> nodes_;
+  std::vector<Target> targets_;
+  Target notFound_;
+};
+
+}
@@ -0,0 +1,112 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/httpserver/SocketTakeover.h>
+
+#include <folly/Exception.h>
+#include <folly/FileUtil.h>
+#include <glog/logging.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace proxygen {
+
+int connectTakeoverSocket(const std::string& path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    throw std::invalid_argument("takeover path too long: " + path);
+  }
+  memcpy(addr.sun_path, path.data(), path.size());
+
+  int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  folly::checkUnixError(sock, "socket() for takeover failed");
+  if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+    VLOG(2) << "No server to take over at " << path << ": "
+            << strerror(errno);
+    folly::closeNoInt(sock);
+    return -1;
+  }
+  return sock;
+}
+
+void sendSocketFDs(int sock, const std::vector<int>& fds) {
+  CHECK_LE(fds.size(), kMaxTakeoverFDs);
+  // The count goes in the data, as an empty message would not be sent
+  uint32_t count = fds.size();
+  struct iovec iov;
+  iov.iov_base = &count;
+  iov.iov_len = sizeof(count);
+
+  char control[CMSG_SPACE(sizeof(int) * kMaxTakeoverFDs)];
+  memset(control, 0, sizeof(control));
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if (!fds.empty()) {
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+  }
+
+  ssize_t rc;
+  do {
+    rc = sendmsg(sock, &msg, 0);
+  } while (rc < 0 && errno == EINTR);
+  folly::checkUnixError(rc, "sendmsg() of listening sockets failed");
+}
+
+std::vector<int> receiveSocketFDs(int sock) {
+  uint32_t count = 0;
+  struct iovec iov;
+  iov.iov_base = &count;
+  iov.iov_len = sizeof(count);
+
+  char control[CMSG_SPACE(sizeof(int) * kMaxTakeoverFDs)];
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  ssize_t rc;
+  do {
+    rc = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  } while (rc < 0 && errno == EINTR);
+  folly::checkUnixError(rc, "recvmsg() of listening sockets failed");
+
+  std::vector<int> fds;
+  for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      auto data = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+      fds.insert(fds.end(), data, data + n);
+    }
+  }
+  if (rc != sizeof(count) || count != fds.size() ||
+      (msg.msg_flags & MSG_CTRUNC)) {
+    for (auto fd: fds) {
+      folly::closeNoInt(fd);
+    }
+    throw std::system_error(EPROTO, std::system_category(),
+                            "bad takeover message");
+  }
+  return fds;
+}
+
+}
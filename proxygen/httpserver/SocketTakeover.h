@@ -0,0 +1,40 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace proxygen {
+
+/**
+ * Handing listening sockets from one process over to another through a
+ * Unix socket, so a restart never stops listening. See
+ * HTTPServerOptions::takeoverPath.
+ */
+
+// At most this many sockets are handed over at once
+const size_t kMaxTakeoverFDs = 64;
+
+/**
+ * Connect to the Unix socket a running server listens for takeovers on.
+ * Returns -1 when nothing listens there, or it is gone.
+ */
+int connectTakeoverSocket(const std::string& path);
+
+/**
+ * Send fds over the connected Unix socket sock, and receive them on the
+ * other side. The received descriptors are owned by the caller. Both block
+ * and throw std::system_error on failure.
+ */
+void sendSocketFDs(int sock, const std::vector<int>& fds);
+std::vector<int> receiveSocketFDs(int sock);
+
+}
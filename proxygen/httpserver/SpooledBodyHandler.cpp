@@ -0,0 +1,213 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/httpserver/SpooledBodyHandler.h>
+
+#include <folly/FileUtil.h>
+#include <folly/MoveWrapper.h>
+#include <folly/String.h>
+#include <folly/io/async/EventBaseManager.h>
+#include <proxygen/httpserver/ResponseBuilder.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using folly::IOBuf;
+using std::unique_ptr;
+
+namespace proxygen {
+
+struct SpooledBodyHandler::Spool {
+  explicit Spool(SpooledBodyHandler* h): handler(h) {}
+
+  ~Spool() {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+  }
+
+  // Cleared when the handler is destroyed, in its thread
+  SpooledBodyHandler* handler;
+  int fd{-1};
+};
+
+namespace {
+
+// Appends buf to the file fd, first created in directory if it is -1;
+// returns 0 or the errno of the failure
+int appendToSpool(int& fd, const std::string& directory, const IOBuf& buf) {
+  if (fd < 0) {
+    std::string path = directory + "/proxygen-spool-XXXXXX";
+    int tmp = ::mkstemp(&path[0]);
+    if (tmp < 0) {
+      return errno;
+    }
+    // The file goes with its last descriptor
+    ::unlink(path.c_str());
+    fd = tmp;
+  }
+  for (auto range: buf) {
+    if (folly::writeFull(fd, range.data(), range.size()) < 0) {
+      return errno;
+    }
+  }
+  return 0;
+}
+
+}
+
+SpooledBodyHandler::SpooledBodyHandler(const Options& options)
+    : options_(options) {
+  if (options_.executor) {
+    eventBase_ = folly::EventBaseManager::get()->getExistingEventBase();
+    CHECK(eventBase_);
+  }
+}
+
+SpooledBodyHandler::~SpooledBodyHandler() {
+  if (mapping_) {
+    ::munmap(mapping_, length_);
+  }
+  if (spool_) {
+    spool_->handler = nullptr;
+  }
+}
+
+unique_ptr<IOBuf> SpooledBodyHandler::takeBody() {
+  if (spool_) {
+    return nullptr;
+  }
+  return body_.move();
+}
+
+int SpooledBodyHandler::getBodyFd() const {
+  return spool_ ? spool_->fd : -1;
+}
+
+folly::ByteRange SpooledBodyHandler::mapBody() {
+  if (!spool_) {
+    auto buf = body_.move();
+    if (!buf) {
+      return folly::ByteRange();
+    }
+    buf->coalesce();
+    folly::ByteRange range(buf->data(), buf->length());
+    body_.append(std::move(buf));
+    return range;
+  }
+  if (!mapping_ && spool_->fd >= 0 && length_ > 0) {
+    auto addr = ::mmap(nullptr, length_, PROT_READ, MAP_SHARED,
+                       spool_->fd, 0);
+    if (addr == MAP_FAILED) {
+      LOG(ERROR) << "Failed to map spooled body: " << folly::errnoStr(errno);
+      return folly::ByteRange();
+    }
+    mapping_ = addr;
+  }
+  return folly::ByteRange(static_cast<const uint8_t*>(mapping_),
+                          mapping_ ? length_ : 0);
+}
+
+void SpooledBodyHandler::onBody(unique_ptr<IOBuf> body) noexcept {
+  if (failed_) {
+    return;
+  }
+  auto len = body->computeChainDataLength();
+  length_ += len;
+  if (options_.maxBodySize > 0 && length_ > options_.maxBodySize) {
+    return fail(413, "Request Entity Too Large");
+  }
+  body_.append(std::move(body));
+
+  if (!spool_) {
+    if (length_ <= options_.memoryLimit) {
+      return;
+    }
+    spool_ = std::make_shared<Spool>(this);
+    pendingBytes_ = length_;
+  } else {
+    pendingBytes_ += len;
+  }
+  if (options_.executor && !paused_ &&
+      pendingBytes_ > options_.maxPendingBytes) {
+    paused_ = true;
+    downstream_->pauseIngress();
+  }
+  write();
+}
+
+void SpooledBodyHandler::onEOM() noexcept {
+  eom_ = true;
+  maybeComplete();
+}
+
+void SpooledBodyHandler::write() {
+  if (writing_ || body_.empty()) {
+    return;
+  }
+  writing_ = true;
+  auto buf = body_.move();
+  auto length = buf->computeChainDataLength();
+  if (!options_.executor) {
+    return onWritten(appendToSpool(spool_->fd, options_.directory, *buf),
+                     length);
+  }
+
+  // Only one write is in flight at a time, so the file is not shared
+  auto spool = spool_;
+  auto directory = options_.directory;
+  auto eventBase = eventBase_;
+  auto wrapped = folly::makeMoveWrapper(std::move(buf));
+  options_.executor->add([spool, directory, eventBase, wrapped, length] {
+      int err = appendToSpool(spool->fd, directory, **wrapped);
+      eventBase->runInEventBaseThread([spool, err, length] {
+          if (spool->handler) {
+            spool->handler->onWritten(err, length);
+          }
+        });
+    });
+}
+
+void SpooledBodyHandler::onWritten(int err, size_t length) {
+  writing_ = false;
+  pendingBytes_ -= length;
+  if (failed_) {
+    return;
+  }
+  if (err != 0) {
+    LOG(ERROR) << "Failed to spool request body: " << folly::errnoStr(err);
+    return fail(500, "Internal Server Error");
+  }
+  if (paused_ && pendingBytes_ <= options_.maxPendingBytes / 2) {
+    paused_ = false;
+    downstream_->resumeIngress();
+  }
+  write();
+  maybeComplete();
+}
+
+void SpooledBodyHandler::maybeComplete() {
+  if (!eom_ || complete_ || failed_ ||
+      (spool_ && (writing_ || !body_.empty()))) {
+    return;
+  }
+  complete_ = true;
+  onBodyComplete();
+}
+
+void SpooledBodyHandler::fail(uint16_t code, const std::string& message) {
+  failed_ = true;
+  body_.move();
+  ResponseBuilder(downstream_)
+    .status(code, message)
+    .closeConnection()
+    .sendWithEOM();
+}
+
+}
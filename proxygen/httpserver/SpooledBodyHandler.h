@@ -0,0 +1,102 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/Executor.h>
+#include <folly/Range.h>
+#include <folly/io/IOBufQueue.h>
+#include <proxygen/httpserver/RequestHandler.h>
+
+namespace folly {
+class EventBase;
+}
+
+namespace proxygen {
+
+/**
+ * RequestHandler that gathers the whole request body before handing it to
+ * onBodyComplete(), as a handler appending each onBody() to a chain would,
+ * without holding large uploads in memory: once more than memoryLimit
+ * bytes came in, the body goes to an unlinked temporary file in directory
+ * instead, and is read back with getBodyFd() or mapBody().
+ *
+ * The writes run on executor, if given, or else inline in the IO thread.
+ * With an executor, ingress is paused while more than maxPendingBytes
+ * wait to be written, so that memory stays flat when the disk is slower
+ * than the uploads.
+ *
+ * A body over maxBodySize, if not 0, fails the request with 413, and a
+ * write error with 500; onBodyComplete() is not called then. Subclasses
+ * implement onRequest(), requestComplete() and onError() as any handler,
+ * and get onBodyComplete() in place of onEOM().
+ */
+class SpooledBodyHandler : public RequestHandler {
+ public:
+  struct Options {
+    size_t memoryLimit{1024 * 1024};
+    std::string directory{"/tmp"};
+    folly::Executor* executor{nullptr};
+    size_t maxPendingBytes{1024 * 1024};
+    size_t maxBodySize{0};
+  };
+
+  explicit SpooledBodyHandler(const Options& options = Options());
+  ~SpooledBodyHandler() override;
+
+  // All of the body is in, and can be read with the methods below
+  virtual void onBodyComplete() noexcept = 0;
+
+  size_t getBodyLength() const { return length_; }
+
+  bool isSpooled() const { return spool_ != nullptr; }
+
+  // The body, if it was kept in memory; nullptr if spooled or empty
+  std::unique_ptr<folly::IOBuf> takeBody();
+
+  // The file of a spooled body, to read from until destroyed; -1 if not
+  int getBodyFd() const;
+
+  /**
+   * The whole body, mapped from its file if it was spooled, valid until
+   * destroyed or takeBody(); empty if it could not be mapped.
+   */
+  folly::ByteRange mapBody();
+
+  // RequestHandler
+  void onBody(std::unique_ptr<folly::IOBuf> body) noexcept override;
+  void onUpgrade(UpgradeProtocol protocol) noexcept override {}
+  void onEOM() noexcept override;
+
+ private:
+  struct Spool;
+
+  void write();
+  void onWritten(int err, size_t length);
+  void maybeComplete();
+  void fail(uint16_t code, const std::string& message);
+
+  const Options options_;
+  folly::EventBase* eventBase_{nullptr};
+  // The file, shared with the writes in flight
+  std::shared_ptr<Spool> spool_;
+  // The body, or once spooled what is still to be written
+  folly::IOBufQueue body_{folly::IOBufQueue::cacheChainLength()};
+  size_t length_{0};
+  // Waiting to be written or being written
+  size_t pendingBytes_{0};
+  void* mapping_{nullptr};
+  bool writing_{false};
+  bool paused_{false};
+  bool eom_{false};
+  bool complete_{false};
+  bool failed_{false};
+};
+
+}
@@ -0,0 +1,409 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/Memory.h>
+#include <proxygen/httpserver/RequestHandler.h>
+#include <proxygen/httpserver/RequestHandlerFactory.h>
+#include <proxygen/httpserver/ResponseHandler.h>
+#include <tuple>
+#include <type_traits>
+
+namespace proxygen {
+
+/**
+ * The filters of a StaticFilterChain. Where a chain of Filters is one
+ * object per filter, each calling the next through RequestHandler and
+ * ResponseHandler, a StaticFilterChain holds all of its filters in one
+ * object, and each of them calls the next one directly: the methods of a
+ * StaticFilter get the next step on the way, whose type is known at
+ * compile time. Only going into and out of the chain is virtual.
+ *
+ * Filters hide the methods they act on, and call the same method of next
+ * to pass things on, or not. The default implementation just lets
+ * everything pass through. requestComplete() and onError() only tell the
+ * filter, the chain passes them to the handler itself. For example
+ *
+ *   class BodyCounter : public StaticFilter {
+ *    public:
+ *     template <typename Next>
+ *     void onBody(Next& next, std::unique_ptr<folly::IOBuf> body) noexcept {
+ *       bytes_ += body->computeChainDataLength();
+ *       next.onBody(std::move(body));
+ *     }
+ *     ...
+ *   };
+ */
+class StaticFilter {
+ public:
+  // Towards the handler
+  template <typename Next>
+  void onRequest(Next& next, std::unique_ptr<HTTPMessage> headers) noexcept {
+    next.onRequest(std::move(headers));
+  }
+
+  template <typename Next>
+  void onBody(Next& next, std::unique_ptr<folly::IOBuf> body) noexcept {
+    next.onBody(std::move(body));
+  }
+
+  template <typename Next>
+  void onUpgrade(Next& next, UpgradeProtocol protocol) noexcept {
+    next.onUpgrade(protocol);
+  }
+
+  template <typename Next>
+  void onEOM(Next& next) noexcept {
+    next.onEOM();
+  }
+
+  template <typename Next>
+  void onEgressPaused(Next& next) noexcept {
+    next.onEgressPaused();
+  }
+
+  template <typename Next>
+  void onEgressResumed(Next& next) noexcept {
+    next.onEgressResumed();
+  }
+
+  void requestComplete() noexcept {}
+
+  void onError(ProxygenError err) noexcept {}
+
+  // Towards the client
+  template <typename Next>
+  void sendHeaders(Next& next, HTTPMessage& msg) noexcept {
+    next.sendHeaders(msg);
+  }
+
+  template <typename Next>
+  void sendChunkHeader(Next& next, size_t len) noexcept {
+    next.sendChunkHeader(len);
+  }
+
+  template <typename Next>
+  void sendBody(Next& next, std::unique_ptr<folly::IOBuf> body) noexcept {
+    next.sendBody(std::move(body));
+  }
+
+  template <typename Next>
+  void sendChunkTerminator(Next& next) noexcept {
+    next.sendChunkTerminator();
+  }
+
+  template <typename Next>
+  void sendEOM(Next& next) noexcept {
+    next.sendEOM();
+  }
+
+  template <typename Next>
+  void sendAbort(Next& next) noexcept {
+    next.sendAbort();
+  }
+};
+
+/**
+ * Filters, client side first, in front of the handler of a request, as
+ * one object. It is created for a request by a StaticFilterChainFactory,
+ * and deletes itself once the request is done, like a Filter. Everything
+ * but the calls that filters hide goes straight to the handler or the
+ * client.
+ */
+template <typename... Filters>
+class StaticFilterChain : public RequestHandler, public ResponseHandler {
+ public:
+  StaticFilterChain(RequestHandler* upstream,
+                    const std::tuple<Filters...>& filters)
+      : ResponseHandler(upstream),
+        filters_(filters) {
+  }
+
+  template <size_t I>
+  typename std::tuple_element<I, std::tuple<Filters...>>::type& getFilter() {
+    return std::get<I>(filters_);
+  }
+
+  // Request handler
+  void setResponseHandler(ResponseHandler* handler) noexcept override {
+    downstream_ = handler;
+    upstream_->setResponseHandler(this);
+  }
+
+  void onRequest(std::unique_ptr<HTTPMessage> headers) noexcept override {
+    Up<0>{*this}.onRequest(std::move(headers));
+  }
+
+  void onBody(std::unique_ptr<folly::IOBuf> body) noexcept override {
+    Up<0>{*this}.onBody(std::move(body));
+  }
+
+  void onUpgrade(UpgradeProtocol protocol) noexcept override {
+    Up<0>{*this}.onUpgrade(protocol);
+  }
+
+  void onEOM() noexcept override {
+    Up<0>{*this}.onEOM();
+  }
+
+  void requestComplete() noexcept override {
+    Up<0>{*this}.requestComplete();
+    downstream_ = nullptr;
+    upstream_->requestComplete();
+    delete this;
+  }
+
+  void onError(ProxygenError err) noexcept override {
+    Up<0>{*this}.onError(err);
+    downstream_ = nullptr;
+    upstream_->onError(err);
+    delete this;
+  }
+
+  void onEgressPaused() noexcept override {
+    Up<0>{*this}.onEgressPaused();
+  }
+
+  void onEgressResumed() noexcept override {
+    Up<0>{*this}.onEgressResumed();
+  }
+
+  size_t getBodyBatchSize() const noexcept override {
+    return upstream_->getBodyBatchSize();
+  }
+
+  // Response handler
+  using ResponseHandler::sendHeaders;
+
+  void sendHeaders(HTTPMessage& msg) noexcept override {
+    Down<kNumFilters>{*this}.sendHeaders(msg);
+  }
+
+  void sendChunkHeader(size_t len) noexcept override {
+    Down<kNumFilters>{*this}.sendChunkHeader(len);
+  }
+
+  void sendBody(std::unique_ptr<folly::IOBuf> body) noexcept override {
+    Down<kNumFilters>{*this}.sendBody(std::move(body));
+  }
+
+  void sendChunkTerminator() noexcept override {
+    Down<kNumFilters>{*this}.sendChunkTerminator();
+  }
+
+  void sendEOM() noexcept override {
+    Down<kNumFilters>{*this}.sendEOM();
+  }
+
+  void sendAbort() noexcept override {
+    Down<kNumFilters>{*this}.sendAbort();
+  }
+
+  void refreshTimeout() noexcept override {
+    downstream_->refreshTimeout();
+  }
+
+  void pauseIngress() noexcept override {
+    downstream_->pauseIngress();
+  }
+
+  void resumeIngress() noexcept override {
+    downstream_->resumeIngress();
+  }
+
+  ResponseHandler* newPushedResponse(
+      PushHandler* pushHandler) noexcept override {
+    return downstream_->newPushedResponse(pushHandler);
+  }
+
+  folly::SysArena* getArena() noexcept override {
+    return downstream_->getArena();
+  }
+
+  const folly::TransportInfo& getSetupTransportInfo() const noexcept override {
+    return downstream_->getSetupTransportInfo();
+  }
+
+  void getCurrentTransportInfo(folly::TransportInfo* tinfo) const override {
+    downstream_->getCurrentTransportInfo(tinfo);
+  }
+
+ private:
+  static const size_t kNumFilters = sizeof...(Filters);
+
+  // The way towards the handler from filter I on: filter I, or the handler
+  // past the last one
+  template <size_t I, typename Enable = void>
+  struct Up {
+    StaticFilterChain& chain;
+
+    Up<I + 1> next() {
+      return Up<I + 1>{chain};
+    }
+
+    void onRequest(std::unique_ptr<HTTPMessage> headers) noexcept {
+      auto up = next();
+      chain.template getFilter<I>().onRequest(up, std::move(headers));
+    }
+    void onBody(std::unique_ptr<folly::IOBuf> body) noexcept {
+      auto up = next();
+      chain.template getFilter<I>().onBody(up, std::move(body));
+    }
+    void onUpgrade(UpgradeProtocol protocol) noexcept {
+      auto up = next();
+      chain.template getFilter<I>().onUpgrade(up, protocol);
+    }
+    void onEOM() noexcept {
+      auto up = next();
+      chain.template getFilter<I>().onEOM(up);
+    }
+    void onEgressPaused() noexcept {
+      auto up = next();
+      chain.template getFilter<I>().onEgressPaused(up);
+    }
+    void onEgressResumed() noexcept {
+      auto up = next();
+      chain.template getFilter<I>().onEgressResumed(up);
+    }
+    void requestComplete() noexcept {
+      chain.template getFilter<I>().requestComplete();
+      next().requestComplete();
+    }
+    void onError(ProxygenError err) noexcept {
+      chain.template getFilter<I>().onError(err);
+      next().onError(err);
+    }
+  };
+
+  template <size_t I>
+  struct Up<I, typename std::enable_if<I == kNumFilters>::type> {
+    StaticFilterChain& chain;
+
+    void onRequest(std::unique_ptr<HTTPMessage> headers) noexcept {
+      chain.upstream_->onRequest(std::move(headers));
+    }
+    void onBody(std::unique_ptr<folly::IOBuf> body) noexcept {
+      chain.upstream_->onBody(std::move(body));
+    }
+    void onUpgrade(UpgradeProtocol protocol) noexcept {
+      chain.upstream_->onUpgrade(protocol);
+    }
+    void onEOM() noexcept {
+      chain.upstream_->onEOM();
+    }
+    void onEgressPaused() noexcept {
+      chain.upstream_->onEgressPaused();
+    }
+    void onEgressResumed() noexcept {
+      chain.upstream_->onEgressResumed();
+    }
+    // The chain tells the handler itself
+    void requestComplete() noexcept {}
+    void onError(ProxygenError err) noexcept {}
+  };
+
+  // The way towards the client from before filter I: filter I - 1, or the
+  // client before the first one
+  template <size_t I, typename Enable = void>
+  struct Down {
+    StaticFilterChain& chain;
+
+    Down<I - 1> next() {
+      return Down<I - 1>{chain};
+    }
+
+    void sendHeaders(HTTPMessage& msg) noexcept {
+      auto down = next();
+      chain.template getFilter<I - 1>().sendHeaders(down, msg);
+    }
+    void sendChunkHeader(size_t len) noexcept {
+      auto down = next();
+      chain.template getFilter<I - 1>().sendChunkHeader(down, len);
+    }
+    void sendBody(std::unique_ptr<folly::IOBuf> body) noexcept {
+      auto down = next();
+      chain.template getFilter<I - 1>().sendBody(down, std::move(body));
+    }
+    void sendChunkTerminator() noexcept {
+      auto down = next();
+      chain.template getFilter<I - 1>().sendChunkTerminator(down);
+    }
+    void sendEOM() noexcept {
+      auto down = next();
+      chain.template getFilter<I - 1>().sendEOM(down);
+    }
+    void sendAbort() noexcept {
+      auto down = next();
+      chain.template getFilter<I - 1>().sendAbort(down);
+    }
+  };
+
+  template <size_t I>
+  struct Down<I, typename std::enable_if<I == 0>::type> {
+    StaticFilterChain& chain;
+
+    void sendHeaders(HTTPMessage& msg) noexcept {
+      chain.downstream_->sendHeaders(msg);
+    }
+    void sendChunkHeader(size_t len) noexcept {
+      chain.downstream_->sendChunkHeader(len);
+    }
+    void sendBody(std::unique_ptr<folly::IOBuf> body) noexcept {
+      chain.downstream_->sendBody(std::move(body));
+    }
+    void sendChunkTerminator() noexcept {
+      chain.downstream_->sendChunkTerminator();
+    }
+    void sendEOM() noexcept {
+      chain.downstream_->sendEOM();
+    }
+    void sendAbort() noexcept {
+      chain.downstream_->sendAbort();
+    }
+  };
+
+  std::tuple<Filters...> filters_;
+};
+
+/**
+ * Puts a StaticFilterChain of copies of filters in front of the handler of
+ * every request, where a RequestHandlerChain would have one factory per
+ * filter, eg.
+ *
+ *   options.handlerFactories = RequestHandlerChain()
+ *     .addThen<StaticFilterChainFactory<BodyCounter, Tracer>>()
+ *     .addThen<MyHandlerFactory>()
+ *     .build();
+ *
+ * The runtime configured Filters and their factories work as before, in
+ * the same chain.
+ */
+template <typename... Filters>
+class StaticFilterChainFactory : public RequestHandlerFactory {
+ public:
+  // The filters to copy for each request, or default constructed ones
+  template <typename... Args>
+  explicit StaticFilterChainFactory(Args&&... args)
+      : filters_(std::forward<Args>(args)...) {
+  }
+
+  void onServerStart() noexcept override {}
+
+  void onServerStop() noexcept override {}
+
+  RequestHandler* onRequest(RequestHandler* h, HTTPMessage*) noexcept override {
+    return new StaticFilterChain<Filters...>(h, filters_);
+  }
+
+ private:
+  std::tuple<Filters...> filters_;
+};
+
+}
@@ -0,0 +1,155 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/httpserver/WebSocketHandler.h>
+
+#include <proxygen/httpserver/ResponseBuilder.h>
+
+using folly::IOBuf;
+using folly::StringPiece;
+using std::string;
+using std::unique_ptr;
+
+namespace proxygen {
+
+WebSocketHandler::WebSocketHandler(const Options& options)
+    : options_(options) {
+  codec_.setCallback(this);
+  codec_.setMaxMessageSize(options_.maxMessageSize);
+  codec_.setMaxEgressFrameSize(options_.maxFrameSize);
+}
+
+void WebSocketHandler::onRequest(unique_ptr<HTTPMessage> headers) noexcept {
+  const auto& reqHeaders = headers->getHeaders();
+  const string& key = reqHeaders.getSingleOrEmpty("Sec-WebSocket-Key");
+  if (headers->getMethod() != HTTPMethod::GET ||
+      !headers->isHTTP1_1() ||
+      !headers->checkForHeaderToken(HTTP_HEADER_UPGRADE, "websocket",
+                                    false) ||
+      !headers->checkForHeaderToken(HTTP_HEADER_CONNECTION, "upgrade",
+                                    false) ||
+      reqHeaders.getSingleOrEmpty("Sec-WebSocket-Version") != "13" ||
+      key.empty()) {
+    VLOG(4) << "not a WebSocket handshake";
+    state_ = State::REJECTED;
+    ResponseBuilder(downstream_)
+      .status(400, "Bad Request")
+      .header("Sec-WebSocket-Version", "13")
+      .sendWithEOM();
+    return;
+  }
+
+  ResponseBuilder response(downstream_);
+  response.status(101, "Switching Protocols")
+    .header(HTTP_HEADER_UPGRADE, "websocket")
+    .header(HTTP_HEADER_CONNECTION, "Upgrade")
+    .header("Sec-WebSocket-Accept", WebSocketCodec::computeAccept(key));
+  const string& offers =
+    reqHeaders.getSingleOrEmpty("Sec-WebSocket-Extensions");
+  if (options_.acceptDeflate && !offers.empty()) {
+    WebSocketCodec::DeflateOptions deflate = options_.deflate;
+    string extension = WebSocketCodec::negotiateDeflate(offers, deflate);
+    if (!extension.empty()) {
+      codec_.setDeflateOptions(deflate);
+      response.header("Sec-WebSocket-Extensions", extension);
+    }
+  }
+  // 101 upgrades the codec of the session as it goes out: what follows
+  // the request comes to onBody()
+  response.send();
+}
+
+void WebSocketHandler::onUpgrade(UpgradeProtocol protocol) noexcept {
+  if (state_ != State::HANDSHAKE) {
+    return;
+  }
+  state_ = State::OPEN;
+  onOpen();
+}
+
+void WebSocketHandler::onBody(unique_ptr<IOBuf> body) noexcept {
+  if (state_ != State::OPEN && state_ != State::CLOSING) {
+    // The body of a rejected request
+    return;
+  }
+  codec_.onIngress(std::move(body));
+  flush();
+}
+
+void WebSocketHandler::onEOM() noexcept {
+  if (state_ == State::OPEN || state_ == State::CLOSING) {
+    // The client shut down its side without a CLOSE
+    finish(WebSocketCodec::kCloseAbnormal);
+  }
+}
+
+void WebSocketHandler::sendMessage(WebSocketCodec::Opcode opcode,
+                                   unique_ptr<IOBuf> payload) {
+  if (state_ != State::OPEN) {
+    return;
+  }
+  codec_.generateMessage(writeBuf_, opcode, std::move(payload));
+  flush();
+}
+
+void WebSocketHandler::sendPing(unique_ptr<IOBuf> payload) {
+  if (state_ != State::OPEN) {
+    return;
+  }
+  codec_.generatePing(writeBuf_, std::move(payload));
+  flush();
+}
+
+void WebSocketHandler::close(uint16_t code, StringPiece reason) {
+  if (state_ != State::OPEN) {
+    return;
+  }
+  codec_.generateClose(writeBuf_, code, reason);
+  state_ = State::CLOSING;
+  flush();
+}
+
+void WebSocketHandler::onPing(unique_ptr<IOBuf> payload) {
+  if (state_ == State::OPEN) {
+    codec_.generatePong(writeBuf_, std::move(payload));
+  }
+}
+
+void WebSocketHandler::onClose(uint16_t code, StringPiece reason) {
+  if (state_ == State::OPEN) {
+    // Echo the code, as the RFC suggests
+    codec_.generateClose(writeBuf_, code);
+  }
+  finish(code);
+}
+
+void WebSocketHandler::onError(uint16_t code, const string& reason) {
+  if (state_ == State::OPEN) {
+    codec_.generateClose(writeBuf_, code, reason);
+  }
+  finish(code);
+}
+
+void WebSocketHandler::flush() {
+  if (!writeBuf_.empty() && state_ != State::CLOSED) {
+    downstream_->sendBody(writeBuf_.move());
+  }
+}
+
+void WebSocketHandler::finish(uint16_t code) {
+  if (state_ == State::CLOSED) {
+    return;
+  }
+  flush();
+  state_ = State::CLOSED;
+  onClosing(code);
+  downstream_->sendEOM();
+}
+
+}
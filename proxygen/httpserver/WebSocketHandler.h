@@ -0,0 +1,103 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <proxygen/httpserver/RequestHandler.h>
+#include <proxygen/lib/http/codec/WebSocketCodec.h>
+
+namespace proxygen {
+
+/**
+ * RequestHandler of WebSocket requests over HTTP/1.1. It answers the
+ * opening handshake, negotiating permessage-deflate if the client offers
+ * it, and then frames the upgraded connection with a WebSocketCodec:
+ * subclasses get the messages of the client in onMessage() and send
+ * theirs with sendMessage(). Pings are answered, and a CLOSE from the
+ * client is echoed before the connection ends. As any handler, it is done
+ * in requestComplete() or onError(), which subclasses implement.
+ *
+ * Requests that are not a valid handshake get a 400.
+ */
+class WebSocketHandler : public RequestHandler,
+                         private WebSocketCodec::Callback {
+ public:
+  struct Options {
+    // Accept permessage-deflate offers, with these egress parameters
+    bool acceptDeflate{true};
+    WebSocketCodec::DeflateOptions deflate;
+    size_t maxMessageSize{1024 * 1024};
+    // 0 sends every message in one frame
+    size_t maxFrameSize{0};
+  };
+
+  explicit WebSocketHandler(const Options& options = Options());
+
+  // The handshake is done: messages can be sent
+  virtual void onOpen() noexcept {}
+
+  // A TEXT or BINARY message from the client
+  virtual void onMessage(WebSocketCodec::Opcode opcode,
+                         std::unique_ptr<folly::IOBuf> payload) noexcept = 0;
+
+  /**
+   * The WebSocket is closing: the client sent or answered a CLOSE with
+   * code, broke the protocol, or went away (kCloseAbnormal). Nothing
+   * more can be sent.
+   */
+  virtual void onClosing(uint16_t code) noexcept {}
+
+  bool isOpen() const { return state_ == State::OPEN; }
+
+  // Dropped unless isOpen()
+  void sendMessage(WebSocketCodec::Opcode opcode,
+                   std::unique_ptr<folly::IOBuf> payload);
+
+  void sendText(folly::StringPiece text) {
+    sendMessage(WebSocketCodec::Opcode::TEXT,
+                folly::IOBuf::copyBuffer(text.data(), text.size()));
+  }
+
+  void sendPing(std::unique_ptr<folly::IOBuf> payload = nullptr);
+
+  // Send a CLOSE, and end the connection once the client answers it
+  void close(uint16_t code = WebSocketCodec::kCloseNormal,
+             folly::StringPiece reason = folly::StringPiece());
+
+  // RequestHandler
+  void onRequest(std::unique_ptr<HTTPMessage> headers) noexcept override;
+  void onBody(std::unique_ptr<folly::IOBuf> body) noexcept override;
+  void onUpgrade(UpgradeProtocol protocol) noexcept override;
+  void onEOM() noexcept override;
+
+ private:
+  enum class State : uint8_t {
+    HANDSHAKE,
+    REJECTED,
+    OPEN,
+    // CLOSE sent, waiting for the answer
+    CLOSING,
+    CLOSED,
+  };
+
+  // WebSocketCodec::Callback, but for onMessage() above
+  void onPing(std::unique_ptr<folly::IOBuf> payload) override;
+  void onClose(uint16_t code, folly::StringPiece reason) override;
+  void onError(uint16_t code, const std::string& reason) override;
+
+  void flush();
+  void finish(uint16_t code);
+
+  Options options_;
+  WebSocketCodec codec_{TransportDirection::DOWNSTREAM};
+  folly::IOBufQueue writeBuf_{folly::IOBufQueue::cacheChainLength()};
+  State state_{State::HANDSHAKE};
+};
+
+}
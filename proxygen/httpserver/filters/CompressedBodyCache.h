@@ -0,0 +1,100 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/io/IOBuf.h>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace proxygen {
+
+/**
+ * Compressed response bodies, so that ZlibServerFilter compresses a static
+ * asset once rather than on every request for it. Entries are keyed by the
+ * content coding and the strong ETag of the response, which must change
+ * whenever the body does.
+ *
+ * One cache can be shared by all the threads of a server. When the bodies
+ * it holds add up to more than its capacity, the least recently used are
+ * evicted.
+ */
+class CompressedBodyCache {
+ public:
+  // capacity is in bytes of compressed bodies
+  explicit CompressedBodyCache(size_t capacity)
+      : capacity_(capacity) {}
+
+  /**
+   * The cached body for key, or nullptr.
+   */
+  std::unique_ptr<folly::IOBuf> get(const std::string& key) {
+    std::lock_guard<std::mutex> g(lock_);
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+      return nullptr;
+    }
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return it->second->body->clone();
+  }
+
+  /**
+   * Store body under key, unless it is larger than the whole cache.
+   */
+  void put(const std::string& key, std::unique_ptr<folly::IOBuf> body) {
+    size_t size = body->computeChainDataLength();
+    if (size > capacity_) {
+      return;
+    }
+    std::lock_guard<std::mutex> g(lock_);
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+      size_ -= it->second->size;
+      entries_.erase(it->second);
+      index_.erase(it);
+    }
+    entries_.push_front(Entry{key, std::move(body), size});
+    index_[key] = entries_.begin();
+    size_ += size;
+    while (size_ > capacity_) {
+      size_ -= entries_.back().size;
+      index_.erase(entries_.back().key);
+      entries_.pop_back();
+    }
+  }
+
+  // The bytes of compressed bodies held
+  size_t size() const {
+    std::lock_guard<std::mutex> g(lock_);
+    return size_;
+  }
+
+  static std::string makeKey(const std::string& encoding,
+                             const std::string& etag) {
+    return encoding + " " + etag;
+  }
+
+ private:
+  struct Entry {
+    std::string key;
+    std::unique_ptr<folly::IOBuf> body;
+    size_t size;
+  };
+
+  const size_t capacity_;
+  mutable std::mutex lock_;
+  size_t size_{0};
+  // most recently used first
+  std::list<Entry> entries_;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+};
+
+}
@@ -0,0 +1,143 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/io/IOBuf.h>
+#include <folly/io/async/EventBaseManager.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace proxygen {
+
+/**
+ * Picks the compression level of each response of a ZlibServerFilter from
+ * how busy the event loop of its thread is and how large the response
+ * is, trading bandwidth for CPU as the load goes up: maxLevel while the
+ * loop is idle, down to minLevel as its average loop time
+ * (EventBase::getAvgLoopTime(), which WorkerLoadTracker weighs too)
+ * reaches fullLoadLoopTime. Large responses, and those of unknown length,
+ * take the longest to compress and step down twice as fast. A minLevel of
+ * 0 leaves responses uncompressed at full load.
+ *
+ * It also spots bodies that are compressed already, such as images or
+ * archives sent with a compressible content type, by the entropy of a
+ * sample of their bytes.
+ *
+ * Levels are those of the content coding, as for the fixed level of the
+ * filter.
+ */
+class CompressionLevelController {
+ public:
+  struct Options {
+    int minLevel{1};
+    // -1 is zlib's default, 6
+    int maxLevel{6};
+    std::chrono::microseconds fullLoadLoopTime{2000};
+    size_t largeResponseSize{256 * 1024};
+    // Bits per byte above which a body is taken as compressed; over 8
+    // never samples
+    double maxEntropy{7.5};
+    size_t entropySampleSize{1024};
+  };
+
+  // Too few bytes to tell compressed data from anything else
+  static const size_t kMinEntropySample = 256;
+
+  explicit CompressionLevelController(const Options& options)
+      : options_(options) {
+    if (options_.maxLevel < 0) {
+      options_.maxLevel = 6;
+    }
+    options_.minLevel = std::min(std::max(options_.minLevel, 0),
+                                 options_.maxLevel);
+  }
+
+  // From 0, idle, to 1, of the event loop of this thread
+  double getLoad() const {
+    auto evb = folly::EventBaseManager::get()->getExistingEventBase();
+    if (!evb || options_.fullLoadLoopTime.count() <= 0) {
+      return 0;
+    }
+    return std::min(1.0, evb->getAvgLoopTime() /
+                    options_.fullLoadLoopTime.count());
+  }
+
+  /**
+   * The level to compress a response of length bytes, 0 if unknown, with
+   * under load; 0 not to compress it.
+   */
+  int pickLevel(double load, size_t length) const {
+    if (length == 0 || length >= options_.largeResponseSize) {
+      load = std::min(1.0, load * 2);
+    }
+    double range = options_.maxLevel - options_.minLevel;
+    return int(std::lround(options_.maxLevel - range * load));
+  }
+
+  int pickLevel(size_t length) const {
+    return pickLevel(getLoad(), length);
+  }
+
+  // Whether body looks compressed already, so not worth compressing
+  bool looksCompressed(const folly::IOBuf& body) const {
+    if (options_.maxEntropy >= 8) {
+      return false;
+    }
+    return sampleEntropy(body, options_.entropySampleSize) >
+      options_.maxEntropy;
+  }
+
+  bool samplesEntropy() const {
+    return options_.maxEntropy < 8;
+  }
+
+  /**
+   * The Shannon entropy, in bits per byte, of about sampleSize bytes
+   * spread evenly over chain, or -1 if it has less than kMinEntropySample
+   * of them.
+   */
+  static double sampleEntropy(const folly::IOBuf& chain, size_t sampleSize) {
+    size_t total = chain.computeChainDataLength();
+    if (total < kMinEntropySample) {
+      return -1;
+    }
+    size_t stride = std::max<size_t>(1, total / std::max<size_t>(
+                                          sampleSize, kMinEntropySample));
+    uint32_t counts[256] = {0};
+    size_t samples = 0;
+    // Offset into the current buffer of the next byte to sample
+    size_t offset = 0;
+    const folly::IOBuf* buf = &chain;
+    do {
+      for (; offset < buf->length(); offset += stride) {
+        ++counts[buf->data()[offset]];
+        ++samples;
+      }
+      offset -= buf->length();
+      buf = buf->next();
+    } while (buf != &chain);
+
+    double entropy = 0;
+    for (auto count : counts) {
+      if (count > 0) {
+        double p = double(count) / samples;
+        entropy -= p * std::log2(p);
+      }
+    }
+    return entropy;
+  }
+
+ private:
+  Options options_;
+};
+
+}
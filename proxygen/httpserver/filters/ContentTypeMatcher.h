@@ -0,0 +1,164 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/Range.h>
+#include <folly/String.h>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace proxygen {
+
+/**
+ * Matches the media type of Content-Type values against a set of them,
+ * case-insensitively and ignoring their parameters. The set may have
+ * wildcards: "text/*" matches all the text subtypes, and a wildcard type
+ * with a wildcard subtype anything.
+ *
+ * The types are hashed into open addressing tables when the matcher is
+ * built, so that matches() is one pass over the value to hash it, without
+ * copying or lowercasing it, and one or two probes.
+ */
+class ContentTypeMatcher {
+ public:
+  ContentTypeMatcher() {}
+
+  explicit ContentTypeMatcher(const std::set<std::string>& types) {
+    std::vector<std::string> exact;
+    std::vector<std::string> wildcards;
+    for (auto type: types) {
+      folly::toLowerAscii(type);
+      if (type == "*/*") {
+        any_ = true;
+      } else if (folly::StringPiece(type).endsWith("/*")) {
+        type.resize(type.size() - 2);
+        wildcards.push_back(std::move(type));
+      } else {
+        exact.push_back(std::move(type));
+      }
+    }
+    exact_ = makeTable(exact);
+    wildcards_ = makeTable(wildcards);
+  }
+
+  bool matches(folly::StringPiece contentType) const noexcept {
+    if (any_) {
+      return true;
+    }
+    const char* p = contentType.begin();
+    const char* end = contentType.end();
+    while (p != end && (*p == ' ' || *p == '\t')) {
+      ++p;
+    }
+    const char* start = p;
+    const char* slash = nullptr;
+    uint64_t hash = kHashSeed;
+    uint64_t typeHash = kHashSeed;
+    for (; p != end && *p != ';' && *p != ' ' && *p != '\t'; ++p) {
+      if (*p == '/' && !slash) {
+        slash = p;
+        typeHash = hash;
+      }
+      hash = hashByte(hash, *p);
+    }
+    folly::StringPiece mediaType(start, p);
+    if (find(exact_, hash, mediaType)) {
+      return true;
+    }
+    return slash &&
+      find(wildcards_, typeHash, folly::StringPiece(start, slash));
+  }
+
+ private:
+  // FNV-1a, of the lowercase bytes
+  static const uint64_t kHashSeed = 14695981039346656037ULL;
+
+  static char toLower(char c) {
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+  }
+
+  static uint64_t hashByte(uint64_t hash, char c) {
+    return (hash ^ uint8_t(toLower(c))) * 1099511628211ULL;
+  }
+
+  // lower is lowercase already
+  static bool equalsLowercase(folly::StringPiece s, const std::string& lower) {
+    if (s.size() != lower.size()) {
+      return false;
+    }
+    for (size_t i = 0; i < s.size(); i++) {
+      if (toLower(s[i]) != lower[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static uint64_t hashOf(folly::StringPiece s) {
+    uint64_t hash = kHashSeed;
+    for (char c: s) {
+      hash = hashByte(hash, c);
+    }
+    return hash;
+  }
+
+  struct Entry {
+    uint64_t hash{0};
+    std::string type;
+  };
+
+  // An empty type is an empty slot: there is always one, the table being
+  // at least twice as large as what it holds
+  static std::vector<Entry> makeTable(std::vector<std::string>& types) {
+    std::vector<Entry> table;
+    if (types.empty()) {
+      return table;
+    }
+    size_t size = 2;
+    while (size < types.size() * 2) {
+      size *= 2;
+    }
+    table.resize(size);
+    for (auto& type: types) {
+      if (type.empty()) {
+        continue;
+      }
+      auto hash = hashOf(type);
+      size_t i = hash & (size - 1);
+      while (!table[i].type.empty()) {
+        i = (i + 1) & (size - 1);
+      }
+      table[i].hash = hash;
+      table[i].type = std::move(type);
+    }
+    return table;
+  }
+
+  static bool find(const std::vector<Entry>& table, uint64_t hash,
+                   folly::StringPiece type) {
+    if (table.empty()) {
+      return false;
+    }
+    size_t mask = table.size() - 1;
+    for (size_t i = hash & mask; !table[i].type.empty(); i = (i + 1) & mask) {
+      if (table[i].hash == hash && equalsLowercase(type, table[i].type)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::vector<Entry> exact_;
+  std::vector<Entry> wildcards_;
+  bool any_{false};
+};
+
+}
@@ -0,0 +1,341 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/Baton.h>
+#include <folly/Executor.h>
+#include <folly/MoveWrapper.h>
+#include <folly/io/async/EventBaseManager.h>
+#include <deque>
+#include <mutex>
+#include <proxygen/httpserver/Filters.h>
+#include <proxygen/httpserver/RequestHandlerFactory.h>
+
+namespace proxygen {
+
+/**
+ * A filter that runs the RequestHandler upstream of it on an executor
+ * (say a CPU thread pool) instead of the IO thread of its session, so
+ * that a slow handler doesn't hold up every other connection of that
+ * thread.
+ *
+ * The callbacks of the handler run one at a time and in order, though not
+ * necessarily all in the same thread. Whatever the handler sends is
+ * queued and handed back to the IO thread in batches, one hop for all
+ * that was sent meanwhile.
+ *
+ * Backpressure: request body waiting for the handler is capped at
+ * maxIngressBytes, beyond which ingress is paused, and egress pause and
+ * resume are passed on to the handler like any other callback.
+ */
+class OffloadFilter : public Filter {
+ public:
+  OffloadFilter(RequestHandler* upstream,
+                folly::Executor* executor,
+                uint64_t maxIngressBytes)
+      : Filter(CHECK_NOTNULL(upstream)),
+        executor_(executor),
+        eventBase_(folly::EventBaseManager::get()->getExistingEventBase()),
+        maxIngressBytes_(maxIngressBytes) {
+    CHECK(eventBase_);
+  }
+
+  // RequestHandler methods, invoked in the IO thread
+
+  void onRequest(std::unique_ptr<HTTPMessage> headers) noexcept override {
+    setupTransportInfo_ = downstream_->getSetupTransportInfo();
+    auto msg = folly::makeMoveWrapper(std::move(headers));
+    runUpstream([this, msg] () mutable {
+        upstream_->onRequest(std::move(*msg));
+      });
+  }
+
+  void onBody(std::unique_ptr<folly::IOBuf> body) noexcept override {
+    auto len = body->computeChainDataLength();
+    ingressBytes_ += len;
+    if (!ingressFull_ && ingressBytes_ > maxIngressBytes_) {
+      ingressFull_ = true;
+      updateIngressPaused();
+    }
+    auto buf = folly::makeMoveWrapper(std::move(body));
+    runUpstream([this, buf, len] () mutable {
+        upstream_->onBody(std::move(*buf));
+        sendDownstream([this, len] { ingressBodyProcessed(len); });
+      });
+  }
+
+  void onUpgrade(UpgradeProtocol protocol) noexcept override {
+    runUpstream([this, protocol] { upstream_->onUpgrade(protocol); });
+  }
+
+  void onEOM() noexcept override {
+    runUpstream([this] { upstream_->onEOM(); });
+  }
+
+  void requestComplete() noexcept override {
+    downstream_ = nullptr;
+    runUpstream([this] { upstream_->requestComplete(); }, true);
+  }
+
+  void onError(ProxygenError err) noexcept override {
+    downstream_ = nullptr;
+    runUpstream([this, err] { upstream_->onError(err); }, true);
+  }
+
+  void onEgressPaused() noexcept override {
+    runUpstream([this] { upstream_->onEgressPaused(); });
+  }
+
+  void onEgressResumed() noexcept override {
+    runUpstream([this] { upstream_->onEgressResumed(); });
+  }
+
+  // ResponseHandler methods, invoked by the handler from the executor
+
+  void sendHeaders(HTTPMessage& msg) noexcept override {
+    sendHeaders(folly::make_unique<HTTPMessage>(msg));
+  }
+
+  void sendHeaders(std::unique_ptr<HTTPMessage> msg) noexcept override {
+    auto headers = folly::makeMoveWrapper(std::move(msg));
+    sendDownstream([this, headers] () mutable {
+        if (downstream_) {
+          downstream_->sendHeaders(std::move(*headers));
+        }
+      });
+  }
+
+  void sendChunkHeader(size_t len) noexcept override {
+    sendDownstream([this, len] {
+        if (downstream_) {
+          downstream_->sendChunkHeader(len);
+        }
+      });
+  }
+
+  void sendBody(std::unique_ptr<folly::IOBuf> body) noexcept override {
+    auto buf = folly::makeMoveWrapper(std::move(body));
+    sendDownstream([this, buf] () mutable {
+        if (downstream_) {
+          downstream_->sendBody(std::move(*buf));
+        }
+      });
+  }
+
+  void sendChunkTerminator() noexcept override {
+    sendDownstream([this] {
+        if (downstream_) {
+          downstream_->sendChunkTerminator();
+        }
+      });
+  }
+
+  void sendEOM() noexcept override {
+    sendDownstream([this] {
+        if (downstream_) {
+          downstream_->sendEOM();
+        }
+      });
+  }
+
+  void sendAbort() noexcept override {
+    sendDownstream([this] {
+        if (downstream_) {
+          downstream_->sendAbort();
+        }
+      });
+  }
+
+  void refreshTimeout() noexcept override {
+    sendDownstream([this] {
+        if (downstream_) {
+          downstream_->refreshTimeout();
+        }
+      });
+  }
+
+  void pauseIngress() noexcept override {
+    sendDownstream([this] {
+        handlerPaused_ = true;
+        updateIngressPaused();
+      });
+  }
+
+  void resumeIngress() noexcept override {
+    sendDownstream([this] {
+        handlerPaused_ = false;
+        updateIngressPaused();
+      });
+  }
+
+  ResponseHandler* newPushedResponse(
+      PushHandler* pushHandler) noexcept override {
+    // The transaction can only be used from the event base
+    return nullptr;
+  }
+
+  const folly::TransportInfo& getSetupTransportInfo() const noexcept override {
+    return setupTransportInfo_;
+  }
+
+  void getCurrentTransportInfo(folly::TransportInfo* tinfo) const override {
+    if (eventBase_->isInEventBaseThread()) {
+      if (downstream_) {
+        downstream_->getCurrentTransportInfo(tinfo);
+      }
+      return;
+    }
+    // Only the IO thread may look at the transport, so wait for it
+    folly::Baton<> done;
+    eventBase_->runInEventBaseThread([this, tinfo, &done] {
+        if (downstream_) {
+          downstream_->getCurrentTransportInfo(tinfo);
+        }
+        done.post();
+      });
+    done.wait();
+  }
+
+ private:
+  typedef std::function<void()> Func;
+
+  // Queue fn for the handler, behind the callbacks that are still pending.
+  // The last callback is followed by the deletion of this filter.
+  void runUpstream(Func fn, bool last = false) {
+    {
+      std::lock_guard<std::mutex> g(upstreamLock_);
+      upstreamQueue_.emplace_back(std::move(fn), last);
+      if (upstreamRunning_) {
+        return;
+      }
+      upstreamRunning_ = true;
+    }
+    executor_->add([this] { drainUpstream(); });
+  }
+
+  void drainUpstream() {
+    for (;;) {
+      std::pair<Func, bool> next;
+      {
+        std::lock_guard<std::mutex> g(upstreamLock_);
+        if (upstreamQueue_.empty()) {
+          upstreamRunning_ = false;
+          return;
+        }
+        next = std::move(upstreamQueue_.front());
+        upstreamQueue_.pop_front();
+      }
+      next.first();
+      if (next.second) {
+        // Nothing comes after the last callback, and once the deletion is
+        // queued this may be gone any time
+        sendDownstream([this] { delete this; });
+        return;
+      }
+    }
+  }
+
+  // Queue fn for the IO thread, with whatever else the handler sent
+  // since the last hop
+  void sendDownstream(Func fn) {
+    auto eventBase = eventBase_;
+    {
+      std::lock_guard<std::mutex> g(downstreamLock_);
+      downstreamQueue_.push_back(std::move(fn));
+      if (downstreamScheduled_) {
+        return;
+      }
+      downstreamScheduled_ = true;
+    }
+    eventBase->runInEventBaseThread([this] { drainDownstream(); });
+  }
+
+  void drainDownstream() {
+    std::vector<Func> batch;
+    {
+      std::lock_guard<std::mutex> g(downstreamLock_);
+      batch.swap(downstreamQueue_);
+      downstreamScheduled_ = false;
+    }
+    // May delete this, as the very last one
+    for (auto& fn: batch) {
+      fn();
+    }
+  }
+
+  void ingressBodyProcessed(uint64_t len) {
+    ingressBytes_ -= len;
+    if (ingressFull_ && ingressBytes_ <= maxIngressBytes_ / 2) {
+      ingressFull_ = false;
+      updateIngressPaused();
+    }
+  }
+
+  void updateIngressPaused() {
+    bool paused = handlerPaused_ || ingressFull_;
+    if (!downstream_ || paused == ingressPaused_) {
+      return;
+    }
+    ingressPaused_ = paused;
+    if (paused) {
+      downstream_->pauseIngress();
+    } else {
+      downstream_->resumeIngress();
+    }
+  }
+
+  folly::Executor* executor_;
+  folly::EventBase* eventBase_;
+  folly::TransportInfo setupTransportInfo_;
+
+  std::mutex upstreamLock_;
+  std::deque<std::pair<Func, bool>> upstreamQueue_;
+  bool upstreamRunning_{false};
+
+  std::mutex downstreamLock_;
+  std::vector<Func> downstreamQueue_;
+  bool downstreamScheduled_{false};
+
+  // Only accessed in the IO thread
+  const uint64_t maxIngressBytes_;
+  uint64_t ingressBytes_{0};
+  bool ingressFull_{false};
+  bool handlerPaused_{false};
+  bool ingressPaused_{false};
+};
+
+class OffloadFilterFactory : public RequestHandlerFactory {
+ public:
+  static const uint64_t kDefaultMaxIngressBytes = 64 * 1024;
+
+  explicit OffloadFilterFactory(
+    std::shared_ptr<folly::Executor> executor,
+    uint64_t maxIngressBytes = kDefaultMaxIngressBytes)
+      : executor_(executor),
+        maxIngressBytes_(maxIngressBytes) {
+  }
+
+  void onServerStart() noexcept override {
+  }
+
+  void onServerStop() noexcept override {
+  }
+
+  RequestHandler* onRequest(RequestHandler* h, HTTPMessage* msg)
+      noexcept override {
+    return new OffloadFilter(h, executor_.get(), maxIngressBytes_);
+  }
+
+ private:
+  std::shared_ptr<folly::Executor> executor_;
+  uint64_t maxIngressBytes_;
+};
+
+}
@@ -0,0 +1,398 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/Conv.h>
+#include <folly/Random.h>
+#include <folly/io/IOBufQueue.h>
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include <proxygen/httpserver/Filters.h>
+#include <proxygen/httpserver/RequestHandlerFactory.h>
+#include <proxygen/lib/utils/UtilInl.h>
+
+namespace proxygen {
+
+/**
+ * A Server filter that answers Range requests for GET, so the handler only
+ * ever sees, and sends, whole responses: Range and If-Range are taken off
+ * the request, and a 200 with a Content-Length is turned into a 206 with
+ * the requested bytes, one range as is and several as multipart/byteranges,
+ * or into a 416 if none of them is in the body. Overlapping and adjacent
+ * ranges are sent as one. If-Range has to match a strong ETag, or the
+ * Last-Modified date exactly, or the whole response is sent.
+ *
+ * The body isn't buffered: each piece the handler sends is cut down, without
+ * copies, to the bytes of it that go out, and the rest is dropped. Files
+ * from ResponseHandler::sendFile() are passed on as the ranges of them to
+ * send, so they keep going out as egress drains.
+ *
+ * Put it before (client side of) ResponseCacheFilter and the compression
+ * filters, so that whole responses are the ones stored and compressed, and
+ * cache hits are ranged too.
+ */
+class RangeFilter : public Filter {
+ public:
+  // A range of the body, first to last inclusive, or the last first bytes
+  // of it if suffix
+  struct Spec {
+    uint64_t first;
+    uint64_t last;
+    bool suffix;
+  };
+
+  // Ranges past this many are taken as an attempt to make us work, and the
+  // whole response is sent instead
+  static const size_t kMaxRanges = 64;
+
+  explicit RangeFilter(RequestHandler* upstream)
+      : Filter(upstream) {}
+
+  /**
+   * Parses the value of a Range header into specs. Returns false if it
+   * isn't a valid byte range set, which has to be ignored.
+   */
+  static bool parseRange(folly::StringPiece value, std::vector<Spec>& specs) {
+    static const folly::StringPiece kUnit("bytes=");
+    specs.clear();
+    if (value.size() < kUnit.size() ||
+        !caseInsensitiveEqual(value.subpiece(0, kUnit.size()), kUnit)) {
+      return false;
+    }
+    value.advance(kUnit.size());
+    while (!value.empty()) {
+      auto comma = value.find(',');
+      auto spec = value.subpiece(0, comma);
+      value.advance(comma == std::string::npos ? value.size() : comma + 1);
+      trim(spec);
+      if (spec.empty()) {
+        // Empty list elements are allowed
+        continue;
+      }
+      auto dash = spec.find('-');
+      if (dash == std::string::npos) {
+        return false;
+      }
+      Spec range{0, std::numeric_limits<uint64_t>::max(), false};
+      auto first = spec.subpiece(0, dash);
+      auto last = spec.subpiece(dash + 1);
+      if (first.empty()) {
+        range.suffix = true;
+        if (!parseNumber(last, range.first)) {
+          return false;
+        }
+      } else if (!parseNumber(first, range.first) ||
+                 (!last.empty() && !parseNumber(last, range.last)) ||
+                 range.last < range.first) {
+        return false;
+      }
+      if (specs.size() == kMaxRanges) {
+        return false;
+      }
+      specs.push_back(range);
+    }
+    return !specs.empty();
+  }
+
+  /**
+   * The ranges of specs in a body of length bytes, in order, with those
+   * that overlap or touch merged. The unsatisfiable ones are left out.
+   */
+  static std::vector<Spec> resolveRanges(const std::vector<Spec>& specs,
+                                         uint64_t length) {
+    std::vector<Spec> ranges;
+    for (const auto& spec: specs) {
+      Spec range{spec.first, spec.last, false};
+      if (spec.suffix) {
+        if (spec.first == 0 || length == 0) {
+          continue;
+        }
+        range.first = length - std::min(spec.first, length);
+        range.last = length - 1;
+      } else if (spec.first >= length) {
+        continue;
+      } else {
+        range.last = std::min(spec.last, length - 1);
+      }
+      ranges.push_back(range);
+    }
+    std::sort(ranges.begin(), ranges.end(),
+              [] (const Spec& a, const Spec& b) { return a.first < b.first; });
+    size_t merged = 0;
+    for (size_t i = 1; i < ranges.size(); ++i) {
+      if (ranges[i].first <= ranges[merged].last + 1) {
+        ranges[merged].last = std::max(ranges[merged].last, ranges[i].last);
+      } else {
+        ranges[++merged] = ranges[i];
+      }
+    }
+    if (!ranges.empty()) {
+      ranges.resize(merged + 1);
+    }
+    return ranges;
+  }
+
+  void onRequest(std::unique_ptr<HTTPMessage> msg) noexcept override {
+    auto& headers = msg->getHeaders();
+    if (headers.exists(HTTP_HEADER_RANGE)) {
+      ranged_ = parseRange(headers.getSingleOrEmpty(HTTP_HEADER_RANGE),
+                           specs_);
+      ifRange_ = headers.getSingleOrEmpty(HTTP_HEADER_IF_RANGE);
+      headers.remove(HTTP_HEADER_RANGE);
+      headers.remove(HTTP_HEADER_IF_RANGE);
+    }
+    Filter::onRequest(std::move(msg));
+  }
+
+  // Response handler
+  void sendHeaders(HTTPMessage& msg) noexcept override {
+    onResponseHeaders(msg);
+    Filter::sendHeaders(msg);
+  }
+
+  void sendHeaders(std::unique_ptr<HTTPMessage> msg) noexcept override {
+    onResponseHeaders(*msg);
+    downstream_->sendHeaders(std::move(msg));
+  }
+
+  void sendChunkHeader(size_t len) noexcept override {
+    if (!active_) {
+      Filter::sendChunkHeader(len);
+    }
+  }
+
+  void sendBody(std::unique_ptr<folly::IOBuf> body) noexcept override {
+    if (!active_) {
+      return Filter::sendBody(std::move(body));
+    }
+    if (!body) {
+      return;
+    }
+    auto start = offset_;
+    offset_ += body->computeChainDataLength();
+    folly::IOBufQueue queue{folly::IOBufQueue::cacheChainLength()};
+    queue.append(std::move(body));
+    forEachRange(start, [&] (uint64_t from, uint64_t length) {
+        queue.trimStart(from - start);
+        start = from + length;
+        auto data = queue.split(length);
+        auto part = partHeader(from);
+        if (part) {
+          part->prependChain(std::move(data));
+          data = std::move(part);
+        }
+        downstream_->sendBody(std::move(data));
+        return true;
+      });
+  }
+
+  bool sendFile(int fd, off_t offset, size_t length) noexcept override {
+    if (!active_) {
+      return downstream_->sendFile(fd, offset, length);
+    }
+    auto start = offset_;
+    offset_ += length;
+    return forEachRange(start, [&] (uint64_t from, uint64_t len) {
+        auto part = partHeader(from);
+        if (part) {
+          downstream_->sendBody(std::move(part));
+        }
+        return downstream_->sendFile(fd, offset + (from - start), len);
+      });
+  }
+
+  void sendChunkTerminator() noexcept override {
+    if (!active_) {
+      Filter::sendChunkTerminator();
+    }
+  }
+
+  void sendEOM() noexcept override {
+    if (active_ && !boundary_.empty()) {
+      downstream_->sendBody(folly::IOBuf::copyBuffer(
+        folly::to<std::string>("\r\n--", boundary_, "--\r\n")));
+    }
+    Filter::sendEOM();
+  }
+
+ private:
+  static bool parseNumber(folly::StringPiece digits, uint64_t& out) {
+    static const uint64_t kMax = std::numeric_limits<uint64_t>::max();
+    if (digits.empty()) {
+      return false;
+    }
+    out = 0;
+    for (auto c: digits) {
+      if (c < '0' || c > '9' || out > (kMax - (c - '0')) / 10) {
+        return false;
+      }
+      out = out * 10 + (c - '0');
+    }
+    return true;
+  }
+
+  static void trim(folly::StringPiece& s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) {
+      s.pop_front();
+    }
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) {
+      s.pop_back();
+    }
+  }
+
+  // Whether the response msg is the representation If-Range names
+  bool ifRangeMatches(const HTTPMessage& msg) const {
+    if (ifRange_.empty()) {
+      return true;
+    }
+    folly::StringPiece ifRange(ifRange_);
+    const auto& headers = msg.getHeaders();
+    if (ifRange.startsWith("W/")) {
+      // Weak ETags don't promise the same bytes
+      return false;
+    }
+    if (ifRange.startsWith("\"")) {
+      return ifRange_ == headers.getSingleOrEmpty(HTTP_HEADER_ETAG);
+    }
+    return ifRange_ == headers.getSingleOrEmpty(HTTP_HEADER_LAST_MODIFIED);
+  }
+
+  void onResponseHeaders(HTTPMessage& msg) noexcept {
+    if (msg.is1xxResponse() || msg.getStatusCode() != 200) {
+      return;
+    }
+    auto& headers = msg.getHeaders();
+    const auto& contentLength =
+      headers.getSingleOrEmpty(HTTP_HEADER_CONTENT_LENGTH);
+    uint64_t length = 0;
+    if (msg.getIsChunked() ||
+        !parseNumber(contentLength, length)) {
+      // Only ever sent whole
+      return;
+    }
+    headers.set(HTTP_HEADER_ACCEPT_RANGES, "bytes");
+    if (!ranged_ || !ifRangeMatches(msg)) {
+      return;
+    }
+    active_ = true;
+    ranges_ = resolveRanges(specs_, length);
+    length_ = folly::to<std::string>(length);
+    if (ranges_.empty()) {
+      msg.setStatusCode(416);
+      msg.setStatusMessage("Requested Range Not Satisfiable");
+      headers.set(HTTP_HEADER_CONTENT_RANGE,
+                  folly::to<std::string>("bytes */", length_));
+      headers.set(HTTP_HEADER_CONTENT_LENGTH, "0");
+      return;
+    }
+    msg.setStatusCode(206);
+    msg.setStatusMessage("Partial Content");
+    if (ranges_.size() == 1) {
+      const auto& range = ranges_.front();
+      headers.set(HTTP_HEADER_CONTENT_RANGE, contentRange(range));
+      headers.set(HTTP_HEADER_CONTENT_LENGTH,
+                  folly::to<std::string>(range.last - range.first + 1));
+      return;
+    }
+
+    boundary_ = folly::to<std::string>(folly::Random::rand64());
+    contentType_ = headers.getSingleOrEmpty(HTTP_HEADER_CONTENT_TYPE);
+    uint64_t bodyLength = boundary_.size() + 8; // \r\n--boundary--\r\n
+    for (const auto& range: ranges_) {
+      bodyLength += partHeaderString(range).size() +
+        range.last - range.first + 1;
+    }
+    headers.set(HTTP_HEADER_CONTENT_TYPE, folly::to<std::string>(
+        "multipart/byteranges; boundary=", boundary_));
+    headers.set(HTTP_HEADER_CONTENT_LENGTH,
+                folly::to<std::string>(bodyLength));
+  }
+
+  std::string contentRange(const Spec& range) const {
+    return folly::to<std::string>("bytes ", range.first, "-", range.last,
+                                  "/", length_);
+  }
+
+  std::string partHeaderString(const Spec& range) const {
+    // The CRLF before the boundary belongs to it, but the first part can
+    // go without
+    return folly::to<std::string>(
+      &range == &ranges_.front() ? "" : "\r\n", "--", boundary_, "\r\n",
+      contentType_.empty() ? "" : "Content-Type: ", contentType_,
+      contentType_.empty() ? "" : "\r\n",
+      "Content-Range: ", contentRange(range), "\r\n\r\n");
+  }
+
+  // The headers of the part that starts at body offset from, if it does
+  std::unique_ptr<folly::IOBuf> partHeader(uint64_t from) const {
+    if (boundary_.empty() || from != ranges_[next_].first) {
+      return nullptr;
+    }
+    return folly::IOBuf::copyBuffer(partHeaderString(ranges_[next_]));
+  }
+
+  // Calls func(from, length) for each piece of the ranges to send in the
+  // body from offset start to offset_, until it returns false
+  template <typename F> // (uint64_t, uint64_t) -> bool
+  bool forEachRange(uint64_t start, F&& func) {
+    while (next_ < ranges_.size() && ranges_[next_].first < offset_) {
+      const auto& range = ranges_[next_];
+      auto from = std::max(range.first, start);
+      auto to = std::min(range.last + 1, offset_);
+      if (!func(from, to - from)) {
+        return false;
+      }
+      start = to;
+      if (to <= range.last) {
+        // The rest of it is in later bodies
+        break;
+      }
+      ++next_;
+    }
+    return true;
+  }
+
+  std::vector<Spec> specs_;
+  std::string ifRange_;
+  // The ranges being sent, and the one the body has reached
+  std::vector<Spec> ranges_;
+  size_t next_{0};
+  // Offset in the whole body of the next byte the handler sends
+  uint64_t offset_{0};
+  std::string length_;
+  std::string boundary_;
+  std::string contentType_;
+  // The request has a valid Range header
+  bool ranged_{false};
+  // Whether the body is being cut down to ranges_
+  bool active_{false};
+};
+
+/**
+ * Creates a RangeFilter for GET requests.
+ */
+class RangeFilterFactory : public RequestHandlerFactory {
+ public:
+  void onServerStart() noexcept override {}
+
+  void onServerStop() noexcept override {}
+
+  RequestHandler* onRequest(RequestHandler* h,
+                            HTTPMessage* msg) noexcept override {
+    if (msg->getMethod() != HTTPMethod::GET) {
+      return h;
+    }
+    return new RangeFilter(h);
+  }
+};
+
+}
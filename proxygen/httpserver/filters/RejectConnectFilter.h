@@ -81,6 +81,11 @@ class RejectConnectFilter : public Filter {
 
   void refreshTimeout() noexcept override {
   }
+
+  ResponseHandler* newPushedResponse(
+      PushHandler* pushHandler) noexcept override {
+    return nullptr;
+  }
 };
 
 class RejectConnectFilterFactory : public RequestHandlerFactory {
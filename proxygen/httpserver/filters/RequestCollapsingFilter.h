@@ -0,0 +1,475 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/io/async/AsyncTimeout.h>
+#include <folly/io/async/EventBaseManager.h>
+#include <proxygen/httpserver/Filters.h>
+#include <proxygen/httpserver/RequestHandlerFactory.h>
+#include <proxygen/httpserver/filters/ResponseCache.h>
+#include <atomic>
+
+namespace proxygen {
+
+/**
+ * The response to a request in flight, kept as it comes for the identical
+ * requests that arrive meanwhile, on this thread or others. The buffers
+ * of its body are shared with them rather than copied.
+ *
+ * The request that leads sets what comes from its handler. Each waiter is
+ * told there is more in the thread of its own EventBase, and reads it.
+ */
+class CollapsedResponse {
+ public:
+  enum class State {
+    PENDING,
+    SHARING,
+    COMPLETE,
+    // The response is only for the request that led
+    NOT_SHARED,
+    FAILED,
+  };
+
+  class Waiter {
+   public:
+    virtual ~Waiter() {}
+
+    virtual void onResponseProgress() noexcept = 0;
+  };
+
+  struct WaiterHandle {
+    folly::EventBase* evb{nullptr};
+    // Cleared in the thread of evb when the waiter goes away
+    Waiter* waiter{nullptr};
+    std::atomic<bool> notified{false};
+  };
+
+  /**
+   * Wait for this response, unless it is over already.
+   */
+  bool addWaiter(std::shared_ptr<WaiterHandle> handle) {
+    std::lock_guard<std::mutex> g(lock_);
+    if (state_ != State::PENDING && state_ != State::SHARING) {
+      return false;
+    }
+    waiters_.push_back(std::move(handle));
+    return true;
+  }
+
+  // The leader's side
+
+  void setHeaders(const HTTPMessage& msg) {
+    update([&] {
+      headers_ = folly::make_unique<HTTPMessage>(msg);
+      state_ = State::SHARING;
+    });
+  }
+
+  void addBody(const folly::IOBuf& body) {
+    update([&] { bodies_.push_back(body.clone()); });
+  }
+
+  void complete() {
+    update([&] { state_ = State::COMPLETE; });
+  }
+
+  void notShared() {
+    update([&] { state_ = State::NOT_SHARED; });
+  }
+
+  void fail() {
+    update([&] { state_ = State::FAILED; });
+  }
+
+  /**
+   * What a waiter has not read yet: the headers if headers is set, and the
+   * body buffers after the first delivered, which it advances.
+   */
+  State read(std::unique_ptr<HTTPMessage>* headers,
+             size_t& delivered,
+             std::vector<std::unique_ptr<folly::IOBuf>>& bodies) {
+    std::lock_guard<std::mutex> g(lock_);
+    if (headers && headers_) {
+      *headers = folly::make_unique<HTTPMessage>(*headers_);
+    }
+    for (; delivered < bodies_.size(); delivered++) {
+      bodies.push_back(bodies_[delivered]->clone());
+    }
+    return state_;
+  }
+
+ private:
+  template <typename F>
+  void update(F func) {
+    std::vector<std::shared_ptr<WaiterHandle>> waiters;
+    {
+      std::lock_guard<std::mutex> g(lock_);
+      func();
+      waiters = waiters_;
+      if (state_ != State::PENDING && state_ != State::SHARING) {
+        // Nobody joins anymore, and they hold on to this themselves
+        waiters_.clear();
+      }
+    }
+    for (auto& handle: waiters) {
+      if (!handle->notified.exchange(true)) {
+        handle->evb->runInEventBaseThread([handle] {
+            handle->notified = false;
+            if (handle->waiter) {
+              handle->waiter->onResponseProgress();
+            }
+          });
+      }
+    }
+  }
+
+  std::mutex lock_;
+  State state_{State::PENDING};
+  std::unique_ptr<HTTPMessage> headers_;
+  std::vector<std::unique_ptr<folly::IOBuf>> bodies_;
+  std::vector<std::shared_ptr<WaiterHandle>> waiters_;
+};
+
+/**
+ * The responses in flight, by request key, shared by all the threads of a
+ * server.
+ */
+class RequestCollapser {
+ public:
+  /**
+   * The response in flight for key, which handle now waits for, or a new
+   * one for this request to lead if there is none.
+   */
+  std::shared_ptr<CollapsedResponse> joinOrLead(
+      const std::string& key,
+      std::shared_ptr<CollapsedResponse::WaiterHandle> handle,
+      bool* leading) {
+    std::lock_guard<std::mutex> g(lock_);
+    auto& response = inFlight_[key];
+    if (response && response->addWaiter(std::move(handle))) {
+      *leading = false;
+      return response;
+    }
+    response = std::make_shared<CollapsedResponse>();
+    *leading = true;
+    return response;
+  }
+
+  /**
+   * Let the next request for key lead again, once response is over.
+   */
+  void finish(const std::string& key, const CollapsedResponse* response) {
+    std::lock_guard<std::mutex> g(lock_);
+    auto it = inFlight_.find(key);
+    if (it != inFlight_.end() && it->second.get() == response) {
+      inFlight_.erase(it);
+    }
+  }
+
+  size_t size() const {
+    std::lock_guard<std::mutex> g(lock_);
+    return inFlight_.size();
+  }
+
+ private:
+  mutable std::mutex lock_;
+  std::unordered_map<std::string, std::shared_ptr<CollapsedResponse>>
+    inFlight_;
+};
+
+/**
+ * A Server filter that holds GET requests back while an identical one is
+ * in flight, then sends them the response of that one as it comes. The
+ * handlers of the requests that waited are told onError(kErrorCanceled)
+ * once the response starts. Responses that are private, set cookies or
+ * vary on anything but Accept-Encoding are not shared: the requests that
+ * waited go on to their own handlers, as they do when no response starts
+ * within the wait timeout.
+ */
+class RequestCollapsingFilter : public Filter,
+                                private CollapsedResponse::Waiter {
+ public:
+  RequestCollapsingFilter(RequestHandler* upstream,
+                          std::shared_ptr<RequestCollapser> collapser,
+                          const std::string& key,
+                          std::chrono::milliseconds waitTimeout)
+      : Filter(upstream),
+        collapser_(collapser),
+        key_(key),
+        waitTimeout_(waitTimeout) {}
+
+  void onRequest(std::unique_ptr<HTTPMessage> msg) noexcept override {
+    auto evb = folly::EventBaseManager::get()->getExistingEventBase();
+    if (!evb) {
+      return Filter::onRequest(std::move(msg));
+    }
+    handle_ = std::make_shared<CollapsedResponse::WaiterHandle>();
+    handle_->evb = evb;
+    handle_->waiter = this;
+    bool leading = false;
+    response_ = collapser_->joinOrLead(key_, handle_, &leading);
+    if (leading) {
+      handle_.reset();
+      leading_ = true;
+      return Filter::onRequest(std::move(msg));
+    }
+    request_ = std::move(msg);
+    timeout_.reset(new WaitTimeout(this, evb));
+    timeout_->scheduleTimeout(waitTimeout_.count());
+  }
+
+  void onBody(std::unique_ptr<folly::IOBuf> body) noexcept override {
+    if (request_) {
+      // Odd for a GET; not worth holding on to
+      release();
+    }
+    if (upstream_) {
+      Filter::onBody(std::move(body));
+    }
+  }
+
+  void onEOM() noexcept override {
+    if (request_) {
+      gotEOM_ = true;
+    } else if (upstream_) {
+      Filter::onEOM();
+    }
+  }
+
+  void requestComplete() noexcept override {
+    detach();
+    if (upstream_) {
+      upstream_->requestComplete();
+    }
+    delete this;
+  }
+
+  void onError(ProxygenError err) noexcept override {
+    detach();
+    if (upstream_) {
+      upstream_->onError(err);
+    }
+    delete this;
+  }
+
+  void onEgressPaused() noexcept override {
+    if (upstream_) {
+      Filter::onEgressPaused();
+    }
+  }
+
+  void onEgressResumed() noexcept override {
+    if (upstream_) {
+      Filter::onEgressResumed();
+    }
+  }
+
+  // Response handler
+  void sendHeaders(HTTPMessage& msg) noexcept override {
+    onLeaderHeaders(msg);
+    Filter::sendHeaders(msg);
+  }
+
+  void sendHeaders(std::unique_ptr<HTTPMessage> msg) noexcept override {
+    onLeaderHeaders(*msg);
+    downstream_->sendHeaders(std::move(msg));
+  }
+
+  void sendBody(std::unique_ptr<folly::IOBuf> body) noexcept override {
+    if (sharing_) {
+      response_->addBody(*body);
+    }
+    Filter::sendBody(std::move(body));
+  }
+
+  void sendEOM() noexcept override {
+    if (sharing_) {
+      sharing_ = false;
+      response_->complete();
+      finishLeading();
+    }
+    Filter::sendEOM();
+  }
+
+  void sendAbort() noexcept override {
+    detach();
+    Filter::sendAbort();
+  }
+
+  /**
+   * Whether the response to one request can be sent to the others
+   * collapsed with it.
+   */
+  static bool isShareable(const HTTPMessage& response) {
+    const auto& headers = response.getHeaders();
+    if (headers.exists(HTTP_HEADER_SET_COOKIE)) {
+      return false;
+    }
+    bool shareable = true;
+    ResponseCache::forEachCacheControl(response,
+        [&] (folly::StringPiece directive, folly::StringPiece) {
+          shareable &= directive != "private" && directive != "no-store";
+        });
+    // The key has Accept-Encoding in it already
+    HTTPHeaders varyOnEncoding;
+    auto vary = ResponseCache::getVary(varyOnEncoding, response);
+    for (auto& header: vary) {
+      shareable &= header.first == "accept-encoding";
+    }
+    return shareable;
+  }
+
+ protected:
+  class WaitTimeout : public folly::AsyncTimeout {
+   public:
+    WaitTimeout(RequestCollapsingFilter* filter, folly::EventBase* evb)
+        : folly::AsyncTimeout(evb),
+          filter_(filter) {}
+
+    void timeoutExpired() noexcept override {
+      filter_->release();
+    }
+
+   private:
+    RequestCollapsingFilter* filter_;
+  };
+
+  void onResponseProgress() noexcept override {
+    std::unique_ptr<HTTPMessage> headers;
+    std::vector<std::unique_ptr<folly::IOBuf>> bodies;
+    auto state = response_->read(headersSent_ ? nullptr : &headers,
+                                 delivered_, bodies);
+    if (!headersSent_ && !headers) {
+      if (state == CollapsedResponse::State::NOT_SHARED ||
+          state == CollapsedResponse::State::FAILED) {
+        release();
+      }
+      return;
+    }
+    if (headers) {
+      timeout_->cancelTimeout();
+      headersSent_ = true;
+      request_.reset();
+      upstream_->onError(kErrorCanceled);
+      upstream_ = nullptr;
+      downstream_->sendHeaders(*headers);
+    }
+    for (auto& body: bodies) {
+      downstream_->sendBody(std::move(body));
+    }
+    if (state == CollapsedResponse::State::COMPLETE) {
+      detach();
+      downstream_->sendEOM();
+    } else if (state == CollapsedResponse::State::FAILED) {
+      detach();
+      downstream_->sendAbort();
+    }
+  }
+
+  // Stop waiting and send the request to its own handler
+  void release() {
+    detach();
+    Filter::onRequest(std::move(request_));
+    if (gotEOM_) {
+      Filter::onEOM();
+    }
+  }
+
+  void onLeaderHeaders(const HTTPMessage& msg) {
+    if (!leading_ || msg.is1xxResponse()) {
+      return;
+    }
+    leading_ = false;
+    if (isShareable(msg)) {
+      sharing_ = true;
+      response_->setHeaders(msg);
+    } else {
+      response_->notShared();
+      finishLeading();
+    }
+  }
+
+  void finishLeading() {
+    collapser_->finish(key_, response_.get());
+  }
+
+  // Leave the collapsed response, failing it if this request led it
+  void detach() {
+    if (handle_) {
+      handle_->waiter = nullptr;
+      handle_.reset();
+    }
+    if (timeout_) {
+      timeout_->cancelTimeout();
+    }
+    if (leading_ || sharing_) {
+      leading_ = false;
+      sharing_ = false;
+      response_->fail();
+      finishLeading();
+    }
+  }
+
+  std::shared_ptr<RequestCollapser> collapser_;
+  const std::string key_;
+  const std::chrono::milliseconds waitTimeout_;
+  std::shared_ptr<CollapsedResponse> response_;
+  std::shared_ptr<CollapsedResponse::WaiterHandle> handle_;
+  std::unique_ptr<WaitTimeout> timeout_;
+  // A waiting request, until it is released or the response starts
+  std::unique_ptr<HTTPMessage> request_;
+  // How many body buffers of response_ were sent
+  size_t delivered_{0};
+  bool gotEOM_{false};
+  bool headersSent_{false};
+  // Until the headers of the response this request leads
+  bool leading_{false};
+  // While the response this request leads is shared
+  bool sharing_{false};
+};
+
+/**
+ * Creates a RequestCollapsingFilter for the GET requests that may be
+ * cached, see ResponseCache::isCacheableRequest(), unless they ask for a
+ * response from the origin with no-cache. Requests are identical when
+ * their Host, URL and Accept-Encoding are.
+ */
+class RequestCollapsingFilterFactory : public RequestHandlerFactory {
+ public:
+  explicit RequestCollapsingFilterFactory(
+      std::chrono::milliseconds waitTimeout = std::chrono::milliseconds(1000))
+      : collapser_(std::make_shared<RequestCollapser>()),
+        waitTimeout_(waitTimeout) {}
+
+  void onServerStart() noexcept override {}
+
+  void onServerStop() noexcept override {}
+
+  RequestHandler* onRequest(RequestHandler* h,
+                            HTTPMessage* msg) noexcept override {
+    if (!ResponseCache::isCacheableRequest(*msg) ||
+        !ResponseCache::allowsStoredResponse(*msg)) {
+      return h;
+    }
+    auto key = ResponseCache::makeKey(*msg) + " " +
+      msg->getHeaders().getSingleOrEmpty(HTTP_HEADER_ACCEPT_ENCODING);
+    return new RequestCollapsingFilter(h, collapser_, key, waitTimeout_);
+  }
+
+  const std::shared_ptr<RequestCollapser>& getCollapser() const {
+    return collapser_;
+  }
+
+ private:
+  std::shared_ptr<RequestCollapser> collapser_;
+  std::chrono::milliseconds waitTimeout_;
+};
+
+}
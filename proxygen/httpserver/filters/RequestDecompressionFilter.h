@@ -0,0 +1,192 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <proxygen/httpserver/Filters.h>
+#include <proxygen/httpserver/RequestHandlerFactory.h>
+#include <proxygen/httpserver/ResponseBuilder.h>
+#include <proxygen/lib/utils/UtilInl.h>
+#include <proxygen/lib/utils/ZlibStreamDecompressor.h>
+
+namespace proxygen {
+
+/**
+ * A filter that inflates request bodies sent with Content-Encoding gzip or
+ * deflate, as they arrive, so the handler gets the request as if it had
+ * been sent uncompressed: without Content-Encoding and, since the
+ * inflated length is only known at the end, without Content-Length.
+ *
+ * Inflating more than maxSize bytes in all fails the request with 413,
+ * and a body that is not valid, or ends before the compressed stream
+ * does, with 400; the handler gets onError(kErrorBadDecompress) in both
+ * cases, or the response is aborted if the handler started it already.
+ *
+ * The flow control window of the request is credited as the compressed
+ * body is handed to the filter, so it is the compressed bytes that count
+ * against it.
+ */
+class RequestDecompressionFilter : public Filter {
+ public:
+  RequestDecompressionFilter(RequestHandler* upstream,
+                             ZlibCompressionType type,
+                             size_t maxSize)
+      : Filter(upstream),
+        decompressor_(type),
+        maxSize_(maxSize) {}
+
+  void onRequest(std::unique_ptr<HTTPMessage> msg) noexcept override {
+    auto& headers = msg->getHeaders();
+    headers.remove(HTTP_HEADER_CONTENT_ENCODING);
+    headers.remove(HTTP_HEADER_CONTENT_LENGTH);
+    upstream_->onRequest(std::move(msg));
+  }
+
+  void onBody(std::unique_ptr<folly::IOBuf> body) noexcept override {
+    if (!upstream_) {
+      return;
+    }
+    auto inflated = decompressor_.decompress(body.get(),
+                                             maxSize_ - inflatedSize_);
+    if (!inflated) {
+      if (decompressor_.getStatus() == Z_BUF_ERROR) {
+        fail(413, "Request Entity Too Large");
+      } else {
+        fail(400, "Bad Request");
+      }
+      return;
+    }
+    auto length = inflated->computeChainDataLength();
+    inflatedSize_ += length;
+    if (length > 0) {
+      upstream_->onBody(std::move(inflated));
+    }
+  }
+
+  void onUpgrade(UpgradeProtocol protocol) noexcept override {
+    if (upstream_) {
+      upstream_->onUpgrade(protocol);
+    }
+  }
+
+  void onEOM() noexcept override {
+    if (!upstream_) {
+      return;
+    }
+    if (!decompressor_.finished()) {
+      // Truncated
+      return fail(400, "Bad Request");
+    }
+    upstream_->onEOM();
+  }
+
+  void requestComplete() noexcept override {
+    if (upstream_) {
+      upstream_->requestComplete();
+    }
+    delete this;
+  }
+
+  void onError(ProxygenError err) noexcept override {
+    if (upstream_) {
+      upstream_->onError(err);
+    }
+    delete this;
+  }
+
+  void onEgressPaused() noexcept override {
+    if (upstream_) {
+      upstream_->onEgressPaused();
+    }
+  }
+
+  void onEgressResumed() noexcept override {
+    if (upstream_) {
+      upstream_->onEgressResumed();
+    }
+  }
+
+  void sendHeaders(HTTPMessage& msg) noexcept override {
+    responseStarted_ |= !msg.is1xxResponse();
+    downstream_->sendHeaders(msg);
+  }
+
+  void sendHeaders(std::unique_ptr<HTTPMessage> msg) noexcept override {
+    responseStarted_ |= !msg->is1xxResponse();
+    downstream_->sendHeaders(std::move(msg));
+  }
+
+ private:
+  // The handler is done with, the rest of the request is dropped
+  void fail(uint16_t code, const std::string& message) {
+    VLOG(4) << "failed to inflate request body: " << code;
+    upstream_->onError(kErrorBadDecompress);
+    upstream_ = nullptr;
+
+    if (responseStarted_) {
+      downstream_->sendAbort();
+    } else {
+      ResponseBuilder(downstream_)
+        .status(code, message)
+        .closeConnection()
+        .sendWithEOM();
+    }
+  }
+
+  ZlibStreamDecompressor decompressor_;
+  const size_t maxSize_;
+  size_t inflatedSize_{0};
+  bool responseStarted_{false};
+};
+
+/**
+ * Creates a RequestDecompressionFilter for the requests with a body
+ * compressed by gzip or deflate alone, see there. Others, including those
+ * compressed more than once, are left to the handler.
+ */
+class RequestDecompressionFilterFactory : public RequestHandlerFactory {
+ public:
+  explicit RequestDecompressionFilterFactory(size_t maxSize)
+      : maxSize_(maxSize) {}
+
+  void onServerStart() noexcept override {
+  }
+
+  void onServerStop() noexcept override {
+  }
+
+  RequestHandler* onRequest(RequestHandler* h,
+                            HTTPMessage* msg) noexcept override {
+    auto type = getCompressionType(
+      msg->getHeaders().getSingleOrEmpty(HTTP_HEADER_CONTENT_ENCODING));
+    if (type != ZlibCompressionType::NONE) {
+      return new RequestDecompressionFilter(h, type, maxSize_);
+    }
+
+    // Not compressed, or not by us
+    return h;
+  }
+
+  // The compression of a body with Content-Encoding encoding, if we inflate
+  static ZlibCompressionType getCompressionType(
+      folly::StringPiece encoding) noexcept {
+    if (caseInsensitiveEqual(encoding, "gzip") ||
+        caseInsensitiveEqual(encoding, "x-gzip")) {
+      return ZlibCompressionType::GZIP;
+    } else if (caseInsensitiveEqual(encoding, "deflate")) {
+      return ZlibCompressionType::DEFLATE;
+    }
+    return ZlibCompressionType::NONE;
+  }
+
+ private:
+  const size_t maxSize_;
+};
+
+}
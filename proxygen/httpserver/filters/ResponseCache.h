@@ -0,0 +1,407 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/Conv.h>
+#include <folly/Optional.h>
+#include <folly/String.h>
+#include <folly/io/IOBuf.h>
+#include <proxygen/lib/http/HTTPMessage.h>
+#include <proxygen/lib/utils/Time.h>
+#include <algorithm>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace proxygen {
+
+/**
+ * Responses to GET requests, so that ResponseCacheFilter can answer
+ * later requests for the same resource without reaching the handler. It
+ * follows the subset of RFC 7234 that applies to a shared cache in front
+ * of its own origin: freshness comes from Cache-Control s-maxage or
+ * max-age, responses with a Vary header are kept per value of the request
+ * headers it names, and stale responses with an ETag can be revalidated.
+ *
+ * Entries are keyed by the Host and URL of their request. One cache can
+ * be shared by all the threads of a server: it is split in shards, each
+ * with its own lock and an equal part of the capacity, and the least
+ * recently used resources of a shard are evicted first.
+ */
+class ResponseCache {
+ public:
+  struct Options {
+    // Bytes of headers and bodies held, across all shards
+    size_t capacity{64 * 1024 * 1024};
+    size_t numShards{16};
+    // Responses with larger bodies are not stored
+    size_t maxBodySize{1024 * 1024};
+    // How many Vary variants of a resource are kept
+    size_t maxVariants{4};
+  };
+
+  /**
+   * A stored response. It does not change once in the cache, so it can be
+   * sent while other threads replace it; its body is shared with clone().
+   */
+  struct Response {
+    HTTPMessage message;
+    std::unique_ptr<folly::IOBuf> body;
+    // The request headers named by Vary, lowercase, with their values
+    std::vector<std::pair<std::string, std::string>> vary;
+    TimePoint storedAt;
+    std::chrono::seconds maxAge{0};
+    // Bytes accounted to the cache, set by put()
+    size_t size{0};
+
+    const std::string& getETag() const {
+      return message.getHeaders().getSingleOrEmpty(HTTP_HEADER_ETAG);
+    }
+
+    bool isFresh(TimePoint now) const {
+      return now < storedAt + maxAge;
+    }
+
+    std::chrono::seconds getAge(TimePoint now) const {
+      return std::chrono::duration_cast<std::chrono::seconds>(
+        now - storedAt);
+    }
+  };
+
+  explicit ResponseCache(const Options& options = Options())
+      : options_(options),
+        shards_(std::max<size_t>(options.numShards, 1)) {
+    shardCapacity_ = options_.capacity / shards_.size();
+  }
+
+  const Options& getOptions() const {
+    return options_;
+  }
+
+  /**
+   * The stored response to request under key, fresh or not, or nullptr.
+   */
+  std::shared_ptr<const Response> get(const std::string& key,
+                                      const HTTPMessage& request) {
+    auto& shard = getShard(key);
+    std::lock_guard<std::mutex> g(shard.lock);
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+      return nullptr;
+    }
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    for (auto& variant: it->second->variants) {
+      if (matchesVary(*variant, request)) {
+        return variant;
+      }
+    }
+    return nullptr;
+  }
+
+  /**
+   * Store response under key, replacing the variant with the same Vary
+   * values if there is one.
+   */
+  void put(const std::string& key, std::shared_ptr<Response> response) {
+    size_t size = key.size() + estimateSize(*response);
+    if (size > shardCapacity_) {
+      return;
+    }
+    response->size = size;
+    auto& shard = getShard(key);
+    std::lock_guard<std::mutex> g(shard.lock);
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+      shard.lru.push_front(Resource{key, {}, 0});
+      it = shard.index.emplace(key, shard.lru.begin()).first;
+    } else {
+      shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    }
+    auto& resource = *it->second;
+    auto& variants = resource.variants;
+    for (auto v = variants.begin(); v != variants.end(); ++v) {
+      if ((*v)->vary == response->vary) {
+        resource.size -= (*v)->size;
+        shard.size -= (*v)->size;
+        variants.erase(v);
+        break;
+      }
+    }
+    variants.insert(variants.begin(), std::move(response));
+    resource.size += size;
+    shard.size += size;
+    while (variants.size() > std::max<size_t>(options_.maxVariants, 1)) {
+      resource.size -= variants.back()->size;
+      shard.size -= variants.back()->size;
+      variants.pop_back();
+    }
+    while (shard.size > shardCapacity_) {
+      shard.size -= shard.lru.back().size;
+      shard.index.erase(shard.lru.back().key);
+      shard.lru.pop_back();
+    }
+  }
+
+  /**
+   * Forget all the variants stored under key.
+   */
+  void remove(const std::string& key) {
+    auto& shard = getShard(key);
+    std::lock_guard<std::mutex> g(shard.lock);
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+      shard.size -= it->second->size;
+      shard.lru.erase(it->second);
+      shard.index.erase(it);
+    }
+  }
+
+  // The bytes held, across all shards
+  size_t size() const {
+    size_t total = 0;
+    for (auto& shard: shards_) {
+      std::lock_guard<std::mutex> g(shard.lock);
+      total += shard.size;
+    }
+    return total;
+  }
+
+  static std::string makeKey(const HTTPMessage& request) {
+    return request.getHeaders().getSingleOrEmpty(HTTP_HEADER_HOST) + " " +
+      request.getURL();
+  }
+
+  /**
+   * Whether the response to request may be stored: a GET without
+   * credentials that does not forbid it.
+   */
+  static bool isCacheableRequest(const HTTPMessage& request) {
+    if (request.getMethod() != HTTPMethod::GET ||
+        request.getHeaders().exists(HTTP_HEADER_AUTHORIZATION)) {
+      return false;
+    }
+    bool noStore = false;
+    forEachCacheControl(request,
+        [&] (folly::StringPiece directive, folly::StringPiece) {
+          noStore |= directive == "no-store";
+        });
+    return !noStore;
+  }
+
+  /**
+   * Whether request may be answered from the cache, rather than only
+   * refresh it.
+   */
+  static bool allowsStoredResponse(const HTTPMessage& request) {
+    bool noCache = request.checkForHeaderToken(HTTP_HEADER_PRAGMA,
+                                               "no-cache", false);
+    forEachCacheControl(request,
+        [&] (folly::StringPiece directive, folly::StringPiece) {
+          noCache |= directive == "no-cache";
+        });
+    return !noCache;
+  }
+
+  /**
+   * How long response stays fresh, or none if it says nothing of it.
+   * s-maxage wins over max-age, and no-cache makes it stale right away.
+   */
+  static folly::Optional<std::chrono::seconds> getFreshnessLifetime(
+      const HTTPMessage& response) {
+    folly::Optional<std::chrono::seconds> maxAge;
+    folly::Optional<std::chrono::seconds> sMaxAge;
+    bool noCache = false;
+    forEachCacheControl(response,
+        [&] (folly::StringPiece directive, folly::StringPiece value) {
+          if (directive == "no-cache") {
+            noCache = true;
+          } else if (directive == "max-age" || directive == "s-maxage") {
+            auto seconds = folly::tryTo<uint32_t>(value);
+            if (seconds.hasValue()) {
+              auto& lifetime = directive == "max-age" ? maxAge : sMaxAge;
+              lifetime = std::chrono::seconds(seconds.value());
+            }
+          }
+        });
+    if (noCache) {
+      return std::chrono::seconds(0);
+    }
+    return sMaxAge ? sMaxAge : maxAge;
+  }
+
+  /**
+   * How long response can be stored fresh, or none if it can't be stored.
+   * Only 200s are, when they are public, do not set cookies, and either
+   * say how long they stay fresh or can be revalidated by their ETag.
+   */
+  static folly::Optional<std::chrono::seconds> getStorableLifetime(
+      const HTTPMessage& response) {
+    const auto& headers = response.getHeaders();
+    if (response.getStatusCode() != 200 ||
+        headers.exists(HTTP_HEADER_SET_COOKIE) ||
+        headers.getSingleOrEmpty(HTTP_HEADER_VARY) == "*") {
+      return folly::none;
+    }
+    bool forbidden = false;
+    forEachCacheControl(response,
+        [&] (folly::StringPiece directive, folly::StringPiece) {
+          forbidden |= directive == "no-store" || directive == "private";
+        });
+    if (forbidden) {
+      return folly::none;
+    }
+    auto lifetime = getFreshnessLifetime(response);
+    if (!lifetime && !headers.getSingleOrEmpty(HTTP_HEADER_ETAG).empty()) {
+      // Heuristic freshness is left out, but it can still be revalidated
+      lifetime = std::chrono::seconds(0);
+    }
+    return lifetime;
+  }
+
+  /**
+   * The request headers named by the Vary header of response, lowercase,
+   * with their values in request.
+   */
+  static std::vector<std::pair<std::string, std::string>> getVary(
+      const HTTPHeaders& requestHeaders, const HTTPMessage& response) {
+    std::vector<std::pair<std::string, std::string>> vary;
+    response.getHeaders().forEachValueOfHeader(HTTP_HEADER_VARY,
+        [&] (const std::string& value) {
+          std::vector<folly::StringPiece> names;
+          folly::split(',', value, names);
+          for (auto name: names) {
+            name = trim(name);
+            if (!name.empty()) {
+              auto lower = name.str();
+              folly::toLowerAscii(lower);
+              vary.emplace_back(lower, requestHeaders.combine(lower));
+            }
+          }
+          return false;
+        });
+    std::sort(vary.begin(), vary.end());
+    return vary;
+  }
+
+  /**
+   * Whether the If-None-Match of request lists etag (weakly).
+   */
+  static bool matchesETag(const HTTPMessage& request,
+                          const std::string& etag) {
+    folly::StringPiece tag(etag);
+    tag.removePrefix("W/");
+    return request.getHeaders().forEachValueOfHeader(
+        HTTP_HEADER_IF_NONE_MATCH,
+        [&] (const std::string& value) {
+          std::vector<folly::StringPiece> candidates;
+          folly::split(',', value, candidates);
+          for (auto candidate: candidates) {
+            candidate = trim(candidate);
+            candidate.removePrefix("W/");
+            if (candidate == "*" || candidate == tag) {
+              return true;
+            }
+          }
+          return false;
+        });
+  }
+
+  /**
+   * Call func(directive, value) for each Cache-Control directive of msg,
+   * the directive lowercase, the value unquoted and empty if not given.
+   */
+  template <typename F>
+  static void forEachCacheControl(const HTTPMessage& msg, F func) {
+    msg.getHeaders().forEachValueOfHeader(HTTP_HEADER_CACHE_CONTROL,
+        [&] (const std::string& value) {
+          std::vector<folly::StringPiece> directives;
+          folly::split(',', value, directives);
+          for (auto directive: directives) {
+            folly::StringPiece name;
+            folly::StringPiece arg;
+            if (!folly::split('=', directive, name, arg)) {
+              name = directive;
+            }
+            auto lower = trim(name).str();
+            folly::toLowerAscii(lower);
+            arg = trim(arg);
+            if (arg.size() >= 2 && arg.front() == '"' && arg.back() == '"') {
+              arg = arg.subpiece(1, arg.size() - 2);
+            }
+            func(folly::StringPiece(lower), arg);
+          }
+          return false;
+        });
+  }
+
+ private:
+  struct Resource {
+    std::string key;
+    // most recently stored first
+    std::vector<std::shared_ptr<const Response>> variants;
+    size_t size;
+  };
+
+  struct Shard {
+    mutable std::mutex lock;
+    size_t size{0};
+    // most recently used first
+    std::list<Resource> lru;
+    std::unordered_map<std::string, std::list<Resource>::iterator> index;
+  };
+
+  Shard& getShard(const std::string& key) {
+    return shards_[std::hash<std::string>()(key) % shards_.size()];
+  }
+
+  static bool matchesVary(const Response& response,
+                          const HTTPMessage& request) {
+    for (auto& header: response.vary) {
+      if (request.getHeaders().combine(header.first) != header.second) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static size_t estimateSize(const Response& response) {
+    size_t size = sizeof(Response);
+    if (response.body) {
+      size += response.body->computeChainDataLength();
+    }
+    response.message.getHeaders().forEach(
+        [&] (const std::string& name, const std::string& value) {
+          size += name.size() + value.size();
+        });
+    for (auto& header: response.vary) {
+      size += header.first.size() + header.second.size();
+    }
+    return size;
+  }
+
+  static folly::StringPiece trim(folly::StringPiece s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) {
+      s.pop_front();
+    }
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) {
+      s.pop_back();
+    }
+    return s;
+  }
+
+  const Options options_;
+  size_t shardCapacity_;
+  std::vector<Shard> shards_;
+};
+
+}
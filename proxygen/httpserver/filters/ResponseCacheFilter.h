@@ -0,0 +1,292 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/io/IOBufQueue.h>
+#include <proxygen/httpserver/Filters.h>
+#include <proxygen/httpserver/RequestHandlerFactory.h>
+#include <proxygen/httpserver/filters/ResponseCache.h>
+
+namespace proxygen {
+
+/**
+ * A Server filter that answers GET requests from a ResponseCache when it
+ * holds a fresh response to them, on the IO thread and without the
+ * request reaching the handler, which is only told onError(kErrorCanceled).
+ * Conditional requests whose If-None-Match lists the stored ETag get a
+ * 304 instead.
+ *
+ * Otherwise the request goes on, and a storable response is kept as it is
+ * sent. When the stored response is stale but has an ETag, the request is
+ * sent on with that If-None-Match: a 304 from the handler refreshes the
+ * stored response, which is then sent in its place.
+ */
+class ResponseCacheFilter : public Filter {
+ public:
+  ResponseCacheFilter(RequestHandler* upstream,
+                      std::shared_ptr<ResponseCache> cache,
+                      const std::string& key,
+                      bool lookup)
+      : Filter(upstream),
+        cache_(cache),
+        key_(key),
+        lookup_(lookup) {}
+
+  void onRequest(std::unique_ptr<HTTPMessage> msg) noexcept override {
+    requestHeaders_ = msg->getHeaders();
+    if (lookup_) {
+      auto now = getCurrentTime();
+      auto stored = cache_->get(key_, *msg);
+      if (stored && stored->isFresh(now)) {
+        return sendHit(*msg, *stored, now);
+      }
+      auto& headers = msg->getHeaders();
+      if (stored && !stored->getETag().empty() &&
+          !headers.exists(HTTP_HEADER_IF_NONE_MATCH) &&
+          !headers.exists(HTTP_HEADER_IF_MODIFIED_SINCE)) {
+        headers.set(HTTP_HEADER_IF_NONE_MATCH, stored->getETag());
+        revalidating_ = stored;
+      }
+    }
+    Filter::onRequest(std::move(msg));
+  }
+
+  void onBody(std::unique_ptr<folly::IOBuf> body) noexcept override {
+    if (upstream_) {
+      Filter::onBody(std::move(body));
+    }
+  }
+
+  void onUpgrade(UpgradeProtocol protocol) noexcept override {
+    if (upstream_) {
+      Filter::onUpgrade(protocol);
+    }
+  }
+
+  void onEOM() noexcept override {
+    if (upstream_) {
+      Filter::onEOM();
+    }
+  }
+
+  void requestComplete() noexcept override {
+    if (upstream_) {
+      upstream_->requestComplete();
+    }
+    delete this;
+  }
+
+  void onError(ProxygenError err) noexcept override {
+    if (upstream_) {
+      upstream_->onError(err);
+    }
+    delete this;
+  }
+
+  void onEgressPaused() noexcept override {
+    if (upstream_) {
+      Filter::onEgressPaused();
+    }
+  }
+
+  void onEgressResumed() noexcept override {
+    if (upstream_) {
+      Filter::onEgressResumed();
+    }
+  }
+
+  // Response handler
+  void sendHeaders(HTTPMessage& msg) noexcept override {
+    if (!onResponseHeaders(msg)) {
+      Filter::sendHeaders(msg);
+    }
+  }
+
+  void sendHeaders(std::unique_ptr<HTTPMessage> msg) noexcept override {
+    if (!onResponseHeaders(*msg)) {
+      downstream_->sendHeaders(std::move(msg));
+    }
+  }
+
+  void sendChunkHeader(size_t len) noexcept override {
+    if (!swallow_) {
+      Filter::sendChunkHeader(len);
+    }
+  }
+
+  void sendBody(std::unique_ptr<folly::IOBuf> body) noexcept override {
+    if (swallow_) {
+      return;
+    }
+    if (store_) {
+      storedBodyLength_ += body->computeChainDataLength();
+      if (storedBodyLength_ > cache_->getOptions().maxBodySize) {
+        store_.reset();
+        storedBody_.move();
+      } else {
+        storedBody_.append(body->clone());
+      }
+    }
+    Filter::sendBody(std::move(body));
+  }
+
+  void sendChunkTerminator() noexcept override {
+    if (!swallow_) {
+      Filter::sendChunkTerminator();
+    }
+  }
+
+  void sendEOM() noexcept override {
+    if (store_) {
+      // Served whole from now on
+      store_->body = storedBody_.move();
+      auto& headers = store_->message.getHeaders();
+      store_->message.setIsChunked(false);
+      headers.remove(HTTP_HEADER_TRANSFER_ENCODING);
+      headers.set(HTTP_HEADER_CONTENT_LENGTH,
+                  folly::to<std::string>(storedBodyLength_));
+      cache_->put(key_, std::move(store_));
+    }
+    Filter::sendEOM();
+  }
+
+  void sendAbort() noexcept override {
+    store_.reset();
+    Filter::sendAbort();
+  }
+
+ protected:
+  void sendHit(const HTTPMessage& request,
+               const ResponseCache::Response& stored,
+               TimePoint now) {
+    upstream_->onError(kErrorCanceled);
+    upstream_ = nullptr;
+
+    HTTPMessage response(stored.message);
+    response.getHeaders().set(
+      HTTP_HEADER_AGE, folly::to<std::string>(stored.getAge(now).count()));
+    const auto& etag = stored.getETag();
+    if (!etag.empty() && ResponseCache::matchesETag(request, etag)) {
+      response.setStatusCode(304);
+      response.setStatusMessage("Not Modified");
+      response.getHeaders().remove(HTTP_HEADER_CONTENT_LENGTH);
+      downstream_->sendHeaders(response);
+    } else {
+      downstream_->sendHeaders(response);
+      if (stored.body) {
+        downstream_->sendBody(stored.body->clone());
+      }
+    }
+    downstream_->sendEOM();
+  }
+
+  // Returns true if the stored response went out instead of msg
+  bool onResponseHeaders(HTTPMessage& msg) noexcept {
+    if (msg.is1xxResponse()) {
+      // The final response comes after
+      return false;
+    }
+    auto now = getCurrentTime();
+    auto revalidating = std::move(revalidating_);
+    if (revalidating && msg.getStatusCode() == 304) {
+      auto refreshed = std::make_shared<ResponseCache::Response>();
+      refreshed->message = revalidating->message;
+      if (revalidating->body) {
+        refreshed->body = revalidating->body->clone();
+      }
+      refreshed->vary = revalidating->vary;
+      refreshed->storedAt = now;
+      refreshed->maxAge = revalidating->maxAge;
+      auto lifetime = ResponseCache::getFreshnessLifetime(msg);
+      if (lifetime) {
+        refreshed->maxAge = *lifetime;
+        refreshed->message.getHeaders().set(
+          HTTP_HEADER_CACHE_CONTROL,
+          msg.getHeaders().combine(HTTP_HEADER_CACHE_CONTROL));
+      }
+      cache_->put(key_, refreshed);
+
+      // The client asked for the whole response, the rest of this one is
+      // for the cache
+      swallow_ = true;
+      HTTPMessage response(refreshed->message);
+      response.getHeaders().set(HTTP_HEADER_AGE, "0");
+      downstream_->sendHeaders(response);
+      if (refreshed->body) {
+        downstream_->sendBody(refreshed->body->clone());
+      }
+      return true;
+    }
+
+    auto lifetime = ResponseCache::getStorableLifetime(msg);
+    if (lifetime) {
+      store_ = std::make_shared<ResponseCache::Response>();
+      store_->message = msg;
+      store_->vary = ResponseCache::getVary(requestHeaders_, msg);
+      store_->storedAt = now;
+      store_->maxAge = *lifetime;
+    }
+    return false;
+  }
+
+  std::shared_ptr<ResponseCache> cache_;
+  const std::string key_;
+  // Whether the request may be answered from the cache
+  const bool lookup_;
+  HTTPHeaders requestHeaders_;
+  // The stale response this request is revalidating
+  std::shared_ptr<const ResponseCache::Response> revalidating_;
+  // The response being stored as it is sent
+  std::shared_ptr<ResponseCache::Response> store_;
+  folly::IOBufQueue storedBody_{folly::IOBufQueue::cacheChainLength()};
+  size_t storedBodyLength_{0};
+  // Set when the stored response went out instead of the handler's 304
+  bool swallow_{false};
+};
+
+/**
+ * Creates a ResponseCacheFilter, sharing one ResponseCache, for the GET
+ * requests that may be cached. Requests with other methods, besides
+ * HEAD, OPTIONS and TRACE, make the cache forget their resource.
+ */
+class ResponseCacheFilterFactory : public RequestHandlerFactory {
+ public:
+  explicit ResponseCacheFilterFactory(
+      const ResponseCache::Options& options = ResponseCache::Options())
+      : cache_(std::make_shared<ResponseCache>(options)) {}
+
+  void onServerStart() noexcept override {}
+
+  void onServerStop() noexcept override {}
+
+  RequestHandler* onRequest(RequestHandler* h,
+                            HTTPMessage* msg) noexcept override {
+    if (ResponseCache::isCacheableRequest(*msg)) {
+      return new ResponseCacheFilter(
+        h, cache_, ResponseCache::makeKey(*msg),
+        ResponseCache::allowsStoredResponse(*msg));
+    }
+    auto method = msg->getMethod();
+    if (method != HTTPMethod::GET && method != HTTPMethod::HEAD &&
+        method != HTTPMethod::OPTIONS && method != HTTPMethod::TRACE) {
+      cache_->remove(ResponseCache::makeKey(*msg));
+    }
+    return h;
+  }
+
+  const std::shared_ptr<ResponseCache>& getCache() const {
+    return cache_;
+  }
+
+ private:
+  std::shared_ptr<ResponseCache> cache_;
+};
+
+}
@@ -10,17 +10,41 @@
 #pragma once
 
 #include <folly/Memory.h>
+#include <folly/ThreadLocal.h>
+#include <folly/small_vector.h>
+#include <atomic>
+#include <mutex>
 
 #include <proxygen/httpserver/Filters.h>
+#include <proxygen/httpserver/filters/CompressedBodyCache.h>
+#include <proxygen/httpserver/filters/CompressionLevelController.h>
+#include <proxygen/httpserver/filters/ContentTypeMatcher.h>
 #include <proxygen/httpserver/RequestHandlerFactory.h>
-#include <proxygen/lib/utils/ZlibStreamCompressor.h>
+#include <proxygen/lib/utils/StreamCompressor.h>
 #include <proxygen/lib/http/RFC2616.h>
 
 namespace proxygen {
 
 /**
- * A Server filter to perform GZip compression. If there are any errors it will
- * fall back to sending uncompressed responses.
+ * A Server filter to compress responses with a content coding (gzip by
+ * default, or any that isSupportedContentEncoding()). If there are any
+ * errors it will fall back to sending uncompressed responses.
+ *
+ * With a CompressedBodyCache, non-chunked responses with a strong ETag are
+ * only compressed the first time; later ones get the cached body.
+ *
+ * Non-chunked responses are otherwise buffered until their compressed
+ * Content-Length is known. In streaming mode they are sent without one
+ * instead, and each body is compressed and sent as it comes: as chunks on
+ * HTTP/1.1 (up to the codec, like any response without a length), or
+ * simply as DATA frames on SPDY and HTTP/2. Responses that can be cached
+ * are still buffered.
+ *
+ * With a CompressionLevelController, the level of each response is picked
+ * from the load of the thread and the length of the response instead, and
+ * non-chunked responses whose body looks compressed already are sent as
+ * they are. In streaming mode their headers are then held back until the
+ * first body is sent.
  */
 class ZlibServerFilter : public Filter {
  public:
@@ -28,38 +52,37 @@ class ZlibServerFilter : public Filter {
       RequestHandler* downstream,
       int32_t compressionLevel,
       uint32_t minimumCompressionSize,
-      const std::shared_ptr<std::set<std::string>> compressibleContentTypes)
+      std::shared_ptr<const ContentTypeMatcher> compressibleContentTypes,
+      const std::string& encoding = "gzip",
+      std::shared_ptr<CompressedBodyCache> cache = nullptr,
+      bool stream = false,
+      std::shared_ptr<const CompressionLevelController> levelController =
+        nullptr)
       : Filter(downstream),
         compressionLevel_(compressionLevel),
         minimumCompressionSize_(minimumCompressionSize),
-        compressibleContentTypes_(compressibleContentTypes) {}
+        compressibleContentTypes_(compressibleContentTypes),
+        encoding_(encoding),
+        cache_(cache),
+        stream_(stream),
+        levelController_(levelController) {}
 
   void sendHeaders(HTTPMessage& msg) noexcept override {
-    DCHECK(compressor_ == nullptr);
-    DCHECK(header_ == false);
-
-    chunked_ = msg.getIsChunked();
-
-    // Make final determination of whether to compress
-    compress_ = isCompressibleContentType(msg) &&
-      (chunked_ || isMinimumCompressibleSize(msg));
-
-    // Add the gzip header
-    if (compress_) {
-      auto& headers = msg.getHeaders();
-      headers.set(HTTP_HEADER_CONTENT_ENCODING, "gzip");
-    }
-
-    // If it's chunked or not being compressed then the headers can be sent
-    // if it's compressed and one body, then need to calculate content length.
-    if (chunked_ || !compress_) {
+    if (prepareHeaders(msg)) {
       Filter::sendHeaders(msg);
-      header_ = true;
     } else {
       responseMessage_ = folly::make_unique<HTTPMessage>(msg);
     }
   }
 
+  void sendHeaders(std::unique_ptr<HTTPMessage> msg) noexcept override {
+    if (prepareHeaders(*msg)) {
+      downstream_->sendHeaders(std::move(msg));
+    } else {
+      responseMessage_ = std::move(msg);
+    }
+  }
+
   void sendChunkHeader(size_t len) noexcept override {
     // The headers should have always been sent since the message is chunked
     DCHECK(header_ = true);
@@ -83,10 +106,27 @@ class ZlibServerFilter : public Filter {
       return;
     }
 
+    if (!cacheKey_.empty()) {
+      auto cached = cache_->get(cacheKey_);
+      if (cached) {
+        return sendCompressedBody(std::move(cached));
+      }
+    }
+
+    // Until the headers are sent the body can still go as it is
+    if (!header_ && compressor_ == nullptr && levelController_ &&
+        levelController_->looksCompressed(*body)) {
+      sendHeldHeaders(false);
+      Filter::sendBody(std::move(body));
+      return;
+    }
+    if (streaming_ && !header_) {
+      sendHeldHeaders(true);
+    }
+
     //First time through the compressor
     if (compressor_ == nullptr) {
-      compressor_ = folly::make_unique<ZlibStreamCompressor>(
-          proxygen::ZlibCompressionType::GZIP, compressionLevel_);
+      compressor_ = makeStreamCompressor(encoding_, compressionLevel_);
 
       if (!compressor_ || compressor_->hasError()) {
         return fail();
@@ -94,35 +134,23 @@ class ZlibServerFilter : public Filter {
     }
     DCHECK(compressor_ != nullptr);
 
-    // If it's chunked, never write the trailer, it will be written on EOM
-    auto compressed = compressor_->compress(body.get(), !chunked_);
+    // If it's chunked or streamed, never write the trailer, it will be
+    // written on EOM
+    auto compressed = compressor_->compress(body.get(),
+                                            !chunked_ && !streaming_);
     if (compressor_->hasError()) {
       return fail();
     }
 
-    auto compressedBodyLength = compressed->computeChainDataLength();
-
-    if (chunked_) {
-        // Send on the swallowed chunk header.
-        Filter::sendChunkHeader(compressedBodyLength);
-    } else {
-      //Send the content length on compressed, non-chunked messages
-      DCHECK(header_ == false);
-      DCHECK(compress_ == true);
-      auto& headers = responseMessage_->getHeaders();
-      headers.set(HTTP_HEADER_CONTENT_LENGTH,
-          folly::to<std::string>(compressedBodyLength));
-
-      Filter::sendHeaders(*responseMessage_);
-      header_  = true;
+    if (!cacheKey_.empty()) {
+      cache_->put(cacheKey_, compressed->clone());
     }
-
-    Filter::sendBody(std::move(compressed));
+    sendCompressedBody(std::move(compressed));
   }
 
   void sendEOM() noexcept override {
 
-    // Need to send the gzip trailer for compressed chunked messages
+    // Need to send the stream trailer for compressed chunked messages
     if (compress_ && chunked_) {
 
       auto emptyBuffer = folly::IOBuf::copyBuffer("");
@@ -132,10 +160,28 @@ class ZlibServerFilter : public Filter {
         return fail();
       }
 
-      // "Inject" a chunk with the gzip trailer.
+      // "Inject" a chunk with the stream trailer.
       Filter::sendChunkHeader(compressed->computeChainDataLength());
       Filter::sendBody(std::move(compressed));
       Filter::sendChunkTerminator();
+    } else if (streaming_) {
+      if (!header_) {
+        sendHeldHeaders(true);
+      }
+      // The compressor may not have been created if there was no body
+      if (compressor_ == nullptr) {
+        compressor_ = makeStreamCompressor(encoding_, compressionLevel_);
+        if (!compressor_ || compressor_->hasError()) {
+          return fail();
+        }
+      }
+      auto emptyBuffer = folly::IOBuf::copyBuffer("");
+      auto compressed = compressor_->compress(emptyBuffer.get(), true);
+
+      if (compressor_->hasError()) {
+        return fail();
+      }
+      sendCompressedBody(std::move(compressed));
     }
 
     Filter::sendEOM();
@@ -147,78 +193,219 @@ class ZlibServerFilter : public Filter {
     Filter::sendAbort();
   }
 
-  //Verify the response is large enough to compress
-  bool isMinimumCompressibleSize(const HTTPMessage& msg) const noexcept {
-    auto contentLengthHeader =
-        msg.getHeaders().getSingleOrEmpty(HTTP_HEADER_CONTENT_LENGTH);
+  // Send the headers held back to sample the first body, compressed and
+  // streamed, or else as they came without the content coding
+  void sendHeldHeaders(bool compressed) {
+    auto& headers = responseMessage_->getHeaders();
+    if (compressed) {
+      headers.remove(HTTP_HEADER_CONTENT_LENGTH);
+    } else {
+      headers.remove(HTTP_HEADER_CONTENT_ENCODING);
+      compress_ = false;
+      streaming_ = false;
+    }
+    downstream_->sendHeaders(std::move(responseMessage_));
+    header_ = true;
+  }
 
-    uint32_t contentLength = 0;
-    if (!contentLengthHeader.empty()) {
-      contentLength = folly::to<uint32_t>(contentLengthHeader);
+  void sendCompressedBody(std::unique_ptr<folly::IOBuf> compressed) {
+    auto compressedBodyLength = compressed->computeChainDataLength();
+
+    if (streaming_) {
+      // The compressor can hold on to all of it until the next flush
+      if (compressedBodyLength > 0) {
+        Filter::sendBody(std::move(compressed));
+      }
+      return;
+    } else if (chunked_) {
+        // Send on the swallowed chunk header.
+        Filter::sendChunkHeader(compressedBodyLength);
+    } else {
+      //Send the content length on compressed, non-chunked messages
+      DCHECK(header_ == false);
+      DCHECK(compress_ == true);
+      auto& headers = responseMessage_->getHeaders();
+      headers.set(HTTP_HEADER_CONTENT_LENGTH,
+          folly::to<std::string>(compressedBodyLength));
+
+      downstream_->sendHeaders(std::move(responseMessage_));
+      header_  = true;
     }
 
-    return contentLength > minimumCompressionSize_;
+    Filter::sendBody(std::move(compressed));
   }
 
-  // Check the response's content type against a list of compressible types
-  bool isCompressibleContentType(const HTTPMessage& msg) const noexcept {
+  // Decide whether to compress and set up the headers to match. Returns
+  // true if they can go now; if not they are sent with the content length
+  // once the compressed body is complete.
+  bool prepareHeaders(HTTPMessage& msg) noexcept {
+    if (msg.is1xxResponse()) {
+      // The final response comes after
+      return true;
+    }
+    DCHECK(compressor_ == nullptr);
+    DCHECK(header_ == false);
 
-    auto responseContentType =
-        msg.getHeaders().getSingleOrEmpty(HTTP_HEADER_CONTENT_TYPE);
+    chunked_ = msg.getIsChunked();
 
-    folly::toLowerAscii((char *)responseContentType.data(),
-        responseContentType.size());
+    // Make final determination of whether to compress
+    compress_ = isCompressibleContentType(msg) &&
+      (chunked_ || isMinimumCompressibleSize(msg));
 
-    // Handle  text/html; encoding=utf-8 case
-    auto parameter_idx = responseContentType.find(';');
-    if (parameter_idx != std::string::npos) {
-     responseContentType = responseContentType.substr(0, parameter_idx);
+    if (compress_ && levelController_) {
+      compressionLevel_ = levelController_->pickLevel(
+        chunked_ ? 0 : getContentLength(msg));
+      compress_ = compressionLevel_ != 0;
     }
 
-    auto idx = compressibleContentTypes_->find(responseContentType);
+    // Add the content encoding header
+    if (compress_) {
+      auto& headers = msg.getHeaders();
+      headers.set(HTTP_HEADER_CONTENT_ENCODING, encoding_);
+    }
 
-    if (idx != compressibleContentTypes_->end()) {
+    // If it's chunked or not being compressed then the headers can be sent
+    // if it's compressed and one body, then need to calculate content length.
+    if (chunked_ || !compress_) {
+      header_ = true;
       return true;
     }
 
+    // Weak ETags don't promise the same bytes
+    auto& etag = msg.getHeaders().getSingleOrEmpty(HTTP_HEADER_ETAG);
+    if (cache_ && !etag.empty() &&
+        !folly::StringPiece(etag).startsWith("W/")) {
+      cacheKey_ = CompressedBodyCache::makeKey(encoding_, etag);
+    }
+
+    if (stream_ && cacheKey_.empty()) {
+      // The compressed length is only known at the end
+      streaming_ = true;
+      if (levelController_ && levelController_->samplesEntropy()) {
+        // Sent with the first body, which may not be worth compressing
+        return false;
+      }
+      msg.getHeaders().remove(HTTP_HEADER_CONTENT_LENGTH);
+      header_ = true;
+      return true;
+    }
     return false;
   }
 
+  //Verify the response is large enough to compress
+  bool isMinimumCompressibleSize(const HTTPMessage& msg) const noexcept {
+    return getContentLength(msg) > minimumCompressionSize_;
+  }
+
+  // The Content-Length of the response, 0 if it has none
+  static uint32_t getContentLength(const HTTPMessage& msg) noexcept {
+    auto contentLengthHeader =
+        msg.getHeaders().getSingleOrEmpty(HTTP_HEADER_CONTENT_LENGTH);
+
+    uint32_t contentLength = 0;
+    if (!contentLengthHeader.empty()) {
+      contentLength = folly::to<uint32_t>(contentLengthHeader);
+    }
+    return contentLength;
+  }
+
+  // Check the response's content type against a list of compressible types
+  bool isCompressibleContentType(const HTTPMessage& msg) const noexcept {
+    return compressibleContentTypes_->matches(
+      msg.getHeaders().getSingleOrEmpty(HTTP_HEADER_CONTENT_TYPE));
+  }
+
   std::unique_ptr<HTTPMessage> responseMessage_;
-  std::unique_ptr<ZlibStreamCompressor> compressor_{nullptr};
+  std::unique_ptr<StreamCompressor> compressor_{nullptr};
   int32_t compressionLevel_{4};
   uint32_t minimumCompressionSize_{1000};
-  const std::shared_ptr<std::set<std::string>> compressibleContentTypes_;
+  const std::shared_ptr<const ContentTypeMatcher> compressibleContentTypes_;
+  const std::string encoding_;
+  std::shared_ptr<CompressedBodyCache> cache_;
+  // Set for the non-chunked responses that can be cached
+  std::string cacheKey_;
+  const bool stream_{false};
+  const std::shared_ptr<const CompressionLevelController> levelController_;
+  // Set for the non-chunked responses sent without a Content-Length
+  bool streaming_{false};
   bool header_{false};
   bool chunked_{false};
   bool compress_{false};
 };
 
+/**
+ * Creates a ZlibServerFilter for the requests that accept one of the given
+ * content codings. The one with the highest q-value in Accept-Encoding
+ * wins, with ties going to the one listed first; codings this build does
+ * not support are ignored.
+ *
+ * If cacheSize is not 0, the factory keeps a CompressedBodyCache of up to
+ * that many bytes, shared by all the requests it filters. With stream,
+ * non-chunked responses are compressed as they are sent rather than
+ * buffered (see ZlibServerFilter). With setLevelController(), the level
+ * of each response follows the load of its thread instead.
+ *
+ * The compressible content types may have wildcards, such as "text/*",
+ * see ContentTypeMatcher. Each thread filters with a matcher of its own,
+ * built when it starts and again after each setCompressibleContentTypes(),
+ * so that the requests of different threads touch no memory in common.
+ */
 class ZlibServerFilterFactory : public RequestHandlerFactory {
  public:
   explicit ZlibServerFilterFactory(
       int32_t compressionLevel,
       uint32_t minimumCompressionSize,
-      const std::set<std::string> compressibleContentTypes)
+      const std::set<std::string> compressibleContentTypes,
+      const std::vector<std::string>& encodings = {"gzip"},
+      size_t cacheSize = 0,
+      bool stream = false)
       : compressionLevel_(compressionLevel),
         minimumCompressionSize_(minimumCompressionSize),
         compressibleContentTypes_(
-            std::make_shared<std::set<std::string>>(compressibleContentTypes)) {
+          std::make_shared<const std::set<std::string>>(
+            compressibleContentTypes)),
+        stream_(stream) {
+    if (cacheSize > 0) {
+      cache_ = std::make_shared<CompressedBodyCache>(cacheSize);
+    }
+    for (auto& encoding: encodings) {
+      if (isSupportedContentEncoding(encoding)) {
+        encodings_.push_back(encoding);
+      } else {
+        LOG(WARNING) << "Content encoding not supported: " << encoding;
+      }
+    }
   }
 
-  void onServerStart() noexcept override {}
+  void onServerStart() noexcept override {
+    getContentTypes();
+    // Released to the pools of this thread, for the first responses
+    for (auto& encoding: encodings_) {
+      if (encoding == "gzip") {
+        makeStreamCompressor(encoding, compressionLevel_);
+      }
+    }
+  }
 
-  void onServerStop() noexcept override {}
+  void onServerStop() noexcept override {
+    local_->contentTypes.reset();
+  }
 
   RequestHandler* onRequest(RequestHandler* h,
                             HTTPMessage* msg) noexcept override {
 
-    if (acceptsSupportedCompressionType(msg)) {
+    auto encoding = memoizedEncoding(
+      msg->getHeaders().getSingleOrEmpty(HTTP_HEADER_ACCEPT_ENCODING));
+    if (encoding) {
       auto zlibServerFilter =
           new ZlibServerFilter(h,
               compressionLevel_,
               minimumCompressionSize_,
-              compressibleContentTypes_);
+              getContentTypes(),
+              *encoding,
+              cache_,
+              stream_,
+              levelController_);
       return zlibServerFilter;
     }
 
@@ -226,31 +413,139 @@ class ZlibServerFilterFactory : public RequestHandlerFactory {
     return h;
   }
 
- protected:
+  /**
+   * Compress the responses of these content types from now on. Can be
+   * called from any thread; the requests each thread has in flight keep
+   * the types they started with.
+   */
+  void setCompressibleContentTypes(const std::set<std::string>& types) {
+    auto updated = std::make_shared<const std::set<std::string>>(types);
+    std::lock_guard<std::mutex> g(contentTypesLock_);
+    compressibleContentTypes_ = std::move(updated);
+    contentTypesVersion_.fetch_add(1, std::memory_order_release);
+  }
 
-  // Check whether the client supports a compression type we support
-  bool acceptsSupportedCompressionType(HTTPMessage* msg) noexcept {
+  /**
+   * Pick the compression level of each response with levelController, in
+   * place of compressionLevel. Call before the server starts.
+   */
+  void setLevelController(
+      std::shared_ptr<const CompressionLevelController> levelController) {
+    levelController_ = std::move(levelController);
+  }
 
-    std::vector<RFC2616::TokenQPair> output;
+  /**
+   * The content coding of encodings (in order of preference) to use for
+   * a request with Accept-Encoding acceptEncoding, or "" for none.
+   */
+  static std::string negotiateEncoding(
+      const std::string& acceptEncoding,
+      const std::vector<std::string>& encodings) noexcept {
+    int index = negotiateEncodingIndex(acceptEncoding, encodings);
+    return index < 0 ? "" : encodings[index];
+  }
+
+  /**
+   * The index in encodings of the content coding negotiateEncoding()
+   * picks, or -1 for none, in one pass over Accept-Encoding.
+   */
+  static int negotiateEncodingIndex(
+      folly::StringPiece acceptEncoding,
+      const std::vector<std::string>& encodings) noexcept {
+    // the qvalue of the first mention of each encoding, or -1
+    folly::small_vector<double, 4> qvalues(encodings.size(), -1);
 
     //Accept encoding header could have qvalues (gzip; q=5.0)
-    auto acceptEncodingHeader =
-        msg->getHeaders().getSingleOrEmpty(HTTP_HEADER_ACCEPT_ENCODING);
+    bool valid = RFC2616::forEachQvalue(acceptEncoding,
+        [&] (folly::StringPiece token, double qvalue) {
+          for (size_t i = 0; i < encodings.size(); i++) {
+            if (qvalues[i] < 0 && token == encodings[i]) {
+              qvalues[i] = qvalue;
+            }
+          }
+          return false;
+        });
+    if (!valid) {
+      return -1;
+    }
 
-    if (RFC2616::parseQvalues(acceptEncodingHeader, output)) {
-      std::vector<RFC2616::TokenQPair>::iterator it = std::find_if(
-          output.begin(), output.end(), [](RFC2616::TokenQPair elem) {
-            return elem.first.compare(folly::StringPiece("gzip")) == 0;
-          });
+    int best = -1;
+    double bestQvalue = 0;
+    for (size_t i = 0; i < encodings.size(); i++) {
+      if (qvalues[i] > bestQvalue) {
+        best = i;
+        bestQvalue = qvalues[i];
+      }
+    }
+    return best;
+  }
 
-      return (it != output.end());
+ protected:
+  /**
+   * negotiateEncoding() over encodings_, remembering the outcome for the
+   * last few distinct Accept-Encoding values seen by this thread, since
+   * clients of a server send very few different ones.
+   */
+  const std::string* memoizedEncoding(const std::string& acceptEncoding) {
+    auto& memo = local_->memo;
+    for (size_t i = 0; i < memo.used; i++) {
+      if (memo.acceptEncodings[i] == acceptEncoding) {
+        return memo.choices[i] < 0 ? nullptr : &encodings_[memo.choices[i]];
+      }
     }
+    int choice = negotiateEncodingIndex(acceptEncoding, encodings_);
+    size_t slot = memo.next;
+    memo.next = (slot + 1) % Memo::kSize;
+    if (memo.used <= slot) {
+      memo.used = slot + 1;
+    }
+    // reuses the capacity of the value it replaces
+    memo.acceptEncodings[slot].assign(acceptEncoding);
+    memo.choices[slot] = choice;
+    return choice < 0 ? nullptr : &encodings_[choice];
+  }
 
-    return false;
+  /**
+   * The matcher of the compressible content types of this thread, built
+   * again when they were changed since
+   */
+  const std::shared_ptr<const ContentTypeMatcher>& getContentTypes() {
+    auto& local = *local_;
+    auto version = contentTypesVersion_.load(std::memory_order_acquire);
+    if (!local.contentTypes || local.contentTypesVersion != version) {
+      std::lock_guard<std::mutex> g(contentTypesLock_);
+      local.contentTypes = std::make_shared<const ContentTypeMatcher>(
+        *compressibleContentTypes_);
+      local.contentTypesVersion =
+        contentTypesVersion_.load(std::memory_order_relaxed);
+    }
+    return local.contentTypes;
   }
 
+  struct Memo {
+    static const size_t kSize = 8;
+    std::string acceptEncodings[kSize];
+    int choices[kSize];
+    size_t used{0};
+    size_t next{0};
+  };
+
+  struct ThreadState {
+    Memo memo;
+    std::shared_ptr<const ContentTypeMatcher> contentTypes;
+    uint64_t contentTypesVersion{0};
+  };
+
   int32_t compressionLevel_;
   uint32_t minimumCompressionSize_;
-  const std::shared_ptr<std::set<std::string>> compressibleContentTypes_;
+  // Only read to build the matcher of each thread
+  std::shared_ptr<const std::set<std::string>> compressibleContentTypes_;
+  std::mutex contentTypesLock_;
+  std::atomic<uint64_t> contentTypesVersion_{0};
+  std::vector<std::string> encodings_;
+  std::shared_ptr<CompressedBodyCache> cache_;
+  bool stream_;
+  std::shared_ptr<const CompressionLevelController> levelController_;
+  folly::ThreadLocal<ThreadState> local_;
 };
 }
@@ -0,0 +1,57 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <gtest/gtest.h>
+#include <proxygen/httpserver/filters/CompressedBodyCache.h>
+
+using namespace proxygen;
+
+namespace {
+
+std::string get(CompressedBodyCache& cache, const std::string& key) {
+  auto body = cache.get(key);
+  return body ? body->moveToFbString().toStdString() : "";
+}
+
+}
+
+TEST(CompressedBodyCacheTest, evicts_least_recently_used) {
+  CompressedBodyCache cache(10);
+  cache.put("a", folly::IOBuf::copyBuffer("aaaa"));
+  cache.put("b", folly::IOBuf::copyBuffer("bbbb"));
+  EXPECT_EQ(8, cache.size());
+  EXPECT_EQ("aaaa", get(cache, "a"));
+
+  // b was used last
+  cache.put("c", folly::IOBuf::copyBuffer("cccc"));
+  EXPECT_EQ(8, cache.size());
+  EXPECT_EQ("", get(cache, "b"));
+  EXPECT_EQ("aaaa", get(cache, "a"));
+  EXPECT_EQ("cccc", get(cache, "c"));
+
+  // Replacing an entry gives its space back
+  cache.put("a", folly::IOBuf::copyBuffer("AAAAAA"));
+  EXPECT_EQ(10, cache.size());
+  EXPECT_EQ("AAAAAA", get(cache, "a"));
+  EXPECT_EQ("cccc", get(cache, "c"));
+}
+
+TEST(CompressedBodyCacheTest, too_large) {
+  CompressedBodyCache cache(10);
+  cache.put("a", folly::IOBuf::copyBuffer("aaaa"));
+  cache.put("b", folly::IOBuf::copyBuffer("bbbbbbbbbbb"));
+  EXPECT_EQ("", get(cache, "b"));
+  EXPECT_EQ("aaaa", get(cache, "a"));
+  EXPECT_EQ(4, cache.size());
+}
+
+TEST(CompressedBodyCacheTest, keys) {
+  EXPECT_NE(CompressedBodyCache::makeKey("gzip", "\"abc\""),
+            CompressedBodyCache::makeKey("br", "\"abc\""));
+}
@@ -0,0 +1,136 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <deque>
+#include <folly/io/IOBuf.h>
+#include <folly/io/async/EventBaseManager.h>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <proxygen/httpserver/filters/OffloadFilter.h>
+#include <proxygen/httpserver/Mocks.h>
+
+using namespace proxygen;
+using namespace testing;
+
+namespace {
+
+// Holds on to what it is given until run() is called from the test
+class QueuedExecutor : public folly::Executor {
+ public:
+  void add(folly::Func fn) override {
+    funcs.push_back(std::move(fn));
+  }
+
+  void run() {
+    while (!funcs.empty()) {
+      auto fn = std::move(funcs.front());
+      funcs.pop_front();
+      fn();
+    }
+  }
+
+  std::deque<folly::Func> funcs;
+};
+
+}
+
+class OffloadFilterTest : public Test {
+ public:
+  void SetUp() override {
+    eventBase_ = folly::EventBaseManager::get()->getEventBase();
+    filter_ = new OffloadFilter(&requestHandler_, &executor_, 10);
+    responseHandler_ = folly::make_unique<StrictMock<MockResponseHandler>>(
+      filter_);
+    EXPECT_CALL(requestHandler_, setResponseHandler(filter_));
+    filter_->setResponseHandler(responseHandler_.get());
+  }
+
+  void finish() {
+    filter_->requestComplete();
+    EXPECT_CALL(requestHandler_, requestComplete());
+    executor_.run();
+    // deletes the filter
+    eventBase_->loopOnce();
+  }
+
+ protected:
+  folly::EventBase* eventBase_;
+  QueuedExecutor executor_;
+  StrictMock<MockRequestHandler> requestHandler_;
+  std::unique_ptr<StrictMock<MockResponseHandler>> responseHandler_;
+  OffloadFilter* filter_;
+};
+
+TEST_F(OffloadFilterTest, handler_runs_on_executor) {
+  filter_->onRequest(folly::make_unique<HTTPMessage>());
+  filter_->onEOM();
+  EXPECT_EQ(executor_.funcs.size(), 1);
+
+  ResponseHandler* downstream = filter_;
+  EXPECT_CALL(requestHandler_, onRequest(_));
+  EXPECT_CALL(requestHandler_, onEOM())
+    .WillOnce(Invoke([downstream] {
+          HTTPMessage msg;
+          msg.setStatusCode(200);
+          downstream->sendHeaders(msg);
+          downstream->sendBody(folly::IOBuf::copyBuffer("hello"));
+          downstream->sendEOM();
+        }));
+  executor_.run();
+
+  // The whole response goes back to the IO thread at once
+  InSequence enforceOrder;
+  EXPECT_CALL(*responseHandler_, sendHeaders(_));
+  EXPECT_CALL(*responseHandler_, sendBody(_));
+  EXPECT_CALL(*responseHandler_, sendEOM());
+  eventBase_->loopOnce();
+
+  finish();
+}
+
+TEST_F(OffloadFilterTest, ingress_backpressure) {
+  filter_->onRequest(folly::make_unique<HTTPMessage>());
+  filter_->onBody(folly::IOBuf::copyBuffer("123456"));
+  EXPECT_CALL(*responseHandler_, pauseIngress());
+  filter_->onBody(folly::IOBuf::copyBuffer("123456"));
+
+  EXPECT_CALL(requestHandler_, onRequest(_));
+  EXPECT_CALL(requestHandler_, onBody(_))
+    .Times(2);
+  executor_.run();
+
+  // Resumed once the handler caught up
+  EXPECT_CALL(*responseHandler_, resumeIngress());
+  eventBase_->loopOnce();
+
+  finish();
+}
+
+TEST_F(OffloadFilterTest, handler_pause) {
+  ResponseHandler* downstream = filter_;
+  filter_->onRequest(folly::make_unique<HTTPMessage>());
+  EXPECT_CALL(requestHandler_, onRequest(_))
+    .WillOnce(InvokeWithoutArgs([downstream] {
+          downstream->pauseIngress();
+        }));
+  executor_.run();
+
+  EXPECT_CALL(*responseHandler_, pauseIngress());
+  eventBase_->loopOnce();
+
+  // Going over the ingress limit and back doesn't resume ingress while
+  // the handler wants it paused
+  filter_->onBody(folly::IOBuf::copyBuffer("123456789012"));
+  EXPECT_CALL(requestHandler_, onBody(_));
+  executor_.run();
+  eventBase_->loopOnce();
+
+  finish();
+}
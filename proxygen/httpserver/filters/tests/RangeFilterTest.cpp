@@ -0,0 +1,178 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <proxygen/httpserver/Mocks.h>
+#include <proxygen/httpserver/ResponseBuilder.h>
+#include <proxygen/httpserver/filters/RangeFilter.h>
+
+using namespace proxygen;
+using namespace testing;
+
+class RangeFilterTest : public Test {
+ public:
+  void SetUp() override {
+    EXPECT_CALL(handler_, setResponseHandler(_))
+      .WillOnce(SaveArg<0>(&downstream_));
+    ON_CALL(handler_, onRequest(_)).WillByDefault(
+      Invoke([this] (std::shared_ptr<HTTPMessage> msg) {
+          request_ = *msg;
+        }));
+    ON_CALL(client_, sendHeaders(_)).WillByDefault(
+      Invoke([this] (HTTPMessage& msg) {
+          response_ = msg;
+        }));
+    ON_CALL(client_, sendBody(_)).WillByDefault(
+      Invoke([this] (std::shared_ptr<folly::IOBuf> buf) {
+          body_ += buf->clone()->moveToFbString().toStdString();
+        }));
+    ON_CALL(client_, sendEOM()).WillByDefault(
+      Invoke([this] { eom_ = true; }));
+  }
+
+  void TearDown() override {
+    if (filter_) {
+      filter_->requestComplete();
+    }
+  }
+
+ protected:
+  void start(const std::string& range, const std::string& ifRange = "") {
+    HTTPMessage request;
+    request.setMethod(HTTPMethod::GET);
+    request.setURL("/video");
+    request.getHeaders().set(HTTP_HEADER_RANGE, range);
+    if (!ifRange.empty()) {
+      request.getHeaders().set(HTTP_HEADER_IF_RANGE, ifRange);
+    }
+    filter_ = factory_.onRequest(&handler_, &request);
+    filter_->setResponseHandler(&client_);
+    filter_->onRequest(folly::make_unique<HTTPMessage>(request));
+    filter_->onEOM();
+  }
+
+  // Sends "0123456789" in bodies of 3 bytes
+  void respond(const std::string& etag = "\"v1\"") {
+    ResponseBuilder(downstream_)
+      .status(200, "OK")
+      .header(HTTP_HEADER_CONTENT_TYPE, "text/plain")
+      .header(HTTP_HEADER_CONTENT_LENGTH, "10")
+      .header(HTTP_HEADER_ETAG, etag)
+      .send();
+    for (auto piece: {"012", "345", "678", "9"}) {
+      downstream_->sendBody(folly::IOBuf::copyBuffer(piece));
+    }
+    downstream_->sendEOM();
+  }
+
+  RangeFilterFactory factory_;
+  NiceMock<MockRequestHandler> handler_;
+  NiceMock<MockResponseHandler> client_{&handler_};
+  RequestHandler* filter_{nullptr};
+  ResponseHandler* downstream_{nullptr};
+  HTTPMessage request_;
+  HTTPMessage response_;
+  std::string body_;
+  bool eom_{false};
+};
+
+TEST_F(RangeFilterTest, parse) {
+  std::vector<RangeFilter::Spec> specs;
+  EXPECT_TRUE(RangeFilter::parseRange("bytes=0-499, -500,9500-,", specs));
+  ASSERT_EQ(3, specs.size());
+  EXPECT_EQ(0, specs[0].first);
+  EXPECT_EQ(499, specs[0].last);
+  EXPECT_FALSE(specs[0].suffix);
+  EXPECT_EQ(500, specs[1].first);
+  EXPECT_TRUE(specs[1].suffix);
+  EXPECT_EQ(9500, specs[2].first);
+  EXPECT_EQ(std::numeric_limits<uint64_t>::max(), specs[2].last);
+
+  for (auto invalid: {"bytes=", "items=0-1", "bytes=5-1", "bytes=1",
+                      "bytes=a-b", "bytes=-", "bytes=99999999999999999999-"}) {
+    EXPECT_FALSE(RangeFilter::parseRange(invalid, specs)) << invalid;
+  }
+}
+
+TEST_F(RangeFilterTest, resolve) {
+  std::vector<RangeFilter::Spec> specs;
+  ASSERT_TRUE(RangeFilter::parseRange("bytes=8-,2-3,-3,4-5,20-,-0", specs));
+  auto ranges = RangeFilter::resolveRanges(specs, 10);
+  ASSERT_EQ(2, ranges.size());
+  EXPECT_EQ(2, ranges[0].first);
+  EXPECT_EQ(5, ranges[0].last);
+  EXPECT_EQ(7, ranges[1].first);
+  EXPECT_EQ(9, ranges[1].last);
+  EXPECT_TRUE(RangeFilter::resolveRanges(specs, 0).empty());
+}
+
+TEST_F(RangeFilterTest, single_range) {
+  start("bytes=2-7");
+  EXPECT_FALSE(request_.getHeaders().exists(HTTP_HEADER_RANGE));
+  respond();
+  EXPECT_EQ(206, response_.getStatusCode());
+  EXPECT_EQ("bytes 2-7/10",
+            response_.getHeaders().getSingleOrEmpty(HTTP_HEADER_CONTENT_RANGE));
+  EXPECT_EQ("6",
+            response_.getHeaders().getSingleOrEmpty(
+              HTTP_HEADER_CONTENT_LENGTH));
+  EXPECT_EQ("234567", body_);
+  EXPECT_TRUE(eom_);
+}
+
+TEST_F(RangeFilterTest, multiple_ranges) {
+  start("bytes=7-8,0-1");
+  respond();
+  EXPECT_EQ(206, response_.getStatusCode());
+  const auto& type =
+    response_.getHeaders().getSingleOrEmpty(HTTP_HEADER_CONTENT_TYPE);
+  const std::string prefix("multipart/byteranges; boundary=");
+  ASSERT_EQ(prefix, type.substr(0, prefix.size()));
+  auto boundary = type.substr(prefix.size());
+  EXPECT_EQ("--" + boundary + "\r\n"
+            "Content-Type: text/plain\r\n"
+            "Content-Range: bytes 0-1/10\r\n\r\n"
+            "01"
+            "\r\n--" + boundary + "\r\n"
+            "Content-Type: text/plain\r\n"
+            "Content-Range: bytes 7-8/10\r\n\r\n"
+            "78"
+            "\r\n--" + boundary + "--\r\n", body_);
+  EXPECT_EQ(folly::to<std::string>(body_.size()),
+            response_.getHeaders().getSingleOrEmpty(
+              HTTP_HEADER_CONTENT_LENGTH));
+}
+
+TEST_F(RangeFilterTest, not_satisfiable) {
+  start("bytes=10-");
+  respond();
+  EXPECT_EQ(416, response_.getStatusCode());
+  EXPECT_EQ("bytes */10",
+            response_.getHeaders().getSingleOrEmpty(HTTP_HEADER_CONTENT_RANGE));
+  EXPECT_EQ("", body_);
+  EXPECT_TRUE(eom_);
+}
+
+TEST_F(RangeFilterTest, if_range) {
+  start("bytes=0-0", "\"v0\"");
+  EXPECT_FALSE(request_.getHeaders().exists(HTTP_HEADER_IF_RANGE));
+  respond("\"v1\"");
+  EXPECT_EQ(200, response_.getStatusCode());
+  EXPECT_EQ("bytes",
+            response_.getHeaders().getSingleOrEmpty(HTTP_HEADER_ACCEPT_RANGES));
+  EXPECT_EQ("0123456789", body_);
+}
+
+TEST_F(RangeFilterTest, if_range_matches) {
+  start("bytes=-1", "\"v1\"");
+  respond("\"v1\"");
+  EXPECT_EQ(206, response_.getStatusCode());
+  EXPECT_EQ("9", body_);
+}
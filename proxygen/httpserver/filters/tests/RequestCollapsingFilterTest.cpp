@@ -0,0 +1,168 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/io/async/EventBase.h>
+#include <folly/io/async/EventBaseManager.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <proxygen/httpserver/Mocks.h>
+#include <proxygen/httpserver/ResponseBuilder.h>
+#include <proxygen/httpserver/filters/RequestCollapsingFilter.h>
+
+using namespace proxygen;
+using namespace testing;
+
+class RequestCollapsingFilterTest : public Test {
+ public:
+  void SetUp() override {
+    folly::EventBaseManager::get()->setEventBase(&evb_, false);
+  }
+
+  void TearDown() override {
+    folly::EventBaseManager::get()->clearEventBase();
+  }
+
+ protected:
+  // One request through the filter, to its own handler and client
+  struct Exchange {
+    explicit Exchange(RequestHandlerFactory& factory)
+        : client(&handler) {
+      EXPECT_CALL(handler, setResponseHandler(_))
+          .WillOnce(SaveArg<0>(&downstream));
+      ON_CALL(client, sendHeaders(_)).WillByDefault(
+          Invoke([this] (HTTPMessage& msg) {
+            status = msg.getStatusCode();
+          }));
+      ON_CALL(client, sendBody(_)).WillByDefault(
+          Invoke([this] (std::shared_ptr<folly::IOBuf> buf) {
+            body += buf->clone()->moveToFbString().toStdString();
+          }));
+      ON_CALL(client, sendEOM()).WillByDefault(
+          Invoke([this] { eom = true; }));
+      request.setMethod(HTTPMethod::GET);
+      request.setURL("/popular");
+      request.getHeaders().set(HTTP_HEADER_HOST, "www.foo.com");
+      filter = factory.onRequest(&handler, &request);
+    }
+
+    ~Exchange() {
+      if (filter) {
+        filter->requestComplete();
+      }
+    }
+
+    void start() {
+      filter->setResponseHandler(&client);
+      filter->onRequest(folly::make_unique<HTTPMessage>(request));
+      filter->onEOM();
+    }
+
+    HTTPMessage request;
+    NiceMock<MockRequestHandler> handler;
+    NiceMock<MockResponseHandler> client;
+    RequestHandler* filter{nullptr};
+    ResponseHandler* downstream{nullptr};
+    uint16_t status{0};
+    std::string body;
+    bool eom{false};
+  };
+
+  void respond(Exchange& exchange, const std::string& header = "") {
+    ResponseBuilder builder(exchange.downstream);
+    builder.status(200, "OK");
+    if (!header.empty()) {
+      builder.header(HTTP_HEADER_SET_COOKIE, header);
+    }
+    builder.send();
+    ResponseBuilder(exchange.downstream).body("pop").send();
+    ResponseBuilder(exchange.downstream).body("ular").sendWithEOM();
+  }
+
+  folly::EventBase evb_;
+  RequestCollapsingFilterFactory factory_{std::chrono::milliseconds(50)};
+};
+
+TEST_F(RequestCollapsingFilterTest, collapses) {
+  Exchange first(factory_);
+  EXPECT_CALL(first.handler, onRequest(_));
+  EXPECT_CALL(first.handler, onEOM());
+  first.start();
+  Exchange second(factory_);
+  EXPECT_CALL(second.handler, onRequest(_)).Times(0);
+  EXPECT_CALL(second.handler, onError(kErrorCanceled));
+  second.start();
+  Exchange third(factory_);
+  EXPECT_CALL(third.handler, onRequest(_)).Times(0);
+  EXPECT_CALL(third.handler, onError(kErrorCanceled));
+  third.start();
+  EXPECT_EQ(1, factory_.getCollapser()->size());
+
+  respond(first);
+  EXPECT_EQ("popular", first.body);
+  EXPECT_FALSE(second.eom);
+  evb_.loopOnce(EVLOOP_NONBLOCK);
+  for (auto exchange: {&second, &third}) {
+    EXPECT_EQ(200, exchange->status);
+    EXPECT_EQ("popular", exchange->body);
+    EXPECT_TRUE(exchange->eom);
+  }
+  EXPECT_EQ(0, factory_.getCollapser()->size());
+
+  // That one is over, the next leads again
+  Exchange fourth(factory_);
+  EXPECT_CALL(fourth.handler, onEOM());
+  fourth.start();
+}
+
+TEST_F(RequestCollapsingFilterTest, not_shared) {
+  Exchange first(factory_);
+  first.start();
+  Exchange second(factory_);
+  second.start();
+  EXPECT_CALL(second.handler, onRequest(_));
+  EXPECT_CALL(second.handler, onEOM());
+  respond(first, "session=1");
+  evb_.loopOnce(EVLOOP_NONBLOCK);
+  EXPECT_EQ(0, second.status);
+  EXPECT_FALSE(second.eom);
+}
+
+TEST_F(RequestCollapsingFilterTest, wait_timeout) {
+  Exchange first(factory_);
+  first.start();
+  Exchange second(factory_);
+  second.start();
+  EXPECT_CALL(second.handler, onRequest(_));
+  EXPECT_CALL(second.handler, onEOM());
+  // Only the timeout is left to run
+  evb_.loop();
+  Mock::VerifyAndClearExpectations(&second.handler);
+
+  // The response of the leader is still shared with whoever waited less
+  Exchange third(factory_);
+  EXPECT_CALL(third.handler, onError(kErrorCanceled));
+  third.start();
+  respond(first);
+  evb_.loopOnce(EVLOOP_NONBLOCK);
+  EXPECT_EQ("popular", third.body);
+  EXPECT_EQ("", second.body);
+}
+
+TEST_F(RequestCollapsingFilterTest, leader_fails) {
+  Exchange first(factory_);
+  first.start();
+  Exchange second(factory_);
+  second.start();
+  EXPECT_CALL(second.handler, onRequest(_));
+  EXPECT_CALL(second.handler, onEOM());
+  first.filter->onError(kErrorConnectionReset);
+  first.filter = nullptr;
+  evb_.loopOnce(EVLOOP_NONBLOCK);
+  EXPECT_EQ(0, factory_.getCollapser()->size());
+}
@@ -0,0 +1,155 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/Conv.h>
+#include <folly/io/Cursor.h>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <proxygen/httpserver/Mocks.h>
+#include <proxygen/httpserver/ResponseBuilder.h>
+#include <proxygen/httpserver/filters/RequestDecompressionFilter.h>
+#include <proxygen/lib/utils/ZlibStreamCompressor.h>
+
+using namespace proxygen;
+using namespace testing;
+
+class RequestDecompressionFilterTest : public Test {
+ public:
+  void SetUp() override {
+    ON_CALL(handler_, setResponseHandler(_)).WillByDefault(
+      SaveArg<0>(&downstream_));
+    ON_CALL(handler_, onRequest(_)).WillByDefault(
+      Invoke([this] (std::shared_ptr<HTTPMessage> msg) {
+          request_ = *msg;
+        }));
+    ON_CALL(handler_, onBody(_)).WillByDefault(
+      Invoke([this] (std::shared_ptr<folly::IOBuf> buf) {
+          body_ += buf->clone()->moveToFbString().toStdString();
+        }));
+    ON_CALL(handler_, onEOM()).WillByDefault(
+      Invoke([this] { eom_ = true; }));
+    ON_CALL(client_, sendHeaders(_)).WillByDefault(
+      Invoke([this] (HTTPMessage& msg) {
+          response_ = msg;
+        }));
+  }
+
+  void TearDown() override {
+    if (filter_) {
+      filter_->requestComplete();
+    }
+  }
+
+ protected:
+  void start(const std::string& encoding, const std::string& length) {
+    HTTPMessage request;
+    request.setMethod(HTTPMethod::POST);
+    request.setURL("/upload");
+    request.getHeaders().set(HTTP_HEADER_CONTENT_ENCODING, encoding);
+    request.getHeaders().set(HTTP_HEADER_CONTENT_LENGTH, length);
+    filter_ = factory_.onRequest(&handler_, &request);
+    filter_->setResponseHandler(&client_);
+    filter_->onRequest(folly::make_unique<HTTPMessage>(request));
+  }
+
+  static std::unique_ptr<folly::IOBuf> compress(const std::string& data) {
+    ZlibStreamCompressor compressor(ZlibCompressionType::GZIP, 6);
+    auto in = folly::IOBuf::copyBuffer(data);
+    return compressor.compress(in.get());
+  }
+
+  RequestDecompressionFilterFactory factory_{1000};
+  NiceMock<MockRequestHandler> handler_;
+  NiceMock<MockResponseHandler> client_{&handler_};
+  RequestHandler* filter_{nullptr};
+  ResponseHandler* downstream_{nullptr};
+  HTTPMessage request_;
+  HTTPMessage response_;
+  std::string body_;
+  bool eom_{false};
+};
+
+TEST_F(RequestDecompressionFilterTest, encodings) {
+  EXPECT_EQ(ZlibCompressionType::GZIP,
+            RequestDecompressionFilterFactory::getCompressionType("gzip"));
+  EXPECT_EQ(ZlibCompressionType::GZIP,
+            RequestDecompressionFilterFactory::getCompressionType("X-Gzip"));
+  EXPECT_EQ(ZlibCompressionType::DEFLATE,
+            RequestDecompressionFilterFactory::getCompressionType("deflate"));
+  for (auto other: {"", "identity", "br", "gzip, gzip"}) {
+    EXPECT_EQ(ZlibCompressionType::NONE,
+              RequestDecompressionFilterFactory::getCompressionType(other))
+      << other;
+  }
+
+  HTTPMessage request;
+  EXPECT_EQ(&handler_, factory_.onRequest(&handler_, &request));
+}
+
+// Each compressed body is inflated as it comes
+TEST_F(RequestDecompressionFilterTest, inflate) {
+  auto compressed = compress("Hello World");
+  auto length = compressed->computeChainDataLength();
+  start("gzip", folly::to<std::string>(length));
+  EXPECT_FALSE(request_.getHeaders().exists(HTTP_HEADER_CONTENT_ENCODING));
+  EXPECT_FALSE(request_.getHeaders().exists(HTTP_HEADER_CONTENT_LENGTH));
+
+  folly::io::Cursor cursor(compressed.get());
+  std::unique_ptr<folly::IOBuf> half;
+  cursor.clone(half, length / 2);
+  filter_->onBody(std::move(half));
+  std::unique_ptr<folly::IOBuf> rest;
+  cursor.clone(rest, length - length / 2);
+  filter_->onBody(std::move(rest));
+  filter_->onEOM();
+
+  EXPECT_EQ("Hello World", body_);
+  EXPECT_TRUE(eom_);
+}
+
+TEST_F(RequestDecompressionFilterTest, too_large) {
+  auto compressed = compress(std::string(100000, 'a'));
+  start("gzip", folly::to<std::string>(compressed->computeChainDataLength()));
+
+  EXPECT_CALL(handler_, onError(kErrorBadDecompress));
+  EXPECT_CALL(client_, sendEOM());
+  filter_->onBody(std::move(compressed));
+  filter_->onEOM();
+
+  EXPECT_EQ(413, response_.getStatusCode());
+  EXPECT_LE(body_.size(), 1000);
+  EXPECT_FALSE(eom_);
+}
+
+TEST_F(RequestDecompressionFilterTest, truncated) {
+  auto compressed = compress("Hello World");
+  compressed->coalesce();
+  compressed->trimEnd(4);
+  start("gzip", folly::to<std::string>(compressed->length()));
+
+  EXPECT_CALL(handler_, onError(kErrorBadDecompress));
+  filter_->onBody(std::move(compressed));
+  filter_->onEOM();
+
+  EXPECT_EQ(400, response_.getStatusCode());
+  EXPECT_FALSE(eom_);
+}
+
+// Once the handler has responded, the response is aborted instead
+TEST_F(RequestDecompressionFilterTest, corrupt_after_response) {
+  start("deflate", "9");
+  ResponseBuilder(downstream_).status(200, "OK").send();
+
+  EXPECT_CALL(handler_, onError(kErrorBadDecompress));
+  EXPECT_CALL(client_, sendAbort());
+  filter_->onBody(folly::IOBuf::copyBuffer("not zlib!"));
+  filter_->onEOM();
+  EXPECT_TRUE(body_.empty());
+}
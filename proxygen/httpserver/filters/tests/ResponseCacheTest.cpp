@@ -0,0 +1,317 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <proxygen/httpserver/Mocks.h>
+#include <proxygen/httpserver/ResponseBuilder.h>
+#include <proxygen/httpserver/filters/ResponseCacheFilter.h>
+
+using namespace proxygen;
+using namespace testing;
+
+namespace {
+
+HTTPMessage makeRequest(const std::string& url) {
+  HTTPMessage request;
+  request.setMethod(HTTPMethod::GET);
+  request.setURL(url);
+  request.getHeaders().set(HTTP_HEADER_HOST, "www.foo.com");
+  return request;
+}
+
+HTTPMessage makeResponse(const std::string& cacheControl) {
+  HTTPMessage response;
+  response.setStatusCode(200);
+  if (!cacheControl.empty()) {
+    response.getHeaders().set(HTTP_HEADER_CACHE_CONTROL, cacheControl);
+  }
+  return response;
+}
+
+std::shared_ptr<ResponseCache::Response> makeStored(
+    const std::string& body,
+    std::vector<std::pair<std::string, std::string>> vary = {}) {
+  auto stored = std::make_shared<ResponseCache::Response>();
+  stored->message = makeResponse("max-age=60");
+  stored->body = folly::IOBuf::copyBuffer(body);
+  stored->vary = vary;
+  stored->storedAt = getCurrentTime();
+  stored->maxAge = std::chrono::seconds(60);
+  return stored;
+}
+
+std::string getBody(ResponseCache& cache, const std::string& key,
+                    const HTTPMessage& request) {
+  auto stored = cache.get(key, request);
+  return stored ? stored->body->clone()->moveToFbString().toStdString() : "";
+}
+
+}
+
+TEST(ResponseCacheTest, evicts_least_recently_used) {
+  ResponseCache::Options options;
+  options.numShards = 1;
+  options.capacity = 1 << 20;
+  auto request = makeRequest("/");
+  {
+    // Find out what an entry takes
+    ResponseCache cache(options);
+    cache.put("a", makeStored("aaaa"));
+    options.capacity = cache.size() * 2;
+  }
+  ResponseCache cache(options);
+  cache.put("a", makeStored("aaaa"));
+  cache.put("b", makeStored("bbbb"));
+  EXPECT_EQ("aaaa", getBody(cache, "a", request));
+
+  // b was used last
+  cache.put("c", makeStored("cccc"));
+  EXPECT_EQ("", getBody(cache, "b", request));
+  EXPECT_EQ("aaaa", getBody(cache, "a", request));
+  EXPECT_EQ("cccc", getBody(cache, "c", request));
+
+  cache.remove("a");
+  EXPECT_EQ("", getBody(cache, "a", request));
+  EXPECT_EQ(options.capacity / 2, cache.size());
+}
+
+TEST(ResponseCacheTest, vary) {
+  ResponseCache::Options options;
+  options.maxVariants = 2;
+  ResponseCache cache(options);
+  auto gzip = makeRequest("/");
+  gzip.getHeaders().set(HTTP_HEADER_ACCEPT_ENCODING, "gzip");
+  auto br = makeRequest("/");
+  br.getHeaders().set(HTTP_HEADER_ACCEPT_ENCODING, "br");
+  auto plain = makeRequest("/");
+
+  auto response = makeResponse("max-age=60");
+  response.getHeaders().set(HTTP_HEADER_VARY, "Accept-Encoding");
+  cache.put("/", makeStored("gzip",
+                            ResponseCache::getVary(gzip.getHeaders(),
+                                                   response)));
+  cache.put("/", makeStored("br",
+                            ResponseCache::getVary(br.getHeaders(),
+                                                   response)));
+  EXPECT_EQ("gzip", getBody(cache, "/", gzip));
+  EXPECT_EQ("br", getBody(cache, "/", br));
+  EXPECT_EQ("", getBody(cache, "/", plain));
+
+  // Only the last two variants are kept
+  cache.put("/", makeStored("plain",
+                            ResponseCache::getVary(plain.getHeaders(),
+                                                   response)));
+  EXPECT_EQ("", getBody(cache, "/", gzip));
+  EXPECT_EQ("br", getBody(cache, "/", br));
+  EXPECT_EQ("plain", getBody(cache, "/", plain));
+}
+
+TEST(ResponseCacheTest, lifetimes) {
+  using std::chrono::seconds;
+  EXPECT_EQ(seconds(60), *ResponseCache::getStorableLifetime(
+              makeResponse("public, max-age=60")));
+  EXPECT_EQ(seconds(10), *ResponseCache::getStorableLifetime(
+              makeResponse("max-age=60, s-maxage=\"10\"")));
+  EXPECT_EQ(seconds(0), *ResponseCache::getStorableLifetime(
+              makeResponse("no-cache, max-age=60")));
+  EXPECT_FALSE(ResponseCache::getStorableLifetime(
+                 makeResponse("no-store")));
+  EXPECT_FALSE(ResponseCache::getStorableLifetime(
+                 makeResponse("Private, max-age=60")));
+  EXPECT_FALSE(ResponseCache::getStorableLifetime(makeResponse("")));
+
+  // What has an ETag can still be revalidated
+  auto response = makeResponse("");
+  response.getHeaders().set(HTTP_HEADER_ETAG, "\"abc\"");
+  EXPECT_EQ(seconds(0), *ResponseCache::getStorableLifetime(response));
+
+  response = makeResponse("max-age=60");
+  response.getHeaders().set(HTTP_HEADER_SET_COOKIE, "a=b");
+  EXPECT_FALSE(ResponseCache::getStorableLifetime(response));
+
+  response = makeResponse("max-age=60");
+  response.setStatusCode(404);
+  EXPECT_FALSE(ResponseCache::getStorableLifetime(response));
+}
+
+TEST(ResponseCacheTest, requests) {
+  auto request = makeRequest("/");
+  EXPECT_TRUE(ResponseCache::isCacheableRequest(request));
+  EXPECT_TRUE(ResponseCache::allowsStoredResponse(request));
+
+  request.getHeaders().set(HTTP_HEADER_CACHE_CONTROL, "no-cache");
+  EXPECT_TRUE(ResponseCache::isCacheableRequest(request));
+  EXPECT_FALSE(ResponseCache::allowsStoredResponse(request));
+
+  request.getHeaders().set(HTTP_HEADER_CACHE_CONTROL, "no-store");
+  EXPECT_FALSE(ResponseCache::isCacheableRequest(request));
+
+  request = makeRequest("/");
+  request.getHeaders().set(HTTP_HEADER_AUTHORIZATION, "Basic Zm9vOmJhcg==");
+  EXPECT_FALSE(ResponseCache::isCacheableRequest(request));
+
+  request = makeRequest("/");
+  request.setMethod(HTTPMethod::POST);
+  EXPECT_FALSE(ResponseCache::isCacheableRequest(request));
+
+  request = makeRequest("/");
+  request.getHeaders().set(HTTP_HEADER_IF_NONE_MATCH, "\"x\", W/\"abc\"");
+  EXPECT_TRUE(ResponseCache::matchesETag(request, "\"abc\""));
+  EXPECT_FALSE(ResponseCache::matchesETag(request, "\"ab\""));
+}
+
+class ResponseCacheFilterTest : public Test {
+ protected:
+  struct Exchange {
+    // The request as the handler got it, if it did
+    std::shared_ptr<HTTPMessage> handled;
+    uint16_t status{0};
+    HTTPHeaders headers;
+    std::string body;
+    bool eom{false};
+  };
+
+  // Sends the response, given the request the handler got
+  typedef std::function<void(ResponseHandler*, const HTTPMessage&)>
+    Responder;
+
+  Exchange exchange(HTTPMessage request, Responder respond) {
+    Exchange result;
+    NiceMock<MockRequestHandler> handler;
+    NiceMock<MockResponseHandler> client(&handler);
+    ResponseHandler* downstream = nullptr;
+    EXPECT_CALL(handler, setResponseHandler(_))
+        .WillOnce(SaveArg<0>(&downstream));
+    ON_CALL(handler, onRequest(_))
+        .WillByDefault(SaveArg<0>(&result.handled));
+    ON_CALL(client, sendHeaders(_)).WillByDefault(
+        Invoke([&] (HTTPMessage& msg) {
+          result.status = msg.getStatusCode();
+          result.headers = msg.getHeaders();
+        }));
+    ON_CALL(client, sendBody(_)).WillByDefault(
+        Invoke([&] (std::shared_ptr<folly::IOBuf> body) {
+          result.body += body->clone()->moveToFbString().toStdString();
+        }));
+    ON_CALL(client, sendEOM()).WillByDefault(
+        Invoke([&] { result.eom = true; }));
+
+    auto filter = factory_.onRequest(&handler, &request);
+    filter->setResponseHandler(&client);
+    filter->onRequest(folly::make_unique<HTTPMessage>(request));
+    filter->onEOM();
+    if (result.handled) {
+      respond(downstream, *result.handled);
+    }
+    filter->requestComplete();
+    return result;
+  }
+
+  static Responder respondWith(const std::string& cacheControl,
+                               const std::string& body,
+                               const std::string& etag = "") {
+    return [=] (ResponseHandler* downstream, const HTTPMessage&) {
+      ResponseBuilder builder(downstream);
+      builder.status(200, "OK")
+        .header(HTTP_HEADER_CACHE_CONTROL, cacheControl);
+      if (!etag.empty()) {
+        builder.header(HTTP_HEADER_ETAG, etag);
+      }
+      builder.body(body).sendWithEOM();
+    };
+  }
+
+  ResponseCacheFilterFactory factory_;
+};
+
+TEST_F(ResponseCacheFilterTest, hit) {
+  auto first = exchange(makeRequest("/a"), respondWith("max-age=60", "abc"));
+  EXPECT_TRUE(first.handled);
+  EXPECT_EQ(200, first.status);
+  EXPECT_EQ("abc", first.body);
+
+  auto second = exchange(makeRequest("/a"), respondWith("max-age=60", "x"));
+  EXPECT_FALSE(second.handled);
+  EXPECT_EQ(200, second.status);
+  EXPECT_EQ("abc", second.body);
+  EXPECT_TRUE(second.eom);
+  EXPECT_EQ("0", second.headers.getSingleOrEmpty(HTTP_HEADER_AGE));
+  EXPECT_EQ("3", second.headers.getSingleOrEmpty(HTTP_HEADER_CONTENT_LENGTH));
+
+  // Another resource isn't
+  auto other = exchange(makeRequest("/b"), respondWith("max-age=60", "x"));
+  EXPECT_TRUE(other.handled);
+}
+
+TEST_F(ResponseCacheFilterTest, not_storable) {
+  exchange(makeRequest("/a"), respondWith("private, max-age=60", "abc"));
+  auto second = exchange(makeRequest("/a"), respondWith("max-age=60", "x"));
+  EXPECT_TRUE(second.handled);
+  EXPECT_EQ("x", second.body);
+}
+
+TEST_F(ResponseCacheFilterTest, conditional_hit) {
+  exchange(makeRequest("/a"), respondWith("max-age=60", "abc", "\"1\""));
+  auto request = makeRequest("/a");
+  request.getHeaders().set(HTTP_HEADER_IF_NONE_MATCH, "\"1\"");
+  auto second = exchange(request, respondWith("max-age=60", "x"));
+  EXPECT_FALSE(second.handled);
+  EXPECT_EQ(304, second.status);
+  EXPECT_EQ("", second.body);
+  EXPECT_TRUE(second.eom);
+}
+
+TEST_F(ResponseCacheFilterTest, revalidate) {
+  exchange(makeRequest("/a"), respondWith("max-age=0", "abc", "\"1\""));
+
+  // Stale, so the handler is asked whether it changed
+  auto second = exchange(makeRequest("/a"),
+      [] (ResponseHandler* downstream, const HTTPMessage& request) {
+        EXPECT_EQ("\"1\"", request.getHeaders().getSingleOrEmpty(
+                    HTTP_HEADER_IF_NONE_MATCH));
+        ResponseBuilder(downstream)
+          .status(304, "Not Modified")
+          .header(HTTP_HEADER_CACHE_CONTROL, "max-age=60")
+          .sendWithEOM();
+      });
+  EXPECT_TRUE(second.handled);
+  EXPECT_EQ(200, second.status);
+  EXPECT_EQ("abc", second.body);
+  EXPECT_TRUE(second.eom);
+
+  // and the 304 made it fresh again
+  auto third = exchange(makeRequest("/a"), respondWith("max-age=60", "x"));
+  EXPECT_FALSE(third.handled);
+  EXPECT_EQ("abc", third.body);
+}
+
+TEST_F(ResponseCacheFilterTest, no_cache_request) {
+  exchange(makeRequest("/a"), respondWith("max-age=60", "abc"));
+  auto request = makeRequest("/a");
+  request.getHeaders().set(HTTP_HEADER_CACHE_CONTROL, "no-cache");
+  auto second = exchange(request, respondWith("max-age=60", "def"));
+  EXPECT_TRUE(second.handled);
+  EXPECT_EQ("def", second.body);
+
+  // and its response replaced the stored one
+  auto third = exchange(makeRequest("/a"), respondWith("max-age=60", "x"));
+  EXPECT_FALSE(third.handled);
+  EXPECT_EQ("def", third.body);
+}
+
+TEST_F(ResponseCacheFilterTest, unsafe_methods_invalidate) {
+  exchange(makeRequest("/a"), respondWith("max-age=60", "abc"));
+  auto post = makeRequest("/a");
+  post.setMethod(HTTPMethod::POST);
+  exchange(post, respondWith("", "ok"));
+  auto second = exchange(makeRequest("/a"), respondWith("max-age=60", "x"));
+  EXPECT_TRUE(second.handled);
+  EXPECT_EQ("x", second.body);
+}
@@ -0,0 +1,139 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <proxygen/httpserver/Mocks.h>
+#include <proxygen/httpserver/ResponseBuilder.h>
+#include <proxygen/httpserver/StaticFilters.h>
+
+using namespace proxygen;
+using namespace testing;
+
+namespace {
+
+// Adds its name to X-Filters of the request and of the response
+class NameFilter : public StaticFilter {
+ public:
+  explicit NameFilter(const std::string& name = "") : name_(name) {}
+
+  template <typename Next>
+  void onRequest(Next& next, std::unique_ptr<HTTPMessage> headers) noexcept {
+    appendName(*headers);
+    next.onRequest(std::move(headers));
+  }
+
+  template <typename Next>
+  void sendHeaders(Next& next, HTTPMessage& msg) noexcept {
+    appendName(msg);
+    next.sendHeaders(msg);
+  }
+
+ private:
+  void appendName(HTTPMessage& msg) {
+    auto& headers = msg.getHeaders();
+    auto names = headers.getSingleOrEmpty("X-Filters");
+    headers.set("X-Filters", names.empty() ? name_ : names + "," + name_);
+  }
+
+  std::string name_;
+};
+
+// Counts the body bytes either way into the counters it was copied with
+class BodyCounter : public StaticFilter {
+ public:
+  BodyCounter(size_t* ingress, size_t* egress)
+      : ingress_(ingress), egress_(egress) {}
+
+  template <typename Next>
+  void onBody(Next& next, std::unique_ptr<folly::IOBuf> body) noexcept {
+    *ingress_ += body->computeChainDataLength();
+    next.onBody(std::move(body));
+  }
+
+  template <typename Next>
+  void sendBody(Next& next, std::unique_ptr<folly::IOBuf> body) noexcept {
+    *egress_ += body->computeChainDataLength();
+    next.sendBody(std::move(body));
+  }
+
+ private:
+  size_t* ingress_;
+  size_t* egress_;
+};
+
+}
+
+TEST(StaticFilterChain, FiltersInOrder) {
+  size_t ingress = 0;
+  size_t egress = 0;
+  StaticFilterChainFactory<NameFilter, BodyCounter, NameFilter> factory(
+    NameFilter("a"), BodyCounter(&ingress, &egress), NameFilter("b"));
+  NiceMock<MockRequestHandler> handler;
+  NiceMock<MockResponseHandler> client(&handler);
+  ResponseHandler* downstream = nullptr;
+  EXPECT_CALL(handler, setResponseHandler(_))
+    .WillOnce(SaveArg<0>(&downstream));
+  std::string requestFilters;
+  EXPECT_CALL(handler, onRequest(_))
+    .WillOnce(Invoke([&] (std::shared_ptr<HTTPMessage> msg) {
+          requestFilters = msg->getHeaders().getSingleOrEmpty("X-Filters");
+        }));
+  EXPECT_CALL(handler, onBody(_));
+  EXPECT_CALL(handler, onEOM());
+  std::string responseFilters;
+  EXPECT_CALL(client, sendHeaders(_))
+    .WillOnce(Invoke([&] (HTTPMessage& msg) {
+          responseFilters = msg.getHeaders().getSingleOrEmpty("X-Filters");
+        }));
+  EXPECT_CALL(client, sendBody(_));
+  EXPECT_CALL(client, sendEOM());
+  EXPECT_CALL(handler, requestComplete());
+
+  HTTPMessage request;
+  request.setMethod(HTTPMethod::POST);
+  request.setURL("/");
+  auto chain = factory.onRequest(&handler, &request);
+  chain->setResponseHandler(&client);
+  EXPECT_NE(nullptr, downstream);
+  chain->onRequest(folly::make_unique<HTTPMessage>(request));
+  chain->onBody(folly::IOBuf::copyBuffer("hello"));
+  chain->onEOM();
+  ResponseBuilder(downstream)
+    .status(200, "OK")
+    .body(folly::IOBuf::copyBuffer("hello world"))
+    .sendWithEOM();
+  chain->requestComplete();
+
+  // Client side first going in, handler side first coming out
+  EXPECT_EQ("a,b", requestFilters);
+  EXPECT_EQ("b,a", responseFilters);
+  EXPECT_EQ(5, ingress);
+  EXPECT_EQ(11, egress);
+}
+
+TEST(StaticFilterChain, Empty) {
+  StaticFilterChainFactory<> factory;
+  NiceMock<MockRequestHandler> handler;
+  NiceMock<MockResponseHandler> client(&handler);
+  ResponseHandler* downstream = nullptr;
+  EXPECT_CALL(handler, setResponseHandler(_))
+    .WillOnce(SaveArg<0>(&downstream));
+  EXPECT_CALL(handler, onEOM());
+  EXPECT_CALL(client, sendHeaders(_));
+  EXPECT_CALL(client, sendEOM());
+  EXPECT_CALL(handler, onError(kErrorTimeout));
+
+  HTTPMessage request;
+  auto chain = factory.onRequest(&handler, &request);
+  chain->setResponseHandler(&client);
+  chain->onEOM();
+  ResponseBuilder(downstream).status(204, "No Content").sendWithEOM();
+  chain->onError(kErrorTimeout);
+}
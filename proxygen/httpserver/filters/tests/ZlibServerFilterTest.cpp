@@ -363,3 +363,274 @@ TEST_F(ZlibServerFilterTest, small_chunks_compress) {
                          1000);
   });
 }
+
+// A non-chunked response sent as several bodies is compressed as it goes
+TEST_F(ZlibServerFilterTest, streamed_compression) {
+  EXPECT_CALL(*requestHandler_, onEOM()).Times(1);
+  EXPECT_CALL(*requestHandler_, setResponseHandler(_))
+      .WillOnce(DoAll(SaveArg<0>(&downstream_), Return()));
+
+  EXPECT_CALL(*responseHandler_, sendHeaders(_)).WillOnce(
+      Invoke([&](HTTPMessage& msg) {
+        EXPECT_TRUE(msg.checkForHeaderToken(
+            HTTP_HEADER_CONTENT_ENCODING, "gzip", false));
+        EXPECT_FALSE(msg.getHeaders().exists(HTTP_HEADER_CONTENT_LENGTH));
+      }));
+  EXPECT_CALL(*responseHandler_, sendChunkHeader(_)).Times(0);
+  EXPECT_CALL(*responseHandler_, sendChunkTerminator()).Times(0);
+
+  std::vector<std::string> sent;
+  EXPECT_CALL(*responseHandler_, sendBody(_))
+      .Times(3)
+      .WillRepeatedly(Invoke([&](std::shared_ptr<folly::IOBuf> body) {
+        auto processedBody = zd_->decompress(body.get());
+        ASSERT_FALSE(zd_->hasError())
+            << "Failed to decompress body. r=" << zd_->getStatus();
+        sent.push_back(processedBody->moveToFbString().toStdString());
+      }));
+  EXPECT_CALL(*responseHandler_, sendEOM()).Times(1);
+
+  HTTPMessage msg;
+  msg.setURL("http://locahost/foo.compressme");
+  msg.getHeaders().set(HTTP_HEADER_ACCEPT_ENCODING, "gzip");
+
+  std::set<std::string> compressibleTypes = {"text/html"};
+  auto filterFactory = folly::make_unique<ZlibServerFilterFactory>(
+      4, 1, compressibleTypes, std::vector<std::string>{"gzip"}, 0, true);
+
+  auto filter = filterFactory->onRequest(requestHandler_, &msg);
+  filter->setResponseHandler(responseHandler_.get());
+  filter->onEOM();
+
+  HTTPMessage response;
+  response.setStatusCode(200);
+  response.getHeaders().set(HTTP_HEADER_CONTENT_TYPE, "text/html");
+  response.getHeaders().set(HTTP_HEADER_CONTENT_LENGTH, "11");
+  downstream_->sendHeaders(response);
+
+  // Each body is flushed through before the next one arrives
+  downstream_->sendBody(folly::IOBuf::copyBuffer("Hello "));
+  EXPECT_EQ(std::vector<std::string>({"Hello "}), sent);
+  downstream_->sendBody(folly::IOBuf::copyBuffer("World"));
+  EXPECT_EQ(std::vector<std::string>({"Hello ", "World"}), sent);
+  downstream_->sendEOM();
+  EXPECT_EQ(std::vector<std::string>({"Hello ", "World", ""}), sent);
+
+  filter->requestComplete();
+}
+
+// A response handed on is held until the body is compressed, then sent
+// on as it is, with its content length
+TEST_F(ZlibServerFilterTest, headers_handed_on) {
+  EXPECT_CALL(*requestHandler_, onEOM()).Times(1);
+  EXPECT_CALL(*requestHandler_, setResponseHandler(_))
+      .WillOnce(DoAll(SaveArg<0>(&downstream_), Return()));
+
+  auto response = folly::make_unique<HTTPMessage>();
+  auto sentResponse = response.get();
+  response->setStatusCode(200);
+  response->getHeaders().set(HTTP_HEADER_CONTENT_TYPE, "text/html");
+  response->getHeaders().set(HTTP_HEADER_CONTENT_LENGTH, "11");
+
+  EXPECT_CALL(*responseHandler_, sendHeaders(_)).WillOnce(
+      Invoke([&](HTTPMessage& msg) {
+        EXPECT_EQ(sentResponse, &msg);
+        EXPECT_TRUE(msg.checkForHeaderToken(
+            HTTP_HEADER_CONTENT_ENCODING, "gzip", false));
+        auto& length =
+          msg.getHeaders().getSingleOrEmpty(HTTP_HEADER_CONTENT_LENGTH);
+        EXPECT_FALSE(length.empty());
+        EXPECT_NE("11", length);
+      }));
+  EXPECT_CALL(*responseHandler_, sendBody(_)).Times(1);
+  EXPECT_CALL(*responseHandler_, sendEOM()).Times(1);
+
+  HTTPMessage msg;
+  msg.setURL("http://locahost/foo.compressme");
+  msg.getHeaders().set(HTTP_HEADER_ACCEPT_ENCODING, "gzip");
+
+  std::set<std::string> compressibleTypes = {"text/html"};
+  auto filterFactory = folly::make_unique<ZlibServerFilterFactory>(
+      4, 1, compressibleTypes);
+
+  auto filter = filterFactory->onRequest(requestHandler_, &msg);
+  filter->setResponseHandler(responseHandler_.get());
+  filter->onEOM();
+
+  downstream_->sendHeaders(std::move(response));
+  downstream_->sendBody(folly::IOBuf::copyBuffer("Hello World"));
+  downstream_->sendEOM();
+
+  filter->requestComplete();
+}
+
+// Requests started after the types change compress the new ones
+TEST_F(ZlibServerFilterTest, content_types_changed) {
+  EXPECT_CALL(*requestHandler_, onEOM()).Times(1);
+  EXPECT_CALL(*requestHandler_, setResponseHandler(_))
+      .WillOnce(DoAll(SaveArg<0>(&downstream_), Return()));
+  EXPECT_CALL(*responseHandler_, sendHeaders(_)).WillOnce(
+      Invoke([&](HTTPMessage& msg) {
+        EXPECT_TRUE(msg.checkForHeaderToken(
+            HTTP_HEADER_CONTENT_ENCODING, "gzip", false));
+      }));
+  EXPECT_CALL(*responseHandler_, sendBody(_)).Times(1);
+  EXPECT_CALL(*responseHandler_, sendEOM()).Times(1);
+
+  HTTPMessage msg;
+  msg.setURL("http://locahost/foo.compressme");
+  msg.getHeaders().set(HTTP_HEADER_ACCEPT_ENCODING, "gzip");
+
+  std::set<std::string> compressibleTypes = {"text/html"};
+  auto filterFactory = folly::make_unique<ZlibServerFilterFactory>(
+      4, 1, compressibleTypes);
+  filterFactory->onServerStart();
+  filterFactory->setCompressibleContentTypes({"text/plain"});
+
+  auto filter = filterFactory->onRequest(requestHandler_, &msg);
+  filter->setResponseHandler(responseHandler_.get());
+  filter->onEOM();
+
+  HTTPMessage response;
+  response.setStatusCode(200);
+  response.getHeaders().set(HTTP_HEADER_CONTENT_TYPE, "text/plain");
+  response.getHeaders().set(HTTP_HEADER_CONTENT_LENGTH, "11");
+  downstream_->sendHeaders(response);
+  downstream_->sendBody(folly::IOBuf::copyBuffer("Hello World"));
+  downstream_->sendEOM();
+
+  filter->requestComplete();
+  filterFactory->onServerStop();
+}
+
+// A body that looks compressed already is sent as it is
+TEST_F(ZlibServerFilterTest, compressed_body_sent_as_is) {
+  std::string body;
+  uint32_t random = 1;
+  for (int i = 0; i < 4096; i++) {
+    random = random * 1103515245 + 12345;
+    body.push_back(char(random >> 16));
+  }
+
+  EXPECT_CALL(*requestHandler_, onEOM()).Times(1);
+  EXPECT_CALL(*requestHandler_, setResponseHandler(_))
+      .WillOnce(DoAll(SaveArg<0>(&downstream_), Return()));
+  EXPECT_CALL(*responseHandler_, sendHeaders(_)).WillOnce(
+      Invoke([&](HTTPMessage& msg) {
+        EXPECT_FALSE(msg.getHeaders().exists(HTTP_HEADER_CONTENT_ENCODING));
+        EXPECT_EQ(folly::to<std::string>(body.size()),
+                  msg.getHeaders().getSingleOrEmpty(
+                    HTTP_HEADER_CONTENT_LENGTH));
+      }));
+  EXPECT_CALL(*responseHandler_, sendBody(IOBufEquals(body))).Times(1);
+  EXPECT_CALL(*responseHandler_, sendEOM()).Times(1);
+
+  HTTPMessage msg;
+  msg.setURL("http://locahost/foo.compressme");
+  msg.getHeaders().set(HTTP_HEADER_ACCEPT_ENCODING, "gzip");
+
+  std::set<std::string> compressibleTypes = {"text/html"};
+  auto filterFactory = folly::make_unique<ZlibServerFilterFactory>(
+      4, 1, compressibleTypes);
+  filterFactory->setLevelController(
+    std::make_shared<const CompressionLevelController>(
+      CompressionLevelController::Options()));
+
+  auto filter = filterFactory->onRequest(requestHandler_, &msg);
+  filter->setResponseHandler(responseHandler_.get());
+  filter->onEOM();
+
+  HTTPMessage response;
+  response.setStatusCode(200);
+  response.getHeaders().set(HTTP_HEADER_CONTENT_TYPE, "text/html");
+  response.getHeaders().set(HTTP_HEADER_CONTENT_LENGTH,
+                            folly::to<std::string>(body.size()));
+  downstream_->sendHeaders(response);
+  downstream_->sendBody(folly::IOBuf::copyBuffer(body));
+  downstream_->sendEOM();
+
+  filter->requestComplete();
+}
+
+TEST(CompressionLevelControllerTest, pick_level) {
+  CompressionLevelController::Options options;
+  options.minLevel = 0;
+  options.maxLevel = -1;
+  options.largeResponseSize = 1000;
+  CompressionLevelController controller(options);
+
+  EXPECT_EQ(6, controller.pickLevel(0, 100));
+  EXPECT_EQ(3, controller.pickLevel(0.5, 100));
+  EXPECT_EQ(0, controller.pickLevel(1, 100));
+  // Large responses, and those of unknown length, step down sooner
+  EXPECT_EQ(3, controller.pickLevel(0.25, 1000));
+  EXPECT_EQ(0, controller.pickLevel(0.5, 0));
+  // No EventBase on this thread, so no load
+  EXPECT_EQ(6, controller.pickLevel(100));
+}
+
+TEST(CompressionLevelControllerTest, sample_entropy) {
+  EXPECT_EQ(-1, CompressionLevelController::sampleEntropy(
+              *folly::IOBuf::copyBuffer("too short"), 1024));
+
+  auto text = folly::IOBuf::copyBuffer(std::string(2000, 'a'));
+  text->prependChain(folly::IOBuf::copyBuffer(std::string(2000, 'b')));
+  EXPECT_NEAR(1, CompressionLevelController::sampleEntropy(*text, 1024),
+              0.01);
+
+  std::string bytes;
+  for (int i = 0; i < 256 * 16; i++) {
+    bytes.push_back(char(i));
+  }
+  EXPECT_NEAR(8, CompressionLevelController::sampleEntropy(
+                *folly::IOBuf::copyBuffer(bytes), 256 * 16), 0.01);
+}
+
+TEST(ZlibServerFilterFactoryTest, negotiate_encoding) {
+  std::vector<std::string> encodings = {"br", "zstd", "gzip"};
+  auto negotiate = [&] (const std::string& acceptEncoding) {
+    return ZlibServerFilterFactory::negotiateEncoding(acceptEncoding,
+                                                      encodings);
+  };
+  // Ties go to the server preference
+  EXPECT_EQ("br", negotiate("gzip, deflate, br"));
+  EXPECT_EQ("zstd", negotiate("gzip, zstd"));
+  EXPECT_EQ("gzip", negotiate("gzip, deflate"));
+  // Otherwise the highest q-value wins
+  EXPECT_EQ("gzip", negotiate("br; q=0.5, gzip; q=0.8"));
+  EXPECT_EQ("zstd", negotiate("zstd, br; q=0.9"));
+  // q=0 means not acceptable
+  EXPECT_EQ("gzip", negotiate("br; q=0, gzip; q=0.1"));
+  EXPECT_EQ("", negotiate("gzip; q=0"));
+  EXPECT_EQ("", negotiate("identity, deflate"));
+  EXPECT_EQ("", negotiate(""));
+}
+
+TEST(ZlibServerFilterFactoryTest, negotiate_encoding_index) {
+  std::vector<std::string> encodings = {"br", "gzip"};
+  EXPECT_EQ(1, ZlibServerFilterFactory::negotiateEncodingIndex(
+      "gzip, br; q=0.5", encodings));
+  // The first mention of an encoding counts
+  EXPECT_EQ(0, ZlibServerFilterFactory::negotiateEncodingIndex(
+      "gzip; q=0.5, br, gzip", encodings));
+  EXPECT_EQ(-1, ZlibServerFilterFactory::negotiateEncodingIndex(
+      "gzip; whoohoo", encodings));
+}
+
+TEST(ContentTypeMatcherTest, matches) {
+  ContentTypeMatcher matcher({"text/html", "Application/JSON", "image/*"});
+  EXPECT_TRUE(matcher.matches("text/html"));
+  EXPECT_TRUE(matcher.matches("Text/HTML; charset=utf-8"));
+  EXPECT_TRUE(matcher.matches(" text/html ;charset=utf-8"));
+  EXPECT_TRUE(matcher.matches("application/json"));
+  EXPECT_TRUE(matcher.matches("image/svg+xml"));
+  EXPECT_TRUE(matcher.matches("IMAGE/png"));
+  EXPECT_FALSE(matcher.matches("text/plain"));
+  EXPECT_FALSE(matcher.matches("text/htmlx"));
+  EXPECT_FALSE(matcher.matches("image"));
+  EXPECT_FALSE(matcher.matches(""));
+
+  EXPECT_FALSE(ContentTypeMatcher().matches("text/html"));
+  ContentTypeMatcher any({"*/*"});
+  EXPECT_TRUE(any.matches("video/mp4"));
+}
@@ -0,0 +1,171 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "LatencyHistogram.h"
+
+#include <algorithm>
+#include <cmath>
+#include <glog/logging.h>
+#include <iomanip>
+
+namespace LoadGen {
+
+namespace {
+
+const unsigned kSubBucketBits = 11;
+const unsigned kSubBucketHalfBits = kSubBucketBits - 1;
+const uint64_t kSubBucketHalfCount = 1 << kSubBucketHalfBits;
+const uint64_t kSubBucketMask = (1 << kSubBucketBits) - 1;
+
+}
+
+LatencyHistogram::LatencyHistogram(uint64_t highestTrackableValue)
+    : highest_(std::max(highestTrackableValue, kSubBucketMask)) {
+  counts_.resize(indexOf(highest_) + 1);
+}
+
+size_t LatencyHistogram::indexOf(uint64_t value) const {
+  // The first bucket covers [0, 2048) in steps of 1, each one after that
+  // twice the range of the last, in half as many steps of twice the size
+  unsigned bucket = 64 - __builtin_clzll(value | kSubBucketMask) -
+    kSubBucketBits;
+  uint64_t subBucket = value >> bucket;
+  return ((bucket + 1) << kSubBucketHalfBits) +
+    (subBucket - kSubBucketHalfCount);
+}
+
+uint64_t LatencyHistogram::valueAt(size_t index) const {
+  int bucket = int(index >> kSubBucketHalfBits) - 1;
+  uint64_t subBucket = (index & (kSubBucketHalfCount - 1)) +
+    kSubBucketHalfCount;
+  if (bucket < 0) {
+    subBucket -= kSubBucketHalfCount;
+    bucket = 0;
+  }
+  return subBucket << bucket;
+}
+
+uint64_t LatencyHistogram::highestEquivalentValue(size_t index) const {
+  return valueAt(index + 1) - 1;
+}
+
+void LatencyHistogram::record(uint64_t value) {
+  value = std::min(value, highest_);
+  counts_[indexOf(value)]++;
+  total_++;
+  min_ = std::min(min_, value);
+  max_ = std::max(max_, value);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+  CHECK_EQ(highest_, other.highest_);
+  for (size_t i = 0; i < counts_.size(); i++) {
+    counts_[i] += other.counts_[i];
+  }
+  total_ += other.total_;
+  min_ = std::min(min_, other.min_);
+  max_ = std::max(max_, other.max_);
+}
+
+double LatencyHistogram::getMean() const {
+  if (total_ == 0) {
+    return 0;
+  }
+  double sum = 0;
+  for (size_t i = 0; i < counts_.size(); i++) {
+    if (counts_[i]) {
+      // Like HdrHistogram, count values as the middle of their sub-bucket
+      sum += counts_[i] * (valueAt(i) + highestEquivalentValue(i)) / 2.0;
+    }
+  }
+  return sum / total_;
+}
+
+double LatencyHistogram::getStdDeviation() const {
+  if (total_ == 0) {
+    return 0;
+  }
+  double mean = getMean();
+  double squares = 0;
+  for (size_t i = 0; i < counts_.size(); i++) {
+    if (counts_[i]) {
+      double delta = (valueAt(i) + highestEquivalentValue(i)) / 2.0 - mean;
+      squares += counts_[i] * delta * delta;
+    }
+  }
+  return std::sqrt(squares / total_);
+}
+
+uint64_t LatencyHistogram::getValueAtPercentile(double percentile) const {
+  if (total_ == 0) {
+    return 0;
+  }
+  percentile = std::min(std::max(percentile, 0.0), 100.0);
+  uint64_t target = std::max<uint64_t>(
+    1, uint64_t(std::ceil(percentile / 100 * total_)));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < counts_.size(); i++) {
+    seen += counts_[i];
+    if (seen >= target) {
+      return std::min(highestEquivalentValue(i), max_);
+    }
+  }
+  return max_;
+}
+
+void LatencyHistogram::printPercentiles(std::ostream& out, double scale,
+                                        uint32_t ticksPerHalfDistance) const {
+  auto flags = out.flags();
+  out << std::fixed << std::setw(12) << "Value" << " "
+      << std::setw(14) << "Percentile" << " "
+      << std::setw(10) << "TotalCount" << " "
+      << std::setw(14) << "1/(1-Percentile)" << "\n\n";
+
+  auto printRow = [&] (double percentile) {
+    uint64_t value = getValueAtPercentile(percentile);
+    uint64_t count = 0;
+    for (size_t i = 0; i < counts_.size() && valueAt(i) <= value; i++) {
+      count += counts_[i];
+    }
+    out << std::setprecision(3) << std::setw(12) << value / scale << " "
+        << std::setprecision(12) << std::setw(14) << percentile / 100 << " "
+        << std::setw(10) << count << " ";
+    if (percentile < 100) {
+      out << std::setprecision(2) << std::setw(14)
+          << 1 / (1 - percentile / 100);
+    }
+    out << "\n";
+  };
+
+  if (total_) {
+    // Each halving of the distance to 100% gets ticksPerHalfDistance rows,
+    // up to the first percentile at the maximum
+    double percentile = 0;
+    while (percentile < 100 && getValueAtPercentile(percentile) < max_) {
+      printRow(percentile);
+      double halvings = std::floor(std::log2(100 / (100 - percentile)));
+      percentile += 100 / (ticksPerHalfDistance * std::pow(2, halvings + 1));
+    }
+    printRow(100);
+  }
+
+  out << std::setprecision(3)
+      << "#[Mean    = " << std::setw(12) << getMean() / scale
+      << ", StdDeviation   = " << std::setw(12)
+      << getStdDeviation() / scale << "]\n"
+      << "#[Max     = " << std::setw(12) << getMax() / scale
+      << ", Total count    = " << std::setw(12) << total_ << "]\n"
+      << "#[Buckets = " << std::setw(12)
+      << (counts_.size() >> kSubBucketHalfBits) - 1
+      << ", SubBuckets     = " << std::setw(12)
+      << (1 << kSubBucketBits) << "]\n";
+  out.flags(flags);
+}
+
+}
@@ -0,0 +1,79 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace LoadGen {
+
+/**
+ * A histogram with the layout of HdrHistogram: values fall in buckets of
+ * doubling width, each split into 2048 linear sub-buckets, so every
+ * recorded value is kept to 3 significant digits however large it is,
+ * in a fixed amount of memory. Values above the highest trackable value
+ * are recorded as that value.
+ */
+class LatencyHistogram {
+ public:
+  explicit LatencyHistogram(uint64_t highestTrackableValue);
+
+  void record(uint64_t value);
+
+  /**
+   * Add the values of other, which must have the same highest trackable
+   * value.
+   */
+  void merge(const LatencyHistogram& other);
+
+  uint64_t getCount() const {
+    return total_;
+  }
+
+  uint64_t getMin() const {
+    return total_ ? min_ : 0;
+  }
+
+  uint64_t getMax() const {
+    return max_;
+  }
+
+  double getMean() const;
+  double getStdDeviation() const;
+
+  /**
+   * The highest value equivalent to the value at percentile, in [0, 100],
+   * or 0 if the histogram is empty.
+   */
+  uint64_t getValueAtPercentile(double percentile) const;
+
+  /**
+   * Print the percentile distribution in the text format of HdrHistogram,
+   * which its plotter takes, with values divided by scale (e.g. 1000 to
+   * print microseconds as milliseconds).
+   */
+  void printPercentiles(std::ostream& out, double scale,
+                        uint32_t ticksPerHalfDistance = 5) const;
+
+ private:
+  size_t indexOf(uint64_t value) const;
+  // The lowest value that falls in the sub-bucket at index
+  uint64_t valueAt(size_t index) const;
+  uint64_t highestEquivalentValue(size_t index) const;
+
+  uint64_t highest_;
+  std::vector<uint64_t> counts_;
+  uint64_t total_{0};
+  uint64_t min_{UINT64_MAX};
+  uint64_t max_{0};
+};
+
+}
@@ -0,0 +1,112 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/Memory.h>
+#include <folly/SocketAddress.h>
+#include <gflags/gflags.h>
+#include <iostream>
+#include <thread>
+#include <unistd.h>
+
+#include "LoadWorker.h"
+
+using namespace LoadGen;
+using namespace proxygen;
+
+DEFINE_string(host, "localhost", "Server to load");
+DEFINE_int32(port, 11000, "Port of the server");
+DEFINE_string(url, "/", "Path of the requests");
+DEFINE_bool(ssl, false, "Connect with TLS, negotiating --protocol by NPN");
+DEFINE_string(protocol, "http/1.1", "http/1.1, spdy/3, spdy/3.1 or h2-14");
+DEFINE_int32(threads, 0, "Threads generating the load. Numbers <= 0 "
+             "will use the number of cores on this machine.");
+DEFINE_int32(connections, 1, "Connections of each thread");
+DEFINE_int32(streams, 1, "Concurrent requests per connection; HTTP/1.x "
+             "always runs one");
+DEFINE_double(rate, 0, "Requests per second, over all threads, for an "
+              "open loop run. If 0, every stream starts its next request "
+              "once its last one completes.");
+DEFINE_int32(priority, -1, "Priority of the requests, or -1 for the "
+             "codec's default");
+DEFINE_int32(duration, 10, "Seconds to generate load for");
+DEFINE_int32(connect_timeout_ms, 1000, "Connect timeout");
+DEFINE_int32(request_timeout_ms, 10000, "Transaction idle timeout");
+DEFINE_int32(ticks_per_half_distance, 5, "Rows of the latency distribution "
+             "for each halving of the distance to the 100th percentile");
+
+int main(int argc, char* argv[]) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+
+  if (FLAGS_threads <= 0) {
+    FLAGS_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    CHECK(FLAGS_threads > 0);
+  }
+  CHECK(FLAGS_connections > 0);
+  CHECK(FLAGS_streams > 0);
+
+  LoadParams params;
+  params.address.setFromHostPort(FLAGS_host, FLAGS_port);
+  params.protocol = FLAGS_protocol;
+  if (FLAGS_ssl) {
+    params.sslContext = std::make_shared<folly::SSLContext>();
+    params.sslContext->setAdvertisedNextProtocols({FLAGS_protocol});
+  }
+  params.request.setMethod(HTTPMethod::GET);
+  params.request.setURL(FLAGS_url);
+  params.request.setHTTPVersion(1, 1);
+  params.request.getHeaders().set(HTTP_HEADER_HOST, FLAGS_host);
+  params.connections = FLAGS_connections;
+  params.streams = FLAGS_streams;
+  params.rate = FLAGS_rate / FLAGS_threads;
+  params.priority = FLAGS_priority;
+  params.connectTimeout = std::chrono::milliseconds(FLAGS_connect_timeout_ms);
+  params.requestTimeout = std::chrono::milliseconds(FLAGS_request_timeout_ms);
+
+  std::vector<std::unique_ptr<LoadWorker>> workers;
+  std::vector<std::thread> threads;
+  for (int32_t i = 0; i < FLAGS_threads; i++) {
+    workers.emplace_back(folly::make_unique<LoadWorker>(params));
+    auto worker = workers.back().get();
+    threads.emplace_back([worker] { worker->run(); });
+  }
+  std::this_thread::sleep_for(std::chrono::seconds(FLAGS_duration));
+  for (auto& worker: workers) {
+    worker->stop();
+  }
+  LoadStats stats;
+  for (size_t i = 0; i < workers.size(); i++) {
+    threads[i].join();
+    stats.merge(workers[i]->getStats());
+  }
+
+  double seconds = FLAGS_duration;
+  std::cout << "Ran " << FLAGS_duration << "s on " << FLAGS_threads
+            << " threads, each with " << FLAGS_connections
+            << " connections of " << FLAGS_streams << " streams to "
+            << params.address.describe() << " over " << FLAGS_protocol
+            << "\n  " << stats.responses << " responses, "
+            << stats.responses / seconds << " req/s, "
+            << stats.bodyBytes / seconds / 1e6 << " MB/s of body\n  ";
+  for (size_t i = 1; i < 6; i++) {
+    std::cout << i << "xx " << stats.statusClasses[i] << "  ";
+  }
+  std::cout << "\n  " << stats.errors << " errors, " << stats.connects
+            << " connects, " << stats.connectErrors << " connect errors";
+  if (FLAGS_rate > 0) {
+    std::cout << ", " << stats.backlog
+              << " due requests never sent for want of a free stream";
+  }
+  std::cout << "\n\nLatency (ms), from when each request was due to its "
+            << "last byte:\n";
+  stats.latency.printPercentiles(std::cout, 1000,
+                                 FLAGS_ticks_per_half_distance);
+  return 0;
+}
@@ -0,0 +1,297 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "LoadWorker.h"
+
+#include <cmath>
+#include <folly/Memory.h>
+#include <proxygen/lib/http/HTTPConnector.h>
+#include <proxygen/lib/http/session/HTTPTransaction.h>
+#include <proxygen/lib/http/session/HTTPUpstreamSession.h>
+
+using namespace proxygen;
+using folly::AsyncSocketException;
+using folly::IOBuf;
+using std::unique_ptr;
+
+namespace LoadGen {
+
+namespace {
+
+// Latencies above an hour are recorded as an hour
+const uint64_t kMaxLatencyUs = 3600ULL * 1000 * 1000;
+const std::chrono::milliseconds kReconnectDelay(100);
+
+}
+
+LoadStats::LoadStats(): latency(kMaxLatencyUs) {}
+
+void LoadStats::merge(const LoadStats& other) {
+  latency.merge(other.latency);
+  responses += other.responses;
+  for (size_t i = 0; i < 6; i++) {
+    statusClasses[i] += other.statusClasses[i];
+  }
+  errors += other.errors;
+  connects += other.connects;
+  connectErrors += other.connectErrors;
+  bodyBytes += other.bodyBytes;
+  backlog += other.backlog;
+}
+
+class LoadWorker::Connection:
+      private HTTPConnector::Callback,
+      private HTTPSession::InfoCallback,
+      private folly::AsyncTimeout {
+ public:
+  explicit Connection(LoadWorker& worker)
+      : folly::AsyncTimeout(&worker.evb_),
+        worker_(worker),
+        connector_(this, worker.timeouts_.get()) {
+    connector_.setPlaintextProtocol(worker.params_.protocol);
+  }
+
+  ~Connection() override {
+    close();
+  }
+
+  void connect() {
+    const auto& params = worker_.params_;
+    if (params.sslContext) {
+      connector_.connectSSL(&worker_.evb_, params.address,
+                            params.sslContext, nullptr,
+                            params.connectTimeout);
+    } else {
+      connector_.connect(&worker_.evb_, params.address,
+                         params.connectTimeout);
+    }
+  }
+
+  bool canSend() const {
+    return session_ && inFlight_ < worker_.params_.streams &&
+      session_->isReusable() && session_->supportsMoreTransactions();
+  }
+
+  // False if the session refused the transaction
+  bool send(TimePoint due);
+
+  void requestDone() {
+    inFlight_--;
+  }
+
+  void close() {
+    cancelTimeout();
+    connector_.reset();
+    if (session_) {
+      auto session = session_;
+      session_ = nullptr;
+      session->setInfoCallback(nullptr);
+      session->dropConnection();
+    }
+  }
+
+ private:
+  void connectSuccess(HTTPUpstreamSession* session) override {
+    worker_.stats_.connects++;
+    session_ = session;
+    session_->setInfoCallback(this);
+    worker_.scheduleDispatch();
+  }
+
+  void connectError(const AsyncSocketException& ex) override {
+    worker_.stats_.connectErrors++;
+    VLOG(1) << "Connect to " << worker_.params_.address.describe()
+            << " failed: " << ex.what();
+    scheduleTimeout(kReconnectDelay.count());
+  }
+
+  // Reconnect
+  void timeoutExpired() noexcept override {
+    connect();
+  }
+
+  // HTTPSession::InfoCallback
+  uint32_t getSubscribedEvents() const override {
+    return InfoCallback::OUTGOING_STREAMS;
+  }
+  void onCreate(const HTTPSession&) override {}
+  void onDestroy(const HTTPSession&) override {
+    session_ = nullptr;
+    // The server closed the connection; get another one
+    scheduleTimeout(0);
+  }
+  void onSettingsOutgoingStreamsNotFull(const HTTPSession&) override {
+    worker_.scheduleDispatch();
+  }
+
+  LoadWorker& worker_;
+  HTTPConnector connector_;
+  HTTPUpstreamSession* session_{nullptr};
+  uint32_t inFlight_{0};
+};
+
+class LoadWorker::Request: public HTTPTransactionHandler {
+ public:
+  Request(LoadWorker& worker, Connection& conn, TimePoint due)
+      : worker_(worker),
+        conn_(conn),
+        due_(due) {}
+
+  void setTransaction(HTTPTransaction*) noexcept override {}
+
+  void detachTransaction() noexcept override {
+    worker_.requestDone(&conn_);
+    delete this;
+  }
+
+  void onHeadersComplete(unique_ptr<HTTPMessage> msg) noexcept override {
+    auto statusClass = msg->getStatusCode() / 100;
+    if (statusClass < 6) {
+      worker_.stats_.statusClasses[statusClass]++;
+    }
+  }
+
+  void onBody(unique_ptr<IOBuf> chain) noexcept override {
+    worker_.stats_.bodyBytes += chain->computeChainDataLength();
+  }
+
+  void onEOM() noexcept override {
+    auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+      getCurrentTime() - due_);
+    worker_.stats_.latency.record(latency.count());
+    worker_.stats_.responses++;
+  }
+
+  void onUpgrade(UpgradeProtocol) noexcept override {}
+
+  void onError(const HTTPException& error) noexcept override {
+    // Requests dropped by stop() don't count
+    if (!worker_.stopping_) {
+      VLOG(1) << "Request failed: " << error.what();
+      worker_.stats_.errors++;
+    }
+  }
+
+  void onEgressPaused() noexcept override {}
+  void onEgressResumed() noexcept override {}
+
+ private:
+  LoadWorker& worker_;
+  Connection& conn_;
+  TimePoint due_;
+};
+
+bool LoadWorker::Connection::send(TimePoint due) {
+  auto request = new Request(worker_, *this, due);
+  auto txn = session_->newTransaction(request, worker_.params_.priority);
+  if (!txn) {
+    delete request;
+    return false;
+  }
+  inFlight_++;
+  txn->sendHeaders(worker_.params_.request);
+  txn->sendEOM();
+  return true;
+}
+
+LoadWorker::LoadWorker(const LoadParams& params)
+    : params_(params),
+      timeouts_(new AsyncTimeoutSet(&evb_, params.requestTimeout)) {
+  // evb_ is only constructed after the base
+  attachEventBase(&evb_);
+}
+
+LoadWorker::~LoadWorker() {
+  connections_.clear();
+  cancelTimeout();
+  detachEventBase();
+}
+
+void LoadWorker::run() {
+  start_ = getCurrentTime();
+  for (uint32_t i = 0; i < params_.connections; i++) {
+    connections_.emplace_back(folly::make_unique<Connection>(*this));
+    connections_.back()->connect();
+  }
+  if (params_.rate > 0) {
+    scheduleTimeout(0);
+  }
+  evb_.loopForever();
+  // Let the dropped sessions go
+  evb_.loop();
+  stats_.backlog = backlog_.size();
+}
+
+void LoadWorker::stop() {
+  stopping_ = true;
+  evb_.runInEventBaseThread([this] {
+    cancelTimeout();
+    for (auto& conn: connections_) {
+      conn->close();
+    }
+    evb_.terminateLoopSoon();
+  });
+}
+
+void LoadWorker::timeoutExpired() noexcept {
+  auto now = getCurrentTime();
+  auto dueAt = [this] (uint64_t n) {
+    return start_ + std::chrono::duration_cast<ClockType::duration>(
+      std::chrono::duration<double>(n / params_.rate));
+  };
+  while (dueAt(issued_) <= now) {
+    backlog_.push_back(dueAt(issued_));
+    issued_++;
+  }
+  auto untilNext = std::chrono::duration_cast<std::chrono::milliseconds>(
+    dueAt(issued_) - now);
+  scheduleTimeout(std::max<int64_t>(untilNext.count(), 1));
+  dispatch();
+}
+
+void LoadWorker::scheduleDispatch() {
+  if (!dispatchScheduled_ && !stopping_) {
+    dispatchScheduled_ = true;
+    // Not from within the callbacks of a session
+    evb_.runInLoop([this] { dispatch(); });
+  }
+}
+
+void LoadWorker::dispatch() {
+  dispatchScheduled_ = false;
+  if (stopping_) {
+    return;
+  }
+  if (params_.rate == 0) {
+    auto now = getCurrentTime();
+    for (auto& conn: connections_) {
+      while (conn->canSend() && conn->send(now)) {}
+    }
+    return;
+  }
+  // Spread the due requests over the connections with free streams
+  size_t idle = 0;
+  while (!backlog_.empty() && idle < connections_.size()) {
+    auto& conn = connections_[nextConnection_];
+    nextConnection_ = (nextConnection_ + 1) % connections_.size();
+    if (conn->canSend() && conn->send(backlog_.front())) {
+      backlog_.pop_front();
+      idle = 0;
+    } else {
+      idle++;
+    }
+  }
+}
+
+void LoadWorker::requestDone(Connection* conn) {
+  conn->requestDone();
+  scheduleDispatch();
+}
+
+}
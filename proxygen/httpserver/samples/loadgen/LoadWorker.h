@@ -0,0 +1,122 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <folly/SocketAddress.h>
+#include <folly/io/async/AsyncTimeout.h>
+#include <folly/io/async/EventBase.h>
+#include <folly/io/async/SSLContext.h>
+#include <memory>
+#include <proxygen/lib/http/HTTPMessage.h>
+#include <proxygen/lib/utils/AsyncTimeoutSet.h>
+#include <proxygen/lib/utils/Time.h>
+#include <vector>
+
+#include "LatencyHistogram.h"
+
+namespace LoadGen {
+
+struct LoadParams {
+  folly::SocketAddress address;
+  // Null for plaintext connections
+  std::shared_ptr<folly::SSLContext> sslContext;
+  // The plaintext protocol, as for HTTPConnector::setPlaintextProtocol
+  std::string protocol;
+  // Sent, with an empty body, for every request
+  proxygen::HTTPMessage request;
+  // Connections of each worker
+  uint32_t connections{1};
+  // Concurrent requests per connection; HTTP/1.x only ever runs one
+  uint32_t streams{1};
+  // Requests per second of each worker, or 0 to run closed loop: every
+  // connection keeps its streams busy, starting a request as soon as
+  // the last one completes
+  double rate{0};
+  // The priority of the requests, or -1 for the codec's default
+  int8_t priority{-1};
+  std::chrono::milliseconds connectTimeout{std::chrono::seconds(1)};
+  std::chrono::milliseconds requestTimeout{std::chrono::seconds(10)};
+};
+
+struct LoadStats {
+  LoadStats();
+
+  void merge(const LoadStats& other);
+
+  // In microseconds, from when the request was due to its last byte. An
+  // open loop request waiting for a free stream counts the wait, so a
+  // stalled server can't hide its latency by slowing the load down.
+  LatencyHistogram latency;
+  uint64_t responses{0};
+  // 1xx to 5xx
+  uint64_t statusClasses[6]{};
+  uint64_t errors{0};
+  uint64_t connects{0};
+  uint64_t connectErrors{0};
+  uint64_t bodyBytes{0};
+  // Open loop requests that were due but still waiting when the run ended
+  uint64_t backlog{0};
+};
+
+/**
+ * Generates load from one EventBase, over params.connections connections
+ * it reopens when they close. Run workers on several threads to load a
+ * server with more than one core.
+ */
+class LoadWorker: private folly::AsyncTimeout {
+ public:
+  explicit LoadWorker(const LoadParams& params);
+  ~LoadWorker() override;
+
+  /**
+   * Generate load from the calling thread until stop().
+   */
+  void run();
+
+  /**
+   * Stop at the next turn of the event loop, dropping the requests still
+   * in flight. Safe to call from any thread.
+   */
+  void stop();
+
+  // Only valid once run() has returned
+  const LoadStats& getStats() const {
+    return stats_;
+  }
+
+ private:
+  class Connection;
+  class Request;
+
+  // Open loop: queue the requests that have come due, and come back at
+  // the next one
+  void timeoutExpired() noexcept override;
+  // Start the queued requests, or fill up the streams in closed loop
+  void dispatch();
+  void scheduleDispatch();
+  void requestDone(Connection* conn);
+
+  const LoadParams params_;
+  folly::EventBase evb_;
+  AsyncTimeoutSet::UniquePtr timeouts_;
+  std::vector<std::unique_ptr<Connection>> connections_;
+  // Due times of the open loop requests waiting for a free stream
+  std::deque<proxygen::TimePoint> backlog_;
+  proxygen::TimePoint start_;
+  uint64_t issued_{0};
+  size_t nextConnection_{0};
+  LoadStats stats_;
+  bool dispatchScheduled_{false};
+  std::atomic<bool> stopping_{false};
+};
+
+}
@@ -0,0 +1,86 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <gtest/gtest.h>
+#include <proxygen/httpserver/samples/loadgen/LatencyHistogram.h>
+#include <sstream>
+
+using namespace LoadGen;
+
+TEST(LatencyHistogramTest, Empty) {
+  LatencyHistogram histogram(1000000);
+  EXPECT_EQ(histogram.getCount(), 0);
+  EXPECT_EQ(histogram.getMin(), 0);
+  EXPECT_EQ(histogram.getMax(), 0);
+  EXPECT_EQ(histogram.getValueAtPercentile(99), 0);
+}
+
+TEST(LatencyHistogramTest, Precision) {
+  LatencyHistogram histogram(1ULL << 40);
+  for (uint64_t value: {0ULL, 1ULL, 2047ULL, 2048ULL, 12345ULL,
+        123456789ULL, 1ULL << 39}) {
+    LatencyHistogram one(1ULL << 40);
+    one.record(value);
+    // The highest equivalent value, capped at the maximum recorded
+    EXPECT_EQ(one.getValueAtPercentile(100), value);
+    histogram.record(value + value / 2048);
+    EXPECT_GE(histogram.getValueAtPercentile(100), value);
+    EXPECT_LE(histogram.getValueAtPercentile(100),
+              value + value / 1024 + 1);
+  }
+}
+
+TEST(LatencyHistogramTest, Percentiles) {
+  LatencyHistogram histogram(1000000);
+  for (uint64_t i = 1; i <= 1000; i++) {
+    histogram.record(i);
+  }
+  EXPECT_EQ(histogram.getCount(), 1000);
+  EXPECT_EQ(histogram.getMin(), 1);
+  EXPECT_EQ(histogram.getMax(), 1000);
+  EXPECT_EQ(histogram.getValueAtPercentile(0), 1);
+  EXPECT_EQ(histogram.getValueAtPercentile(50), 500);
+  EXPECT_EQ(histogram.getValueAtPercentile(99), 990);
+  EXPECT_EQ(histogram.getValueAtPercentile(100), 1000);
+  EXPECT_DOUBLE_EQ(histogram.getMean(), 500.5);
+}
+
+TEST(LatencyHistogramTest, HighestTrackable) {
+  LatencyHistogram histogram(100000);
+  histogram.record(1000000);
+  EXPECT_EQ(histogram.getMax(), histogram.getValueAtPercentile(100));
+  EXPECT_LT(histogram.getMax(), 1000000);
+}
+
+TEST(LatencyHistogramTest, Merge) {
+  LatencyHistogram a(1000000);
+  LatencyHistogram b(1000000);
+  a.record(10);
+  b.record(20);
+  b.record(30);
+  a.merge(b);
+  EXPECT_EQ(a.getCount(), 3);
+  EXPECT_EQ(a.getMin(), 10);
+  EXPECT_EQ(a.getMax(), 30);
+  EXPECT_EQ(a.getValueAtPercentile(50), 20);
+}
+
+TEST(LatencyHistogramTest, PrintPercentiles) {
+  LatencyHistogram histogram(1000000);
+  for (uint64_t i = 1; i <= 100; i++) {
+    histogram.record(i * 1000);
+  }
+  std::ostringstream out;
+  histogram.printPercentiles(out, 1000);
+  auto text = out.str();
+  EXPECT_EQ(text.find("       Value     Percentile TotalCount"), 0);
+  EXPECT_NE(text.find("     100.000 1.000000000000        100"),
+            std::string::npos);
+  EXPECT_NE(text.find("Total count    =          100]"), std::string::npos);
+}
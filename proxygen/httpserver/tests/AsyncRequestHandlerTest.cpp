@@ -0,0 +1,162 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <proxygen/httpserver/AsyncRequestHandler.h>
+#include <proxygen/httpserver/Mocks.h>
+#include <proxygen/httpserver/ResponseBuilder.h>
+
+using namespace proxygen;
+using namespace testing;
+
+namespace {
+
+// Once gate is set, reads the whole body and sends it back
+class EchoHandler : public AsyncRequestHandler {
+ public:
+  EchoHandler(const Options& options, bool* destroyed)
+      : AsyncRequestHandler(options),
+        destroyed_(destroyed) {}
+
+  ~EchoHandler() override {
+    *destroyed_ = true;
+  }
+
+  folly::Future<folly::Unit> handle(
+      std::unique_ptr<HTTPMessage> request) override {
+    return gate.getFuture().then([this] { return readAll(); });
+  }
+
+  folly::Future<folly::Unit> readAll() {
+    return readBody().then([this] (std::unique_ptr<folly::IOBuf> body) {
+        if (body) {
+          body_.append(std::move(body));
+          return readAll();
+        }
+        ResponseBuilder(downstream_)
+          .status(200, "OK")
+          .body(body_.move())
+          .send();
+        return folly::makeFuture();
+      });
+  }
+
+  using AsyncRequestHandler::waitForEgress;
+
+  folly::Promise<folly::Unit> gate;
+
+ private:
+  folly::IOBufQueue body_{folly::IOBufQueue::cacheChainLength()};
+  bool* destroyed_;
+};
+
+}
+
+class AsyncRequestHandlerTest : public Test {
+ public:
+  void SetUp() override {
+    options_.maxBufferedBytes = 4;
+    handler_ = new EchoHandler(options_, &destroyed_);
+    handler_->setResponseHandler(&client_);
+    ON_CALL(client_, sendHeaders(_)).WillByDefault(
+      Invoke([this] (HTTPMessage& msg) {
+          response_ = msg;
+        }));
+    ON_CALL(client_, sendBody(_)).WillByDefault(
+      Invoke([this] (std::shared_ptr<folly::IOBuf> body) {
+          responseBody_ += body->moveToFbString().toStdString();
+        }));
+    handler_->onRequest(folly::make_unique<HTTPMessage>());
+  }
+
+ protected:
+  void send(const std::string& data) {
+    handler_->onBody(folly::IOBuf::copyBuffer(data));
+  }
+
+  AsyncRequestHandler::Options options_;
+  EchoHandler* handler_;
+  bool destroyed_{false};
+  NiceMock<MockResponseHandler> client_{nullptr};
+  HTTPMessage response_;
+  std::string responseBody_;
+};
+
+TEST_F(AsyncRequestHandlerTest, echo) {
+  handler_->gate.setValue();
+  send("abc");
+  send("de");
+  EXPECT_CALL(client_, sendEOM());
+  handler_->onEOM();
+
+  EXPECT_EQ(200, response_.getStatusCode());
+  EXPECT_EQ("abcde", responseBody_);
+  EXPECT_FALSE(destroyed_);
+  handler_->requestComplete();
+  EXPECT_TRUE(destroyed_);
+}
+
+// Body that is not read holds back ingress
+TEST_F(AsyncRequestHandlerTest, buffered_body_pauses_ingress) {
+  EXPECT_CALL(client_, pauseIngress());
+  send("abc");
+  send("de");
+  send("f");
+  handler_->onEOM();
+  Mock::VerifyAndClearExpectations(&client_);
+
+  EXPECT_CALL(client_, resumeIngress());
+  EXPECT_CALL(client_, sendEOM());
+  handler_->gate.setValue();
+  EXPECT_EQ("abcdef", responseBody_);
+  handler_->requestComplete();
+  EXPECT_TRUE(destroyed_);
+}
+
+// Waits for egress to resume, and fail with the request
+TEST_F(AsyncRequestHandlerTest, wait_for_egress) {
+  EXPECT_TRUE(handler_->waitForEgress().isReady());
+  handler_->onEgressPaused();
+  auto egress = handler_->waitForEgress();
+  EXPECT_FALSE(egress.isReady());
+  handler_->onEgressResumed();
+  EXPECT_TRUE(egress.hasValue());
+
+  handler_->onEgressPaused();
+  egress = handler_->waitForEgress();
+  EXPECT_CALL(client_, sendHeaders(_)).Times(0);
+  EXPECT_CALL(client_, sendAbort()).Times(0);
+  handler_->onError(kErrorConnectionReset);
+  EXPECT_TRUE(egress.hasException());
+  EXPECT_FALSE(destroyed_);
+
+  // The handler goes once it is done too, and sends nowhere
+  handler_->gate.setValue();
+  EXPECT_TRUE(destroyed_);
+}
+
+// A pending read fails with the request
+TEST_F(AsyncRequestHandlerTest, error_while_reading) {
+  handler_->gate.setValue();
+  send("abc");
+  EXPECT_CALL(client_, sendHeaders(_)).Times(0);
+  handler_->onError(kErrorTimeout);
+  EXPECT_TRUE(destroyed_);
+}
+
+// A handler failing before it responds answers with 500
+TEST_F(AsyncRequestHandlerTest, failure_answers_500) {
+  EXPECT_CALL(client_, sendEOM());
+  handler_->gate.setException(std::runtime_error("failed"));
+  EXPECT_EQ(500, response_.getStatusCode());
+  EXPECT_FALSE(destroyed_);
+  handler_->requestComplete();
+  EXPECT_TRUE(destroyed_);
+}
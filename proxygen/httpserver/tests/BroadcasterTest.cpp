@@ -0,0 +1,123 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <gtest/gtest.h>
+#include <proxygen/httpserver/Broadcaster.h>
+#include <proxygen/httpserver/Mocks.h>
+
+using namespace folly;
+using namespace proxygen;
+using namespace testing;
+
+namespace {
+
+HTTPMessage makeRequest(const char* protocol = nullptr) {
+  HTTPMessage request;
+  request.setMethod(HTTPMethod::GET);
+  request.setURL("/events");
+  request.setHTTPVersion(1, 1);
+  if (protocol) {
+    request.setAdvancedProtocolString(protocol);
+  }
+  return request;
+}
+
+}
+
+TEST(Broadcaster, SharesEvents) {
+  Broadcaster broadcaster;
+  MockResponseHandler http1(nullptr);
+  MockResponseHandler http2(nullptr);
+  HTTPMessage http1Headers;
+  HTTPMessage http2Headers;
+  EXPECT_CALL(http1, sendHeaders(_))
+    .WillOnce(SaveArg<0>(&http1Headers));
+  EXPECT_CALL(http2, sendHeaders(_))
+    .WillOnce(SaveArg<0>(&http2Headers));
+  auto sub1 = broadcaster.subscribe(&http1, makeRequest());
+  auto sub2 = broadcaster.subscribe(&http2, makeRequest("h2"));
+  EXPECT_EQ(2, broadcaster.getNumSubscribers());
+
+  // HTTP/1.x responses go to the end of the connection, unframed
+  EXPECT_EQ(200, http1Headers.getStatusCode());
+  EXPECT_FALSE(http1Headers.getIsChunked());
+  EXPECT_EQ("close", http1Headers.getHeaders().getSingleOrEmpty(
+              HTTP_HEADER_CONNECTION));
+  EXPECT_FALSE(http2Headers.getHeaders().exists(HTTP_HEADER_CONNECTION));
+
+  auto event = IOBuf::copyBuffer("data: hello\n\n");
+  const uint8_t* bytes = event->data();
+  EXPECT_CALL(http1, sendBody(_))
+    .WillOnce(Invoke([&] (std::shared_ptr<IOBuf> body) {
+          EXPECT_EQ(bytes, body->data());
+        }));
+  EXPECT_CALL(http2, sendBody(_))
+    .WillOnce(Invoke([&] (std::shared_ptr<IOBuf> body) {
+          EXPECT_EQ(bytes, body->data());
+        }));
+  broadcaster.publish(std::move(event));
+
+  EXPECT_CALL(http1, sendEOM())
+    .WillOnce(Invoke([&] { broadcaster.unsubscribe(sub1); }));
+  EXPECT_CALL(http2, sendEOM());
+  broadcaster.close();
+  EXPECT_EQ(1, broadcaster.getNumSubscribers());
+  broadcaster.unsubscribe(sub2);
+  EXPECT_EQ(0, broadcaster.getNumSubscribers());
+}
+
+TEST(Broadcaster, DropsSlowSubscribers) {
+  Broadcaster::Options options;
+  options.maxBufferedBytes = 10;
+  Broadcaster broadcaster(options);
+  MockResponseHandler slow(nullptr);
+  MockResponseHandler fast(nullptr);
+  EXPECT_CALL(slow, sendHeaders(_));
+  EXPECT_CALL(fast, sendHeaders(_));
+  auto slowSub = broadcaster.subscribe(&slow, makeRequest());
+  auto fastSub = broadcaster.subscribe(&fast, makeRequest());
+
+  slowSub->onEgressPaused();
+  EXPECT_CALL(fast, sendBody(_)).Times(3);
+  EXPECT_CALL(slow, sendBody(_)).Times(0);
+  broadcaster.publish(IOBuf::copyBuffer("12345"));
+  broadcaster.publish(IOBuf::copyBuffer("12345"));
+  EXPECT_CALL(slow, sendAbort())
+    .WillOnce(Invoke([&] { broadcaster.unsubscribe(slowSub); }));
+  broadcaster.publish(IOBuf::copyBuffer("1"));
+  EXPECT_EQ(1, broadcaster.getNumSubscribers());
+  broadcaster.unsubscribe(fastSub);
+}
+
+TEST(Broadcaster, CoalescesSlowSubscribers) {
+  Broadcaster::Options options;
+  options.slowPolicy = Broadcaster::SlowPolicy::COALESCE;
+  Broadcaster broadcaster(options);
+  MockResponseHandler slow(nullptr);
+  EXPECT_CALL(slow, sendHeaders(_));
+  auto sub = broadcaster.subscribe(&slow, makeRequest());
+
+  sub->onEgressPaused();
+  for (auto event : { "1", "2", "3" }) {
+    broadcaster.publish(IOBuf::copyBuffer(event));
+  }
+  broadcaster.close();
+  EXPECT_EQ(2, sub->getCoalescedEvents());
+
+  // The latest event, then the EOM held back for it
+  InSequence enforceOrder;
+  EXPECT_CALL(slow, sendBody(_))
+    .WillOnce(Invoke([&] (std::shared_ptr<IOBuf> body) {
+          EXPECT_EQ("3", body->moveToFbString().toStdString());
+        }));
+  EXPECT_CALL(slow, sendEOM());
+  sub->onEgressResumed();
+  EXPECT_FALSE(sub->isDropped());
+  broadcaster.unsubscribe(sub);
+}
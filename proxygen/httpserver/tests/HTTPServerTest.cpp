@@ -8,13 +8,28 @@
  *
  */
 #include <boost/thread.hpp>
+#include <folly/FileUtil.h>
 #include <folly/io/async/AsyncSSLSocket.h>
 #include <folly/io/async/AsyncServerSocket.h>
 #include <folly/io/async/EventBaseManager.h>
+#include <future>
 #include <gtest/gtest.h>
+#include <proxygen/httpserver/AdmissionController.h>
 #include <proxygen/httpserver/HTTPServer.h>
+#include <proxygen/httpserver/RequestHandler.h>
+#include <proxygen/httpserver/RequestHandlerAdaptor.h>
+#include <proxygen/httpserver/RequestTraceSampler.h>
 #include <proxygen/httpserver/ResponseBuilder.h>
+#include <proxygen/httpserver/SocketTakeover.h>
+#include <proxygen/lib/http/HTTPConnector.h>
+#include <proxygen/lib/http/session/HTTPUpstreamSession.h>
+#include <proxygen/lib/ssl/SSLSessionCache.h>
 #include <proxygen/lib/utils/TestUtils.h>
+#include <proxygen/lib/utils/ThreadLocalFreeList.h>
+#include <proxygen/proxygen-config.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace proxygen;
 using namespace testing;
@@ -153,3 +168,372 @@ TEST(SSL, SSLTest) {
   evb.loop();
   EXPECT_TRUE(cb.success);
 }
+
+TEST(SSL, ResumesUpstreamSession) {
+  HTTPServer::IPConfig cfg{
+    folly::SocketAddress("127.0.0.1", 0),
+      HTTPServer::Protocol::HTTP};
+  folly::SSLContextConfig sslCfg;
+  sslCfg.isDefault = true;
+  sslCfg.setCertificate(
+    kTestDir + "certs/test_cert1.pem",
+    kTestDir + "certs/test_key1.pem",
+    "");
+  cfg.sslConfigs.push_back(sslCfg);
+
+  HTTPServerOptions options;
+  options.threads = 2;
+  options.ticketSeeds.currentSeeds.push_back(
+    "00112233445566778899aabbccddeeff");
+
+  auto server = folly::make_unique<HTTPServer>(std::move(options));
+  std::vector<HTTPServer::IPConfig> ips{cfg};
+  server->bind(ips);
+
+  ServerThread st(server.get());
+  EXPECT_TRUE(st.start());
+
+  class Cb : public HTTPConnector::Callback {
+   public:
+    void connectSuccess(HTTPUpstreamSession* session) override {
+      resume.push_back(session->getSetupTransportInfo().sslResume);
+      session->dropConnection();
+    }
+    void connectError(const folly::AsyncSocketException&) override {
+      errors++;
+    }
+
+    std::vector<folly::SSLResumeEnum> resume;
+    uint32_t errors{0};
+  };
+
+  folly::EventBase evb;
+  AsyncTimeoutSet::UniquePtr timeouts(
+    new AsyncTimeoutSet(&evb, folly::TimeoutManager::InternalEnum::INTERNAL,
+                        std::chrono::milliseconds(500)));
+  auto ctx = std::make_shared<SSLContext>();
+#ifdef TLS1_3_VERSION
+  // TLS 1.3 sessions only arrive after the handshake
+  SSL_CTX_set_max_proto_version(ctx->getSSLCtx(), TLS1_2_VERSION);
+#endif
+  auto cache = std::make_shared<SSLSessionCache>();
+  Cb cb;
+  HTTPConnector connector(&cb, timeouts.get());
+  connector.setSSLSessionCache(cache);
+
+  // The first connect saves its session, the second resumes it
+  for (int i = 0; i < 2; i++) {
+    connector.connectSSL(&evb, server->addresses().front().address, ctx,
+                         nullptr, std::chrono::milliseconds(1000));
+    evb.loop();
+    EXPECT_EQ(1, cache->size());
+  }
+  EXPECT_EQ(0, cb.errors);
+  ASSERT_EQ(2, cb.resume.size());
+  EXPECT_EQ(folly::SSLResumeEnum::HANDSHAKE, cb.resume[0]);
+  EXPECT_NE(folly::SSLResumeEnum::HANDSHAKE, cb.resume[1]);
+}
+
+TEST(Inline, NoWorkerThreads) {
+  std::vector<HTTPServer::IPConfig> ips{
+    {folly::SocketAddress("127.0.0.1", 0), HTTPServer::Protocol::HTTP}};
+
+  HTTPServerOptions options;
+  options.threads = 0;
+
+  auto server = folly::make_unique<HTTPServer>(std::move(options));
+  server->bind(ips);
+
+  ServerThread st(server.get());
+  EXPECT_TRUE(st.start());
+
+  class Cb : public folly::AsyncSocket::ConnectCallback {
+   public:
+    explicit Cb(folly::AsyncSocket* sock) : sock_(sock) {}
+    void connectSuccess() noexcept override {
+      success = true;
+      sock_->close();
+    }
+    void connectErr(const folly::AsyncSocketException&)
+      noexcept override {
+      success = false;
+    }
+
+    bool success{false};
+    folly::AsyncSocket* sock_{nullptr};
+  };
+
+  folly::EventBase evb;
+  folly::AsyncSocket::UniquePtr sock(new folly::AsyncSocket(&evb));
+  Cb cb(sock.get());
+  sock->connect(&cb, server->addresses().front().address, 1000);
+  evb.loop();
+  EXPECT_TRUE(cb.success);
+}
+
+TEST(TransportFactory, MakesConnectionTransports) {
+  std::vector<HTTPServer::IPConfig> ips{
+    {folly::SocketAddress("127.0.0.1", 0), HTTPServer::Protocol::HTTP}};
+
+  std::promise<void> made;
+  HTTPServerOptions options;
+  options.threads = 1;
+  options.transportFactory = [&] (folly::EventBase* base, int fd) {
+    made.set_value();
+    return folly::AsyncSocket::UniquePtr(new folly::AsyncSocket(base, fd));
+  };
+
+  auto server = folly::make_unique<HTTPServer>(std::move(options));
+  server->bind(ips);
+
+  ServerThread st(server.get());
+  EXPECT_TRUE(st.start());
+
+  folly::EventBase evb;
+  folly::AsyncSocket::UniquePtr sock(new folly::AsyncSocket(&evb));
+  sock->connect(nullptr, server->addresses().front().address, 1000);
+  evb.loop();
+  EXPECT_EQ(std::future_status::ready,
+            made.get_future().wait_for(std::chrono::seconds(1)));
+  sock->close();
+}
+
+#if PROXYGEN_HAVE_LIBURING
+namespace {
+
+class OkHandler : public RequestHandler {
+ public:
+  void onRequest(std::unique_ptr<HTTPMessage> headers) noexcept override {}
+  void onBody(std::unique_ptr<folly::IOBuf> body) noexcept override {}
+  void onUpgrade(UpgradeProtocol prot) noexcept override {}
+  void onEOM() noexcept override {
+    ResponseBuilder(downstream_).status(200, "OK").body("ok").sendWithEOM();
+  }
+  void requestComplete() noexcept override {
+    delete this;
+  }
+  void onError(ProxygenError err) noexcept override {
+    delete this;
+  }
+};
+
+class OkHandlerFactory : public RequestHandlerFactory {
+ public:
+  void onServerStart() noexcept override {}
+  void onServerStop() noexcept override {}
+  RequestHandler* onRequest(RequestHandler*, HTTPMessage*) noexcept override {
+    return new OkHandler();
+  }
+};
+
+}
+
+TEST(IOUring, ServesRequests) {
+  std::vector<HTTPServer::IPConfig> ips{
+    {folly::SocketAddress("127.0.0.1", 0), HTTPServer::Protocol::HTTP}};
+
+  // Falls back to plain sockets where io_uring isn't allowed, so it is
+  // served either way
+  HTTPServerOptions options;
+  options.threads = 1;
+  options.ioUring = true;
+  options.handlerFactories.push_back(folly::make_unique<OkHandlerFactory>());
+
+  auto server = folly::make_unique<HTTPServer>(std::move(options));
+  server->bind(ips);
+
+  ServerThread st(server.get());
+  EXPECT_TRUE(st.start());
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_GE(fd, 0);
+  sockaddr_storage addr;
+  socklen_t len = server->addresses().front().address.getAddress(&addr);
+  ASSERT_EQ(0, connect(fd, reinterpret_cast<sockaddr*>(&addr), len));
+  timeval timeout{5, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  // two requests on the connection, pipelined
+  std::string req("GET / HTTP/1.1\r\nHost: test\r\n\r\n");
+  req += req;
+  ASSERT_EQ(req.size(), folly::writeFull(fd, req.data(), req.size()));
+
+  std::string response;
+  char buf[4096];
+  // until both bodies are in
+  auto secondBody = [&] {
+    auto first = response.find("\r\n\r\nok");
+    return first != std::string::npos &&
+      response.find("\r\n\r\nok", first + 1) != std::string::npos;
+  };
+  while (!secondBody()) {
+    ssize_t n = read(fd, buf, sizeof(buf));
+    ASSERT_GT(n, 0);
+    response.append(buf, n);
+  }
+  EXPECT_EQ(0, response.find("HTTP/1.1 200 OK\r\n"));
+  EXPECT_NE(std::string::npos, response.find("HTTP/1.1 200 OK\r\n", 1));
+  close(fd);
+}
+#endif
+
+TEST(SocketTakeover, SendReceive) {
+  int pair[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, pair), 0);
+  int pipeFDs[2];
+  ASSERT_EQ(pipe(pipeFDs), 0);
+
+  sendSocketFDs(pair[0], {pipeFDs[0], pipeFDs[1]});
+  auto fds = receiveSocketFDs(pair[1]);
+  ASSERT_EQ(fds.size(), 2);
+  // The same pipe, through new descriptors
+  struct stat sent, received;
+  ASSERT_EQ(fstat(pipeFDs[0], &sent), 0);
+  ASSERT_EQ(fstat(fds[0], &received), 0);
+  EXPECT_NE(fds[0], pipeFDs[0]);
+  EXPECT_EQ(sent.st_ino, received.st_ino);
+
+  sendSocketFDs(pair[0], {});
+  EXPECT_TRUE(receiveSocketFDs(pair[1]).empty());
+
+  for (auto fd: {pair[0], pair[1], pipeFDs[0], pipeFDs[1], fds[0], fds[1]}) {
+    close(fd);
+  }
+}
+
+TEST(SocketTakeover, NothingToTakeOver) {
+  EXPECT_EQ(connectTakeoverSocket("/nonexistent/takeover.sock"), -1);
+}
+
+TEST(AdmissionController, ShedsLowPriorityFirst) {
+  AdmissionController::Options options;
+  options.numPriorities = 2;
+  options.initialLimit = 10;
+  options.minLimit = 1;
+  options.classifier = [] (const HTTPMessage& msg) -> uint8_t {
+    return msg.getPath() == "/batch" ? 1 : 0;
+  };
+  AdmissionController controller(options);
+
+  HTTPMessage interactive;
+  interactive.setURL("/");
+  HTTPMessage batch;
+  batch.setURL("/batch");
+
+  // Batch requests only get half of the limit
+  for (int i = 0; i < 5; i++) {
+    EXPECT_TRUE(controller.admit(batch));
+  }
+  EXPECT_FALSE(controller.admit(batch));
+  for (int i = 0; i < 5; i++) {
+    EXPECT_TRUE(controller.admit(interactive));
+  }
+  EXPECT_FALSE(controller.admit(interactive));
+  EXPECT_EQ(10, controller.getInflight());
+}
+
+TEST(AdmissionController, AdditiveIncreaseMultiplicativeDecrease) {
+  AdmissionController::Options options;
+  options.initialLimit = 10;
+  options.minLimit = 1;
+  options.targetLatency = std::chrono::milliseconds(100);
+  options.backoffRatio = 0.5;
+  AdmissionController controller(options);
+  HTTPMessage msg;
+  msg.setURL("/");
+
+  // Requests on time raise it by about one per limit of them
+  for (int i = 0; i < 20; i++) {
+    EXPECT_TRUE(controller.admit(msg));
+    controller.onRequestDone(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(11, controller.getLimit());
+
+  // Slow ones halve it, once per targetLatency
+  EXPECT_TRUE(controller.admit(msg));
+  EXPECT_TRUE(controller.admit(msg));
+  controller.onRequestDone(std::chrono::milliseconds(200));
+  controller.onRequestDone(std::chrono::milliseconds(200));
+  EXPECT_EQ(5, controller.getLimit());
+  EXPECT_EQ(0, controller.getInflight());
+}
+
+namespace {
+
+class BatchingHandler : public RequestHandler {
+ public:
+  size_t getBodyBatchSize() const noexcept override {
+    return 10;
+  }
+
+  void onRequest(std::unique_ptr<HTTPMessage> headers) noexcept override {}
+  void onBody(std::unique_ptr<folly::IOBuf> body) noexcept override {
+    bodies.push_back(body->computeChainDataLength());
+  }
+  void onUpgrade(UpgradeProtocol prot) noexcept override {}
+  void onEOM() noexcept override {
+    eom = true;
+  }
+  void requestComplete() noexcept override {}
+  void onError(ProxygenError err) noexcept override {}
+
+  std::vector<size_t> bodies;
+  bool eom{false};
+};
+
+}
+
+TEST(RequestHandlerAdaptor, BatchesBody) {
+  auto evb = EventBaseManager::get()->getEventBase();
+  BatchingHandler handler;
+  // The adaptor deletes itself on detachTransaction()
+  HTTPTransactionHandler* adaptor = new RequestHandlerAdaptor(&handler);
+  adaptor->setTransaction(nullptr);
+
+  // Full batches go at once, the rest at the end of the loop
+  for (int i = 0; i < 7; i++) {
+    adaptor->onBody(folly::IOBuf::copyBuffer("abcd"));
+  }
+  EXPECT_EQ(std::vector<size_t>({12, 12}), handler.bodies);
+  evb->loopOnce();
+  EXPECT_EQ(std::vector<size_t>({12, 12, 4}), handler.bodies);
+
+  // And before the EOM
+  adaptor->onBody(folly::IOBuf::copyBuffer("abcd"));
+  adaptor->onEOM();
+  EXPECT_EQ(std::vector<size_t>({12, 12, 4, 4}), handler.bodies);
+  EXPECT_TRUE(handler.eom);
+  adaptor->detachTransaction();
+}
+
+TEST(RequestHandlerAdaptor, ReusesMemory) {
+  BatchingHandler handler;
+  ThreadLocalFreeList<RequestHandlerAdaptor>::takeCounts();
+  HTTPTransactionHandler* adaptor = new RequestHandlerAdaptor(&handler);
+  adaptor->setTransaction(nullptr);
+  adaptor->detachTransaction();
+  adaptor = new RequestHandlerAdaptor(&handler);
+  EXPECT_EQ(1, ThreadLocalFreeList<RequestHandlerAdaptor>::takeCounts().reused);
+  adaptor->setTransaction(nullptr);
+  adaptor->detachTransaction();
+}
+
+TEST(RequestTraceSampler, SamplesOneInNAndFlagged) {
+  RequestTraceSampler sampler(nullptr, 3, "X-Trace");
+  HTTPMessage msg;
+  std::vector<bool> sampled;
+  for (int i = 0; i < 6; i++) {
+    sampled.push_back(sampler.sample(msg));
+  }
+  EXPECT_EQ(std::vector<bool>({false, false, true, false, false, true}),
+            sampled);
+
+  // Flagged ones don't count towards the rate
+  msg.getHeaders().set("X-Trace", "1");
+  EXPECT_TRUE(sampler.sample(msg));
+  EXPECT_TRUE(sampler.sample(msg));
+  msg.getHeaders().remove("X-Trace");
+  EXPECT_FALSE(sampler.sample(msg));
+
+  RequestTraceSampler none(nullptr, 0, "");
+  EXPECT_FALSE(none.sample(msg));
+}
@@ -0,0 +1,112 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <gtest/gtest.h>
+#include <proxygen/httpserver/Router.h>
+
+using namespace proxygen;
+
+namespace {
+
+// Targets are told apart by the handler pointer they return
+RequestHandler* handle(int id) {
+  return reinterpret_cast<RequestHandler*>(intptr_t(id));
+}
+
+Router::Target target(int id) {
+  return [id] (HTTPMessage*, const RouteParams&) { return handle(id); };
+}
+
+int route(const Router& router, HTTPMethod method, const std::string& path,
+          RouteParams& params) {
+  const Router::Target* found = nullptr;
+  if (router.match(method, path, &found, params) != Router::Match::FOUND) {
+    return 0;
+  }
+  return intptr_t((*found)(nullptr, params));
+}
+
+}
+
+TEST(Router, Routes) {
+  Router router;
+  router.add(HTTPMethod::GET, "/", target(1));
+  router.add(HTTPMethod::GET, "/users", target(2));
+  router.add(HTTPMethod::POST, "/users", target(3));
+  router.add(HTTPMethod::GET, "/users/:id", target(4));
+  router.add(HTTPMethod::GET, "/users/me", target(5));
+  router.add(HTTPMethod::GET, "/users/:id/posts/:post", target(6));
+  router.add("/static/*", target(7));
+  router.add("/user", target(8));
+
+  RouteParams params;
+  EXPECT_EQ(1, route(router, HTTPMethod::GET, "/", params));
+  EXPECT_EQ(2, route(router, HTTPMethod::GET, "/users", params));
+  EXPECT_EQ(3, route(router, HTTPMethod::POST, "/users", params));
+  EXPECT_EQ(8, route(router, HTTPMethod::PUT, "/user", params));
+  // Literals win over parameters
+  EXPECT_EQ(5, route(router, HTTPMethod::GET, "/users/me", params));
+  EXPECT_EQ(0, params.size());
+
+  EXPECT_EQ(4, route(router, HTTPMethod::GET, "/users/42", params));
+  ASSERT_EQ(1, params.size());
+  EXPECT_EQ("id", params.getName(0));
+  EXPECT_EQ("42", params.getValue(0));
+
+  // Back off the literal "me" to the parameter
+  EXPECT_EQ(6, route(router, HTTPMethod::GET, "/users/me/posts/7", params));
+  EXPECT_EQ("me", params.get("id"));
+  EXPECT_EQ("7", params.get("post"));
+  EXPECT_EQ("", params.get("nope"));
+
+  EXPECT_EQ(7, route(router, HTTPMethod::GET, "/static/css/a.css", params));
+  EXPECT_EQ("css/a.css", params.get("*"));
+  EXPECT_EQ(7, route(router, HTTPMethod::DELETE, "/static/", params));
+  EXPECT_EQ("", params.get("*"));
+  EXPECT_EQ(0, route(router, HTTPMethod::GET, "/static", params));
+
+  EXPECT_EQ(0, route(router, HTTPMethod::GET, "/users/", params));
+  EXPECT_EQ(0, route(router, HTTPMethod::GET, "/other", params));
+  // HEAD goes to GET
+  EXPECT_EQ(2, route(router, HTTPMethod::HEAD, "/users", params));
+}
+
+TEST(Router, MethodNotAllowed) {
+  Router router;
+  router.add(HTTPMethod::GET, "/things/:id", target(1));
+  router.add(HTTPMethod::PUT, "/things/:id", target(2));
+
+  const Router::Target* found = nullptr;
+  RouteParams params;
+  std::vector<HTTPMethod> allowed;
+  EXPECT_EQ(Router::Match::METHOD_NOT_ALLOWED,
+            router.match(HTTPMethod::POST, "/things/1", &found, params,
+                         &allowed));
+  EXPECT_EQ((std::vector<HTTPMethod>{HTTPMethod::GET, HTTPMethod::PUT}),
+            allowed);
+  EXPECT_EQ(Router::Match::NOT_FOUND,
+            router.match(HTTPMethod::GET, "/thing", &found, params));
+}
+
+TEST(Router, BadPatterns) {
+  Router router;
+  router.add(HTTPMethod::GET, "/a/:id", target(1));
+  EXPECT_THROW(router.add(HTTPMethod::GET, "a", target(2)),
+               std::invalid_argument);
+  EXPECT_THROW(router.add(HTTPMethod::GET, "/a/:id", target(2)),
+               std::invalid_argument);
+  EXPECT_THROW(router.add(HTTPMethod::GET, "/a/:name/b", target(2)),
+               std::invalid_argument);
+  EXPECT_THROW(router.add(HTTPMethod::GET, "/a/*/b", target(2)),
+               std::invalid_argument);
+  EXPECT_THROW(router.add(HTTPMethod::GET, "/b/:", target(2)),
+               std::invalid_argument);
+  EXPECT_THROW(router.add("/:a/:b/:c/:d/:e/:f/:g/:h/:i", target(2)),
+               std::invalid_argument);
+}
@@ -0,0 +1,183 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <deque>
+#include <folly/io/async/EventBaseManager.h>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <proxygen/httpserver/Mocks.h>
+#include <proxygen/httpserver/SpooledBodyHandler.h>
+
+using namespace proxygen;
+using namespace testing;
+
+namespace {
+
+// Holds on to what it is given until run() is called from the test
+class QueuedExecutor : public folly::Executor {
+ public:
+  void add(folly::Func fn) override {
+    funcs.push_back(std::move(fn));
+  }
+
+  void run() {
+    while (!funcs.empty()) {
+      auto fn = std::move(funcs.front());
+      funcs.pop_front();
+      fn();
+    }
+  }
+
+  std::deque<folly::Func> funcs;
+};
+
+class TestHandler : public SpooledBodyHandler {
+ public:
+  explicit TestHandler(const Options& options): SpooledBodyHandler(options) {}
+
+  void onRequest(std::unique_ptr<HTTPMessage> headers) noexcept override {}
+  void requestComplete() noexcept override {}
+  void onError(ProxygenError err) noexcept override {}
+  void onEgressPaused() noexcept override {}
+  void onEgressResumed() noexcept override {}
+
+  void onBodyComplete() noexcept override {
+    ++completed;
+  }
+
+  std::string readFile() {
+    std::string data(getBodyLength(), '\0');
+    EXPECT_EQ(ssize_t(data.size()),
+              pread(getBodyFd(), &data[0], data.size(), 0));
+    return data;
+  }
+
+  int completed{0};
+};
+
+}
+
+class SpooledBodyHandlerTest : public Test {
+ public:
+  void SetUp() override {
+    eventBase_ = folly::EventBaseManager::get()->getEventBase();
+    options_.memoryLimit = 8;
+    ON_CALL(client_, sendHeaders(_)).WillByDefault(
+      Invoke([this] (HTTPMessage& msg) {
+          response_ = msg;
+        }));
+  }
+
+ protected:
+  void start() {
+    handler_ = folly::make_unique<TestHandler>(options_);
+    handler_->setResponseHandler(&client_);
+    handler_->onRequest(folly::make_unique<HTTPMessage>());
+  }
+
+  void send(const std::string& data) {
+    handler_->onBody(folly::IOBuf::copyBuffer(data));
+  }
+
+  folly::EventBase* eventBase_;
+  SpooledBodyHandler::Options options_;
+  std::unique_ptr<TestHandler> handler_;
+  NiceMock<MockResponseHandler> client_{nullptr};
+  HTTPMessage response_;
+};
+
+TEST_F(SpooledBodyHandlerTest, small_body_in_memory) {
+  start();
+  send("hello");
+  handler_->onEOM();
+
+  EXPECT_EQ(1, handler_->completed);
+  EXPECT_FALSE(handler_->isSpooled());
+  EXPECT_EQ(-1, handler_->getBodyFd());
+  EXPECT_EQ("hello", handler_->mapBody().str());
+  EXPECT_EQ("hello", handler_->takeBody()->moveToFbString().toStdString());
+}
+
+TEST_F(SpooledBodyHandlerTest, large_body_spooled) {
+  start();
+  send("hello ");
+  EXPECT_FALSE(handler_->isSpooled());
+  send("world");
+  EXPECT_TRUE(handler_->isSpooled());
+  send("!");
+  handler_->onEOM();
+
+  EXPECT_EQ(1, handler_->completed);
+  EXPECT_EQ(12, handler_->getBodyLength());
+  EXPECT_EQ("hello world!", handler_->readFile());
+  EXPECT_EQ("hello world!", handler_->mapBody().str());
+  EXPECT_EQ(nullptr, handler_->takeBody());
+}
+
+// Ingress waits for the writes of the executor, and so does the handler
+TEST_F(SpooledBodyHandlerTest, executor_writes) {
+  QueuedExecutor executor;
+  options_.executor = &executor;
+  options_.maxPendingBytes = 10;
+  start();
+
+  send("0123456789");
+  EXPECT_EQ(1, executor.funcs.size());
+  EXPECT_CALL(client_, pauseIngress());
+  send("abcdef");
+  handler_->onEOM();
+  EXPECT_EQ(0, handler_->completed);
+  Mock::VerifyAndClearExpectations(&client_);
+
+  EXPECT_CALL(client_, resumeIngress());
+  executor.run();
+  eventBase_->loopOnce();
+  // The second write follows the first
+  executor.run();
+  eventBase_->loopOnce();
+
+  EXPECT_EQ(1, handler_->completed);
+  EXPECT_EQ("0123456789abcdef", handler_->readFile());
+}
+
+// Writes that finish after the handler is gone are ignored
+TEST_F(SpooledBodyHandlerTest, destroyed_while_writing) {
+  QueuedExecutor executor;
+  options_.executor = &executor;
+  start();
+  send("0123456789");
+  handler_.reset();
+
+  executor.run();
+  eventBase_->loopOnce();
+}
+
+TEST_F(SpooledBodyHandlerTest, too_large) {
+  options_.maxBodySize = 10;
+  start();
+  EXPECT_CALL(client_, sendEOM());
+  send("0123456789");
+  send("a");
+  handler_->onEOM();
+
+  EXPECT_EQ(413, response_.getStatusCode());
+  EXPECT_EQ(0, handler_->completed);
+}
+
+TEST_F(SpooledBodyHandlerTest, write_error) {
+  options_.directory = "/nonexistent/directory";
+  start();
+  EXPECT_CALL(client_, sendEOM());
+  send("0123456789");
+  handler_->onEOM();
+
+  EXPECT_EQ(500, response_.getStatusCode());
+  EXPECT_EQ(0, handler_->completed);
+}
@@ -0,0 +1,227 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/http/DNSResolver.h>
+
+#include <folly/Conv.h>
+#include <folly/IPAddress.h>
+#include <folly/Memory.h>
+#include <netdb.h>
+#include <proxygen/lib/utils/TraceEvent.h>
+#include <stdexcept>
+#include <string.h>
+
+using folly::AsyncSocketException;
+using folly::SocketAddress;
+using std::string;
+using std::vector;
+
+namespace proxygen {
+
+DNSResolver::Request::Request(folly::EventBase* eventBase, uint16_t port,
+                              Callback* cb, const TraceEventContext* trace)
+    : eventBase_(eventBase),
+      port_(port),
+      cb_(CHECK_NOTNULL(cb)) {
+  if (trace) {
+    trace_ = folly::make_unique<TraceEventContext>(*trace);
+  }
+}
+
+DNSResolver::DNSResolver(folly::Executor* executor, const Options& options)
+    : executor_(CHECK_NOTNULL(executor)),
+      options_(options) {
+  CHECK_GT(options_.numShards, 0);
+  for (size_t i = 0; i < options_.numShards; i++) {
+    shards_.push_back(folly::make_unique<Shard>());
+  }
+}
+
+DNSResolver::Shard& DNSResolver::getShard(const string& host) {
+  return *shards_[std::hash<string>()(host) % shards_.size()];
+}
+
+std::shared_ptr<DNSResolver::Request> DNSResolver::resolve(
+  folly::EventBase* eventBase,
+  const string& host,
+  uint16_t port,
+  Callback* cb,
+  const TraceEventContext* trace) {
+
+  std::shared_ptr<Request> request(new Request(eventBase, port, cb, trace));
+  if (folly::IPAddress::validate(host)) {
+    deliver(*request, {SocketAddress(host, 0)}, "");
+    return request;
+  }
+
+  auto& shard = getShard(host);
+  bool hit = false;
+  bool prefetch = false;
+  bool joined = false;
+  bool needLookup = false;
+  vector<SocketAddress> addrs;
+  string error;
+  {
+    std::lock_guard<std::mutex> guard(shard.mutex);
+    auto now = getCurrentTime();
+    auto& entry = shard.entries[host];
+    if (timePointInitialized(entry.expiry) && now < entry.expiry) {
+      hit = true;
+      addrs = entry.addrs;
+      error = entry.error;
+      if (error.empty() && !entry.inflight &&
+          entry.expiry - now < options_.prefetchWindow) {
+        prefetch = true;
+        needLookup = true;
+        entry.inflight = true;
+      }
+    } else {
+      joined = entry.inflight;
+      entry.waiters.push_back(request);
+      if (!entry.inflight) {
+        needLookup = true;
+        entry.inflight = true;
+      }
+    }
+  }
+  if (needLookup) {
+    startLookup(shard, host);
+  }
+
+  if (request->trace_) {
+    TraceEvent event(TraceEventType::DnsCache, request->trace_->parentID);
+    auto now = getCurrentTime();
+    event.start(now);
+    event.end(now);
+    event.addMeta(TraceFieldType::HostName, host);
+    event.addMeta(TraceFieldType::DNSCacheHit, hit);
+    event.addMeta(TraceFieldType::DNSCacheStale, prefetch);
+    event.addMeta(TraceFieldType::DNSCacheInflight, joined);
+    request->trace_->traceEventAvailable(std::move(event));
+  }
+  if (hit) {
+    deliver(*request, addrs, error);
+  }
+  return request;
+}
+
+void DNSResolver::startLookup(Shard& shard, const string& host) {
+  auto start = getCurrentTime();
+  executor_->add([this, &shard, host, start] {
+      vector<SocketAddress> addrs;
+      string error;
+      try {
+        addrs = lookup(host);
+        if (addrs.empty()) {
+          error = folly::to<string>("no addresses for ", host);
+        }
+      } catch (const std::exception& ex) {
+        error = ex.what();
+      }
+      finishLookup(shard, host, std::move(addrs), std::move(error), start);
+    });
+}
+
+void DNSResolver::finishLookup(Shard& shard, const string& host,
+                               vector<SocketAddress> addrs,
+                               string error, TimePoint start) {
+  vector<std::shared_ptr<Request>> waiters;
+  {
+    std::lock_guard<std::mutex> guard(shard.mutex);
+    auto now = getCurrentTime();
+    auto& entry = shard.entries[host];
+    entry.inflight = false;
+    std::swap(waiters, entry.waiters);
+    if (!error.empty() && entry.error.empty() &&
+        timePointInitialized(entry.expiry) && now < entry.expiry) {
+      // A failed prefetch leaves the addresses we have until they expire
+    } else {
+      entry.addrs = addrs;
+      entry.error = error;
+      entry.expiry = now + (error.empty() ? options_.ttl :
+                            options_.negativeTtl);
+    }
+
+    if (shard.entries.size() > options_.maxEntriesPerShard) {
+      for (auto it = shard.entries.begin(); it != shard.entries.end();) {
+        if (!it->second.inflight && it->second.expiry <= now) {
+          it = shard.entries.erase(it);
+        } else {
+          ++it;
+        }
+      }
+    }
+  }
+
+  auto end = getCurrentTime();
+  for (auto& waiter: waiters) {
+    waiter->eventBase_->runInEventBaseThread(
+      [waiter, host, addrs, error, start, end] {
+        if (!waiter->cb_) {
+          return;
+        }
+        if (waiter->trace_) {
+          TraceEvent event(TraceEventType::DnsResolution,
+                           waiter->trace_->parentID);
+          event.start(start);
+          event.end(end);
+          event.addMeta(TraceFieldType::HostName, host);
+          event.addMeta(TraceFieldType::NumberAnswers, addrs.size());
+          if (!error.empty()) {
+            event.addMeta(TraceFieldType::Error, error);
+          }
+          waiter->trace_->traceEventAvailable(std::move(event));
+        }
+        deliver(*waiter, addrs, error);
+      });
+  }
+}
+
+void DNSResolver::deliver(Request& request, const vector<SocketAddress>& addrs,
+                          const string& error) {
+  auto cb = request.cb_;
+  request.cb_ = nullptr;
+  if (!cb) {
+    return;
+  }
+  if (!error.empty()) {
+    cb->resolveError(AsyncSocketException(AsyncSocketException::UNKNOWN,
+                                          error));
+    return;
+  }
+  auto result = addrs;
+  for (auto& addr: result) {
+    addr.setPort(request.port_);
+  }
+  cb->resolveSuccess(result);
+}
+
+vector<SocketAddress> DNSResolver::lookup(const string& host) {
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_ADDRCONFIG;
+  struct addrinfo* results = nullptr;
+  int rc = getaddrinfo(host.c_str(), nullptr, &hints, &results);
+  if (rc != 0) {
+    throw std::runtime_error(folly::to<string>(
+        "getaddrinfo of ", host, " failed: ", gai_strerror(rc)));
+  }
+  vector<SocketAddress> addrs;
+  for (auto ai = results; ai; ai = ai->ai_next) {
+    SocketAddress addr;
+    addr.setFromSockaddr(ai->ai_addr, ai->ai_addrlen);
+    addrs.push_back(addr);
+  }
+  freeaddrinfo(results);
+  return addrs;
+}
+
+}
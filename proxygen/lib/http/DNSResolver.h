@@ -0,0 +1,145 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/Executor.h>
+#include <folly/SocketAddress.h>
+#include <folly/io/async/AsyncSocketException.h>
+#include <folly/io/async/EventBase.h>
+#include <memory>
+#include <mutex>
+#include <proxygen/lib/utils/Time.h>
+#include <proxygen/lib/utils/TraceEventContext.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace proxygen {
+
+/**
+ * Resolves host names without blocking the IO thread: getaddrinfo() runs
+ * on an executor (say a small thread pool), and the result comes back on
+ * the EventBase of the caller.
+ *
+ * Results are cached for ttl, since getaddrinfo() doesn't tell the TTL of
+ * the records, and failures for negativeTtl. A hit within prefetchWindow of
+ * its expiry is answered from the cache while the name is looked up again
+ * in the background, so that names in use seldom have to wait. Concurrent
+ * misses for the same name share one lookup.
+ *
+ * One resolver may be shared by every thread: the cache is split in
+ * shards, each with a lock of its own. It must outlive the lookups it
+ * started.
+ */
+class DNSResolver {
+ public:
+  struct Options {
+    std::chrono::milliseconds ttl{60000};
+    std::chrono::milliseconds negativeTtl{5000};
+    std::chrono::milliseconds prefetchWindow{5000};
+    size_t numShards{16};
+    // Beyond this many names, expired entries are dropped from a shard
+    size_t maxEntriesPerShard{1024};
+  };
+
+  class Callback {
+   public:
+    virtual ~Callback() {}
+    virtual void resolveSuccess(
+      const std::vector<folly::SocketAddress>& addrs) noexcept = 0;
+    virtual void resolveError(
+      const folly::AsyncSocketException& ex) noexcept = 0;
+  };
+
+  /**
+   * A resolve() to be answered. Cancelling it, from the thread of the
+   * EventBase it was made on, means its callback won't be invoked.
+   */
+  class Request {
+   public:
+    void cancel() {
+      cb_ = nullptr;
+    }
+
+    // Until answered or cancelled
+    bool isPending() const {
+      return cb_;
+    }
+
+   private:
+    friend class DNSResolver;
+    Request(folly::EventBase* eventBase, uint16_t port, Callback* cb,
+            const TraceEventContext* trace);
+
+    folly::EventBase* eventBase_;
+    uint16_t port_;
+    Callback* cb_;
+    std::unique_ptr<TraceEventContext> trace_;
+  };
+
+  explicit DNSResolver(folly::Executor* executor,
+                       const Options& options = Options());
+  virtual ~DNSResolver() {}
+
+  /**
+   * Resolve host, to addresses with the given port. The callback is
+   * invoked right away on a cache hit, or else later in the thread of
+   * eventBase. IP address literals are not looked up.
+   *
+   * With a trace context, a DnsCache event is traced for the resolve and,
+   * if it waited for a lookup, a DnsResolution one for that.
+   */
+  std::shared_ptr<Request> resolve(folly::EventBase* eventBase,
+                                   const std::string& host,
+                                   uint16_t port,
+                                   Callback* cb,
+                                   const TraceEventContext* trace = nullptr);
+
+ protected:
+  /**
+   * Look host up, blocking. Runs on the executor. Throws on failure.
+   */
+  virtual std::vector<folly::SocketAddress> lookup(const std::string& host);
+
+ private:
+  struct Entry {
+    // With port 0
+    std::vector<folly::SocketAddress> addrs;
+    // Empty unless the last lookup failed
+    std::string error;
+    TimePoint expiry;
+    bool inflight{false};
+    std::vector<std::shared_ptr<Request>> waiters;
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    std::unordered_map<std::string, Entry> entries;
+  };
+
+  Shard& getShard(const std::string& host);
+
+  // Once the entry of host is marked inflight. The executor may run the
+  // lookup right away, so the shard must not be locked.
+  void startLookup(Shard& shard, const std::string& host);
+  void finishLookup(Shard& shard, const std::string& host,
+                    std::vector<folly::SocketAddress> addrs,
+                    std::string error, TimePoint start);
+
+  static void deliver(Request& request,
+                      const std::vector<folly::SocketAddress>& addrs,
+                      const std::string& error);
+
+  folly::Executor* executor_;
+  const Options options_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+}
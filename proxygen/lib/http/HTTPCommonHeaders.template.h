@@ -55,6 +55,19 @@ class HTTPCommonHeaders {
 
     return headerNames + code;
   }
+
+  static std::string* initLowerHeaderNames();
+
+  /**
+   * Same as getPointerToHeaderName(), in lowercase as HTTP/2 and SPDY
+   * spell the names
+   */
+  inline static const std::string* getPointerToLowerHeaderName(
+      HTTPHeaderCode code) {
+    static const auto lowerHeaderNames = initLowerHeaderNames();
+
+    return lowerHeaderNames + code;
+  }
 };
 
 } // proxygen
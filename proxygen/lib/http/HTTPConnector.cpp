@@ -9,11 +9,16 @@
  */
 #include <proxygen/lib/http/HTTPConnector.h>
 
+#include <algorithm>
+#include <folly/Conv.h>
 #include <folly/wangle/ssl/SSLUtil.h>
 #include <proxygen/lib/http/codec/HTTP1xCodec.h>
 #include <proxygen/lib/http/codec/SPDYCodec.h>
+#include <proxygen/lib/http/codec/experimental/HTTP2Codec.h>
+#include <proxygen/lib/http/codec/experimental/HTTP2Constants.h>
 #include <proxygen/lib/http/session/HTTPTransaction.h>
 #include <proxygen/lib/http/session/HTTPUpstreamSession.h>
+#include <proxygen/lib/utils/TraceEvent.h>
 #include <folly/io/async/AsyncSSLSocket.h>
 
 
@@ -31,6 +36,8 @@ unique_ptr<HTTPCodec> makeCodec(const string& chosenProto,
   if (spdyVersion) {
     return folly::make_unique<SPDYCodec>(TransportDirection::UPSTREAM,
                                          *spdyVersion);
+  } else if (chosenProto == http2::kProtocolString) {
+    return folly::make_unique<HTTP2Codec>(TransportDirection::UPSTREAM);
   } else {
     if (!chosenProto.empty() &&
         !HTTP1xCodec::supportsNextProtocol(chosenProto)) {
@@ -44,6 +51,29 @@ unique_ptr<HTTPCodec> makeCodec(const string& chosenProto,
   }
 }
 
+// The addresses in order, but with the families taking turns (RFC 8305)
+vector<SocketAddress> interleaveFamilies(const vector<SocketAddress>& addrs) {
+  vector<SocketAddress> first;
+  vector<SocketAddress> other;
+  for (const auto& addr: addrs) {
+    if (addr.getFamily() == addrs.front().getFamily()) {
+      first.push_back(addr);
+    } else {
+      other.push_back(addr);
+    }
+  }
+  vector<SocketAddress> result;
+  for (size_t i = 0; i < std::max(first.size(), other.size()); i++) {
+    if (i < first.size()) {
+      result.push_back(first[i]);
+    }
+    if (i < other.size()) {
+      result.push_back(other[i]);
+    }
+  }
+  return result;
+}
+
 }
 
 HTTPConnector::HTTPConnector(Callback* callback, AsyncTimeoutSet* timeoutSet)
@@ -54,6 +84,11 @@ HTTPConnector::~HTTPConnector() {
 }
 
 void HTTPConnector::reset() {
+  if (dnsRequest_) {
+    dnsRequest_->cancel();
+    dnsRequest_.reset();
+  }
+  cancelAttempts();
   if (socket_) {
     auto cb = cb_;
     cb_ = nullptr;
@@ -66,10 +101,23 @@ void HTTPConnector::setPlaintextProtocol(const std::string& plaintextProto) {
   plaintextProtocol_ = plaintextProto;
 }
 
+void HTTPConnector::setServerName(const std::string& serverName) {
+  serverName_ = serverName;
+}
+
 void HTTPConnector::setHTTPVersionOverride(bool enabled) {
   forceHTTP1xCodecTo1_1_ = enabled;
 }
 
+void HTTPConnector::setSSLSessionCache(
+  std::shared_ptr<SSLSessionCache> cache) {
+  sslSessionCache_ = std::move(cache);
+}
+
+void HTTPConnector::setTraceEventContext(const TraceEventContext& context) {
+  traceContext_ = folly::make_unique<TraceEventContext>(context);
+}
+
 void HTTPConnector::connect(
   EventBase* eventBase,
   const folly::SocketAddress& connectAddr,
@@ -86,6 +134,161 @@ void HTTPConnector::connect(
                    socketOptions, bindAddr);
 }
 
+void HTTPConnector::connect(
+  EventBase* eventBase,
+  const vector<folly::SocketAddress>& connectAddrs,
+  chrono::milliseconds timeoutMs,
+  chrono::milliseconds attemptDelay,
+  const AsyncSocket::OptionMap& socketOptions) {
+
+  DCHECK(!isBusy());
+  CHECK(!connectAddrs.empty());
+  transportInfo_ = TransportInfo();
+  transportInfo_.ssl = false;
+  eventBase_ = eventBase;
+  attemptAddrs_ = interleaveFamilies(connectAddrs);
+  numAttempts_ = 0;
+  attemptDelay_ = attemptDelay;
+  attemptConnectTimeout_ = timeoutMs;
+  attemptSocketOptions_ = socketOptions;
+  if (!attemptTimeout_ || attemptTimeout_->getEventBase() != eventBase) {
+    attemptTimeout_ = folly::make_unique<AttemptTimeout>(this, eventBase);
+  }
+  connectStart_ = getCurrentTime();
+  startAttempt();
+}
+
+void HTTPConnector::connect(
+  EventBase* eventBase,
+  DNSResolver* resolver,
+  const std::string& host,
+  uint16_t port,
+  chrono::milliseconds timeoutMs,
+  chrono::milliseconds attemptDelay,
+  const AsyncSocket::OptionMap& socketOptions) {
+
+  DCHECK(!isBusy());
+  eventBase_ = eventBase;
+  attemptDelay_ = attemptDelay;
+  attemptConnectTimeout_ = timeoutMs;
+  attemptSocketOptions_ = socketOptions;
+  auto request = resolver->resolve(eventBase, host, port, this,
+                                   traceContext_.get());
+  // Unless it was answered right away
+  if (request->isPending()) {
+    dnsRequest_ = std::move(request);
+  }
+}
+
+void HTTPConnector::resolveSuccess(
+  const vector<folly::SocketAddress>& addrs) noexcept {
+  dnsRequest_.reset();
+  connect(eventBase_, addrs, attemptConnectTimeout_, attemptDelay_,
+          attemptSocketOptions_);
+}
+
+void HTTPConnector::resolveError(const AsyncSocketException& ex) noexcept {
+  dnsRequest_.reset();
+  if (cb_) {
+    cb_->connectError(ex);
+  }
+}
+
+void HTTPConnector::startAttempt() {
+  if (numAttempts_ == attemptAddrs_.size()) {
+    return;
+  }
+  auto attempt = folly::make_unique<Attempt>(this,
+                                             attemptAddrs_[numAttempts_++],
+                                             eventBase_);
+  auto raw = attempt.get();
+  attempts_.push_back(std::move(attempt));
+  if (numAttempts_ < attemptAddrs_.size()) {
+    attemptTimeout_->scheduleTimeout(attemptDelay_.count());
+  }
+  VLOG(4) << "Connecting to " << raw->addr_.describe() << ", attempt "
+          << numAttempts_ << " of " << attemptAddrs_.size();
+  raw->start_ = getCurrentTime();
+  // This may fail, and so start the next attempt, right away
+  raw->socket_->connect(raw, raw->addr_, attemptConnectTimeout_.count(),
+                        attemptSocketOptions_);
+}
+
+void HTTPConnector::attemptSuccess(Attempt* attempt) noexcept {
+  traceAttempt(*attempt, "");
+  if (traceContext_) {
+    TraceEvent event(TraceEventType::MultiConnector,
+                     traceContext_->parentID);
+    event.start(connectStart_);
+    event.end(getCurrentTime());
+    event.addMeta(TraceFieldType::NumConnAttempts, numAttempts_);
+    event.addMeta(TraceFieldType::AttemptAddrs, attempt->addr_.describe());
+    event.addMeta(TraceFieldType::SucceededConnTime,
+                  millisecondsSince(attempt->start_).count());
+    traceContext_->traceEventAvailable(std::move(event));
+  }
+  socket_ = std::move(attempt->socket_);
+  // The attempt is gone after this, so don't touch it
+  cancelAttempts();
+  connectSuccess();
+}
+
+void HTTPConnector::attemptError(Attempt* attempt,
+                                 const AsyncSocketException& ex) noexcept {
+  VLOG(4) << "Connecting to " << attempt->addr_.describe() << " failed: "
+          << ex.what();
+  traceAttempt(*attempt, ex.what());
+  for (auto it = attempts_.begin(); it != attempts_.end(); ++it) {
+    if (it->get() == attempt) {
+      // The socket is destroyed once it's done calling back
+      attempts_.erase(it);
+      break;
+    }
+  }
+  if (numAttempts_ < attemptAddrs_.size()) {
+    // No need to wait for the next one
+    attemptTimeout_->cancelTimeout();
+    startAttempt();
+  } else if (attempts_.empty()) {
+    if (cb_) {
+      cb_->connectError(ex);
+    }
+  }
+}
+
+void HTTPConnector::cancelAttempts() {
+  if (attemptTimeout_) {
+    attemptTimeout_->cancelTimeout();
+  }
+  auto attempts = std::move(attempts_);
+  attempts_.clear();
+  for (auto& attempt: attempts) {
+    if (attempt->socket_) {
+      traceAttempt(*attempt, "cancelled");
+    }
+    attempt->connector_ = nullptr;
+    attempt->socket_.reset();
+  }
+}
+
+void HTTPConnector::traceAttempt(const Attempt& attempt,
+                                 const std::string& error) {
+  if (!traceContext_) {
+    return;
+  }
+  TraceEvent event(TraceEventType::SingleConnector,
+                   traceContext_->parentID);
+  event.start(attempt.start_);
+  event.end(getCurrentTime());
+  event.addMeta(TraceFieldType::AttemptAddrs, attempt.addr_.describe());
+  event.addMeta(TraceFieldType::AttemptAddrFamily,
+                attempt.addr_.getFamily() == AF_INET6 ? "ipv6" : "ipv4");
+  if (!error.empty()) {
+    event.addMeta(TraceFieldType::Error, error);
+  }
+  traceContext_->traceEventAvailable(std::move(event));
+}
+
 void HTTPConnector::connectSSL(
   EventBase* eventBase,
   const folly::SocketAddress& connectAddr,
@@ -99,9 +302,21 @@ void HTTPConnector::connectSSL(
   transportInfo_ = TransportInfo();
   transportInfo_.ssl = true;
   auto sslSock = new AsyncSSLSocket(context, eventBase);
+  if (sslSessionCache_) {
+    // Sessions are only good for the context that negotiated them
+    sslSessionKey_ = folly::to<std::string>(
+      connectAddr.describe(), "/", serverName_, "/",
+      (uintptr_t)context.get());
+    if (!session) {
+      session = sslSessionCache_->get(sslSessionKey_);
+    }
+  }
   if (session) {
     sslSock->setSSLSession(session, true /* take ownership */);
   }
+  if (!serverName_.empty()) {
+    sslSock->setServerName(serverName_);
+  }
   socket_.reset(sslSock);
   connectStart_ = getCurrentTime();
   socket_->connect(this, connectAddr, timeoutMs.count(),
@@ -147,6 +362,15 @@ void HTTPConnector::connectSuccess() noexcept {
     transportInfo_.sslVersion = sslSocket->getSSLVersion();
     transportInfo_.sslResume = SSLUtil::getResumeState(sslSocket);
 
+    if (sslSessionCache_ && !sslSocket->getSSLSessionReused()) {
+      // Save the new session (or ticket) for the next connection
+      SSL_SESSION* sslSession = sslSocket->getSSLSession();
+      if (sslSession) {
+        sslSessionCache_->put(sslSessionKey_, sslSession);
+        SSL_SESSION_free(sslSession);
+      }
+    }
+
     codec = makeCodec(*transportInfo_.sslNextProtocol, forceHTTP1xCodecTo1_1_);
   } else {
     codec = makeCodec(plaintextProtocol_, forceHTTP1xCodecTo1_1_);
@@ -10,10 +10,15 @@
 #pragma once
 
 #include <folly/wangle/acceptor/TransportInfo.h>
+#include <folly/io/async/AsyncTimeout.h>
 #include <folly/io/async/SSLContext.h>
+#include <proxygen/lib/http/DNSResolver.h>
+#include <proxygen/lib/ssl/SSLSessionCache.h>
 #include <proxygen/lib/utils/AsyncTimeoutSet.h>
 #include <proxygen/lib/utils/Time.h>
+#include <proxygen/lib/utils/TraceEventContext.h>
 #include <folly/io/async/AsyncSocket.h>
+#include <vector>
 
 namespace proxygen {
 
@@ -25,7 +30,8 @@ class HTTPUpstreamSession;
  * service setting up one connection at a time.
  */
 class HTTPConnector:
-      private folly::AsyncSocket::ConnectCallback {
+      private folly::AsyncSocket::ConnectCallback,
+      private DNSResolver::Callback {
  public:
   /**
    * This class defines the pure virtual interface on which to receive the
@@ -77,12 +83,32 @@ class HTTPConnector:
    */
   void setPlaintextProtocol(const std::string& plaintextProto);
 
+  /**
+   * Sets the host name connectSSL() sends in the TLS server name
+   * indication. None is sent by default.
+   */
+  void setServerName(const std::string& serverName);
+
   /**
    * Overrides the HTTP version to always use the latest and greatest
    * version we support.
    */
   void setHTTPVersionOverride(bool enabled);
 
+  /**
+   * Use cache to resume TLS sessions with the servers connectSSL() is given
+   * no explicit session for, and to save the sessions it negotiates. The
+   * cache may be shared with other connectors, in any thread.
+   */
+  void setSSLSessionCache(std::shared_ptr<SSLSessionCache> cache);
+
+  /**
+   * Report each attempt of a multi address connect() as a SingleConnector
+   * event, and the whole of it as a MultiConnector one, to the context's
+   * observers.
+   */
+  void setTraceEventContext(const TraceEventContext& context);
+
   /**
    * Begin the process of getting a plaintext connection to the server
    * specified by 'connectAddr'. This function immediately starts async
@@ -105,6 +131,48 @@ class HTTPConnector:
     const folly::SocketAddress& bindAddr =
       folly::AsyncSocket::anyAddress());
 
+  /**
+   * Begin the process of getting a plaintext connection to whichever of
+   * 'connectAddrs' answers first, as in RFC 8305 (happy eyeballs). The
+   * attempts start 'attemptDelay' apart, or as soon as the one before
+   * fails, with the address families taking turns starting with that of
+   * the first address. Once one connects the others are cancelled, and
+   * the callback is only told of the winner, or of the last error if
+   * none connects.
+   *
+   * @param eventBase The event base to put events on.
+   * @param connectAddrs The addresses to connect to, in order of
+   *                     preference. Must not be empty.
+   * @param timeoutMs Optional. If this value is greater than zero, then
+   *                  each attempt gives up after this amount of time.
+   * @param attemptDelay How long to give an attempt before starting the
+   *                     next one alongside it.
+   * @param socketOptions Optional socket options to set on the connection.
+   */
+  void connect(
+    folly::EventBase* eventBase,
+    const std::vector<folly::SocketAddress>& connectAddrs,
+    std::chrono::milliseconds timeoutMs = std::chrono::milliseconds(0),
+    std::chrono::milliseconds attemptDelay = std::chrono::milliseconds(250),
+    const folly::AsyncSocket::OptionMap& socketOptions =
+      folly::AsyncSocket::emptyOptionMap);
+
+  /**
+   * Resolve 'host' with 'resolver', then connect to its addresses as the
+   * multi address connect() above does. A failed resolve is given to the
+   * callback as a connect error. With a trace context set, the resolve is
+   * traced too.
+   */
+  void connect(
+    folly::EventBase* eventBase,
+    DNSResolver* resolver,
+    const std::string& host,
+    uint16_t port,
+    std::chrono::milliseconds timeoutMs = std::chrono::milliseconds(0),
+    std::chrono::milliseconds attemptDelay = std::chrono::milliseconds(250),
+    const folly::AsyncSocket::OptionMap& socketOptions =
+      folly::AsyncSocket::emptyOptionMap);
+
   /**
    * Begin the process of getting a secure connection to the server
    * specified by 'connectAddr'. This function immediately starts async
@@ -113,7 +181,8 @@ class HTTPConnector:
    * @param eventBase The event base to put events on.
    * @param connectAddr The address to connect to.
    * @param ctx SSL context to use. Must not be null.
-   * @param session Optional ssl session to use.
+   * @param session Optional ssl session to use. If null, one is looked up
+   *                in the SSL session cache, if any.
    * @param timeoutMs Optional. If this value is greater than zero, then a
    *                  connect error will be given if no connection is
    *                  established within this amount of time.
@@ -141,20 +210,92 @@ class HTTPConnector:
    * @returns true iff this connector is busy setting up a connection. If
    * this is false, it is safe to call connect() or connectSSL() on it again.
    */
-  bool isBusy() const { return socket_.get(); }
+  bool isBusy() const {
+    return socket_.get() || !attempts_.empty() || dnsRequest_;
+  }
 
  private:
+  // One of the racing connects of a multi address connect()
+  class Attempt : public folly::AsyncSocket::ConnectCallback {
+   public:
+    Attempt(HTTPConnector* connector, const folly::SocketAddress& addr,
+            folly::EventBase* eventBase)
+      : connector_(connector),
+        addr_(addr),
+        socket_(new folly::AsyncSocket(eventBase)) {}
+
+    void connectSuccess() noexcept override {
+      if (connector_) {
+        connector_->attemptSuccess(this);
+      }
+    }
+
+    void connectErr(const folly::AsyncSocketException& ex)
+      noexcept override {
+      if (connector_) {
+        connector_->attemptError(this, ex);
+      }
+    }
+
+    HTTPConnector* connector_;
+    folly::SocketAddress addr_;
+    folly::AsyncSocket::UniquePtr socket_;
+    TimePoint start_;
+  };
+
+  class AttemptTimeout : public folly::AsyncTimeout {
+   public:
+    AttemptTimeout(HTTPConnector* connector, folly::EventBase* eventBase)
+      : folly::AsyncTimeout(eventBase),
+        connector_(connector) {}
+
+    void timeoutExpired() noexcept override {
+      connector_->startAttempt();
+    }
+   private:
+    HTTPConnector* connector_;
+  };
+
   void connectSuccess() noexcept override;
   void connectErr(const folly::AsyncSocketException& ex)
     noexcept override;
 
+  // DNSResolver::Callback
+  void resolveSuccess(
+    const std::vector<folly::SocketAddress>& addrs) noexcept override;
+  void resolveError(const folly::AsyncSocketException& ex) noexcept override;
+
+  // Start connecting to the next address, if there are any left
+  void startAttempt();
+  void attemptSuccess(Attempt* attempt) noexcept;
+  void attemptError(Attempt* attempt,
+                    const folly::AsyncSocketException& ex) noexcept;
+  // Drop the attempts still going, without any callbacks
+  void cancelAttempts();
+  void traceAttempt(const Attempt& attempt, const std::string& error);
+
   Callback* cb_;
   AsyncTimeoutSet* timeoutSet_;
   folly::AsyncSocket::UniquePtr socket_;
   folly::TransportInfo transportInfo_;
   std::string plaintextProtocol_;
+  std::string serverName_;
+  std::shared_ptr<SSLSessionCache> sslSessionCache_;
+  std::string sslSessionKey_;
   TimePoint connectStart_;
   bool forceHTTP1xCodecTo1_1_{false};
+
+  // State of a multi address connect()
+  folly::EventBase* eventBase_{nullptr};
+  std::vector<folly::SocketAddress> attemptAddrs_;
+  size_t numAttempts_{0};
+  std::vector<std::unique_ptr<Attempt>> attempts_;
+  std::unique_ptr<AttemptTimeout> attemptTimeout_;
+  std::chrono::milliseconds attemptDelay_{0};
+  std::chrono::milliseconds attemptConnectTimeout_{0};
+  folly::AsyncSocket::OptionMap attemptSocketOptions_;
+  std::unique_ptr<TraceEventContext> traceContext_;
+  std::shared_ptr<DNSResolver::Request> dnsRequest_;
 };
 
 }
@@ -10,6 +10,8 @@
 #define PROXYGEN_HTTPHEADERS_IMPL
 #include <proxygen/lib/http/HTTPHeaders.h>
 
+#include <algorithm>
+#include <folly/ThreadLocal.h>
 #include <glog/logging.h>
 #include <vector>
 
@@ -41,21 +43,86 @@ HTTPHeaders::initGlobals() {
   perHopHeaders[HTTP_HEADER_UPGRADE] = true;
 }
 
+struct HTTPHeaders::Vectors {
+  folly::fbvector<HTTPHeaderCode> codes;
+  folly::fbvector<const std::string *> headerNames;
+  folly::fbvector<std::string> headerValues;
+};
+
+namespace {
+
+const size_t kMaxIdleVectors = 4096;
+
+struct IdleVectors {
+  std::vector<HTTPHeaders::Vectors> vectors;
+  PoolCounts counts;
+};
+
+// Leaked, so that headers can still be destroyed during static destruction
+folly::ThreadLocal<IdleVectors>& idleVectors() {
+  static auto idle = new folly::ThreadLocal<IdleVectors>();
+  return *idle;
+}
+
+}
+
 HTTPHeaders::HTTPHeaders() :
   deletedCount_(0) {
+  auto& idle = *idleVectors();
+  if (!idle.vectors.empty()) {
+    auto& vectors = idle.vectors.back();
+    codes_.swap(vectors.codes);
+    headerNames_.swap(vectors.headerNames);
+    headerValues_.swap(vectors.headerValues);
+    idle.vectors.pop_back();
+    idle.counts.reused++;
+    return;
+  }
   codes_.reserve(kInitialVectorReserve);
   headerNames_.reserve(kInitialVectorReserve);
   headerValues_.reserve(kInitialVectorReserve);
+  idle.counts.allocated++;
+}
+
+void HTTPHeaders::recycleVectors() {
+  // Moved from, or grown too large to keep around
+  if (codes_.capacity() < kInitialVectorReserve ||
+      codes_.capacity() > kMaxPooledVectorReserve ||
+      headerNames_.capacity() < kInitialVectorReserve ||
+      headerValues_.capacity() < kInitialVectorReserve) {
+    return;
+  }
+  auto& idle = *idleVectors();
+  if (idle.vectors.size() >= kMaxIdleVectors) {
+    return;
+  }
+  codes_.clear();
+  headerNames_.clear();
+  headerValues_.clear();
+  idle.vectors.emplace_back();
+  auto& vectors = idle.vectors.back();
+  vectors.codes.swap(codes_);
+  vectors.headerNames.swap(headerNames_);
+  vectors.headerValues.swap(headerValues_);
+}
+
+PoolCounts HTTPHeaders::takeVectorPoolCounts() {
+  auto& idle = *idleVectors();
+  auto counts = idle.counts;
+  idle.counts = PoolCounts();
+  return counts;
 }
 
 void HTTPHeaders::add(folly::StringPiece name, folly::StringPiece value) {
   CHECK(name.size());
   const HTTPHeaderCode code = HTTPCommonHeaders::hash(name.data(), name.size());
-  codes_.push_back(code);
+  pushCode(code);
   headerNames_.push_back((code == HTTP_HEADER_OTHER)
-      ? new std::string(name.data(), name.size())
+      ? allocHeaderName(name.data(), name.size())
       : HTTPCommonHeaders::getPointerToHeaderName(code));
+  countHeaderCopies();
   headerValues_.emplace_back(value.data(), value.size());
+  compactIfNeeded();
 }
 
 void HTTPHeaders::rawAdd(const std::string& name, const std::string& value) {
@@ -64,11 +131,90 @@ void HTTPHeaders::rawAdd(const std::string& name, const std::string& value) {
 
 void HTTPHeaders::addFromCodec(const char* str, size_t len, string&& value) {
   const HTTPHeaderCode code = HTTPCommonHeaders::hash(str, len);
-  codes_.push_back(code);
+  pushCode(code);
   headerNames_.push_back((code == HTTP_HEADER_OTHER)
-      ? new string(str, len)
+      ? allocHeaderName(str, len)
       : HTTPCommonHeaders::getPointerToHeaderName(code));
   headerValues_.emplace_back(std::move(value));
+  compactIfNeeded();
+}
+
+void HTTPHeaders::addFromCodec(HTTPHeaderCode code, folly::StringPiece name,
+                               folly::StringPiece value) {
+  if (arenaBlockSize_) {
+    pushCode(code);
+    // With the first header from the arena, the headers before it get
+    // null pieces
+    if (arenaHeaders_.size() < codes_.size()) {
+      arenaHeaders_.reserve(codes_.capacity());
+      arenaHeaders_.resize(codes_.size());
+    }
+    ArenaHeader& header = arenaHeaders_.back();
+    if (code == HTTP_HEADER_OTHER) {
+      header.name = copyToArena(name);
+      headerNames_.push_back(nullptr);
+    } else {
+      headerNames_.push_back(HTTPCommonHeaders::getPointerToHeaderName(code));
+    }
+    header.value = copyToArena(value);
+    headerValues_.emplace_back();
+    compactIfNeeded();
+    return;
+  }
+  pushCode(code);
+  headerNames_.push_back((code == HTTP_HEADER_OTHER)
+      ? allocHeaderName(name.data(), name.size())
+      : HTTPCommonHeaders::getPointerToHeaderName(code));
+  countHeaderCopies();
+  headerValues_.emplace_back(value.data(), value.size());
+  compactIfNeeded();
+}
+
+void HTTPHeaders::reserve(size_t n) {
+  const size_t size = codes_.size() + n;
+  codes_.reserve(size);
+  headerNames_.reserve(size);
+  headerValues_.reserve(size);
+  if (!arenaHeaders_.empty()) {
+    arenaHeaders_.reserve(size);
+  }
+}
+
+void HTTPHeaders::useArena(size_t blockSize) {
+  CHECK_GT(blockSize, 0);
+  arenaBlockSize_ = blockSize;
+}
+
+folly::StringPiece HTTPHeaders::copyToArena(folly::StringPiece str) {
+  folly::IOBuf* tail = arena_ ? arena_->prev() : nullptr;
+  // a block shared with a copy of these headers is left as it is: the
+  // bytes past its length aren't the copy's, but neither are they ours
+  if (!tail || tail->isSharedOne() || tail->tailroom() < str.size()) {
+    auto block = folly::IOBuf::create(std::max(arenaBlockSize_, str.size()));
+    tail = block.get();
+    if (arena_) {
+      arena_->prependChain(std::move(block));
+    } else {
+      arena_ = std::move(block);
+    }
+  }
+  uint8_t* data = tail->writableTail();
+  memcpy(data, str.data(), str.size());
+  tail->append(str.size());
+  return folly::StringPiece(reinterpret_cast<const char*>(data), str.size());
+}
+
+void HTTPHeaders::copyNameOutOfArena(size_t pos) const {
+  folly::StringPiece& name = arenaHeaders_[pos].name;
+  headerNames_[pos] = allocHeaderName(name.data(), name.size());
+  name.clear();
+}
+
+void HTTPHeaders::copyValueOutOfArena(size_t pos) const {
+  folly::StringPiece& value = arenaHeaders_[pos].value;
+  countHeaderCopies();
+  headerValues_[pos].assign(value.data(), value.size());
+  value.clear();
 }
 
 bool HTTPHeaders::exists(folly::StringPiece name) const {
@@ -83,7 +229,11 @@ bool HTTPHeaders::exists(folly::StringPiece name) const {
 }
 
 bool HTTPHeaders::exists(HTTPHeaderCode code) const {
-  return memchr((void*)codes_.data(), code, codes_.size()) != nullptr;
+  ITERATE_OVER_CODES(code, {
+    (void)pos;
+    return true;
+  });
+  return false;
 }
 
 size_t HTTPHeaders::getNumberOfValues(HTTPHeaderCode code) const {
@@ -112,7 +262,6 @@ bool HTTPHeaders::remove(folly::StringPiece name) {
   } else {
     bool removed = false;
     ITERATE_OVER_STRINGS(name, {
-      delete headerNames_[pos];
       codes_[pos] = HTTP_HEADER_NONE;
       removed = true;
       ++deletedCount_;
@@ -131,26 +280,73 @@ bool HTTPHeaders::remove(HTTPHeaderCode code) {
   return removed;
 }
 
-void HTTPHeaders::disposeOfHeaderNames() {
+void HTTPHeaders::compact() {
+  size_t out = 0;
   for (size_t i = 0; i < codes_.size(); ++i) {
-    if (codes_[i] == HTTP_HEADER_OTHER) {
-      delete headerNames_[i];
+    if (codes_[i] == HTTP_HEADER_NONE) {
+      continue;
     }
+    if (out != i) {
+      codes_[out] = codes_[i];
+      headerNames_[out] = headerNames_[i];
+      headerValues_[out] = std::move(headerValues_[i]);
+      if (!arenaHeaders_.empty()) {
+        arenaHeaders_[out] = arenaHeaders_[i];
+      }
+    }
+    ++out;
+  }
+  codes_.resize(out);
+  headerNames_.resize(out);
+  headerValues_.erase(headerValues_.begin() + out, headerValues_.end());
+  if (!arenaHeaders_.empty()) {
+    arenaHeaders_.resize(out);
+  }
+  deletedCount_ = 0;
+}
+
+const std::string* HTTPHeaders::allocHeaderName(const char* str,
+                                                size_t len) const {
+  if (nameBlockUsed_ == kNamesPerBlock) {
+    std::unique_ptr<NameBlock> block(new NameBlock);
+    block->next = std::move(nameBlocks_);
+    nameBlocks_ = std::move(block);
+    nameBlockUsed_ = 0;
   }
+  std::string& name = nameBlocks_->names[nameBlockUsed_++];
+  countHeaderCopies();
+  name.assign(str, len);
+  return &name;
+}
+
+void HTTPHeaders::disposeOfHeaderNames() {
+  // iteratively, so a long chain of blocks does not recurse
+  while (nameBlocks_) {
+    nameBlocks_ = std::move(nameBlocks_->next);
+  }
+  nameBlockUsed_ = kNamesPerBlock;
 }
 
 HTTPHeaders::~HTTPHeaders () {
   disposeOfHeaderNames();
+  recycleVectors();
 }
 
 HTTPHeaders::HTTPHeaders(const HTTPHeaders& hdrs) :
   codes_(hdrs.codes_),
   headerNames_(hdrs.headerNames_),
   headerValues_(hdrs.headerValues_),
-  deletedCount_(hdrs.deletedCount_) {
+  arenaHeaders_(hdrs.arenaHeaders_),
+  arena_(hdrs.arena_ ? hdrs.arena_->clone() : nullptr),
+  arenaBlockSize_(hdrs.arenaBlockSize_),
+  deletedCount_(hdrs.deletedCount_),
+  codesAdded_(hdrs.codesAdded_) {
+  countHeaderCopies(headerValues_.size());
   for (size_t i = 0; i < codes_.size(); ++i) {
-    if (codes_[i] == HTTP_HEADER_OTHER) {
-      headerNames_[i] = new string(*hdrs.headerNames_[i]);
+    const string* name = hdrs.headerNames_[i];
+    // the names still in the arena are shared along with it
+    if (codes_[i] == HTTP_HEADER_OTHER && name) {
+      headerNames_[i] = allocHeaderName(name->data(), name->size());
     }
   }
 }
@@ -159,7 +355,13 @@ HTTPHeaders::HTTPHeaders(HTTPHeaders&& hdrs) noexcept :
     codes_(std::move(hdrs.codes_)),
     headerNames_(std::move(hdrs.headerNames_)),
     headerValues_(std::move(hdrs.headerValues_)),
-    deletedCount_(hdrs.deletedCount_) {
+    arenaHeaders_(std::move(hdrs.arenaHeaders_)),
+    arena_(std::move(hdrs.arena_)),
+    arenaBlockSize_(hdrs.arenaBlockSize_),
+    deletedCount_(hdrs.deletedCount_),
+    codesAdded_(hdrs.codesAdded_),
+    nameBlocks_(std::move(hdrs.nameBlocks_)),
+    nameBlockUsed_(hdrs.nameBlockUsed_) {
   hdrs.removeAll();
 }
 
@@ -169,10 +371,16 @@ HTTPHeaders& HTTPHeaders::operator= (const HTTPHeaders& hdrs) {
     codes_ = hdrs.codes_;
     headerNames_ = hdrs.headerNames_;
     headerValues_ = hdrs.headerValues_;
+    arenaHeaders_ = hdrs.arenaHeaders_;
+    arena_ = hdrs.arena_ ? hdrs.arena_->clone() : nullptr;
+    arenaBlockSize_ = hdrs.arenaBlockSize_;
     deletedCount_ = hdrs.deletedCount_;
+    codesAdded_ = hdrs.codesAdded_;
+    countHeaderCopies(headerValues_.size());
     for (size_t i = 0; i < codes_.size(); ++i) {
-      if (codes_[i] == HTTP_HEADER_OTHER) {
-        headerNames_[i] = new string(*hdrs.headerNames_[i]);
+      const string* name = hdrs.headerNames_[i];
+      if (codes_[i] == HTTP_HEADER_OTHER && name) {
+        headerNames_[i] = allocHeaderName(name->data(), name->size());
       }
     }
   }
@@ -181,10 +389,17 @@ HTTPHeaders& HTTPHeaders::operator= (const HTTPHeaders& hdrs) {
 
 HTTPHeaders& HTTPHeaders::operator= (HTTPHeaders&& hdrs) {
   if (this != &hdrs) {
+    disposeOfHeaderNames();
     codes_ = std::move(hdrs.codes_);
     headerNames_ = std::move(hdrs.headerNames_);
     headerValues_ = std::move(hdrs.headerValues_);
+    arenaHeaders_ = std::move(hdrs.arenaHeaders_);
+    arena_ = std::move(hdrs.arena_);
+    arenaBlockSize_ = hdrs.arenaBlockSize_;
     deletedCount_ = hdrs.deletedCount_;
+    codesAdded_ = hdrs.codesAdded_;
+    nameBlocks_ = std::move(hdrs.nameBlocks_);
+    nameBlockUsed_ = hdrs.nameBlockUsed_;
 
     hdrs.removeAll();
   }
@@ -198,7 +413,11 @@ void HTTPHeaders::removeAll() {
   codes_.clear();
   headerNames_.clear();
   headerValues_.clear();
+  // still in arena mode, with a new arena if need be
+  arenaHeaders_.clear();
+  arena_.reset();
   deletedCount_ = 0;
+  codesAdded_.reset();
 }
 
 size_t HTTPHeaders::size() const {
@@ -213,19 +432,22 @@ HTTPHeaders::transferHeaderIfPresent(folly::StringPiece name,
                                                       name.size());
   if (code == HTTP_HEADER_OTHER) {
     ITERATE_OVER_STRINGS(name, {
-      strippedHeaders.codes_.push_back(HTTP_HEADER_OTHER);
-      // in the next line, ownership of pointer goes to strippedHeaders
-      strippedHeaders.headerNames_.push_back(headerNames_[pos]);
-      strippedHeaders.headerValues_.push_back(headerValues_[pos]);
+      strippedHeaders.pushCode(HTTP_HEADER_OTHER);
+      const folly::StringPiece otherName = namePieceAt(pos);
+      const folly::StringPiece value = valuePieceAt(pos);
+      strippedHeaders.headerNames_.push_back(
+        strippedHeaders.allocHeaderName(otherName.data(), otherName.size()));
+      strippedHeaders.headerValues_.emplace_back(value.data(), value.size());
       codes_[pos] = HTTP_HEADER_NONE;
       transferred = true;
       ++deletedCount_;
     });
   } else { // code != HTTP_HEADER_OTHER
     ITERATE_OVER_CODES(code, {
-      strippedHeaders.codes_.push_back(code);
+      const folly::StringPiece value = valuePieceAt(pos);
+      strippedHeaders.pushCode(code);
       strippedHeaders.headerNames_.push_back(headerNames_[pos]);
-      strippedHeaders.headerValues_.push_back(headerValues_[pos]);
+      strippedHeaders.headerValues_.emplace_back(value.data(), value.size());
       codes_[pos] = HTTP_HEADER_NONE;
       transferred = true;
       ++deletedCount_;
@@ -284,9 +506,10 @@ HTTPHeaders::stripPerHopHeaders(HTTPHeaders& strippedHeaders) {
   auto& perHopHeaders = perHopHeaderCodes();
   for (size_t i = 0; i < codes_.size(); ++i) {
     if (perHopHeaders[codes_[i]]) {
-      strippedHeaders.codes_.push_back(codes_[i]);
+      const folly::StringPiece value = valuePieceAt(i);
+      strippedHeaders.pushCode(codes_[i]);
       strippedHeaders.headerNames_.push_back(headerNames_[i]);
-      strippedHeaders.headerValues_.push_back(headerValues_[i]);
+      strippedHeaders.headerValues_.emplace_back(value.data(), value.size());
       codes_[i] = HTTP_HEADER_NONE;
       ++deletedCount_;
       VLOG(5) << "Stripped hop-by-hop header " << *headerNames_[i];
@@ -297,10 +520,13 @@ HTTPHeaders::stripPerHopHeaders(HTTPHeaders& strippedHeaders) {
 void HTTPHeaders::copyTo(HTTPHeaders& hdrs) const {
   for (size_t i = 0; i < codes_.size(); ++i) {
     if (codes_[i] != HTTP_HEADER_NONE) {
-      hdrs.codes_.push_back(codes_[i]);
+      const folly::StringPiece name = namePieceAt(i);
+      const folly::StringPiece value = valuePieceAt(i);
+      hdrs.pushCode(codes_[i]);
       hdrs.headerNames_.push_back((codes_[i] == HTTP_HEADER_OTHER) ?
-          new string(*headerNames_[i]) : headerNames_[i]);
-      hdrs.headerValues_.push_back(headerValues_[i]);
+          hdrs.allocHeaderName(name.data(), name.size()) :
+          headerNames_[i]);
+      hdrs.headerValues_.emplace_back(value.data(), value.size());
     }
   }
 }
@@ -10,13 +10,22 @@
 #pragma once
 
 #include <folly/FBVector.h>
+#include <folly/Likely.h>
 #include <folly/Range.h>
+#include <folly/io/IOBuf.h>
 #include <proxygen/lib/http/HTTPCommonHeaders.h>
+#include <proxygen/lib/utils/AllocStats.h>
+#include <proxygen/lib/utils/ThreadLocalFreeList.h>
 #include <proxygen/lib/utils/UtilInl.h>
 
 #include <bitset>
 #include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include <memory>
 #include <string>
+#include <type_traits>
 
 namespace proxygen {
 
@@ -45,8 +54,8 @@ inline bool isLWS(char c) {
  * the wire. We hash the names of all common HTTP headers (using a static
  * perfect hash function generated using gperf from HTTPCommonHeaders.gperf)
  * into 1-byte hashes (we call them "codes") and only store these. We search
- * them using memchr, which has an x86_64 assembly implementation with
- * complexity O(n/16) ;)
+ * them 16 at a time with SSE2, and a 256-bit set of the codes added so far
+ * answers most lookups of absent codes without a search at all.
  *
  * Instead of creating strings with header names, we point to a static array
  * of strings in HTTPCommonHeaders. If the header name is not in our set of
@@ -54,7 +63,13 @@ inline bool isLWS(char c) {
  * to be very complete), then we create a new string with its name (we own that
  * pointer then). For such headers, we store the code HTTP_HEADER_OTHER.
  *
- * The code HTTP_HEADER_NONE signifies a header that has been removed.
+ * In arena mode (see useArena()) the names and values parsed by a codec
+ * are instead copied into a few shared IOBuf blocks, and only get their
+ * own strings when first asked for as strings.
+ *
+ * The code HTTP_HEADER_NONE signifies a header that has been removed. Once
+ * removed headers make up half of a long enough collection, the next add
+ * compacts them away, so set() in a loop does not keep growing it.
  *
  * Most methods which take a header name have two versions: one accepting
  * a string, and one accepting a code. It is recommended to use the latter
@@ -91,6 +106,41 @@ class HTTPHeaders {
 
   void addFromCodec(const char* str, size_t len, std::string&& value);
 
+  /**
+   * Adds a header a codec already looked up, such as an HPACK table entry;
+   * the name is only stored when code is HTTP_HEADER_OTHER, and never
+   * hashed again.
+   */
+  void addFromCodec(HTTPHeaderCode code, folly::StringPiece name,
+                    folly::StringPiece value);
+
+  /**
+   * Makes room for n more headers at once, for codecs which know or can
+   * guess how many a header block holds, rather than growing as they are
+   * added.
+   */
+  void reserve(size_t n);
+
+  static const size_t kDefaultArenaBlockSize = 1024;
+
+  /**
+   * Arena mode: from now on addFromCodec(code, name, value) copies the
+   * name and value into blocks of blockSize bytes, refcounted IOBufs
+   * owned by these headers, rather than into strings of their own, and
+   * the headers point into them. A header is only copied out into its own
+   * std::string the first time it's asked for as one, eg. by
+   * getSingleOrEmpty() or forEach(); exists(), remove() and forEachPiece()
+   * never do. Copies of the headers share the blocks rather than copy
+   * them, and start a new block rather than add to a shared one. Even the
+   * const methods modify the headers then, so as ever they aren't to be
+   * called from several threads at once.
+   */
+  void useArena(size_t blockSize = kDefaultArenaBlockSize);
+
+  bool usesArena() const {
+    return arenaBlockSize_ != 0;
+  }
+
   /**
    * For the header 'name', set its value to the single header 'value',
    * removing any other instances of this header.
@@ -151,6 +201,14 @@ class HTTPHeaders {
   template <typename LAMBDA>
   inline void forEachWithCode(LAMBDA func) const;
 
+  /**
+   * forEachWithCode(), with the names and values as StringPieces, for
+   * those only read on the spot: in arena mode they aren't copied out of
+   * the arena.
+   */
+  template <typename LAMBDA> // (HTTPHeaderCode, StringPiece, StringPiece)
+  inline void forEachPiece(LAMBDA func) const;
+
   /**
    * Process the list of all headers, in the order that they were seen:
    * for each header:value pair, the function/functor/lambda-expression
@@ -239,26 +297,167 @@ class HTTPHeaders {
    */
   static std::bitset<256>& perHopHeaderCodes();
 
+  /**
+   * How many headers constructed in the current thread, since the last
+   * call, allocated their vectors, and how many reused those of destroyed
+   * headers.
+   */
+  static PoolCounts takeVectorPoolCounts();
+
+  // The vectors kept for reuse
+  struct Vectors;
+
  private:
   // vector storing the 1-byte hashes of header names
   folly::fbvector<HTTPHeaderCode> codes_;
 
   /**
-   * Vector storing pointers to header names; we own those pointers which
-   * correspond to HTTP_HEADER_OTHER codes.
+   * Vector storing pointers to header names; those which correspond to
+   * HTTP_HEADER_OTHER codes point into nameBlocks_, or are null while
+   * the name is in the arena.
    */
-  folly::fbvector<const std::string *> headerNames_;
+  mutable folly::fbvector<const std::string *> headerNames_;
 
-  folly::fbvector<std::string> headerValues_;
+  // the values still in the arena are empty
+  mutable folly::fbvector<std::string> headerValues_;
+
+  /**
+   * The HTTP_HEADER_OTHER name and the value of the headers whose are in
+   * the arena, which are null pieces once copied out or for the other
+   * headers. Either empty or as long as codes_.
+   */
+  struct ArenaHeader {
+    folly::StringPiece name;
+    folly::StringPiece value;
+  };
+  mutable folly::fbvector<ArenaHeader> arenaHeaders_;
+
+  // the arena blocks, oldest first; created by the first header added
+  std::unique_ptr<folly::IOBuf> arena_;
+  size_t arenaBlockSize_{0};
 
   size_t deletedCount_;
 
+  /**
+   * The codes added since the last removeAll(). Removing a header leaves
+   * its code in, so a code in the set may still be absent from codes_.
+   */
+  std::bitset<256> codesAdded_;
+
+  void pushCode(HTTPHeaderCode code) {
+    codes_.push_back(code);
+    codesAdded_.set(code);
+    if (!arenaHeaders_.empty()) {
+      arenaHeaders_.emplace_back();
+    }
+  }
+
+  // The name and value of the header at pos, as strings: copied out of
+  // the arena first if they are still in it
+  const std::string& nameAt(size_t pos) const {
+    if (UNLIKELY(!headerNames_[pos])) {
+      copyNameOutOfArena(pos);
+    }
+    return *headerNames_[pos];
+  }
+
+  const std::string& valueAt(size_t pos) const {
+    if (UNLIKELY(!arenaHeaders_.empty() &&
+                 arenaHeaders_[pos].value.data())) {
+      copyValueOutOfArena(pos);
+    }
+    return headerValues_[pos];
+  }
+
+  // The same, without copying anything
+  folly::StringPiece namePieceAt(size_t pos) const {
+    return headerNames_[pos] ?
+      folly::StringPiece(*headerNames_[pos]) : arenaHeaders_[pos].name;
+  }
+
+  folly::StringPiece valuePieceAt(size_t pos) const {
+    return (!arenaHeaders_.empty() && arenaHeaders_[pos].value.data()) ?
+      arenaHeaders_[pos].value : folly::StringPiece(headerValues_[pos]);
+  }
+
+  void copyNameOutOfArena(size_t pos) const;
+  void copyValueOutOfArena(size_t pos) const;
+
+  // Copies str to the end of the last arena block, or of a new one
+  folly::StringPiece copyToArena(folly::StringPiece str);
+
+  /**
+   * Removed headers are only dropped from the vectors, keeping the order of
+   * the others, once there are at least this many and they are at least
+   * half of them, which amortizes the compaction over the removals.
+   */
+  static const size_t kMinCompactDeleted = 8;
+
+  /**
+   * Drops the HTTP_HEADER_NONE entries. Only called at the end of an add,
+   * once the value is in, so that a value passed by reference from these
+   * same headers is never moved from before being copied, and positions
+   * seen by ITERATE_OVER_CODES stay valid while removing.
+   */
+  void compact();
+
+  void compactIfNeeded() {
+    if (deletedCount_ >= kMinCompactDeleted &&
+        deletedCount_ * 2 >= codes_.size()) {
+      compact();
+    }
+  }
+
+  /**
+   * Bit i of the result is set when codes[base + i] == code, for the up to
+   * 16 codes from base
+   */
+  static uint32_t matchCodes(const HTTPHeaderCode* codes, size_t size,
+                             size_t base, HTTPHeaderCode code) {
+#if defined(__SSE2__)
+    if (base + 16 <= size) {
+      __m128i v = _mm_loadu_si128((const __m128i*)(codes + base));
+      return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(code)));
+    }
+#endif
+    uint32_t mask = 0;
+    for (size_t i = base; i < size && i < base + 16; i++) {
+      mask |= uint32_t(codes[i] == code) << (i - base);
+    }
+    return mask;
+  }
+
   /**
    * The initial capacity of the three vectors, reserved right after
    * construction.
    */
   static const size_t kInitialVectorReserve = 16;
 
+  /**
+   * The vectors of destroyed headers are cleared and kept per thread, for
+   * the next headers constructed, unless they grew past this.
+   */
+  static const size_t kMaxPooledVectorReserve = 64;
+
+  void recycleVectors();
+
+  /**
+   * HTTP_HEADER_OTHER names are stored kNamesPerBlock to an allocation,
+   * rather than one allocation each.  A block is only freed with all the
+   * others, by removeAll() or destruction, so the name of a removed header
+   * stays allocated until then.
+   */
+  static const size_t kNamesPerBlock = 8;
+
+  struct NameBlock {
+    std::unique_ptr<NameBlock> next;
+    std::string names[kNamesPerBlock];
+  };
+
+  // newest block first; mutable, for names copied out of the arena
+  mutable std::unique_ptr<NameBlock> nameBlocks_;
+  mutable size_t nameBlockUsed_{kNamesPerBlock};
+
   /**
    * Moves the named header and values from this group to the destination
    * group.  No-op if the header doesn't exist.  Returns true if header(s) were
@@ -268,8 +467,19 @@ class HTTPHeaders {
 
   static void initGlobals() __attribute__ ((__constructor__));
 
-  // deletes the strings in headerNames_ that we own
+  // copies a HTTP_HEADER_OTHER name into nameBlocks_
+  const std::string* allocHeaderName(const char* str, size_t len) const;
+
+  // frees the strings in headerNames_ that we own
   void disposeOfHeaderNames();
+
+  // Only a std::string rvalue is moved into headerValues_
+  template <typename T>
+  static void countValueCopy() {
+    if (!std::is_same<T, std::string>::value) {
+      countHeaderCopies();
+    }
+  }
 };
 
 // Implementation follows - it has to be in the .h because of the templates
@@ -278,37 +488,43 @@ template <typename T> // T = string
 void HTTPHeaders::add(folly::StringPiece name, T&& value) {
   assert(name.size());
   const HTTPHeaderCode code = HTTPCommonHeaders::hash(name.data(), name.size());
-  codes_.push_back(code);
+  pushCode(code);
   headerNames_.push_back((code == HTTP_HEADER_OTHER)
-      ? new std::string(name.data(), name.size())
+      ? allocHeaderName(name.data(), name.size())
       : HTTPCommonHeaders::getPointerToHeaderName(code));
+  countValueCopy<T>();
   headerValues_.emplace_back(std::forward<T>(value));
+  compactIfNeeded();
 }
 
 template <typename T> // T = string
 void HTTPHeaders::add(HTTPHeaderCode code, T&& value) {
-  codes_.push_back(code);
+  pushCode(code);
   headerNames_.push_back(HTTPCommonHeaders::getPointerToHeaderName(code));
+  countValueCopy<T>();
   headerValues_.emplace_back(std::forward<T>(value));
+  compactIfNeeded();
 }
 
-// iterate over the positions (in vector) of all headers with given code
+// iterate over the positions (in vector) of all headers with given code, in
+// order; Block may remove the header at pos
 #define ITERATE_OVER_CODES(Code, Block) { \
-  const HTTPHeaderCode* ptr = codes_.data(); \
-  while(true) { \
-    ptr = (HTTPHeaderCode*) memchr((void*)ptr, (Code), \
-                            codes_.size() - (ptr - codes_.data())); \
-    if (ptr == nullptr) break; \
-    const size_t pos = ptr - codes_.data(); \
-    {Block} \
-    ptr++; \
+  const HTTPHeaderCode iterCode = (Code); \
+  const size_t numCodes = codesAdded_.test(iterCode) ? codes_.size() : 0; \
+  for (size_t base = 0; base < numCodes; base += 16) { \
+    uint32_t mask = matchCodes(codes_.data(), numCodes, base, iterCode); \
+    while (mask) { \
+      const size_t pos = base + __builtin_ctz(mask); \
+      mask &= mask - 1; \
+      {Block} \
+    } \
   } \
 }
 
 // iterate over the positions of all headers with given name
 #define ITERATE_OVER_STRINGS(String, Block) \
     ITERATE_OVER_CODES(HTTP_HEADER_OTHER, { \
-  if (caseInsensitiveEqual((String), *headerNames_[pos])) { \
+  if (caseInsensitiveEqual((String), namePieceAt(pos))) { \
     {Block} \
   } \
 })
@@ -317,7 +533,7 @@ template <typename LAMBDA> // (const string &, const string &) -> void
 void HTTPHeaders::forEach(LAMBDA func) const {
   for (size_t i = 0; i < codes_.size(); ++i) {
     if (codes_[i] != HTTP_HEADER_NONE) {
-      func(*headerNames_[i], headerValues_[i]);
+      func(nameAt(i), valueAt(i));
     }
   }
 }
@@ -326,7 +542,16 @@ template <typename LAMBDA>
 void HTTPHeaders::forEachWithCode(LAMBDA func) const {
   for (size_t i = 0; i < codes_.size(); ++i) {
     if (codes_[i] != HTTP_HEADER_NONE) {
-      func(codes_[i], *headerNames_[i], headerValues_[i]);
+      func(codes_[i], nameAt(i), valueAt(i));
+    }
+  }
+}
+
+template <typename LAMBDA>
+void HTTPHeaders::forEachPiece(LAMBDA func) const {
+  for (size_t i = 0; i < codes_.size(); ++i) {
+    if (codes_[i] != HTTP_HEADER_NONE) {
+      func(codes_[i], namePieceAt(i), valuePieceAt(i));
     }
   }
 }
@@ -339,7 +564,7 @@ bool HTTPHeaders::forEachValueOfHeader(folly::StringPiece name,
     return forEachValueOfHeader(code, func);
   } else {
     ITERATE_OVER_STRINGS(name, {
-      if (func(headerValues_[pos])) {
+      if (func(valueAt(pos))) {
         return true;
       }
     });
@@ -351,7 +576,7 @@ template <typename LAMBDA> // const string & -> bool
 bool HTTPHeaders::forEachValueOfHeader(HTTPHeaderCode code,
                                        LAMBDA func) const {
   ITERATE_OVER_CODES(code, {
-    if (func(headerValues_[pos])) {
+    if (func(valueAt(pos))) {
       return true;
     }
   });
@@ -379,15 +604,11 @@ bool HTTPHeaders::removeByPredicate(LAMBDA func) {
   bool removed = false;
   for (size_t i = 0; i < codes_.size(); ++i) {
     if (codes_[i] == HTTP_HEADER_NONE ||
-        !func(codes_[i], *headerNames_[i], headerValues_[i])) {
+        !func(codes_[i], nameAt(i), valueAt(i))) {
       continue;
     }
 
-    if (codes_[i] == HTTP_HEADER_OTHER) {
-      delete headerNames_[i];
-      headerNames_[i] = nullptr;
-    }
-
+    // a HTTP_HEADER_OTHER name stays in nameBlocks_ until removeAll()
     codes_[i] = HTTP_HEADER_NONE;
     ++deletedCount_;
     removed = true;
@@ -9,10 +9,15 @@
  */
 #include <proxygen/lib/http/HTTPMessage.h>
 
+#include <algorithm>
 #include <array>
 #include <boost/algorithm/string.hpp>
 #include <folly/Format.h>
 #include <folly/Range.h>
+#include <folly/ThreadLocal.h>
+#include <proxygen/lib/utils/HTTPTime.h>
+#include <proxygen/lib/utils/ThreadLocalFreeList.h>
+#include <proxygen/lib/utils/UnionBasedStatic.h>
 #include <string>
 #include <utility>
 #include <vector>
@@ -36,6 +41,78 @@ const string kCookieStr = "cookie.";
  * approximately 1% of our total CPU time on temporary locale objects.)
  */
 std::locale defaultLocale;
+
+// As boost::trim() in the classic locale
+StringPiece trimWhitespace(StringPiece sp) {
+  while (!sp.empty() && isspace((unsigned char)sp.front())) {
+    sp.pop_front();
+  }
+  while (!sp.empty() && isspace((unsigned char)sp.back())) {
+    sp.pop_back();
+  }
+  return sp;
+}
+
+StringPiece trimSpaces(StringPiece sp) {
+  while (!sp.empty() && sp.front() == ' ') {
+    sp.pop_front();
+  }
+  while (!sp.empty() && sp.back() == ' ') {
+    sp.pop_back();
+  }
+  return sp;
+}
+
+/**
+ * As HTTPMessage::splitNameValuePieces(), without a std::function or
+ * copies, until callback returns true
+ */
+template <typename Trim, typename Callback>
+void forEachNameValue(StringPiece sp, char pairDelim, char valueDelim,
+                      Trim trim, Callback callback) {
+  while (!sp.empty()) {
+    StringPiece keyValue = sp.split_step(pairDelim);
+    if (keyValue.empty()) {
+      continue;
+    }
+
+    size_t valueDelimPos = keyValue.find(valueDelim);
+    bool stop;
+    if (valueDelimPos == StringPiece::npos) {
+      // Key only
+      stop = callback(trim(keyValue), StringPiece());
+    } else {
+      stop = callback(trim(keyValue.subpiece(0, valueDelimPos)),
+                      trim(keyValue.subpiece(valueDelimPos + 1)));
+    }
+    if (stop) {
+      return;
+    }
+  }
+}
+
+/**
+ * Sort by name, keeping only the first or last value of each name, in the
+ * order they were added
+ */
+template <typename Index>
+void sortIndex(Index& index, bool keepLast) {
+  typedef typename Index::value_type Entry;
+  std::stable_sort(index.begin(), index.end(),
+                   [] (const Entry& a, const Entry& b) {
+                     return a.first < b.first;
+                   });
+  auto out = index.begin();
+  for (auto it = index.begin(); it != index.end(); ) {
+    auto next = it + 1;
+    while (next != index.end() && next->first == it->first) {
+      ++next;
+    }
+    *out++ = keepLast ? *(next - 1) : *it;
+    it = next;
+  }
+  index.erase(out, index.end());
+}
 }
 
 namespace proxygen {
@@ -70,6 +147,8 @@ HTTPMessage::HTTPMessage() :
     version_(1,0),
     sslVersion_(0), sslCipher_(nullptr), protoStr_(nullptr), pri_(0),
     parsedCookies_(false), parsedQueryParams_(false),
+    indexedQueryParams_(false), scannedCookies_(false),
+    scannedQueryParams_(false),
     chunked_(false), upgraded_(false), wantsKeepalive_(true),
     trailersAllowed_(false), secure_(false) {
 }
@@ -77,6 +156,21 @@ HTTPMessage::HTTPMessage() :
 HTTPMessage::~HTTPMessage() {
 }
 
+void* HTTPMessage::operator new(size_t size) {
+  if (size != sizeof(HTTPMessage)) {
+    return ::operator new(size);
+  }
+  return ThreadLocalFreeList<HTTPMessage>::allocate();
+}
+
+void HTTPMessage::operator delete(void* p, size_t size) {
+  if (size != sizeof(HTTPMessage)) {
+    ::operator delete(p);
+    return;
+  }
+  ThreadLocalFreeList<HTTPMessage>::deallocate(p);
+}
+
 HTTPMessage::HTTPMessage(const HTTPMessage& message) :
     startTime_(message.startTime_),
     seqNo_(message.seqNo_),
@@ -86,16 +180,19 @@ HTTPMessage::HTTPMessage(const HTTPMessage& message) :
     localIP_(message.localIP_),
     versionStr_(message.versionStr_),
     fields_(message.fields_),
-    cookies_(message.cookies_),
     queryParams_(message.queryParams_),
     version_(message.version_),
     headers_(message.headers_),
-    strippedPerHopHeaders_(message.headers_),
+    strippedPerHopHeaders_(message.strippedPerHopHeaders_),
+    headerTemplate_(message.headerTemplate_),
     sslVersion_(message.sslVersion_),
     sslCipher_(message.sslCipher_),
     protoStr_(message.protoStr_),
-    parsedCookies_(message.parsedCookies_),
+    // The views of cookies and query parameters are set by copyIndexes()
+    parsedCookies_(false),
     parsedQueryParams_(message.parsedQueryParams_),
+    indexedQueryParams_(false), scannedCookies_(false),
+    scannedQueryParams_(false),
     chunked_(message.chunked_),
     upgraded_(message.upgraded_),
     wantsKeepalive_(message.wantsKeepalive_),
@@ -104,6 +201,7 @@ HTTPMessage::HTTPMessage(const HTTPMessage& message) :
   if (message.trailers_) {
     trailers_.reset(new HTTPHeaders(*message.trailers_.get()));
   }
+  copyIndexes(message);
 }
 
 HTTPMessage& HTTPMessage::operator=(const HTTPMessage& message) {
@@ -118,15 +216,18 @@ HTTPMessage& HTTPMessage::operator=(const HTTPMessage& message) {
   localIP_ = message.localIP_;
   versionStr_ = message.versionStr_;
   fields_ = message.fields_;
-  cookies_ = message.cookies_;
+  unparseCookies();
+  queryParamIndex_.clear();
+  indexedQueryParams_ = false;
+  scannedQueryParams_ = false;
   queryParams_ = message.queryParams_;
   version_ = message.version_;
   headers_ = message.headers_;
-  strippedPerHopHeaders_ = message.headers_;
+  strippedPerHopHeaders_ = message.strippedPerHopHeaders_;
+  headerTemplate_ = message.headerTemplate_;
   sslVersion_ = message.sslVersion_;
   sslCipher_ = message.sslCipher_;
   protoStr_ = message.protoStr_;
-  parsedCookies_ = message.parsedCookies_;
   parsedQueryParams_ = message.parsedQueryParams_;
   chunked_ = message.chunked_;
   upgraded_ = message.upgraded_;
@@ -139,9 +240,60 @@ HTTPMessage& HTTPMessage::operator=(const HTTPMessage& message) {
   } else {
     trailers_.reset();
   }
+  copyIndexes(message);
   return *this;
 }
 
+namespace {
+
+// Points a view into one string at the same bytes of a copy of it
+bool rebasePiece(StringPiece& piece, StringPiece from, StringPiece to) {
+  if (piece.begin() < from.begin() || piece.end() > from.end()) {
+    return false;
+  }
+  piece.reset(to.begin() + (piece.begin() - from.begin()), piece.size());
+  return true;
+}
+
+}
+
+void HTTPMessage::copyIndexes(const HTTPMessage& message) {
+  if (message.parsedCookies_) {
+    // headers_ is a copy in the same order, so the Cookie values line up
+    folly::small_vector<pair<StringPiece, StringPiece>, 2> values;
+    message.headers_.forEachValueOfHeader(HTTP_HEADER_COOKIE,
+                                          [&] (const string& value) {
+      values.emplace_back(value, StringPiece());
+      return false;
+    });
+    size_t i = 0;
+    headers_.forEachValueOfHeader(HTTP_HEADER_COOKIE,
+                                  [&] (const string& value) {
+      values[i++].second = value;
+      return false;
+    });
+    cookies_ = message.cookies_;
+    for (auto& cookie: cookies_) {
+      for (const auto& value: values) {
+        if (rebasePiece(cookie.first, value.first, value.second)) {
+          // an empty value from a name without '=' points nowhere
+          rebasePiece(cookie.second, value.first, value.second);
+          break;
+        }
+      }
+    }
+    parsedCookies_ = true;
+  }
+  if (message.indexedQueryParams_) {
+    queryParamIndex_ = message.queryParamIndex_;
+    for (auto& param: queryParamIndex_) {
+      rebasePiece(param.first, message.request().query_, request().query_);
+      rebasePiece(param.second, message.request().query_, request().query_);
+    }
+    indexedQueryParams_ = true;
+  }
+}
+
 void HTTPMessage::setMethod(HTTPMethod method) {
   Request& req = request();
   req.method_ = method;
@@ -225,15 +377,25 @@ bool HTTPMessage::isHTTP1_1() const {
 }
 
 string HTTPMessage::formatDateHeader() {
-  const auto now = std::chrono::system_clock::to_time_t(
-    std::chrono::system_clock::now());
+  return getDateHeader();
+}
 
-  char buff[1024];
-  tm timeTupple;
-  gmtime_r(&now, &timeTupple);
+const string& HTTPMessage::getDateHeader() {
+  struct DateHeader {
+    time_t time{0};
+    string value;
+  };
+  static folly::ThreadLocal<DateHeader> cached;
 
-  strftime(buff, 1024, "%a, %d %b %Y %H:%M:%S %Z", &timeTupple);
-  return std::string(buff);
+  const auto now = std::chrono::system_clock::to_time_t(
+    std::chrono::system_clock::now());
+  DateHeader& date = *cached;
+  if (date.time != now || date.value.empty()) {
+    date.time = now;
+    date.value.resize(kHTTPDateTimeLength);
+    formatHTTPDateTime(now, &date.value[0]);
+  }
+  return date.value;
 }
 
 void HTTPMessage::ensureHostHeader() {
@@ -244,9 +406,54 @@ void HTTPMessage::ensureHostHeader() {
   }
 }
 
+namespace {
+
+const uint16_t kMinInternedStatus = 100;
+const uint16_t kMaxInternedStatus = 999;
+
+struct StatusStrings {
+  string codes[kMaxInternedStatus - kMinInternedStatus + 1];
+  string reasons[kMaxInternedStatus - kMinInternedStatus + 1];
+};
+
+// A union-based static, as responses may still be built after exit()
+DEFINE_UNION_STATIC_CONST_NO_INIT(StatusStrings, Status, s_statusStrings);
+
+__attribute__((__constructor__))
+void initStatusStrings() {
+  auto strings = new (const_cast<StatusStrings*>(&s_statusStrings.data))
+    StatusStrings();
+  for (uint16_t status = kMinInternedStatus; status <= kMaxInternedStatus;
+       status++) {
+    const size_t i = status - kMinInternedStatus;
+    strings->codes[i] = folly::to<string>(status);
+    strings->reasons[i] = HTTPMessage::getDefaultReason(status);
+  }
+}
+
+}
+
 void HTTPMessage::setStatusCode(uint16_t status) {
-  response().status_ = status;
-  response().statusStr_ = folly::to<string>(status);
+  Response& resp = response();
+  resp.status_ = status;
+  if (status >= kMinInternedStatus && status <= kMaxInternedStatus) {
+    resp.internedStatusStr_ =
+      &s_statusStrings.data.codes[status - kMinInternedStatus];
+  } else {
+    resp.statusStr_ = folly::to<string>(status);
+    resp.internedStatusStr_ = nullptr;
+  }
+}
+
+void HTTPMessage::setDefaultStatusMessage() {
+  Response& resp = response();
+  if (resp.status_ >= kMinInternedStatus &&
+      resp.status_ <= kMaxInternedStatus) {
+    resp.internedStatusMsg_ =
+      &s_statusStrings.data.reasons[resp.status_ - kMinInternedStatus];
+  } else {
+    setStatusMessage(getDefaultReason(resp.status_));
+  }
 }
 
 uint16_t HTTPMessage::getStatusCode() const {
@@ -277,67 +484,147 @@ HTTPMessage::constructDirectResponse(const pair<uint8_t,uint8_t>& version,
   setIsUpgraded(false);
 }
 
+folly::Optional<StringPiece> HTTPMessage::findInIndex(
+    const NameValueIndex& index, StringPiece name) {
+  auto it = std::lower_bound(
+    index.begin(), index.end(), name,
+    [] (const std::pair<StringPiece, StringPiece>& entry, StringPiece key) {
+      return entry.first < key;
+    });
+  if (it == index.end() || it->first != name) {
+    return folly::none;
+  }
+  return it->second;
+}
+
 void HTTPMessage::parseCookies() const {
   DCHECK(!parsedCookies_);
   parsedCookies_ = true;
 
+  cookies_.clear();
   headers_.forEachValueOfHeader(HTTP_HEADER_COOKIE,
                                 [&](const string& headerval) {
-    splitNameValuePieces(headerval, ';', '=',
+    forEachNameValue(headerval, ';', '=', trimSpaces,
         [this](StringPiece cookieName, StringPiece cookieValue) {
-          cookies_.emplace(cookieName, cookieValue);
+          cookies_.emplace_back(cookieName, cookieValue);
+          return false;
         });
 
     return false; // continue processing "cookie" headers
   });
+  sortIndex(cookies_, false);
 }
 
 void HTTPMessage::unparseCookies() {
   cookies_.clear();
   parsedCookies_ = false;
+  scannedCookies_ = false;
 }
 
 const StringPiece HTTPMessage::getCookie(const string& name) const {
-  // Parse the cookies if we haven't done so yet
   if (!parsedCookies_) {
-    parseCookies();
+    if (scannedCookies_) {
+      // Looking up more than one, so index them all
+      parseCookies();
+    } else {
+      scannedCookies_ = true;
+      StringPiece cookie;
+      headers_.forEachValueOfHeader(HTTP_HEADER_COOKIE,
+                                    [&](const string& headerval) {
+        bool found = false;
+        forEachNameValue(headerval, ';', '=', trimSpaces,
+            [&](StringPiece cookieName, StringPiece cookieValue) {
+              found = (cookieName == name);
+              if (found) {
+                cookie = cookieValue;
+              }
+              return found;
+            });
+        return found;
+      });
+      return cookie;
+    }
   }
 
-  auto it = cookies_.find(name);
-  if (it == cookies_.end()) {
-    return StringPiece();
-  } else {
-    return it->second;
-  }
+  auto cookie = findInIndex(cookies_, name);
+  return cookie ? *cookie : StringPiece();
+}
+
+void HTTPMessage::indexQueryParams() const {
+  DCHECK(!indexedQueryParams_);
+  indexedQueryParams_ = true;
+
+  queryParamIndex_.clear();
+  forEachNameValue(request().query_, '&', '=', trimWhitespace,
+      [this] (StringPiece paramName, StringPiece paramValue) {
+        queryParamIndex_.emplace_back(paramName, paramValue);
+        return false;
+      });
+  // We have some unit tests that make sure we always return the last
+  // value when there are duplicate parameters. I don't think this really
+  // matters, but for now we might as well maintain the same behavior.
+  sortIndex(queryParamIndex_, true);
 }
 
 void HTTPMessage::parseQueryParams() const {
   DCHECK(!parsedQueryParams_);
-  const Request& req = request();
-
   parsedQueryParams_ = true;
-  if (req.query_.empty()) {
-    return;
+
+  if (!indexedQueryParams_) {
+    indexQueryParams();
+  }
+  auto params = std::make_shared<std::map<string, string>>();
+  for (const auto& param: queryParamIndex_) {
+    params->emplace(param.first.str(), param.second.str());
   }
+  queryParams_ = std::move(params);
+}
 
-  splitNameValue(req.query_, '&', '=',
-        [this] (string&& paramName, string&& paramValue) {
+std::map<string, string>& HTTPMessage::mutableQueryParams() {
+  // Parse the query parameters if we haven't done so yet
+  if (!parsedQueryParams_) {
+    parseQueryParams();
+  }
+  if (!queryParams_.unique()) {
+    queryParams_ = std::make_shared<std::map<string, string>>(*queryParams_);
+  }
+  return *queryParams_;
+}
 
-    auto it = queryParams_.find(paramName);
-    if (it == queryParams_.end()) {
-      queryParams_.emplace(std::move(paramName), std::move(paramValue));
+void HTTPMessage::unparseQueryParams() {
+  queryParams_.reset();
+  parsedQueryParams_ = false;
+  queryParamIndex_.clear();
+  indexedQueryParams_ = false;
+  scannedQueryParams_ = false;
+}
+
+folly::Optional<StringPiece> HTTPMessage::lookupQueryParam(
+    StringPiece name) const {
+  if (!indexedQueryParams_) {
+    if (scannedQueryParams_) {
+      // Looking up more than one, so index them all
+      indexQueryParams();
     } else {
-      // We have some unit tests that make sure we always return the last
-      // value when there are duplicate parameters. I don't think this really
-      // matters, but for now we might as well maintain the same behavior.
-      it->second = std::move(paramValue);
+      scannedQueryParams_ = true;
+      folly::Optional<StringPiece> param;
+      forEachNameValue(request().query_, '&', '=', trimWhitespace,
+          [&] (StringPiece paramName, StringPiece paramValue) {
+            if (paramName == name) {
+              // The last one wins, so keep going
+              param = paramValue;
+            }
+            return false;
+          });
+      return param;
     }
-  });
+  }
+  return findInIndex(queryParamIndex_, name);
 }
 
-void HTTPMessage::unparseQueryParams() {
-  queryParams_.clear();
-  parsedQueryParams_ = false;
+StringPiece HTTPMessage::getQueryParamPiece(StringPiece name) const {
+  auto param = lookupQueryParam(name);
+  return param ? *param : StringPiece();
 }
 
 const string* HTTPMessage::getQueryParamPtr(const string& name) const {
@@ -346,15 +633,18 @@ const string* HTTPMessage::getQueryParamPtr(const string& name) const {
     parseQueryParams();
   }
 
-  auto it = queryParams_.find(name);
-  if (it == queryParams_.end()) {
+  auto it = queryParams_->find(name);
+  if (it == queryParams_->end()) {
     return nullptr;
   }
   return &it->second;
 }
 
 bool HTTPMessage::hasQueryParam(const string& name) const {
-  return getQueryParamPtr(name) != nullptr;
+  if (parsedQueryParams_) {
+    return queryParams_->count(name) > 0;
+  }
+  return lookupQueryParam(name).hasValue();
 }
 
 const string& HTTPMessage::getQueryParam(const string& name) const {
@@ -363,7 +653,10 @@ const string& HTTPMessage::getQueryParam(const string& name) const {
 }
 
 int HTTPMessage::getIntQueryParam(const std::string& name) const {
-  return folly::to<int>(getQueryParam(name));
+  if (parsedQueryParams_) {
+    return folly::to<int>(getQueryParam(name));
+  }
+  return folly::to<int>(getQueryParamPiece(name));
 }
 
 int HTTPMessage::getIntQueryParam(const std::string& name, int defval) const {
@@ -376,7 +669,8 @@ int HTTPMessage::getIntQueryParam(const std::string& name, int defval) const {
 }
 
 std::string HTTPMessage::getDecodedQueryParam(const std::string& name) const {
-  auto val = getQueryParam(name);
+  StringPiece val = parsedQueryParams_ ? StringPiece(getQueryParam(name)) :
+    getQueryParamPiece(name);
 
   std::string result;
   try {
@@ -392,7 +686,7 @@ const std::map<std::string, std::string>& HTTPMessage::getQueryParams() const {
   if (!parsedQueryParams_) {
     parseQueryParams();
   }
-  return queryParams_;
+  return *queryParams_;
 }
 
 bool HTTPMessage::setQueryString(const std::string& query) {
@@ -406,6 +700,10 @@ bool HTTPMessage::setQueryString(const std::string& query) {
                                query, // new query string
                                u.fragment());
     request().query_ = query;
+    // The parameters themselves stay parsed, but not their views
+    queryParamIndex_.clear();
+    indexedQueryParams_ = false;
+    scannedQueryParams_ = false;
     return true;
   }
 
@@ -414,29 +712,22 @@ bool HTTPMessage::setQueryString(const std::string& query) {
 }
 
 bool HTTPMessage::removeQueryParam(const std::string& name) {
-  // Parse the query parameters if we haven't done so yet
-  if (!parsedQueryParams_) {
-    parseQueryParams();
-  }
-
-  if (!queryParams_.erase(name)) {
+  if (!hasQueryParam(name)) {
     // Query param was not found.
     return false;
   }
 
-  auto query = createQueryString(queryParams_, request().query_.length());
+  auto& params = mutableQueryParams();
+  params.erase(name);
+  auto query = createQueryString(params, request().query_.length());
   return setQueryString(query);
 }
 
 bool HTTPMessage::setQueryParam(const std::string& name,
     const std::string& value) {
-  // Parse the query parameters if we haven't done so yet
-  if (!parsedQueryParams_) {
-    parseQueryParams();
-  }
-
-  queryParams_[name] = value;
-  auto query = createQueryString(queryParams_, request().query_.length());
+  auto& params = mutableQueryParams();
+  params[name] = value;
+  auto query = createQueryString(params, request().query_.length());
   return setQueryString(query);
 }
 
@@ -463,7 +754,7 @@ std::string HTTPMessage::createUrl(const folly::StringPiece scheme,
   url.reserve(scheme.size() + authority.size() + path.size() + query.size() +
                  fragment.size() + 5); // 5 chars for ://,? and #
   if (!scheme.empty()) {
-    folly::toAppend(scheme.str(), "://", &url);
+    folly::toAppend(scheme, "://", &url);
   }
   folly::toAppend(authority, path, &url);
   if (!query.empty()) {
@@ -589,8 +880,8 @@ void HTTPMessage::dumpMessage(int vlogLevel) const {
   } else if (fields_.type() == typeid(Response)) {
     // Response fields.
     const Response& resp = response();
-    fields.push_back(make_pair("status", &resp.statusStr_));
-    fields.push_back(make_pair("status_msg", &resp.statusMsg_));
+    fields.push_back(make_pair("status", &resp.statusStr()));
+    fields.push_back(make_pair("status_msg", &resp.statusMsg()));
   }
 
   for (auto field : fields) {
@@ -637,8 +928,8 @@ void HTTPMessage::dumpMessageToSink(google::LogSink* logSink) const {
   } else if (fields_.type() == typeid(Response)) {
     // Response fields.
     const Response& resp = response();
-    fields.push_back(make_pair("status", &resp.statusStr_));
-    fields.push_back(make_pair("status_msg", &resp.statusMsg_));
+    fields.push_back(make_pair("status", &resp.statusStr()));
+    fields.push_back(make_pair("status_msg", &resp.statusMsg()));
   }
 
   LOG_TO_SINK(logSink, INFO) << "Fields for message: ";
@@ -815,6 +1106,7 @@ const char* HTTPMessage::getDefaultReason(uint16_t status) {
     case 416: return "Requested Range Not Satisfiable";
     case 417: return "Expectation Failed";
     case 418: return "I'm a teapot";
+    case 425: return "Too Early";
     case 500: return "Internal Server Error";
     case 501: return "Not Implemented";
     case 502: return "Bad Gateway";
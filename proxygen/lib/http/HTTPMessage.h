@@ -15,8 +15,10 @@
 #include <folly/Optional.h>
 #include <folly/SocketAddress.h>
 #include <folly/io/IOBufQueue.h>
+#include <folly/small_vector.h>
 #include <glog/logging.h>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <proxygen/lib/http/HTTPHeaderSize.h>
 #include <proxygen/lib/http/HTTPHeaders.h>
@@ -27,6 +29,8 @@
 
 namespace proxygen {
 
+class HeaderTemplate;
+
 /**
  * An HTTP request or response minus the body.
  *
@@ -41,9 +45,21 @@ class HTTPMessage {
 
   HTTPMessage();
   ~HTTPMessage();
+  /**
+   * Copies share the parsed query parameters until either side changes
+   * them, and take over the cookie and query parameter views of the
+   * original instead of parsing them again.
+   */
   HTTPMessage(const HTTPMessage& message);
   HTTPMessage& operator=(const HTTPMessage& message);
 
+  /**
+   * Messages get their memory from a ThreadLocalFreeList, as sessions
+   * create and destroy at least one for every transaction.
+   */
+  static void* operator new(size_t size);
+  static void operator delete(void* p, size_t size);
+
   /**
    * Is this a chunked message? (fpreq, fpresp)
    */
@@ -140,18 +156,19 @@ class HTTPMessage {
   ParseURL setURL(T&& url) {
     VLOG(9) << "setURL: " << url;
 
-    // Set the URL, path, and query string parameters
-    ParseURL u(url);
+    // Set the URL, path, and query string parameters. The result views the
+    // stored URL, so it stays valid for as long as the URL is not changed.
+    Request& req = request();
+    req.url_ = std::forward<T>(url);
+    ParseURL u(req.url_);
     if (u.valid()) {
       VLOG(9) << "set path: " << u.path() << " query:" << u.query();
-      request().path_ = u.path().str();
-      request().query_ = u.query().str();
+      req.path_.assign(u.path().data(), u.path().size());
+      req.query_.assign(u.query().data(), u.query().size());
       unparseQueryParams();
     } else {
-      VLOG(4) << "Error in parsing URL: " << url;
+      VLOG(4) << "Error in parsing URL: " << req.url_;
     }
-
-    request().url_ = std::forward<T>(url);
     return u;
   }
   // The template function above doesn't work with char*,
@@ -197,11 +214,19 @@ class HTTPMessage {
    */
   template <typename T> // T = string
   void setStatusMessage(T&& msg) {
-    response().statusMsg_ = std::forward<T>(msg);
+    Response& resp = response();
+    resp.statusMsg_ = std::forward<T>(msg);
+    resp.internedStatusMsg_ = nullptr;
   }
   const std::string& getStatusMessage() const {
-    return response().statusMsg_;
+    return response().statusMsg();
   }
+
+  /**
+   * Sets the status message to getDefaultReason() of the status code,
+   * without copying it (res)
+   */
+  void setDefaultStatusMessage();
   void rawSetStatusMessage(std::string msg) {
     setStatusMessage(msg);
   }
@@ -243,6 +268,18 @@ class HTTPMessage {
     trailers_ = std::move(trailers);
   }
 
+  /**
+   * Send the headers of headerTemplate too, after getHeaders(), without
+   * copying them into this message
+   */
+  void setHeaderTemplate(
+      std::shared_ptr<const HeaderTemplate> headerTemplate) {
+    headerTemplate_ = std::move(headerTemplate);
+  }
+  const HeaderTemplate* getHeaderTemplate() const {
+    return headerTemplate_.get();
+  }
+
   /**
    * Decrements Max-Forwards header, when present on OPTIONS or TRACE methods.
    *
@@ -270,6 +307,13 @@ class HTTPMessage {
    */
   static std::string formatDateHeader();
 
+  /**
+   * Same as formatDateHeader(), but without the copy: the value is formatted
+   * at most once a second per thread, and the reference is valid until the
+   * next call on the same thread.
+   */
+  static const std::string& getDateHeader();
+
   /**
    * Ensures this HTTPMessage contains a host header, adding a default one
    * with the destination address if necessary.
@@ -363,6 +407,15 @@ class HTTPMessage {
    */
   const std::string& getQueryParam(const std::string& name) const;
 
+  /**
+   * Get the query parameter with the specified name, as a view of the query
+   * string, or an empty StringPiece if there is no parameter with the
+   * specified name.  Unlike getQueryParam(), nothing is copied: the first
+   * lookup scans the query string, and later ones index it.  The returned
+   * value is only valid until the query string is changed.
+   */
+  folly::StringPiece getQueryParamPiece(folly::StringPiece name) const;
+
   /**
    * Get the query parameter with the specified name as int.
    *
@@ -424,6 +477,8 @@ class HTTPMessage {
    * only valid as long as the Cookie Header in HTTPMessage object exists.
    * Applications should make sure they call unparseCookies() when editing
    * the Cookie Header, so that the StringPiece references are cleared.
+   *
+   * The first lookup scans the Cookie headers, and later ones index them.
    */
   const folly::StringPiece getCookie(const std::string& name) const;
 
@@ -603,10 +658,23 @@ class HTTPMessage {
 
  private:
 
+  // Name-value pairs sorted by name, one per name
+  typedef folly::small_vector<
+    std::pair<folly::StringPiece, folly::StringPiece>, 4> NameValueIndex;
+
+  static folly::Optional<folly::StringPiece> findInIndex(
+    const NameValueIndex& index, folly::StringPiece name);
+
   void parseCookies() const;
 
   void parseQueryParams() const;
+  void indexQueryParams() const;
   void unparseQueryParams();
+  std::map<std::string, std::string>& mutableQueryParams();
+  // takes over the views of cookies and query parameters of a copied message
+  void copyIndexes(const HTTPMessage& message);
+  folly::Optional<folly::StringPiece> lookupQueryParam(
+    folly::StringPiece name) const;
 
   /**
    * Trims whitespace from the beggining and end of the StringPiece.
@@ -630,8 +698,19 @@ class HTTPMessage {
 
   struct Response {
     uint16_t status_;
+    // Unless interned_* point at the static copies kept for the status
+    // codes from 100 to 999 and their default reasons
     std::string statusStr_;
     std::string statusMsg_;
+    const std::string* internedStatusStr_{nullptr};
+    const std::string* internedStatusMsg_{nullptr};
+
+    const std::string& statusStr() const {
+      return internedStatusStr_ ? *internedStatusStr_ : statusStr_;
+    }
+    const std::string& statusMsg() const {
+      return internedStatusMsg_ ? *internedStatusMsg_ : statusMsg_;
+    }
   };
 
   folly::SocketAddress dstAddress_;
@@ -684,15 +763,20 @@ class HTTPMessage {
    * These are mutable since we parse them lazily in getCookie() and
    * getQueryParam()
    */
-  mutable std::map<folly::StringPiece, folly::StringPiece> cookies_;
-  // TODO: use StringPiece for queryParams_ and delete splitNameValue()
-  mutable std::map<std::string, std::string> queryParams_;
+  // Views of the Cookie headers, the first value of each name
+  mutable NameValueIndex cookies_;
+  // Views of the query string, the last value of each name
+  mutable NameValueIndex queryParamIndex_;
+  // Copies, for getQueryParam() and the like, which return std::strings,
+  // shared with the copies of this message until one of them changes it
+  mutable std::shared_ptr<std::map<std::string, std::string>> queryParams_;
 
   std::pair<uint8_t, uint8_t> version_;
   HTTPHeaders headers_;
   HTTPHeaders strippedPerHopHeaders_;
   HTTPHeaderSize size_;
   std::unique_ptr<HTTPHeaders> trailers_;
+  std::shared_ptr<const HeaderTemplate> headerTemplate_;
 
   int sslVersion_;
   const char* sslCipher_;
@@ -701,6 +785,10 @@ class HTTPMessage {
 
   mutable bool parsedCookies_:1;
   mutable bool parsedQueryParams_:1;
+  mutable bool indexedQueryParams_:1;
+  // Whether there was a lookup without indexing already
+  mutable bool scannedCookies_:1;
+  mutable bool scannedQueryParams_:1;
   bool chunked_:1;
   bool upgraded_:1;
   bool wantsKeepalive_:1;
@@ -53,4 +53,9 @@ std::ostream& operator <<(std::ostream& out, HTTPMethod method) {
   return out;
 }
 
+bool isSafeMethod(HTTPMethod method) {
+  return method == HTTPMethod::GET || method == HTTPMethod::HEAD ||
+    method == HTTPMethod::OPTIONS || method == HTTPMethod::TRACE;
+}
+
 }
@@ -56,4 +56,10 @@ extern const std::string& methodToString(HTTPMethod method);
 
 std::ostream& operator<<(std::ostream& os, HTTPMethod method);
 
+/**
+ * Whether method is safe (RFC 7231 4.2.1): GET, HEAD, OPTIONS or TRACE,
+ * which may be retried or replayed without changing anything
+ */
+bool isSafeMethod(HTTPMethod method);
+
 }
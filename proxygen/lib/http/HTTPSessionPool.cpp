@@ -0,0 +1,445 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/http/HTTPSessionPool.h>
+
+#include <folly/io/async/AsyncSSLSocket.h>
+#include <openssl/x509v3.h>
+#include <proxygen/lib/http/session/HTTPUpstreamSession.h>
+#include <tuple>
+#include <vector>
+
+using folly::AsyncSocketException;
+using std::string;
+using std::unique_ptr;
+
+namespace {
+
+// Whether the certificate the peer of session presented is valid for host
+bool certificateCovers(const proxygen::HTTPSession& session,
+                       const string& host) {
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+  auto sslSocket =
+    dynamic_cast<const folly::AsyncSSLSocket*>(session.getTransport());
+  if (!sslSocket || !sslSocket->getSSL()) {
+    return false;
+  }
+  X509* cert = SSL_get_peer_certificate(sslSocket->getSSL());
+  if (!cert) {
+    return false;
+  }
+  bool covers = X509_check_host(cert, host.data(), host.size(), 0,
+                                nullptr) == 1;
+  X509_free(cert);
+  return covers;
+#else
+  return false;
+#endif
+}
+
+// The host of an origin, such as "https://example.com:8443"
+string originHost(const string& origin) {
+  auto start = origin.find("://");
+  start = (start == string::npos) ? 0 : start + 3;
+  auto end = origin.find_first_of(":/", start);
+  return origin.substr(start, end - start);
+}
+
+}
+
+namespace proxygen {
+
+bool HTTPSessionPool::Key::operator<(const Key& other) const {
+  // keys differing only in host sort together, for coalescing
+  return std::tie(address, sslContext, protocol, host) <
+    std::tie(other.address, other.sslContext, other.protocol, other.host);
+}
+
+bool HTTPSessionPool::Key::operator==(const Key& other) const {
+  return std::tie(address, sslContext, protocol, host) ==
+    std::tie(other.address, other.sslContext, other.protocol, other.host);
+}
+
+HTTPSessionPool::PendingConnect::PendingConnect(
+  HTTPSessionPool* p, const Key& k, HTTPSessionPool::Callback* c)
+    : pool(p),
+      key(k),
+      cb(c),
+      connector(this, p->timeoutSet_) {}
+
+void HTTPSessionPool::PendingConnect::connectSuccess(
+  HTTPUpstreamSession* session) {
+  pool->connectDone(this, session, nullptr);
+}
+
+void HTTPSessionPool::PendingConnect::connectError(
+  const AsyncSocketException& ex) {
+  pool->connectDone(this, nullptr, &ex);
+}
+
+HTTPSessionPool::HTTPSessionPool(folly::EventBase* eventBase,
+                                 AsyncTimeoutSet* timeoutSet,
+                                 const Options& options)
+    : eventBase_(CHECK_NOTNULL(eventBase)),
+      timeoutSet_(timeoutSet),
+      options_(options) {}
+
+HTTPSessionPool::~HTTPSessionPool() {
+  // Destroying the connectors cancels them without callbacks
+  pendingConnects_.clear();
+
+  std::vector<HTTPUpstreamSession*> idle;
+  std::vector<HTTPUpstreamSession*> busy;
+  for (auto& it: sessions_) {
+    auto session = it.second->session;
+    session->setInfoCallback(nullptr);
+    if (session->hasActiveTransactions()) {
+      busy.push_back(session);
+    } else {
+      idle.push_back(session);
+    }
+  }
+  keys_.clear();
+  sessions_.clear();
+  for (auto session: idle) {
+    session->closeWhenIdle();
+  }
+  for (auto session: busy) {
+    session->drain();
+  }
+}
+
+void HTTPSessionPool::getSession(const Key& key, Callback* cb) {
+  Key target = key;
+  boost::optional<Key> fallback;
+  auto altAddress = options_.useAltSvc && key.sslContext ?
+    getAltSvcAddress(key.host) : nullptr;
+  if (altAddress) {
+    target.address = *altAddress;
+    fallback = key;
+  }
+
+  auto session = findSession(target);
+  if (!session && options_.coalesce) {
+    session = findCoalescedSession(target);
+  }
+  if (session) {
+    cb->sessionAvailable(session);
+  } else {
+    connect(target, cb, fallback);
+  }
+}
+
+void HTTPSessionPool::cancel(Callback* cb) {
+  for (auto& pending: pendingConnects_) {
+    if (pending->cb == cb) {
+      pending->cb = nullptr;
+    }
+  }
+}
+
+void HTTPSessionPool::prewarm(const Key& key, uint32_t numSessions) {
+  uint32_t have = getNumIdleSessions(key);
+  for (auto& pending: pendingConnects_) {
+    if (!pending->cb && pending->key == key) {
+      have++;
+    }
+  }
+  for (; have < numSessions; have++) {
+    connect(key, nullptr);
+  }
+}
+
+void HTTPSessionPool::addSession(const Key& key,
+                                 HTTPUpstreamSession* session) {
+  auto info = trackSession(key, session);
+  if (!session->hasActiveTransactions()) {
+    sessionIdle(info);
+  } else if (info->parallel && session->supportsMoreTransactions()) {
+    keys_[key].shared.push_back(*info);
+  }
+}
+
+const folly::SocketAddress*
+HTTPSessionPool::getAltSvcAddress(const string& host) {
+  auto it = host.empty() ? altSvcs_.end() : altSvcs_.find(host);
+  if (it == altSvcs_.end()) {
+    return nullptr;
+  }
+  if (it->second.expires <= getCurrentTime()) {
+    altSvcs_.erase(it);
+    return nullptr;
+  }
+  return &it->second.address;
+}
+
+uint32_t HTTPSessionPool::getNumIdleSessions(const Key& key) const {
+  auto it = keys_.find(key);
+  if (it == keys_.end()) {
+    return 0;
+  }
+  return it->second.idle.size();
+}
+
+void HTTPSessionPool::connect(const Key& key, Callback* cb,
+                              const boost::optional<Key>& fallback) {
+  pendingConnects_.emplace_back(new PendingConnect(this, key, cb));
+  pendingConnects_.back()->fallback = fallback;
+  auto& connector = pendingConnects_.back()->connector;
+  if (key.sslContext) {
+    connector.setSSLSessionCache(options_.sslSessionCache);
+    connector.setServerName(key.host);
+    connector.connectSSL(eventBase_, key.address, key.sslContext, nullptr,
+                         options_.connectTimeout);
+  } else {
+    connector.setPlaintextProtocol(key.protocol);
+    connector.connect(eventBase_, key.address, options_.connectTimeout);
+  }
+}
+
+void HTTPSessionPool::connectDone(PendingConnect* pending,
+                                  HTTPUpstreamSession* session,
+                                  const AsyncSocketException* ex) {
+  Key key = pending->key;
+  Callback* cb = pending->cb;
+  auto fallback = pending->fallback;
+  // The connector is done with its socket, so it's safe to delete it from
+  // its own callback
+  for (auto it = pendingConnects_.begin(); it != pendingConnects_.end();
+       ++it) {
+    if (it->get() == pending) {
+      pendingConnects_.erase(it);
+      break;
+    }
+  }
+
+  if (!session) {
+    if (fallback) {
+      // Forget the alternative, and go to the origin itself
+      VLOG(4) << "alternative service " << key.address.describe()
+              << " for " << key.host << " failed: " << ex->what();
+      altSvcs_.erase(fallback->host);
+      if (cb) {
+        connect(*fallback, cb);
+      }
+    } else if (cb) {
+      cb->sessionError(*ex);
+    }
+    return;
+  }
+
+  auto info = trackSession(key, session);
+  if (cb) {
+    if (info->parallel) {
+      keys_[key].shared.push_back(*info);
+    }
+    cb->sessionAvailable(session);
+  } else {
+    // prewarmed, or the requester went away
+    session->startNow();
+    sessionIdle(info);
+  }
+}
+
+HTTPUpstreamSession* HTTPSessionPool::findSession(const Key& key) {
+  auto it = keys_.find(key);
+  if (it == keys_.end()) {
+    return nullptr;
+  }
+  auto& sessions = it->second;
+
+  for (auto& info: sessions.shared) {
+    if (info.session->supportsMoreTransactions() &&
+        !info.session->isClosing()) {
+      return info.session;
+    }
+  }
+
+  trimIdle(sessions);
+  while (!sessions.idle.empty()) {
+    auto& info = sessions.idle.front();
+    info.idleHook.unlink();
+    if (!info.session->isReusable()) {
+      info.session->closeWhenIdle();
+      continue;
+    }
+    if (info.parallel) {
+      sessions.shared.push_back(info);
+    }
+    return info.session;
+  }
+  return nullptr;
+}
+
+HTTPUpstreamSession* HTTPSessionPool::findCoalescedSession(const Key& key) {
+  if (!key.sslContext || key.host.empty()) {
+    return nullptr;
+  }
+  // The keys of other hosts at the same address start at the one without
+  for (auto it = keys_.lower_bound(Key(key.address, key.sslContext,
+                                       key.protocol));
+       it != keys_.end() && it->first.address == key.address &&
+         it->first.sslContext == key.sslContext &&
+         it->first.protocol == key.protocol;
+       ++it) {
+    if (it->first.host == key.host) {
+      continue;
+    }
+    auto& sessions = it->second;
+    for (auto& info: sessions.shared) {
+      if (info.session->supportsMoreTransactions() &&
+          !info.session->isClosing() &&
+          certificateCovers(*info.session, key.host)) {
+        VLOG(4) << "coalescing " << key.host << " onto the session of "
+                << it->first.host;
+        return info.session;
+      }
+    }
+    for (auto& info: sessions.idle) {
+      if (info.parallel && info.session->isReusable() &&
+          certificateCovers(*info.session, key.host)) {
+        VLOG(4) << "coalescing " << key.host << " onto the idle session of "
+                << it->first.host;
+        info.idleHook.unlink();
+        sessions.shared.push_back(info);
+        return info.session;
+      }
+    }
+  }
+  return nullptr;
+}
+
+HTTPSessionPool::SessionInfo*
+HTTPSessionPool::trackSession(const Key& key, HTTPUpstreamSession* session) {
+  session->setInfoCallback(this);
+  auto info = new SessionInfo(key, session,
+                              session->getCodec().supportsParallelRequests());
+  auto result = sessions_.emplace(session, unique_ptr<SessionInfo>(info));
+  CHECK(result.second) << "Session added to the pool twice";
+  return info;
+}
+
+void HTTPSessionPool::sessionIdle(SessionInfo* info) {
+  if (info->session->isClosing()) {
+    return;
+  }
+  auto& sessions = keys_[info->key];
+  info->sharedHook.unlink();
+  info->idleSince = getCurrentTime();
+  sessions.idle.push_front(*info);
+  trimIdle(sessions);
+}
+
+void HTTPSessionPool::trimIdle(KeySessions& sessions) {
+  auto now = getCurrentTime();
+  while (!sessions.idle.empty()) {
+    auto& oldest = sessions.idle.back();
+    if (sessions.idle.size() <= options_.maxIdleSessionsPerKey &&
+        now - oldest.idleSince < options_.maxIdleTime) {
+      break;
+    }
+    // unlink first: closing can destroy the session, and its info, now
+    oldest.idleHook.unlink();
+    oldest.session->closeWhenIdle();
+  }
+}
+
+HTTPSessionPool::SessionInfo*
+HTTPSessionPool::findInfo(const HTTPSession& session) {
+  auto it = sessions_.find(&session);
+  if (it == sessions_.end()) {
+    return nullptr;
+  }
+  return it->second.get();
+}
+
+void HTTPSessionPool::onActivateConnection(const HTTPSession& session) {
+  auto info = findInfo(session);
+  if (!info) {
+    return;
+  }
+  info->idleHook.unlink();
+  if (info->parallel && !info->sharedHook.is_linked()) {
+    keys_[info->key].shared.push_back(*info);
+  }
+}
+
+void HTTPSessionPool::onDeactivateConnection(const HTTPSession& session) {
+  auto info = findInfo(session);
+  if (info) {
+    sessionIdle(info);
+  }
+}
+
+void HTTPSessionPool::onDestroy(const HTTPSession& session) {
+  // Erasing the info unlinks it from its key's lists. The key's entry
+  // stays, as this can run from within the loops that walk it.
+  sessions_.erase(&session);
+}
+
+void HTTPSessionPool::onSettingsOutgoingStreamsFull(
+  const HTTPSession& session) {
+  auto info = findInfo(session);
+  if (info) {
+    info->sharedHook.unlink();
+  }
+}
+
+void HTTPSessionPool::onSettingsOutgoingStreamsNotFull(
+  const HTTPSession& session) {
+  auto info = findInfo(session);
+  if (info && info->parallel && !info->idleHook.is_linked() &&
+      !info->sharedHook.is_linked()) {
+    keys_[info->key].shared.push_back(*info);
+  }
+}
+
+void HTTPSessionPool::onAltSvc(const HTTPSession& session,
+                               const AltSvc& altSvc) {
+  auto info = findInfo(session);
+  if (!info || !info->key.sslContext) {
+    return;
+  }
+  // The alternative is connected to with the same SSL context, which
+  // negotiates HTTP/2 with it
+  if (altSvc.protocol.compare(0, 2, "h2") != 0) {
+    VLOG(4) << "ignoring alternative service protocol=" << altSvc.protocol;
+    return;
+  }
+  string origin = altSvc.origin.empty() ?
+    info->key.host : originHost(altSvc.origin);
+  if (origin.empty() ||
+      (origin != info->key.host && !certificateCovers(session, origin))) {
+    // The session is not authoritative for the origin
+    return;
+  }
+  if (altSvc.maxAge == 0) {
+    altSvcs_.erase(origin);
+    return;
+  }
+
+  folly::SocketAddress address;
+  if (altSvc.host.empty()) {
+    address = info->key.address;
+    address.setPort(altSvc.port);
+  } else {
+    try {
+      address.setFromIpPort(altSvc.host, altSvc.port);
+    } catch (const std::exception&) {
+      // Alternatives that need a name lookup are not supported
+      VLOG(4) << "ignoring alternative service host=" << altSvc.host;
+      return;
+    }
+  }
+  auto& entry = altSvcs_[origin];
+  entry.address = address;
+  entry.expires = getCurrentTime() + std::chrono::seconds(altSvc.maxAge);
+}
+
+}
@@ -0,0 +1,252 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <boost/optional.hpp>
+#include <folly/IntrusiveList.h>
+#include <folly/SocketAddress.h>
+#include <folly/io/async/SSLContext.h>
+#include <list>
+#include <map>
+#include <memory>
+#include <proxygen/lib/http/HTTPConnector.h>
+#include <proxygen/lib/http/session/HTTPSession.h>
+#include <proxygen/lib/utils/Time.h>
+#include <unordered_map>
+
+namespace proxygen {
+
+class HTTPUpstreamSession;
+
+/**
+ * A pool of upstream sessions for one EventBase, so that requests to the
+ * same server can reuse connections instead of paying for a new TCP (and
+ * TLS) handshake each time.
+ *
+ * Sessions are pooled by (address, SSL context, protocol). A session whose
+ * codec multiplexes (SPDY, HTTP/2) is shared by concurrent requests for as
+ * long as it supports more transactions; a serial (HTTP/1.x) session only
+ * goes back to the pool once its transaction is done. When no session can
+ * take the request, a new connection is made with an HTTPConnector.
+ *
+ * Secure keys with a host are coalesced as HTTP/2 allows: a request may
+ * share a parallel session made for another host at the same address if
+ * the certificate of that session also covers its host. Alternative
+ * services advertised on pooled sessions (HTTP/2 ALTSVC frames) redirect
+ * later requests for their origin, falling back to the original address
+ * when the alternative can't be connected to. Coalescing is only as safe
+ * as the SSL contexts' verification of the server certificates.
+ *
+ * The pool installs itself as the InfoCallback of every session it holds.
+ * It must only be used from the thread of its EventBase, and must outlive
+ * the connects it started unless it is destroyed first, which cancels
+ * them.
+ */
+class HTTPSessionPool: private HTTPSession::InfoCallback {
+ public:
+  /**
+   * What a pooled session connects to. Sessions are only shared between
+   * requests with equal keys.
+   */
+  struct Key {
+    Key() {}
+    Key(const folly::SocketAddress& addr,
+        const std::shared_ptr<folly::SSLContext>& ctx = nullptr,
+        const std::string& proto = "",
+        const std::string& hostName = "")
+      : address(addr),
+        sslContext(ctx),
+        protocol(proto),
+        host(hostName) {}
+
+    bool operator<(const Key& other) const;
+    bool operator==(const Key& other) const;
+
+    folly::SocketAddress address;
+    // Null for plaintext connections
+    std::shared_ptr<folly::SSLContext> sslContext;
+    // The plaintext protocol (see HTTPConnector::setPlaintextProtocol).
+    // Secure connections negotiate theirs with the context's NPN list.
+    std::string protocol;
+    // The host of the requests' authority: sent as the TLS server name,
+    // and what coalescing and alternative services are keyed by
+    std::string host;
+  };
+
+  class Callback {
+   public:
+    virtual ~Callback() {}
+    /**
+     * A session the request can run on. Start the transaction right away:
+     * a serial session that is handed out and left unused is no longer
+     * pooled.
+     */
+    virtual void sessionAvailable(HTTPUpstreamSession* session) = 0;
+    virtual void sessionError(const folly::AsyncSocketException& ex) = 0;
+  };
+
+  struct Options {
+    // Idle sessions kept per key; the least recently used go first
+    uint32_t maxIdleSessionsPerKey{8};
+    // Idle sessions older than this are closed rather than reused
+    std::chrono::milliseconds maxIdleTime{std::chrono::seconds(60)};
+    std::chrono::milliseconds connectTimeout{std::chrono::seconds(1)};
+    // Optional, to resume TLS sessions on new secure connections
+    std::shared_ptr<SSLSessionCache> sslSessionCache;
+    // Share sessions across hosts their certificates cover
+    bool coalesce{true};
+    // Send requests to the alternative services their origins advertise
+    bool useAltSvc{true};
+  };
+
+  /**
+   * @param eventBase  The event base sessions and connects run on.
+   * @param timeoutSet The transaction timeouts given to new sessions.
+   */
+  HTTPSessionPool(folly::EventBase* eventBase,
+                  AsyncTimeoutSet* timeoutSet,
+                  const Options& options);
+
+  /**
+   * Cancels pending connects, closes idle sessions and drains the busy
+   * ones, which are left to finish their transactions on their own.
+   */
+  ~HTTPSessionPool() override;
+
+  /**
+   * Get a session for key. If one is available, cb is invoked before this
+   * returns; otherwise once a new connection is established or has failed.
+   */
+  void getSession(const Key& key, Callback* cb);
+
+  /**
+   * Forget about cb. Its pending connects still complete, and their
+   * sessions go to the idle pool.
+   */
+  void cancel(Callback* cb);
+
+  /**
+   * Open connections for key, in the background, until it has numSessions
+   * idle or being established.
+   */
+  void prewarm(const Key& key, uint32_t numSessions);
+
+  /**
+   * Hand a session established elsewhere to the pool, which then owns it
+   * like those it connected itself.
+   */
+  void addSession(const Key& key, HTTPUpstreamSession* session);
+
+  uint32_t getNumIdleSessions(const Key& key) const;
+
+  uint32_t getNumPendingConnects() const {
+    return pendingConnects_.size();
+  }
+
+  // All the sessions, idle or busy, held by the pool
+  uint32_t getNumSessions() const {
+    return sessions_.size();
+  }
+
+  /**
+   * The address requests for host currently go to instead of their own,
+   * or nullptr if there is no alternative service for it.
+   */
+  const folly::SocketAddress* getAltSvcAddress(const std::string& host);
+
+ private:
+  struct SessionInfo {
+    SessionInfo(const Key& k, HTTPUpstreamSession* s, bool p)
+      : key(k),
+        session(s),
+        parallel(p) {}
+
+    Key key;
+    HTTPUpstreamSession* session;
+    bool parallel;
+    TimePoint idleSince;
+    // in the key's idle list while the session has no transactions
+    folly::IntrusiveListHook idleHook;
+    // in the key's shared list while a parallel session takes more streams
+    folly::IntrusiveListHook sharedHook;
+  };
+
+  typedef folly::IntrusiveList<SessionInfo,
+                               &SessionInfo::idleHook> IdleList;
+  typedef folly::IntrusiveList<SessionInfo,
+                               &SessionInfo::sharedHook> SharedList;
+
+  struct KeySessions {
+    // most recently used first
+    IdleList idle;
+    SharedList shared;
+  };
+
+  class PendingConnect: public HTTPConnector::Callback {
+   public:
+    PendingConnect(HTTPSessionPool* pool, const Key& key,
+                   HTTPSessionPool::Callback* cb);
+
+    void connectSuccess(HTTPUpstreamSession* session) override;
+    void connectError(const folly::AsyncSocketException& ex) override;
+
+    HTTPSessionPool* pool;
+    Key key;
+    HTTPSessionPool::Callback* cb;
+    // The key before its alternative service, to retry when that fails
+    boost::optional<Key> fallback;
+    HTTPConnector connector;
+  };
+
+  struct AltSvcEntry {
+    folly::SocketAddress address;
+    TimePoint expires;
+  };
+
+  void connect(const Key& key, Callback* cb,
+               const boost::optional<Key>& fallback = boost::none);
+  void connectDone(PendingConnect* pending, HTTPUpstreamSession* session,
+                   const folly::AsyncSocketException* ex);
+
+  // An idle or shared session for key, or nullptr
+  HTTPUpstreamSession* findSession(const Key& key);
+  // A parallel session of another host whose certificate covers key's
+  HTTPUpstreamSession* findCoalescedSession(const Key& key);
+  SessionInfo* trackSession(const Key& key, HTTPUpstreamSession* session);
+  void sessionIdle(SessionInfo* info);
+  // Close idle sessions past maxIdleTime, or past maxIdleSessionsPerKey
+  void trimIdle(KeySessions& sessions);
+  SessionInfo* findInfo(const HTTPSession& session);
+
+  // HTTPSession::InfoCallback
+  uint32_t getSubscribedEvents() const override {
+    return InfoCallback::CONNECTION_ACTIVITY |
+      InfoCallback::OUTGOING_STREAMS | InfoCallback::ALT_SVC;
+  }
+  void onCreate(const HTTPSession&) override {}
+  void onActivateConnection(const HTTPSession& session) override;
+  void onDeactivateConnection(const HTTPSession& session) override;
+  void onDestroy(const HTTPSession& session) override;
+  void onSettingsOutgoingStreamsFull(const HTTPSession& session) override;
+  void onSettingsOutgoingStreamsNotFull(const HTTPSession& session) override;
+  void onAltSvc(const HTTPSession& session, const AltSvc& altSvc) override;
+
+  folly::EventBase* eventBase_;
+  AsyncTimeoutSet* timeoutSet_;
+  Options options_;
+  std::map<Key, KeySessions> keys_;
+  std::unordered_map<const HTTPSession*,
+                     std::unique_ptr<SessionInfo>> sessions_;
+  std::list<std::unique_ptr<PendingConnect>> pendingConnects_;
+  // by origin host
+  std::unordered_map<std::string, AltSvcEntry> altSvcs_;
+};
+
+}
@@ -0,0 +1,71 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/http/HeaderTemplate.h>
+
+#include <stdexcept>
+
+namespace proxygen {
+
+namespace {
+
+bool isGeneratedByCodecs(HTTPHeaderCode code) {
+  switch (code) {
+    case HTTP_HEADER_CONNECTION:
+    case HTTP_HEADER_CONTENT_LENGTH:
+    case HTTP_HEADER_DATE:
+    case HTTP_HEADER_HOST:
+    case HTTP_HEADER_KEEP_ALIVE:
+    case HTTP_HEADER_PROXY_CONNECTION:
+    case HTTP_HEADER_TRANSFER_ENCODING:
+    case HTTP_HEADER_UPGRADE:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool hasLineBreak(const std::string& str) {
+  return str.find_first_of("\r\n") != std::string::npos;
+}
+
+}
+
+HeaderTemplate& HeaderTemplate::add(const std::string& name,
+                                    const std::string& value) {
+  append(HTTPCommonHeaders::hash(name), name, value);
+  return *this;
+}
+
+HeaderTemplate& HeaderTemplate::add(HTTPHeaderCode code,
+                                    const std::string& value) {
+  append(code, *HTTPCommonHeaders::getPointerToHeaderName(code), value);
+  return *this;
+}
+
+void HeaderTemplate::append(HTTPHeaderCode code,
+                            std::string name,
+                            std::string value) {
+  if (name.empty() || name[0] == ':' || hasLineBreak(name) ||
+      hasLineBreak(value)) {
+    throw std::invalid_argument("invalid template header \"" + name + "\"");
+  }
+  if (isGeneratedByCodecs(code)) {
+    throw std::invalid_argument("the codecs generate \"" + name + "\"");
+  }
+  http1Block_.append(name);
+  http1Block_.append(": ");
+  http1Block_.append(value);
+  http1Block_.append("\r\n");
+  entries_.push_back(Entry{std::move(name), std::move(value)});
+  const Entry& entry = entries_.back();
+  headers_.emplace_back(code, entry.name, entry.value);
+}
+
+}
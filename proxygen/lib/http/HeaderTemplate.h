@@ -0,0 +1,71 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <proxygen/lib/http/HTTPCommonHeaders.h>
+#include <proxygen/lib/http/codec/compress/Header.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace proxygen {
+
+/**
+ * The headers most responses have in common, such as Server,
+ * Cache-Control or CORS headers, built once, eg. at startup, and attached
+ * to messages by reference with HTTPMessage::setHeaderTemplate() instead
+ * of being added to each. HTTP1xCodec writes them as one block rendered
+ * here, and the SPDY and HTTP/2 codecs take their entries as they are,
+ * with names already classified into HTTPHeaderCodes.
+ *
+ * They go out after the headers of the message, but aren't part of
+ * getHeaders(), so filters don't see them. The headers codecs generate or
+ * drop themselves (Connection, Content-Length, Date, Host, Keep-Alive,
+ * Proxy-Connection, Transfer-Encoding and Upgrade) can't be in a
+ * template.
+ *
+ * A template isn't changed once attached, so it can be shared between
+ * threads.
+ */
+class HeaderTemplate {
+ public:
+  /**
+   * Add a header. Throws std::invalid_argument for the headers above, an
+   * empty name, or a CR or LF in the name or value.
+   */
+  HeaderTemplate& add(const std::string& name, const std::string& value);
+  HeaderTemplate& add(HTTPHeaderCode code, const std::string& value);
+
+  // The headers in the order added, which point into this template
+  const std::vector<compress::Header>& getHeaders() const {
+    return headers_;
+  }
+
+  // "Name: value\r\n" for each header
+  const std::string& getHTTP1Block() const { return http1Block_; }
+
+  size_t size() const { return headers_.size(); }
+
+ private:
+  struct Entry {
+    std::string name;
+    std::string value;
+  };
+
+  void append(HTTPHeaderCode code, std::string name, std::string value);
+
+  // A deque, so that headers_ can point into it as it grows
+  std::deque<Entry> entries_;
+  std::vector<compress::Header> headers_;
+  std::string http1Block_;
+};
+
+}
@@ -0,0 +1,117 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/http/HeaderValueCache.h>
+
+#include <folly/ThreadLocal.h>
+#include <list>
+#include <proxygen/lib/utils/ChromeUtils.h>
+#include <unordered_map>
+
+namespace proxygen {
+
+namespace {
+
+const int8_t kUnparsedVersion = -2;
+
+struct Table {
+  struct Slot {
+    std::shared_ptr<const CachedHeaderValue> value;
+    std::list<const std::string*>::iterator pos;
+  };
+
+  // Keyed by the header code followed by the value
+  std::unordered_map<std::string, Slot> index;
+  // The keys in index, most recently used first
+  std::list<const std::string*> lru;
+  // Reused to build the keys looked up
+  std::string key;
+};
+
+// Leaked, so that entries can still be looked up during static destruction
+folly::ThreadLocal<Table>& tables() {
+  static auto tables = new folly::ThreadLocal<Table>();
+  return *tables;
+}
+
+size_t& maxEntries() {
+  static size_t max = 256;
+  return max;
+}
+
+}
+
+CachedHeaderValue::CachedHeaderValue(folly::StringPiece value)
+    : value_(value.data(), value.size()),
+      chromeVersion_(kUnparsedVersion) {
+}
+
+int8_t CachedHeaderValue::getChromeVersion() const {
+  if (chromeVersion_ == kUnparsedVersion) {
+    chromeVersion_ = proxygen::getChromeVersion(value_);
+  }
+  return chromeVersion_;
+}
+
+const std::vector<RFC2616::TokenQPair>& CachedHeaderValue::getQvalues(
+    bool* wellFormed) const {
+  if (!qvaluesParsed_) {
+    qvaluesWellFormed_ = RFC2616::parseQvalues(value_, qvalues_);
+    qvaluesParsed_ = true;
+  }
+  if (wellFormed) {
+    *wellFormed = qvaluesWellFormed_;
+  }
+  return qvalues_;
+}
+
+std::shared_ptr<const CachedHeaderValue> HeaderValueCache::get(
+    HTTPHeaderCode code, folly::StringPiece value) {
+  if (value.size() > kMaxValueLength || maxEntries() == 0) {
+    return std::make_shared<const CachedHeaderValue>(value);
+  }
+  auto& table = *tables();
+  table.key.assign(1, char(code));
+  table.key.append(value.data(), value.size());
+  auto it = table.index.find(table.key);
+  if (it != table.index.end()) {
+    table.lru.splice(table.lru.begin(), table.lru, it->second.pos);
+    return it->second.value;
+  }
+
+  auto entry = std::make_shared<const CachedHeaderValue>(value);
+  it = table.index.emplace(table.key, Table::Slot{entry, {}}).first;
+  table.lru.push_front(&it->first);
+  it->second.pos = table.lru.begin();
+  while (table.index.size() > maxEntries()) {
+    table.index.erase(*table.lru.back());
+    table.lru.pop_back();
+  }
+  return entry;
+}
+
+void HeaderValueCache::setMaxEntries(size_t max) {
+  maxEntries() = max;
+}
+
+size_t HeaderValueCache::getMaxEntries() {
+  return maxEntries();
+}
+
+size_t HeaderValueCache::getNumEntries() {
+  return tables()->index.size();
+}
+
+void HeaderValueCache::clear() {
+  auto& table = *tables();
+  table.index.clear();
+  table.lru.clear();
+}
+
+}
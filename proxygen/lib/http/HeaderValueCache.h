@@ -0,0 +1,82 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/Range.h>
+#include <memory>
+#include <proxygen/lib/http/HTTPCommonHeaders.h>
+#include <proxygen/lib/http/RFC2616.h>
+#include <string>
+#include <vector>
+
+namespace proxygen {
+
+/**
+ * An immutable header value, with what is derived from it parsed the
+ * first time it is asked for.
+ */
+class CachedHeaderValue {
+ public:
+  explicit CachedHeaderValue(folly::StringPiece value);
+
+  const std::string& getValue() const { return value_; }
+
+  // getChromeVersion() of a user-agent
+  int8_t getChromeVersion() const;
+
+  /**
+   * RFC2616::parseQvalues() of an accept-* value, whose tokens point into
+   * getValue(). wellFormed is set to what parseQvalues() returned.
+   */
+  const std::vector<RFC2616::TokenQPair>& getQvalues(
+    bool* wellFormed = nullptr) const;
+
+ private:
+  std::string value_;
+  mutable std::vector<RFC2616::TokenQPair> qvalues_;
+  mutable int8_t chromeVersion_;
+  mutable bool qvaluesParsed_{false};
+  mutable bool qvaluesWellFormed_{false};
+};
+
+/**
+ * Per-thread tables of the header values that repeat from request to
+ * request and connection to connection, such as user-agent or
+ * accept-encoding, so that codecs and filters parse each distinct value
+ * once per thread instead of once per request.
+ *
+ * Up to getMaxEntries() values are kept per thread, evicting the least
+ * recently used. An entry lives on while it is referenced.
+ */
+class HeaderValueCache {
+ public:
+  // Longer values are not cached, as they rarely repeat
+  static const size_t kMaxValueLength = 512;
+
+  /**
+   * The entry of value in the table of the current thread, added if
+   * missing. code is the header's, so that equal values of different
+   * headers are told apart.
+   */
+  static std::shared_ptr<const CachedHeaderValue> get(
+    HTTPHeaderCode code, folly::StringPiece value);
+
+  // Entries kept per thread, 256 by default; 0 disables the cache
+  static void setMaxEntries(size_t max);
+  static size_t getMaxEntries();
+
+  // The entries in the table of the current thread
+  static size_t getNumEntries();
+
+  // Empty the table of the current thread
+  static void clear();
+};
+
+}
@@ -0,0 +1,324 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/http/HedgedRequest.h>
+
+#include <algorithm>
+#include <folly/Conv.h>
+#include <limits>
+#include <proxygen/lib/http/session/HTTPUpstreamSession.h>
+
+using folly::AsyncSocketException;
+using std::unique_ptr;
+
+namespace proxygen {
+
+namespace {
+
+// RFC 7231 4.2.2
+bool isIdempotent(const HTTPMessage& request) {
+  auto method = request.getMethod();
+  if (!method) {
+    return false;
+  }
+  switch (*method) {
+    case HTTPMethod::GET:
+    case HTTPMethod::HEAD:
+    case HTTPMethod::OPTIONS:
+    case HTTPMethod::TRACE:
+    case HTTPMethod::PUT:
+    case HTTPMethod::DELETE:
+      return true;
+    default:
+      return false;
+  }
+}
+
+}
+
+HedgePolicy::HedgePolicy(const Options& options)
+    : options_(options),
+      budget_(options.maxBurst),
+      delay_(options.initialDelay) {
+  options_.window = std::max(options_.window, 1u);
+  latencies_.reserve(options_.window);
+}
+
+void HedgePolicy::onRequest() {
+  budget_ = std::min(budget_ + options_.maxExtraLoad, options_.maxBurst);
+}
+
+bool HedgePolicy::tryAcquire() {
+  if (budget_ < 1) {
+    return false;
+  }
+  budget_ -= 1;
+  return true;
+}
+
+void HedgePolicy::recordLatency(std::chrono::milliseconds latency) {
+  auto ms = static_cast<uint32_t>(std::min<int64_t>(
+      std::max<int64_t>(latency.count(), 0),
+      std::numeric_limits<uint32_t>::max()));
+  if (latencies_.size() < options_.window) {
+    latencies_.push_back(ms);
+  } else {
+    latencies_[next_] = ms;
+    next_ = (next_ + 1) % latencies_.size();
+  }
+  // Taking the percentile is only worth it every so many latencies
+  if (++sinceUpdate_ >= std::max(options_.window / 16, 1u)) {
+    sinceUpdate_ = 0;
+    updateDelay();
+  }
+}
+
+void HedgePolicy::updateDelay() {
+  std::vector<uint32_t> sorted(latencies_);
+  size_t rank = std::min(
+    sorted.size() - 1,
+    static_cast<size_t>(options_.percentile / 100 * sorted.size()));
+  std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+  delay_ = std::max(options_.minDelay,
+                    std::min(options_.maxDelay,
+                             std::chrono::milliseconds(sorted[rank])));
+}
+
+HedgedRequest::Attempt::Attempt(HedgedRequest* r,
+                                const HTTPSessionPool::Key& k)
+    : request(r),
+      key(k) {}
+
+void HedgedRequest::Attempt::abort() {
+  aborted = true;
+  if (waitingForSession) {
+    waitingForSession = false;
+    request->pool_->cancel(this);
+  }
+  if (txn && !failed) {
+    // detaches the transaction, usually before this returns
+    txn->sendAbort();
+  }
+}
+
+void HedgedRequest::Attempt::sessionAvailable(HTTPUpstreamSession* session) {
+  waitingForSession = false;
+  if (!session->newTransaction(this)) {
+    HTTPException ex(HTTPException::Direction::INGRESS_AND_EGRESS,
+                     "session takes no more transactions");
+    ex.setProxygenError(kErrorConnect);
+    request->attemptFailed(this, ex);
+    return;
+  }
+  // Any of these may fail the transaction, and detach it
+  txn->sendHeaders(request->request_);
+  if (txn && request->body_) {
+    txn->sendBody(request->body_->clone());
+  }
+  if (txn) {
+    txn->sendEOM();
+  }
+}
+
+void HedgedRequest::Attempt::sessionError(const AsyncSocketException& ex) {
+  waitingForSession = false;
+  HTTPException error(HTTPException::Direction::INGRESS_AND_EGRESS,
+                      folly::to<std::string>("connect failed: ", ex.what()));
+  error.setProxygenError(kErrorConnect);
+  request->attemptFailed(this, error);
+}
+
+void HedgedRequest::Attempt::detachTransaction() noexcept {
+  txn = nullptr;
+  // may destroy the request, and this with it
+  request->maybeDestroy();
+}
+
+void HedgedRequest::Attempt::onHeadersComplete(unique_ptr<HTTPMessage> msg)
+  noexcept {
+  if (!aborted) {
+    request->attemptHeaders(this, std::move(msg));
+  }
+}
+
+void HedgedRequest::Attempt::onBody(unique_ptr<folly::IOBuf> chain)
+  noexcept {
+  if (!aborted && request->winner_ == this) {
+    request->callback_->onBody(std::move(chain));
+  }
+}
+
+void HedgedRequest::Attempt::onTrailers(unique_ptr<HTTPHeaders> trailers)
+  noexcept {
+  if (!aborted && request->winner_ == this) {
+    request->callback_->onTrailers(std::move(trailers));
+  }
+}
+
+void HedgedRequest::Attempt::onEOM() noexcept {
+  if (!aborted && request->winner_ == this) {
+    request->callback_->onEOM();
+    request->finish();
+  }
+}
+
+void HedgedRequest::Attempt::onError(const HTTPException& error) noexcept {
+  if (!aborted) {
+    request->attemptFailed(this, error);
+  }
+}
+
+HedgedRequest::HedgedRequest(folly::EventBase* eventBase,
+                             HTTPSessionPool* pool,
+                             HedgePolicy* policy,
+                             Callback* callback)
+    : folly::AsyncTimeout(eventBase),
+      pool_(CHECK_NOTNULL(pool)),
+      policy_(CHECK_NOTNULL(policy)),
+      callback_(CHECK_NOTNULL(callback)) {}
+
+HedgedRequest::~HedgedRequest() {
+  for (auto& attempt: attempts_) {
+    DCHECK(!attempt->isRunning());
+  }
+}
+
+void HedgedRequest::start(const HTTPMessage& request,
+                          unique_ptr<folly::IOBuf> body,
+                          const std::vector<HTTPSessionPool::Key>& targets) {
+  CHECK(!targets.empty());
+  CHECK(attempts_.empty());
+  DestructorGuard dg(this);
+  request_ = request;
+  body_ = std::move(body);
+  targets_ = targets;
+  idempotent_ = idempotent_ || isIdempotent(request);
+  startTime_ = getCurrentTime();
+  policy_->onRequest();
+  startAttempt();
+  scheduleHedge();
+}
+
+void HedgedRequest::cancel() {
+  DestructorGuard dg(this);
+  finished_ = true;
+  cancelTimeout();
+  for (auto& attempt: attempts_) {
+    attempt->abort();
+  }
+  maybeDestroy();
+}
+
+void HedgedRequest::startAttempt() {
+  auto attempt = new Attempt(this, targets_[attempts_.size()]);
+  attempts_.emplace_back(attempt);
+  attempt->waitingForSession = true;
+  // may call back, and run the attempt, before this returns
+  pool_->getSession(attempt->key, attempt);
+}
+
+void HedgedRequest::scheduleHedge() {
+  if (finished_ || winner_ || !idempotent_ ||
+      attempts_.size() >= targets_.size()) {
+    return;
+  }
+  scheduleTimeout(policy_->getDelay());
+}
+
+void HedgedRequest::timeoutExpired() noexcept {
+  DestructorGuard dg(this);
+  if (!policy_->tryAcquire()) {
+    VLOG(4) << "no budget left to hedge the request";
+    return;
+  }
+  VLOG(4) << "hedging the request, attempt " << attempts_.size() + 1;
+  startAttempt();
+  scheduleHedge();
+}
+
+void HedgedRequest::attemptHeaders(Attempt* attempt,
+                                   unique_ptr<HTTPMessage> msg) {
+  DestructorGuard dg(this);
+  if (finished_ || attempt->failed) {
+    return;
+  }
+  if (!winner_) {
+    winner_ = attempt;
+    cancelTimeout();
+    policy_->recordLatency(millisecondsSince(startTime_));
+    for (auto& other: attempts_) {
+      if (other.get() != attempt) {
+        other->abort();
+      }
+    }
+  }
+  if (winner_ == attempt) {
+    callback_->onHeadersComplete(std::move(msg));
+  }
+}
+
+void HedgedRequest::attemptFailed(Attempt* attempt,
+                                  const HTTPException& error) {
+  DestructorGuard dg(this);
+  attempt->failed = true;
+  if (finished_) {
+    return;
+  }
+  if (winner_) {
+    if (winner_ == attempt) {
+      callback_->onError(error);
+      finish();
+    }
+    return;
+  }
+  for (auto& other: attempts_) {
+    if (!other->failed && other->isRunning()) {
+      // another copy may still respond
+      return;
+    }
+  }
+  // A request that never got a connection was not sent
+  bool retryable = idempotent_ ||
+    error.getProxygenError() == kErrorConnect;
+  if (retryable && attempts_.size() < targets_.size() &&
+      policy_->tryAcquire()) {
+    VLOG(4) << "retrying the request after: " << error.what();
+    startAttempt();
+    scheduleHedge();
+    return;
+  }
+  callback_->onError(error);
+  finish();
+}
+
+void HedgedRequest::finish() {
+  finished_ = true;
+  cancelTimeout();
+  for (auto& attempt: attempts_) {
+    if (attempt.get() != winner_) {
+      attempt->abort();
+    }
+  }
+  maybeDestroy();
+}
+
+void HedgedRequest::maybeDestroy() {
+  if (!finished_ || destroying_) {
+    return;
+  }
+  for (auto& attempt: attempts_) {
+    if (attempt->isRunning()) {
+      return;
+    }
+  }
+  destroying_ = true;
+  destroy();
+}
+
+}
@@ -0,0 +1,220 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/io/async/AsyncTimeout.h>
+#include <folly/io/async/DelayedDestruction.h>
+#include <memory>
+#include <proxygen/lib/http/HTTPMessage.h>
+#include <proxygen/lib/http/HTTPSessionPool.h>
+#include <proxygen/lib/http/session/HTTPTransaction.h>
+#include <proxygen/lib/utils/Time.h>
+#include <vector>
+
+namespace proxygen {
+
+/**
+ * When to hedge, shared by the requests to a set of upstreams: how long a
+ * request may go unanswered before a copy is sent elsewhere, taken as a
+ * percentile of the recent response times, and a budget that caps the
+ * extra load the copies (and retries) put on the upstreams.
+ *
+ * Every request earns maxExtraLoad of a hedge, and may spend the budget
+ * built up so, up to maxBurst. Not thread safe.
+ */
+class HedgePolicy {
+ public:
+  struct Options {
+    // Hedge requests still unanswered at this percentile of latency
+    double percentile{95};
+    // Hedges and retries, as a fraction of the requests
+    double maxExtraLoad{0.05};
+    // Hedges that may be sent back to back once the budget is full
+    double maxBurst{10};
+    // The delay until enough latencies are known, and its bounds after
+    std::chrono::milliseconds initialDelay{50};
+    std::chrono::milliseconds minDelay{1};
+    std::chrono::milliseconds maxDelay{1000};
+    // Recent response times the percentile is taken over
+    uint32_t window{1024};
+  };
+
+  explicit HedgePolicy(const Options& options);
+
+  std::chrono::milliseconds getDelay() const {
+    return delay_;
+  }
+
+  // Earn the budget of a new request
+  void onRequest();
+
+  /**
+   * Spend the budget of one hedge or retry. Returns false, spending
+   * nothing, if there is not enough of it left.
+   */
+  bool tryAcquire();
+
+  // The time a request took until its response headers arrived
+  void recordLatency(std::chrono::milliseconds latency);
+
+  double getBudget() const {
+    return budget_;
+  }
+
+ private:
+  void updateDelay();
+
+  Options options_;
+  // the last window latencies, in ms, oldest at next_ once full
+  std::vector<uint32_t> latencies_;
+  size_t next_{0};
+  uint32_t sinceUpdate_{0};
+  double budget_;
+  std::chrono::milliseconds delay_;
+};
+
+/**
+ * A request sent through an HTTPSessionPool to the first of a list of
+ * upstreams, and hedged: each time it has gone without a response for the
+ * policy's delay, a copy goes to the next upstream. Upstreams that fail
+ * before responding are retried on the next one right away. The first
+ * response wins and is handed to the callback; the other copies are
+ * cancelled with sendAbort(), which resets their streams (or closes the
+ * serial connections they run on). Hedges and retries are only sent while
+ * the policy's budget allows.
+ *
+ * A cancelled copy may already have been processed, so only requests with
+ * an idempotent method, or that the caller marks as idempotent, are hedged
+ * or retried. Others are sent once, and only retried if they failed to get
+ * a connection. The request body is sent in one piece with each copy.
+ *
+ * A HedgedRequest is allocated with new and destroys itself once the
+ * callback had onEOM() or onError() and every copy is done, or after
+ * cancel(). The pool and the policy must outlive it.
+ */
+class HedgedRequest: public folly::DelayedDestruction,
+                     private folly::AsyncTimeout {
+ public:
+  class Callback {
+   public:
+    virtual ~Callback() {}
+    // Events of the winning response
+    virtual void onHeadersComplete(std::unique_ptr<HTTPMessage> msg)
+      noexcept = 0;
+    virtual void onBody(std::unique_ptr<folly::IOBuf> chain) noexcept = 0;
+    virtual void onTrailers(std::unique_ptr<HTTPHeaders> trailers)
+      noexcept {}
+    virtual void onEOM() noexcept = 0;
+    // The response failed, or no upstream gave one
+    virtual void onError(const HTTPException& error) noexcept = 0;
+  };
+
+  HedgedRequest(folly::EventBase* eventBase,
+                HTTPSessionPool* pool,
+                HedgePolicy* policy,
+                Callback* callback);
+
+  /**
+   * Send request, with an optional body, to targets: the first gets it
+   * now, the others are used in order for hedges and retries.
+   */
+  void start(const HTTPMessage& request,
+             std::unique_ptr<folly::IOBuf> body,
+             const std::vector<HTTPSessionPool::Key>& targets);
+
+  /**
+   * Hedge and retry the request whatever its method, as one that can be
+   * processed more than once. Call before start().
+   */
+  void setIdempotent() {
+    idempotent_ = true;
+  }
+
+  /**
+   * Abort every copy of the request. The callback gets no more events.
+   */
+  void cancel();
+
+  // Copies of the request sent so far, or being connected
+  size_t getNumAttempts() const {
+    return attempts_.size();
+  }
+
+ private:
+  class Attempt: public HTTPSessionPool::Callback,
+                 public HTTPTransactionHandler {
+   public:
+    Attempt(HedgedRequest* request, const HTTPSessionPool::Key& key);
+
+    // Stop the attempt without further events, if it is still running
+    void abort();
+
+    // May still respond, or call back
+    bool isRunning() const {
+      return waitingForSession || txn;
+    }
+
+    // HTTPSessionPool::Callback
+    void sessionAvailable(HTTPUpstreamSession* session) override;
+    void sessionError(const folly::AsyncSocketException& ex) override;
+
+    // HTTPTransactionHandler
+    void setTransaction(HTTPTransaction* t) noexcept override {
+      txn = t;
+    }
+    void detachTransaction() noexcept override;
+    void onHeadersComplete(std::unique_ptr<HTTPMessage> msg)
+      noexcept override;
+    void onBody(std::unique_ptr<folly::IOBuf> chain) noexcept override;
+    void onTrailers(std::unique_ptr<HTTPHeaders> trailers)
+      noexcept override;
+    void onEOM() noexcept override;
+    void onUpgrade(UpgradeProtocol protocol) noexcept override {}
+    void onError(const HTTPException& error) noexcept override;
+    void onEgressPaused() noexcept override {}
+    void onEgressResumed() noexcept override {}
+
+    HedgedRequest* request;
+    HTTPSessionPool::Key key;
+    HTTPTransaction* txn{nullptr};
+    bool waitingForSession{false};
+    // failed before responding, or given up on
+    bool failed{false};
+    bool aborted{false};
+  };
+
+  ~HedgedRequest() override;
+
+  void startAttempt();
+  void scheduleHedge();
+  void attemptHeaders(Attempt* attempt, std::unique_ptr<HTTPMessage> msg);
+  void attemptFailed(Attempt* attempt, const HTTPException& error);
+  // Once the callback is done with, destroy the request when idle
+  void finish();
+  void maybeDestroy();
+
+  // AsyncTimeout
+  void timeoutExpired() noexcept override;
+
+  HTTPSessionPool* pool_;
+  HedgePolicy* policy_;
+  Callback* callback_;
+  HTTPMessage request_;
+  std::unique_ptr<folly::IOBuf> body_;
+  std::vector<HTTPSessionPool::Key> targets_;
+  std::vector<std::unique_ptr<Attempt>> attempts_;
+  Attempt* winner_{nullptr};
+  TimePoint startTime_;
+  bool idempotent_{false};
+  bool finished_{false};
+  bool destroying_{false};
+};
+
+}
@@ -9,9 +9,11 @@
  */
 #pragma once
 
+#include <folly/Conv.h>
 #include <folly/Range.h>
 #include <proxygen/lib/http/HTTPMethod.h>
 #include <string>
+#include <vector>
 
 namespace proxygen {
 
@@ -69,4 +71,56 @@ typedef std::pair<folly::StringPiece, double> TokenQPair;
 
 bool parseQvalues(folly::StringPiece value, std::vector<TokenQPair> &output);
 
+/**
+ * The tokens and qvalues parseQvalues() would output, passed one at a time
+ * to func(token, qvalue) instead, which returns true to stop. Nothing is
+ * allocated. Returns false if a token was malformed; unlike parseQvalues()
+ * it does not also require a token, and the tokens after a stop aren't
+ * checked.
+ */
+template <typename F> // (StringPiece, double) -> bool
+bool forEachQvalue(folly::StringPiece value, F&& func) {
+  bool result = true;
+  while (!value.empty()) {
+    folly::StringPiece token = value.split_step(',');
+    if (token.empty()) {
+      continue;
+    }
+    auto pos = token.find(';');
+    double qvalue = 1.0;
+    if (pos != std::string::npos) {
+      auto qpos = token.find("q=", pos);
+      if (qpos != std::string::npos) {
+        folly::StringPiece qvalueStr(token.data() + qpos + 2,
+                                     token.size() - (qpos + 2));
+        try {
+          qvalue = folly::to<double>(&qvalueStr);
+        } catch (const std::range_error&) {
+          // q=<some garbage>
+          result = false;
+        }
+        // we could validate that the remainder of qvalueStr was all
+        // whitespace, for now we just discard it
+      } else {
+        // ; but no q=
+        result = false;
+      }
+      token.reset(token.start(), pos);
+    }
+    // strip leading whitespace
+    while (token.size() > 0 && isspace(token[0])) {
+      token.reset(token.start() + 1, token.size() - 1);
+    }
+    if (token.size() == 0) {
+      // empty token
+      result = false;
+    } else {
+      if (func(token, qvalue)) {
+        break;
+      }
+    }
+  }
+  return result;
+}
+
 }}
@@ -9,6 +9,7 @@
  */
 #include <proxygen/lib/http/codec/CodecProtocol.h>
 #include <proxygen/lib/http/codec/HTTPCodec.h>
+#include <proxygen/lib/http/codec/compress/HPACKCodec.h>
 
 #include <glog/logging.h>
 
@@ -22,6 +23,21 @@ static const std::string spdy_3_1 = "spdy/3.1";
 static const std::string spdy_3_1_hpack = "spdy/3.1-hpack";
 static const std::string http_2 = "http/2";
 static const std::string empty = "";
+
+// The protocols as named in ALPN and NPN. The final HTTP/2 is spoken as
+// the draft it was last compatible with
+const struct {
+  const char* name;
+  CodecProtocol protocol;
+} kNextProtocols[] = {
+  {"http/1.1", CodecProtocol::HTTP_1_1},
+  {"http/1.0", CodecProtocol::HTTP_1_1},
+  {"h2", CodecProtocol::HTTP_2},
+  {"h2-14", CodecProtocol::HTTP_2},
+  {"spdy/3.1", CodecProtocol::SPDY_3_1},
+  {"spdy/3", CodecProtocol::SPDY_3},
+  {"spdy/2", CodecProtocol::SPDY_2},
+};
 }
 
 extern const std::string& getCodecProtocolString(CodecProtocol proto) {
@@ -65,6 +81,19 @@ extern CodecProtocol getCodecProtocolFromStr(const std::string& protocolStr) {
   }
 }
 
+extern boost::optional<CodecProtocol> getCodecProtocolFromNextProtocol(
+    const std::string& nextProtocol) {
+  if (nextProtocol == kHpackNpn) {
+    return CodecProtocol::SPDY_3_1_HPACK;
+  }
+  for (const auto& entry: kNextProtocols) {
+    if (nextProtocol == entry.name) {
+      return entry.protocol;
+    }
+  }
+  return boost::none;
+}
+
 extern bool isSpdyCodecProtocol(CodecProtocol protocol) {
   return protocol == CodecProtocol::SPDY_2 ||
          protocol == CodecProtocol::SPDY_3 ||
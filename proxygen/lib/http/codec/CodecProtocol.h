@@ -9,6 +9,7 @@
  */
 #pragma once
 
+#include <boost/optional.hpp>
 #include <cstdint>
 #include <string>
 
@@ -39,6 +40,13 @@ extern bool isValidCodecProtocolStr(const std::string& protocolStr);
  */
 extern CodecProtocol getCodecProtocolFromStr(const std::string& protocolStr);
 
+/**
+ * Get the protocol negotiated under the given name by ALPN or NPN, or none
+ * if no codec speaks it.
+ */
+extern boost::optional<CodecProtocol> getCodecProtocolFromNextProtocol(
+  const std::string& nextProtocol);
+
 /**
  * Check if the given protocol is SPDY.
  */
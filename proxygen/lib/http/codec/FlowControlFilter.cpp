@@ -72,11 +72,12 @@ bool FlowControlFilter::ingressBytesProcessed(folly::IOBufQueue& writeBuf,
                                               uint32_t delta) {
   toAck_ += delta;
   bool willAck = (toAck_ > 0 &&
-                  uint32_t(toAck_) > recvWindow_.getCapacity() / 2);
+                  uint32_t(toAck_) > getWindowUpdateThreshold());
   VLOG(4) << "processed " << delta << " toAck_=" << toAck_
           << " bytes, will ack=" << willAck;
   if (willAck) {
     CHECK(recvWindow_.free(toAck_));
+    maybeGrowReceiveWindow();
     call_->generateWindowUpdate(writeBuf, 0, toAck_);
     toAck_ = 0;
     return true;
@@ -84,6 +85,27 @@ bool FlowControlFilter::ingressBytesProcessed(folly::IOBufQueue& writeBuf,
   return false;
 }
 
+void FlowControlFilter::maybeGrowReceiveWindow() {
+  auto capacity = recvWindow_.getCapacity();
+  if (maxRecvCapacity_ <= capacity || rtt_.count() == 0) {
+    return;
+  }
+  auto now = getCurrentTime();
+  // The peer consumed a whole threshold's worth of window within two
+  // round trips of the previous update, so it was likely stalled waiting
+  // for it. Doubling the window converges on the bandwidth-delay product.
+  if (lastUpdateTime_ != TimePoint() && now - lastUpdateTime_ < 2 * rtt_) {
+    uint32_t newCapacity = std::min<uint64_t>(maxRecvCapacity_,
+                                              uint64_t(capacity) * 2);
+    if (recvWindow_.setCapacity(newCapacity)) {
+      VLOG(4) << "Growing conn-level recv window to " << newCapacity;
+      toAck_ += newCapacity - capacity;
+      notify_.onConnectionReceiveWindowGrown();
+    }
+  }
+  lastUpdateTime_ = now;
+}
+
 uint32_t FlowControlFilter::getAvailableSend() const {
   return sendWindow_.getNonNegativeSize();
 }
@@ -107,8 +129,9 @@ void FlowControlFilter::onBody(StreamID stream,
         recvWindow_.getSize(), ", amount=", amount));
     callback_->onError(0, ex, false);
   } else {
-    if (VLOG_IS_ON(4) && recvWindow_.getSize() == 0) {
+    if (recvWindow_.getSize() == 0) {
       VLOG(4) << "recvWindow full";
+      notify_.onConnectionReceiveWindowFull();
     }
     toAck_ += padding;
     CHECK(recvWindow_.free(padding));
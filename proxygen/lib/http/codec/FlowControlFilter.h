@@ -11,6 +11,7 @@
 
 #include <proxygen/lib/http/Window.h>
 #include <proxygen/lib/http/codec/HTTPCodecFilter.h>
+#include <proxygen/lib/utils/Time.h>
 
 namespace folly {
 class IOBufQueue;
@@ -34,6 +35,12 @@ class FlowControlFilter:
      */
     virtual void onConnectionSendWindowOpen() = 0;
     virtual void onConnectionSendWindowClosed() = 0;
+    /**
+     * The peer used up the receive window, and has to wait for a window
+     * update; and auto-tuning grew the window.
+     */
+    virtual void onConnectionReceiveWindowFull() {}
+    virtual void onConnectionReceiveWindowGrown() {}
   };
 
   static const uint32_t kDefaultCapacity;
@@ -66,10 +73,41 @@ class FlowControlFilter:
    */
   void setReceiveWindowSize(folly::IOBufQueue& writeBuf, uint32_t capacity);
 
+  /**
+   * Set the number of processed bytes that must be pending before a
+   * WINDOW_UPDATE is sent. 0 (the default) means half the receive
+   * window's capacity.
+   */
+  void setWindowUpdateThreshold(uint32_t threshold) {
+    updateThreshold_ = threshold;
+  }
+
+  uint32_t getWindowUpdateThreshold() const {
+    return updateThreshold_ ? updateThreshold_ :
+      recvWindow_.getCapacity() / 2;
+  }
+
+  /**
+   * Grow the receive window, up to maxCapacity, when the peer uses it up
+   * faster than the round trip time allows, ie: when the window rather
+   * than the bandwidth-delay product limits the transfer. A maxCapacity
+   * not above the current capacity disables auto-tuning (the default).
+   */
+  void setReceiveWindowAutoTuning(uint32_t maxCapacity) {
+    maxRecvCapacity_ = maxCapacity;
+  }
+
+  /**
+   * Update the round trip time estimate used for auto-tuning.
+   */
+  void setRoundTripTime(std::chrono::microseconds rtt) {
+    rtt_ = rtt;
+  }
+
   /**
    * Notify the flow control filter that some ingress bytes were
-   * processed. If the number of bytes to acknowledge exceeds half the
-   * receive window's capacity, a WINDOW_UPDATE frame will be written.
+   * processed. If the number of bytes to acknowledge exceeds the window
+   * update threshold, a WINDOW_UPDATE frame will be written.
    * @param writeBuf The buffer to write egress on. This function may
    *                 generate a WINDOW_UPDATE on this buffer.
    * @param delta    The number of bytes that were processed.
@@ -103,10 +141,16 @@ class FlowControlFilter:
 
  private:
 
+  void maybeGrowReceiveWindow();
+
   Callback& notify_;
   Window recvWindow_;
   Window sendWindow_;
   int32_t toAck_{0};
+  uint32_t updateThreshold_{0};
+  uint32_t maxRecvCapacity_{0};
+  std::chrono::microseconds rtt_{0};
+  TimePoint lastUpdateTime_;
   bool error_:1;
   bool sendsBlocked_:1;
 };
@@ -9,9 +9,15 @@
  */
 #include <proxygen/lib/http/codec/HTTP1xCodec.h>
 
+#include <cstring>
+#include <limits>
 #include <folly/Memory.h>
 #include <proxygen/lib/http/HTTPHeaderSize.h>
+#include <proxygen/lib/http/HeaderTemplate.h>
 #include <proxygen/lib/http/RFC2616.h>
+#include <proxygen/lib/http/codec/HTTPChecks.h>
+#include <proxygen/lib/http/codec/SPDYUtil.h>
+#include <proxygen/lib/utils/AllocStats.h>
 
 using folly::IOBuf;
 using folly::IOBufQueue;
@@ -63,13 +69,175 @@ appendUint(IOBufQueue& queue, size_t& len, uint64_t value) {
   (queue).append(str, sizeof(str) - 1)
 
 void
-appendString(IOBufQueue& queue, size_t& len, const string& str) {
-  queue.append(str.data(), str.length());
-  len += str.length();
+appendString(IOBufQueue& queue, size_t& len, folly::StringPiece str) {
+  queue.append(str.data(), str.size());
+  len += str.size();
+}
+
+// "ffffffffffffffff\r\n"
+const size_t kMaxChunkHeaderSize = 2 * sizeof(size_t) + 2;
+
+/**
+ * Write the chunk header of a chunk of the given length: its length in
+ * lowercase hex and CRLF.
+ * @return Number of bytes written.
+ */
+size_t formatChunkHeader(size_t length, char* dst) {
+  static const char kHexDigits[] = "0123456789abcdef";
+  int digits = 1;
+  while (digits < int(2 * sizeof(size_t)) && (length >> (4 * digits))) {
+    digits++;
+  }
+  for (int i = digits - 1; i >= 0; i--) {
+    *dst++ = kHexDigits[(length >> (4 * i)) & 0xf];
+  }
+  *dst++ = '\r';
+  *dst = '\n';
+  return digits + 2;
 }
 
 const std::pair<uint8_t, uint8_t> kHTTPVersion10(1, 0);
 
+/**
+ * "HTTP/1.x <code> <reason>" pre-serialized for every status code that has
+ * a default reason, so the usual response line is a single append.
+ */
+class StatusLines {
+ public:
+  StatusLines() {
+    for (uint16_t minor = 0; minor < 2; minor++) {
+      for (uint16_t code = kMinCode; code < kMaxCode; code++) {
+        const char* reason = proxygen::HTTPMessage::getDefaultReason(code);
+        if (strcmp(reason, "-") != 0) {
+          lines_[minor][code - kMinCode] =
+            folly::to<string>("HTTP/1.", minor, " ", code, " ", reason);
+        }
+      }
+    }
+  }
+
+  // Returns nullptr unless the line for this exact version, code and reason
+  // was pre-serialized
+  const string* get(std::pair<uint8_t, uint8_t> version, uint16_t code,
+                    const string& reason) const {
+    if (version.first != 1 || version.second > 1 ||
+        code < kMinCode || code >= kMaxCode) {
+      return nullptr;
+    }
+    const string& line = lines_[version.second][code - kMinCode];
+    // "HTTP/1.x NNN " precedes the reason
+    if (line.empty() || line.compare(kReasonOffset, string::npos, reason)) {
+      return nullptr;
+    }
+    return &line;
+  }
+
+ private:
+  static const uint16_t kMinCode = 100;
+  static const uint16_t kMaxCode = 600;
+  static const size_t kReasonOffset = 13;
+
+  string lines_[2][kMaxCode - kMinCode];
+};
+
+const StatusLines& getStatusLines() {
+  static const StatusLines statusLines;
+  return statusLines;
+}
+
+const size_t kHeadUnsupported = std::numeric_limits<size_t>::max();
+
+/**
+ * Find the end of a request head, resuming at the start of the line at
+ * 'from', which is advanced past the complete lines. Returns the length of
+ * the head, 0 if it is incomplete, or kHeadUnsupported if it has a line
+ * that does not end with CRLF, starts with an empty line or is larger than
+ * http_parser allows.
+ */
+size_t findHeadEnd(const char* data, size_t len, size_t& from) {
+  const size_t end = std::min<size_t>(len, HTTP_MAX_HEADER_SIZE);
+  while (true) {
+    auto lf = (const char*)memchr(data + from, '\n', end - from);
+    if (!lf) {
+      return (len > end) ? kHeadUnsupported : 0;
+    }
+    size_t pos = lf - data;
+    if (pos == from || data[pos - 1] != '\r') {
+      return kHeadUnsupported;
+    }
+    if (pos - 1 == from) {
+      return (from == 0) ? kHeadUnsupported : pos + 1;
+    }
+    from = pos + 1;
+  }
+}
+
+// The methods http_parser would accept with no special handling
+bool isScannableMethod(folly::StringPiece method) {
+  switch (method.size()) {
+    case 3: return method == "GET" || method == "PUT";
+    case 4: return method == "HEAD" || method == "POST";
+    case 6: return method == "DELETE";
+    case 7: return method == "OPTIONS";
+    default: return false;
+  }
+}
+
+// Origin-form targets with no bytes http_parser treats specially
+bool isScannableURL(folly::StringPiece url) {
+  if (url.empty() || url[0] != '/') {
+    return false;
+  }
+  for (uint8_t c: url) {
+    if (c <= ' ' || c >= 0x7f || c == '#') {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool isScannableHeaderName(folly::StringPiece name) {
+  if (name.empty()) {
+    return false;
+  }
+  for (char c: name) {
+    if (!(c >= 'a' && c <= 'z') && !(c >= 'A' && c <= 'Z') &&
+        !(c >= '0' && c <= '9') && c != '-' && c != '_') {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Header values without control bytes (but HTAB), DEL or the backslash
+// http_parser tracks in quoted strings
+bool isScannableHeaderValue(folly::StringPiece value) {
+  auto bytes = folly::ByteRange(value);
+  for (size_t i = proxygen::SPDYUtil::findValueSpecial(bytes);
+       i < bytes.size(); i++) {
+    uint8_t c = bytes[i];
+    if ((c < 0x20 && c != '\t') || c == 0x7f || c == '\\') {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool parseContentLength(folly::StringPiece value, uint64_t& length) {
+  // Small enough not to overflow
+  if (value.empty() || value.size() > 18) {
+    return false;
+  }
+  length = 0;
+  for (char c: value) {
+    if (c < '0' || c > '9') {
+      return false;
+    }
+    length = length * 10 + (c - '0');
+  }
+  return true;
+}
+
 } // anonymous namespace
 
 namespace proxygen {
@@ -81,6 +249,8 @@ HTTP1xCodec::HTTP1xCodec(TransportDirection direction, bool forceUpstream1_1)
     ingressTxnID_(0),
     egressTxnID_(0),
     currentIngressBuf_(nullptr),
+    pendingHeadScanned_(0),
+    scannedBodyRemaining_(0),
     headerParseState_(HeaderParseState::kParsingHeaderIdle),
     transportDirection_(direction),
     keepaliveRequested_(KeepaliveRequested::UNSET),
@@ -105,7 +275,9 @@ HTTP1xCodec::HTTP1xCodec(TransportDirection direction, bool forceUpstream1_1)
     ingressUpgrade_(false),
     ingressUpgradeComplete_(false),
     egressUpgrade_(false),
-    headersComplete_(false) {
+    headersComplete_(false),
+    scanHeads_(false),
+    httpChecks_(false) {
   switch (direction) {
   case TransportDirection::DOWNSTREAM:
     http_parser_init(&parser_, HTTP_REQUEST);
@@ -150,11 +322,24 @@ HTTP1xCodec::setParserPaused(bool paused) {
   parserPaused_ = paused;
 }
 
+void
+HTTP1xCodec::setHeaderArena(size_t blockSize) {
+  headerArenaBlockSize_ = blockSize;
+}
+
+void
+HTTP1xCodec::setHeadScanner(bool enabled) {
+  CHECK(transportDirection_ == TransportDirection::DOWNSTREAM);
+  CHECK_EQ(ingressTxnID_, 0);
+  scanHeads_ = enabled;
+}
+
 size_t
 HTTP1xCodec::onIngress(const IOBuf& buf) {
   if (parserError_) {
     return 0;
   } else if (ingressUpgradeComplete_) {
+    countIOBufClones();
     callback_->onBody(ingressTxnID_, buf.clone(), 0);
     return buf.computeChainDataLength();
   } else {
@@ -162,28 +347,48 @@ HTTP1xCodec::onIngress(const IOBuf& buf) {
     CHECK(!parserActive_);
     parserActive_ = true;
     currentIngressBuf_ = &buf;
-    size_t bytesParsed = http_parser_execute(&parser_,
-                                             &kParserSettings,
-                                             (const char*)buf.data(),
-                                             buf.length());
-    // in case we parsed a section of the headers but we're not done parsing
-    // the headers we need to keep accounting of it for total header size
-    if (!headersComplete_) {
-      headerSize_.uncompressed += bytesParsed;
+    size_t bytesParsed = 0;
+    if (scanHeads_) {
+      bytesParsed = scanIngress(buf);
+    }
+    if (!scanHeads_ && !pendingHead_.empty()) {
+      // What the scanner had buffered when it gave up goes first
+      size_t pendingParsed = http_parser_execute(&parser_,
+                                                 &kParserSettings,
+                                                 pendingHead_.data(),
+                                                 pendingHead_.size());
+      if (!headersComplete_) {
+        headerSize_.uncompressed += pendingParsed;
+      }
+      // pendingHead_ is about to change under the current header
+      copyHeaderPieces();
+      pendingHead_.erase(0, pendingParsed);
+    }
+    if (!scanHeads_ && pendingHead_.empty() &&
+        HTTP_PARSER_ERRNO(&parser_) == HPE_OK) {
+      size_t parsed = http_parser_execute(&parser_,
+                                          &kParserSettings,
+                                          (const char*)buf.data() +
+                                            bytesParsed,
+                                          buf.length() - bytesParsed);
+      // in case we parsed a section of the headers but we're not done
+      // parsing the headers we need to keep accounting of it for total
+      // header size
+      if (!headersComplete_) {
+        headerSize_.uncompressed += parsed;
+      }
+      bytesParsed += parsed;
     }
     parserActive_ = false;
-    parserError_ = (HTTP_PARSER_ERRNO(&parser_) != HPE_OK) &&
+    if (!scanHeads_) {
+      parserError_ = (HTTP_PARSER_ERRNO(&parser_) != HPE_OK) &&
         (HTTP_PARSER_ERRNO(&parser_) != HPE_PAUSED);
-    if (parserError_) {
-      onParserError();
-    }
-    if (currentHeaderName_.empty() && !currentHeaderNameStringPiece_.empty()) {
-      // we currently are storing a chunk of header name via pointers in
-      // currentHeaderNameStringPiece_, but the currentIngressBuf_ is about to
-      // vanish and so we need to copy over that data to currentHeaderName_
-      currentHeaderName_.assign(currentHeaderNameStringPiece_.begin(),
-                                currentHeaderNameStringPiece_.size());
+      if (parserError_) {
+        onParserError();
+      }
     }
+    // the currentIngressBuf_ is about to vanish
+    copyHeaderPieces();
     currentIngressBuf_ = nullptr;
     if (pendingEOF_) {
       onIngressEOF();
@@ -207,11 +412,24 @@ HTTP1xCodec::onIngressEOF() {
     return;
   }
   parserActive_ = true;
-  if (http_parser_execute(&parser_, &kParserSettings, nullptr, 0) != 0) {
+  if (scanHeads_ && scannedBodyRemaining_ > 0) {
+    // http_parser fails the same way on a truncated body
+    parser_.http_errno = HPE_INVALID_EOF_STATE;
     parserError_ = true;
   } else {
-    parserError_ = (HTTP_PARSER_ERRNO(&parser_) != HPE_OK) &&
-        (HTTP_PARSER_ERRNO(&parser_) != HPE_PAUSED);
+    if (scanHeads_ && !pendingHead_.empty()) {
+      // Let http_parser judge the truncated head
+      stopHeadScanner();
+      http_parser_execute(&parser_, &kParserSettings,
+                          pendingHead_.data(), pendingHead_.size());
+      pendingHead_.clear();
+    }
+    if (http_parser_execute(&parser_, &kParserSettings, nullptr, 0) != 0) {
+      parserError_ = true;
+    } else {
+      parserError_ = (HTTP_PARSER_ERRNO(&parser_) != HPE_OK) &&
+          (HTTP_PARSER_ERRNO(&parser_) != HPE_PAUSED);
+    }
   }
   parserActive_ = false;
   if (parserError_) {
@@ -267,10 +485,24 @@ HTTP1xCodec::isBusy() const {
   return requestPending_ || responsePending_;
 }
 
+void
+HTTP1xCodec::releaseIdleMemory() {
+  if (msg_ || !pendingHead_.empty()) {
+    // in the middle of a message
+    return;
+  }
+  // the strings keep their capacity for the next message when cleared
+  std::string().swap(currentHeaderName_);
+  std::string().swap(currentHeaderValue_);
+  std::string().swap(url_);
+  std::string().swap(reason_);
+  std::string().swap(pendingHead_);
+}
+
 void
 HTTP1xCodec::addDateHeader(IOBufQueue& writeBuf, size_t& len) {
   appendLiteral(writeBuf, len, "Date: ");
-  appendString(writeBuf, len, HTTPMessage::formatDateHeader());
+  appendString(writeBuf, len, HTTPMessage::getDateHeader());
   appendLiteral(writeBuf, len, CRLF);
 }
 
@@ -283,18 +515,32 @@ HTTP1xCodec::generateHeader(IOBufQueue& writeBuf,
                             HTTPHeaderSize* size) {
   CHECK(assocStream == 0) << "HTTP does not support pushed transactions, "
     "assocStream=" << assocStream;
+  if (httpChecks_) {
+    HTTPChecksBase::checkEgressHeaders(msg);
+  }
   if (keepalive_ && disableKeepalivePending_) {
     keepalive_ = false;
   }
   const bool upstream = (transportDirection_ == TransportDirection::UPSTREAM);
   const bool downstream = !upstream;
+  if (downstream && msg.is1xxResponse() && !mayChunkEgress_ &&
+      msg.getStatusCode() != 101) {
+    // HTTP/1.0 clients don't expect informational responses (RFC 7231 6.2)
+    VLOG(4) << "Dropping " << msg.getStatusCode() << " response to a "
+            << "HTTP/1.0 request";
+    if (size) {
+      size->compressed = 0;
+      size->uncompressed = 0;
+    }
+    return;
+  }
   if (upstream) {
     DCHECK(txn == egressTxnID_);
     requestPending_ = true;
     responsePending_ = true;
     connectRequest_ = (msg.getMethod() == HTTPMethod::CONNECT);
     headRequest_ = (msg.getMethod() == HTTPMethod::HEAD);
-    expectNoResponseBody_ = connectRequest_ || headRequest_;
+    noResponseBody_.push_back(connectRequest_ || headRequest_);
   } else {
     // In HTTP, transactions must be egressed sequentially -- no out of order
     // responses.  So txn must be egressTxnID_ + 1.  Furthermore, we shouldn't
@@ -350,7 +596,13 @@ HTTP1xCodec::generateHeader(IOBufQueue& writeBuf,
 
   size_t len = 0;
   switch (transportDirection_) {
-  case TransportDirection::DOWNSTREAM:
+  case TransportDirection::DOWNSTREAM: {
+    const string* statusLine = getStatusLines().get(
+      version, msg.getStatusCode(), msg.getStatusMessage());
+    if (statusLine) {
+      appendString(writeBuf, len, *statusLine);
+      break;
+    }
     appendLiteral(writeBuf, len, "HTTP/");
     appendUint(writeBuf, len, version.first);
     appendLiteral(writeBuf, len, ".");
@@ -360,6 +612,7 @@ HTTP1xCodec::generateHeader(IOBufQueue& writeBuf,
     appendLiteral(writeBuf, len, " ");
     appendString(writeBuf, len, msg.getStatusMessage());
     break;
+  }
   case TransportDirection::UPSTREAM:
     if (forceUpstream1_1_ && version < HTTPMessage::kHTTPVersion11) {
       version = HTTPMessage::kHTTPVersion11;
@@ -387,16 +640,19 @@ HTTP1xCodec::generateHeader(IOBufQueue& writeBuf,
   }
   egressChunked_ &= mayChunkEgress_;
   appendLiteral(writeBuf, len, CRLF);
-  const string* deferredContentLength = nullptr;
+  folly::StringPiece deferredContentLength;
+  bool hasContentLength = false;
   bool hasTransferEncodingChunked = false;
   bool hasUpgradeHeader = false;
   bool hasDateHeader = false;
-  msg.getHeaders().forEachWithCode([&] (HTTPHeaderCode code,
-                                        const string& header,
-                                        const string& value) {
+  // as pieces, which leaves headers parsed into an arena where they are
+  msg.getHeaders().forEachPiece([&] (HTTPHeaderCode code,
+                                     folly::StringPiece header,
+                                     folly::StringPiece value) {
     if (code == HTTP_HEADER_CONTENT_LENGTH) {
       // Write the Content-Length last (t1071703)
-      deferredContentLength = &value;
+      deferredContentLength = value;
+      hasContentLength = true;
       return; // continue
     } else if (code == HTTP_HEADER_CONNECTION) {
       // TODO: add support for the case where "close" is part of
@@ -422,22 +678,26 @@ HTTP1xCodec::generateHeader(IOBufQueue& writeBuf,
     } else if (!hasDateHeader && code == HTTP_HEADER_DATE) {
       hasDateHeader = true;
     }
-    size_t lineLen = header.length() + value.length() + 4; // 4 for ": " + CRLF
+    size_t lineLen = header.size() + value.size() + 4; // 4 for ": " + CRLF
     auto writable = writeBuf.preallocate(lineLen,
         std::max(lineLen, size_t(2000)));
     char* dst = (char*)writable.first;
-    memcpy(dst, header.data(), header.length());
-    dst += header.length();
+    memcpy(dst, header.data(), header.size());
+    dst += header.size();
     *dst++ = ':';
     *dst++ = ' ';
-    memcpy(dst, value.data(), value.length());
-    dst += value.length();
+    memcpy(dst, value.data(), value.size());
+    dst += value.size();
     *dst++ = '\r';
     *dst = '\n';
     DCHECK(size_t(++dst - (char*)writable.first) == lineLen);
     writeBuf.postallocate(lineLen);
     len += lineLen;
   });
+  if (auto headerTemplate = msg.getHeaderTemplate()) {
+    // Rendered once for all the messages it's attached to
+    appendString(writeBuf, len, headerTemplate->getHTTP1Block());
+  }
   bool bodyCheck =
     (downstream && keepalive_ && !expectNoResponseBody_ && !egressUpgrade_) ||
     // auto chunk POSTs and any request that came to us chunked
@@ -445,7 +705,7 @@ HTTP1xCodec::generateHeader(IOBufQueue& writeBuf,
   // TODO: 400 a 1.0 POST with no content-length
   // clear egressChunked_ if the header wasn't actually set
   egressChunked_ &= hasTransferEncodingChunked;
-  if (bodyCheck && !egressChunked_ && !deferredContentLength) {
+  if (bodyCheck && !egressChunked_ && !hasContentLength) {
     // On a connection that would otherwise be eligible for keep-alive,
     // we're being asked to send a response message with no Content-Length,
     // no chunked encoding, and no special circumstances that would eliminate
@@ -459,7 +719,7 @@ HTTP1xCodec::generateHeader(IOBufQueue& writeBuf,
       keepalive_ = false;
     }
   }
-  if (downstream && !hasDateHeader) {
+  if (downstream && !hasDateHeader && !is1xxResponse_) {
     addDateHeader(writeBuf, len);
   }
   if (!is1xxResponse_ || upstream || hasUpgradeHeader) {
@@ -473,9 +733,9 @@ HTTP1xCodec::generateHeader(IOBufQueue& writeBuf,
       appendLiteral(writeBuf, len, "close\r\n");
     }
   }
-  if (deferredContentLength) {
+  if (hasContentLength) {
     appendLiteral(writeBuf, len, "Content-Length: ");
-    appendString(writeBuf, len, *deferredContentLength);
+    appendString(writeBuf, len, deferredContentLength);
     appendString(writeBuf, len, CRLF);
   }
   appendLiteral(writeBuf, len, CRLF);
@@ -506,16 +766,27 @@ HTTP1xCodec::generateBody(IOBufQueue& writeBuf,
   size_t totLen = buflen;
 
   if (egressChunked_ && !inChunk_) {
-    char chunkLenBuf[32];
-    int rc = snprintf(chunkLenBuf, sizeof(chunkLenBuf), "%zx\r\n", buflen);
-    CHECK(rc > 0);
-    CHECK(size_t(rc) < sizeof(chunkLenBuf));
-
-    writeBuf.append(chunkLenBuf, rc);
-    totLen += rc;
+    // Frame the chunk in the room around the body where there is some, so
+    // that small chunks do not each add a few tiny buffers to the chain
+    char chunkLenBuf[kMaxChunkHeaderSize];
+    size_t headerLen = formatChunkHeader(buflen, chunkLenBuf);
+    if (!chain->isSharedOne() && chain->headroom() >= headerLen) {
+      chain->prepend(headerLen);
+      memcpy(chain->writableData(), chunkLenBuf, headerLen);
+    } else {
+      writeBuf.append(chunkLenBuf, headerLen);
+    }
+    totLen += headerLen;
 
-    writeBuf.append(std::move(chain));
-    writeBuf.append("\r\n", 2);
+    IOBuf* tail = chain->prev();
+    if (!tail->isSharedOne() && tail->tailroom() >= 2) {
+      memcpy(tail->writableTail(), CRLF, 2);
+      tail->append(2);
+      writeBuf.append(std::move(chain));
+    } else {
+      writeBuf.append(std::move(chain));
+      writeBuf.append(CRLF, 2);
+    }
     totLen += 2;
   } else {
     writeBuf.append(std::move(chain));
@@ -530,22 +801,17 @@ HTTP1xCodec::generateBody(IOBufQueue& writeBuf,
 size_t HTTP1xCodec::generateChunkHeader(IOBufQueue& writeBuf,
                                         StreamID txn,
                                         size_t length) {
-  // TODO: Format directly into the IOBuf, rather than copying after the fact.
-  // IOBufQueue::append() currently forces us to copy.
-
   CHECK(length) << "use sendEOM to terminate the message using the "
                 << "standard zero-length chunk. Don't "
                 << "send zero-length chunks using this API.";
   if (egressChunked_) {
     CHECK(!inChunk_);
     inChunk_ = true;
-    char chunkLenBuf[32];
-    int rc = snprintf(chunkLenBuf, sizeof(chunkLenBuf), "%zx\r\n", length);
-    CHECK(rc > 0);
-    CHECK(size_t(rc) < sizeof(chunkLenBuf));
-
-    writeBuf.append(chunkLenBuf, rc);
-    return rc;
+    // Goes in the tailroom of what came before, if there is some
+    char chunkLenBuf[kMaxChunkHeaderSize];
+    size_t headerLen = formatChunkHeader(length, chunkLenBuf);
+    writeBuf.append(chunkLenBuf, headerLen);
+    return headerLen;
   }
 
   return 0;
@@ -628,6 +894,11 @@ HTTP1xCodec::onMessageBegin() {
   headerSize_.uncompressed = 0;
   headerParseState_ = HeaderParseState::kParsingHeaderStart;
   msg_.reset(new HTTPMessage());
+  if (headerArenaBlockSize_) {
+    msg_->getHeaders().useArena(headerArenaBlockSize_);
+  }
+  // messages on a connection tend to have as many headers as the last
+  msg_->getHeaders().reserve(headerCountHint_);
   trailers_.reset();
   if (transportDirection_ == TransportDirection::DOWNSTREAM) {
     requestPending_ = true;
@@ -655,7 +926,39 @@ HTTP1xCodec::onReason(const char* buf, size_t len) {
   return 0;
 }
 
+void HTTP1xCodec::copyHeaderPieces() {
+  if (currentHeaderName_.empty() && !currentHeaderNameStringPiece_.empty()) {
+    // we currently are storing a chunk of header name via pointers in
+    // currentHeaderNameStringPiece_, so we need to copy over that data to
+    // currentHeaderName_
+    currentHeaderName_.assign(currentHeaderNameStringPiece_.begin(),
+                              currentHeaderNameStringPiece_.size());
+  }
+  if (!currentHeaderValueStringPiece_.empty()) {
+    DCHECK(currentHeaderValue_.empty());
+    currentHeaderValue_.assign(currentHeaderValueStringPiece_.begin(),
+                               currentHeaderValueStringPiece_.size());
+    currentHeaderValueStringPiece_.clear();
+  }
+}
+
 void HTTP1xCodec::pushHeaderNameAndValue(HTTPHeaders& hdrs) {
+  if (!currentHeaderValueStringPiece_.empty()) {
+    // the whole value is still in the buffer being parsed
+    if (LIKELY(currentHeaderName_.empty())) {
+      const HTTPHeaderCode code = HTTPCommonHeaders::hash(
+        currentHeaderNameStringPiece_.begin(),
+        currentHeaderNameStringPiece_.size());
+      hdrs.addFromCodec(code, currentHeaderNameStringPiece_,
+                        currentHeaderValueStringPiece_);
+    } else {
+      hdrs.add(currentHeaderName_, currentHeaderValueStringPiece_);
+      currentHeaderName_.clear();
+    }
+    currentHeaderNameStringPiece_.clear();
+    currentHeaderValueStringPiece_.clear();
+    return;
+  }
   if (LIKELY(currentHeaderName_.empty())) {
     hdrs.addFromCodec(currentHeaderNameStringPiece_.begin(),
                       currentHeaderNameStringPiece_.size(),
@@ -725,6 +1028,22 @@ HTTP1xCodec::onHeaderValue(const char* buf, size_t len) {
   } else {
     headerParseState_ = HeaderParseState::kParsingTrailerValue;
   }
+  if (currentHeaderValue_.empty()) {
+    if (currentHeaderValueStringPiece_.empty()) {
+      // the first chunk (typically, there is only one)
+      currentHeaderValueStringPiece_.reset(buf, len);
+      return 0;
+    } else if (currentHeaderValueStringPiece_.end() == buf) {
+      // still contiguous in memory
+      currentHeaderValueStringPiece_.reset(
+        currentHeaderValueStringPiece_.begin(),
+        currentHeaderValueStringPiece_.size() + len);
+      return 0;
+    }
+    currentHeaderValue_.assign(currentHeaderValueStringPiece_.begin(),
+                               currentHeaderValueStringPiece_.size());
+    currentHeaderValueStringPiece_.clear();
+  }
   currentHeaderValue_.append(buf, len);
   return 0;
 }
@@ -734,6 +1053,7 @@ HTTP1xCodec::onHeadersComplete(size_t len) {
   if (headerParseState_ == HeaderParseState::kParsingHeaderValue) {
     pushHeaderNameAndValue(msg_->getHeaders());
   }
+  headerCountHint_ = msg_->getHeaders().size();
 
   // Update the HTTPMessage with the values parsed from the header
   msg_->setHTTPVersion(parser_.http_major, parser_.http_minor);
@@ -742,7 +1062,21 @@ HTTP1xCodec::onHeadersComplete(size_t len) {
   if (transportDirection_ == TransportDirection::DOWNSTREAM) {
     // Set the method type
     msg_->setMethod(http_method_str(static_cast<http_method>(parser_.method)));
+  } else {
+    msg_->setStatusCode(parser_.status_code);
+    msg_->setStatusMessage(std::move(reason_));
+    reason_.clear();
+  }
 
+  // 1 is a magic value that tells the http_parser not to expect a
+  // message body even if the message header implied the presence
+  // of one (e.g., via a Content-Length)
+  return deliverHeaders(len) ? 1 : 0;
+}
+
+bool
+HTTP1xCodec::deliverHeaders(size_t len) {
+  if (transportDirection_ == TransportDirection::DOWNSTREAM) {
     connectRequest_ = (msg_->getMethod() == HTTPMethod::CONNECT);
 
     // If this is a headers-only request, we shouldn't send
@@ -763,20 +1097,17 @@ HTTP1xCodec::onHeadersComplete(size_t len) {
 
     // If the client sent us an HTTP/1.x with x >= 1, we may send
     // chunked responses.
-    mayChunkEgress_ = ((parser_.http_major == 1) && (parser_.http_minor >= 1));
-  } else {
-    msg_->setStatusCode(parser_.status_code);
-    msg_->setStatusMessage(std::move(reason_));
-    reason_.clear();
+    const auto& version = msg_->getHTTPVersion();
+    mayChunkEgress_ = ((version.first == 1) && (version.second >= 1));
   }
 
   if (transportDirection_ == TransportDirection::UPSTREAM) {
     if (connectRequest_ &&
-        (parser_.status_code >= 200 && parser_.status_code < 300)) {
+        (msg_->getStatusCode() >= 200 && msg_->getStatusCode() < 300)) {
       // Enable upgrade if this is a 200 response to a CONNECT
       // request we sent earlier
       ingressUpgrade_ = true;
-    } else if (parser_.status_code == 101) {
+    } else if (msg_->getStatusCode() == 101) {
       // Set the upgrade flags if the server has upgraded.
       ingressUpgrade_ = true;
       egressUpgrade_ = true;
@@ -819,6 +1150,9 @@ HTTP1xCodec::onHeadersComplete(size_t len) {
     ignoreBody = false;
   } else {
     is1xxResponse_ = msg_->is1xxResponse();
+    // The response is to the oldest request not yet answered
+    expectNoResponseBody_ = !noResponseBody_.empty() &&
+      noResponseBody_.front();
     if (expectNoResponseBody_) {
       ignoreBody = true;
     } else {
@@ -830,12 +1164,13 @@ HTTP1xCodec::onHeadersComplete(size_t len) {
   headerSize_.uncompressed += len;
   msg_->setIngressHeaderSize(headerSize_);
 
+  if (httpChecks_ &&
+      !HTTPChecksBase::checkIngressHeaders(callback_, ingressTxnID_, *msg_)) {
+    msg_.reset();
+    return ignoreBody;
+  }
   callback_->onHeadersComplete(ingressTxnID_, std::move(msg_));
-
-  // 1 is a magic value that tells the http_parser not to expect a
-  // message body even if the message header implied the presence
-  // of one (e.g., via a Content-Length)
-  return (ignoreBody) ? 1 : 0;
+  return ignoreBody;
 }
 
 int
@@ -847,6 +1182,7 @@ HTTP1xCodec::onBody(const char* buf, size_t len) {
   const char* dataEnd = dataStart + currentIngressBuf_->length();
   DCHECK_GE(buf, dataStart);
   DCHECK_LE(buf + len, dataEnd);
+  countIOBufClones();
   unique_ptr<IOBuf> clone(currentIngressBuf_->clone());
   clone->trimStart(buf - dataStart);
   clone->trimEnd(dataEnd - (buf + len));
@@ -894,7 +1230,10 @@ int HTTP1xCodec::onMessageComplete() {
     requestPending_ = false;
     break;
   case TransportDirection::UPSTREAM:
-    responsePending_ = is1xxResponse_;
+    if (!is1xxResponse_ && !noResponseBody_.empty()) {
+      noResponseBody_.pop_front();
+    }
+    responsePending_ = is1xxResponse_ || !noResponseBody_.empty();
   }
 
   callback_->onMessageComplete(ingressTxnID_, ingressUpgrade_);
@@ -909,6 +1248,162 @@ int HTTP1xCodec::onMessageComplete() {
   return 0;
 }
 
+size_t
+HTTP1xCodec::scanIngress(const IOBuf& buf) {
+  const char* data = (const char*)buf.data();
+  const size_t length = buf.length();
+  size_t parsed = 0;
+  try {
+    while (parsed < length && scanHeads_ && !parserPaused_ &&
+           !parserError_) {
+      if (scannedBodyRemaining_ > 0) {
+        size_t len = std::min<uint64_t>(scannedBodyRemaining_,
+                                        length - parsed);
+        onBody(data + parsed, len);
+        parsed += len;
+        scannedBodyRemaining_ -= len;
+        if (scannedBodyRemaining_ == 0) {
+          onMessageComplete();
+        }
+        continue;
+      }
+
+      if (pendingHead_.empty()) {
+        size_t scanned = 0;
+        size_t headLen = findHeadEnd(data + parsed, length - parsed, scanned);
+        if (headLen == kHeadUnsupported ||
+            (headLen > 0 &&
+             !parseRequestHead(folly::StringPiece(data + parsed, headLen)))) {
+          stopHeadScanner();
+        } else if (headLen == 0) {
+          pendingHead_.assign(data + parsed, length - parsed);
+          pendingHeadScanned_ = scanned;
+          parsed = length;
+        } else {
+          parsed += headLen;
+        }
+        continue;
+      }
+
+      // The head started in an earlier read
+      size_t pendingLen = pendingHead_.size();
+      pendingHead_.append(data + parsed, length - parsed);
+      size_t headLen = findHeadEnd(pendingHead_.data(), pendingHead_.size(),
+                                   pendingHeadScanned_);
+      if (headLen == kHeadUnsupported ||
+          (headLen > 0 &&
+           !parseRequestHead(folly::StringPiece(pendingHead_.data(),
+                                                headLen)))) {
+        // http_parser gets the rest of buf from where we are
+        pendingHead_.resize(pendingLen);
+        stopHeadScanner();
+      } else if (headLen == 0) {
+        parsed = length;
+      } else {
+        parsed += headLen - pendingLen;
+        pendingHead_.clear();
+        pendingHeadScanned_ = 0;
+      }
+    }
+  } catch (const std::exception& ex) {
+    onParserError(ex.what());
+    parserError_ = true;
+  }
+  return parsed;
+}
+
+bool
+HTTP1xCodec::parseRequestHead(folly::StringPiece head) {
+  // Request line: method SP request-target SP HTTP-version CRLF. Every
+  // line ends with CRLF, findHeadEnd() checked; a stray CR inside one
+  // fails the checks below.
+  auto lineEnd = (const char*)memchr(head.begin(), '\n', head.size()) - 1;
+  folly::StringPiece line(head.begin(), lineEnd);
+  auto sp = (const char*)memchr(line.begin(), ' ', line.size());
+  if (!sp) {
+    return false;
+  }
+  folly::StringPiece method(line.begin(), sp);
+  line = folly::StringPiece(sp + 1, line.end());
+  sp = (const char*)memchr(line.begin(), ' ', line.size());
+  if (!sp || !isScannableMethod(method)) {
+    return false;
+  }
+  folly::StringPiece url(line.begin(), sp);
+  folly::StringPiece version(sp + 1, line.end());
+  if (!isScannableURL(url) ||
+      (version != "HTTP/1.1" && version != "HTTP/1.0")) {
+    return false;
+  }
+
+  HTTPHeaders headers;
+  if (headerArenaBlockSize_) {
+    headers.useArena(headerArenaBlockSize_);
+  }
+  bool hasContentLength = false;
+  uint64_t contentLength = 0;
+  const char* pos = lineEnd + 2;
+  // The head ends with an empty line
+  while (pos < head.end() - 2) {
+    lineEnd = (const char*)memchr(pos, '\n', head.end() - pos) - 1;
+    auto colon = (const char*)memchr(pos, ':', lineEnd - pos);
+    if (!colon) {
+      return false;
+    }
+    folly::StringPiece name(pos, colon);
+    folly::StringPiece value(colon + 1, lineEnd);
+    while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) {
+      value.pop_front();
+    }
+    // http_parser reports no value at all for empty ones
+    if (value.empty() || !isScannableHeaderName(name) ||
+        !isScannableHeaderValue(value)) {
+      return false;
+    }
+
+    HTTPHeaderCode code = HTTPCommonHeaders::hash(name.data(), name.size());
+    switch (code) {
+      case HTTP_HEADER_TRANSFER_ENCODING:
+      case HTTP_HEADER_UPGRADE:
+        return false;
+      case HTTP_HEADER_CONTENT_LENGTH:
+        if (hasContentLength || !parseContentLength(value, contentLength)) {
+          return false;
+        }
+        hasContentLength = true;
+        break;
+      default:
+        break;
+    }
+    headers.addFromCodec(code, name, value);
+    pos = lineEnd + 2;
+  }
+
+  onMessageBegin();
+  msg_->getHeaders() = std::move(headers);
+  msg_->setHTTPVersion(1, version.back() - '0');
+  msg_->setIsChunked(false);
+  msg_->setMethod(method);
+  url_.assign(url.data(), url.size());
+  // A pause asked for in onMessageBegin() takes effect once the head is
+  // delivered, as the scanner has already consumed it
+  deliverHeaders(head.size());
+
+  if (contentLength > 0) {
+    scannedBodyRemaining_ = contentLength;
+  } else {
+    onMessageComplete();
+  }
+  return true;
+}
+
+void
+HTTP1xCodec::stopHeadScanner() {
+  VLOG(4) << "Handing the connection over to http_parser";
+  scanHeads_ = false;
+  pendingHeadScanned_ = 0;
+}
+
 int
 HTTP1xCodec::onMessageBeginCB(http_parser* parser) {
   HTTP1xCodec* codec = static_cast<HTTP1xCodec*>(parser->data);
@@ -12,6 +12,7 @@
 #include <proxygen/lib/http/HTTPMessage.h>
 #include <proxygen/lib/http/codec/HTTPCodec.h>
 #include <proxygen/lib/http/codec/TransportDirection.h>
+#include <deque>
 #include <string>
 
 #include <proxygen/external/http_parser/http_parser.h>
@@ -44,6 +45,10 @@ class HTTP1xCodec : public HTTPCodec {
   bool closeOnEgressComplete() const override { return egressUpgrade_; }
   bool supportsParallelRequests() const override { return false; }
   bool supportsPushTransactions() const override { return false; }
+  bool enableHTTPChecks() override {
+    httpChecks_ = true;
+    return true;
+  }
   void generateHeader(folly::IOBufQueue& writeBuf,
                       StreamID txn,
                       const HTTPMessage& msg,
@@ -71,12 +76,35 @@ class HTTP1xCodec : public HTTPCodec {
   size_t generateGoaway(folly::IOBufQueue& writeBuf,
                         StreamID lastStream,
                         ErrorCode statusCode) override;
+  void releaseIdleMemory() override;
 
   /**
    * @returns true if the codec supports the given NPN protocol.
    */
   static bool supportsNextProtocol(const std::string& npn);
 
+  /**
+   * Parse request heads with a scanner that finds line ends and header
+   * separators with memchr() and the vectorized SPDYUtil checks, instead
+   * of running http_parser over every byte. Only for DOWNSTREAM codecs,
+   * and only before any ingress.
+   *
+   * The scanner handles plain GET/HEAD/POST/PUT/DELETE/OPTIONS requests
+   * with CRLF line ends and at most a Content-Length body. As soon as it
+   * sees anything else (chunked bodies, upgrades, CONNECT, folded or
+   * unusual headers, malformed input), the connection permanently reverts
+   * to http_parser, which is handed the buffered bytes, so errors and
+   * edge cases are reported exactly as before.
+   */
+  void setHeadScanner(bool enabled);
+
+  /**
+   * Parse the headers of incoming messages into an arena of blockSize
+   * byte blocks rather than into strings of their own; see
+   * HTTPHeaders::useArena(). 0, the default, turns it off again.
+   */
+  void setHeaderArena(size_t blockSize);
+
  private:
   /** Simple state model used to track the parsing of HTTP headers */
   enum class HeaderParseState : uint8_t {
@@ -121,6 +149,12 @@ class HTTP1xCodec : public HTTPCodec {
   /** Push out header name-value pair to hdrs and clear currentHeader*_ */
   void pushHeaderNameAndValue(HTTPHeaders& hdrs);
 
+  /**
+   * Copy the pieces of the current header still pointing into the buffer
+   * being parsed, before that buffer goes away.
+   */
+  void copyHeaderPieces();
+
   // Parser callbacks
   int onMessageBegin();
   int onURL(const char* buf, size_t len);
@@ -128,11 +162,22 @@ class HTTP1xCodec : public HTTPCodec {
   int onHeaderField(const char* buf, size_t len);
   int onHeaderValue(const char* buf, size_t len);
   int onHeadersComplete(size_t len);
+  /** The part of onHeadersComplete() the head scanner shares. Returns
+      true if there must be no message body. */
+  bool deliverHeaders(size_t len);
   int onBody(const char* buf, size_t len);
   int onChunkHeader(size_t len);
   int onChunkComplete();
   int onMessageComplete();
 
+  // Head scanner
+  size_t scanIngress(const folly::IOBuf& buf);
+  /** Parse a complete request head and deliver it to the callback.
+      Returns false, with no callback invoked, if http_parser must take
+      over. */
+  bool parseRequestHead(folly::StringPiece head);
+  void stopHeadScanner();
+
   HTTPCodec::Callback* callback_;
   StreamID ingressTxnID_;
   StreamID egressTxnID_;
@@ -143,9 +188,24 @@ class HTTP1xCodec : public HTTPCodec {
   std::string currentHeaderName_;
   folly::StringPiece currentHeaderNameStringPiece_;
   std::string currentHeaderValue_;
+  // A value seen in one piece is copied once, straight into the headers
+  folly::StringPiece currentHeaderValueStringPiece_;
   std::string url_;
   std::string reason_;
+  // Bytes of a request head split across reads, kept while scanning heads;
+  // after the scanner stops, the bytes http_parser still has to see
+  std::string pendingHead_;
+  // Where the search for the end of pendingHead_ resumes
+  size_t pendingHeadScanned_;
+  // What is left of the Content-Length body of a scanned request
+  uint64_t scannedBodyRemaining_;
   HTTPHeaderSize headerSize_;
+  // headers in the last message, reserved up front for the next one
+  size_t headerCountHint_{0};
+  size_t headerArenaBlockSize_{0};
+  // Upstream, for each request sent and not yet answered, in order,
+  // whether its response has no body (pipelined requests queue up)
+  std::deque<bool> noResponseBody_;
   HeaderParseState headerParseState_;
   TransportDirection transportDirection_;
   KeepaliveRequested keepaliveRequested_; // only used in DOWNSTREAM mode
@@ -172,6 +232,8 @@ class HTTP1xCodec : public HTTPCodec {
   bool ingressUpgradeComplete_:1;
   bool egressUpgrade_:1;
   bool headersComplete_:1;
+  bool scanHeads_:1;
+  bool httpChecks_:1;
 
   // C-callable wrappers for the http_parser callbacks
   static int onMessageBeginCB(http_parser* parser);
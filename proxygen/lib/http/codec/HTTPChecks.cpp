@@ -13,39 +13,33 @@
 
 namespace proxygen {
 
-void HTTPChecks::onHeadersComplete(StreamID stream,
-                                   std::unique_ptr<HTTPMessage> msg) {
+bool HTTPChecksBase::checkIngressHeaders(HTTPCodec::Callback* callback,
+                                         HTTPCodec::StreamID stream,
+                                         const HTTPMessage& msg) {
 
-  if (msg->isRequest() && (RFC2616::isRequestBodyAllowed(msg->getMethod())
-                           == RFC2616::BodyAllowed::NOT_ALLOWED) &&
-      RFC2616::bodyImplied(msg->getHeaders())) {
+  if (msg.isRequest() && (RFC2616::isRequestBodyAllowed(msg.getMethod())
+                          == RFC2616::BodyAllowed::NOT_ALLOWED) &&
+      RFC2616::bodyImplied(msg.getHeaders())) {
     HTTPException ex(
       HTTPException::Direction::INGRESS, "RFC2616: Request Body Not Allowed");
     ex.setProxygenError(kErrorParseHeader);
     // setting the status code means that the error is at the HTTP layer and
     // that parsing succeeded.
     ex.setHttpStatusCode(400);
-    callback_->onError(stream, ex, true);
-    return;
+    callback->onError(stream, ex, true);
+    return false;
   }
 
-  callback_->onHeadersComplete(stream, std::move(msg));
+  return true;
 }
 
-void HTTPChecks::generateHeader(folly::IOBufQueue& writeBuf,
-                                StreamID stream,
-                                const HTTPMessage& msg,
-                                StreamID assocStream,
-                                bool eom,
-                                HTTPHeaderSize* sizeOut) {
+void HTTPChecksBase::checkEgressHeaders(const HTTPMessage& msg) {
   if (msg.isRequest() && RFC2616::bodyImplied(msg.getHeaders())) {
     CHECK(RFC2616::isRequestBodyAllowed(msg.getMethod()) !=
           RFC2616::BodyAllowed::NOT_ALLOWED);
     // We could also add a "strict" mode that disallows sending body on GET
     // requests here too.
   }
-
-  call_->generateHeader(writeBuf, stream, msg, assocStream, eom, sizeOut);
 }
 
 }
@@ -10,30 +10,66 @@
 #pragma once
 
 #include <proxygen/lib/http/codec/HTTPCodecFilter.h>
+#include <utility>
 
 namespace proxygen {
 
+/**
+ * The checks of HTTPChecksFilter, which is a template, kept here. Codecs
+ * that enableHTTPChecks() run them as they parse and serialize headers.
+ */
+class HTTPChecksBase {
+ public:
+  /**
+   * Returns false, after reporting the error to callback, if the ingress
+   * message breaks the checks.
+   */
+  static bool checkIngressHeaders(HTTPCodec::Callback* callback,
+                                  HTTPCodec::StreamID stream,
+                                  const HTTPMessage& msg);
+
+  static void checkEgressHeaders(const HTTPMessage& msg);
+};
+
 /**
  * This class enforces certain higher-level HTTP semantics. It does not enforce
  * conditions that require state to decide. That is, this class is stateless and
  * only examines the calls and callbacks that go through it.
+ *
+ * The checks are added on top of Base, any PassThroughHTTPCodecFilter, and
+ * hand on to it without a virtual call. HTTPSession uses
+ * HTTPChecksFilter<FlowControlFilter> when the codec has session flow
+ * control, so that every call and callback crosses one filter fewer.
  */
-
-class HTTPChecks: public PassThroughHTTPCodecFilter {
+template <typename Base>
+class HTTPChecksFilter: public Base, private HTTPChecksBase {
  public:
+  template <typename... Args>
+  explicit HTTPChecksFilter(Args&&... args):
+      Base(std::forward<Args>(args)...) {}
+
   // HTTPCodec::Callback methods
 
-  void onHeadersComplete(StreamID stream,
-                         std::unique_ptr<HTTPMessage> msg) override;
+  void onHeadersComplete(HTTPCodec::StreamID stream,
+                         std::unique_ptr<HTTPMessage> msg) override {
+    if (checkIngressHeaders(this->callback_, stream, *msg)) {
+      Base::onHeadersComplete(stream, std::move(msg));
+    }
+  }
 
   // HTTPCodec methods
 
   void generateHeader(folly::IOBufQueue& writeBuf,
-                      StreamID stream,
+                      HTTPCodec::StreamID stream,
                       const HTTPMessage& msg,
-                      StreamID assocStream,
+                      HTTPCodec::StreamID assocStream,
                       bool eom,
-                      HTTPHeaderSize* sizeOut) override;
+                      HTTPHeaderSize* sizeOut) override {
+    checkEgressHeaders(msg);
+    Base::generateHeader(writeBuf, stream, msg, assocStream, eom, sizeOut);
+  }
 };
 
+typedef HTTPChecksFilter<PassThroughHTTPCodecFilter> HTTPChecks;
+
 }
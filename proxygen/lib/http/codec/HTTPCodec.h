@@ -25,6 +25,24 @@ class HTTPMessage;
 class HTTPTransactionHandler;
 class HTTPErrorPage;
 
+namespace http2 {
+struct PriorityUpdate;
+}
+
+/**
+ * An alternative service advertised by the server: origin may also be
+ * reached with protocol at host:port, for maxAge seconds. An empty host
+ * is the host of the connection.
+ */
+struct AltSvc {
+  std::string protocol;
+  std::string host;
+  uint16_t port{0};
+  uint32_t maxAge{0};
+  // Empty if the advertisement is for the origin of its stream
+  std::string origin;
+};
+
 /**
  * Interface for a parser&generator that can translate between an internal
  * representation of an HTTP request and a wire format.  The details of the
@@ -162,7 +180,8 @@ class HTTPCodec {
      * @param stream_id The stream ID
      * @param flags     The flags field of frame header
      * @param length    The length field of frame header
-     * @param version   The version of frame (SPDY only)
+     * @param version   The version of control frames (SPDY), or the
+     *                  frame type (HTTP/2)
      * @note Not all protocols have frames. SPDY does, but HTTP/1.1 doesn't.
      */
     virtual void onFrameHeader(uint32_t stream_id,
@@ -213,6 +232,21 @@ class HTTPCodec {
      */
     virtual void onSettingsAck() {}
 
+    /**
+     * Called upon receipt of stream priority information, either in a
+     * HEADERS frame, in which case this is called just before
+     * onMessageBegin() for the stream, or in a PRIORITY frame. Only for
+     * protocols with a dependency tree, i.e. HTTP/2.
+     */
+    virtual void onPriority(StreamID stream,
+                            const http2::PriorityUpdate& pri) {}
+
+    /**
+     * Called upon receipt of an alternative service advertisement, such as
+     * an HTTP/2 ALTSVC frame, on stream or on the connection (stream 0).
+     */
+    virtual void onAltSvc(StreamID stream, const AltSvc& altSvc) {}
+
     /**
      * Return the number of open streams started by this codec callback.
      * Parallel codecs with a maximum number of streams will invoke this
@@ -487,10 +521,37 @@ class HTTPCodec {
    */
   virtual void setHeaderCodecStats(HeaderCodec::Stats* stats) {}
 
+  /**
+   * Bytes held by the header compression state of this codec, if the
+   * protocol compresses headers
+   */
+  virtual size_t getHeaderCompressionStateSize() const {
+    return 0;
+  }
+
+  /**
+   * Tells the header compression of this codec, if any, to hold on to as
+   * little memory as it can while pressure is true
+   */
+  virtual void setHeaderCompressionMemoryPressure(bool pressure) {}
+
+  /**
+   * Free the memory this codec can do without until the next message,
+   * while the connection has no transactions
+   */
+  virtual void releaseIdleMemory() {}
+
   /**
    * Get the identifier of the last stream started by the remote.
    */
   virtual StreamID getLastIncomingStreamID() const { return NoStream; }
+
+  /**
+   * Have the codec enforce the checks of HTTPChecks itself, as it parses
+   * and serializes headers, instead of an HTTPChecks filter. Returns false
+   * if this codec can't, and the filter is still needed.
+   */
+  virtual bool enableHTTPChecks() { return false; }
 };
 
 }
@@ -101,6 +101,16 @@ void PassThroughHTTPCodecFilter::onSettingsAck() {
   callback_->onSettingsAck();
 }
 
+void PassThroughHTTPCodecFilter::onPriority(StreamID stream,
+                                            const http2::PriorityUpdate& pri) {
+  callback_->onPriority(stream, pri);
+}
+
+void PassThroughHTTPCodecFilter::onAltSvc(StreamID stream,
+                                          const AltSvc& altSvc) {
+  callback_->onAltSvc(stream, altSvc);
+}
+
 uint32_t PassThroughHTTPCodecFilter::numOutgoingStreams() const {
   return callback_->numOutgoingStreams();
 }
@@ -273,9 +283,26 @@ void PassThroughHTTPCodecFilter::setHeaderCodecStats(
   call_->setHeaderCodecStats(stats);
 }
 
+size_t PassThroughHTTPCodecFilter::getHeaderCompressionStateSize() const {
+  return call_->getHeaderCompressionStateSize();
+}
+
+void PassThroughHTTPCodecFilter::setHeaderCompressionMemoryPressure(
+    bool pressure) {
+  call_->setHeaderCompressionMemoryPressure(pressure);
+}
+
+void PassThroughHTTPCodecFilter::releaseIdleMemory() {
+  call_->releaseIdleMemory();
+}
+
 HTTPCodec::StreamID
 PassThroughHTTPCodecFilter::getLastIncomingStreamID() const {
   return call_->getLastIncomingStreamID();
 }
 
+bool PassThroughHTTPCodecFilter::enableHTTPChecks() {
+  return call_->enableHTTPChecks();
+}
+
 }
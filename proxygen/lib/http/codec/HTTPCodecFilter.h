@@ -81,6 +81,11 @@ class PassThroughHTTPCodecFilter: public HTTPCodecFilter {
 
   void onSettingsAck() override;
 
+  void onPriority(StreamID stream,
+                  const http2::PriorityUpdate& pri) override;
+
+  void onAltSvc(StreamID stream, const AltSvc& altSvc) override;
+
   uint32_t numOutgoingStreams() const override;
 
   uint32_t numIncomingStreams() const override;
@@ -170,9 +175,17 @@ class PassThroughHTTPCodecFilter: public HTTPCodecFilter {
 
   void setHeaderCodecStats(HeaderCodec::Stats* stats) override;
 
+  size_t getHeaderCompressionStateSize() const override;
+
+  void setHeaderCompressionMemoryPressure(bool pressure) override;
+
+  void releaseIdleMemory() override;
+
   void enableDoubleGoawayDrain() override;
 
   HTTPCodec::StreamID getLastIncomingStreamID() const override;
+
+  bool enableHTTPChecks() override;
 };
 
 typedef FilterChain<
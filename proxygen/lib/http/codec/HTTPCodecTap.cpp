@@ -0,0 +1,223 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/http/codec/HTTPCodecTap.h>
+
+#include <folly/Bits.h>
+#include <glog/logging.h>
+#include <sstream>
+
+namespace proxygen {
+
+const char* HTTPCodecTap::getEventString(Event event) {
+  switch (event) {
+    case Event::FRAME_HEADER: return "FRAME_HEADER";
+    case Event::HEADERS: return "HEADERS";
+    case Event::BODY: return "BODY";
+    case Event::EOM: return "EOM";
+    case Event::ABORT: return "ABORT";
+    case Event::GOAWAY: return "GOAWAY";
+    case Event::PING_REQUEST: return "PING_REQUEST";
+    case Event::PING_REPLY: return "PING_REPLY";
+    case Event::WINDOW_UPDATE: return "WINDOW_UPDATE";
+    case Event::SETTINGS: return "SETTINGS";
+    case Event::SETTINGS_ACK: return "SETTINGS_ACK";
+    case Event::PRIORITY: return "PRIORITY";
+    case Event::ALTSVC: return "ALTSVC";
+    case Event::ERROR: return "ERROR";
+  }
+  return "UNKNOWN";
+}
+
+HTTPCodecTap::HTTPCodecTap(size_t capacity, bool dumpOnError)
+    : entries_(folly::nextPowTwo(std::max<size_t>(capacity, 1))),
+      mask_(entries_.size() - 1),
+      dumpOnError_(dumpOnError) {
+}
+
+std::vector<HTTPCodecTap::Entry> HTTPCodecTap::getEntries() const {
+  std::vector<Entry> entries;
+  uint64_t first = next_ > entries_.size() ? next_ - entries_.size() : 0;
+  entries.reserve(next_ - first);
+  for (uint64_t i = first; i < next_; ++i) {
+    entries.push_back(entries_[i & mask_]);
+  }
+  return entries;
+}
+
+void HTTPCodecTap::dump(std::ostream& os) const {
+  auto entries = getEntries();
+  for (const auto& entry: entries) {
+    os << "+" << (entry.time - entries.front().time).count() << "us "
+       << (entry.egress ? "out " : "in  ") << getEventString(entry.event)
+       << " stream=" << entry.stream << " length=" << entry.length;
+    if (entry.event == Event::FRAME_HEADER) {
+      os << " flags=0x" << std::hex << unsigned(entry.flags) << std::dec
+         << " type=" << unsigned(entry.type);
+    }
+    os << "\n";
+  }
+}
+
+void HTTPCodecTap::onHeadersComplete(StreamID stream,
+                                     std::unique_ptr<HTTPMessage> msg) {
+  record(Event::HEADERS, false, stream,
+         msg->getIngressHeaderSize().compressed);
+  callback_->onHeadersComplete(stream, std::move(msg));
+}
+
+void HTTPCodecTap::onBody(StreamID stream,
+                          std::unique_ptr<folly::IOBuf> chain,
+                          uint16_t padding) {
+  record(Event::BODY, false, stream, chain->computeChainDataLength());
+  callback_->onBody(stream, std::move(chain), padding);
+}
+
+void HTTPCodecTap::onMessageComplete(StreamID stream, bool upgrade) {
+  record(Event::EOM, false, stream, 0);
+  callback_->onMessageComplete(stream, upgrade);
+}
+
+void HTTPCodecTap::onFrameHeader(uint32_t stream_id,
+                                 uint8_t flags,
+                                 uint32_t length,
+                                 uint16_t version) {
+  record(Event::FRAME_HEADER, false, stream_id, length, flags,
+         uint8_t(version));
+  callback_->onFrameHeader(stream_id, flags, length, version);
+}
+
+void HTTPCodecTap::onError(StreamID stream,
+                           const HTTPException& error,
+                           bool newStream) {
+  record(Event::ERROR, false, stream,
+         error.hasCodecStatusCode() ?
+         uint32_t(error.getCodecStatusCode()) : 0);
+  if (dumpOnError_ && stream == 0) {
+    std::ostringstream os;
+    dump(os);
+    LOG(ERROR) << "Connection error: " << error.what()
+               << ", last frames:\n" << os.str();
+  }
+  callback_->onError(stream, error, newStream);
+}
+
+void HTTPCodecTap::onAbort(StreamID stream, ErrorCode code) {
+  record(Event::ABORT, false, stream, uint32_t(code));
+  callback_->onAbort(stream, code);
+}
+
+void HTTPCodecTap::onGoaway(uint64_t lastGoodStreamID, ErrorCode code) {
+  record(Event::GOAWAY, false, lastGoodStreamID, uint32_t(code));
+  callback_->onGoaway(lastGoodStreamID, code);
+}
+
+void HTTPCodecTap::onPingRequest(uint64_t uniqueID) {
+  record(Event::PING_REQUEST, false, 0, 0);
+  callback_->onPingRequest(uniqueID);
+}
+
+void HTTPCodecTap::onPingReply(uint64_t uniqueID) {
+  record(Event::PING_REPLY, false, 0, 0);
+  callback_->onPingReply(uniqueID);
+}
+
+void HTTPCodecTap::onWindowUpdate(StreamID stream, uint32_t amount) {
+  record(Event::WINDOW_UPDATE, false, stream, amount);
+  callback_->onWindowUpdate(stream, amount);
+}
+
+void HTTPCodecTap::onSettings(const SettingsList& settings) {
+  record(Event::SETTINGS, false, 0, settings.size());
+  callback_->onSettings(settings);
+}
+
+void HTTPCodecTap::onSettingsAck() {
+  record(Event::SETTINGS_ACK, false, 0, 0);
+  callback_->onSettingsAck();
+}
+
+void HTTPCodecTap::onPriority(StreamID stream,
+                              const http2::PriorityUpdate& pri) {
+  record(Event::PRIORITY, false, stream, 0);
+  callback_->onPriority(stream, pri);
+}
+
+void HTTPCodecTap::onAltSvc(StreamID stream, const AltSvc& altSvc) {
+  record(Event::ALTSVC, false, stream, altSvc.port);
+  callback_->onAltSvc(stream, altSvc);
+}
+
+void HTTPCodecTap::generateHeader(folly::IOBufQueue& writeBuf,
+                                  StreamID stream,
+                                  const HTTPMessage& msg,
+                                  StreamID assocStream,
+                                  bool eom,
+                                  HTTPHeaderSize* size) {
+  auto before = writeBuf.chainLength();
+  call_->generateHeader(writeBuf, stream, msg, assocStream, eom, size);
+  record(Event::HEADERS, true, stream, writeBuf.chainLength() - before);
+}
+
+size_t HTTPCodecTap::generateBody(folly::IOBufQueue& writeBuf,
+                                  StreamID stream,
+                                  std::unique_ptr<folly::IOBuf> chain,
+                                  boost::optional<uint8_t> padding,
+                                  bool eom) {
+  auto bytes = call_->generateBody(writeBuf, stream, std::move(chain),
+                                   padding, eom);
+  record(Event::BODY, true, stream, bytes);
+  return bytes;
+}
+
+size_t HTTPCodecTap::generateEOM(folly::IOBufQueue& writeBuf,
+                                 StreamID stream) {
+  auto bytes = call_->generateEOM(writeBuf, stream);
+  record(Event::EOM, true, stream, bytes);
+  return bytes;
+}
+
+size_t HTTPCodecTap::generateRstStream(folly::IOBufQueue& writeBuf,
+                                       StreamID stream,
+                                       ErrorCode statusCode) {
+  record(Event::ABORT, true, stream, uint32_t(statusCode));
+  return call_->generateRstStream(writeBuf, stream, statusCode);
+}
+
+size_t HTTPCodecTap::generateGoaway(folly::IOBufQueue& writeBuf,
+                                    StreamID lastStream,
+                                    ErrorCode statusCode) {
+  record(Event::GOAWAY, true, lastStream, uint32_t(statusCode));
+  return call_->generateGoaway(writeBuf, lastStream, statusCode);
+}
+
+size_t HTTPCodecTap::generatePingRequest(folly::IOBufQueue& writeBuf) {
+  record(Event::PING_REQUEST, true, 0, 0);
+  return call_->generatePingRequest(writeBuf);
+}
+
+size_t HTTPCodecTap::generatePingReply(folly::IOBufQueue& writeBuf,
+                                       uint64_t uniqueID) {
+  record(Event::PING_REPLY, true, 0, 0);
+  return call_->generatePingReply(writeBuf, uniqueID);
+}
+
+size_t HTTPCodecTap::generateSettings(folly::IOBufQueue& writeBuf) {
+  record(Event::SETTINGS, true, 0, 0);
+  return call_->generateSettings(writeBuf);
+}
+
+size_t HTTPCodecTap::generateWindowUpdate(folly::IOBufQueue& writeBuf,
+                                          StreamID stream,
+                                          uint32_t delta) {
+  record(Event::WINDOW_UPDATE, true, stream, delta);
+  return call_->generateWindowUpdate(writeBuf, stream, delta);
+}
+
+}
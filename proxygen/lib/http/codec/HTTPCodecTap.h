@@ -0,0 +1,151 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <proxygen/lib/http/codec/HTTPCodecFilter.h>
+#include <proxygen/lib/utils/Time.h>
+
+#include <ostream>
+#include <vector>
+
+namespace proxygen {
+
+/**
+ * A filter that keeps the last frames and messages that went through the
+ * codec in a ring buffer, in both directions, as a few bytes of metadata
+ * each rather than their contents, so that it can stay on in production.
+ * dump() prints them, oldest first; connection errors log them by
+ * default. Put it next to the codec, so it sees what the codec does,
+ * before other filters change it.
+ */
+class HTTPCodecTap: public PassThroughHTTPCodecFilter {
+ public:
+  enum class Event : uint8_t {
+    FRAME_HEADER,
+    HEADERS,
+    BODY,
+    EOM,
+    ABORT,
+    GOAWAY,
+    PING_REQUEST,
+    PING_REPLY,
+    WINDOW_UPDATE,
+    SETTINGS,
+    SETTINGS_ACK,
+    PRIORITY,
+    ALTSVC,
+    ERROR,
+  };
+
+  static const char* getEventString(Event event);
+
+  struct Entry {
+    // On the steady clock
+    std::chrono::microseconds time;
+    uint32_t stream;
+    // Bytes, or what the event has instead: the ErrorCode of ABORT, GOAWAY
+    // and ERROR, the credit of WINDOW_UPDATE, the number of SETTINGS, the
+    // port of ALTSVC
+    uint32_t length;
+    Event event;
+    bool egress;
+    // Of FRAME_HEADER: the flags, and the frame type on HTTP/2 or the
+    // version of control frames on SPDY
+    uint8_t flags;
+    uint8_t type;
+  };
+
+  /**
+   * Keeps the last capacity entries, rounded up to a power of two. With
+   * dumpOnError, errors of the whole connection log them.
+   */
+  explicit HTTPCodecTap(size_t capacity, bool dumpOnError = true);
+
+  // The entries kept, oldest first
+  std::vector<Entry> getEntries() const;
+
+  // One line per entry, timed from the oldest
+  void dump(std::ostream& os) const;
+
+  // HTTPCodec::Callback methods
+  void onHeadersComplete(StreamID stream,
+                         std::unique_ptr<HTTPMessage> msg) override;
+  void onBody(StreamID stream,
+              std::unique_ptr<folly::IOBuf> chain,
+              uint16_t padding) override;
+  void onMessageComplete(StreamID stream, bool upgrade) override;
+  void onFrameHeader(uint32_t stream_id,
+                     uint8_t flags,
+                     uint32_t length,
+                     uint16_t version = 0) override;
+  void onError(StreamID stream,
+               const HTTPException& error,
+               bool newStream = false) override;
+  void onAbort(StreamID stream, ErrorCode code) override;
+  void onGoaway(uint64_t lastGoodStreamID, ErrorCode code) override;
+  void onPingRequest(uint64_t uniqueID) override;
+  void onPingReply(uint64_t uniqueID) override;
+  void onWindowUpdate(StreamID stream, uint32_t amount) override;
+  void onSettings(const SettingsList& settings) override;
+  void onSettingsAck() override;
+  void onPriority(StreamID stream,
+                  const http2::PriorityUpdate& pri) override;
+  void onAltSvc(StreamID stream, const AltSvc& altSvc) override;
+
+  // HTTPCodec methods
+  void generateHeader(folly::IOBufQueue& writeBuf,
+                      StreamID stream,
+                      const HTTPMessage& msg,
+                      StreamID assocStream,
+                      bool eom,
+                      HTTPHeaderSize* size) override;
+  size_t generateBody(folly::IOBufQueue& writeBuf,
+                      StreamID stream,
+                      std::unique_ptr<folly::IOBuf> chain,
+                      boost::optional<uint8_t> padding,
+                      bool eom) override;
+  size_t generateEOM(folly::IOBufQueue& writeBuf,
+                     StreamID stream) override;
+  size_t generateRstStream(folly::IOBufQueue& writeBuf,
+                           StreamID stream,
+                           ErrorCode statusCode) override;
+  size_t generateGoaway(folly::IOBufQueue& writeBuf,
+                        StreamID lastStream,
+                        ErrorCode statusCode) override;
+  size_t generatePingRequest(folly::IOBufQueue& writeBuf) override;
+  size_t generatePingReply(folly::IOBufQueue& writeBuf,
+                           uint64_t uniqueID) override;
+  size_t generateSettings(folly::IOBufQueue& writeBuf) override;
+  size_t generateWindowUpdate(folly::IOBufQueue& writeBuf,
+                              StreamID stream,
+                              uint32_t delta) override;
+
+ private:
+  void record(Event event, bool egress, uint64_t stream, uint64_t length,
+              uint8_t flags = 0, uint8_t type = 0) {
+    auto& entry = entries_[next_++ & mask_];
+    entry.time = std::chrono::duration_cast<std::chrono::microseconds>(
+      getCurrentTime().time_since_epoch());
+    entry.stream = uint32_t(stream);
+    entry.length = uint32_t(length);
+    entry.event = event;
+    entry.egress = egress;
+    entry.flags = flags;
+    entry.type = type;
+  }
+
+  std::vector<Entry> entries_;
+  const size_t mask_;
+  // Entries recorded so far
+  uint64_t next_{0};
+  const bool dumpOnError_;
+};
+
+}
@@ -20,10 +20,13 @@
 #include <iostream>
 #include <proxygen/lib/http/HTTPHeaderSize.h>
 #include <proxygen/lib/http/HTTPMessage.h>
+#include <proxygen/lib/http/HeaderTemplate.h>
 #include <proxygen/lib/http/codec/CodecDictionaries.h>
+#include <proxygen/lib/http/codec/HTTPChecks.h>
 #include <proxygen/lib/http/codec/SPDYUtil.h>
 #include <proxygen/lib/http/codec/compress/GzipHeaderCodec.h>
 #include <proxygen/lib/http/codec/compress/HPACKCodec.h>
+#include <proxygen/lib/utils/AllocStats.h>
 #include <proxygen/lib/utils/ParseURL.h>
 #include <proxygen/lib/utils/UtilInl.h>
 #include <vector>
@@ -76,6 +79,14 @@ const size_t kMaxUncompressed = 1 << 17;   // 128kb should be enough for anyone
 /* The number of bytes of the frame header. */
 #define FRAME_HEADER_LEN 8
 
+#define RETURN_IF_PARSE_ERROR(expr)             \
+  {                                             \
+    auto parseErr = (expr);                     \
+    if (parseErr) {                             \
+      return parseErr;                          \
+    }                                           \
+  }
+
 // SPDY flags
 const uint8_t kFlagFin = 0x01;
 
@@ -122,37 +133,6 @@ uint32_t parseUint32(Cursor* cursor) {
   return cursor->readBE<uint32_t>();
 }
 
-class SPDYSessionFailed : public std::exception {
- public:
-  explicit SPDYSessionFailed(spdy::GoawayStatusCode inStatus)
-      : statusCode(inStatus) {}
-
-  spdy::GoawayStatusCode statusCode;
-};
-
-class SPDYStreamFailed : public std::exception {
- public:
-  SPDYStreamFailed(bool inIsNew, uint32_t inStreamID,
-                   uint32_t inStatus,
-                   const std::string& inMsg = empty_string)
-      : isNew(inIsNew),
-        streamID(inStreamID),
-        statusCode(inStatus) {
-    message = folly::to<std::string>("new=", isNew, " streamID=", streamID,
-                                     " statusCode=", statusCode, " message=",
-                                     inMsg);
-  }
-
-  ~SPDYStreamFailed() throw() override {}
-
-  const char* what() const throw() override { return message.c_str(); }
-
-  bool isNew;
-  uint32_t streamID;
-  uint32_t statusCode;
-  std::string message;
-};
-
 } // anonynous namespace
 
 std::bitset<256> SPDYCodec::perHopHeaderCodes_;
@@ -209,12 +189,16 @@ const SPDYVersionSettings& SPDYCodec::getVersionSettings(SPDYVersion version) {
 }
 
 SPDYCodec::SPDYCodec(TransportDirection direction, SPDYVersion version,
-                     int spdyCompressionLevel /* = Z_NO_COMPRESSION */)
+                     int spdyCompressionLevel /* = Z_NO_COMPRESSION */,
+                     int spdyCompressionWindowBits,
+                     int spdyCompressionMemLevel)
   : versionSettings_(getVersionSettings(version)),
     transportDirection_(direction),
     frameState_(FrameState::FRAME_HEADER),
     sessionClosing_(ClosingState::OPEN),
-    ctrl_(false) {
+    ctrl_(false),
+    headerPrefixParsed_(false),
+    httpChecks_(false) {
   VLOG(4) << "creating SPDY/" << static_cast<int>(versionSettings_.majorVersion)
           << "." << static_cast<int>(versionSettings_.minorVersion)
           << " codec";
@@ -222,7 +206,8 @@ SPDYCodec::SPDYCodec(TransportDirection direction, SPDYVersion version,
     headerCodec_ = folly::make_unique<HPACKCodec>(transportDirection_);
   } else {
     headerCodec_ = folly::make_unique<GzipHeaderCodec>(
-      spdyCompressionLevel, versionSettings_);
+      spdyCompressionLevel, versionSettings_, spdyCompressionWindowBits,
+      spdyCompressionMemLevel);
   }
   // Limit uncompressed headers to 128kb
   headerCodec_->setMaxUncompressed(kMaxUncompressed);
@@ -286,34 +271,37 @@ void SPDYCodec::setParserPaused(bool paused) {
   // Not applicable
 }
 
-void SPDYCodec::checkLength(uint32_t expectedLength, const std::string& msg) {
+SPDYCodec::ParseError SPDYCodec::checkLength(uint32_t expectedLength,
+                                             const char* msg) {
   if (length_ != expectedLength) {
     LOG(ERROR) << msg << ": invalid length " << length_ << " != " <<
       expectedLength;
-    throw SPDYSessionFailed(spdy::GOAWAY_PROTOCOL_ERROR);
+    return ParseError::session(spdy::GOAWAY_PROTOCOL_ERROR);
   }
+  return ParseError();
 }
 
-void SPDYCodec::checkMinLength(uint32_t minLength, const std::string& msg) {
+SPDYCodec::ParseError SPDYCodec::checkMinLength(uint32_t minLength,
+                                                const char* msg) {
   if (length_ < minLength) {
     LOG(ERROR) << msg << ": invalid length " << length_ << " < " << minLength;
-    throw SPDYSessionFailed(spdy::GOAWAY_PROTOCOL_ERROR);
+    return ParseError::session(spdy::GOAWAY_PROTOCOL_ERROR);
   }
+  return ParseError();
 }
 
 size_t SPDYCodec::onIngress(const folly::IOBuf& buf) {
-  size_t bytesParsed = 0;
   currentIngressBuf_ = &buf;
-  try {
-    bytesParsed = parseIngress(buf);
-  } catch (const SPDYSessionFailed& ex) {
-    failSession(ex.statusCode);
-    bytesParsed = buf.computeChainDataLength();
+  auto result = parseIngress(buf);
+  if (result.isError()) {
+    failSession(result.error());
+    return buf.computeChainDataLength();
   }
-  return bytesParsed;
+  return result.ok();
 }
 
-size_t SPDYCodec::parseIngress(const folly::IOBuf& buf) {
+Result<size_t, spdy::GoawayStatusCode>
+SPDYCodec::parseIngress(const folly::IOBuf& buf) {
   const size_t chainLength = buf.computeChainDataLength();
   Cursor cursor(&buf);
   size_t avail = cursor.totalLength();
@@ -332,7 +320,7 @@ size_t SPDYCodec::parseIngress(const folly::IOBuf& buf) {
         type_  = cursor.readBE<uint16_t>();
         if (version_ != versionSettings_.majorVersion) {
           LOG(ERROR) << "Invalid version=" << version_;
-          throw SPDYSessionFailed(spdy::GOAWAY_PROTOCOL_ERROR);
+          return spdy::GOAWAY_PROTOCOL_ERROR;
         }
       } else {
         streamId_ = cursor.readBE<uint32_t>() & STREAM_ID_MASK;
@@ -354,7 +342,7 @@ size_t SPDYCodec::parseIngress(const folly::IOBuf& buf) {
           // and a settings frame would have > 1023 pairs, of which none are
           // allowed to be duplicates. Just fail everything.
           LOG(ERROR) << "excessive frame size length_=" << length_;
-          throw SPDYSessionFailed(spdy::GOAWAY_PROTOCOL_ERROR);
+          return spdy::GOAWAY_PROTOCOL_ERROR;
         }
         frameState_ = FrameState::CTRL_FRAME_DATA;
         callback_->onFrameHeader(0, flags_, length_, version_);
@@ -364,16 +352,26 @@ size_t SPDYCodec::parseIngress(const folly::IOBuf& buf) {
       }
     } else if (frameState_ == FrameState::CTRL_FRAME_DATA) {
       if (avail < length_) {
-        // Make the caller buffer the rest of the control frame.
-        // We could attempt to decompress incomplete name/value blocks,
-        // but for now we're favoring simplicity.
         VLOG(6) << "Need more data: length_=" << length_ << " avail=" << avail;
+        auto err = onPartialControlFrame(cursor);
+        if (err) {
+          // Nothing but inflating the header block can fail this early
+          DCHECK(err.scope == ParseError::Scope::SESSION);
+          return spdy::GoawayStatusCode(err.statusCode);
+        }
+        // Anything left is for the caller to buffer
         break;
       }
-      try {
-        onControlFrame(cursor);
-      } catch (const SPDYStreamFailed& ex) {
-        failStream(ex.isNew, ex.streamID, ex.statusCode, ex.what());
+      auto err = onControlFrame(cursor);
+      headerPrefixParsed_ = false;
+      if (err.scope == ParseError::Scope::SESSION) {
+        return spdy::GoawayStatusCode(err.statusCode);
+      } else if (err) {
+        failStream(err.isNew, err.streamID, err.statusCode,
+                   folly::to<std::string>(
+                     "new=", err.isNew, " streamID=", err.streamID,
+                     " statusCode=", err.statusCode,
+                     " message=", err.message));
       }
       frameState_ = FrameState::FRAME_HEADER;
     } else if (avail > 0 || length_ == 0) {
@@ -384,6 +382,7 @@ size_t SPDYCodec::parseIngress(const folly::IOBuf& buf) {
         std::numeric_limits<uint32_t>::max() : static_cast<uint32_t>(avail);
       toClone = std::min(toClone, length_);
       std::unique_ptr<IOBuf> chunk;
+      countIOBufClones();
       cursor.clone(chunk, toClone);
       callback_->onBody(StreamID(streamId_), std::move(chunk), 0);
       length_ -= toClone;
@@ -400,40 +399,111 @@ size_t SPDYCodec::parseIngress(const folly::IOBuf& buf) {
   return chainLength - avail;
 }
 
-void SPDYCodec::onControlFrame(Cursor& cursor) {
+SPDYCodec::ParseError SPDYCodec::parseHeaderFramePrefix(Cursor& cursor) {
+  if (headerPrefixParsed_) {
+    return ParseError();
+  }
   switch (type_) {
     case spdy::SYN_STREAM:
-    {
-      checkMinLength(kFrameSizeSynStream, "SYN_STREAM");
+      RETURN_IF_PARSE_ERROR(checkMinLength(kFrameSizeSynStream, "SYN_STREAM"));
       streamId_ = cursor.readBE<uint32_t>() & STREAM_ID_MASK;
-      uint32_t assocStream = cursor.readBE<uint32_t>();
-      uint8_t pri = cursor.read<uint8_t>() >> versionSettings_.priShift;
-      uint8_t slot = cursor.read<uint8_t>();
+      synAssocStream_ = cursor.readBE<uint32_t>();
+      synPri_ = cursor.read<uint8_t>() >> versionSettings_.priShift;
+      synSlot_ = cursor.read<uint8_t>();
       length_ -= kFrameSizeSynStream;
-      auto result = decodeHeaders(cursor);
-      checkLength(0, "SYN_STREAM");
-      onSynStream(assocStream, pri, slot,
-                  result.headers, headerCodec_->getDecodedSize());
       break;
-    }
     case spdy::SYN_REPLY:
-    {
-      checkMinLength(versionSettings_.synReplySize, "SYN_REPLY");
+      RETURN_IF_PARSE_ERROR(checkMinLength(versionSettings_.synReplySize,
+                                           "SYN_REPLY"));
       streamId_ = cursor.readBE<uint32_t>() & STREAM_ID_MASK;
       length_ -= versionSettings_.synReplySize;
       if (version_ == 2) {
         // 2 byte unused
         cursor.skip(2);
       }
-      auto result = decodeHeaders(cursor);
-      checkLength(0, "SYN_REPLY");
-      onSynReply(result.headers,
-                 headerCodec_->getDecodedSize());
       break;
+    case spdy::HEADERS:
+      // Note: this is for the HEADERS frame type, not the initial headers
+      RETURN_IF_PARSE_ERROR(checkMinLength(kFrameSizeHeaders, "HEADERS"));
+      streamId_ = cursor.readBE<uint32_t>() & STREAM_ID_MASK;
+      length_ -= kFrameSizeHeaders;
+      if (version_ == 2) {
+        // 2 byte unused
+        cursor.skip(2);
+        length_ -= 2;
+      }
+      break;
+    default:
+      LOG(FATAL) << "No header block in frame type " << type_;
+  }
+  headerPrefixParsed_ = true;
+  return ParseError();
+}
+
+SPDYCodec::ParseError SPDYCodec::onPartialControlFrame(Cursor& cursor) {
+  if (type_ != spdy::SYN_STREAM && type_ != spdy::SYN_REPLY &&
+      type_ != spdy::HEADERS) {
+    return ParseError();
+  }
+  if (!headerCodec_->supportsPartialDecode()) {
+    return ParseError();
+  }
+  if (!headerPrefixParsed_) {
+    // The fields ahead of the header block are read in one go
+    uint32_t prefixLength = kFrameSizeHeaders;
+    if (type_ == spdy::SYN_STREAM) {
+      prefixLength = kFrameSizeSynStream;
+    } else if (type_ == spdy::SYN_REPLY) {
+      prefixLength = versionSettings_.synReplySize;
+    } else if (version_ == 2) {
+      prefixLength += 2;
+    }
+    if (length_ < prefixLength || cursor.totalLength() < prefixLength) {
+      return ParseError();
+    }
+    RETURN_IF_PARSE_ERROR(parseHeaderFramePrefix(cursor));
+  }
+
+  uint32_t avail = cursor.totalLength();
+  DCHECK_LT(avail, length_);
+  if (avail == 0) {
+    return ParseError();
+  }
+  auto err = headerCodec_->decodePartial(cursor, avail);
+  if (err != HeaderDecodeError::NONE) {
+    return headerDecodeError(err);
+  }
+  length_ -= avail;
+  return ParseError();
+}
+
+SPDYCodec::ParseError SPDYCodec::onControlFrame(Cursor& cursor) {
+  switch (type_) {
+    case spdy::SYN_STREAM:
+    {
+      RETURN_IF_PARSE_ERROR(parseHeaderFramePrefix(cursor));
+      auto result = decodeHeaders(cursor);
+      if (result.isError()) {
+        return std::move(result.error());
+      }
+      RETURN_IF_PARSE_ERROR(checkLength(0, "SYN_STREAM"));
+      return onSynStream(synAssocStream_, synPri_, synSlot_,
+                         result.ok().headers, headerCodec_->getDecodedSize());
+    }
+    case spdy::SYN_REPLY:
+    {
+      RETURN_IF_PARSE_ERROR(parseHeaderFramePrefix(cursor));
+      auto result = decodeHeaders(cursor);
+      if (result.isError()) {
+        return std::move(result.error());
+      }
+      RETURN_IF_PARSE_ERROR(checkLength(0, "SYN_REPLY"));
+      return onSynReply(result.ok().headers,
+                        headerCodec_->getDecodedSize());
     }
     case spdy::RST_STREAM:
     {
-      checkLength(kFrameSizeRstStream, "RST");
+      RETURN_IF_PARSE_ERROR(checkLength(kFrameSizeRstStream, "RST"));
       streamId_ = cursor.readBE<uint32_t>() & STREAM_ID_MASK;
       uint32_t statusCode = cursor.readBE<uint32_t>();
       onRstStream(statusCode);
@@ -441,13 +511,13 @@ void SPDYCodec::onControlFrame(Cursor& cursor) {
     }
     case spdy::SETTINGS:
     {
-      checkMinLength(kFrameSizeSettings, "SETTINGS");
+      RETURN_IF_PARSE_ERROR(checkMinLength(kFrameSizeSettings, "SETTINGS"));
       uint32_t numSettings = cursor.readBE<uint32_t>();
       length_ -= sizeof(uint32_t);
       if (length_ / 8 < numSettings) {
         LOG(ERROR) << "SETTINGS: number of settings to high. "
                    << length_ << " < 8 * " << numSettings;
-        throw SPDYSessionFailed(spdy::GOAWAY_PROTOCOL_ERROR);
+        return ParseError::session(spdy::GOAWAY_PROTOCOL_ERROR);
       }
       SettingList settings;
       for (uint32_t i = 0; i < numSettings; i++) {
@@ -462,23 +532,22 @@ void SPDYCodec::onControlFrame(Cursor& cursor) {
         id &= ~FLAGS_MASK;
         settings.emplace_back(flags, id, value);
       }
-      onSettings(settings);
-      break;
+      return onSettings(settings);
     }
     case spdy::NOOP:
       VLOG(4) << "Noop received. Doing nothing.";
-      checkLength(0, "NOOP");
-      break;
+      return checkLength(0, "NOOP");
     case spdy::PING:
     {
-      checkLength(kFrameSizePing, "PING");
+      RETURN_IF_PARSE_ERROR(checkLength(kFrameSizePing, "PING"));
       uint32_t unique_id = cursor.readBE<uint32_t>();
       onPing(unique_id);
       break;
     }
     case spdy::GOAWAY:
     {
-      checkLength(versionSettings_.goawaySize, "GOAWAY");
+      RETURN_IF_PARSE_ERROR(checkLength(versionSettings_.goawaySize,
+                                        "GOAWAY"));
       uint32_t lastStream = cursor.readBE<uint32_t>();
       uint32_t statusCode = 0;
       if (version_ == 3) {
@@ -489,23 +558,19 @@ void SPDYCodec::onControlFrame(Cursor& cursor) {
     }
     case spdy::HEADERS:
     {
-      // Note: this is for the HEADERS frame type, not the initial headers
-      checkMinLength(kFrameSizeHeaders, "HEADERS");
-      streamId_ = cursor.readBE<uint32_t>() & STREAM_ID_MASK;
-      length_ -= kFrameSizeHeaders;
-      if (version_ == 2) {
-        // 2 byte unused
-        cursor.skip(2);
-        length_ -= 2;
-      }
+      RETURN_IF_PARSE_ERROR(parseHeaderFramePrefix(cursor));
       auto result = decodeHeaders(cursor);
-      checkLength(0, "HEADERS");
-      onHeaders(result.headers);
+      if (result.isError()) {
+        return std::move(result.error());
+      }
+      RETURN_IF_PARSE_ERROR(checkLength(0, "HEADERS"));
+      onHeaders(result.ok().headers);
       break;
     }
     case spdy::WINDOW_UPDATE:
     {
-      checkLength(kFrameSizeWindowUpdate, "WINDOW_UPDATE");
+      RETURN_IF_PARSE_ERROR(checkLength(kFrameSizeWindowUpdate,
+                                        "WINDOW_UPDATE"));
       streamId_ = cursor.readBE<uint32_t>() & STREAM_ID_MASK;
       uint32_t delta = cursor.readBE<uint32_t>() & DELTA_WINDOW_SIZE_MASK;
       onWindowUpdate(delta);
@@ -527,33 +592,39 @@ void SPDYCodec::onControlFrame(Cursor& cursor) {
       // Consume rest of the frame to skip processing it further
       cursor.skip(length_);
       length_ = 0;
-      return;
+      break;
   }
+  return ParseError();
 }
 
-HeaderDecodeResult SPDYCodec::decodeHeaders(Cursor& cursor) {
+Result<HeaderDecodeResult, SPDYCodec::ParseError>
+SPDYCodec::decodeHeaders(Cursor& cursor) {
   auto result = headerCodec_->decode(cursor, length_);
   if (result.isError()) {
-    auto err = result.error();
-    if (err == HeaderDecodeError::HEADERS_TOO_LARGE ||
-        err == HeaderDecodeError::INFLATE_DICTIONARY ||
-        err == HeaderDecodeError::BAD_ENCODING) {
-      // Fail stream only for FRAME_TOO_LARGE error
-      if (err == HeaderDecodeError::HEADERS_TOO_LARGE) {
-        failStream(true, streamId_, spdy::RST_FRAME_TOO_LARGE);
-      }
-      throw SPDYSessionFailed(spdy::GOAWAY_PROTOCOL_ERROR);
-    }
-    // For other types of errors we throw a stream error
-    bool newStream = (type_ != spdy::HEADERS);
-    throw SPDYStreamFailed(newStream, streamId_, spdy::RST_PROTOCOL_ERROR,
-                           "Error parsing header: " + folly::to<string>(err));
+    return headerDecodeError(result.error());
   }
 
   length_ -= result.ok().bytesConsumed;
   return result.ok();
 }
 
+SPDYCodec::ParseError SPDYCodec::headerDecodeError(HeaderDecodeError err) {
+  if (err == HeaderDecodeError::HEADERS_TOO_LARGE ||
+      err == HeaderDecodeError::INFLATE_DICTIONARY ||
+      err == HeaderDecodeError::BAD_ENCODING) {
+    // Fail stream only for FRAME_TOO_LARGE error
+    if (err == HeaderDecodeError::HEADERS_TOO_LARGE) {
+      failStream(true, streamId_, spdy::RST_FRAME_TOO_LARGE);
+    }
+    return ParseError::session(spdy::GOAWAY_PROTOCOL_ERROR);
+  }
+  // For other types of errors we fail only the stream
+  bool newStream = (type_ != spdy::HEADERS);
+  return ParseError::stream(newStream, streamId_, spdy::RST_PROTOCOL_ERROR,
+                            "Error parsing header: " +
+                            folly::to<string>(err));
+}
+
 void SPDYCodec::onIngressEOF() {
   // SPDY does not report errors for partial frames
 }
@@ -615,6 +686,15 @@ unique_ptr<IOBuf> SPDYCodec::encodeHeaders(
     }
     allHeaders.emplace_back(code, name, value);
   });
+  if (auto headerTemplate = msg.getHeaderTemplate()) {
+    // Already classified, and free of per-hop headers
+    for (const auto& header : headerTemplate->getHeaders()) {
+      if (versionSettings_.majorVersion == 2 && header.value->empty()) {
+        continue;
+      }
+      allHeaders.push_back(header);
+    }
+  }
 
   headerCodec_->setEncodeHeadroom(headroom);
   auto out = headerCodec_->encode(allHeaders);
@@ -706,9 +786,21 @@ void SPDYCodec::generateHeader(folly::IOBufQueue& writeBuf,
                                StreamID assocStream,
                                bool eom,
                                HTTPHeaderSize* size) {
+  if (httpChecks_) {
+    HTTPChecksBase::checkEgressHeaders(msg);
+  }
   if (transportDirection_ == TransportDirection::UPSTREAM ||
       assocStream != HTTPCodec::NoStream) {
     generateSynStream(stream, assocStream, writeBuf, msg, eom, size);
+  } else if (msg.is1xxResponse()) {
+    // A stream has a single SYN_REPLY, there is no room for informational
+    // responses ahead of it
+    VLOG(4) << "Dropping " << msg.getStatusCode() << " response on stream="
+            << stream;
+    if (size) {
+      size->compressed = 0;
+      size->uncompressed = 0;
+    }
   } else {
     generateSynReply(stream, writeBuf, msg, eom, size);
   }
@@ -1063,12 +1155,14 @@ size_t SPDYCodec::generateDataFrame(folly::IOBufQueue& writeBuf,
   return kFrameSizeDataCommon + length;
 }
 
-unique_ptr<HTTPMessage>
+Result<unique_ptr<HTTPMessage>, SPDYCodec::ParseError>
 SPDYCodec::parseHeaders(TransportDirection direction, StreamID streamID,
                         StreamID assocStreamID,
                         const HeaderPieceList& inHeaders) {
   unique_ptr<HTTPMessage> msg(new HTTPMessage());
   HTTPHeaders& headers = msg->getHeaders();
+  // one slot per name/value pair, and a couple more for the ones added below
+  headers.reserve(inHeaders.size() / 2 + 2);
   bool newStream = (type_ != spdy::HEADERS);
 
   bool hasScheme = false;
@@ -1116,7 +1210,7 @@ SPDYCodec::parseHeaders(TransportDirection direction, StreamID streamID,
         }
       }
       partialMsg_ = std::move(msg);
-      throw SPDYStreamFailed(false, streamID, 400, "Bad header value");
+      return ParseError::stream(false, streamID, 400, "Bad header value");
     }
     bool add = false;
     if (off || version_ == 2) {
@@ -1153,14 +1247,18 @@ SPDYCodec::parseHeaders(TransportDirection direction, StreamID streamID,
           }
           if (code >= 100 && code <= 999) {
             msg->setStatusCode(code);
-            msg->setStatusMessage(reasonPiece.str());
+            if (reasonPiece == HTTPMessage::getDefaultReason(code)) {
+              msg->setDefaultStatusMessage();
+            } else {
+              msg->setStatusMessage(reasonPiece.str());
+            }
           } else {
             msg->setStatusCode(0);
             headers.add(name, value);
             partialMsg_ = std::move(msg);
-            throw SPDYStreamFailed(newStream, streamID,
-                                   spdy::RST_PROTOCOL_ERROR,
-                                  "Invalid status code");
+            return ParseError::stream(newStream, streamID,
+                                      spdy::RST_PROTOCOL_ERROR,
+                                      "Invalid status code");
           }
         } else if (!assocStreamID) {
           if (version_ == 2) {
@@ -1177,8 +1275,9 @@ SPDYCodec::parseHeaders(TransportDirection direction, StreamID streamID,
       if (!inHeaders[i].isMultiValued() && headers.exists(name)) {
         headers.add(name, value);
         partialMsg_ = std::move(msg);
-        throw SPDYStreamFailed(newStream, streamID, spdy::RST_PROTOCOL_ERROR,
-                               "Duplicate header value");
+        return ParseError::stream(newStream, streamID,
+                                  spdy::RST_PROTOCOL_ERROR,
+                                  "Duplicate header value");
       }
       headers.add(name, value);
     }
@@ -1186,7 +1285,7 @@ SPDYCodec::parseHeaders(TransportDirection direction, StreamID streamID,
   if (assocStreamID &&
       (!headers.exists(HTTP_HEADER_HOST) || !hasScheme || !hasPath)) {
     // Fail a server push without host, scheme or path headers
-    throw SPDYStreamFailed(newStream, streamID, 400, "Bad Request");
+    return ParseError::stream(newStream, streamID, 400, "Bad Request");
   }
   if (direction == TransportDirection::DOWNSTREAM) {
     if (version_ == 2 && !headers.exists(HTTP_HEADER_HOST)) {
@@ -1218,18 +1317,22 @@ SPDYCodec::parseHeaders(TransportDirection direction, StreamID streamID,
   return std::move(msg);
 }
 
-void SPDYCodec::onSynCommon(StreamID streamID,
-                            StreamID assocStreamID,
-                            const HeaderPieceList& headers,
-                            int8_t pri,
-                            const HTTPHeaderSize& size) {
+SPDYCodec::ParseError SPDYCodec::onSynCommon(StreamID streamID,
+                                             StreamID assocStreamID,
+                                             const HeaderPieceList& headers,
+                                             int8_t pri,
+                                             const HTTPHeaderSize& size) {
   if (version_ != versionSettings_.majorVersion) {
     LOG(ERROR) << "Invalid version=" << version_;
-    throw SPDYSessionFailed(spdy::GOAWAY_PROTOCOL_ERROR);
+    return ParseError::session(spdy::GOAWAY_PROTOCOL_ERROR);
   }
 
-  unique_ptr<HTTPMessage> msg = parseHeaders(transportDirection_,
-                                             streamID, assocStreamID, headers);
+  auto result = parseHeaders(transportDirection_,
+                             streamID, assocStreamID, headers);
+  if (result.isError()) {
+    return std::move(result.error());
+  }
+  unique_ptr<HTTPMessage> msg = std::move(result.ok());
   msg->setIngressHeaderSize(size);
 
   msg->setAdvancedProtocolString(versionSettings_.protocolVersionString);
@@ -1241,20 +1344,24 @@ void SPDYCodec::onSynCommon(StreamID streamID,
     callback_->onMessageBegin(streamID, msg.get());
   }
 
-  callback_->onHeadersComplete(streamID, std::move(msg));
+  if (!httpChecks_ ||
+      HTTPChecksBase::checkIngressHeaders(callback_, streamID, *msg)) {
+    callback_->onHeadersComplete(streamID, std::move(msg));
+  }
+  return ParseError();
 }
 
-void SPDYCodec::onSynStream(uint32_t assocStream,
-                            uint8_t pri, uint8_t slot,
-                            const HeaderPieceList& headers,
-                            const HTTPHeaderSize& size) {
+SPDYCodec::ParseError SPDYCodec::onSynStream(uint32_t assocStream,
+                                             uint8_t pri, uint8_t slot,
+                                             const HeaderPieceList& headers,
+                                             const HTTPHeaderSize& size) {
   VLOG(4) << "Got SYN_STREAM, stream=" << streamId_
           << " pri=" << folly::to<int>(pri);
   if (sessionClosing_ == ClosingState::CLOSING) {
     VLOG(4) << "Dropping SYN_STREAM after final GOAWAY, stream=" << streamId_;
     // Suppress any EOM callback for the current frame.
     flags_ &= ~spdy::CTRL_FLAG_FIN;
-    return;
+    return ParseError();
   }
   if (streamId_ == 0 ||
       streamId_ < lastStreamID_ ||
@@ -1268,38 +1375,38 @@ void SPDYCodec::onSynStream(uint32_t assocStream,
                << " lastStreamID_=" << lastStreamID_
                << " assocStreamID=" << assocStream
                << " direction=" << transportDirection_;
-    throw SPDYSessionFailed(spdy::GOAWAY_PROTOCOL_ERROR);
+    return ParseError::session(spdy::GOAWAY_PROTOCOL_ERROR);
   }
 
   if (streamId_ == lastStreamID_) {
-    throw SPDYStreamFailed(true, streamId_, spdy::RST_PROTOCOL_ERROR);
+    return ParseError::stream(true, streamId_, spdy::RST_PROTOCOL_ERROR);
   }
   if (callback_->numIncomingStreams() >=
       egressSettings_.getSetting(SettingsId::MAX_CONCURRENT_STREAMS,
                                  spdy::kMaxConcurrentStreams)) {
-    throw SPDYStreamFailed(true, streamId_, spdy::RST_REFUSED_STREAM);
+    return ParseError::stream(true, streamId_, spdy::RST_REFUSED_STREAM);
   }
   if (assocStream != 0 && !(flags_ & spdy::CTRL_FLAG_UNIDIRECTIONAL)) {
-    throw SPDYStreamFailed(true, streamId_, spdy::RST_PROTOCOL_ERROR);
+    return ParseError::stream(true, streamId_, spdy::RST_PROTOCOL_ERROR);
   }
   lastStreamID_ = streamId_;
-  onSynCommon(StreamID(streamId_),
-              StreamID(assocStream), headers, pri, size);
+  return onSynCommon(StreamID(streamId_),
+                     StreamID(assocStream), headers, pri, size);
 }
 
-void SPDYCodec::onSynReply(const HeaderPieceList& headers,
-                           const HTTPHeaderSize& size) {
+SPDYCodec::ParseError SPDYCodec::onSynReply(const HeaderPieceList& headers,
+                                            const HTTPHeaderSize& size) {
   VLOG(4) << "Got SYN_REPLY, stream=" << streamId_;
   if (transportDirection_ == TransportDirection::DOWNSTREAM ||
       (streamId_ & 0x1) == 0) {
-    throw SPDYStreamFailed(true, streamId_, spdy::RST_PROTOCOL_ERROR);
+    return ParseError::stream(true, streamId_, spdy::RST_PROTOCOL_ERROR);
   }
   // Server push transactions, short of any better heuristics,
   // should have a background priority. Thus, we pick the largest
   // numerical value for the SPDY priority, which no matter what
   // protocol version this is can be conveyed to onSynCommon by -1.
-  onSynCommon(StreamID(streamId_),
-              HTTPCodec::NoStream, headers, -1, size);
+  return onSynCommon(StreamID(streamId_),
+                     HTTPCodec::NoStream, headers, -1, size);
 }
 
 void SPDYCodec::onRstStream(uint32_t statusCode) noexcept {
@@ -1310,7 +1417,7 @@ void SPDYCodec::onRstStream(uint32_t statusCode) noexcept {
                      spdy::rstToErrorCode(spdy::ResetStatusCode(statusCode)));
 }
 
-void SPDYCodec::onSettings(const SettingList& settings) {
+SPDYCodec::ParseError SPDYCodec::onSettings(const SettingList& settings) {
   VLOG(4) << "Got " << settings.size() << " settings with "
           << "version=" << version_ << " and flags="
           << std::hex << folly::to<unsigned int>(flags_) << std::dec;
@@ -1337,7 +1444,7 @@ void SPDYCodec::onSettings(const SettingList& settings) {
         break;
       case spdy::SETTINGS_INITIAL_WINDOW_SIZE:
         if (cur.value > std::numeric_limits<int32_t>::max()) {
-          throw SPDYSessionFailed(spdy::GOAWAY_PROTOCOL_ERROR);
+          return ParseError::session(spdy::GOAWAY_PROTOCOL_ERROR);
         }
         break;
       default:
@@ -1353,6 +1460,7 @@ void SPDYCodec::onSettings(const SettingList& settings) {
     }
   }
   callback_->onSettings(settingsList);
+  return ParseError();
 }
 
 void SPDYCodec::onPing(uint32_t uniqueID) noexcept {
@@ -17,8 +17,10 @@
 #include <proxygen/lib/http/codec/HTTPSettings.h>
 #include <proxygen/lib/http/codec/SPDYConstants.h>
 #include <proxygen/lib/http/codec/SPDYVersionSettings.h>
+#include <proxygen/lib/http/codec/compress/GzipHeaderCodec.h>
 #include <proxygen/lib/http/codec/compress/HPACKCodec.h>
 #include <proxygen/lib/http/codec/compress/HeaderCodec.h>
+#include <proxygen/lib/utils/Result.h>
 #include <zlib.h>
 
 namespace folly { namespace io {
@@ -34,9 +36,17 @@ namespace proxygen {
  */
 class SPDYCodec: public HTTPCodec {
 public:
+  /**
+   * spdyCompressionWindowBits and spdyCompressionMemLevel size the header
+   * compression context of gzip versions, see GzipHeaderCodec.
+   */
   explicit SPDYCodec(TransportDirection direction,
                      SPDYVersion version,
-                     int spdyCompressionLevel = Z_NO_COMPRESSION);
+                     int spdyCompressionLevel = Z_NO_COMPRESSION,
+                     int spdyCompressionWindowBits =
+                       GzipHeaderCodec::kDefaultWindowBits,
+                     int spdyCompressionMemLevel =
+                       GzipHeaderCodec::kDefaultMemLevel);
   ~SPDYCodec() override;
 
   static const SPDYVersionSettings& getVersionSettings(SPDYVersion version);
@@ -95,6 +105,10 @@ public:
                               uint32_t delta) override;
   void enableDoubleGoawayDrain() override;
   StreamID getLastIncomingStreamID() const override { return lastStreamID_; }
+  bool enableHTTPChecks() override {
+    httpChecks_ = true;
+    return true;
+  }
 
   /**
    * Returns a const reference to the ingress settings. Since ingress
@@ -124,6 +138,14 @@ public:
     headerCodec_->setStats(stats);
   }
 
+  size_t getHeaderCompressionStateSize() const override {
+    return headerCodec_->getCompressionStateSize();
+  }
+
+  void releaseIdleMemory() override {
+    headerCodec_->releaseIdleMemory();
+  }
+
   struct SettingData {
     SettingData(uint8_t inFlags, uint32_t inId, uint32_t inValue)
         : flags(inFlags),
@@ -174,25 +196,71 @@ public:
    */
   size_t generatePingCommon(folly::IOBufQueue& writeBuf,
                             uint64_t uniqueID);
+
   /**
-   * Ingress parser, can throw exceptions
+   * Why parsing a frame failed: either the whole session fails, or only
+   * the stream streamID, which is then reset. statusCode is the GOAWAY
+   * status of a session error, and the RST_STREAM status (or HTTP status,
+   * if >= 100) of a stream error. A default constructed ParseError is no
+   * error, and only an error converts to true.
    */
-  size_t parseIngress(const folly::IOBuf& buf);
+  struct ParseError {
+    enum class Scope : uint8_t {
+      NONE,
+      STREAM,
+      SESSION,
+    };
+
+    static ParseError session(spdy::GoawayStatusCode status) {
+      ParseError err;
+      err.scope = Scope::SESSION;
+      err.statusCode = status;
+      return err;
+    }
+
+    static ParseError stream(bool isNew, uint32_t streamID, uint32_t status,
+                             const std::string& message = empty_string) {
+      ParseError err;
+      err.scope = Scope::STREAM;
+      err.isNew = isNew;
+      err.streamID = streamID;
+      err.statusCode = status;
+      err.message = message;
+      return err;
+    }
+
+    explicit operator bool() const {
+      return scope != Scope::NONE;
+    }
+
+    Scope scope{Scope::NONE};
+    bool isNew{false};
+    uint32_t streamID{0};
+    uint32_t statusCode{0};
+    std::string message;
+  };
+
+  /**
+   * Ingress parser. Stream errors are handled as they happen, the session
+   * error that stops the parsing is returned.
+   */
+  Result<size_t, spdy::GoawayStatusCode> parseIngress(
+    const folly::IOBuf& buf);
 
   /**
    * Handle an ingress SYN_STREAM control frame. For a downstream-facing
    * SPDY session, this frame is the equivalent of an HTTP request header.
    */
-  void onSynStream(uint32_t assocStream,
-                   uint8_t pri, uint8_t slot,
-                   const compress::HeaderPieceList& headers,
-                   const HTTPHeaderSize& size);
+  ParseError onSynStream(uint32_t assocStream,
+                         uint8_t pri, uint8_t slot,
+                         const compress::HeaderPieceList& headers,
+                         const HTTPHeaderSize& size);
   /**
    * Handle an ingress SYN_REPLY control frame. For an upstream-facing
    * SPDY session, this frame is the equivalent of an HTTP response header.
    */
-  void onSynReply(const compress::HeaderPieceList& headers,
-                  const HTTPHeaderSize& size);
+  ParseError onSynReply(const compress::HeaderPieceList& headers,
+                        const HTTPHeaderSize& size);
   /**
    * Handle an ingress RST_STREAM control frame.
    */
@@ -201,7 +269,7 @@ public:
    * Handle a SETTINGS message that changes/updates settings for the
    * entire SPDY connection (across all transactions)
    */
-  void onSettings(const SettingList& settings);
+  ParseError onSettings(const SettingList& settings);
 
   void onPing(uint32_t uniqueID) noexcept;
 
@@ -222,15 +290,29 @@ public:
    * Parses the headers in the nameValues array and creates an HTTPMessage
    * object initialized for this transaction.
    */
-  std::unique_ptr<HTTPMessage> parseHeaders(
+  Result<std::unique_ptr<HTTPMessage>, ParseError> parseHeaders(
     TransportDirection direction, StreamID streamID,
     StreamID assocStreamID, const compress::HeaderPieceList& headers);
 
   /**
    * Helper function to parse out a control frame and execute its handler.
-   * All errors are thrown as exceptions.
+   * Returns the error that failed the frame, if any.
+   */
+  ParseError onControlFrame(folly::io::Cursor& cursor);
+
+  /**
+   * Takes what has arrived of a control frame that is not whole yet. The
+   * header block of a SYN_STREAM, SYN_REPLY or HEADERS frame is inflated
+   * as it arrives, so that only the inflated part has to be kept around.
+   * The bytes of other frames are left to the caller to buffer.
+   */
+  ParseError onPartialControlFrame(folly::io::Cursor& cursor);
+
+  /**
+   * Reads the fields of a SYN_STREAM, SYN_REPLY or HEADERS frame ahead of
+   * its header block, unless onPartialControlFrame() read them already.
    */
-  void onControlFrame(folly::io::Cursor& cursor);
+  ParseError parseHeaderFramePrefix(folly::io::Cursor& cursor);
 
   /**
    * Helper function that contains the common implementation details of
@@ -241,11 +323,11 @@ public:
    * value for this SPDY version (i.e., 3 for SPDY/2 or 7 for SPDY/3),
    * -2 the second largest (i.e., 2 for SPDY/2 or 6 for SPDY/3).
    */
-  void onSynCommon(StreamID streamID,
-                   StreamID assocStreamID,
-                   const compress::HeaderPieceList& headers,
-                   int8_t pri,
-                   const HTTPHeaderSize& size);
+  ParseError onSynCommon(StreamID streamID,
+                         StreamID assocStreamID,
+                         const compress::HeaderPieceList& headers,
+                         int8_t pri,
+                         const HTTPHeaderSize& size);
 
   /**
    * Generate the header for a SPDY data frame
@@ -313,11 +395,18 @@ public:
   /**
    * Decodes the headers from the cursor and returns the result.
    */
-  HeaderDecodeResult decodeHeaders(folly::io::Cursor& cursor);
+  Result<HeaderDecodeResult, ParseError> decodeHeaders(
+    folly::io::Cursor& cursor);
+
+  /**
+   * The error that fails the frame, or its stream, for a header block that
+   * can't be decoded.
+   */
+  ParseError headerDecodeError(HeaderDecodeError err);
 
-  void checkLength(uint32_t expectedLength, const std::string& msg);
+  ParseError checkLength(uint32_t expectedLength, const char* msg);
 
-  void checkMinLength(uint32_t minLength, const std::string& msg);
+  ParseError checkMinLength(uint32_t minLength, const char* msg);
 
   bool isSPDYReserved(const std::string& name);
 
@@ -355,6 +444,10 @@ public:
   uint16_t version_{0};
   uint16_t type_{0xffff};
   uint8_t flags_{0};
+  // Fields of the SYN_STREAM being parsed, ahead of its header block
+  uint32_t synAssocStream_{0};
+  uint8_t synPri_{0};
+  uint8_t synSlot_{0};
   TransportDirection transportDirection_;
 
   // SPDY Frame parsing state
@@ -372,6 +465,8 @@ public:
   } sessionClosing_:2;
 
   bool ctrl_:1;
+  bool headerPrefixParsed_:1;
+  bool httpChecks_:1;
 
   std::unique_ptr<HeaderCodec> headerCodec_;
 };
@@ -9,8 +9,16 @@
  */
 #include <proxygen/lib/http/codec/SPDYUtil.h>
 
-#include <folly/ThreadLocal.h>
+#include <atomic>
+#include <folly/CpuId.h>
+#include <glog/logging.h>
 #include <proxygen/lib/http/RFC2616.h>
+#include <proxygen/lib/utils/UtilInl.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define PROXYGEN_SPDYUTIL_SIMD 1
+#include <immintrin.h>
+#endif
 
 namespace proxygen {
 
@@ -57,23 +65,257 @@ const char SPDYUtil::http_tokens[256] = {
        'x',     'y',     'z',      0,      '|',     '}',     '~',       0
 };
 
+/**
+ * Controls (including CR), DEL, the quote and the backslash. Bytes past 127
+ * are allowed in header values.
+ */
+const bool SPDYUtil::value_specials[256] = {
+/*   0 -  15 */ 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+/*  16 -  31 */ 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+/*  32 -  47 */ 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+/*  48 -  63 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+/*  64 -  79 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+/*  80 -  95 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0,
+/*  96 - 111 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+/* 112 - 127 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1
+};
+
+namespace {
+
+// The bytes rejected by http_tokens and value_specials, as inclusive
+// ranges, padded to 16 bytes for _mm_cmpestri
+const uint8_t kNameRanges[16] = {
+  0x01, 0x1f, 0x28, 0x29, 0x2c, 0x2c, 0x3a, 0x5d, 0x7b, 0x7b, 0x7f, 0x7f
+};
+const int kNumNameRanges = 6;
+const uint8_t kValueRanges[16] = {
+  0x00, 0x1f, 0x22, 0x22, 0x5c, 0x5c, 0x7f, 0x7f
+};
+const int kNumValueRanges = 4;
+// kNameRanges without the uppercase letters, for names that are
+// lowercased before they are checked
+const uint8_t kLowerNameRanges[16] = {
+  0x01, 0x1f, 0x28, 0x29, 0x2c, 0x2c, 0x3a, 0x40, 0x5b, 0x5d, 0x7b, 0x7b,
+  0x7f, 0x7f
+};
+const int kNumLowerNameRanges = 7;
+
+#ifdef PROXYGEN_SPDYUTIL_SIMD
+
+// These return where the scalar loop has to take over: the first byte in
+// the ranges if there is one, or else the start of the tail that is too
+// short for a vector
+
+__attribute__((__target__("sse4.2")))
+size_t findInRangesSSE42(folly::ByteRange data, const uint8_t* ranges,
+                         int numRanges) {
+  const __m128i r = _mm_loadu_si128((const __m128i*)ranges);
+  size_t i = 0;
+  for (; i + 16 <= data.size(); i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(data.data() + i));
+    int index = _mm_cmpestri(r, numRanges * 2, v, 16,
+                             _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES |
+                             _SIDD_LEAST_SIGNIFICANT);
+    if (index != 16) {
+      return i + index;
+    }
+  }
+  return i;
+}
+
+__attribute__((__target__("avx2")))
+size_t findInRangesAVX2(folly::ByteRange data, const uint8_t* ranges,
+                        int numRanges) {
+  __m256i lo[8];
+  __m256i hi[8];
+  for (int j = 0; j < numRanges; j++) {
+    lo[j] = _mm256_set1_epi8(ranges[j * 2]);
+    hi[j] = _mm256_set1_epi8(ranges[j * 2 + 1]);
+  }
+  size_t i = 0;
+  for (; i + 32 <= data.size(); i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(data.data() + i));
+    __m256i found = _mm256_setzero_si256();
+    for (int j = 0; j < numRanges; j++) {
+      // lo <= v <= hi, unsigned, iff clamping v to [lo, hi] leaves it as is
+      __m256i clamped = _mm256_min_epu8(_mm256_max_epu8(v, lo[j]), hi[j]);
+      found = _mm256_or_si256(found, _mm256_cmpeq_epi8(clamped, v));
+    }
+    uint32_t mask = _mm256_movemask_epi8(found);
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return i;
+}
+
+// These lowercase all the bytes they look at and return where the scalar
+// loop has to take over. invalid is set when a lowercased byte is in
+// kLowerNameRanges.
+
+__attribute__((__target__("sse4.2")))
+size_t lowercaseSSE42(folly::ByteRange data, uint8_t* out, bool& invalid) {
+  const __m128i r = _mm_loadu_si128((const __m128i*)kLowerNameRanges);
+  const __m128i beforeA = _mm_set1_epi8('A' - 1);
+  const __m128i afterZ = _mm_set1_epi8('Z' + 1);
+  const __m128i caseBit = _mm_set1_epi8(0x20);
+  int found = 0;
+  size_t i = 0;
+  for (; i + 16 <= data.size(); i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(data.data() + i));
+    // bytes past 127 are negative, and so never uppercase
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, beforeA),
+                                  _mm_cmplt_epi8(v, afterZ));
+    v = _mm_or_si128(v, _mm_and_si128(upper, caseBit));
+    _mm_storeu_si128((__m128i*)(out + i), v);
+    found |= _mm_cmpestrc(r, kNumLowerNameRanges * 2, v, 16,
+                          _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES);
+  }
+  invalid = found;
+  return i;
+}
+
+__attribute__((__target__("avx2")))
+size_t lowercaseAVX2(folly::ByteRange data, uint8_t* out, bool& invalid) {
+  __m256i lo[kNumLowerNameRanges];
+  __m256i hi[kNumLowerNameRanges];
+  for (int j = 0; j < kNumLowerNameRanges; j++) {
+    lo[j] = _mm256_set1_epi8(kLowerNameRanges[j * 2]);
+    hi[j] = _mm256_set1_epi8(kLowerNameRanges[j * 2 + 1]);
+  }
+  const __m256i beforeA = _mm256_set1_epi8('A' - 1);
+  const __m256i afterZ = _mm256_set1_epi8('Z' + 1);
+  const __m256i caseBit = _mm256_set1_epi8(0x20);
+  __m256i found = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 32 <= data.size(); i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(data.data() + i));
+    __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(v, beforeA),
+                                     _mm256_cmpgt_epi8(afterZ, v));
+    v = _mm256_or_si256(v, _mm256_and_si256(upper, caseBit));
+    _mm256_storeu_si256((__m256i*)(out + i), v);
+    for (int j = 0; j < kNumLowerNameRanges; j++) {
+      __m256i clamped = _mm256_min_epu8(_mm256_max_epu8(v, lo[j]), hi[j]);
+      found = _mm256_or_si256(found, _mm256_cmpeq_epi8(clamped, v));
+    }
+  }
+  invalid = _mm256_movemask_epi8(found) != 0;
+  return i;
+}
+
+#endif
+
+SPDYUtil::ScanImpl detectScanImpl() {
+#ifdef PROXYGEN_SPDYUTIL_SIMD
+  folly::CpuId cpu;
+  if (cpu.avx2()) {
+    return SPDYUtil::ScanImpl::AVX2;
+  }
+  if (cpu.sse42()) {
+    return SPDYUtil::ScanImpl::SSE42;
+  }
+#endif
+  return SPDYUtil::ScanImpl::SCALAR;
+}
+
+std::atomic<SPDYUtil::ScanImpl>& scanImpl() {
+  static std::atomic<SPDYUtil::ScanImpl> impl(detectScanImpl());
+  return impl;
+}
+
+size_t findInRanges(folly::ByteRange data, const uint8_t* ranges,
+                    int numRanges) {
+#ifdef PROXYGEN_SPDYUTIL_SIMD
+  switch (scanImpl().load(std::memory_order_relaxed)) {
+    case SPDYUtil::ScanImpl::AVX2:
+      return findInRangesAVX2(data, ranges, numRanges);
+    case SPDYUtil::ScanImpl::SSE42:
+      return findInRangesSSE42(data, ranges, numRanges);
+    case SPDYUtil::ScanImpl::SCALAR:
+      break;
+  }
+#endif
+  return 0;
+}
+
+size_t lowercaseVector(folly::ByteRange data, uint8_t* out, bool& invalid) {
+  invalid = false;
+#ifdef PROXYGEN_SPDYUTIL_SIMD
+  switch (scanImpl().load(std::memory_order_relaxed)) {
+    case SPDYUtil::ScanImpl::AVX2:
+      return lowercaseAVX2(data, out, invalid);
+    case SPDYUtil::ScanImpl::SSE42:
+      return lowercaseSSE42(data, out, invalid);
+    case SPDYUtil::ScanImpl::SCALAR:
+      break;
+  }
+#endif
+  return 0;
+}
+
+}
+
+SPDYUtil::ScanImpl SPDYUtil::getBestScanImpl() {
+  return detectScanImpl();
+}
+
+void SPDYUtil::setScanImpl(ScanImpl impl) {
+  CHECK(impl <= getBestScanImpl()) << "Unsupported scan implementation";
+  scanImpl().store(impl);
+}
+
+size_t SPDYUtil::findInvalidNameByte(folly::ByteRange name) {
+  size_t i = findInRanges(name, kNameRanges, kNumNameRanges);
+  for (; i < name.size(); i++) {
+    uint8_t p = name[i];
+    if (p < 0x80 && http_tokens[p] != p) {
+      break;
+    }
+  }
+  return i;
+}
+
+size_t SPDYUtil::findValueSpecial(folly::ByteRange value) {
+  size_t i = findInRanges(value, kValueRanges, kNumValueRanges);
+  while (i < value.size() && !value_specials[value[i]]) {
+    i++;
+  }
+  return i;
+}
+
+bool SPDYUtil::lowercaseHeaderName(folly::ByteRange name, uint8_t* out) {
+  bool invalid;
+  size_t i = lowercaseVector(name, out, invalid);
+  for (; i < name.size(); i++) {
+    uint8_t p = name[i];
+    if (p >= 'A' && p <= 'Z') {
+      p |= 0x20;
+    }
+    out[i] = p;
+    if (p < 0x80 && http_tokens[p] != p) {
+      invalid = true;
+    }
+  }
+  return !invalid && name.size() > 0;
+}
+
 bool SPDYUtil::hasGzipAndDeflate(const std::string& value, bool& hasGzip,
                                  bool& hasDeflate) {
-  static folly::ThreadLocal<std::vector<RFC2616::TokenQPair>> output;
-  output->clear();
   hasGzip = false;
   hasDeflate = false;
-  RFC2616::parseQvalues(value, *output);
-  for (const auto& encodingQ: *output) {
-    std::string lower(std::move(encodingQ.first.str()));
-    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+  RFC2616::forEachQvalue(value, [&] (folly::StringPiece encoding,
+                                     double qvalue) {
     // RFC says 3 sig figs
-    if (lower == "gzip" && encodingQ.second >= 0.001) {
+    if (qvalue < 0.001) {
+      return false;
+    }
+    if (caseInsensitiveEqual(encoding, "gzip")) {
       hasGzip = true;
-    } else if (lower == "deflate" && encodingQ.second >= 0.001) {
+    } else if (caseInsensitiveEqual(encoding, "deflate")) {
       hasDeflate = true;
     }
-  }
+    return false;
+  });
   return hasGzip && hasDeflate;
 }
 
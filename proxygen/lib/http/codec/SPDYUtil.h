@@ -22,6 +22,8 @@ class SPDYUtil {
   // If these are needed elsewhere, we can move them to a more generic
   // namespace/class later
   static const char http_tokens[256];
+  // bytes that validateHeaderValue() has to look at more closely
+  static const bool value_specials[256];
 
   static bool validateURL(folly::ByteRange url) {
     for (auto p: url) {
@@ -43,16 +45,52 @@ class SPDYUtil {
     return true;
   }
 
+  /**
+   * How findInvalidNameByte(), findValueSpecial() and lowercaseHeaderName()
+   * scan their input. The best one the CPU supports is picked at startup;
+   * setting another one is meant for tests and benchmarks.
+   */
+  enum class ScanImpl {
+    SCALAR,
+    SSE42,
+    AVX2
+  };
+
+  static ScanImpl getBestScanImpl();
+  static void setScanImpl(ScanImpl impl);
+
+  /**
+   * @return the index of the first byte of name that is not a lowercase
+   *         token char, or name.size() if there is none
+   */
+  static size_t findInvalidNameByte(folly::ByteRange name);
+
+  /**
+   * @return the index of the first byte of value in value_specials, or
+   *         value.size() if there is none
+   */
+  static size_t findValueSpecial(folly::ByteRange value);
+
+  /**
+   * Write name in lowercase to out, and check in the same pass that the
+   * lowercase name is what validateHeaderName() accepts. out needs room
+   * for name.size() bytes and may be name itself.
+   *
+   * @return true if the lowercase name is a valid header name
+   */
+  static bool lowercaseHeaderName(folly::ByteRange name, uint8_t* out);
+
+  static bool lowercaseHeaderName(std::string& name) {
+    return lowercaseHeaderName(
+      folly::ByteRange((const uint8_t*)name.data(), name.size()),
+      (uint8_t*)&name[0]);
+  }
+
   static bool validateHeaderName(folly::ByteRange name) {
     if (name.size() == 0) {
       return false;
     }
-    for (auto p: name) {
-      if (p < 0x80 && http_tokens[(uint8_t)p] != p) {
-        return false;
-      }
-    }
-    return true;
+    return findInvalidNameByte(name) == name.size();
   }
 
   /**
@@ -75,6 +113,14 @@ class SPDYUtil {
            lws_expect_ws1,
            lws_expect_ws2 } state = lws_none;
 
+    // Most values have no controls, quotes or escapes at all: skip what
+    // cannot change the state without the state machine
+    size_t plain = findValueSpecial(value);
+    if (plain == value.size()) {
+      return true;
+    }
+    value.advance(plain);
+
     for (auto p = std::begin(value); p != std::end(value); ++p) {
       if (escape) {
         escape = false;
@@ -0,0 +1,689 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/http/codec/WebSocketCodec.h>
+
+#include <folly/Random.h>
+#include <folly/String.h>
+#include <folly/io/Cursor.h>
+#include <glog/logging.h>
+#include <proxygen/lib/utils/CryptUtil.h>
+
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using folly::IOBuf;
+using folly::IOBufQueue;
+using folly::StringPiece;
+using std::string;
+using std::unique_ptr;
+
+namespace {
+
+const char* kAcceptGUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+// Z_SYNC_FLUSH ends every deflated message with it, which the sender
+// strips off and the receiver puts back (RFC 7692 7.2.1)
+const uint8_t kDeflateTail[] = { 0x00, 0x00, 0xff, 0xff };
+
+const size_t kZlibMinBuffer = 4000;
+const size_t kZlibBufferGrowth = 16000;
+
+bool isControl(uint8_t opcode) {
+  return opcode & 0x8;
+}
+
+bool isKnownOpcode(uint8_t opcode) {
+  return opcode <= 0x2 || (opcode >= 0x8 && opcode <= 0xa);
+}
+
+// May appear in CLOSE frames (RFC 6455 7.4)
+bool isValidCloseCode(uint16_t code) {
+  return (code >= 1000 && code <= 1003) ||
+    (code >= 1007 && code <= 1014) ||
+    (code >= 3000 && code <= 4999);
+}
+
+void unmaskChain(IOBuf& chain, const uint8_t mask[4], uint64_t offset) {
+  IOBuf* buf = &chain;
+  do {
+    proxygen::WebSocketCodec::applyMask(buf->writableData(), buf->length(),
+                                        mask, offset);
+    offset += buf->length();
+    buf = buf->next();
+  } while (buf != &chain);
+}
+
+StringPiece trimWhitespace(StringPiece sp) {
+  while (!sp.empty() && isspace((unsigned char)sp.front())) {
+    sp.pop_front();
+  }
+  while (!sp.empty() && isspace((unsigned char)sp.back())) {
+    sp.pop_back();
+  }
+  return sp;
+}
+
+// The value of a *_max_window_bits parameter, -1 if it is not one
+int parseWindowBits(StringPiece value) {
+  if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+    value = value.subpiece(1, value.size() - 2);
+  }
+  if (value.empty() || value.size() > 2) {
+    return -1;
+  }
+  int bits = 0;
+  for (char c : value) {
+    if (c < '0' || c > '9') {
+      return -1;
+    }
+    bits = bits * 10 + (c - '0');
+  }
+  return (bits >= 8 && bits <= 15) ? bits : -1;
+}
+
+}
+
+namespace proxygen {
+
+const uint16_t WebSocketCodec::kCloseNormal;
+const uint16_t WebSocketCodec::kCloseGoingAway;
+const uint16_t WebSocketCodec::kCloseProtocolError;
+const uint16_t WebSocketCodec::kCloseNoStatus;
+const uint16_t WebSocketCodec::kCloseAbnormal;
+const uint16_t WebSocketCodec::kCloseInvalidData;
+const uint16_t WebSocketCodec::kCloseTooBig;
+const uint16_t WebSocketCodec::kCloseInternalError;
+const size_t WebSocketCodec::kMaxControlPayload;
+const size_t WebSocketCodec::kMaxFrameHeaderSize;
+
+WebSocketCodec::WebSocketCodec(TransportDirection direction)
+    : transportDirection_(direction) {
+}
+
+void WebSocketCodec::onIngress(unique_ptr<IOBuf> buf) {
+  if (error_) {
+    return;
+  }
+  readBuf_.append(std::move(buf));
+  while (!error_) {
+    if (state_ == State::HEADER) {
+      if (!parseHeader()) {
+        break;
+      }
+    } else if (!parsePayload()) {
+      break;
+    }
+  }
+}
+
+bool WebSocketCodec::parseHeader() {
+  size_t available = readBuf_.chainLength();
+  if (available < 2) {
+    return false;
+  }
+  folly::io::Cursor cursor(readBuf_.front());
+  uint8_t first = cursor.read<uint8_t>();
+  uint8_t second = cursor.read<uint8_t>();
+  bool masked = second & 0x80;
+  uint8_t shortLength = second & 0x7f;
+  size_t headerSize = 2 + (masked ? 4 : 0);
+  if (shortLength == 126) {
+    headerSize += 2;
+  } else if (shortLength == 127) {
+    headerSize += 8;
+  }
+  if (available < headerSize) {
+    return false;
+  }
+  uint64_t length = shortLength;
+  if (shortLength == 126) {
+    length = cursor.readBE<uint16_t>();
+  } else if (shortLength == 127) {
+    length = cursor.readBE<uint64_t>();
+  }
+  if (masked) {
+    cursor.pull(frameMask_, sizeof(frameMask_));
+  }
+
+  bool fin = first & 0x80;
+  bool rsv1 = first & 0x40;
+  uint8_t opcode = first & 0x0f;
+  if (first & 0x30) {
+    fail(kCloseProtocolError, "RSV2 or RSV3 set");
+    return false;
+  }
+  if (!isKnownOpcode(opcode)) {
+    fail(kCloseProtocolError, folly::to<string>("unknown opcode ",
+                                                uint32_t(opcode)));
+    return false;
+  }
+  if (masked != (transportDirection_ == TransportDirection::DOWNSTREAM)) {
+    fail(kCloseProtocolError, masked ? "masked frame from the server" :
+         "unmasked frame from the client");
+    return false;
+  }
+  if (length & (uint64_t(1) << 63)) {
+    fail(kCloseProtocolError, "most significant bit of the length set");
+    return false;
+  }
+  if (isControl(opcode)) {
+    if (!fin || rsv1 || length > kMaxControlPayload) {
+      fail(kCloseProtocolError, "fragmented, compressed or long control "
+           "frame");
+      return false;
+    }
+  } else {
+    if (opcode == uint8_t(Opcode::CONTINUATION)) {
+      if (messageOpcode_ == Opcode::CONTINUATION || rsv1) {
+        fail(kCloseProtocolError, "unexpected CONTINUATION");
+        return false;
+      }
+    } else {
+      if (messageOpcode_ != Opcode::CONTINUATION) {
+        fail(kCloseProtocolError, "new message in a fragmented one");
+        return false;
+      }
+      if (rsv1 && !deflateOptions_.enabled) {
+        fail(kCloseProtocolError, "RSV1 set without permessage-deflate");
+        return false;
+      }
+      messageOpcode_ = Opcode(opcode);
+      messageCompressed_ = rsv1;
+    }
+    if (length > maxMessageSize_ - message_.chainLength()) {
+      fail(kCloseTooBig, "message too large");
+      return false;
+    }
+  }
+
+  readBuf_.trimStart(headerSize);
+  frameOpcode_ = Opcode(opcode);
+  frameFin_ = fin;
+  frameMasked_ = masked;
+  frameRemaining_ = length;
+  frameOffset_ = 0;
+  state_ = State::PAYLOAD;
+  return true;
+}
+
+bool WebSocketCodec::parsePayload() {
+  if (isControl(uint8_t(frameOpcode_))) {
+    // At most kMaxControlPayload bytes, delivered whole
+    if (readBuf_.chainLength() < frameRemaining_) {
+      return false;
+    }
+    auto payload = frameRemaining_ > 0 ?
+      readBuf_.split(frameRemaining_) : IOBuf::create(0);
+    if (frameMasked_ && frameRemaining_ > 0) {
+      unmaskChain(*payload, frameMask_, 0);
+    }
+    frameRemaining_ = 0;
+    state_ = State::HEADER;
+    onControlFrame(std::move(payload));
+    return !error_;
+  }
+
+  // Data frames are taken as they arrive, since they can be large
+  size_t length = std::min<uint64_t>(readBuf_.chainLength(), frameRemaining_);
+  if (length > 0) {
+    auto payload = readBuf_.split(length);
+    if (frameMasked_) {
+      unmaskChain(*payload, frameMask_, frameOffset_);
+    }
+    message_.append(std::move(payload));
+    frameRemaining_ -= length;
+    frameOffset_ += length;
+  }
+  if (frameRemaining_ > 0) {
+    return false;
+  }
+  state_ = State::HEADER;
+  if (frameFin_) {
+    onMessageComplete();
+  }
+  return !error_;
+}
+
+void WebSocketCodec::onControlFrame(unique_ptr<IOBuf> payload) {
+  switch (frameOpcode_) {
+    case Opcode::PING:
+      callback_->onPing(std::move(payload));
+      break;
+    case Opcode::PONG:
+      callback_->onPong(std::move(payload));
+      break;
+    case Opcode::CLOSE: {
+      size_t length = payload->computeChainDataLength();
+      if (length == 0) {
+        callback_->onClose(kCloseNoStatus, StringPiece());
+        break;
+      }
+      if (length == 1) {
+        fail(kCloseProtocolError, "CLOSE payload of 1 byte");
+        break;
+      }
+      payload->coalesce();
+      uint16_t code = (uint16_t(payload->data()[0]) << 8) |
+        payload->data()[1];
+      if (!isValidCloseCode(code)) {
+        fail(kCloseProtocolError,
+             folly::to<string>("invalid CLOSE code ", code));
+        break;
+      }
+      payload->trimStart(2);
+      if (validateUTF8_ && !isValidUTF8(*payload)) {
+        fail(kCloseInvalidData, "CLOSE reason is not UTF-8");
+        break;
+      }
+      callback_->onClose(code, StringPiece((const char*)payload->data(),
+                                           payload->length()));
+      break;
+    }
+    default:
+      LOG(DFATAL) << "not a control opcode " << uint32_t(frameOpcode_);
+  }
+}
+
+void WebSocketCodec::onMessageComplete() {
+  auto payload = message_.move();
+  if (!payload) {
+    payload = IOBuf::create(0);
+  }
+  Opcode opcode = messageOpcode_;
+  messageOpcode_ = Opcode::CONTINUATION;
+  if (messageCompressed_) {
+    messageCompressed_ = false;
+    payload = inflate(std::move(payload));
+    if (!payload) {
+      return;
+    }
+  }
+  if (opcode == Opcode::TEXT && validateUTF8_ && !isValidUTF8(*payload)) {
+    fail(kCloseInvalidData, "TEXT message is not UTF-8");
+    return;
+  }
+  callback_->onMessage(opcode, std::move(payload));
+}
+
+void WebSocketCodec::fail(uint16_t code, const string& reason) {
+  VLOG(4) << "WebSocket error " << code << ": " << reason;
+  error_ = true;
+  readBuf_.move();
+  message_.move();
+  callback_->onError(code, reason);
+}
+
+unique_ptr<IOBuf> WebSocketCodec::inflate(unique_ptr<IOBuf> payload) {
+  if (!inflater_) {
+    // The largest window, which also inflates what smaller ones deflated
+    inflater_ = ZlibStreamPool::getInflater(-15);
+    if (!inflater_) {
+      fail(kCloseInternalError, "failed to set up an inflater");
+      return nullptr;
+    }
+  }
+  payload->prependChain(IOBuf::wrapBuffer(kDeflateTail,
+                                          sizeof(kDeflateTail)));
+  z_stream* stream = inflater_.get();
+  IOBufQueue out(IOBufQueue::cacheChainLength());
+  const IOBuf* buf = payload.get();
+  do {
+    stream->next_in = const_cast<uint8_t*>(buf->data());
+    stream->avail_in = buf->length();
+    do {
+      auto space = out.preallocate(kZlibMinBuffer, kZlibBufferGrowth);
+      stream->next_out = static_cast<uint8_t*>(space.first);
+      stream->avail_out = space.second;
+      int rc = ::inflate(stream, Z_SYNC_FLUSH);
+      out.postallocate(space.second - stream->avail_out);
+      if (rc == Z_STREAM_END) {
+        // The peer ended the deflate stream, and starts a new one
+        inflateReset(stream);
+      } else if (rc == Z_BUF_ERROR) {
+        break;
+      } else if (rc != Z_OK) {
+        fail(kCloseInvalidData, "invalid deflate data");
+        return nullptr;
+      }
+      if (out.chainLength() > maxMessageSize_) {
+        fail(kCloseTooBig, "message too large once inflated");
+        return nullptr;
+      }
+    } while (stream->avail_in > 0 || stream->avail_out == 0);
+    buf = buf->next();
+  } while (buf != payload.get());
+
+  auto inflated = out.move();
+  return inflated ? std::move(inflated) : IOBuf::create(0);
+}
+
+unique_ptr<IOBuf> WebSocketCodec::deflate(const IOBuf& payload) {
+  if (!deflater_) {
+    deflater_ = ZlibStreamPool::getDeflater(deflateOptions_.level,
+                                            -deflateOptions_.windowBits,
+                                            deflateOptions_.memLevel);
+    if (!deflater_) {
+      return nullptr;
+    }
+  }
+  z_stream* stream = deflater_.get();
+  IOBufQueue out(IOBufQueue::cacheChainLength());
+  const IOBuf* buf = &payload;
+  do {
+    const IOBuf* next = buf->next();
+    int flush = (next == &payload) ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+    stream->next_in = const_cast<uint8_t*>(buf->data());
+    stream->avail_in = buf->length();
+    do {
+      auto space = out.preallocate(kZlibMinBuffer, kZlibBufferGrowth);
+      stream->next_out = static_cast<uint8_t*>(space.first);
+      stream->avail_out = space.second;
+      int rc = ::deflate(stream, flush);
+      out.postallocate(space.second - stream->avail_out);
+      if (rc != Z_OK && rc != Z_BUF_ERROR) {
+        // What the peer inflated so far is still good; start over
+        deflateReset(stream);
+        return nullptr;
+      }
+    } while (stream->avail_out == 0);
+    buf = next;
+  } while (buf != &payload);
+
+  if (deflateOptions_.noContextTakeover) {
+    deflateReset(stream);
+  }
+  DCHECK_GE(out.chainLength(), sizeof(kDeflateTail));
+  out.trimEnd(sizeof(kDeflateTail));
+  auto deflated = out.move();
+  return deflated ? std::move(deflated) : IOBuf::create(0);
+}
+
+size_t WebSocketCodec::generateMessage(IOBufQueue& writeBuf,
+                                       Opcode opcode,
+                                       unique_ptr<IOBuf> payload) {
+  DCHECK(opcode == Opcode::TEXT || opcode == Opcode::BINARY);
+  if (!payload) {
+    payload = IOBuf::create(0);
+  }
+  bool compressed = false;
+  if (deflateOptions_.enabled &&
+      payload->computeChainDataLength() >= deflateOptions_.minSize) {
+    auto deflated = deflate(*payload);
+    if (deflated) {
+      payload = std::move(deflated);
+      compressed = true;
+    }
+  }
+
+  size_t length = payload->computeChainDataLength();
+  if (maxEgressFrameSize_ == 0 || length <= maxEgressFrameSize_) {
+    return generateFrame(writeBuf, opcode, true, compressed,
+                         std::move(payload));
+  }
+  IOBufQueue fragments(IOBufQueue::cacheChainLength());
+  fragments.append(std::move(payload));
+  size_t written = 0;
+  bool first = true;
+  while (!fragments.empty()) {
+    auto fragment = fragments.split(std::min(maxEgressFrameSize_,
+                                             fragments.chainLength()));
+    written += generateFrame(writeBuf,
+                             first ? opcode : Opcode::CONTINUATION,
+                             fragments.empty(),
+                             first && compressed,
+                             std::move(fragment));
+    first = false;
+  }
+  return written;
+}
+
+size_t WebSocketCodec::generatePing(IOBufQueue& writeBuf,
+                                    unique_ptr<IOBuf> payload) {
+  return generateControl(writeBuf, Opcode::PING, std::move(payload));
+}
+
+size_t WebSocketCodec::generatePong(IOBufQueue& writeBuf,
+                                    unique_ptr<IOBuf> payload) {
+  return generateControl(writeBuf, Opcode::PONG, std::move(payload));
+}
+
+size_t WebSocketCodec::generateClose(IOBufQueue& writeBuf,
+                                     uint16_t code,
+                                     StringPiece reason) {
+  if (code == kCloseNoStatus) {
+    // Not to be sent, it stands for the lack of a code
+    return generateControl(writeBuf, Opcode::CLOSE, nullptr);
+  }
+  if (reason.size() > kMaxControlPayload - 2) {
+    // Cut at the start of a code point, for the reason to stay UTF-8
+    size_t end = kMaxControlPayload - 2;
+    while (end > 0 && (uint8_t(reason[end]) & 0xc0) == 0x80) {
+      --end;
+    }
+    reason = reason.subpiece(0, end);
+  }
+  auto payload = IOBuf::create(2 + reason.size());
+  uint8_t* data = payload->writableData();
+  data[0] = code >> 8;
+  data[1] = code & 0xff;
+  memcpy(data + 2, reason.data(), reason.size());
+  payload->append(2 + reason.size());
+  return generateControl(writeBuf, Opcode::CLOSE, std::move(payload));
+}
+
+size_t WebSocketCodec::generateControl(IOBufQueue& writeBuf,
+                                       Opcode opcode,
+                                       unique_ptr<IOBuf> payload) {
+  if (payload && payload->computeChainDataLength() > kMaxControlPayload) {
+    LOG(DFATAL) << "control frame payload over " << kMaxControlPayload
+                << " bytes";
+    return 0;
+  }
+  return generateFrame(writeBuf, opcode, true, false, std::move(payload));
+}
+
+size_t WebSocketCodec::generateFrame(IOBufQueue& writeBuf,
+                                     Opcode opcode,
+                                     bool fin,
+                                     bool rsv1,
+                                     unique_ptr<IOBuf> payload) {
+  uint64_t length = payload ? payload->computeChainDataLength() : 0;
+  bool masked = transportDirection_ == TransportDirection::UPSTREAM;
+  uint8_t header[kMaxFrameHeaderSize];
+  size_t headerSize = 2;
+  header[0] = (fin ? 0x80 : 0) | (rsv1 ? 0x40 : 0) | uint8_t(opcode);
+  uint8_t maskBit = masked ? 0x80 : 0;
+  if (length < 126) {
+    header[1] = maskBit | length;
+  } else if (length <= 0xffff) {
+    header[1] = maskBit | 126;
+    header[2] = length >> 8;
+    header[3] = length & 0xff;
+    headerSize = 4;
+  } else {
+    header[1] = maskBit | 127;
+    for (size_t i = 0; i < 8; ++i) {
+      header[2 + i] = (length >> (56 - 8 * i)) & 0xff;
+    }
+    headerSize = 10;
+  }
+  if (masked) {
+    uint32_t key = folly::Random::rand32();
+    memcpy(header + headerSize, &key, sizeof(key));
+    if (length > 0) {
+      // The payload may be the caller's too: mask a copy of it then
+      payload->unshare();
+      unmaskChain(*payload, header + headerSize, 0);
+    }
+    headerSize += sizeof(key);
+  }
+  writeBuf.append(header, headerSize);
+  if (length > 0) {
+    writeBuf.append(std::move(payload));
+  }
+  return headerSize + length;
+}
+
+string WebSocketCodec::computeAccept(StringPiece key) {
+  string text = folly::to<string>(key, kAcceptGUID);
+  uint8_t sha1[kMaxDigestLength];
+  size_t length = digest(DigestType::SHA1,
+                         folly::ByteRange((const uint8_t*)text.data(),
+                                          text.size()),
+                         sha1);
+  return base64Encode(folly::ByteRange(sha1, length));
+}
+
+string WebSocketCodec::negotiateDeflate(StringPiece offers,
+                                        DeflateOptions& options) {
+  std::vector<StringPiece> extensions;
+  folly::split(',', offers, extensions);
+  for (auto extension : extensions) {
+    std::vector<StringPiece> params;
+    folly::split(';', extension, params);
+    if (trimWhitespace(params[0]) != "permessage-deflate") {
+      continue;
+    }
+    DeflateOptions accepted = options;
+    accepted.enabled = true;
+    string response = "permessage-deflate";
+    bool acceptable = true;
+    for (size_t i = 1; i < params.size() && acceptable; ++i) {
+      StringPiece name = trimWhitespace(params[i]);
+      StringPiece value;
+      auto equals = name.find('=');
+      if (equals != StringPiece::npos) {
+        value = trimWhitespace(name.subpiece(equals + 1));
+        name = trimWhitespace(name.subpiece(0, equals));
+      }
+      if (name == "server_no_context_takeover" && value.empty()) {
+        accepted.noContextTakeover = true;
+        response.append("; server_no_context_takeover");
+      } else if (name == "client_no_context_takeover" && value.empty()) {
+        // Nothing to do here: the inflater keeps its window either way
+        response.append("; client_no_context_takeover");
+      } else if (name == "server_max_window_bits") {
+        // zlib deflates raw streams with no less than 9 bits
+        int bits = parseWindowBits(value);
+        if (bits < 9) {
+          acceptable = false;
+        } else {
+          accepted.windowBits = std::min(accepted.windowBits, bits);
+          response.append(folly::to<string>("; server_max_window_bits=",
+                                            accepted.windowBits));
+        }
+      } else if (name == "client_max_window_bits") {
+        // A hint the server may leave unanswered, since it inflates with
+        // 15 bits
+        acceptable = value.empty() || parseWindowBits(value) > 0;
+      } else {
+        acceptable = false;
+      }
+    }
+    if (acceptable) {
+      options = accepted;
+      return response;
+    }
+  }
+  return string();
+}
+
+void WebSocketCodec::applyMask(uint8_t* data, size_t len,
+                               const uint8_t mask[4], size_t offset) {
+  // The mask starting at offset, over the widest block XORed at once
+  uint8_t pattern[16];
+  for (size_t i = 0; i < sizeof(pattern); ++i) {
+    pattern[i] = mask[(offset + i) & 3];
+  }
+  size_t i = 0;
+#if defined(__SSE2__)
+  const __m128i key = _mm_loadu_si128((const __m128i*)pattern);
+  for (; i + 16 <= len; i += 16) {
+    __m128i* block = (__m128i*)(data + i);
+    _mm_storeu_si128(block, _mm_xor_si128(_mm_loadu_si128(block), key));
+  }
+#endif
+  uint64_t key64;
+  memcpy(&key64, pattern, sizeof(key64));
+  for (; i + 8 <= len; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    word ^= key64;
+    memcpy(data + i, &word, sizeof(word));
+  }
+  for (; i < len; ++i) {
+    data[i] ^= pattern[i & 3];
+  }
+}
+
+bool WebSocketCodec::isValidUTF8(const IOBuf& chain) {
+  // State carried over from one buffer of the chain to the next
+  uint32_t codePoint = 0;
+  uint32_t minCodePoint = 0;
+  unsigned pending = 0;
+  const IOBuf* buf = &chain;
+  do {
+    const uint8_t* data = buf->data();
+    size_t len = buf->length();
+    size_t i = 0;
+    while (i < len) {
+      if (pending == 0) {
+        // Skip ASCII a word at a time
+        uint64_t word;
+        while (i + 8 <= len) {
+          memcpy(&word, data + i, sizeof(word));
+          if (word & 0x8080808080808080ULL) {
+            break;
+          }
+          i += 8;
+        }
+        if (i == len) {
+          break;
+        }
+        uint8_t c = data[i++];
+        if (c < 0x80) {
+          continue;
+        } else if ((c & 0xe0) == 0xc0) {
+          pending = 1;
+          codePoint = c & 0x1f;
+          minCodePoint = 0x80;
+        } else if ((c & 0xf0) == 0xe0) {
+          pending = 2;
+          codePoint = c & 0x0f;
+          minCodePoint = 0x800;
+        } else if ((c & 0xf8) == 0xf0) {
+          pending = 3;
+          codePoint = c & 0x07;
+          minCodePoint = 0x10000;
+        } else {
+          return false;
+        }
+      } else {
+        uint8_t c = data[i++];
+        if ((c & 0xc0) != 0x80) {
+          return false;
+        }
+        codePoint = (codePoint << 6) | (c & 0x3f);
+        if (--pending == 0 &&
+            (codePoint < minCodePoint || codePoint > 0x10ffff ||
+             (codePoint >= 0xd800 && codePoint <= 0xdfff))) {
+          // Overlong, out of range, or a surrogate
+          return false;
+        }
+      }
+    }
+    buf = buf->next();
+  } while (buf != &chain);
+  return pending == 0;
+}
+
+}
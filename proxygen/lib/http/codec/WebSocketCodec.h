@@ -0,0 +1,219 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/Range.h>
+#include <folly/io/IOBuf.h>
+#include <folly/io/IOBufQueue.h>
+#include <proxygen/lib/http/codec/TransportDirection.h>
+#include <proxygen/lib/utils/ZlibStreamPool.h>
+
+#include <string>
+
+namespace proxygen {
+
+/**
+ * The framing of RFC 6455 WebSockets, for the bytes of a connection that
+ * upgraded to "websocket", with the permessage-deflate extension of
+ * RFC 7692. DOWNSTREAM codecs are servers: they insist on masked ingress
+ * and send unmasked frames, and UPSTREAM ones the other way around.
+ *
+ * Payloads are handed out as the ingress buffers themselves, split off
+ * the read queue and unmasked in place, so a message made of fragments
+ * is a chain of slices rather than a copy. Only compressed messages are
+ * copied, by the inflater.
+ */
+class WebSocketCodec {
+ public:
+  enum class Opcode : uint8_t {
+    CONTINUATION = 0x0,
+    TEXT = 0x1,
+    BINARY = 0x2,
+    CLOSE = 0x8,
+    PING = 0x9,
+    PONG = 0xa,
+  };
+
+  // Status codes of CLOSE frames
+  static const uint16_t kCloseNormal = 1000;
+  static const uint16_t kCloseGoingAway = 1001;
+  static const uint16_t kCloseProtocolError = 1002;
+  static const uint16_t kCloseNoStatus = 1005;
+  // Never sent: the connection ended without a CLOSE
+  static const uint16_t kCloseAbnormal = 1006;
+  static const uint16_t kCloseInvalidData = 1007;
+  static const uint16_t kCloseTooBig = 1009;
+  static const uint16_t kCloseInternalError = 1011;
+
+  // The largest payload of PING, PONG and CLOSE frames
+  static const size_t kMaxControlPayload = 125;
+
+  // The largest frame header: 2 bytes, 8 of length and 4 of mask
+  static const size_t kMaxFrameHeaderSize = 14;
+
+  class Callback {
+   public:
+    virtual ~Callback() {}
+
+    // A TEXT or BINARY message, with its fragments joined, and inflated
+    virtual void onMessage(Opcode opcode,
+                           std::unique_ptr<folly::IOBuf> payload) = 0;
+
+    virtual void onPing(std::unique_ptr<folly::IOBuf> payload) = 0;
+
+    virtual void onPong(std::unique_ptr<folly::IOBuf> payload) {}
+
+    // code is kCloseNoStatus if the CLOSE frame had none
+    virtual void onClose(uint16_t code, folly::StringPiece reason) = 0;
+
+    /**
+     * The peer broke the protocol, or sent a message too large; code is
+     * the status to close the connection with. The codec drops all the
+     * ingress after it.
+     */
+    virtual void onError(uint16_t code, const std::string& reason) = 0;
+  };
+
+  struct DeflateOptions {
+    bool enabled{false};
+    // Start each egress message with an empty window
+    bool noContextTakeover{false};
+    // Of the egress window, 9 to 15
+    int windowBits{15};
+    int level{Z_DEFAULT_COMPRESSION};
+    int memLevel{8};
+    // Smaller egress messages are sent as they are
+    size_t minSize{64};
+  };
+
+  explicit WebSocketCodec(TransportDirection direction);
+
+  void setCallback(Callback* callback) { callback_ = callback; }
+
+  TransportDirection getTransportDirection() const {
+    return transportDirection_;
+  }
+
+  // Larger messages, before or after inflating, are errors (kCloseTooBig)
+  void setMaxMessageSize(size_t maxSize) { maxMessageSize_ = maxSize; }
+
+  // Fragment larger egress messages; 0, the default, never does
+  void setMaxEgressFrameSize(size_t maxSize) { maxEgressFrameSize_ = maxSize; }
+
+  // Fail TEXT messages that are not UTF-8 (kCloseInvalidData). On.
+  void setValidateUTF8(bool validate) { validateUTF8_ = validate; }
+
+  // As negotiated, see negotiateDeflate(); before any frame goes through
+  void setDeflateOptions(const DeflateOptions& options) {
+    deflateOptions_ = options;
+  }
+
+  /**
+   * Parse buf, calling back for every message and control frame that
+   * completes in it, and keep the rest for the next call. Masked payloads
+   * are unmasked in place, also in buffers shared with clones of buf,
+   * which should be past these bytes already.
+   */
+  void onIngress(std::unique_ptr<folly::IOBuf> buf);
+
+  bool hasError() const { return error_; }
+
+  /**
+   * Append the frames of a TEXT or BINARY message, deflated if the
+   * options say so and fragmented to the max egress frame size. Returns
+   * the bytes appended.
+   */
+  size_t generateMessage(folly::IOBufQueue& writeBuf,
+                         Opcode opcode,
+                         std::unique_ptr<folly::IOBuf> payload);
+
+  size_t generatePing(folly::IOBufQueue& writeBuf,
+                      std::unique_ptr<folly::IOBuf> payload = nullptr);
+
+  size_t generatePong(folly::IOBufQueue& writeBuf,
+                      std::unique_ptr<folly::IOBuf> payload = nullptr);
+
+  size_t generateClose(folly::IOBufQueue& writeBuf,
+                       uint16_t code = kCloseNormal,
+                       folly::StringPiece reason = folly::StringPiece());
+
+  // The Sec-WebSocket-Accept answering the Sec-WebSocket-Key key
+  static std::string computeAccept(folly::StringPiece key);
+
+  /**
+   * Choose the first permessage-deflate offer of a Sec-WebSocket-Extensions
+   * header that a server can accept, and set options for it. Returns the
+   * extension to answer with, empty if there is none.
+   */
+  static std::string negotiateDeflate(folly::StringPiece offers,
+                                      DeflateOptions& options);
+
+  /**
+   * XOR len bytes at data with the 4 byte mask, the first byte with byte
+   * offset % 4 of it. In 16 byte blocks with SSE2, 8 byte words otherwise.
+   */
+  static void applyMask(uint8_t* data, size_t len,
+                        const uint8_t mask[4], size_t offset);
+
+  // Whether the bytes of the chain are well formed UTF-8
+  static bool isValidUTF8(const folly::IOBuf& chain);
+
+ private:
+  enum class State : uint8_t {
+    HEADER,
+    PAYLOAD,
+  };
+
+  bool parseHeader();
+  bool parsePayload();
+  void onControlFrame(std::unique_ptr<folly::IOBuf> payload);
+  void onMessageComplete();
+  void fail(uint16_t code, const std::string& reason);
+  size_t generateFrame(folly::IOBufQueue& writeBuf,
+                       Opcode opcode,
+                       bool fin,
+                       bool rsv1,
+                       std::unique_ptr<folly::IOBuf> payload);
+  size_t generateControl(folly::IOBufQueue& writeBuf,
+                         Opcode opcode,
+                         std::unique_ptr<folly::IOBuf> payload);
+  std::unique_ptr<folly::IOBuf> deflate(const folly::IOBuf& payload);
+  std::unique_ptr<folly::IOBuf> inflate(std::unique_ptr<folly::IOBuf> payload);
+
+  Callback* callback_{nullptr};
+  TransportDirection transportDirection_;
+  DeflateOptions deflateOptions_;
+  size_t maxMessageSize_{16 * 1024 * 1024};
+  size_t maxEgressFrameSize_{0};
+  bool validateUTF8_{true};
+  bool error_{false};
+
+  folly::IOBufQueue readBuf_{folly::IOBufQueue::cacheChainLength()};
+  State state_{State::HEADER};
+
+  // The frame being parsed
+  Opcode frameOpcode_{Opcode::CONTINUATION};
+  bool frameFin_{false};
+  bool frameMasked_{false};
+  uint8_t frameMask_[4];
+  uint64_t frameRemaining_{0};
+  uint64_t frameOffset_{0};
+
+  // The fragmented message being assembled, if messageOpcode_ is TEXT or
+  // BINARY
+  Opcode messageOpcode_{Opcode::CONTINUATION};
+  bool messageCompressed_{false};
+  folly::IOBufQueue message_{folly::IOBufQueue::cacheChainLength()};
+
+  ZlibStreamPool::StreamPtr deflater_;
+  ZlibStreamPool::StreamPtr inflater_;
+};
+
+}
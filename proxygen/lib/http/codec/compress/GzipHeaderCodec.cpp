@@ -15,7 +15,10 @@
 #include <folly/io/IOBuf.h>
 #include <proxygen/lib/http/codec/SPDYCodec.h>
 #include <proxygen/lib/http/codec/SPDYConstants.h>
+#include <proxygen/lib/http/codec/SPDYUtil.h>
 #include <proxygen/lib/utils/UnionBasedStatic.h>
+#include <algorithm>
+#include <functional>
 #include <string>
 
 using folly::IOBuf;
@@ -35,46 +38,7 @@ namespace {
 // Maximum size of header names+values after expanding multi-value headers
 const size_t kMaxExpandedHeaderLineBytes = 80 * 1024;
 
-// Pre-initialized compression contexts seeded with the
-// starting dictionary for different SPDY versions - cloning
-// one of these is faster than initializing and seeding a
-// brand new deflate context.
-struct ZlibConfig {
-
-  ZlibConfig(SPDYVersion inVersion, int inCompressionLevel)
-      : version(inVersion), compressionLevel(inCompressionLevel) {}
-
-  bool operator==(const ZlibConfig& lhs) const {
-    return (version == lhs.version) &&
-      (compressionLevel == lhs.compressionLevel);
-  }
-
-  bool operator<(const ZlibConfig& lhs) const {
-    return (version < lhs.version) ||
-        ((version == lhs.version) &&
-         (compressionLevel < lhs.compressionLevel));
-  }
-  SPDYVersion version;
-  int compressionLevel;
-};
-
-struct ZlibContext {
-  ~ZlibContext() {
-    deflateEnd(&deflater);
-    inflateEnd(&inflater);
-  }
-
-  z_stream deflater;
-  z_stream inflater;
-};
-
-
-typedef std::map<ZlibConfig, std::unique_ptr<ZlibContext>> ZlibContextMap;
-
 DEFINE_UNION_STATIC(ThreadLocalPtr<IOBuf>, IOBuf, s_buf);
-DEFINE_UNION_STATIC(folly::ThreadLocal<ZlibContextMap>,
-                    ThreadLocalContextMap,
-                    s_zlibContexts);
 
 folly::IOBuf& getStaticHeaderBufSpace(size_t size) {
   if (!s_buf.data) {
@@ -90,64 +54,150 @@ folly::IOBuf& getStaticHeaderBufSpace(size_t size) {
   return *s_buf.data;
 }
 
-void appendString(uint8_t*& dst, const string& str) {
-  size_t len = str.length();
-  memcpy(dst, str.data(), len);
-  dst += len;
-}
+/**
+ * Scratch space of encode(), shared by the codecs of a thread so that the
+ * codec of every new session doesn't have to grow its own
+ */
+struct EncodeScratch {
+  vector<int> nextValue;
+  vector<bool> firstValue;
+  vector<size_t> combinedValueLen;
+};
+
+DEFINE_UNION_STATIC(folly::ThreadLocal<EncodeScratch>, EncodeScratch,
+                    s_encodeScratch);
+
+// Uncompressed bytes gathered before they are handed to deflate
+const size_t kEncodeChunkSize = 4096;
 
 /**
- * get the thread local cached zlib context
+ * Feeds the uncompressed name/value block to deflate a chunk at a time,
+ * so that it never has to be held whole. Strings that don't fit in a
+ * chunk go to deflate straight from where they are.
  */
-static const ZlibContext* getZlibContext(SPDYVersionSettings versionSettings,
-                                         int compressionLevel) {
-  ZlibConfig zlibConfig(versionSettings.version, compressionLevel);
-  auto match = s_zlibContexts.data->find(zlibConfig);
-  if (match != s_zlibContexts.data->end()) {
-    return match->second.get();
-  } else {
-    // This is the first request for the specified SPDY version and compression
-    // level in this thread, so we need to construct the initial compressor and
-    // decompressor contexts.
-    auto newContext = folly::make_unique<ZlibContext>();
-    newContext->deflater.zalloc = Z_NULL;
-    newContext->deflater.zfree = Z_NULL;
-    newContext->deflater.opaque = Z_NULL;
-    newContext->deflater.avail_in = 0;
-    newContext->deflater.next_in = Z_NULL;
-    int windowBits  = (compressionLevel == Z_NO_COMPRESSION) ? 8 : 11;
-    int r = deflateInit2(
-        &(newContext->deflater),
-        compressionLevel,
-        Z_DEFLATED, // compression method
-        windowBits, // log2 of the compression window size, negative value
-                    // means raw deflate output format w/o libz header
-        1,          // memory size for internal compression state, 1-9
-        Z_DEFAULT_STRATEGY);
-    CHECK(r == Z_OK);
-    if (compressionLevel != Z_NO_COMPRESSION) {
-      r = deflateSetDictionary(&(newContext->deflater), versionSettings.dict,
-                               versionSettings.dictSize);
-      CHECK(r == Z_OK);
+class DeflateWriter {
+ public:
+  DeflateWriter(z_stream* deflater, const SPDYVersionSettings& settings)
+      : deflater_(deflater),
+        settings_(settings) {}
+
+  void appendSize(size_t size) {
+    uint8_t buf[sizeof(uint32_t)];
+    uint8_t* dst = buf;
+    settings_.appendSizeFun(dst, size);
+    append(buf, dst - buf);
+  }
+
+  void append(const string& str) {
+    append((const uint8_t*)str.data(), str.length());
+  }
+
+  void appendLowercase(const string& str) {
+    if (str.length() > kEncodeChunkSize - used_) {
+      flushChunk();
+      if (str.length() > kEncodeChunkSize) {
+        string lower(str);
+        SPDYUtil::lowercaseHeaderName(lower);
+        return deflateData((const uint8_t*)lower.data(), lower.length(),
+                           Z_NO_FLUSH);
+      }
+    }
+    // copies and lowercases in one pass
+    SPDYUtil::lowercaseHeaderName(
+      folly::ByteRange((const uint8_t*)str.data(), str.length()),
+      chunk_ + used_);
+    used_ += str.length();
+  }
+
+  void append(const uint8_t* data, size_t len) {
+    if (len > kEncodeChunkSize - used_) {
+      flushChunk();
+      if (len > kEncodeChunkSize) {
+        return deflateData(data, len, Z_NO_FLUSH);
+      }
     }
+    memcpy(chunk_ + used_, data, len);
+    used_ += len;
+  }
+
+  void finish() {
+    deflateData(chunk_, used_, Z_SYNC_FLUSH);
+    used_ = 0;
+  }
+
+ private:
+  void flushChunk() {
+    if (used_ > 0) {
+      deflateData(chunk_, used_, Z_NO_FLUSH);
+      used_ = 0;
+    }
+  }
 
-    newContext->inflater.zalloc = Z_NULL;
-    newContext->inflater.zfree = Z_NULL;
-    newContext->inflater.opaque = Z_NULL;
-    newContext->inflater.avail_in = 0;
-    newContext->inflater.next_in = Z_NULL;
-// TODO (t6405700): Port the zlib optimization forward to 1.2.8 for gcc 4.9
-#if ZLIB_VERNUM == 0x1250
-    // set zlib's reserved flag to allocate smaller initial sliding window, then
-    // double it if necessary
-    newContext->inflater.reserved = 0x01;
-#endif
-    r = inflateInit2(&(newContext->inflater), 0);
+  void deflateData(const uint8_t* data, size_t len, int flush) {
+    deflater_->next_in = const_cast<uint8_t*>(data);
+    deflater_->avail_in = len;
+    int r = deflate(deflater_, flush);
     CHECK(r == Z_OK);
+    CHECK(deflater_->avail_in == 0);
+  }
+
+  z_stream* deflater_;
+  const SPDYVersionSettings& settings_;
+  uint8_t chunk_[kEncodeChunkSize];
+  size_t used_{0};
+};
+
+bool sameName(const Header& a, const Header& b) {
+  return a.code == b.code && *a.name == *b.name;
+}
+
+size_t hashName(const Header& header) {
+  if (header.code != HTTP_HEADER_OTHER) {
+    return header.code;
+  }
+  return std::hash<string>()(*header.name);
+}
+
+/**
+ * The headers with the same name as an earlier one, which SPDY requires
+ * to be combined with it. next[i] is set to the index of the next header
+ * with the same name as header i, or -1, and first[i] to whether header i
+ * is the first with its name.
+ */
+void groupHeaders(const vector<Header>& headers,
+                  vector<int>& next,
+                  vector<bool>& first) {
+  size_t n = headers.size();
+  next.assign(n, -1);
+  first.assign(n, true);
+
+  if (std::is_sorted(headers.begin(), headers.end())) {
+    // Duplicates are already next to each other
+    for (size_t i = 1; i < n; i++) {
+      if (sameName(headers[i - 1], headers[i])) {
+        next[i - 1] = i;
+        first[i] = false;
+      }
+    }
+    return;
+  }
 
-    auto result = newContext.get();
-    s_zlibContexts.data->emplace(zlibConfig, std::move(newContext));
-    return result;
+  // Open addressing, with the last header seen for each name
+  size_t tableSize = 16;
+  while (tableSize < n * 2) {
+    tableSize *= 2;
+  }
+  vector<int> table(tableSize, -1);
+  for (size_t i = 0; i < n; i++) {
+    size_t slot = hashName(headers[i]) & (tableSize - 1);
+    while (table[slot] >= 0 && !sameName(headers[table[slot]], headers[i])) {
+      slot = (slot + 1) & (tableSize - 1);
+    }
+    if (table[slot] >= 0) {
+      next[table[slot]] = i;
+      first[i] = false;
+    }
+    table[slot] = i;
   }
 }
 
@@ -156,13 +206,38 @@ static const ZlibContext* getZlibContext(SPDYVersionSettings versionSettings,
 namespace proxygen {
 
 GzipHeaderCodec::GzipHeaderCodec(int compressionLevel,
-                                 const SPDYVersionSettings& versionSettings)
+                                 const SPDYVersionSettings& versionSettings,
+                                 int windowBits,
+                                 int memLevel)
     : versionSettings_(versionSettings) {
-  // Create compression and decompression contexts by cloning thread-local
-  // copies of the initial SPDY compression state
-  auto context = getZlibContext(versionSettings, compressionLevel);
-  deflateCopy(&deflater_, const_cast<z_stream*>(&(context->deflater)));
-  inflateCopy(&inflater_, const_cast<z_stream*>(&(context->inflater)));
+  DCHECK(windowBits >= 9 && windowBits <= MAX_WBITS);
+  DCHECK(memLevel >= 1 && memLevel <= MAX_MEM_LEVEL);
+  if (compressionLevel == Z_NO_COMPRESSION) {
+    // No window needed
+    windowBits = 8;
+    memLevel = 1;
+  }
+  compressionLevel_ = compressionLevel;
+  windowBits_ = windowBits;
+  memLevel_ = memLevel;
+  // Reuse the compression and decompression contexts of codecs that are
+  // gone, rather than allocating new ones
+  if (compressionLevel != Z_NO_COMPRESSION) {
+    // copied from a stream that has ingested the dictionary already
+    deflater_ = ZlibStreamPool::getPrimedDeflater(
+        compressionLevel,
+        windowBits, // log2 of the compression window size, negative value
+                    // means raw deflate output format w/o libz header
+        memLevel,   // memory size for internal compression state, 1-9
+        versionSettings.dict,
+        versionSettings.dictSize);
+  } else {
+    deflater_ = ZlibStreamPool::getDeflater(compressionLevel, windowBits,
+                                            memLevel);
+  }
+  CHECK(deflater_);
+  inflater_ = ZlibStreamPool::getInflater(0);
+  CHECK(inflater_);
 }
 
 GzipHeaderCodec::GzipHeaderCodec(int compressionLevel,
@@ -171,9 +246,24 @@ GzipHeaderCodec::GzipHeaderCodec(int compressionLevel,
         compressionLevel,
         SPDYCodec::getVersionSettings(version)) {}
 
-GzipHeaderCodec::~GzipHeaderCodec() {
-  deflateEnd(&deflater_);
-  inflateEnd(&inflater_);
+size_t GzipHeaderCodec::getCompressionStateSize() const {
+  return (deflater_ ? ZlibStreamPool::getAllocatedBytes(deflater_.get()) : 0) +
+    ZlibStreamPool::getAllocatedBytes(inflater_.get()) +
+    (partialHeaders_ ? partialHeaders_->capacity() : 0);
+}
+
+void GzipHeaderCodec::releaseIdleMemory() {
+  // Every header block ends with a sync flush, so the peer is at a block
+  // boundary from where any deflate output can follow. The decompression
+  // context has to stay: the peer may refer back to anything in its
+  // window. Before the first block the peer hasn't seen the zlib header
+  // or the dictionary, which only the primed context puts out.
+  if (deflaterStarted_) {
+    deflater_.reset();
+  }
+  if (!partialPending_) {
+    partialHeaders_.reset();
+  }
 }
 
 folly::IOBuf& GzipHeaderCodec::getHeaderBuf() {
@@ -181,100 +271,90 @@ folly::IOBuf& GzipHeaderCodec::getHeaderBuf() {
 }
 
 unique_ptr<IOBuf> GzipHeaderCodec::encode(vector<Header>& headers) noexcept {
-  // Build a sequence of the header names and values, sorted by name.
-  // The purpose of the sort is to make it easier to combine the
-  // values of multiple headers with the same name.  The SPDY spec
-  // prohibits any header name from appearing more than once in the
-  // Name/Value list, so we must combine values when serializing.
-  std::sort(headers.begin(), headers.end());
-
-  auto& uncompressed = getHeaderBuf();
-  // Compute the amount of space needed to hold the uncompressed
-  // representation of the headers.  This is an upper bound on the
-  // amount of space we'll actually need, because if we end up
-  // combining any headers with the same name, the combined
-  // representation will be smaller than the original.
-  size_t maxUncompressedSize = versionSettings_.nameValueSize;
-  for (const Header& header : headers) {
-    maxUncompressedSize += versionSettings_.nameValueSize;
-    maxUncompressedSize += header.name->length();
-    maxUncompressedSize += versionSettings_.nameValueSize;
-    maxUncompressedSize += header.value->length();
-  }
-
-  // TODO: give on 'onError()' callback if the space in uncompressed buf
-  // cannot fit the headers and then skip the "reserve" code below. We
-  // have already reserved the maximum legal amount of space for
-  // uncompressed headers.
-
-  VLOG(5) << "reserving " << maxUncompressedSize
-          << " bytes for uncompressed headers";
-  uncompressed.reserve(0, maxUncompressedSize);
-
-  // Serialize the uncompressed representation of the headers.
-  uint8_t* dst = uncompressed.writableData();
-  dst += versionSettings_.nameValueSize; // Leave space for count of headers.
-  HTTPHeaderCode lastCode = HTTP_HEADER_OTHER;
-  const string* lastName = &empty_string;
-  uint8_t* lastValueLenPtr = nullptr;
-  size_t lastValueLen = 0;
+  // The SPDY spec prohibits any header name from appearing more than once
+  // in the Name/Value list, so the values of multiple headers with the
+  // same name are combined, at the first one.
+  EncodeScratch& scratch = *s_encodeScratch.data;
+  groupHeaders(headers, scratch.nextValue, scratch.firstValue);
+
+  // Compute the length of the uncompressed representation of the headers,
+  // for the compressed output to fit in one buffer.
   unsigned numHeaders = 0;
-  for (const Header& header : headers) {
-    if ((header.code != lastCode) || (*header.name != *lastName)) {
-      // Simple case: this header name is different from the previous
-      // one, so we don't need to combine values.
-      numHeaders++;
-      versionSettings_.appendSizeFun(dst, header.name->length());
-
-      // lowercasing the header name inline
-      char* nameBegin = (char *)dst;
-      appendString(dst, *header.name);
-      folly::toLowerAscii((char *)nameBegin, header.name->size());
-
-      lastValueLenPtr = dst;
-      lastValueLen = header.value->length();
-      versionSettings_.appendSizeFun(dst, header.value->length());
-      appendString(dst, *header.value);
-      lastCode = header.code;
-      lastName = header.name;
-    } else if (header.value->length() > 0) {
-      // More complicated case: we do need to combine values.
-      if (lastValueLen > 0) {
-        // Only nul terminate if previous value was non-empty
-        *dst++ = 0;  // SPDY uses a null byte as a separator
-        lastValueLen++;
+  size_t uncompressedLen = versionSettings_.nameValueSize;
+  scratch.combinedValueLen.assign(headers.size(), 0);
+  for (size_t i = 0; i < headers.size(); i++) {
+    if (!scratch.firstValue[i]) {
+      continue;
+    }
+    numHeaders++;
+    size_t valueLen = headers[i].value->length();
+    for (int j = scratch.nextValue[i]; j >= 0; j = scratch.nextValue[j]) {
+      if (headers[j].value->length() > 0) {
+        // Only nul terminate if previous value was non-empty; SPDY uses a
+        // null byte as a separator
+        if (valueLen > 0) {
+          valueLen++;
+        }
+        valueLen += headers[j].value->length();
       }
-      appendString(dst, *header.value);
-      // Go back and rewrite the length field in front of the value
-      lastValueLen += header.value->length();
-      uint8_t* tmp = lastValueLenPtr;
-      versionSettings_.appendSizeFun(tmp, lastValueLen);
     }
+    scratch.combinedValueLen[i] = valueLen;
+    uncompressedLen += versionSettings_.nameValueSize * 2 +
+      headers[i].name->length() + valueLen;
   }
 
-  // Compute the uncompressed length; if we combined any header values,
-  // we will have used less space than originally estimated.
-  size_t uncompressedLen = dst - uncompressed.writableData();
-
-  // Go back and write the count of unique header names at the start.
-  dst = uncompressed.writableData();
-  versionSettings_.appendSizeFun(dst, numHeaders);
+  if (!deflater_) {
+    // Continue the stream after releaseIdleMemory(). The peer has already
+    // seen the zlib header, so this one puts out raw deflate data, and its
+    // window starts empty, so it doesn't need the dictionary either.
+    // Raw deflate can't take the smallest window.
+    deflater_ = ZlibStreamPool::getDeflater(compressionLevel_,
+                                            -std::max(windowBits_, 9),
+                                            memLevel_);
+    CHECK(deflater_);
+  }
 
   // Allocate a contiguous space big enough to hold the compressed headers,
   // plus any headroom requested by the caller.
-  size_t maxDeflatedSize = deflateBound(&deflater_, uncompressedLen);
+  size_t maxDeflatedSize = deflateBound(deflater_.get(), uncompressedLen);
   unique_ptr<IOBuf> out(IOBuf::create(maxDeflatedSize + encodeHeadroom_));
   out->advance(encodeHeadroom_);
-
-  // Compress
-  deflater_.next_in = uncompressed.writableData();
-  deflater_.avail_in = uncompressedLen;
-  deflater_.next_out = out->writableData();
-  deflater_.avail_out = maxDeflatedSize;
-  int r = deflate(&deflater_, Z_SYNC_FLUSH);
-  CHECK(r == Z_OK);
-  CHECK(deflater_.avail_in == 0);
-  out->append(maxDeflatedSize - deflater_.avail_out);
+  deflater_->next_out = out->writableData();
+  deflater_->avail_out = maxDeflatedSize;
+
+  // Serialize the uncompressed representation of the headers, compressing
+  // it as it goes.
+  DeflateWriter writer(deflater_.get(), versionSettings_);
+  writer.appendSize(numHeaders);
+  for (size_t i = 0; i < headers.size(); i++) {
+    if (!scratch.firstValue[i]) {
+      continue;
+    }
+    writer.appendSize(headers[i].name->length());
+    if (headers[i].code != HTTP_HEADER_OTHER) {
+      // common names are already known in lowercase
+      writer.append(
+        *HTTPCommonHeaders::getPointerToLowerHeaderName(headers[i].code));
+    } else {
+      writer.appendLowercase(*headers[i].name);
+    }
+    writer.appendSize(scratch.combinedValueLen[i]);
+    writer.append(*headers[i].value);
+    bool separate = headers[i].value->length() > 0;
+    for (int j = scratch.nextValue[i]; j >= 0; j = scratch.nextValue[j]) {
+      if (headers[j].value->length() > 0) {
+        if (separate) {
+          const uint8_t kSeparator = 0;
+          writer.append(&kSeparator, 1);
+        }
+        writer.append(*headers[j].value);
+        separate = true;
+      }
+    }
+  }
+  writer.finish();
+  out->append(maxDeflatedSize - deflater_->avail_out);
+  deflaterStarted_ = true;
 
   VLOG(4) << "header size orig=" << uncompressedLen
           << ", max deflated=" << maxDeflatedSize
@@ -289,46 +369,34 @@ unique_ptr<IOBuf> GzipHeaderCodec::encode(vector<Header>& headers) noexcept {
   return std::move(out);
 }
 
-Result<HeaderDecodeResult, HeaderDecodeError>
-GzipHeaderCodec::decode(Cursor& cursor, uint32_t length) noexcept {
-  outHeaders_.clear();
-
-  // empty header block
-  if (length == 0) {
-    return HeaderDecodeResult{outHeaders_, 0};
-  }
-
-  // Get the thread local buffer space to use
-  auto& uncompressed = getHeaderBuf();
-  uint32_t consumed = 0;
-  // Decompress the headers
+HeaderDecodeError GzipHeaderCodec::inflateHeaders(Cursor& cursor,
+                                                  uint32_t length,
+                                                  IOBuf& out) noexcept {
   while (length > 0) {
     auto next = cursor.peek();
     uint32_t chunkLen = std::min((uint32_t)next.second, length);
-    inflater_.avail_in = chunkLen;
-    inflater_.next_in = (uint8_t *)next.first;
+    inflater_->avail_in = chunkLen;
+    inflater_->next_in = (uint8_t *)next.first;
     do {
-      if (uncompressed.tailroom() == 0) {
-        // This code should not execute, since we throw an error if the
-        // decompressed size of the headers is too large and we initialize
-        // the buffer to that size.
-        LOG(ERROR) << "Doubling capacity of SPDY headers buffer";
-        uncompressed.reserve(0, uncompressed.capacity());
+      if (out.tailroom() == 0) {
+        // Only the buffer of a partial block starts out smaller than
+        // maxUncompressed_, which is checked below
+        out.reserve(0, out.capacity());
       }
 
-      inflater_.next_out = uncompressed.writableTail();
-      inflater_.avail_out = uncompressed.tailroom();
-      int r = inflate(&inflater_, Z_NO_FLUSH);
+      inflater_->next_out = out.writableTail();
+      inflater_->avail_out = out.tailroom();
+      int r = inflate(inflater_.get(), Z_NO_FLUSH);
       if (r == Z_NEED_DICT) {
         // we cannot initialize the inflater dictionary before calling inflate()
         // as it checks the adler-32 checksum of the supplied dictionary
-        r = inflateSetDictionary(&inflater_, versionSettings_.dict,
+        r = inflateSetDictionary(inflater_.get(), versionSettings_.dict,
                                  versionSettings_.dictSize);
         if (r != Z_OK) {
           LOG(ERROR) << "inflate set dictionary failed with error=" << r;
           return HeaderDecodeError::INFLATE_DICTIONARY;
         }
-        inflater_.avail_out = 0;
+        inflater_->avail_out = 0;
         continue;
       }
       if (r != 0) {
@@ -336,25 +404,71 @@ GzipHeaderCodec::decode(Cursor& cursor, uint32_t length) noexcept {
         LOG(ERROR) << "inflate failed with error=" << r;
         return HeaderDecodeError::BAD_ENCODING;
       }
-      uncompressed.append(uncompressed.tailroom() - inflater_.avail_out);
-      if (uncompressed.length() > maxUncompressed_) {
+      out.append(out.tailroom() - inflater_->avail_out);
+      if (out.length() > maxUncompressed_) {
         LOG(ERROR) << "Decompressed headers too large";
         return HeaderDecodeError::HEADERS_TOO_LARGE;
       }
-    } while (inflater_.avail_in > 0 && inflater_.avail_out == 0);
+    } while (inflater_->avail_in > 0 && inflater_->avail_out == 0);
     length -= chunkLen;
-    consumed += chunkLen;
     cursor.skip(chunkLen);
   }
+  return HeaderDecodeError::NONE;
+}
+
+HeaderDecodeError GzipHeaderCodec::decodePartial(Cursor& cursor,
+                                                 uint32_t length) noexcept {
+  if (!partialPending_) {
+    // The thread's buffer can't hold on to the block until it is whole,
+    // other codecs decode into it meanwhile. Start small, most blocks
+    // inflate to a few times their size.
+    size_t capacity = std::min<size_t>(maxUncompressed_,
+                                       std::max<size_t>(length * 4, 1024));
+    partialHeaders_ = IOBuf::create(capacity);
+    partialConsumed_ = 0;
+    partialPending_ = true;
+  }
+  partialConsumed_ += length;
+  return inflateHeaders(cursor, length, *partialHeaders_);
+}
+
+Result<HeaderDecodeResult, HeaderDecodeError>
+GzipHeaderCodec::decode(Cursor& cursor, uint32_t length) noexcept {
+  outHeaders_.clear();
+
+  // compressed bytes of the whole block, of which only length are left
+  uint32_t consumed = length;
+  IOBuf* uncompressed = nullptr;
+  if (partialPending_) {
+    // The rest of the block decodePartial() started
+    partialPending_ = false;
+    consumed += partialConsumed_;
+    uncompressed = partialHeaders_.get();
+  } else {
+    // headers of the previous block are no longer referenced
+    partialHeaders_.reset();
+    // empty header block
+    if (length == 0) {
+      return HeaderDecodeResult{outHeaders_, 0};
+    }
+    // Get the thread local buffer space to use
+    uncompressed = &getHeaderBuf();
+  }
+
+  // Decompress the headers
+  auto err = inflateHeaders(cursor, length, *uncompressed);
+  if (err != HeaderDecodeError::NONE) {
+    return err;
+  }
 
   decodedSize_.compressed = consumed;
-  decodedSize_.uncompressed = uncompressed.computeChainDataLength();
+  decodedSize_.uncompressed = uncompressed->computeChainDataLength();
   if (stats_) {
     stats_->recordDecode(Type::GZIP, decodedSize_);
   }
 
   size_t expandedHeaderLineBytes = 0;
-  auto result = parseNameValues(uncompressed);
+  auto result = parseNameValues(*uncompressed);
   if (result.isError()) {
     return result.error();
   }
@@ -365,7 +479,7 @@ GzipHeaderCodec::decode(Cursor& cursor, uint32_t length) noexcept {
     return HeaderDecodeError::HEADERS_TOO_LARGE;
   }
 
-  return HeaderDecodeResult{outHeaders_, consumed};
+  return HeaderDecodeResult{outHeaders_, length};
 }
 
 void GzipHeaderCodec::decodeStreaming(
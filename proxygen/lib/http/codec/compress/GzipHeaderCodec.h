@@ -16,6 +16,8 @@
 #include <memory>
 #include <proxygen/lib/http/codec/SPDYVersionSettings.h>
 #include <proxygen/lib/http/codec/compress/HeaderCodec.h>
+#include <proxygen/lib/utils/ZlibStreamPool.h>
+#include <vector>
 #include <zlib.h>
 
 namespace proxygen {
@@ -23,11 +25,22 @@ namespace proxygen {
 class GzipHeaderCodec : public HeaderCodec {
 
  public:
+  // Deflate parameters of the compression context
+  static const int kDefaultWindowBits = 11;
+  static const int kDefaultMemLevel = 1;
+
+  /**
+   * windowBits (9-15) and memLevel (1-9) size the compression context, as
+   * in deflateInit2(): smaller ones hold less memory per session and
+   * compress worse. The decompression context has to follow whatever
+   * window the peer compresses with.
+   */
   GzipHeaderCodec(int compressionLevel,
-                  const SPDYVersionSettings& versionSettings);
+                  const SPDYVersionSettings& versionSettings,
+                  int windowBits = kDefaultWindowBits,
+                  int memLevel = kDefaultMemLevel);
   explicit GzipHeaderCodec(int compressionLevel,
                            SPDYVersion version = SPDYVersion::SPDY3_1);
-  ~GzipHeaderCodec() override;
 
   std::unique_ptr<folly::IOBuf> encode(
     std::vector<compress::Header>& headers) noexcept override;
@@ -35,14 +48,37 @@ class GzipHeaderCodec : public HeaderCodec {
   Result<HeaderDecodeResult, HeaderDecodeError>
   decode(folly::io::Cursor& cursor, uint32_t length) noexcept override;
 
+  bool supportsPartialDecode() const override {
+    return true;
+  }
+
+  HeaderDecodeError decodePartial(folly::io::Cursor& cursor,
+                                  uint32_t length) noexcept override;
+
   void decodeStreaming(
       folly::io::Cursor& cursor,
       uint32_t length,
       HeaderCodec::StreamingCallback* streamingCb) noexcept override;
 
+  size_t getCompressionStateSize() const override;
+
+  /**
+   * Frees the compression context, once it has compressed a header block.
+   * The next header block is compressed by a new one, which can't refer to
+   * the blocks before it.
+   */
+  void releaseIdleMemory() override;
+
  private:
   folly::IOBuf& getHeaderBuf();
 
+  /**
+   * Inflate length bytes from the cursor to the end of out.
+   */
+  HeaderDecodeError inflateHeaders(folly::io::Cursor& cursor,
+                                   uint32_t length,
+                                   folly::IOBuf& out) noexcept;
+
   /**
    * Parse the decompressed name/value header block.
    */
@@ -50,7 +86,19 @@ class GzipHeaderCodec : public HeaderCodec {
   parseNameValues(const folly::IOBuf&) noexcept;
 
   const SPDYVersionSettings& versionSettings_;
-  z_stream deflater_;
-  z_stream inflater_;
+  // deflate parameters, to set up the compression context again
+  int compressionLevel_;
+  int windowBits_;
+  int memLevel_;
+  ZlibStreamPool::StreamPtr deflater_;
+  // whether deflater_ put out the zlib header, so the peer can take raw
+  // deflate data from here on
+  bool deflaterStarted_{false};
+  ZlibStreamPool::StreamPtr inflater_;
+  // What decodePartial() inflated of the block decode() is to finish, or
+  // the last block it finished, whose headers point into it
+  std::unique_ptr<folly::IOBuf> partialHeaders_;
+  uint32_t partialConsumed_{0};
+  bool partialPending_{false};
 };
 }
@@ -12,6 +12,7 @@
 #include <algorithm>
 #include <folly/String.h>
 #include <folly/io/Cursor.h>
+#include <proxygen/lib/http/codec/SPDYUtil.h>
 #include <proxygen/lib/http/codec/compress/HPACKHeader.h>
 
 using folly::IOBuf;
@@ -47,16 +48,23 @@ unique_ptr<IOBuf> HPACKCodec::encode(vector<Header>& headers) noexcept {
   // convert to HPACK API format
   uint32_t uncompressed = 0;
   for (const auto& h : headers) {
-    converted.emplace_back(*h.name, *h.value);
-    // This is ugly but since we're not changing the size
-    // of the string I'm assuming this is OK
+    if (h.code != HTTP_HEADER_OTHER) {
+      converted.emplace_back(
+        *HTTPCommonHeaders::getPointerToLowerHeaderName(h.code), *h.value);
+    } else {
+      converted.emplace_back(*h.name, *h.value);
+      SPDYUtil::lowercaseHeaderName(converted.back().name);
+    }
     auto& header = converted.back();
-    char* mutableName = const_cast<char*>(header.name.data());
-    folly::toLowerAscii(mutableName, header.name.size());
 
     uncompressed += header.name.size() + header.value.size() + 2;
   }
   auto buf = encoder_->encode(converted, encodeHeadroom_);
+  recordEncodedSize(buf.get(), uncompressed);
+  return std::move(buf);
+}
+
+void HPACKCodec::recordEncodedSize(const IOBuf* buf, uint32_t uncompressed) {
   encodedSize_.compressed = 0;
   if (buf) {
     encodedSize_.compressed = buf->computeChainDataLength();
@@ -65,7 +73,6 @@ unique_ptr<IOBuf> HPACKCodec::encode(vector<Header>& headers) noexcept {
   if (stats_) {
     stats_->recordEncode(Type::HPACK, encodedSize_);
   }
-  return std::move(buf);
 }
 
 Result<HeaderDecodeResult, HeaderDecodeError>
@@ -131,10 +138,12 @@ void HPACKCodec::decodeStreaming(
   onHeadersComplete();
 }
 
-void HPACKCodec::onHeader(const std::string& name, const std::string& value) {
+void HPACKCodec::onHeader(HTTPHeaderCode code,
+                          folly::StringPiece name,
+                          folly::StringPiece value) {
   assert(streamingCb_ != nullptr);
   decodedSize_.uncompressed += name.size() + value.size() + 2;
-  streamingCb_->onHeader(name, value);
+  streamingCb_->onHeader(code, name, value);
 }
 
 void HPACKCodec::onHeadersComplete() {
@@ -147,12 +156,19 @@ void HPACKCodec::onHeadersComplete() {
 
 void HPACKCodec::onDecodeError(HeaderDecodeError decodeError) {
   assert(streamingCb_ != nullptr);
+  // same mapping as decode()
+  auto err = decoder_->getError();
+  if (err == HPACK::DecodeError::HEADERS_TOO_LARGE ||
+      err == HPACK::DecodeError::LITERAL_TOO_LARGE) {
+    if (stats_) {
+      stats_->recordDecodeTooLarge(Type::HPACK);
+    }
+    streamingCb_->onDecodeError(HeaderDecodeError::HEADERS_TOO_LARGE);
+    return;
+  }
   if (stats_) {
     stats_->recordDecodeError(Type::HPACK);
   }
-  if (decoder_->getError() == HPACK::DecodeError::HEADERS_TOO_LARGE) {
-    streamingCb_->onDecodeError(HeaderDecodeError::HEADERS_TOO_LARGE);
-  }
   streamingCb_->onDecodeError(HeaderDecodeError::BAD_ENCODING);
 }
 }
@@ -49,7 +49,9 @@ class HPACKCodec : public HeaderCodec, HeaderCodec::StreamingCallback {
   decode(folly::io::Cursor& cursor, uint32_t length) noexcept override;
 
   // Callbacks that handle Codec-level stats and errors
-  void onHeader(const std::string& name, const std::string& value) override;
+  void onHeader(HTTPHeaderCode code,
+                folly::StringPiece name,
+                folly::StringPiece value) override;
   void onHeadersComplete() override;
   void onDecodeError(HeaderDecodeError decodeError) override;
 
@@ -62,11 +64,38 @@ class HPACKCodec : public HeaderCodec, HeaderCodec::StreamingCallback {
     encoder_->setHeaderTableSize(size);
   }
 
+  void setMaxUncompressed(uint32_t maxUncompressed) override {
+    HeaderCodec::setMaxUncompressed(maxUncompressed);
+    decoder_->setMaxUncompressed(maxUncompressed);
+  }
+
   void setDecoderHeaderTableMaxSize(uint32_t size) {
     decoder_->setHeaderTableMaxSize(size);
   }
 
+  void setEncoderIndexingPolicy(std::unique_ptr<HPACKIndexingPolicy> policy) {
+    encoder_->setIndexingPolicy(std::move(policy));
+  }
+
+  const HPACKEncoder::IndexingStats& getEncoderIndexingStats() const {
+    return encoder_->getIndexingStats();
+  }
+
+  size_t getCompressionStateSize() const override {
+    return encoder_->getTable().bytes() + decoder_->getTable().bytes();
+  }
+
+  void releaseIdleMemory() override {
+    encoder_->releaseIdleMemory();
+    decoder_->releaseIdleMemory();
+  }
+
  protected:
+  /**
+   * Update the encoded size and the stats after encoding a header block
+   */
+  void recordEncodedSize(const folly::IOBuf* buf, uint32_t uncompressed);
+
   std::unique_ptr<HPACKEncoder> encoder_;
   std::unique_ptr<HPACKDecoder> decoder_;
 
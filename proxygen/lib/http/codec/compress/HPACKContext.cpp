@@ -15,8 +15,9 @@ using std::string;
 
 namespace proxygen {
 
-HPACKContext::HPACKContext(HPACK::MessageType msgType, uint32_t tableSize) :
-    table_(tableSize), msgType_(msgType) {
+HPACKContext::HPACKContext(HPACK::MessageType msgType, uint32_t tableSize,
+                           bool referenceSet) :
+    table_(tableSize, referenceSet), msgType_(msgType) {
 }
 
 uint32_t HPACKContext::getIndex(const HPACKHeader& header) const {
@@ -17,8 +17,12 @@ namespace proxygen {
 
 class HPACKContext {
  public:
+  /**
+   * referenceSet is for the drafts before 09, see HeaderTable
+   */
   HPACKContext(HPACK::MessageType msgType,
-               uint32_t tableSize);
+               uint32_t tableSize,
+               bool referenceSet = true);
   virtual ~HPACKContext() {}
 
   /**
@@ -50,8 +54,16 @@ class HPACKContext {
     return table_;
   }
 
+  /**
+   * Free what the context keeps around only to spare allocations, while
+   * there is no header block to code
+   */
+  virtual void releaseIdleMemory() {
+    table_.compact();
+  }
+
  protected:
-  virtual const HeaderTable& getStaticTable() const {
+  virtual const StaticHeaderTable& getStaticTable() const {
     return StaticHeaderTable::get();
   }
 
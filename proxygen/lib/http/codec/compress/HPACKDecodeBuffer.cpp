@@ -42,6 +42,17 @@ uint8_t HPACKDecodeBuffer::peek() {
 }
 
 DecodeError HPACKDecodeBuffer::decodeLiteral(std::string& literal) {
+  folly::StringPiece decoded;
+  DecodeError result = decodeLiteral(literal, decoded);
+  if (result == DecodeError::NONE && decoded.data() != literal.data()) {
+    literal.assign(decoded.data(), decoded.size());
+  }
+  return result;
+}
+
+DecodeError HPACKDecodeBuffer::decodeLiteral(std::string& scratch,
+                                             folly::StringPiece& literal) {
+  scratch.clear();
   literal.clear();
   if (remainingBytes_ == 0) {
     LOG(ERROR) << "remainingBytes_ == 0";
@@ -61,29 +72,44 @@ DecodeError HPACKDecodeBuffer::decodeLiteral(std::string& literal) {
                << size << " remainingBytes_=" << remainingBytes_;
     return DecodeError::BUFFER_UNDERFLOW;
   }
-  if (size > HPACK::kMaxLiteralSize) {
-    LOG(ERROR) << "Literal too large, size=" << size;
+  // every character takes at most kMaxCodeBits, so this many of them is
+  // the shortest the huffman literal can decode to
+  uint32_t minDecodedSize = huffman ? size * 8 / huffman::kMaxCodeBits : size;
+  if (size > HPACK::kMaxLiteralSize || minDecodedSize > maxLiteralSize_) {
+    LOG(ERROR) << "Literal too large, size=" << size
+               << " maxLiteralSize_=" << maxLiteralSize_;
     return DecodeError::LITERAL_TOO_LARGE;
   }
-  const uint8_t* data;
-  unique_ptr<IOBuf> tmpbuf;
+  remainingBytes_ -= size;
   // handle the case where the buffer spans multiple buffers
   if (cursor_.length() >= size) {
-    data = cursor_.data();
+    const uint8_t* data = cursor_.data();
     cursor_.skip(size);
-  } else {
+    if (huffman) {
+      huffmanTree_.decode(data, size, scratch);
+      literal = scratch;
+    } else {
+      literal.reset((const char *)data, size);
+    }
+  } else if (huffman) {
     // temporary buffer to pull the chunks together
-    tmpbuf = IOBuf::create(size);
+    unique_ptr<IOBuf> tmpbuf = IOBuf::create(size);
     // pull() will move the cursor
     cursor_.pull(tmpbuf->writableData(), size);
-    data = tmpbuf->data();
-  }
-  if (huffman) {
-    huffmanTree_.decode(data, size, literal);
+    huffmanTree_.decode(tmpbuf->data(), size, scratch);
+    literal = scratch;
   } else {
-    literal.append((const char *)data, size);
+    scratch.resize(size);
+    cursor_.pull(&scratch[0], size);
+    literal = scratch;
+  }
+  if (literal.size() > maxLiteralSize_) {
+    LOG(ERROR) << "Literal too large, decoded size=" << literal.size()
+               << " maxLiteralSize_=" << maxLiteralSize_;
+    scratch.clear();
+    literal.clear();
+    return DecodeError::LITERAL_TOO_LARGE;
   }
-  remainingBytes_ -= size;
   return DecodeError::NONE;
 }
 
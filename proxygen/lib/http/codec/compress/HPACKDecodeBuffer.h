@@ -9,6 +9,7 @@
  */
 #pragma once
 
+#include <algorithm>
 #include <folly/Conv.h>
 #include <folly/io/Cursor.h>
 #include <folly/io/IOBuf.h>
@@ -41,6 +42,15 @@ class HPACKDecodeBuffer {
     remainingBytes_ = totalBytes;
   }
 
+  /**
+   * Reject the literals that decode to more than the given number of
+   * bytes, without allocating anything for them when their encoded size
+   * already tells. Never more than HPACK::kMaxLiteralSize.
+   */
+  void setMaxLiteralSize(uint32_t maxLiteralSize) {
+    maxLiteralSize_ = std::min(maxLiteralSize, HPACK::kMaxLiteralSize);
+  }
+
   uint32_t consumedBytes() const {
     return totalBytes_ - remainingBytes_;
   }
@@ -76,11 +86,20 @@ class HPACKDecodeBuffer {
    */
   HPACK::DecodeError decodeLiteral(std::string& literal);
 
+  /**
+   * same as above, but without a copy when the literal is not huffman
+   * encoded and is contiguous in the buffer: literal points either to the
+   * buffer being decoded or to scratch, where it is decoded otherwise.
+   */
+  HPACK::DecodeError decodeLiteral(std::string& scratch,
+                                   folly::StringPiece& literal);
+
 private:
   const huffman::HuffTree& huffmanTree_;
   folly::io::Cursor& cursor_;
   uint32_t totalBytes_;
   uint32_t remainingBytes_;
+  uint32_t maxLiteralSize_{HPACK::kMaxLiteralSize};
 };
 
 }
@@ -44,6 +44,7 @@ uint32_t HPACKDecoder::decode(Cursor& cursor,
   uint32_t emittedSize = 0;
   HPACKDecodeBuffer dbuf(getHuffmanTree(), cursor, totalBytes);
   while (!hasError() && !dbuf.empty()) {
+    limitLiterals(dbuf, emittedSize);
     emittedSize += decodeHeader(dbuf, &headers);
     if (emittedSize > maxUncompressed_) {
       LOG(ERROR) << "exceeded uncompressed size limit of "
@@ -75,6 +76,7 @@ uint32_t HPACKDecoder::decodeStreaming(
   streamingCb_ = streamingCb;
   HPACKDecodeBuffer dbuf(getHuffmanTree(), cursor, totalBytes);
   while (!hasError() && !dbuf.empty()) {
+    limitLiterals(dbuf, emittedSize);
     emittedSize += decodeHeader(dbuf, nullptr);
 
     if (emittedSize > maxUncompressed_) {
@@ -199,6 +201,14 @@ uint32_t HPACKDecoder::decodeIndexedHeader(HPACKDecodeBuffer& dbuf,
   return emittedSize;
 }
 
+void HPACKDecoder::limitLiterals(HPACKDecodeBuffer& dbuf,
+                                 uint32_t emittedSize) const {
+  // every header counts HPACKHeader::kMinLength on top of its literals
+  uint32_t left = maxUncompressed_ - emittedSize;
+  dbuf.setMaxLiteralSize(
+    left > HPACKHeader::kMinLength ? left - HPACKHeader::kMinLength : 0);
+}
+
 bool HPACKDecoder::isValid(uint32_t index) {
   if (!isStatic(index)) {
     return table_.isValid(globalToDynamicIndex(index));
@@ -218,11 +228,25 @@ uint32_t HPACKDecoder::decodeHeader(HPACKDecodeBuffer& dbuf,
 
 uint32_t HPACKDecoder::emit(const HPACKHeader& header, headers_t* emitted) {
   if (streamingCb_) {
-    streamingCb_->onHeader(header.name, header.value);
+    streamingCb_->onHeader(HTTPCommonHeaders::hash(header.name),
+                           header.name, header.value);
   } else if (emitted) {
     emitted->push_back(header);
   }
   return header.bytes();
 }
 
+uint32_t HPACKDecoder::emit(HTTPHeaderCode code,
+                            folly::StringPiece name,
+                            folly::StringPiece value,
+                            headers_t* emitted) {
+  if (streamingCb_) {
+    streamingCb_->onHeader(code, name, value);
+  } else if (emitted) {
+    emitted->emplace_back(name.str(), value.str());
+  }
+  return folly::to<uint32_t>(HPACKHeader::kMinLength + name.size() +
+                             value.size());
+}
+
 }
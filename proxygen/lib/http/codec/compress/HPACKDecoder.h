@@ -33,7 +33,7 @@ class HPACKDecoder : public HPACKContext {
     uint32_t tableSize=HPACK::kTableSize,
     uint32_t maxUncompressed=HeaderCodec::kMaxUncompressed,
     Version version=Version::HPACK05)
-      : HPACKContext(msgType, tableSize),
+      : HPACKContext(msgType, tableSize, version == Version::HPACK05),
         maxTableSize_(tableSize),
         maxUncompressed_(maxUncompressed),
         version_(version) {}
@@ -75,6 +75,14 @@ class HPACKDecoder : public HPACKContext {
     maxTableSize_ = maxSize;
   }
 
+  /**
+   * Limit on the uncompressed size of a header block, counted the way
+   * SETTINGS_MAX_HEADER_LIST_SIZE counts it
+   */
+  void setMaxUncompressed(uint32_t maxUncompressed) {
+    maxUncompressed_ = maxUncompressed;
+  }
+
  protected:
   bool isValid(uint32_t index);
 
@@ -84,6 +92,15 @@ class HPACKDecoder : public HPACKContext {
 
   uint32_t emit(const HPACKHeader& header, headers_t* emitted);
 
+  /**
+   * Emit a header given as views, which the streaming callback gets as they
+   * are, and only turns into an HPACKHeader when decoding into a vector
+   */
+  uint32_t emit(HTTPHeaderCode code,
+                folly::StringPiece name,
+                folly::StringPiece value,
+                headers_t* emitted);
+
   virtual uint32_t decodeIndexedHeader(HPACKDecodeBuffer& dbuf,
                                        headers_t* emitted);
 
@@ -92,6 +109,13 @@ class HPACKDecoder : public HPACKContext {
 
   uint32_t decodeHeader(HPACKDecodeBuffer& dbuf, headers_t* emitted);
 
+  /**
+   * Cap the literals of the next header to what is left of maxUncompressed_
+   * after emittedSize, so that a block over the limit is rejected before
+   * its oversized literals are decoded
+   */
+  void limitLiterals(HPACKDecodeBuffer& dbuf, uint32_t emittedSize) const;
+
   HPACK::DecodeError err_{HPACK::DecodeError::NONE};
   uint32_t maxTableSize_;
   uint32_t maxUncompressed_;
@@ -10,6 +10,7 @@
 #include <proxygen/lib/http/codec/compress/HPACKEncodeBuffer.h>
 
 #include <ctype.h>
+#include <cstring>
 #include <memory>
 #include <proxygen/lib/http/codec/compress/HPACKConstants.h>
 #include <proxygen/lib/http/codec/compress/Logging.h>
@@ -48,14 +49,29 @@ void HPACKEncodeBuffer::addHeadroom(uint32_t headroom) {
   bufQueue_.append(std::move(buf));
 }
 
-void HPACKEncodeBuffer::append(uint8_t byte) {
-  buf_.push(&byte, 1);
-}
-
 uint32_t HPACKEncodeBuffer::encodeInteger(uint32_t value, uint8_t prefix,
                                           uint8_t nbit) {
   CHECK(nbit > 0 && nbit <= 8);
-  uint32_t count = 0;
+  uint8_t bytes[kMaxIntegerSize];
+  uint32_t count = writeInteger(bytes, value, prefix, nbit);
+  buf_.push(bytes, count);
+  return count;
+}
+
+uint32_t HPACKEncodeBuffer::getIntegerSize(uint32_t value, uint8_t nbit) {
+  uint8_t mask = ~HPACK::NBIT_MASKS[nbit] & 0xFF;
+  if (value < mask) {
+    return 1;
+  }
+  uint32_t count = 2;
+  for (value -= mask; value >= 128; value = value >> 7) {
+    ++count;
+  }
+  return count;
+}
+
+uint32_t HPACKEncodeBuffer::writeInteger(uint8_t* out, uint32_t value,
+                                         uint8_t prefix, uint8_t nbit) {
   uint8_t prefix_mask = HPACK::NBIT_MASKS[nbit];
   uint8_t mask = ~prefix_mask & 0xFF;
 
@@ -63,40 +79,63 @@ uint32_t HPACKEncodeBuffer::encodeInteger(uint32_t value, uint8_t prefix,
   uint8_t byte = prefix & prefix_mask;
   if (value < mask) {
     // fits in the first byte
-    byte = byte | (mask & value);
-    append(byte);
+    out[0] = byte | (mask & value);
     return 1;
   }
 
-  byte |= mask;
+  uint32_t count = 0;
+  out[count++] = byte | mask;
   value -= mask;
-  ++count;
-  append(byte);
   // variable length encoding
   while (value >= 128) {
-    byte = 128 | (127 & value);
-    append(byte);
+    out[count++] = 128 | (127 & value);
     value = value >> 7;
-    ++count;
   }
   // last byte, which should always fit on 1 byte
-  append(value);
-  ++count;
+  out[count++] = value;
   return count;
 }
 
 uint32_t HPACKEncodeBuffer::encodeHuffman(const std::string& literal) {
-  uint32_t size = huffmanTree_.getEncodeSize(literal);
-  // add the length
-  uint32_t count = encodeInteger(size, HPACK::LiteralEncoding::HUFFMAN, 7);
-  // ensure we have enough bytes before performing the encoding
-  count += huffmanTree_.encode(literal, buf_);
+  return encodeHuffman(literal, false);
+}
+
+uint32_t HPACKEncodeBuffer::encodeHuffman(const std::string& literal,
+                                          bool plainIfLonger) {
+  // Encode in a single pass right behind room for the longest length prefix
+  // the literal may need, and backpatch the length once it's known
+  uint32_t maxSize = HuffTree::getMaxEncodeSize(literal.size());
+  uint32_t reserved = getIntegerSize(maxSize, 7);
+  buf_.ensure(reserved + maxSize);
+  uint8_t* start = buf_.writableData();
+  uint32_t size = huffmanTree_.encode(literal, start + reserved);
+  uint32_t count;
+  if (plainIfLonger && size >= literal.size()) {
+    // the plain layout fits in the same space, since maxSize >= size
+    count = writeInteger(start, literal.size(),
+                         HPACK::LiteralEncoding::PLAIN, 7);
+    memcpy(start + count, literal.data(), literal.size());
+    size = literal.size();
+  } else {
+    count = writeInteger(start, size, HPACK::LiteralEncoding::HUFFMAN, 7);
+    if (count < reserved) {
+      // the bound overestimated the length of the prefix
+      memmove(start + count, start + reserved, size);
+    }
+  }
+  count += size;
+  buf_.append(count);
   return count;
 }
 
 uint32_t HPACKEncodeBuffer::encodeLiteral(const std::string& literal) {
-  if (huffmanEnabled_) {
-    return encodeHuffman(literal);
+  return encodeLiteral(literal, huffmanEnabled_);
+}
+
+uint32_t HPACKEncodeBuffer::encodeLiteral(const std::string& literal,
+                                          bool huffman) {
+  if (huffman) {
+    return encodeHuffman(literal, true);
   }
   // otherwise use simple layout
   uint32_t count =
@@ -62,6 +62,11 @@ class HPACKEncodeBuffer {
    */
   uint32_t encodeInteger(uint32_t value, uint8_t prefix, uint8_t nbit);
 
+  /**
+   * how many bytes encodeInteger() takes for the value with an nbit prefix
+   */
+  static uint32_t getIntegerSize(uint32_t value, uint8_t nbit);
+
   /**
    * encodes a string, either header name or header value
    *
@@ -70,21 +75,52 @@ class HPACKEncodeBuffer {
   uint32_t encodeLiteral(const std::string& literal);
 
   /**
-   * encodes a string using huffman encoding
+   * encodes a string, using huffman encoding if asked to and it makes the
+   * string shorter, and the plain layout otherwise
+   *
+   * @return bytes used for encoding
+   */
+  uint32_t encodeLiteral(const std::string& literal, bool huffman);
+
+  /**
+   * how many bytes the plain layout of the literal takes, length included
+   */
+  static uint32_t getPlainLiteralSize(const std::string& literal) {
+    return getIntegerSize(literal.size(), 7) + literal.size();
+  }
+
+  /**
+   * Append bytes that are already encoded
+   */
+  void append(folly::ByteRange bytes) {
+    buf_.push(bytes.data(), bytes.size());
+  }
+
+  /**
+   * encodes a string using huffman encoding, in a single pass over it
    */
   uint32_t encodeHuffman(const std::string& literal);
 
+  /**
+   * same as above, but falls back to the plain layout when the huffman
+   * encoding isn't shorter
+   */
+  uint32_t encodeHuffman(const std::string& literal, bool plainIfLonger);
+
   /**
    * prints the content of an IOBuf in binary format. Useful for debugging.
    */
   std::string toBin();
 
  private:
+  // longest encoding of a 32-bit integer, with at least 1 bit of prefix
+  static const uint32_t kMaxIntegerSize = 6;
 
   /**
-   * append one byte at the end of buffer ensuring we always have enough space
+   * encodeInteger() into a flat buffer with room for kMaxIntegerSize bytes
    */
-  void append(uint8_t byte);
+  static uint32_t writeInteger(uint8_t* out, uint32_t value, uint8_t prefix,
+                               uint8_t nbit);
 
   uint32_t growthSize_;
   folly::IOBufQueue bufQueue_;
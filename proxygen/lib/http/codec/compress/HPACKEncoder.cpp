@@ -34,9 +34,10 @@ HPACKEncoder::HPACKEncoder(HPACK::MessageType msgType,
 
 HPACKEncoder::HPACKEncoder(const huffman::HuffTree& huffmanTree,
                            bool huffman,
-                           uint32_t tableSize) :
+                           uint32_t tableSize,
+                           bool referenceSet) :
     // since we already have the huffman tree, msgType doesn't matter
-    HPACKContext(HPACK::MessageType::REQ, tableSize),
+    HPACKContext(HPACK::MessageType::REQ, tableSize, referenceSet),
     huffman_(huffman),
     buffer_(kBufferGrowth, huffmanTree, huffman) {
 }
@@ -59,7 +60,7 @@ unique_ptr<IOBuf> HPACKEncoder::encode(const vector<HPACKHeader>& headers,
 
 bool HPACKEncoder::willBeAdded(const HPACKHeader& header) {
   auto index = getIndex(header);
-  return isStatic(index) || (index == 0 && header.isIndexable());
+  return isStatic(index) || (index == 0 && shouldIndex(header));
 }
 
 void HPACKEncoder::encodeEvictedReferences(const HPACKHeader& header) {
@@ -118,7 +119,7 @@ void HPACKEncoder::encodeDelta(const vector<HPACKHeader>& headers) {
 }
 
 void HPACKEncoder::encodeAsLiteral(const HPACKHeader& header) {
-  bool indexing = header.isIndexable();
+  bool indexing = shouldIndex(header);
   uint8_t prefix = indexing ?
     HPACK::HeaderEncoding::LITERAL_INCR_INDEXING :
     HPACK::HeaderEncoding::LITERAL_NO_INDEXING;
@@ -131,12 +132,61 @@ void HPACKEncoder::encodeAsLiteral(const HPACKHeader& header) {
     buffer_.encodeLiteral(header.name);
   }
   // value
-  buffer_.encodeLiteral(header.value);
+  encodeLiteralValue(header);
   // indexed ones need to get added to the header table
-  if (indexing) {
-    if (table_.add(header)) {
-      table_.addReference(1);
+  if (addLiteral(header, indexing)) {
+    table_.addReference(1);
+  }
+}
+
+bool HPACKEncoder::addLiteral(const HPACKHeader& header, bool indexing) {
+  indexingStats_.literals++;
+  if (indexingPolicy_) {
+    indexingPolicy_->onLiteral(header, indexing);
+  }
+  return indexing && addToTable(header);
+}
+
+bool HPACKEncoder::addToTable(const HPACKHeader& header) {
+  uint32_t size = table_.size();
+  bool added = table_.add(header);
+  indexingStats_.evictions += size + (added ? 1 : 0) - table_.size();
+  if (added) {
+    indexingStats_.inserts++;
+  }
+  return added;
+}
+
+void HPACKEncoder::encodeLiteralValue(const HPACKHeader& header) {
+  const std::string& value = header.value;
+  if (!huffman_ || value.size() < kHuffmanStatsMinLength) {
+    buffer_.encodeLiteral(value, huffman_);
+    return;
+  }
+  auto it = huffmanStats_.find(header.name);
+  if (it == huffmanStats_.end()) {
+    if (huffmanStats_.size() >= kMaxHuffmanStats) {
+      buffer_.encodeLiteral(value, true);
+      return;
+    }
+    it = huffmanStats_.emplace(header.name, HuffmanStats()).first;
+  }
+  HuffmanStats& stats = it->second;
+  if (stats.misses >= kHuffmanMaxMisses &&
+      ++stats.skipped < kHuffmanRetryInterval) {
+    // spare the CPU for values that don't compress, like opaque tokens
+    buffer_.encodeLiteral(value, false);
+    return;
+  }
+  stats.skipped = 0;
+  uint32_t saved = HPACKEncodeBuffer::getPlainLiteralSize(value) -
+    buffer_.encodeLiteral(value, true);
+  if (saved * 8 < value.size()) {
+    if (stats.misses < kHuffmanMaxMisses) {
+      stats.misses++;
     }
+  } else {
+    stats.misses = 0;
   }
 }
 
@@ -151,13 +201,16 @@ void HPACKEncoder::clearReferenceSet() {
 
 void HPACKEncoder::encodeHeader(const HPACKHeader& header) {
   uint32_t index = getIndex(header);
+  if (index && !isStatic(index)) {
+    indexingStats_.hits++;
+  }
   if (index) {
     // firstly check if it's part of the static table
     if (isStatic(index)) {
       encodeAsIndex(index);
       // insert the static header in the dynamic header table
       // to take advantage of the delta compression
-      if (table_.add(getStaticHeader(index))) {
+      if (addToTable(getStaticHeader(index))) {
         table_.addReference(1);
       }
     } else if (!table_.inReferenceSet(globalToDynamicIndex(index))) {
@@ -11,10 +11,14 @@
 
 #include <folly/io/IOBuf.h>
 #include <list>
+#include <memory>
 #include <proxygen/lib/http/codec/compress/HPACKConstants.h>
 #include <proxygen/lib/http/codec/compress/HPACKContext.h>
 #include <proxygen/lib/http/codec/compress/HPACKEncodeBuffer.h>
+#include <proxygen/lib/http/codec/compress/HPACKIndexingPolicy.h>
 #include <proxygen/lib/http/codec/compress/HeaderTable.h>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace proxygen {
@@ -28,7 +32,8 @@ class HPACKEncoder : public HPACKContext {
 
   HPACKEncoder(const huffman::HuffTree& huffmanTree,
                bool huffman,
-               uint32_t tableSize=HPACK::kTableSize);
+               uint32_t tableSize=HPACK::kTableSize,
+               bool referenceSet=true);
 
   /**
    * Size of a new IOBuf which is added to the chain
@@ -37,6 +42,18 @@ class HPACKEncoder : public HPACKContext {
    */
   static const uint32_t kBufferGrowth = 4000;
 
+  /**
+   * Values shorter than this are always huffman encoded when huffman is
+   * enabled, longer ones are tracked per header name. Values of a name that
+   * huffman encoding failed to shrink by 1/8th kHuffmanMaxMisses times in a
+   * row are sent plain, trying huffman again every kHuffmanRetryInterval
+   * values. Up to kMaxHuffmanStats names are tracked per encoder.
+   */
+  static const uint32_t kHuffmanStatsMinLength = 16;
+  static const uint8_t kHuffmanMaxMisses = 4;
+  static const uint8_t kHuffmanRetryInterval = 32;
+  static const uint32_t kMaxHuffmanStats = 64;
+
   /**
    * Encode the given headers and return the buffer
    */
@@ -44,14 +61,70 @@ class HPACKEncoder : public HPACKContext {
     const std::vector<HPACKHeader>& headers,
     uint32_t headroom = 0);
 
-  void setHeaderTableSize(uint32_t size) {
+  virtual void setHeaderTableSize(uint32_t size) {
     table_.setCapacity(size);
     pendingContextUpdate_ = true;
   }
 
+  /**
+   * Replaces the default choice of which literal headers get added to the
+   * header table.
+   */
+  void setIndexingPolicy(std::unique_ptr<HPACKIndexingPolicy> policy) {
+    indexingPolicy_ = std::move(policy);
+  }
+
+  /**
+   * How well the header table is used, over the life of the encoder
+   */
+  struct IndexingStats {
+    // headers found in the header table, not counting the static one
+    uint64_t hits{0};
+    // headers sent as literals
+    uint64_t literals{0};
+    // entries added to the header table
+    uint64_t inserts{0};
+    // entries evicted to make room for the inserts
+    uint64_t evictions{0};
+  };
+
+  const IndexingStats& getIndexingStats() const {
+    return indexingStats_;
+  }
+
  protected:
   void encodeAsIndex(uint32_t index);
 
+  /**
+   * Encodes the value of a header sent as a literal, choosing between the
+   * huffman and plain layout from what huffman did for that name so far
+   */
+  void encodeLiteralValue(const HPACKHeader& header);
+
+  /**
+   * Whether to index a header not found in the table, see
+   * HPACKIndexingPolicy::shouldIndex()
+   */
+  bool shouldIndex(const HPACKHeader& header) const {
+    return indexingPolicy_ ? indexingPolicy_->shouldIndex(header) :
+      header.isIndexable();
+  }
+
+  /**
+   * Records a header sent as a literal and adds it to the header table if
+   * indexing
+   *
+   * @return true if it was added
+   */
+  bool addLiteral(const HPACKHeader& header, bool indexing);
+
+  /**
+   * Adds the header to the header table, keeping track of evictions
+   */
+  bool addToTable(const HPACKHeader& header);
+
+  IndexingStats indexingStats_;
+
  private:
   virtual void encodeHeader(const HPACKHeader& header);
 
@@ -76,7 +149,16 @@ class HPACKEncoder : public HPACKContext {
 
   void clearReferenceSet();
 
+  struct HuffmanStats {
+    // values in a row huffman encoding saved less than 1/8th on
+    uint8_t misses{0};
+    // values sent plain since huffman encoding was last tried
+    uint8_t skipped{0};
+  };
+
   bool huffman_;
+  std::unordered_map<std::string, HuffmanStats> huffmanStats_;
+  std::unique_ptr<HPACKIndexingPolicy> indexingPolicy_;
  protected:
   HPACKEncodeBuffer buffer_;
   bool pendingContextUpdate_{false};
@@ -0,0 +1,75 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/http/codec/compress/HPACKIndexingPolicy.h>
+
+#include <algorithm>
+#include <folly/Hash.h>
+
+namespace proxygen {
+
+namespace {
+// the counters saturate here, so halving them keeps doing something
+const uint8_t kMaxCount = 15;
+}
+
+void ConfigurableIndexingPolicy::setAdmissionThreshold(uint8_t sightings) {
+  admissionThreshold_ = std::min(sightings, kMaxCount);
+  if (admissionThreshold_ > 1) {
+    counters_.assign(kCounters, 0);
+  } else {
+    counters_.clear();
+  }
+  literals_ = 0;
+}
+
+uint32_t ConfigurableIndexingPolicy::counterIndex(
+    const HPACKHeader& header) const {
+  return folly::hash::hash_combine(header.name, header.value) % kCounters;
+}
+
+bool ConfigurableIndexingPolicy::shouldIndex(
+    const HPACKHeader& header) const {
+  if (!header.isIndexable()) {
+    return false;
+  }
+  if (maxEntryBytes_ && header.bytes() > maxEntryBytes_) {
+    return false;
+  }
+  if (!neverIndex_.empty() && neverIndex_.count(header.name)) {
+    return false;
+  }
+  if (!counters_.empty() &&
+      counters_[counterIndex(header)] + 1 < admissionThreshold_) {
+    return false;
+  }
+  return true;
+}
+
+void ConfigurableIndexingPolicy::onLiteral(const HPACKHeader& header,
+                                           bool indexed) {
+  if (counters_.empty()) {
+    return;
+  }
+  uint8_t& count = counters_[counterIndex(header)];
+  if (indexed) {
+    // it's in the table now, and needs to earn its way back once evicted
+    count = 0;
+  } else if (count < kMaxCount) {
+    count++;
+  }
+  if (++literals_ == kAgingPeriod) {
+    for (auto& c: counters_) {
+      c >>= 1;
+    }
+    literals_ = 0;
+  }
+}
+
+}
@@ -0,0 +1,98 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <proxygen/lib/http/codec/compress/HPACKHeader.h>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace proxygen {
+
+/**
+ * Decides which headers the encoder adds to its header table when it has
+ * to send them as literals. The default keeps the heuristics of
+ * HPACKHeader::isIndexable().
+ */
+class HPACKIndexingPolicy {
+ public:
+  virtual ~HPACKIndexingPolicy() {}
+
+  /**
+   * The encoder may ask more than once about the same header of a block,
+   * so this must not change any state; that's what onLiteral() is for.
+   *
+   * @return true if the header should be added to the header table
+   */
+  virtual bool shouldIndex(const HPACKHeader& header) const {
+    return header.isIndexable();
+  }
+
+  /**
+   * Called for every header sent as a literal, after the decision above
+   */
+  virtual void onLiteral(const HPACKHeader& /*header*/, bool /*indexed*/) {}
+};
+
+/**
+ * On top of the default heuristics, keeps out of the header table the
+ * headers with a name in a never-index list, the ones larger than a size
+ * threshold and, with an admission threshold, the ones that haven't been
+ * sent as literals that many times recently. The latter stops values that
+ * never repeat, like request ids or dates, from evicting the ones that do.
+ *
+ * Recent sightings are kept in a fixed array of small counters indexed by
+ * the hash of the header, which are halved every kAgingPeriod literals.
+ * Collisions only make a header admitted early.
+ */
+class ConfigurableIndexingPolicy : public HPACKIndexingPolicy {
+ public:
+  static const uint32_t kCounters = 4096;
+  static const uint32_t kAgingPeriod = 8 * kCounters;
+
+  ConfigurableIndexingPolicy() {}
+
+  /**
+   * Never index headers with this name, which has to be lower case
+   */
+  void addNeverIndex(const std::string& name) {
+    neverIndex_.insert(name);
+  }
+
+  /**
+   * Do not index headers whose entry, of HPACKHeader::bytes(), is larger
+   * than this. 0 disables the limit.
+   */
+  void setMaxEntryBytes(uint32_t bytes) {
+    maxEntryBytes_ = bytes;
+  }
+
+  /**
+   * Index a header only once it is sent as a literal this many times,
+   * counting the current one. 0 and 1 index on the first one, up to 15.
+   */
+  void setAdmissionThreshold(uint8_t sightings);
+
+  bool shouldIndex(const HPACKHeader& header) const override;
+
+  void onLiteral(const HPACKHeader& header, bool indexed) override;
+
+ private:
+  uint32_t counterIndex(const HPACKHeader& header) const;
+
+  std::unordered_set<std::string> neverIndex_;
+  uint32_t maxEntryBytes_{0};
+  uint8_t admissionThreshold_{0};
+  // empty as long as there is no admission threshold
+  std::vector<uint8_t> counters_;
+  uint32_t literals_{0};
+};
+
+}
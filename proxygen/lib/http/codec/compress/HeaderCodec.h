@@ -9,7 +9,9 @@
  */
 #pragma once
 
+#include <folly/Range.h>
 #include <memory>
+#include <proxygen/lib/http/HTTPCommonHeaders.h>
 #include <proxygen/lib/http/HTTPHeaderSize.h>
 #include <proxygen/lib/http/codec/compress/Header.h>
 #include <proxygen/lib/http/codec/compress/HeaderPiece.h>
@@ -65,8 +67,14 @@ class HeaderCodec {
    public:
     virtual ~StreamingCallback() {}
 
-    virtual void onHeader(const std::string& name,
-                          const std::string& value) = 0;
+    /**
+     * name and value are only valid for the duration of the call. code is
+     * the HTTPHeaderCode of name, HTTP_HEADER_OTHER if it is not a common
+     * header.
+     */
+    virtual void onHeader(HTTPHeaderCode code,
+                          folly::StringPiece name,
+                          folly::StringPiece value) = 0;
     virtual void onHeadersComplete() = 0;
     virtual void onDecodeError(HeaderDecodeError decodeError) = 0;
   };
@@ -93,6 +101,25 @@ class HeaderCodec {
   virtual Result<HeaderDecodeResult, HeaderDecodeError>
   decode(folly::io::Cursor& cursor, uint32_t length) noexcept = 0;
 
+  /**
+   * Whether this codec can decodePartial() the start of a header block
+   * ahead of the rest of it.
+   */
+  virtual bool supportsPartialDecode() const {
+    return false;
+  }
+
+  /**
+   * Take the first length bytes of a header block whose remaining bytes
+   * have yet to arrive, so that the caller does not have to hold on to
+   * them. The next decode() continues the same block with the bytes that
+   * follow. A decode error is as fatal as one from decode().
+   */
+  virtual HeaderDecodeError decodePartial(folly::io::Cursor& cursor,
+                                          uint32_t length) noexcept {
+    return HeaderDecodeError::BAD_ENCODING;
+  }
+
   /**
    * Decode headers given a Cursor and an amount of bytes to consume.
    */
@@ -120,7 +147,7 @@ class HeaderCodec {
     encodeHeadroom_ = headroom;
   }
 
-  void setMaxUncompressed(uint32_t maxUncompressed) {
+  virtual void setMaxUncompressed(uint32_t maxUncompressed) {
     maxUncompressed_ = maxUncompressed;
   }
 
@@ -128,6 +155,20 @@ class HeaderCodec {
     return maxUncompressed_;
   }
 
+  /**
+   * Bytes held by the compression state of this codec, beyond the codec
+   * object itself
+   */
+  virtual size_t getCompressionStateSize() const {
+    return 0;
+  }
+
+  /**
+   * Free what the compression state can do without between header blocks,
+   * at the cost of compressing or decoding the next one a little slower
+   */
+  virtual void releaseIdleMemory() {}
+
   /**
    * set the stats object
    */
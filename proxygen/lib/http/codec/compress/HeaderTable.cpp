@@ -9,6 +9,9 @@
  */
 #include <proxygen/lib/http/codec/compress/HeaderTable.h>
 
+#include <algorithm>
+#include <folly/Bits.h>
+#include <folly/Hash.h>
 #include <glog/logging.h>
 
 using std::list;
@@ -25,7 +28,51 @@ void HeaderTable::init(uint32_t capacityVal) {
   // at a minimum an entry will take 32 bytes
   length_ = (capacityVal >> 5) + 1;
   table_.assign(length_, HPACKHeader());
-  names_.clear();
+  hashes_.assign(length_, EntryHashes());
+  initIndexes();
+  ++generation_;
+}
+
+void HeaderTable::initIndexes() {
+  // at most 2/3 full
+  indexMask_ = folly::nextPowTwo(uint64_t(length_) * 3 / 2 + 1) - 1;
+  headerIndex_.assign(indexMask_ + 1, IndexSlot());
+  nameIndex_.assign(indexMask_ + 1, IndexSlot());
+  for (uint32_t i = 0, t = tail(); i < size_; i++, t = next(t)) {
+    addToIndex(headerIndex_, hashes_[t].header, t);
+    addToIndex(nameIndex_, hashes_[t].name, t);
+  }
+}
+
+void HeaderTable::addToIndex(Index& index, uint32_t hash, uint32_t entry) {
+  uint32_t i = hash & indexMask_;
+  while (index[i].entry) {
+    i = (i + 1) & indexMask_;
+  }
+  index[i].entry = entry + 1;
+  index[i].hash = hash;
+}
+
+void HeaderTable::removeFromIndex(Index& index, uint32_t hash,
+                                  uint32_t entry) {
+  uint32_t i = hash & indexMask_;
+  while (index[i].entry != entry + 1) {
+    DCHECK(index[i].entry);
+    i = (i + 1) & indexMask_;
+  }
+  // Shift back the slots further along the cluster that would otherwise no
+  // longer be found past the freed one
+  for (uint32_t j = (i + 1) & indexMask_; index[j].entry;
+       j = (j + 1) & indexMask_) {
+    uint32_t home = index[j].hash & indexMask_;
+    bool reachable = (i <= j) ? (i < home && home <= j) :
+      (i < home || home <= j);
+    if (!reachable) {
+      index[i] = index[j];
+      i = j;
+    }
+  }
+  index[i] = IndexSlot();
 }
 
 bool HeaderTable::add(const HPACKHeader& header) {
@@ -40,37 +87,78 @@ bool HeaderTable::add(const HPACKHeader& header) {
   if (size_ > 0) {
     head_ = next(head_);
   }
+  // reuses the capacity of the strings of the entry evicted from there
   table_[head_] = header;
-  // index name
-  names_[header.name].push_back(head_);
+  // index name and the full header
+  auto& hashes = hashes_[head_];
+  hashes.header = headerHash(header);
+  hashes.name = nameHash(header.name);
+  addToIndex(headerIndex_, hashes.header, head_);
+  addToIndex(nameIndex_, hashes.name, head_);
   bytes_ += header.bytes();
   ++size_;
+  ++generation_;
   return true;
 }
 
 uint32_t HeaderTable::getIndex(const HPACKHeader& header) const {
-  auto it = names_.find(header.name);
-  if (it == names_.end()) {
+  return getIndex(header.name, header.value);
+}
+
+uint32_t HeaderTable::getIndex(const std::string& name,
+                               const std::string& value) const {
+  if (size_ == 0) {
     return 0;
   }
-  for (auto i : it->second) {
-    if (table_[i].value == header.value) {
-      return toExternal(i);
+  uint32_t hash = headerHash(name, value);
+  uint32_t index = 0;
+  // the whole cluster is walked to return the oldest copy
+  for (uint32_t i = hash & indexMask_; headerIndex_[i].entry;
+       i = (i + 1) & indexMask_) {
+    if (headerIndex_[i].hash != hash) {
+      continue;
+    }
+    uint32_t entry = headerIndex_[i].entry - 1;
+    if (table_[entry].name == name && table_[entry].value == value) {
+      index = std::max(index, toExternal(entry));
     }
   }
-  return 0;
+  return index;
 }
 
 bool HeaderTable::hasName(const std::string& name) {
-  return names_.find(name) != names_.end();
+  return nameIndex(name) != 0;
 }
 
 uint32_t HeaderTable::nameIndex(const std::string& name) const {
-  auto it = names_.find(name);
-  if (it == names_.end()) {
+  if (size_ == 0) {
     return 0;
   }
-  return toExternal(it->second.back());
+  uint32_t hash = nameHash(name);
+  uint32_t index = 0;
+  // the most recent one
+  for (uint32_t i = hash & indexMask_; nameIndex_[i].entry;
+       i = (i + 1) & indexMask_) {
+    if (nameIndex_[i].hash != hash) {
+      continue;
+    }
+    uint32_t entry = nameIndex_[i].entry - 1;
+    uint32_t external = toExternal(entry);
+    if ((index == 0 || external < index) && table_[entry].name == name) {
+      index = external;
+    }
+  }
+  return index;
+}
+
+uint32_t HeaderTable::nameCount(const std::string& name) const {
+  uint32_t count = 0;
+  for (const auto& slot : nameIndex_) {
+    if (slot.entry && table_[slot.entry - 1].name == name) {
+      count++;
+    }
+  }
+  return count;
 }
 
 const HPACKHeader& HeaderTable::operator[](uint32_t i) const {
@@ -79,36 +167,48 @@ const HPACKHeader& HeaderTable::operator[](uint32_t i) const {
 }
 
 bool HeaderTable::inReferenceSet(uint32_t index) const {
-  return refset_.find(toInternal(index)) != refset_.end();
+  return refs_ && refs_->refset.find(toInternal(index)) != refs_->refset.end();
 }
 
 bool HeaderTable::isSkippedReference(uint32_t index) const {
-  return skippedRefs_.find(toInternal(index)) != skippedRefs_.end();
+  return refs_ &&
+    refs_->skippedRefs.find(toInternal(index)) != refs_->skippedRefs.end();
 }
 
 void HeaderTable::clearSkippedReferences() {
-  skippedRefs_.clear();
+  if (refs_) {
+    refs_->skippedRefs.clear();
+  }
 }
 
 void HeaderTable::addSkippedReference(uint32_t index) {
-  skippedRefs_.insert(toInternal(index));
+  DCHECK(refs_);
+  refs_->skippedRefs.insert(toInternal(index));
 }
 
 void HeaderTable::addReference(uint32_t index) {
-  refset_.insert(toInternal(index));
+  DCHECK(refs_);
+  refs_->refset.insert(toInternal(index));
 }
 
 void HeaderTable::removeReference(uint32_t index) {
-  refset_.erase(toInternal(index));
+  if (refs_) {
+    refs_->refset.erase(toInternal(index));
+  }
 }
 
 void HeaderTable::clearReferenceSet() {
-  refset_.clear();
+  if (refs_) {
+    refs_->refset.clear();
+  }
 }
 
 list<uint32_t> HeaderTable::referenceSet() const {
   list<uint32_t> external;
-  for (auto& i : refset_) {
+  if (!refs_) {
+    return external;
+  }
+  for (auto& i : refs_->refset) {
     external.push_back(toExternal(i));
   }
   // seems like the compiler will avoid the copy here
@@ -117,18 +217,14 @@ list<uint32_t> HeaderTable::referenceSet() const {
 
 void HeaderTable::removeLast() {
   auto t = tail();
-  refset_.erase(t);
-  skippedRefs_.erase(t);
-  // remove the first element from the names index
-  auto names_it = names_.find(table_[t].name);
-  DCHECK(names_it != names_.end());
-  list<uint32_t> &ilist = names_it->second;
-  DCHECK(ilist.front() ==t);
-  ilist.pop_front();
-  // remove the name if there are no indices associated with it
-  if (ilist.empty()) {
-    names_.erase(names_it);
+  ++generation_;
+  if (refs_) {
+    refs_->refset.erase(t);
+    refs_->skippedRefs.erase(t);
   }
+  removeFromIndex(headerIndex_, hashes_[t].header, t);
+  removeFromIndex(nameIndex_, hashes_[t].name, t);
+  // the strings are left for the next entry to reuse
   bytes_ -= table_[t].bytes();
   --size_;
 }
@@ -136,6 +232,53 @@ void HeaderTable::removeLast() {
 void HeaderTable::setCapacity(uint32_t capacity) {
   capacity_ = capacity;
   evict(0);
+  // same sizing as init()
+  uint32_t length = (capacity >> 5) + 1;
+  if (length != length_) {
+    resize(length);
+  }
+}
+
+void HeaderTable::compact() {
+  for (uint32_t i = 0; i < length_; i++) {
+    // the entries are the size_ slots from tail() on
+    if ((i + length_ - tail()) % length_ >= size_) {
+      std::string().swap(table_[i].name);
+      std::string().swap(table_[i].value);
+    }
+  }
+}
+
+void HeaderTable::resize(uint32_t length) {
+  DCHECK_LT(size_, length);
+  std::vector<HPACKHeader> table(length);
+  std::vector<EntryHashes> hashes(length);
+  for (uint32_t i = size_; i > 0; i--) {
+    table[size_ - i] = std::move(table_[toInternal(i)]);
+    hashes[size_ - i] = hashes_[toInternal(i)];
+  }
+  // the internal indices all change, moving the most recent entry to
+  // size_ - 1
+  auto moved = [this] (const std::unordered_set<uint32_t>& indices) {
+    std::unordered_set<uint32_t> result;
+    for (auto i : indices) {
+      result.insert(size_ - toExternal(i));
+    }
+    return result;
+  };
+  if (refs_) {
+    refs_->refset = moved(refs_->refset);
+    refs_->skippedRefs = moved(refs_->skippedRefs);
+  }
+  table_.swap(table);
+  hashes_.swap(hashes);
+  length_ = length;
+  head_ = size_ > 0 ? size_ - 1 : 0;
+  initIndexes();
+  // assign() would keep the capacity of the old indexes
+  Index(headerIndex_).swap(headerIndex_);
+  Index(nameIndex_).swap(nameIndex_);
+  ++generation_;
 }
 
 uint32_t HeaderTable::evict(uint32_t needed) {
@@ -147,6 +290,15 @@ uint32_t HeaderTable::evict(uint32_t needed) {
   return evicted;
 }
 
+uint32_t HeaderTable::headerHash(const std::string& name,
+                                 const std::string& value) {
+  return folly::hash::hash_combine(name, value);
+}
+
+uint32_t HeaderTable::nameHash(const std::string& name) {
+  return std::hash<std::string>()(name);
+}
+
 bool HeaderTable::isValid(uint32_t index) const {
   return 0 < index && index <= size_;
 }
@@ -10,9 +10,9 @@
 #pragma once
 
 #include <list>
+#include <memory>
 #include <proxygen/lib/http/codec/compress/HPACKHeader.h>
 #include <string>
-#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
@@ -21,14 +21,24 @@ namespace proxygen {
 /**
  * Data structure for maintaining indexed headers, based on a fixed-length ring
  * with FIFO semantics. Externally it acts as an array.
+ *
+ * The reference set of the HPACK drafts before 09 is only kept by tables
+ * created with it; without one adding and evicting entries touches nothing
+ * but the ring and its indexes, and the reference set is always empty.
+ *
+ * The entries are looked up by name and by name and value through two open
+ * addressing indexes sized with the ring, so neither adding nor evicting an
+ * entry allocates.  The strings of a ring slot keep their capacity for the
+ * next entry stored there.
  */
 
 class HeaderTable {
  public:
 
-  typedef std::unordered_map<std::string, std::list<uint32_t>> names_map;
-
-  explicit HeaderTable(uint32_t capacityVal) {
+  explicit HeaderTable(uint32_t capacityVal, bool referenceSet = true) {
+    if (referenceSet) {
+      refs_.reset(new ReferenceSet());
+    }
     init(capacityVal);
   }
   HeaderTable() {}
@@ -55,6 +65,12 @@ class HeaderTable {
    */
   uint32_t getIndex(const HPACKHeader& header) const;
 
+  /**
+   * Same as getIndex(header), for a name and value that are not held by an
+   * HPACKHeader. The name has to be lowercase already.
+   */
+  uint32_t getIndex(const std::string& name, const std::string& value) const;
+
   /**
    * Get the table entry at the given index.
    *
@@ -73,14 +89,10 @@ class HeaderTable {
   bool hasName(const std::string& name);
 
   /**
-   * @return the map holding the indexed names
-   *
-   * Note: this contains references to internal indices, so it's useful only
-   * for testing or instrumentation.
+   * @return how many entries have the given name, walking the index, so
+   * only meant for testing or instrumentation
    */
-  const names_map& names() const {
-    return names_;
-  }
+  uint32_t nameCount(const std::string& name) const;
 
   /**
    * Get any index of a header that has the given name. From all the
@@ -89,6 +101,13 @@ class HeaderTable {
    */
   uint32_t nameIndex(const std::string& name) const;
 
+  /**
+   * @return true if the table keeps a reference set
+   */
+  bool hasReferenceSet() const {
+    return refs_ != nullptr;
+  }
+
   /**
    * Clear new references set
    */
@@ -139,10 +158,17 @@ class HeaderTable {
 
   /**
    * Sets the current capacity of the header table, and evicts entries
-   * if needed.  capacity must not be larger than currect capacity.
+   * if needed.  The storage is resized to fit the new capacity, so
+   * shrinking the table frees what it no longer needs.
    */
   void setCapacity(uint32_t capacity);
 
+  /**
+   * Frees the strings the ring slots without an entry kept for the next
+   * entries.
+   */
+  void compact();
+
   /**
    * @return number of entries
    */
@@ -164,6 +190,14 @@ class HeaderTable {
     return length_;
   }
 
+  /**
+   * Changes whenever an entry is added or removed, so an unchanged value
+   * means every index still refers to the same header.
+   */
+  uint64_t generation() const {
+    return generation_;
+  }
+
   bool operator==(const HeaderTable& other) const;
 
   /**
@@ -178,6 +212,46 @@ class HeaderTable {
  private:
   HeaderTable& operator=(const HeaderTable&); // non-copyable
 
+  /**
+   * A slot of headerIndex_ or nameIndex_, which are linear probing hash
+   * tables of the entries.  Collisions are resolved by comparing against
+   * the table entries.
+   */
+  struct IndexSlot {
+    // internal index of the entry plus one, 0 if the slot is free
+    uint32_t entry{0};
+    uint32_t hash{0};
+  };
+  typedef std::vector<IndexSlot> Index;
+
+  struct EntryHashes {
+    uint32_t header{0};
+    uint32_t name{0};
+  };
+
+  /**
+   * Hash of the header name and value, used as key in headerIndex_.
+   */
+  static uint32_t headerHash(const HPACKHeader& header) {
+    return headerHash(header.name, header.value);
+  }
+  static uint32_t headerHash(const std::string& name,
+                             const std::string& value);
+
+  /**
+   * Hash of the header name, used as key in nameIndex_.
+   */
+  static uint32_t nameHash(const std::string& name);
+
+  /**
+   * Size the indexes for length_ entries and index the current ones
+   */
+  void initIndexes();
+
+  void addToIndex(Index& index, uint32_t hash, uint32_t entry);
+
+  void removeFromIndex(Index& index, uint32_t hash, uint32_t entry);
+
   /**
    * Removes one header entry from the beginning of the header table.
    */
@@ -188,6 +262,11 @@ class HeaderTable {
    */
   uint32_t evict(uint32_t needed);
 
+  /**
+   * Move the entries to a ring of the given length, oldest first.
+   */
+  void resize(uint32_t length);
+
   /**
    * Move the index to the right.
    */
@@ -215,10 +294,19 @@ class HeaderTable {
   uint32_t size_{0};    // how many entries we have in the table
   uint32_t length_{0};   // number of entries in table_
   uint32_t head_{0};     // points to the first element of the ring
-
-  names_map names_;
-  std::unordered_set<uint32_t> refset_;
-  std::unordered_set<uint32_t> skippedRefs_;
+  uint64_t generation_{0};
+
+  // the hashes of each entry of table_, to find it in the indexes
+  std::vector<EntryHashes> hashes_;
+  Index headerIndex_;
+  Index nameIndex_;
+  uint32_t indexMask_{0};
+  struct ReferenceSet {
+    std::unordered_set<uint32_t> refset;
+    std::unordered_set<uint32_t> skippedRefs;
+  };
+  // internal indices, nullptr for the tables without a reference set
+  std::unique_ptr<ReferenceSet> refs_;
 };
 
 std::ostream& operator<<(std::ostream& os, const HeaderTable& table);
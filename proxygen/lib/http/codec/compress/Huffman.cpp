@@ -11,6 +11,9 @@
 #include <proxygen/lib/utils/UnionBasedStatic.h>
 
 #include <arpa/inet.h>
+#include <cstring>
+#include <glog/logging.h>
+#include <memory>
 
 using folly::IOBuf;
 using std::pair;
@@ -20,52 +23,81 @@ namespace proxygen { namespace huffman {
 
 HuffTree::HuffTree(const uint32_t* codes, const uint8_t* bits)
     : codes_(codes), bits_(bits) {
-  buildTree();
+  // value-initialized, as the tree only fills in the used nodes
+  HuffTables* tables = new HuffTables();
+  ownTables_.reset(tables);
+  tables_ = tables;
+  buildTree(*tables);
+}
+
+HuffTree::HuffTree(const uint32_t* codes, const uint8_t* bits,
+                   const HuffTables& tables)
+    : codes_(codes), bits_(bits), tables_(&tables) {
 }
 
 HuffTree::HuffTree(const HuffTree& tree) :
-    codes_(tree.codes_), bits_(tree.bits_) {
-  buildTree();
+    codes_(tree.codes_), bits_(tree.bits_), ownTables_(tree.ownTables_),
+    tables_(tree.tables_) {
 }
 
 bool HuffTree::decode(const uint8_t* buf, uint32_t size, string& literal)
     const {
-  const SuperHuffNode* snode = &table_[0];
-  uint32_t w = 0;
+  // bits are MSB-aligned in 'w'; everything below the first wbits bits is 0
+  uint64_t w = 0;
   uint32_t wbits = 0;
   uint32_t i = 0;
-  while (i < size || wbits > 0) {
-    // decide if we need to load more bits using an 8-bit chunk
-    if (i < size && wbits < 8) {
-      w = (w << 8) | buf[i];
+  while (true) {
+    // top up the accumulator a byte at a time
+    while (wbits <= 56 && i < size) {
+      w |= uint64_t(buf[i]) << (56 - wbits);
       wbits += 8;
       i++;
     }
-    // key is used for performing the indexed lookup
-    uint32_t key;
-    if (wbits >= 8) {
-      key = w >> (wbits - 8);
-    } else {
-      // this the case we're at the end of the buffer
-      uint8_t xbits = 8 - wbits;
-      w = (w << xbits) | ((1 << xbits) - 1);
-      key = w;
-      wbits = 8;
+    if (wbits == 0) {
+      break;
+    }
+    if (wbits >= kFastDecodeBits) {
+      // the lookup key is made only of real input bits
+      const HuffFastEntry& entry =
+        tables_->fastTable[w >> (64 - kFastDecodeBits)];
+      if (entry.metadata.numSymbols > 0) {
+        literal.append((const char*)entry.symbols, entry.metadata.numSymbols);
+        w <<= entry.metadata.bits;
+        wbits -= entry.metadata.bits;
+        continue;
+      }
     }
-    // perform the indexed lookup
-    const HuffNode& node = snode->index[key];
-    if (node.isLeaf()) {
-      // final node, we can emit the character
-      literal.push_back(node.data.ch);
-      wbits -= node.metadata.bits;
-      snode = &table_[0];
-    } else {
+    // the next code is longer than the fast table, or we are at the end of
+    // the buffer: walk the 8-bit tree for a single character
+    const SuperHuffNode* snode = &tables_->table[0];
+    uint32_t used = 0;
+    bool emitted = false;
+    while (used < wbits) {
+      uint32_t avail = wbits - used;
+      uint32_t key = (w << used) >> 56;
+      if (avail < 8) {
+        // this the case we're at the end of the buffer, pad with 1's
+        key |= (1 << (8 - avail)) - 1;
+      }
+      const HuffNode& node = snode->index[key];
+      if (node.isLeaf()) {
+        // final node, we can emit the character
+        literal.push_back(node.data.ch);
+        used += node.metadata.bits;
+        emitted = true;
+        break;
+      }
       // this is a branch, so we just need to move one level
-      wbits -= 8;
-      snode = &table_[node.data.superNodeIndex];
+      used += 8;
+      snode = &tables_->table[node.data.superNodeIndex];
+    }
+    if (!emitted || used >= wbits) {
+      // only padding was left
+      break;
     }
     // remove what we've just used
-    w = w & ((1 << wbits) - 1);
+    w <<= used;
+    wbits -= used;
   }
   return true;
 }
@@ -74,19 +106,21 @@ bool HuffTree::decode(const uint8_t* buf, uint32_t size, string& literal)
  * insert a new character into the tree, identified by an unique code,
  * a number of bits to represent it. The code is aligned at LSB.
  */
-void HuffTree::insert(uint32_t code, uint8_t bits, uint8_t ch) {
-  SuperHuffNode* snode = &table_[0];
+void HuffTree::insert(HuffTables& tables, uint32_t& nodes, uint32_t code,
+                      uint8_t bits, uint8_t ch) {
+  SuperHuffNode* snode = &tables.table[0];
   uint32_t mask = 0xFF << (bits - 8);
   while (bits > 8) {
     uint32_t x = (code & mask) >> (bits - 8);
     // mark this node as branch
     if (snode->index[x].isLeaf()) {
-      nodes_++;
+      nodes++;
+      CHECK_LT(nodes, kMaxSuperNodes);
       HuffNode& node = snode->index[x];
       node.metadata.isSuperNode = true;
-      node.data.superNodeIndex = nodes_;
+      node.data.superNodeIndex = nodes;
     }
-    snode = &table_[snode->index[x].data.superNodeIndex];
+    snode = &tables.table[snode->index[x].data.superNodeIndex];
     bits -= 8;
     code = code & ~mask;
     mask = mask >> 8;
@@ -123,60 +157,112 @@ void HuffTree::fillIndex(SuperHuffNode& snode, uint32_t code, uint8_t bits,
 /**
  * initializes and builds the huffman tree
  */
-void HuffTree::buildTree() {
+void HuffTree::buildTree(HuffTables& tables) const {
   // create the indexed table
+  uint32_t nodes = 0;
   for (uint32_t i = 0; i < kTableSize; i++) {
-    insert(codes_[i], bits_[i], i);
+    insert(tables, nodes, codes_[i], bits_[i], i);
+  }
+  buildFastTable(tables);
+}
+
+/**
+ * fills the fast table by greedily decoding every possible kFastDecodeBits
+ * key
+ */
+void HuffTree::buildFastTable(HuffTables& tables) const {
+  const uint32_t kKeys = 1 << kFastDecodeBits;
+  const uint32_t kKeyMask = kKeys - 1;
+  // first pass: the single character each key starts with, if its code
+  // fits in the key
+  uint8_t firstCh[kKeys];
+  uint8_t firstBits[kKeys];
+  memset(firstBits, 0, sizeof(firstBits));
+  for (uint32_t ch = 0; ch < kTableSize; ch++) {
+    uint8_t bits = bits_[ch];
+    if (bits == 0 || bits > kFastDecodeBits) {
+      continue;
+    }
+    uint32_t shift = kFastDecodeBits - bits;
+    uint32_t first = codes_[ch] << shift;
+    for (uint32_t key = first; key < first + (1 << shift); key++) {
+      firstCh[key] = ch;
+      firstBits[key] = bits;
+    }
+  }
+  // second pass: chain as many characters as fit completely in the key
+  for (uint32_t key = 0; key < kKeys; key++) {
+    HuffFastEntry& entry = tables.fastTable[key];
+    uint32_t used = 0;
+    uint8_t n = 0;
+    while (n < kMaxFastDecodeSymbols) {
+      uint32_t rest = (key << used) & kKeyMask;
+      uint8_t bits = firstBits[rest];
+      if (bits == 0 || used + bits > kFastDecodeBits) {
+        break;
+      }
+      entry.symbols[n++] = firstCh[rest];
+      used += bits;
+    }
+    entry.metadata.numSymbols = n;
+    entry.metadata.bits = used;
   }
 }
 
 uint32_t HuffTree::encode(const std::string& literal,
                           folly::io::QueueAppender& buf) const {
-  uint32_t code;  // the huffman code of a given character
-  uint8_t bits;   // on how many bits code is represented
-  uint32_t w = 0; // 4-byte word used for packing bits and write it to memory
-  uint8_t wbits = 0;  // how many bits we have in 'w'
-  uint32_t totalBytes = 0;
+  uint32_t maxSize = getMaxEncodeSize(literal.size());
+  if (buf.length() >= maxSize) {
+    // encode in place, the common case as long as the growth size of the
+    // queue covers the literal
+    uint32_t size = encode(literal, buf.writableData());
+    buf.append(size);
+    return size;
+  }
+  // encoding in a fresh buffer would leave the rest of this one unused
+  uint8_t stackBuf[256];
+  std::unique_ptr<uint8_t[]> heapBuf;
+  uint8_t* out = stackBuf;
+  if (maxSize > sizeof(stackBuf)) {
+    heapBuf.reset(new uint8_t[maxSize]);
+    out = heapBuf.get();
+  }
+  uint32_t size = encode(literal, out);
+  buf.push(out, size);
+  return size;
+}
+
+uint32_t HuffTree::encode(const std::string& literal, uint8_t* out) const {
+  uint64_t w = 0;     // accumulator, its low 'wbits' bits are not written yet
+  uint32_t wbits = 0;
+  uint8_t* start = out;
   for (size_t i = 0; i < literal.size(); i++) {
     uint8_t ch = literal[i];
-    code = codes_[ch];
-    bits = bits_[ch];
-
-    if (wbits + bits < 32) {
-      w = (w << bits) | code;
-      wbits += bits;
-    } else {
-      uint8_t xbits = wbits + bits - 32;
-      w = (w << (bits - xbits)) | (code >> xbits);
-      // write the word into the buffer by converting to network order, which
-      // takes care of the endianness problems
-      buf.writeBE<uint32_t>(w);
-      totalBytes += 4;
-      // carry for next batch
-      wbits = xbits;
-      w = code & ((1 << xbits) - 1);
+    uint8_t bits = bits_[ch];
+    // at most 31 + kMaxCodeBits bits are pending, so nothing is lost on the
+    // shift and no code needs splitting across words
+    w = (w << bits) | codes_[ch];
+    wbits += bits;
+    if (wbits >= 32) {
+      wbits -= 32;
+      // write the oldest 32 bits in network order
+      uint32_t word = htonl(uint32_t(w >> wbits));
+      memcpy(out, &word, sizeof(word));
+      out += sizeof(word);
     }
   }
-  // we might have some padding at the byte level
+  // we might have some padding at the byte level, with the EOS prefix
   if (wbits & 0x7) {
-    // padding bits
     uint8_t padbits = 8 - (wbits & 0x7);
     w = (w << padbits) | ((1 << padbits) - 1);
-
     wbits += padbits;
   }
-  // we need to write the leftover bytes, from 1 to 4 bytes
-  if (wbits > 0) {
-    uint8_t bytes = wbits >> 3;
-    // align the bits to the MSB
-    w = w << (32 - wbits);
-    // set the bytes in the network order and copy w[0], w[1]...
-    w = htonl(w);
-    // we need to use memcpy because we might write less than 4 bytes
-    buf.push((uint8_t*)&w, bytes);
-    totalBytes += bytes;
+  // leftover bytes, from 0 to 4
+  while (wbits > 0) {
+    wbits -= 8;
+    *out++ = uint8_t(w >> wbits);
   }
-  return totalBytes;
+  return out - start;
 }
 
 uint32_t HuffTree::getEncodeSize(const std::string& literal) const {
@@ -310,17 +396,21 @@ const uint8_t s_respBitsTable05[kTableSize] = {
 DEFINE_UNION_STATIC_CONST_NO_INIT(HuffTree, ReqHuffTree, s_reqHuffTree05);
 DEFINE_UNION_STATIC_CONST_NO_INIT(HuffTree, RespHuffTree, s_respHuffTree05);
 
+// generated from the tables above, in HuffmanTables.cpp
+extern const HuffTables kReqHuffTables05;
+extern const HuffTables kRespHuffTables05;
+
 __attribute__((__constructor__))
 void initReqHuffTree05() {
-  // constructing the tree in-place
+  // constructing the tree in-place, over the prebuilt decode tables
   new (const_cast<HuffTree*>(&s_reqHuffTree05.data))
-    HuffTree(s_reqCodesTable05, s_reqBitsTable05);
+    HuffTree(s_reqCodesTable05, s_reqBitsTable05, kReqHuffTables05);
 }
 
 __attribute__((__constructor__))
 void initRespHuffTree05() {
   new (const_cast<HuffTree*>(&s_respHuffTree05.data))
-    HuffTree(s_respCodesTable05, s_respBitsTable05);
+    HuffTree(s_respCodesTable05, s_respBitsTable05, kRespHuffTables05);
 }
 
 const HuffTree& reqHuffTree05() {
@@ -12,6 +12,7 @@
 #include <folly/io/Cursor.h>
 #include <folly/io/IOBuf.h>
 #include <proxygen/lib/http/codec/compress/HPACKConstants.h>
+#include <memory>
 #include <string>
 
 namespace proxygen { namespace huffman {
@@ -19,6 +20,9 @@ namespace proxygen { namespace huffman {
 // size of the huffman tables (codes and bits)
 const uint32_t kTableSize = 256;
 
+// longest code in any of the tables, HPACK bounds them to 30 bits
+const uint32_t kMaxCodeBits = 30;
+
 // not used explicitly, since the prefixes are all 1's and they are
 // used only for padding of up to 7 bits
 const uint32_t kEOSReqHpack05 = 0x3ffffdc;
@@ -33,11 +37,11 @@ struct HuffNode {
   union {
     uint8_t ch;   // leafs hold characters
     uint8_t superNodeIndex;
-  } data{0};
+  } data;
   struct {
     uint8_t bits:4; // how many bits are used for representing ch, range is 0-8
     bool isSuperNode:1;
-  } metadata{0,false};
+  } metadata;
 
   bool isLeaf() const {
     return !metadata.isSuperNode;
@@ -51,6 +55,42 @@ struct SuperHuffNode {
   HuffNode index[256];
 };
 
+// most super nodes any of the trees needs
+const uint32_t kMaxSuperNodes = 46;
+
+// number of bits used to index the multi-symbol decode table
+const uint32_t kFastDecodeBits = 12;
+
+// maximum number of characters a single fast table lookup may emit
+const uint32_t kMaxFastDecodeSymbols = 3;
+
+/**
+ * entry in the direct-mapped decode table, indexed by the next
+ * kFastDecodeBits of the bit stream
+ *
+ * numSymbols == 0 means the next code is longer than kFastDecodeBits and
+ * has to be resolved through the SuperHuffNode tree
+ */
+struct HuffFastEntry {
+  uint8_t symbols[kMaxFastDecodeSymbols];
+  struct {
+    uint8_t numSymbols:2; // how many characters to emit
+    uint8_t bits:4;       // how many bits those characters consume
+  } metadata;
+};
+
+/**
+ * the decode tables of a HuffTree, value-initialize them before building
+ *
+ * The tables of the static trees are generated from their code tables at
+ * build time by gen_HuffmanTables.py, so they are read-only data instead
+ * of being built by every process at startup.
+ */
+struct HuffTables {
+  SuperHuffNode table[kMaxSuperNodes];
+  HuffFastEntry fastTable[1 << kFastDecodeBits];
+};
+
 /**
  * Immutable Huffman tree used in the process of decoding. Traditionally the
  * huffman tree is binary, but using that approach leads to major inefficiencies
@@ -80,6 +120,13 @@ struct SuperHuffNode {
  * 3. we don't have enough bits, so we use paddding and we get a key of
  * 01011111, which points to '(' character, like any other node under the
  * subtree '010'.
+ *
+ * On top of the tree, decode() uses a direct-mapped table indexed by the
+ * next 12 bits of input. Each entry holds every character whose code fits
+ * completely in those bits (up to 3), so the common short codes used by
+ * header names and values are emitted several at a time without
+ * branching through the tree. Only codes longer than 12 bits and the
+ * final bits of the input fall back to the tree.
  */
 class HuffTree {
  public:
@@ -88,6 +135,13 @@ class HuffTree {
    * ideally they are static
    */
   explicit HuffTree(const uint32_t* codes, const uint8_t* bits);
+
+  /**
+   * same as above, with decode tables built ahead of time from the same
+   * codes and bits, which must outlive the tree
+   */
+  HuffTree(const uint32_t* codes, const uint8_t* bits,
+           const HuffTables& tables);
   ~HuffTree() {}
 
   /**
@@ -110,6 +164,24 @@ class HuffTree {
   uint32_t encode(const std::string& literal,
                   folly::io::QueueAppender& buf) const;
 
+  /**
+   * encode string literal into a flat buffer, in a single pass over it
+   *
+   * @param literal string to encode
+   * @param out where to write the encoded binary data, it needs room for
+   *        getMaxEncodeSize(literal.size()) bytes
+   * @return size how many bytes were written
+   */
+  uint32_t encode(const std::string& literal, uint8_t* out) const;
+
+  /**
+   * upper bound of the encode size of a literal of the given length, for
+   * reserving space up front instead of walking the literal twice
+   */
+  static uint32_t getMaxEncodeSize(uint32_t length) {
+    return (length * kMaxCodeBits + 7) >> 3;
+  }
+
   /**
    * get the encode size for a string literal, works as a dry-run for the encode
    * useful to allocate enough buffer space before doing the actual encode
@@ -135,19 +207,27 @@ class HuffTree {
   const uint32_t* codesTable() const;
   const uint8_t* bitsTable() const;
 
+  // get the decode tables, useful for testing
+  const HuffTables& getTables() const {
+    return *tables_;
+  }
+
  private:
-  void fillIndex(SuperHuffNode& snode, uint32_t code, uint8_t bits, uint8_t ch,
-     uint8_t level);
-  void buildTree();
-  void insert(uint32_t code, uint8_t bits, uint8_t ch);
+  static void fillIndex(SuperHuffNode& snode, uint32_t code, uint8_t bits,
+                        uint8_t ch, uint8_t level);
+  static void insert(HuffTables& tables, uint32_t& nodes, uint32_t code,
+                     uint8_t bits, uint8_t ch);
+  void buildTree(HuffTables& tables) const;
+  void buildFastTable(HuffTables& tables) const;
 
-  uint32_t nodes_{0};
   const uint32_t* codes_;
   const uint8_t* bits_;
+  // set when the tree built its own tables
+  std::shared_ptr<const HuffTables> ownTables_;
 
  protected:
   explicit HuffTree(const HuffTree& tree);
-  SuperHuffNode table_[46];
+  const HuffTables* tables_;
 };
 
 // accessors for static huffman trees from the draft-05 version of HPACK
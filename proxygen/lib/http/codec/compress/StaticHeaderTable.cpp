@@ -8,7 +8,6 @@
  *
  */
 #include <proxygen/lib/http/codec/compress/StaticHeaderTable.h>
-#include <proxygen/lib/utils/UnionBasedStatic.h>
 
 #include <glog/logging.h>
 #include <list>
@@ -89,15 +88,6 @@ const int kEntriesSize = sizeof(s_tableEntries) / (2 * sizeof(const char*));
  * we're using a union to prevent the static object destruction when
  * calling exit() from a different thread, common on mobile
  */
-DEFINE_UNION_STATIC_CONST_NO_INIT(StaticHeaderTable, StaticTable, s_table);
-
-__attribute__((__constructor__))
-void initStaticTable() {
-  // use placement new to initialize the static table
-  new (const_cast<StaticHeaderTable*>(&s_table.data))
-    StaticHeaderTable(s_tableEntries, kEntriesSize);
-}
-
 StaticHeaderTable::StaticHeaderTable(
     const char* entries[][2],
     int size)
@@ -117,10 +107,39 @@ StaticHeaderTable::StaticHeaderTable(
   }
   // the static table is not involved in the delta compression
   clearReferenceSet();
+
+  for (uint32_t i = 1; i <= this->size(); i++) {
+    HTTPHeaderCode code = HTTPCommonHeaders::hash((*this)[i].name);
+    CHECK(code != HTTP_HEADER_OTHER) << "not a common header: "
+                                     << (*this)[i].name;
+    auto& entries = codeEntries_[code];
+    if (entries.count == 0) {
+      entries.first = i;
+    }
+    CHECK_EQ(entries.first + entries.count, i) << "entries of "
+      << (*this)[i].name << " are not next to each other";
+    entries.count++;
+  }
+}
+
+const StaticHeaderTable& StaticHeaderTable::get() {
+  // built on first use instead of at startup, by processes which never
+  // need it, and leaked so that calling exit() from a different thread
+  // does not destroy it under the threads still using it
+  static const StaticHeaderTable* table =
+    new StaticHeaderTable(s_tableEntries, kEntriesSize);
+  return *table;
 }
 
-const HeaderTable& StaticHeaderTable::get() {
-  return s_table.data;
+uint32_t StaticHeaderTable::getIndex(HTTPHeaderCode code,
+                                     const std::string& value) const {
+  const auto& entries = codeEntries_[code];
+  for (uint32_t i = entries.first; i < entries.first + entries.count; i++) {
+    if ((*this)[i].value == value) {
+      return i;
+    }
+  }
+  return 0;
 }
 
 }
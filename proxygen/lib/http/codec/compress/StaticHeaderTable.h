@@ -9,12 +9,20 @@
  */
 #pragma once
 
+#include <proxygen/lib/http/HTTPCommonHeaders.h>
 #include <proxygen/lib/http/codec/compress/HeaderTable.h>
 #include <string>
 #include <vector>
 
 namespace proxygen {
 
+/**
+ * Every name in the static tables is a common header, and entries with the
+ * same name are next to each other, so lookups go by the HTTPHeaderCode of
+ * the name into a table of the entries per code instead of through the
+ * hash maps of HeaderTable. Names that aren't common headers are rejected
+ * by the perfect hash alone.
+ */
 class StaticHeaderTable : public HeaderTable {
 
  public:
@@ -22,7 +30,37 @@ class StaticHeaderTable : public HeaderTable {
     const char* entries[][2],
     int size);
 
-  static const HeaderTable& get();
+  static const StaticHeaderTable& get();
+
+  /**
+   * Same as HeaderTable::getIndex()
+   */
+  uint32_t getIndex(const HPACKHeader& header) const {
+    return getIndex(HTTPCommonHeaders::hash(header.name), header.value);
+  }
+
+  uint32_t getIndex(HTTPHeaderCode code, const std::string& value) const;
+
+  /**
+   * Same as HeaderTable::nameIndex(), the first entry with the name
+   */
+  uint32_t nameIndex(const std::string& name) const {
+    return nameIndex(HTTPCommonHeaders::hash(name));
+  }
+
+  uint32_t nameIndex(HTTPHeaderCode code) const {
+    return codeEntries_[code].first;
+  }
+
+ private:
+  struct CodeEntries {
+    // index of the first entry with the name, 0 if there is none
+    uint8_t first{0};
+    uint8_t count{0};
+  };
+
+  // HTTPHeaderCode is a uint8_t
+  CodeEntries codeEntries_[256];
 };
 
 }
@@ -21,4 +21,28 @@ HPACKCodec09::HPACKCodec09(TransportDirection direction) :
   decoder_ = folly::make_unique<HPACKDecoder09>();
 }
 
+std::unique_ptr<folly::IOBuf> HPACKCodec09::encode(
+  std::vector<compress::Header>& headers) noexcept {
+  uint32_t uncompressed = 0;
+  for (const auto& h : headers) {
+    uncompressed += h.name->size() + h.value->size() + 2;
+  }
+  auto buf = static_cast<HPACKEncoder09*>(encoder_.get())->encode(
+    headers, encodeHeadroom_);
+  recordEncodedSize(buf.get(), uncompressed);
+  return buf;
+}
+
+void HPACKCodec09::setEncodeCacheSize(uint32_t entries) {
+  static_cast<HPACKEncoder09*>(encoder_.get())->setEncodeCacheSize(entries);
+}
+
+void HPACKCodec09::setEncoderAdaptiveTableSize(uint32_t minSize) {
+  static_cast<HPACKEncoder09*>(encoder_.get())->setAdaptiveTableSize(minSize);
+}
+
+void HPACKCodec09::setEncoderMemoryPressure(bool pressure) {
+  static_cast<HPACKEncoder09*>(encoder_.get())->setMemoryPressure(pressure);
+}
+
 }
@@ -16,6 +16,28 @@ namespace proxygen {
 class HPACKCodec09 : public HPACKCodec {
  public:
   explicit HPACKCodec09(TransportDirection direction);
+
+  /**
+   * Encodes the list as it is, without converting it to HPACKHeaders
+   * first, see HPACKEncoder09::encode()
+   */
+  std::unique_ptr<folly::IOBuf> encode(
+    std::vector<compress::Header>& headers) noexcept override;
+
+  /**
+   * See HPACKEncoder09::setEncodeCacheSize()
+   */
+  void setEncodeCacheSize(uint32_t entries);
+
+  /**
+   * See HPACKEncoder09::setAdaptiveTableSize()
+   */
+  void setEncoderAdaptiveTableSize(uint32_t minSize);
+
+  /**
+   * See HPACKEncoder09::setMemoryPressure()
+   */
+  void setEncoderMemoryPressure(bool pressure);
 };
 
 }
@@ -35,7 +35,7 @@ class HPACKContextImpl {
   }
 
   static uint32_t getIndex(const HPACKHeader& header,
-                           const HeaderTable& staticTable,
+                           const StaticHeaderTable& staticTable,
                            const HeaderTable& dynamicTable) {
     uint32_t index = staticTable.getIndex(header);
     if (index) {
@@ -49,7 +49,7 @@ class HPACKContextImpl {
   }
 
   static uint32_t nameIndex(const std::string& name,
-                            const HeaderTable& staticTable,
+                            const StaticHeaderTable& staticTable,
                             const HeaderTable& dynamicTable) {
     uint32_t index = staticTable.nameIndex(name);
     if (index) {
@@ -39,7 +39,9 @@ uint32_t HPACKDecoder09::decodeLiteralHeader(HPACKDecodeBuffer& dbuf,
                                              headers_t* emitted) {
   uint8_t byte = dbuf.peek();
   bool indexing = byte & HPACK09::HeaderEncoding::LITERAL_INCR_INDEXING;
-  HPACKHeader header;
+  HTTPHeaderCode code;
+  folly::StringPiece name;
+  folly::StringPiece value;
   uint8_t indexMask = 0x3F;  // 0011 1111
   uint8_t length = 6;
   if (!indexing) {
@@ -67,28 +69,31 @@ uint32_t HPACKDecoder09::decodeLiteralHeader(HPACKDecodeBuffer& dbuf,
       err_ = HPACK::DecodeError::INVALID_INDEX;
       return 0;
     }
-    header.name = getHeader(index).name;
+    // the table entry stays put until the table is next changed
+    name = getHeader(index).name;
+    code = headerCode(index);
   } else {
     // skip current byte
     dbuf.next();
-    err_ = dbuf.decodeLiteral(header.name);
+    err_ = dbuf.decodeLiteral(nameBuf_, name);
     if (err_ != HPACK::DecodeError::NONE) {
       LOG(ERROR) << "Error decoding header name err_=" << err_;
       return 0;
     }
+    code = HTTPCommonHeaders::hash(name.data(), name.size());
   }
   // value
-  err_ = dbuf.decodeLiteral(header.value);
+  err_ = dbuf.decodeLiteral(valueBuf_, value);
   if (err_ != HPACK::DecodeError::NONE) {
-    LOG(ERROR) << "Error decoding header value name=" << header.name
+    LOG(ERROR) << "Error decoding header value name=" << name
                << " err_=" << err_;
     return 0;
   }
 
-  uint32_t emittedSize = emit(header, emitted);
+  uint32_t emittedSize = emit(code, name, value, emitted);
 
   if (indexing) {
-    table_.add(header);
+    table_.add(HPACKHeader(name.str(), value.str()));
   }
 
   return emittedSize;
@@ -108,16 +113,16 @@ uint32_t HPACKDecoder09::decodeIndexedHeader(HPACKDecodeBuffer& dbuf,
     err_ = HPACK::DecodeError::INVALID_INDEX;
     return 0;
   }
-  uint32_t emittedSize = 0;
-  // a static index cannot be part of the reference set
+  auto& header = getHeader(index);
+  return emit(headerCode(index), header.name, header.value, emitted);
+}
+
+HTTPHeaderCode HPACKDecoder09::headerCode(uint32_t index) {
   if (isStatic(index)) {
-    auto& header = getStaticHeader(index);
-    emittedSize = emit(header, emitted);
-  } else {
-    auto& header = getDynamicHeader(index);
-    emittedSize = emit(header, emitted);
+    return HPACK09::getStaticHeaderCode(globalToStaticIndex(index));
   }
-  return emittedSize;
+  const auto& name = getDynamicHeader(index).name;
+  return HTTPCommonHeaders::hash(name.data(), name.size());
 }
 
 }
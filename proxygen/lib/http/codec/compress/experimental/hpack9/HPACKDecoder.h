@@ -29,7 +29,7 @@ public:
   void handleTableSizeUpdate(HPACKDecodeBuffer& dbuf);
 
  protected:
-  const HeaderTable& getStaticTable() const override {
+  const StaticHeaderTable& getStaticTable() const override {
     return HPACK09::getStaticTable();
   }
 
@@ -68,6 +68,15 @@ public:
                                headers_t* emitted) override;
   uint32_t decodeIndexedHeader(HPACKDecodeBuffer& dbuf,
                                headers_t* emitted) override;
+
+ private:
+  // The HTTPHeaderCode of the name of the header at index
+  HTTPHeaderCode headerCode(uint32_t index);
+
+  // scratch space for literals that cannot be referenced in place, reused
+  // across headers
+  std::string nameBuf_;
+  std::string valueBuf_;
 };
 
 }
@@ -9,9 +9,12 @@
  */
 #include <proxygen/lib/http/codec/compress/experimental/hpack9/HPACKEncoder.h>
 
+#include <proxygen/lib/http/codec/SPDYUtil.h>
 #include <proxygen/lib/http/codec/compress/experimental/hpack9/HPACKConstants.h>
 
+#include <folly/Hash.h>
 #include <folly/io/IOBuf.h>
+#include <glog/logging.h>
 
 namespace proxygen {
 
@@ -22,33 +25,257 @@ std::unique_ptr<folly::IOBuf> HPACKEncoder09::encode(
     buffer_.addHeadroom(headroom);
     headroom = 0;
   }
+  adaptTableSize();
+  // the cached blocks never start with a table size update
+  CachedBlock* cached = nullptr;
+  if (!pendingContextUpdate_) {
+    cached = findCachedBlock(headers);
+  }
+  if (cached && cached->generation == table_.generation() &&
+      cached->headers == headers) {
+    buffer_.append(folly::ByteRange(folly::StringPiece(cached->encoded)));
+    return buffer_.release();
+  }
+
+  encodeContextUpdate();
+  allIndexed_ = true;
+  for (const auto& header : headers) {
+    encodeHeader(header);
+  }
+  auto out = buffer_.release();
+
+  // Only a block of indexed headers left the table as it was, and so has
+  // the same encoding for as long as the table does not change
+  if (cached && allIndexed_ && out) {
+    cached->headers = headers;
+    fillCachedBlock(*cached, *out);
+  }
+  return out;
+}
+
+std::unique_ptr<folly::IOBuf> HPACKEncoder09::encode(
+  const std::vector<compress::Header>& headers,
+  uint32_t headroom) {
+  if (headroom) {
+    buffer_.addHeadroom(headroom);
+    headroom = 0;
+  }
+  adaptTableSize();
+  CachedBlock* cached = nullptr;
+  if (!pendingContextUpdate_) {
+    cached = findCachedBlock(headers);
+  }
+  if (cached && cached->generation == table_.generation() &&
+      isCached(*cached, headers)) {
+    buffer_.append(folly::ByteRange(folly::StringPiece(cached->encoded)));
+    return buffer_.release();
+  }
+
+  encodeContextUpdate();
+  allIndexed_ = true;
+  for (const auto& header : headers) {
+    encodeHeader(header);
+  }
+  auto out = buffer_.release();
+
+  if (cached && allIndexed_ && out) {
+    cached->headers.clear();
+    for (const auto& header : headers) {
+      cached->headers.emplace_back(lowerName(header), *header.value);
+    }
+    fillCachedBlock(*cached, *out);
+  }
+  return out;
+}
+
+void HPACKEncoder09::encodeContextUpdate() {
   if (pendingContextUpdate_) {
+    if (minPendingSize_ < table_.capacity()) {
+      // The table shrank then grew since the last update, so the decoder
+      // has to evict what we did before growing back
+      buffer_.encodeInteger(minPendingSize_,
+                            HPACK09::HeaderEncoding::TABLE_SIZE_UPDATE,
+                            5);
+    }
     buffer_.encodeInteger(table_.capacity(),
                           HPACK09::HeaderEncoding::TABLE_SIZE_UPDATE,
                           5);
     pendingContextUpdate_ = false;
   }
+}
+
+void HPACKEncoder09::setHeaderTableSize(uint32_t size) {
+  maxTableSize_ = size;
+  if (minAdaptiveSize_) {
+    resizeTable(std::max(std::min(table_.capacity(), size),
+                         minAdaptiveTableSize()));
+  } else {
+    resizeTable(size);
+  }
+}
+
+void HPACKEncoder09::setAdaptiveTableSize(uint32_t minSize) {
+  minAdaptiveSize_ = minSize;
+  window_ = indexingStats_;
+  resizeTable(minSize ? minAdaptiveTableSize() : maxTableSize_);
+}
+
+void HPACKEncoder09::releaseIdleMemory() {
+  HPACKEncoder::releaseIdleMemory();
+  setEncodeCacheSize(encodeCache_.size());
+  std::string().swap(lowerName_);
+}
+
+void HPACKEncoder09::setMemoryPressure(bool pressure) {
+  memoryPressure_ = pressure;
+  if (pressure && minAdaptiveSize_ &&
+      table_.capacity() > minAdaptiveTableSize()) {
+    resizeTable(minAdaptiveTableSize());
+  }
+}
+
+void HPACKEncoder09::adaptTableSize() {
+  if (!minAdaptiveSize_) {
+    return;
+  }
+  uint64_t hits = indexingStats_.hits - window_.hits;
+  uint64_t lookups = hits + indexingStats_.literals - window_.literals;
+  if (lookups < kAdaptWindow) {
+    return;
+  }
+  uint64_t evictions = indexingStats_.evictions - window_.evictions;
+  window_ = indexingStats_;
+  if (memoryPressure_) {
+    return;
+  }
+  uint32_t size = table_.capacity();
+  if (evictions > 0 && hits * kGrowHitRatio >= lookups) {
+    size = std::min(size * 2, maxTableSize_);
+  } else if (hits * kShrinkHitRatio < lookups) {
+    size = std::max(size / 2, minAdaptiveTableSize());
+  }
+  if (size != table_.capacity()) {
+    VLOG(5) << "Resizing the header table from " << table_.capacity()
+            << " to " << size << " after " << hits << " hits in "
+            << lookups;
+    resizeTable(size);
+  }
+}
+
+void HPACKEncoder09::resizeTable(uint32_t size) {
+  // the entries evicted here are part of the pending update
+  minPendingSize_ = pendingContextUpdate_ ?
+    std::min(minPendingSize_, size) : size;
+  HPACKEncoder::setHeaderTableSize(size);
+}
+
+void HPACKEncoder09::fillCachedBlock(CachedBlock& cached,
+                                     const folly::IOBuf& out) {
+  cached.generation = table_.generation();
+  cached.encoded.clear();
+  for (auto& range: out) {
+    cached.encoded.append(reinterpret_cast<const char*>(range.data()),
+                          range.size());
+  }
+}
+
+HPACKEncoder09::CachedBlock* HPACKEncoder09::findCachedBlock(
+  const std::vector<HPACKHeader>& headers) {
+  if (encodeCache_.empty()) {
+    return nullptr;
+  }
+  uint64_t hash = 0;
   for (const auto& header : headers) {
-    encodeHeader(header);
+    hash = folly::hash::hash_combine(hash, header.name, header.value);
+  }
+  return &encodeCache_[hash % encodeCache_.size()];
+}
+
+HPACKEncoder09::CachedBlock* HPACKEncoder09::findCachedBlock(
+  const std::vector<compress::Header>& headers) {
+  if (encodeCache_.empty()) {
+    return nullptr;
+  }
+  // same hash as for the HPACKHeader list with the same headers
+  uint64_t hash = 0;
+  for (const auto& header : headers) {
+    hash = folly::hash::hash_combine(hash, lowerName(header),
+                                     *header.value);
+  }
+  return &encodeCache_[hash % encodeCache_.size()];
+}
+
+bool HPACKEncoder09::isCached(const CachedBlock& cached,
+                              const std::vector<compress::Header>& headers) {
+  if (cached.headers.size() != headers.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < headers.size(); i++) {
+    if (cached.headers[i].value != *headers[i].value ||
+        cached.headers[i].name != lowerName(headers[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+const std::string& HPACKEncoder09::lowerName(const compress::Header& header) {
+  if (header.code != HTTP_HEADER_OTHER) {
+    return *HTTPCommonHeaders::getPointerToLowerHeaderName(header.code);
   }
-  return buffer_.release();
+  lowerName_.resize(header.name->size());
+  SPDYUtil::lowercaseHeaderName(
+    folly::ByteRange((const uint8_t*)header.name->data(),
+                     header.name->size()),
+    (uint8_t*)&lowerName_[0]);
+  return lowerName_;
 }
 
 void HPACKEncoder09::encodeHeader(const HPACKHeader& header) {
   uint32_t index = getIndex(header);
   if (index) {
+    if (!isStatic(index)) {
+      indexingStats_.hits++;
+    }
     encodeAsIndex(index);
   } else {
     encodeAsLiteral(header);
   }
 }
 
+void HPACKEncoder09::encodeHeader(const compress::Header& header) {
+  const std::string& name = lowerName(header);
+  const std::string& value = *header.value;
+  HTTPHeaderCode code = header.code;
+  if (code == HTTP_HEADER_OTHER) {
+    // the list may still carry common headers by name only
+    code = HTTPCommonHeaders::hash(name);
+  }
+  uint32_t index = getStaticTable().getIndex(code, value);
+  if (index) {
+    encodeAsIndex(staticToGlobalIndex(index));
+    return;
+  }
+  index = table_.getIndex(name, value);
+  if (index) {
+    indexingStats_.hits++;
+    encodeAsIndex(dynamicToGlobalIndex(index));
+    return;
+  }
+  // the scratch header keeps its capacity, so this is normally no
+  // allocation; the header table makes its own copy of indexed literals
+  literal_.name.assign(name);
+  literal_.value.assign(value);
+  encodeAsLiteral(literal_);
+}
+
 void HPACKEncoder09::encodeAsLiteral(const HPACKHeader& header) {
-  bool indexing = header.isIndexable();
+  bool indexing = shouldIndex(header);
   uint8_t prefix = indexing ?
     HPACK09::HeaderEncoding::LITERAL_INCR_INDEXING :
     HPACK09::HeaderEncoding::LITERAL_NO_INDEXING;
   uint8_t len = indexing ? 6 : 4;
+  allIndexed_ = false;
   // name
   uint32_t index = nameIndex(header.name);
   if (index) {
@@ -58,11 +285,9 @@ void HPACKEncoder09::encodeAsLiteral(const HPACKHeader& header) {
     buffer_.encodeLiteral(header.name);
   }
   // value
-  buffer_.encodeLiteral(header.value);
+  encodeLiteralValue(header);
   // indexed ones need to get added to the header table
-  if (indexing) {
-    table_.add(header);
-  }
+  addLiteral(header, indexing);
 }
 
 }
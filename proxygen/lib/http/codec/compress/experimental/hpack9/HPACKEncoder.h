@@ -10,6 +10,10 @@
 #pragma once
 
 #include <proxygen/lib/http/codec/compress/HPACKEncoder.h>
+#include <proxygen/lib/http/codec/compress/Header.h>
+
+#include <algorithm>
+#include <limits>
 
 #include <proxygen/lib/http/codec/compress/experimental/hpack9/Huffman.h>
 #include <proxygen/lib/http/codec/compress/experimental/hpack9/StaticHeaderTable.h>
@@ -21,13 +25,65 @@ class HPACKEncoder09 : public HPACKEncoder {
  public:
   explicit HPACKEncoder09(bool huffman = true,
                           uint32_t tableSize = HPACK::kTableSize)
-      : HPACKEncoder(huffman::huffTree09(), huffman, tableSize) {}
+      : HPACKEncoder(huffman::huffTree09(), huffman, tableSize, false),
+        maxTableSize_(tableSize) {}
 
   std::unique_ptr<folly::IOBuf> encode(const std::vector<HPACKHeader>& headers,
                                        uint32_t headroom = 0) override;
 
+  /**
+   * Same as encode() above, straight from the header list of the codec.
+   * Lookups are keyed on the header code when it is known and the names
+   * and values are only copied for the literals and the entries added to
+   * the header table.
+   */
+  std::unique_ptr<folly::IOBuf> encode(
+    const std::vector<compress::Header>& headers,
+    uint32_t headroom = 0);
+
+  /**
+   * Keep the encoding of up to the given number of header blocks that were
+   * made only of indexed headers, and reuse it when the same block is
+   * encoded again before the header table changes. 0 disables this.
+   */
+  void setEncodeCacheSize(uint32_t entries) {
+    encodeCache_.clear();
+    encodeCache_.resize(entries);
+  }
+
+  /**
+   * The limit the peer set on the header table size.  With adaptive sizing
+   * the table may be kept smaller than that.
+   */
+  void setHeaderTableSize(uint32_t size) override;
+
+  /**
+   * Size the header table by how much use it gets, between minSize and the
+   * limit of the peer, instead of always taking all the peer allows.  The
+   * table starts at minSize.  Every kAdaptWindow headers looked up in it,
+   * it doubles if entries were evicted while at least 1/kGrowHitRatio of
+   * them were found, and halves if fewer than 1/kShrinkHitRatio were.
+   * Each change is signalled with a table size update.  0 disables this.
+   */
+  void setAdaptiveTableSize(uint32_t minSize);
+
+  /**
+   * Under memory pressure an adaptive header table is held at its minimum
+   * size, and only grows again once the pressure is gone.
+   */
+  void setMemoryPressure(bool pressure);
+
+  /**
+   * Also empties the encode cache
+   */
+  void releaseIdleMemory() override;
+
+  static const uint32_t kAdaptWindow = 128;
+  static const uint32_t kGrowHitRatio = 4;
+  static const uint32_t kShrinkHitRatio = 16;
+
  protected:
-  const HeaderTable& getStaticTable() const override {
+  const StaticHeaderTable& getStaticTable() const override {
     return HPACK09::getStaticTable();
   }
 
@@ -59,10 +115,65 @@ class HPACKEncoder09 : public HPACKEncoder {
   }
 
  private:
+  struct CachedBlock {
+    // the table generation the block was encoded against
+    uint64_t generation{std::numeric_limits<uint64_t>::max()};
+    std::vector<HPACKHeader> headers;
+    std::string encoded;
+  };
 
   void encodeHeader(const HPACKHeader& header) override;
 
+  void encodeHeader(const compress::Header& header);
+
   void encodeAsLiteral(const HPACKHeader& header) override;
+
+  CachedBlock* findCachedBlock(const std::vector<HPACKHeader>& headers);
+
+  CachedBlock* findCachedBlock(const std::vector<compress::Header>& headers);
+
+  bool isCached(const CachedBlock& cached,
+                const std::vector<compress::Header>& headers);
+
+  void encodeContextUpdate();
+
+  void adaptTableSize();
+
+  void resizeTable(uint32_t size);
+
+  // The smallest size an adaptive table may have, no more than the peer
+  // allows
+  uint32_t minAdaptiveTableSize() const {
+    return std::min(minAdaptiveSize_, maxTableSize_);
+  }
+
+  void fillCachedBlock(CachedBlock& cached, const folly::IOBuf& out);
+
+  /**
+   * The name of the header in lowercase, as HPACK expects it. That is the
+   * canonical spelling for the common headers, otherwise a copy that stays
+   * valid until the next call.
+   */
+  const std::string& lowerName(const compress::Header& header);
+
+  // direct mapped by the hash of the headers
+  std::vector<CachedBlock> encodeCache_;
+  // false as soon as the block being encoded has a literal
+  bool allIndexed_{true};
+  // scratch space of lowerName() and the literals of the compress::Header
+  // encode, kept to reuse their allocations
+  std::string lowerName_;
+  HPACKHeader literal_;
+
+  uint32_t maxTableSize_{HPACK::kTableSize};
+  // 0 unless the table size is adaptive
+  uint32_t minAdaptiveSize_{0};
+  bool memoryPressure_{false};
+  // indexingStats_ as of the start of the current window
+  IndexingStats window_;
+  // The smallest size the table had since the last table size update was
+  // sent, which the decoder has to evict down to as well
+  uint32_t minPendingSize_{0};
 };
 
 }
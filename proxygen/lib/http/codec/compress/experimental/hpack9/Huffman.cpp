@@ -70,10 +70,13 @@ const uint8_t s_bitsTable09[kTableSize] = {
  */
 DEFINE_UNION_STATIC_CONST_NO_INIT(HuffTree, HuffTree09, s_huffTree09);
 
+// generated from the tables above, in HuffmanTables.cpp
+extern const HuffTables kHuffTables09;
+
 __attribute__((__constructor__))
 void initHuffTree09() {
   new (const_cast<HuffTree*>(&s_huffTree09.data))
-    HuffTree(s_codesTable09, s_bitsTable09);
+    HuffTree(s_codesTable09, s_bitsTable09, kHuffTables09);
 }
 
 const HuffTree& huffTree09() {
@@ -9,7 +9,7 @@
  */
 #include <proxygen/lib/http/codec/compress/experimental/hpack9/StaticHeaderTable.h>
 
-#include <proxygen/lib/utils/UnionBasedStatic.h>
+#include <glog/logging.h>
 
 namespace proxygen { namespace HPACK09 {
 
@@ -80,21 +80,39 @@ const char* s_tableEntries[][2] = {
 
 const int kEntriesSize = sizeof(s_tableEntries) / (2 * sizeof(const char*));
 
+namespace {
+
+struct StaticTableData {
+  StaticTableData() : table(s_tableEntries, kEntriesSize) {
+    for (int i = 1; i <= kEntriesSize; i++) {
+      headerCodes[i] = HTTPCommonHeaders::hash(table[i].name);
+    }
+  }
+
+  StaticHeaderTable table;
+  // indexed like the table, which starts at 1
+  HTTPHeaderCode headerCodes[kEntriesSize + 1];
+};
+
 /**
- * we're using a union to prevent the static object destruction when
- * calling exit() from a different thread, common on mobile
+ * built on first use instead of at startup, by processes which never need
+ * it, and leaked to prevent the static object destruction when calling
+ * exit() from a different thread, common on mobile
  */
-DEFINE_UNION_STATIC_CONST_NO_INIT(StaticHeaderTable, StaticTable, s_table);
+const StaticTableData& getStaticTableData() {
+  static const StaticTableData* data = new StaticTableData();
+  return *data;
+}
+
+}
 
-__attribute__((__constructor__))
-void initStaticTable() {
-  // use placement new to initialize the static table
-  new (const_cast<StaticHeaderTable*>(&s_table.data))
-    StaticHeaderTable(s_tableEntries, kEntriesSize);
+const StaticHeaderTable& getStaticTable() {
+  return getStaticTableData().table;
 }
 
-const HeaderTable& getStaticTable() {
-  return s_table.data;
+HTTPHeaderCode getStaticHeaderCode(uint32_t index) {
+  DCHECK(index > 0 && index <= uint32_t(kEntriesSize));
+  return getStaticTableData().headerCodes[index];
 }
 
 }}
@@ -9,10 +9,17 @@
  */
 #pragma once
 
+#include <proxygen/lib/http/HTTPCommonHeaders.h>
 #include <proxygen/lib/http/codec/compress/StaticHeaderTable.h>
 
 namespace proxygen { namespace HPACK09 {
 
-const HeaderTable& getStaticTable();
+const StaticHeaderTable& getStaticTable();
+
+/**
+ * The HTTPHeaderCode of the name of the static table entry at index,
+ * computed once, so decoding does not need to look names up
+ */
+HTTPHeaderCode getStaticHeaderCode(uint32_t index);
 
 }}
@@ -13,6 +13,7 @@
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 #include <proxygen/lib/http/codec/compress/experimental/hpack9/HPACKCodec.h>
+#include <proxygen/lib/http/codec/compress/experimental/hpack9/HPACKEncoder.h>
 #include <proxygen/lib/http/codec/compress/Header.h>
 #include <proxygen/lib/http/codec/compress/HeaderCodec.h>
 #include <vector>
@@ -285,3 +286,150 @@ TEST_F(HPACKCodecTests, header_codec_stats) {
   EXPECT_EQ(stats.encodedBytesUncompr, 0);
   client.setStats(nullptr);
 }
+
+TEST_F(HPACKCodecTests, encode_cache) {
+  vector<vector<string>> headers = {
+    {"content-encoding", "gzip"},
+    {"x-fb-debug", "sdfgrwer"}
+  };
+  vector<Header> resp = headersFromArray(headers);
+  vector<vector<string>> otherHeaders = {
+    {"content-encoding", "gzip"},
+    {"x-fb-debug", "bleah"}
+  };
+  vector<Header> otherResp = headersFromArray(otherHeaders);
+
+  // encodes the same as a codec without the cache
+  HPACKCodec09 reference{TransportDirection::DOWNSTREAM};
+  server.setEncodeCacheSize(4);
+  server.setEncodeHeadroom(9);
+  reference.setEncodeHeadroom(9);
+  for (int i = 0; i < 6; i++) {
+    // every third block adds to the table, and so invalidates the cache
+    auto& block = (i % 3 == 2) ? otherResp : resp;
+    unique_ptr<IOBuf> encoded = server.encode(block);
+    unique_ptr<IOBuf> expected = reference.encode(block);
+    EXPECT_EQ(encoded->headroom(), 9);
+    EXPECT_TRUE(IOBufEqual()(encoded, expected));
+
+    Cursor cursor(encoded.get());
+    auto result = client.decode(cursor, encoded->computeChainDataLength());
+    EXPECT_TRUE(result.isOk());
+    EXPECT_EQ(result.ok().headers.size(), 4);
+  }
+}
+
+namespace {
+
+class TestStreamingCallback : public HeaderCodec::StreamingCallback {
+ public:
+  void onHeader(HTTPHeaderCode code,
+                StringPiece name,
+                StringPiece value) override {
+    codes.push_back(code);
+    headers.emplace_back(name.str(), value.str());
+  }
+  void onHeadersComplete() override {
+    complete = true;
+  }
+  void onDecodeError(HeaderDecodeError decodeError) override {
+    error = true;
+  }
+
+  vector<HTTPHeaderCode> codes;
+  vector<pair<string, string>> headers;
+  bool complete{false};
+  bool error{false};
+};
+
+}
+
+TEST_F(HPACKCodecTests, decode_streaming_codes) {
+  vector<vector<string>> headers = {
+    {":status", "200"},
+    {"content-length", "80"},
+    {"x-fb-debug", "sdfgrwer"},
+    {"content-type", "text/html"}
+  };
+  vector<Header> resp = headersFromArray(headers);
+
+  // the second time around, the literals come from the dynamic table
+  for (int i = 0; i < 2; i++) {
+    unique_ptr<IOBuf> encoded = server.encode(resp);
+    Cursor cursor(encoded.get());
+    TestStreamingCallback cb;
+    client.decodeStreaming(cursor, encoded->computeChainDataLength(), &cb);
+    EXPECT_TRUE(cb.complete);
+    EXPECT_FALSE(cb.error);
+    ASSERT_EQ(cb.headers.size(), 4);
+    for (size_t j = 0; j < headers.size(); j++) {
+      EXPECT_EQ(cb.headers[j].first, headers[j][0]);
+      EXPECT_EQ(cb.headers[j].second, headers[j][1]);
+    }
+    EXPECT_EQ(cb.codes[0], HTTP_HEADER_COLON_STATUS);
+    EXPECT_EQ(cb.codes[1], HTTP_HEADER_CONTENT_LENGTH);
+    EXPECT_EQ(cb.codes[2], HTTP_HEADER_OTHER);
+    EXPECT_EQ(cb.codes[3], HTTP_HEADER_CONTENT_TYPE);
+  }
+}
+
+TEST_F(HPACKCodecTests, encode_header_codes) {
+  string status = "200";
+  string contentType = "text/html";
+  string debugName = "X-FB-Debug";
+  string debug = "sdfgrwer";
+  string cacheControlName = "Cache-Control";
+  string cacheControl = "private";
+  // common headers with their canonical names, one of them without its
+  // code, and one that isn't common
+  vector<Header> resp = {
+    Header(HTTP_HEADER_COLON_STATUS, status),
+    Header(HTTP_HEADER_CONTENT_TYPE, contentType),
+    Header(debugName, debug),
+    Header(cacheControlName, cacheControl)
+  };
+  vector<HPACKHeader> expectedHeaders = {
+    HPACKHeader(":status", status),
+    HPACKHeader("content-type", contentType),
+    HPACKHeader("x-fb-debug", debug),
+    HPACKHeader("cache-control", cacheControl)
+  };
+
+  // encodes the same as the HPACKHeader list, the second time around from
+  // the dynamic table
+  HPACKEncoder09 reference;
+  for (int i = 0; i < 2; i++) {
+    unique_ptr<IOBuf> encoded = server.encode(resp);
+    unique_ptr<IOBuf> expected = reference.encode(expectedHeaders);
+    EXPECT_TRUE(IOBufEqual()(encoded, expected));
+
+    Cursor cursor(encoded.get());
+    TestStreamingCallback cb;
+    client.decodeStreaming(cursor, encoded->computeChainDataLength(), &cb);
+    EXPECT_FALSE(cb.error);
+    ASSERT_EQ(cb.headers.size(), 4);
+    for (size_t j = 0; j < expectedHeaders.size(); j++) {
+      EXPECT_EQ(cb.headers[j].first, expectedHeaders[j].name);
+      EXPECT_EQ(cb.headers[j].second, expectedHeaders[j].value);
+    }
+  }
+  EXPECT_EQ(server.getEncoderIndexingStats().hits, 3);
+  EXPECT_EQ(server.getEncodedSize().uncompressed, 77);
+}
+
+TEST_F(HPACKCodecTests, max_uncompressed_streaming) {
+  string name = "x-fb-debug";
+  string value(1000, 'a');
+  vector<Header> resp = {Header(name, value)};
+  unique_ptr<IOBuf> encoded = server.encode(resp);
+
+  // the limit reaches the decoder, which rejects the value before
+  // decoding it
+  client.setMaxUncompressed(500);
+  Cursor cursor(encoded.get());
+  TestStreamingCallback cb;
+  client.decodeStreaming(cursor, encoded->computeChainDataLength(), &cb);
+  EXPECT_TRUE(cb.error);
+  EXPECT_FALSE(cb.complete);
+  EXPECT_TRUE(cb.headers.empty());
+}
@@ -34,7 +34,7 @@ class TestContext : public HPACKContext {
     table_.add(header);
   }
 
-  const HeaderTable& getStaticTable() const override {
+  const StaticHeaderTable& getStaticTable() const override {
     return HPACK09::getStaticTable();
   }
 
@@ -122,6 +122,9 @@ TEST_F(HPACKContextTests, decoder_large_header) {
   EXPECT_EQ(encoder.getTable().referenceSet().size(), 0);
   EXPECT_EQ(decoder.getTable().size(), 0);
   EXPECT_EQ(decoder.getTable().referenceSet().size(), 0);
+  // neither keeps one at all
+  EXPECT_FALSE(encoder.getTable().hasReferenceSet());
+  EXPECT_FALSE(decoder.getTable().hasReferenceSet());
 }
 
 /**
@@ -251,6 +254,90 @@ TEST_P(HPACKContextTests, contextUpdate) {
   }
 }
 
+namespace {
+
+// Encodes the block and checks the decoder gets it back
+void roundTrip(HPACKEncoder09& encoder, HPACKDecoder09& decoder,
+               const vector<HPACKHeader>& headers) {
+  auto encoded = encoder.encode(headers);
+  auto decoded = decoder.decode(encoded.get());
+  ASSERT_FALSE(decoder.hasError());
+  EXPECT_EQ(*decoded, headers);
+  EXPECT_EQ(decoder.getTable().capacity(), encoder.getTable().capacity());
+  EXPECT_EQ(decoder.getTable().size(), encoder.getTable().size());
+}
+
+vector<HPACKHeader> uniqueBlock(uint32_t i, bool withRepeated) {
+  vector<HPACKHeader> headers;
+  if (withRepeated) {
+    headers.emplace_back("x-a", string(29, 'a'));
+    headers.emplace_back("x-b", string(29, 'b'));
+  } else {
+    headers.emplace_back("x-v", folly::to<string>(i, string(20, 'v')));
+    headers.emplace_back("x-w", folly::to<string>(i, string(20, 'w')));
+  }
+  headers.emplace_back("x-u", folly::to<string>(i, string(20, 'u')));
+  return headers;
+}
+
+// Round trips blocks until the table gets resized, or for kAdaptWindow
+// blocks; returns the new capacity
+uint32_t encodeUntilResized(HPACKEncoder09& encoder, HPACKDecoder09& decoder,
+                            uint32_t& i, bool withRepeated) {
+  uint32_t capacity = encoder.getTable().capacity();
+  for (uint32_t n = 0; n < HPACKEncoder09::kAdaptWindow; n++) {
+    roundTrip(encoder, decoder, uniqueBlock(i++, withRepeated));
+    if (encoder.getTable().capacity() != capacity) {
+      break;
+    }
+  }
+  return encoder.getTable().capacity();
+}
+
+}
+
+TEST_F(HPACKContextTests, adaptive_table_size) {
+  HPACKEncoder09 encoder(true);
+  HPACKDecoder09 decoder;
+  encoder.setAdaptiveTableSize(256);
+  EXPECT_EQ(encoder.getTable().capacity(), 256);
+
+  // Two headers out of three are found in a table too small to keep them
+  uint32_t i = 0;
+  EXPECT_EQ(encodeUntilResized(encoder, decoder, i, true), 512);
+  EXPECT_EQ(encodeUntilResized(encoder, decoder, i, true), 1024);
+  EXPECT_EQ(encodeUntilResized(encoder, decoder, i, true), 2048);
+  EXPECT_EQ(encodeUntilResized(encoder, decoder, i, true), 4096);
+  // No more than the peer allows
+  EXPECT_EQ(encodeUntilResized(encoder, decoder, i, true), 4096);
+
+  // Nothing is found any more
+  EXPECT_EQ(encodeUntilResized(encoder, decoder, i, false), 2048);
+
+  encoder.setMemoryPressure(true);
+  EXPECT_EQ(encoder.getTable().capacity(), 256);
+  EXPECT_EQ(encodeUntilResized(encoder, decoder, i, true), 256);
+  encoder.setMemoryPressure(false);
+  EXPECT_EQ(encodeUntilResized(encoder, decoder, i, true), 512);
+}
+
+TEST_F(HPACKContextTests, shrink_then_grow) {
+  HPACKEncoder09 encoder(true);
+  HPACKDecoder09 decoder;
+  vector<HPACKHeader> headers;
+  headers.emplace_back("x-fb-random", "bla");
+  roundTrip(encoder, decoder, headers);
+  EXPECT_EQ(encoder.getTable().size(), 1);
+
+  // The decoder has to evict it too, even though both end up as large as
+  // they were
+  encoder.setHeaderTableSize(0);
+  encoder.setHeaderTableSize(HPACK::kTableSize);
+  headers.emplace_back("x-fb-other", "bla");
+  roundTrip(encoder, decoder, headers);
+  EXPECT_EQ(encoder.getTable().size(), 2);
+}
+
 INSTANTIATE_TEST_CASE_P(Context,
                         HPACKContextTests,
                         ::testing::Values(true, false));
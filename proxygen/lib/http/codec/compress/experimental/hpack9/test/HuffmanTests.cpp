@@ -129,6 +129,38 @@ TEST_F(HuffmanTests, non_printable_decode) {
   EXPECT_EQ((uint8_t) literal[1], 240);
 }
 
+/*
+ * round trip strings mixing short codes, which are decoded several at a time,
+ * with long ones that fall back to the tree, at every alignment
+ */
+TEST_F(HuffmanTests, mixed_round_trip) {
+  string alphabet("/e0:-.");
+  alphabet.push_back(1);
+  alphabet.push_back((char)240);
+  alphabet.push_back((char)254);
+  for (const HuffTree* tree : {&reqTree_}) {
+    for (uint32_t len = 0; len < 24; len++) {
+      for (uint32_t seed = 0; seed < alphabet.size(); seed++) {
+        string value;
+        for (uint32_t i = 0; i < len; i++) {
+          value.push_back(alphabet[(seed + i * i) % alphabet.size()]);
+        }
+        IOBufQueue bufQueue;
+        QueueAppender appender(&bufQueue, 512);
+        uint32_t size = tree->encode(value, appender);
+        EXPECT_EQ(size, tree->getEncodeSize(value));
+        auto buf = bufQueue.move();
+        string literal;
+        if (buf) {
+          buf->coalesce();
+          tree->decode(buf->data(), buf->length(), literal);
+        }
+        EXPECT_EQ(literal, value);
+      }
+    }
+  }
+}
+
 TEST_F(HuffmanTests, example_com) {
   // interesting case of one bit with value 0 in the last byte
   IOBufQueue bufQueue;
@@ -268,7 +300,7 @@ class TestingHuffTree : public HuffTree {
   explicit TestingHuffTree(const HuffTree& tree) : HuffTree(tree) {}
 
   const SuperHuffNode* getInternalTable() {
-    return table_;
+    return tables_->table;
   }
 
   static TestingHuffTree getHuffTree() {
@@ -278,9 +310,45 @@ class TestingHuffTree : public HuffTree {
 
 };
 
+/**
+ * checks the decode tables of a tree match the ones built at run time
+ * from its codes, as the static trees use tables generated at build time
+ */
+void expectTablesBuiltFromCodes(const HuffTree& tree) {
+  HuffTree built(tree.codesTable(), tree.bitsTable());
+  const HuffTables& expected = built.getTables();
+  const HuffTables& actual = tree.getTables();
+  for (uint32_t i = 0; i < kMaxSuperNodes; i++) {
+    for (uint32_t j = 0; j < 256; j++) {
+      const HuffNode& e = expected.table[i].index[j];
+      const HuffNode& a = actual.table[i].index[j];
+      EXPECT_EQ(e.data.ch, a.data.ch) << i << " " << j;
+      EXPECT_EQ(e.metadata.bits, a.metadata.bits) << i << " " << j;
+      EXPECT_EQ(e.metadata.isSuperNode, a.metadata.isSuperNode)
+        << i << " " << j;
+    }
+  }
+  for (uint32_t key = 0; key < (1 << kFastDecodeBits); key++) {
+    const HuffFastEntry& e = expected.fastTable[key];
+    const HuffFastEntry& a = actual.fastTable[key];
+    ASSERT_EQ(e.metadata.numSymbols, a.metadata.numSymbols) << key;
+    EXPECT_EQ(e.metadata.bits, a.metadata.bits) << key;
+    for (uint32_t n = 0; n < e.metadata.numSymbols; n++) {
+      EXPECT_EQ(e.symbols[n], a.symbols[n]) << key;
+    }
+  }
+}
+
 TEST_F(HuffmanTests, sanity_checks) {
   TestingHuffTree reqTree = TestingHuffTree::getHuffTree();
   const SuperHuffNode* allSnodesReq = reqTree.getInternalTable();
   uint32_t totalReqChars = treeDfs(allSnodesReq, 0, 0, 0, 0x3fffffff, 30);
   EXPECT_EQ(totalReqChars, 256);
 }
+
+TEST_F(HuffmanTests, generated_tables) {
+  expectTablesBuiltFromCodes(huffTree09());
+  // copies share the tables
+  TestingHuffTree tree = TestingHuffTree::getHuffTree();
+  EXPECT_EQ(&huffTree09().getTables(), &tree.getTables());
+}
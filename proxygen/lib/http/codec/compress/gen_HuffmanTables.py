@@ -0,0 +1,142 @@
+#!/bin/env python
+# @lint-avoid-python-3-compatibility-imports
+#
+# Generates the decode tables of the static Huffman trees (see
+# HuffTree in Huffman.h) from the code and bit length tables of the
+# sources given, so that they are read-only data of the library rather
+# than built at startup. Each pair of s_<name>CodesTable<suffix> and
+# s_<name>BitsTable<suffix> arrays gives k<Name>HuffTables<suffix>, such
+# as kReqHuffTables05 from s_reqCodesTable05 and s_reqBitsTable05.
+#
+# This builds the tables exactly as HuffTree::buildTree() would at run
+# time, which HuffmanTests checks.
+
+import optparse
+import re
+
+TABLE_SIZE = 256
+# must match Huffman.h
+MAX_SUPER_NODES = 46
+FAST_DECODE_BITS = 12
+MAX_FAST_DECODE_SYMBOLS = 3
+
+ARRAY_RE = re.compile(
+    r'const uint(?:32|8)_t s_(\w*?)([Cc]odes|[Bb]its)Table(\w*)\[kTableSize\]'
+    r'\s*=\s*\{(.*?)\};', re.S)
+
+
+def parse_tables(file_names):
+    tables = {}
+    for file_name in file_names:
+        with open(file_name, 'r') as inf:
+            source = inf.read()
+        for m in ARRAY_RE.finditer(source):
+            name = 'k%s%sHuffTables%s' % (
+                m.group(1)[:1].upper(), m.group(1)[1:], m.group(3))
+            values = [int(v, 0) for v in m.group(4).split(',') if v.strip()]
+            assert len(values) == TABLE_SIZE, name
+            tables.setdefault(name, {})[m.group(2).capitalize()] = values
+    return sorted(tables.items())
+
+
+def build_tree(codes, bits):
+    # (ch or super node index, bits, is super node) per slot
+    table = [[(0, 0, False)] * 256 for _ in range(MAX_SUPER_NODES)]
+    nodes = 0
+    for ch in range(TABLE_SIZE):
+        code = codes[ch]
+        nbits = bits[ch]
+        snode = 0
+        while nbits > 8:
+            mask = 0xFF << (nbits - 8)
+            x = (code & mask) >> (nbits - 8)
+            if not table[snode][x][2]:
+                nodes += 1
+                assert nodes < MAX_SUPER_NODES, 'too many super nodes'
+                table[snode][x] = (nodes, 0, True)
+            snode = table[snode][x][0]
+            nbits -= 8
+            code &= ~mask
+        shift = 8 - nbits
+        for key in range(code << shift, (code + 1) << shift):
+            table[snode][key] = (ch, nbits, False)
+    return table[:nodes + 1]
+
+
+def build_fast_table(codes, bits):
+    keys = 1 << FAST_DECODE_BITS
+    first_ch = [0] * keys
+    first_bits = [0] * keys
+    for ch in range(TABLE_SIZE):
+        b = bits[ch]
+        if b == 0 or b > FAST_DECODE_BITS:
+            continue
+        shift = FAST_DECODE_BITS - b
+        first = codes[ch] << shift
+        for key in range(first, first + (1 << shift)):
+            first_ch[key] = ch
+            first_bits[key] = b
+    fast = []
+    for key in range(keys):
+        used = 0
+        symbols = []
+        while len(symbols) < MAX_FAST_DECODE_SYMBOLS:
+            rest = (key << used) & (keys - 1)
+            b = first_bits[rest]
+            if b == 0 or used + b > FAST_DECODE_BITS:
+                break
+            symbols.append(first_ch[rest])
+            used += b
+        fast.append((symbols, used))
+    return fast
+
+
+def write_rows(outf, items, per_line):
+    for i in range(0, len(items), per_line):
+        outf.write('    ' + ', '.join(items[i:i + per_line]) + ',\n')
+
+
+def gen_source(tables, output_file):
+    with open(output_file, 'w') as outf:
+        outf.write('// Copyright 2004-present Facebook. '
+                   'All Rights Reserved.\n')
+        outf.write('// ** AUTOGENERATED FILE. DO NOT HAND-EDIT **\n\n')
+        outf.write('#include <proxygen/lib/http/codec/compress/Huffman.h>\n\n')
+        outf.write('namespace proxygen { namespace huffman {\n\n')
+        for name, arrays in tables:
+            codes = arrays['Codes']
+            bits = arrays['Bits']
+            outf.write('extern const HuffTables %s;\n' % name)
+            outf.write('const HuffTables %s = {\n  {\n' % name)
+            for snode in build_tree(codes, bits):
+                outf.write('  {{\n')
+                write_rows(outf, ['{{%d}, {%d, %s}}' % (
+                    v, b, 'true' if s else 'false') for v, b, s in snode], 6)
+                outf.write('  }},\n')
+            outf.write('  },\n  {\n')
+            write_rows(outf, ['{{%s}, {%d, %d}}' % (
+                ', '.join(str(c) for c in (symbols + [0, 0, 0])[:3]),
+                len(symbols), used)
+                for symbols, used in build_fast_table(codes, bits)], 4)
+            outf.write('  },\n};\n\n')
+        outf.write('}}\n')
+
+
+def main():
+    parser = optparse.OptionParser()
+    parser.add_option("--input_files", dest="input_files", type="string",
+                      default=None, help="Sources with the code tables")
+    parser.add_option("--output_file", dest="output_file", type="string",
+                      default=None, help="Path of the source to generate")
+    options, _ = parser.parse_args()
+
+    assert options.input_files is not None, "Missing arg: --input_files"
+    assert options.output_file is not None, "Missing arg: --output_file"
+
+    tables = parse_tables(options.input_files.split(","))
+    assert tables, "No code tables found"
+    gen_source(tables, options.output_file)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,270 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <folly/Memory.h>
+#include <folly/String.h>
+#include <folly/io/Cursor.h>
+#include <functional>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <map>
+#include <proxygen/lib/http/codec/compress/GzipHeaderCodec.h>
+#include <proxygen/lib/http/codec/compress/HPACKCodec.h>
+#include <proxygen/lib/http/codec/compress/experimental/hpack9/HPACKCodec.h>
+#include <proxygen/lib/http/codec/compress/test/HTTPArchive.h>
+#include <string>
+#include <vector>
+
+DEFINE_string(har, "", "Comma separated list of HAR files to replay");
+DEFINE_bool(public_har, false,
+            "The files are in the format of the public HPACK test cases "
+            "instead of HAR");
+DEFINE_int32(table_size, 4096, "HPACK header table size");
+DEFINE_int32(gzip_level, 9, "Compression level of the gzip header codec");
+DEFINE_int32(requests_per_connection, 0,
+             "Messages per simulated connection, 0 for one connection per "
+             "host with all of its messages");
+DEFINE_int32(iterations, 10, "Times each corpus is replayed for timing");
+
+/**
+ * Replays the header blocks of HAR files through the header codecs and
+ * reports, per codec and per direction, the compressed size, the encode and
+ * decode time per header, and how many headers the encoder found in its
+ * dynamic table.
+ *
+ * Messages are split into connections by host, as a browser would open
+ * them, and each connection gets its own encoder and decoder so the
+ * compression state is what one session would see.
+ */
+
+using namespace folly::io;
+using namespace folly;
+using namespace proxygen::compress;
+using namespace proxygen;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace {
+
+// Gives access to the dynamic table of the encoder of an HPACK codec
+template <class Codec>
+class TableCodec : public Codec {
+ public:
+  explicit TableCodec(TransportDirection direction) : Codec(direction) {
+    this->setEncoderHeaderTableSize(FLAGS_table_size);
+    this->setDecoderHeaderTableMaxSize(FLAGS_table_size);
+  }
+
+  const HeaderTable* getEncoderTable() const {
+    return &this->encoder_->getTable();
+  }
+};
+
+struct CodecSpec {
+  const char* name;
+  std::function<unique_ptr<HeaderCodec>(TransportDirection)> make;
+  // the dynamic table of the encoder, nullptr for codecs without one
+  std::function<const HeaderTable*(const HeaderCodec&)> getTable;
+};
+
+template <class Codec>
+CodecSpec hpackSpec(const char* name) {
+  return {
+    name,
+    [] (TransportDirection direction) -> unique_ptr<HeaderCodec> {
+      return folly::make_unique<TableCodec<Codec>>(direction);
+    },
+    [] (const HeaderCodec& codec) {
+      return static_cast<const TableCodec<Codec>&>(codec).getEncoderTable();
+    }
+  };
+}
+
+CodecSpec gzipSpec() {
+  return {
+    "gzip",
+    [] (TransportDirection) -> unique_ptr<HeaderCodec> {
+      return folly::make_unique<GzipHeaderCodec>(FLAGS_gzip_level);
+    },
+    [] (const HeaderCodec&) -> const HeaderTable* {
+      return nullptr;
+    }
+  };
+}
+
+typedef vector<const vector<HPACKHeader>*> Connection;
+
+struct Totals {
+  bool hasTable{false};
+  uint64_t messages{0};
+  uint64_t headers{0};
+  uint64_t uncompressed{0};
+  uint64_t compressed{0};
+  uint64_t tableHits{0};
+  uint64_t decodeErrors{0};
+  std::chrono::nanoseconds encodeTime{0};
+  std::chrono::nanoseconds decodeTime{0};
+};
+
+/**
+ * Groups messages[i] by the host of requests[i], cutting a connection every
+ * FLAGS_requests_per_connection messages if set
+ */
+vector<Connection> splitConnections(
+    const vector<vector<HPACKHeader>>& requests,
+    const vector<vector<HPACKHeader>>& messages) {
+  std::map<string, vector<Connection>> hosts;
+  for (size_t i = 0; i < messages.size(); i++) {
+    string host;
+    if (i < requests.size()) {
+      for (const auto& header: requests[i]) {
+        if (header.name == "host" || header.name == ":authority") {
+          host = header.value;
+          break;
+        }
+      }
+    }
+    auto& connections = hosts[host];
+    if (connections.empty() ||
+        (FLAGS_requests_per_connection > 0 &&
+         connections.back().size() >=
+         uint32_t(FLAGS_requests_per_connection))) {
+      connections.emplace_back();
+    }
+    connections.back().push_back(&messages[i]);
+  }
+  vector<Connection> result;
+  for (auto& host: hosts) {
+    for (auto& connection: host.second) {
+      result.push_back(std::move(connection));
+    }
+  }
+  return result;
+}
+
+void replay(const CodecSpec& spec, const vector<Connection>& connections,
+            TransportDirection direction, bool countSizes, Totals& totals) {
+  TransportDirection peer = (direction == TransportDirection::UPSTREAM) ?
+    TransportDirection::DOWNSTREAM : TransportDirection::UPSTREAM;
+  for (const auto& connection: connections) {
+    auto encoder = spec.make(direction);
+    auto decoder = spec.make(peer);
+    for (const auto* message: connection) {
+      vector<Header> headers;
+      headers.reserve(message->size());
+      for (const auto& header: *message) {
+        headers.emplace_back(header.name, header.value);
+      }
+      if (countSizes) {
+        const HeaderTable* table = spec.getTable(*encoder);
+        if (table) {
+          totals.hasTable = true;
+          for (const auto& header: *message) {
+            if (table->getIndex(header) != 0) {
+              totals.tableHits++;
+            }
+          }
+        }
+      }
+
+      auto start = std::chrono::steady_clock::now();
+      auto encoded = encoder->encode(headers);
+      auto encodeEnd = std::chrono::steady_clock::now();
+      uint32_t length = encoded ? encoded->computeChainDataLength() : 0;
+      Cursor cursor(encoded.get());
+      auto result = decoder->decode(cursor, length);
+      auto decodeEnd = std::chrono::steady_clock::now();
+      if (result.isError()) {
+        // gzip rejects some values HPACK takes, like empty ones
+        totals.decodeErrors++;
+      }
+
+      totals.encodeTime += encodeEnd - start;
+      totals.decodeTime += decodeEnd - encodeEnd;
+      if (countSizes) {
+        totals.messages++;
+        totals.headers += message->size();
+        totals.uncompressed += HTTPArchive::getSize(*message);
+        totals.compressed += length;
+      }
+    }
+  }
+}
+
+void report(const CodecSpec& spec, const char* direction,
+            const Totals& totals) {
+  if (totals.headers == 0) {
+    return;
+  }
+  double timedHeaders = double(totals.headers) * FLAGS_iterations;
+  printf("  %-8s %-9s %7llu msgs %10llu -> %9llu bytes (%5.1f%%) "
+         "%7.1f ns/hdr enc %7.1f ns/hdr dec",
+         spec.name, direction, (unsigned long long)totals.messages,
+         (unsigned long long)totals.uncompressed,
+         (unsigned long long)totals.compressed,
+         100.0 * totals.compressed / std::max<uint64_t>(totals.uncompressed, 1),
+         totals.encodeTime.count() / timedHeaders,
+         totals.decodeTime.count() / timedHeaders);
+  if (totals.hasTable) {
+    printf("  %5.1f%% table hits",
+           100.0 * totals.tableHits / totals.headers);
+  }
+  if (totals.decodeErrors) {
+    printf("  %llu decode errors",
+           (unsigned long long)totals.decodeErrors / FLAGS_iterations);
+  }
+  printf("\n");
+}
+
+}
+
+int main(int argc, char* argv[]) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  vector<string> files;
+  folly::split(',', FLAGS_har, files, true);
+  if (files.empty() || FLAGS_iterations <= 0) {
+    LOG(ERROR) << "Usage: " << argv[0] << " --har=file1.har,file2.har";
+    return 1;
+  }
+  const vector<CodecSpec> specs = {
+    hpackSpec<HPACKCodec>("hpack05"),
+    hpackSpec<HPACKCodec09>("hpack09"),
+    gzipSpec(),
+  };
+  for (const auto& file: files) {
+    auto har = FLAGS_public_har ? HTTPArchive::fromPublicFile(file) :
+      HTTPArchive::fromFile(file);
+    if (!har) {
+      return 1;
+    }
+    auto requests = splitConnections(har->requests, har->requests);
+    auto responses = splitConnections(har->requests, har->responses);
+    printf("%s: %zu requests and %zu responses over %zu connections\n",
+           file.c_str(), har->requests.size(), har->responses.size(),
+           requests.size());
+    for (const auto& spec: specs) {
+      Totals requestTotals;
+      Totals responseTotals;
+      for (int i = 0; i < FLAGS_iterations; i++) {
+        replay(spec, requests, TransportDirection::UPSTREAM, i == 0,
+               requestTotals);
+        replay(spec, responses, TransportDirection::DOWNSTREAM, i == 0,
+               responseTotals);
+      }
+      report(spec, "requests", requestTotals);
+      report(spec, "responses", responseTotals);
+    }
+  }
+  return 0;
+}
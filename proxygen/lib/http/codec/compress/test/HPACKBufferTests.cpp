@@ -113,6 +113,43 @@ TEST_F(HPACKBufferTests, encode_huffman_literal) {
   EXPECT_EQ(data_[10], 47);
 }
 
+/*
+ * the length prefix is reserved for the worst case encode size, here 2 bytes,
+ * and the literal moved back once it turns out to need 1
+ */
+TEST_F(HPACKBufferTests, encode_huffman_literal_backpatch) {
+  string literal(40, 'e');
+  HPACKEncodeBuffer encoder(512, huffman::reqHuffTree05(), true);
+  EXPECT_EQ(encoder.encodeLiteral(literal), 21);
+  EXPECT_EQ(encoder.encodeLiteral(literal), 21);
+  releaseData(encoder);
+  EXPECT_EQ(buf_->computeChainDataLength(), 42);
+  EXPECT_EQ(data_[0], 148); // 128(huffman bit) + 20(length)
+  resetDecoder();
+  for (int i = 0; i < 2; i++) {
+    string decoded;
+    EXPECT_EQ(decoder_.decodeLiteral(decoded), DecodeError::NONE);
+    EXPECT_EQ(decoded, literal);
+  }
+}
+
+TEST_F(HPACKBufferTests, encode_huffman_literal_plain_fallback) {
+  // 'Q' takes 9 bits, so huffman would make it longer
+  string literal(10, 'Q');
+  HPACKEncodeBuffer encoder(512, huffman::reqHuffTree05(), true);
+  EXPECT_EQ(encoder.encodeLiteral(literal), 11);
+  EXPECT_EQ(encoder.encodeHuffman(literal), 13);
+  releaseData(encoder);
+  EXPECT_EQ(data_[0], 10);
+  EXPECT_EQ(data_[11], 140); // 128(huffman bit) + 12(length)
+  resetDecoder();
+  for (int i = 0; i < 2; i++) {
+    string decoded;
+    EXPECT_EQ(decoder_.decodeLiteral(decoded), DecodeError::NONE);
+    EXPECT_EQ(decoded, literal);
+  }
+}
+
 TEST_F(HPACKBufferTests, decode_single_byte) {
   buf_ = IOBuf::create(512);
   uint8_t* wdata = buf_->writableData();
@@ -409,3 +446,31 @@ TEST_F(HPACKBufferTests, large_literal_error) {
   EXPECT_EQ(decoder_.decodeLiteral(decoded), DecodeError::LITERAL_TOO_LARGE);
   EXPECT_EQ(decoded.size(), 0);
 }
+
+/**
+ * literals over the limit of the decode buffer are rejected, huffman ones
+ * before they are decoded when their encoded size is too large already
+ */
+TEST_F(HPACKBufferTests, max_literal_size) {
+  string literal(100, 'e');
+  HPACKEncodeBuffer encoder(512, huffman::reqHuffTree05(), true);
+  for (bool huffman : {false, true}) {
+    encoder.encodeLiteral(literal, huffman);
+    releaseData(encoder);
+    uint32_t encodedSize = buf_->computeChainDataLength();
+    for (uint32_t maxLiteralSize : {100, 99, 10}) {
+      resetDecoder();
+      decoder_.setMaxLiteralSize(maxLiteralSize);
+      string decoded;
+      if (maxLiteralSize >= literal.size()) {
+        EXPECT_EQ(decoder_.decodeLiteral(decoded), DecodeError::NONE);
+        EXPECT_EQ(decoded, literal);
+        EXPECT_EQ(decoder_.consumedBytes(), encodedSize);
+      } else {
+        EXPECT_EQ(decoder_.decodeLiteral(decoded),
+                  DecodeError::LITERAL_TOO_LARGE);
+        EXPECT_EQ(decoded.size(), 0);
+      }
+    }
+  }
+}
@@ -8,13 +8,16 @@
  *
  */
 #include <folly/Conv.h>
+#include <folly/Memory.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 #include <memory>
 #include <proxygen/lib/http/codec/compress/HPACKContext.h>
 #include <proxygen/lib/http/codec/compress/HPACKDecoder.h>
 #include <proxygen/lib/http/codec/compress/HPACKEncoder.h>
+#include <proxygen/lib/http/codec/compress/HPACKIndexingPolicy.h>
 #include <proxygen/lib/http/codec/compress/Logging.h>
+#include <proxygen/lib/http/codec/compress/test/TestUtil.h>
 
 using namespace folly;
 using namespace proxygen;
@@ -73,6 +76,29 @@ TEST_F(HPACKContextTests, static_table) {
   CHECK_EQ(table[table.size()].name, "www-authenticate");
 }
 
+/*
+ * the lookups by header code find what the hash maps of the table do
+ */
+TEST_F(HPACKContextTests, static_table_code_lookup) {
+  auto& table = StaticHeaderTable::get();
+  const HeaderTable& base = table;
+  for (uint32_t i = 1; i <= table.size(); i++) {
+    const HPACKHeader& header = table[i];
+    EXPECT_EQ(table.getIndex(header), base.getIndex(header));
+    EXPECT_EQ(table.getIndex(header), i);
+    EXPECT_EQ(table.nameIndex(header.name), base.nameIndex(header.name));
+    HPACKHeader other(header.name, header.value + "x");
+    EXPECT_EQ(table.getIndex(other), 0);
+  }
+  EXPECT_EQ(table.nameIndex(HTTP_HEADER_COOKIE), table.nameIndex("cookie"));
+  EXPECT_EQ(table.getIndex(HTTP_HEADER_COLON_STATUS, "404"),
+            base.getIndex(HPACKHeader(":status", "404")));
+  // a common header that isn't in the table, and one that isn't common
+  EXPECT_EQ(table.nameIndex("x-forwarded-for"), 0);
+  EXPECT_EQ(table.nameIndex("x-not-common"), 0);
+  EXPECT_EQ(table.getIndex(HPACKHeader("x-not-common", "")), 0);
+}
+
 TEST_F(HPACKContextTests, static_index) {
   TestContext context(HPACK::MessageType::REQ, HPACK::kTableSize);
   HPACKHeader authority(":authority", "");
@@ -98,6 +124,95 @@ TEST_F(HPACKContextTests, encoder_multiple_values) {
   EXPECT_EQ(encoder.encode(req), nullptr);
 }
 
+/*
+ * values of a name that huffman keeps barely shrinking get sent plain, with
+ * huffman tried again after a while
+ */
+TEST_F(HPACKContextTests, encoder_huffman_skip) {
+  HPACKEncoder encoder(HPACK::MessageType::REQ, true);
+  HPACKDecoder decoder(HPACK::MessageType::REQ);
+  // 'B' takes 8 bits and the others 7, so 32 characters take 29 bytes
+  string chars("AFjkv&");
+  vector<uint64_t> lengths;
+  for (uint32_t i = 0; i < HPACKEncoder::kHuffmanMaxMisses +
+         HPACKEncoder::kHuffmanRetryInterval; i++) {
+    string value = "B" + string(29, 'A');
+    value.push_back(chars[i % chars.size()]);
+    value.push_back(chars[i / chars.size()]);
+    vector<HPACKHeader> req;
+    req.push_back(HPACKHeader("x-token", value));
+    auto encoded = hpack::encodeDecode(req, encoder, decoder);
+    lengths.push_back(encoded->computeChainDataLength());
+  }
+  // the first encode has the name as a literal, then 1 byte removes the
+  // previous value from the reference set and 1 indexes the name
+  uint32_t huffmanLength = 1 + 1 + 1 + 29;
+  uint32_t i = 1;
+  for (; i < HPACKEncoder::kHuffmanMaxMisses; i++) {
+    EXPECT_EQ(lengths[i], huffmanLength);
+  }
+  for (; i < HPACKEncoder::kHuffmanMaxMisses +
+         HPACKEncoder::kHuffmanRetryInterval - 1; i++) {
+    EXPECT_EQ(lengths[i], huffmanLength + 3);
+  }
+  EXPECT_EQ(lengths[i], huffmanLength);
+}
+
+TEST_F(HPACKContextTests, encoder_indexing_stats) {
+  // room for two of the headers below
+  HPACKEncoder encoder(HPACK::MessageType::REQ, false, 100);
+  for (auto value: {"a", "b", "c", "a", "c"}) {
+    vector<HPACKHeader> req;
+    req.push_back(HPACKHeader("x-header", string(value)));
+    encoder.encode(req);
+  }
+  const auto& stats = encoder.getIndexingStats();
+  EXPECT_EQ(stats.literals, 4);
+  EXPECT_EQ(stats.inserts, 4);
+  // "a" is evicted by "c", then "b" by "a" again
+  EXPECT_EQ(stats.evictions, 2);
+  EXPECT_EQ(stats.hits, 1);
+}
+
+TEST_F(HPACKContextTests, encoder_indexing_policy) {
+  HPACKEncoder encoder(HPACK::MessageType::REQ, false);
+  auto policy = folly::make_unique<ConfigurableIndexingPolicy>();
+  policy->addNeverIndex("x-request-id");
+  policy->setMaxEntryBytes(64);
+  encoder.setIndexingPolicy(std::move(policy));
+
+  vector<HPACKHeader> req;
+  req.push_back(HPACKHeader("x-request-id", "1234"));
+  req.push_back(HPACKHeader("x-large", string(30, 'a')));
+  req.push_back(HPACKHeader("x-small", string(20, 'a')));
+  encoder.encode(req);
+  EXPECT_EQ(encoder.getTable().size(), 1);
+  EXPECT_EQ(encoder.getTable()[1].name, "x-small");
+  EXPECT_EQ(encoder.getIndexingStats().literals, 3);
+  EXPECT_EQ(encoder.getIndexingStats().inserts, 1);
+}
+
+TEST_F(HPACKContextTests, encoder_indexing_admission) {
+  HPACKEncoder encoder(HPACK::MessageType::REQ, false);
+  auto policy = folly::make_unique<ConfigurableIndexingPolicy>();
+  policy->setAdmissionThreshold(2);
+  encoder.setIndexingPolicy(std::move(policy));
+
+  vector<HPACKHeader> req;
+  req.push_back(HPACKHeader("x-header", "value"));
+  // the first time it's only counted
+  encoder.encode(req);
+  EXPECT_EQ(encoder.getTable().size(), 0);
+  // and the second indexed
+  encoder.encode(req);
+  EXPECT_EQ(encoder.getTable().size(), 1);
+  encoder.encode(req);
+  const auto& stats = encoder.getIndexingStats();
+  EXPECT_EQ(stats.literals, 2);
+  EXPECT_EQ(stats.inserts, 1);
+  EXPECT_EQ(stats.hits, 1);
+}
+
 TEST_F(HPACKContextTests, decoder_large_header) {
   // with this size basically the table will not be able to store any entry
   uint32_t size = 32;
@@ -0,0 +1,58 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/Benchmark.h>
+#include <folly/Conv.h>
+#include <proxygen/lib/http/codec/compress/HeaderTable.h>
+#include <vector>
+
+using namespace folly;
+using namespace proxygen;
+using namespace std;
+
+namespace {
+
+/**
+ * Fill a table of the given size in bytes with headers sharing one name,
+ * which is the worst case for a per-name scan, then look up every entry
+ * the way HPACKEncoder::encodeHeader does for each header it encodes.
+ */
+void lookup(unsigned iters, size_t tableSize) {
+  vector<HPACKHeader> headers;
+  HeaderTable table(tableSize);
+  BENCHMARK_SUSPEND {
+    for (size_t i = 0; ; i++) {
+      HPACKHeader header("cookie", folly::to<string>("c_user=", i));
+      if (table.bytes() + header.bytes() > tableSize) {
+        break;
+      }
+      table.add(header);
+      headers.push_back(std::move(header));
+    }
+  }
+  uint32_t sum = 0;
+  for (unsigned i = 0; i < iters; ++i) {
+    const auto& header = headers[i % headers.size()];
+    sum += table.getIndex(header);
+    sum += table.nameIndex(header.name);
+  }
+  doNotOptimizeAway(sum);
+}
+
+}
+
+BENCHMARK_PARAM(lookup, 4096)
+BENCHMARK_PARAM(lookup, 16384)
+BENCHMARK_PARAM(lookup, 65536)
+BENCHMARK_PARAM(lookup, 262144)
+
+int main(int argc, char* argv[]) {
+  folly::runBenchmarks();
+  return 0;
+}
@@ -7,6 +7,7 @@
  *  of patent rights can be found in the PATENTS file in the same directory.
  *
  */
+#include <folly/Conv.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 #include <memory>
@@ -51,10 +52,8 @@ TEST_F(HeaderTableTests, add) {
   table.add(HPACKHeader("accept-encoding", "gzip"));
   table.add(HPACKHeader("accept-encoding", "gzip"));
   table.add(HPACKHeader("accept-encoding", "gzip"));
-  EXPECT_EQ(table.names().size(), 1);
   EXPECT_EQ(table.hasName("accept-encoding"), true);
-  auto it = table.names().find("accept-encoding");
-  EXPECT_EQ(it->second.size(), 3);
+  EXPECT_EQ(table.nameCount("accept-encoding"), 3);
   EXPECT_EQ(table.nameIndex("accept-encoding"), 1);
 }
 
@@ -73,15 +72,15 @@ TEST_F(HeaderTableTests, evict) {
   EXPECT_EQ(table.add(accept2), true);
   // evict the first one
   EXPECT_EQ(table[1], accept2);
-  auto ilist = table.names().find("accept-encoding")->second;
-  EXPECT_EQ(ilist.size(), max);
+  EXPECT_EQ(table.nameCount("accept-encoding"), max);
   // evict all the 'accept' headers
   for (size_t i = 0; i < max - 1; i++) {
     EXPECT_EQ(table.add(accept2), true);
   }
   EXPECT_EQ(table.size(), max);
   EXPECT_EQ(table[max], accept2);
-  EXPECT_EQ(table.names().size(), 1);
+  EXPECT_EQ(table.getIndex(accept), 0);
+  EXPECT_EQ(table.nameCount("accept-encoding"), max);
   // add an entry that will cause 2 evictions
   EXPECT_EQ(table.add(accept3), true);
   EXPECT_EQ(table[1], accept3);
@@ -93,7 +92,39 @@ TEST_F(HeaderTableTests, evict) {
   HPACKHeader bigheader("user-agent", bigvalue);
   EXPECT_EQ(table.add(bigheader), false);
   EXPECT_EQ(table.size(), 0);
-  EXPECT_EQ(table.names().size(), 0);
+  EXPECT_FALSE(table.hasName("accept-encoding"));
+  EXPECT_EQ(table.nameCount("accept-encoding"), 0);
+}
+
+TEST_F(HeaderTableTests, get_index) {
+  HPACKHeader gzip("accept-encoding", "gzip");
+  HPACKHeader deflate("accept-encoding", "deflate");
+  HPACKHeader cookie("cookie", "gzip");
+  uint32_t capacity = gzip.bytes() * 4;
+  HeaderTable table(capacity);
+  EXPECT_EQ(table.getIndex(gzip), 0);
+  table.add(gzip);
+  table.add(deflate);
+  table.add(cookie);
+  // same value under a different name must not match
+  EXPECT_EQ(table.getIndex(gzip), 3);
+  EXPECT_EQ(table.getIndex(deflate), 2);
+  EXPECT_EQ(table.getIndex(cookie), 1);
+  EXPECT_EQ(table.getIndex(HPACKHeader("accept-encoding", "br")), 0);
+  // the oldest copy is returned, and lookups follow evictions
+  table.add(gzip);
+  EXPECT_EQ(table.getIndex(gzip), 4);
+  table.add(deflate);
+  EXPECT_EQ(table.getIndex(gzip), 2);
+  EXPECT_EQ(table.getIndex(deflate), 4);
+  table.setCapacity(deflate.bytes());
+  EXPECT_EQ(table.size(), 1);
+  EXPECT_EQ(table.getIndex(gzip), 0);
+  EXPECT_EQ(table.getIndex(cookie), 0);
+  EXPECT_EQ(table.getIndex(deflate), 1);
+  table.setCapacity(0);
+  EXPECT_EQ(table.getIndex(deflate), 0);
+  EXPECT_EQ(table.nameIndex("accept-encoding"), 0);
 }
 
 TEST_F(HeaderTableTests, set_capacity) {
@@ -112,6 +143,106 @@ TEST_F(HeaderTableTests, set_capacity) {
   EXPECT_EQ(table.bytes(), capacity / 2);
 }
 
+TEST_F(HeaderTableTests, set_capacity_resizes) {
+  HPACKHeader accept("accept-encoding", "gzip");
+  HPACKHeader deflate("accept-encoding", "deflate");
+  HPACKHeader cookie("cookie", "gzip");
+  HeaderTable table(4096, false);
+  EXPECT_EQ(table.length(), 129);
+  // wrap the ring around, so the entries do not start at 0
+  for (uint32_t i = 0; i < 140; i++) {
+    table.add(HPACKHeader("x-filler", folly::to<std::string>(i)));
+  }
+  table.add(accept);
+  table.add(deflate);
+  table.add(cookie);
+
+  table.setCapacity(accept.bytes() + deflate.bytes() + cookie.bytes());
+  EXPECT_EQ(table.size(), 3);
+  EXPECT_LT(table.length(), 129);
+  EXPECT_EQ(table.getIndex(cookie), 1);
+  EXPECT_EQ(table.getIndex(deflate), 2);
+  EXPECT_EQ(table.getIndex(accept), 3);
+  EXPECT_EQ(table.nameIndex("accept-encoding"), 2);
+
+  // growing past the initial capacity keeps room for every entry
+  table.setCapacity(8192);
+  EXPECT_EQ(table.length(), 257);
+  for (uint32_t i = 0; i < 200; i++) {
+    EXPECT_TRUE(table.add(HPACKHeader("x", "")));
+  }
+  EXPECT_EQ(table.size(), 203);
+  EXPECT_EQ(table.getIndex(accept), 203);
+  EXPECT_EQ(table[203], accept);
+}
+
+TEST_F(HeaderTableTests, compact) {
+  // long values, so the strings don't fit in place
+  HPACKHeader big("x-big", std::string(200, 'a'));
+  HPACKHeader small("x-small", std::string(100, 'b'));
+  HeaderTable table(big.bytes() * 2, false);
+  // wrap the ring around, so the entries do not start at 0
+  for (uint32_t i = 0; i < table.length() + 2; i++) {
+    table.add(big);
+  }
+  table.add(small);
+  EXPECT_EQ(table.size(), 2);
+
+  table.compact();
+  EXPECT_EQ(table.size(), 2);
+  EXPECT_EQ(table[1], small);
+  EXPECT_EQ(table[2], big);
+  EXPECT_EQ(table.getIndex(small), 1);
+  EXPECT_EQ(table.getIndex(big), 2);
+  EXPECT_TRUE(table.add(big));
+  EXPECT_EQ(table[1], big);
+  EXPECT_EQ(table[2], small);
+}
+
+TEST_F(HeaderTableTests, colliding_index_slots) {
+  // A small table, to have the entries share index clusters, that is
+  // wrapped around many times
+  HeaderTable table(32 * 8, false);
+  std::vector<HPACKHeader> added;
+  for (uint32_t i = 0; i < 1000; i++) {
+    HPACKHeader header(folly::to<std::string>("x-", i % 7),
+                       folly::to<std::string>(i % 5));
+    table.add(header);
+    added.push_back(header);
+    // the entries still in the table are all found, at the index of their
+    // oldest copy
+    for (uint32_t j = 1; j <= table.size(); j++) {
+      const auto& entry = added[added.size() - j];
+      uint32_t oldest = j;
+      for (uint32_t k = j + 1; k <= table.size(); k++) {
+        if (added[added.size() - k] == entry) {
+          oldest = k;
+        }
+      }
+      EXPECT_EQ(table.getIndex(entry), oldest);
+      EXPECT_LE(table.nameIndex(entry.name), j);
+      EXPECT_NE(table.nameIndex(entry.name), 0);
+    }
+  }
+}
+
+TEST_F(HeaderTableTests, no_reference_set) {
+  HPACKHeader accept("accept-encoding", "gzip");
+  HPACKHeader deflate("accept-encoding", "deflate");
+  HeaderTable table(accept.bytes() + 2 * deflate.bytes() - 1, false);
+  EXPECT_FALSE(table.hasReferenceSet());
+  EXPECT_TRUE(table.add(accept));
+  EXPECT_TRUE(table.add(deflate));
+  EXPECT_FALSE(table.inReferenceSet(1));
+  // evicts accept
+  EXPECT_TRUE(table.add(deflate));
+  EXPECT_EQ(table.size(), 2);
+  EXPECT_EQ(table.getIndex(accept), 0);
+  EXPECT_TRUE(table.referenceSet().empty());
+  table.clearReferenceSet();
+  table.clearSkippedReferences();
+}
+
 TEST_F(HeaderTableTests, comparison) {
   uint32_t capacity = 128;
   HeaderTable t1(capacity);
@@ -0,0 +1,146 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/Benchmark.h>
+#include <folly/io/Cursor.h>
+#include <folly/io/IOBufQueue.h>
+#include <proxygen/lib/http/codec/compress/Huffman.h>
+#include <proxygen/lib/http/codec/compress/experimental/hpack9/Huffman.h>
+#include <string>
+#include <vector>
+
+using namespace folly::io;
+using namespace folly;
+using namespace proxygen::huffman;
+using namespace std;
+
+namespace {
+
+/**
+ * Decodes one character per tree lookup the way HuffTree did before the
+ * multi-symbol table, so the two can be compared on the same input
+ */
+class TreeOnlyHuffTree : public HuffTree {
+ public:
+  explicit TreeOnlyHuffTree(const HuffTree& tree) : HuffTree(tree) {}
+
+  void decodeTreeOnly(const uint8_t* buf, uint32_t size,
+                      string& literal) const {
+    const SuperHuffNode* snode = &tables_->table[0];
+    uint32_t w = 0;
+    uint32_t wbits = 0;
+    uint32_t i = 0;
+    while (i < size || wbits > 0) {
+      if (i < size && wbits < 8) {
+        w = (w << 8) | buf[i];
+        wbits += 8;
+        i++;
+      }
+      uint32_t key;
+      if (wbits >= 8) {
+        key = w >> (wbits - 8);
+      } else {
+        uint8_t xbits = 8 - wbits;
+        w = (w << xbits) | ((1 << xbits) - 1);
+        key = w;
+        wbits = 8;
+      }
+      const HuffNode& node = snode->index[key];
+      if (node.isLeaf()) {
+        literal.push_back(node.data.ch);
+        wbits -= node.metadata.bits;
+        snode = &tables_->table[0];
+      } else {
+        wbits -= 8;
+        snode = &tables_->table[node.data.superNodeIndex];
+      }
+      w = w & ((1 << wbits) - 1);
+    }
+  }
+};
+
+// typical request header values
+const vector<string> kValues = {
+  "www.facebook.com",
+  "/static/rsrc.php/v2/yB/r/2jEHFk3kMSJ.css",
+  "text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8",
+  "gzip, deflate, sdch",
+  "Mozilla/5.0 (Macintosh; Intel Mac OS X 10_10_2) AppleWebKit/537.36 "
+  "(KHTML, like Gecko) Chrome/41.0.2272.89 Safari/537.36",
+  "datr=1a2b3c4d5e6f7g8h9i0j; c_user=100000000000001; xs=42%3AabcDEF",
+  "max-age=0",
+};
+
+vector<string> encodeAll(const HuffTree& tree) {
+  vector<string> encoded;
+  for (const auto& value: kValues) {
+    IOBufQueue bufQueue;
+    QueueAppender appender(&bufQueue, 512);
+    tree.encode(value, appender);
+    auto buf = bufQueue.move();
+    buf->coalesce();
+    encoded.emplace_back((const char*)buf->data(), buf->length());
+  }
+  return encoded;
+}
+
+void treeDecode(const HuffTree& base, unsigned iters) {
+  vector<string> encoded;
+  TreeOnlyHuffTree tree(base);
+  BENCHMARK_SUSPEND {
+    encoded = encodeAll(base);
+  }
+  string literal;
+  for (unsigned i = 0; i < iters; ++i) {
+    for (const auto& value: encoded) {
+      literal.clear();
+      tree.decodeTreeOnly((const uint8_t*)value.data(), value.size(),
+                          literal);
+    }
+  }
+  doNotOptimizeAway(literal);
+}
+
+void tableDecode(const HuffTree& tree, unsigned iters) {
+  vector<string> encoded;
+  BENCHMARK_SUSPEND {
+    encoded = encodeAll(tree);
+  }
+  string literal;
+  for (unsigned i = 0; i < iters; ++i) {
+    for (const auto& value: encoded) {
+      literal.clear();
+      tree.decode((const uint8_t*)value.data(), value.size(), literal);
+    }
+  }
+  doNotOptimizeAway(literal);
+}
+
+}
+
+BENCHMARK(tree_decode_05, iters) {
+  treeDecode(reqHuffTree05(), iters);
+}
+
+BENCHMARK_RELATIVE(table_decode_05, iters) {
+  tableDecode(reqHuffTree05(), iters);
+}
+
+BENCHMARK(tree_decode_09, iters) {
+  treeDecode(huffTree09(), iters);
+}
+
+BENCHMARK_RELATIVE(table_decode_09, iters) {
+  tableDecode(huffTree09(), iters);
+}
+
+int main(int argc, char* argv[]) {
+  folly::runBenchmarks();
+  return 0;
+}
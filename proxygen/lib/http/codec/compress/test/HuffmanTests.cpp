@@ -14,6 +14,7 @@
 #include <proxygen/lib/http/codec/compress/Huffman.h>
 #include <proxygen/lib/http/codec/compress/Logging.h>
 #include <tuple>
+#include <vector>
 
 using namespace folly::io;
 using namespace folly;
@@ -141,6 +142,74 @@ TEST_F(HuffmanTests, non_printable_decode) {
   EXPECT_EQ((uint8_t) literal[1], 240);
 }
 
+/*
+ * round trip strings mixing short codes, which are decoded several at a time,
+ * with long ones that fall back to the tree, at every alignment
+ */
+TEST_F(HuffmanTests, mixed_round_trip) {
+  string alphabet("/e0:-.");
+  alphabet.push_back(1);
+  alphabet.push_back((char)240);
+  alphabet.push_back((char)254);
+  for (const HuffTree* tree : {&reqTree_, &respTree_}) {
+    for (uint32_t len = 0; len < 24; len++) {
+      for (uint32_t seed = 0; seed < alphabet.size(); seed++) {
+        string value;
+        for (uint32_t i = 0; i < len; i++) {
+          value.push_back(alphabet[(seed + i * i) % alphabet.size()]);
+        }
+        IOBufQueue bufQueue;
+        QueueAppender appender(&bufQueue, 512);
+        uint32_t size = tree->encode(value, appender);
+        EXPECT_EQ(size, tree->getEncodeSize(value));
+        auto buf = bufQueue.move();
+        string literal;
+        if (buf) {
+          buf->coalesce();
+          tree->decode(buf->data(), buf->length(), literal);
+        }
+        EXPECT_EQ(literal, value);
+      }
+    }
+  }
+}
+
+/*
+ * the flat buffer encode stays within getMaxEncodeSize() and matches the
+ * encode into a queue, which falls back to a scratch buffer when the tail
+ * of the queue is too short
+ */
+TEST_F(HuffmanTests, flat_encode) {
+  string alphabet("/e0:-.");
+  alphabet.push_back(1);
+  alphabet.push_back((char)254);
+  for (const HuffTree* tree : {&reqTree_, &respTree_}) {
+    for (uint32_t len = 0; len < 300; len += 7) {
+      string value;
+      for (uint32_t i = 0; i < len; i++) {
+        value.push_back(alphabet[(i * i) % alphabet.size()]);
+      }
+      uint32_t maxSize = HuffTree::getMaxEncodeSize(len);
+      vector<uint8_t> out(maxSize + 1, 0xab);
+      uint32_t size = tree->encode(value, out.data());
+      EXPECT_EQ(size, tree->getEncodeSize(value));
+      EXPECT_LE(size, maxSize);
+      EXPECT_EQ(out[maxSize], 0xab);
+
+      IOBufQueue bufQueue;
+      QueueAppender appender(&bufQueue, 16);
+      EXPECT_EQ(tree->encode(value, appender), size);
+      auto buf = bufQueue.move();
+      string encoded;
+      if (buf) {
+        buf->coalesce();
+        encoded.assign((const char*)buf->data(), buf->length());
+      }
+      EXPECT_EQ(encoded, string((const char*)out.data(), size));
+    }
+  }
+}
+
 TEST_F(HuffmanTests, example_com) {
   // interesting case of one bit with value 0 in the last byte
   IOBufQueue bufQueue;
@@ -282,7 +351,7 @@ class TestingHuffTree : public HuffTree {
   explicit TestingHuffTree(const HuffTree& tree) : HuffTree(tree) {}
 
   const SuperHuffNode* getInternalTable() {
-    return table_;
+    return tables_->table;
   }
 
   static TestingHuffTree getReqHuffTree() {
@@ -297,6 +366,35 @@ class TestingHuffTree : public HuffTree {
 
 };
 
+/**
+ * checks the decode tables of a tree match the ones built at run time
+ * from its codes, as the static trees use tables generated at build time
+ */
+void expectTablesBuiltFromCodes(const HuffTree& tree) {
+  HuffTree built(tree.codesTable(), tree.bitsTable());
+  const HuffTables& expected = built.getTables();
+  const HuffTables& actual = tree.getTables();
+  for (uint32_t i = 0; i < kMaxSuperNodes; i++) {
+    for (uint32_t j = 0; j < 256; j++) {
+      const HuffNode& e = expected.table[i].index[j];
+      const HuffNode& a = actual.table[i].index[j];
+      EXPECT_EQ(e.data.ch, a.data.ch) << i << " " << j;
+      EXPECT_EQ(e.metadata.bits, a.metadata.bits) << i << " " << j;
+      EXPECT_EQ(e.metadata.isSuperNode, a.metadata.isSuperNode)
+        << i << " " << j;
+    }
+  }
+  for (uint32_t key = 0; key < (1 << kFastDecodeBits); key++) {
+    const HuffFastEntry& e = expected.fastTable[key];
+    const HuffFastEntry& a = actual.fastTable[key];
+    ASSERT_EQ(e.metadata.numSymbols, a.metadata.numSymbols) << key;
+    EXPECT_EQ(e.metadata.bits, a.metadata.bits) << key;
+    for (uint32_t n = 0; n < e.metadata.numSymbols; n++) {
+      EXPECT_EQ(e.symbols[n], a.symbols[n]) << key;
+    }
+  }
+}
+
 TEST_F(HuffmanTests, sanity_checks) {
   TestingHuffTree reqTree = TestingHuffTree::getReqHuffTree();
   const SuperHuffNode* allSnodesReq = reqTree.getInternalTable();
@@ -308,3 +406,11 @@ TEST_F(HuffmanTests, sanity_checks) {
   uint32_t totalRespChars = treeDfs(allSnodesResp, 0, 0, 0, 0xffffdd, 24);
   EXPECT_EQ(totalRespChars, 256);
 }
+
+TEST_F(HuffmanTests, generated_tables) {
+  expectTablesBuiltFromCodes(reqHuffTree05());
+  expectTablesBuiltFromCodes(respHuffTree05());
+  // copies share the tables
+  TestingHuffTree reqTree = TestingHuffTree::getReqHuffTree();
+  EXPECT_EQ(&reqHuffTree05().getTables(), &reqTree.getTables());
+}
@@ -9,8 +9,11 @@
  */
 #include <proxygen/lib/http/codec/experimental/HTTP2Codec.h>
 #include <proxygen/lib/http/codec/experimental/HTTP2Constants.h>
+#include <proxygen/lib/http/HeaderTemplate.h>
+#include <proxygen/lib/http/HeaderValueCache.h>
+#include <proxygen/lib/http/codec/HTTPChecks.h>
 #include <proxygen/lib/http/codec/SPDYUtil.h>
-#include <proxygen/lib/utils/ChromeUtils.h>
+#include <proxygen/lib/utils/AllocStats.h>
 #include <proxygen/lib/utils/Logging.h>
 
 #include <folly/Conv.h>
@@ -148,7 +151,8 @@ size_t HTTP2Codec::onIngress(const folly::IOBuf& buf) {
           if (callback_) {
             callback_->onFrameHeader(curHeader_.stream,
                                      curHeader_.flags,
-                                     curHeader_.length);
+                                     curHeader_.length,
+                                     uint8_t(curHeader_.type));
           }
         }
 #ifndef NDEBUG
@@ -157,13 +161,24 @@ size_t HTTP2Codec::onIngress(const folly::IOBuf& buf) {
       } else {
         break;
       }
-    } else {
+    } else if (frameState_ == FrameState::FRAME_DATA) {
       // Already parsed the common frame header
       const auto frameLen = curHeader_.length;
       if (bufLen >= frameLen) {
         connError = parseFrame(cursor);
         parsed += curHeader_.length;
         frameState_ = FrameState::FRAME_HEADER;
+      } else if (curHeader_.type == http2::FrameType::DATA && bufLen > 0) {
+        // Rather than buffering up a whole DATA frame, hand the body over
+        // as it arrives
+        connError = parseDataFrameBegin(cursor, bufLen, parsed);
+      } else {
+        break;
+      }
+    } else {
+      // In the middle of a DATA frame
+      if (bufLen > 0) {
+        connError = parseDataFrameData(cursor, bufLen, parsed);
       } else {
         break;
       }
@@ -173,7 +188,7 @@ size_t HTTP2Codec::onIngress(const folly::IOBuf& buf) {
   return parsed;
 }
 
-ErrorCode HTTP2Codec::parseFrame(folly::io::Cursor& cursor) {
+ErrorCode HTTP2Codec::checkFrameStart() {
   if (expectedContinuationStream_ != 0 &&
        (curHeader_.type != http2::FrameType::CONTINUATION ||
         expectedContinuationStream_ != curHeader_.stream)) {
@@ -212,7 +227,27 @@ ErrorCode HTTP2Codec::parseFrame(folly::io::Cursor& cursor) {
   if (callback_) {
     callback_->onFrameHeader(curHeader_.stream,
                              curHeader_.flags,
-                             curHeader_.length);
+                             curHeader_.length,
+                             uint8_t(curHeader_.type));
+  }
+  return ErrorCode::NO_ERROR;
+}
+
+ErrorCode HTTP2Codec::parseFrame(folly::io::Cursor& cursor) {
+  auto startErr = checkFrameStart();
+  RETURN_IF_ERROR(startErr);
+
+  if (((curHeader_.type == http2::FrameType::WINDOW_UPDATE &&
+        curHeader_.length == http2::kFrameWindowUpdateSize) ||
+       (curHeader_.type == http2::FrameType::RST_STREAM &&
+        curHeader_.length == http2::kFrameRstStreamSize)) &&
+      resetStreams_.contains(curHeader_.stream)) {
+    // The stream is closed, there is nothing left to update or reset. The
+    // late DATA still goes on, for connection flow control to count it
+    VLOG(4) << "Dropping " << getFrameTypeString(curHeader_.type)
+            << " for reset stream=" << curHeader_.stream;
+    cursor.skip(curHeader_.length);
+    return ErrorCode::NO_ERROR;
   }
 
   ErrorCode err = ErrorCode::NO_ERROR;
@@ -227,8 +262,7 @@ ErrorCode HTTP2Codec::parseFrame(folly::io::Cursor& cursor) {
     case http2::FrameType::GOAWAY: err = parseGoaway(cursor); break;
     case http2::FrameType::WINDOW_UPDATE: err = parseWindowUpdate(cursor);break;
     case http2::FrameType::CONTINUATION: err = parseContinuation(cursor); break;
-    case http2::FrameType::ALTSVC:
-      // fall through, unimplemented
+    case http2::FrameType::ALTSVC: err = parseAltSvc(cursor); break;
     default:
       // Implementations MUST ignore and discard any frame that has a
       // type that is unknown
@@ -272,6 +306,61 @@ ErrorCode HTTP2Codec::parseData(Cursor& cursor) {
   return handleEndStream();
 }
 
+ErrorCode HTTP2Codec::parseDataFrameBegin(Cursor& cursor,
+                                          size_t bufLen,
+                                          size_t& parsed) {
+  auto startErr = checkFrameStart();
+  RETURN_IF_ERROR(startErr);
+
+  VLOG(10) << "parsing partial DATA frame for stream=" << curHeader_.stream
+           << " length=" << curHeader_.length << " available=" << bufLen;
+  auto startLen = cursor.totalLength();
+  auto ret = http2::parseDataBegin(cursor, curHeader_, pendingDataFrameBytes_,
+                                   pendingDataFramePaddingBytes_);
+  RETURN_IF_ERROR(ret);
+  auto headerLen = startLen - cursor.totalLength();
+  parsed += headerLen;
+  // The flow-controlled padding includes the length byte, if present
+  pendingDataFramePadding_ = pendingDataFramePaddingBytes_ + headerLen;
+  frameState_ = FrameState::DATA_FRAME_DATA;
+  return parseDataFrameData(cursor, bufLen - headerLen, parsed);
+}
+
+ErrorCode HTTP2Codec::parseDataFrameData(Cursor& cursor,
+                                         size_t bufLen,
+                                         size_t& parsed) {
+  // The padding is reported along with the first piece of the body, or
+  // an empty body if there is none
+  if ((pendingDataFrameBytes_ > 0 && bufLen > 0) ||
+      (pendingDataFrameBytes_ == 0 && pendingDataFramePadding_ > 0)) {
+    auto dataLen = std::min<size_t>(bufLen, pendingDataFrameBytes_);
+    std::unique_ptr<IOBuf> outData;
+    countIOBufClones();
+    cursor.clone(outData, dataLen);
+    parsed += dataLen;
+    bufLen -= dataLen;
+    pendingDataFrameBytes_ -= dataLen;
+    auto padding = pendingDataFramePadding_;
+    pendingDataFramePadding_ = 0;
+    if (callback_) {
+      callback_->onBody(StreamID(curHeader_.stream), std::move(outData),
+                        padding);
+    }
+  }
+  if (pendingDataFrameBytes_ == 0 && pendingDataFramePaddingBytes_ > 0) {
+    uint8_t toSkip = std::min<size_t>(bufLen, pendingDataFramePaddingBytes_);
+    auto ret = http2::parseDataEnd(cursor, toSkip);
+    RETURN_IF_ERROR(ret);
+    parsed += toSkip;
+    pendingDataFramePaddingBytes_ -= toSkip;
+  }
+  if (pendingDataFrameBytes_ > 0 || pendingDataFramePaddingBytes_ > 0) {
+    return ErrorCode::NO_ERROR;
+  }
+  frameState_ = FrameState::FRAME_HEADER;
+  return handleEndStream();
+}
+
 ErrorCode HTTP2Codec::parseHeaders(Cursor& cursor) {
   boost::optional<http2::PriorityUpdate> priority;
   std::unique_ptr<IOBuf> headerBuf;
@@ -318,6 +407,11 @@ ErrorCode HTTP2Codec::parseHeadersImpl(
     bool isRequest = (transportDirection_ == TransportDirection::DOWNSTREAM ||
                       promisedStream);
     msg = folly::make_unique<HTTPMessage>();
+    if (headerArenaBlockSize_) {
+      msg->getHeaders().useArena(headerArenaBlockSize_);
+    }
+    // the blocks of a connection tend to hold as many headers as the last
+    msg->getHeaders().reserve(headerCountHint_);
     decodeInfo_.init(msg.get(), isRequest);
     headerCodec_.decodeStreaming(headerCursor,
                                  curHeaderBlock_.chainLength(),
@@ -357,7 +451,7 @@ ErrorCode HTTP2Codec::parseHeadersImpl(
     if (curHeader_.type == http2::FrameType::HEADERS) {
       if (curHeader_.flags & http2::PRIORITY) {
         DCHECK(priority);
-        // callback_->onPriority(priority.get());
+        callback_->onPriority(curHeader_.stream, priority.get());
       }
 
       // callback checks total number of streams is smaller than settings max
@@ -367,7 +461,10 @@ ErrorCode HTTP2Codec::parseHeadersImpl(
       callback_->onPushMessageBegin(*promisedStream, curHeader_.stream,
                                     msg.get());
     }
-    if (curHeader_.flags & http2::END_HEADERS && msg) {
+    if (curHeader_.flags & http2::END_HEADERS && msg &&
+        (!httpChecks_ ||
+         HTTPChecksBase::checkIngressHeaders(callback_, curHeader_.stream,
+                                             *msg))) {
       callback_->onHeadersComplete(curHeader_.stream, std::move(msg));
     }
     return handleEndStream();
@@ -375,15 +472,14 @@ ErrorCode HTTP2Codec::parseHeadersImpl(
   return ErrorCode::NO_ERROR;
 }
 
-void HTTP2Codec::onHeader(const std::string& name,
-                          const std::string& value) {
+void HTTP2Codec::onHeader(HTTPHeaderCode code,
+                          folly::StringPiece nameSp,
+                          folly::StringPiece valueSp) {
   // Refuse decoding other headers if an error is already found
   if (decodeInfo_.decodeError != HeaderDecodeError::NONE
       || decodeInfo_.parsingError != "") {
     return;
   }
-  folly::StringPiece nameSp(name);
-  folly::StringPiece valueSp(value);
 
   HTTPRequestVerifier& verifier = decodeInfo_.verifier;
   if (nameSp.startsWith(':')) {
@@ -392,44 +488,45 @@ void HTTP2Codec::onHeader(const std::string& name,
         folly::to<string>("Illegal pseudo header name=", nameSp);
       return;
     }
+    // The codes are case insensitive, pseudo header names are not
+    if (!SPDYUtil::validateHeaderName(nameSp.subpiece(1))) {
+      code = HTTP_HEADER_OTHER;
+    }
     if (decodeInfo_.isRequest) {
-      if (nameSp == http2::kMethod) {
-        if (!verifier.setMethod(valueSp)) {
-          return;
-        }
-      } else if (nameSp == http2::kScheme) {
-        if (!verifier.setScheme(valueSp)) {
-          return;
-        }
-      } else if (nameSp == http2::kAuthority) {
-        if (!verifier.setAuthority(valueSp)) {
-          return;
-        }
-      } else if (nameSp == http2::kPath) {
-        if (!verifier.setPath(valueSp)) {
-          return;
-        }
-      } else {
-        decodeInfo_.parsingError =
-          folly::to<string>("Invalid header name=", nameSp);
-        return;
+      // the verifier records the errors of the set* methods
+      switch (code) {
+        case HTTP_HEADER_COLON_METHOD:
+          verifier.setMethod(valueSp);
+          break;
+        case HTTP_HEADER_COLON_SCHEME:
+          verifier.setScheme(valueSp);
+          break;
+        case HTTP_HEADER_COLON_AUTHORITY:
+          verifier.setAuthority(valueSp);
+          break;
+        case HTTP_HEADER_COLON_PATH:
+          verifier.setPath(valueSp);
+          break;
+        default:
+          decodeInfo_.parsingError =
+            folly::to<string>("Invalid header name=", nameSp);
+          break;
       }
     } else {
-      if (nameSp == http2::kStatus) {
+      if (code == HTTP_HEADER_COLON_STATUS) {
         if (decodeInfo_.hasStatus) {
           decodeInfo_.parsingError = string("Duplicate status");
           return;
         }
         decodeInfo_.hasStatus = true;
-        int32_t code = -1;
+        int32_t statusCode = -1;
         try {
-          code = folly::to<unsigned int>(valueSp);
+          statusCode = folly::to<unsigned int>(valueSp);
         } catch (const std::range_error& ex) {
         }
-        if (code >= 100 && code <= 999) {
-          decodeInfo_.msg->setStatusCode(code);
-          decodeInfo_.msg->setStatusMessage(
-              HTTPMessage::getDefaultReason(code));
+        if (statusCode >= 100 && statusCode <= 999) {
+          decodeInfo_.msg->setStatusCode(statusCode);
+          decodeInfo_.msg->setDefaultStatusMessage();
         } else {
           decodeInfo_.parsingError =
             folly::to<string>("Malformed status code=", valueSp);
@@ -443,7 +540,7 @@ void HTTP2Codec::onHeader(const std::string& name,
     }
   } else {
     decodeInfo_.regularHeaderSeen = true;
-    if (nameSp == "connection") {
+    if (code == HTTP_HEADER_CONNECTION) {
       decodeInfo_.parsingError =
         string("HTTP/2 Message with Connection header");
       return;
@@ -455,22 +552,26 @@ void HTTP2Codec::onHeader(const std::string& name,
           nameSp, " value=", valueSp);
       return;
     }
-    if (!needsChromeWorkaround_ && nameSp == "user-agent") {
-      int8_t version = getChromeVersion(valueSp);
+    if (!needsChromeWorkaround_ && code == HTTP_HEADER_USER_AGENT) {
+      // Clients repeat their agents, each is parsed once per thread
+      int8_t version =
+        HeaderValueCache::get(code, valueSp)->getChromeVersion();
       // Versions of Chrome under 43 need this workaround
       if (version > 0 && version < 43) {
           needsChromeWorkaround_ = true;
           VLOG(4) << "Using chrome http/2 continuation workaround";
       }
     }
-    // Add the (name, value) pair to headers
-    decodeInfo_.msg->getHeaders().add(nameSp, valueSp);
+    // Add the (name, value) pair to headers, without looking the name up
+    // again since the decoder already knows its code
+    decodeInfo_.msg->getHeaders().addFromCodec(code, nameSp, valueSp);
   }
 }
 
 void HTTP2Codec::onHeadersComplete() {
   HTTPHeaders& headers = decodeInfo_.msg->getHeaders();
   HTTPRequestVerifier& verifier = decodeInfo_.verifier;
+  headerCountHint_ = headers.size();
 
   if (decodeInfo_.isRequest) {
     auto combinedCookie = headers.combine(HTTP_HEADER_COOKIE, "; ");
@@ -496,11 +597,15 @@ void HTTP2Codec::onDecodeError(HeaderDecodeError decodeError) {
 }
 
 ErrorCode HTTP2Codec::parsePriority(Cursor& cursor) {
-  // will implement callbacks in subsequent diff
   VLOG(4) << "parsing PRIORITY frame for stream=" << curHeader_.stream <<
     " length=" << curHeader_.length;
   http2::PriorityUpdate pri;
-  return http2::parsePriority(cursor, curHeader_, pri);
+  auto err = http2::parsePriority(cursor, curHeader_, pri);
+  RETURN_IF_ERROR(err);
+  if (callback_) {
+    callback_->onPriority(curHeader_.stream, pri);
+  }
+  return err;
 }
 
 ErrorCode HTTP2Codec::parseRstStream(Cursor& cursor) {
@@ -510,6 +615,7 @@ ErrorCode HTTP2Codec::parseRstStream(Cursor& cursor) {
   ErrorCode statusCode = ErrorCode::NO_ERROR;
   auto err = http2::parseRstStream(cursor, curHeader_, statusCode);
   RETURN_IF_ERROR(err);
+  resetStreams_.add(curHeader_.stream);
   if (callback_) {
     callback_->onAbort(curHeader_.stream, statusCode);
   }
@@ -651,6 +757,23 @@ ErrorCode HTTP2Codec::parseGoaway(Cursor& cursor) {
   return ErrorCode::NO_ERROR;
 }
 
+ErrorCode HTTP2Codec::parseAltSvc(Cursor& cursor) {
+  VLOG(4) << "parsing ALTSVC frame for stream=" << curHeader_.stream <<
+    " length=" << curHeader_.length;
+  uint32_t maxAge = 0;
+  uint32_t port = 0;
+  AltSvc altSvc;
+  auto err = http2::parseAltSvc(cursor, curHeader_, maxAge, port,
+                                altSvc.protocol, altSvc.host, altSvc.origin);
+  RETURN_IF_ERROR(err);
+  altSvc.maxAge = maxAge;
+  altSvc.port = port;
+  if (callback_) {
+    callback_->onAltSvc(curHeader_.stream, altSvc);
+  }
+  return ErrorCode::NO_ERROR;
+}
+
 ErrorCode HTTP2Codec::parseWindowUpdate(Cursor& cursor) {
   VLOG(4) << "parsing WINDOW_UPDATE frame for stream=" << curHeader_.stream <<
     " length=" << curHeader_.length;
@@ -730,6 +853,9 @@ void HTTP2Codec::generateHeader(folly::IOBufQueue& writeBuf,
                                 HTTPHeaderSize* size) {
   VLOG(4) << "generating " << ((assocStream != 0) ? "PUSH_PROMISE" : "HEADERS")
           << " for stream=" << stream;
+  if (httpChecks_) {
+    HTTPChecksBase::checkEgressHeaders(msg);
+  }
   std::vector<Header> allHeaders;
 
   // The role of this local status string is to hold the generated
@@ -779,6 +905,12 @@ void HTTP2Codec::generateHeader(folly::IOBufQueue& writeBuf,
         allHeaders.emplace_back(code, name, value);
       }
     });
+  if (auto headerTemplate = msg.getHeaderTemplate()) {
+    // Already classified, and free of per-hop headers
+    allHeaders.insert(allHeaders.end(),
+                      headerTemplate->getHeaders().begin(),
+                      headerTemplate->getHeaders().end());
+  }
 
   headerCodec_.setEncodeHeadroom(http2::kFrameHeaderSize +
                                  http2::kFrameHeadersBaseMaxSize);
@@ -842,12 +974,23 @@ size_t HTTP2Codec::generateBody(folly::IOBufQueue& writeBuf,
                                 boost::optional<uint8_t> padding,
                                 bool eom) {
   // todo: generate random padding for everything?
-  size_t written = 0;
+  // The padding counts against the peer's max frame size
+  uint32_t maxPayload = maxSendFrameSize();
+  if (padding) {
+    DCHECK_LT(padding.get() + 1, maxPayload);
+    maxPayload -= padding.get() + 1;
+  }
 
+  if (!chain || chain->computeChainDataLength() <= maxPayload) {
+    return http2::writeData(writeBuf, std::move(chain), stream, padding, eom);
+  }
+
+  // Split into frames by reference, without copying
+  size_t written = 0;
   IOBufQueue queue(IOBufQueue::cacheChainLength());
   queue.append(std::move(chain));
-  while (queue.chainLength() > maxSendFrameSize()) {
-    auto chunk = queue.split(maxSendFrameSize());
+  while (queue.chainLength() > maxPayload) {
+    auto chunk = queue.split(maxPayload);
     written += http2::writeData(writeBuf, std::move(chunk), stream,
                                 padding, false);
   }
@@ -886,6 +1029,7 @@ size_t HTTP2Codec::generateRstStream(folly::IOBufQueue& writeBuf,
                                      ErrorCode statusCode) {
   VLOG(4) << "sending RST_STREAM for stream=" << stream
           << " with code=" << getErrorCodeString(statusCode);
+  resetStreams_.add(stream);
   return http2::writeRstStream(writeBuf, stream, statusCode);
 }
 
@@ -11,6 +11,7 @@
 
 #include <proxygen/lib/http/codec/experimental/HTTPRequestVerifier.h>
 #include <proxygen/lib/http/codec/experimental/HTTP2Framer.h>
+#include <proxygen/lib/http/codec/experimental/StreamIDBitmap.h>
 #include <proxygen/lib/http/codec/HTTPCodec.h>
 #include <proxygen/lib/http/codec/HTTPSettings.h>
 #include <proxygen/lib/utils/Result.h>
@@ -27,8 +28,9 @@ namespace proxygen {
  */
 class HTTP2Codec: public HTTPCodec, HeaderCodec::StreamingCallback {
 public:
-  void onHeader(const std::string& name,
-                const std::string& value) override;
+  void onHeader(HTTPHeaderCode code,
+                folly::StringPiece name,
+                folly::StringPiece value) override;
   void onHeadersComplete() override;
   void onDecodeError(HeaderDecodeError decodeError) override;
 
@@ -54,7 +56,11 @@ public:
   bool isWaitingToDrain() const override;
   bool closeOnEgressComplete() const override { return false; }
   bool supportsParallelRequests() const override { return true; }
-  bool supportsPushTransactions() const override { return true; }
+  bool supportsPushTransactions() const override {
+    // Clients take pushes until their SETTINGS say otherwise
+    return transportDirection_ == TransportDirection::UPSTREAM ||
+      ingressSettings_.getSetting(SettingsId::ENABLE_PUSH, 1) != 0;
+  }
   size_t generateConnectionPreface(folly::IOBufQueue& writeBuf) override;
   void generateHeader(folly::IOBufQueue& writeBuf,
                       StreamID stream,
@@ -95,6 +101,10 @@ public:
     return &ingressSettings_;
   }
   HTTPSettings* getEgressSettings() override { return &egressSettings_; }
+  bool enableHTTPChecks() override {
+    httpChecks_ = true;
+    return true;
+  }
 
   //HTTP2Codec specific API
 
@@ -108,6 +118,45 @@ public:
     kHeaderSplitSize = splitSize;
   }
 
+  /**
+   * Reuse the encoding of repeated header blocks that are fully indexed,
+   * such as the same response headers sent on every stream. Off (0) by
+   * default.
+   */
+  void setHeaderEncodeCacheSize(uint32_t entries) {
+    headerCodec_.setEncodeCacheSize(entries);
+  }
+
+  size_t getHeaderCompressionStateSize() const override {
+    return headerCodec_.getCompressionStateSize();
+  }
+
+  void setHeaderCompressionMemoryPressure(bool pressure) override {
+    headerCodec_.setEncoderMemoryPressure(pressure);
+  }
+
+  void releaseIdleMemory() override {
+    headerCodec_.releaseIdleMemory();
+  }
+
+  /**
+   * Keep the HPACK header table of the encoder only as large as it is
+   * useful, down to minSize, rather than as large as the peer allows.
+   * Off (0) by default. See HPACKEncoder09::setAdaptiveTableSize().
+   */
+  void setAdaptiveHeaderTableSize(uint32_t minSize) {
+    headerCodec_.setEncoderAdaptiveTableSize(minSize);
+  }
+
+  /**
+   * Decode the headers of incoming streams into an arena of blockSize
+   * byte blocks rather than into strings of their own; see
+   * HTTPHeaders::useArena(). Off (0) by default.
+   */
+  void setHeaderArena(size_t blockSize) {
+    headerArenaBlockSize_ = blockSize;
+  }
+
  private:
   class HeaderDecodeInfo {
    public:
@@ -147,8 +196,15 @@ public:
 
   static void initPerHopHeaders() __attribute__ ((__constructor__));
 
+  ErrorCode checkFrameStart();
   ErrorCode parseFrame(folly::io::Cursor& cursor);
   ErrorCode parseData(folly::io::Cursor& cursor);
+  ErrorCode parseDataFrameBegin(folly::io::Cursor& cursor,
+                                size_t bufLen,
+                                size_t& parsed);
+  ErrorCode parseDataFrameData(folly::io::Cursor& cursor,
+                               size_t bufLen,
+                               size_t& parsed);
   ErrorCode parseHeaders(folly::io::Cursor& cursor);
   ErrorCode parsePriority(folly::io::Cursor& cursor);
   ErrorCode parseRstStream(folly::io::Cursor& cursor);
@@ -158,6 +214,7 @@ public:
   ErrorCode parseGoaway(folly::io::Cursor& cursor);
   ErrorCode parseContinuation(folly::io::Cursor& cursor);
   ErrorCode parseWindowUpdate(folly::io::Cursor& cursor);
+  ErrorCode parseAltSvc(folly::io::Cursor& cursor);
   ErrorCode parseHeadersImpl(
     folly::io::Cursor& cursor,
     std::unique_ptr<folly::IOBuf> headerBuf,
@@ -186,7 +243,12 @@ public:
   StreamID expectedContinuationStream_{0};
   bool pendingEndStreamHandling_{false};
   bool needsChromeWorkaround_{false};
+  bool httpChecks_{false};
   folly::IOBufQueue curHeaderBlock_{folly::IOBufQueue::cacheChainLength()};
+  // State of a DATA frame whose payload is delivered as it arrives
+  uint32_t pendingDataFrameBytes_{0};
+  uint16_t pendingDataFramePadding_{0};
+  uint8_t pendingDataFramePaddingBytes_{0};
   HTTPSettings ingressSettings_{
     { SettingsId::HEADER_TABLE_SIZE, 4096 },
     { SettingsId::ENABLE_PUSH, 1 },
@@ -199,6 +261,8 @@ public:
     { SettingsId::MAX_HEADER_LIST_SIZE, 1 << 17 }, // same as SPDYCodec
   };
   StreamID lastStreamID_{0};
+  // The streams either side reset recently, whose late frames are dropped
+  StreamIDBitmap resetStreams_;
   uint32_t ingressGoawayAck_{std::numeric_limits<uint32_t>::max()};
 #ifndef NDEBUG
   uint32_t egressGoawayAck_{std::numeric_limits<uint32_t>::max()};
@@ -209,8 +273,9 @@ public:
     DOWNSTREAM_CONNECTION_PREFACE = 1,
     FRAME_HEADER = 2,
     FRAME_DATA = 3,
+    DATA_FRAME_DATA = 4,
   };
-  FrameState frameState_:2;
+  FrameState frameState_:3;
   enum ClosingState {
     OPEN = 0,
     FIRST_GOAWAY_SENT = 1,
@@ -220,6 +285,9 @@ public:
 
   static uint32_t kHeaderSplitSize;
   HeaderDecodeInfo decodeInfo_;
+  // headers in the last decoded block, reserved up front for the next one
+  size_t headerCountHint_{0};
+  size_t headerArenaBlockSize_{0};
 };
 
 } // proxygen
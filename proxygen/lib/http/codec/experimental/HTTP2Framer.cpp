@@ -10,6 +10,7 @@
 #include <proxygen/lib/http/codec/experimental/HTTP2Framer.h>
 
 #include <cstdint>
+#include <folly/Bits.h>
 
 using namespace folly::io;
 using namespace folly;
@@ -30,6 +31,13 @@ static const bool kStrictPadding = true;
 
 static_assert(sizeof(kZeroPad) == 256, "bad zero padding");
 
+// Frame headers and small frames go to buffers of about a page, which the
+// next frames written fill up, with payloads small enough to be copied
+// (see IOBufQueue::append() with pack). Writing many small frames then
+// makes a short chain rather than a few IOBufs per frame; larger payloads
+// are still chained as they are.
+const size_t kFrameBufferGrowth = 4000;
+
 void writePriorityBody(IOBufQueue& queue,
                        uint32_t streamDependency,
                        bool exclusive,
@@ -40,14 +48,14 @@ void writePriorityBody(IOBufQueue& queue,
     streamDependency |= ~kUint31Mask;
   }
 
-  QueueAppender appender(&queue, 8);
+  QueueAppender appender(&queue, kFrameBufferGrowth);
   appender.writeBE<uint32_t>(streamDependency);
   appender.writeBE<uint8_t>(weight);
 }
 
 void writePadding(IOBufQueue& queue, boost::optional<uint8_t> size) {
   if (size && size.get() > 0) {
-    auto out = queue.preallocate(size.get(), size.get());
+    auto out = queue.preallocate(size.get(), kFrameBufferGrowth);
     memset(out.first, 0, size.get());
     queue.postallocate(size.get());
   }
@@ -112,7 +120,7 @@ size_t writeFrameHeader(IOBufQueue& queue,
     queue.append(std::move(payload));
     payload = std::move(tail);
   }
-  QueueAppender appender(&queue, kFrameHeaderSize);
+  QueueAppender appender(&queue, kFrameBufferGrowth);
   appender.writeBE<uint32_t>(lengthAndType);
   appender.writeBE<uint8_t>(flags);
   appender.writeBE<uint32_t>(kUint31Mask & stream);
@@ -129,18 +137,31 @@ size_t writeFrameHeader(IOBufQueue& queue,
   if (payloadLength) {
     queue.postallocate(payloadLength);
   }
-  queue.append(std::move(payload));
+  queue.append(std::move(payload), true);
 
   return length;
 }
 
-uint32_t parseUint31(Cursor& cursor) {
-  // MUST ignore the 1 bit before the stream-id
-  return kUint31Mask & cursor.readBE<uint32_t>();
+/**
+ * Points at the next length bytes of the cursor when they are all in its
+ * current buffer, as they are for most frames, so the fixed-size fields
+ * in them can be read with a single bounds check. nullptr otherwise, for
+ * the fields to be read through the cursor.
+ */
+const uint8_t* peekContiguous(Cursor& cursor, size_t length) {
+  return cursor.length() >= length ? cursor.data() : nullptr;
 }
 
-ErrorCode parseErrorCode(Cursor& cursor, ErrorCode& outCode) {
-  auto code = cursor.readBE<uint32_t>();
+template <class T>
+T readBE(const uint8_t* data) {
+  return Endian::big(loadUnaligned<T>(data));
+}
+
+uint32_t parseUint31(const uint8_t* data) {
+  return kUint31Mask & readBE<uint32_t>(data);
+}
+
+ErrorCode parseErrorCode(uint32_t code, ErrorCode& outCode) {
   if (code > kMaxErrorCode) {
     return ErrorCode::PROTOCOL_ERROR;
   }
@@ -148,6 +169,15 @@ ErrorCode parseErrorCode(Cursor& cursor, ErrorCode& outCode) {
   return ErrorCode::NO_ERROR;
 }
 
+uint32_t parseUint31(Cursor& cursor) {
+  // MUST ignore the 1 bit before the stream-id
+  return kUint31Mask & cursor.readBE<uint32_t>();
+}
+
+ErrorCode parseErrorCode(Cursor& cursor, ErrorCode& outCode) {
+  return parseErrorCode(cursor.readBE<uint32_t>(), outCode);
+}
+
 PriorityUpdate parsePriorityCommon(Cursor& cursor) {
   PriorityUpdate priority;
   uint32_t streamAndExclusive = cursor.readBE<uint32_t>();
@@ -222,13 +252,22 @@ parseFrameHeader(Cursor& cursor,
                  FrameHeader& header) noexcept {
   DCHECK_LE(kFrameHeaderSize, cursor.totalLength());
 
+  uint32_t lengthAndType;
+  const uint8_t* data = peekContiguous(cursor, kFrameHeaderSize);
+  if (data) {
+    lengthAndType = readBE<uint32_t>(data);
+    header.flags = data[4];
+    header.stream = parseUint31(data + 5);
+    cursor.skip(kFrameHeaderSize);
+  } else {
+    lengthAndType = cursor.readBE<uint32_t>();
+    header.flags = cursor.readBE<uint8_t>();
+    header.stream = parseUint31(cursor);
+  }
   // MUST ignore the 2 bits before the length
-  uint32_t lengthAndType = cursor.readBE<uint32_t>();
   header.length = kLengthMask & (lengthAndType >> 8);
   uint8_t type = lengthAndType & 0xff;
   header.type = FrameType(type);
-  header.flags = cursor.readBE<uint8_t>();
-  header.stream = parseUint31(cursor);
   return ErrorCode::NO_ERROR;
 }
 
@@ -255,6 +294,29 @@ parseData(Cursor& cursor,
   return skipPadding(cursor, padding, kStrictPadding);
 }
 
+ErrorCode
+parseDataBegin(Cursor& cursor,
+               FrameHeader header,
+               uint32_t& outLength,
+               uint8_t& outPadding) noexcept {
+  if (header.stream == 0) {
+    return ErrorCode::PROTOCOL_ERROR;
+  }
+
+  const auto err = parsePadding(cursor, header, outPadding);
+  RETURN_IF_ERROR(err);
+  if (header.length < outPadding) {
+    return ErrorCode::PROTOCOL_ERROR;
+  }
+  outLength = header.length - outPadding;
+  return ErrorCode::NO_ERROR;
+}
+
+ErrorCode
+parseDataEnd(Cursor& cursor, uint8_t length) noexcept {
+  return skipPadding(cursor, length, kStrictPadding);
+}
+
 ErrorCode
 parseHeaders(Cursor& cursor,
              FrameHeader header,
@@ -310,6 +372,11 @@ parseRstStream(Cursor& cursor,
   if (header.stream == 0) {
     return ErrorCode::PROTOCOL_ERROR;
   }
+  const uint8_t* data = peekContiguous(cursor, kFrameRstStreamSize);
+  if (data) {
+    cursor.skip(kFrameRstStreamSize);
+    return parseErrorCode(readBE<uint32_t>(data), outCode);
+  }
   return parseErrorCode(cursor, outCode);
 }
 
@@ -331,6 +398,15 @@ parseSettings(Cursor& cursor,
   if (header.length % 6 != 0) {
     return ErrorCode::FRAME_SIZE_ERROR;
   }
+  const uint8_t* data = peekContiguous(cursor, header.length);
+  if (data) {
+    for (uint32_t i = 0; i < header.length; i += 6) {
+      settings.push_back(std::make_pair(SettingsId(readBE<uint16_t>(data + i)),
+                                        readBE<uint32_t>(data + i + 2)));
+    }
+    cursor.skip(header.length);
+    return ErrorCode::NO_ERROR;
+  }
   for (; header.length > 0; header.length -= 6) {
     uint16_t id = cursor.readBE<uint16_t>();
     uint32_t val = cursor.readBE<uint32_t>();
@@ -382,7 +458,13 @@ parsePing(Cursor& cursor,
     return ErrorCode::PROTOCOL_ERROR;
   }
 
-  cursor.pull(&outOpaqueData, sizeof(outOpaqueData));
+  const uint8_t* data = peekContiguous(cursor, kFramePingSize);
+  if (data) {
+    memcpy(&outOpaqueData, data, sizeof(outOpaqueData));
+    cursor.skip(kFramePingSize);
+  } else {
+    cursor.pull(&outOpaqueData, sizeof(outOpaqueData));
+  }
   return ErrorCode::NO_ERROR;
 }
 
@@ -417,7 +499,13 @@ parseWindowUpdate(Cursor& cursor,
   if (header.length != kFrameWindowUpdateSize) {
     return ErrorCode::FRAME_SIZE_ERROR;
   }
-  outAmount = parseUint31(cursor);
+  const uint8_t* data = peekContiguous(cursor, kFrameWindowUpdateSize);
+  if (data) {
+    outAmount = parseUint31(data);
+    cursor.skip(kFrameWindowUpdateSize);
+  } else {
+    outAmount = parseUint31(cursor);
+  }
   return ErrorCode::NO_ERROR;
 }
 
@@ -628,7 +716,7 @@ writePushPromise(IOBufQueue& queue,
                                          nullptr);
   QueueAppender appender(&queue, frameLen);
   appender.writeBE<uint32_t>(promisedStream);
-  queue.append(std::move(headers));
+  queue.append(std::move(headers), true);
   writePadding(queue, padding);
   return kFrameHeaderSize + frameLen;
 }
@@ -667,7 +755,7 @@ writeGoaway(IOBufQueue& queue,
   QueueAppender appender(&queue, frameLen);
   appender.writeBE<uint32_t>(lastStreamID);
   appender.writeBE<uint32_t>(static_cast<uint32_t>(errorCode));
-  queue.append(std::move(debugData));
+  queue.append(std::move(debugData), true);
   return kFrameHeaderSize + frameLen;
 }
 
@@ -107,6 +107,36 @@ parseData(folly::io::Cursor& cursor,
           std::unique_ptr<folly::IOBuf>& outBuf,
           uint16_t& padding) noexcept;
 
+/**
+ * This function parses the padding length of a DATA frame, for callers
+ * that consume the body incrementally instead of with parseData(). It
+ * pulls at most one byte from the cursor.
+ *
+ * @param cursor     The cursor to pull data from.
+ * @param header     The frame header for the frame being parsed.
+ * @param outLength  The number of body bytes that follow, excluding padding.
+ * @param outPadding The number of padding bytes that follow the body.
+ * @return NO_ERROR for successful parse. The connection error code to
+ *         return in a GOAWAY frame if failure.
+ */
+extern ErrorCode
+parseDataBegin(folly::io::Cursor& cursor,
+               FrameHeader header,
+               uint32_t& outLength,
+               uint8_t& outPadding) noexcept;
+
+/**
+ * This function discards (and verifies) up to length padding bytes at
+ * the end of a DATA frame parsed with parseDataBegin().
+ *
+ * @param cursor  The cursor to pull data from.
+ * @param length  The number of padding bytes to discard.
+ * @return NO_ERROR for successful parse. The connection error code to
+ *         return in a GOAWAY frame if failure.
+ */
+extern ErrorCode
+parseDataEnd(folly::io::Cursor& cursor, uint8_t length) noexcept;
+
 /**
  * This function parses the section of the HEADERS frame after the common
  * frame header. It discards any padding and returns the header data in
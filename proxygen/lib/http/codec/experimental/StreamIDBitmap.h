@@ -0,0 +1,57 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <bitset>
+#include <cstdint>
+
+namespace proxygen {
+
+/**
+ * A set of stream IDs kept in a fixed size bitmap that slides along with
+ * the highest ID added to it. Adding and looking up an ID cost the same
+ * however many are in the set and never allocate; the price is that the
+ * IDs that fell behind the bitmap are forgotten, and are no longer found.
+ */
+class StreamIDBitmap {
+ public:
+  // How many consecutive stream IDs are tracked
+  static const uint32_t kWindowSize = 2048;
+
+  void add(uint32_t id) {
+    if (id >= base_ + kWindowSize) {
+      slide(id - kWindowSize + 1);
+    } else if (id < base_) {
+      return;
+    }
+    bits_.set(id - base_);
+  }
+
+  bool contains(uint32_t id) const {
+    return id >= base_ && id - base_ < kWindowSize && bits_.test(id - base_);
+  }
+
+ private:
+  void slide(uint32_t base) {
+    uint32_t shift = base - base_;
+    if (shift >= kWindowSize) {
+      bits_.reset();
+    } else {
+      bits_ >>= shift;
+    }
+    base_ = base;
+  }
+
+  std::bitset<kWindowSize> bits_;
+  // The lowest stream ID the bitmap covers
+  uint32_t base_{0};
+};
+
+}
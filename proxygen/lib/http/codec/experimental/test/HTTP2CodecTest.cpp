@@ -592,6 +592,69 @@ TEST_F(HTTP2CodecTest, LongData) {
   EXPECT_EQ(callbacks_.data.move()->moveToFbString(), buf->moveToFbString());
 }
 
+TEST_F(HTTP2CodecTest, LongPaddedData) {
+  HTTPSettings* settings = (HTTPSettings*)upstreamCodec_.getIngressSettings();
+  settings->setSetting(SettingsId::MAX_FRAME_SIZE, 16);
+  auto buf = makeBuf(100);
+  // 10 bytes of data and 6 of padding per frame
+  upstreamCodec_.generateBody(output_, 1, std::move(buf->clone()),
+                              5, true);
+
+  parse();
+  EXPECT_EQ(callbacks_.messageComplete, 1);
+  EXPECT_EQ(callbacks_.bodyCalls, 10);
+  EXPECT_EQ(callbacks_.bodyLength, 100);
+  EXPECT_EQ(callbacks_.streamErrors, 0);
+  EXPECT_EQ(callbacks_.sessionErrors, 0);
+  EXPECT_EQ(callbacks_.data.move()->moveToFbString(), buf->moveToFbString());
+}
+
+TEST_F(HTTP2CodecTest, PartialData) {
+  // The body of a DATA frame arriving a few bytes at a time is delivered
+  // as it comes, without waiting for the rest of the frame
+  auto buf = makeBuf(100);
+  upstreamCodec_.generateBody(output_, 1, std::move(buf->clone()),
+                              10, true);
+  auto ingress = output_.move();
+  IOBufQueue pending(IOBufQueue::cacheChainLength());
+  Cursor c(ingress.get());
+  for (auto remaining = ingress->computeChainDataLength(); remaining > 0;) {
+    auto len = std::min<size_t>(remaining, 7);
+    std::unique_ptr<IOBuf> piece;
+    c.clone(piece, len);
+    pending.append(std::move(piece));
+    remaining -= len;
+    pending.trimStart(downstreamCodec_.onIngress(*pending.front()));
+  }
+
+  EXPECT_EQ(pending.chainLength(), 0);
+  EXPECT_EQ(callbacks_.messageComplete, 1);
+  EXPECT_GT(callbacks_.bodyCalls, 1);
+  EXPECT_EQ(callbacks_.bodyLength, 100);
+  EXPECT_EQ(callbacks_.streamErrors, 0);
+  EXPECT_EQ(callbacks_.sessionErrors, 0);
+  EXPECT_EQ(callbacks_.data.move()->moveToFbString(), buf->moveToFbString());
+}
+
+TEST_F(HTTP2CodecTest, LargeFrames) {
+  // Both ends agree on frames larger than the default
+  HTTPSettings* settings = (HTTPSettings*)upstreamCodec_.getIngressSettings();
+  settings->setSetting(SettingsId::MAX_FRAME_SIZE, 1 << 16);
+  downstreamCodec_.getEgressSettings()->setSetting(SettingsId::MAX_FRAME_SIZE,
+                                                   1 << 16);
+  auto buf = makeBuf(100000);
+  upstreamCodec_.generateBody(output_, 1, std::move(buf->clone()),
+                              HTTPCodec::NoPadding, true);
+
+  parse();
+  EXPECT_EQ(callbacks_.messageComplete, 1);
+  EXPECT_EQ(callbacks_.bodyCalls, 2);
+  EXPECT_EQ(callbacks_.bodyLength, 100000);
+  EXPECT_EQ(callbacks_.streamErrors, 0);
+  EXPECT_EQ(callbacks_.sessionErrors, 0);
+  EXPECT_EQ(callbacks_.data.move()->moveToFbString(), buf->moveToFbString());
+}
+
 TEST_F(HTTP2CodecTest, BasicRst) {
   upstreamCodec_.generateRstStream(output_, 2, ErrorCode::ENHANCE_YOUR_CALM);
   parse();
@@ -604,6 +667,25 @@ TEST_F(HTTP2CodecTest, BasicRst) {
   EXPECT_EQ(callbacks_.sessionErrors, 0);
 }
 
+TEST_F(HTTP2CodecTest, LateFramesAfterRst) {
+  // reset by the client
+  upstreamCodec_.generateRstStream(output_, 1, ErrorCode::CANCEL);
+  upstreamCodec_.generateWindowUpdate(output_, 1, 10);
+  upstreamCodec_.generateRstStream(output_, 1, ErrorCode::CANCEL);
+  // reset by the server
+  IOBufQueue serverOutput{IOBufQueue::cacheChainLength()};
+  downstreamCodec_.generateRstStream(serverOutput, 3, ErrorCode::CANCEL);
+  upstreamCodec_.generateWindowUpdate(output_, 3, 10);
+  upstreamCodec_.generateWindowUpdate(output_, 5, 10);
+
+  parse();
+  EXPECT_EQ(callbacks_.aborts, 1);
+  EXPECT_EQ(callbacks_.windowUpdateCalls, 1);
+  EXPECT_EQ(callbacks_.windowUpdates[5], std::vector<uint32_t>({10}));
+  EXPECT_EQ(callbacks_.streamErrors, 0);
+  EXPECT_EQ(callbacks_.sessionErrors, 0);
+}
+
 TEST_F(HTTP2CodecTest, BasicPing) {
   upstreamCodec_.generatePingRequest(output_);
   upstreamCodec_.generatePingReply(output_, 17);
@@ -625,6 +707,21 @@ TEST_F(HTTP2CodecTest, BasicPing) {
   EXPECT_EQ(callbacks_.sessionErrors, 0);
 }
 
+TEST_F(HTTP2CodecTest, BasicAltSvc) {
+  SetUpUpstreamTest();
+  http2::writeAltSvc(output_, 0, 3600, 8443, "h2", "", "https://a.com");
+  parseUpstream();
+
+  EXPECT_EQ(callbacks_.altSvcs, 1);
+  EXPECT_EQ(callbacks_.altSvc.protocol, "h2");
+  EXPECT_EQ(callbacks_.altSvc.host, "");
+  EXPECT_EQ(callbacks_.altSvc.port, 8443);
+  EXPECT_EQ(callbacks_.altSvc.maxAge, 3600);
+  EXPECT_EQ(callbacks_.altSvc.origin, "https://a.com");
+  EXPECT_EQ(callbacks_.streamErrors, 0);
+  EXPECT_EQ(callbacks_.sessionErrors, 0);
+}
+
 TEST_F(HTTP2CodecTest, BasicWindow) {
   // This test would fail if the codec had window state
   upstreamCodec_.generateWindowUpdate(output_, 0, 10);
@@ -760,6 +857,21 @@ TEST_F(HTTP2CodecTest, BadPushSettings) {
 }
 
 
+TEST_F(HTTP2CodecTest, DisablePushSetting) {
+  // Until the client says otherwise, the server may push
+  EXPECT_TRUE(downstreamCodec_.supportsPushTransactions());
+
+  auto settings = upstreamCodec_.getEgressSettings();
+  settings->setSetting(SettingsId::ENABLE_PUSH, 0);
+  upstreamCodec_.generateSettings(output_);
+
+  parse();
+  EXPECT_EQ(callbacks_.settings, 1);
+  EXPECT_EQ(callbacks_.sessionErrors, 0);
+  EXPECT_FALSE(downstreamCodec_.supportsPushTransactions());
+  EXPECT_TRUE(upstreamCodec_.supportsPushTransactions());
+}
+
 TEST_F(HTTP2CodecTest, SettingsTableSize) {
   auto settings = upstreamCodec_.getEgressSettings();
   settings->setSetting(SettingsId::HEADER_TABLE_SIZE, 8192);
@@ -109,6 +109,40 @@ TEST_F(HTTP2FramerTest, ManyDataFrameSizes) {
   }
 }
 
+TEST_F(HTTP2FramerTest, SmallFramesShareBuffers) {
+  const uint32_t kNumStreams = 20;
+  for (uint32_t stream = 1; stream < kNumStreams * 2; stream += 2) {
+    writeData(queue_, makeBuf(20), stream, kNoPadding, false);
+    writeWindowUpdate(queue_, stream, 100);
+  }
+  EXPECT_EQ(1, queue_.front()->countChainElements());
+
+  Cursor cursor(queue_.front());
+  for (uint32_t stream = 1; stream < kNumStreams * 2; stream += 2) {
+    FrameHeader header;
+    std::unique_ptr<IOBuf> outBuf;
+    uint16_t padding = 0;
+    uint32_t amount = 0;
+    ASSERT_EQ(ErrorCode::NO_ERROR, parseFrameHeader(cursor, header));
+    ASSERT_EQ(ErrorCode::NO_ERROR, parseData(cursor, header, outBuf, padding));
+    EXPECT_EQ(stream, header.stream);
+    EXPECT_EQ(20, outBuf->computeChainDataLength());
+    ASSERT_EQ(ErrorCode::NO_ERROR, parseFrameHeader(cursor, header));
+    ASSERT_EQ(ErrorCode::NO_ERROR, parseWindowUpdate(cursor, header, amount));
+    EXPECT_EQ(100, amount);
+  }
+  EXPECT_EQ(0, cursor.totalLength());
+}
+
+TEST_F(HTTP2FramerTest, LargePayloadNotCopied) {
+  auto body = makeBuf(kMaxFramePayloadLength);
+  writeData(queue_, body->clone(), 1, kNoPadding, false);
+  writeWindowUpdate(queue_, 1, 100);
+  const IOBuf* buf = queue_.front();
+  EXPECT_EQ(3, buf->countChainElements());
+  EXPECT_EQ(body->data(), buf->next()->data());
+}
+
 TEST_F(HTTP2FramerTest, BadStreamData) {
   writeFrameHeaderManual(queue_, 0,
                          static_cast<uint8_t>(FrameType::DATA),
@@ -460,3 +494,54 @@ TEST_F(HTTP2FramerTest, Continuation) {
   ASSERT_EQ(1, header.stream);
   EXPECT_EQ(outBuf->moveToFbString(), body->moveToFbString());
 }
+
+TEST_F(HTTP2FramerTest, ControlFramesAcrossBuffers) {
+  const deque<SettingPair> settings = {{SettingsId::HEADER_TABLE_SIZE, 3},
+                                       {SettingsId::MAX_CONCURRENT_STREAMS, 4}};
+  uint64_t data = folly::Random::rand64();
+  writeSettings(queue_, settings);
+  writePing(queue_, data, false);
+  writeWindowUpdate(queue_, 33, 120);
+  writeRstStream(queue_, 1, ErrorCode::CANCEL);
+
+  // The same frames, one byte per buffer, go through the cursor
+  auto contiguous = queue_.move();
+  contiguous->coalesce();
+  std::unique_ptr<IOBuf> split;
+  for (size_t i = 0; i < contiguous->length(); i++) {
+    auto byte = IOBuf::copyBuffer(contiguous->data() + i, 1);
+    if (split) {
+      split->prependChain(std::move(byte));
+    } else {
+      split = std::move(byte);
+    }
+  }
+
+  for (auto buf : {contiguous.get(), split.get()}) {
+    Cursor cursor(buf);
+    FrameHeader header;
+    std::deque<SettingPair> outSettings;
+    uint64_t outData;
+    uint32_t amount;
+    ErrorCode outCode;
+    ASSERT_EQ(ErrorCode::NO_ERROR, parseFrameHeader(cursor, header));
+    ASSERT_EQ(FrameType::SETTINGS, header.type);
+    ASSERT_EQ(ErrorCode::NO_ERROR, parseSettings(cursor, header, outSettings));
+    EXPECT_EQ(settings, outSettings);
+    ASSERT_EQ(ErrorCode::NO_ERROR, parseFrameHeader(cursor, header));
+    ASSERT_EQ(FrameType::PING, header.type);
+    ASSERT_EQ(ErrorCode::NO_ERROR, parsePing(cursor, header, outData));
+    EXPECT_EQ(data, outData);
+    ASSERT_EQ(ErrorCode::NO_ERROR, parseFrameHeader(cursor, header));
+    ASSERT_EQ(FrameType::WINDOW_UPDATE, header.type);
+    EXPECT_EQ(33, header.stream);
+    ASSERT_EQ(ErrorCode::NO_ERROR, parseWindowUpdate(cursor, header, amount));
+    EXPECT_EQ(120, amount);
+    ASSERT_EQ(ErrorCode::NO_ERROR, parseFrameHeader(cursor, header));
+    ASSERT_EQ(FrameType::RST_STREAM, header.type);
+    EXPECT_EQ(1, header.stream);
+    ASSERT_EQ(ErrorCode::NO_ERROR, parseRstStream(cursor, header, outCode));
+    EXPECT_EQ(ErrorCode::CANCEL, outCode);
+    EXPECT_EQ(0, cursor.totalLength());
+  }
+}
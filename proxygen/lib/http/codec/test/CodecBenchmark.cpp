@@ -0,0 +1,570 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <folly/Benchmark.h>
+#include <folly/Memory.h>
+#include <folly/io/Cursor.h>
+#include <folly/io/IOBufQueue.h>
+#include <gflags/gflags.h>
+#include <new>
+#include <proxygen/lib/http/HTTPMessage.h>
+#include <proxygen/lib/http/codec/HTTP1xCodec.h>
+#include <proxygen/lib/http/codec/SPDYCodec.h>
+#include <proxygen/lib/http/codec/compress/GzipHeaderCodec.h>
+#include <proxygen/lib/http/codec/compress/HPACKCodec.h>
+#include <proxygen/lib/http/codec/compress/experimental/hpack9/HPACKCodec.h>
+#include <proxygen/lib/http/codec/compress/test/HTTPArchive.h>
+#include <proxygen/lib/http/codec/experimental/HTTP2Codec.h>
+#include <proxygen/lib/utils/AllocStats.h>
+#include <string>
+#include <vector>
+
+DEFINE_string(har, "", "HTTP archive to take the request and response "
+              "headers from, instead of the built-in ones");
+DEFINE_int32(report_ops, 10000, "Operations run per scenario for the "
+              "throughput and allocation report, 0 to skip it");
+
+using namespace folly;
+using namespace proxygen;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+// Allocations made by the process, to report them per operation. With
+// --enable-alloc-stats the library counts them already.
+#if PROXYGEN_ALLOC_STATS
+static uint64_t allocCount() {
+  return getThreadAllocCounts().allocations;
+}
+#else
+static uint64_t g_allocs = 0;
+
+static uint64_t allocCount() {
+  return g_allocs;
+}
+
+void* operator new(size_t size) {
+  ++g_allocs;
+  void* p = malloc(size);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+#endif
+
+namespace {
+
+// Work done around the measured code, kept out of the report, and the
+// bytes the measured code parsed or produced
+struct Meter {
+  uint64_t bytes{0};
+  uint64_t untimedAllocs{0};
+  std::chrono::nanoseconds untimed{0};
+};
+
+Meter g_meter;
+
+template <typename F>
+void untimed(F&& f) {
+  BENCHMARK_SUSPEND {
+    auto allocs = allocCount();
+    auto start = std::chrono::steady_clock::now();
+    f();
+    g_meter.untimedAllocs += allocCount() - allocs;
+    g_meter.untimed += std::chrono::steady_clock::now() - start;
+  }
+}
+
+// Messages are encoded ahead in batches, as the stateful header
+// compressors need them decoded in the order they were encoded
+const unsigned kBatch = 256;
+
+typedef vector<vector<HPACKHeader>> HeaderCorpus;
+
+vector<HPACKHeader> builtinRequest(unsigned i) {
+  string cookie;
+  for (int c = 0; c < 20; c++) {
+    cookie += "c" + std::to_string(c) + "=AQHxY2Z0bWVzc2FnZXNfc2Vzc2lvbl9pZA; ";
+  }
+  return {
+    {":path", "/static/images/" + std::to_string(i) + ".png"},
+    {"host", "www.facebook.com"},
+    {"user-agent", "Mozilla/5.0 (Macintosh; Intel Mac OS X 10_10_3) "
+                   "AppleWebKit/537.36 (KHTML, like Gecko) "
+                   "Chrome/43.0.2357.81 Safari/537.36"},
+    {"accept", "image/webp,*/*;q=0.8"},
+    {"accept-encoding", "gzip, deflate, sdch"},
+    {"accept-language", "en-US,en;q=0.8"},
+    {"referer", "https://www.facebook.com/"},
+    {"cookie", cookie},
+  };
+}
+
+vector<HPACKHeader> builtinResponse(unsigned i) {
+  return {
+    {"content-type", "image/png"},
+    {"cache-control", "public, max-age=1209600"},
+    {"expires", "Thu, 02 Jul 2015 11:21:" + std::to_string(10 + i % 50) +
+                " GMT"},
+    {"last-modified", "Mon, 01 Jan 2001 08:00:00 GMT"},
+    {"access-control-allow-origin", "*"},
+    {"timing-allow-origin", "*"},
+    {"x-content-type-options", "nosniff"},
+    {"date", "Thu, 18 Jun 2015 11:21:10 GMT"},
+  };
+}
+
+struct Corpus {
+  Corpus() {
+    if (!FLAGS_har.empty()) {
+      auto har = HTTPArchive::fromFile(FLAGS_har);
+      CHECK(har && !har->requests.empty() && !har->responses.empty())
+        << "No messages in " << FLAGS_har;
+      requests = std::move(har->requests);
+      responses = std::move(har->responses);
+      return;
+    }
+    for (unsigned i = 0; i < 16; i++) {
+      requests.push_back(builtinRequest(i));
+      responses.push_back(builtinResponse(i));
+    }
+  }
+
+  HeaderCorpus requests;
+  HeaderCorpus responses;
+};
+
+const Corpus& corpus() {
+  static const Corpus corpus;
+  return corpus;
+}
+
+const HeaderCorpus& requestCorpus() {
+  return corpus().requests;
+}
+
+const HeaderCorpus& responseCorpus() {
+  return corpus().responses;
+}
+
+bool skipHeader(const string& name) {
+  // Pseudo headers and the ones the codecs add or refuse themselves
+  return name.empty() || name[0] == ':' || name == "connection" ||
+    name == "keep-alive" || name == "transfer-encoding" ||
+    name == "content-length" || name == "proxy-connection";
+}
+
+HTTPMessage toRequest(const vector<HPACKHeader>& headers) {
+  HTTPMessage msg;
+  msg.setMethod(HTTPMethod::GET);
+  msg.setHTTPVersion(1, 1);
+  msg.setURL("/");
+  for (const auto& header: headers) {
+    if (header.name == ":path") {
+      msg.setURL(header.value);
+    } else if (!skipHeader(header.name)) {
+      msg.getHeaders().add(header.name, header.value);
+    }
+  }
+  if (!msg.getHeaders().exists(HTTP_HEADER_HOST)) {
+    msg.getHeaders().add(HTTP_HEADER_HOST, "www.facebook.com");
+  }
+  return msg;
+}
+
+HTTPMessage toResponse(const vector<HPACKHeader>& headers, size_t bodyLen) {
+  HTTPMessage msg;
+  msg.setStatusCode(200);
+  msg.setStatusMessage("OK");
+  msg.setHTTPVersion(1, 1);
+  for (const auto& header: headers) {
+    if (!skipHeader(header.name)) {
+      msg.getHeaders().add(header.name, header.value);
+    }
+  }
+  msg.getHeaders().add(HTTP_HEADER_CONTENT_LENGTH, std::to_string(bodyLen));
+  return msg;
+}
+
+unique_ptr<HTTPCodec> makeCodec(CodecProtocol proto,
+                                TransportDirection direction) {
+  switch (proto) {
+    case CodecProtocol::HTTP_1_1:
+      return folly::make_unique<HTTP1xCodec>(direction);
+    case CodecProtocol::SPDY_3_1:
+      return folly::make_unique<SPDYCodec>(direction, SPDYVersion::SPDY3_1,
+                                           Z_DEFAULT_COMPRESSION);
+    case CodecProtocol::HTTP_2:
+      return folly::make_unique<HTTP2Codec>(direction);
+    default:
+      LOG(FATAL) << "No benchmark for " << getCodecProtocolString(proto);
+  }
+  return nullptr;
+}
+
+// Only notes the streams that begin
+class StreamCallback: public HTTPCodec::Callback {
+ public:
+  void onMessageBegin(HTTPCodec::StreamID stream, HTTPMessage*) override {
+    streams.push_back(stream);
+  }
+  void onHeadersComplete(HTTPCodec::StreamID,
+                         unique_ptr<HTTPMessage>) override {}
+  void onBody(HTTPCodec::StreamID, unique_ptr<IOBuf>, uint16_t) override {}
+  void onTrailersComplete(HTTPCodec::StreamID,
+                          unique_ptr<HTTPHeaders>) override {}
+  void onMessageComplete(HTTPCodec::StreamID, bool) override {}
+  void onError(HTTPCodec::StreamID, const HTTPException& error,
+               bool) override {
+    LOG(FATAL) << "Benchmark traffic failed to parse: " << error.what();
+  }
+
+  vector<HTTPCodec::StreamID> streams;
+};
+
+// A client and a server codec, with the client's requests ready to parse
+struct CodecPair {
+  explicit CodecPair(CodecProtocol proto):
+      client(makeCodec(proto, TransportDirection::UPSTREAM)),
+      server(makeCodec(proto, TransportDirection::DOWNSTREAM)) {
+    client->setCallback(&clientCallback);
+    server->setCallback(&serverCallback);
+    client->generateConnectionPreface(wire);
+    client->generateSettings(wire);
+    if (!wire.empty()) {
+      server->onIngress(*takeWire());
+    }
+  }
+
+  unique_ptr<IOBuf> takeWire() {
+    auto buf = wire.move();
+    buf->coalesce();
+    return buf;
+  }
+
+  // Next batch of requests, as the server reads them
+  unique_ptr<IOBuf> generateRequests(unsigned count) {
+    const auto& corpus = requestCorpus();
+    for (unsigned i = 0; i < count; i++) {
+      auto msg = toRequest(corpus[next++ % corpus.size()]);
+      client->generateHeader(wire, client->createStream(), msg, 0, true);
+    }
+    return takeWire();
+  }
+
+  unique_ptr<HTTPCodec> client;
+  unique_ptr<HTTPCodec> server;
+  StreamCallback clientCallback;
+  StreamCallback serverCallback;
+  IOBufQueue wire{IOBufQueue::cacheChainLength()};
+  size_t next{0};
+};
+
+void parseRequests(unsigned iters, CodecProtocol proto) {
+  unique_ptr<CodecPair> codecs;
+  untimed([&] { codecs = folly::make_unique<CodecPair>(proto); });
+  for (unsigned done = 0; done < iters; done += kBatch) {
+    unique_ptr<IOBuf> requests;
+    const unsigned count = std::min(kBatch, iters - done);
+    untimed([&] { requests = codecs->generateRequests(count); });
+    g_meter.bytes += requests->length();
+    codecs->server->onIngress(*requests);
+  }
+}
+
+// Counts the errors instead of failing on them
+class ErrorCallback: public StreamCallback {
+ public:
+  void onError(HTTPCodec::StreamID, const HTTPException&, bool) override {
+    errors++;
+  }
+
+  uint64_t errors{0};
+};
+
+// A RST_STREAM frame one byte off its fixed length, which fails the session
+unique_ptr<IOBuf> malformedFrame(CodecProtocol proto) {
+  auto buf = IOBuf::create(16);
+  io::Appender cursor(buf.get(), 0);
+  if (proto == CodecProtocol::SPDY_3_1) {
+    cursor.writeBE<uint16_t>(0x8003);  // control bit and version
+    cursor.writeBE<uint16_t>(3);       // RST_STREAM
+    cursor.writeBE<uint32_t>(4);       // flags and length, 8 is valid
+    cursor.writeBE<uint32_t>(1);
+  } else {
+    CHECK(proto == CodecProtocol::HTTP_2);
+    cursor.writeBE<uint16_t>(0);       // length, 4 is valid
+    cursor.writeBE<uint8_t>(3);
+    cursor.writeBE<uint8_t>(0x3);      // RST_STREAM
+    cursor.writeBE<uint8_t>(0);        // flags
+    cursor.writeBE<uint32_t>(1);
+    cursor.push(reinterpret_cast<const uint8_t*>("\0\0\0"), 3);
+  }
+  return buf;
+}
+
+// The codecs report malformed input as errors, which must stay cheap: a
+// peer can send as much of it as it likes. Each frame fails its session,
+// so every one goes to a fresh server codec.
+void parseMalformedFrames(unsigned iters, CodecProtocol proto) {
+  // Codecs are made a few at a time, as each SPDY one holds zlib state
+  const unsigned kCodecBatch = 16;
+  vector<unique_ptr<CodecPair>> codecs;
+  unique_ptr<IOBuf> frame;
+  ErrorCallback errors;
+  untimed([&] { frame = malformedFrame(proto); });
+  for (unsigned done = 0; done < iters; done += kCodecBatch) {
+    const unsigned count = std::min(kCodecBatch, iters - done);
+    untimed([&] {
+        codecs.clear();
+        for (unsigned i = 0; i < count; i++) {
+          codecs.push_back(folly::make_unique<CodecPair>(proto));
+          codecs.back()->server->setCallback(&errors);
+        }
+      });
+    for (auto& pair: codecs) {
+      pair->server->onIngress(*frame);
+      g_meter.bytes += frame->length();
+    }
+  }
+  CHECK_GE(errors.errors, iters);
+}
+
+void serializeRequests(unsigned iters, CodecProtocol proto) {
+  unique_ptr<CodecPair> codecs;
+  vector<HTTPMessage> msgs;
+  untimed([&] {
+      codecs = folly::make_unique<CodecPair>(proto);
+      for (const auto& headers: requestCorpus()) {
+        msgs.push_back(toRequest(headers));
+      }
+    });
+  IOBufQueue& wire = codecs->wire;
+  for (unsigned i = 0; i < iters; i++) {
+    auto& client = *codecs->client;
+    client.generateHeader(wire, client.createStream(), msgs[i % msgs.size()],
+                          0, true);
+    if (wire.chainLength() > 64 * 1024) {
+      g_meter.bytes += wire.chainLength();
+      untimed([&] { wire.move(); });
+    }
+  }
+  g_meter.bytes += wire.chainLength();
+}
+
+void serializeResponses(unsigned iters, CodecProtocol proto, size_t bodyLen) {
+  unique_ptr<CodecPair> codecs;
+  vector<HTTPMessage> msgs;
+  unique_ptr<IOBuf> body;
+  untimed([&] {
+      codecs = folly::make_unique<CodecPair>(proto);
+      for (const auto& headers: responseCorpus()) {
+        msgs.push_back(toResponse(headers, bodyLen));
+      }
+      body = IOBuf::create(bodyLen);
+      memset(body->writableData(), 'a', bodyLen);
+      body->append(bodyLen);
+    });
+  auto& server = *codecs->server;
+  IOBufQueue out{IOBufQueue::cacheChainLength()};
+  for (unsigned done = 0; done < iters; done += kBatch) {
+    const unsigned count = std::min(kBatch, iters - done);
+    // The server can only respond to requests it has read
+    untimed([&] {
+        codecs->serverCallback.streams.clear();
+        server.onIngress(*codecs->generateRequests(count));
+      });
+    for (auto stream: codecs->serverCallback.streams) {
+      server.generateHeader(out, stream, msgs[stream % msgs.size()], 0,
+                            bodyLen == 0);
+      if (bodyLen) {
+        server.generateBody(out, stream, body->clone(), HTTPCodec::NoPadding,
+                            true);
+      }
+    }
+    g_meter.bytes += out.chainLength();
+    untimed([&] { out.move(); });
+  }
+}
+
+void serializeSmallResponses(unsigned iters, CodecProtocol proto) {
+  serializeResponses(iters, proto, 0);
+}
+
+void serializeLargeResponses(unsigned iters, CodecProtocol proto) {
+  serializeResponses(iters, proto, 16 * 1024);
+}
+
+enum class Compressor {
+  GZIP,
+  HPACK,
+  HPACK09,
+};
+
+unique_ptr<HeaderCodec> makeCompressor(Compressor type,
+                                       TransportDirection direction) {
+  switch (type) {
+    case Compressor::GZIP:
+      return folly::make_unique<GzipHeaderCodec>(Z_DEFAULT_COMPRESSION);
+    case Compressor::HPACK:
+      return folly::make_unique<HPACKCodec>(direction);
+    case Compressor::HPACK09:
+      return folly::make_unique<HPACKCodec09>(direction);
+  }
+  return nullptr;
+}
+
+vector<vector<compress::Header>> toCompressHeaders(
+    const HeaderCorpus& corpus) {
+  vector<vector<compress::Header>> out;
+  for (const auto& headers: corpus) {
+    out.emplace_back();
+    for (const auto& header: headers) {
+      out.back().emplace_back(header.name, header.value);
+    }
+  }
+  return out;
+}
+
+void encodeHeaders(unsigned iters, Compressor type) {
+  unique_ptr<HeaderCodec> encoder;
+  vector<vector<compress::Header>> corpus;
+  untimed([&] {
+      encoder = makeCompressor(type, TransportDirection::UPSTREAM);
+      corpus = toCompressHeaders(requestCorpus());
+    });
+  for (unsigned i = 0; i < iters; i++) {
+    auto buf = encoder->encode(corpus[i % corpus.size()]);
+    g_meter.bytes += buf->computeChainDataLength();
+  }
+}
+
+void decodeHeaders(unsigned iters, Compressor type) {
+  unique_ptr<HeaderCodec> encoder;
+  unique_ptr<HeaderCodec> decoder;
+  vector<vector<compress::Header>> corpus;
+  untimed([&] {
+      encoder = makeCompressor(type, TransportDirection::UPSTREAM);
+      decoder = makeCompressor(type, TransportDirection::DOWNSTREAM);
+      corpus = toCompressHeaders(requestCorpus());
+    });
+  vector<unique_ptr<IOBuf>> blocks;
+  for (unsigned done = 0; done < iters; done += kBatch) {
+    const unsigned count = std::min(kBatch, iters - done);
+    untimed([&] {
+        blocks.clear();
+        for (unsigned i = 0; i < count; i++) {
+          blocks.push_back(
+            encoder->encode(corpus[(done + i) % corpus.size()]));
+        }
+      });
+    for (const auto& block: blocks) {
+      io::Cursor cursor(block.get());
+      auto len = block->computeChainDataLength();
+      auto result = decoder->decode(cursor, len);
+      CHECK(result.isOk());
+      g_meter.bytes += len;
+    }
+  }
+}
+
+}
+
+BENCHMARK_PARAM(parseRequests, CodecProtocol::HTTP_1_1)
+BENCHMARK_RELATIVE_PARAM(parseRequests, CodecProtocol::SPDY_3_1)
+BENCHMARK_RELATIVE_PARAM(parseRequests, CodecProtocol::HTTP_2)
+BENCHMARK_DRAW_LINE();
+BENCHMARK_PARAM(serializeRequests, CodecProtocol::HTTP_1_1)
+BENCHMARK_RELATIVE_PARAM(serializeRequests, CodecProtocol::SPDY_3_1)
+BENCHMARK_RELATIVE_PARAM(serializeRequests, CodecProtocol::HTTP_2)
+BENCHMARK_DRAW_LINE();
+BENCHMARK_PARAM(serializeSmallResponses, CodecProtocol::HTTP_1_1)
+BENCHMARK_RELATIVE_PARAM(serializeSmallResponses, CodecProtocol::SPDY_3_1)
+BENCHMARK_RELATIVE_PARAM(serializeSmallResponses, CodecProtocol::HTTP_2)
+BENCHMARK_DRAW_LINE();
+BENCHMARK_PARAM(serializeLargeResponses, CodecProtocol::HTTP_1_1)
+BENCHMARK_RELATIVE_PARAM(serializeLargeResponses, CodecProtocol::SPDY_3_1)
+BENCHMARK_RELATIVE_PARAM(serializeLargeResponses, CodecProtocol::HTTP_2)
+BENCHMARK_DRAW_LINE();
+BENCHMARK_PARAM(encodeHeaders, Compressor::GZIP)
+BENCHMARK_RELATIVE_PARAM(encodeHeaders, Compressor::HPACK)
+BENCHMARK_RELATIVE_PARAM(encodeHeaders, Compressor::HPACK09)
+BENCHMARK_DRAW_LINE();
+BENCHMARK_PARAM(decodeHeaders, Compressor::GZIP)
+BENCHMARK_RELATIVE_PARAM(decodeHeaders, Compressor::HPACK)
+BENCHMARK_RELATIVE_PARAM(decodeHeaders, Compressor::HPACK09)
+BENCHMARK_DRAW_LINE();
+BENCHMARK_PARAM(parseMalformedFrames, CodecProtocol::SPDY_3_1)
+BENCHMARK_RELATIVE_PARAM(parseMalformedFrames, CodecProtocol::HTTP_2)
+
+namespace {
+
+template <typename P>
+void report(const char* name, void (*fn)(unsigned, P), P param) {
+  g_meter = Meter();
+  auto allocs = allocCount();
+  auto start = std::chrono::steady_clock::now();
+  fn(FLAGS_report_ops, param);
+  auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - start) - g_meter.untimed;
+  auto ops = double(FLAGS_report_ops);
+  printf("%-32s %10.1f MB/s %10.1f B/op %8.2f allocs/op\n", name,
+         g_meter.bytes * 1000.0 / std::max<int64_t>(elapsed.count(), 1),
+         g_meter.bytes / ops,
+         (allocCount() - allocs - g_meter.untimedAllocs) / ops);
+}
+
+}
+
+int main(int argc, char* argv[]) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  folly::runBenchmarks();
+  if (FLAGS_report_ops <= 0) {
+    return 0;
+  }
+
+  const std::pair<const char*, CodecProtocol> protocols[] = {
+    {"http/1.1", CodecProtocol::HTTP_1_1},
+    {"spdy/3.1", CodecProtocol::SPDY_3_1},
+    {"h2", CodecProtocol::HTTP_2},
+  };
+  for (const auto& proto: protocols) {
+    printf("%s\n", proto.first);
+    report("  parseRequests", parseRequests, proto.second);
+    report("  serializeRequests", serializeRequests, proto.second);
+    report("  serializeSmallResponses", serializeSmallResponses,
+           proto.second);
+    report("  serializeLargeResponses", serializeLargeResponses,
+           proto.second);
+    if (proto.second != CodecProtocol::HTTP_1_1) {
+      report("  parseMalformedFrames", parseMalformedFrames, proto.second);
+    }
+  }
+  const std::pair<const char*, Compressor> compressors[] = {
+    {"gzip", Compressor::GZIP},
+    {"hpack", Compressor::HPACK},
+    {"hpack09", Compressor::HPACK09},
+  };
+  for (const auto& compressor: compressors) {
+    printf("%s\n", compressor.first);
+    report("  encodeHeaders", encodeHeaders, compressor.second);
+    report("  decodeHeaders", decodeHeaders, compressor.second);
+  }
+  return 0;
+}
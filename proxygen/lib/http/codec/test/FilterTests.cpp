@@ -13,10 +13,12 @@
 #include <proxygen/lib/http/HTTPMessage.h>
 #include <proxygen/lib/http/codec/FlowControlFilter.h>
 #include <proxygen/lib/http/codec/HTTPChecks.h>
+#include <proxygen/lib/http/codec/HTTPCodecTap.h>
 #include <proxygen/lib/http/codec/SPDYConstants.h>
 #include <proxygen/lib/http/codec/test/MockHTTPCodec.h>
 #include <proxygen/lib/http/codec/test/TestUtils.h>
 #include <random>
+#include <sstream>
 
 using namespace proxygen;
 using namespace std;
@@ -53,6 +55,28 @@ class HTTPChecksTest: public FilterTest {
   }
 };
 
+class HTTPCodecTapTest: public FilterTest {
+ public:
+  void SetUp() override {
+    // Rounded up to 4
+    tap_ = new HTTPCodecTap(3, false);
+    chain_.addFilters(std::unique_ptr<HTTPCodecTap>(tap_));
+  }
+ protected:
+  HTTPCodecTap* tap_;
+};
+
+class FusedChecksFlowControlTest: public FilterTest {
+ public:
+  void SetUp() override {
+    filter_ = new HTTPChecksFilter<FlowControlFilter>(flowCallback_, writeBuf_,
+                                                      codec_);
+    chain_.addFilters(std::unique_ptr<FlowControlFilter>(filter_));
+  }
+  StrictMock<MockFlowControlCallback> flowCallback_;
+  FlowControlFilter* filter_;
+};
+
 template <int initSize>
 class FlowControlFilterTest: public FilterTest {
  public:
@@ -144,6 +168,45 @@ TEST_F(DefaultFlowControl, send_update) {
   filter_->ingressBytesProcessed(writeBuf_, 1);
 }
 
+TEST_F(DefaultFlowControl, update_threshold) {
+  InSequence enforceSequence;
+  EXPECT_CALL(callback_, onBody(_, _, _))
+    .WillRepeatedly(Return());
+  filter_->setWindowUpdateThreshold(1000);
+
+  callbackStart_->onBody(1, makeBuf(2000), 0);
+  filter_->ingressBytesProcessed(writeBuf_, 1000);
+  EXPECT_CALL(*codec_, generateWindowUpdate(_, 0, 1001));
+  filter_->ingressBytesProcessed(writeBuf_, 1);
+}
+
+TEST_F(DefaultFlowControl, auto_tune_window) {
+  InSequence enforceSequence;
+  EXPECT_CALL(callback_, onBody(_, _, _))
+    .WillRepeatedly(Return());
+  // Any two updates will be less than 2 RTTs apart
+  filter_->setRoundTripTime(std::chrono::hours(1));
+  filter_->setReceiveWindowAutoTuning(spdy::kInitialWindow * 2);
+
+  // The first update only starts the clock
+  callbackStart_->onBody(1, makeBuf(spdy::kInitialWindow / 2 + 1), 0);
+  EXPECT_CALL(*codec_,
+              generateWindowUpdate(_, 0, spdy::kInitialWindow / 2 + 1));
+  filter_->ingressBytesProcessed(writeBuf_, spdy::kInitialWindow / 2 + 1);
+
+  // The second one comes too soon, so the window doubles
+  callbackStart_->onBody(1, makeBuf(spdy::kInitialWindow / 2 + 1), 0);
+  EXPECT_CALL(*codec_,
+              generateWindowUpdate(_, 0, spdy::kInitialWindow * 3 / 2 + 1));
+  filter_->ingressBytesProcessed(writeBuf_, spdy::kInitialWindow / 2 + 1);
+
+  // And no further than the maximum
+  callbackStart_->onBody(1, makeBuf(spdy::kInitialWindow + 1), 0);
+  EXPECT_CALL(*codec_,
+              generateWindowUpdate(_, 0, spdy::kInitialWindow + 1));
+  filter_->ingressBytesProcessed(writeBuf_, spdy::kInitialWindow + 1);
+}
+
 TEST_F(BigWindow, recv_too_much) {
   // Constructing the filter with a large capacity causes a WINDOW_UPDATE
   // for stream zero to be generated
@@ -245,3 +308,55 @@ TEST_F(HTTPChecksTest, recv_trace_body) {
 
   callbackStart_->onHeadersComplete(0, std::move(msg));
 }
+
+TEST_F(FusedChecksFlowControlTest, checks_and_flow_control) {
+  // The checks still apply
+  EXPECT_CALL(callback_, onError(_, _, true))
+    .WillOnce(Invoke([] (HTTPCodec::StreamID,
+                         std::shared_ptr<HTTPException> exc,
+                         bool newTxn) {
+                       ASSERT_EQ(exc->getHttpStatusCode(), 400);
+        }));
+  auto msg = makePostRequest();
+  msg->setMethod("TRACE");
+  callbackStart_->onHeadersComplete(1, std::move(msg));
+
+  EXPECT_CALL(callback_, onHeadersComplete(3, _));
+  callbackStart_->onHeadersComplete(3, makePostRequest());
+
+  // And so does flow control, in the same filter
+  EXPECT_CALL(*codec_, generateBody(_, _, _, _, _))
+    .WillRepeatedly(Return(0));
+  EXPECT_EQ(filter_->getAvailableSend(), spdy::kInitialWindow);
+  chain_->generateBody(writeBuf_, 3, makeBuf(100), HTTPCodec::NoPadding,
+                       false);
+  EXPECT_EQ(filter_->getAvailableSend(), spdy::kInitialWindow - 100);
+}
+
+TEST_F(HTTPCodecTapTest, keeps_last_entries) {
+  EXPECT_CALL(callback_, onWindowUpdate(_, _)).Times(5);
+  for (uint32_t i = 1; i <= 5; i++) {
+    callbackStart_->onWindowUpdate(i, i * 100);
+  }
+  EXPECT_CALL(*codec_, generateWindowUpdate(_, 7, 1000))
+    .WillOnce(Return(13));
+  chain_->generateWindowUpdate(writeBuf_, 7, 1000);
+
+  // The first two are gone
+  auto entries = tap_->getEntries();
+  ASSERT_EQ(4, entries.size());
+  EXPECT_EQ(3, entries[0].stream);
+  EXPECT_EQ(300, entries[0].length);
+  EXPECT_FALSE(entries[0].egress);
+  EXPECT_TRUE(entries[3].event == HTTPCodecTap::Event::WINDOW_UPDATE);
+  EXPECT_EQ(7, entries[3].stream);
+  EXPECT_EQ(1000, entries[3].length);
+  EXPECT_TRUE(entries[3].egress);
+
+  std::ostringstream os;
+  tap_->dump(os);
+  auto dump = os.str();
+  EXPECT_EQ(0, dump.find("+0us in  WINDOW_UPDATE stream=3 length=300\n"));
+  EXPECT_NE(std::string::npos,
+            dump.find("out WINDOW_UPDATE stream=7 length=1000\n"));
+}
@@ -10,6 +10,7 @@
 #include <gtest/gtest.h>
 #include <proxygen/lib/http/HTTPHeaderSize.h>
 #include <proxygen/lib/http/HTTPMessage.h>
+#include <proxygen/lib/http/HeaderTemplate.h>
 #include <proxygen/lib/http/codec/HTTP1xCodec.h>
 
 using namespace proxygen;
@@ -27,23 +28,35 @@ class HTTP1xCodecCallback : public HTTPCodec::Callback {
                          std::unique_ptr<HTTPMessage> msg) override {
     headersComplete++;
     headerSize = msg->getIngressHeaderSize();
+    this->msg = std::move(msg);
   }
   void onBody(HTTPCodec::StreamID stream,
               std::unique_ptr<folly::IOBuf> chain,
-              uint16_t padding) override {}
+              uint16_t padding) override {
+    body.append(std::move(chain));
+  }
   void onChunkHeader(HTTPCodec::StreamID stream, size_t length) override {}
   void onChunkComplete(HTTPCodec::StreamID stream) override {}
   void onTrailersComplete(HTTPCodec::StreamID stream,
                           std::unique_ptr<HTTPHeaders> trailers) override {}
-  void onMessageComplete(HTTPCodec::StreamID stream, bool upgrade) override {}
+  void onMessageComplete(HTTPCodec::StreamID stream, bool upgrade) override {
+    messageComplete++;
+  }
   void onError(HTTPCodec::StreamID stream,
                const HTTPException& error,
                bool newTxn) override {
     LOG(ERROR) << "parse error";
+    errors++;
+    lastError = error.getProxygenError();
   }
 
   uint32_t headersComplete{0};
+  uint32_t messageComplete{0};
+  uint32_t errors{0};
+  ProxygenError lastError{kErrorNone};
   HTTPHeaderSize headerSize;
+  std::unique_ptr<HTTPMessage> msg;
+  folly::IOBufQueue body{folly::IOBufQueue::cacheChainLength()};
 };
 
 unique_ptr<folly::IOBuf> getSimpleRequestData() {
@@ -94,6 +107,26 @@ TEST(HTTP1xCodecTest, TestChunkedHeaders) {
   }
 }
 
+TEST(HTTP1xCodecTest, TestHeaderValuesSplitAcrossBuffers) {
+  string req("GET /aha HTTP/1.1\r\nHost: m.facebook.com\r\n"
+             "X-Custom: some value\r\nAccept: */*\r\n\r\n");
+  for (size_t split = 1; split < req.size(); split++) {
+    HTTP1xCodec codec(TransportDirection::DOWNSTREAM);
+    HTTP1xCodecCallback callbacks;
+    codec.setCallback(&callbacks);
+    auto buffer1 = folly::IOBuf::copyBuffer(req.substr(0, split));
+    auto buffer2 = folly::IOBuf::copyBuffer(req.substr(split));
+    codec.onIngress(*buffer1);
+    codec.onIngress(*buffer2);
+    ASSERT_EQ(callbacks.headersComplete, 1);
+    const auto& headers = callbacks.msg->getHeaders();
+    EXPECT_EQ(headers.size(), 3);
+    EXPECT_EQ(headers.getSingleOrEmpty(HTTP_HEADER_HOST), "m.facebook.com");
+    EXPECT_EQ(headers.getSingleOrEmpty("X-Custom"), "some value");
+    EXPECT_EQ(headers.getSingleOrEmpty(HTTP_HEADER_ACCEPT), "*/*");
+  }
+}
+
 TEST(HTTP1xCodecTest, TestChunkedUpstream) {
   HTTP1xCodec codec(TransportDirection::UPSTREAM);
 
@@ -131,3 +164,353 @@ TEST(HTTP1xCodecTest, TestChunkedUpstream) {
   auto eomFromBuf = buf.split(buf.chainLength());
   ASSERT_EQ("5\r\nWorld\r\n0\r\n\r\n", eomFromBuf->moveToFbString());
 }
+
+TEST(HTTP1xCodecTest, TestChunkFramingInPlace) {
+  HTTP1xCodec codec(TransportDirection::UPSTREAM);
+  auto txnID = codec.createStream();
+  HTTPMessage msg;
+  msg.setHTTPVersion(1, 1);
+  msg.setURL("/");
+  msg.getHeaders().set("Transfer-Encoding", "chunked");
+  msg.setIsChunked(true);
+  folly::IOBufQueue buf(folly::IOBufQueue::cacheChainLength());
+  codec.generateHeader(buf, txnID, msg, 0, false, nullptr);
+  buf.move();
+
+  // With room around the body, the framing goes in the same buffer
+  auto body = folly::IOBuf::create(64);
+  body->advance(16);
+  memcpy(body->writableData(), "Hello, World", 12);
+  body->append(12);
+  codec.generateBody(buf, txnID, std::move(body), HTTPCodec::NoPadding,
+                     false);
+  auto framed = buf.move();
+  EXPECT_FALSE(framed->isChained());
+  EXPECT_EQ("c\r\nHello, World\r\n", framed->moveToFbString());
+
+  // Without, around it
+  string big(300, 'a');
+  auto wrapped = folly::IOBuf::wrapBuffer(big.data(), big.size());
+  codec.generateBody(buf, txnID, std::move(wrapped), HTTPCodec::NoPadding,
+                     true);
+  EXPECT_EQ("12c\r\n" + big + "\r\n0\r\n\r\n",
+            buf.move()->moveToFbString().toStdString());
+}
+
+string generateResponse(uint16_t code, const string& reason,
+                        std::pair<uint8_t, uint8_t> version) {
+  HTTP1xCodec codec(TransportDirection::DOWNSTREAM);
+  HTTP1xCodecCallback callbacks;
+  codec.setCallback(&callbacks);
+  auto request = getSimpleRequestData();
+  codec.onIngress(*request);
+
+  HTTPMessage resp;
+  resp.setHTTPVersion(version.first, version.second);
+  resp.setStatusCode(code);
+  resp.setStatusMessage(reason);
+  resp.getHeaders().set(HTTP_HEADER_CONTENT_LENGTH, "0");
+  folly::IOBufQueue buf(folly::IOBufQueue::cacheChainLength());
+  codec.generateHeader(buf, 1, resp, 0, true, nullptr);
+  return buf.move()->moveToFbString().toStdString();
+}
+
+TEST(HTTP1xCodecTest, TestStatusLine) {
+  auto startsWith = [] (const string& s, const string& prefix) {
+    return s.compare(0, prefix.size(), prefix) == 0;
+  };
+  EXPECT_TRUE(startsWith(generateResponse(200, "OK", {1, 1}),
+                         "HTTP/1.1 200 OK\r\n"));
+  EXPECT_TRUE(startsWith(generateResponse(404, "Not Found", {1, 0}),
+                         "HTTP/1.0 404 Not Found\r\n"));
+  // Not the default reason, or not a known code
+  EXPECT_TRUE(startsWith(generateResponse(200, "Fine", {1, 1}),
+                         "HTTP/1.1 200 Fine\r\n"));
+  EXPECT_TRUE(startsWith(generateResponse(200, "", {1, 1}),
+                         "HTTP/1.1 200 \r\n"));
+  EXPECT_TRUE(startsWith(generateResponse(299, "Odd", {1, 1}),
+                         "HTTP/1.1 299 Odd\r\n"));
+}
+
+TEST(HTTP1xCodecTest, TestDateHeader) {
+  auto response = generateResponse(200, "OK", {1, 1});
+  auto& date = HTTPMessage::getDateHeader();
+  EXPECT_EQ(29, date.size());
+  EXPECT_EQ(HTTPMessage::formatDateHeader(), date);
+  EXPECT_NE(string::npos, response.find("\r\nDate: "));
+}
+
+string generateEarlyHints(const string& request) {
+  HTTP1xCodec codec(TransportDirection::DOWNSTREAM);
+  HTTP1xCodecCallback callbacks;
+  codec.setCallback(&callbacks);
+  auto buffer = folly::IOBuf::copyBuffer(request);
+  codec.onIngress(*buffer);
+
+  folly::IOBufQueue buf(folly::IOBufQueue::cacheChainLength());
+  for (auto link: {"</a.css>; rel=preload", "</b.js>; rel=preload"}) {
+    HTTPMessage hints;
+    hints.setHTTPVersion(1, 1);
+    hints.setStatusCode(103);
+    hints.setStatusMessage("Early Hints");
+    hints.getHeaders().add(HTTP_HEADER_LINK, link);
+    codec.generateHeader(buf, 1, hints, 0, false, nullptr);
+  }
+  HTTPMessage resp;
+  resp.setHTTPVersion(1, 1);
+  resp.setStatusCode(200);
+  resp.setStatusMessage("OK");
+  resp.getHeaders().set(HTTP_HEADER_CONTENT_LENGTH, "0");
+  codec.generateHeader(buf, 1, resp, 0, true, nullptr);
+  return buf.move()->moveToFbString().toStdString();
+}
+
+TEST(HTTP1xCodecTest, TestEarlyHints) {
+  auto out = generateEarlyHints("GET / HTTP/1.1\r\nHost: a\r\n\r\n");
+  const string hints1 =
+    "HTTP/1.1 103 Early Hints\r\nLink: </a.css>; rel=preload\r\n\r\n";
+  const string hints2 =
+    "HTTP/1.1 103 Early Hints\r\nLink: </b.js>; rel=preload\r\n\r\n";
+  EXPECT_EQ(hints1 + hints2, out.substr(0, hints1.size() + hints2.size()));
+  auto rest = out.substr(hints1.size() + hints2.size());
+  EXPECT_EQ(0, rest.find("HTTP/1.1 200 OK\r\n"));
+  EXPECT_NE(string::npos, rest.find("\r\nDate: "));
+  EXPECT_NE(string::npos, rest.find("\r\nContent-Length: 0\r\n"));
+
+  // Not for HTTP/1.0 clients
+  out = generateEarlyHints("GET / HTTP/1.0\r\n\r\n");
+  EXPECT_EQ(0, out.find("HTTP/1.1 200 OK\r\n"));
+  EXPECT_EQ(string::npos, out.find("103"));
+}
+
+// Feed data to codec in reads of at most chunkSize bytes, each of them
+// consumed whole
+void ingressInChunks(HTTP1xCodec& codec, const string& data,
+                     size_t chunkSize) {
+  for (size_t i = 0; i < data.size(); i += chunkSize) {
+    auto buf = folly::IOBuf::copyBuffer(data.substr(i, chunkSize));
+    EXPECT_EQ(buf->length(), codec.onIngress(*buf));
+  }
+}
+
+TEST(HTTP1xCodecTest, TestHeadScanner) {
+  string req("GET /yeah?a=b HTTP/1.1\r\n"
+             "Host: www.facebook.com\r\n"
+             "X-Custom-Header:\t spaced \r\n"
+             "Accept-Encoding: gzip, deflate\r\n\r\n");
+  // whole, split at every byte, and in between
+  for (size_t chunkSize: {req.size(), (size_t)1, (size_t)7}) {
+    HTTP1xCodec codec(TransportDirection::DOWNSTREAM);
+    codec.setHeadScanner(true);
+    HTTP1xCodecCallback callbacks;
+    codec.setCallback(&callbacks);
+    ingressInChunks(codec, req, chunkSize);
+    EXPECT_EQ(callbacks.headersComplete, 1);
+    EXPECT_EQ(callbacks.messageComplete, 1);
+    EXPECT_EQ(callbacks.errors, 0);
+    EXPECT_EQ(callbacks.headerSize.uncompressed, req.size());
+    ASSERT_NE(callbacks.msg, nullptr);
+    auto& msg = *callbacks.msg;
+    EXPECT_EQ(msg.getMethod(), HTTPMethod::GET);
+    EXPECT_EQ(msg.getURL(), "/yeah?a=b");
+    EXPECT_EQ(msg.getPath(), "/yeah");
+    EXPECT_EQ(msg.getHTTPVersion().first, 1);
+    EXPECT_EQ(msg.getHTTPVersion().second, 1);
+    EXPECT_EQ(msg.getHeaders().size(), 3);
+    EXPECT_EQ(msg.getHeaders().getSingleOrEmpty(HTTP_HEADER_HOST),
+              "www.facebook.com");
+    EXPECT_EQ(msg.getHeaders().getSingleOrEmpty("x-custom-header"),
+              "spaced ");
+    EXPECT_FALSE(msg.getIsChunked());
+  }
+}
+
+TEST(HTTP1xCodecTest, TestHeadScannerPipelinedBodies) {
+  string req("POST /upload HTTP/1.1\r\n"
+             "Host: www.facebook.com\r\n"
+             "Content-Length: 5\r\n\r\n"
+             "Hello"
+             "POST /upload HTTP/1.0\r\n"
+             "Content-Length: 6\r\n\r\n"
+             " World"
+             "HEAD / HTTP/1.1\r\n\r\n");
+  for (size_t chunkSize: {req.size(), (size_t)1, (size_t)13}) {
+    HTTP1xCodec codec(TransportDirection::DOWNSTREAM);
+    codec.setHeadScanner(true);
+    HTTP1xCodecCallback callbacks;
+    codec.setCallback(&callbacks);
+    ingressInChunks(codec, req, chunkSize);
+    EXPECT_EQ(callbacks.headersComplete, 3);
+    EXPECT_EQ(callbacks.messageComplete, 3);
+    EXPECT_EQ(callbacks.errors, 0);
+    EXPECT_EQ(callbacks.body.move()->moveToFbString(), "Hello World");
+    ASSERT_NE(callbacks.msg, nullptr);
+    EXPECT_EQ(callbacks.msg->getMethod(), HTTPMethod::HEAD);
+  }
+}
+
+TEST(HTTP1xCodecTest, TestHeadScannerFallback) {
+  // Chunked bodies, bare LF line ends and unknown methods are left to
+  // http_parser, whether the scanner gives up on a whole head or on one it
+  // buffered
+  vector<string> unscannable{
+    "POST /upload HTTP/1.1\r\n"
+    "Transfer-Encoding: chunked\r\n\r\n"
+    "5\r\nHello\r\n0\r\n\r\n",
+    "GET /yeah HTTP/1.1\nHost: www.facebook.com\n\n",
+    "PATCH /thing HTTP/1.1\r\n\r\n",
+  };
+  for (auto& middle: unscannable) {
+    string req("GET / HTTP/1.1\r\n\r\n" + middle +
+               "GET /last HTTP/1.1\r\n\r\n");
+    for (size_t chunkSize: {req.size(), (size_t)1, (size_t)20}) {
+      HTTP1xCodec codec(TransportDirection::DOWNSTREAM);
+      codec.setHeadScanner(true);
+      HTTP1xCodecCallback callbacks;
+      codec.setCallback(&callbacks);
+      ingressInChunks(codec, req, chunkSize);
+      EXPECT_EQ(callbacks.headersComplete, 3);
+      EXPECT_EQ(callbacks.messageComplete, 3);
+      EXPECT_EQ(callbacks.errors, 0);
+      ASSERT_NE(callbacks.msg, nullptr);
+      EXPECT_EQ(callbacks.msg->getURL(), "/last");
+    }
+  }
+
+  // The scanner's bare LF request of TestSimpleHeaders
+  HTTP1xCodec codec(TransportDirection::DOWNSTREAM);
+  codec.setHeadScanner(true);
+  HTTP1xCodecCallback callbacks;
+  codec.setCallback(&callbacks);
+  auto buffer = getSimpleRequestData();
+  codec.onIngress(*buffer);
+  EXPECT_EQ(callbacks.headersComplete, 1);
+  EXPECT_EQ(buffer->length(), callbacks.headerSize.uncompressed);
+}
+
+TEST(HTTP1xCodecTest, TestHeadScannerErrors) {
+  // Malformed heads get the errors http_parser reports for them
+  for (bool scanner: {false, true}) {
+    HTTP1xCodec codec(TransportDirection::DOWNSTREAM);
+    codec.setHeadScanner(scanner);
+    HTTP1xCodecCallback callbacks;
+    codec.setCallback(&callbacks);
+    auto buf = folly::IOBuf::copyBuffer(
+      "GET / HTTP/1.1\r\nContent-Length: x\r\n\r\n");
+    codec.onIngress(*buf);
+    EXPECT_EQ(callbacks.headersComplete, 0);
+    EXPECT_EQ(callbacks.errors, 1);
+    EXPECT_EQ(callbacks.lastError, kErrorParseHeader);
+  }
+
+  // Truncated heads and bodies
+  for (string req: {"GET / HTTP/1.1\r\nHost: ",
+                    "POST / HTTP/1.1\r\nContent-Length: 10\r\n\r\nHello"}) {
+    for (bool scanner: {false, true}) {
+      HTTP1xCodec codec(TransportDirection::DOWNSTREAM);
+      codec.setHeadScanner(scanner);
+      HTTP1xCodecCallback callbacks;
+      codec.setCallback(&callbacks);
+      ingressInChunks(codec, req, 8);
+      codec.onIngressEOF();
+      EXPECT_EQ(callbacks.messageComplete, 0);
+      EXPECT_EQ(callbacks.errors, 1);
+      EXPECT_EQ(callbacks.lastError, kErrorEOF);
+    }
+  }
+}
+
+TEST(HTTP1xCodecTest, TestHTTPChecks) {
+  // A TRACE must not have a body, which the codec itself rejects once it
+  // runs the checks of HTTPChecks
+  for (bool checks: {false, true}) {
+    HTTP1xCodec codec(TransportDirection::DOWNSTREAM);
+    if (checks) {
+      EXPECT_TRUE(codec.enableHTTPChecks());
+    }
+    HTTP1xCodecCallback callbacks;
+    codec.setCallback(&callbacks);
+    auto buf = folly::IOBuf::copyBuffer(
+      "TRACE / HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc");
+    codec.onIngress(*buf);
+    EXPECT_EQ(callbacks.headersComplete, checks ? 0 : 1);
+    EXPECT_EQ(callbacks.errors, checks ? 1 : 0);
+    if (checks) {
+      EXPECT_EQ(callbacks.lastError, kErrorParseHeader);
+    }
+  }
+}
+
+TEST(HTTP1xCodecTest, TestHeaderArena) {
+  string req("GET /yeah HTTP/1.1\r\n"
+             "Host: www.facebook.com\r\n"
+             "X-Custom-Header: custom\r\n"
+             "Content-Length: 0\r\n\r\n");
+  // by http_parser, split or not, and by the head scanner
+  for (size_t chunkSize: {req.size(), (size_t)5, (size_t)0}) {
+    HTTP1xCodec codec(TransportDirection::DOWNSTREAM);
+    codec.setHeaderArena(256);
+    if (chunkSize == 0) {
+      codec.setHeadScanner(true);
+      chunkSize = req.size();
+    }
+    HTTP1xCodecCallback callbacks;
+    codec.setCallback(&callbacks);
+    ingressInChunks(codec, req, chunkSize);
+    EXPECT_EQ(callbacks.headersComplete, 1);
+    EXPECT_EQ(callbacks.errors, 0);
+    ASSERT_NE(callbacks.msg, nullptr);
+    auto& headers = callbacks.msg->getHeaders();
+    EXPECT_TRUE(headers.usesArena());
+    EXPECT_EQ(headers.size(), 3);
+    EXPECT_EQ(headers.getSingleOrEmpty("x-custom-header"), "custom");
+
+    // and straight back out of the arena, Content-Length last
+    HTTPMessage copy(*callbacks.msg);
+    copy.setHTTPVersion(1, 1);
+    copy.getHeaders().remove(HTTP_HEADER_HOST);
+    HTTP1xCodec upstream(TransportDirection::UPSTREAM);
+    folly::IOBufQueue buf(folly::IOBufQueue::cacheChainLength());
+    upstream.generateHeader(buf, upstream.createStream(), copy, 0, true,
+                            nullptr);
+    auto out = buf.move()->moveToFbString().toStdString();
+    EXPECT_NE(out.find("\r\nX-Custom-Header: custom\r\n"), string::npos);
+    EXPECT_NE(out.find("\r\nContent-Length: 0\r\n\r\n"), string::npos);
+    EXPECT_EQ(out.find("Host"), string::npos);
+  }
+}
+
+TEST(HTTP1xCodecTest, TestHeaderTemplate) {
+  auto headerTemplate = std::make_shared<HeaderTemplate>();
+  headerTemplate->add(HTTP_HEADER_SERVER, "proxygen")
+    .add("Access-Control-Allow-Origin", "*");
+  EXPECT_EQ(headerTemplate->size(), 2);
+  // Classified from the name
+  EXPECT_EQ(headerTemplate->getHeaders()[1].code,
+            HTTP_HEADER_ACCESS_CONTROL_ALLOW_ORIGIN);
+  EXPECT_THROW(headerTemplate->add(HTTP_HEADER_CONNECTION, "close"),
+               std::invalid_argument);
+  EXPECT_THROW(headerTemplate->add("X-Split", "a\r\nb"),
+               std::invalid_argument);
+
+  HTTP1xCodec codec(TransportDirection::DOWNSTREAM);
+  HTTP1xCodecCallback callbacks;
+  codec.setCallback(&callbacks);
+  codec.onIngress(*getSimpleRequestData());
+  HTTPMessage resp;
+  resp.setHTTPVersion(1, 1);
+  resp.setStatusCode(200);
+  resp.setStatusMessage("OK");
+  resp.getHeaders().set(HTTP_HEADER_CONTENT_LENGTH, "0");
+  resp.setHeaderTemplate(headerTemplate);
+  // A copy still refers to the template
+  HTTPMessage copy(resp);
+  EXPECT_EQ(copy.getHeaderTemplate(), headerTemplate.get());
+  folly::IOBufQueue buf(folly::IOBufQueue::cacheChainLength());
+  codec.generateHeader(buf, 1, copy, 0, true, nullptr);
+  auto response = buf.move()->moveToFbString().toStdString();
+  EXPECT_NE(response.find("\r\nServer: proxygen\r\n"
+                          "Access-Control-Allow-Origin: *\r\n"),
+            string::npos);
+  EXPECT_FALSE(resp.getHeaders().exists(HTTP_HEADER_SERVER));
+}
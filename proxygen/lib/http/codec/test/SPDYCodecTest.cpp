@@ -10,6 +10,7 @@
 #include <gtest/gtest.h>
 #include <proxygen/lib/http/HTTPHeaderSize.h>
 #include <proxygen/lib/http/HTTPMessage.h>
+#include <proxygen/lib/http/HeaderTemplate.h>
 #include <proxygen/lib/http/codec/SPDYCodec.h>
 #include <proxygen/lib/http/codec/SPDYConstants.h>
 #include <proxygen/lib/http/codec/SPDYVersionSettings.h>
@@ -910,6 +911,45 @@ TEST(SPDYCodecTest, DateHeader) {
   EXPECT_TRUE(callbacks.msg->getHeaders().exists(HTTP_HEADER_DATE));
 }
 
+TEST(SPDYCodecTest, HeaderTemplate) {
+  FakeHTTPCodecCallback callbacks;
+  SPDYCodec egressCodec(TransportDirection::DOWNSTREAM,
+                        SPDYVersion::SPDY3);
+  SPDYCodec ingressCodec(TransportDirection::UPSTREAM,
+                         SPDYVersion::SPDY3);
+  ingressCodec.setCallback(&callbacks);
+
+  auto headerTemplate = std::make_shared<HeaderTemplate>();
+  headerTemplate->add(HTTP_HEADER_SERVER, "proxygen")
+    .add("X-Frame-Options", "DENY");
+  HTTPMessage resp;
+  resp.setStatusCode(200);
+  resp.getHeaders().add(HTTP_HEADER_CONTENT_TYPE, "text/plain");
+  resp.setHeaderTemplate(headerTemplate);
+  auto syn = getSynStream(egressCodec, 1, resp, 0);
+  ingressCodec.onIngress(*syn);
+  EXPECT_EQ(callbacks.headersComplete, 1);
+  EXPECT_EQ(callbacks.sessionErrors, 0);
+  const auto& headers = callbacks.msg->getHeaders();
+  EXPECT_EQ(headers.getSingleOrEmpty(HTTP_HEADER_CONTENT_TYPE),
+            "text/plain");
+  EXPECT_EQ(headers.getSingleOrEmpty(HTTP_HEADER_SERVER), "proxygen");
+  EXPECT_EQ(headers.getSingleOrEmpty("X-Frame-Options"), "DENY");
+}
+
+TEST(SPDYCodecTest, InformationalResponseDropped) {
+  SPDYCodec egressCodec(TransportDirection::DOWNSTREAM,
+                        SPDYVersion::SPDY3);
+  HTTPMessage hints;
+  hints.setStatusCode(103);
+  hints.getHeaders().add(HTTP_HEADER_LINK, "</a.css>; rel=preload");
+  folly::IOBufQueue output(folly::IOBufQueue::cacheChainLength());
+  HTTPHeaderSize size;
+  egressCodec.generateHeader(output, 1, hints, 0, false, &size);
+  EXPECT_EQ(output.chainLength(), 0);
+  EXPECT_EQ(size.uncompressed, 0);
+}
+
 // SYN_STREAM includes ~100k header name with 50k one-byte values
 uint8_t multiValuedHeaderAttack[] =
 { 0x80, 0x03, 0x00, 0x01, 0x01, 0x00, 0x02, 0x11,
@@ -1274,6 +1314,44 @@ TEST(SPDYCodecTest, SegmentedHeaderBlock) {
             size);
 }
 
+TEST(SPDYCodecTest, PartialHeaderBlock) {
+  SPDYCodec egressCodec(TransportDirection::UPSTREAM,
+                        SPDYVersion::SPDY3_1);
+  SPDYCodec ingressCodec(TransportDirection::DOWNSTREAM,
+                         SPDYVersion::SPDY3_1);
+  FakeHTTPCodecCallback callbacks;
+  ingressCodec.setCallback(&callbacks);
+  // a value that barely compresses, for a large header block
+  std::mt19937 rng;
+  string value;
+  for (int i = 0; i < 8000; i++) {
+    value.push_back('a' + rng() % 26);
+  }
+  for (uint32_t streamID = 1; streamID <= 3; streamID += 2) {
+    HTTPMessage req;
+    req.setMethod("GET");
+    req.setURL("http://www.facebook.com");
+    req.getHeaders().set("HOST", "www.facebook.com");
+    req.getHeaders().set("X-FB-Random", value);
+    auto buf = getSynStream(egressCodec, streamID, req);
+    buf->coalesce();
+    auto tail = buf->clone();
+    size_t half = buf->length() / 2;
+    buf->trimEnd(buf->length() - half);
+    tail->trimStart(half);
+
+    // The first half is taken without waiting for the rest of the frame
+    EXPECT_EQ(ingressCodec.onIngress(*buf), half);
+    EXPECT_EQ(callbacks.headersComplete, streamID / 2);
+    EXPECT_EQ(ingressCodec.onIngress(*tail), tail->length());
+    EXPECT_EQ(callbacks.headersComplete, streamID / 2 + 1);
+    EXPECT_EQ(callbacks.streamErrors, 0);
+    EXPECT_EQ(callbacks.sessionErrors, 0);
+    EXPECT_EQ(callbacks.msg->getHeaders().getSingleOrEmpty("x-fb-random"),
+              value);
+  }
+}
+
 const uint8_t kColonHeaders[] = {
   0x80, 0x03, 0x00, 0x01, 0x48, 0x00, 0x00, 0x1a, 0xf6, 0xf6, 0x1a, 0xb5,
   0x00, 0x00, 0x00, 0x00, 0x17, 0x28, 0x28, 0x53, 0x62, 0x60, 0x60, 0x10,
@@ -1331,3 +1409,120 @@ TEST(SPDYCodecTest, StreamIdOverflow) {
   }
   EXPECT_EQ(streamId, pow(2,31)-3);
 }
+
+TEST(SPDYCodecTest, SmallCompressionWindow) {
+  FakeHTTPCodecCallback callbacks;
+  SPDYCodec egressCodec(TransportDirection::UPSTREAM, SPDYVersion::SPDY3,
+                        Z_DEFAULT_COMPRESSION, 15, 9);
+  SPDYCodec smallEgressCodec(TransportDirection::UPSTREAM, SPDYVersion::SPDY3,
+                             Z_DEFAULT_COMPRESSION, 9, 1);
+  SPDYCodec ingressCodec(TransportDirection::DOWNSTREAM, SPDYVersion::SPDY3);
+  ingressCodec.setCallback(&callbacks);
+  EXPECT_LT(smallEgressCodec.getHeaderCompressionStateSize(),
+            egressCodec.getHeaderCompressionStateSize());
+
+  auto req = getGetRequest();
+  req.getHeaders().add("X-Custom", "Value");
+  auto syn = getSynStream(smallEgressCodec, 1, req);
+  ingressCodec.onIngress(*syn);
+  EXPECT_EQ(callbacks.headersComplete, 1);
+  EXPECT_EQ(callbacks.streamErrors, 0);
+  EXPECT_EQ(callbacks.sessionErrors, 0);
+  CHECK_NOTNULL(callbacks.msg.get());
+  EXPECT_EQ(callbacks.msg->getHeaders().getSingleOrEmpty("X-Custom"),
+            "Value");
+  // Decoding allocated the peer's window
+  EXPECT_GT(ingressCodec.getHeaderCompressionStateSize(), 0);
+}
+
+TEST(SPDYCodecTest, ReleaseIdleMemory) {
+  FakeHTTPCodecCallback callbacks;
+  SPDYCodec egressCodec(TransportDirection::UPSTREAM, SPDYVersion::SPDY3,
+                        Z_DEFAULT_COMPRESSION);
+  SPDYCodec ingressCodec(TransportDirection::DOWNSTREAM, SPDYVersion::SPDY3);
+  ingressCodec.setCallback(&callbacks);
+
+  auto req = getGetRequest();
+  req.getHeaders().add("X-Custom", "Value");
+  auto syn = getSynStream(egressCodec, 1, req);
+  ingressCodec.onIngress(*syn);
+  EXPECT_EQ(callbacks.headersComplete, 1);
+
+  // the compression context goes, the stream goes on with a new one
+  size_t stateSize = egressCodec.getHeaderCompressionStateSize();
+  egressCodec.releaseIdleMemory();
+  EXPECT_LT(egressCodec.getHeaderCompressionStateSize(), stateSize);
+  ingressCodec.releaseIdleMemory();
+  for (HTTPCodec::StreamID id = 3; id <= 5; id += 2) {
+    syn = getSynStream(egressCodec, id, req);
+    ingressCodec.onIngress(*syn);
+  }
+  EXPECT_EQ(callbacks.headersComplete, 3);
+  EXPECT_EQ(callbacks.streamErrors, 0);
+  EXPECT_EQ(callbacks.sessionErrors, 0);
+  CHECK_NOTNULL(callbacks.msg.get());
+  EXPECT_EQ(callbacks.msg->getHeaders().getSingleOrEmpty("X-Custom"),
+            "Value");
+}
+
+// An idle session may release its memory before it sends anything
+TEST(SPDYCodecTest, ReleaseIdleMemoryBeforeFirstHeader) {
+  FakeHTTPCodecCallback callbacks;
+  SPDYCodec egressCodec(TransportDirection::UPSTREAM, SPDYVersion::SPDY3,
+                        Z_DEFAULT_COMPRESSION);
+  SPDYCodec ingressCodec(TransportDirection::DOWNSTREAM, SPDYVersion::SPDY3);
+  ingressCodec.setCallback(&callbacks);
+
+  egressCodec.releaseIdleMemory();
+  ingressCodec.releaseIdleMemory();
+  auto req = getGetRequest();
+  req.getHeaders().add("X-Custom", "Value");
+  for (HTTPCodec::StreamID id = 1; id <= 3; id += 2) {
+    auto syn = getSynStream(egressCodec, id, req);
+    ingressCodec.onIngress(*syn);
+    egressCodec.releaseIdleMemory();
+  }
+  EXPECT_EQ(callbacks.headersComplete, 2);
+  EXPECT_EQ(callbacks.streamErrors, 0);
+  EXPECT_EQ(callbacks.sessionErrors, 0);
+  CHECK_NOTNULL(callbacks.msg.get());
+  EXPECT_EQ(callbacks.msg->getHeaders().getSingleOrEmpty("X-Custom"),
+            "Value");
+}
+
+// Repeated headers apart from each other, and values longer than what the
+// encoder buffers before deflating
+TEST(SPDYCodecTest, HeaderCombinedOutOfOrder) {
+  FakeHTTPCodecCallback callbacks;
+  SPDYCodec egressCodec(TransportDirection::UPSTREAM, SPDYVersion::SPDY3,
+                        Z_DEFAULT_COMPRESSION);
+  SPDYCodec ingressCodec(TransportDirection::DOWNSTREAM, SPDYVersion::SPDY3);
+  ingressCodec.setCallback(&callbacks);
+
+  const std::string kLongValue(10000, 'a');
+  HTTPMessage req;
+  req.setMethod("GET");
+  req.setURL("https://www.foo.com");
+  req.getHeaders().add("X-Repeated", "1");
+  req.getHeaders().set("HOST", "www.foo.com");
+  req.getHeaders().add("X-Long", kLongValue);
+  req.getHeaders().add("X-Repeated", "2");
+  req.getHeaders().add("Accept", "*/*");
+  req.getHeaders().add("X-Repeated", "3");
+  auto syn = getSynStream(egressCodec, 1, req);
+  ingressCodec.onIngress(*syn);
+  EXPECT_EQ(callbacks.headersComplete, 1);
+  EXPECT_EQ(callbacks.streamErrors, 0);
+  EXPECT_EQ(callbacks.sessionErrors, 0);
+  CHECK_NOTNULL(callbacks.msg.get());
+  const auto& headers = callbacks.msg->getHeaders();
+  EXPECT_EQ(headers.getNumberOfValues("X-Repeated"), 3);
+  std::vector<std::string> values;
+  headers.forEachValueOfHeader("X-Repeated", [&] (const std::string& value) {
+      values.push_back(value);
+      return false;
+    });
+  EXPECT_EQ(values, std::vector<std::string>({"1", "2", "3"}));
+  EXPECT_EQ(headers.getSingleOrEmpty("X-Long"), kLongValue);
+  EXPECT_EQ(headers.getSingleOrEmpty(HTTP_HEADER_HOST), "www.foo.com");
+}
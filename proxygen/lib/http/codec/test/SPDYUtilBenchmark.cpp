@@ -0,0 +1,68 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <algorithm>
+#include <folly/Benchmark.h>
+#include <proxygen/lib/http/codec/SPDYUtil.h>
+#include <string>
+#include <vector>
+
+using namespace proxygen;
+
+namespace {
+
+// Header names and values as a browser sends them, with a large cookie
+std::vector<std::pair<std::string, std::string>> makeHeaders() {
+  std::string cookie;
+  for (int i = 0; i < 40; i++) {
+    cookie += "c" + std::to_string(i) + "=AQHxY2Z0bWVzc2FnZXNfc2Vzc2lvbl9pZA; ";
+  }
+  return {
+    {"user-agent", "Mozilla/5.0 (Macintosh; Intel Mac OS X 10_10_3) "
+                   "AppleWebKit/537.36 (KHTML, like Gecko) "
+                   "Chrome/43.0.2357.81 Safari/537.36"},
+    {"accept", "text/html,application/xhtml+xml,application/xml;q=0.9,"
+               "image/webp,*/*;q=0.8"},
+    {"accept-encoding", "gzip, deflate, sdch"},
+    {"accept-language", "en-US,en;q=0.8"},
+    {"referer", "https://www.facebook.com/"},
+    {"cookie", cookie},
+  };
+}
+
+void validate(unsigned iters, SPDYUtil::ScanImpl impl) {
+  std::vector<std::pair<std::string, std::string>> headers;
+  BENCHMARK_SUSPEND {
+    headers = makeHeaders();
+    // runs the best one there is on CPUs without impl
+    SPDYUtil::setScanImpl(std::min(impl, SPDYUtil::getBestScanImpl()));
+  }
+  bool ok = true;
+  for (unsigned i = 0; i < iters; ++i) {
+    for (const auto& header: headers) {
+      ok &= SPDYUtil::validateHeaderName(folly::ByteRange(
+          (const unsigned char*)header.first.data(), header.first.size()));
+      ok &= SPDYUtil::validateHeaderValue(folly::ByteRange(
+          (const unsigned char*)header.second.data(), header.second.size()),
+        SPDYUtil::STRICT);
+    }
+  }
+  folly::doNotOptimizeAway(ok);
+}
+
+}
+
+BENCHMARK_PARAM(validate, SPDYUtil::ScanImpl::SCALAR)
+BENCHMARK_RELATIVE_PARAM(validate, SPDYUtil::ScanImpl::SSE42)
+BENCHMARK_RELATIVE_PARAM(validate, SPDYUtil::ScanImpl::AVX2)
+
+int main(int argc, char* argv[]) {
+  folly::runBenchmarks();
+  return 0;
+}
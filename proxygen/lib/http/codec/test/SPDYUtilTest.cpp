@@ -0,0 +1,106 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <gtest/gtest.h>
+#include <proxygen/lib/http/codec/SPDYUtil.h>
+#include <string>
+#include <vector>
+
+using namespace proxygen;
+
+namespace {
+
+folly::ByteRange range(const std::string& s) {
+  return folly::ByteRange((const unsigned char*)s.data(), s.size());
+}
+
+// The implementations this CPU can run
+std::vector<SPDYUtil::ScanImpl> scanImpls() {
+  std::vector<SPDYUtil::ScanImpl> impls{SPDYUtil::ScanImpl::SCALAR};
+  if (SPDYUtil::getBestScanImpl() >= SPDYUtil::ScanImpl::SSE42) {
+    impls.push_back(SPDYUtil::ScanImpl::SSE42);
+  }
+  if (SPDYUtil::getBestScanImpl() >= SPDYUtil::ScanImpl::AVX2) {
+    impls.push_back(SPDYUtil::ScanImpl::AVX2);
+  }
+  return impls;
+}
+
+}
+
+class SPDYUtilTest : public testing::TestWithParam<SPDYUtil::ScanImpl> {
+ public:
+  void SetUp() override {
+    SPDYUtil::setScanImpl(GetParam());
+  }
+  void TearDown() override {
+    SPDYUtil::setScanImpl(SPDYUtil::getBestScanImpl());
+  }
+};
+
+TEST_P(SPDYUtilTest, every_byte_at_every_position) {
+  // long enough for the vectors and a scalar tail
+  const size_t len = 70;
+  for (size_t pos = 0; pos < len; pos++) {
+    for (int c = 0; c < 256; c++) {
+      std::string s(len, 'a');
+      s[pos] = c;
+      bool tokenChar = c >= 0x80 || SPDYUtil::http_tokens[c] == c;
+      EXPECT_EQ(SPDYUtil::findInvalidNameByte(range(s)),
+                tokenChar ? len : pos);
+      EXPECT_EQ(SPDYUtil::findValueSpecial(range(s)),
+                SPDYUtil::value_specials[c] ? pos : len);
+    }
+  }
+}
+
+TEST_P(SPDYUtilTest, validate_headers) {
+  EXPECT_TRUE(SPDYUtil::validateHeaderName(range("x-forwarded-for")));
+  EXPECT_FALSE(SPDYUtil::validateHeaderName(range("X-Forwarded-For")));
+  EXPECT_FALSE(SPDYUtil::validateHeaderName(range("")));
+  std::string cookie;
+  for (int i = 0; i < 50; i++) {
+    cookie += "name" + std::to_string(i) + "=value; ";
+  }
+  EXPECT_TRUE(SPDYUtil::validateHeaderValue(range(cookie), SPDYUtil::STRICT));
+  EXPECT_FALSE(SPDYUtil::validateHeaderValue(range(cookie + "\r"),
+                                             SPDYUtil::STRICT));
+  EXPECT_TRUE(SPDYUtil::validateHeaderValue(range(cookie + "\r\n x"),
+                                            SPDYUtil::STRICT));
+  EXPECT_FALSE(SPDYUtil::validateHeaderValue(range("\"a\\"),
+                                             SPDYUtil::STRICT));
+}
+
+TEST_P(SPDYUtilTest, lowercase_every_byte_at_every_position) {
+  const size_t len = 70;
+  for (size_t pos = 0; pos < len; pos++) {
+    for (int c = 0; c < 256; c++) {
+      std::string s(len, 'a');
+      s[pos] = c;
+      s[(pos + 7) % len] = 'Q';
+      std::string expected = s;
+      for (auto& e : expected) {
+        e = (e >= 'A' && e <= 'Z') ? e + 'a' - 'A' : e;
+      }
+      std::string out(len, '\0');
+      bool valid = SPDYUtil::lowercaseHeaderName(range(s),
+                                                 (uint8_t*)&out[0]);
+      EXPECT_EQ(out, expected);
+      EXPECT_EQ(valid, SPDYUtil::validateHeaderName(range(expected)));
+    }
+  }
+  std::string name = "X-Forwarded-For";
+  EXPECT_TRUE(SPDYUtil::lowercaseHeaderName(name));
+  EXPECT_EQ(name, "x-forwarded-for");
+  std::string empty;
+  EXPECT_FALSE(SPDYUtil::lowercaseHeaderName(empty));
+}
+
+INSTANTIATE_TEST_CASE_P(ScanImpls, SPDYUtilTest,
+                        testing::ValuesIn(scanImpls()));
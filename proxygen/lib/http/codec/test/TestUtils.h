@@ -144,6 +144,11 @@ class FakeHTTPCodecCallback : public HTTPCodec::Callback {
     settingsAcks++;
   }
 
+  void onAltSvc(HTTPCodec::StreamID stream, const AltSvc& alt) override {
+    altSvcs++;
+    altSvc = alt;
+  }
+
   uint32_t numOutgoingStreams() const override {
     return 0;
   }
@@ -198,6 +203,8 @@ class FakeHTTPCodecCallback : public HTTPCodec::Callback {
     windowUpdateCalls = 0;
     settings = 0;
     settingsAcks = 0;
+    altSvcs = 0;
+    altSvc = AltSvc();
     windowSize = 0;
     maxStreams = 0;
     windowUpdates.clear();
@@ -224,6 +231,8 @@ class FakeHTTPCodecCallback : public HTTPCodec::Callback {
   uint32_t windowUpdateCalls{0};
   uint32_t settings{0};
   uint32_t settingsAcks{0};
+  uint32_t altSvcs{0};
+  AltSvc altSvc;
   uint32_t windowSize{0};
   uint32_t maxStreams{0};
   std::map<uint32_t, std::vector<uint32_t> > windowUpdates;
@@ -0,0 +1,325 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/io/Cursor.h>
+#include <gtest/gtest.h>
+#include <proxygen/lib/http/codec/WebSocketCodec.h>
+
+using namespace folly;
+using namespace proxygen;
+using namespace std;
+
+namespace {
+
+class WebSocketCallback: public WebSocketCodec::Callback {
+ public:
+  void onMessage(WebSocketCodec::Opcode opcode,
+                 unique_ptr<IOBuf> payload) override {
+    opcodes.push_back(opcode);
+    messages.push_back(payload->moveToFbString().toStdString());
+  }
+  void onPing(unique_ptr<IOBuf> payload) override {
+    pings.push_back(payload->moveToFbString().toStdString());
+  }
+  void onClose(uint16_t code, StringPiece reason) override {
+    closeCode = code;
+    closeReason = reason.str();
+  }
+  void onError(uint16_t code, const string& reason) override {
+    errorCode = code;
+  }
+
+  vector<WebSocketCodec::Opcode> opcodes;
+  vector<string> messages;
+  vector<string> pings;
+  uint16_t closeCode{0};
+  string closeReason;
+  uint16_t errorCode{0};
+};
+
+class WebSocketCodecTest: public testing::Test {
+ public:
+  WebSocketCodecTest()
+      : client_(TransportDirection::UPSTREAM),
+        server_(TransportDirection::DOWNSTREAM) {
+    client_.setCallback(&clientCallback_);
+    server_.setCallback(&serverCallback_);
+  }
+
+  // Feed what the client wrote to the server, chunk bytes at a time
+  void clientToServer(size_t chunk = 0) {
+    auto bytes = output_.move();
+    if (!bytes) {
+      return;
+    }
+    if (chunk == 0) {
+      server_.onIngress(std::move(bytes));
+      return;
+    }
+    io::Cursor cursor(bytes.get());
+    while (!cursor.isAtEnd()) {
+      unique_ptr<IOBuf> piece;
+      cursor.clone(piece, std::min(chunk, cursor.totalLength()));
+      server_.onIngress(std::move(piece));
+    }
+  }
+
+ protected:
+  WebSocketCodec client_;
+  WebSocketCodec server_;
+  WebSocketCallback clientCallback_;
+  WebSocketCallback serverCallback_;
+  IOBufQueue output_{IOBufQueue::cacheChainLength()};
+};
+
+unique_ptr<IOBuf> makeBuf(const vector<uint8_t>& bytes) {
+  return IOBuf::copyBuffer(bytes.data(), bytes.size());
+}
+
+}
+
+TEST(WebSocketCodec, accept) {
+  // RFC 6455 1.3
+  EXPECT_EQ("s3pPLMBiTxaQ9kGWRoHzxOo+xOo=",
+            WebSocketCodec::computeAccept("dGhlIHNhbXBsZSBub25jZQ=="));
+}
+
+TEST(WebSocketCodec, applyMask) {
+  const uint8_t mask[4] = { 0x37, 0xfa, 0x21, 0x3d };
+  for (size_t len : { 0, 1, 7, 8, 15, 16, 17, 33, 100 }) {
+    for (size_t offset = 0; offset < 4; ++offset) {
+      vector<uint8_t> data(len), expected(len);
+      for (size_t i = 0; i < len; ++i) {
+        data[i] = i * 7;
+        expected[i] = data[i] ^ mask[(offset + i) % 4];
+      }
+      WebSocketCodec::applyMask(data.data(), len, mask, offset);
+      EXPECT_EQ(expected, data) << len << " " << offset;
+    }
+  }
+}
+
+TEST(WebSocketCodec, utf8) {
+  EXPECT_TRUE(WebSocketCodec::isValidUTF8(*IOBuf::copyBuffer(
+    "plain ASCII, and some more to fill words")));
+  EXPECT_TRUE(WebSocketCodec::isValidUTF8(*IOBuf::copyBuffer(
+    "\xce\xba\xe1\xbd\xb9\xcf\x83\xce\xbc\xce\xb5")));
+  // Overlong, surrogate, truncated
+  EXPECT_FALSE(WebSocketCodec::isValidUTF8(*IOBuf::copyBuffer("\xc0\xaf")));
+  EXPECT_FALSE(WebSocketCodec::isValidUTF8(
+                 *IOBuf::copyBuffer("\xed\xa0\x80")));
+  EXPECT_FALSE(WebSocketCodec::isValidUTF8(*IOBuf::copyBuffer("ab\xce")));
+
+  // A code point split between buffers
+  auto chain = IOBuf::copyBuffer("x\xe1\xbd");
+  chain->prependChain(IOBuf::copyBuffer("\xb9y"));
+  EXPECT_TRUE(WebSocketCodec::isValidUTF8(*chain));
+}
+
+TEST(WebSocketCodec, rfcExamples) {
+  // RFC 6455 5.7: an unmasked "Hello" to a client, then the same masked
+  // to a server, in two fragments
+  WebSocketCallback callback;
+  WebSocketCodec client(TransportDirection::UPSTREAM);
+  client.setCallback(&callback);
+  client.onIngress(makeBuf({ 0x81, 0x05, 0x48, 0x65, 0x6c, 0x6c, 0x6f }));
+  ASSERT_EQ(1, callback.messages.size());
+  EXPECT_EQ("Hello", callback.messages[0]);
+
+  WebSocketCodec server(TransportDirection::DOWNSTREAM);
+  server.setCallback(&callback);
+  server.onIngress(makeBuf({ 0x01, 0x83, 0x37, 0xfa, 0x21, 0x3d,
+                             0x7f, 0x9f, 0x4d }));
+  server.onIngress(makeBuf({ 0x80, 0x82, 0x37, 0xfa, 0x21, 0x3d,
+                             0x5b, 0x63 }));
+  ASSERT_EQ(2, callback.messages.size());
+  EXPECT_EQ("Hello", callback.messages[1]);
+  EXPECT_EQ(0, callback.errorCode);
+}
+
+TEST(WebSocketCodec, rfcDeflateExample) {
+  // RFC 7692 7.2.3.1
+  WebSocketCallback callback;
+  WebSocketCodec client(TransportDirection::UPSTREAM);
+  client.setCallback(&callback);
+  WebSocketCodec::DeflateOptions options;
+  options.enabled = true;
+  client.setDeflateOptions(options);
+  client.onIngress(makeBuf({ 0xc1, 0x07, 0xf2, 0x48, 0xcd, 0xc9, 0xc9,
+                             0x07, 0x00 }));
+  ASSERT_EQ(1, callback.messages.size());
+  EXPECT_EQ("Hello", callback.messages[0]);
+}
+
+TEST_F(WebSocketCodecTest, messages) {
+  string large(70000, 'a');
+  client_.generateMessage(output_, WebSocketCodec::Opcode::TEXT,
+                          IOBuf::copyBuffer("first"));
+  client_.generateMessage(output_, WebSocketCodec::Opcode::BINARY,
+                          IOBuf::copyBuffer(large));
+  client_.generateMessage(output_, WebSocketCodec::Opcode::TEXT, nullptr);
+  clientToServer(3);
+
+  ASSERT_EQ(3, serverCallback_.messages.size());
+  EXPECT_EQ(WebSocketCodec::Opcode::TEXT, serverCallback_.opcodes[0]);
+  EXPECT_EQ("first", serverCallback_.messages[0]);
+  EXPECT_EQ(WebSocketCodec::Opcode::BINARY, serverCallback_.opcodes[1]);
+  EXPECT_EQ(large, serverCallback_.messages[1]);
+  EXPECT_EQ("", serverCallback_.messages[2]);
+
+  server_.generateMessage(output_, WebSocketCodec::Opcode::TEXT,
+                          IOBuf::copyBuffer("reply"));
+  client_.onIngress(output_.move());
+  ASSERT_EQ(1, clientCallback_.messages.size());
+  EXPECT_EQ("reply", clientCallback_.messages[0]);
+}
+
+TEST_F(WebSocketCodecTest, fragments) {
+  client_.setMaxEgressFrameSize(10);
+  server_.setMaxMessageSize(100);
+  string text(95, 'x');
+  client_.generateMessage(output_, WebSocketCodec::Opcode::TEXT,
+                          IOBuf::copyBuffer(text));
+  // Control frames may come between fragments
+  auto bytes = output_.move();
+  io::Cursor cursor(bytes.get());
+  unique_ptr<IOBuf> firstFragment;
+  cursor.clone(firstFragment, 2 + 4 + 10);
+  unique_ptr<IOBuf> rest;
+  cursor.clone(rest, cursor.totalLength());
+  server_.onIngress(std::move(firstFragment));
+  client_.generatePing(output_, IOBuf::copyBuffer("ping"));
+  clientToServer();
+  server_.onIngress(std::move(rest));
+
+  ASSERT_EQ(1, serverCallback_.pings.size());
+  EXPECT_EQ("ping", serverCallback_.pings[0]);
+  ASSERT_EQ(1, serverCallback_.messages.size());
+  EXPECT_EQ(text, serverCallback_.messages[0]);
+
+  client_.generateMessage(output_, WebSocketCodec::Opcode::TEXT,
+                          IOBuf::copyBuffer(string(101, 'x')));
+  clientToServer();
+  EXPECT_EQ(WebSocketCodec::kCloseTooBig, serverCallback_.errorCode);
+}
+
+TEST_F(WebSocketCodecTest, deflate) {
+  WebSocketCodec::DeflateOptions options;
+  string response = WebSocketCodec::negotiateDeflate(
+    "x-unknown, permessage-deflate; client_max_window_bits; "
+    "server_max_window_bits=10", options);
+  EXPECT_EQ("permessage-deflate; server_max_window_bits=10", response);
+  EXPECT_TRUE(options.enabled);
+  EXPECT_EQ(10, options.windowBits);
+  client_.setDeflateOptions(options);
+  server_.setDeflateOptions(options);
+  client_.setMaxEgressFrameSize(16);
+
+  // The second message deflates against the first
+  string text(1000, 'z');
+  for (int i = 0; i < 2; ++i) {
+    client_.generateMessage(output_, WebSocketCodec::Opcode::TEXT,
+                            IOBuf::copyBuffer(text));
+    EXPECT_LT(output_.chainLength(), 100u);
+    clientToServer(5);
+  }
+  ASSERT_EQ(2, serverCallback_.messages.size());
+  EXPECT_EQ(text, serverCallback_.messages[0]);
+  EXPECT_EQ(text, serverCallback_.messages[1]);
+  EXPECT_EQ(0, serverCallback_.errorCode);
+
+  // Too small to compress
+  server_.generateMessage(output_, WebSocketCodec::Opcode::TEXT,
+                          IOBuf::copyBuffer("short"));
+  EXPECT_EQ(0x81, output_.front()->data()[0]);
+  client_.onIngress(output_.move());
+  ASSERT_EQ(1, clientCallback_.messages.size());
+  EXPECT_EQ("short", clientCallback_.messages[0]);
+}
+
+TEST(WebSocketCodec, negotiateDeflate) {
+  WebSocketCodec::DeflateOptions options;
+  EXPECT_EQ("", WebSocketCodec::negotiateDeflate("x-webkit-deflate-frame",
+                                                 options));
+  EXPECT_FALSE(options.enabled);
+  // Unknown parameters, and windows zlib won't do, decline the offer
+  EXPECT_EQ("", WebSocketCodec::negotiateDeflate(
+              "permessage-deflate; bogus, "
+              "permessage-deflate; server_max_window_bits=8", options));
+  EXPECT_FALSE(options.enabled);
+  EXPECT_EQ("permessage-deflate; server_no_context_takeover",
+            WebSocketCodec::negotiateDeflate(
+              "permessage-deflate; server_max_window_bits=16, "
+              "permessage-deflate ; server_no_context_takeover", options));
+  EXPECT_TRUE(options.enabled);
+  EXPECT_TRUE(options.noContextTakeover);
+}
+
+TEST_F(WebSocketCodecTest, close) {
+  client_.generateClose(output_, WebSocketCodec::kCloseGoingAway, "bye");
+  clientToServer(1);
+  EXPECT_EQ(WebSocketCodec::kCloseGoingAway, serverCallback_.closeCode);
+  EXPECT_EQ("bye", serverCallback_.closeReason);
+
+  server_.generateClose(output_, WebSocketCodec::kCloseNoStatus);
+  EXPECT_EQ(2, output_.chainLength());
+  client_.onIngress(output_.move());
+  EXPECT_EQ(WebSocketCodec::kCloseNoStatus, clientCallback_.closeCode);
+}
+
+// A reason too long for the frame is cut where no code point is split
+TEST_F(WebSocketCodecTest, closeReasonTruncated) {
+  const string prefix(WebSocketCodec::kMaxControlPayload - 3, 'a');
+  client_.generateClose(output_, WebSocketCodec::kCloseNormal,
+                        prefix + "\xe2\x82\xac");
+  clientToServer(1);
+  EXPECT_FALSE(server_.hasError());
+  EXPECT_EQ(prefix, serverCallback_.closeReason);
+
+  const string ascii(WebSocketCodec::kMaxControlPayload * 2, 'b');
+  server_.generateClose(output_, WebSocketCodec::kCloseNormal, ascii);
+  client_.onIngress(output_.move());
+  EXPECT_EQ(ascii.substr(0, WebSocketCodec::kMaxControlPayload - 2),
+            clientCallback_.closeReason);
+}
+
+TEST_F(WebSocketCodecTest, errors) {
+  // Unmasked frames to a server
+  server_.generateMessage(output_, WebSocketCodec::Opcode::TEXT,
+                          IOBuf::copyBuffer("hi"));
+  client_.generateMessage(output_, WebSocketCodec::Opcode::TEXT,
+                          IOBuf::copyBuffer("dropped"));
+  clientToServer();
+  EXPECT_EQ(WebSocketCodec::kCloseProtocolError, serverCallback_.errorCode);
+  EXPECT_TRUE(server_.hasError());
+  EXPECT_TRUE(serverCallback_.messages.empty());
+
+  // Invalid UTF-8, a CONTINUATION out of nowhere, RSV1 with no
+  // permessage-deflate, and a PING too long
+  const vector<vector<uint8_t>> frames = {
+    { 0x81, 0x02, 0xc0, 0xaf },
+    { 0x80, 0x01, 0x61 },
+    { 0xc1, 0x01, 0x61 },
+    { 0x89, 0x7e, 0x00, 0x7e },
+  };
+  const uint16_t codes[] = {
+    WebSocketCodec::kCloseInvalidData,
+    WebSocketCodec::kCloseProtocolError,
+    WebSocketCodec::kCloseProtocolError,
+    WebSocketCodec::kCloseProtocolError,
+  };
+  for (size_t i = 0; i < frames.size(); ++i) {
+    WebSocketCallback callback;
+    WebSocketCodec client(TransportDirection::UPSTREAM);
+    client.setCallback(&callback);
+    client.onIngress(makeBuf(frames[i]));
+    EXPECT_EQ(codes[i], callback.errorCode) << i;
+    EXPECT_TRUE(callback.messages.empty());
+  }
+}
@@ -32,6 +32,7 @@ cat ${HEADERS_LIST?} | sort | uniq \
     for (i in n) {
       h = n[i];
       gsub("-", "_", h);
+      sub("^:", "COLON_", h);
       print n[i] ", HTTP_HEADER_" toupper(h)
     };
     print "%%";
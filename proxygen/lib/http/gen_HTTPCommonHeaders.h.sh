@@ -12,6 +12,7 @@ cat ${HEADERS_LIST?} | sort | uniq \
     for (i in n) {
       h = n[i];
       gsub("-", "_", h);
+      sub("^:", "COLON_", h);
       print "  HTTP_HEADER_" toupper(h) " = " i+1 ","
     };
     next
@@ -135,19 +135,41 @@ void ByteEventTracker::addPingByteEvent(size_t pingSize,
 
 uint64_t ByteEventTracker::preSend(bool* cork,
                                    bool* eom,
-                                   uint64_t bytesWritten) {
+                                   uint64_t bytesScheduled) {
+  // With more than one write in flight, nextLastByteEvent_ may already have
+  // been handed to the transport. Skip ahead to the first LAST_BYTE event
+  // that still lies beyond the scheduled bytes.
+  if (nextLastByteEvent_ &&
+      nextLastByteEvent_->byteOffset_ <= bytesScheduled) {
+    auto it = byteEvents_.iterator_to(*nextLastByteEvent_);
+    nextLastByteEvent_ = nullptr;
+    for (; it != byteEvents_.end(); ++it) {
+      if (it->eventType_ == ByteEvent::LAST_BYTE &&
+          it->byteOffset_ > bytesScheduled) {
+        nextLastByteEvent_ = &(*it);
+        break;
+      }
+    }
+  }
   if (nextLastByteEvent_) {
     uint64_t nextLastByteNo = nextLastByteEvent_->byteOffset_;
-    CHECK(nextLastByteNo > bytesWritten);
-    uint64_t needed = nextLastByteNo - bytesWritten;
+    CHECK(nextLastByteNo > bytesScheduled);
+    uint64_t needed = nextLastByteNo - bytesScheduled;
     VLOG(5) << "needed: " << needed << "(" << nextLastByteNo << "-"
-            << bytesWritten << ")";
+            << bytesScheduled << ")";
 
     return needed;
   }
   return 0;
 }
 
+void ByteEventTracker::onAckLatencyEvent(const AckLatencyEvent& event) {
+  if (ttlbaStats_) {
+    ttlbaStats_->recordTTLBALatency(
+      std::chrono::duration_cast<std::chrono::milliseconds>(event.latency));
+  }
+}
+
 void ByteEventTracker::addFirstBodyByteEvent(uint64_t offset,
                                              HTTPTransaction* txn) {
   byteEvents_.push_back(
@@ -51,9 +51,10 @@ class ByteEventTracker {
                                 bool eorTrackingEnabled) noexcept;
 
   /**
-   * Returns the number of bytes needed or 0 when there's nothing to do.
+   * Returns the number of bytes needed beyond bytesScheduled to reach the
+   * next last byte event, or 0 when there's nothing to do.
    */
-  virtual uint64_t preSend(bool* cork, bool* eom, uint64_t bytesWritten);
+  virtual uint64_t preSend(bool* cork, bool* eom, uint64_t bytesScheduled);
 
   virtual void addAckToLastByteEvent(HTTPTransaction* txn,
                                      const ByteEvent& lastByteEvent,
@@ -67,9 +68,20 @@ class ByteEventTracker {
     AsyncTimeoutSet* ackLatencyTimeouts,
     folly::AsyncTransportWrapper* transport) { return false; }
 
-  virtual void setTTLBAStats(TTLBAStats* stats) {}
+  virtual void setTTLBAStats(TTLBAStats* stats) {
+    ttlbaStats_ = stats;
+  }
 
-  virtual void onAckLatencyEvent(const AckLatencyEvent&) {}
+  /**
+   * Whether the session may move to another EventBase with its events,
+   * see HTTPSession::detachEventBase(): once all of its events are done.
+   * Trackers with timeouts of their own, which can't move, override this.
+   */
+  virtual bool isDetachable() const {
+    return byteEvents_.empty();
+  }
+
+  virtual void onAckLatencyEvent(const AckLatencyEvent& event);
 
  private:
   // byteEvents_ is in the ascending order of ByteEvent::byteOffset_
@@ -79,6 +91,7 @@ class ByteEventTracker {
   Callback* callback_;
 
   ByteEvent* nextLastByteEvent_{nullptr};
+  TTLBAStats* ttlbaStats_{nullptr};
 };
 
 } // proxygen
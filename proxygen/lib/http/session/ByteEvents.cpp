@@ -10,6 +10,7 @@
 #include <proxygen/lib/http/session/ByteEvents.h>
 
 #include <proxygen/lib/utils/Time.h>
+#include <type_traits>
 
 namespace proxygen {
 
@@ -20,6 +21,40 @@ const char* const kTypeStrings[] =  {
   "FIRST_HEADER_BYTE",
 };
 
+namespace {
+
+union ByteEventSlot {
+  std::aligned_storage<sizeof(TransactionByteEvent),
+                       alignof(TransactionByteEvent)>::type transaction;
+  std::aligned_storage<sizeof(AckByteEvent),
+                       alignof(AckByteEvent)>::type ack;
+  std::aligned_storage<sizeof(PingByteEvent),
+                       alignof(PingByteEvent)>::type ping;
+};
+
+typedef ThreadLocalFreeList<ByteEventSlot> ByteEventFreeList;
+
+}
+
+void* ByteEvent::operator new(size_t size) {
+  if (size > sizeof(ByteEventSlot)) {
+    return ::operator new(size);
+  }
+  return ByteEventFreeList::allocate();
+}
+
+void ByteEvent::operator delete(void* p, size_t size) {
+  if (size > sizeof(ByteEventSlot)) {
+    ::operator delete(p);
+    return;
+  }
+  ByteEventFreeList::deallocate(p);
+}
+
+PoolCounts ByteEvent::takePoolCounts() {
+  return ByteEventFreeList::takeCounts();
+}
+
 std::ostream& operator<<(std::ostream& os, const ByteEvent& be) {
   os << folly::to<std::string>(
     "(", kTypeStrings[be.eventType_], ", ", be.byteOffset_, ")");
@@ -12,6 +12,7 @@
 #include <folly/IntrusiveList.h>
 #include <proxygen/lib/http/session/HTTPTransaction.h>
 #include <proxygen/lib/utils/AsyncTimeoutSet.h>
+#include <proxygen/lib/utils/ThreadLocalFreeList.h>
 #include <proxygen/lib/utils/Time.h>
 
 namespace proxygen {
@@ -31,6 +32,16 @@ class ByteEvent {
   virtual HTTPTransaction* getTransaction() { return nullptr; }
   virtual int64_t getLatency() { return -1; }
 
+  /**
+   * Events of every type get their memory from one ThreadLocalFreeList of
+   * slots that fit any of them, as sessions add several per response.
+   */
+  static void* operator new(size_t size);
+  static void operator delete(void* p, size_t size);
+
+  // The counts of the pool of the current thread since the last call
+  static PoolCounts takePoolCounts();
+
   folly::IntrusiveListHook listHook;
   EventType eventType_:3; // packed w/ byteOffset_
   size_t eomTracked_:1;
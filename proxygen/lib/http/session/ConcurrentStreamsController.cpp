@@ -0,0 +1,45 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/http/session/ConcurrentStreamsController.h>
+
+#include <algorithm>
+#include <glog/logging.h>
+
+namespace proxygen {
+
+ConcurrentStreamsController::ConcurrentStreamsController(
+  const Options& options):
+    options_(options),
+    limit_(options.maxLimit) {
+  CHECK_LE(options_.minLimit, options_.maxLimit);
+  CHECK(options_.backoffRatio > 0 && options_.backoffRatio < 1);
+}
+
+uint32_t ConcurrentStreamsController::update(
+    std::chrono::microseconds loopLag, size_t transactions) {
+  auto oldLimit = limit_;
+  if (loopLag > options_.maxLoopLag ||
+      transactions > options_.maxTransactions) {
+    limit_ = std::max(options_.minLimit,
+                      uint32_t(limit_ * options_.backoffRatio));
+  } else {
+    limit_ = uint32_t(std::min<uint64_t>(
+                        options_.maxLimit,
+                        uint64_t(limit_) + options_.increment));
+  }
+  if (limit_ != oldLimit) {
+    VLOG(3) << "Concurrent streams limit " << oldLimit << " -> " << limit_
+            << ", loop lag=" << loopLag.count() << "us, transactions="
+            << transactions;
+  }
+  return limit_;
+}
+
+}
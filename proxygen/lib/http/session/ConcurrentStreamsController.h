@@ -0,0 +1,61 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <chrono>
+#include <inttypes.h>
+#include <stddef.h>
+
+namespace proxygen {
+
+/**
+ * Picks the SETTINGS_MAX_CONCURRENT_STREAMS that the sessions of a worker
+ * advertise from how loaded the worker is, so that under overload the
+ * clients hold back their requests instead of us queueing them.
+ *
+ * The limit adapts the way TCP congestion windows do (AIMD): on each
+ * update it shrinks by backoffRatio, down to minLimit, while the event
+ * loop lags by more than maxLoopLag or more than maxTransactions are open,
+ * and otherwise grows by increment, up to maxLimit.
+ *
+ * See HTTPSessionAcceptor::setConcurrentStreamsControl().
+ */
+class ConcurrentStreamsController {
+ public:
+  struct Options {
+    uint32_t minLimit{10};
+    uint32_t maxLimit{100};
+    uint32_t increment{10};
+    double backoffRatio{0.5};
+    std::chrono::milliseconds maxLoopLag{100};
+    size_t maxTransactions{10000};
+  };
+
+  explicit ConcurrentStreamsController(const Options& options);
+
+  /**
+   * Adjust the limit to the load, and return it
+   */
+  uint32_t update(std::chrono::microseconds loopLag, size_t transactions);
+
+  uint32_t getLimit() const {
+    return limit_;
+  }
+
+  const Options& getOptions() const {
+    return options_;
+  }
+
+ private:
+  const Options options_;
+  uint32_t limit_;
+};
+
+}
@@ -12,8 +12,205 @@
 
 namespace proxygen {
 
-int foo() {
-  return 0;
+void HTTP2PriorityQueue::Node::addChild(Node* child, bool exclusive) {
+  if (exclusive) {
+    // this->children become new node's children
+    moveChildrenTo(child);
+  }
+  addChild(child);
+}
+
+void HTTP2PriorityQueue::Node::reparent(Node* newParent, bool exclusive) {
+  parent_->detachChild(this);
+  newParent->addChild(this, exclusive);
+}
+
+void HTTP2PriorityQueue::Node::signalPendingEgress() {
+  bool wasActive = isActive();
+  enqueued_ = true;
+  if (!wasActive && parent_) {
+    parent_->activateChild(this);
+  }
+}
+
+void HTTP2PriorityQueue::Node::clearPendingEgress() {
+  CHECK(enqueued_);
+  enqueued_ = false;
+  if (!isActive() && parent_) {
+    parent_->deactivateChild(this);
+  }
+}
+
+void HTTP2PriorityQueue::Node::removeFromTree() {
+  // move my children to my parent
+  moveChildrenTo(parent_);
+  parent_->detachChild(this);
+}
+
+HTTP2PriorityQueue::Node* HTTP2PriorityQueue::Node::nextEgress() {
+  Node* node = this;
+  // A node with egress of its own goes before its descendants; otherwise
+  // the active child at the front of the round robin takes its turn
+  while (!(node->enqueued_ && node->parent_)) {
+    if (node->activeChildren_.empty()) {
+      return nullptr;
+    }
+    node = &node->activeChildren_.front();
+  }
+  return node;
+}
+
+void HTTP2PriorityQueue::Node::consumed(uint64_t bytes) {
+  for (Node* node = this; node->parent_; node = node->parent_) {
+    node->credit_ -= bytes;
+    if (node->credit_ > 0) {
+      continue;
+    }
+    while (node->credit_ <= 0) {
+      node->credit_ += node->quantum();
+    }
+    if (node->activeHook_.is_linked()) {
+      // turn is over, go to the back of the line
+      node->activeHook_.unlink();
+      node->parent_->activeChildren_.push_back(*node);
+    }
+  }
+}
+
+bool HTTP2PriorityQueue::Node::iterate(
+  const std::function<bool(HTTPCodec::StreamID,
+                           HTTPTransaction *, double)>& fn,
+  const std::function<bool()>& stopFn, bool all) {
+  bool stop = false;
+  if (stopFn()) {
+    return true;
+  }
+  if (parent_ /* exclude root */  && (all || isEnqueued())) {
+    stop = fn(id_, txn_, (double)weight_ / parent_->totalChildWeight_);
+  }
+  for (auto& child: children_) {
+    if (stop || stopFn()) {
+      return true;
+    }
+    stop = child.iterate(fn, stopFn, all);
+  }
+  return stop;
+}
+
+bool HTTP2PriorityQueue::Node::visitBFS(
+  const std::function<bool(HTTPCodec::StreamID,
+                           HTTPTransaction *, double)>& fn,
+  bool all, std::list<Node*>& pendingNodes) {
+  bool stop = false;
+  if (parent_ != nullptr && (all || isEnqueued())) {
+    stop = fn(id_, txn_, (double)weight_ / parent_->totalChildWeight_);
+  }
+  if (stop) {
+    return true;
+  }
+  for (auto& child: children_) {
+    pendingNodes.push_back(&child);
+  }
+  return false;
+}
+
+void HTTP2PriorityQueue::Node::addChild(Node* child) {
+  DCHECK(!child->siblingHook_.is_linked());
+  child->parent_ = this;
+  totalChildWeight_ += child->weight_;
+  children_.push_back(*child);
+  if (child->isActive()) {
+    activateChild(child);
+  }
+}
+
+void HTTP2PriorityQueue::Node::detachChild(Node* child) {
+  CHECK_EQ(child->parent_, this) << "Detach non-child id=" << child->id_;
+  if (child->activeHook_.is_linked()) {
+    deactivateChild(child);
+  }
+  totalChildWeight_ -= child->weight_;
+  child->siblingHook_.unlink();
+  child->parent_ = nullptr;
+}
+
+void HTTP2PriorityQueue::Node::moveChildrenTo(Node* newParent) {
+  while (!children_.empty()) {
+    Node* child = &children_.front();
+    detachChild(child);
+    newParent->addChild(child);
+  }
+}
+
+void HTTP2PriorityQueue::Node::activateChild(Node* child) {
+  DCHECK(!child->activeHook_.is_linked());
+  bool wasActive = isActive();
+  activeChildren_.push_back(*child);
+  child->credit_ = child->quantum();
+  if (!wasActive && parent_) {
+    parent_->activateChild(this);
+  }
+}
+
+void HTTP2PriorityQueue::Node::deactivateChild(Node* child) {
+  DCHECK(child->activeHook_.is_linked());
+  child->activeHook_.unlink();
+  if (!isActive() && parent_) {
+    parent_->deactivateChild(this);
+  }
+}
+
+HTTP2PriorityQueue::Handle
+HTTP2PriorityQueue::addTransaction(HTTPCodec::StreamID id,
+                                   http2::PriorityUpdate pri,
+                                   HTTPTransaction *txn) {
+  CHECK(id != 0);
+
+  Node* parent = &root_;
+  if (pri.streamDependency != 0) {
+    Node* dep = find(pri.streamDependency);
+    if (dep == nullptr) {
+      // specified a missing parent (timed out an idle node)?
+      LOG(INFO) << "assigning default priority to txn=" << id;
+    } else {
+      parent = dep;
+    }
+  }
+  // created detached: addChild() links it once it has adopted any siblings
+  auto result = nodes_.emplace(id, nullptr, id, pri.weight, txn);
+  CHECK(result.second) << "Duplicate priority node id=" << id;
+  parent->addChild(result.first, pri.exclusive);
+  return result.first;
+}
+
+HTTP2PriorityQueue::Handle
+HTTP2PriorityQueue::updatePriority(Handle handle, http2::PriorityUpdate pri) {
+  Node& node = *handle;
+  node.updateWeight(pri.weight);
+  if (pri.streamDependency == node.parentID() && !pri.exclusive) {
+    // no move
+    return handle;
+  }
+
+  Node* newParent = find(pri.streamDependency);
+  if (!newParent || newParent == &node) {
+    newParent = &root_;
+  }
+
+  if (newParent->isDescendantOf(&node)) {
+    newParent->reparent(node.parent(), false);
+  }
+  node.reparent(newParent, pri.exclusive);
+  return handle;
+}
+
+void HTTP2PriorityQueue::removeTransaction(Handle handle) {
+  // TODO: or require the node to do it?
+  if (handle->hasPendingEgress()) {
+    clearPendingEgress(handle);
+  }
+  handle->removeFromTree();
+  nodes_.erase(handle->getID());
 }
 
 }
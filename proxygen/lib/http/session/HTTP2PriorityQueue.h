@@ -9,14 +9,35 @@
  */
 #pragma once
 
+#include <folly/IntrusiveList.h>
+#include <glog/logging.h>
+#include <functional>
 #include <proxygen/lib/http/codec/HTTPCodec.h>
-#include <proxygen/lib/http/session/HTTPTransaction.h>
 #include <proxygen/lib/http/codec/experimental/HTTP2Framer.h>
+#include <proxygen/lib/http/session/StreamTable.h>
 
 #include <list>
 
 namespace proxygen {
 
+class HTTPTransaction;
+
+/**
+ * RFC 7540 priority tree, used as an egress scheduler.
+ *
+ * Besides the dependency tree, every node keeps the list of its children
+ * that have pending egress themselves or somewhere below them. That makes
+ * finding the next stream to serve O(depth) rather than a walk over the
+ * whole tree: a stream with pending egress is served before its
+ * descendants, and siblings take turns in deficit round robin order, each
+ * turn being worth (weight + 1) * kBytesPerWeight body bytes, so bandwidth
+ * is shared in proportion to weight.
+ *
+ * Nodes live in a StreamTable, which indexes them by stream ID and
+ * recycles their storage, and the tree itself is made of intrusive lists,
+ * so adding, removing and re-parenting streams does not allocate once the
+ * table has grown to the session's working set.
+ */
 class HTTP2PriorityQueue {
 
  private:
@@ -24,43 +45,24 @@ class HTTP2PriorityQueue {
 
  public:
 
-  typedef std::list<Node>::iterator Handle;
+  typedef Node* Handle;
+
+  // Body bytes per unit of weight a node may send before its siblings get
+  // a turn. The default weight of 16 gets a little over 4KB.
+  static const uint32_t kBytesPerWeight = 256;
 
  private:
 
   class Node {
    public:
     Node(Node* parent, HTTPCodec::StreamID id,
-         uint32_t weight, HTTPTransaction *txn)
+         uint8_t weight, HTTPTransaction *txn)
       : parent_(parent),
         id_(id),
         weight_(weight),
         txn_(txn) {
     }
 
-    Node(Node* parent, HTTPCodec::StreamID id,
-         uint32_t weight, HTTPTransaction *txn,
-         std::list<Node>&& children)
-      : parent_(parent),
-        id_(id),
-        weight_(weight),
-        txn_(txn),
-        children_(std::move(children)) {
-      // update children to point to new parent
-      for (auto& child: children_) {
-        child.parent_ = this;
-        totalChildWeight_ += child.weight_;
-      }
-    }
-
-    void addChildren(std::list<Node>&& children) {
-      for (auto& child: children) {
-        children_.emplace_back(this, child.id_, child.weight_, child.txn_,
-                               std::move(child.children_));
-        totalChildWeight_ += child.weight_;
-      }
-    }
-
     Node* parent() const {
       return parent_;
     }
@@ -72,56 +74,20 @@ class HTTP2PriorityQueue {
       return 0;
     }
 
-    Handle lastChild() {
-      auto it = children_.rbegin();
-      it++;
-      Handle result = it.base();
-      return result;
-    }
-
-    // Add a new node as a child of this node
-    Handle emplaceNode(HTTPCodec::StreamID id, uint32_t weight,
-                       HTTPTransaction* txn, bool exclusive,
-                       std::list<Node>&& nodeChildren) {
-      std::list<Node> children;
-      if (exclusive) {
-        // this->children become new node's children
-        std::swap(children, children_);
-        totalChildWeight_ = 0;
-      }
-      children_.emplace_back(this, id, weight, txn, std::move(nodeChildren));
-      Handle result = lastChild();
-      result->addChildren(std::move(children));
-      totalChildWeight_ += weight;
-      return result;
+    HTTPCodec::StreamID getID() const {
+      return id_;
     }
 
-    void detachChild(HTTPCodec::StreamID id) {
-      auto it = std::find_if(children_.begin(), children_.end(),
-                             [id] (Node& n) { return n.id_ == id; });
-      if (it == children_.end()) {
-        CHECK(false) << "Detach non-child id=" << id;
-      }
-      detachChild(it);
+    HTTPTransaction* getTransaction() const {
+      return txn_;
     }
 
-    void detachChild(Handle it) {
-      totalChildWeight_ -= it->weight_;
-      children_.erase(it);
-    }
+    // Add a new node as a child of this node. If exclusive, this node's
+    // other children become the new node's children.
+    void addChild(Node* child, bool exclusive);
 
-    Handle reparent(Node* newParent, bool exclusive) {
-      Node* oldParent = parent_;
-      std::list<Node> children;
-      std::swap(children_, children);
-      Node selfCopy = *this;
-      parent_->detachChild(id_);
-      auto result = newParent->emplaceNode(selfCopy.id_, selfCopy.weight_,
-                                           selfCopy.txn_, exclusive,
-                                           std::move(children));
-      result->enqueued_ = selfCopy.enqueued_;
-      return result;
-    }
+    // Move this node, with its subtree, under newParent
+    void reparent(Node* newParent, bool exclusive);
 
     // Returns true if this is a descendant of node
     bool isDescendantOf(Node *node) {
@@ -140,13 +106,17 @@ class HTTP2PriorityQueue {
       return (txn_ != nullptr && enqueued_);
     }
 
-    void signalPendingEgress() {
-      enqueued_ = true;
+    // True if the node itself, rather than a descendant, has egress
+    bool hasPendingEgress() const {
+      return enqueued_;
     }
 
-    void clearPendingEgress() {
-      CHECK(enqueued_);
-      enqueued_ = false;
+    void signalPendingEgress();
+
+    void clearPendingEgress();
+
+    uint8_t getWeight() const {
+      return weight_;
     }
 
     // Set a new weight for this node
@@ -156,26 +126,18 @@ class HTTP2PriorityQueue {
       parent_->totalChildWeight_ += delta;
     }
 
-    // Removes the node from the tree
-    void removeFromTree(Handle self) {
-      // move my children to my parent
-      parent_->addChildren(std::move(children_));
-      parent_->detachChild(self);
-    }
+    // Removes the node from the tree, giving its children to its parent
+    void removeFromTree();
 
-    // Find the node for the given stream ID in the priority tree
-    Node* findInTree(HTTPCodec::StreamID id) {
-      if (id_ == id) {
-        return this;
-      }
-      Node* res = nullptr;
-      for (auto& child: children_) {
-        res = child.findInTree(id);
-        if (res) {
-          break;
-        }
-      }
-      return res;
+    // The node that should egress next in this subtree, or nullptr
+    Node* nextEgress();
+
+    // Charge body bytes sent by this node to it and its ancestors
+    void consumed(uint64_t bytes);
+
+    // Body bytes this node may send before yielding to a sibling
+    uint32_t egressAllowance() const {
+      return credit_ > 0 ? credit_ : 0;
     }
 
     /* Execute the given function on this node and all child nodes presently
@@ -191,50 +153,46 @@ class HTTP2PriorityQueue {
      */
     bool iterate(const std::function<bool(HTTPCodec::StreamID,
                                           HTTPTransaction *, double)>& fn,
-                 const std::function<bool()>& stopFn, bool all) {
-      bool stop = false;
-      if (stopFn()) {
-        return true;
-      }
-      if (parent_ /* exclude root */  && (all || isEnqueued())) {
-        stop = fn(id_, txn_, (double)weight_ / parent_->totalChildWeight_);
-      }
-      for (auto& child: children_) {
-        if (stop || stopFn()) {
-          return true;
-        }
-        stop = child.iterate(fn, stopFn, all);
-      }
-      return stop;
-    }
+                 const std::function<bool()>& stopFn, bool all);
 
     bool visitBFS(const std::function<bool(HTTPCodec::StreamID,
                                            HTTPTransaction *, double)>& fn,
-                  bool all, std::list<Node*>& pendingNodes) {
-      bool stop = false;
-      if (parent_ != nullptr && (all || isEnqueued())) {
-        stop = fn(id_, txn_, (double)weight_ / parent_->totalChildWeight_);
-      }
-      if (stop) {
-        return true;
-      }
-      for (auto& child: children_) {
-        pendingNodes.push_back(&child);
-      }
-      return false;
+                  bool all, std::list<Node*>& pendingNodes);
+
+   private:
+    // Whether this node or any descendant has pending egress
+    bool isActive() const {
+      return enqueued_ || !activeChildren_.empty();
+    }
+
+    int64_t quantum() const {
+      return (int64_t(weight_) + 1) * kBytesPerWeight;
     }
 
+    void addChild(Node* child);
+    void detachChild(Node* child);
+    // Append all our children to newParent's children
+    void moveChildrenTo(Node* newParent);
+
+    void activateChild(Node* child);
+    void deactivateChild(Node* child);
 
-   private:
     Node *parent_{nullptr};
     bool enqueued_{false};
     HTTPCodec::StreamID id_{0};
     uint8_t weight_{16};
     HTTPTransaction *txn_{nullptr};
     uint64_t totalChildWeight_{0};
-    std::list<Node> children_;
-
-
+    // links this node in parent_->children_
+    folly::IntrusiveListHook siblingHook_;
+    folly::IntrusiveList<Node, &Node::siblingHook_> children_;
+
+    // remaining deficit round robin credit, in body bytes
+    int64_t credit_{0};
+    // links this node in parent_->activeChildren_ while isActive()
+    folly::IntrusiveListHook activeHook_;
+    // children with pending egress in their subtree, in service order
+    folly::IntrusiveList<Node, &Node::activeHook_> activeChildren_;
   };
 
  public:
@@ -245,7 +203,7 @@ class HTTP2PriorityQueue {
     if (id == 0) {
       return nullptr;
     }
-    return root_.findInTree(id);
+    return nodes_.find(id);
   }
 
   // Notify the queue when a transaction has egress
@@ -263,54 +221,13 @@ class HTTP2PriorityQueue {
 
   // adds new transaction (possibly nullptr) to the priority tree
   Handle addTransaction(HTTPCodec::StreamID id, http2::PriorityUpdate pri,
-                        HTTPTransaction *txn) {
-    CHECK(id != 0);
-
-    Node* parent = &root_;
-    if (pri.streamDependency != 0) {
-      Node* dep = find(pri.streamDependency);
-      if (dep == nullptr) {
-        // specified a missing parent (timed out an idle node)?
-        LOG(INFO) << "assigning default priority to txn=" << id;
-      } else {
-        parent = dep;
-      }
-    }
-    std::list<Node> emptyChildren;
-    auto result = parent->emplaceNode(id, pri.weight, txn, pri.exclusive,
-                                      std::move(emptyChildren));
-    return result;
-  }
+                        HTTPTransaction *txn);
 
   // update the priority of an existing node
-  Handle updatePriority(Handle handle, http2::PriorityUpdate pri) {
-    Node& node = *handle;
-    node.updateWeight(pri.weight);
-    if (pri.streamDependency == node.parentID() && !pri.exclusive) {
-      // no move
-      return handle;
-    }
-
-    Node* newParent = find(pri.streamDependency);
-    if (!newParent) {
-      newParent = &root_;
-    }
-
-    if (newParent->isDescendantOf(&node)) {
-      newParent = &(*(newParent->reparent(node.parent(), false)));
-    }
-    return node.reparent(newParent, pri.exclusive);
-  }
+  Handle updatePriority(Handle handle, http2::PriorityUpdate pri);
 
   // Remove the transaction from the priority tree
-  void removeTransaction(Handle handle) {
-    Node& node = *handle;
-    // TODO: or require the node to do it?
-    if (node.isEnqueued()) {
-      clearPendingEgress(handle);
-    }
-    node.removeFromTree(handle);
-  }
+  void removeTransaction(Handle handle);
 
   // Returns true if there are no transaction with pending egress
   bool empty() const {
@@ -322,6 +239,18 @@ class HTTP2PriorityQueue {
     return activeCount_;
   }
 
+  /**
+   * The node that should egress next, or nullptr if nothing is pending.
+   * After it has sent, report the body bytes through consumed().
+   */
+  Handle nextEgress() {
+    return root_.nextEgress();
+  }
+
+  void consumed(Handle handle, uint64_t bytes) {
+    handle->consumed(bytes);
+  }
+
   void iterate(const std::function<bool(HTTPCodec::StreamID,
                                         HTTPTransaction *, double)>& fn,
                const std::function<bool()>& stopFn, bool all) {
@@ -341,7 +270,9 @@ class HTTP2PriorityQueue {
     }
   }
 
-
+ private:
+  // every node but the root, by stream ID
+  StreamTable<Node> nodes_;
   Node root_{nullptr, 0, 1, nullptr};
   uint64_t activeCount_{0};
 };
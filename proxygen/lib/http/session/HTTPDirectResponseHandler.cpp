@@ -55,7 +55,7 @@ HTTPDirectResponseHandler::onHeadersComplete(
   if (!statusMessage_.empty()) {
     response.setStatusMessage(statusMessage_);
   } else {
-    response.setStatusMessage(HTTPMessage::getDefaultReason(statusCode_));
+    response.setDefaultStatusMessage();
   }
   if (forceConnectionClose_) {
     response.getHeaders().add(HTTP_HEADER_CONNECTION, "close");
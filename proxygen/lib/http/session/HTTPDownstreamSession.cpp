@@ -29,9 +29,20 @@ HTTPDownstreamSession::setupOnHeadersComplete(HTTPTransaction* txn,
   // ingress and egress messages have completed (or failed).
   HTTPTransaction::Handler* handler = nullptr;
 
-  // In the general case, delegate to the handler factory to generate
-  // a handler for the transaction.
-  handler = controller_->getRequestHandler(*txn, msg);
+  if (isRejectedEarlyData(*msg)) {
+    // It may be a replay; the client sends it again after its handshake
+    VLOG(4) << *this << " rejecting " << msg->getMethodString()
+            << " sent as early data";
+    HTTPException ex(HTTPException::Direction::INGRESS,
+                     "unsafe request sent as early data");
+    ex.setHttpStatusCode(425);
+    ex.setProxygenError(kErrorEarlyDataRejected);
+    handler = controller_->getParseErrorHandler(txn, ex, localAddr_);
+  } else {
+    // In the general case, delegate to the handler factory to generate
+    // a handler for the transaction.
+    handler = controller_->getRequestHandler(*txn, msg);
+  }
   CHECK(handler);
 
   DestructorGuard dg(this);
@@ -40,6 +51,41 @@ HTTPDownstreamSession::setupOnHeadersComplete(HTTPTransaction* txn,
   setNewTransactionPauseState(txnID);
 }
 
+void
+HTTPDownstreamSession::setupOnRequests(
+    const std::vector<HTTPTransaction*>& txns,
+    const std::vector<HTTPMessage*>& msgs) {
+  std::vector<HTTPTransaction*> requestTxns;
+  std::vector<HTTPMessage*> requestMsgs;
+  requestTxns.reserve(txns.size());
+  requestMsgs.reserve(msgs.size());
+  for (size_t i = 0; i < txns.size(); ++i) {
+    if (isRejectedEarlyData(*msgs[i])) {
+      setupOnHeadersComplete(txns[i], msgs[i]);
+    } else {
+      CHECK(!txns[i]->getHandler());
+      requestTxns.push_back(txns[i]);
+      requestMsgs.push_back(msgs[i]);
+    }
+  }
+  if (requestTxns.empty()) {
+    return;
+  }
+
+  std::vector<HTTPTransaction::Handler*> handlers;
+  handlers.reserve(requestTxns.size());
+  controller_->getRequestHandlers(requestTxns, requestMsgs, handlers);
+  CHECK_EQ(handlers.size(), requestTxns.size());
+
+  DestructorGuard dg(this);
+  for (size_t i = 0; i < requestTxns.size(); ++i) {
+    CHECK(handlers[i]);
+    auto txnID = requestTxns[i]->getID();
+    requestTxns[i]->setHandler(handlers[i]);
+    setNewTransactionPauseState(txnID);
+  }
+}
+
 HTTPTransaction::Handler*
 HTTPDownstreamSession::getParseErrorHandler(HTTPTransaction* txn,
                                             const HTTPException& error) {
@@ -47,6 +47,13 @@ class HTTPDownstreamSession final: public HTTPSession {
    */
   void setupOnHeadersComplete(HTTPTransaction* txn, HTTPMessage* msg) override;
 
+  /**
+   * Called by dispatchRequests(). The controller gets all the requests
+   * at once, see HTTPSessionController::getRequestHandlers().
+   */
+  void setupOnRequests(const std::vector<HTTPTransaction*>& txns,
+                       const std::vector<HTTPMessage*>& msgs) override;
+
   /**
    * Called by processParseError() in the downstream case. This function ensures
    * that a handler is set for the transaction.
@@ -86,6 +86,9 @@ class HTTPEvent {
 
   std::unique_ptr<HTTPMessage> getHeaders() { return std::move(headers_); }
 
+  // The headers, left in the event
+  HTTPMessage* peekHeaders() const { return headers_.get(); }
+
   std::unique_ptr<folly::IOBuf> getBody() { return std::move(body_); }
 
   std::unique_ptr<HTTPException> getError() { return std::move(error_); }
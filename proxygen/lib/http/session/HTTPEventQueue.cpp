@@ -0,0 +1,135 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/http/session/HTTPEventQueue.h>
+
+#include <folly/ThreadLocal.h>
+#include <vector>
+
+namespace proxygen {
+
+namespace {
+
+typedef std::aligned_storage<sizeof(HTTPEvent),
+                             alignof(HTTPEvent)>::type Slot;
+
+// Rings of up to 2^kMaxPooledShift events are pooled, the larger ones are
+// rare enough to be freed
+const uint32_t kMaxPooledShift = 10;
+const size_t kMaxIdleRings = 64;
+
+size_t shiftOf(uint32_t capacity) {
+  return __builtin_ctz(capacity);
+}
+
+class IdleRings {
+ public:
+  ~IdleRings() {
+    clear();
+  }
+
+  Slot* get(uint32_t capacity) {
+    auto shift = shiftOf(capacity);
+    if (shift <= kMaxPooledShift && !rings_[shift].empty()) {
+      auto ring = rings_[shift].back();
+      rings_[shift].pop_back();
+      numIdle_--;
+      return ring;
+    }
+    return new Slot[capacity];
+  }
+
+  void put(Slot* ring, uint32_t capacity) {
+    auto shift = shiftOf(capacity);
+    if (shift > kMaxPooledShift || rings_[shift].size() >= kMaxIdleRings) {
+      delete[] ring;
+      return;
+    }
+    rings_[shift].push_back(ring);
+    numIdle_++;
+  }
+
+  size_t size() const {
+    return numIdle_;
+  }
+
+  void clear() {
+    for (auto& rings: rings_) {
+      for (auto ring: rings) {
+        delete[] ring;
+      }
+      rings.clear();
+    }
+    numIdle_ = 0;
+  }
+
+ private:
+  std::vector<Slot*> rings_[kMaxPooledShift + 1];
+  size_t numIdle_{0};
+};
+
+// Leaked, so that queues can still be destroyed during static destruction
+folly::ThreadLocal<IdleRings>& idleRings() {
+  static auto idle = new folly::ThreadLocal<IdleRings>();
+  return *idle;
+}
+
+}
+
+void HTTPEventQueue::pop() {
+  front().~HTTPEvent();
+  head_ = (head_ + 1) & (capacity_ - 1);
+  if (--size_ == 0) {
+    releaseRing();
+  }
+}
+
+void HTTPEventQueue::clear() {
+  while (size_ > 0) {
+    pop();
+  }
+  releaseRing();
+}
+
+void HTTPEventQueue::grow() {
+  uint32_t capacity = capacity_ * 2;
+  Slot* slots = idleRings()->get(capacity);
+  for (uint32_t i = 0; i < size_; i++) {
+    auto event = reinterpret_cast<HTTPEvent*>(
+      &slots_[(head_ + i) & (capacity_ - 1)]);
+    new (&slots[i]) HTTPEvent(std::move(*event));
+    event->~HTTPEvent();
+  }
+  if (slots_ != inline_) {
+    idleRings()->put(slots_, capacity_);
+  }
+  slots_ = slots;
+  capacity_ = capacity;
+  head_ = 0;
+}
+
+void HTTPEventQueue::releaseRing() {
+  DCHECK_EQ(size_, 0);
+  if (slots_ != inline_) {
+    idleRings()->put(slots_, capacity_);
+    slots_ = inline_;
+    capacity_ = kInlineEvents;
+  }
+  head_ = 0;
+}
+
+size_t HTTPEventQueue::getNumPooledRings() {
+  return idleRings()->size();
+}
+
+void HTTPEventQueue::clearPool() {
+  idleRings()->clear();
+}
+
+}
@@ -0,0 +1,92 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <proxygen/lib/http/session/HTTPEvent.h>
+#include <type_traits>
+
+namespace proxygen {
+
+/**
+ * FIFO of HTTPEvents, for the ingress a transaction receives while it is
+ * paused. The first few events are held inline, so pausing for a moment
+ * allocates nothing. Past that the events move to a ring twice as large,
+ * taken from a per-thread pool of rings, which it goes back to once the
+ * queue drains.
+ *
+ * References from front() are invalidated by emplace().
+ */
+class HTTPEventQueue {
+ public:
+  HTTPEventQueue() {}
+
+  ~HTTPEventQueue() {
+    clear();
+  }
+
+  HTTPEventQueue(const HTTPEventQueue&) = delete;
+  HTTPEventQueue& operator=(const HTTPEventQueue&) = delete;
+
+  template <typename... Args>
+  void emplace(Args&&... args) {
+    if (size_ == capacity_) {
+      grow();
+    }
+    new (&slots_[(head_ + size_) & (capacity_ - 1)])
+      HTTPEvent(std::forward<Args>(args)...);
+    size_++;
+  }
+
+  HTTPEvent& front() {
+    DCHECK(size_ > 0);
+    return *reinterpret_cast<HTTPEvent*>(&slots_[head_]);
+  }
+
+  void pop();
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  // The events held, inline or not
+  size_t capacity() const {
+    return capacity_;
+  }
+
+  void clear();
+
+  // The rings idle in the pool of the current thread
+  static size_t getNumPooledRings();
+
+  // Free the idle rings of the current thread
+  static void clearPool();
+
+ private:
+  typedef std::aligned_storage<sizeof(HTTPEvent),
+                               alignof(HTTPEvent)>::type Slot;
+
+  // A power of 2, as are all the capacities
+  static const uint32_t kInlineEvents = 4;
+
+  void grow();
+  void releaseRing();
+
+  Slot inline_[kInlineEvents];
+  Slot* slots_{inline_};
+  uint32_t capacity_{kInlineEvents};
+  uint32_t head_{0};
+  uint32_t size_{0};
+};
+
+}
@@ -9,15 +9,24 @@
  */
 #include <proxygen/lib/http/session/HTTPSession.h>
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <folly/Conv.h>
+#include <folly/Memory.h>
 #include <folly/wangle/acceptor/ConnectionManager.h>
 #include <folly/wangle/acceptor/SocketOptions.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <openssl/err.h>
+#include <sstream>
 #include <proxygen/lib/http/HTTPHeaderSize.h>
 #include <proxygen/lib/http/codec/HTTPChecks.h>
+#include <proxygen/lib/http/codec/HTTPCodecTap.h>
 #include <proxygen/lib/http/session/HTTPSessionController.h>
 #include <proxygen/lib/http/session/HTTPSessionStats.h>
+#include <proxygen/lib/http/session/SessionMemoryAccountant.h>
+#include <proxygen/lib/utils/ReadBufferPool.h>
 #include <folly/io/async/AsyncSSLSocket.h>
 
 using folly::AsyncSSLSocket;
@@ -40,17 +49,122 @@ static const uint32_t kMinReadSize = 1460;
 static const uint32_t kMaxReadSize = 4000;
 static const uint32_t kWriteReadyMax = 65536;
 
+// Writes gathered under a TCP_NOTSENT_LOWAT still fill a few packets
+static const uint32_t kMinLowWatermarkWrite = 4096;
+
+#if defined(__linux__) && !defined(TCP_NOTSENT_LOWAT)
+#define TCP_NOTSENT_LOWAT 25
+#endif
+
+// Number of consecutive reads using less than a quarter of the read buffer
+// before the buffer is shrunk
+static const uint8_t kShortReadsBeforeShrink = 4;
+
+// Bytes above kMaxReadSize currently in use by all sessions' read buffers
+std::atomic<uint64_t> readBufferGrowth{0};
+
 // Lower = higher latency, better prioritization
 // Higher = lower latency, less prioritization
 static const uint32_t kMaxWritesPerLoop = 32;
 
+// RFC 7540 5.3.5: streams depend on stream 0 with a weight of 16, which
+// goes on the wire as 15
+const proxygen::http2::PriorityUpdate kDefaultHTTP2Priority{0, false, 15};
+
+// The least a transaction may buffer with egress quotas, so that streams
+// among thousands still write whole frames
+const uint64_t kMinEgressQuota = 4096;
+
 } // anonymous namespace
 
 namespace proxygen {
 
 uint32_t HTTPSession::kDefaultReadBufLimit = 65536;
+uint32_t HTTPSession::kDefaultStreamReadBufLimit = 0;
 uint64_t HTTPSession::egressBodySizeLimit_ = 4096;
 uint32_t HTTPSession::kPendingWriteMax = 65536;
+uint32_t HTTPSession::kMaxReadBufferSize = 65536;
+uint64_t HTTPSession::kReadBufferGrowthCap = 64 * 1024 * 1024;
+bool HTTPSession::kUseReadBufferPool = false;
+uint32_t HTTPSession::kPhaseSampleRate = 0;
+std::chrono::microseconds HTTPSession::kSlowCallbackThreshold{0};
+bool HTTPSession::kAccountingEnabled = false;
+uint32_t HTTPSession::kCodecTapSize = 0;
+
+HTTPSession::SampledCallback::SampledCallback(HTTPSession* session,
+                                              const char* name)
+  : session_(session),
+    name_(name) {
+  if (kPhaseSampleRate == 0 || session_->phaseSampling_ ||
+      ++session_->callbacksSinceSample_ < kPhaseSampleRate) {
+    return;
+  }
+  session_->callbacksSinceSample_ = 0;
+  session_->phaseSampling_ = true;
+  session_->phaseTimes_.fill(std::chrono::steady_clock::duration::zero());
+  sampling_ = true;
+  start_ = getCurrentTime();
+}
+
+HTTPSession::SampledCallback::~SampledCallback() {
+  if (!sampling_) {
+    return;
+  }
+  session_->phaseSampling_ = false;
+  if (!kAccountingEnabled) {
+    session_->currentPhase_ = nullptr;
+  }
+  auto total = std::chrono::duration_cast<std::chrono::microseconds>(
+    getCurrentTime() - start_);
+  auto stats = session_->sessionStats_;
+  bool slow = kSlowCallbackThreshold.count() > 0 &&
+    total > kSlowCallbackThreshold;
+  if (!stats && !slow) {
+    return;
+  }
+  std::ostringstream trace;
+  for (size_t i = 0; i < kNumSessionPhases; ++i) {
+    auto phase = SessionPhase(i);
+    auto time = std::chrono::duration_cast<std::chrono::microseconds>(
+      session_->phaseTimes_[i]);
+    if (stats) {
+      stats->recordSessionPhaseTime(phase, time);
+    }
+    trace << " " << getSessionPhaseString(phase) << "=" << time.count();
+  }
+  if (slow) {
+    LOG(WARNING) << *session_ << " spent " << total.count() << "us in "
+                 << name_ << ":" << trace.str();
+  }
+}
+
+HTTPSession::PhaseTimer::PhaseTimer(HTTPSession* session, SessionPhase phase)
+  : session_(session),
+    phase_(phase) {
+  if (!session_->phaseSampling_ && !kAccountingEnabled) {
+    return;
+  }
+  parent_ = session_->currentPhase_;
+  session_->currentPhase_ = this;
+  start_ = getCurrentTime();
+}
+
+HTTPSession::PhaseTimer::~PhaseTimer() {
+  if (session_->currentPhase_ != this) {
+    return;
+  }
+  auto elapsed = getCurrentTime() - start_;
+  if (session_->phaseSampling_) {
+    session_->phaseTimes_[size_t(phase_)] += elapsed - nested_;
+  }
+  if (kAccountingEnabled) {
+    session_->accounting_.phaseTimes[size_t(phase_)] += elapsed - nested_;
+  }
+  session_->currentPhase_ = parent_;
+  if (parent_) {
+    parent_->nested_ += elapsed;
+  }
+}
 
 HTTPSession::WriteSegment::WriteSegment(
     HTTPSession* session,
@@ -118,10 +232,14 @@ HTTPSession::HTTPSession(
     controller_(controller),
     codec_(std::move(codec)),
     infoCallback_(infoCallback),
+    infoEvents_(infoCallback ? infoCallback->getSubscribedEvents() : 0),
     writeTimeout_(this),
     flowControlTimeout_(this),
     transactionTimeouts_(CHECK_NOTNULL(transactionTimeouts)),
     transportInfo_(tinfo),
+    readBufferSize_(kMaxReadSize),
+    egressQuantum_(egressBodySizeLimit_),
+    egressBytesPerWrite_(kWriteReadyMax),
     direction_(codec_->getTransportDirection()),
     reads_(SocketState::PAUSED),
     writes_(SocketState::UNPAUSED),
@@ -132,12 +250,24 @@ HTTPSession::HTTPSession(
     resetAfterDrainingWrites_(false),
     resetSocketOnShutdown_(false),
     ingressError_(false),
-    inLoopCallback_(false) {
+    inLoopCallback_(false),
+    usePriorityTree_(codec_->getProtocol() == CodecProtocol::HTTP_2) {
 
-  codec_.add<HTTPChecks>();
+  if (kCodecTapSize > 0) {
+    // Next to the codec, before the other filters
+    codecTap_ = new HTTPCodecTap(kCodecTapSize);
+    codec_.addFilters(std::unique_ptr<HTTPCodecTap>(codecTap_));
+  }
+
+  // Codecs that can run the checks as they parse spare the filter hop
+  const bool codecChecks = codec_->enableHTTPChecks();
+  if (!codecChecks && !codec_->supportsSessionFlowControl()) {
+    codec_.add<HTTPChecks>();
+  }
 
   if (!codec_->supportsParallelRequests()) {
-    // until we support upstream pipelining
+    // until upstream pipelining is turned on, see
+    // HTTPUpstreamSession::setMaxPipelineDepth()
     maxConcurrentIncomingStreams_ = 1;
     maxConcurrentOutgoingStreamsConfig_ = isDownstream() ? 0 : 1;
   }
@@ -151,7 +281,14 @@ HTTPSession::HTTPSession(
   codec_->generateConnectionPreface(writeBuf_);
 
   if (codec_->supportsSessionFlowControl()) {
-    connFlowControl_ = new FlowControlFilter(*this, writeBuf_, codec_.call());
+    if (codecChecks) {
+      connFlowControl_ = new FlowControlFilter(*this, writeBuf_,
+                                               codec_.call());
+    } else {
+      // One filter does the checks too, sparing a hop per call and callback
+      connFlowControl_ = new HTTPChecksFilter<FlowControlFilter>(
+        *this, writeBuf_, codec_.call());
+    }
     codec_.addFilters(std::unique_ptr<FlowControlFilter>(connFlowControl_));
   }
 
@@ -180,7 +317,29 @@ HTTPSession::~HTTPSession() {
   CHECK(txnEgressQueue_.empty());
   DCHECK(!sock_->getReadCallback());
 
+  if (readBufferSize_ > kMaxReadSize) {
+    readBufferGrowth -= readBufferSize_ - kMaxReadSize;
+  }
+
+  if (memoryAccountant_) {
+    memoryAccountant_->add(-int64_t(accountedMemory_));
+  }
+  if (egressAccountant_) {
+    egressAccountant_->add(-int64_t(pendingWriteSize_));
+  }
+  if (tenantScheduler_) {
+    tenantScheduler_->removeMember(tenant_, this);
+  }
+
+  if (kAllocStatsEnabled && sessionStats_) {
+    sessionStats_->recordSessionAllocCounts(allocCounts_);
+  }
+
   if (infoCallback_) {
+    flushTransportBytes();
+    if (pendingWriteSize_ && (infoEvents_ & InfoCallback::EGRESS_BUFFER)) {
+      infoCallback_->onEgressBufferChanged(*this, -int64_t(pendingWriteSize_));
+    }
     infoCallback_->onDestroy(*this);
   }
   if (controller_) {
@@ -197,12 +356,54 @@ void HTTPSession::startNow() {
     connFlowControl_->setReceiveWindowSize(writeBuf_,
                                            receiveSessionWindowSize_);
   }
+  if (pingTimeout_) {
+    pingTimeout_->scheduleTimeout(pingInterval_.count());
+  }
+  if (idleMemoryTimeout_ && transactions_.empty()) {
+    idleMemoryTimeout_->scheduleTimeout(idleMemoryInterval_.count());
+  }
   scheduleWrite();
   resumeReads();
 }
 
+void HTTPSession::startNow(unique_ptr<IOBuf> initialIngress,
+                           unique_ptr<HTTPMessage> upgradeRequest) {
+  DestructorGuard dg(this);
+  startNow();
+  if (upgradeRequest) {
+    const HTTPCodec::StreamID upgradeStream = 1;
+    onMessageBegin(upgradeStream, upgradeRequest.get());
+    onHeadersComplete(upgradeStream, std::move(upgradeRequest));
+    onMessageComplete(upgradeStream, false);
+  }
+  if (initialIngress) {
+    readBuf_.append(std::move(initialIngress));
+    processReadData();
+  }
+}
+
+void HTTPSession::setMaxReadBufferSize(uint32_t size) {
+  kMaxReadBufferSize = std::max(size, kMaxReadSize);
+}
+
+void HTTPSession::setReadBufferGrowthCap(uint64_t cap) {
+  kReadBufferGrowthCap = cap;
+}
+
 void HTTPSession::setInfoCallback(InfoCallback* cb) {
+  flushTransportBytes();
   infoCallback_ = cb;
+  infoEvents_ = cb ? cb->getSubscribedEvents() : 0;
+}
+
+void HTTPSession::setController(HTTPSessionController* controller) {
+  if (controller_) {
+    controller_->detachSession(this);
+  }
+  controller_ = controller;
+  if (controller_) {
+    controller_->attachSession(this);
+  }
 }
 
 void HTTPSession::setSessionStats(HTTPSessionStats* stats) {
@@ -212,6 +413,58 @@ void HTTPSession::setSessionStats(HTTPSessionStats* stats) {
   }
 }
 
+void HTTPSession::setMemoryAccountant(SessionMemoryAccountant* accountant) {
+  if (memoryAccountant_) {
+    memoryAccountant_->add(-int64_t(accountedMemory_));
+    accountedMemory_ = 0;
+  }
+  memoryAccountant_ = accountant;
+  updateAccountedMemory();
+}
+
+void HTTPSession::updateAccountedMemory() {
+  if (!memoryAccountant_) {
+    return;
+  }
+  uint64_t bytes = readBuf_.chainLength() + pendingReadSize_ +
+    pendingWriteSize_ + codec_->getHeaderCompressionStateSize();
+  if (bytes != accountedMemory_) {
+    memoryAccountant_->add(int64_t(bytes) - int64_t(accountedMemory_));
+    accountedMemory_ = bytes;
+  }
+}
+
+void HTTPSession::setEgressAccountant(SessionMemoryAccountant* accountant,
+                                      uint32_t pressuredWriteMax) {
+  if (egressAccountant_) {
+    egressAccountant_->add(-int64_t(pendingWriteSize_));
+  }
+  egressAccountant_ = accountant;
+  pressuredWriteMax_ = pressuredWriteMax;
+  if (egressAccountant_) {
+    egressAccountant_->add(pendingWriteSize_);
+  }
+}
+
+void HTTPSession::setMemoryPressure(bool pressure) {
+  if (pressure == memoryPressure_) {
+    return;
+  }
+  memoryPressure_ = pressure;
+  codec_->setHeaderCompressionMemoryPressure(pressure);
+  if (pressure) {
+    VLOG(3) << *this << " under memory pressure, pausing reads";
+    pauseReads();
+  } else {
+    VLOG(3) << *this << " out of memory pressure";
+    resumeReads();
+    // Hand out the flow control credit held back meanwhile
+    if (!pendingWindowUpdates_.empty() || pendingSessionWindowUpdate_ > 0) {
+      scheduleWindowUpdates();
+    }
+  }
+}
+
 void HTTPSession::setFlowControl(size_t initialReceiveWindow,
                                  size_t receiveStreamWindowSize,
                                  size_t receiveSessionWindowSize) {
@@ -242,13 +495,19 @@ void HTTPSession::setMaxConcurrentPushTransactions(uint32_t num) {
 }
 
 void HTTPSession::setMaxConcurrentIncomingStreams(uint32_t num) {
-  CHECK(!started_);
-  if (codec_->supportsParallelRequests()) {
-    maxConcurrentIncomingStreams_ = num;
-    HTTPSettings* settings = codec_->getEgressSettings();
-    if (settings) {
-      settings->setSetting(SettingsId::MAX_CONCURRENT_STREAMS,
-                           maxConcurrentIncomingStreams_);
+  if (!codec_->supportsParallelRequests() ||
+      num == maxConcurrentIncomingStreams_) {
+    return;
+  }
+  maxConcurrentIncomingStreams_ = num;
+  HTTPSettings* settings = codec_->getEgressSettings();
+  if (settings) {
+    settings->setSetting(SettingsId::MAX_CONCURRENT_STREAMS,
+                         maxConcurrentIncomingStreams_);
+    if (started_ && !draining_ && codec_->isReusable()) {
+      VLOG(4) << *this << " advertising " << num << " concurrent streams";
+      codec_->generateSettings(writeBuf_);
+      scheduleWrite();
     }
   }
 }
@@ -294,6 +553,29 @@ HTTPSession::writeTimeoutExpired() noexcept {
   shutdownTransportWithReset(kErrorWriteTimeout);
 }
 
+void HTTPSession::pingTimeoutExpired() noexcept {
+  if (writesShutdown()) {
+    return;
+  }
+  if (pingSentTime_) {
+    auto waited = millisecondsSince(*pingSentTime_);
+    if (waited < pingReplyTimeout_) {
+      // An earlier sendPing() is still in its time
+      pingTimeout_->scheduleTimeout((pingReplyTimeout_ - waited).count());
+      return;
+    }
+    VLOG(3) << *this << " got no reply to a ping in " << waited.count()
+            << "ms, dropping";
+    DestructorGuard g(this);
+    setCloseReason(ConnectionCloseReason::TIMEOUT);
+    shutdownTransportWithReset(kErrorTimeout);
+    return;
+  }
+  if (sendPing()) {
+    pingTimeout_->scheduleTimeout(pingReplyTimeout_.count());
+  }
+}
+
 void
 HTTPSession::flowControlTimeoutExpired() noexcept {
   VLOG(4) << "Flow control timeout for " << *this;
@@ -380,10 +662,64 @@ bool HTTPSession::isDownstream() const {
 
 void
 HTTPSession::getReadBuffer(void** buf, size_t* bufSize) {
+  if (kUseReadBufferPool) {
+    // the same check as preallocate(), which would allocate a new buffer
+    const IOBuf* tail = readBuf_.front() ? readBuf_.front()->prev() : nullptr;
+    if (!tail || tail->isSharedOne() || tail->tailroom() < kMinReadSize) {
+      readBuf_.append(ReadBufferPool::get());
+      // if the transport reads nothing into it, it goes back once the
+      // event is handled
+      if (!readBufferReleaser_.isLoopCallbackScheduled()) {
+        sock_->getEventBase()->runInLoop(&readBufferReleaser_);
+      }
+    }
+  }
   pair<void*,uint32_t> readSpace = readBuf_.preallocate(kMinReadSize,
-                                                        kMaxReadSize);
+                                                        readBufferSize_);
   *buf = readSpace.first;
   *bufSize = readSpace.second;
+  lastReadBufferSize_ = readSpace.second;
+}
+
+void
+HTTPSession::adjustReadBufferSize(size_t readSize) {
+  if (readSize >= lastReadBufferSize_) {
+    // The transport filled the whole buffer, there is probably more
+    // waiting in the kernel. Double the next read if the global budget
+    // allows it.
+    numShortReads_ = 0;
+    if (readBufferSize_ >= kMaxReadBufferSize) {
+      return;
+    }
+    uint32_t newSize = std::min(readBufferSize_ * 2, kMaxReadBufferSize);
+    uint64_t delta = newSize - readBufferSize_;
+    if (readBufferGrowth.fetch_add(delta) + delta > kReadBufferGrowthCap) {
+      readBufferGrowth -= delta;
+      return;
+    }
+    VLOG(5) << *this << " growing read buffer to " << newSize;
+    readBufferSize_ = newSize;
+  } else if (readBufferSize_ > kMaxReadSize &&
+             readSize < readBufferSize_ / 4) {
+    if (++numShortReads_ < kShortReadsBeforeShrink) {
+      return;
+    }
+    numShortReads_ = 0;
+    uint32_t newSize = std::max(readBufferSize_ / 2, kMaxReadSize);
+    readBufferGrowth -= readBufferSize_ - newSize;
+    VLOG(5) << *this << " shrinking read buffer to " << newSize;
+    readBufferSize_ = newSize;
+  } else {
+    numShortReads_ = 0;
+  }
+}
+
+void
+HTTPSession::releaseEmptyReadBuffer() {
+  // the data read was all parsed, so the buffers freed, or nothing was read
+  if (readBuf_.front() && readBuf_.chainLength() == 0) {
+    readBuf_.move();
+  }
 }
 
 void
@@ -391,14 +727,21 @@ HTTPSession::readDataAvailable(size_t readSize) noexcept {
   VLOG(10) << "read completed on " << *this << ", bytes=" << readSize;
 
   DestructorGuard dg(this);
+  SampledCallback sampled(this, "readDataAvailable");
   resetTimeout();
   readBuf_.postallocate(readSize);
+  adjustReadBufferSize(readSize);
 
-  if (infoCallback_) {
+  accounting_.bytesRead += readSize;
+  if (infoEvents_ & InfoCallback::READ) {
     infoCallback_->onRead(*this, readSize);
   }
+  if (infoEvents_ & InfoCallback::BATCHED_BYTES) {
+    addTransportBytes(readSize, 0);
+  }
 
   processReadData();
+  chargeTenantIngress(readSize);
 }
 
 bool
@@ -414,24 +757,40 @@ HTTPSession::readBufferAvailable(std::unique_ptr<IOBuf> readBuf) noexcept {
   VLOG(5) << "read completed on " << *this << ", bytes=" << readSize;
 
   DestructorGuard dg(this);
+  SampledCallback sampled(this, "readBufferAvailable");
   resetTimeout();
   readBuf_.append(std::move(readBuf));
 
-  if (infoCallback_) {
+  accounting_.bytesRead += readSize;
+  if (infoEvents_ & InfoCallback::READ) {
     infoCallback_->onRead(*this, readSize);
   }
+  if (infoEvents_ & InfoCallback::BATCHED_BYTES) {
+    addTransportBytes(readSize, 0);
+  }
 
   processReadData();
+  chargeTenantIngress(readSize);
 }
 
 void
 HTTPSession::processReadData() {
+  // Parsing is charged to the session but for the transactions' callbacks
+  AllocStatsScope allocScope(allocCounts_);
   // skip the empty IOBuf before feeding CODEC.
   while(kOpenSslModeMoveBufferOwnership &&
         readBuf_.front() != nullptr && readBuf_.front()->length() == 0) {
     readBuf_.pop_front();
   }
 
+  // The handlers of the requests parsed here are set up together after
+  // the parse; not for serial protocols, which parse one at a time
+  const bool collect = batchRequestDispatch_ && !collectingRequests_ &&
+    isDownstream() && codec_->supportsParallelRequests();
+  if (collect) {
+    collectingRequests_ = true;
+  }
+
   // Pass the ingress data through the codec to parse it. The codec
   // will invoke various methods of the HTTPSession as callbacks.
   const IOBuf* currentReadBuf;
@@ -445,7 +804,11 @@ HTTPSession::processReadData() {
           currentReadBuf->length() != 0)) {
     // We're about to parse, make sure the parser is not paused
     codec_->setParserPaused(false);
-    size_t bytesParsed = codec_->onIngress(*currentReadBuf);
+    size_t bytesParsed;
+    {
+      PhaseTimer parse(this, SessionPhase::INGRESS_PARSE);
+      bytesParsed = codec_->onIngress(*currentReadBuf);
+    }
     if (bytesParsed == 0) {
       // If the codec didn't make any progress with current input, we
       // better get more.
@@ -453,6 +816,67 @@ HTTPSession::processReadData() {
     }
     readBuf_.trimStart(bytesParsed);
   }
+  if (collect) {
+    collectingRequests_ = false;
+    dispatchRequests();
+  }
+  updateAccountedMemory();
+}
+
+void
+HTTPSession::dispatchRequests() {
+  if (requestsToDispatch_.empty()) {
+    return;
+  }
+  DestructorGuard dg(this);
+  PhaseTimer dispatch(this, SessionPhase::HANDLER_DISPATCH);
+  std::vector<HTTPCodec::StreamID> streamIDs;
+  streamIDs.swap(requestsToDispatch_);
+
+  std::vector<HTTPTransaction*> txns;
+  std::vector<HTTPMessage*> msgs;
+  size_t dispatched = 0;
+  for (auto streamID: streamIDs) {
+    HTTPTransaction* txn = findTransaction(streamID);
+    if (!txn || !txn->isIngressQueuedForHandler()) {
+      continue;
+    }
+    HTTPMessage* msg = txn->getQueuedHeaders();
+    if (!msg) {
+      // Dropped with an error before it had a handler
+      txn->sendAbort();
+      continue;
+    }
+    streamIDs[dispatched++] = streamID;
+    txns.push_back(txn);
+    msgs.push_back(msg);
+  }
+  streamIDs.resize(dispatched);
+  if (txns.empty()) {
+    return;
+  }
+  setupOnRequests(txns, msgs);
+
+  // The handlers may abort the transactions from the first one's headers on
+  for (auto streamID: streamIDs) {
+    HTTPTransaction* txn = findTransaction(streamID);
+    if (!txn) {
+      continue;
+    }
+    if (!txn->getHandler()) {
+      txn->sendAbort();
+      continue;
+    }
+    txn->dispatchQueuedIngress();
+  }
+}
+
+void
+HTTPSession::setupOnRequests(const std::vector<HTTPTransaction*>& txns,
+                             const std::vector<HTTPMessage*>& msgs) {
+  for (size_t i = 0; i < txns.size(); ++i) {
+    setupOnHeadersComplete(txns[i], msgs[i]);
+  }
 }
 
 void
@@ -462,7 +886,7 @@ HTTPSession::readEOF() noexcept {
   // for SSL only: error without any bytes from the client might happen
   // due to client-side issues with the SSL cert. Note that it can also
   // happen if the client sends a SPDY frame header but no body.
-  if (infoCallback_
+  if ((infoEvents_ & InfoCallback::INGRESS_ERROR)
       && transportInfo_.ssl && transactionSeqNo_ == 0 && readBuf_.empty()) {
     infoCallback_->onIngressError(*this, kErrorClientSilent);
   }
@@ -472,6 +896,7 @@ HTTPSession::readEOF() noexcept {
   // write side of the socket open so those transactions can
   // finish generating responses.)
   setCloseReason(ConnectionCloseReason::READ_EOF);
+  errorOnPipelinedTransactions(getOldestUnansweredTransaction());
   shutdownTransport(true, transactions_.empty());
 }
 
@@ -479,7 +904,7 @@ void
 HTTPSession::readErr(const AsyncSocketException& ex) noexcept {
   DestructorGuard guard(this);
   VLOG(4) << "read error on " << *this << ": " << ex.what();
-  if (infoCallback_ && (
+  if ((infoEvents_ & InfoCallback::INGRESS_ERROR) && (
         ERR_GET_LIB(ex.getErrno()) == ERR_LIB_USER &&
         ERR_GET_REASON(ex.getErrno()) ==
         (int)AsyncSSLSocket::SSL_CLIENT_RENEGOTIATION_ATTEMPT)) {
@@ -494,6 +919,7 @@ HTTPSession::readErr(const AsyncSocketException& ex) noexcept {
     transportInfo_.sslError = ERR_GET_REASON(ex.getErrno());
   }
   setCloseReason(ConnectionCloseReason::IO_READ_ERROR);
+  errorOnPipelinedTransactions(getOldestUnansweredTransaction());
   shutdownTransport(true, transactions_.empty());
 }
 
@@ -506,7 +932,8 @@ HTTPSession::newPushedTransaction(HTTPCodec::StreamID assocStreamId,
   }
   CHECK(isDownstream());
   CHECK_NOTNULL(handler);
-  if (draining_ || (pushedTxns_ >= maxConcurrentPushTransactions_)) {
+  if (draining_ || (pushedTxns_ >= maxConcurrentPushTransactions_) ||
+      (pushedTxns_ >= maxConcurrentOutgoingStreamsRemote_)) {
     // This session doesn't support any more push transactions
     // This could be an actual problem - since a single downstream SPDY session
     // might be connected to N upstream hosts, each of which send M pushes,
@@ -539,7 +966,7 @@ size_t HTTPSession::getCodecSendWindowSize() const {
 
 void
 HTTPSession::setNewTransactionPauseState(HTTPCodec::StreamID streamID) {
-  if (!egressLimitExceeded()) {
+  if (!egressLimitPaused_) {
     return;
   }
 
@@ -549,7 +976,7 @@ HTTPSession::setNewTransactionPauseState(HTTPCodec::StreamID streamID) {
     VLOG(4) << *this << " starting streamID=" << txn->getID()
             << " egress paused. pendingWriteSize_=" << pendingWriteSize_
             << ", numActiveWrites_=" << numActiveWrites_
-            << ", kPendingWriteMax=" << kPendingWriteMax;
+            << ", limit=" << getPendingWriteLimit();
     txn->pauseEgress();
   }
 }
@@ -571,7 +998,7 @@ HTTPSession::onMessageBeginImpl(HTTPCodec::StreamID streamID,
                                 HTTPCodec::StreamID assocStreamID,
                                 HTTPMessage* msg) {
   VLOG(4) << "processing new message on " << *this << ", streamID=" << streamID;
-  if (infoCallback_) {
+  if (infoEvents_ & InfoCallback::REQUEST_BEGIN) {
     infoCallback_->onRequestBegin(*this);
   }
   auto txn = findTransaction(streamID);
@@ -622,7 +1049,13 @@ HTTPSession::onMessageBeginImpl(HTTPCodec::StreamID streamID,
     // The previous transaction hasn't completed yet. Pause reads until
     // it completes; this requires pausing both transactions.
     DCHECK(transactions_.size() == 2);
-    auto prevTxn = &transactions_.begin()->second;
+    HTTPTransaction* prevTxn = nullptr;
+    for (const auto& entry: transactions_) {
+      if (entry.first != streamID) {
+        prevTxn = &entry.second;
+      }
+    }
+    DCHECK(prevTxn);
     if (!prevTxn->isIngressPaused()) {
       DCHECK(prevTxn->isIngressComplete());
       prevTxn->pauseIngress();
@@ -645,7 +1078,15 @@ HTTPSession::onHeadersComplete(HTTPCodec::StreamID streamID,
     setCloseReason(ConnectionCloseReason::REQ_NOTREUSABLE);
   }
 
-  if (infoCallback_) {
+  const auto& headerSize = msg->getIngressHeaderSize();
+  accounting_.ingressHeaderBytes += headerSize.uncompressed;
+  accounting_.ingressHeaderBytesCompressed +=
+    headerSize.compressed ? headerSize.compressed : headerSize.uncompressed;
+  if (sessionStats_) {
+    sessionStats_->recordIngressHeaderSize(headerSize.uncompressed);
+  }
+
+  if (infoEvents_ & InfoCallback::INGRESS_MESSAGE) {
     infoCallback_->onIngressMessage(*this, *msg.get());
   }
   HTTPTransaction* txn = findTransaction(streamID);
@@ -659,6 +1100,16 @@ HTTPSession::onHeadersComplete(HTTPCodec::StreamID streamID,
   msg->setSecureInfo(transportInfo_.sslVersion, sslCipher);
   msg->setSecure(transportInfo_.ssl);
 
+  if (collectingRequests_ && !txn->getHandler()) {
+    // Its handler is set up with the rest of the read's, in
+    // dispatchRequests(); the transaction queues its ingress until then
+    txn->queueIngressForHandler();
+    requestsToDispatch_.push_back(streamID);
+    txn->onIngressHeadersComplete(std::move(msg));
+    return;
+  }
+
+  PhaseTimer dispatch(this, SessionPhase::HANDLER_DISPATCH);
   setupOnHeadersComplete(txn, msg.get());
 
   // The txn may have already been aborted by the handler.
@@ -687,16 +1138,35 @@ HTTPSession::onBody(HTTPCodec::StreamID streamID,
   uint64_t length = chain->computeChainDataLength();
   HTTPTransaction* txn = findTransaction(streamID);
   if (!txn) {
-    if (connFlowControl_ &&
-        connFlowControl_->ingressBytesProcessed(writeBuf_, length)) {
-      scheduleWrite();
-    }
+    sessionBytesProcessed(length);
     invalidStream(streamID);
     return;
   }
   auto oldSize = pendingReadSize_;
   pendingReadSize_ += length + padding;
-  txn->onIngressBody(std::move(chain), padding);
+  {
+    PhaseTimer dispatch(this, SessionPhase::HANDLER_DISPATCH);
+    txn->onIngressBody(std::move(chain), padding);
+  }
+  if (kDefaultStreamReadBufLimit > 0 && oldSize < pendingReadSize_ &&
+      codec_->supportsParallelRequests() &&
+      !codec_->supportsStreamFlowControl()) {
+    // No window holds this stream back, so reset it before its buffered
+    // body pauses reads for all the others
+    txn = findTransaction(streamID);
+    if (txn && txn->getReceiveWindow().getOutstanding() >
+        kDefaultStreamReadBufLimit) {
+      VLOG(3) << *this << " resetting streamID=" << streamID
+              << " for buffering " << txn->getReceiveWindow().getOutstanding()
+              << " bytes of ingress";
+      HTTPException ex(HTTPException::Direction::INGRESS_AND_EGRESS,
+        folly::to<std::string>("Stream buffered more than ",
+                               kDefaultStreamReadBufLimit,
+                               " bytes of ingress"));
+      ex.setCodecStatusCode(ErrorCode::FLOW_CONTROL_ERROR);
+      txn->onError(ex);
+    }
+  }
   if (oldSize < pendingReadSize_) {
     // Transaction must have buffered something and not called
     // notifyBodyProcessed() on it.
@@ -706,7 +1176,7 @@ HTTPSession::onBody(HTTPCodec::StreamID streamID,
     if (pendingReadSize_ > kDefaultReadBufLimit &&
         oldSize <= kDefaultReadBufLimit) {
       VLOG(4) << *this << " pausing due to read limit exceeded.";
-      if (infoCallback_) {
+      if (infoEvents_ & InfoCallback::INGRESS_LIMIT_EXCEEDED) {
         infoCallback_->onIngressLimitExceeded(*this);
       }
       pauseReads();
@@ -791,6 +1261,7 @@ HTTPSession::onMessageComplete(HTTPCodec::StreamID streamID,
   if (txnIngressFinished) {
     decrementTransactionCount(txn, true, false);
   }
+  const auto txnID = txn->getID();
   txn->onIngressEOM();
 
   // The codec knows, based on the semantics of whatever protocol it
@@ -816,6 +1287,8 @@ HTTPSession::onMessageComplete(HTTPCodec::StreamID streamID,
       txnIngressFinished &&
       !codec_->supportsParallelRequests()) {
     VLOG(4) << *this << " cannot reuse ingress";
+    // The server won't answer what was pipelined behind this one
+    errorOnPipelinedTransactions(txnID);
     shutdownTransport(true, false);
   }
 }
@@ -831,12 +1304,15 @@ void HTTPSession::onError(HTTPCodec::StreamID streamID,
   if (ingressError_) {
     return;
   }
+  // The handlers of the requests before it see the error as they would
+  // have without batching
+  dispatchRequests();
   if (!codec_->supportsParallelRequests()) {
     // this error should only prevent us from reading/handling more errors
     // on serial streams
     ingressError_ = true;
   }
-  if ((streamID == 0) && infoCallback_) {
+  if ((streamID == 0) && (infoEvents_ & InfoCallback::INGRESS_ERROR)) {
     infoCallback_->onIngressError(*this, kErrorMessage);
   }
 
@@ -877,6 +1353,7 @@ void HTTPSession::onAbort(HTTPCodec::StreamID streamID,
                           ErrorCode code) {
   VLOG(4) << "stream abort on " << *this << ", streamID=" << streamID
           << ", code=" << getErrorCodeString(code);
+  dispatchRequests();
   HTTPTransaction* txn = findTransaction(streamID);
   if (!txn) {
     VLOG(4) << *this << " abort for unrecognized transaction, streamID= "
@@ -916,12 +1393,11 @@ void HTTPSession::onGoaway(uint64_t lastGoodStreamID,
   vector<HTTPCodec::StreamID> ids;
   HTTPCodec::StreamID firstStream = HTTPCodec::NoStream;
 
-  for (const auto& txn: transactions_) {
-    auto streamID = txn.first;
+  for (auto streamID: getSortedTransactionIds()) {
     if (((bool)(streamID & 0x01) == isUpstream()) &&
         (streamID > lastGoodStreamID)) {
       if (firstStream == HTTPCodec::NoStream) {
-        // transactions_ is a set so it should be sorted by stream id.
+        // The ids are sorted, so this is the lowest unacknowledged stream.
         // We will defer adding the firstStream to the id list until
         // we can determine whether we have a codec error code.
         firstStream = streamID;
@@ -972,7 +1448,17 @@ void HTTPSession::onPingRequest(uint64_t uniqueID) {
 
 void HTTPSession::onPingReply(uint64_t uniqueID) {
   VLOG(4) << *this << " got ping reply with id=" << uniqueID;
-  if (infoCallback_) {
+  if (pingSentTime_) {
+    auto rtt = std::chrono::duration_cast<std::chrono::microseconds>(
+      getCurrentTime() - *pingSentTime_);
+    // Smoothed as in RFC 6298
+    pingRTT_ = pingRTT_.count() == 0 ? rtt : (7 * pingRTT_ + rtt) / 8;
+    pingSentTime_.clear();
+    if (pingTimeout_) {
+      pingTimeout_->scheduleTimeout(pingInterval_.count());
+    }
+  }
+  if (infoEvents_ & InfoCallback::PING) {
     infoCallback_->onPingReplyReceived();
   }
 }
@@ -995,19 +1481,65 @@ void HTTPSession::onWindowUpdate(HTTPCodec::StreamID streamID,
 }
 
 void HTTPSession::onSettings(const SettingsList& settings) {
+  // Only the last of several initial windows in one frame is applied
+  folly::Optional<uint32_t> sendWindow;
   for (auto& setting: settings) {
     if (setting.id == SettingsId::INITIAL_WINDOW_SIZE) {
-      onSetSendWindow(setting.value);
+      sendWindow = setting.value;
     } else if (setting.id == SettingsId::MAX_CONCURRENT_STREAMS) {
       onSetMaxInitiatedStreams(setting.value);
     }
   }
+  if (sendWindow) {
+    onSetSendWindow(*sendWindow);
+  }
+}
+
+void HTTPSession::onPriority(HTTPCodec::StreamID streamID,
+                             const http2::PriorityUpdate& pri) {
+  VLOG(4) << *this << " got priority on streamID=" << streamID
+          << " dependency=" << pri.streamDependency
+          << " exclusive=" << pri.exclusive << " weight=" << int(pri.weight);
+  HTTPTransaction* txn = findTransaction(streamID);
+  if (txn) {
+    txn->updatePriority(pri);
+  } else {
+    // HEADERS with priority report it before onMessageBegin
+    pendingPriorityStream_ = streamID;
+    pendingPriority_ = pri;
+  }
+}
+
+void HTTPSession::onAltSvc(HTTPCodec::StreamID streamID,
+                           const AltSvc& altSvc) {
+  VLOG(4) << *this << " got alt-svc on streamID=" << streamID
+          << " protocol=" << altSvc.protocol << " host=" << altSvc.host
+          << " port=" << altSvc.port << " maxAge=" << altSvc.maxAge;
+  if (infoEvents_ & InfoCallback::ALT_SVC) {
+    infoCallback_->onAltSvc(*this, altSvc);
+  }
 }
 
 void HTTPSession::onSetSendWindow(uint32_t windowSize) {
   VLOG(4) << *this << " got send window size adjustment. new=" << windowSize;
-  invokeOnAllTransactions(&HTTPTransaction::onIngressSetSendWindow,
-                          windowSize);
+  bool grew = windowSize > initialSendWindow_.size;
+  initialSendWindow_.size = windowSize;
+  if (!grew) {
+    // The transactions see the smaller window when they next use it
+    return;
+  }
+  // Only the transactions the window paused may have to resume
+  DestructorGuard g(this);
+  std::vector<HTTPCodec::StreamID> ids;
+  for (auto& txn: initialSendWindow_.paused) {
+    ids.push_back(txn.getID());
+  }
+  for (auto id: ids) {
+    auto txn = findTransaction(id);
+    if (txn != nullptr) {
+      txn->onIngressSetSendWindow(windowSize);
+    }
+  }
 }
 
 void HTTPSession::onSetMaxInitiatedStreams(uint32_t maxTxns) {
@@ -1015,7 +1547,8 @@ void HTTPSession::onSetMaxInitiatedStreams(uint32_t maxTxns) {
           << "we can initiate: " << maxTxns;
   const bool didSupport = supportsMoreTransactions();
   maxConcurrentOutgoingStreamsRemote_ = maxTxns;
-  if (infoCallback_ && didSupport != supportsMoreTransactions()) {
+  if ((infoEvents_ & InfoCallback::OUTGOING_STREAMS) &&
+      didSupport != supportsMoreTransactions()) {
     if (didSupport) {
       infoCallback_->onSettingsOutgoingStreamsFull(*this);
     } else {
@@ -1061,7 +1594,7 @@ HTTPSession::transactionTimeout(HTTPTransaction* txn) noexcept {
     VLOG(4) << *this << " creating direct error handler";
     auto handler = getTransactionTimeoutHandler(txn);
     txn->setHandler(handler);
-    if (infoCallback_) {
+    if (infoEvents_ & InfoCallback::INGRESS_ERROR) {
       infoCallback_->onIngressError(*this, kErrorTimeout);
     }
   }
@@ -1075,6 +1608,37 @@ HTTPSession::transactionTimeout(HTTPTransaction* txn) noexcept {
 void HTTPSession::sendHeaders(HTTPTransaction* txn,
                               const HTTPMessage& headers,
                               HTTPHeaderSize* size) noexcept {
+  sendHeadersWithOptionalEOM(txn, headers, size, false);
+}
+
+void HTTPSession::sendHeadersWithEOM(HTTPTransaction* txn,
+                                     const HTTPMessage& headers,
+                                     HTTPHeaderSize* size) noexcept {
+  sendHeadersWithOptionalEOM(txn, headers, size, true);
+}
+
+bool HTTPSession::canSendHeadersWithBody(size_t bodyLen) const noexcept {
+  // Bodies bigger than a write, or behind other transactions, go through
+  // the egress queue, for the write buffer limit and priorities to apply
+  return bodyLen <= egressBytesPerWrite_ && txnEgressQueue_.empty() &&
+    (!connFlowControl_ || connFlowControl_->getAvailableSend() >= bodyLen);
+}
+
+size_t HTTPSession::sendHeadersWithBodyAndEOM(
+    HTTPTransaction* txn,
+    const HTTPMessage& headers,
+    HTTPHeaderSize* size,
+    std::unique_ptr<folly::IOBuf> body) noexcept {
+  DCHECK(canSendHeadersWithBody(body->computeChainDataLength()));
+  return sendHeadersWithOptionalEOM(txn, headers, size, true, std::move(body));
+}
+
+size_t HTTPSession::sendHeadersWithOptionalEOM(
+    HTTPTransaction* txn,
+    const HTTPMessage& headers,
+    HTTPHeaderSize* size,
+    bool eom,
+    std::unique_ptr<folly::IOBuf> body) noexcept {
   CHECK(started_);
   unique_ptr<IOBuf> goawayBuf;
   if (shouldShutdown()) {
@@ -1092,21 +1656,39 @@ void HTTPSession::sendHeaders(HTTPTransaction* txn,
                          txn->getID(),
                          headers,
                          headers.isRequest() ? txn->getAssocTxnId() : 0,
-                         false, // eom
+                         eom && !body,
                          size);
+  const uint64_t headersOffset = sessionByteOffset();
+  size_t encodedBodySize = 0;
+  if (body) {
+    // The connection window is reserved by the flow control filter
+    encodedBodySize = codec_->generateBody(writeBuf_,
+                                           txn->getID(),
+                                           std::move(body),
+                                           HTTPCodec::NoPadding,
+                                           eom);
+  }
   const uint64_t newOffset = sessionByteOffset();
 
   // only do it for downstream now to bypass handling upstream reuse cases
   if (isDownstream() &&
-      newOffset > oldOffset &&
+      headersOffset > oldOffset &&
       // catch 100-ish response?
       !txn->testAndSetFirstHeaderByteSent() && byteEventTracker_) {
-    byteEventTracker_->addFirstHeaderByteEvent(newOffset, txn);
+    byteEventTracker_->addFirstHeaderByteEvent(headersOffset, txn);
+  }
+  if (encodedBodySize > 0 && !txn->testAndSetFirstByteSent() &&
+      byteEventTracker_) {
+    byteEventTracker_->addFirstBodyByteEvent(headersOffset, txn);
   }
 
   if (size) {
     VLOG(4) << *this << " sending headers, size=" << size->compressed
             << ", uncompressedSize=" << size->uncompressed;
+    // 0 when the protocol doesn't compress them
+    accounting_.egressHeaderBytes += size->uncompressed;
+    accounting_.egressHeaderBytesCompressed +=
+      size->compressed ? size->compressed : size->uncompressed;
   }
   if (goawayBuf) {
     VLOG(4) << *this << " moved GOAWAY to end of writeBuf";
@@ -1114,6 +1696,20 @@ void HTTPSession::sendHeaders(HTTPTransaction* txn,
   }
   scheduleWrite();
   onHeadersSent(headers, wasReusable);
+  if (eom) {
+    VLOG(4) << *this << " sending EOM with headers for streamID="
+            << txn->getID();
+    if (!txn->testAndSetFirstByteSent()) {
+      txn->onEgressBodyFirstByte();
+    }
+    txn->onEgressBodyLastByte();
+    if (newOffset > oldOffset && byteEventTracker_) {
+      byteEventTracker_->addLastByteEvent(txn, newOffset,
+                                          sock_->isEorTrackingEnabled());
+    }
+    onEgressMessageFinished(txn);
+  }
+  return encodedBodySize;
 }
 
 size_t
@@ -1180,7 +1776,7 @@ HTTPSession::onEgressMessageFinished(HTTPTransaction* txn, bool withRST) {
   // to be read or sent on this connection, close the socket in one or
   // more directions.
   CHECK(!transactions_.empty());
-  if (infoCallback_) {
+  if (infoEvents_ & InfoCallback::REQUEST_END) {
     infoCallback_->onRequestEnd(*this, txn->getMaxDeferredSize());
   }
   decrementTransactionCount(txn, false, true);
@@ -1285,12 +1881,29 @@ HTTPSession::decrementTransactionCount(HTTPTransaction* txn,
   }
 }
 
+void HTTPSession::reportPoolAllocations() {
+  if (!sessionStats_) {
+    return;
+  }
+  auto report = [this] (PooledObject object, PoolCounts counts) {
+    if (counts.allocated > 0 || counts.reused > 0) {
+      sessionStats_->recordPoolAllocations(object, counts.allocated,
+                                           counts.reused);
+    }
+  };
+  report(PooledObject::TRANSACTION,
+         ThreadLocalFreeList<HTTPTransaction>::takeCounts());
+  report(PooledObject::MESSAGE,
+         ThreadLocalFreeList<HTTPMessage>::takeCounts());
+  report(PooledObject::HEADER_VECTORS, HTTPHeaders::takeVectorPoolCounts());
+  report(PooledObject::BYTE_EVENT, ByteEvent::takePoolCounts());
+}
+
 void
 HTTPSession::detach(HTTPTransaction* txn) noexcept {
   DestructorGuard guard(this);
   HTTPCodec::StreamID streamID = txn->getID();
-  auto it = transactions_.find(txn->getID());
-  DCHECK(it != transactions_.end());
+  DCHECK(transactions_.find(streamID) == txn);
   if (!txn->isIngressPaused()) {
     VLOG(4) << *this << " removing streamID=" << streamID <<
         ", liveTransactions was " << liveTransactions_;
@@ -1308,25 +1921,36 @@ HTTPSession::detach(HTTPTransaction* txn) noexcept {
     }
   }
   decrementTransactionCount(txn, true, true);
-  transactions_.erase(it);
+  if (kAllocStatsEnabled && sessionStats_) {
+    sessionStats_->recordTransactionAllocCounts(txn->getAllocCounts());
+  }
+  if (sessionStats_ && txn->getArenaSize() > 0) {
+    sessionStats_->recordTransactionArenaSize(txn->getArenaSize());
+  }
+  transactions_.erase(streamID);
+  reportPoolAllocations();
 
   if (transactions_.empty()) {
     latestActive_ = getCurrentTime();
-    if (infoCallback_) {
+    if (infoEvents_ & InfoCallback::CONNECTION_ACTIVITY) {
       infoCallback_->onDeactivateConnection(*this);
     }
+    if (idleMemoryTimeout_) {
+      idleMemoryTimeout_->scheduleTimeout(idleMemoryInterval_.count());
+    }
   } else {
-    if (infoCallback_) {
+    if (infoEvents_ & InfoCallback::TRANSACTION_DETACHED) {
       infoCallback_->onTransactionDetached(*this);
     }
   }
 
   if (!readsShutdown()) {
-    if (!codec_->supportsParallelRequests() && !transactions_.empty()) {
+    if (!codec_->supportsParallelRequests() && !transactions_.empty() &&
+        maxPipelineDepth_ == 1) {
       // If we had more than one transaction, then someone tried to pipeline and
       // we paused reads
       DCHECK(transactions_.size() == 1);
-      auto& nextTxn = transactions_.begin()->second;
+      auto& nextTxn = (*transactions_.begin()).second;
       DCHECK(nextTxn.isIngressPaused());
       DCHECK(!nextTxn.isIngressComplete());
       nextTxn.resumeIngress();
@@ -1360,6 +1984,21 @@ HTTPSession::detach(HTTPTransaction* txn) noexcept {
 size_t
 HTTPSession::sendWindowUpdate(HTTPTransaction* txn,
                               uint32_t bytes) noexcept {
+  if (batchWindowUpdates_ || memoryPressure_) {
+    auto id = txn->getID();
+    auto it = std::find_if(
+      pendingWindowUpdates_.begin(), pendingWindowUpdates_.end(),
+      [id] (const std::pair<HTTPCodec::StreamID, uint32_t>& update) {
+        return update.first == id;
+      });
+    if (it != pendingWindowUpdates_.end()) {
+      it->second += bytes;
+    } else {
+      pendingWindowUpdates_.emplace_back(id, bytes);
+    }
+    scheduleWindowUpdates();
+    return 0;
+  }
   size_t sent = codec_->generateWindowUpdate(writeBuf_, txn->getID(), bytes);
   if (sent) {
     scheduleWrite();
@@ -1367,6 +2006,72 @@ HTTPSession::sendWindowUpdate(HTTPTransaction* txn,
   return sent;
 }
 
+void
+HTTPSession::sessionBytesProcessed(uint32_t bytes) {
+  if (!connFlowControl_) {
+    return;
+  }
+  if (batchWindowUpdates_ || memoryPressure_) {
+    pendingSessionWindowUpdate_ += bytes;
+    scheduleWindowUpdates();
+  } else if (connFlowControl_->ingressBytesProcessed(writeBuf_, bytes)) {
+    scheduleWrite();
+  }
+}
+
+void
+HTTPSession::scheduleWindowUpdates() {
+  if (!isLoopCallbackScheduled()) {
+    sock_->getEventBase()->runInLoop(this);
+  }
+}
+
+void
+HTTPSession::flushWindowUpdates() {
+  if (memoryPressure_) {
+    return;
+  }
+  for (const auto& update: pendingWindowUpdates_) {
+    // A stream that finished meanwhile doesn't need more credit
+    if (findTransaction(update.first)) {
+      codec_->generateWindowUpdate(writeBuf_, update.first, update.second);
+    }
+  }
+  pendingWindowUpdates_.clear();
+  if (pendingSessionWindowUpdate_ > 0) {
+    connFlowControl_->setRoundTripTime(getRoundTripTime());
+    connFlowControl_->ingressBytesProcessed(writeBuf_,
+                                            pendingSessionWindowUpdate_);
+    pendingSessionWindowUpdate_ = 0;
+  }
+}
+
+void HTTPSession::setSessionWindowUpdateThreshold(uint32_t threshold) {
+  if (connFlowControl_) {
+    connFlowControl_->setWindowUpdateThreshold(threshold);
+  }
+}
+
+void HTTPSession::setSessionWindowAutoTuning(uint32_t maxSize) {
+  if (connFlowControl_) {
+    connFlowControl_->setRoundTripTime(getRoundTripTime());
+    connFlowControl_->setReceiveWindowAutoTuning(maxSize);
+  }
+}
+
+std::chrono::microseconds
+HTTPSession::getReceiveWindowTuningRTT() const noexcept {
+  // Window updates are held back under pressure anyway
+  if (memoryPressure_) {
+    return std::chrono::microseconds(0);
+  }
+  return getRoundTripTime();
+}
+
+std::chrono::microseconds HTTPSession::getRoundTripTime() const {
+  return pingRTT_.count() > 0 ? pingRTT_ : transportInfo_.rtt;
+}
+
 void
 HTTPSession::notifyIngressBodyProcessed(uint32_t bytes) noexcept {
   CHECK(pendingReadSize_ >= bytes);
@@ -1375,10 +2080,8 @@ HTTPSession::notifyIngressBodyProcessed(uint32_t bytes) noexcept {
   VLOG(4) << *this << " Dequeued " << bytes << " bytes of ingress. "
     << "Ingress buffer uses " << pendingReadSize_  << " of "
     << kDefaultReadBufLimit << " bytes.";
-  if (connFlowControl_ &&
-      connFlowControl_->ingressBytesProcessed(writeBuf_, bytes)) {
-    scheduleWrite();
-  }
+  sessionBytesProcessed(bytes);
+  updateAccountedMemory();
   if (oldSize > kDefaultReadBufLimit &&
       pendingReadSize_ <= kDefaultReadBufLimit) {
     resumeReads();
@@ -1437,6 +2140,38 @@ bool HTTPSession::getCurrentTransportInfo(TransportInfo* tinfo) {
   return false;
 }
 
+bool HTTPSession::setNotSentLowWatermark(uint32_t bytes) {
+#ifdef TCP_NOTSENT_LOWAT
+  AsyncSocket* sock = dynamic_cast<AsyncSocket*>(sock_.get());
+  int value = bytes;
+  if (!sock || sock->setSockOpt(IPPROTO_TCP, TCP_NOTSENT_LOWAT, &value) != 0) {
+    VLOG(4) << *this << " can't set TCP_NOTSENT_LOWAT";
+    return false;
+  }
+  egressBytesPerWrite_ = std::min(egressBytesPerWrite_,
+                                  std::max(bytes, kMinLowWatermarkWrite));
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool HTTPSession::setTLSRecordSizing(uint32_t recordSize,
+                                     uint32_t smallBytes,
+                                     std::chrono::milliseconds idleTime) {
+  AsyncSSLSocket* sock = dynamic_cast<AsyncSSLSocket*>(sock_.get());
+  if (!sock) {
+    VLOG(4) << *this << " can't size the TLS records of a plain transport";
+    return false;
+  }
+  tlsSmallRecordSize_ = std::max<uint32_t>(recordSize,
+                                           sock->getMinWriteSize());
+  tlsSmallRecordBytes_ = smallBytes;
+  tlsRecordIdleTime_ = idleTime;
+  tlsSmallBytesLeft_ = smallBytes;
+  return true;
+}
+
 void HTTPSession::setByteEventTracker(
     std::unique_ptr<ByteEventTracker> byteEventTracker) {
   byteEventTracker_ = std::move(byteEventTracker);
@@ -1445,9 +2180,9 @@ void HTTPSession::setByteEventTracker(
 }
 
 unique_ptr<IOBuf> HTTPSession::getNextToSend(bool* cork, bool* eom) {
-  // limit ourselves to one outstanding write at a time (onWriteSuccess calls
-  // scheduleWrite)
-  if (numActiveWrites_ > 0 || writesShutdown()) {
+  // limit ourselves to maxActiveWrites_ outstanding writes at a time
+  // (onWriteSuccess calls scheduleWrite)
+  if (numActiveWrites_ >= maxActiveWrites_ || writesShutdown()) {
     VLOG(4) << "skipping write during this loop, numActiveWrites_=" <<
       numActiveWrites_ << " writesShutdown()=" << writesShutdown();
     return nullptr;
@@ -1455,9 +2190,30 @@ unique_ptr<IOBuf> HTTPSession::getNextToSend(bool* cork, bool* eom) {
 
   // We always tack on at least one body packet to the current write buf
   // This ensures that a short HTTPS response will go out in a single SSL record
+  //
+  // Transactions are then served deficit round robin: each turn credits the
+  // txn at the top of the queue with egressQuantum_ body bytes, and we keep
+  // visiting transactions until this write reaches egressBytesPerWrite_, so
+  // one large download does not push tiny responses into separate writes.
   while (!txnEgressQueue_.empty()) {
-    uint32_t allowed = txnEgressQueue_.size() > 1 ? egressBodySizeLimit_ :
-      kWriteReadyMax;
+    const size_t buffered = writeBuf_.chainLength();
+    if (buffered >= egressBytesPerWrite_) {
+      break;
+    }
+    HTTPTransaction* txn;
+    uint32_t allowed = egressBytesPerWrite_ - buffered;
+    if (usePriorityTree_) {
+      // HTTP/2: the dependency tree picks the stream and its share
+      auto node = txnEgressTree_.nextEgress();
+      CHECK(node);
+      txn = node->getTransaction();
+      allowed = std::min(allowed, node->egressAllowance());
+    } else {
+      txn = txnEgressQueue_.top();
+      if (txnEgressQueue_.size() > 1) {
+        allowed = std::min(allowed, txn->addEgressQuantum(egressQuantum_));
+      }
+    }
     if (connFlowControl_) {
       allowed = std::min(allowed, connFlowControl_->getAvailableSend());
       if (allowed == 0) {
@@ -1466,15 +2222,18 @@ unique_ptr<IOBuf> HTTPSession::getNextToSend(bool* cork, bool* eom) {
         break;
       }
     }
-    auto txn = txnEgressQueue_.top();
     // returns true if there is more egress pending for this txn
-    if (txn->onWriteReady(allowed) || writeBuf_.front()) {
+    if (txn->onWriteReady(allowed) &&
+        writeBuf_.chainLength() == buffered) {
+      // no progress, e.g. the txn is rate limited
       break;
     }
   }
   *eom = false;
   if (byteEventTracker_) {
-    uint64_t needed = byteEventTracker_->preSend(cork, eom, bytesWritten_);
+    // Writes may still be in flight, so measure from the end of the last
+    // segment handed to the transport rather than from bytesWritten_
+    uint64_t needed = byteEventTracker_->preSend(cork, eom, bytesScheduled_);
     if (needed > 0) {
       VLOG(5) << *this << " writeBuf_.chainLength(): "
               << writeBuf_.chainLength() << " txnEgressQueue_.empty(): "
@@ -1507,6 +2266,8 @@ HTTPSession::runLoopCallback() noexcept {
   //   * The session has generated some egress data (see scheduleWrite())
   //   * Reads have become unpaused (see resumeReads())
   DestructorGuard dg(this);
+  SampledCallback sampled(this, "runLoopCallback");
+  AllocStatsScope allocScope(allocCounts_);
   inLoopCallback_ = true;
   folly::ScopeGuard scopeg = folly::makeGuard([this] {
       inLoopCallback_ = false;
@@ -1517,11 +2278,22 @@ HTTPSession::runLoopCallback() noexcept {
       checkForShutdown();
     });
   VLOG(5) << *this << " in loop callback";
+  flushWindowUpdates();
 
   for (uint32_t i = 0; i < kMaxWritesPerLoop; ++i) {
+    if (tenant_ && hasPendingEgress() &&
+        !tenantScheduler_->mayWrite(tenant_, this)) {
+      VLOG(4) << *this << " holding writes for the other tenants";
+      tenantWritesHeld_ = true;
+      break;
+    }
     bool cork = true;
     bool eom = false;
-    unique_ptr<IOBuf> writeBuf = getNextToSend(&cork, &eom);
+    unique_ptr<IOBuf> writeBuf;
+    {
+      PhaseTimer serialize(this, SessionPhase::EGRESS_SERIALIZE);
+      writeBuf = getNextToSend(&cork, &eom);
+    }
 
     if (!writeBuf) {
       break;
@@ -1534,6 +2306,13 @@ HTTPSession::runLoopCallback() noexcept {
       checkForShutdown();
       return;
     }
+    if (shouldCoalesceEgress(len)) {
+      // Hold it for the responses to the requests right behind
+      VLOG(4) << *this << " holding " << len << " bytes of egress";
+      writeBuf_.append(std::move(writeBuf));
+      sock_->getEventBase()->runInLoop(this);
+      break;
+    }
 
     WriteSegment* segment = new WriteSegment(this, len);
     segment->setCork(cork);
@@ -1548,16 +2327,35 @@ HTTPSession::runLoopCallback() noexcept {
     VLOG(4) << *this << " writing " << len << ", activeWrites="
              << numActiveWrites_ << " cork=" << cork << " eom=" << eom;
     bytesScheduled_ += len;
-    sock_->writeChain(segment, std::move(writeBuf), segment->getFlags());
+    if (tenant_) {
+      tenantScheduler_->chargeEgress(tenant_, len);
+    }
+    // Account for the segment before handing it off; a synchronous
+    // onWriteSuccess() subtracts it again.
+    // updateWriteBufSize called in scope guard
+    pendingWriteSizeDelta_ += len;
+    if (tlsSmallRecordBytes_ > 0) {
+      writeBuf = sizeTLSRecords(std::move(writeBuf));
+    }
+    {
+      PhaseTimer write(this, SessionPhase::WRITE);
+      sock_->writeChain(segment, std::move(writeBuf), segment->getFlags());
+    }
+    if (sessionStats_) {
+      sessionStats_->recordWriteBufferSize(
+        pendingWriteSize_ + pendingWriteSizeDelta_);
+    }
     if (numActiveWrites_ > 0) {
       updateWriteCount();
-      pendingWriteSizeDelta_ += len;
-      // updateWriteBufSize called in scope guard
-      break;
+      if (numActiveWrites_ >= maxActiveWrites_) {
+        break;
+      }
     }
     // writeChain can result in a writeError and trigger the shutdown code path
   }
-  if (numActiveWrites_ == 0 && !writesShutdown() && hasMoreWrites() &&
+  if (!tenantWritesHeld_ &&
+      numActiveWrites_ < maxActiveWrites_ && !writesShutdown() &&
+      hasPendingEgress() &&
       (!connFlowControl_ || connFlowControl_->getAvailableSend())) {
     scheduleWrite();
   }
@@ -1566,20 +2364,116 @@ HTTPSession::runLoopCallback() noexcept {
     processReadData();
 
     // Install the read callback if necessary
-    if (readsUnpaused() && !sock_->getReadCallback()) {
+    if (readsUnpaused() && !tenantReadsHeld_ && !sock_->getReadCallback()) {
       sock_->setReadCB(this);
     }
   }
   // checkForShutdown is now in ScopeGuard
 }
 
+void HTTPSession::onIngressAllowed() noexcept {
+  tenantReadsHeld_ = false;
+  if (readsUnpaused() && !sock_->getReadCallback()) {
+    resetTimeout();
+    sock_->setReadCB(this);
+  }
+}
+
+void HTTPSession::onEgressAllowed() noexcept {
+  tenantWritesHeld_ = false;
+  scheduleWrite();
+}
+
+void HTTPSession::chargeTenantIngress(size_t bytes) {
+  if (!tenant_) {
+    return;
+  }
+  tenantScheduler_->chargeIngress(tenant_, bytes);
+  if (readsUnpaused() && !tenantScheduler_->mayRead(tenant_, this)) {
+    VLOG(4) << *this << " holding reads for the other tenants";
+    tenantReadsHeld_ = true;
+    // the idle timeout is not the peer's fault while reads are held
+    cancelTimeout();
+    sock_->setReadCB(nullptr);
+  }
+}
+
+void HTTPSession::setTenantScheduler(TenantScheduler* scheduler) {
+  if (tenantScheduler_) {
+    tenantScheduler_->removeMember(tenant_, this);
+  }
+  tenantScheduler_ = scheduler;
+  tenant_ = scheduler ? scheduler->addMember(scheduler->classify(*this)) :
+    nullptr;
+  // the old scheduler would have let go of them
+  if (tenantReadsHeld_) {
+    onIngressAllowed();
+  }
+  if (tenantWritesHeld_) {
+    onEgressAllowed();
+  }
+}
+
+unique_ptr<IOBuf> HTTPSession::sizeTLSRecords(unique_ptr<IOBuf> writeBuf) {
+  auto now = getCurrentTime();
+  if (timePointInitialized(lastWriteTime_) &&
+      now - lastWriteTime_ >= tlsRecordIdleTime_) {
+    // The congestion window may have collapsed meanwhile, start over
+    tlsSmallBytesLeft_ = tlsSmallRecordBytes_;
+  }
+  lastWriteTime_ = now;
+  if (tlsSmallBytesLeft_ == 0) {
+    return writeBuf;
+  }
+  // The transport writes each buffer of at least its minimum write size
+  // in a record of its own
+  IOBufQueue queue{IOBufQueue::cacheChainLength()};
+  queue.append(std::move(writeBuf));
+  IOBufQueue records;
+  while (tlsSmallBytesLeft_ > 0 && !queue.empty()) {
+    size_t len = std::min<size_t>(
+      std::min(tlsSmallRecordSize_, tlsSmallBytesLeft_),
+      queue.chainLength());
+    auto record = queue.split(len);
+    record->coalesce();
+    records.append(std::move(record));
+    tlsSmallBytesLeft_ -= len;
+  }
+  records.append(queue.move());
+  return records.move();
+}
+
+bool HTTPSession::shouldCoalesceEgress(uint64_t len) {
+  if (egressCoalesceBytes_ == 0 || len >= egressCoalesceBytes_ ||
+      !writeBuf_.empty() || !txnEgressQueue_.empty() || writesShutdown()) {
+    egressCoalesceStart_.clear();
+    return false;
+  }
+  // Only while there are requests that may be answered right away: parsed
+  // and waiting for the ones in front, or not yet parsed
+  bool pipelined = transactions_.size() > 1 ||
+    (readsUnpaused() && !readBuf_.empty());
+  if (!pipelined) {
+    egressCoalesceStart_.clear();
+    return false;
+  }
+  auto now = getCurrentTime();
+  if (!egressCoalesceStart_) {
+    egressCoalesceStart_ = now;
+  } else if (now - *egressCoalesceStart_ >= egressCoalesceDelay_) {
+    egressCoalesceStart_.clear();
+    return false;
+  }
+  return true;
+}
+
 void
 HTTPSession::scheduleWrite() {
   // Do all the network writes for this connection in one batch at
   // the end of the current event loop iteration.  Writing in a
   // batch helps us packetize the network traffic more efficiently,
   // as well as saving a few system calls.
-  if (!isLoopCallbackScheduled() &&
+  if (!isLoopCallbackScheduled() && !tenantWritesHeld_ &&
       (writeBuf_.front() || !txnEgressQueue_.empty())) {
     VLOG(5) << *this << " scheduling write callback";
     sock_->getEventBase()->runInLoop(this);
@@ -1587,16 +2481,39 @@ HTTPSession::scheduleWrite() {
 }
 
 bool HTTPSession::egressLimitExceeded() const {
-  return pendingWriteSize_ >= kPendingWriteMax;
+  return pendingWriteSize_ >= getPendingWriteLimit();
+}
+
+uint64_t HTTPSession::getPendingWriteLimit() const {
+  // Over the budget of all the sessions, each keeps a little, so that
+  // they all make progress. Sessions holding more than that are writing,
+  // and look again as their writes complete.
+  if (egressAccountant_ && egressAccountant_->isUnderPressure()) {
+    return std::min(kPendingWriteMax, pressuredWriteMax_);
+  }
+  return kPendingWriteMax;
+}
+
+uint64_t HTTPSession::getEgressBufferQuota(const HTTPTransaction& txn)
+    const noexcept {
+  if (!egressQuotas_) {
+    return 0;
+  }
+  // Weighted against the default weight, so that streams which all have
+  // it split the limit evenly
+  uint64_t share = getPendingWriteLimit() * txn.getEgressWeight() /
+    (uint64_t(HTTPTransaction::kDefaultEgressWeight) *
+     std::max<size_t>(transactions_.size(), 1));
+  return std::max<uint64_t>(share, kMinEgressQuota);
 }
 
 void
 HTTPSession::updateWriteCount() {
-  if (numActiveWrites_ > 0 && writesUnpaused()) {
+  if (numActiveWrites_ >= maxActiveWrites_ && writesUnpaused()) {
     // Exceeded limit. Pause reading on the incoming stream.
     VLOG(3) << "Pausing egress for " << *this;
     writes_ = SocketState::PAUSED;
-  } else if (numActiveWrites_ == 0 && writesPaused()) {
+  } else if (numActiveWrites_ < maxActiveWrites_ && writesPaused()) {
     // Dropped below limit. Resume reading on the incoming stream if needed.
     VLOG(3) << "Resuming egress for " << *this;
     writes_ = SocketState::UNPAUSED;
@@ -1610,20 +2527,52 @@ HTTPSession::updateWriteBufSize(int64_t delta) {
   delta += pendingWriteSizeDelta_;
   pendingWriteSizeDelta_ = 0;
   DCHECK(delta >= 0 || uint64_t(-delta) <= pendingWriteSize_);
-  bool wasExceeded = egressLimitExceeded();
   pendingWriteSize_ += delta;
+  if (egressAccountant_ && delta) {
+    egressAccountant_->add(delta);
+  }
+  if ((infoEvents_ & InfoCallback::EGRESS_BUFFER) && delta) {
+    infoCallback_->onEgressBufferChanged(*this, delta);
+  }
+  if (delta) {
+    updateAccountedMemory();
+  }
 
-  if (egressLimitExceeded() && !wasExceeded) {
+  bool exceeded = egressLimitExceeded();
+  if (exceeded && !egressLimitPaused_) {
     // Exceeded limit. Pause reading on the incoming stream.
     VLOG(3) << "Pausing txn egress for " << *this;
+    egressLimitPaused_ = true;
     invokeOnAllTransactions(&HTTPTransaction::pauseEgress);
-  } else if (!egressLimitExceeded() && wasExceeded) {
+  } else if (!exceeded && egressLimitPaused_) {
     // Dropped below limit. Resume reading on the incoming stream if needed.
     VLOG(3) << "Resuming txn egress for " << *this;
+    egressLimitPaused_ = false;
     invokeOnAllTransactions(&HTTPTransaction::resumeEgress);
   }
 }
 
+void HTTPSession::addTransportBytes(size_t bytesRead, size_t bytesWritten) {
+  batchedBytesRead_ += bytesRead;
+  batchedBytesWritten_ += bytesWritten;
+  if (!transportBytesCallback_.isLoopCallbackScheduled()) {
+    sock_->getEventBase()->runInLoop(&transportBytesCallback_);
+  }
+}
+
+void HTTPSession::flushTransportBytes() {
+  transportBytesCallback_.cancelLoopCallback();
+  if (batchedBytesRead_ == 0 && batchedBytesWritten_ == 0) {
+    return;
+  }
+  if (infoEvents_ & InfoCallback::BATCHED_BYTES) {
+    infoCallback_->onTransportBytes(*this, batchedBytesRead_,
+                                    batchedBytesWritten_);
+  }
+  batchedBytesRead_ = 0;
+  batchedBytesWritten_ = 0;
+}
+
 void
 HTTPSession::shutdownTransport(bool shutdownReads,
                                bool shutdownWrites) {
@@ -1691,7 +2640,7 @@ HTTPSession::shutdownTransport(bool shutdownReads,
     sock_->setReadCB(nullptr);
     reads_ = SocketState::SHUTDOWN;
     if (!transactions_.empty() && error == kErrorConnectionReset) {
-      if (infoCallback_ != nullptr) {
+      if (infoEvents_ & InfoCallback::INGRESS_ERROR) {
         infoCallback_->onIngressError(*this, error);
       }
     } else if (error == kErrorEOF) {
@@ -1824,19 +2773,132 @@ bool HTTPSession::shouldShutdown() const {
 size_t HTTPSession::sendPing() {
   const size_t bytes = codec_->generatePingRequest(writeBuf_);
   if (bytes) {
+    if (!pingSentTime_) {
+      // Replies aren't told apart, so one ping at a time is timed
+      pingSentTime_ = getCurrentTime();
+    }
     scheduleWrite();
   }
   return bytes;
 }
 
+void HTTPSession::setPingKeepalive(std::chrono::milliseconds interval,
+                                   std::chrono::milliseconds timeout) {
+  pingInterval_ = interval;
+  pingReplyTimeout_ = timeout;
+  if (interval.count() == 0) {
+    pingTimeout_.reset();
+    return;
+  }
+  if (!pingTimeout_) {
+    pingTimeout_ = folly::make_unique<PingTimeout>(this,
+                                                   sock_->getEventBase());
+  }
+  if (started_ && !pingSentTime_) {
+    pingTimeout_->scheduleTimeout(interval.count());
+  }
+}
+
+void HTTPSession::setIdleMemoryTimeout(std::chrono::milliseconds timeout) {
+  idleMemoryInterval_ = timeout;
+  if (timeout.count() == 0) {
+    idleMemoryTimeout_.reset();
+    return;
+  }
+  if (!idleMemoryTimeout_) {
+    idleMemoryTimeout_ = folly::make_unique<IdleMemoryTimeout>(
+      this, sock_->getEventBase());
+  }
+  if (started_ && transactions_.empty()) {
+    idleMemoryTimeout_->scheduleTimeout(timeout.count());
+  }
+}
+
+void HTTPSession::releaseIdleMemory() noexcept {
+  if (!transactions_.empty()) {
+    return;
+  }
+  VLOG(4) << *this << " idle, releasing memory";
+  // Buffers with no data left are only kept for their tailroom. The
+  // transport asks for a read buffer again only once the socket is
+  // readable.
+  if (readBuf_.front() && readBuf_.chainLength() == 0) {
+    readBuf_.move();
+  }
+  if (writeBuf_.front() && writeBuf_.chainLength() == 0) {
+    writeBuf_.move();
+  }
+  codec_->releaseIdleMemory();
+  updateAccountedMemory();
+}
+
+bool HTTPSession::isDetachable() const {
+  return started_ && !inLoopCallback_ && !hasMoreWrites() &&
+    !isLoopCallbackScheduled() &&
+    !transportBytesCallback_.isLoopCallbackScheduled() &&
+    !writeTimeout_.isScheduled() && !flowControlTimeout_.isScheduled() &&
+    pendingWindowUpdates_.empty() && pendingSessionWindowUpdate_ == 0 &&
+    (!byteEventTracker_ || byteEventTracker_->isDetachable()) &&
+    sock_->isDetachable();
+}
+
+void HTTPSession::detachEventBase() {
+  CHECK(isDetachable());
+  VLOG(4) << *this << " detaching from its EventBase";
+  if (readsUnpaused()) {
+    sock_->setReadCB(nullptr);
+  }
+  cancelTimeout();
+  readBufferReleaser_.cancelLoopCallback();
+  releaseEmptyReadBuffer();
+  invokeOnAllTransactions(&HTTPTransaction::detachTimeouts);
+  if (pingTimeout_) {
+    pingTimeout_->cancelTimeout();
+    pingTimeout_->detachEventBase();
+  }
+  if (idleMemoryTimeout_) {
+    idleMemoryTimeout_->cancelTimeout();
+    idleMemoryTimeout_->detachEventBase();
+  }
+  sock_->detachEventBase();
+}
+
+void HTTPSession::attachEventBase(folly::EventBase* eventBase,
+                                  AsyncTimeoutSet* transactionTimeouts,
+                                  AsyncTimeoutSet* headerTimeouts,
+                                  AsyncTimeoutSet* bodyTimeouts) {
+  VLOG(4) << *this << " attaching to a new EventBase";
+  sock_->attachEventBase(eventBase);
+  transactionTimeouts_ = transactionTimeouts;
+  headerTimeouts_ = headerTimeouts;
+  bodyTimeouts_ = bodyTimeouts;
+  invokeOnAllTransactions(&HTTPTransaction::attachTimeouts,
+                          transactionTimeouts, headerTimeouts, bodyTimeouts);
+  if (pingTimeout_) {
+    pingTimeout_->attachEventBase(eventBase);
+    // The rest of the wait for a reply, or a whole interval to the next
+    auto wait = pingInterval_;
+    if (pingSentTime_) {
+      wait = std::max(pingReplyTimeout_ - millisecondsSince(*pingSentTime_),
+                      std::chrono::milliseconds(0));
+    }
+    pingTimeout_->scheduleTimeout(wait.count());
+  }
+  if (idleMemoryTimeout_) {
+    idleMemoryTimeout_->attachEventBase(eventBase);
+    if (transactions_.empty()) {
+      idleMemoryTimeout_->scheduleTimeout(idleMemoryInterval_.count());
+    }
+  }
+  if (readsUnpaused()) {
+    resetTimeout();
+    sock_->setReadCB(this);
+  }
+}
+
 HTTPTransaction*
 HTTPSession::findTransaction(HTTPCodec::StreamID streamID) {
-  auto it = transactions_.find(streamID);
-  if (it == transactions_.end()) {
-    return nullptr;
-  } else {
-    return &it->second;
-  }
+  return transactions_.find(streamID);
 }
 
 HTTPTransaction*
@@ -1850,7 +2912,10 @@ HTTPSession::createTransaction(HTTPCodec::StreamID streamID,
   }
 
   if (transactions_.empty()) {
-    if (infoCallback_) {
+    if (idleMemoryTimeout_) {
+      idleMemoryTimeout_->cancelTimeout();
+    }
+    if (infoEvents_ & InfoCallback::CONNECTION_ACTIVITY) {
       infoCallback_->onActivateConnection(*this);
     }
     if (numTxnServed_ >= 1) {
@@ -1860,20 +2925,39 @@ HTTPSession::createTransaction(HTTPCodec::StreamID streamID,
   }
 
   auto matchPair = transactions_.emplace(
-    std::piecewise_construct,
-    std::forward_as_tuple(streamID),
-    std::forward_as_tuple(
-      direction_, streamID, transactionSeqNo_, *this,
-      txnEgressQueue_, transactionTimeouts_, sessionStats_,
-      codec_->supportsStreamFlowControl(),
-      initialReceiveWindow_,
-      getCodecSendWindowSize(),
-      priority, assocStreamID));
+    streamID,
+    direction_, streamID, transactionSeqNo_, *this,
+    txnEgressQueue_, transactionTimeouts_, sessionStats_,
+    codec_->supportsStreamFlowControl(),
+    initialReceiveWindow_,
+    getCodecSendWindowSize(),
+    priority, assocStreamID);
 
   CHECK(matchPair.second) << "Emplacement failed, despite earlier "
     "existence check.";
 
-  HTTPTransaction* txn = &matchPair.first->second;
+  HTTPTransaction* txn = matchPair.first;
+  txn->setWorkerContext(workerContext_);
+  if (codec_->supportsStreamFlowControl()) {
+    txn->setInitialSendWindow(&initialSendWindow_);
+  }
+
+  if (headerTimeouts_ || bodyTimeouts_) {
+    txn->setIngressTimeouts(headerTimeouts_, bodyTimeouts_);
+  }
+
+  if (usePriorityTree_) {
+    if (pendingPriorityStream_ == streamID) {
+      txn->setPriorityTree(txnEgressTree_, pendingPriority_);
+      pendingPriorityStream_ = 0;
+    } else if (assocStreamID) {
+      // Pushes start out depending on the stream they were promised on
+      txn->setPriorityTree(txnEgressTree_, {uint32_t(assocStreamID), false,
+                                            kDefaultHTTP2Priority.weight});
+    } else {
+      txn->setPriorityTree(txnEgressTree_, kDefaultHTTP2Priority);
+    }
+  }
 
   if (numTxnServed_ > 0) {
     auto stats = txn->getSessionStats();
@@ -1889,6 +2973,7 @@ HTTPSession::createTransaction(HTTPCodec::StreamID streamID,
   ++liveTransactions_;
   ++transactionSeqNo_;
   txn->setReceiveWindow(receiveStreamWindowSize_);
+  txn->setReceiveWindowAutoTuning(maxStreamReceiveWindow_);
 
   if ((isUpstream() && !txn->isPushed()) ||
       (isDownstream() && txn->isPushed())) {
@@ -1911,6 +2996,7 @@ void
 HTTPSession::onWriteSuccess(uint64_t bytesWritten) {
   DestructorGuard dg(this);
   bytesWritten_ += bytesWritten;
+  accounting_.bytesWritten += bytesWritten;
   transportInfo_.totalBytes += bytesWritten;
   CHECK(writeTimeout_.isScheduled());
   if (pendingWrites_.empty()) {
@@ -1921,9 +3007,12 @@ HTTPSession::onWriteSuccess(uint64_t bytesWritten) {
     transactionTimeouts_->scheduleTimeout(&writeTimeout_);
   }
 
-  if (infoCallback_) {
+  if (infoEvents_ & InfoCallback::WRITE) {
     infoCallback_->onWrite(*this, bytesWritten);
   }
+  if (infoEvents_ & InfoCallback::BATCHED_BYTES) {
+    addTransportBytes(0, bytesWritten);
+  }
 
   VLOG(5) << "total bytesWritten_: " << bytesWritten_;
 
@@ -1949,9 +3038,13 @@ HTTPSession::onWriteSuccess(uint64_t bytesWritten) {
     //             in the future we may want to have a pull model
     //             whereby the socket asks us for a given amount of
     //             data to send...
-    if (numActiveWrites_ == 0 && hasMoreWrites()) {
+    if (numActiveWrites_ < maxActiveWrites_ && hasPendingEgress()) {
       runLoopCallback();
     }
+  } else {
+    // runLoopCallback added this segment to pendingWriteSizeDelta_ before
+    // calling writeChain; the scope guard applies the net change.
+    pendingWriteSizeDelta_ -= bytesWritten;
   }
   onWriteCompleted();
 }
@@ -1960,9 +3053,12 @@ void
 HTTPSession::onWriteError(size_t bytesWritten,
                           const AsyncSocketException& ex) {
   VLOG(4) << *this << " write error: " << ex.what();
-  if (infoCallback_) {
+  if (infoEvents_ & InfoCallback::WRITE) {
     infoCallback_->onWrite(*this, bytesWritten);
   }
+  if (infoEvents_ & InfoCallback::BATCHED_BYTES) {
+    addTransportBytes(0, bytesWritten);
+  }
 
   // Save the SSL error, if there was one.  It will be recorded later
   if (ERR_GET_LIB(ex.getErrno()) == ERR_LIB_SSL) {
@@ -2018,6 +3114,15 @@ void HTTPSession::onNewTransactionParseError(HTTPCodec::StreamID streamID,
   }
 }
 
+bool HTTPSession::isRejectedEarlyData(const HTTPMessage& msg) const {
+  if (!rejectUnsafeEarlyData_ ||
+      msg.getHeaders().getSingleOrEmpty(HTTP_HEADER_EARLY_DATA) != "1") {
+    return false;
+  }
+  auto method = msg.getMethod();
+  return !method || !isSafeMethod(*method);
+}
+
 void
 HTTPSession::handleErrorDirectly(HTTPTransaction* txn,
                                  const HTTPException& error) {
@@ -2029,7 +3134,7 @@ HTTPSession::handleErrorDirectly(HTTPTransaction* txn,
     return;
   }
   txn->setHandler(handler);
-  if (infoCallback_) {
+  if (infoEvents_ & InfoCallback::INGRESS_ERROR) {
     infoCallback_->onIngressError(*this, error.getProxygenError());
   }
   txn->onError(error);
@@ -2042,11 +3147,11 @@ HTTPSession::pauseReads() {
   codec_->setParserPaused(true);
   if (!readsUnpaused() ||
       (codec_->supportsParallelRequests() &&
-       pendingReadSize_ <= kDefaultReadBufLimit)) {
+       pendingReadSize_ <= kDefaultReadBufLimit && !memoryPressure_)) {
     return;
   }
   VLOG(4) << *this << ": pausing reads";
-  if (infoCallback_) {
+  if (infoEvents_ & InfoCallback::INGRESS_PAUSED) {
     infoCallback_->onIngressPaused(*this);
   }
   cancelTimeout();
@@ -2056,7 +3161,7 @@ HTTPSession::pauseReads() {
 
 void
 HTTPSession::resumeReads() {
-  if (!readsPaused() ||
+  if (!readsPaused() || memoryPressure_ ||
       (codec_->supportsParallelRequests() &&
        pendingReadSize_ > kDefaultReadBufLimit)) {
     return;
@@ -2083,12 +3188,53 @@ HTTPSession::hasMoreWrites() const {
     !txnEgressQueue_.empty();
 }
 
-void HTTPSession::errorOnAllTransactions(ProxygenError err) {
+bool
+HTTPSession::hasPendingEgress() const {
+  return writeBuf_.front() || !txnEgressQueue_.empty();
+}
+
+std::vector<HTTPCodec::StreamID>
+HTTPSession::getSortedTransactionIds() const {
   std::vector<HTTPCodec::StreamID> ids;
+  ids.reserve(transactions_.size());
   for (const auto& txn: transactions_) {
     ids.push_back(txn.first);
   }
-  errorOnTransactionIds(ids, err);
+  std::sort(ids.begin(), ids.end());
+  return ids;
+}
+
+HTTPCodec::StreamID HTTPSession::getOldestUnansweredTransaction() {
+  for (auto id: getSortedTransactionIds()) {
+    auto txn = findTransaction(id);
+    if (txn && !txn->isIngressEOMSeen()) {
+      return id;
+    }
+  }
+  return HTTPCodec::NoStream;
+}
+
+void HTTPSession::errorOnPipelinedTransactions(HTTPCodec::StreamID after) {
+  if (maxPipelineDepth_ == 1 || after == HTTPCodec::NoStream) {
+    return;
+  }
+  // Requests queued behind the one being answered, and so not processed.
+  // They were all safe, so their handlers may retry them elsewhere.
+  std::vector<HTTPCodec::StreamID> ids;
+  for (auto id: getSortedTransactionIds()) {
+    auto txn = findTransaction(id);
+    if (id > after && txn && !txn->isIngressStarted()) {
+      ids.push_back(id);
+    }
+  }
+  if (!ids.empty()) {
+    VLOG(4) << *this << " failing " << ids.size() << " pipelined requests";
+    errorOnTransactionIds(ids, kErrorStreamUnacknowledged);
+  }
+}
+
+void HTTPSession::errorOnAllTransactions(ProxygenError err) {
+  errorOnTransactionIds(getSortedTransactionIds(), err);
 }
 
 void HTTPSession::errorOnTransactionIds(
@@ -2124,6 +3270,18 @@ void HTTPSession::onConnectionSendWindowClosed() {
   transactionTimeouts_->scheduleTimeout(&flowControlTimeout_);
 }
 
+void HTTPSession::onConnectionReceiveWindowFull() {
+  if (sessionStats_) {
+    sessionStats_->recordSessionReceiveWindowFull();
+  }
+}
+
+void HTTPSession::onConnectionReceiveWindowGrown() {
+  if (sessionStats_) {
+    sessionStats_->recordSessionReceiveWindowGrown();
+  }
+}
+
 HTTPCodec::StreamID HTTPSession::getGracefulGoawayAck() const {
   if (!codec_->isReusable() || codec_->isWaitingToDrain()) {
     // TODO: just track last stream ID inside HTTPSession since this logic
@@ -2150,7 +3308,7 @@ void HTTPSession::invalidStream(HTTPCodec::StreamID stream, ErrorCode code) {
 }
 
 void HTTPSession::onPingReplyLatency(int64_t latency) noexcept {
-  if (infoCallback_ && latency >= 0) {
+  if ((infoEvents_ & InfoCallback::PING) && latency >= 0) {
     infoCallback_->onPingReplySent(latency);
   }
 }
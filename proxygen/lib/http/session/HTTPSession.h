@@ -13,6 +13,7 @@
 #include <folly/wangle/acceptor/ManagedConnection.h>
 #include <folly/wangle/acceptor/TransportInfo.h>
 #include <folly/io/IOBufQueue.h>
+#include <folly/io/async/AsyncTimeout.h>
 #include <folly/io/async/EventBase.h>
 #include <proxygen/lib/http/HTTPConstants.h>
 #include <proxygen/lib/http/HTTPHeaderSize.h>
@@ -21,8 +22,12 @@
 #include <proxygen/lib/http/codec/HTTPCodecFilter.h>
 #include <proxygen/lib/http/session/ByteEventTracker.h>
 #include <proxygen/lib/http/session/HTTPEvent.h>
+#include <proxygen/lib/http/session/HTTPSessionStats.h>
 #include <proxygen/lib/http/session/HTTPTransaction.h>
+#include <proxygen/lib/http/session/StreamTable.h>
+#include <proxygen/lib/http/session/TenantScheduler.h>
 #include <proxygen/lib/utils/Time.h>
+#include <array>
 #include <queue>
 #include <set>
 #include <folly/io/async/AsyncSocket.h>
@@ -30,13 +35,16 @@
 
 namespace proxygen {
 
+class HTTPCodecTap;
 class HTTPSessionController;
-class HTTPSessionStats;
+class SessionMemoryAccountant;
+class WorkerContext;
 
 class HTTPSession:
   private FlowControlFilter::Callback,
   private HTTPCodec::Callback,
   private folly::EventBase::LoopCallback,
+  private TenantScheduler::Member,
   public ByteEventTracker::Callback,
   public HTTPTransaction::Transport,
   public folly::AsyncTransportWrapper::ReadCallback,
@@ -47,32 +55,75 @@ class HTTPSession:
   /**
    * Optional callback interface that the HTTPSession
    * notifies of connection lifecycle events.
+   *
+   * A callback only gets the events it subscribes to, with
+   * getSubscribedEvents(); the session skips the rest without a virtual
+   * call. onCreate() and onDestroy() are always delivered.
    */
   class InfoCallback {
    public:
+    enum Event : uint32_t {
+      INGRESS_ERROR = 1 << 0,
+      READ = 1 << 1,
+      WRITE = 1 << 2,
+      REQUEST_BEGIN = 1 << 3,
+      REQUEST_END = 1 << 4,
+      // onActivateConnection() and onDeactivateConnection()
+      CONNECTION_ACTIVITY = 1 << 5,
+      INGRESS_MESSAGE = 1 << 6,
+      INGRESS_LIMIT_EXCEEDED = 1 << 7,
+      INGRESS_PAUSED = 1 << 8,
+      TRANSACTION_DETACHED = 1 << 9,
+      // onPingReplySent() and onPingReplyReceived()
+      PING = 1 << 10,
+      // onSettingsOutgoingStreamsFull() and ...NotFull()
+      OUTGOING_STREAMS = 1 << 11,
+      EGRESS_BUFFER = 1 << 12,
+      // onTransportBytes() once per event loop that read or wrote,
+      // typically instead of READ and WRITE
+      BATCHED_BYTES = 1 << 13,
+      ALT_SVC = 1 << 14,
+    };
+    // All but BATCHED_BYTES
+    static const uint32_t kAllEvents = ((1 << 15) - 1) & ~BATCHED_BYTES;
+
     virtual ~InfoCallback() {}
 
+    // Read once, when the callback is given to the session
+    virtual uint32_t getSubscribedEvents() const {
+      return kAllEvents;
+    }
+
     // Note: you must not start any asynchronous work from onCreate()
     virtual void onCreate(const HTTPSession&) = 0;
-    virtual void onIngressError(const HTTPSession&, ProxygenError) = 0;
-    virtual void onRead(const HTTPSession&, size_t bytesRead) = 0;
-    virtual void onWrite(const HTTPSession&, size_t bytesWritten) = 0;
-    virtual void onRequestBegin(const HTTPSession&) = 0;
+    virtual void onIngressError(const HTTPSession&, ProxygenError) {}
+    virtual void onRead(const HTTPSession&, size_t bytesRead) {}
+    virtual void onWrite(const HTTPSession&, size_t bytesWritten) {}
+    virtual void onRequestBegin(const HTTPSession&) {}
     virtual void onRequestEnd(const HTTPSession&,
-                              uint32_t maxIngressQueueSize) = 0;
-    virtual void onActivateConnection(const HTTPSession&) = 0;
-    virtual void onDeactivateConnection(const HTTPSession&) = 0;
-    // Note: you must not start any asynchronous work from onDestroy()
+                              uint32_t maxIngressQueueSize) {}
+    virtual void onActivateConnection(const HTTPSession&) {}
+    virtual void onDeactivateConnection(const HTTPSession&) {}
+    // Note: you must not start any asynchronous work from onDestroy().
+    // getAccounting() then has the totals of the session.
     virtual void onDestroy(const HTTPSession&) = 0;
     virtual void onIngressMessage(const HTTPSession&,
-                                  const HTTPMessage&) = 0;
-    virtual void onIngressLimitExceeded(const HTTPSession&) = 0;
-    virtual void onIngressPaused(const HTTPSession&) = 0;
-    virtual void onTransactionDetached(const HTTPSession&) = 0;
-    virtual void onPingReplySent(int64_t latency) = 0;
-    virtual void onPingReplyReceived() = 0;
-    virtual void onSettingsOutgoingStreamsFull(const HTTPSession&) = 0;
-    virtual void onSettingsOutgoingStreamsNotFull(const HTTPSession&) = 0;
+                                  const HTTPMessage&) {}
+    virtual void onIngressLimitExceeded(const HTTPSession&) {}
+    virtual void onIngressPaused(const HTTPSession&) {}
+    virtual void onTransactionDetached(const HTTPSession&) {}
+    virtual void onPingReplySent(int64_t latency) {}
+    virtual void onPingReplyReceived() {}
+    virtual void onSettingsOutgoingStreamsFull(const HTTPSession&) {}
+    virtual void onSettingsOutgoingStreamsNotFull(const HTTPSession&) {}
+    // The egress bytes buffered by the session changed by delta
+    virtual void onEgressBufferChanged(const HTTPSession&, int64_t delta) {}
+    // The bytes read and written since the last call, at the end of the
+    // event loop iteration
+    virtual void onTransportBytes(const HTTPSession&, size_t bytesRead,
+                                  size_t bytesWritten) {}
+    // The peer advertised an alternative service
+    virtual void onAltSvc(const HTTPSession&, const AltSvc& altSvc) {}
   };
 
   class WriteTimeout :
@@ -86,6 +137,32 @@ class HTTPSession:
     HTTPSession* session_;
   };
 
+  class PingTimeout : public folly::AsyncTimeout {
+   public:
+    PingTimeout(HTTPSession* session, folly::EventBase* eventBase)
+      : folly::AsyncTimeout(eventBase),
+        session_(session) {}
+
+    void timeoutExpired() noexcept override {
+      session_->pingTimeoutExpired();
+    }
+   private:
+    HTTPSession* session_;
+  };
+
+  class IdleMemoryTimeout : public folly::AsyncTimeout {
+   public:
+    IdleMemoryTimeout(HTTPSession* session, folly::EventBase* eventBase)
+      : folly::AsyncTimeout(eventBase),
+        session_(session) {}
+
+    void timeoutExpired() noexcept override {
+      session_->releaseIdleMemory();
+    }
+   private:
+    HTTPSession* session_;
+  };
+
   class FlowControlTimeout : public AsyncTimeoutSet::Callback {
    public:
     explicit FlowControlTimeout(HTTPSession* session) : session_(session) {}
@@ -98,6 +175,32 @@ class HTTPSession:
     HTTPSession* session_;
   };
 
+  // Reports the bytes batched for InfoCallback::BATCHED_BYTES
+  class TransportBytesCallback : public folly::EventBase::LoopCallback {
+   public:
+    explicit TransportBytesCallback(HTTPSession* session)
+      : session_(session) {}
+
+    void runLoopCallback() noexcept override {
+      session_->flushTransportBytes();
+    }
+   private:
+    HTTPSession* session_;
+  };
+
+  // Gives back the read buffer of a session that read nothing into it
+  class ReadBufferReleaser : public folly::EventBase::LoopCallback {
+   public:
+    explicit ReadBufferReleaser(HTTPSession* session)
+      : session_(session) {}
+
+    void runLoopCallback() noexcept override {
+      session_->releaseEmptyReadBuffer();
+    }
+   private:
+    HTTPSession* session_;
+  };
+
   /**
    * Set the read buffer limit to be used for all new HTTPSession objects.
    */
@@ -107,17 +210,163 @@ class HTTPSession:
   }
 
   /**
-   * Set the maximum egress body size for any outbound body bytes per loop,
-   * when there are > 1 transactions.
+   * Set the most ingress body bytes a single paused transaction may buffer,
+   * for all new HTTPSession objects. On codecs with parallel requests but
+   * no stream flow control, a transaction over this limit is reset rather
+   * than left to fill the read buffer limit and pause every other
+   * transaction of the session. Transactions with flow control are held
+   * back by their receive window instead. 0, the default, sets no limit.
+   */
+  static void setDefaultStreamReadBufferLimit(uint32_t limit) {
+    kDefaultStreamReadBufLimit = limit;
+  }
+
+  /**
+   * Set the largest read size a session may grow to when it sees reads
+   * filling the whole buffer, and the total number of bytes above the
+   * initial read size that all sessions in the process may use for this.
+   */
+  static void setMaxReadBufferSize(uint32_t size);
+  static void setReadBufferGrowthCap(uint64_t cap);
+
+  /**
+   * Read into buffers borrowed from the ReadBufferPool of the thread instead
+   * of allocating new ones, for all sessions. A session holds no read buffer
+   * while it has no ingress to parse. Off by default.
+   */
+  static void setUseReadBufferPool(bool use) {
+    kUseReadBufferPool = use;
+  }
+
+  /**
+   * Set the default egress quantum for new sessions: the number of body
+   * bytes a transaction may send per turn when there are > 1 transactions.
    */
   static void setFlowControlledBodySizeLimit(uint64_t limit) {
     egressBodySizeLimit_ = limit;
   }
 
+  /**
+   * Time the phases of one in every sampleRate event loop callbacks of
+   * each session into its HTTPSessionStats, and log the sampled callbacks
+   * that take longer than slowCallback, phase by phase. 0 turns sampling
+   * off, which is the default.
+   */
+  static void setPhaseSampling(uint32_t sampleRate,
+                               std::chrono::microseconds slowCallback) {
+    kPhaseSampleRate = sampleRate;
+    kSlowCallbackThreshold = slowCallback;
+  }
+
+  /**
+   * What a session has cost so far, to attribute worker CPU and traffic to
+   * connections, see getAccounting().
+   */
+  struct Accounting {
+    // Time spent in each SessionPhase, less the phases nested in it. Only
+    // counted while setAccounting() is on.
+    std::array<std::chrono::steady_clock::duration, kNumSessionPhases>
+      phaseTimes{{}};
+    uint64_t bytesRead{0};
+    uint64_t bytesWritten{0};
+    // Header blocks, compressed and not, so the savings are the difference
+    uint64_t ingressHeaderBytes{0};
+    uint64_t ingressHeaderBytesCompressed{0};
+    uint64_t egressHeaderBytes{0};
+    uint64_t egressHeaderBytesCompressed{0};
+  };
+
+  /**
+   * Time the phases of every event loop callback of every session into
+   * its Accounting. This takes two clock reads per phase, so it is off by
+   * default; bytes are always counted.
+   */
+  static void setAccounting(bool enabled) {
+    kAccountingEnabled = enabled;
+  }
+
+  const Accounting& getAccounting() const {
+    return accounting_;
+  }
+
+  /**
+   * Give new sessions an HTTPCodecTap keeping their last entries frames
+   * and messages, logged on connection errors. 0, the default, turns it
+   * off.
+   */
+  static void setCodecTapSize(uint32_t entries) {
+    kCodecTapSize = entries;
+  }
+
+  // nullptr unless setCodecTapSize() was on when the session was created
+  const HTTPCodecTap* getCodecTap() const {
+    return codecTap_;
+  }
+
   void setInfoCallback(InfoCallback* callback);
 
   void setSessionStats(HTTPSessionStats* stats);
 
+  /**
+   * Give the transactions of this session the state of the worker thread
+   * running it, see HTTPTransaction::getWorkerContext().
+   */
+  void setWorkerContext(WorkerContext* context) {
+    workerContext_ = context;
+  }
+
+  /**
+   * Share the worker fairly with the sessions of other tenants, see
+   * TenantScheduler. The session is classified now, and stays in its
+   * tenant until it is given another scheduler, or nullptr.
+   */
+  void setTenantScheduler(TenantScheduler* scheduler);
+
+  /**
+   * Add the bytes this session holds in its buffers and header compression
+   * state to accountant, for as long as it lives
+   */
+  void setMemoryAccountant(SessionMemoryAccountant* accountant);
+
+  /**
+   * While under memory pressure, stop reading and hold back the
+   * WINDOW_UPDATEs that would let the peer send more
+   */
+  void setMemoryPressure(bool pressure);
+
+  bool isUnderMemoryPressure() const {
+    return memoryPressure_;
+  }
+
+  /**
+   * Add the egress bytes this session buffers to accountant, which all the
+   * sessions of the process can share as their egress budget. While it is
+   * over budget, this session pauses its transactions' egress once it
+   * buffers pressuredWriteMax bytes instead of getPendingWriteMax().
+   */
+  void setEgressAccountant(SessionMemoryAccountant* accountant,
+                           uint32_t pressuredWriteMax = 16384);
+
+  /**
+   * If enabled, every transaction also has its egress paused once it
+   * buffers more than its share of getPendingWriteMax(), in proportion to
+   * its priority weight, so that no stream holds all of the buffer.
+   */
+  void setEgressQuotas(bool enabled) {
+    egressQuotas_ = enabled;
+  }
+
+  /**
+   * If enabled, the handlers of the new requests parsed from one read are
+   * set up together once the whole read is parsed, see setupOnRequests(),
+   * rather than each as soon as its headers are. The ingress of those
+   * requests is queued in their transactions until then. Only sessions
+   * with parallel requests (SPDY, HTTP/2) batch them.
+   */
+  void setBatchRequestDispatch(bool enabled) {
+    batchRequestDispatch_ = enabled;
+  }
+
   folly::AsyncTransportWrapper* getTransport() {
     return sock_.get();
   }
@@ -190,6 +439,12 @@ class HTTPSession:
   const HTTPSessionController* getController() const { return controller_; }
   HTTPSessionController* getController() { return controller_; }
 
+  /**
+   * Detach the session from its controller and attach it to controller,
+   * eg. when it moves to another thread
+   */
+  void setController(HTTPSessionController* controller);
+
   /**
    * Start closing the socket.
    * @param shutdownReads  Whether to close the read side of the
@@ -236,6 +491,42 @@ class HTTPSession:
    size_t receiveStreamWindowSize,
    size_t receiveSessionWindowSize);
 
+  /**
+   * Time out the wait of transactions for the rest of their ingress
+   * headers with headerTimeouts, and for more of their body with
+   * bodyTimeouts, instead of the transaction timeouts. Either may be null.
+   * See HTTPTransaction::setIngressTimeouts().
+   */
+  void setIngressTimeouts(AsyncTimeoutSet* headerTimeouts,
+                          AsyncTimeoutSet* bodyTimeouts) {
+    headerTimeouts_ = headerTimeouts;
+    bodyTimeouts_ = bodyTimeouts;
+  }
+
+  /**
+   * Whether detachEventBase() can move the session to another thread: it
+   * has started, has nothing written or waiting to be, and no loop
+   * callback, timeout of its own or byte event that needs this thread.
+   */
+  bool isDetachable() const;
+
+  /**
+   * Stop all of the session's work on its EventBase, to move it to the
+   * EventBase of another thread: stop reading, cancel its timeouts and
+   * those of its transactions and detach its transport. Its codec state,
+   * transactions and byte events are kept. Nothing of the session may
+   * run until attachEventBase() is called from the new thread, with the
+   * timeout sets of that thread. Moving it between ConnectionManagers,
+   * and to the controller, callbacks, stats and accountants of the new
+   * thread, is up to the caller; see HTTPSessionAcceptor::handOffSessions().
+   */
+  void detachEventBase();
+
+  void attachEventBase(folly::EventBase* eventBase,
+                       AsyncTimeoutSet* transactionTimeouts,
+                       AsyncTimeoutSet* headerTimeouts = nullptr,
+                       AsyncTimeoutSet* bodyTimeouts = nullptr);
+
   /**
    * Set the maximum number of outgoing transactions this session can open
    * at once. Note: you can only call function before startNow() is called
@@ -251,9 +542,15 @@ class HTTPSession:
 
   /**
    * Set the maximum number of transactions the remote can open at once.
+   * Once the session has started, a change is advertised in a SETTINGS
+   * frame of its own. Streams open already are not affected.
    */
   void setMaxConcurrentIncomingStreams(uint32_t num);
 
+  uint32_t getMaxConcurrentIncomingStreams() const {
+    return maxConcurrentIncomingStreams_;
+  }
+
   /**
    * Get/Set the number of egress bytes this session will buffer before
    * pausing all transactions' egress.
@@ -266,6 +563,127 @@ class HTTPSession:
     kPendingWriteMax = max;
   }
 
+  /**
+   * Set the maximum number of writes this session may have submitted to
+   * the transport without having received a completion callback. The
+   * default of 1 serializes egress behind a single writeChain.
+   */
+  void setMaxActiveWrites(uint32_t num) {
+    CHECK_GT(num, 0);
+    maxActiveWrites_ = num;
+  }
+
+  uint32_t getMaxActiveWrites() const {
+    return maxActiveWrites_;
+  }
+
+  /**
+   * Set the deficit round robin quantum, the number of body bytes each
+   * transaction in a priority band is credited with per turn while more
+   * than one transaction has pending egress. Defaults to the value of
+   * setFlowControlledBodySizeLimit() when the session was created.
+   */
+  void setEgressQuantum(uint32_t quantum) {
+    CHECK_GT(quantum, 0);
+    egressQuantum_ = quantum;
+  }
+
+  uint32_t getEgressQuantum() const {
+    return egressQuantum_;
+  }
+
+  /**
+   * Set how many bytes getNextToSend() gathers from transactions into a
+   * single write.
+   */
+  void setEgressBytesPerWrite(uint32_t bytes) {
+    CHECK_GT(bytes, 0);
+    egressBytesPerWrite_ = bytes;
+  }
+
+  uint32_t getEgressBytesPerWrite() const {
+    return egressBytesPerWrite_;
+  }
+
+  /**
+   * Have the kernel take no more egress than it can send right away plus
+   * bytes (TCP_NOTSENT_LOWAT), and gather no more than that into a write,
+   * so that the next write, and which transactions it serves, is decided
+   * as the socket drains rather than once its send buffer is full.
+   *
+   * @return false if the transport is not a TCP socket that supports it
+   */
+  bool setNotSentLowWatermark(uint32_t bytes);
+
+  /**
+   * Over TLS, send the first smallBytes of egress after the session has
+   * written nothing for idleTime in records of recordSize bytes, which
+   * the peer can decrypt as each one arrives rather than once a full 16KB
+   * record has, then leave the rest in records as large as the transport
+   * makes them. recordSize is raised to the minimum write size of the
+   * transport, below which it merges buffers. Off (0 bytes) by default.
+   *
+   * @return false if the transport is not an AsyncSSLSocket
+   */
+  bool setTLSRecordSizing(uint32_t recordSize,
+                          uint32_t smallBytes,
+                          std::chrono::milliseconds idleTime);
+
+  /**
+   * While requests are pipelined behind the ones being answered, hold
+   * writes smaller than maxBytes for up to maxDelay, so that the responses
+   * to the next requests go out in the same write. The loop callback runs
+   * again every event loop iteration meanwhile. Off (0 bytes) by default.
+   */
+  void setEgressCoalescing(uint32_t maxBytes,
+                           std::chrono::microseconds maxDelay) {
+    egressCoalesceBytes_ = maxBytes;
+    egressCoalesceDelay_ = maxDelay;
+  }
+
+  /**
+   * Hold the WINDOW_UPDATEs generated while processing ingress until the
+   * end of the event loop iteration, then send one per stream and one for
+   * the session carrying all the credit accrued meanwhile. Off by default.
+   */
+  void setWindowUpdateBatching(bool batch) {
+    batchWindowUpdates_ = batch;
+  }
+
+  /**
+   * Answer the requests with unsafe methods that were sent as TLS early
+   * data, and so may be replays, with 425 Too Early (RFC 8470) instead of
+   * handing them to a handler. The client retries them once its handshake
+   * is done. A request was sent as early data if it has Early-Data: 1, as
+   * set by the TLS terminator in front of us that accepted it. Off by
+   * default, which forwards such requests as they are.
+   */
+  void setRejectUnsafeEarlyData(bool reject) {
+    rejectUnsafeEarlyData_ = reject;
+  }
+
+  /**
+   * Set the number of consumed bytes that triggers a session-level
+   * WINDOW_UPDATE. 0 (the default) means half the session receive window.
+   */
+  void setSessionWindowUpdateThreshold(uint32_t threshold);
+
+  /**
+   * Let the session receive window grow up to maxSize to match the
+   * bandwidth-delay product of the connection, see
+   * FlowControlFilter::setReceiveWindowAutoTuning().
+   */
+  void setSessionWindowAutoTuning(uint32_t maxSize);
+
+  /**
+   * Likewise let the receive window of each new stream grow up to maxSize,
+   * see HTTPTransaction::setReceiveWindowAutoTuning(). The windows stop
+   * growing while the memory accountant is under pressure.
+   */
+  void setStreamWindowAutoTuning(uint32_t maxSize) {
+    maxStreamReceiveWindow_ = maxSize;
+  }
+
   /**
    * Start reading from the transport and send any introductory messages
    * to the remote side. This function must be called once per session to
@@ -273,6 +691,16 @@ class HTTPSession:
    */
   void startNow();
 
+  /**
+   * Start the session on a connection whose first bytes were already read
+   * by someone else, such as ProtocolSniffer. initialIngress is parsed as if it
+   * had just been read. If upgradeRequest is set, it is the request that
+   * upgraded the connection to this session's protocol, and is received
+   * in full as stream 1.
+   */
+  void startNow(std::unique_ptr<folly::IOBuf> initialIngress,
+                std::unique_ptr<HTTPMessage> upgradeRequest = nullptr);
+
   /**
    * Returns true if this session is draining. This can happen if drain()
    * is called explicitly, if a GOAWAY frame is received, or during shutdown.
@@ -286,6 +714,32 @@ class HTTPSession:
    */
   size_t sendPing();
 
+  /**
+   * Ping the peer every interval, and drop the session once a ping goes
+   * unanswered for timeout, ie: when the peer or the path to it is gone,
+   * rather than waiting for TCP to give up. Only HTTP/2 and SPDY have
+   * pings. An interval of 0 (the default) turns it off.
+   */
+  void setPingKeepalive(std::chrono::milliseconds interval,
+                        std::chrono::milliseconds timeout);
+
+  /**
+   * Once the session has had no transactions for timeout, free the
+   * buffers and codec state it can rebuild when a message comes, so that
+   * keepalive connections idle for long cost little more than the session
+   * itself. A timeout of 0 (the default) turns it off.
+   */
+  void setIdleMemoryTimeout(std::chrono::milliseconds timeout);
+
+  /**
+   * The round trip time measured by the replies to our pings, smoothed the
+   * way TCP does, or 0 before the first one. Receive window auto-tuning
+   * goes by it once known.
+   */
+  std::chrono::microseconds getPingRTT() const {
+    return pingRTT_;
+  }
+
   // ManagedConnection methods
   void timeoutExpired() noexcept override {
     readTimeoutExpired();
@@ -355,6 +809,19 @@ class HTTPSession:
   virtual void setupOnHeadersComplete(HTTPTransaction* txn,
                                       HTTPMessage* msg) = 0;
 
+  /**
+   * setupOnHeadersComplete() for the requests parsed from one read, in
+   * order, when requests are batched, see setBatchRequestDispatch().
+   */
+  virtual void setupOnRequests(const std::vector<HTTPTransaction*>& txns,
+                               const std::vector<HTTPMessage*>& msgs);
+
+  /**
+   * Whether the request msg is to be answered with 425 Too Early, see
+   * setRejectUnsafeEarlyData()
+   */
+  bool isRejectedEarlyData(const HTTPMessage& msg) const;
+
   /**
    * Called by handleErrorDirectly (when handling parse errors) if the
    * transaction has no handler.
@@ -386,6 +853,15 @@ class HTTPSession:
   void onEgressMessageFinished(HTTPTransaction* txn,
                                bool withRST = false);
 
+  // sendHeaders(), with the body if any and the EOM in the same codec
+  // call if eom. Returns the bytes the body was encoded into
+  size_t sendHeadersWithOptionalEOM(
+      HTTPTransaction* txn,
+      const HTTPMessage& headers,
+      HTTPHeaderSize* size,
+      bool eom,
+      std::unique_ptr<folly::IOBuf> body = nullptr) noexcept;
+
   /**
    * Gets the next IOBuf to send (either writeBuf_ or new egress from
    * the priority queue), and sets cork appropriately
@@ -395,6 +871,24 @@ class HTTPSession:
   void decrementTransactionCount(HTTPTransaction* txn,
                                  bool ingressEOM, bool egressEOM);
 
+  /**
+   * Whether to hold a write of len bytes back, see setEgressCoalescing()
+   */
+  bool shouldCoalesceEgress(uint64_t len);
+
+  /**
+   * Cut the head of writeBuf into small TLS records of a buffer each, see
+   * setTLSRecordSizing()
+   */
+  std::unique_ptr<folly::IOBuf> sizeTLSRecords(
+    std::unique_ptr<folly::IOBuf> writeBuf);
+
+  /**
+   * Report the pooled allocations of this thread since the last report,
+   * by any session, to sessionStats_
+   */
+  void reportPoolAllocations();
+
   size_t getCodecSendWindowSize() const;
 
   /**
@@ -471,12 +965,32 @@ class HTTPSession:
   void writeTimeoutExpired() noexcept;
   void flowControlTimeoutExpired() noexcept;
 
+  void pingTimeoutExpired() noexcept;
+
+  void releaseIdleMemory() noexcept;
+
+  // The ping RTT if known, or else the TCP one
+  std::chrono::microseconds getRoundTripTime() const;
+
+  /**
+   * Grow or shrink readBufferSize_ based on how much of the last read
+   * buffer the transport filled.
+   */
+  void adjustReadBufferSize(size_t readSize);
+  void releaseEmptyReadBuffer();
+
   // AsyncTransportWrapper::ReadCallback methods
   void getReadBuffer(void** buf, size_t* bufSize) override;
   void readDataAvailable(size_t readSize) noexcept override;
   bool isBufferMovable() noexcept override;
   void readBufferAvailable(std::unique_ptr<folly::IOBuf>) noexcept override;
   void processReadData();
+
+  /**
+   * Set up the handlers of the requests collected in requestsToDispatch_
+   * and deliver their queued ingress.
+   */
+  void dispatchRequests();
   void readEOF() noexcept override;
   void readErr(
       const folly::AsyncSocketException&) noexcept override;
@@ -505,6 +1019,9 @@ class HTTPSession:
   void onPingReply(uint64_t uniqueID) override;
   void onWindowUpdate(HTTPCodec::StreamID stream, uint32_t amount) override;
   void onSettings(const SettingsList& settings) override;
+  void onPriority(HTTPCodec::StreamID stream,
+                  const http2::PriorityUpdate& pri) override;
+  void onAltSvc(HTTPCodec::StreamID stream, const AltSvc& altSvc) override;
   uint32_t numOutgoingStreams() const override { return outgoingStreams_; }
   uint32_t numIncomingStreams() const override { return incomingStreams_; }
 
@@ -515,6 +1032,15 @@ class HTTPSession:
   void sendHeaders(HTTPTransaction* txn,
                    const HTTPMessage& headers,
                    HTTPHeaderSize* size) noexcept override;
+  void sendHeadersWithEOM(HTTPTransaction* txn,
+                          const HTTPMessage& headers,
+                          HTTPHeaderSize* size) noexcept override;
+  bool canSendHeadersWithBody(size_t bodyLen) const noexcept override;
+  size_t sendHeadersWithBodyAndEOM(
+      HTTPTransaction* txn,
+      const HTTPMessage& headers,
+      HTTPHeaderSize* size,
+      std::unique_ptr<folly::IOBuf> body) noexcept override;
   size_t sendBody(HTTPTransaction* txn, std::unique_ptr<folly::IOBuf>,
                   bool includeEOM) noexcept override;
   size_t sendChunkHeader(HTTPTransaction* txn,
@@ -528,12 +1054,19 @@ class HTTPSession:
   void detach(HTTPTransaction* txn) noexcept override;
   size_t sendWindowUpdate(HTTPTransaction* txn,
                           uint32_t bytes) noexcept override;
+  void sessionBytesProcessed(uint32_t bytes);
+  void scheduleWindowUpdates();
+  void flushWindowUpdates();
   void notifyPendingEgress() noexcept override;
   void notifyIngressBodyProcessed(uint32_t bytes) noexcept override;
   void notifyEgressBodyBuffered(int64_t bytes) noexcept override;
   HTTPTransaction* newPushedTransaction(HTTPCodec::StreamID assocStreamId,
                                         HTTPTransaction::PushHandler* handler,
                                         int8_t priority) noexcept override;
+  std::chrono::microseconds getReceiveWindowTuningRTT()
+    const noexcept override;
+  uint64_t getEgressBufferQuota(const HTTPTransaction& txn)
+    const noexcept override;
 
  public:
   const folly::SocketAddress& getLocalAddress()
@@ -567,6 +1100,13 @@ class HTTPSession:
   // EventBase::LoopCallback methods
   void runLoopCallback() noexcept override;
 
+  // TenantScheduler::Member methods
+  void onIngressAllowed() noexcept override;
+  void onEgressAllowed() noexcept override;
+
+  // Charge the bytes read to the tenant, and stop reading if it is over
+  void chargeTenantIngress(size_t bytes);
+
   /**
    * Schedule a write to occur at the end of this event loop.
    */
@@ -579,11 +1119,20 @@ class HTTPSession:
   void updateWriteCount();
   void updateWriteBufSize(int64_t delta);
 
+  // Count bytes for BATCHED_BYTES, reported at the end of the loop
+  void addTransportBytes(size_t bytesRead, size_t bytesWritten);
+  void flushTransportBytes();
+
+  void updateAccountedMemory();
+
   /**
    * Returns true iff egress should stop on this session.
    */
   bool egressLimitExceeded() const;
 
+  /** What egressLimitExceeded() compares the buffered egress to */
+  uint64_t getPendingWriteLimit() const;
+
   /**
    * Tells us what would be the offset of the next byte to be
    * enqueued within the whole session.
@@ -656,18 +1205,21 @@ class HTTPSession:
   bool hasMoreWrites() const;
 
   /**
-   * This function invokes a callback on all transactions. It is safe,
-   * but runs in O(n*log n) and if the callback *adds* transactions,
-   * they will not get the callback.
+   * Check whether the session has egress that has not yet been handed to
+   * the transport.
+   */
+  bool hasPendingEgress() const;
+
+  /**
+   * This function invokes a callback on all transactions, in stream ID
+   * order. It is safe, but runs in O(n*log n) and if the callback *adds*
+   * transactions, they will not get the callback.
    */
   template<typename... Args1, typename... Args2>
   void invokeOnAllTransactions(void (HTTPTransaction::*fn)(Args1...),
                                Args2&&... args) {
     DestructorGuard g(this);
-    std::vector<HTTPCodec::StreamID> ids;
-    for (const auto& txn: transactions_) {
-      ids.push_back(txn.first);
-    }
+    std::vector<HTTPCodec::StreamID> ids = getSortedTransactionIds();
     for (auto idit = ids.begin(); idit != ids.end() && !transactions_.empty();
          ++idit) {
       auto txn = findTransaction(*idit);
@@ -677,6 +1229,23 @@ class HTTPSession:
     }
   }
 
+  /**
+   * Returns the IDs of all transactions in ascending order.
+   */
+  std::vector<HTTPCodec::StreamID> getSortedTransactionIds() const;
+
+  /**
+   * The transaction whose response would come next, or NoStream
+   */
+  HTTPCodec::StreamID getOldestUnansweredTransaction();
+
+  /**
+   * Fail the requests pipelined after the given one whose responses
+   * haven't started with kErrorStreamUnacknowledged, as no server got to
+   * them. A no-op unless pipelining.
+   */
+  void errorOnPipelinedTransactions(HTTPCodec::StreamID after);
+
   /**
    * This function invokes a callback on all transactions. It is safe,
    * but runs in O(n*log n) and if the callback *adds* transactions,
@@ -705,6 +1274,7 @@ class HTTPSession:
 
   /** Chain of ingress IOBufs */
   folly::IOBufQueue readBuf_{folly::IOBufQueue::cacheChainLength()};
+  ReadBufferReleaser readBufferReleaser_{this};
 
   /** Queue of egress IOBufs */
   folly::IOBufQueue writeBuf_{folly::IOBufQueue::cacheChainLength()};
@@ -712,7 +1282,20 @@ class HTTPSession:
   /** Priority queue of transactions with egress pending */
   HTTPTransaction::PriorityQueue txnEgressQueue_;
 
-  std::map<HTTPCodec::StreamID, HTTPTransaction> transactions_;
+  /**
+   * HTTP/2 dependency tree of our transactions. When usePriorityTree_ is
+   * set it decides which transaction in txnEgressQueue_ egresses next.
+   */
+  HTTP2PriorityQueue txnEgressTree_;
+
+  /**
+   * Priority the codec reported for a stream we have no transaction for
+   * yet, applied when the transaction is created
+   */
+  HTTPCodec::StreamID pendingPriorityStream_{0};
+  http2::PriorityUpdate pendingPriority_;
+
+  StreamTable<HTTPTransaction> transactions_;
 
   /** Count of transactions awaiting input */
   uint32_t liveTransactions_{0};
@@ -735,6 +1318,12 @@ class HTTPSession:
   HTTPCodecFilterChain codec_;
 
   InfoCallback* infoCallback_{nullptr};
+  // infoCallback_->getSubscribedEvents(), or 0 without a callback
+  uint32_t infoEvents_{0};
+
+  TransportBytesCallback transportBytesCallback_{this};
+  size_t batchedBytesRead_{0};
+  size_t batchedBytesWritten_{0};
 
   /**
    * The root cause reason this connection was closed.
@@ -746,10 +1335,38 @@ class HTTPSession:
 
   FlowControlTimeout flowControlTimeout_;
 
+  /**
+   * Keepalive pings, see setPingKeepalive(), and when the ping waiting for
+   * a reply, if any, went out
+   */
+  std::unique_ptr<PingTimeout> pingTimeout_;
+
+  // See setIdleMemoryTimeout()
+  std::unique_ptr<IdleMemoryTimeout> idleMemoryTimeout_;
+  std::chrono::milliseconds idleMemoryInterval_{0};
+  std::chrono::milliseconds pingInterval_{0};
+  std::chrono::milliseconds pingReplyTimeout_{0};
+  folly::Optional<TimePoint> pingSentTime_;
+  std::chrono::microseconds pingRTT_{0};
+
   AsyncTimeoutSet* transactionTimeouts_{nullptr};
+  AsyncTimeoutSet* headerTimeouts_{nullptr};
+  AsyncTimeoutSet* bodyTimeouts_{nullptr};
 
   HTTPSessionStats* sessionStats_{nullptr};
 
+  WorkerContext* workerContext_{nullptr};
+
+  // See setTenantScheduler()
+  TenantScheduler* tenantScheduler_{nullptr};
+  TenantScheduler::Tenant* tenant_{nullptr};
+  // Out of the tenant's credit until the scheduler lets go of these
+  bool tenantReadsHeld_{false};
+  bool tenantWritesHeld_{false};
+
+  // What the session cost outside of its transactions' own work
+  AllocCounts allocCounts_;
+
   folly::TransportInfo transportInfo_;
 
   /**
@@ -780,6 +1397,12 @@ class HTTPSession:
    */
   uint32_t maxConcurrentOutgoingStreamsConfig_{100};
 
+  /**
+   * How many requests an upstream session with a serial codec may have
+   * outstanding at once, see HTTPUpstreamSession::setMaxPipelineDepth()
+   */
+  uint32_t maxPipelineDepth_{1};
+
   /**
    * The received setting for the maximum number of concurrent
    * transactions that this session may create. We may assume the
@@ -816,12 +1439,99 @@ class HTTPSession:
    */
   uint32_t pendingReadSize_{0};
 
+  /**
+   * Preferred size of the next read buffer, and the size actually handed
+   * to the transport by the last getReadBuffer() call.
+   */
+  uint32_t readBufferSize_;
+  uint32_t lastReadBufferSize_{0};
+
+  /**
+   * Number of consecutive reads that used only a small fraction of
+   * readBufferSize_.
+   */
+  uint8_t numShortReads_{0};
+
   /**
    * Number of writes submitted to the transport for which we haven't yet
    * received completion or failure callbacks.
    */
   unsigned numActiveWrites_{0};
 
+  /**
+   * Maximum value of numActiveWrites_ before getNextToSend() stops
+   * producing egress.
+   */
+  uint32_t maxActiveWrites_{1};
+
+  /**
+   * Deficit round robin quantum for body egress, see setEgressQuantum()
+   */
+  uint32_t egressQuantum_;
+
+  /**
+   * Egress bytes getNextToSend() collects before handing a write to the
+   * transport
+   */
+  uint32_t egressBytesPerWrite_;
+
+  /**
+   * Bounds of the writes held back, see setEgressCoalescing(), and when
+   * the write being held was first held
+   */
+  uint32_t egressCoalesceBytes_{0};
+  std::chrono::microseconds egressCoalesceDelay_{0};
+  folly::Optional<TimePoint> egressCoalesceStart_;
+
+  /**
+   * See setTLSRecordSizing(); how many bytes may still go out in small
+   * records, and when the last write was handed to the transport
+   */
+  uint32_t tlsSmallRecordSize_{0};
+  uint32_t tlsSmallRecordBytes_{0};
+  std::chrono::milliseconds tlsRecordIdleTime_{0};
+  uint32_t tlsSmallBytesLeft_{0};
+  TimePoint lastWriteTime_;
+
+  /**
+   * Credits waiting for the end of the loop, see setWindowUpdateBatching()
+   */
+  std::vector<std::pair<HTTPCodec::StreamID, uint32_t>> pendingWindowUpdates_;
+  uint32_t pendingSessionWindowUpdate_{0};
+  bool batchWindowUpdates_{false};
+  // See setRejectUnsafeEarlyData()
+  bool rejectUnsafeEarlyData_{false};
+
+  // Whether the current event loop callback is sampled, and its phase
+  // times so far
+  bool phaseSampling_{false};
+  PhaseTimer* currentPhase_{nullptr};
+  uint32_t callbacksSinceSample_{0};
+  std::array<std::chrono::steady_clock::duration, kNumSessionPhases>
+    phaseTimes_;
+
+  Accounting accounting_;
+
+  // Owned by codec_
+  HTTPCodecTap* codecTap_{nullptr};
+
+  SessionMemoryAccountant* memoryAccountant_{nullptr};
+  // What this session last added to memoryAccountant_
+  uint64_t accountedMemory_{0};
+  bool memoryPressure_{false};
+
+  SessionMemoryAccountant* egressAccountant_{nullptr};
+  uint32_t pressuredWriteMax_{0};
+  // Whether the transactions are paused by egressLimitExceeded()
+  bool egressLimitPaused_{false};
+  bool egressQuotas_{false};
+
+  // See setBatchRequestDispatch()
+  bool batchRequestDispatch_{false};
+  // Whether processReadData() collects the new requests to dispatch
+  bool collectingRequests_{false};
+  std::vector<HTTPCodec::StreamID> requestsToDispatch_;
+
   /**
    * Number of bytes written so far.
    */
@@ -856,7 +1566,11 @@ class HTTPSession:
 
   // Flow control settings
   size_t initialReceiveWindow_{65536};
+  // The INITIAL_WINDOW_SIZE the peer set last, followed by the transactions
+  InitialSendWindow initialSendWindow_{65536};
   size_t receiveStreamWindowSize_{65536};
+  // Limit of per stream receive window auto-tuning, 0 for none
+  uint32_t maxStreamReceiveWindow_{0};
   size_t receiveSessionWindowSize_{65536};
 
   const TransportDirection direction_;
@@ -889,6 +1603,7 @@ class HTTPSession:
   // indicates a fatal error that prevents further ingress data processing
   bool ingressError_:1;
   bool inLoopCallback_:1;
+  bool usePriorityTree_:1;
 
   /**
    * Maximum number of ingress body bytes that can be buffered across all
@@ -897,8 +1612,31 @@ class HTTPSession:
   static uint32_t kDefaultReadBufLimit;
 
   /**
-   * Maximum number of bytes to egress per loop when there are > 1
-   * transactions.  Otherwise defaults to kPendingWriteMax.
+   * Maximum number of ingress body bytes that a single transaction without
+   * flow control can buffer, 0 for no limit.
+   */
+  static uint32_t kDefaultStreamReadBufLimit;
+
+  /**
+   * Upper bound for readBufferSize_.
+   */
+  static uint32_t kMaxReadBufferSize;
+
+  /**
+   * Maximum number of read buffer bytes above the initial read size that
+   * may be in use across all sessions.
+   */
+  static uint64_t kReadBufferGrowthCap;
+
+  /**
+   * Whether new read buffers come from the ReadBufferPool.
+   */
+  static bool kUseReadBufferPool;
+
+  /**
+   * Default deficit round robin quantum for new sessions, the number of
+   * body bytes a transaction may egress per turn when there are > 1
+   * transactions.
    */
   static uint64_t egressBodySizeLimit_;
 
@@ -908,7 +1646,55 @@ class HTTPSession:
    */
   static uint32_t kPendingWriteMax;
 
+  /**
+   * See setPhaseSampling()
+   */
+  static uint32_t kPhaseSampleRate;
+  static std::chrono::microseconds kSlowCallbackThreshold;
+
+  /**
+   * See setAccounting()
+   */
+  static bool kAccountingEnabled;
+
+  /**
+   * See setCodecTapSize()
+   */
+  static uint32_t kCodecTapSize;
+
  private:
+  /**
+   * Decides whether the event loop callback it is in is sampled, if no
+   * enclosing one is, and reports its phase times once done.
+   */
+  class SampledCallback {
+   public:
+    SampledCallback(HTTPSession* session, const char* name);
+    ~SampledCallback();
+   private:
+    HTTPSession* session_;
+    const char* name_;
+    bool sampling_{false};
+    TimePoint start_;
+  };
+
+  /**
+   * Adds the time until it goes out of scope to a phase of the sampled
+   * callback, if any, and of the Accounting if that is on, less the time
+   * of the phases nested in it.
+   */
+  class PhaseTimer {
+   public:
+    PhaseTimer(HTTPSession* session, SessionPhase phase);
+    ~PhaseTimer();
+   private:
+    HTTPSession* session_;
+    SessionPhase phase_;
+    PhaseTimer* parent_{nullptr};
+    TimePoint start_;
+    std::chrono::steady_clock::duration nested_{0};
+  };
+
   void onSetSendWindow(uint32_t windowSize);
   void onSetMaxInitiatedStreams(uint32_t maxTxns);
 
@@ -923,6 +1709,8 @@ class HTTPSession:
    */
   void onConnectionSendWindowOpen() override;
   void onConnectionSendWindowClosed() override;
+  void onConnectionReceiveWindowFull() override;
+  void onConnectionReceiveWindowGrown() override;
 
   /**
    * Get the id of the stream we should ack in a graceful GOAWAY
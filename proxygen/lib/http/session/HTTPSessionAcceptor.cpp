@@ -11,6 +11,17 @@
 #include <proxygen/lib/http/codec/HTTP1xCodec.h>
 #include <proxygen/lib/http/codec/experimental/HTTP2Codec.h>
 #include <proxygen/lib/http/session/HTTPDirectResponseHandler.h>
+#include <proxygen/lib/http/session/SessionMemoryAccountant.h>
+#include <proxygen/lib/ssl/KernelTLS.h>
+#include <proxygen/lib/ssl/SSLKeyOffload.h>
+#include <folly/Random.h>
+#include <algorithm>
+#include <sys/socket.h>
+#include <vector>
+
+#if defined(__linux__) && !defined(SO_BUSY_POLL)
+#define SO_BUSY_POLL 46
+#endif
 
 using folly::AsyncSocket;
 using folly::SocketAddress;
@@ -22,19 +33,27 @@ namespace proxygen {
 
 const SocketAddress HTTPSessionAcceptor::unknownSocketAddress_("0.0.0.0", 0);
 
+// Longest between two steps of a paced drain, in ms, however few the
+// sessions
+static const int64_t kMaxDrainInterval = 100;
+
 HTTPSessionAcceptor::HTTPSessionAcceptor(
   const AcceptorConfiguration& accConfig):
     HTTPAcceptor(accConfig),
     simpleController_(this) {
-  if (!isSSL()) {
-    auto version = SPDYCodec::getVersion(accConfig.plaintextProtocol);
-    if (version) {
-      alwaysUseSPDYVersion_ = *version;
+  if (!isSSL() && !accConfig.plaintextProtocol.empty()) {
+    auto protocol =
+      getCodecProtocolFromNextProtocol(accConfig.plaintextProtocol);
+    if (protocol) {
+      plaintextProtocol_ = *protocol;
     }
   }
 }
 
 HTTPSessionAcceptor::~HTTPSessionAcceptor() {
+  for (auto sniffer: sniffers_) {
+    sniffer->destroy();
+  }
 }
 
 const HTTPErrorPage* HTTPSessionAcceptor::getErrorPage(
@@ -51,30 +70,360 @@ const HTTPErrorPage* HTTPSessionAcceptor::getErrorPage(
   return errorPage;
 }
 
+void HTTPSessionAcceptor::onCreate(const HTTPSession&) {
+  if (loadTracker_) {
+    loadTracker_->onSessionCreated(loadTrackerWorker_);
+    updateLoopTime();
+  }
+  if (busyPoller_) {
+    busyPoller_->onActivity();
+  }
+}
+
+void HTTPSessionAcceptor::onRead(const HTTPSession&, size_t bytesRead) {
+  busyPoller_->onActivity();
+}
+
+void HTTPSessionAcceptor::onRequestEnd(const HTTPSession&,
+                                       uint32_t maxIngressQueueSize) {
+  if (loadTracker_) {
+    updateLoopTime();
+  }
+}
+
+void HTTPSessionAcceptor::onDestroy(const HTTPSession& session) {
+  if (loadTracker_) {
+    loadTracker_->onSessionDestroyed(loadTrackerWorker_);
+  }
+  auto it = sessionsIndex_.find(&session);
+  if (it != sessionsIndex_.end()) {
+    sessions_.erase(it->second);
+    sessionsIndex_.erase(it);
+  }
+}
+
+void HTTPSessionAcceptor::onEgressBufferChanged(const HTTPSession&,
+                                                int64_t delta) {
+  if (loadTracker_) {
+    loadTracker_->onEgressBufferChanged(loadTrackerWorker_, delta);
+  }
+}
+
+void HTTPSessionAcceptor::init(folly::AsyncServerSocket* serverSocket,
+                               folly::EventBase* eventBase) {
+  HTTPAcceptor::init(serverSocket, eventBase);
+  // Spare every connection its getsockname() when there is only one
+  // address it can have been accepted on
+  auto listenAddress = accConfig_.bindAddress;
+  if (serverSocket && serverSocket->getAddresses().size() == 1) {
+    listenAddress = serverSocket->getAddresses().front();
+  }
+  auto family = listenAddress.getFamily();
+  if ((family == AF_INET || family == AF_INET6) &&
+      !listenAddress.getIPAddress().isZero() && listenAddress.getPort() != 0) {
+    localAddress_ = listenAddress;
+  }
+  if (isSSL() && accConfig_.sslKeyOffloadExecutor && sslCtxManager_) {
+    auto ctx = sslCtxManager_->getDefaultSSLCtx();
+    if (!ctx || !enableSSLKeyOffload(ctx->getSSLCtx(),
+                                     accConfig_.sslKeyOffloadExecutor)) {
+      LOG(WARNING) << "Can't offload the TLS key operations of "
+                   << accConfig_.name;
+    }
+  }
+  if (memoryAccountant_) {
+    memoryPressureTimeout_.reset(new MemoryPressureTimeout(this));
+    memoryPressureTimeout_->scheduleTimeout(memoryCheckInterval_.count());
+  }
+  if (streamsController_) {
+    streamsTimeout_.reset(new ConcurrentStreamsTimeout(this));
+    streamsTimeout_->schedule(streamsCheckInterval_);
+  }
+  if (busyPollSpinTime_.count() > 0) {
+    busyPoller_ = folly::make_unique<BusyPoller>(eventBase, busyPollSpinTime_);
+  }
+}
+
+void HTTPSessionAcceptor::checkMemoryPressure() {
+  bool pressure = memoryAccountant_->isUnderPressure();
+  if (pressure != memoryPressure_) {
+    memoryPressure_ = pressure;
+    // setMemoryPressure(false) may resume reads, which may destroy the
+    // session, so go over a copy
+    std::vector<HTTPSession*> sessions(sessions_.begin(), sessions_.end());
+    for (auto session: sessions) {
+      if (sessionsIndex_.count(session)) {
+        session->setMemoryPressure(pressure);
+      }
+    }
+  }
+  if (pressure && !sessions_.empty()) {
+    // Shed the oldest sessions first: they have had the most of their
+    // share, and their clients most likely to reconnect elsewhere
+    size_t toShed = std::max<size_t>(1, sessions_.size() / 10);
+    std::vector<HTTPSession*> shed;
+    for (auto session: sessions_) {
+      if (shed.size() == toShed) {
+        break;
+      }
+      if (!session->isDraining()) {
+        shed.push_back(session);
+      }
+    }
+    for (auto session: shed) {
+      if (!sessionsIndex_.count(session)) {
+        continue;
+      }
+      VLOG(3) << "Shedding session under memory pressure, peer "
+              << session->getPeerAddress();
+      if (session->isBusy()) {
+        session->notifyPendingShutdown();
+      } else {
+        session->closeWhenIdle();
+      }
+    }
+  }
+  memoryPressureTimeout_->scheduleTimeout(memoryCheckInterval_.count());
+}
+
+void HTTPSessionAcceptor::acceptStopped() noexcept {
+  if (drainWindow_.count() <= 0 || sessions_.empty() || drainTimeout_) {
+    HTTPAcceptor::acceptStopped();
+    return;
+  }
+  // The idle ones first, oldest first: their clients lose the least
+  drainQueue_.assign(sessions_.begin(), sessions_.end());
+  std::stable_partition(drainQueue_.begin(), drainQueue_.end(),
+                        [] (HTTPSession* session) {
+                          return !session->isBusy();
+                        });
+  drainNext_ = 0;
+  drainStart_ = getCurrentTime();
+  drainTimeout_.reset(new DrainPacingTimeout(this));
+  drainNextSessions();
+}
+
+void HTTPSessionAcceptor::drainNextSessions() {
+  auto elapsed = millisecondsSince(drainStart_);
+  size_t total = drainQueue_.size();
+  size_t due = total;
+  if (elapsed < drainWindow_) {
+    due = std::max<size_t>(
+      drainNext_ + 1, total * elapsed.count() / drainWindow_.count());
+  }
+  while (drainNext_ < std::min(due, total)) {
+    auto session = drainQueue_[drainNext_++];
+    if (sessionsIndex_.count(session)) {
+      session->notifyPendingShutdown();
+    }
+  }
+  if (drainProgress_) {
+    drainProgress_(drainNext_, total);
+  }
+  if (drainNext_ < total) {
+    // The next few, a little before or after their even share
+    auto interval = std::max<int64_t>(
+      1, drainWindow_.count() / int64_t(total));
+    auto jitter = int64_t(folly::Random::rand32(uint32_t(interval) + 1));
+    drainTimeout_->scheduleTimeout(
+      std::min<int64_t>(kMaxDrainInterval, interval / 2 + jitter));
+    return;
+  }
+  drainQueue_.clear();
+  HTTPAcceptor::acceptStopped();
+}
+
+size_t HTTPSessionAcceptor::handOffSessions(HTTPSessionAcceptor* target,
+                                            size_t maxSessions) {
+  CHECK_NE(target, this);
+  if (drainTimeout_ || maxSessions == 0) {
+    return 0;
+  }
+  std::vector<HTTPSession*> sessions;
+  for (auto session: sessions_) {
+    if (!session->isDraining() && session->isDetachable()) {
+      sessions.push_back(session);
+    }
+  }
+  // The heaviest first, the oldest of those first
+  std::stable_sort(sessions.begin(), sessions.end(),
+                   [] (const HTTPSession* a, const HTTPSession* b) {
+                     return a->getNumIncomingStreams() >
+                       b->getNumIncomingStreams();
+                   });
+  if (sessions.size() > maxSessions) {
+    sessions.resize(maxSessions);
+  }
+  if (sessions.empty()) {
+    return 0;
+  }
+  for (auto session: sessions) {
+    releaseSession(session);
+  }
+  // One trip to the other thread for all of them
+  target->getEventBase()->runInEventBaseThread([target, sessions] {
+      for (auto session: sessions) {
+        target->adoptSession(session);
+      }
+    });
+  return sessions.size();
+}
+
+void HTTPSessionAcceptor::setTenantScheduler(TenantScheduler* scheduler) {
+  tenantScheduler_ = scheduler;
+  for (auto session: sessions_) {
+    session->setTenantScheduler(scheduler);
+  }
+}
+
+void HTTPSessionAcceptor::releaseSession(HTTPSession* session) {
+  VLOG(4) << "Handing off session for peer " << session->getPeerAddress();
+  // Gone, as far as this thread can tell
+  session->setInfoCallback(nullptr);
+  if (loadTracker_) {
+    loadTracker_->onSessionDestroyed(loadTrackerWorker_);
+  }
+  auto it = sessionsIndex_.find(session);
+  sessions_.erase(it->second);
+  sessionsIndex_.erase(it);
+  session->getConnectionManager()->removeConnection(session);
+  session->setController(nullptr);
+  session->setMemoryAccountant(nullptr);
+  session->setEgressAccountant(nullptr);
+  session->setSessionStats(nullptr);
+  session->setWorkerContext(nullptr);
+  session->setTenantScheduler(nullptr);
+  session->detachEventBase();
+}
+
+void HTTPSessionAcceptor::adoptSession(HTTPSession* session) {
+  VLOG(4) << "Taking over session for peer " << session->getPeerAddress();
+  session->attachEventBase(getEventBase(), getTransactionTimeoutSet(),
+                           getHeaderTimeoutSet(), getBodyTimeoutSet());
+  session->setController(getController());
+  session->setInfoCallback(this);
+  if (loadTracker_) {
+    loadTracker_->onSessionCreated(loadTrackerWorker_);
+  }
+  session->setSessionStats(downstreamSessionStats_);
+  session->setWorkerContext(workerContext_);
+  if (tenantScheduler_) {
+    session->setTenantScheduler(tenantScheduler_);
+  }
+  if (egressAccountant_) {
+    session->setEgressAccountant(egressAccountant_);
+  }
+  if (memoryAccountant_) {
+    session->setMemoryAccountant(memoryAccountant_);
+  }
+  session->setMemoryPressure(memoryPressure_);
+  if (auto maxStreams = getMaxConcurrentIncomingStreams()) {
+    session->setMaxConcurrentIncomingStreams(maxStreams);
+  }
+  sessionsIndex_[session] = sessions_.insert(sessions_.end(), session);
+  Acceptor::addConnection(session);
+}
+
+void HTTPSessionAcceptor::updateConcurrentStreams(
+    std::chrono::microseconds loopLag) {
+  size_t transactions = 0;
+  for (auto session: sessions_) {
+    transactions += session->getNumIncomingStreams();
+  }
+  streamsController_->update(loopLag, transactions);
+  auto limit = getMaxConcurrentIncomingStreams();
+  for (auto session: sessions_) {
+    session->setMaxConcurrentIncomingStreams(limit);
+  }
+  streamsTimeout_->schedule(streamsCheckInterval_);
+}
+
+uint32_t HTTPSessionAcceptor::getMaxConcurrentIncomingStreams() const {
+  uint32_t limit = accConfig_.maxConcurrentIncomingStreams;
+  if (streamsController_) {
+    auto adapted = streamsController_->getLimit();
+    limit = limit ? std::min(limit, adapted) : adapted;
+  }
+  return limit;
+}
+
+void HTTPSessionAcceptor::updateLoopTime() {
+  loadTracker_->setLoopTime(
+    loadTrackerWorker_,
+    std::chrono::microseconds(int64_t(getEventBase()->getAvgLoopTime())));
+}
+
+unique_ptr<HTTPCodec> HTTPSessionAcceptor::makeHTTP1xCodec() const {
+  auto codec = folly::make_unique<HTTP1xCodec>(TransportDirection::DOWNSTREAM);
+  if (accConfig_.http1xHeadScanner) {
+    codec->setHeadScanner(true);
+  }
+  if (accConfig_.headerArenaBlockSize) {
+    codec->setHeaderArena(accConfig_.headerArenaBlockSize);
+  }
+  return std::move(codec);
+}
+
+unique_ptr<HTTPCodec> HTTPSessionAcceptor::makeCodec(
+    CodecProtocol protocol) const {
+  SPDYVersion version = SPDYVersion::SPDY3_1;
+  switch (protocol) {
+    case CodecProtocol::HTTP_1_1:
+      return makeHTTP1xCodec();
+    case CodecProtocol::HTTP_2: {
+      auto codec =
+        folly::make_unique<HTTP2Codec>(TransportDirection::DOWNSTREAM);
+      if (accConfig_.headerArenaBlockSize) {
+        codec->setHeaderArena(accConfig_.headerArenaBlockSize);
+      }
+      return std::move(codec);
+    }
+    case CodecProtocol::SPDY_2:
+      version = SPDYVersion::SPDY2;
+      break;
+    case CodecProtocol::SPDY_3:
+      version = SPDYVersion::SPDY3;
+      break;
+    case CodecProtocol::SPDY_3_1:
+      version = SPDYVersion::SPDY3_1;
+      break;
+    case CodecProtocol::SPDY_3_1_HPACK:
+      version = SPDYVersion::SPDY3_1_HPACK;
+      break;
+  }
+  return folly::make_unique<SPDYCodec>(
+    TransportDirection::DOWNSTREAM,
+    version,
+    accConfig_.spdyCompressionLevel,
+    accConfig_.spdyCompressionWindowBits,
+    accConfig_.spdyCompressionMemLevel);
+}
+
 void HTTPSessionAcceptor::onNewConnection(
-  folly::AsyncSocket::UniquePtr ssock,
+  AsyncSocket::UniquePtr sock,
     const SocketAddress* peerAddress,
     const string& nextProtocol,
   const folly::TransportInfo& tinfo) {
-  unique_ptr<HTTPCodec> codec;
-
-  AsyncSocket::UniquePtr sock(dynamic_cast<AsyncSocket*>(ssock.release()));
-
-  if (!isSSL() && alwaysUseSPDYVersion_) {
-    codec = folly::make_unique<SPDYCodec>(
-      TransportDirection::DOWNSTREAM,
-      alwaysUseSPDYVersion_.value(),
-      accConfig_.spdyCompressionLevel);
-  } else if (nextProtocol.empty() ||
-             HTTP1xCodec::supportsNextProtocol(nextProtocol)) {
-    codec = folly::make_unique<HTTP1xCodec>(TransportDirection::DOWNSTREAM);
-  } else if (auto version = SPDYCodec::getVersion(nextProtocol)) {
-    codec = folly::make_unique<SPDYCodec>(
-      TransportDirection::DOWNSTREAM,
-      *version,
-      accConfig_.spdyCompressionLevel);
-  } else if (nextProtocol == "h2-14") {
-    codec = folly::make_unique<HTTP2Codec>(TransportDirection::DOWNSTREAM);
+  if (isSSL() && accConfig_.kernelTLS) {
+    sock = moveToKernelTLS(std::move(sock));
+  }
+
+  folly::Optional<CodecProtocol> protocol;
+  if (!isSSL() && plaintextProtocol_) {
+    protocol = plaintextProtocol_;
+  } else if (!isSSL() &&
+             (accConfig_.allowH2C || accConfig_.allowPlaintextSPDY)) {
+    // Wait for the first bytes to tell the protocol
+    auto sniffer = new ProtocolSniffer(std::move(sock), *peerAddress, tinfo,
+                                       this, accConfig_.allowH2C,
+                                       accConfig_.allowPlaintextSPDY);
+    sniffers_.insert(sniffer);
+    sniffer->start(accConfig_.connectionIdleTimeout);
+    return;
+  } else if (nextProtocol.empty()) {
+    protocol = CodecProtocol::HTTP_1_1;
+  } else if (auto negotiated = getCodecProtocolFromNextProtocol(nextProtocol)) {
+    protocol = *negotiated;
   } else {
     // Either we advertised a protocol we don't support or the
     // client requested a protocol we didn't advertise.
@@ -82,32 +431,133 @@ void HTTPSessionAcceptor::onNewConnection(
     return;
   }
 
-  CHECK(codec);
+  startSession(std::move(sock), *peerAddress, makeCodec(*protocol), tinfo);
+}
+
+AsyncSocket::UniquePtr HTTPSessionAcceptor::moveToKernelTLS(
+    AsyncSocket::UniquePtr sock) {
+  auto sslSock = dynamic_cast<folly::AsyncSSLSocket*>(sock.get());
+  if (!sslSock || !enableKernelTLS(sslSock->getSSL(), sslSock->getFd())) {
+    return sock;
+  }
+  VLOG(4) << "Moved TLS to the kernel for fd " << sslSock->getFd();
+  auto base = sock->getEventBase();
+  // Nothing goes through the SSL object anymore, not even close_notify
+  int fd = sock->detachFd();
+  return AsyncSocket::UniquePtr(new AsyncSocket(base, fd));
+}
+
+void HTTPSessionAcceptor::onSniffed(ProtocolSniffer* sniffer,
+                                    ProtocolSniffer::Protocol protocol,
+                                    AsyncSocket::UniquePtr sock,
+                                    unique_ptr<folly::IOBuf> ingress,
+                                    unique_ptr<HTTPMessage> upgradeRequest)
+    noexcept {
+  CodecProtocol codecProtocol = CodecProtocol::HTTP_1_1;
+  switch (protocol) {
+    case ProtocolSniffer::Protocol::HTTP1:
+      break;
+    case ProtocolSniffer::Protocol::HTTP2_PRIOR_KNOWLEDGE:
+    case ProtocolSniffer::Protocol::HTTP2_UPGRADE:
+      codecProtocol = CodecProtocol::HTTP_2;
+      break;
+    case ProtocolSniffer::Protocol::SPDY_2:
+      codecProtocol = CodecProtocol::SPDY_2;
+      break;
+    case ProtocolSniffer::Protocol::SPDY_3:
+      // Nothing tells 3 from 3.1 on the wire, and 3.1 is what clients speak
+      codecProtocol = CodecProtocol::SPDY_3_1;
+      break;
+  }
+  auto codec = makeCodec(codecProtocol);
+  sniffers_.erase(sniffer);
+  // Still in use by the caller, it goes away once it returns
+  sniffer->destroy();
+  startSession(std::move(sock), sniffer->getPeerAddress(), std::move(codec),
+               sniffer->getTransportInfo(), std::move(ingress),
+               std::move(upgradeRequest));
+}
+
+void HTTPSessionAcceptor::onSniffError(ProtocolSniffer* sniffer) noexcept {
+  sniffers_.erase(sniffer);
+  sniffer->destroy();
+}
 
+void HTTPSessionAcceptor::startSession(AsyncSocket::UniquePtr sock,
+                                       const SocketAddress& peerAddress,
+                                       unique_ptr<HTTPCodec> codec,
+                                       const folly::TransportInfo& tinfo,
+                                       unique_ptr<folly::IOBuf> ingress,
+                                       unique_ptr<HTTPMessage> upgradeRequest) {
   auto controller = getController();
+#ifdef SO_BUSY_POLL
+  if (accConfig_.busyPollMicros) {
+    int busyPoll = accConfig_.busyPollMicros;
+    if (sock->setSockOpt(SOL_SOCKET, SO_BUSY_POLL, &busyPoll) != 0) {
+      // Raising it above net.core.busy_read takes CAP_NET_ADMIN
+      VLOG(4) << "couldn't set SO_BUSY_POLL, errno=" << errno;
+    }
+  }
+#endif
   SocketAddress localAddress;
-  try {
-    sock->getLocalAddress(&localAddress);
-  } catch (...) {
-    VLOG(3) << "couldn't get local address for socket";
-    localAddress = unknownSocketAddress_;
+  if (localAddress_) {
+    localAddress = *localAddress_;
+  } else {
+    try {
+      sock->getLocalAddress(&localAddress);
+    } catch (...) {
+      VLOG(3) << "couldn't get local address for socket";
+      localAddress = unknownSocketAddress_;
+    }
   }
-  VLOG(4) << "Created new session for peer " << *peerAddress;
+  VLOG(4) << "Created new session for peer " << peerAddress;
   HTTPDownstreamSession* session =
     new HTTPDownstreamSession(getTransactionTimeoutSet(), std::move(sock),
-                              localAddress, *peerAddress,
+                              localAddress, peerAddress,
                               controller, std::move(codec), tinfo, this);
-  if (accConfig_.maxConcurrentIncomingStreams) {
-    session->setMaxConcurrentIncomingStreams(
-        accConfig_.maxConcurrentIncomingStreams);
+  if (auto maxStreams = getMaxConcurrentIncomingStreams()) {
+    session->setMaxConcurrentIncomingStreams(maxStreams);
   }
   // set flow control parameters
   session->setFlowControl(accConfig_.initialReceiveWindow,
                           accConfig_.receiveStreamWindowSize,
                           accConfig_.receiveSessionWindowSize);
+  session->setIngressTimeouts(getHeaderTimeoutSet(), getBodyTimeoutSet());
+  session->setRejectUnsafeEarlyData(accConfig_.rejectUnsafeEarlyData);
+  if (accConfig_.egressCoalesceBytes) {
+    session->setEgressCoalescing(accConfig_.egressCoalesceBytes,
+                                 accConfig_.egressCoalesceDelay);
+  }
   session->setSessionStats(downstreamSessionStats_);
+  session->setWorkerContext(workerContext_);
+  if (tenantScheduler_) {
+    session->setTenantScheduler(tenantScheduler_);
+  }
+  if (egressAccountant_) {
+    session->setEgressAccountant(egressAccountant_);
+  }
+  if (accConfig_.egressQuotas) {
+    session->setEgressQuotas(true);
+  }
+  if (accConfig_.batchRequestDispatch) {
+    session->setBatchRequestDispatch(true);
+  }
+  if (accConfig_.notSentLowWatermark) {
+    session->setNotSentLowWatermark(accConfig_.notSentLowWatermark);
+  }
+  if (memoryAccountant_) {
+    session->setMemoryAccountant(memoryAccountant_);
+    if (memoryPressure_) {
+      session->setMemoryPressure(true);
+    }
+  }
+  sessionsIndex_[session] = sessions_.insert(sessions_.end(), session);
   Acceptor::addConnection(session);
-  session->startNow();
+  if (ingress || upgradeRequest) {
+    session->startNow(std::move(ingress), std::move(upgradeRequest));
+  } else {
+    session->startNow();
+  }
 }
 
 } // proxygen
@@ -9,16 +9,32 @@
  */
 #pragma once
 
+#include <proxygen/lib/http/codec/CodecProtocol.h>
 #include <proxygen/lib/http/codec/SPDYCodec.h>
+#include <proxygen/lib/http/session/ConcurrentStreamsController.h>
+#include <proxygen/lib/http/session/ProtocolSniffer.h>
 #include <proxygen/lib/http/session/HTTPDownstreamSession.h>
 #include <proxygen/lib/http/session/HTTPErrorPage.h>
 #include <proxygen/lib/http/session/SimpleController.h>
+#include <proxygen/lib/services/BusyPoller.h>
 #include <proxygen/lib/services/HTTPAcceptor.h>
+#include <proxygen/lib/services/WorkerLoadTracker.h>
+#include <proxygen/lib/utils/Time.h>
 #include <folly/io/async/AsyncSSLSocket.h>
+#include <folly/Memory.h>
+#include <folly/io/async/AsyncTimeout.h>
+#include <functional>
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include <unordered_set>
 
 namespace proxygen {
 
 class HTTPSessionStats;
+class SessionMemoryAccountant;
+class TenantScheduler;
+class WorkerContext;
 
 /**
  * Specialization of Acceptor that serves as an abstract base for
@@ -26,7 +42,8 @@ class HTTPSessionStats;
  */
 class HTTPSessionAcceptor:
   public HTTPAcceptor,
-  private HTTPSession::InfoCallback {
+  private HTTPSession::InfoCallback,
+  private ProtocolSniffer::Callback {
 public:
   explicit HTTPSessionAcceptor(const AcceptorConfiguration& accConfig);
   ~HTTPSessionAcceptor() override;
@@ -80,6 +97,129 @@ public:
   virtual HTTPTransaction::Handler* newHandler(
     HTTPTransaction& txn, HTTPMessage* msg) noexcept = 0;
 
+  /**
+   * newHandler() for the requests a session parsed from one read, in
+   * order, appending their handlers to handlers. Acceptors that can
+   * create them together override it.
+   */
+  virtual void newHandlers(
+    const std::vector<HTTPTransaction*>& txns,
+    const std::vector<HTTPMessage*>& msgs,
+    std::vector<HTTPTransaction::Handler*>& handlers) noexcept {
+    for (size_t i = 0; i < txns.size(); ++i) {
+      handlers.push_back(newHandler(*txns[i], msgs[i]));
+    }
+  }
+
+  /**
+   * Report the sessions of this acceptor, their buffered egress and the
+   * loop time of its EventBase as the load of the given worker.
+   */
+  void setLoadTracker(WorkerLoadTracker* tracker, size_t worker) {
+    loadTracker_ = tracker;
+    loadTrackerWorker_ = worker;
+  }
+
+  /**
+   * The state of the worker thread of this acceptor, for the transactions
+   * of its sessions, see WorkerContext. It must outlive the sessions.
+   */
+  void setWorkerContext(WorkerContext* context) {
+    workerContext_ = context;
+  }
+
+  WorkerContext* getWorkerContext() const {
+    return workerContext_;
+  }
+
+  /**
+   * Share the worker fairly between the tenants of the sessions of this
+   * acceptor, current and future, see TenantScheduler. It must be for the
+   * EventBase of this acceptor, and be unset before it is destroyed.
+   */
+  void setTenantScheduler(TenantScheduler* scheduler);
+
+  /**
+   * Account the memory of the sessions of this acceptor to the given
+   * accountant, and check it every checkInterval. While it is under
+   * pressure, the sessions stop reading and hold back their window updates,
+   * and on each check the oldest tenth of them are closed if idle or else
+   * drained. Call before init().
+   */
+  void setMemoryAccountant(
+      SessionMemoryAccountant* accountant,
+      std::chrono::milliseconds checkInterval =
+        std::chrono::milliseconds(100)) {
+    memoryAccountant_ = accountant;
+    memoryCheckInterval_ = checkInterval;
+  }
+
+  /**
+   * Account the egress buffered by the sessions of this acceptor to the
+   * given accountant, which the acceptors of all the threads may share as
+   * their egress budget, see HTTPSession::setEgressAccountant().
+   */
+  void setEgressAccountant(SessionMemoryAccountant* accountant) {
+    egressAccountant_ = accountant;
+  }
+
+  /**
+   * Adapt the number of streams the sessions of this acceptor let their
+   * clients open at once to the load of the worker, updating it every
+   * checkInterval, see ConcurrentStreamsController. It never goes above
+   * the configured maxConcurrentIncomingStreams. Call before init().
+   */
+  void setConcurrentStreamsControl(
+      const ConcurrentStreamsController::Options& options,
+      std::chrono::milliseconds checkInterval =
+        std::chrono::milliseconds(100)) {
+    streamsController_ =
+      folly::make_unique<ConcurrentStreamsController>(options);
+    streamsCheckInterval_ = checkInterval;
+  }
+
+  /**
+   * Keep the EventBase of this acceptor polling without blocking for up to
+   * spinTime after each read or new connection of its sessions, see
+   * BusyPoller. Call before init().
+   */
+  void setBusyPolling(std::chrono::microseconds spinTime) {
+    busyPollSpinTime_ = spinTime;
+  }
+
+  /**
+   * Once the listening socket stops accepting, tell the sessions of this
+   * acceptor to drain a few at a time over window rather than all at once,
+   * so that their clients do not all reconnect elsewhere at the same
+   * time. Idle sessions go first, at slightly random intervals. Whatever
+   * is left at the end of the window drains then, and closes after the
+   * graceful shutdown timeout as usual. progress is told how many sessions
+   * were told to drain, of how many, as it goes. Call before init().
+   */
+  void setDrainPacing(
+      std::chrono::milliseconds window,
+      std::function<void(size_t drained, size_t total)> progress = nullptr) {
+    drainWindow_ = window;
+    drainProgress_ = progress;
+  }
+
+  /**
+   * Move up to maxSessions of the sessions of this acceptor to target, the
+   * HTTPSessionAcceptor of another thread, to take load off this one. The
+   * sessions with the most transactions go first, of those that can be
+   * detached (see HTTPSession::isDetachable()) and are not draining. They
+   * are all detached here, and attached in one go on target's thread,
+   * which target must live to see. Returns how many were handed off.
+   */
+  size_t handOffSessions(HTTPSessionAcceptor* target, size_t maxSessions);
+
+  const ConcurrentStreamsController* getConcurrentStreamsController() const {
+    return streamsController_.get();
+  }
+
+  void init(folly::AsyncServerSocket* serverSocket,
+            folly::EventBase* eventBase) override;
+
 protected:
   /**
    * This function is invoked when a new session is created to get the
@@ -119,24 +259,110 @@ private:
   HTTPSessionAcceptor& operator=(const HTTPSessionAcceptor&) = delete;
 
   // HTTPSession::InfoCallback methods
-  void onCreate(const HTTPSession&) override {}
-  void onIngressError(const HTTPSession&, ProxygenError error) override {}
-  void onRead(const HTTPSession&, size_t bytesRead) override {}
-  void onWrite(const HTTPSession&, size_t bytesWritten) override {}
-  void onRequestBegin(const HTTPSession&) override {}
+  uint32_t getSubscribedEvents() const override {
+    return InfoCallback::REQUEST_END | InfoCallback::EGRESS_BUFFER |
+      (busyPoller_ ? InfoCallback::READ : 0);
+  }
+  void onCreate(const HTTPSession&) override;
+  void onRead(const HTTPSession&, size_t bytesRead) override;
   void onRequestEnd(const HTTPSession&,
-                    uint32_t maxIngressQueueSize) override {}
-  void onActivateConnection(const HTTPSession&) override {}
-  void onDeactivateConnection(const HTTPSession&) override {}
-  void onDestroy(const HTTPSession&) override {}
-  void onIngressMessage(const HTTPSession&, const HTTPMessage&) override {}
-  void onIngressLimitExceeded(const HTTPSession&) override {}
-  void onIngressPaused(const HTTPSession&) override {}
-  void onTransactionDetached(const HTTPSession&) override {}
-  void onPingReplySent(int64_t latency) override {}
-  void onPingReplyReceived() override {}
-  void onSettingsOutgoingStreamsFull(const HTTPSession&) override {}
-  void onSettingsOutgoingStreamsNotFull(const HTTPSession&) override {}
+                    uint32_t maxIngressQueueSize) override;
+  void onDestroy(const HTTPSession&) override;
+  void onEgressBufferChanged(const HTTPSession&, int64_t delta) override;
+
+  // ProtocolSniffer::Callback methods
+  void onSniffed(ProtocolSniffer* sniffer,
+                 ProtocolSniffer::Protocol protocol,
+                 folly::AsyncSocket::UniquePtr sock,
+                 std::unique_ptr<folly::IOBuf> ingress,
+                 std::unique_ptr<HTTPMessage> upgradeRequest)
+    noexcept override;
+  void onSniffError(ProtocolSniffer* sniffer) noexcept override;
+
+  // Acceptor
+  void acceptStopped() noexcept override;
+
+  std::unique_ptr<HTTPCodec> makeHTTP1xCodec() const;
+
+  std::unique_ptr<HTTPCodec> makeCodec(CodecProtocol protocol) const;
+
+  // The plain socket to run the session over if the kernel took over the
+  // encryption of sock, else sock
+  folly::AsyncSocket::UniquePtr moveToKernelTLS(
+    folly::AsyncSocket::UniquePtr sock);
+
+  void startSession(folly::AsyncSocket::UniquePtr sock,
+                    const folly::SocketAddress& peerAddress,
+                    std::unique_ptr<HTTPCodec> codec,
+                    const folly::TransportInfo& tinfo,
+                    std::unique_ptr<folly::IOBuf> ingress = nullptr,
+                    std::unique_ptr<HTTPMessage> upgradeRequest = nullptr);
+
+  void updateLoopTime();
+
+  void checkMemoryPressure();
+
+  void updateConcurrentStreams(std::chrono::microseconds loopLag);
+
+  uint32_t getMaxConcurrentIncomingStreams() const;
+
+  void drainNextSessions();
+
+  // Hand a session off to another acceptor, or take one from another
+  void releaseSession(HTTPSession* session);
+  void adoptSession(HTTPSession* session);
+
+  class MemoryPressureTimeout: public folly::AsyncTimeout {
+   public:
+    explicit MemoryPressureTimeout(HTTPSessionAcceptor* acceptor):
+        folly::AsyncTimeout(acceptor->getEventBase()),
+        acceptor_(acceptor) {}
+
+    void timeoutExpired() noexcept override {
+      acceptor_->checkMemoryPressure();
+    }
+
+   private:
+    HTTPSessionAcceptor* acceptor_;
+  };
+
+  class DrainPacingTimeout: public folly::AsyncTimeout {
+   public:
+    explicit DrainPacingTimeout(HTTPSessionAcceptor* acceptor):
+        folly::AsyncTimeout(acceptor->getEventBase()),
+        acceptor_(acceptor) {}
+
+    void timeoutExpired() noexcept override {
+      acceptor_->drainNextSessions();
+    }
+
+   private:
+    HTTPSessionAcceptor* acceptor_;
+  };
+
+  class ConcurrentStreamsTimeout: public folly::AsyncTimeout {
+   public:
+    explicit ConcurrentStreamsTimeout(HTTPSessionAcceptor* acceptor):
+        folly::AsyncTimeout(acceptor->getEventBase()),
+        acceptor_(acceptor) {}
+
+    void schedule(std::chrono::milliseconds interval) {
+      scheduled_ = getCurrentTime() + interval;
+      scheduleTimeout(interval.count());
+    }
+
+    void timeoutExpired() noexcept override {
+      // How much later than asked for the loop got to it
+      auto lag = std::max(getCurrentTime() - scheduled_,
+                          TimePoint::duration::zero());
+      acceptor_->updateConcurrentStreams(
+        std::chrono::duration_cast<std::chrono::microseconds>(lag));
+    }
+
+   private:
+    HTTPSessionAcceptor* acceptor_;
+    TimePoint scheduled_;
+  };
 
   /** General-case error page generator */
   std::unique_ptr<HTTPErrorPage> defaultErrorPage_;
@@ -144,10 +370,54 @@ private:
   /** Generator of more detailed error pages for internal clients */
   std::unique_ptr<HTTPErrorPage> diagnosticErrorPage_;
 
-  folly::Optional<SPDYVersion> alwaysUseSPDYVersion_{};
+  /** The protocol of all plaintext connections, if configured */
+  folly::Optional<CodecProtocol> plaintextProtocol_;
 
   SimpleController simpleController_;
 
+  WorkerLoadTracker* loadTracker_{nullptr};
+  size_t loadTrackerWorker_{0};
+
+  WorkerContext* workerContext_{nullptr};
+  TenantScheduler* tenantScheduler_{nullptr};
+
+  SessionMemoryAccountant* memoryAccountant_{nullptr};
+  SessionMemoryAccountant* egressAccountant_{nullptr};
+  std::chrono::milliseconds memoryCheckInterval_{100};
+  std::unique_ptr<MemoryPressureTimeout> memoryPressureTimeout_;
+  bool memoryPressure_{false};
+
+  std::unique_ptr<ConcurrentStreamsController> streamsController_;
+  std::chrono::milliseconds streamsCheckInterval_{100};
+  std::unique_ptr<ConcurrentStreamsTimeout> streamsTimeout_;
+
+  std::chrono::milliseconds drainWindow_{0};
+  std::function<void(size_t, size_t)> drainProgress_;
+  std::unique_ptr<DrainPacingTimeout> drainTimeout_;
+  // The sessions to tell to drain, in order, and how many were
+  std::vector<HTTPSession*> drainQueue_;
+  size_t drainNext_{0};
+  TimePoint drainStart_;
+
+  std::chrono::microseconds busyPollSpinTime_{0};
+  std::unique_ptr<BusyPoller> busyPoller_;
+
+  /**
+   * The sessions of this acceptor, oldest first
+   */
+  std::list<HTTPSession*> sessions_;
+  std::unordered_map<const HTTPSession*,
+                     std::list<HTTPSession*>::iterator> sessionsIndex_;
+
+  /**
+   * The local address of every connection, when the listening socket is
+   * bound to a single address other than the wildcard one
+   */
+  folly::Optional<folly::SocketAddress> localAddress_;
+
+  /** Plaintext connections whose protocol is not known yet */
+  std::unordered_set<ProtocolSniffer*> sniffers_;
+
   /**
    * 0.0.0.0:0, a valid address to use if getsockname() or getpeername() fails
    */
@@ -9,6 +9,8 @@
  */
 #pragma once
 
+#include <vector>
+
 namespace folly {
 class SocketAddress;
 }
@@ -39,6 +41,22 @@ class HTTPSessionController {
   virtual HTTPTransactionHandler* getRequestHandler(
     HTTPTransaction& txn, HTTPMessage* msg) = 0;
 
+  /**
+   * Will be invoked instead of getRequestHandler() with all the requests
+   * HTTPSession parsed from one read, in order, when it batches them (see
+   * HTTPSession::setBatchRequestDispatch()). Appends the handler of each
+   * to handlers. Override it to set the handlers up together, eg. to
+   * allocate them in bulk; by default each comes from getRequestHandler().
+   */
+  virtual void getRequestHandlers(
+    const std::vector<HTTPTransaction*>& txns,
+    const std::vector<HTTPMessage*>& msgs,
+    std::vector<HTTPTransactionHandler*>& handlers) {
+    for (size_t i = 0; i < txns.size(); ++i) {
+      handlers.push_back(getRequestHandler(*txns[i], msgs[i]));
+    }
+  }
+
   /**
    * Will be invoked when HTTPSession is unable to parse a new request
    * on the connection because of bad input.
@@ -12,9 +12,50 @@
 #include <chrono>
 #include <inttypes.h>
 #include <proxygen/lib/http/session/TTLBAStats.h>
+#include <proxygen/lib/utils/AllocStats.h>
 
 namespace proxygen {
 
+/**
+ * The phases the event loop callbacks of a session spend their time in,
+ * as sampled with HTTPSession::setPhaseSampling()
+ */
+enum class SessionPhase : uint8_t {
+  // Parsing ingress in the codec, handler callbacks excluded
+  INGRESS_PARSE,
+  // Creating handlers and running their ingress callbacks
+  HANDLER_DISPATCH,
+  // Collecting and serializing egress from the transactions
+  EGRESS_SERIALIZE,
+  // Handing egress to the transport
+  WRITE,
+};
+
+const size_t kNumSessionPhases = 4;
+
+inline const char* getSessionPhaseString(SessionPhase phase) {
+  switch (phase) {
+    case SessionPhase::INGRESS_PARSE: return "ingress_parse";
+    case SessionPhase::HANDLER_DISPATCH: return "handler_dispatch";
+    case SessionPhase::EGRESS_SERIALIZE: return "egress_serialize";
+    case SessionPhase::WRITE: return "write";
+  }
+  return "unknown";
+}
+
+/**
+ * The objects whose memory is pooled per thread, instead of being freed
+ */
+enum class PooledObject : uint8_t {
+  TRANSACTION,
+  MESSAGE,
+  // The vectors of HTTPHeaders
+  HEADER_VECTORS,
+  BYTE_EVENT,
+};
+
+const size_t kNumPooledObjects = 4;
+
 // This may be retired with a byte events refactor
 class HTTPSessionStats : public TTLBAStats {
  public:
@@ -25,6 +66,35 @@ class HTTPSessionStats : public TTLBAStats {
   virtual void recordTransactionsServed(uint64_t) noexcept = 0;
   virtual void recordSessionReused() noexcept = 0;
   virtual void recordSessionIdleTime(std::chrono::seconds) noexcept {};
+  virtual void recordSessionPhaseTime(SessionPhase,
+                                      std::chrono::microseconds) noexcept {}
+  // Objects that got memory from the allocator, and from a pool
+  virtual void recordPoolAllocations(PooledObject,
+                                     uint64_t /*allocated*/,
+                                     uint64_t /*reused*/) noexcept {}
+  // What a transaction cost in allocations and copies, and what its
+  // session cost besides, e.g. parsing; only counted with
+  // --enable-alloc-stats
+  virtual void recordTransactionAllocCounts(const AllocCounts&) noexcept {}
+  virtual void recordSessionAllocCounts(const AllocCounts&) noexcept {}
+  // A transaction, or the session, got as much body as its receive window
+  // allows, so the peer has to wait for a window update; and receive
+  // window auto-tuning grew one
+  virtual void recordTransactionReceiveWindowFull() noexcept {}
+  virtual void recordTransactionReceiveWindowGrown() noexcept {}
+  virtual void recordSessionReceiveWindowFull() noexcept {}
+  virtual void recordSessionReceiveWindowGrown() noexcept {}
+  // Bytes held by the arena of a transaction that used one
+  virtual void recordTransactionArenaSize(size_t) noexcept {}
+  // From the start of a transaction to the first headers it sends, and
+  // to its end
+  virtual void recordTimeToFirstByte(std::chrono::milliseconds) noexcept {}
+  virtual void recordTransactionDuration(
+    std::chrono::milliseconds) noexcept {}
+  // Decoded size of the headers of each ingress message
+  virtual void recordIngressHeaderSize(size_t) noexcept {}
+  // Egress buffered in the session and the transport, as of each write
+  virtual void recordWriteBufferSize(size_t) noexcept {}
 };
 
 }
@@ -10,12 +10,20 @@
 #include <proxygen/lib/http/session/HTTPTransaction.h>
 
 #include <algorithm>
+#include <cmath>
+#include <limits>
 #include <folly/Conv.h>
-#include <folly/io/async/EventBaseManager.h>
+#include <folly/FileUtil.h>
+#include <folly/Memory.h>
+#include <folly/String.h>
 #include <glog/logging.h>
 #include <proxygen/lib/http/HTTPHeaderSize.h>
 #include <proxygen/lib/http/codec/SPDYConstants.h>
 #include <proxygen/lib/http/session/HTTPSessionStats.h>
+#include <proxygen/lib/utils/FileRange.h>
+#include <proxygen/lib/utils/TraceEvent.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using folly::IOBuf;
 using std::unique_ptr;
@@ -25,6 +33,12 @@ namespace proxygen {
 namespace {
   const int64_t kApproximateMTU = 1400;
   const int64_t kRateLimitMaxDelayMs = 10000;
+  // Default egress burst, in time at the rate limit
+  const int64_t kRateLimitDefaultBurstMs = 10;
+  // How far ahead of egress files passed to sendFile() are mapped
+  const size_t kFileBodyWindow = 256 * 1024;
+  // Blocks of the arena; most requests keep their state in one
+  const size_t kArenaBlockSize = 4096;
 }
 
 HTTPTransaction::HTTPTransaction(TransportDirection direction,
@@ -63,7 +77,8 @@ HTTPTransaction::HTTPTransaction(TransportDirection direction,
     firstHeaderByteSent_(false),
     inResume_(false),
     inActiveSet_(true),
-    ingressErrorSeen_(false) {
+    ingressErrorSeen_(false),
+    firstHeadersTimed_(false) {
 
   if (assocStreamId_) {
     if (isUpstream()) {
@@ -73,22 +88,57 @@ HTTPTransaction::HTTPTransaction(TransportDirection direction,
     }
   }
 
+  // Refreshed on nearly every read and write
+  setLazyRefresh(true);
   refreshTimeout();
   if (stats_) {
     stats_->recordTransactionOpened();
+    startTime_ = getCurrentTime();
   }
-
-  cancelled_.reset(new bool(false));
 }
 
 HTTPTransaction::~HTTPTransaction() {
+  closeFileBodies();
   if (stats_) {
     stats_->recordTransactionClosed();
+    stats_->recordTransactionDuration(millisecondsSince(startTime_));
   }
   if (isEnqueued()) {
     dequeue();
   }
-  *cancelled_ = true;
+  if (priorityTree_) {
+    priorityTree_->removeTransaction(priorityTreeHandle_);
+  }
+  if (spliceEgress_) {
+    spliceEgress_->spliceIngress_ = nullptr;
+  }
+  if (spliceIngress_) {
+    spliceIngress_->spliceEgress_ = nullptr;
+  }
+}
+
+folly::SysArena& HTTPTransaction::getArena() {
+  if (!arena_) {
+    arena_ = folly::make_unique<folly::SysArena>(kArenaBlockSize);
+  }
+  return *arena_;
+}
+
+void HTTPTransaction::setPriorityTree(HTTP2PriorityQueue& tree,
+                                      const http2::PriorityUpdate& pri) {
+  CHECK(!priorityTree_);
+  priorityTree_ = &tree;
+  priorityTreeHandle_ = tree.addTransaction(id_, pri, this);
+  if (isEnqueued()) {
+    tree.signalPendingEgress(priorityTreeHandle_);
+  }
+}
+
+void HTTPTransaction::updatePriority(const http2::PriorityUpdate& pri) {
+  if (priorityTree_) {
+    priorityTreeHandle_ = priorityTree_->updatePriority(priorityTreeHandle_,
+                                                        pri);
+  }
 }
 
 void HTTPTransaction::onIngressHeadersComplete(
@@ -97,6 +147,14 @@ void HTTPTransaction::onIngressHeadersComplete(
   if (transportCallback_) {
     transportCallback_->headerBytesReceived(msg->getIngressHeaderSize());
   }
+  if (trace_) {
+    trace_->ingressHeadersTime = getCurrentTime();
+    auto start = msg->getStartTime();
+    traceStep(TraceEventType::ReadSocket,
+              std::min(start, trace_->ingressHeadersTime),
+              TraceFieldType::ReadBytes,
+              msg->getIngressHeaderSize().compressed);
+  }
   if (isUpstream() && !isPushed()) {
     lastResponseStatus_ = msg->getStatusCode();
   }
@@ -105,9 +163,8 @@ void HTTPTransaction::onIngressHeadersComplete(
     return;
   }
   if (mustQueueIngress()) {
-    checkCreateDeferredIngress();
-    deferredIngress_->emplace(id_, HTTPEvent::Type::HEADERS_COMPLETE,
-                             std::move(msg));
+    deferredIngress_.emplace(id_, HTTPEvent::Type::HEADERS_COMPLETE,
+                            std::move(msg));
     VLOG(4) << *this << " Queued ingress event of type " <<
       HTTPEvent::Type::HEADERS_COMPLETE;
   } else {
@@ -118,10 +175,15 @@ void HTTPTransaction::onIngressHeadersComplete(
 void HTTPTransaction::processIngressHeadersComplete(
     std::unique_ptr<HTTPMessage> msg) {
   CallbackGuard guard(*this);
+  AllocStatsScope allocScope(allocCounts_);
   if (aborted_) {
     return;
   }
   refreshTimeout();
+  if (trace_ && timePointInitialized(trace_->ingressHeadersTime)) {
+    traceStep(TraceEventType::Scheduling, trace_->ingressHeadersTime,
+              TraceFieldType::SizeOfQueue, deferredIngress_.size());
+  }
   if (handler_ && !isIngressComplete()) {
     handler_->onHeadersComplete(std::move(msg));
   }
@@ -144,6 +206,12 @@ void HTTPTransaction::onIngressBody(unique_ptr<IOBuf> chain,
         HTTPTransactionIngressSM::Event::onBody)) {
     return;
   }
+  if (useFlowControl_ && stats_ &&
+      int64_t(recvWindow_.getOutstanding()) + recvToAck_ + int64_t(len) +
+      padding >= int64_t(recvWindow_.getCapacity())) {
+    // The peer has no window left until it hears from us
+    stats_->recordTransactionReceiveWindowFull();
+  }
   if (mustQueueIngress()) {
     // register the bytes in the receive window
     if (!recvWindow_.reserve(len + padding, useFlowControl_)) {
@@ -151,9 +219,8 @@ void HTTPTransaction::onIngressBody(unique_ptr<IOBuf> chain,
     } else {
       CHECK(recvWindow_.free(padding));
       recvToAck_ += padding;
-      checkCreateDeferredIngress();
-      deferredIngress_->emplace(id_, HTTPEvent::Type::BODY,
-                               std::move(chain));
+      deferredIngress_.emplace(id_, HTTPEvent::Type::BODY,
+                              std::move(chain));
       VLOG(4) << *this << " Queued ingress event of type " <<
         HTTPEvent::Type::BODY << " size=" << len;
     }
@@ -164,13 +231,22 @@ void HTTPTransaction::onIngressBody(unique_ptr<IOBuf> chain,
 
 void HTTPTransaction::processIngressBody(unique_ptr<IOBuf> chain, size_t len) {
   CallbackGuard guard(*this);
+  AllocStatsScope allocScope(allocCounts_);
   if (aborted_) {
     return;
   }
   refreshTimeout();
   transport_.notifyIngressBodyProcessed(len);
-  if (handler_) {
-    if (!isIngressComplete()) {
+  if (spliceEgress_ && !spliceEgress_->canSpliceBody()) {
+    VLOG(4) << *this << " can't forward body to " << *spliceEgress_;
+    spliceIngressBody(nullptr);
+  }
+  if (handler_ || spliceEgress_) {
+    if (isIngressComplete()) {
+      // Nothing to deliver
+    } else if (spliceEgress_) {
+      spliceEgress_->sendBody(std::move(chain));
+    } else {
       handler_->onBody(std::move(chain));
     }
 
@@ -184,6 +260,7 @@ void HTTPTransaction::processIngressBody(unique_ptr<IOBuf> chain, size_t len) {
           divisor = 1;
         }
         if (uint32_t(recvToAck_) >= (recvWindow_.getCapacity() / divisor)) {
+          maybeGrowReceiveWindow();
           flushWindowUpdate();
         }
       }
@@ -197,8 +274,7 @@ void HTTPTransaction::onIngressChunkHeader(size_t length) {
     return;
   }
   if (mustQueueIngress()) {
-    checkCreateDeferredIngress();
-    deferredIngress_->emplace(id_, HTTPEvent::Type::CHUNK_HEADER, length);
+    deferredIngress_.emplace(id_, HTTPEvent::Type::CHUNK_HEADER, length);
     VLOG(4) << *this << " Queued ingress event of type " <<
       HTTPEvent::Type::CHUNK_HEADER << " size=" << length;
   } else {
@@ -212,7 +288,7 @@ void HTTPTransaction::processIngressChunkHeader(size_t length) {
     return;
   }
   refreshTimeout();
-  if (handler_ && !isIngressComplete()) {
+  if (handler_ && !isIngressComplete() && !spliceEgress_) {
     handler_->onChunkHeader(length);
   }
 }
@@ -223,8 +299,7 @@ void HTTPTransaction::onIngressChunkComplete() {
     return;
   }
   if (mustQueueIngress()) {
-    checkCreateDeferredIngress();
-    deferredIngress_->emplace(id_, HTTPEvent::Type::CHUNK_COMPLETE);
+    deferredIngress_.emplace(id_, HTTPEvent::Type::CHUNK_COMPLETE);
     VLOG(4) << *this << " Queued ingress event of type " <<
       HTTPEvent::Type::CHUNK_COMPLETE;
   } else {
@@ -238,7 +313,7 @@ void HTTPTransaction::processIngressChunkComplete() {
     return;
   }
   refreshTimeout();
-  if (handler_ && !isIngressComplete()) {
+  if (handler_ && !isIngressComplete() && !spliceEgress_) {
     handler_->onChunkComplete();
   }
 }
@@ -249,8 +324,7 @@ void HTTPTransaction::onIngressTrailers(unique_ptr<HTTPHeaders> trailers) {
     return;
   }
   if (mustQueueIngress()) {
-    checkCreateDeferredIngress();
-    deferredIngress_->emplace(id_, HTTPEvent::Type::TRAILERS_COMPLETE,
+    deferredIngress_.emplace(id_, HTTPEvent::Type::TRAILERS_COMPLETE,
         std::move(trailers));
     VLOG(4) << *this << " Queued ingress event of type " <<
       HTTPEvent::Type::TRAILERS_COMPLETE;
@@ -276,8 +350,7 @@ void HTTPTransaction::onIngressUpgrade(UpgradeProtocol protocol) {
     return;
   }
   if (mustQueueIngress()) {
-    checkCreateDeferredIngress();
-    deferredIngress_->emplace(id_, HTTPEvent::Type::UPGRADE, protocol);
+    deferredIngress_.emplace(id_, HTTPEvent::Type::UPGRADE, protocol);
     VLOG(4) << *this << " Queued ingress event of type " <<
       HTTPEvent::Type::UPGRADE;
   } else {
@@ -312,8 +385,7 @@ void HTTPTransaction::onIngressEOM() {
     return;
   }
   if (mustQueueIngress()) {
-    checkCreateDeferredIngress();
-    deferredIngress_->emplace(id_, HTTPEvent::Type::MESSAGE_COMPLETE);
+    deferredIngress_.emplace(id_, HTTPEvent::Type::MESSAGE_COMPLETE);
     VLOG(4) << *this << " Queued ingress event of type " <<
       HTTPEvent::Type::MESSAGE_COMPLETE;
   } else {
@@ -323,6 +395,7 @@ void HTTPTransaction::onIngressEOM() {
 
 void HTTPTransaction::processIngressEOM() {
   CallbackGuard guard(*this);
+  AllocStatsScope allocScope(allocCounts_);
   if (aborted_) {
     return;
   }
@@ -332,6 +405,14 @@ void HTTPTransaction::processIngressEOM() {
         HTTPTransactionIngressSM::Event::eomFlushed)) {
     return;
   }
+  if (spliceEgress_) {
+    auto egressTxn = spliceEgress_;
+    spliceIngressBody(nullptr);
+    if (!wasComplete && HTTPTransactionEgressSM::canTransit(
+          egressTxn->egressState_, HTTPTransactionEgressSM::Event::sendEOM)) {
+      egressTxn->sendEOM();
+    }
+  }
   if (handler_) {
     if (!wasComplete) {
       handler_->onEOM();
@@ -345,7 +426,7 @@ void HTTPTransaction::processIngressEOM() {
 bool HTTPTransaction::isExpectingIngress() const {
   return (!ingressPaused_ &&
           (!isIngressEOMSeen() ||
-           (useFlowControl_ && sendWindow_.getSize() <= 0)));
+           (useFlowControl_ && getSendWindowSize() <= 0)));
 }
 
 void HTTPTransaction::updateReadTimeout() {
@@ -359,8 +440,13 @@ void HTTPTransaction::updateReadTimeout() {
 void HTTPTransaction::markIngressComplete() {
   VLOG(4) << "Marking ingress complete on " << *this;
   ingressState_ = HTTPTransactionIngressSM::State::ReceivingDone;
-  deferredIngress_.reset();
+  deferredIngress_.clear();
   cancelTimeout();
+  if (spliceEgress_) {
+    spliceEgress_->spliceIngress_ = nullptr;
+    spliceEgress_ = nullptr;
+    splicePausedIngress_ = false;
+  }
 }
 
 void HTTPTransaction::markEgressComplete() {
@@ -369,10 +455,15 @@ void HTTPTransaction::markEgressComplete() {
     transport_.notifyEgressBodyBuffered(-deferredEgressBody_.chainLength());
   }
   deferredEgressBody_.move();
+  closeFileBodies();
   if (isEnqueued()) {
     dequeue();
   }
   egressState_ = HTTPTransactionEgressSM::State::SendingDone;
+  if (spliceIngress_) {
+    // The rest of its body goes to its handler again
+    spliceIngress_->spliceIngressBody(nullptr);
+  }
 }
 
 bool HTTPTransaction::validateIngressStateTransition(
@@ -396,6 +487,7 @@ bool HTTPTransaction::validateIngressStateTransition(
 
 void HTTPTransaction::onError(const HTTPException& error) {
   CallbackGuard guard(*this);
+  AllocStatsScope allocScope(allocCounts_);
 
   const bool wasAborted = aborted_; // see comment below
   const bool wasEgressComplete = isEgressComplete();
@@ -461,7 +553,7 @@ void HTTPTransaction::onIngressTimeout() {
   VLOG(4) << "ingress timeout on " << *this;
   pauseIngress();
   bool windowUpdateTimeout = !isEgressComplete() &&
-    useFlowControl_ && sendWindow_.getSize() <= 0;
+    useFlowControl_ && getSendWindowSize() <= 0;
   if (handler_) {
     if (windowUpdateTimeout) {
       HTTPException ex(HTTPException::Direction::INGRESS_AND_EGRESS,
@@ -489,7 +581,7 @@ void HTTPTransaction::onIngressWindowUpdate(const uint32_t amount) {
   CallbackGuard guard(*this);
   VLOG(4) << *this << " Remote side ack'd " << amount << " bytes";
   updateReadTimeout();
-  if (sendWindow_.free(amount)) {
+  if (syncSendWindow() && sendWindow_.free(amount)) {
     notifyTransportPendingEgress();
   } else {
     sendAbort(ErrorCode::FLOW_CONTROL_ERROR);
@@ -508,6 +600,26 @@ void HTTPTransaction::onIngressSetSendWindow(const uint32_t newWindowSize) {
   }
 }
 
+void HTTPTransaction::setInitialSendWindow(InitialSendWindow* window) {
+  sendWindowPausedHook_.unlink();
+  initialSendWindow_ = window;
+}
+
+int32_t HTTPTransaction::getSendWindowSize() const {
+  if (!initialSendWindow_) {
+    return sendWindow_.getSize();
+  }
+  int64_t size = int64_t(sendWindow_.getSize()) + initialSendWindow_->size -
+    sendWindow_.getCapacity();
+  return std::min<int64_t>(size, std::numeric_limits<int32_t>::max());
+}
+
+bool HTTPTransaction::syncSendWindow() {
+  return !initialSendWindow_ ||
+    initialSendWindow_->size == sendWindow_.getCapacity() ||
+    sendWindow_.setCapacity(initialSendWindow_->size);
+}
+
 void HTTPTransaction::onEgressTimeout() {
   CallbackGuard guard(*this);
   VLOG(4) << "egress timeout on " << *this;
@@ -526,6 +638,10 @@ void HTTPTransaction::onEgressHeaderFirstByte() {
   if (transportCallback_) {
     transportCallback_->firstHeaderByteFlushed();
   }
+  if (trace_ && timePointInitialized(trace_->egressHeadersTime)) {
+    traceStep(TraceEventType::WriteSocket, trace_->egressHeadersTime,
+              TraceFieldType::WriteBytes, trace_->egressHeaderBytes);
+  }
 }
 
 void HTTPTransaction::onEgressBodyFirstByte() {
@@ -540,6 +656,10 @@ void HTTPTransaction::onEgressBodyLastByte() {
   if (transportCallback_) {
     transportCallback_->lastByteFlushed();
   }
+  if (trace_) {
+    trace_->lastByteTime = getCurrentTime();
+    traceTCPInfo();
+  }
 }
 
 void HTTPTransaction::onEgressLastByteAck(std::chrono::milliseconds latency) {
@@ -547,26 +667,156 @@ void HTTPTransaction::onEgressLastByteAck(std::chrono::milliseconds latency) {
   if (transportCallback_) {
     transportCallback_->lastByteAcked(latency);
   }
+  if (trace_ && timePointInitialized(trace_->lastByteTime)) {
+    traceStep(TraceEventType::LastByteAck, trace_->lastByteTime,
+              TraceFieldType::AckLatency, latency.count());
+    traceTCPInfo();
+  }
+}
+
+void HTTPTransaction::setTraceEventContext(const TraceEventContext& context,
+                                           bool sampleTCPInfo) {
+  trace_ = folly::make_unique<TraceState>(context, sampleTCPInfo);
+}
+
+void HTTPTransaction::traceStep(TraceEventType type, TimePoint start,
+                                TraceFieldType field, int64_t value) {
+  TraceEvent event(type, trace_->context.parentID);
+  event.start(start);
+  event.end(getCurrentTime());
+  event.addMeta(TraceFieldType::StreamID, id_);
+  event.addMeta(field, value);
+  trace_->context.traceEventAvailable(std::move(event));
+}
+
+void HTTPTransaction::traceTCPInfo() {
+#if defined(__linux__)
+  if (!trace_->sampleTCPInfo) {
+    return;
+  }
+  folly::TransportInfo tinfo;
+  if (!transport_.getCurrentTransportInfo(&tinfo)) {
+    return;
+  }
+  const auto& info = tinfo.tcpinfo;
+  TraceEvent event(TraceEventType::TCPInfo, trace_->context.parentID);
+  auto now = getCurrentTime();
+  event.start(now);
+  event.end(now);
+  event.addMeta(TraceFieldType::StreamID, id_);
+  event.addMeta(TraceFieldType::RTT, info.tcpi_rtt);
+  event.addMeta(TraceFieldType::RTTVar, info.tcpi_rttvar);
+  event.addMeta(TraceFieldType::Cwnd, info.tcpi_snd_cwnd);
+  event.addMeta(TraceFieldType::CwndBytes,
+                uint64_t(info.tcpi_snd_cwnd) * info.tcpi_snd_mss);
+  event.addMeta(TraceFieldType::TotalRetx, info.tcpi_total_retrans);
+  event.addMeta(TraceFieldType::PacketLoss, info.tcpi_lost);
+  trace_->context.traceEventAvailable(std::move(event));
+#endif
 }
 
 void HTTPTransaction::sendHeaders(const HTTPMessage& headers) {
+  sendHeadersWithOptionalEOM(headers, false);
+}
+
+void HTTPTransaction::sendHeadersWithEOM(const HTTPMessage& headers) {
+  CallbackGuard guard(*this);
+  if (trailers_) {
+    // They go between the two
+    sendHeaders(headers);
+    sendEOM();
+    return;
+  }
+  sendHeadersWithOptionalEOM(headers, true);
+}
+
+void HTTPTransaction::sendHeadersWithBodyAndEOM(
+    const HTTPMessage& headers,
+    std::unique_ptr<folly::IOBuf> body) {
+  CallbackGuard guard(*this);
+  const size_t bodyLen = body ? body->computeChainDataLength() : 0;
+  if (bodyLen == 0) {
+    sendHeadersWithEOM(headers);
+    return;
+  }
+  if (trailers_ || headers.getIsChunked() || egressRateBytesPerSec_ > 0 ||
+      (useFlowControl_ && sendWindow_.getNonNegativeSize() < bodyLen) ||
+      !transport_.canSendHeadersWithBody(bodyLen)) {
+    sendHeaders(headers);
+    sendBody(std::move(body));
+    sendEOM();
+    return;
+  }
+  sendHeadersWithOptionalEOM(headers, true, std::move(body));
+}
+
+void HTTPTransaction::sendHeadersWithOptionalEOM(
+    const HTTPMessage& headers,
+    bool eom,
+    std::unique_ptr<folly::IOBuf> body) {
+  AllocStatsScope allocScope(allocCounts_);
   CHECK(HTTPTransactionEgressSM::transit(
           egressState_, HTTPTransactionEgressSM::Event::sendHeaders));
   DCHECK(!isEgressComplete());
+  const size_t bodyLen = body ? body->computeChainDataLength() : 0;
+  if (body) {
+    DCHECK(eom);
+    CHECK(HTTPTransactionEgressSM::transit(
+            egressState_, HTTPTransactionEgressSM::Event::sendBody));
+    if (useFlowControl_) {
+      CHECK(sendWindow_.reserve(bodyLen));
+    }
+  }
+  if (eom) {
+    DCHECK(!isEnqueued());
+    CHECK(HTTPTransactionEgressSM::transit(
+            egressState_, HTTPTransactionEgressSM::Event::sendEOM));
+    CHECK(HTTPTransactionEgressSM::transit(
+            egressState_, HTTPTransactionEgressSM::Event::eomFlushed));
+  }
   if (isDownstream() && !isPushed()) {
     lastResponseStatus_ = headers.getStatusCode();
   }
+  if (isUpstream()) {
+    auto method = headers.getMethod();
+    safeRequest_ = method && isSafeMethod(*method);
+  }
+  if (trace_ && !timePointInitialized(trace_->egressHeadersTime)) {
+    trace_->egressHeadersTime = getCurrentTime();
+  }
+  if (stats_ && !firstHeadersTimed_) {
+    firstHeadersTimed_ = true;
+    stats_->recordTimeToFirstByte(millisecondsSince(startTime_));
+  }
   HTTPHeaderSize size;
-  transport_.sendHeaders(this, headers, &size);
+  size_t nbytes = 0;
+  if (body) {
+    updateReadTimeout();
+    nbytes = transport_.sendHeadersWithBodyAndEOM(this, headers, &size,
+                                                  std::move(body));
+  } else if (eom) {
+    transport_.sendHeadersWithEOM(this, headers, &size);
+  } else {
+    transport_.sendHeaders(this, headers, &size);
+  }
   if (transportCallback_) {
     transportCallback_->headerBytesGenerated(size);
+    if (bodyLen > 0) {
+      transportCallback_->bodyBytesGenerated(nbytes);
+    }
+  }
+  if (trace_) {
+    trace_->egressHeaderBytes += size.compressed;
   }
   flushWindowUpdate();
 }
 
 void HTTPTransaction::sendBody(std::unique_ptr<folly::IOBuf> body) {
+  AllocStatsScope allocScope(allocCounts_);
   CHECK(HTTPTransactionEgressSM::transit(
       egressState_, HTTPTransactionEgressSM::Event::sendBody));
+  // The body goes after the files sent before it
+  mapFileBodies(true);
   if (body && isEnqueued()) {
     size_t bodyLen = body->computeChainDataLength();
     transport_.notifyEgressBodyBuffered(bodyLen);
@@ -575,9 +825,77 @@ void HTTPTransaction::sendBody(std::unique_ptr<folly::IOBuf> body) {
   notifyTransportPendingEgress();
 }
 
+bool HTTPTransaction::sendFile(int fd, off_t offset, size_t length) {
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || offset < 0 ||
+      uint64_t(st.st_size) < uint64_t(offset) + length) {
+    VLOG(2) << "Can't send " << length << " bytes at " << offset
+            << " of fd " << fd << " on " << *this;
+    return false;
+  }
+  int dupFd = length > 0 ? dup(fd) : -1;
+  if (length > 0 && dupFd < 0) {
+    LOG(ERROR) << "Failed to dup file body: " << folly::errnoStr(errno)
+               << " on " << *this;
+    return false;
+  }
+  CHECK(HTTPTransactionEgressSM::transit(
+      egressState_, HTTPTransactionEgressSM::Event::sendBody));
+  if (length > 0) {
+    fileBodies_.push_back(FileBody{dupFd, offset, length});
+    mapFileBodies(false);
+    notifyTransportPendingEgress();
+  }
+  return true;
+}
+
+void HTTPTransaction::mapFileBodies(bool all) {
+  while (!fileBodies_.empty() &&
+         (all || deferredEgressBody_.chainLength() < kFileBodyWindow)) {
+    auto& file = fileBodies_.front();
+    size_t length = all ? file.length :
+      std::min<size_t>(file.length, kFileBodyWindow);
+    auto body = mapFileRange(file.fd, file.offset, length);
+    if (!body) {
+      LOG(ERROR) << "Failed to map file body: " << folly::errnoStr(errno)
+                 << " on " << *this;
+      closeFileBodies();
+      sendAbort();
+      return;
+    }
+    file.offset += length;
+    file.length -= length;
+    if (file.length == 0) {
+      folly::closeNoInt(file.fd);
+      fileBodies_.pop_front();
+    }
+    if (isEnqueued()) {
+      transport_.notifyEgressBodyBuffered(length);
+    }
+    deferredEgressBody_.append(std::move(body));
+  }
+}
+
+void HTTPTransaction::closeFileBodies() {
+  for (auto& file: fileBodies_) {
+    folly::closeNoInt(file.fd);
+  }
+  fileBodies_.clear();
+}
+
 bool HTTPTransaction::onWriteReady(const uint32_t maxEgress) {
   CallbackGuard guard(*this);
+  AllocStatsScope allocScope(allocCounts_);
   DCHECK(isEnqueued());
+  if (useFlowControl_ && !syncSendWindow()) {
+    sendAbort(ErrorCode::FLOW_CONTROL_ERROR);
+    return isEnqueued();
+  }
+  if (useFlowControl_ && sendWindow_.getSize() <= 0) {
+    // The initial send window shrank since this was enqueued
+    notifyTransportPendingEgress();
+    return isEnqueued();
+  }
   sendDeferredBody(maxEgress);
   if (isEnqueued()) {
     // Within a given band there are two tiers of priority
@@ -610,7 +928,7 @@ size_t HTTPTransaction::sendDeferredBody(const uint32_t maxEgress) {
 
   size_t canSend = std::min<size_t>(sendWindow, bytesLeft);
 
-  if (maybeDelayForRateLimit()) {
+  if (maybeDelayForRateLimit(&canSend)) {
     // Timeout will call notifyTransportPendingEgress again
     return 0;
   }
@@ -635,6 +953,17 @@ size_t HTTPTransaction::sendDeferredBody(const uint32_t maxEgress) {
   } else {
     // This body is expliticly chunked
     while (!chunkHeaders_.empty() && canSend > 0) {
+      if (!chunkHeaders_.front().headerSent) {
+        // The chunks whose bodies are all buffered already go out as one,
+        // to save on framing
+        while (chunkHeaders_.size() > 1 &&
+               chunkHeaders_[0].length + chunkHeaders_[1].length <=
+               deferredEgressBody_.chainLength()) {
+          size_t length = chunkHeaders_.front().length;
+          chunkHeaders_.pop_front();
+          chunkHeaders_.front().length += length;
+        }
+      }
       Chunk& chunk = chunkHeaders_.front();
       if (!chunk.headerSent) {
         nbytes += transport_.sendChunkHeader(this, chunk.length);
@@ -660,6 +989,16 @@ size_t HTTPTransaction::sendDeferredBody(const uint32_t maxEgress) {
     nbytes += sendEOMNow();
   }
 
+  // Charge what we sent against the round robin credit
+  const size_t bodyBytesSent = bytesLeft - deferredEgressBody_.chainLength();
+  egressDeficit_ -= std::min<size_t>(egressDeficit_, bodyBytesSent);
+  if (priorityTree_) {
+    priorityTree_->consumed(priorityTreeHandle_, bodyBytesSent);
+  }
+
+  // Map the next window of any file body before the one sent runs out
+  mapFileBodies(false);
+
   // Update the handler's pause state
   notifyTransportPendingEgress();
 
@@ -669,38 +1008,25 @@ size_t HTTPTransaction::sendDeferredBody(const uint32_t maxEgress) {
   return nbytes;
 }
 
-bool HTTPTransaction::maybeDelayForRateLimit() {
-  if (egressLimitBytesPerMs_ <= 0) {
-    // No rate limiting
+bool HTTPTransaction::maybeDelayForRateLimit(size_t* canSend) {
+  if (egressRateBytesPerSec_ == 0 || *canSend == 0 ||
+      !transactionIdleTimeouts_) {
+    // No rate limiting, or only an EOM to send
     return false;
   }
 
-  if (numLimitedBytesEgressed_ == 0) {
-    // If we haven't egressed any bytes yet, don't delay.
-    return false;
-  }
-
-  int64_t limitedDurationMs = (int64_t) millisecondsBetween(
-    getCurrentTime(),
-    startRateLimit_
-  ).count();
-
-  // Algebra!  Try to figure out the next time send where we'll
-  // be allowed to send at least 1 full packet's worth.  The
-  // formula we're using is:
-  //   (bytesSoFar + packetSize) / (timeSoFar + delay) == targetRateLimit
-  int64_t requiredDelayMs = (
-    (
-     ((int64_t)numLimitedBytesEgressed_ + kApproximateMTU) -
-     ((int64_t)egressLimitBytesPerMs_ * limitedDurationMs)
-    ) / (int64_t)egressLimitBytesPerMs_
-  );
-
-  if (requiredDelayMs <= 0) {
-    // No delay required
+  refillEgressTokens();
+  // Send a packet's worth at a time at least, rather than waking up for
+  // every few bytes
+  size_t wanted = std::min<size_t>(
+    {*canSend, size_t(kApproximateMTU), size_t(egressBurstBytes_)});
+  if (egressTokens_ >= wanted) {
+    *canSend = std::min<size_t>(*canSend, size_t(egressTokens_));
     return false;
   }
 
+  int64_t requiredDelayMs = int64_t(std::ceil(
+    (wanted - egressTokens_) * 1000 / egressRateBytesPerSec_));
   if (requiredDelayMs > kRateLimitMaxDelayMs) {
     // The delay should never be this long
     VLOG(4) << "ratelim: Required delay too long (" << requiredDelayMs
@@ -708,26 +1034,30 @@ bool HTTPTransaction::maybeDelayForRateLimit() {
     return false;
   }
 
-  // Delay required
-
+  // Wait for the tokens on the session's timers; notifyTransportPendingEgress
+  // takes us out of the egress queue meanwhile
   egressRateLimited_ = true;
+  transactionIdleTimeouts_->scheduleTimeout(
+    &pacingTimeout_,
+    std::chrono::milliseconds(std::max<int64_t>(requiredDelayMs, 1)));
+  notifyTransportPendingEgress();
+  return true;
+}
 
-  // Make a reference first so we only end up making one copy of the ptr
-  std::shared_ptr<bool> &cancelled = cancelled_;
-
-  folly::EventBaseManager::get()->getEventBase()->runAfterDelay(
-    [this, cancelled]() {
-      if (*cancelled) {
-        return;
-      }
-      egressRateLimited_ = false;
-      notifyTransportPendingEgress();
-    },
-    requiredDelayMs
-  );
+void HTTPTransaction::refillEgressTokens() {
+  auto now = getCurrentTime();
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+    now - lastEgressTokenRefill_);
+  lastEgressTokenRefill_ = now;
+  egressTokens_ = std::min<double>(
+    egressBurstBytes_,
+    egressTokens_ + elapsed.count() * egressRateBytesPerSec_ / 1000000.0);
+}
 
+void HTTPTransaction::onPacingTimeout() {
+  CallbackGuard guard(*this);
+  egressRateLimited_ = false;
   notifyTransportPendingEgress();
-  return true;
 }
 
 size_t HTTPTransaction::sendEOMNow() {
@@ -766,8 +1096,9 @@ size_t HTTPTransaction::sendBodyNow(std::unique_ptr<folly::IOBuf> body,
   }
   updateReadTimeout();
   nbytes = transport_.sendBody(this, std::move(body), sendEom);
-  if (egressLimitBytesPerMs_ > 0) {
-    numLimitedBytesEgressed_ += nbytes;
+  if (egressRateBytesPerSec_ > 0) {
+    // Framing too takes up the link, so may leave the bucket in debt
+    egressTokens_ -= nbytes;
   }
   return nbytes;
 }
@@ -775,10 +1106,12 @@ size_t HTTPTransaction::sendBodyNow(std::unique_ptr<folly::IOBuf> body,
 void
 HTTPTransaction::sendEOM() {
   CallbackGuard guard(*this);
+  AllocStatsScope allocScope(allocCounts_);
   CHECK(HTTPTransactionEgressSM::transit(
       egressState_, HTTPTransactionEgressSM::Event::sendEOM))
     << ", " << *this;
-  if (deferredEgressBody_.chainLength() == 0 && chunkHeaders_.empty()) {
+  if (deferredEgressBody_.chainLength() == 0 && chunkHeaders_.empty() &&
+      fileBodies_.empty()) {
     // there is nothing left to send, egress the EOM directly.  For SPDY
     // this will jump the txn queue
     if (!isEnqueued()) {
@@ -874,6 +1207,7 @@ void HTTPTransaction::pauseIngress() {
 void HTTPTransaction::resumeIngress() {
   VLOG(4) << *this << " resumeIngress request";
   CallbackGuard guard(*this);
+  AllocStatsScope allocScope(allocCounts_);
   if (!ingressPaused_ || isIngressComplete()) {
     VLOG(4) << *this << " can't resume ingress; ingressPaused="
             << ingressPaused_ << ", ingressComplete="
@@ -882,22 +1216,52 @@ void HTTPTransaction::resumeIngress() {
   }
   ingressPaused_ = false;
   transport_.resumeIngress(this);
+  processDeferredIngress();
+}
+
+HTTPMessage* HTTPTransaction::getQueuedHeaders() {
+  if (deferredIngress_.empty() ||
+      deferredIngress_.front().getEvent() !=
+      HTTPEvent::Type::HEADERS_COMPLETE) {
+    return nullptr;
+  }
+  return deferredIngress_.front().peekHeaders();
+}
+
+void HTTPTransaction::dispatchQueuedIngress() {
+  CallbackGuard guard(*this);
+  AllocStatsScope allocScope(allocCounts_);
+  DCHECK(handlerPending_);
+  handlerPending_ = false;
+  if (!ingressPaused_) {
+    processDeferredIngress();
+  }
+}
+
+void HTTPTransaction::processDeferredIngress() {
+  if (handlerPending_) {
+    // Stays queued for the handler being set up
+    return;
+  }
   if (inResume_) {
     VLOG(4) << *this << " skipping recursive resume loop";
     return;
   }
   inResume_ = true;
 
-  if (deferredIngress_ && (maxDeferredIngress_ <= deferredIngress_->size())) {
-    maxDeferredIngress_ = deferredIngress_->size();
+  if (maxDeferredIngress_ <= deferredIngress_.size()) {
+    maxDeferredIngress_ = deferredIngress_.size();
   }
 
   // Process any deferred ingress callbacks
   // Note: we recheck the ingressPaused_ state because a callback
   // invoked by the resumeIngress() call above could have re-paused
   // the transaction.
-  while (!ingressPaused_ && deferredIngress_ && !deferredIngress_->empty()) {
-    HTTPEvent& callback(deferredIngress_->front());
+  while (!ingressPaused_ && !deferredIngress_.empty()) {
+    // Moved out, as the callback may queue more events, which could move
+    // the queue's storage. It stays queued until processed, so that these
+    // events go after it.
+    HTTPEvent callback(std::move(deferredIngress_.front()));
     VLOG(5) << *this << " Processing deferred ingress callback of type " <<
       callback.getEvent();
     switch (callback.getEvent()) {
@@ -929,8 +1293,8 @@ void HTTPTransaction::resumeIngress() {
         processIngressUpgrade(callback.getUpgradeProtocol());
         break;
     }
-    if (deferredIngress_) {
-      deferredIngress_->pop();
+    if (!deferredIngress_.empty()) {
+      deferredIngress_.pop();
     }
   }
   updateReadTimeout();
@@ -959,20 +1323,67 @@ void HTTPTransaction::resumeEgress() {
   notifyTransportPendingEgress();
 }
 
-void HTTPTransaction::setEgressRateLimit(uint64_t bitsPerSecond) {
-  egressLimitBytesPerMs_ = bitsPerSecond / 8000;
-  if (bitsPerSecond > 0 && egressLimitBytesPerMs_ == 0) {
-    VLOG(4) << "ratelim: Limit too low (" << bitsPerSecond << "), ignoring";
+void HTTPTransaction::spliceIngressBody(HTTPTransaction* egressTxn) {
+  CallbackGuard guard(*this);
+  if (spliceEgress_) {
+    VLOG(4) << *this << " stops forwarding body to " << *spliceEgress_;
+    spliceEgress_->spliceIngress_ = nullptr;
+    spliceEgress_ = nullptr;
+    setSplicePaused(false);
+  }
+  if (!egressTxn || isIngressComplete()) {
+    return;
+  }
+  if (egressTxn->spliceIngress_) {
+    egressTxn->spliceIngress_->spliceIngressBody(nullptr);
+  }
+  VLOG(4) << *this << " forwards body to " << *egressTxn;
+  spliceEgress_ = egressTxn;
+  egressTxn->spliceIngress_ = this;
+  egressTxn->updateHandlerPauseState();
+}
+
+bool HTTPTransaction::canSpliceBody() const {
+  return !aborted_ && HTTPTransactionEgressSM::canTransit(
+    egressState_, HTTPTransactionEgressSM::Event::sendBody);
+}
+
+void HTTPTransaction::setSplicePaused(bool paused) {
+  if (paused == splicePausedIngress_) {
+    return;
+  }
+  splicePausedIngress_ = paused;
+  if (paused) {
+    pauseIngress();
+  } else {
+    resumeIngress();
+  }
+}
+
+void HTTPTransaction::setEgressRateLimit(uint64_t bitsPerSecond,
+                                         uint32_t burstBytes) {
+  egressRateBytesPerSec_ = bitsPerSecond / 8;
+  if (burstBytes == 0) {
+    burstBytes = std::max<uint64_t>(
+      egressRateBytesPerSec_ * kRateLimitDefaultBurstMs / 1000,
+      4 * kApproximateMTU);
+  }
+  egressBurstBytes_ = burstBytes;
+  egressTokens_ = burstBytes;
+  lastEgressTokenRefill_ = getCurrentTime();
+  if (egressRateBytesPerSec_ == 0) {
+    pacingTimeout_.cancelTimeout();
+    if (egressRateLimited_) {
+      onPacingTimeout();
+    }
   }
-  startRateLimit_ = getCurrentTime();
-  numLimitedBytesEgressed_ = 0;
 }
 
 void HTTPTransaction::notifyTransportPendingEgress() {
   if (!egressRateLimited_ &&
       (deferredEgressBody_.chainLength() > 0 ||
        isEgressEOMQueued()) &&
-      (!useFlowControl_ || sendWindow_.getSize() > 0)) {
+      (!useFlowControl_ || getSendWindowSize() > 0)) {
     // Egress isn't paused, we have something to send, and flow
     // control isn't blocking us.
     if (!isEnqueued()) {
@@ -983,6 +1394,9 @@ void HTTPTransaction::notifyTransportPendingEgress() {
       priority_ &= ~(0x01);
       queueHandle_ = egressQueue_.push(this);
       enqueued_ = true;
+      if (priorityTree_) {
+        priorityTree_->signalPendingEgress(priorityTreeHandle_);
+      }
       transport_.notifyPendingEgress();
       transport_.notifyEgressBodyBuffered(deferredEgressBody_.chainLength());
     }
@@ -996,10 +1410,20 @@ void HTTPTransaction::notifyTransportPendingEgress() {
 
 void HTTPTransaction::updateHandlerPauseState() {
   int64_t availWindow =
-    sendWindow_.getSize() - deferredEgressBody_.chainLength();
+    getSendWindowSize() - deferredEgressBody_.chainLength();
   bool flowControlPaused = useFlowControl_ && availWindow <= 0;
+  if (initialSendWindow_ &&
+      flowControlPaused != sendWindowPausedHook_.is_linked()) {
+    if (flowControlPaused) {
+      initialSendWindow_->paused.push_back(*this);
+    } else {
+      sendWindowPausedHook_.unlink();
+    }
+  }
+  uint64_t quota = transport_.getEgressBufferQuota(*this);
+  bool quotaPaused = quota > 0 && deferredEgressBody_.chainLength() >= quota;
   bool handlerShouldBePaused = egressPaused_ || flowControlPaused ||
-    egressRateLimited_;
+    egressRateLimited_ || quotaPaused;
   if (handler_ && handlerShouldBePaused != handlerEgressPaused_) {
     if (handlerShouldBePaused) {
       handlerEgressPaused_ = true;
@@ -1009,16 +1433,13 @@ void HTTPTransaction::updateHandlerPauseState() {
       handler_->onEgressResumed();
     }
   }
+  if (spliceIngress_) {
+    spliceIngress_->setSplicePaused(handlerShouldBePaused);
+  }
 }
 
 bool HTTPTransaction::mustQueueIngress() const {
-  return ingressPaused_ || (deferredIngress_ && !deferredIngress_->empty());
-}
-
-void HTTPTransaction::checkCreateDeferredIngress() {
-  if (!deferredIngress_) {
-    deferredIngress_ = folly::make_unique<std::queue<HTTPEvent>>();
-  }
+  return ingressPaused_ || handlerPending_ || !deferredIngress_.empty();
 }
 
 bool HTTPTransaction::onPushedTransaction(HTTPTransaction* pushTxn) {
@@ -1049,6 +1470,39 @@ void HTTPTransaction::setTransactionIdleTimeouts(
   }
 }
 
+void HTTPTransaction::setIngressTimeouts(AsyncTimeoutSet* headerTimeouts,
+                                         AsyncTimeoutSet* bodyTimeouts) {
+  headerTimeouts_ = headerTimeouts;
+  bodyTimeouts_ = bodyTimeouts;
+  if (isScheduled()) {
+    refreshTimeout();
+  }
+}
+
+void HTTPTransaction::detachTimeouts() {
+  timeoutDetached_ = isScheduled();
+  cancelTimeout();
+  // A paced transaction waits again once attached
+  pacingTimeout_.cancelTimeout();
+}
+
+void HTTPTransaction::attachTimeouts(AsyncTimeoutSet* transactionIdleTimeouts,
+                                     AsyncTimeoutSet* headerTimeouts,
+                                     AsyncTimeoutSet* bodyTimeouts) {
+  transactionIdleTimeouts_ = transactionIdleTimeouts;
+  headerTimeouts_ = headerTimeouts;
+  bodyTimeouts_ = bodyTimeouts;
+  if (timeoutDetached_) {
+    timeoutDetached_ = false;
+    refreshTimeout();
+  }
+  if (egressRateLimited_) {
+    // The tokens are refilled by time, so any short wait will do
+    transactionIdleTimeouts_->scheduleTimeout(&pacingTimeout_,
+                                              std::chrono::milliseconds(1));
+  }
+}
+
 void
 HTTPTransaction::describe(std::ostream& os) const {
   transport_.describe(os);
@@ -1091,6 +1545,30 @@ void HTTPTransaction::flushWindowUpdate() {
   }
 }
 
+void HTTPTransaction::maybeGrowReceiveWindow() {
+  auto capacity = recvWindow_.getCapacity();
+  if (maxRecvCapacity_ <= capacity) {
+    return;
+  }
+  auto rtt = transport_.getReceiveWindowTuningRTT();
+  auto now = getCurrentTime();
+  // Half the window went within two round trips of the previous update,
+  // so the peer likely had to wait for this one
+  if (rtt.count() > 0 && lastWindowUpdateTime_ != TimePoint() &&
+      now - lastWindowUpdateTime_ < 2 * rtt) {
+    uint32_t newCapacity = std::min<uint64_t>(maxRecvCapacity_,
+                                              uint64_t(capacity) * 2);
+    if (recvWindow_.setCapacity(newCapacity)) {
+      VLOG(4) << *this << " growing recv window to " << newCapacity;
+      recvToAck_ += newCapacity - capacity;
+      if (stats_) {
+        stats_->recordTransactionReceiveWindowGrown();
+      }
+    }
+  }
+  lastWindowUpdateTime_ = now;
+}
+
 std::ostream&
 operator<<(std::ostream& os, const HTTPTransaction& txn) {
   txn.describe(os);
@@ -9,8 +9,12 @@
  */
 #pragma once
 
+#include <algorithm>
 #include <boost/heap/d_ary_heap.hpp>
 #include <climits>
+#include <deque>
+#include <folly/Arena.h>
+#include <folly/IntrusiveList.h>
 #include <folly/SocketAddress.h>
 #include <folly/wangle/acceptor/TransportInfo.h>
 #include <ostream>
@@ -20,12 +24,17 @@
 #include <proxygen/lib/http/ProxygenErrorEnum.h>
 #include <proxygen/lib/http/Window.h>
 #include <proxygen/lib/http/codec/HTTPCodec.h>
+#include <proxygen/lib/http/session/HTTP2PriorityQueue.h>
 #include <proxygen/lib/http/session/HTTPEvent.h>
+#include <proxygen/lib/http/session/HTTPEventQueue.h>
 #include <proxygen/lib/http/session/HTTPTransactionEgressSM.h>
 #include <proxygen/lib/http/session/HTTPTransactionIngressSM.h>
+#include <proxygen/lib/utils/AllocStats.h>
 #include <proxygen/lib/utils/AsyncTimeoutSet.h>
 #include <proxygen/lib/utils/Time.h>
+#include <proxygen/lib/utils/TraceEventContext.h>
 #include <set>
+#include <vector>
 
 namespace proxygen {
 
@@ -85,6 +94,8 @@ namespace proxygen {
 
 class HTTPSessionStats;
 class HTTPTransaction;
+struct InitialSendWindow;
+class WorkerContext;
 class HTTPTransactionHandler {
  public:
 
@@ -270,6 +281,39 @@ class HTTPTransaction :
 
     virtual size_t sendEOM(HTTPTransaction* txn) noexcept = 0;
 
+    /**
+     * The headers of a message without a body, and its EOM. Transports
+     * that can frame both at once should override this.
+     */
+    virtual void sendHeadersWithEOM(HTTPTransaction* txn,
+                                    const HTTPMessage& headers,
+                                    HTTPHeaderSize* size) noexcept {
+      sendHeaders(txn, headers, size);
+      sendEOM(txn);
+    }
+
+    /**
+     * Whether sendHeadersWithBodyAndEOM() can take a body of bodyLen bytes
+     * right now, eg. the connection's send window has room for all of it.
+     * The transaction sends the parts separately when it can't.
+     */
+    virtual bool canSendHeadersWithBody(size_t /*bodyLen*/) const noexcept {
+      return false;
+    }
+
+    /**
+     * The headers, the whole fixed length body and the EOM of a message,
+     * framed at once. Returns the bytes the body was encoded into.
+     */
+    virtual size_t sendHeadersWithBodyAndEOM(
+        HTTPTransaction* txn,
+        const HTTPMessage& headers,
+        HTTPHeaderSize* size,
+        std::unique_ptr<folly::IOBuf> body) noexcept {
+      sendHeaders(txn, headers, size);
+      return sendBody(txn, std::move(body), true);
+    }
+
     virtual size_t sendAbort(HTTPTransaction* txn,
                              ErrorCode statusCode) noexcept = 0;
 
@@ -300,6 +344,20 @@ class HTTPTransaction :
 
     virtual bool isDraining() const = 0;
 
+    /**
+     * The round trip time to auto-tune receive windows by, or 0 if they
+     * should not grow now, eg. while sessions hold too much memory.
+     */
+    virtual std::chrono::microseconds getReceiveWindowTuningRTT()
+      const noexcept = 0;
+
+    /**
+     * The most body bytes txn may buffer before its handler is paused, or 0
+     * for no limit of its own.
+     */
+    virtual uint64_t getEgressBufferQuota(const HTTPTransaction& txn)
+      const noexcept = 0;
+
     virtual HTTPTransaction* newPushedTransaction(
       HTTPCodec::StreamID assocStreamId,
       HTTPTransaction::PushHandler* handler,
@@ -389,10 +447,65 @@ class HTTPTransaction :
     return handler_;
   }
 
+  /**
+   * Queue the ingress from the headers on until dispatchQueuedIngress(),
+   * while the handler is yet to be set. HTTPSession uses it to set up the
+   * handlers of all the requests parsed from one read together.
+   */
+  void queueIngressForHandler() {
+    DCHECK(!handler_);
+    handlerPending_ = true;
+  }
+
+  bool isIngressQueuedForHandler() const {
+    return handlerPending_;
+  }
+
+  /**
+   * The request queued since queueIngressForHandler(), for choosing the
+   * handler, or nullptr if an error has dropped it.
+   */
+  HTTPMessage* getQueuedHeaders();
+
+  /**
+   * Deliver the ingress queued since queueIngressForHandler() to the
+   * handler set since, unless ingress is paused.
+   */
+  void dispatchQueuedIngress();
+
   uint32_t getPriority() const {
     return priority_;
   }
 
+  static const uint32_t kDefaultEgressWeight = 16;
+
+  /**
+   * The RFC 7540 weight of this transaction, 1 to 256, from its node in the
+   * priority tree if it has one
+   */
+  uint32_t getEgressWeight() const {
+    return priorityTreeHandle_ ? priorityTreeHandle_->getWeight() + 1 :
+      kDefaultEgressWeight;
+  }
+
+  /**
+   * Schedule this transaction's egress through the given HTTP/2 priority
+   * tree, in addition to the session's egress queue. The transaction
+   * keeps the tree's pending egress state in sync and charges it for the
+   * body bytes it sends, and removes itself from the tree on destruction.
+   */
+  void setPriorityTree(HTTP2PriorityQueue& tree,
+                       const http2::PriorityUpdate& pri);
+
+  /**
+   * Move this transaction in the priority tree, if it has one.
+   */
+  void updatePriority(const http2::PriorityUpdate& pri);
+
+  HTTP2PriorityQueue::Handle getPriorityTreeHandle() const {
+    return priorityTreeHandle_;
+  }
+
   HTTPTransactionEgressSM::State getEgressState() const {
     return egressState_;
   }
@@ -439,6 +552,24 @@ class HTTPTransaction :
     return stats_;
   }
 
+  /**
+   * The state of the worker thread running this transaction, if its
+   * session was given one, see WorkerContext.
+   */
+  WorkerContext* getWorkerContext() const {
+    return workerContext_;
+  }
+
+  void setWorkerContext(WorkerContext* context) {
+    workerContext_ = context;
+  }
+
+  /**
+   * Have the capacity of the send window follow the initial send window of
+   * the session, see InitialSendWindow.
+   */
+  void setInitialSendWindow(InitialSendWindow* window);
+
   /**
    * Check whether more response is expected. One or more 1xx status
    * responses can be received prior to the regular response.
@@ -459,6 +590,17 @@ class HTTPTransaction :
    */
   virtual void setReceiveWindow(uint32_t capacity);
 
+  /**
+   * Grow the receive window, up to maxCapacity, when the peer uses it up
+   * faster than the round trip time of the transport allows, ie: when the
+   * window rather than the bandwidth-delay product limits the upload. A
+   * maxCapacity not above the current capacity disables auto-tuning (the
+   * default). See FlowControlFilter::setReceiveWindowAutoTuning().
+   */
+  void setReceiveWindowAutoTuning(uint32_t maxCapacity) {
+    maxRecvCapacity_ = maxCapacity;
+  }
+
   /**
    * Get the receive window of the transaction
    */
@@ -546,6 +688,18 @@ class HTTPTransaction :
    */
   bool onWriteReady(uint32_t maxEgress);
 
+  /**
+   * Credit this transaction with another deficit round robin quantum and
+   * return the number of body bytes it may send on this turn. Credit left
+   * unused carries over to the next turn, up to twice the quantum, and is
+   * dropped when the transaction leaves the egress queue.
+   */
+  uint32_t addEgressQuantum(uint32_t quantum) {
+    egressDeficit_ = std::min<uint64_t>(uint64_t(egressDeficit_) + quantum,
+                                        uint64_t(quantum) * 2);
+    return egressDeficit_;
+  }
+
   /**
    * Invoked by the session when there is a timeout on the egress stream.
    */
@@ -582,6 +736,49 @@ class HTTPTransaction :
     transportCallback_ = cb;
   }
 
+  /**
+   * Report the timing of this transaction on the wire to context's
+   * observers, as one TraceEvent per step, all with context's parent ID:
+   *
+   *   ReadSocket     from message begin to its headers parsed
+   *   Scheduling     from headers parsed to handed to the handler
+   *   WriteSocket    from sendHeaders() to the first header byte written
+   *   LastByteAck    from the last byte written to its ACK, if tracked
+   *
+   * Set it before the ingress headers complete to get the first two.
+   *
+   * With sampleTCPInfo, each of the last two steps is also followed by a
+   * TCPInfo event with the socket's RTT, congestion window and losses at
+   * that point, at the cost of a getsockopt() each.
+   */
+  void setTraceEventContext(const TraceEventContext& context,
+                            bool sampleTCPInfo = false);
+
+  /**
+   * The allocations and copies made on behalf of this transaction so far:
+   * in its ingress callbacks, the handler's work in them, and serializing
+   * its egress. Zero unless built with --enable-alloc-stats.
+   */
+  const AllocCounts& getAllocCounts() const {
+    return allocCounts_;
+  }
+
+  /**
+   * Memory that lives as long as the transaction, for the handler and
+   * filters to keep request state in without a heap allocation each.
+   * Created on first use, and freed in one go when the transaction is
+   * destroyed, after detachTransaction(). The destructors of objects
+   * placed in it are not run; folly::StlAllocator makes containers of it.
+   */
+  folly::SysArena& getArena();
+
+  /**
+   * @return the bytes the arena got from the allocator, 0 if it is unused
+   */
+  size_t getArenaSize() const {
+    return arena_ ? arena_->totalSize() : 0;
+  }
+
   /**
    * @return true if egress has started on this transaction.
    */
@@ -611,6 +808,15 @@ class HTTPTransaction :
     return isIngressEOMQueued() || isIngressComplete();
   }
 
+  /**
+   * @return true if this is a request, with a safe method (RFC 7231
+   * 4.2.1), that has been sent. Only those may have others pipelined
+   * behind them.
+   */
+  bool isSafeRequest() const {
+    return safeRequest_;
+  }
+
   /**
    * @return true if egress has started on this transaction.
    */
@@ -661,6 +867,31 @@ class HTTPTransaction :
    */
   virtual void sendHeaders(const HTTPMessage& headers);
 
+  /**
+   * Send the egress message headers and the EOM of a message without a
+   * body, as sendHeaders() then sendEOM() would. The codec frames them in
+   * one go, eg. a HEADERS frame with END_STREAM rather than an empty DATA
+   * frame after it, and the EOM doesn't wait behind the header block.
+   *
+   * @param headers  Message headers
+   */
+  virtual void sendHeadersWithEOM(const HTTPMessage& headers);
+
+  /**
+   * Send the egress message headers, the whole body and the EOM of a
+   * message with a Content-Length, as sendHeaders(), sendBody() then
+   * sendEOM() would, but in one codec call and one write when the body
+   * fits in the stream's and the connection's send windows, and in one
+   * write's worth of egress. Otherwise, or when the message is chunked,
+   * has trailers or egress is rate limited, the parts go out separately,
+   * so flow control and rate limiting apply as usual.
+   *
+   * @param headers  Message headers
+   * @param body     Message body data
+   */
+  virtual void sendHeadersWithBodyAndEOM(const HTTPMessage& headers,
+                                         std::unique_ptr<folly::IOBuf> body);
+
   /**
    * Send part or all of the egress message body to the Transport. If flow
    * control is enabled, the chunk boundaries may not be respected.
@@ -675,6 +906,19 @@ class HTTPTransaction :
    */
   virtual void sendBody(std::unique_ptr<folly::IOBuf> body);
 
+  /**
+   * Send length bytes of the file fd from offset as body, like sendBody(),
+   * but without reading them into memory: the file is mapped a window at a
+   * time as egress drains, and the mapped pages are written to the
+   * transport as they are. The transaction keeps its own descriptor for
+   * the file, so fd may be closed right after. The file must not shrink
+   * until the body is sent.
+   *
+   * @return false, sending nothing, if fd is not a regular file at least
+   *         offset + length bytes long.
+   */
+  virtual bool sendFile(int fd, off_t offset, size_t length);
+
   /**
    * Write any protocol framing required for the subsequent call(s)
    * to sendBody(). This method does not actually write the message out on
@@ -687,7 +931,7 @@ class HTTPTransaction :
             egressState_, HTTPTransactionEgressSM::Event::sendChunkHeader));
     // TODO: move this logic down to session/codec
     if (!transport_.getCodec().supportsParallelRequests()) {
-      chunkHeaders_.emplace_back(Chunk(length));
+      chunkHeaders_.push_back(Chunk(length));
     }
   }
 
@@ -803,14 +1047,39 @@ class HTTPTransaction :
    * The transaction will buffer extra bytes if doing so would cause it to go
    * over the specified rate limit.  Setting to a value of 0 will cause no
    * rate-limiting to occur.
+   *
+   * Egress is paced with a token bucket: at most burstBytes go out at once,
+   * and the bucket refills at the rate limit, waking the transaction up on
+   * the session's timers. A burstBytes of 0 allows 10ms at the rate limit,
+   * or a few packets if more.
    */
-  void setEgressRateLimit(uint64_t bitsPerSecond);
+  void setEgressRateLimit(uint64_t bitsPerSecond, uint32_t burstBytes = 0);
 
   /**
    * @return true iff egress processing is paused for the handler
    */
   bool isEgressPaused() const { return handlerEgressPaused_; }
 
+  /**
+   * Forward the rest of the ingress body, and the EOM, as egress on
+   * egressTxn, which may be this one or one on another session of the same
+   * EventBase, instead of through the handler. The IOBufs are handed over
+   * as they are, without onBody() or chunk callbacks, and ingress is paused
+   * whenever egressTxn's egress would be, so the ingress flow control
+   * window opens as fast as egressTxn drains. The handler still gets
+   * onTrailers() and onEOM(), the latter after the EOM went to egressTxn,
+   * and should not pause or resume ingress meanwhile. If egressTxn can no
+   * longer send a body, the handler gets the rest of it again.
+   *
+   * Pass nullptr to stop forwarding.
+   */
+  void spliceIngressBody(HTTPTransaction* egressTxn);
+
+  /**
+   * @return the transaction the ingress body is forwarded to, if any
+   */
+  HTTPTransaction* getIngressBodySplice() const { return spliceEgress_; }
+
   /**
    * @return true iff this transaction can be used to push resources to
    * the remote side.
@@ -862,6 +1131,24 @@ class HTTPTransaction :
    */
   void setTransactionIdleTimeouts(AsyncTimeoutSet* transactionIdleTimeouts);
 
+  /**
+   * Time out any wait for the rest of the ingress headers with
+   * headerTimeouts, and for more of the body with bodyTimeouts, instead of
+   * the transaction idle timeouts. Either may be null to not.
+   */
+  void setIngressTimeouts(AsyncTimeoutSet* headerTimeouts,
+                          AsyncTimeoutSet* bodyTimeouts);
+
+  /**
+   * Cancel the timeouts of the transaction for its session to move to
+   * another EventBase, and schedule them again on the timeout sets of the
+   * new one once it has, see HTTPSession::detachEventBase().
+   */
+  void detachTimeouts();
+  void attachTimeouts(AsyncTimeoutSet* transactionIdleTimeouts,
+                      AsyncTimeoutSet* headerTimeouts,
+                      AsyncTimeoutSet* bodyTimeouts);
+
   /**
    * Returns the associated transaction ID for pushed transactions, 0 otherwise
    */
@@ -885,11 +1172,13 @@ class HTTPTransaction :
   }
 
   /**
-   * Schedule or refresh the timeout for this transaction
+   * Schedule or refresh the timeout for this transaction, from the set for
+   * where its ingress is at
    */
   void refreshTimeout() {
-    if (transactionIdleTimeouts_) {
-      transactionIdleTimeouts_->scheduleTimeout(this);
+    auto timeouts = getTimeoutSet();
+    if (timeouts) {
+      timeouts->scheduleTimeout(this);
     }
   }
 
@@ -981,11 +1270,11 @@ class HTTPTransaction :
 
   bool mustQueueIngress() const;
 
-  /**
-   * Check if deferredIngress_ points to some queue before pushing HTTPEvent
-   * to it.
-   */
-  void checkCreateDeferredIngress();
+  // Process deferredIngress_ until it's empty or ingress is paused
+  void processDeferredIngress();
+
+  void sendHeadersWithOptionalEOM(const HTTPMessage& headers, bool eom,
+                                  std::unique_ptr<folly::IOBuf> body = nullptr);
 
   /**
    * Implementation of sending an abort for this transaction.
@@ -995,6 +1284,11 @@ class HTTPTransaction :
   // Internal implementations of the ingress-related callbacks
   // that work whether the ingress events are immediate or deferred.
   void processIngressHeadersComplete(std::unique_ptr<HTTPMessage> msg);
+
+  void traceStep(TraceEventType type, TimePoint start,
+                 TraceFieldType field, int64_t value);
+
+  void traceTCPInfo();
   void processIngressBody(std::unique_ptr<folly::IOBuf> chain, size_t len);
   void processIngressChunkHeader(size_t length);
   void processIngressChunkComplete();
@@ -1008,11 +1302,40 @@ class HTTPTransaction :
   size_t sendEOMNow();
   void onDeltaSendWindowSize(int32_t windowDelta);
 
+  /**
+   * The send window size, counting a change of the initial send window of
+   * the session that was not applied to it yet.
+   */
+  int32_t getSendWindowSize() const;
+
+  /**
+   * Applies to the send window a change of the initial send window of the
+   * session since it was last used. Returns false if the new capacity
+   * overflows the window.
+   */
+  bool syncSendWindow();
+
   void notifyTransportPendingEgress();
 
   size_t sendDeferredBody(uint32_t maxEgress);
 
-  bool maybeDelayForRateLimit();
+  /**
+   * Limit canSend to the tokens in the egress bucket, or schedule the
+   * pacing timeout and return true if there are too few to send now.
+   */
+  bool maybeDelayForRateLimit(size_t* canSend);
+  void refillEgressTokens();
+  void onPacingTimeout();
+
+  class PacingTimeout: public AsyncTimeoutSet::Callback {
+   public:
+    explicit PacingTimeout(HTTPTransaction& txn): txn_(txn) {}
+    void timeoutExpired() noexcept override {
+      txn_.onPacingTimeout();
+    }
+   private:
+    HTTPTransaction& txn_;
+  };
 
   bool isEnqueued() const { return enqueued_; }
 
@@ -1020,17 +1343,51 @@ class HTTPTransaction :
     DCHECK(isEnqueued());
     egressQueue_.erase(queueHandle_);
     enqueued_ = false;
+    egressDeficit_ = 0;
+    if (priorityTree_) {
+      priorityTree_->clearPendingEgress(priorityTreeHandle_);
+    }
   }
 
   bool hasPendingEOM() const {
-    return deferredEgressBody_.chainLength() == 0 &&
+    return deferredEgressBody_.chainLength() == 0 && fileBodies_.empty() &&
       isEgressEOMQueued();
   }
 
+  /**
+   * Map the files passed to sendFile() into deferredEgressBody_, up to a
+   * window ahead of egress, or all of them if all.
+   */
+  void mapFileBodies(bool all);
+
+  void closeFileBodies();
+
+  /**
+   * Whether the ingress body of a transaction spliced to this one can
+   * still be sent
+   */
+  bool canSpliceBody() const;
+
+  /**
+   * Pause or resume ingress for the transaction spliced to, as its egress
+   * is paused or not, see spliceIngressBody()
+   */
+  void setSplicePaused(bool paused);
+
   bool isExpectingIngress() const;
 
   void updateReadTimeout();
 
+  AsyncTimeoutSet* getTimeoutSet() const {
+    if (!isIngressStarted() && headerTimeouts_) {
+      return headerTimeouts_;
+    }
+    if (isIngressStarted() && !isIngressEOMSeen() && bodyTimeouts_) {
+      return bodyTimeouts_;
+    }
+    return transactionIdleTimeouts_;
+  }
+
   /**
    * Causes isIngressComplete() to return true, removes any queued
    * ingress, and cancels the read timeout.
@@ -1056,11 +1413,17 @@ class HTTPTransaction :
    */
   void flushWindowUpdate();
 
+  /**
+   * Doubles the receive window if it was used up within two round trips of
+   * the previous window update.
+   */
+  void maybeGrowReceiveWindow();
+
   /**
    * Queue to hold any events that we receive from the Transaction
    * while the ingress is supposed to be paused.
    */
-  std::unique_ptr<std::queue<HTTPEvent>> deferredIngress_;
+  HTTPEventQueue deferredIngress_;
 
   uint32_t maxDeferredIngress_{0};
 
@@ -1080,7 +1443,12 @@ class HTTPTransaction :
   HTTPTransactionIngressSM::State ingressState_{
     HTTPTransactionIngressSM::getNewInstance()};
   AsyncTimeoutSet* transactionIdleTimeouts_{nullptr};
+  AsyncTimeoutSet* headerTimeouts_{nullptr};
+  AsyncTimeoutSet* bodyTimeouts_{nullptr};
   HTTPSessionStats* stats_{nullptr};
+  WorkerContext* workerContext_{nullptr};
+  // Only kept with stats_
+  TimePoint startTime_;
 
   /**
    * The recv window and associated data. This keeps track of how many
@@ -1094,8 +1462,32 @@ class HTTPTransaction :
    */
   Window sendWindow_;
 
+  InitialSendWindow* initialSendWindow_{nullptr};
+  // Linked in the paused list of initialSendWindow_ while the send window
+  // pauses egress
+  folly::IntrusiveListHook sendWindowPausedHook_;
+  friend struct InitialSendWindow;
+
   TransportCallback* transportCallback_{nullptr};
 
+  // When the steps traced with setTraceEventContext() began
+  struct TraceState {
+    TraceState(const TraceEventContext& ctx, bool sampleTCP):
+        context(ctx), sampleTCPInfo(sampleTCP) {}
+
+    TraceEventContext context;
+    bool sampleTCPInfo;
+    TimePoint ingressHeadersTime;
+    TimePoint egressHeadersTime;
+    TimePoint lastByteTime;
+    uint64_t egressHeaderBytes{0};
+  };
+  std::unique_ptr<TraceState> trace_;
+
+  AllocCounts allocCounts_;
+
+  std::unique_ptr<folly::SysArena> arena_;
+
   /**
    * Number of callbacks currently active.  Used to prevent destruction
    * while in a callback that might turn around and invoke some method
@@ -1113,7 +1505,61 @@ class HTTPTransaction :
     size_t length;
     bool headerSent;
   };
-  std::list<Chunk> chunkHeaders_;
+
+  /**
+   * FIFO of chunks, in a ring that is kept for the life of the
+   * transaction, rather than a list node per chunk
+   */
+  class ChunkQueue {
+   public:
+    bool empty() const {
+      return size_ == 0;
+    }
+
+    size_t size() const {
+      return size_;
+    }
+
+    Chunk& operator[](size_t i) {
+      DCHECK_LT(i, size_);
+      return chunks_[(head_ + i) % chunks_.size()];
+    }
+
+    Chunk& front() {
+      return (*this)[0];
+    }
+
+    void push_back(const Chunk& chunk) {
+      if (size_ == chunks_.size()) {
+        grow();
+      }
+      chunks_[(head_ + size_) % chunks_.size()] = chunk;
+      size_++;
+    }
+
+    void pop_front() {
+      DCHECK_GT(size_, 0);
+      head_ = (head_ + 1) % chunks_.size();
+      size_--;
+    }
+
+   private:
+    void grow() {
+      std::vector<Chunk> chunks;
+      chunks.reserve(std::max<size_t>(4, 2 * chunks_.size()));
+      for (size_t i = 0; i < size_; i++) {
+        chunks.push_back((*this)[i]);
+      }
+      chunks.resize(chunks.capacity(), Chunk(0));
+      chunks_.swap(chunks);
+      head_ = 0;
+    }
+
+    std::vector<Chunk> chunks_;
+    size_t head_{0};
+    size_t size_{0};
+  };
+  ChunkQueue chunkHeaders_;
 
   /**
    * Reference to our priority queue
@@ -1126,11 +1572,25 @@ class HTTPTransaction :
    */
   PriorityQueue::handle_type queueHandle_;
 
+  /**
+   * HTTP/2 priority tree that schedules our egress, if any, and our node in
+   * it
+   */
+  HTTP2PriorityQueue* priorityTree_{nullptr};
+  HTTP2PriorityQueue::Handle priorityTreeHandle_{nullptr};
+
   /**
    * bytes we need to acknowledge to the remote end using a window update
    */
   int32_t recvToAck_{0};
 
+  /**
+   * Limit of receive window auto-tuning, and when the last window update
+   * of a full threshold went out
+   */
+  uint32_t maxRecvCapacity_{0};
+  TimePoint lastWindowUpdateTime_;
+
   /**
    * ID of request transaction (for pushed txns only)
    */
@@ -1155,6 +1615,15 @@ class HTTPTransaction :
    */
   uint16_t lastResponseStatus_{0};
 
+  // See isSafeRequest()
+  bool safeRequest_{false};
+
+  // Whether detachTimeouts() cancelled a scheduled timeout
+  bool timeoutDetached_{false};
+
+  // See queueIngressForHandler()
+  bool handlerPending_{false};
+
   bool ingressPaused_:1;
   bool egressPaused_:1;
   bool handlerEgressPaused_:1;
@@ -1168,15 +1637,55 @@ class HTTPTransaction :
   bool inResume_:1;
   bool inActiveSet_:1;
   bool ingressErrorSeen_:1;
+  bool firstHeadersTimed_:1;
 
   static uint64_t egressBufferLimit_;
 
-  uint64_t egressLimitBytesPerMs_{0};
-  proxygen::TimePoint startRateLimit_;
-  uint64_t numLimitedBytesEgressed_{0};
+  uint64_t egressRateBytesPerSec_{0};
+  uint32_t egressBurstBytes_{0};
+  double egressTokens_{0};
+  proxygen::TimePoint lastEgressTokenRefill_;
+  PacingTimeout pacingTimeout_{*this};
+
+  /**
+   * The transaction the ingress body is forwarded to, and the one
+   * forwarding its ingress body to us, see spliceIngressBody(), and
+   * whether our ingress is paused because the former's egress is
+   */
+  HTTPTransaction* spliceEgress_{nullptr};
+  HTTPTransaction* spliceIngress_{nullptr};
+  bool splicePausedIngress_{false};
+
+  /**
+   * The parts of files passed to sendFile() not mapped yet, in order
+   */
+  struct FileBody {
+    int fd;
+    off_t offset;
+    size_t length;
+  };
+  std::deque<FileBody> fileBodies_;
+
+  /**
+   * Body bytes this transaction may still send before yielding to the next
+   * transaction in its priority band, see addEgressQuantum()
+   */
+  uint32_t egressDeficit_{0};
+};
+
+/**
+ * The initial send window of the streams of a session, which the peer may
+ * change at any time. The transactions of the session apply a change of it
+ * to their send window the next time they use it, so the session only has
+ * to tell the ones it paused, which need to resume when it grows. Changing
+ * the initial window then costs the same however many streams are open.
+ */
+struct InitialSendWindow {
+  explicit InitialSendWindow(uint32_t initialSize): size(initialSize) {}
 
-  // Used by pending callbacks to see if the transaction has been deleted
-  std::shared_ptr<bool> cancelled_;
+  uint32_t size;
+  folly::IntrusiveList<HTTPTransaction,
+                       &HTTPTransaction::sendWindowPausedHook_> paused;
 };
 
 /**
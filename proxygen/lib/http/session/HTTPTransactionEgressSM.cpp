@@ -9,17 +9,15 @@
  */
 #include <proxygen/lib/http/session/HTTPTransactionEgressSM.h>
 
-#include <proxygen/lib/utils/UnionBasedStatic.h>
-
 namespace proxygen {
 
 namespace {
 
 typedef typename HTTPTransactionEgressSMData::State State;
 typedef typename HTTPTransactionEgressSMData::Event Event;
-typedef std::map<std::pair<State, Event>, State> TransitionTable;
-
-DEFINE_UNION_STATIC_CONST_NO_INIT(TransitionTable, Table, s_transitions);
+typedef DenseTransitionTable<State, Event,
+                             size_t(State::SendingDone) + 1,
+                             size_t(Event::eomFlushed) + 1> TransitionTable;
 
 //             +--> ChunkHeaderSent -> ChunkBodySent
 //             |      ^                    v
@@ -29,51 +27,43 @@ DEFINE_UNION_STATIC_CONST_NO_INIT(TransitionTable, Table, s_transitions);
 // Start -> HeadersSent                   +----> EOMQueued --> SendingDone
 //             |                                     ^
 //             +------------> RegularBodySent -------+
-__attribute__((__constructor__))
-void initTableUnion() {
-  // Use const_cast for the placement new initialization since we want this to
-  // be const after construction.
-  new (const_cast<TransitionTable*>(&s_transitions.data)) TransitionTable {
-    {{State::Start, Event::sendHeaders}, State::HeadersSent},
+constexpr TransitionTable::Transition kTransitions[] = {
+  {State::Start, Event::sendHeaders, State::HeadersSent},
 
-    // For HTTP sending 100 response, then a regular response
-    {{State::HeadersSent, Event::sendHeaders}, State::HeadersSent},
+  // For HTTP sending 100 response, then a regular response
+  {State::HeadersSent, Event::sendHeaders, State::HeadersSent},
 
-    {{State::HeadersSent, Event::sendBody}, State::RegularBodySent},
-    {{State::HeadersSent, Event::sendChunkHeader}, State::ChunkHeaderSent},
-    {{State::HeadersSent, Event::sendEOM}, State::EOMQueued},
+  {State::HeadersSent, Event::sendBody, State::RegularBodySent},
+  {State::HeadersSent, Event::sendChunkHeader, State::ChunkHeaderSent},
+  {State::HeadersSent, Event::sendEOM, State::EOMQueued},
 
-    {{State::RegularBodySent, Event::sendBody}, State::RegularBodySent},
-    {{State::RegularBodySent, Event::sendEOM}, State::EOMQueued},
+  {State::RegularBodySent, Event::sendBody, State::RegularBodySent},
+  {State::RegularBodySent, Event::sendEOM, State::EOMQueued},
 
-    {{State::ChunkHeaderSent, Event::sendBody}, State::ChunkBodySent},
+  {State::ChunkHeaderSent, Event::sendBody, State::ChunkBodySent},
 
-    {{State::ChunkBodySent, Event::sendBody}, State::ChunkBodySent},
-    {{State::ChunkBodySent, Event::sendChunkTerminator},
-     State::ChunkTerminatorSent},
+  {State::ChunkBodySent, Event::sendBody, State::ChunkBodySent},
+  {State::ChunkBodySent, Event::sendChunkTerminator,
+   State::ChunkTerminatorSent},
 
-    {{State::ChunkTerminatorSent, Event::sendChunkHeader},
-     State::ChunkHeaderSent},
-    {{State::ChunkTerminatorSent, Event::sendTrailers}, State::TrailersSent},
-    {{State::ChunkTerminatorSent, Event::sendEOM}, State::EOMQueued},
+  {State::ChunkTerminatorSent, Event::sendChunkHeader,
+   State::ChunkHeaderSent},
+  {State::ChunkTerminatorSent, Event::sendTrailers, State::TrailersSent},
+  {State::ChunkTerminatorSent, Event::sendEOM, State::EOMQueued},
 
-    {{State::TrailersSent, Event::sendEOM}, State::EOMQueued},
+  {State::TrailersSent, Event::sendEOM, State::EOMQueued},
 
-    {{State::EOMQueued, Event::eomFlushed}, State::SendingDone},
-  };
-}
+  {State::EOMQueued, Event::eomFlushed, State::SendingDone},
+};
+
+constexpr TransitionTable kTable = TransitionTable::make(kTransitions);
 
 } // namespace
 
 std::pair<HTTPTransactionEgressSMData::State, bool>
 HTTPTransactionEgressSMData::find(HTTPTransactionEgressSMData::State s,
                                   HTTPTransactionEgressSMData::Event e) {
-  auto const &it = s_transitions.data.find(std::make_pair(s, e));
-  if (it == s_transitions.data.end()) {
-    return std::make_pair(s, false);
-  }
-
-  return std::make_pair(it->second, true);
+  return kTable.find(s, e);
 }
 
 std::ostream& operator<<(std::ostream& os,
@@ -9,17 +9,15 @@
  */
 #include <proxygen/lib/http/session/HTTPTransactionIngressSM.h>
 
-#include <proxygen/lib/utils/UnionBasedStatic.h>
-
 namespace proxygen {
 
 namespace {
 
 typedef typename HTTPTransactionIngressSMData::State State;
 typedef typename HTTPTransactionIngressSMData::Event Event;
-typedef std::map<std::pair<State, Event>, State> TransitionTable;
-
-DEFINE_UNION_STATIC_CONST_NO_INIT(TransitionTable, Table, s_transitions);
+typedef DenseTransitionTable<State, Event,
+                             size_t(State::ReceivingDone) + 1,
+                             size_t(Event::eomFlushed) + 1> TransitionTable;
 
 //             +--> ChunkHeaderReceived -> ChunkBodyReceived
 //             |        ^                     v
@@ -31,60 +29,52 @@ DEFINE_UNION_STATIC_CONST_NO_INIT(TransitionTable, Table, s_transitions);
 //             |  +-----> RegularBodyReceived --+  |
 //             |                                   |
 //             +---------> UpgradeComplete --------+
-__attribute__((__constructor__))
-void initTableUnion() {
-  // Use const_cast for the placement new initialization since we want this to
-  // be const after construction.
-  new (const_cast<TransitionTable*>(&s_transitions.data)) TransitionTable {
-    {{State::Start, Event::onHeaders}, State::HeadersReceived},
-
-    // For HTTP receiving 100 response, then a regular response
-    {{State::HeadersReceived, Event::onHeaders}, State::HeadersReceived},
-
-    {{State::HeadersReceived, Event::onBody}, State::RegularBodyReceived},
-    {{State::HeadersReceived, Event::onChunkHeader},
-     State::ChunkHeaderReceived},
-    // special case - 0 byte body with trailers
-    {{State::HeadersReceived, Event::onTrailers}, State::TrailersReceived},
-    {{State::HeadersReceived, Event::onUpgrade}, State::UpgradeComplete},
-    {{State::HeadersReceived, Event::onEOM}, State::EOMQueued},
-
-    {{State::RegularBodyReceived, Event::onBody}, State::RegularBodyReceived},
-    {{State::RegularBodyReceived, Event::onEOM}, State::EOMQueued},
-
-    {{State::ChunkHeaderReceived, Event::onBody}, State::ChunkBodyReceived},
-
-    {{State::ChunkBodyReceived, Event::onBody}, State::ChunkBodyReceived},
-    {{State::ChunkBodyReceived, Event::onChunkComplete}, State::ChunkCompleted},
-
-    {{State::ChunkCompleted, Event::onChunkHeader}, State::ChunkHeaderReceived},
-    // TODO: "trailers" may be received at any time due to the SPDY HEADERS
-    // frame coming at any time. We might want to have a
-    // TransactionStateMachineFactory that takes a codec and generates the
-    // appropriate transaction state machine from that.
-    {{State::ChunkCompleted, Event::onTrailers}, State::TrailersReceived},
-    {{State::ChunkCompleted, Event::onEOM}, State::EOMQueued},
-
-    {{State::TrailersReceived, Event::onEOM}, State::EOMQueued},
-
-    {{State::UpgradeComplete, Event::onBody}, State::UpgradeComplete},
-    {{State::UpgradeComplete, Event::onEOM}, State::EOMQueued},
-
-    {{State::EOMQueued, Event::eomFlushed}, State::ReceivingDone},
-  };
-}
+constexpr TransitionTable::Transition kTransitions[] = {
+  {State::Start, Event::onHeaders, State::HeadersReceived},
+
+  // For HTTP receiving 100 response, then a regular response
+  {State::HeadersReceived, Event::onHeaders, State::HeadersReceived},
+
+  {State::HeadersReceived, Event::onBody, State::RegularBodyReceived},
+  {State::HeadersReceived, Event::onChunkHeader,
+   State::ChunkHeaderReceived},
+  // special case - 0 byte body with trailers
+  {State::HeadersReceived, Event::onTrailers, State::TrailersReceived},
+  {State::HeadersReceived, Event::onUpgrade, State::UpgradeComplete},
+  {State::HeadersReceived, Event::onEOM, State::EOMQueued},
+
+  {State::RegularBodyReceived, Event::onBody, State::RegularBodyReceived},
+  {State::RegularBodyReceived, Event::onEOM, State::EOMQueued},
+
+  {State::ChunkHeaderReceived, Event::onBody, State::ChunkBodyReceived},
+
+  {State::ChunkBodyReceived, Event::onBody, State::ChunkBodyReceived},
+  {State::ChunkBodyReceived, Event::onChunkComplete, State::ChunkCompleted},
+
+  {State::ChunkCompleted, Event::onChunkHeader, State::ChunkHeaderReceived},
+  // TODO: "trailers" may be received at any time due to the SPDY HEADERS
+  // frame coming at any time. We might want to have a
+  // TransactionStateMachineFactory that takes a codec and generates the
+  // appropriate transaction state machine from that.
+  {State::ChunkCompleted, Event::onTrailers, State::TrailersReceived},
+  {State::ChunkCompleted, Event::onEOM, State::EOMQueued},
+
+  {State::TrailersReceived, Event::onEOM, State::EOMQueued},
+
+  {State::UpgradeComplete, Event::onBody, State::UpgradeComplete},
+  {State::UpgradeComplete, Event::onEOM, State::EOMQueued},
+
+  {State::EOMQueued, Event::eomFlushed, State::ReceivingDone},
+};
+
+constexpr TransitionTable kTable = TransitionTable::make(kTransitions);
 
 } // namespace
 
 std::pair<HTTPTransactionIngressSMData::State, bool>
 HTTPTransactionIngressSMData::find(HTTPTransactionIngressSMData::State s,
                                    HTTPTransactionIngressSMData::Event e) {
-  auto const &it = s_transitions.data.find(std::make_pair(s, e));
-  if (it == s_transitions.data.end()) {
-    return std::make_pair(s, false);
-  }
-
-  return std::make_pair(it->second, true);
+  return kTable.find(s, e);
 }
 
 std::ostream& operator<<(std::ostream& os,
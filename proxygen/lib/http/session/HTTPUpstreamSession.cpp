@@ -9,6 +9,7 @@
  */
 #include <proxygen/lib/http/session/HTTPUpstreamSession.h>
 
+#include <algorithm>
 #include <folly/wangle/acceptor/ConnectionManager.h>
 #include <proxygen/lib/http/session/HTTPTransaction.h>
 
@@ -60,6 +61,32 @@ bool HTTPUpstreamSession::isClosing() const {
     resetAfterDrainingWrites_;
 }
 
+void HTTPUpstreamSession::setMaxPipelineDepth(uint32_t depth) {
+  if (codec_->supportsParallelRequests()) {
+    return;
+  }
+  maxPipelineDepth_ = std::max(depth, uint32_t(1));
+  maxConcurrentOutgoingStreamsConfig_ = maxPipelineDepth_;
+}
+
+bool HTTPUpstreamSession::canPipeline() const {
+  if (!supportsMoreTransactions() || draining_) {
+    return false;
+  }
+  if (codec_->supportsParallelRequests() || transactions_.empty()) {
+    return true;
+  }
+  if (isClosing() || !codec_->isReusable() || ingressError_) {
+    return false;
+  }
+  for (const auto& txn: transactions_) {
+    if (!txn.second.isEgressComplete() || !txn.second.isSafeRequest()) {
+      return false;
+    }
+  }
+  return true;
+}
+
 HTTPTransaction*
 HTTPUpstreamSession::newTransaction(HTTPTransaction::Handler* handler,
                                     int8_t priority) {
@@ -69,6 +96,10 @@ HTTPUpstreamSession::newTransaction(HTTPTransaction::Handler* handler,
     // This session doesn't support any more parallel transactions
     return nullptr;
   }
+  if (!canPipeline()) {
+    VLOG(4) << *this << " can't pipeline a transaction yet";
+    return nullptr;
+  }
 
   if (!started_) {
     startNow();
@@ -52,6 +52,26 @@ class HTTPUpstreamSession final: public HTTPSession {
   HTTPTransaction* newTransaction(HTTPTransaction::Handler* handler,
                                   int8_t priority = -1);
 
+  /**
+   * Let up to depth requests be outstanding at once on a serial (HTTP/1.x)
+   * codec, by pipelining them (RFC 7230 6.3.2). Off (1) by default, and
+   * ignored for codecs that multiplex.
+   *
+   * A new transaction is only pipelined once every request ahead of it
+   * has been sent in full and has a safe method (GET, HEAD, OPTIONS or
+   * TRACE), see canPipeline(); callers should only pipeline safe requests
+   * too. Should the connection go away, or the server close it after a
+   * response, the requests queued behind the one being answered get
+   * kErrorStreamUnacknowledged, so that they can be retried elsewhere.
+   */
+  void setMaxPipelineDepth(uint32_t depth);
+
+  /**
+   * Returns true if newTransaction() may be called now, whether or not it
+   * pipelines the transaction.
+   */
+  bool canPipeline() const;
+
   /**
    * Returns true if this session has no open transactions and the underlying
    * transport can be used again in a new request.
@@ -0,0 +1,223 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/http/session/ProtocolSniffer.h>
+
+#include <folly/io/Cursor.h>
+#include <proxygen/lib/http/codec/experimental/HTTP2Constants.h>
+
+using folly::IOBuf;
+using std::unique_ptr;
+
+namespace proxygen {
+
+namespace {
+
+const uint32_t kMinReadSize = 1460;
+const uint32_t kMaxReadSize = 4000;
+
+const char* kSwitchingProtocols =
+  "HTTP/1.1 101 Switching Protocols\r\n"
+  "Connection: Upgrade\r\n"
+  "Upgrade: h2c\r\n"
+  "\r\n";
+
+const char* kHTTP2Settings = "HTTP2-Settings";
+
+// The first byte of a SPDY control frame: the control bit, and the high
+// byte of its version, which is 0
+const uint8_t kSPDYControlBit = 0x80;
+
+}
+
+ProtocolSniffer::ProtocolSniffer(folly::AsyncSocket::UniquePtr sock,
+                                 const folly::SocketAddress& peerAddress,
+                                 const folly::TransportInfo& tinfo,
+                                 Callback* callback,
+                                 bool allowHTTP2,
+                                 bool allowSPDY):
+    folly::AsyncTimeout(sock->getEventBase()),
+    sock_(std::move(sock)),
+    peerAddress_(peerAddress),
+    tinfo_(tinfo),
+    callback_(callback),
+    probe_(TransportDirection::DOWNSTREAM),
+    allowHTTP2_(allowHTTP2),
+    allowSPDY_(allowSPDY),
+    prefaceMismatch_(false),
+    gotUpgrade_(false),
+    fallback_(false),
+    requestComplete_(false) {
+  probe_.setCallback(this);
+}
+
+ProtocolSniffer::~ProtocolSniffer() {
+  cancelTimeout();
+  if (sock_) {
+    sock_->setReadCB(nullptr);
+  }
+}
+
+void ProtocolSniffer::start(std::chrono::milliseconds timeout) {
+  sock_->setReadCB(this);
+  if (timeout.count() > 0) {
+    scheduleTimeout(timeout.count());
+  }
+}
+
+void ProtocolSniffer::getReadBuffer(void** buf, size_t* bufSize) {
+  auto readSpace = readBuf_.preallocate(kMinReadSize, kMaxReadSize);
+  *buf = readSpace.first;
+  *bufSize = readSpace.second;
+}
+
+void ProtocolSniffer::readDataAvailable(size_t readSize) noexcept {
+  DestructorGuard dg(this);
+  readBuf_.postallocate(readSize);
+  processIngress(readBuf_.move());
+}
+
+void ProtocolSniffer::readEOF() noexcept {
+  DestructorGuard dg(this);
+  VLOG(4) << "EOF from " << peerAddress_ << " before its protocol was known";
+  fail();
+}
+
+void ProtocolSniffer::readErr(const folly::AsyncSocketException& ex) noexcept {
+  DestructorGuard dg(this);
+  VLOG(4) << "Read error from " << peerAddress_
+          << " before its protocol was known: " << ex.what();
+  fail();
+}
+
+void ProtocolSniffer::timeoutExpired() noexcept {
+  DestructorGuard dg(this);
+  VLOG(4) << "Timed out waiting for the protocol of " << peerAddress_;
+  fail();
+}
+
+void ProtocolSniffer::processIngress(unique_ptr<IOBuf> chunk) {
+  ingress_.append(std::move(chunk));
+  if (allowSPDY_) {
+    // The first byte of a control frame has its top bit set, which is not
+    // printable, so never starts an HTTP/1.x request or the HTTP/2 preface
+    folly::io::Cursor cursor(ingress_.front());
+    if (cursor.read<uint8_t>() == kSPDYControlBit) {
+      if (ingress_.chainLength() < 2) {
+        return;
+      }
+      switch (cursor.read<uint8_t>()) {
+        case 2: return finish(Protocol::SPDY_2);
+        case 3: return finish(Protocol::SPDY_3);
+        // Else leave it to HTTP/1.x to reject
+        default: return finish(Protocol::HTTP1);
+      }
+    }
+  }
+  if (!allowHTTP2_) {
+    return finish(Protocol::HTTP1);
+  }
+  if (!prefaceMismatch_) {
+    const auto& preface = http2::kConnectionPreface;
+    size_t len = std::min(ingress_.chainLength(), preface.length());
+    folly::io::Cursor cursor(ingress_.front());
+    if (cursor.readFixedString(len) == preface.substr(0, len)) {
+      if (len == preface.length()) {
+        finish(Protocol::HTTP2_PRIOR_KNOWLEDGE);
+      }
+      // Else wait for the rest of the preface
+      return;
+    }
+    prefaceMismatch_ = true;
+  }
+
+  // Give the probe what it has not parsed yet
+  folly::IOBufQueue pending(folly::IOBufQueue::cacheChainLength());
+  pending.append(ingress_.front()->clone());
+  pending.trimStart(probeParsed_);
+  while (!pending.empty() && !fallback_ && !requestComplete_) {
+    size_t parsed = probe_.onIngress(*pending.front());
+    if (parsed == 0) {
+      break;
+    }
+    probeParsed_ += parsed;
+    pending.trimStart(parsed);
+  }
+
+  if (fallback_) {
+    finish(Protocol::HTTP1);
+  } else if (requestComplete_) {
+    finish(Protocol::HTTP2_UPGRADE);
+  }
+}
+
+void ProtocolSniffer::onHeadersComplete(HTTPCodec::StreamID stream,
+                                   unique_ptr<HTTPMessage> msg) {
+  const auto& headers = msg->getHeaders();
+  const auto& contentLength =
+    headers.getSingleOrEmpty(HTTP_HEADER_CONTENT_LENGTH);
+  // The upgrade has to wait for a request body, so leave those to HTTP/1.1
+  if (msg->checkForHeaderToken(HTTP_HEADER_UPGRADE, "h2c", false) &&
+      headers.exists(kHTTP2Settings) &&
+      !msg->getIsChunked() &&
+      (contentLength.empty() || contentLength == "0")) {
+    gotUpgrade_ = true;
+    upgradeRequest_ = std::move(msg);
+  } else {
+    fallback_ = true;
+  }
+}
+
+void ProtocolSniffer::onMessageComplete(HTTPCodec::StreamID stream,
+                                   bool upgrade) {
+  if (gotUpgrade_) {
+    requestComplete_ = true;
+    // Whatever follows is HTTP/2 for the session to parse
+    probe_.setParserPaused(true);
+  } else {
+    fallback_ = true;
+  }
+}
+
+void ProtocolSniffer::onError(HTTPCodec::StreamID stream,
+                         const HTTPException& error,
+                         bool newTxn) {
+  // The HTTP/1.x session will find the same error and answer it
+  fallback_ = true;
+}
+
+void ProtocolSniffer::finish(Protocol protocol) {
+  cancelTimeout();
+  sock_->setReadCB(nullptr);
+  if (protocol == Protocol::HTTP2_UPGRADE) {
+    VLOG(4) << "Upgrading " << peerAddress_ << " to h2c";
+    sock_->writeChain(nullptr, IOBuf::copyBuffer(kSwitchingProtocols,
+                                                 strlen(kSwitchingProtocols)));
+    ingress_.trimStart(probeParsed_);
+    // These were about this hop only
+    auto& headers = upgradeRequest_->getHeaders();
+    headers.remove(HTTP_HEADER_CONNECTION);
+    headers.remove(HTTP_HEADER_UPGRADE);
+    headers.remove(kHTTP2Settings);
+  } else {
+    upgradeRequest_.reset();
+  }
+  callback_->onSniffed(this, protocol, std::move(sock_), ingress_.move(),
+                       std::move(upgradeRequest_));
+}
+
+void ProtocolSniffer::fail() {
+  cancelTimeout();
+  sock_->setReadCB(nullptr);
+  sock_->closeNow();
+  sock_.reset();
+  callback_->onSniffError(this);
+}
+
+} // proxygen
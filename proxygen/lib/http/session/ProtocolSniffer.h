@@ -0,0 +1,151 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <proxygen/lib/http/codec/HTTP1xCodec.h>
+#include <folly/SocketAddress.h>
+#include <folly/io/IOBufQueue.h>
+#include <folly/io/async/AsyncSocket.h>
+#include <folly/io/async/AsyncTimeout.h>
+#include <folly/io/async/DelayedDestruction.h>
+#include <folly/wangle/acceptor/TransportInfo.h>
+
+namespace proxygen {
+
+/**
+ * Finds out which protocol a client speaks on a plaintext connection
+ * before an HTTPSession and its codec are made for it, from its first
+ * bytes. If HTTP/2 is allowed, a connection that opens with the HTTP/2
+ * connection preface speaks HTTP/2 with prior knowledge. Else its first
+ * request is parsed as HTTP/1.x, and if it asks for Upgrade: h2c without a
+ * body, the 101 response is sent here and the request becomes stream 1 of
+ * the HTTP/2 session. If SPDY is allowed, a connection that opens with a
+ * SPDY control frame speaks the SPDY version of that frame. Anything else
+ * is HTTP/1.x, which is known from the first byte when HTTP/2 is not
+ * allowed.
+ *
+ * All the bytes read meanwhile are handed over with the socket, so that
+ * the session parses them as if it had read them itself.
+ */
+class ProtocolSniffer:
+  public folly::DelayedDestruction,
+  private folly::AsyncTransportWrapper::ReadCallback,
+  private HTTPCodec::Callback,
+  private folly::AsyncTimeout {
+ public:
+  enum class Protocol {
+    HTTP1,
+    HTTP2_PRIOR_KNOWLEDGE,
+    HTTP2_UPGRADE,
+    // SPDY/3 and 3.1 frames are the same, SPDY_3 is either
+    SPDY_2,
+    SPDY_3,
+  };
+
+  class Callback {
+   public:
+    virtual ~Callback() {}
+
+    /**
+     * The protocol is known. upgradeRequest is only set for
+     * HTTP2_UPGRADE, and ingress may be empty.
+     */
+    virtual void onSniffed(ProtocolSniffer* sniffer,
+                           Protocol protocol,
+                           folly::AsyncSocket::UniquePtr sock,
+                           std::unique_ptr<folly::IOBuf> ingress,
+                           std::unique_ptr<HTTPMessage> upgradeRequest)
+      noexcept = 0;
+
+    /**
+     * The connection closed, failed or timed out before the protocol was
+     * known. The socket is already closed.
+     */
+    virtual void onSniffError(ProtocolSniffer* sniffer) noexcept = 0;
+  };
+
+  ProtocolSniffer(folly::AsyncSocket::UniquePtr sock,
+                  const folly::SocketAddress& peerAddress,
+                  const folly::TransportInfo& tinfo,
+                  Callback* callback,
+                  bool allowHTTP2 = true,
+                  bool allowSPDY = false);
+
+  /**
+   * Start reading. If the protocol is not known within timeout, the
+   * connection is closed.
+   */
+  void start(std::chrono::milliseconds timeout);
+
+  const folly::SocketAddress& getPeerAddress() const {
+    return peerAddress_;
+  }
+
+  const folly::TransportInfo& getTransportInfo() const {
+    return tinfo_;
+  }
+
+ private:
+  ~ProtocolSniffer() override;
+
+  // AsyncTransportWrapper::ReadCallback methods
+  void getReadBuffer(void** buf, size_t* bufSize) override;
+  void readDataAvailable(size_t readSize) noexcept override;
+  void readEOF() noexcept override;
+  void readErr(const folly::AsyncSocketException&) noexcept override;
+
+  // HTTPCodec::Callback methods
+  void onMessageBegin(HTTPCodec::StreamID stream, HTTPMessage* msg) override {}
+  void onHeadersComplete(HTTPCodec::StreamID stream,
+                         std::unique_ptr<HTTPMessage> msg) override;
+  void onBody(HTTPCodec::StreamID stream,
+              std::unique_ptr<folly::IOBuf> chain,
+              uint16_t padding) override {}
+  void onTrailersComplete(HTTPCodec::StreamID stream,
+                          std::unique_ptr<HTTPHeaders> trailers) override {}
+  void onMessageComplete(HTTPCodec::StreamID stream, bool upgrade) override;
+  void onError(HTTPCodec::StreamID stream,
+               const HTTPException& error,
+               bool newTxn) override;
+
+  // AsyncTimeout method
+  void timeoutExpired() noexcept override;
+
+  /** Look at what was read since the last call */
+  void processIngress(std::unique_ptr<folly::IOBuf> chunk);
+
+  void finish(Protocol protocol);
+
+  void fail();
+
+  folly::AsyncSocket::UniquePtr sock_;
+  folly::SocketAddress peerAddress_;
+  folly::TransportInfo tinfo_;
+  Callback* callback_;
+
+  /** Probe for the first request if the preface did not match */
+  HTTP1xCodec probe_;
+  std::unique_ptr<HTTPMessage> upgradeRequest_;
+
+  folly::IOBufQueue readBuf_{folly::IOBufQueue::cacheChainLength()};
+  /** All that was read so far */
+  folly::IOBufQueue ingress_{folly::IOBufQueue::cacheChainLength()};
+  /** How much of ingress_ the probe parsed */
+  size_t probeParsed_{0};
+
+  const bool allowHTTP2_:1;
+  const bool allowSPDY_:1;
+  bool prefaceMismatch_:1;
+  bool gotUpgrade_:1;
+  bool fallback_:1;
+  bool requestComplete_:1;
+};
+
+} // proxygen
@@ -0,0 +1,39 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/http/session/SessionMemoryAccountant.h>
+
+#include <glog/logging.h>
+
+namespace proxygen {
+
+SessionMemoryAccountant::SessionMemoryAccountant(uint64_t highWatermark,
+                                                 uint64_t lowWatermark):
+    highWatermark_(highWatermark),
+    lowWatermark_(lowWatermark) {
+  CHECK_LE(lowWatermark_, highWatermark_);
+}
+
+bool SessionMemoryAccountant::isUnderPressure() {
+  auto bytes = getBytes();
+  if (bytes > highWatermark_) {
+    if (!underPressure_.exchange(true, std::memory_order_relaxed)) {
+      LOG(WARNING) << "Sessions are under memory pressure, holding "
+                   << bytes << " bytes";
+    }
+  } else if (bytes <= lowWatermark_) {
+    if (underPressure_.exchange(false, std::memory_order_relaxed)) {
+      LOG(INFO) << "Sessions are out of memory pressure, holding "
+                << bytes << " bytes";
+    }
+  }
+  return underPressure_.load(std::memory_order_relaxed);
+}
+
+}
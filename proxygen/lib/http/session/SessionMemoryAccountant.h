@@ -0,0 +1,59 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace proxygen {
+
+/**
+ * Sums up the bytes the sessions of all the threads hold in their read
+ * and write buffers and header compression state, to tell when they hold
+ * too much. Pressure begins once the total goes over highWatermark, and
+ * lasts until it is back down to lowWatermark. Thread safe.
+ *
+ * See HTTPSession::setMemoryAccountant() and
+ * HTTPSessionAcceptor::setMemoryAccountant().
+ */
+class SessionMemoryAccountant {
+ public:
+  SessionMemoryAccountant(uint64_t highWatermark, uint64_t lowWatermark);
+
+  void add(int64_t delta) {
+    bytes_.fetch_add(delta, std::memory_order_relaxed);
+  }
+
+  uint64_t getBytes() const {
+    auto bytes = bytes_.load(std::memory_order_relaxed);
+    return bytes > 0 ? bytes : 0;
+  }
+
+  /**
+   * Whether the sessions hold too much, as of now
+   */
+  bool isUnderPressure();
+
+  uint64_t getHighWatermark() const {
+    return highWatermark_;
+  }
+
+  uint64_t getLowWatermark() const {
+    return lowWatermark_;
+  }
+
+ private:
+  const uint64_t highWatermark_;
+  const uint64_t lowWatermark_;
+  std::atomic<int64_t> bytes_{0};
+  std::atomic<bool> underPressure_{false};
+};
+
+}
@@ -24,6 +24,13 @@ HTTPTransactionHandler* SimpleController::getRequestHandler(
   return acceptor_->newHandler(txn, msg);
 }
 
+void SimpleController::getRequestHandlers(
+    const std::vector<HTTPTransaction*>& txns,
+    const std::vector<HTTPMessage*>& msgs,
+    std::vector<HTTPTransactionHandler*>& handlers) {
+  acceptor_->newHandlers(txns, msgs, handlers);
+}
+
 HTTPTransactionHandler* SimpleController::getParseErrorHandler(
     HTTPTransaction* txn,
     const HTTPException& error,
@@ -34,9 +41,9 @@ HTTPTransactionHandler* SimpleController::getParseErrorHandler(
   }
 
   auto errorPage = acceptor_->getErrorPage(localAddress);
-  return createErrorHandler(error.hasHttpStatusCode() ?
-                            error.getHttpStatusCode() : 400,
-                            "Bad Request", errorPage);
+  auto status = error.hasHttpStatusCode() ? error.getHttpStatusCode() : 400;
+  return createErrorHandler(status, HTTPMessage::getDefaultReason(status),
+                            errorPage);
 }
 
 HTTPTransactionHandler* SimpleController::getTransactionTimeoutHandler(
@@ -33,6 +33,14 @@ class SimpleController : public HTTPSessionController {
   HTTPTransactionHandler* getRequestHandler(HTTPTransaction& txn,
                                             HTTPMessage* msg) override;
 
+  /**
+   * Hands the requests parsed from one read to the acceptor together
+   */
+  void getRequestHandlers(
+    const std::vector<HTTPTransaction*>& txns,
+    const std::vector<HTTPMessage*>& msgs,
+    std::vector<HTTPTransactionHandler*>& handlers) override;
+
   /**
    * Will be invoked when HTTPSession is unable to parse a new request
    * on the connection because of bad input.
@@ -0,0 +1,243 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <glog/logging.h>
+#include <proxygen/lib/http/codec/HTTPCodec.h>
+#include <proxygen/lib/utils/ThreadLocalFreeList.h>
+#include <utility>
+#include <vector>
+
+namespace proxygen {
+
+/**
+ * Map from StreamID to a T with stable addresses, tuned for the way
+ * HTTP/2 and SPDY hand out stream IDs.
+ *
+ * Stream IDs are monotonically increasing and partitioned into odd and
+ * even by initiator, so (id >> 1) makes a dense, cache-friendly index into
+ * an open addressing table with linear probing. The memory of values is
+ * recycled through a ThreadLocalFreeList, shared by all the tables of a
+ * thread, so once the thread reaches its steady state concurrency,
+ * creating and destroying streams, or sessions, does not touch the
+ * allocator.
+ *
+ * Iteration order is unspecified. The table must not be modified while
+ * it is being iterated.
+ */
+template <typename T>
+class StreamTable {
+ public:
+  typedef HTTPCodec::StreamID StreamID;
+  typedef std::pair<StreamID, T&> value_type;
+
+ private:
+  struct Slot {
+    StreamID id{0};
+    T* value{nullptr};
+  };
+
+ public:
+  class iterator {
+   public:
+    iterator(const Slot* slot, const Slot* end): slot_(slot), end_(end) {
+      skipEmpty();
+    }
+
+    value_type operator*() const {
+      return value_type(slot_->id, *slot_->value);
+    }
+
+    iterator& operator++() {
+      ++slot_;
+      skipEmpty();
+      return *this;
+    }
+
+    bool operator==(const iterator& other) const {
+      return slot_ == other.slot_;
+    }
+
+    bool operator!=(const iterator& other) const {
+      return slot_ != other.slot_;
+    }
+
+   private:
+    void skipEmpty() {
+      while (slot_ != end_ && !slot_->value) {
+        ++slot_;
+      }
+    }
+
+    const Slot* slot_;
+    const Slot* end_;
+  };
+
+  StreamTable() {}
+
+  ~StreamTable() {
+    clear();
+  }
+
+  StreamTable(const StreamTable&) = delete;
+  StreamTable& operator=(const StreamTable&) = delete;
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  size_t count(StreamID id) const {
+    return find(id) ? 1 : 0;
+  }
+
+  /**
+   * Returns the value for the given id, or nullptr if it is not present.
+   */
+  T* find(StreamID id) const {
+    if (size_ == 0) {
+      return nullptr;
+    }
+    for (size_t i = hash(id) & mask_; slots_[i].value;
+         i = (i + 1) & mask_) {
+      if (slots_[i].id == id) {
+        return slots_[i].value;
+      }
+    }
+    return nullptr;
+  }
+
+  /**
+   * Construct a T in place for the given id. Returns the value for id and
+   * whether it was created by this call.
+   */
+  template <typename... Args>
+  std::pair<T*, bool> emplace(StreamID id, Args&&... args) {
+    T* existing = find(id);
+    if (existing) {
+      return std::make_pair(existing, false);
+    }
+    if ((size_ + 1) * 4 > slots_.size() * 3) {
+      rehash(slots_.empty() ? kInitialCapacity : slots_.size() * 2);
+    }
+    void* storage = FreeList::allocate();
+    T* value;
+    try {
+      value = new (storage) T(std::forward<Args>(args)...);
+    } catch (...) {
+      FreeList::deallocate(storage);
+      throw;
+    }
+    insertSlot(id, value);
+    ++size_;
+    return std::make_pair(value, true);
+  }
+
+  /**
+   * Destroy the value for the given id. Returns false if it was not
+   * present.
+   */
+  bool erase(StreamID id) {
+    if (size_ == 0) {
+      return false;
+    }
+    size_t i = hash(id) & mask_;
+    while (slots_[i].value && slots_[i].id != id) {
+      i = (i + 1) & mask_;
+    }
+    if (!slots_[i].value) {
+      return false;
+    }
+    T* value = slots_[i].value;
+    removeSlot(i);
+    --size_;
+    value->~T();
+    FreeList::deallocate(value);
+    return true;
+  }
+
+  void clear() {
+    for (auto& slot: slots_) {
+      if (slot.value) {
+        T* value = slot.value;
+        slot.value = nullptr;
+        value->~T();
+        FreeList::deallocate(value);
+      }
+    }
+    size_ = 0;
+  }
+
+  iterator begin() const {
+    return iterator(slots_.data(), slots_.data() + slots_.size());
+  }
+
+  iterator end() const {
+    return iterator(slots_.data() + slots_.size(),
+                    slots_.data() + slots_.size());
+  }
+
+ private:
+  typedef ThreadLocalFreeList<T> FreeList;
+
+  static const size_t kInitialCapacity = 8;
+
+  static size_t hash(StreamID id) {
+    // Streams of one parity are contiguous after the shift; the other
+    // parity probes into the neighboring slot.
+    return id >> 1;
+  }
+
+  void insertSlot(StreamID id, T* value) {
+    size_t i = hash(id) & mask_;
+    while (slots_[i].value) {
+      i = (i + 1) & mask_;
+    }
+    slots_[i].id = id;
+    slots_[i].value = value;
+  }
+
+  void removeSlot(size_t i) {
+    // Backward shift deletion keeps probe sequences intact without
+    // tombstones
+    slots_[i].value = nullptr;
+    for (size_t j = (i + 1) & mask_; slots_[j].value; j = (j + 1) & mask_) {
+      size_t home = hash(slots_[j].id) & mask_;
+      bool movable = (i <= j) ? (home <= i || home > j) :
+                                (home <= i && home > j);
+      if (movable) {
+        slots_[i] = slots_[j];
+        slots_[j].value = nullptr;
+        i = j;
+      }
+    }
+  }
+
+  void rehash(size_t capacity) {
+    DCHECK_EQ(capacity & (capacity - 1), size_t(0));
+    std::vector<Slot> old(capacity);
+    old.swap(slots_);
+    mask_ = capacity - 1;
+    for (auto& slot: old) {
+      if (slot.value) {
+        insertSlot(slot.id, slot.value);
+      }
+    }
+  }
+
+  std::vector<Slot> slots_;
+  size_t mask_{0};
+  size_t size_{0};
+};
+
+} // proxygen
@@ -9,6 +9,8 @@
  */
 #pragma once
 
+#include <chrono>
+
 namespace proxygen {
 
 class TTLBAStats {
@@ -22,6 +24,8 @@ class TTLBAStats {
   virtual void recordTTLBATimeout() noexcept = 0;
   virtual void recordTTLBAEomPassed() noexcept = 0;
   virtual void recordTTLBATracked() noexcept = 0;
+  // From the last byte of a response leaving to the peer acknowledging it
+  virtual void recordTTLBALatency(std::chrono::milliseconds) noexcept {}
 };
 
 } // namespace proxygen
@@ -0,0 +1,164 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/http/session/TenantScheduler.h>
+
+#include <algorithm>
+#include <glog/logging.h>
+
+namespace proxygen {
+
+class TenantScheduler::Tenant {
+ public:
+  Tenant(const std::string& k, uint32_t w)
+      : key(k),
+        weight(w) {}
+
+  std::string key;
+  uint32_t weight;
+  uint32_t members{0};
+  int64_t ingressCredit{0};
+  int64_t egressCredit{0};
+  // The last round the tenant read or wrote in
+  uint64_t lastActive{0};
+  IngressList ingressWaiting;
+  EgressList egressWaiting;
+};
+
+TenantScheduler::TenantScheduler(folly::EventBase* eventBase,
+                                 Classifier classifier,
+                                 const Options& options)
+    : eventBase_(CHECK_NOTNULL(eventBase)),
+      classifier_(classifier),
+      options_(options) {}
+
+TenantScheduler::~TenantScheduler() {
+  // Destroying the tenants unlinks the members still waiting
+}
+
+void TenantScheduler::setWeight(const std::string& tenant, uint32_t weight) {
+  weight = std::max(weight, 1u);
+  weights_[tenant] = weight;
+  auto it = tenants_.find(tenant);
+  if (it != tenants_.end()) {
+    it->second->weight = weight;
+  }
+}
+
+TenantScheduler::Tenant* TenantScheduler::addMember(
+    const std::string& key) {
+  auto& tenant = tenants_[key];
+  if (!tenant) {
+    auto weight = weights_.find(key);
+    tenant.reset(new Tenant(key,
+                            weight == weights_.end() ? 1 : weight->second));
+    tenant->ingressCredit = getQuantum(*tenant, false);
+    tenant->egressCredit = getQuantum(*tenant, true);
+  }
+  tenant->members++;
+  return tenant.get();
+}
+
+void TenantScheduler::removeMember(Tenant* tenant, Member* member) {
+  member->ingressHook_.unlink();
+  member->egressHook_.unlink();
+  DCHECK_GT(tenant->members, 0);
+  if (--tenant->members == 0) {
+    tenants_.erase(tenant->key);
+  }
+}
+
+bool TenantScheduler::mayRead(Tenant* tenant, Member* member) {
+  if (tenant->ingressCredit > 0 || busyTenants_ <= 1) {
+    return true;
+  }
+  if (!member->ingressHook_.is_linked()) {
+    tenant->ingressWaiting.push_back(*member);
+  }
+  scheduleRound();
+  return false;
+}
+
+bool TenantScheduler::mayWrite(Tenant* tenant, Member* member) {
+  if (tenant->egressCredit > 0 || busyTenants_ <= 1) {
+    return true;
+  }
+  if (!member->egressHook_.is_linked()) {
+    tenant->egressWaiting.push_back(*member);
+  }
+  scheduleRound();
+  return false;
+}
+
+void TenantScheduler::chargeIngress(Tenant* tenant, size_t bytes) {
+  charge(tenant, bytes, false);
+}
+
+void TenantScheduler::chargeEgress(Tenant* tenant, size_t bytes) {
+  charge(tenant, bytes, true);
+}
+
+int64_t TenantScheduler::getQuantum(const Tenant& tenant,
+                                    bool egress) const {
+  return int64_t(tenant.weight) *
+    (egress ? options_.egressQuantum : options_.ingressQuantum);
+}
+
+void TenantScheduler::charge(Tenant* tenant, size_t bytes, bool egress) {
+  (egress ? tenant->egressCredit : tenant->ingressCredit) -= bytes;
+  tenant->lastActive = round_;
+  scheduleRound();
+}
+
+void TenantScheduler::scheduleRound() {
+  if (!isLoopCallbackScheduled()) {
+    eventBase_->runInLoop(this);
+  }
+}
+
+void TenantScheduler::runLoopCallback() noexcept {
+  IngressList ingress;
+  EgressList egress;
+  uint32_t busy = 0;
+  for (auto& it: tenants_) {
+    auto& tenant = *it.second;
+    bool active = tenant.lastActive == round_ ||
+      !tenant.ingressWaiting.empty() || !tenant.egressWaiting.empty();
+    if (active) {
+      busy++;
+    }
+    // Debts carry over to the next round, unused credit does not
+    auto ingressQuantum = getQuantum(tenant, false);
+    auto egressQuantum = getQuantum(tenant, true);
+    tenant.ingressCredit = active ?
+      std::min(tenant.ingressCredit + ingressQuantum, ingressQuantum) :
+      ingressQuantum;
+    tenant.egressCredit = active ?
+      std::min(tenant.egressCredit + egressQuantum, egressQuantum) :
+      egressQuantum;
+    ingress.splice(ingress.end(), tenant.ingressWaiting);
+    egress.splice(egress.end(), tenant.egressWaiting);
+  }
+  round_++;
+  busyTenants_ = busy;
+
+  // Members resumed may be destroyed by the others, which unlinks them
+  while (!ingress.empty()) {
+    auto& member = ingress.front();
+    ingress.pop_front();
+    member.onIngressAllowed();
+  }
+  while (!egress.empty()) {
+    auto& member = egress.front();
+    egress.pop_front();
+    member.onEgressAllowed();
+  }
+}
+
+}
@@ -0,0 +1,124 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/IntrusiveList.h>
+#include <folly/io/async/EventBase.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace proxygen {
+
+class HTTPSession;
+
+/**
+ * Weighted fair sharing of a worker between tenants. The sessions of the
+ * worker's EventBase are grouped by a tenant key that a classifier
+ * derives from each of them (from its VIP, its TLS server name...). Each
+ * loop iteration, every tenant is credited its weight times the ingress
+ * and egress quanta, and its sessions spend that credit on the bytes they
+ * read and write, in deficit round robin. Once a tenant is out of credit
+ * while other tenants are busy too, its sessions wait for the next
+ * iteration: reads stop, so its requests are dispatched to their handlers
+ * no faster, and writes are held back. A tenant that is alone is never
+ * held, so the worker stays busy.
+ *
+ * A tenant with many connections thus gets no more of the worker than
+ * one with few. Only used from the thread of its EventBase, and must
+ * outlive the sessions given to it.
+ */
+class TenantScheduler: private folly::EventBase::LoopCallback {
+ public:
+  // The tenant key of a session
+  typedef std::function<std::string(const HTTPSession&)> Classifier;
+
+  struct Options {
+    // Bytes a tenant of weight 1 may read, and write, per loop iteration
+    uint32_t ingressQuantum{64 * 1024};
+    uint32_t egressQuantum{64 * 1024};
+  };
+
+  /**
+   * What the scheduler resumes once its tenant has credit again: the
+   * sessions.
+   */
+  class Member {
+   public:
+    virtual ~Member() {}
+    virtual void onIngressAllowed() noexcept = 0;
+    virtual void onEgressAllowed() noexcept = 0;
+
+   private:
+    friend class TenantScheduler;
+    folly::IntrusiveListHook ingressHook_;
+    folly::IntrusiveListHook egressHook_;
+  };
+
+  class Tenant;
+
+  TenantScheduler(folly::EventBase* eventBase,
+                  Classifier classifier,
+                  const Options& options);
+
+  ~TenantScheduler() override;
+
+  // The weight of tenant, of its current and future sessions; 1 by default
+  void setWeight(const std::string& tenant, uint32_t weight);
+
+  std::string classify(const HTTPSession& session) const {
+    return classifier_ ? classifier_(session) : std::string();
+  }
+
+  // Add a member to tenant, until it is removed
+  Tenant* addMember(const std::string& tenant);
+  void removeMember(Tenant* tenant, Member* member);
+
+  /**
+   * Whether member of tenant may read (write) now. If not, member is
+   * called back with onIngressAllowed() (onEgressAllowed()) once it may.
+   */
+  bool mayRead(Tenant* tenant, Member* member);
+  bool mayWrite(Tenant* tenant, Member* member);
+
+  void chargeIngress(Tenant* tenant, size_t bytes);
+  void chargeEgress(Tenant* tenant, size_t bytes);
+
+  size_t getNumTenants() const {
+    return tenants_.size();
+  }
+
+  // Tenants that read or wrote in the last loop iteration
+  uint32_t getNumBusyTenants() const {
+    return busyTenants_;
+  }
+
+ private:
+  typedef folly::IntrusiveList<Member, &Member::ingressHook_> IngressList;
+  typedef folly::IntrusiveList<Member, &Member::egressHook_> EgressList;
+
+  int64_t getQuantum(const Tenant& tenant, bool egress) const;
+  void charge(Tenant* tenant, size_t bytes, bool egress);
+  void scheduleRound();
+
+  // EventBase::LoopCallback: the next round of deficit round robin
+  void runLoopCallback() noexcept override;
+
+  folly::EventBase* eventBase_;
+  Classifier classifier_;
+  Options options_;
+  std::unordered_map<std::string, std::unique_ptr<Tenant>> tenants_;
+  std::unordered_map<std::string, uint32_t> weights_;
+  uint64_t round_{1};
+  uint32_t busyTenants_{0};
+};
+
+}
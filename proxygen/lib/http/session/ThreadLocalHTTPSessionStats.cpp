@@ -0,0 +1,206 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/http/session/ThreadLocalHTTPSessionStats.h>
+
+#include <algorithm>
+#include <folly/Conv.h>
+#include <glog/logging.h>
+
+namespace proxygen {
+
+namespace {
+
+std::atomic<size_t> nextThreadSlot{0};
+
+}
+
+class ThreadLocalHTTPSessionStats::PublishTimeout :
+      public folly::AsyncTimeout {
+ public:
+  PublishTimeout(ThreadLocalHTTPSessionStats& stats,
+                 folly::EventBase* eventBase,
+                 std::chrono::milliseconds interval):
+      folly::AsyncTimeout(eventBase),
+      stats_(stats),
+      interval_(interval) {}
+
+  void timeoutExpired() noexcept override {
+    stats_.publish();
+    scheduleTimeout(interval_.count());
+  }
+
+ private:
+  ThreadLocalHTTPSessionStats& stats_;
+  std::chrono::milliseconds interval_;
+};
+
+const size_t ThreadLocalHTTPSessionStats::kNumBuckets;
+const size_t ThreadLocalHTTPSessionStats::kMaxThreads;
+
+size_t ThreadLocalHTTPSessionStats::getBucket(uint64_t value) {
+  if (value == 0) {
+    return 0;
+  }
+  size_t bucket = 64 - __builtin_clzll(value);
+  return std::min(bucket, kNumBuckets - 1);
+}
+
+const char* ThreadLocalHTTPSessionStats::getHistogramName(
+    Histogram histogram) {
+  switch (histogram) {
+    case TRANSACTIONS_PER_SESSION: return "transactions_per_session";
+    case SESSION_IDLE_SECONDS: return "session_idle_seconds";
+    case PHASE_INGRESS_PARSE_US: return "phase_ingress_parse_us";
+    case PHASE_HANDLER_DISPATCH_US: return "phase_handler_dispatch_us";
+    case PHASE_EGRESS_SERIALIZE_US: return "phase_egress_serialize_us";
+    case PHASE_WRITE_US: return "phase_write_us";
+    case TRANSACTION_ARENA_KB: return "transaction_arena_kb";
+    case TTLBA_MS: return "ttlba_ms";
+    case TIME_TO_FIRST_BYTE_MS: return "time_to_first_byte_ms";
+    case TRANSACTION_DURATION_MS: return "transaction_duration_ms";
+    case INGRESS_HEADER_BYTES: return "ingress_header_bytes";
+    case WRITE_BUFFER_KB: return "write_buffer_kb";
+    case NUM_HISTOGRAMS: break;
+  }
+  return "unknown";
+}
+
+uint64_t ThreadLocalHTTPSessionStats::Snapshot::getPercentile(
+    Histogram histogram, double percentile) const {
+  uint64_t total = 0;
+  for (size_t i = 0; i < kNumBuckets; ++i) {
+    total += getBucket(histogram, i);
+  }
+  if (total == 0) {
+    return 0;
+  }
+  double rank = total * std::min(std::max(percentile, 0.0), 100.0) / 100;
+  uint64_t below = 0;
+  for (size_t i = 0; i < kNumBuckets; ++i) {
+    uint64_t count = getBucket(histogram, i);
+    if (count == 0 || below + count < rank) {
+      below += count;
+      continue;
+    }
+    if (i == 0) {
+      return 0;
+    }
+    uint64_t low = uint64_t(1) << (i - 1);
+    if (i == kNumBuckets - 1) {
+      return low;
+    }
+    // Assume the values are spread evenly over [low, 2 * low)
+    return low + uint64_t(low * (rank - below) / count);
+  }
+  return uint64_t(1) << (kNumBuckets - 2);
+}
+
+void ThreadLocalHTTPSessionStats::Snapshot::exportPercentiles(
+    const std::vector<double>& percentiles,
+    const std::function<void(const std::string&, uint64_t)>& exporter)
+    const {
+  for (size_t i = 0; i < NUM_HISTOGRAMS; ++i) {
+    auto histogram = Histogram(i);
+    for (auto percentile: percentiles) {
+      exporter(folly::to<std::string>(getHistogramName(histogram), ".p",
+                                      percentile),
+               getPercentile(histogram, percentile));
+    }
+  }
+}
+
+ThreadLocalHTTPSessionStats::Snapshot
+ThreadLocalHTTPSessionStats::Snapshot::since(const Snapshot& earlier) const {
+  Snapshot delta;
+  for (size_t i = 0; i < kNumValues; ++i) {
+    delta.values_[i] = values_[i] - earlier.values_[i];
+  }
+  return delta;
+}
+
+size_t ThreadLocalHTTPSessionStats::getThreadSlot() {
+  // The slot of a thread is the same in every instance
+  static thread_local size_t slot = std::min(
+    nextThreadSlot.fetch_add(1, std::memory_order_relaxed), kMaxThreads);
+  return slot;
+}
+
+ThreadLocalHTTPSessionStats::ThreadLocalHTTPSessionStats():
+    blocks_(new Block[kMaxThreads + 1]) {
+  for (size_t i = 0; i <= kMaxThreads; ++i) {
+    for (auto& value: blocks_[i].values) {
+      value.store(0, std::memory_order_relaxed);
+    }
+  }
+  for (auto& value: published_) {
+    value.store(0, std::memory_order_relaxed);
+  }
+}
+
+ThreadLocalHTTPSessionStats::~ThreadLocalHTTPSessionStats() noexcept {
+  CHECK(!publishTimeout_) << "stopPublishing() was not called";
+}
+
+ThreadLocalHTTPSessionStats::Snapshot
+ThreadLocalHTTPSessionStats::getSnapshot() const {
+  Snapshot snapshot;
+  auto numBlocks = std::min(
+    nextThreadSlot.load(std::memory_order_relaxed), kMaxThreads) + 1;
+  for (size_t i = 0; i < numBlocks; ++i) {
+    size_t block = (i + 1 == numBlocks) ? kMaxThreads : i;
+    for (size_t j = 0; j < kNumValues; ++j) {
+      snapshot.values_[j] +=
+        blocks_[block].values[j].load(std::memory_order_relaxed);
+    }
+  }
+  return snapshot;
+}
+
+void ThreadLocalHTTPSessionStats::startPublishing(
+    folly::EventBase* eventBase,
+    std::chrono::milliseconds interval) {
+  CHECK(!publishTimeout_);
+  publish();
+  publishTimeout_.reset(new PublishTimeout(*this, eventBase, interval));
+  publishTimeout_->scheduleTimeout(interval.count());
+}
+
+void ThreadLocalHTTPSessionStats::stopPublishing() {
+  publishTimeout_.reset();
+}
+
+void ThreadLocalHTTPSessionStats::publish() {
+  auto snapshot = getSnapshot();
+  // Only the publishing thread writes, so a plain sequence lock will do
+  auto seq = publishedSeq_.load(std::memory_order_relaxed);
+  publishedSeq_.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  for (size_t i = 0; i < kNumValues; ++i) {
+    published_[i].store(snapshot.values_[i], std::memory_order_relaxed);
+  }
+  publishedSeq_.store(seq + 2, std::memory_order_release);
+}
+
+ThreadLocalHTTPSessionStats::Snapshot
+ThreadLocalHTTPSessionStats::getPublishedSnapshot() const {
+  Snapshot snapshot;
+  uint64_t seq;
+  do {
+    seq = publishedSeq_.load(std::memory_order_acquire);
+    for (size_t i = 0; i < kNumValues; ++i) {
+      snapshot.values_[i] = published_[i].load(std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while ((seq & 1) ||
+           seq != publishedSeq_.load(std::memory_order_relaxed));
+  return snapshot;
+}
+
+} // proxygen
@@ -0,0 +1,276 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <folly/detail/CacheLocality.h>
+#include <folly/io/async/AsyncTimeout.h>
+#include <functional>
+#include <memory>
+#include <proxygen/lib/http/session/HTTPSessionStats.h>
+#include <string>
+#include <vector>
+
+namespace proxygen {
+
+/**
+ * An HTTPSessionStats that can be shared by the sessions of every thread.
+ * Each thread counts into a cache line aligned block of its own, with
+ * plain relaxed stores, and getSnapshot() sums the blocks of all threads
+ * without taking any lock.
+ *
+ * The first kMaxThreads threads that record anything get a block each;
+ * any further threads share one more block, with atomic increments.
+ * Blocks are never reused, so counts survive the threads that made them.
+ *
+ * Optionally a timer publishes a snapshot every so often, which can be
+ * read from any thread with getPublishedSnapshot(). The difference of two
+ * snapshots gives the percentiles of the histograms over the time between
+ * them, e.g. to alert on tail latency.
+ */
+class ThreadLocalHTTPSessionStats : public HTTPSessionStats {
+ public:
+  enum Counter {
+    TRANSACTIONS_OPENED,
+    TRANSACTIONS_CLOSED,
+    SESSIONS_REUSED,
+    TTLBA_EXCEED_LIMIT,
+    TTLBA_IOB_SPLIT_BY_EOM,
+    TTLBA_NOT_FOUND,
+    TTLBA_RECEIVED,
+    TTLBA_TIMEOUT,
+    TTLBA_EOM_PASSED,
+    TTLBA_TRACKED,
+    // An allocated and a reused counter per PooledObject
+    POOL_TRANSACTIONS_ALLOCATED,
+    POOL_TRANSACTIONS_REUSED,
+    POOL_MESSAGES_ALLOCATED,
+    POOL_MESSAGES_REUSED,
+    POOL_HEADER_VECTORS_ALLOCATED,
+    POOL_HEADER_VECTORS_REUSED,
+    POOL_BYTE_EVENTS_ALLOCATED,
+    POOL_BYTE_EVENTS_REUSED,
+    TRANSACTION_RECV_WINDOW_FULL,
+    TRANSACTION_RECV_WINDOW_GROWN,
+    SESSION_RECV_WINDOW_FULL,
+    SESSION_RECV_WINDOW_GROWN,
+    NUM_COUNTERS
+  };
+
+  enum Histogram {
+    TRANSACTIONS_PER_SESSION,
+    SESSION_IDLE_SECONDS,
+    // One per SessionPhase, in microseconds
+    PHASE_INGRESS_PARSE_US,
+    PHASE_HANDLER_DISPATCH_US,
+    PHASE_EGRESS_SERIALIZE_US,
+    PHASE_WRITE_US,
+    // Of the transactions that used their arena
+    TRANSACTION_ARENA_KB,
+    TTLBA_MS,
+    TIME_TO_FIRST_BYTE_MS,
+    TRANSACTION_DURATION_MS,
+    INGRESS_HEADER_BYTES,
+    WRITE_BUFFER_KB,
+    NUM_HISTOGRAMS
+  };
+
+  // Bucket 0 counts zeroes, bucket i > 0 values in [2^(i-1), 2^i), and
+  // the last bucket everything above
+  static const size_t kNumBuckets = 16;
+  static const size_t kMaxThreads = 256;
+  static const size_t kNumValues = NUM_COUNTERS + NUM_HISTOGRAMS * kNumBuckets;
+
+  class Snapshot {
+   public:
+    uint64_t get(Counter counter) const {
+      return values_[counter];
+    }
+
+    uint64_t getBucket(Histogram histogram, size_t bucket) const {
+      return values_[getBucketIndex(histogram, bucket)];
+    }
+
+    /**
+     * The value below which percentile (0 to 100) of the values in
+     * histogram fall, interpolated within its bucket; 0 when it is empty.
+     * Values in the last bucket count as its lower bound.
+     */
+    uint64_t getPercentile(Histogram histogram, double percentile) const;
+
+    /**
+     * Name each of percentiles of every histogram, as in "ttlba_ms.p99",
+     * and pass it with its value to exporter.
+     */
+    void exportPercentiles(
+      const std::vector<double>& percentiles,
+      const std::function<void(const std::string&, uint64_t)>& exporter)
+      const;
+
+    /**
+     * What was counted since earlier, a snapshot taken before this one.
+     */
+    Snapshot since(const Snapshot& earlier) const;
+
+   private:
+    friend class ThreadLocalHTTPSessionStats;
+    std::array<uint64_t, kNumValues> values_{};
+  };
+
+  static size_t getBucket(uint64_t value);
+
+  static const char* getHistogramName(Histogram histogram);
+
+  ThreadLocalHTTPSessionStats();
+  ~ThreadLocalHTTPSessionStats() noexcept override;
+
+  /**
+   * Sum up the counts of all the threads, from any thread.
+   */
+  Snapshot getSnapshot() const;
+
+  /**
+   * Publish a snapshot every interval from eventBase, until
+   * stopPublishing(). Both must be called in the thread of eventBase.
+   */
+  void startPublishing(folly::EventBase* eventBase,
+                       std::chrono::milliseconds interval);
+  void stopPublishing();
+
+  /**
+   * The last snapshot published, from any thread.
+   */
+  Snapshot getPublishedSnapshot() const;
+
+  // HTTPSessionStats methods
+  void recordTransactionOpened() noexcept override {
+    add(TRANSACTIONS_OPENED, 1);
+  }
+  void recordTransactionClosed() noexcept override {
+    add(TRANSACTIONS_CLOSED, 1);
+  }
+  void recordTransactionsServed(uint64_t num) noexcept override {
+    add(getBucketIndex(TRANSACTIONS_PER_SESSION, getBucket(num)), 1);
+  }
+  void recordSessionReused() noexcept override {
+    add(SESSIONS_REUSED, 1);
+  }
+  void recordSessionIdleTime(std::chrono::seconds idle) noexcept override {
+    add(getBucketIndex(SESSION_IDLE_SECONDS, getBucket(idle.count())), 1);
+  }
+  void recordSessionPhaseTime(SessionPhase phase,
+                              std::chrono::microseconds time)
+    noexcept override {
+    auto histogram = Histogram(PHASE_INGRESS_PARSE_US + size_t(phase));
+    add(getBucketIndex(histogram, getBucket(time.count())), 1);
+  }
+  void recordPoolAllocations(PooledObject object,
+                             uint64_t allocated,
+                             uint64_t reused) noexcept override {
+    auto counter = POOL_TRANSACTIONS_ALLOCATED + 2 * size_t(object);
+    add(counter, allocated);
+    add(counter + 1, reused);
+  }
+  void recordTransactionReceiveWindowFull() noexcept override {
+    add(TRANSACTION_RECV_WINDOW_FULL, 1);
+  }
+  void recordTransactionReceiveWindowGrown() noexcept override {
+    add(TRANSACTION_RECV_WINDOW_GROWN, 1);
+  }
+  void recordSessionReceiveWindowFull() noexcept override {
+    add(SESSION_RECV_WINDOW_FULL, 1);
+  }
+  void recordSessionReceiveWindowGrown() noexcept override {
+    add(SESSION_RECV_WINDOW_GROWN, 1);
+  }
+  void recordTransactionArenaSize(size_t bytes) noexcept override {
+    add(getBucketIndex(TRANSACTION_ARENA_KB, getBucket(bytes / 1024)), 1);
+  }
+  void recordTimeToFirstByte(std::chrono::milliseconds time)
+    noexcept override {
+    add(getBucketIndex(TIME_TO_FIRST_BYTE_MS, getBucket(time.count())), 1);
+  }
+  void recordTransactionDuration(std::chrono::milliseconds time)
+    noexcept override {
+    add(getBucketIndex(TRANSACTION_DURATION_MS, getBucket(time.count())),
+        1);
+  }
+  void recordIngressHeaderSize(size_t bytes) noexcept override {
+    add(getBucketIndex(INGRESS_HEADER_BYTES, getBucket(bytes)), 1);
+  }
+  void recordWriteBufferSize(size_t bytes) noexcept override {
+    add(getBucketIndex(WRITE_BUFFER_KB, getBucket(bytes / 1024)), 1);
+  }
+
+  // TTLBAStats methods
+  void recordTTLBAExceedLimit() noexcept override {
+    add(TTLBA_EXCEED_LIMIT, 1);
+  }
+  void recordTTLBAIOBSplitByEom() noexcept override {
+    add(TTLBA_IOB_SPLIT_BY_EOM, 1);
+  }
+  void recordTTLBANotFound() noexcept override {
+    add(TTLBA_NOT_FOUND, 1);
+  }
+  void recordTTLBAReceived() noexcept override {
+    add(TTLBA_RECEIVED, 1);
+  }
+  void recordTTLBATimeout() noexcept override {
+    add(TTLBA_TIMEOUT, 1);
+  }
+  void recordTTLBAEomPassed() noexcept override {
+    add(TTLBA_EOM_PASSED, 1);
+  }
+  void recordTTLBATracked() noexcept override {
+    add(TTLBA_TRACKED, 1);
+  }
+  void recordTTLBALatency(std::chrono::milliseconds latency)
+    noexcept override {
+    add(getBucketIndex(TTLBA_MS, getBucket(latency.count())), 1);
+  }
+
+ private:
+  struct Block {
+    std::array<std::atomic<uint64_t>, kNumValues> values;
+  } FOLLY_ALIGN_TO_AVOID_FALSE_SHARING;
+
+  class PublishTimeout;
+
+  static size_t getBucketIndex(Histogram histogram, size_t bucket) {
+    return NUM_COUNTERS + histogram * kNumBuckets + bucket;
+  }
+
+  static size_t getThreadSlot();
+
+  void add(size_t index, uint64_t amount) {
+    auto slot = getThreadSlot();
+    auto& value = blocks_[slot].values[index];
+    if (slot < kMaxThreads) {
+      // No other thread writes to this block
+      value.store(value.load(std::memory_order_relaxed) + amount,
+                  std::memory_order_relaxed);
+    } else {
+      value.fetch_add(amount, std::memory_order_relaxed);
+    }
+  }
+
+  void publish();
+
+  // kMaxThreads blocks plus the shared one
+  std::unique_ptr<Block[]> blocks_;
+
+  // Published with a sequence lock: odd while being written
+  std::atomic<uint64_t> publishedSeq_{0};
+  std::array<std::atomic<uint64_t>, kNumValues> published_;
+  std::unique_ptr<PublishTimeout> publishTimeout_;
+};
+
+} // proxygen
@@ -0,0 +1,38 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <gtest/gtest.h>
+#include <proxygen/lib/http/session/ConcurrentStreamsController.h>
+
+using namespace proxygen;
+using std::chrono::milliseconds;
+
+TEST(ConcurrentStreamsController, additiveIncreaseMultiplicativeDecrease) {
+  ConcurrentStreamsController::Options options;
+  options.minLimit = 10;
+  options.maxLimit = 100;
+  options.increment = 20;
+  options.backoffRatio = 0.5;
+  options.maxLoopLag = milliseconds(50);
+  options.maxTransactions = 1000;
+  ConcurrentStreamsController controller(options);
+  EXPECT_EQ(100, controller.getLimit());
+
+  // Backs off on loop lag and on too many transactions
+  EXPECT_EQ(50, controller.update(milliseconds(51), 0));
+  EXPECT_EQ(25, controller.update(milliseconds(0), 1001));
+  EXPECT_EQ(12, controller.update(milliseconds(100), 1001));
+  EXPECT_EQ(10, controller.update(milliseconds(100), 0));
+  // And comes back gradually
+  EXPECT_EQ(30, controller.update(milliseconds(50), 1000));
+  for (int i = 0; i < 10; i++) {
+    controller.update(milliseconds(0), 0);
+  }
+  EXPECT_EQ(100, controller.getLimit());
+}
@@ -11,6 +11,7 @@
 #include <proxygen/lib/http/codec/SPDYConstants.h>
 #include <proxygen/lib/http/codec/test/MockHTTPCodec.h>
 #include <proxygen/lib/http/codec/test/TestUtils.h>
+#include <proxygen/lib/http/session/ThreadLocalHTTPSessionStats.h>
 #include <proxygen/lib/http/session/test/HTTPSessionMocks.h>
 #include <proxygen/lib/http/session/test/HTTPTransactionMocks.h>
 #include <proxygen/lib/test/TestAsyncTransport.h>
@@ -191,6 +192,53 @@ TEST_F(DownstreamTransactionTest, window_decrease) {
   eventBase_.loop();
 }
 
+TEST_F(DownstreamTransactionTest, window_auto_tuning) {
+  ThreadLocalHTTPSessionStats stats;
+  HTTPTransaction txn(
+    TransportDirection::DOWNSTREAM,
+    HTTPCodec::StreamID(1), 1, transport_,
+    txnEgressQueue_, transactionTimeouts_.get(),
+    &stats,
+    true, // flow control enabled
+    400,
+    spdy::kInitialWindow);
+  txn.setReceiveWindowAutoTuning(1000);
+
+  EXPECT_CALL(transport_, getReceiveWindowTuningRTTNonConst())
+    .WillRepeatedly(Return(std::chrono::seconds(1)));
+  EXPECT_CALL(handler_, setTransaction(&txn));
+  EXPECT_CALL(handler_, onHeadersComplete(_));
+  EXPECT_CALL(handler_, onBody(_)).Times(4);
+  // The first update only starts the clock. The next ones come well within
+  // a round trip, so the window doubles each time, up to the limit
+  EXPECT_CALL(transport_, sendWindowUpdate(&txn, 200));
+  EXPECT_CALL(transport_, sendWindowUpdate(&txn, 600)).Times(2);
+  EXPECT_CALL(transport_, sendWindowUpdate(&txn, 1000));
+  EXPECT_CALL(transport_, sendAbort(&txn, _));
+  EXPECT_CALL(handler_, detachTransaction());
+  EXPECT_CALL(transport_, detach(&txn));
+
+  txn.setHandler(&handler_);
+  txn.onIngressHeadersComplete(makeGetRequest());
+  txn.onIngressBody(makeBuf(200), 0);
+  txn.onIngressBody(makeBuf(200), 0);
+  EXPECT_EQ(txn.getReceiveWindow().getCapacity(), 800);
+  txn.onIngressBody(makeBuf(400), 0);
+  EXPECT_EQ(txn.getReceiveWindow().getCapacity(), 1000);
+  // All of the window at once
+  txn.onIngressBody(makeBuf(1000), 0);
+  EXPECT_EQ(txn.getReceiveWindow().getCapacity(), 1000);
+
+  auto snapshot = stats.getSnapshot();
+  EXPECT_EQ(snapshot.get(ThreadLocalHTTPSessionStats::
+                         TRANSACTION_RECV_WINDOW_GROWN), 2);
+  EXPECT_EQ(snapshot.get(ThreadLocalHTTPSessionStats::
+                         TRANSACTION_RECV_WINDOW_FULL), 1);
+
+  txn.sendAbort();
+  eventBase_.loop();
+}
+
 TEST_F(DownstreamTransactionTest, parse_error_cbs) {
   // Test where the transaction gets on parse error and then a body
   // callback. This is possible because codecs are stateless between
@@ -320,6 +368,45 @@ TEST_F(DownstreamTransactionTest, deferred_egress) {
   txn.onError(err);
 }
 
+TEST_F(DownstreamTransactionTest, egress_quota) {
+  HTTPTransaction txn(
+    TransportDirection::DOWNSTREAM,
+    HTTPCodec::StreamID(1), 1, transport_,
+    txnEgressQueue_, transactionTimeouts_.get());
+
+  ON_CALL(transport_, getEgressBufferQuotaNonConst(_))
+    .WillByDefault(Return(100));
+  EXPECT_CALL(handler_, setTransaction(&txn));
+  EXPECT_CALL(handler_, onHeadersComplete(_))
+    .WillOnce(Invoke([&](std::shared_ptr<HTTPMessage> msg) {
+          auto response = makeResponse(200);
+          txn.sendHeaders(*response.get());
+          txn.sendBody(makeBuf(150));
+        }));
+  EXPECT_CALL(transport_, sendHeaders(&txn, _, _));
+  // Buffering more than its quota
+  EXPECT_CALL(handler_, onEgressPaused());
+
+  txn.setHandler(&handler_);
+  txn.onIngressHeadersComplete(makeGetRequest());
+  Mock::VerifyAndClearExpectations(&handler_);
+
+  // Back under it once some of the body is sent
+  EXPECT_CALL(transport_, sendBody(&txn, _, false))
+    .WillRepeatedly(Invoke([](Unused, std::shared_ptr<folly::IOBuf> body,
+                              Unused) {
+                             return body->computeChainDataLength();
+                           }));
+  EXPECT_CALL(handler_, onEgressResumed());
+  txn.onWriteReady(100);
+
+  EXPECT_CALL(handler_, onError(_));
+  EXPECT_CALL(handler_, detachTransaction());
+  EXPECT_CALL(transport_, detach(&txn));
+  HTTPException err(HTTPException::Direction::INGRESS_AND_EGRESS, "test");
+  txn.onError(err);
+}
+
 TEST_F(DownstreamTransactionTest, internal_error) {
   unique_ptr<StrictMock<MockHTTPHandler>> handler(
     new StrictMock<MockHTTPHandler>);
@@ -9,8 +9,12 @@
  */
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <chrono>
 #include <list>
 #include <map>
+#include <random>
+#include <set>
 #include <proxygen/lib/http/session/HTTP2PriorityQueue.h>
 
 using namespace std::placeholders;
@@ -70,6 +74,22 @@ class QueueTest : public testing::Test {
                   [] { return false; }, true);
   }
 
+  // Serve the queue for the given number of turns, each sending at most
+  // the node's allowance, and return the body bytes sent per stream
+  std::map<HTTPCodec::StreamID, uint64_t> drain(uint32_t turns) {
+    std::map<HTTPCodec::StreamID, uint64_t> sent;
+    for (uint32_t i = 0; i < turns; i++) {
+      auto h = q_.nextEgress();
+      if (!h) {
+        break;
+      }
+      uint32_t bytes = std::min<uint32_t>(h->egressAllowance(), 1000);
+      sent[h->getID()] += bytes;
+      q_.consumed(h, bytes);
+    }
+    return sent;
+  }
+
   HTTP2PriorityQueue q_;
   std::map<HTTPCodec::StreamID, HTTP2PriorityQueue::Handle> handles_;
   IDList nodes_;
@@ -211,6 +231,136 @@ TEST_F(QueueTest, Misc) {
   EXPECT_EQ(nodes_, IDList({{3, 25}, {5, 25}, {7, 50}}));
 }
 
+TEST_F(QueueTest, NextEgressEmpty) {
+  buildSimpleTree();
+  EXPECT_EQ(q_.nextEgress(), nullptr);
+  signalEgress(9, true);
+  signalEgress(9, false);
+  EXPECT_EQ(q_.nextEgress(), nullptr);
+}
+
+TEST_F(QueueTest, NextEgressParentFirst) {
+  buildSimpleTree();
+
+  // children only get bandwidth while their parent can't use it
+  signalEgress(1, true);
+  signalEgress(3, true);
+  signalEgress(9, true);
+  EXPECT_EQ(q_.nextEgress()->getID(), 1);
+  signalEgress(1, false);
+  auto sent = drain(100);
+  EXPECT_EQ(sent.size(), 2);
+  EXPECT_GT(sent[3], 0);
+  EXPECT_GT(sent[9], 0);
+}
+
+TEST_F(QueueTest, NextEgressWeighted) {
+  buildSimpleTree();
+
+  // 3 and 5 have weight 4 and 7 has weight 8 under 1; 9 inherits 5's share
+  signalEgress(3, true);
+  signalEgress(7, true);
+  signalEgress(9, true);
+  auto sent = drain(10000);
+  double total = sent[3] + sent[7] + sent[9];
+  EXPECT_NEAR(sent[3] / total, 5.0 / 19, 0.01);
+  EXPECT_NEAR(sent[9] / total, 5.0 / 19, 0.01);
+  EXPECT_NEAR(sent[7] / total, 9.0 / 19, 0.01);
+
+  // the share of a stream that goes idle is split among the rest
+  signalEgress(7, false);
+  sent = drain(10000);
+  EXPECT_EQ(sent.count(7), 0);
+  EXPECT_NEAR(double(sent[3]) / sent[9], 1.0, 0.01);
+}
+
+TEST_F(QueueTest, NextEgressAfterUpdate) {
+  buildSimpleTree();
+
+  signalEgress(3, true);
+  signalEgress(9, true);
+  // make 3 depend exclusively on 9, so 9 is always served first
+  updatePriority(3, {9, true, 16});
+  for (uint32_t i = 0; i < 10; i++) {
+    EXPECT_EQ(q_.nextEgress()->getID(), 9);
+    q_.consumed(q_.nextEgress(), 1000);
+  }
+  removeTransaction(9);
+  EXPECT_EQ(q_.nextEgress()->getID(), 3);
+  removeTransaction(3);
+  EXPECT_EQ(q_.nextEgress(), nullptr);
+  EXPECT_TRUE(q_.empty());
+}
+
+/*
+ * Browsers re-parent streams with exclusive PRIORITY frames all the time;
+ * churn a large tree that way and check it stays consistent.
+ */
+TEST_F(QueueTest, ExclusiveChurnStress) {
+  const uint32_t kStreams = 1000;
+  const uint32_t kUpdates = 200000;
+  std::mt19937 rng(42);
+  auto randomID = [&] {
+    return HTTPCodec::StreamID(rng() % kStreams) * 2 + 1;
+  };
+  for (uint32_t i = 0; i < kStreams; i++) {
+    HTTPCodec::StreamID id = i * 2 + 1;
+    addTransaction(id, {i > 0 ? randomID() % (id) : 0, false,
+                        uint8_t(rng())});
+  }
+
+  std::map<HTTPCodec::StreamID, bool> pending;
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < kUpdates; i++) {
+    HTTPCodec::StreamID id = randomID();
+    switch (rng() % 8) {
+      case 0:
+        // stream closes and the ID comes back for a new one
+        if (pending[id]) {
+          pending[id] = false;
+        }
+        removeTransaction(id);
+        addTransaction(id, {randomID(), rng() % 2 == 0, uint8_t(rng())});
+        break;
+      case 1:
+        pending[id] = !pending[id];
+        signalEgress(id, pending[id]);
+        break;
+      default:
+        updatePriority(id, {randomID(), true, uint8_t(rng())});
+    }
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - start);
+  VLOG(1) << "ns per tree mutation: " << elapsed.count() / kUpdates;
+
+  // every stream is still in the tree exactly once
+  dump();
+  EXPECT_EQ(nodes_.size(), kStreams);
+  std::set<HTTPCodec::StreamID> ids;
+  for (auto& node: nodes_) {
+    ids.insert(node.first);
+  }
+  EXPECT_EQ(ids.size(), kStreams);
+
+  // and the scheduler serves exactly the pending ones
+  uint32_t numPending = 0;
+  std::set<HTTPCodec::StreamID> served;
+  for (auto& p: pending) {
+    numPending += p.second ? 1 : 0;
+  }
+  EXPECT_EQ(q_.numPendingEgress(), numPending);
+  while (!q_.empty()) {
+    auto h = q_.nextEgress();
+    ASSERT_NE(h, nullptr);
+    EXPECT_TRUE(pending[h->getID()]);
+    served.insert(h->getID());
+    signalEgress(h->getID(), false);
+  }
+  EXPECT_EQ(served.size(), numPending);
+  EXPECT_EQ(q_.nextEgress(), nullptr);
+}
+
 TEST_F(QueueTest, BreadthFirst) {
   buildSimpleTree();
 
@@ -8,6 +8,7 @@
  *
  */
 #include <folly/Conv.h>
+#include <folly/FileUtil.h>
 #include <folly/Foreach.h>
 #include <folly/wangle/acceptor/ConnectionManager.h>
 #include <folly/io/Cursor.h>
@@ -20,11 +21,15 @@
 #include <proxygen/lib/http/session/HTTPDirectResponseHandler.h>
 #include <proxygen/lib/http/session/HTTPDownstreamSession.h>
 #include <proxygen/lib/http/session/HTTPSession.h>
+#include <proxygen/lib/http/session/ThreadLocalHTTPSessionStats.h>
 #include <proxygen/lib/http/session/test/HTTPSessionMocks.h>
 #include <proxygen/lib/http/session/test/HTTPSessionTest.h>
 #include <proxygen/lib/http/session/test/MockByteEventTracker.h>
 #include <proxygen/lib/http/session/test/TestUtils.h>
 #include <proxygen/lib/test/TestAsyncTransport.h>
+#include <proxygen/lib/utils/ReadBufferPool.h>
+#include <proxygen/lib/utils/TraceEvent.h>
+#include <proxygen/lib/utils/TraceEventObserver.h>
 #include <string>
 #include <strstream>
 #include <folly/io/async/test/MockAsyncTransport.h>
@@ -175,6 +180,46 @@ TEST_F(HTTPDownstreamSessionTest, http_1_0_no_headers) {
   eventBase_.loop();
 }
 
+TEST_F(HTTPDownstreamSessionTest, info_callback_subscribed_events) {
+  // Only the events subscribed to, with the bytes batched per loop
+  StrictMock<MockHTTPSessionInfoCallback> infoCb;
+  infoCb.events = HTTPSession::InfoCallback::REQUEST_BEGIN |
+    HTTPSession::InfoCallback::BATCHED_BYTES;
+  httpSession_->setInfoCallback(&infoCb);
+  size_t bytesRead = 0;
+  size_t bytesWritten = 0;
+  EXPECT_CALL(infoCb, onRequestBegin(_));
+  EXPECT_CALL(infoCb, onTransportBytes(_, _, _))
+    .WillRepeatedly(Invoke([&] (const HTTPSession&, size_t read,
+                                size_t written) {
+          bytesRead += read;
+          bytesWritten += written;
+        }));
+  EXPECT_CALL(infoCb, onDestroy(_));
+
+  MockHTTPHandler* handler = new MockHTTPHandler();
+  EXPECT_CALL(mockController_, getRequestHandler(_, _))
+    .WillOnce(Return(handler));
+  EXPECT_CALL(*handler, setTransaction(_))
+    .WillOnce(SaveArg<0>(&handler->txn_));
+  EXPECT_CALL(*handler, onHeadersComplete(_));
+  EXPECT_CALL(*handler, onEOM())
+    .WillOnce(InvokeWithoutArgs([&] {
+          handler->sendReplyWithBody(200, 100, false);
+        }));
+  EXPECT_CALL(*handler, detachTransaction())
+    .WillOnce(InvokeWithoutArgs([&] { delete handler; }));
+  EXPECT_CALL(mockController_, detachSession(_));
+
+  const std::string request("GET / HTTP/1.0\r\n\r\n");
+  transport_->addReadEvent(request.c_str(), std::chrono::milliseconds(0));
+  transport_->startReadEvents();
+  eventBase_.loop();
+
+  EXPECT_EQ(bytesRead, request.size());
+  EXPECT_GT(bytesWritten, 100);
+}
+
 TEST_F(HTTPDownstreamSessionTest, http_1_0_no_headers_eof) {
   MockHTTPHandler* handler = new MockHTTPHandler();
 
@@ -249,6 +294,104 @@ TEST_F(HTTPDownstreamSessionTest, single_bytes) {
   eventBase_.loop();
 }
 
+TEST_F(HTTPDownstreamSessionTest, read_buffer_pool) {
+  // Each byte read lands in a buffer borrowed from the pool, which goes
+  // back once the parser consumed it
+  HTTPSession::setUseReadBufferPool(true);
+  ReadBufferPool::clear();
+  ReadBufferPool::takeCounts();
+  MockHTTPHandler* handler = new MockHTTPHandler();
+
+  InSequence dummy;
+  EXPECT_CALL(mockController_, getRequestHandler(_, _))
+    .WillOnce(Return(handler));
+
+  EXPECT_CALL(*handler, setTransaction(_))
+    .WillOnce(SaveArg<0>(&handler->txn_));
+  EXPECT_CALL(*handler, onHeadersComplete(_));
+  EXPECT_CALL(*handler, onEOM())
+    .WillOnce(InvokeWithoutArgs(handler, &MockHTTPHandler::terminate));
+  EXPECT_CALL(*handler, detachTransaction())
+    .WillOnce(InvokeWithoutArgs([&] { delete handler; }));
+
+  EXPECT_CALL(mockController_, detachSession(_));
+
+  const char* request = "GET / HTTP/1.1\r\n"
+    "Host: example.com\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+  addSingleByteReads(request);
+  transport_->addReadEOF(std::chrono::milliseconds(0));
+  transport_->startReadEvents();
+  eventBase_.loop();
+
+  auto counts = ReadBufferPool::takeCounts();
+  EXPECT_LE(counts.allocated, 2);
+  EXPECT_GT(counts.reused, strlen(request) / 2);
+  EXPECT_GT(ReadBufferPool::getNumIdleBuffers(), 0);
+  HTTPSession::setUseReadBufferPool(false);
+  ReadBufferPool::clear();
+}
+
+TEST_F(HTTPDownstreamSessionTest, reject_unsafe_early_data) {
+  // Of the requests sent as early data, the GET goes to its handler and
+  // the POST is turned away for the client to retry
+  httpSession_->setRejectUnsafeEarlyData(true);
+  HTTP1xCodec clientCodec(TransportDirection::UPSTREAM);
+  IOBufQueue requests{IOBufQueue::cacheChainLength()};
+  HTTPMessage get = getGetRequest();
+  get.getHeaders().set(HTTP_HEADER_EARLY_DATA, "1");
+  auto streamID = clientCodec.createStream();
+  clientCodec.generateHeader(requests, streamID, get);
+  clientCodec.generateEOM(requests, streamID);
+  HTTPMessage post = getPostRequest();
+  post.getHeaders().set(HTTP_HEADER_EARLY_DATA, "1");
+  post.getHeaders().set(HTTP_HEADER_CONTENT_LENGTH, "10");
+  streamID = clientCodec.createStream();
+  clientCodec.generateHeader(requests, streamID, post);
+  clientCodec.generateBody(requests, streamID, makeBuf(10), boost::none,
+                           true);
+
+  MockHTTPHandler handler;
+  InSequence dummy;
+  EXPECT_CALL(mockController_, getRequestHandler(_, _))
+    .WillOnce(Return(&handler));
+  EXPECT_CALL(handler, setTransaction(_))
+    .WillOnce(SaveArg<0>(&handler.txn_));
+  EXPECT_CALL(handler, onHeadersComplete(_));
+  EXPECT_CALL(handler, onEOM())
+    .WillOnce(InvokeWithoutArgs([&handler] {
+          handler.sendReplyWithBody(200, 100);
+        }));
+  EXPECT_CALL(handler, detachTransaction());
+  EXPECT_CALL(mockController_, getParseErrorHandler(_, _, _))
+    .WillOnce(Invoke([] (HTTPTransaction*, const HTTPException& error,
+                         const folly::SocketAddress&) {
+          EXPECT_EQ(error.getHttpStatusCode(), 425);
+          EXPECT_EQ(error.getProxygenError(), kErrorEarlyDataRejected);
+          return new HTTPDirectResponseHandler(425, "Too Early");
+        }));
+  EXPECT_CALL(mockController_, detachSession(_));
+
+  unique_ptr<IOBuf> head = requests.move();
+  head->coalesce();
+  transport_->addReadEvent(head->data(), head->length(),
+                           std::chrono::milliseconds(0));
+  transport_->startReadEvents();
+  eventBase_.loop();
+
+  NiceMock<MockHTTPCodecCallback> callbacks;
+  std::vector<unsigned> statuses;
+  EXPECT_CALL(callbacks, onHeadersComplete(_, _))
+    .WillRepeatedly(Invoke([&] (HTTPCodec::StreamID,
+                                std::shared_ptr<HTTPMessage> msg) {
+          statuses.push_back(msg->getStatusCode());
+        }));
+  clientCodec.setCallback(&callbacks);
+  parseOutput(clientCodec);
+  EXPECT_EQ(statuses, std::vector<unsigned>({200, 425}));
+}
+
 TEST_F(HTTPDownstreamSessionTest, single_bytes_with_body) {
   MockHTTPHandler* handler = new MockHTTPHandler();
 
@@ -333,6 +476,100 @@ TEST_F(HTTPDownstreamSessionTest, split_body) {
   eventBase_.loop();
 }
 
+TEST_F(HTTPDownstreamSessionTest, splice_ingress_body) {
+  // Echo the request body through a splice, without any onBody()
+  MockHTTPHandler handler;
+
+  InSequence handlerSequence;
+  EXPECT_CALL(mockController_, getRequestHandler(_, _))
+    .WillOnce(Return(&handler));
+  EXPECT_CALL(handler, setTransaction(_))
+    .WillOnce(Invoke([&handler] (HTTPTransaction* txn) {
+          handler.txn_ = txn; }));
+  EXPECT_CALL(handler, onHeadersComplete(_))
+    .WillOnce(InvokeWithoutArgs([&handler] {
+          handler.sendHeaders(200, 10);
+          handler.txn_->spliceIngressBody(handler.txn_);
+          EXPECT_EQ(handler.txn_->getIngressBodySplice(), handler.txn_);
+        }));
+  EXPECT_CALL(handler, onBody(_))
+    .Times(0);
+  EXPECT_CALL(handler, onEOM())
+    .WillOnce(InvokeWithoutArgs([&handler] {
+          EXPECT_EQ(handler.txn_->getIngressBodySplice(), nullptr);
+          EXPECT_TRUE(handler.txn_->isEgressEOMSeen());
+        }));
+  EXPECT_CALL(handler, detachTransaction());
+  EXPECT_CALL(mockController_, detachSession(_));
+
+  transport_->addReadEvent("POST / HTTP/1.1\r\n"
+                           "Host: example.com\r\n"
+                           "Content-Length: 10\r\n"
+                           "\r\n"
+                           "12345", std::chrono::milliseconds(0));
+  transport_->addReadEvent("abcde", std::chrono::milliseconds(5));
+  transport_->addReadEOF(std::chrono::milliseconds(0));
+  transport_->startReadEvents();
+  HTTPSession::DestructorGuard g(httpSession_);
+  eventBase_.loop();
+
+  HTTP1xCodec clientCodec(TransportDirection::UPSTREAM);
+  NiceMock<MockHTTPCodecCallback> callbacks;
+  std::string body;
+  EXPECT_CALL(callbacks, onBody(1, _, _))
+    .WillRepeatedly(Invoke([&body] (HTTPCodec::StreamID,
+                                    std::shared_ptr<folly::IOBuf> chain,
+                                    uint16_t) {
+          body += chain->moveToFbString().toStdString();
+        }));
+  EXPECT_CALL(callbacks, onMessageComplete(1, _));
+  clientCodec.setCallback(&callbacks);
+  parseOutput(clientCodec);
+  EXPECT_EQ(body, "12345abcde");
+}
+
+TEST_F(HTTPDownstreamSessionTest, adaptive_read_size) {
+  // A large upload delivered in one burst should be read with a growing
+  // read buffer instead of fixed 4000 byte reads
+  const size_t kBodySize = 200000;
+  MockHTTPHandler* handler = new MockHTTPHandler();
+  size_t bodyBytes = 0;
+  size_t bodyCalls = 0;
+
+  InSequence dummy;
+  EXPECT_CALL(mockController_, getRequestHandler(_, _))
+    .WillOnce(Return(handler));
+
+  EXPECT_CALL(*handler, setTransaction(_))
+    .WillOnce(SaveArg<0>(&handler->txn_));
+  EXPECT_CALL(*handler, onHeadersComplete(_));
+  EXPECT_CALL(*handler, onBody(_))
+    .WillRepeatedly(Invoke([&] (std::shared_ptr<folly::IOBuf> chain) {
+          bodyBytes += chain->computeChainDataLength();
+          bodyCalls++;
+        }));
+  EXPECT_CALL(*handler, onEOM())
+    .WillOnce(InvokeWithoutArgs(handler, &MockHTTPHandler::terminate));
+  EXPECT_CALL(*handler, detachTransaction())
+    .WillOnce(InvokeWithoutArgs([&] { delete handler; }));
+
+  EXPECT_CALL(mockController_, detachSession(_));
+
+  std::string request = folly::to<std::string>(
+    "POST / HTTP/1.1\r\n"
+    "Host: example.com\r\n"
+    "Content-Length: ", kBodySize, "\r\n"
+    "\r\n", std::string(kBodySize, 'a'));
+  transport_->addReadEvent(request.data(), request.size(),
+                           std::chrono::milliseconds(0));
+  transport_->addReadEOF(std::chrono::milliseconds(0));
+  transport_->startReadEvents();
+  eventBase_.loop();
+
+  EXPECT_EQ(kBodySize, bodyBytes);
+  EXPECT_LT(bodyCalls, kBodySize / 4000 / 2);
+}
+
 TEST_F(HTTPDownstreamSessionTest, post_chunked) {
   MockHTTPHandler* handler = new MockHTTPHandler();
 
@@ -647,6 +884,28 @@ TEST(HTTPDownstreamTest, byte_events_drained) {
   evb.loop();
 }
 
+TEST(HTTPDownstreamTest, byte_events_pooled) {
+  // Events processed free their slots for the next ones
+  struct : public ByteEventTracker::Callback {
+    void onPingReplyLatency(int64_t) noexcept override { replies++; }
+    uint64_t getAppBytesWritten() noexcept override { return 0; }
+    uint64_t getRawBytesWritten() noexcept override { return 0; }
+    void onDeleteAckEvent() override {}
+    size_t replies{0};
+  } callback;
+  ByteEventTracker tracker(&callback);
+
+  tracker.addPingByteEvent(17, getCurrentTime(), 0);
+  tracker.processByteEvents(17, false);
+  ByteEvent::takePoolCounts();
+  tracker.addPingByteEvent(17, getCurrentTime(), 17);
+  tracker.processByteEvents(34, false);
+  EXPECT_EQ(2, callback.replies);
+  auto counts = ByteEvent::takePoolCounts();
+  EXPECT_EQ(0, counts.allocated);
+  EXPECT_EQ(1, counts.reused);
+}
+
 TEST_F(HTTPDownstreamSessionTest, trailers) {
   testChunks(true);
 }
@@ -687,11 +946,12 @@ void HTTPDownstreamTest<C>::testChunks(bool trailers) {
     .Times(1);
   EXPECT_CALL(callbacks, onHeadersComplete(1, _))
     .Times(1);
-  for (int i = 0; i < 6; i++) {
-    EXPECT_CALL(callbacks, onChunkHeader(1, _));
-    EXPECT_CALL(callbacks, onBody(1, _, _));
-    EXPECT_CALL(callbacks, onChunkComplete(1));
-  }
+  // The six chunks were all buffered by the time they were sent, so they
+  // went out as one
+  EXPECT_CALL(callbacks, onChunkHeader(1, 100));
+  EXPECT_CALL(callbacks, onBody(1, _, _))
+    .Times(AtLeast(1));
+  EXPECT_CALL(callbacks, onChunkComplete(1));
   if (trailers) {
     EXPECT_CALL(callbacks, onTrailersComplete(1, _));
   }
@@ -702,6 +962,157 @@ void HTTPDownstreamTest<C>::testChunks(bool trailers) {
   EXPECT_CALL(mockController_, detachSession(_));
 }
 
+TEST_F(HTTPDownstreamSessionTest, explicit_chunks_not_buffered) {
+  StrictMock<MockHTTPHandler> handler;
+
+  InSequence dummy;
+
+  EXPECT_CALL(mockController_, getRequestHandler(_, _))
+    .WillOnce(Return(&handler));
+
+  EXPECT_CALL(handler, setTransaction(_))
+    .WillOnce(SaveArg<0>(&handler.txn_));
+  EXPECT_CALL(handler, onHeadersComplete(_));
+  EXPECT_CALL(handler, onEOM())
+    .WillOnce(InvokeWithoutArgs([&handler, this] () {
+          HTTPMessage reply;
+          reply.setStatusCode(200);
+          reply.setHTTPVersion(1, 1);
+          reply.setIsChunked(true);
+          handler.txn_->sendHeaders(reply);
+          handler.txn_->sendChunkHeader(10);
+          handler.txn_->sendBody(makeBuf(10));
+          handler.txn_->sendChunkTerminator();
+          // Only half of the second chunk is there when they are sent
+          handler.txn_->sendChunkHeader(20);
+          handler.txn_->sendBody(makeBuf(10));
+          eventBase_.tryRunAfterDelay([&handler] {
+              handler.txn_->sendBody(makeBuf(10));
+              handler.txn_->sendChunkTerminator();
+              handler.txn_->sendEOM();
+            }, 10);
+        }));
+  EXPECT_CALL(handler, detachTransaction());
+
+  transport_->addReadEvent("GET / HTTP/1.1\r\n"
+                           "\r\n", std::chrono::milliseconds(0));
+  transport_->addReadEOF(std::chrono::milliseconds(0));
+  transport_->startReadEvents();
+  HTTPSession::DestructorGuard g(httpSession_);
+  eventBase_.loop();
+
+  HTTP1xCodec clientCodec(TransportDirection::UPSTREAM);
+  NiceMock<MockHTTPCodecCallback> callbacks;
+
+  EXPECT_CALL(callbacks, onMessageBegin(1, _));
+  EXPECT_CALL(callbacks, onHeadersComplete(1, _));
+  EXPECT_CALL(callbacks, onChunkHeader(1, 10));
+  EXPECT_CALL(callbacks, onBody(1, _, _));
+  EXPECT_CALL(callbacks, onChunkComplete(1));
+  EXPECT_CALL(callbacks, onChunkHeader(1, 20));
+  EXPECT_CALL(callbacks, onBody(1, _, _))
+    .Times(AtLeast(1));
+  EXPECT_CALL(callbacks, onChunkComplete(1));
+  EXPECT_CALL(callbacks, onMessageComplete(1, _));
+
+  clientCodec.setCallback(&callbacks);
+  parseOutput(clientCodec);
+  EXPECT_CALL(mockController_, detachSession(_));
+}
+
+TEST_F(HTTPDownstreamSessionTest, headers_with_eom) {
+  StrictMock<MockHTTPHandler> handler;
+
+  InSequence dummy;
+
+  EXPECT_CALL(mockController_, getRequestHandler(_, _))
+    .WillOnce(Return(&handler));
+
+  EXPECT_CALL(handler, setTransaction(_))
+    .WillOnce(SaveArg<0>(&handler.txn_));
+  EXPECT_CALL(handler, onHeadersComplete(_));
+  EXPECT_CALL(handler, onEOM())
+    .WillOnce(InvokeWithoutArgs([&handler] () {
+          HTTPMessage reply;
+          reply.setStatusCode(200);
+          reply.setHTTPVersion(1, 1);
+          reply.getHeaders().set(HTTP_HEADER_CONTENT_LENGTH, "0");
+          handler.txn_->sendHeadersWithEOM(reply);
+        }));
+  EXPECT_CALL(handler, detachTransaction());
+
+  transport_->addReadEvent("GET / HTTP/1.1\r\n"
+                           "\r\n", std::chrono::milliseconds(0));
+  transport_->addReadEOF(std::chrono::milliseconds(0));
+  transport_->startReadEvents();
+  HTTPSession::DestructorGuard g(httpSession_);
+  eventBase_.loop();
+
+  HTTP1xCodec clientCodec(TransportDirection::UPSTREAM);
+  NiceMock<MockHTTPCodecCallback> callbacks;
+
+  EXPECT_CALL(callbacks, onMessageBegin(1, _));
+  EXPECT_CALL(callbacks, onHeadersComplete(1, _));
+  EXPECT_CALL(callbacks, onBody(1, _, _))
+    .Times(0);
+  EXPECT_CALL(callbacks, onMessageComplete(1, _));
+
+  clientCodec.setCallback(&callbacks);
+  parseOutput(clientCodec);
+  EXPECT_CALL(mockController_, detachSession(_));
+}
+
+TEST_F(HTTPDownstreamSessionTest, headers_with_body_and_eom) {
+  StrictMock<MockHTTPHandler> handler;
+
+  InSequence dummy;
+
+  EXPECT_CALL(mockController_, getRequestHandler(_, _))
+    .WillOnce(Return(&handler));
+
+  EXPECT_CALL(handler, setTransaction(_))
+    .WillOnce(SaveArg<0>(&handler.txn_));
+  EXPECT_CALL(handler, onHeadersComplete(_));
+  EXPECT_CALL(handler, onEOM())
+    .WillOnce(InvokeWithoutArgs([&handler] () {
+          HTTPMessage reply;
+          reply.setStatusCode(200);
+          reply.setHTTPVersion(1, 1);
+          reply.getHeaders().set(HTTP_HEADER_CONTENT_LENGTH, "100");
+          handler.txn_->sendHeadersWithBodyAndEOM(reply, makeBuf(100));
+        }));
+  EXPECT_CALL(handler, detachTransaction());
+
+  transport_->addReadEvent("GET / HTTP/1.1\r\n"
+                           "\r\n", std::chrono::milliseconds(0));
+  transport_->addReadEOF(std::chrono::milliseconds(0));
+  transport_->startReadEvents();
+  HTTPSession::DestructorGuard g(httpSession_);
+  eventBase_.loop();
+
+  // The whole response went out in one write
+  EXPECT_EQ(transport_->getWriteEvents()->size(), 1);
+
+  HTTP1xCodec clientCodec(TransportDirection::UPSTREAM);
+  NiceMock<MockHTTPCodecCallback> callbacks;
+  size_t bodyLen = 0;
+
+  EXPECT_CALL(callbacks, onMessageBegin(1, _));
+  EXPECT_CALL(callbacks, onHeadersComplete(1, _));
+  EXPECT_CALL(callbacks, onBody(1, _, _))
+    .WillRepeatedly(Invoke([&] (HTTPCodec::StreamID,
+                                std::shared_ptr<folly::IOBuf> chain,
+                                uint16_t) {
+          bodyLen += chain->computeChainDataLength();
+        }));
+  EXPECT_CALL(callbacks, onMessageComplete(1, _));
+
+  clientCodec.setCallback(&callbacks);
+  parseOutput(clientCodec);
+  EXPECT_EQ(bodyLen, 100);
+  EXPECT_CALL(mockController_, detachSession(_));
+}
+
 TEST_F(HTTPDownstreamSessionTest, http_drain) {
   StrictMock<MockHTTPHandler> handler1;
   StrictMock<MockHTTPHandler> handler2;
@@ -880,16 +1291,138 @@ TEST_F(SPDY3DownstreamSessionTest, http_paused_buffered) {
   transport_->startReadEvents();
   eventBase_.loop();
 }
-TEST_F(HTTPDownstreamSessionTest, http_writes_draining_timeout) {
-  IOBufQueue requests{IOBufQueue::cacheChainLength()};
+TEST_F(SPDY3DownstreamSessionTest, spdy_write_pipelining) {
+  IOBufQueue requests1{IOBufQueue::cacheChainLength()};
+  IOBufQueue requests2{IOBufQueue::cacheChainLength()};
   HTTPMessage req = getGetRequest();
   MockHTTPHandler handler1;
-  HTTP1xCodec clientCodec(TransportDirection::UPSTREAM);
-  auto streamID = HTTPCodec::StreamID(0);
-  clientCodec.generateConnectionPreface(requests);
-  clientCodec.generateHeader(requests, streamID, req);
-  clientCodec.generateEOM(requests, streamID);
-  clientCodec.generateHeader(requests, streamID, req);
+  MockHTTPHandler handler2;
+  SPDYCodec clientCodec(TransportDirection::UPSTREAM,
+                        SPDYVersion::SPDY3);
+  auto streamID = HTTPCodec::StreamID(1);
+  clientCodec.generateConnectionPreface(requests1);
+  clientCodec.generateHeader(requests1, streamID, req);
+  clientCodec.generateEOM(requests1, streamID);
+  streamID += 2;
+  clientCodec.generateHeader(requests2, streamID, req);
+  clientCodec.generateEOM(requests2, streamID);
+
+  // Allow the second response to be handed to the transport while the
+  // first is still outstanding
+  httpSession_->setMaxActiveWrites(2);
+
+  EXPECT_CALL(mockController_, getRequestHandler(_, _))
+    .WillOnce(Return(&handler1))
+    .WillOnce(Return(&handler2));
+
+  EXPECT_CALL(handler1, setTransaction(_))
+    .WillOnce(Invoke([&handler1] (HTTPTransaction* txn) {
+          handler1.txn_ = txn; }));
+  EXPECT_CALL(handler1, onHeadersComplete(_));
+  EXPECT_CALL(handler1, onEOM())
+    .WillOnce(InvokeWithoutArgs([&handler1, this] {
+          transport_->pauseWrites();
+          handler1.sendReplyWithBody(200, 100);
+        }));
+  EXPECT_CALL(handler1, detachTransaction());
+  EXPECT_CALL(handler2, setTransaction(_))
+    .WillOnce(Invoke([&handler2] (HTTPTransaction* txn) {
+          handler2.txn_ = txn; }));
+  EXPECT_CALL(handler2, onHeadersComplete(_));
+  EXPECT_CALL(handler2, onEOM())
+    .WillOnce(InvokeWithoutArgs([&handler2, this] {
+          EXPECT_FALSE(httpSession_->writesPaused());
+          handler2.sendReplyWithBody(200, 100);
+          eventBase_.runAfterDelay([this] {
+              // Both responses are outstanding on the transport
+              EXPECT_TRUE(httpSession_->writesPaused());
+              transport_->resumeWrites();
+            }, 10);
+        }));
+  EXPECT_CALL(handler2, detachTransaction());
+
+  transport_->addReadEvent(requests1, std::chrono::milliseconds(10));
+  transport_->addReadEvent(requests2, std::chrono::milliseconds(10));
+  transport_->startReadEvents();
+  eventBase_.loop();
+
+  NiceMock<MockHTTPCodecCallback> callbacks;
+  EXPECT_CALL(callbacks, onMessageComplete(_, _))
+    .Times(2);
+  clientCodec.setCallback(&callbacks);
+  parseOutput(clientCodec);
+}
+
+TEST_F(SPDY3DownstreamSessionTest, spdy_egress_round_robin) {
+  IOBufQueue requests{IOBufQueue::cacheChainLength()};
+  HTTPMessage req = getGetRequest();
+  MockHTTPHandler handler1;
+  MockHTTPHandler handler2;
+  SPDYCodec clientCodec(TransportDirection::UPSTREAM,
+                        SPDYVersion::SPDY3);
+  auto streamID = HTTPCodec::StreamID(1);
+  clientCodec.generateConnectionPreface(requests);
+  clientCodec.generateHeader(requests, streamID, req);
+  clientCodec.generateEOM(requests, streamID);
+  streamID += 2;
+  clientCodec.generateHeader(requests, streamID, req);
+  clientCodec.generateEOM(requests, streamID);
+
+  EXPECT_EQ(httpSession_->getEgressQuantum(), 4096);
+  httpSession_->setEgressQuantum(2048);
+
+  EXPECT_CALL(mockController_, getRequestHandler(_, _))
+    .WillOnce(Return(&handler1))
+    .WillOnce(Return(&handler2));
+
+  // a large download and a tiny response share the connection
+  EXPECT_CALL(handler1, setTransaction(_))
+    .WillOnce(Invoke([&handler1] (HTTPTransaction* txn) {
+          handler1.txn_ = txn; }));
+  EXPECT_CALL(handler1, onHeadersComplete(_));
+  EXPECT_CALL(handler1, onEOM())
+    .WillOnce(InvokeWithoutArgs([&handler1] {
+          handler1.sendReplyWithBody(200, 20000);
+        }));
+  EXPECT_CALL(handler1, detachTransaction());
+  EXPECT_CALL(handler2, setTransaction(_))
+    .WillOnce(Invoke([&handler2] (HTTPTransaction* txn) {
+          handler2.txn_ = txn; }));
+  EXPECT_CALL(handler2, onHeadersComplete(_));
+  EXPECT_CALL(handler2, onEOM())
+    .WillOnce(InvokeWithoutArgs([&handler2] {
+          handler2.sendReplyWithBody(200, 100);
+        }));
+  EXPECT_CALL(handler2, detachTransaction());
+
+  transport_->addReadEvent(requests, std::chrono::milliseconds(10));
+  transport_->startReadEvents();
+  eventBase_.loop();
+
+  // both responses go out in a single write after the SETTINGS frame,
+  // and the small one is not stuck behind the large one
+  EXPECT_LE(transport_->getWriteEvents()->size(), 2);
+  NiceMock<MockHTTPCodecCallback> callbacks;
+  std::vector<HTTPCodec::StreamID> completed;
+  EXPECT_CALL(callbacks, onMessageComplete(_, _))
+    .WillRepeatedly(Invoke([&completed] (HTTPCodec::StreamID id, bool) {
+          completed.push_back(id);
+        }));
+  clientCodec.setCallback(&callbacks);
+  parseOutput(clientCodec);
+  EXPECT_EQ(completed, std::vector<HTTPCodec::StreamID>({3, 1}));
+}
+
+TEST_F(HTTPDownstreamSessionTest, http_writes_draining_timeout) {
+  IOBufQueue requests{IOBufQueue::cacheChainLength()};
+  HTTPMessage req = getGetRequest();
+  MockHTTPHandler handler1;
+  HTTP1xCodec clientCodec(TransportDirection::UPSTREAM);
+  auto streamID = HTTPCodec::StreamID(0);
+  clientCodec.generateConnectionPreface(requests);
+  clientCodec.generateHeader(requests, streamID, req);
+  clientCodec.generateEOM(requests, streamID);
+  clientCodec.generateHeader(requests, streamID, req);
 
   EXPECT_CALL(mockController_, getRequestHandler(_, _))
     .WillOnce(Return(&handler1));
@@ -922,10 +1455,6 @@ TEST_F(HTTPDownstreamSessionTest, http_writes_draining_timeout) {
 }
 
 TEST_F(HTTPDownstreamSessionTest, http_rate_limit_normal) {
-  // The rate-limiting code grabs the event base from the EventBaseManager,
-  // so we need to set it.
-  folly::EventBaseManager::get()->setEventBase(&eventBase_, false);
-
   // Create a request
   IOBufQueue requests{IOBufQueue::cacheChainLength()};
   HTTPMessage req = getGetRequest();
@@ -978,11 +1507,63 @@ TEST_F(HTTPDownstreamSessionTest, http_rate_limit_normal) {
   EXPECT_GT(writeDuration, 800);
 }
 
-TEST_F(SPDY3DownstreamSessionTest, spdy_rate_limit_normal) {
-  // The rate-limiting code grabs the event base from the EventBaseManager,
-  // so we need to set it.
-  folly::EventBaseManager::get()->setEventBase(&eventBase_, false);
+TEST_F(HTTPDownstreamSessionTest, http_rate_limit_burst) {
+  IOBufQueue requests{IOBufQueue::cacheChainLength()};
+  HTTPMessage req = getGetRequest();
+  MockHTTPHandler handler1;
+  HTTP1xCodec clientCodec(TransportDirection::UPSTREAM);
+  auto streamID = HTTPCodec::StreamID(0);
+  clientCodec.generateConnectionPreface(requests);
+  clientCodec.generateHeader(requests, streamID, req);
+  clientCodec.generateEOM(requests, streamID);
+  const uint32_t burst = 20000;
+
+  EXPECT_CALL(mockController_, getRequestHandler(_, _))
+    .WillRepeatedly(Return(&handler1));
+
+  EXPECT_CALL(handler1, setTransaction(_))
+    .WillOnce(Invoke([&handler1, burst] (HTTPTransaction* txn) {
+      uint32_t rateLimit_kbps = 640;
+      txn->setEgressRateLimit(rateLimit_kbps * 1024, burst);
+      handler1.txn_ = txn;
+    }));
+
+  InSequence handlerSequence;
+  EXPECT_CALL(handler1, onHeadersComplete(_));
+  EXPECT_CALL(handler1, onEOM())
+    .WillOnce(InvokeWithoutArgs([&handler1, this] {
+          // At 640kbps, the 80000 bytes past the burst take about 1s
+          uint32_t rspLengthBytes = 100000;
+          handler1.sendHeaders(200, rspLengthBytes);
+          handler1.sendBody(rspLengthBytes);
+          handler1.txn_->sendEOM();
+        }));
+  EXPECT_CALL(handler1, detachTransaction());
+
+  transport_->addReadEvent(requests, std::chrono::milliseconds(10));
+  transport_->startReadEvents();
 
+  HTTPSession::DestructorGuard g(httpSession_);
+  eventBase_.loop();
+
+  // No write is over the burst, plus the headers
+  auto writeEvents = transport_->getWriteEvents();
+  size_t largestWrite = 0;
+  for (auto event: *writeEvents) {
+    size_t length = 0;
+    for (size_t i = 0; i < event->getCount(); i++) {
+      length += event->getIoVec()[i].iov_len;
+    }
+    largestWrite = std::max(largestWrite, length);
+  }
+  EXPECT_GT(writeEvents->size(), 2);
+  EXPECT_LE(largestWrite, burst + 200);
+  int64_t writeDuration = (int64_t)millisecondsBetween(
+    writeEvents->back()->getTime(), writeEvents->front()->getTime()).count();
+  EXPECT_GT(writeDuration, 900);
+}
+
+TEST_F(SPDY3DownstreamSessionTest, spdy_rate_limit_normal) {
   IOBufQueue requests{IOBufQueue::cacheChainLength()};
   HTTPMessage req = getGetRequest();
   MockHTTPHandler handler1;
@@ -1041,10 +1622,6 @@ TEST_F(SPDY3DownstreamSessionTest, spdy_rate_limit_normal) {
  * to send more bytes (so as to keep under the rate limit).
  */
 TEST_F(SPDY3DownstreamSessionTest, spdy_rate_limit_rst) {
-  // The rate-limiting code grabs the event base from the EventBaseManager,
-  // so we need to set it.
-  folly::EventBaseManager::get()->setEventBase(&eventBase_, false);
-
   IOBufQueue requests{IOBufQueue::cacheChainLength()};
   IOBufQueue rst{IOBufQueue::cacheChainLength()};
   HTTPMessage req = getGetRequest();
@@ -1220,6 +1797,93 @@ TEST_F(HTTPDownstreamSessionTest, body_packetization) {
   EXPECT_EQ(transport_->getWriteEvents()->size(), 1);
 }
 
+TEST_F(HTTPDownstreamSessionTest, coalesce_pipelined_responses) {
+  MockHTTPHandler handlers[3];
+  httpSession_->setEgressCoalescing(4096, std::chrono::seconds(1));
+
+  InSequence handlerSequence;
+  for (auto& handler: handlers) {
+    EXPECT_CALL(mockController_, getRequestHandler(_, _))
+      .WillOnce(Return(&handler));
+    EXPECT_CALL(handler, setTransaction(_))
+      .WillOnce(Invoke([&handler] (HTTPTransaction* txn) {
+            handler.txn_ = txn; }));
+    EXPECT_CALL(handler, onHeadersComplete(_));
+    EXPECT_CALL(handler, onEOM())
+      .WillOnce(InvokeWithoutArgs([&handler] {
+            handler.sendReplyWithBody(200, 100);
+          }));
+    EXPECT_CALL(handler, detachTransaction());
+  }
+  EXPECT_CALL(mockController_, detachSession(_));
+
+  transport_->addReadEvent("GET / HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                           "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                           "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n",
+                           std::chrono::milliseconds(0));
+  transport_->addReadEOF(std::chrono::milliseconds(0));
+  transport_->startReadEvents();
+  HTTPSession::DestructorGuard g(httpSession_);
+  eventBase_.loop();
+
+  // All three responses went out in one write
+  EXPECT_EQ(transport_->getWriteEvents()->size(), 1);
+}
+
+namespace {
+
+struct TraceEventRecorder : public TraceEventObserver {
+  void traceEventAvailable(TraceEvent event) noexcept override {
+    events.push_back(std::move(event));
+  }
+
+  std::vector<TraceEvent> events;
+};
+
+}
+
+TEST_F(HTTPDownstreamSessionTest, trace_transaction_timing) {
+  MockHTTPHandler handler;
+  TraceEventRecorder recorder;
+
+  EXPECT_CALL(mockController_, getRequestHandler(_, _))
+    .WillOnce(Return(&handler));
+  EXPECT_CALL(handler, setTransaction(_))
+    .WillOnce(Invoke([&] (HTTPTransaction* txn) {
+          handler.txn_ = txn;
+          txn->setTraceEventContext(TraceEventContext(42, &recorder));
+        }));
+  EXPECT_CALL(handler, onHeadersComplete(_));
+  EXPECT_CALL(handler, onEOM())
+    .WillOnce(InvokeWithoutArgs([&handler] {
+          handler.sendReplyWithBody(200, 100);
+        }));
+  EXPECT_CALL(handler, detachTransaction());
+  EXPECT_CALL(mockController_, detachSession(_));
+
+  transport_->addReadEvent("GET / HTTP/1.1\r\nHost: localhost\r\n\r\n",
+                           std::chrono::milliseconds(0));
+  transport_->addReadEOF(std::chrono::milliseconds(0));
+  transport_->startReadEvents();
+  HTTPSession::DestructorGuard g(httpSession_);
+  eventBase_.loop();
+
+  std::vector<TraceEventType> types;
+  for (const auto& event: recorder.events) {
+    types.push_back(event.getType());
+    EXPECT_EQ(event.getParentID(), 42);
+    EXPECT_EQ(event.getTraceFieldDataAs<int>(TraceFieldType::StreamID), 1);
+    EXPECT_LE(event.getStartTime(), event.getEndTime());
+  }
+  // There is no ACK tracking here
+  EXPECT_EQ(types, (std::vector<TraceEventType>{
+        TraceEventType::ReadSocket,
+        TraceEventType::Scheduling,
+        TraceEventType::WriteSocket}));
+  EXPECT_GT(recorder.events[2].getTraceFieldDataAs<int>(
+              TraceFieldType::WriteBytes), 0);
+}
+
 TEST_F(HTTPDownstreamSessionTest, http_malformed_pkt1) {
   // Create a HTTP connection and keep sending just '\n' to the HTTP1xCodec.
   std::string data(90000, '\n');
@@ -1358,6 +2022,251 @@ void HTTPDownstreamTest<C>::testPriorities(
   }
 }
 
+// Request headers sent a byte at a time each reset the transaction
+// timeout, but not the header timeout
+TEST_F(HTTPDownstreamSessionTest, header_read_timeout) {
+  AsyncTimeoutSet::UniquePtr headerTimeouts(
+    new AsyncTimeoutSet(&eventBase_, std::chrono::milliseconds(50)));
+  httpSession_->setIngressTimeouts(headerTimeouts.get(), nullptr);
+  StrictMock<MockHTTPHandler> handler;
+
+  EXPECT_CALL(mockController_, getTransactionTimeoutHandler(_, _))
+    .WillOnce(Return(&handler));
+  EXPECT_CALL(handler, setTransaction(_))
+    .WillOnce(Invoke([&handler] (HTTPTransaction* txn) {
+          handler.txn_ = txn; }));
+  EXPECT_CALL(handler, onError(_))
+    .WillOnce(Invoke([&] (const HTTPException& ex) {
+          EXPECT_EQ(ex.getProxygenError(), kErrorTimeout);
+          handler.terminate();
+        }));
+  EXPECT_CALL(handler, detachTransaction());
+  EXPECT_CALL(mockController_, detachSession(_));
+
+  // Well over 50ms in all, each byte well within the 500ms timeout
+  addSingleByteReads("GET / HTTP/1.1\r\nHost: www.foo.com\r\n\r\n",
+                     std::chrono::milliseconds(5));
+  transport_->startReadEvents();
+  eventBase_.loop();
+}
+
+TEST_F(HTTPDownstreamSessionTest, send_file) {
+  // Larger than the window the transaction maps at a time
+  std::string content;
+  for (int i = 0; i < 600000; i++) {
+    content.push_back('a' + i % 26);
+  }
+  char path[] = "/tmp/HTTPDownstreamSessionTestXXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_GE(fd, 0);
+  unlink(path);
+  ASSERT_EQ(content.size(),
+            folly::writeFull(fd, content.data(), content.size()));
+  const off_t offset = 1000;
+  const size_t length = 500000;
+
+  MockHTTPHandler handler;
+  EXPECT_CALL(mockController_, getRequestHandler(_, _))
+    .WillOnce(Return(&handler));
+  EXPECT_CALL(handler, setTransaction(_))
+    .WillOnce(Invoke([&handler] (HTTPTransaction* txn) {
+          handler.txn_ = txn; }));
+  EXPECT_CALL(handler, onHeadersComplete(_));
+  EXPECT_CALL(handler, onEOM())
+    .WillOnce(InvokeWithoutArgs([&] {
+          handler.sendHeaders(200, length);
+          EXPECT_FALSE(handler.txn_->sendFile(fd, offset, content.size()));
+          EXPECT_TRUE(handler.txn_->sendFile(fd, offset, length));
+          // The transaction has its own descriptor
+          folly::closeNoInt(fd);
+          handler.txn_->sendEOM();
+        }));
+  EXPECT_CALL(handler, detachTransaction());
+  EXPECT_CALL(mockController_, detachSession(_));
+
+  transport_->addReadEvent("GET / HTTP/1.1\r\n\r\n",
+                           std::chrono::milliseconds(0));
+  transport_->addReadEOF(std::chrono::milliseconds(0));
+  transport_->startReadEvents();
+  HTTPSession::DestructorGuard g(httpSession_);
+  eventBase_.loop();
+
+  HTTP1xCodec clientCodec(TransportDirection::UPSTREAM);
+  NiceMock<MockHTTPCodecCallback> callbacks;
+  std::string body;
+  EXPECT_CALL(callbacks, onBody(1, _, _))
+    .WillRepeatedly(Invoke([&] (HTTPCodec::StreamID,
+                                std::shared_ptr<folly::IOBuf> chain,
+                                uint16_t) {
+          body += chain->moveToFbString().toStdString();
+        }));
+  EXPECT_CALL(callbacks, onMessageComplete(1, _));
+  clientCodec.setCallback(&callbacks);
+  parseOutput(clientCodec);
+  EXPECT_EQ(content.substr(offset, length), body);
+}
+
+TEST_F(HTTPDownstreamSessionTest, phase_sampling) {
+  ThreadLocalHTTPSessionStats stats;
+  httpSession_->setSessionStats(&stats);
+  HTTPSession::setPhaseSampling(1, std::chrono::microseconds(0));
+  MockHTTPHandler* handler = new MockHTTPHandler();
+
+  EXPECT_CALL(mockController_, getRequestHandler(_, _))
+    .WillOnce(Return(handler));
+  EXPECT_CALL(*handler, setTransaction(_))
+    .WillOnce(SaveArg<0>(&handler->txn_));
+  EXPECT_CALL(*handler, onHeadersComplete(_));
+  EXPECT_CALL(*handler, onEOM())
+    .WillOnce(InvokeWithoutArgs([handler] {
+          handler->sendReplyWithBody(200, 100);
+        }));
+  EXPECT_CALL(*handler, detachTransaction())
+    .WillOnce(InvokeWithoutArgs([&] { delete handler; }));
+  EXPECT_CALL(mockController_, detachSession(_));
+
+  transport_->addReadEvent("GET / HTTP/1.0\r\n\r\n",
+                           std::chrono::milliseconds(0));
+  transport_->startReadEvents();
+  eventBase_.loop();
+  HTTPSession::setPhaseSampling(0, std::chrono::microseconds(0));
+
+  // Every callback was sampled, each recording all of the phases
+  auto snapshot = stats.getSnapshot();
+  auto samples = [&] (ThreadLocalHTTPSessionStats::Histogram histogram) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < ThreadLocalHTTPSessionStats::kNumBuckets; i++) {
+      total += snapshot.getBucket(histogram, i);
+    }
+    return total;
+  };
+  auto callbacks = samples(ThreadLocalHTTPSessionStats::PHASE_WRITE_US);
+  EXPECT_GE(callbacks, 2);
+  EXPECT_EQ(callbacks,
+            samples(ThreadLocalHTTPSessionStats::PHASE_INGRESS_PARSE_US));
+  EXPECT_EQ(callbacks,
+            samples(ThreadLocalHTTPSessionStats::PHASE_HANDLER_DISPATCH_US));
+}
+
+TEST_F(HTTPDownstreamSessionTest, accounting) {
+  NiceMock<MockHTTPSessionInfoCallback> infoCb;
+  httpSession_->setInfoCallback(&infoCb);
+  HTTPSession::setAccounting(true);
+  HTTPSession::Accounting accounting;
+  EXPECT_CALL(infoCb, onDestroy(_))
+    .WillOnce(Invoke([&] (const HTTPSession& session) {
+          accounting = session.getAccounting();
+        }));
+  MockHTTPHandler* handler = new MockHTTPHandler();
+
+  EXPECT_CALL(mockController_, getRequestHandler(_, _))
+    .WillOnce(Return(handler));
+  EXPECT_CALL(*handler, setTransaction(_))
+    .WillOnce(SaveArg<0>(&handler->txn_));
+  EXPECT_CALL(*handler, onHeadersComplete(_));
+  EXPECT_CALL(*handler, onEOM())
+    .WillOnce(InvokeWithoutArgs([handler] {
+          handler->sendReplyWithBody(200, 100, false);
+        }));
+  EXPECT_CALL(*handler, detachTransaction())
+    .WillOnce(InvokeWithoutArgs([&] { delete handler; }));
+  EXPECT_CALL(mockController_, detachSession(_));
+
+  const std::string request("GET / HTTP/1.0\r\n\r\n");
+  transport_->addReadEvent(request.c_str(), std::chrono::milliseconds(0));
+  transport_->startReadEvents();
+  eventBase_.loop();
+  HTTPSession::setAccounting(false);
+
+  EXPECT_EQ(request.size(), accounting.bytesRead);
+  EXPECT_GT(accounting.bytesWritten, 100);
+  EXPECT_GT(accounting.ingressHeaderBytes, 0);
+  EXPECT_GT(accounting.egressHeaderBytes, 0);
+  // Nothing is compressed in HTTP/1.x
+  EXPECT_EQ(accounting.ingressHeaderBytes,
+            accounting.ingressHeaderBytesCompressed);
+  EXPECT_EQ(accounting.egressHeaderBytes,
+            accounting.egressHeaderBytesCompressed);
+  EXPECT_GT(accounting.phaseTimes[size_t(SessionPhase::INGRESS_PARSE)] +
+            accounting.phaseTimes[size_t(SessionPhase::HANDLER_DISPATCH)],
+            std::chrono::steady_clock::duration::zero());
+}
+
+TEST_F(HTTPDownstreamSessionTest, move_event_base) {
+  MockHTTPHandler* handler = new MockHTTPHandler();
+
+  EXPECT_CALL(mockController_, getRequestHandler(_, _))
+    .WillOnce(Return(handler));
+  EXPECT_CALL(*handler, setTransaction(_))
+    .WillOnce(SaveArg<0>(&handler->txn_));
+  EXPECT_CALL(*handler, onHeadersComplete(_));
+  EXPECT_CALL(*handler, onEOM())
+    .WillOnce(InvokeWithoutArgs([this] { eventBase_.terminateLoopSoon(); }));
+
+  transport_->addReadEvent("GET / HTTP/1.1\r\n\r\n",
+                           std::chrono::milliseconds(0));
+  transport_->startReadEvents();
+  eventBase_.loop();
+
+  // Waiting on its handler, with nothing to write
+  EXPECT_TRUE(httpSession_->isDetachable());
+  httpSession_->detachEventBase();
+  EXPECT_EQ(nullptr, transport_->getEventBase());
+
+  EventBase eventBase2;
+  auto transactionTimeouts2 = makeTimeoutSet(&eventBase2);
+  httpSession_->attachEventBase(&eventBase2, transactionTimeouts2.get());
+  EXPECT_EQ(&eventBase2, transport_->getEventBase());
+
+  EXPECT_CALL(*handler, detachTransaction())
+    .WillOnce(InvokeWithoutArgs([&] { delete handler; }));
+  EXPECT_CALL(mockController_, detachSession(_));
+  handler->sendReplyWithBody(200, 100, false);
+  eventBase2.loop();
+}
+
+TEST_F(HTTPDownstreamSessionTest, transaction_arena) {
+  ThreadLocalHTTPSessionStats stats;
+  httpSession_->setSessionStats(&stats);
+  MockHTTPHandler* handler = new MockHTTPHandler();
+
+  EXPECT_CALL(mockController_, getRequestHandler(_, _))
+    .WillOnce(Return(handler));
+  EXPECT_CALL(*handler, setTransaction(_))
+    .WillOnce(SaveArg<0>(&handler->txn_));
+  EXPECT_CALL(*handler, onHeadersComplete(_))
+    .WillOnce(InvokeWithoutArgs([handler] {
+          EXPECT_EQ(handler->txn_->getArenaSize(), 0);
+          auto& arena = handler->txn_->getArena();
+          EXPECT_EQ(&arena, &handler->txn_->getArena());
+          EXPECT_NE(arena.allocate(100), nullptr);
+          EXPECT_GT(handler->txn_->getArenaSize(), 100);
+        }));
+  EXPECT_CALL(*handler, onEOM())
+    .WillOnce(InvokeWithoutArgs([handler] {
+          handler->sendReplyWithBody(200, 100);
+        }));
+  EXPECT_CALL(*handler, detachTransaction())
+    .WillOnce(InvokeWithoutArgs([&] { delete handler; }));
+  EXPECT_CALL(mockController_, detachSession(_));
+
+  transport_->addReadEvent("GET / HTTP/1.0\r\n\r\n",
+                           std::chrono::milliseconds(0));
+  transport_->startReadEvents();
+  eventBase_.loop();
+
+  // One block of a few KB
+  auto snapshot = stats.getSnapshot();
+  uint64_t total = 0;
+  for (size_t i = 0; i < ThreadLocalHTTPSessionStats::kNumBuckets; i++) {
+    total += snapshot.getBucket(
+      ThreadLocalHTTPSessionStats::TRANSACTION_ARENA_KB, i);
+  }
+  EXPECT_EQ(total, 1);
+  EXPECT_EQ(snapshot.getBucket(
+              ThreadLocalHTTPSessionStats::TRANSACTION_ARENA_KB, 0), 0);
+}
+
 // Verifies that the read timeout is not running when no ingress is expected/
 // required to proceed
 TEST_F(SPDY3DownstreamSessionTest, spdy_timeout) {
@@ -1468,6 +2377,156 @@ TEST_F(SPDY3DownstreamSessionTest, spdy_timeout_win) {
   eventBase_.loop();
 }
 
+TEST_F(SPDY3DownstreamSessionTest, headers_with_body_and_eom_window) {
+  IOBufQueue requests{IOBufQueue::cacheChainLength()};
+  HTTPMessage req = getGetRequest();
+  SPDYCodec clientCodec(TransportDirection::UPSTREAM,
+                        SPDYVersion::SPDY3);
+  auto streamID = HTTPCodec::StreamID(1);
+  clientCodec.generateConnectionPreface(requests);
+  clientCodec.getEgressSettings()->setSetting(SettingsId::INITIAL_WINDOW_SIZE,
+                                              500);
+  clientCodec.generateSettings(requests);
+  clientCodec.generateHeader(requests, streamID, req, 0, false, nullptr);
+  clientCodec.generateEOM(requests, streamID);
+  IOBufQueue windowUpdate{IOBufQueue::cacheChainLength()};
+  clientCodec.generateWindowUpdate(windowUpdate, streamID, 500);
+  MockHTTPHandler handler;
+
+  EXPECT_CALL(mockController_, getRequestHandler(_, _))
+    .WillOnce(Return(&handler));
+  EXPECT_CALL(mockController_, detachSession(_));
+
+  InSequence handlerSequence;
+  EXPECT_CALL(handler, setTransaction(_))
+    .WillOnce(Invoke([&] (HTTPTransaction* txn) {
+          handler.txn_ = txn; }));
+  EXPECT_CALL(handler, onHeadersComplete(_));
+  EXPECT_CALL(handler, onEOM())
+    .WillOnce(InvokeWithoutArgs([&] {
+          // Too big for the stream window, so the body is flow controlled
+          HTTPMessage reply;
+          reply.setStatusCode(200);
+          reply.setHTTPVersion(1, 1);
+          reply.getHeaders().set(HTTP_HEADER_CONTENT_LENGTH, "1000");
+          handler.txn_->sendHeadersWithBodyAndEOM(reply, makeBuf(1000));
+        }));
+  EXPECT_CALL(handler, detachTransaction());
+
+  transport_->addReadEvent(requests, std::chrono::milliseconds(10));
+  transport_->addReadEvent(windowUpdate, std::chrono::milliseconds(20));
+  transport_->addReadEOF(std::chrono::milliseconds(30));
+  transport_->startReadEvents();
+  HTTPSession::DestructorGuard g(httpSession_);
+  eventBase_.loop();
+
+  NiceMock<MockHTTPCodecCallback> callbacks;
+  std::vector<size_t> bodyLens;
+
+  EXPECT_CALL(callbacks, onMessageBegin(streamID, _));
+  EXPECT_CALL(callbacks, onHeadersComplete(streamID, _));
+  EXPECT_CALL(callbacks, onBody(streamID, _, _))
+    .WillRepeatedly(Invoke([&] (HTTPCodec::StreamID,
+                                std::shared_ptr<folly::IOBuf> chain,
+                                uint16_t) {
+          bodyLens.push_back(chain->computeChainDataLength());
+        }));
+  EXPECT_CALL(callbacks, onMessageComplete(streamID, _));
+
+  clientCodec.setCallback(&callbacks);
+  parseOutput(clientCodec);
+  // One window's worth before the WINDOW_UPDATE, the rest after it
+  EXPECT_EQ(bodyLens, std::vector<size_t>({500, 500}));
+}
+
+TEST_F(SPDY3DownstreamSessionTest, batch_request_dispatch) {
+  IOBufQueue requests{IOBufQueue::cacheChainLength()};
+  HTTPMessage post = getPostRequest();
+  post.getHeaders().set(HTTP_HEADER_CONTENT_LENGTH, "100");
+  HTTPMessage req = getGetRequest();
+  SPDYCodec clientCodec(TransportDirection::UPSTREAM,
+                        SPDYVersion::SPDY3);
+  auto streamID = HTTPCodec::StreamID(1);
+  clientCodec.generateConnectionPreface(requests);
+  clientCodec.generateHeader(requests, streamID, post);
+  clientCodec.generateBody(requests, streamID, makeBuf(100), boost::none,
+                           true);
+  clientCodec.generateHeader(requests, streamID + 2, req);
+  clientCodec.generateEOM(requests, streamID + 2);
+  StrictMock<MockHTTPHandler> handler1;
+  StrictMock<MockHTTPHandler> handler2;
+  httpSession_->setBatchRequestDispatch(true);
+
+  {
+    InSequence handlerSequence;
+    // Both handlers are set up before either gets its request
+    EXPECT_CALL(mockController_, getRequestHandler(_, _))
+      .WillOnce(Return(&handler1));
+    EXPECT_CALL(mockController_, getRequestHandler(_, _))
+      .WillOnce(Return(&handler2));
+    EXPECT_CALL(handler1, setTransaction(_))
+      .WillOnce(SaveArg<0>(&handler1.txn_));
+    EXPECT_CALL(handler2, setTransaction(_))
+      .WillOnce(SaveArg<0>(&handler2.txn_));
+    // Then the ingress queued meanwhile is delivered, in order
+    EXPECT_CALL(handler1, onHeadersComplete(_));
+    EXPECT_CALL(handler1, onBody(_))
+      .WillOnce(Invoke([] (std::shared_ptr<folly::IOBuf> chain) {
+            EXPECT_EQ(chain->computeChainDataLength(), 100);
+          }));
+    EXPECT_CALL(handler1, onEOM())
+      .WillOnce(InvokeWithoutArgs([&handler1] {
+            handler1.sendReplyWithBody(200, 100);
+          }));
+    EXPECT_CALL(handler2, onHeadersComplete(_));
+    EXPECT_CALL(handler2, onEOM())
+      .WillOnce(InvokeWithoutArgs([&handler2] {
+            handler2.sendReplyWithBody(200, 100);
+          }));
+  }
+  EXPECT_CALL(handler1, detachTransaction());
+  EXPECT_CALL(handler2, detachTransaction());
+  EXPECT_CALL(mockController_, detachSession(_));
+
+  transport_->addReadEvent(requests, std::chrono::milliseconds(10));
+  transport_->addReadEOF(std::chrono::milliseconds(50));
+  transport_->startReadEvents();
+  eventBase_.loop();
+}
+
+TEST_F(SPDY3DownstreamSessionTest, batch_request_dispatch_abort) {
+  IOBufQueue requests{IOBufQueue::cacheChainLength()};
+  HTTPMessage req = getGetRequest();
+  SPDYCodec clientCodec(TransportDirection::UPSTREAM,
+                        SPDYVersion::SPDY3);
+  auto streamID = HTTPCodec::StreamID(1);
+  clientCodec.generateConnectionPreface(requests);
+  clientCodec.generateHeader(requests, streamID, req);
+  clientCodec.generateRstStream(requests, streamID, ErrorCode::CANCEL);
+  StrictMock<MockHTTPHandler> handler;
+  httpSession_->setBatchRequestDispatch(true);
+
+  InSequence handlerSequence;
+  // The reset in the same read dispatches the request first, so the
+  // handler sees it as it would have without batching
+  EXPECT_CALL(mockController_, getRequestHandler(_, _))
+    .WillOnce(Return(&handler));
+  EXPECT_CALL(handler, setTransaction(_))
+    .WillOnce(SaveArg<0>(&handler.txn_));
+  EXPECT_CALL(handler, onHeadersComplete(_));
+  EXPECT_CALL(handler, onError(_))
+    .WillOnce(Invoke([] (const HTTPException& ex) {
+          EXPECT_EQ(ex.getProxygenError(), kErrorStreamAbort);
+        }));
+  EXPECT_CALL(handler, detachTransaction());
+  EXPECT_CALL(mockController_, detachSession(_));
+
+  transport_->addReadEvent(requests, std::chrono::milliseconds(10));
+  transport_->addReadEOF(std::chrono::milliseconds(50));
+  transport_->startReadEvents();
+  eventBase_.loop();
+}
+
 TYPED_TEST_CASE_P(HTTPDownstreamTest);
 
 TYPED_TEST_P(HTTPDownstreamTest, testWritesDraining) {
@@ -1735,6 +2794,118 @@ TEST_F(SPDY31DownstreamTest, testSessionFlowControl) {
   parseOutput(clientCodec);
 }
 
+TEST_F(SPDY31DownstreamTest, testMaxConcurrentStreamsUpdate) {
+  eventBase_.loopOnce();
+  // A change once started goes out in SETTINGS of its own
+  httpSession_->setMaxConcurrentIncomingStreams(10);
+  httpSession_->setMaxConcurrentIncomingStreams(10);
+  eventBase_.loopOnce();
+  EXPECT_EQ(10, httpSession_->getMaxConcurrentIncomingStreams());
+
+  NiceMock<MockHTTPCodecCallback> callbacks;
+  SPDYCodec clientCodec(TransportDirection::UPSTREAM,
+                        SPDYVersion::SPDY3_1);
+  std::vector<uint32_t> advertised;
+  EXPECT_CALL(callbacks, onSettings(_))
+    .WillRepeatedly(Invoke([&] (const SettingsList& settings) {
+          for (const auto& setting: settings) {
+            if (setting.id == SettingsId::MAX_CONCURRENT_STREAMS) {
+              advertised.push_back(setting.value);
+            }
+          }
+        }));
+  clientCodec.setCallback(&callbacks);
+  parseOutput(clientCodec);
+  EXPECT_EQ(std::vector<uint32_t>({100, 10}), advertised);
+}
+
+TEST_F(SPDY3DownstreamSessionTest, ping_keepalive_timeout) {
+  // The client never answers, so the session goes once the reply is due
+  EXPECT_CALL(mockController_, detachSession(_));
+  transport_->startReadEvents();
+  httpSession_->setPingKeepalive(std::chrono::milliseconds(10),
+                                 std::chrono::milliseconds(20));
+  auto start = getCurrentTime();
+  eventBase_.loop();
+  EXPECT_GE(millisecondsSince(start).count(), 30);
+}
+
+TEST_F(SPDY3DownstreamSessionTest, ping_keepalive_rtt) {
+  // A reply to the first ping gives the RTT
+  IOBufQueue requests{IOBufQueue::cacheChainLength()};
+  SPDYCodec clientCodec(TransportDirection::UPSTREAM,
+                        SPDYVersion::SPDY3);
+  clientCodec.generatePingReply(requests, 2);
+  transport_->addReadEvent(requests, std::chrono::milliseconds(20));
+  transport_->addReadEOF(std::chrono::milliseconds(20));
+  transport_->startReadEvents();
+  httpSession_->setPingKeepalive(std::chrono::milliseconds(10),
+                                 std::chrono::milliseconds(100));
+  std::chrono::microseconds rtt(0);
+  eventBase_.runAfterDelay([&] { rtt = httpSession_->getPingRTT(); }, 30);
+
+  EXPECT_CALL(mockController_, detachSession(_));
+  eventBase_.loop();
+  EXPECT_GT(rtt.count(), 0);
+}
+
+TEST_F(SPDY3DownstreamSessionTest, idle_memory_timeout) {
+  // The header compression state freed while idle comes back for the
+  // second response, which the client still decodes
+  IOBufQueue requests1{IOBufQueue::cacheChainLength()};
+  IOBufQueue requests2{IOBufQueue::cacheChainLength()};
+  HTTPMessage req = getGetRequest();
+  MockHTTPHandler handler1;
+  MockHTTPHandler handler2;
+  SPDYCodec clientCodec(TransportDirection::UPSTREAM,
+                        SPDYVersion::SPDY3);
+  auto streamID = HTTPCodec::StreamID(1);
+  clientCodec.generateConnectionPreface(requests1);
+  clientCodec.generateHeader(requests1, streamID, req);
+  clientCodec.generateEOM(requests1, streamID);
+  streamID += 2;
+  clientCodec.generateHeader(requests2, streamID, req);
+  clientCodec.generateEOM(requests2, streamID);
+
+  httpSession_->setIdleMemoryTimeout(std::chrono::milliseconds(10));
+
+  EXPECT_CALL(mockController_, getRequestHandler(_, _))
+    .WillOnce(Return(&handler1))
+    .WillOnce(Return(&handler2));
+
+  EXPECT_CALL(handler1, setTransaction(_))
+    .WillOnce(Invoke([&handler1] (HTTPTransaction* txn) {
+          handler1.txn_ = txn; }));
+  EXPECT_CALL(handler1, onHeadersComplete(_));
+  EXPECT_CALL(handler1, onEOM())
+    .WillOnce(InvokeWithoutArgs([&handler1] {
+          handler1.sendReplyWithBody(200, 100);
+        }));
+  EXPECT_CALL(handler1, detachTransaction());
+  EXPECT_CALL(handler2, setTransaction(_))
+    .WillOnce(Invoke([&handler2] (HTTPTransaction* txn) {
+          handler2.txn_ = txn; }));
+  EXPECT_CALL(handler2, onHeadersComplete(_));
+  EXPECT_CALL(handler2, onEOM())
+    .WillOnce(InvokeWithoutArgs([&handler2] {
+          handler2.sendReplyWithBody(200, 100);
+        }));
+  EXPECT_CALL(handler2, detachTransaction());
+
+  transport_->addReadEvent(requests1, std::chrono::milliseconds(10));
+  transport_->addReadEvent(requests2, std::chrono::milliseconds(50));
+  transport_->startReadEvents();
+  eventBase_.loop();
+
+  NiceMock<MockHTTPCodecCallback> callbacks;
+  EXPECT_CALL(callbacks, onMessageComplete(_, _))
+    .Times(2);
+  EXPECT_CALL(callbacks, onError(_, _, _))
+    .Times(0);
+  clientCodec.setCallback(&callbacks);
+  parseOutput(clientCodec);
+}
+
 TEST_F(SPDY3DownstreamSessionTest, new_txn_egress_paused) {
   // Send 1 request with prio=0
   // Have egress pause while sending the first response
@@ -1925,6 +3096,60 @@ TEST_F(HTTP2DownstreamSessionTest, padding_flow_control) {
  * - [server --> client] respond 2nd stream (res with length 200 + EOM)
  * - [client --> server] RST_STREAM on the 1st stream
  */
+TEST_F(HTTP2DownstreamSessionTest, priority_dependency) {
+  IOBufQueue requests{IOBufQueue::cacheChainLength()};
+  HTTPMessage req = getGetRequest();
+  HTTP2Codec clientCodec(TransportDirection::UPSTREAM);
+  MockHTTPHandler handler1;
+  MockHTTPHandler handler2;
+
+  clientCodec.generateConnectionPreface(requests);
+  clientCodec.generateHeader(requests, 1, req, 0, false, nullptr);
+  clientCodec.generateEOM(requests, 1);
+  clientCodec.generateHeader(requests, 3, req, 0, false, nullptr);
+  clientCodec.generateEOM(requests, 3);
+  // stream 3 only gets bandwidth stream 1 can't use
+  http2::writePriority(requests, 3, {1, true, 255});
+
+  EXPECT_CALL(mockController_, getRequestHandler(_, _))
+    .WillOnce(Return(&handler1))
+    .WillOnce(Return(&handler2));
+
+  EXPECT_CALL(handler1, setTransaction(_))
+    .WillOnce(Invoke([&handler1] (HTTPTransaction* txn) {
+          handler1.txn_ = txn; }));
+  EXPECT_CALL(handler1, onHeadersComplete(_));
+  EXPECT_CALL(handler1, onEOM())
+    .WillOnce(InvokeWithoutArgs([&handler1] {
+          handler1.sendReplyWithBody(200, 20000);
+        }));
+  EXPECT_CALL(handler1, detachTransaction());
+  EXPECT_CALL(handler2, setTransaction(_))
+    .WillOnce(Invoke([&handler2] (HTTPTransaction* txn) {
+          handler2.txn_ = txn; }));
+  EXPECT_CALL(handler2, onHeadersComplete(_));
+  EXPECT_CALL(handler2, onEOM())
+    .WillOnce(InvokeWithoutArgs([&handler2] {
+          handler2.sendReplyWithBody(200, 100);
+        }));
+  EXPECT_CALL(handler2, detachTransaction());
+
+  transport_->addReadEvent(requests, std::chrono::milliseconds(10));
+  transport_->startReadEvents();
+  eventBase_.loop();
+
+  // without the dependency the small response would finish first
+  NiceMock<MockHTTPCodecCallback> callbacks;
+  std::vector<HTTPCodec::StreamID> completed;
+  EXPECT_CALL(callbacks, onMessageComplete(_, _))
+    .WillRepeatedly(Invoke([&completed] (HTTPCodec::StreamID id, bool) {
+          completed.push_back(id);
+        }));
+  clientCodec.setCallback(&callbacks);
+  parseOutput(clientCodec);
+  EXPECT_EQ(completed, std::vector<HTTPCodec::StreamID>({1, 3}));
+}
+
 TEST_F(HTTP2DownstreamSessionTest, server_push) {
   HTTP2Codec serverCodec(TransportDirection::DOWNSTREAM);
   HTTP2Codec clientCodec(TransportDirection::UPSTREAM);
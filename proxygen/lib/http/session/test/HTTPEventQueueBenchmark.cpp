@@ -0,0 +1,110 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/Benchmark.h>
+#include <folly/io/async/EventBase.h>
+#include <proxygen/lib/http/codec/test/TestUtils.h>
+#include <proxygen/lib/http/session/HTTPEventQueue.h>
+#include <proxygen/lib/http/session/test/HTTPSessionMocks.h>
+#include <proxygen/lib/http/session/test/HTTPTransactionMocks.h>
+#include <queue>
+
+using namespace folly;
+using namespace proxygen;
+using namespace testing;
+
+namespace {
+
+// Each iteration queues `burst` bodies in a new queue, as a transaction
+// paused once would, and drains them
+template <typename Queue>
+void queueBodies(uint32_t numIters, uint32_t burst) {
+  std::unique_ptr<IOBuf> body;
+  BENCHMARK_SUSPEND {
+    body = makeBuf(100);
+  }
+  size_t sum = 0;
+  for (uint32_t i = 0; i < numIters; ++i) {
+    Queue queue;
+    for (uint32_t j = 0; j < burst; ++j) {
+      queue.emplace(1, HTTPEvent::Type::BODY, body->clone());
+    }
+    while (!queue.empty()) {
+      sum += queue.front().getBody()->length();
+      queue.pop();
+    }
+  }
+  doNotOptimizeAway(sum);
+}
+
+// As HTTPTransaction used to queue its ingress
+void stdQueue(uint32_t numIters, uint32_t burst) {
+  queueBodies<std::queue<HTTPEvent>>(numIters, burst);
+}
+
+void eventQueue(uint32_t numIters, uint32_t burst) {
+  queueBodies<HTTPEventQueue>(numIters, burst);
+}
+
+// Each iteration starts a transaction and has its handler pause it until
+// it received `burst` bodies, as an upload to a slow backend would
+void pausedIngress(uint32_t numIters, uint32_t burst) {
+  EventBase eventBase;
+  AsyncTimeoutSet::UniquePtr transactionTimeouts;
+  NiceMock<MockHTTPTransactionTransport> transport;
+  NiceMock<MockHTTPHandler> handler;
+  HTTPTransaction::PriorityQueue txnEgressQueue;
+  std::unique_ptr<IOBuf> body;
+  BENCHMARK_SUSPEND {
+    transactionTimeouts.reset(
+      new AsyncTimeoutSet(&eventBase, std::chrono::milliseconds(500)));
+    body = makeBuf(100);
+  }
+  size_t received = 0;
+  EXPECT_CALL(handler, onBody(_))
+    .WillRepeatedly(Invoke([&](std::shared_ptr<IOBuf> chain) {
+          received += chain->length();
+        }));
+  for (uint32_t i = 0; i < numIters; ++i) {
+    HTTPTransaction txn(
+      TransportDirection::DOWNSTREAM,
+      HTTPCodec::StreamID(1), 1, transport,
+      txnEgressQueue, transactionTimeouts.get());
+    txn.setHandler(&handler);
+    txn.onIngressHeadersComplete(makeGetRequest());
+    txn.pauseIngress();
+    for (uint32_t j = 0; j < burst; ++j) {
+      txn.onIngressBody(body->clone(), 0);
+    }
+    txn.resumeIngress();
+    txn.onIngressEOM();
+    txn.sendAbort();
+  }
+  doNotOptimizeAway(received);
+}
+
+}
+
+BENCHMARK_PARAM(stdQueue, 2)
+BENCHMARK_RELATIVE_PARAM(eventQueue, 2)
+BENCHMARK_PARAM(stdQueue, 16)
+BENCHMARK_RELATIVE_PARAM(eventQueue, 16)
+BENCHMARK_PARAM(stdQueue, 256)
+BENCHMARK_RELATIVE_PARAM(eventQueue, 256)
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK_PARAM(pausedIngress, 2)
+BENCHMARK_PARAM(pausedIngress, 16)
+BENCHMARK_PARAM(pausedIngress, 256)
+
+int main(int argc, char* argv[]) {
+  folly::runBenchmarks();
+  return 0;
+}
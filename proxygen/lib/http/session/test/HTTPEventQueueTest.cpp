@@ -0,0 +1,88 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/io/IOBuf.h>
+#include <gtest/gtest.h>
+#include <proxygen/lib/http/session/HTTPEventQueue.h>
+
+using namespace proxygen;
+
+namespace {
+
+void expectChunk(HTTPEventQueue& queue, size_t length) {
+  ASSERT_FALSE(queue.empty());
+  EXPECT_EQ(queue.front().getEvent(), HTTPEvent::Type::CHUNK_HEADER);
+  EXPECT_EQ(queue.front().getChunkLength(), length);
+  queue.pop();
+}
+
+}
+
+TEST(HTTPEventQueue, fifo_across_growth) {
+  HTTPEventQueue::clearPool();
+  HTTPEventQueue queue;
+  auto inlineCapacity = queue.capacity();
+  // Wrap around the inline events before growing
+  for (size_t i = 0; i < inlineCapacity; i++) {
+    queue.emplace(1, HTTPEvent::Type::CHUNK_HEADER, i);
+  }
+  expectChunk(queue, 0);
+  expectChunk(queue, 1);
+  for (size_t i = inlineCapacity; i < 10 * inlineCapacity; i++) {
+    queue.emplace(1, HTTPEvent::Type::CHUNK_HEADER, i);
+  }
+  EXPECT_GT(queue.capacity(), inlineCapacity);
+  EXPECT_EQ(queue.size(), 10 * inlineCapacity - 2);
+  for (size_t i = 2; i < 10 * inlineCapacity; i++) {
+    expectChunk(queue, i);
+  }
+  EXPECT_TRUE(queue.empty());
+  EXPECT_EQ(queue.capacity(), inlineCapacity);
+}
+
+TEST(HTTPEventQueue, rings_are_pooled) {
+  HTTPEventQueue::clearPool();
+  HTTPEventQueue queue;
+  auto inlineCapacity = queue.capacity();
+  for (size_t i = 0; i <= inlineCapacity; i++) {
+    queue.emplace(1, HTTPEvent::Type::CHUNK_COMPLETE);
+  }
+  EXPECT_EQ(HTTPEventQueue::getNumPooledRings(), 0);
+  while (!queue.empty()) {
+    queue.pop();
+  }
+  EXPECT_EQ(HTTPEventQueue::getNumPooledRings(), 1);
+
+  // The next queue to overflow takes it
+  HTTPEventQueue other;
+  for (size_t i = 0; i <= inlineCapacity; i++) {
+    other.emplace(1, HTTPEvent::Type::CHUNK_COMPLETE);
+  }
+  EXPECT_EQ(HTTPEventQueue::getNumPooledRings(), 0);
+  other.clear();
+  EXPECT_EQ(HTTPEventQueue::getNumPooledRings(), 1);
+  HTTPEventQueue::clearPool();
+  EXPECT_EQ(HTTPEventQueue::getNumPooledRings(), 0);
+}
+
+TEST(HTTPEventQueue, clear_destroys_events) {
+  HTTPEventQueue queue;
+  auto body = folly::IOBuf::create(10);
+  body->append(10);
+  queue.emplace(1, HTTPEvent::Type::BODY, body->clone());
+  queue.emplace(1, HTTPEvent::Type::BODY, body->clone());
+  EXPECT_TRUE(body->isShared());
+  queue.clear();
+  EXPECT_TRUE(queue.empty());
+  EXPECT_FALSE(body->isShared());
+
+  queue.emplace(1, HTTPEvent::Type::BODY, std::move(body));
+  auto out = queue.front().getBody();
+  EXPECT_EQ(out->computeChainDataLength(), 10);
+}
@@ -12,6 +12,8 @@
 #include <proxygen/lib/utils/TestUtils.h>
 #include <folly/io/async/test/MockAsyncServerSocket.h>
 #include <folly/io/async/test/MockAsyncSocket.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 using namespace proxygen;
 using namespace testing;
@@ -34,6 +36,7 @@ class HTTPTargetSessionAcceptor : public HTTPSessionAcceptor {
 
   HTTPTransaction::Handler* newHandler(HTTPTransaction& txn,
                                        HTTPMessage* msg) noexcept override {
+    lastURL_ = msg->getURL();
     return new MockHTTPHandler();
   }
 
@@ -55,6 +58,7 @@ class HTTPTargetSessionAcceptor : public HTTPSessionAcceptor {
 
   uint32_t sessionsCreated_{0};
   std::string expectedProto_;
+  std::string lastURL_;
 };
 
 class HTTPSessionAcceptorTestBase :
@@ -101,6 +105,43 @@ class HTTPSessionAcceptorTestNPNPlaintext :
 };
 class HTTPSessionAcceptorTestNPNJunk :
     public HTTPSessionAcceptorTestBase {};
+class HTTPSessionAcceptorTestH2C :
+    public HTTPSessionAcceptorTestBase {
+ public:
+  void setupSSL() override {}
+
+  void SetUp() override {
+    config_.allowH2C = true;
+    HTTPSessionAcceptorTestBase::SetUp();
+    int fds[2];
+    CHECK_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    client_ = fds[1];
+    AsyncSocket::UniquePtr sock(new AsyncSocket(&eventBase_, fds[0]));
+    SocketAddress clientAddress;
+    folly::TransportInfo tinfo;
+    acceptor_->connectionReady(std::move(sock), clientAddress, "", tinfo);
+  }
+
+  void TearDown() override {
+    if (client_ >= 0) {
+      close(client_);
+    }
+  }
+
+  void clientWrite(const std::string& data) {
+    CHECK_EQ(write(client_, data.data(), data.size()), ssize_t(data.size()));
+    eventBase_.loopOnce(EVLOOP_NONBLOCK);
+  }
+
+  std::string clientRead() {
+    char buf[1024];
+    auto n = read(client_, buf, sizeof(buf));
+    return n > 0 ? std::string(buf, n) : "";
+  }
+
+ protected:
+  int client_{-1};
+};
 
 // Verify HTTPSessionAcceptor creates the correct codec based on NPN
 TEST_P(HTTPSessionAcceptorTestNPN, npn) {
@@ -123,6 +164,16 @@ INSTANTIATE_TEST_CASE_P(NPNPositive,
                         HTTPSessionAcceptorTestNPN,
                         ::testing::ValuesIn(protos1));
 
+// Verify the final HTTP/2 name is negotiated too
+TEST_F(HTTPSessionAcceptorTestNPN, h2) {
+  acceptor_->expectedProto_ = "http/2";
+  AsyncSocket::UniquePtr sock(new AsyncSocket(&eventBase_));
+  SocketAddress clientAddress;
+  folly::TransportInfo tinfo;
+  acceptor_->connectionReady(std::move(sock), clientAddress, "h2", tinfo);
+  EXPECT_EQ(acceptor_->sessionsCreated_, 1);
+}
+
 // Verify HTTPSessionAcceptor creates the correct plaintext codec
 TEST_P(HTTPSessionAcceptorTestNPNPlaintext, plaintext_protocols) {
   std::string proto(GetParam());
@@ -141,6 +192,15 @@ INSTANTIATE_TEST_CASE_P(NPNPlaintext,
                         HTTPSessionAcceptorTestNPNPlaintext,
                         ::testing::ValuesIn(protos2));
 
+class HTTPSessionAcceptorTestSniffSPDY :
+    public HTTPSessionAcceptorTestH2C {
+ public:
+  void SetUp() override {
+    config_.allowPlaintextSPDY = true;
+    HTTPSessionAcceptorTestH2C::SetUp();
+  }
+};
+
 // Verify HTTPSessionAcceptor closes the socket on invalid NPN
 TEST_F(HTTPSessionAcceptorTestNPNJunk, npn) {
   std::string proto("/http/1.1");
@@ -151,3 +211,109 @@ TEST_F(HTTPSessionAcceptorTestNPNJunk, npn) {
   acceptor_->connectionReady(std::move(sock), clientAddress, proto, tinfo);
   EXPECT_EQ(acceptor_->sessionsCreated_, 0);
 }
+
+// Verify a plaintext connection opening with the HTTP/2 preface gets HTTP/2
+TEST_F(HTTPSessionAcceptorTestH2C, prior_knowledge) {
+  acceptor_->expectedProto_ = "http/2";
+  clientWrite("PRI * HTTP/2.0\r\n");
+  EXPECT_EQ(acceptor_->sessionsCreated_, 0);
+  clientWrite("\r\nSM\r\n\r\n");
+  EXPECT_EQ(acceptor_->sessionsCreated_, 1);
+}
+
+// Verify Upgrade: h2c is answered with 101 and the request is served on
+// the HTTP/2 session
+TEST_F(HTTPSessionAcceptorTestH2C, upgrade) {
+  acceptor_->expectedProto_ = "http/2";
+  clientWrite("GET /upgraded HTTP/1.1\r\n"
+              "Host: www.foo.com\r\n"
+              "Connection: Upgrade, HTTP2-Settings\r\n"
+              "Upgrade: h2c\r\n"
+              "HTTP2-Settings: AAMAAABkAAQAAP__\r\n"
+              "\r\n");
+  EXPECT_EQ(acceptor_->sessionsCreated_, 1);
+  EXPECT_EQ(acceptor_->lastURL_, "/upgraded");
+  EXPECT_EQ(clientRead().find("HTTP/1.1 101 Switching Protocols\r\n"), 0);
+}
+
+// Verify other requests stay HTTP/1.1 and nothing is lost on the way
+TEST_F(HTTPSessionAcceptorTestH2C, http1x) {
+  acceptor_->expectedProto_ = "http/1.1";
+  clientWrite("GET /plain HTTP/1.1\r\n");
+  EXPECT_EQ(acceptor_->sessionsCreated_, 0);
+  clientWrite("Host: www.foo.com\r\n\r\n");
+  EXPECT_EQ(acceptor_->sessionsCreated_, 1);
+  EXPECT_EQ(acceptor_->lastURL_, "/plain");
+}
+
+// Verify a connection closed before its protocol is known gets no session
+TEST_F(HTTPSessionAcceptorTestH2C, eof) {
+  close(client_);
+  client_ = -1;
+  eventBase_.loopOnce(EVLOOP_NONBLOCK);
+  EXPECT_EQ(acceptor_->sessionsCreated_, 0);
+}
+
+// Verify a plaintext connection opening with a SPDY control frame gets the
+// SPDY version of that frame
+TEST_F(HTTPSessionAcceptorTestSniffSPDY, spdy) {
+  acceptor_->expectedProto_ = "spdy/3.1";
+  // SETTINGS with no entries
+  clientWrite(std::string("\x80", 1));
+  EXPECT_EQ(acceptor_->sessionsCreated_, 0);
+  clientWrite(std::string("\x03\x00\x04\x00\x00\x00\x04\x00\x00\x00\x00",
+                          11));
+  EXPECT_EQ(acceptor_->sessionsCreated_, 1);
+}
+
+// Verify HTTP/1.x and HTTP/2 are still told apart along with SPDY
+TEST_F(HTTPSessionAcceptorTestSniffSPDY, http1x) {
+  acceptor_->expectedProto_ = "http/1.1";
+  clientWrite("GET /plain HTTP/1.1\r\nHost: www.foo.com\r\n\r\n");
+  EXPECT_EQ(acceptor_->sessionsCreated_, 1);
+  EXPECT_EQ(acceptor_->lastURL_, "/plain");
+}
+
+class HTTPSessionAcceptorTestDrainPacing :
+    public HTTPSessionAcceptorTestBase {
+ public:
+  void setupSSL() override {}
+};
+
+// Verify the sessions are told to drain over the pacing window
+TEST_F(HTTPSessionAcceptorTestDrainPacing, paced) {
+  std::vector<std::pair<size_t, size_t>> progress;
+  acceptor_->setDrainPacing(
+    std::chrono::milliseconds(30),
+    [&] (size_t drained, size_t total) {
+      progress.emplace_back(drained, total);
+    });
+  acceptor_->expectedProto_ = "http/1.1";
+  std::vector<int> clients;
+  for (int i = 0; i < 3; i++) {
+    int fds[2];
+    CHECK_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    clients.push_back(fds[1]);
+    AsyncSocket::UniquePtr sock(new AsyncSocket(&eventBase_, fds[0]));
+    SocketAddress clientAddress;
+    folly::TransportInfo tinfo;
+    acceptor_->connectionReady(std::move(sock), clientAddress, "", tinfo);
+  }
+  EXPECT_EQ(acceptor_->sessionsCreated_, 3);
+
+  static_cast<folly::AsyncServerSocket::AcceptCallback*>(acceptor_.get())
+    ->acceptStopped();
+  ASSERT_FALSE(progress.empty());
+  EXPECT_LT(progress.front().first, 3);
+  auto deadline =
+    std::chrono::steady_clock::now() + std::chrono::seconds(1);
+  while (progress.back().first < 3 &&
+         std::chrono::steady_clock::now() < deadline) {
+    eventBase_.loopOnce();
+  }
+  EXPECT_EQ(std::make_pair(size_t(3), size_t(3)), progress.back());
+  EXPECT_GT(progress.size(), 1);
+  for (auto fd: clients) {
+    close(fd);
+  }
+}
@@ -0,0 +1,332 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <folly/Memory.h>
+#include <folly/SocketAddress.h>
+#include <folly/String.h>
+#include <folly/io/async/AsyncSocket.h>
+#include <folly/io/async/EventBase.h>
+#include <gflags/gflags.h>
+#include <proxygen/lib/http/codec/HTTP1xCodec.h>
+#include <proxygen/lib/http/codec/SPDYCodec.h>
+#include <proxygen/lib/http/codec/experimental/HTTP2Codec.h>
+#include <proxygen/lib/http/session/HTTPDownstreamSession.h>
+#include <proxygen/lib/http/session/HTTPSessionController.h>
+#include <proxygen/lib/http/session/HTTPUpstreamSession.h>
+#include <proxygen/lib/utils/AllocStats.h>
+#include <string>
+#include <sys/socket.h>
+#include <vector>
+
+DEFINE_int32(requests, 20000, "Requests per scenario");
+DEFINE_string(protocols, "http/1.1,spdy/3.1,http/2",
+              "Codecs to run, as a comma separated list of http/1.1, "
+              "spdy/3.1 and http/2");
+
+/**
+ * Runs a client and a server session against each other over socketpairs
+ * in one thread, and reports throughput and request latency, from the
+ * request being started to its response complete, for a set of scenarios
+ * per codec. HTTP/1.1 can't multiplex, so it gets one connection per
+ * concurrent stream instead.
+ */
+
+using namespace folly;
+using namespace proxygen;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace {
+
+struct Scenario {
+  const char* name;
+  uint32_t streams;
+  size_t bodySize;
+  // Receive windows of the client; 0 keeps the defaults
+  size_t streamWindow;
+  size_t sessionWindow;
+};
+
+const Scenario kScenarios[] = {
+  {"1 stream, 100B", 1, 100, 0, 0},
+  {"100 streams, 100B", 100, 100, 0, 0},
+  {"10 streams, 1MB", 10, 1024 * 1024, 0, 0},
+  {"100 streams, 64KB, 16KB windows", 100, 64 * 1024, 16 * 1024, 65536},
+};
+
+unique_ptr<HTTPCodec> makeCodec(CodecProtocol proto,
+                                TransportDirection direction) {
+  switch (proto) {
+    case CodecProtocol::HTTP_1_1:
+      return folly::make_unique<HTTP1xCodec>(direction);
+    case CodecProtocol::SPDY_3_1:
+      return folly::make_unique<SPDYCodec>(direction, SPDYVersion::SPDY3_1);
+    case CodecProtocol::HTTP_2:
+      return folly::make_unique<HTTP2Codec>(direction);
+    default:
+      LOG(FATAL) << "No benchmark for " << getCodecProtocolString(proto);
+  }
+  return nullptr;
+}
+
+// Responds to every request with bodySize bytes
+class ServerHandler: public HTTPTransaction::Handler {
+ public:
+  explicit ServerHandler(const unique_ptr<IOBuf>& body): body_(body) {}
+
+  void setTransaction(HTTPTransaction* txn) noexcept override {
+    txn_ = txn;
+  }
+  void detachTransaction() noexcept override {
+    delete this;
+  }
+  void onHeadersComplete(unique_ptr<HTTPMessage>) noexcept override {}
+  void onBody(unique_ptr<IOBuf>) noexcept override {}
+  void onEOM() noexcept override {
+    HTTPMessage response;
+    response.setStatusCode(200);
+    response.setStatusMessage("OK");
+    response.setHTTPVersion(1, 1);
+    response.getHeaders().set(HTTP_HEADER_CONTENT_LENGTH,
+                              std::to_string(body_->length()));
+    txn_->sendHeaders(response);
+    // Flow control is left to the transaction, which buffers the body
+    txn_->sendBody(body_->clone());
+    txn_->sendEOM();
+  }
+  void onUpgrade(UpgradeProtocol) noexcept override {}
+  void onError(const HTTPException& error) noexcept override {
+    LOG(FATAL) << "Server transaction failed: " << error.what();
+  }
+  void onEgressPaused() noexcept override {}
+  void onEgressResumed() noexcept override {}
+
+ private:
+  const unique_ptr<IOBuf>& body_;
+  HTTPTransaction* txn_{nullptr};
+};
+
+class ServerController: public HTTPSessionController {
+ public:
+  explicit ServerController(size_t bodySize): body_(IOBuf::create(bodySize)) {
+    memset(body_->writableData(), 'a', bodySize);
+    body_->append(bodySize);
+  }
+
+  HTTPTransactionHandler* getRequestHandler(HTTPTransaction&,
+                                            HTTPMessage*) override {
+    return new ServerHandler(body_);
+  }
+  HTTPTransactionHandler* getParseErrorHandler(
+      HTTPTransaction*, const HTTPException& error,
+      const SocketAddress&) override {
+    LOG(FATAL) << "Server failed to parse: " << error.what();
+    return nullptr;
+  }
+  HTTPTransactionHandler* getTransactionTimeoutHandler(
+      HTTPTransaction*, const SocketAddress&) override {
+    LOG(FATAL) << "Server transaction timed out";
+    return nullptr;
+  }
+  void attachSession(HTTPSession*) override {}
+  void detachSession(const HTTPSession*) override {}
+
+ private:
+  unique_ptr<IOBuf> body_;
+};
+
+class Client;
+
+// One request at a time; starts the next when its response completes
+class ClientHandler: public HTTPTransaction::Handler {
+ public:
+  ClientHandler(Client& client, HTTPUpstreamSession* session):
+      client_(client), session_(session) {}
+
+  void start();
+
+  void setTransaction(HTTPTransaction* txn) noexcept override {
+    txn_ = txn;
+  }
+  void detachTransaction() noexcept override;
+  void onHeadersComplete(unique_ptr<HTTPMessage> msg) noexcept override {
+    CHECK_EQ(msg->getStatusCode(), 200);
+  }
+  void onBody(unique_ptr<IOBuf> chain) noexcept override;
+  void onEOM() noexcept override {}
+  void onUpgrade(UpgradeProtocol) noexcept override {}
+  void onError(const HTTPException& error) noexcept override {
+    LOG(FATAL) << "Client transaction failed: " << error.what();
+  }
+  void onEgressPaused() noexcept override {}
+  void onEgressResumed() noexcept override {}
+
+ private:
+  Client& client_;
+  HTTPUpstreamSession* session_;
+  HTTPTransaction* txn_{nullptr};
+  std::chrono::steady_clock::time_point start_;
+};
+
+class Client {
+ public:
+  Client(EventBase& evb, uint32_t requests):
+      evb_(evb), remaining_(requests) {
+    latencies_.reserve(requests);
+  }
+
+  bool takeRequest() {
+    if (remaining_ == 0) {
+      return false;
+    }
+    --remaining_;
+    return true;
+  }
+
+  void onResponse(std::chrono::steady_clock::duration latency) {
+    latencies_.push_back(
+      std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+  }
+
+  EventBase& evb_;
+  uint32_t remaining_;
+  uint64_t bodyBytes_{0};
+  vector<int64_t> latencies_;
+};
+
+void ClientHandler::start() {
+  if (!client_.takeRequest()) {
+    delete this;
+    return;
+  }
+  start_ = std::chrono::steady_clock::now();
+  txn_ = session_->newTransaction(this);
+  CHECK(txn_);
+  HTTPMessage request;
+  request.setMethod(HTTPMethod::GET);
+  request.setURL("/");
+  request.setHTTPVersion(1, 1);
+  request.getHeaders().set(HTTP_HEADER_HOST, "localhost");
+  txn_->sendHeaders(request);
+  txn_->sendEOM();
+}
+
+void ClientHandler::onBody(unique_ptr<IOBuf> chain) noexcept {
+  client_.bodyBytes_ += chain->computeChainDataLength();
+}
+
+void ClientHandler::detachTransaction() noexcept {
+  client_.onResponse(std::chrono::steady_clock::now() - start_);
+  txn_ = nullptr;
+  // Not from within the session detaching the transaction
+  client_.evb_.runInLoop([this] { start(); });
+}
+
+void runScenario(CodecProtocol proto, const Scenario& scenario) {
+  EventBase evb;
+  AsyncTimeoutSet::UniquePtr timeouts(
+    new AsyncTimeoutSet(&evb, std::chrono::milliseconds(60000)));
+  ServerController controller(scenario.bodySize);
+  Client client(evb, FLAGS_requests);
+  SocketAddress addr("127.0.0.1", 0);
+  TransportInfo tinfo;
+
+  const bool multiplexed = proto != CodecProtocol::HTTP_1_1;
+  const uint32_t connections = multiplexed ? 1 : scenario.streams;
+  const uint32_t streamsPerConnection = multiplexed ? scenario.streams : 1;
+  vector<HTTPSession*> sessions;
+  for (uint32_t i = 0; i < connections; i++) {
+    int fds[2];
+    CHECK_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    auto server = new HTTPDownstreamSession(
+      timeouts.get(),
+      AsyncTransportWrapper::UniquePtr(new AsyncSocket(&evb, fds[0])),
+      addr, addr, &controller,
+      makeCodec(proto, TransportDirection::DOWNSTREAM), tinfo);
+    server->setMaxConcurrentIncomingStreams(streamsPerConnection);
+    auto upstream = new HTTPUpstreamSession(
+      timeouts.get(),
+      AsyncTransportWrapper::UniquePtr(new AsyncSocket(&evb, fds[1])),
+      addr, addr, makeCodec(proto, TransportDirection::UPSTREAM), tinfo,
+      nullptr);
+    upstream->setMaxConcurrentOutgoingStreams(streamsPerConnection);
+    if (scenario.streamWindow) {
+      upstream->setFlowControl(scenario.streamWindow, scenario.streamWindow,
+                               scenario.sessionWindow);
+    }
+    server->startNow();
+    upstream->startNow();
+    sessions.push_back(server);
+    sessions.push_back(upstream);
+    for (uint32_t s = 0; s < streamsPerConnection; s++) {
+      auto handler = new ClientHandler(client, upstream);
+      evb.runInLoop([handler] { handler->start(); });
+    }
+  }
+
+  auto allocsBefore = getThreadAllocCounts();
+  auto start = std::chrono::steady_clock::now();
+  // The loop runs until every request is answered
+  while (client.latencies_.size() < uint32_t(FLAGS_requests)) {
+    evb.loopOnce();
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - start).count();
+  auto allocs = getThreadAllocCounts();
+  for (auto session: sessions) {
+    session->dropConnection();
+  }
+  evb.loop();
+
+  auto& latencies = client.latencies_;
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&latencies] (double p) {
+    return latencies[std::min(latencies.size() - 1,
+                              size_t(p * latencies.size()))];
+  };
+  printf("  %-34s %10.0f req/s %9.1f MB/s  p50 %6lldus  p99 %6lldus\n",
+         scenario.name,
+         latencies.size() * 1e6 / std::max<int64_t>(elapsed, 1),
+         double(client.bodyBytes_) / std::max<int64_t>(elapsed, 1),
+         (long long)percentile(0.5), (long long)percentile(0.99));
+  if (kAllocStatsEnabled) {
+    // Client and server together
+    double requests = latencies.size();
+    printf("  %-34s %10.2f allocs/req %7.0f B/req %6.2f clones/req "
+           "%6.2f header copies/req\n", "",
+           (allocs.allocations - allocsBefore.allocations) / requests,
+           (allocs.allocatedBytes - allocsBefore.allocatedBytes) / requests,
+           (allocs.iobufClones - allocsBefore.iobufClones) / requests,
+           (allocs.headerCopies - allocsBefore.headerCopies) / requests);
+  }
+}
+
+}
+
+int main(int argc, char* argv[]) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  vector<string> protocols;
+  folly::split(',', FLAGS_protocols, protocols);
+  for (const auto& protocol: protocols) {
+    if (!isValidCodecProtocolStr(protocol)) {
+      LOG(ERROR) << "Unknown protocol " << protocol;
+      return 1;
+    }
+    auto proto = getCodecProtocolFromStr(protocol);
+    printf("%s\n", protocol.c_str());
+    for (const auto& scenario: kScenarios) {
+      runScenario(proto, scenario);
+    }
+  }
+  return 0;
+}
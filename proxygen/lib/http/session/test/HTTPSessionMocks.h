@@ -219,6 +219,14 @@ class MockHTTPSessionInfoCallback: public HTTPSession::InfoCallback {
   MOCK_METHOD0(onPingReplyReceived, void());
   MOCK_METHOD1(onSettingsOutgoingStreamsFull, void(const HTTPSession&));
   MOCK_METHOD1(onSettingsOutgoingStreamsNotFull, void(const HTTPSession&));
+  MOCK_METHOD3(onTransportBytes, void(const HTTPSession&, size_t, size_t));
+  MOCK_METHOD2(onAltSvc, void(const HTTPSession&, const AltSvc&));
+
+  uint32_t getSubscribedEvents() const override {
+    return events;
+  }
+
+  uint32_t events{kAllEvents};
 };
 
 }
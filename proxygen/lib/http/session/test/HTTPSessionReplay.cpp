@@ -0,0 +1,344 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <folly/FileUtil.h>
+#include <folly/Memory.h>
+#include <folly/SocketAddress.h>
+#include <folly/String.h>
+#include <folly/io/async/AsyncSocket.h>
+#include <folly/io/async/EventBase.h>
+#include <fstream>
+#include <gflags/gflags.h>
+#include <proxygen/lib/http/codec/HTTP1xCodec.h>
+#include <proxygen/lib/http/codec/SPDYCodec.h>
+#include <proxygen/lib/http/codec/experimental/HTTP2Codec.h>
+#include <proxygen/lib/http/session/HTTPDownstreamSession.h>
+#include <proxygen/lib/http/session/HTTPSessionController.h>
+#include <proxygen/lib/utils/AllocStats.h>
+#include <string>
+#include <sys/socket.h>
+#include <vector>
+
+DEFINE_string(captures, "", "Comma separated capture files, the ingress of "
+              "one connection each");
+DEFINE_string(protocol, "http/1.1", "Codec of the captures: http/1.1, "
+              "spdy/3.1 or http/2");
+DEFINE_bool(timed, false, "Replay with the original timings, from "
+            "<capture>.times, rather than as fast as the session reads");
+DEFINE_int32(iterations, 10, "Times to replay the captures");
+DEFINE_int32(body_size, 100, "Bytes of body in every response");
+
+/**
+ * Replays captured ingress into HTTPDownstreamSessions, one per capture
+ * file, all at once over socketpairs in one thread, and reports the
+ * throughput, the latency of the requests from their headers to their
+ * response complete, and the allocations per request. Every request gets
+ * a 200 with body_size bytes, and the responses are read and dropped.
+ *
+ * A capture is the raw bytes a server read from one connection, eg. from
+ * dumpBinToFile() or the TCP payload of one direction of a stream in a
+ * pcap. For timed replays, <capture>.times has a line per read, with the
+ * microseconds since the first one and the bytes it got.
+ */
+
+using namespace folly;
+using namespace proxygen;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace {
+
+struct Segment {
+  std::chrono::microseconds offset;
+  size_t length;
+};
+
+struct Capture {
+  string name;
+  string bytes;
+  // Empty unless timed
+  vector<Segment> segments;
+};
+
+bool loadCapture(const string& name, Capture& capture) {
+  capture.name = name;
+  if (!readFile(name.c_str(), capture.bytes)) {
+    LOG(ERROR) << "Cannot read " << name;
+    return false;
+  }
+  if (!FLAGS_timed) {
+    return true;
+  }
+  std::ifstream times(name + ".times");
+  int64_t offset;
+  size_t length;
+  size_t total = 0;
+  while (times >> offset >> length) {
+    capture.segments.push_back({std::chrono::microseconds(offset), length});
+    total += length;
+  }
+  if (total != capture.bytes.size()) {
+    LOG(ERROR) << name << ".times has " << total << " bytes of "
+               << capture.bytes.size();
+    return false;
+  }
+  return true;
+}
+
+unique_ptr<HTTPCodec> makeCodec(CodecProtocol proto) {
+  switch (proto) {
+    case CodecProtocol::HTTP_1_1:
+      return folly::make_unique<HTTP1xCodec>(TransportDirection::DOWNSTREAM);
+    case CodecProtocol::SPDY_3_1:
+      return folly::make_unique<SPDYCodec>(TransportDirection::DOWNSTREAM,
+                                           SPDYVersion::SPDY3_1);
+    case CodecProtocol::HTTP_2:
+      return folly::make_unique<HTTP2Codec>(TransportDirection::DOWNSTREAM);
+    default:
+      LOG(FATAL) << "No replay for " << getCodecProtocolString(proto);
+  }
+  return nullptr;
+}
+
+struct Results {
+  vector<int64_t> latencies;
+  uint64_t parseErrors{0};
+  uint32_t sessionsClosed{0};
+};
+
+class ReplayHandler: public HTTPTransaction::Handler {
+ public:
+  ReplayHandler(const unique_ptr<IOBuf>& body, Results& results):
+      body_(body), results_(results) {}
+
+  void setTransaction(HTTPTransaction* txn) noexcept override {
+    txn_ = txn;
+  }
+  void detachTransaction() noexcept override {
+    if (started_) {
+      results_.latencies.push_back(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start_).count());
+    }
+    delete this;
+  }
+  void onHeadersComplete(unique_ptr<HTTPMessage>) noexcept override {
+    started_ = true;
+    start_ = std::chrono::steady_clock::now();
+  }
+  void onBody(unique_ptr<IOBuf>) noexcept override {}
+  void onEOM() noexcept override {
+    HTTPMessage response;
+    response.setStatusCode(200);
+    response.setStatusMessage("OK");
+    response.setHTTPVersion(1, 1);
+    response.getHeaders().set(HTTP_HEADER_CONTENT_LENGTH,
+                              std::to_string(body_->length()));
+    txn_->sendHeaders(response);
+    txn_->sendBody(body_->clone());
+    txn_->sendEOM();
+  }
+  void onUpgrade(UpgradeProtocol) noexcept override {}
+  void onError(const HTTPException&) noexcept override {
+    // The capture may end in the middle of a request
+    started_ = false;
+  }
+  void onEgressPaused() noexcept override {}
+  void onEgressResumed() noexcept override {}
+
+ private:
+  const unique_ptr<IOBuf>& body_;
+  Results& results_;
+  HTTPTransaction* txn_{nullptr};
+  bool started_{false};
+  std::chrono::steady_clock::time_point start_;
+};
+
+class ReplayController: public HTTPSessionController {
+ public:
+  ReplayController(size_t bodySize, Results& results):
+      body_(IOBuf::create(bodySize)),
+      results_(results) {
+    memset(body_->writableData(), 'a', bodySize);
+    body_->append(bodySize);
+  }
+
+  HTTPTransactionHandler* getRequestHandler(HTTPTransaction&,
+                                            HTTPMessage*) override {
+    return new ReplayHandler(body_, results_);
+  }
+  HTTPTransactionHandler* getParseErrorHandler(
+      HTTPTransaction*, const HTTPException&,
+      const SocketAddress&) override {
+    results_.parseErrors++;
+    return nullptr;
+  }
+  HTTPTransactionHandler* getTransactionTimeoutHandler(
+      HTTPTransaction*, const SocketAddress&) override {
+    return nullptr;
+  }
+  void attachSession(HTTPSession*) override {}
+  void detachSession(const HTTPSession*) override {
+    results_.sessionsClosed++;
+  }
+
+ private:
+  unique_ptr<IOBuf> body_;
+  Results& results_;
+};
+
+// The client end of a connection: sends the capture, drops the responses
+class Replayer: public AsyncTransportWrapper::ReadCallback {
+ public:
+  Replayer(EventBase& evb, int fd, const Capture& capture):
+      socket_(new AsyncSocket(&evb, fd)),
+      capture_(capture) {
+    socket_->setReadCB(this);
+  }
+
+  void start(EventBase& evb) {
+    if (capture_.segments.empty()) {
+      send(0, capture_.bytes.size());
+      socket_->shutdownWrite();
+      return;
+    }
+    size_t offset = 0;
+    for (size_t i = 0; i < capture_.segments.size(); i++) {
+      const auto& segment = capture_.segments[i];
+      bool last = i + 1 == capture_.segments.size();
+      evb.runAfterDelay([this, offset, segment, last] {
+          send(offset, segment.length);
+          if (last) {
+            socket_->shutdownWrite();
+          }
+        }, std::chrono::duration_cast<std::chrono::milliseconds>(
+          segment.offset).count());
+      offset += segment.length;
+    }
+  }
+
+  void getReadBuffer(void** buf, size_t* len) noexcept override {
+    *buf = readBuf_;
+    *len = sizeof(readBuf_);
+  }
+  void readDataAvailable(size_t) noexcept override {}
+  void readEOF() noexcept override {
+    socket_->close();
+  }
+  void readErr(const AsyncSocketException&) noexcept override {
+    socket_->close();
+  }
+
+ private:
+  void send(size_t offset, size_t length) {
+    socket_->writeChain(nullptr, IOBuf::wrapBuffer(
+      capture_.bytes.data() + offset, length));
+  }
+
+  AsyncSocket::UniquePtr socket_;
+  const Capture& capture_;
+  char readBuf_[16384];
+};
+
+void replay(CodecProtocol proto, const vector<Capture>& captures,
+            Results& results) {
+  EventBase evb;
+  AsyncTimeoutSet::UniquePtr timeouts(
+    new AsyncTimeoutSet(&evb, std::chrono::milliseconds(60000)));
+  ReplayController controller(FLAGS_body_size, results);
+  SocketAddress addr("127.0.0.1", 0);
+  TransportInfo tinfo;
+
+  vector<unique_ptr<Replayer>> replayers;
+  for (const auto& capture: captures) {
+    int fds[2];
+    CHECK_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    auto server = new HTTPDownstreamSession(
+      timeouts.get(),
+      AsyncTransportWrapper::UniquePtr(new AsyncSocket(&evb, fds[0])),
+      addr, addr, &controller, makeCodec(proto), tinfo);
+    server->startNow();
+    replayers.push_back(folly::make_unique<Replayer>(evb, fds[1], capture));
+  }
+  for (auto& replayer: replayers) {
+    replayer->start(evb);
+  }
+  // Each session closes once its capture is done and answered
+  while (results.sessionsClosed < captures.size()) {
+    evb.loopOnce();
+  }
+}
+
+}
+
+int main(int argc, char* argv[]) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  if (!isValidCodecProtocolStr(FLAGS_protocol)) {
+    LOG(ERROR) << "Unknown protocol " << FLAGS_protocol;
+    return 1;
+  }
+  auto proto = getCodecProtocolFromStr(FLAGS_protocol);
+  vector<string> names;
+  folly::split(',', FLAGS_captures, names, true);
+  vector<Capture> captures(names.size());
+  size_t bytes = 0;
+  for (size_t i = 0; i < names.size(); i++) {
+    if (!loadCapture(names[i], captures[i])) {
+      return 1;
+    }
+    bytes += captures[i].bytes.size();
+  }
+  if (captures.empty()) {
+    LOG(ERROR) << "No captures to replay, see --captures";
+    return 1;
+  }
+
+  Results results;
+  auto allocsBefore = getThreadAllocCounts();
+  auto start = std::chrono::steady_clock::now();
+  for (int32_t i = 0; i < FLAGS_iterations; i++) {
+    results.sessionsClosed = 0;
+    replay(proto, captures, results);
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - start).count();
+  auto allocs = getThreadAllocCounts();
+
+  auto& latencies = results.latencies;
+  if (latencies.empty()) {
+    LOG(ERROR) << "No request in the captures was answered";
+    return 1;
+  }
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&latencies] (double p) {
+    return latencies[std::min(latencies.size() - 1,
+                              size_t(p * latencies.size()))];
+  };
+  printf("%zu captures, %zu bytes, %zu requests, %llu parse errors\n",
+         captures.size(), bytes, latencies.size() / FLAGS_iterations,
+         (unsigned long long)results.parseErrors / FLAGS_iterations);
+  printf("  %10.0f req/s %9.1f MB/s in  p50 %6lldus  p99 %6lldus\n",
+         latencies.size() * 1e6 / std::max<int64_t>(elapsed, 1),
+         double(bytes) * FLAGS_iterations / std::max<int64_t>(elapsed, 1),
+         (long long)percentile(0.5), (long long)percentile(0.99));
+  if (kAllocStatsEnabled) {
+    double requests = latencies.size();
+    printf("  %10.2f allocs/req %7.0f B/req %6.2f clones/req "
+           "%6.2f header copies/req\n",
+           (allocs.allocations - allocsBefore.allocations) / requests,
+           (allocs.allocatedBytes - allocsBefore.allocatedBytes) / requests,
+           (allocs.iobufClones - allocsBefore.iobufClones) / requests,
+           (allocs.headerCopies - allocsBefore.headerCopies) / requests);
+  }
+  return 0;
+}
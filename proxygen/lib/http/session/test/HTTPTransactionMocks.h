@@ -84,6 +84,20 @@ class MockHTTPTransactionTransport: public HTTPTransaction::Transport {
       ->getCodecNonConst();
   }
   MOCK_CONST_METHOD0(isDraining, bool());
+  GMOCK_METHOD0_(, noexcept,, getReceiveWindowTuningRTTNonConst,
+                 std::chrono::microseconds());
+  std::chrono::microseconds getReceiveWindowTuningRTT()
+    const noexcept override {
+    return const_cast<MockHTTPTransactionTransport*>(this)
+      ->getReceiveWindowTuningRTTNonConst();
+  }
+  GMOCK_METHOD1_(, noexcept,, getEgressBufferQuotaNonConst,
+                 uint64_t(const HTTPTransaction&));
+  uint64_t getEgressBufferQuota(const HTTPTransaction& txn)
+    const noexcept override {
+    return const_cast<MockHTTPTransactionTransport*>(this)
+      ->getEgressBufferQuotaNonConst(txn);
+  }
 };
 
 class MockHTTPTransaction : public HTTPTransaction {
@@ -117,6 +131,16 @@ class MockHTTPTransaction : public HTTPTransaction {
   MOCK_CONST_METHOD0(extraResponseExpected, bool());
 
   MOCK_METHOD1(sendHeaders, void(const HTTPMessage& headers));
+  void sendHeadersWithEOM(const HTTPMessage& headers) override {
+    sendHeaders(headers);
+    sendEOM();
+  }
+  void sendHeadersWithBodyAndEOM(const HTTPMessage& headers,
+                                 std::unique_ptr<folly::IOBuf> body) override {
+    sendHeaders(headers);
+    sendBody(std::move(body));
+    sendEOM();
+  }
   MOCK_METHOD1(sendBody, void(std::shared_ptr<folly::IOBuf>));
   void sendBody(std::unique_ptr<folly::IOBuf> iob) noexcept override {
     sendBody(std::shared_ptr<folly::IOBuf>(iob.release()));
@@ -9,6 +9,7 @@
  */
 #include <folly/Foreach.h>
 #include <folly/io/Cursor.h>
+#include <folly/io/async/AsyncSSLSocket.h>
 #include <folly/io/async/EventBase.h>
 #include <folly/io/async/TimeoutManager.h>
 #include <gtest/gtest.h>
@@ -20,6 +21,7 @@
 #include <proxygen/lib/http/session/test/TestUtils.h>
 #include <proxygen/lib/test/TestAsyncTransport.h>
 #include <string>
+#include <thread>
 #include <folly/io/async/test/MockAsyncTransport.h>
 #include <vector>
 
@@ -555,6 +557,87 @@ TEST_F(HTTPUpstreamSessionTest, two_requests_with_pause) {
   httpSession_->destroy();
 }
 
+TEST_F(HTTPUpstreamSessionTest, pipelined_requests) {
+  httpSession_->setMaxPipelineDepth(2);
+  MockHTTPHandler handler1;
+  MockHTTPHandler handler2;
+  HTTPMessage req = getGetRequest();
+  HTTPMessage headReq = getGetRequest();
+  headReq.setMethod(HTTPMethod::HEAD);
+
+  EXPECT_CALL(handler1, setTransaction(_))
+    .WillOnce(SaveArg<0>(&handler1.txn_));
+  EXPECT_CALL(handler2, setTransaction(_))
+    .WillOnce(SaveArg<0>(&handler2.txn_));
+  auto txn1 = httpSession_->newTransaction(&handler1);
+  txn1->sendHeaders(req);
+  // Not behind a request still being sent
+  EXPECT_FALSE(httpSession_->canPipeline());
+  EXPECT_EQ(nullptr, httpSession_->newTransaction(&handler2));
+  txn1->sendEOM();
+  eventBase_.loop();
+  EXPECT_TRUE(httpSession_->canPipeline());
+  auto txn2 = httpSession_->newTransaction(&handler2);
+  ASSERT_NE(nullptr, txn2);
+  txn2->sendHeaders(headReq);
+  txn2->sendEOM();
+  eventBase_.loop();
+  EXPECT_FALSE(httpSession_->canPipeline());
+
+  // The responses come in order, the second one without a body as it is
+  // to a HEAD
+  InSequence dummy;
+  EXPECT_CALL(handler1, onHeadersComplete(_));
+  EXPECT_CALL(handler1, onBody(_));
+  EXPECT_CALL(handler1, onEOM());
+  EXPECT_CALL(handler1, detachTransaction());
+  EXPECT_CALL(handler2, onHeadersComplete(_));
+  EXPECT_CALL(handler2, onEOM());
+  EXPECT_CALL(handler2, detachTransaction());
+  readAndLoop("HTTP/1.1 200 OK\r\n"
+              "Content-Length: 7\r\n\r\n"
+              "content"
+              "HTTP/1.1 200 OK\r\n"
+              "Content-Length: 7\r\n\r\n");
+  EXPECT_TRUE(httpSession_->isReusable());
+  httpSession_->destroy();
+}
+
+TEST_F(HTTPUpstreamSessionTest, pipelined_requests_connection_close) {
+  httpSession_->setMaxPipelineDepth(3);
+  MockHTTPHandler handler1;
+  MockHTTPHandler handler2;
+  HTTPMessage req = getGetRequest();
+
+  EXPECT_CALL(handler1, setTransaction(_))
+    .WillOnce(SaveArg<0>(&handler1.txn_));
+  EXPECT_CALL(handler2, setTransaction(_))
+    .WillOnce(SaveArg<0>(&handler2.txn_));
+  for (auto handler: {&handler1, &handler2}) {
+    auto txn = httpSession_->newTransaction(handler);
+    ASSERT_NE(nullptr, txn);
+    txn->sendHeaders(req);
+    txn->sendEOM();
+    eventBase_.loop();
+  }
+
+  // The server closes after the first, so the second can be retried
+  EXPECT_CALL(handler1, onHeadersComplete(_));
+  EXPECT_CALL(handler1, onBody(_));
+  EXPECT_CALL(handler1, onEOM());
+  EXPECT_CALL(handler1, detachTransaction());
+  EXPECT_CALL(handler2, onError(_))
+    .WillOnce(Invoke([] (const HTTPException& err) {
+          EXPECT_EQ(kErrorStreamUnacknowledged, err.getProxygenError());
+        }));
+  EXPECT_CALL(handler2, detachTransaction());
+  readAndLoop("HTTP/1.1 200 OK\r\n"
+              "Connection: close\r\n"
+              "Content-Length: 7\r\n\r\n"
+              "content");
+  EXPECT_TRUE(sessionDestroyed_);
+}
+
 typedef TimeoutableHTTPUpstreamTest<HTTP1xCodecPair> HTTPUpstreamTimeoutTest;
 TEST_F(HTTPUpstreamTimeoutTest, write_timeout_after_response) {
   // Test where the upstream session times out while writing the request
@@ -1599,6 +1682,164 @@ TEST_F(MockHTTPUpstreamTest, force_shutdown_in_set_transaction) {
   (void)httpSession_->newTransaction(&handler);
 }
 
+namespace {
+
+// An AsyncSSLSocket that writes nothing, but notes the TLS records the
+// buffers it is handed would go out in: a buffer of at least the minimum
+// write size makes records of its own, smaller ones are merged, and no
+// record is larger than 16KB.
+class RecordingSSLSocket : public AsyncSSLSocket {
+ public:
+  explicit RecordingSSLSocket(EventBase* evb)
+      : AsyncSSLSocket(std::make_shared<SSLContext>(), evb) {}
+
+  void setReadCB(ReadCallback* callback) override {
+    readCallback_ = callback;
+  }
+  ReadCallback* getReadCallback() const override {
+    return readCallback_;
+  }
+  bool good() const override { return good_; }
+  bool readable() const override { return false; }
+  bool error() const override { return !good_; }
+  void closeNow() override { good_ = false; }
+  void closeWithReset() override { good_ = false; }
+  void shutdownWriteNow() override {}
+  size_t getAppBytesWritten() const override { return bytesWritten_; }
+  size_t getRawBytesWritten() const override { return bytesWritten_; }
+
+  void writeChain(WriteCallback* callback, unique_ptr<IOBuf>&& buf,
+                  WriteFlags flags) override {
+    size_t pending = 0;
+    for (auto range: *buf) {
+      pending += range.size();
+      if (pending >= getMinWriteSize()) {
+        addRecords(pending);
+        pending = 0;
+      }
+    }
+    addRecords(pending);
+    getEventBase()->runInLoop([callback] { callback->writeSuccess(); });
+  }
+
+  vector<size_t> records;
+
+ private:
+  void addRecords(size_t len) {
+    bytesWritten_ += len;
+    while (len > 0) {
+      records.push_back(std::min<size_t>(len, 16384));
+      len -= records.back();
+    }
+  }
+
+  ReadCallback* readCallback_{nullptr};
+  bool good_{true};
+  size_t bytesWritten_{0};
+};
+
+}
+
+class TLSRecordSizingTest: public testing::Test {
+ public:
+  void SetUp() override {
+    HTTPSession::setPendingWriteMax(65536);
+    sock_ = new RecordingSSLSocket(&eventBase_);
+    sock_->setMinWriteSize(1024);
+    httpSession_ = new HTTPUpstreamSession(
+      transactionTimeouts_.get(),
+      AsyncTransportWrapper::UniquePtr(sock_),
+      localAddr, peerAddr,
+      makeClientCodec<HTTP1xCodec>(1),
+      mockTransportInfo, nullptr);
+    httpSession_->startNow();
+    EXPECT_CALL(handler_, setTransaction(_))
+      .WillOnce(SaveArg<0>(&handler_.txn_));
+    auto txn = httpSession_->newTransaction(&handler_);
+    HTTPMessage req = getPostRequest();
+    req.getHeaders().set(HTTP_HEADER_CONTENT_LENGTH, "1000000");
+    txn->sendHeaders(req);
+  }
+
+  void TearDown() override {
+    httpSession_->dropConnection();
+  }
+
+ protected:
+  // The records of sending size more bytes of the request body
+  vector<size_t> sendBody(size_t size) {
+    sock_->records.clear();
+    handler_.txn_->sendBody(makeBuf(size));
+    eventBase_.loop();
+    return sock_->records;
+  }
+
+  EventBase eventBase_;
+  AsyncTimeoutSet::UniquePtr transactionTimeouts_{
+    makeInternalTimeoutSet(&eventBase_)};
+  RecordingSSLSocket* sock_{nullptr};
+  HTTPUpstreamSession* httpSession_{nullptr};
+  NiceMock<MockHTTPHandler> handler_;
+};
+
+TEST_F(TLSRecordSizingTest, small_records_after_idle) {
+  ASSERT_TRUE(httpSession_->setTLSRecordSizing(
+                1024, 4096, std::chrono::milliseconds(200)));
+  // The headers and the first 4KB go out in small records, the rest of
+  // the bulk transfer in full ones
+  auto records = sendBody(40000);
+  ASSERT_GE(records.size(), 6);
+  for (size_t i = 0; i < 4; i++) {
+    EXPECT_EQ(records[i], 1024);
+  }
+  EXPECT_EQ(records[4], 16384);
+
+  // Still busy, so there is no going back to small records
+  records = sendBody(20000);
+  ASSERT_GE(records.size(), 2);
+  EXPECT_EQ(records[0], 16384);
+
+  // Until the session has been idle
+  std::this_thread::sleep_for(std::chrono::milliseconds(250));
+  records = sendBody(30000);
+  ASSERT_GE(records.size(), 5);
+  for (size_t i = 0; i < 4; i++) {
+    EXPECT_EQ(records[i], 1024);
+  }
+  EXPECT_EQ(records[4], 16384);
+}
+
+TEST_F(TLSRecordSizingTest, record_size_raised_to_min_write_size) {
+  ASSERT_TRUE(httpSession_->setTLSRecordSizing(
+                100, 2048, std::chrono::milliseconds(200)));
+  auto records = sendBody(20000);
+  ASSERT_GE(records.size(), 3);
+  EXPECT_EQ(records[0], 1024);
+  EXPECT_EQ(records[1], 1024);
+  EXPECT_EQ(records[2], 16384);
+}
+
+TEST_F(TLSRecordSizingTest, disabled) {
+  // Off by default
+  auto records = sendBody(40000);
+  ASSERT_GE(records.size(), 2);
+  EXPECT_EQ(records[0], 16384);
+
+  // and with no small bytes
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  ASSERT_TRUE(httpSession_->setTLSRecordSizing(
+                1024, 0, std::chrono::milliseconds(1)));
+  records = sendBody(40000);
+  ASSERT_GE(records.size(), 2);
+  EXPECT_EQ(records[0], 16384);
+}
+
+TEST_F(HTTPUpstreamSessionTest, tls_record_sizing_needs_tls) {
+  EXPECT_FALSE(httpSession_->setTLSRecordSizing(
+                 1024, 4096, std::chrono::milliseconds(200)));
+  httpSession_->destroy();
+}
+
 // Register and instantiate all our type-paramterized tests
 REGISTER_TYPED_TEST_CASE_P(HTTPUpstreamTest,
                            immediate_eof/*[, other_test]*/);
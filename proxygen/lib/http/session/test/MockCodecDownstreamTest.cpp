@@ -767,6 +767,77 @@ TEST_F(MockCodecDownstreamTest, buffering) {
   eventBase_.loop();
 }
 
+TEST_F(MockCodecDownstreamTest, stream_buffer_limit) {
+  // A paused stream without flow control is reset when it buffers more
+  // than its limit, before it can pause reads for the other stream
+  MockHTTPHandler handler1;
+  MockHTTPHandler handler2;
+  auto req1 = makePostRequest();
+  auto req2 = makePostRequest();
+  auto chunk = makeBuf(10);
+
+  fakeMockCodec(*codec_);
+  EXPECT_CALL(*codec_, supportsStreamFlowControl())
+    .WillRepeatedly(Return(false));
+
+  httpSession_->setDefaultReadBufferLimit(25);
+  HTTPSession::setDefaultStreamReadBufferLimit(15);
+
+  EXPECT_CALL(mockController_, getRequestHandler(_, _))
+    .WillOnce(Return(&handler1))
+    .WillOnce(Return(&handler2));
+
+  EXPECT_CALL(handler1, setTransaction(_))
+    .WillOnce(SaveArg<0>(&handler1.txn_));
+  EXPECT_CALL(handler1, onHeadersComplete(_))
+    .WillOnce(InvokeWithoutArgs([&handler1] () {
+          handler1.txn_->pauseIngress();
+        }));
+  EXPECT_CALL(*codec_, generateRstStream(_, 1, ErrorCode::FLOW_CONTROL_ERROR))
+    .WillOnce(Return(1));
+  EXPECT_CALL(handler1, onError(_))
+    .WillOnce(Invoke([] (const HTTPException& ex) {
+          EXPECT_TRUE(ex.hasCodecStatusCode());
+          EXPECT_EQ(ex.getCodecStatusCode(), ErrorCode::FLOW_CONTROL_ERROR);
+        }));
+  EXPECT_CALL(handler1, detachTransaction());
+
+  EXPECT_CALL(*transport_, writeChain(_, _, _))
+    .WillRepeatedly(Invoke([&] (folly::AsyncTransportWrapper::WriteCallback* callback,
+                                const shared_ptr<IOBuf> iob,
+                                WriteFlags flags) {
+                             callback->writeSuccess();
+                           }));
+
+  codecCallback_->onMessageBegin(HTTPCodec::StreamID(1), req1.get());
+  codecCallback_->onHeadersComplete(HTTPCodec::StreamID(1), std::move(req1));
+  for (int i = 0; i < 2; i++) {
+    codecCallback_->onBody(HTTPCodec::StreamID(1), chunk->clone(), 0);
+  }
+
+  EXPECT_CALL(handler2, setTransaction(_))
+    .WillOnce(SaveArg<0>(&handler2.txn_));
+  EXPECT_CALL(handler2, onHeadersComplete(_));
+  EXPECT_CALL(handler2, onBody(_));
+  EXPECT_CALL(handler2, onEOM())
+    .WillOnce(InvokeWithoutArgs([&handler2] () {
+          handler2.sendReplyWithBody(200, 100);
+        }));
+  EXPECT_CALL(handler2, detachTransaction());
+
+  codecCallback_->onMessageBegin(HTTPCodec::StreamID(3), req2.get());
+  codecCallback_->onHeadersComplete(HTTPCodec::StreamID(3), std::move(req2));
+  codecCallback_->onBody(HTTPCodec::StreamID(3), chunk->clone(), 0);
+  codecCallback_->onMessageComplete(HTTPCodec::StreamID(3), false);
+  eventBase_.loop();
+  // reads were never paused
+  EXPECT_NE(transportCb_, nullptr);
+
+  HTTPSession::setDefaultStreamReadBufferLimit(0);
+  EXPECT_CALL(mockController_, detachSession(_));
+  httpSession_->shutdownTransportWithReset(kErrorConnectionReset);
+}
+
 TEST_F(MockCodecDownstreamTest, spdy_window) {
   // Test window updates
   MockHTTPHandler handler1;
@@ -849,6 +920,64 @@ TEST_F(MockCodecDownstreamTest, spdy_window) {
   httpSession_->shutdownTransportWithReset(kErrorConnectionReset);
 }
 
+TEST_F(MockCodecDownstreamTest, spdy_initial_window_grows) {
+  // A larger initial window resumes the transactions it paused
+  MockHTTPHandler handler1;
+  auto req1 = makeGetRequest();
+
+  fakeMockCodec(*codec_);
+
+  {
+    InSequence enforceOrder;
+    EXPECT_CALL(mockController_, getRequestHandler(_, _))
+      .WillOnce(Return(&handler1));
+
+    EXPECT_CALL(handler1, setTransaction(_))
+      .WillOnce(Invoke([&handler1] (HTTPTransaction* txn) {
+            handler1.txn_ = txn; }));
+    EXPECT_CALL(handler1, onHeadersComplete(_))
+      .WillOnce(InvokeWithoutArgs([this] () {
+            codecCallback_->onSettings(
+              {{SettingsId::INITIAL_WINDOW_SIZE, 4000}});
+          }));
+    EXPECT_CALL(handler1, onEOM())
+      .WillOnce(InvokeWithoutArgs([&handler1] () {
+            handler1.sendHeaders(200, 12000);
+            handler1.sendBody(12000);
+          }));
+    EXPECT_CALL(handler1, onEgressPaused())
+      .WillOnce(InvokeWithoutArgs([this] () {
+            eventBase_.runInLoop([this] {
+                // 4kb sent, the other 8kb fit in the new window
+                codecCallback_->onSettings(
+                  {{SettingsId::INITIAL_WINDOW_SIZE, 3000},
+                   {SettingsId::INITIAL_WINDOW_SIZE, 16000}});
+              });
+          }));
+    EXPECT_CALL(handler1, onEgressResumed())
+      .WillOnce(InvokeWithoutArgs([&handler1] () {
+            handler1.txn_->sendEOM();
+          }));
+
+    EXPECT_CALL(handler1, detachTransaction());
+
+    codecCallback_->onMessageBegin(HTTPCodec::StreamID(1), req1.get());
+    codecCallback_->onHeadersComplete(HTTPCodec::StreamID(1), std::move(req1));
+    codecCallback_->onMessageComplete(HTTPCodec::StreamID(1), false);
+
+    EXPECT_CALL(mockController_, detachSession(_));
+  }
+
+  EXPECT_CALL(*transport_, writeChain(_, _, _))
+    .WillRepeatedly(Invoke([] (folly::AsyncTransportWrapper::WriteCallback* callback,
+                               std::shared_ptr<folly::IOBuf> iob,
+                               folly::WriteFlags flags) {
+                             callback->writeSuccess();
+                           }));
+  eventBase_.loop();
+  httpSession_->shutdownTransportWithReset(kErrorConnectionReset);
+}
+
 TEST_F(MockCodecDownstreamTest, double_resume) {
   // Test spdy ping mechanism and egress re-ordering
   MockHTTPHandler handler1;
@@ -1044,6 +1173,37 @@ TEST_F(MockCodecDownstreamTest, unpaused_large_post) {
   httpSession_->shutdownTransportWithReset(kErrorConnectionReset);
 }
 
+TEST_F(MockCodecDownstreamTest, batched_window_updates) {
+  // With batching, the credits accrued on the stream and the session
+  // during a loop are acked together at its end
+  InSequence enforceOrder;
+  NiceMock<MockHTTPHandler> handler1;
+  httpSession_->setWindowUpdateBatching(true);
+  auto req1 = makePostRequest();
+
+  EXPECT_CALL(mockController_, getRequestHandler(_, _))
+    .WillOnce(Return(&handler1));
+  EXPECT_CALL(handler1, setTransaction(_))
+    .WillOnce(SaveArg<0>(&handler1.txn_));
+
+  EXPECT_CALL(handler1, onHeadersComplete(_));
+  EXPECT_CALL(handler1, onBody(PtrBufHasLen(20000)))
+    .Times(3);
+  EXPECT_CALL(*codec_, generateWindowUpdate(_, 1, 40000));
+  EXPECT_CALL(*codec_, generateWindowUpdate(_, 0, 60000));
+
+  codecCallback_->onMessageBegin(1, req1.get());
+  codecCallback_->onHeadersComplete(1, std::move(req1));
+  for (unsigned i = 0; i < 3; ++i) {
+    codecCallback_->onBody(1, makeBuf(20000), 0);
+  }
+  eventBase_.loopOnce();
+
+  // Just tear everything down now.
+  EXPECT_CALL(mockController_, detachSession(_));
+  httpSession_->shutdownTransportWithReset(kErrorConnectionReset);
+}
+
 TEST_F(MockCodecDownstreamTest, ingress_paused_window_update) {
   // Test sending a large response body while the handler has ingress paused. We
   // should process the ingress window_updates and deliver the full body
@@ -0,0 +1,37 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <gtest/gtest.h>
+#include <proxygen/lib/http/session/SessionMemoryAccountant.h>
+
+using namespace proxygen;
+
+TEST(SessionMemoryAccountant, hysteresis) {
+  SessionMemoryAccountant accountant(1000, 500);
+  EXPECT_FALSE(accountant.isUnderPressure());
+  accountant.add(1000);
+  EXPECT_FALSE(accountant.isUnderPressure());
+  accountant.add(1);
+  EXPECT_TRUE(accountant.isUnderPressure());
+  // Stays under pressure until back down to the low watermark
+  accountant.add(-400);
+  EXPECT_TRUE(accountant.isUnderPressure());
+  accountant.add(-101);
+  EXPECT_FALSE(accountant.isUnderPressure());
+  accountant.add(400);
+  EXPECT_FALSE(accountant.isUnderPressure());
+  EXPECT_EQ(900, accountant.getBytes());
+}
+
+TEST(SessionMemoryAccountant, neverNegative) {
+  SessionMemoryAccountant accountant(1000, 500);
+  accountant.add(-10);
+  EXPECT_EQ(0, accountant.getBytes());
+  EXPECT_FALSE(accountant.isUnderPressure());
+}
@@ -0,0 +1,91 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/Benchmark.h>
+#include <map>
+#include <proxygen/lib/http/session/StreamTable.h>
+
+using namespace folly;
+using namespace proxygen;
+
+namespace {
+
+// Roughly the footprint of an HTTPTransaction
+struct Payload {
+  explicit Payload(HTTPCodec::StreamID i): id(i) {}
+  HTTPCodec::StreamID id;
+  char pad[512];
+};
+
+typedef std::map<HTTPCodec::StreamID, Payload> PayloadMap;
+
+// Keep `concurrency` streams open; each iteration opens a new stream,
+// looks up every open stream as if one frame arrived for each, and closes
+// the oldest stream.
+void streamTableChurn(uint32_t numIters, uint32_t concurrency) {
+  StreamTable<Payload> table;
+  HTTPCodec::StreamID next = 1;
+  BENCHMARK_SUSPEND {
+    for (uint32_t i = 0; i < concurrency; ++i, next += 2) {
+      table.emplace(next, next);
+    }
+  }
+  uint64_t sum = 0;
+  for (uint32_t i = 0; i < numIters; ++i, next += 2) {
+    table.emplace(next, next);
+    for (HTTPCodec::StreamID id = next - 2 * concurrency; id <= next;
+         id += 2) {
+      auto val = table.find(id);
+      sum += val ? val->id : 0;
+    }
+    table.erase(next - 2 * concurrency);
+  }
+  doNotOptimizeAway(sum);
+}
+
+void mapChurn(uint32_t numIters, uint32_t concurrency) {
+  PayloadMap map;
+  HTTPCodec::StreamID next = 1;
+  BENCHMARK_SUSPEND {
+    for (uint32_t i = 0; i < concurrency; ++i, next += 2) {
+      map.emplace(std::piecewise_construct,
+                  std::forward_as_tuple(next),
+                  std::forward_as_tuple(next));
+    }
+  }
+  uint64_t sum = 0;
+  for (uint32_t i = 0; i < numIters; ++i, next += 2) {
+    map.emplace(std::piecewise_construct,
+                std::forward_as_tuple(next),
+                std::forward_as_tuple(next));
+    for (HTTPCodec::StreamID id = next - 2 * concurrency; id <= next;
+         id += 2) {
+      auto it = map.find(id);
+      sum += (it != map.end()) ? it->second.id : 0;
+    }
+    map.erase(next - 2 * concurrency);
+  }
+  doNotOptimizeAway(sum);
+}
+
+}
+
+BENCHMARK_PARAM(mapChurn, 1)
+BENCHMARK_RELATIVE_PARAM(streamTableChurn, 1)
+BENCHMARK_PARAM(mapChurn, 10)
+BENCHMARK_RELATIVE_PARAM(streamTableChurn, 10)
+BENCHMARK_PARAM(mapChurn, 100)
+BENCHMARK_RELATIVE_PARAM(streamTableChurn, 100)
+BENCHMARK_PARAM(mapChurn, 1000)
+BENCHMARK_RELATIVE_PARAM(streamTableChurn, 1000)
+
+int main(int argc, char* argv[]) {
+  folly::runBenchmarks();
+  return 0;
+}
@@ -0,0 +1,115 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <gtest/gtest.h>
+
+#include <map>
+#include <proxygen/lib/http/session/StreamTable.h>
+#include <set>
+
+using namespace proxygen;
+
+namespace {
+
+struct Value {
+  explicit Value(HTTPCodec::StreamID i): id(i) {
+    ++live;
+  }
+  ~Value() {
+    --live;
+  }
+  HTTPCodec::StreamID id;
+  static int live;
+};
+
+int Value::live = 0;
+
+}
+
+TEST(StreamTableTest, basic) {
+  StreamTable<Value> table;
+  EXPECT_TRUE(table.empty());
+  EXPECT_EQ(nullptr, table.find(1));
+  EXPECT_FALSE(table.erase(1));
+
+  auto res = table.emplace(1, 1);
+  EXPECT_TRUE(res.second);
+  EXPECT_EQ(1, res.first->id);
+  EXPECT_EQ(res.first, table.find(1));
+  EXPECT_EQ(1, table.count(1));
+
+  // A second emplace returns the existing value
+  auto res2 = table.emplace(1, 100);
+  EXPECT_FALSE(res2.second);
+  EXPECT_EQ(res.first, res2.first);
+  EXPECT_EQ(1, res2.first->id);
+
+  EXPECT_TRUE(table.erase(1));
+  EXPECT_TRUE(table.empty());
+  EXPECT_EQ(0, Value::live);
+}
+
+TEST(StreamTableTest, stable_addresses) {
+  StreamTable<Value> table;
+  std::map<HTTPCodec::StreamID, Value*> addrs;
+  for (HTTPCodec::StreamID id = 1; id < 2000; id += 2) {
+    addrs[id] = table.emplace(id, id).first;
+  }
+  // Growing the table must not move the values
+  for (auto& entry: addrs) {
+    EXPECT_EQ(entry.second, table.find(entry.first));
+    EXPECT_EQ(entry.first, entry.second->id);
+  }
+  table.clear();
+  EXPECT_EQ(0, Value::live);
+}
+
+TEST(StreamTableTest, mixed_parity_churn) {
+  // Interleave client (odd) and push (even) streams, deleting out of
+  // order, and compare against std::map
+  StreamTable<Value> table;
+  std::set<HTTPCodec::StreamID> expected;
+  HTTPCodec::StreamID nextOdd = 1;
+  HTTPCodec::StreamID nextEven = 2;
+  for (uint32_t round = 0; round < 5000; ++round) {
+    if (round % 3 != 2) {
+      table.emplace(nextOdd, nextOdd);
+      expected.insert(nextOdd);
+      nextOdd += 2;
+    } else {
+      table.emplace(nextEven, nextEven);
+      expected.insert(nextEven);
+      nextEven += 2;
+    }
+    if (expected.size() > 50) {
+      // Remove the oldest and a middle stream
+      auto it = expected.begin();
+      EXPECT_TRUE(table.erase(*it));
+      expected.erase(it);
+      it = expected.begin();
+      std::advance(it, expected.size() / 2);
+      EXPECT_TRUE(table.erase(*it));
+      expected.erase(it);
+    }
+    ASSERT_EQ(expected.size(), table.size());
+  }
+  for (auto id: expected) {
+    auto value = table.find(id);
+    ASSERT_NE(nullptr, value);
+    EXPECT_EQ(id, value->id);
+  }
+  std::set<HTTPCodec::StreamID> iterated;
+  for (const auto& entry: table) {
+    EXPECT_EQ(entry.first, entry.second.id);
+    iterated.insert(entry.first);
+  }
+  EXPECT_EQ(expected, iterated);
+  EXPECT_EQ(nullptr, table.find(nextOdd));
+  EXPECT_EQ(nullptr, table.find(nextEven));
+}
@@ -0,0 +1,118 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/io/async/EventBase.h>
+#include <gtest/gtest.h>
+#include <proxygen/lib/http/session/TenantScheduler.h>
+
+using namespace folly;
+using namespace proxygen;
+
+namespace {
+
+class FakeMember: public TenantScheduler::Member {
+ public:
+  void onIngressAllowed() noexcept override {
+    ingressAllowed++;
+  }
+  void onEgressAllowed() noexcept override {
+    egressAllowed++;
+  }
+
+  uint32_t ingressAllowed{0};
+  uint32_t egressAllowed{0};
+};
+
+TenantScheduler::Options makeOptions() {
+  TenantScheduler::Options options;
+  options.ingressQuantum = 1000;
+  options.egressQuantum = 1000;
+  return options;
+}
+
+}
+
+TEST(TenantScheduler, alone_never_held) {
+  EventBase eventBase;
+  TenantScheduler scheduler(&eventBase, nullptr, makeOptions());
+  FakeMember member;
+  auto tenant = scheduler.addMember("a");
+  for (int i = 0; i < 3; i++) {
+    EXPECT_TRUE(scheduler.mayRead(tenant, &member));
+    EXPECT_TRUE(scheduler.mayWrite(tenant, &member));
+    scheduler.chargeIngress(tenant, 5000);
+    scheduler.chargeEgress(tenant, 5000);
+    eventBase.loopOnce();
+  }
+  EXPECT_EQ(1, scheduler.getNumBusyTenants());
+  scheduler.removeMember(tenant, &member);
+  EXPECT_EQ(0, scheduler.getNumTenants());
+}
+
+TEST(TenantScheduler, weighted_share) {
+  EventBase eventBase;
+  TenantScheduler scheduler(&eventBase, nullptr, makeOptions());
+  scheduler.setWeight("b", 2);
+  FakeMember a;
+  FakeMember b;
+  auto tenantA = scheduler.addMember("a");
+  auto tenantB = scheduler.addMember("b");
+  EXPECT_EQ(2, scheduler.getNumTenants());
+
+  // both busy in the first round
+  scheduler.chargeEgress(tenantA, 1000);
+  scheduler.chargeEgress(tenantB, 2000);
+  eventBase.loopOnce();
+  EXPECT_EQ(2, scheduler.getNumBusyTenants());
+
+  // b gets to write twice as much as a before it waits
+  EXPECT_TRUE(scheduler.mayWrite(tenantA, &a));
+  scheduler.chargeEgress(tenantA, 1000);
+  EXPECT_FALSE(scheduler.mayWrite(tenantA, &a));
+  EXPECT_TRUE(scheduler.mayWrite(tenantB, &b));
+  scheduler.chargeEgress(tenantB, 1500);
+  EXPECT_TRUE(scheduler.mayWrite(tenantB, &b));
+  scheduler.chargeEgress(tenantB, 500);
+  EXPECT_FALSE(scheduler.mayWrite(tenantB, &b));
+  // reads have credit of their own
+  EXPECT_TRUE(scheduler.mayRead(tenantA, &a));
+
+  // and the next round lets them go
+  eventBase.loopOnce();
+  EXPECT_EQ(1, a.egressAllowed);
+  EXPECT_EQ(1, b.egressAllowed);
+  EXPECT_EQ(0, a.ingressAllowed);
+  EXPECT_TRUE(scheduler.mayWrite(tenantA, &a));
+
+  scheduler.removeMember(tenantA, &a);
+  scheduler.removeMember(tenantB, &b);
+  EXPECT_EQ(0, scheduler.getNumTenants());
+}
+
+TEST(TenantScheduler, debt_carries_over) {
+  EventBase eventBase;
+  TenantScheduler scheduler(&eventBase, nullptr, makeOptions());
+  FakeMember a;
+  FakeMember b;
+  auto tenantA = scheduler.addMember("a");
+  auto tenantB = scheduler.addMember("b");
+  scheduler.chargeEgress(tenantA, 1);
+  scheduler.chargeEgress(tenantB, 1);
+  eventBase.loopOnce();
+
+  // a overdraws by a round's worth, and sits the next one out
+  scheduler.chargeEgress(tenantA, 2000);
+  scheduler.chargeEgress(tenantB, 1);
+  eventBase.loopOnce();
+  EXPECT_FALSE(scheduler.mayWrite(tenantA, &a));
+  EXPECT_TRUE(scheduler.mayWrite(tenantB, &b));
+
+  scheduler.removeMember(tenantA, &a);
+  scheduler.removeMember(tenantB, &b);
+}
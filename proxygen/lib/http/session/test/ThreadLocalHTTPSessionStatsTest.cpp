@@ -0,0 +1,107 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <gtest/gtest.h>
+#include <map>
+#include <proxygen/lib/http/session/ThreadLocalHTTPSessionStats.h>
+#include <thread>
+#include <vector>
+
+using namespace proxygen;
+
+using Stats = ThreadLocalHTTPSessionStats;
+
+TEST(ThreadLocalHTTPSessionStatsTest, buckets) {
+  EXPECT_EQ(Stats::getBucket(0), 0);
+  EXPECT_EQ(Stats::getBucket(1), 1);
+  EXPECT_EQ(Stats::getBucket(2), 2);
+  EXPECT_EQ(Stats::getBucket(3), 2);
+  EXPECT_EQ(Stats::getBucket(4), 3);
+  EXPECT_EQ(Stats::getBucket(uint64_t(-1)), Stats::kNumBuckets - 1);
+}
+
+TEST(ThreadLocalHTTPSessionStatsTest, single_thread) {
+  Stats stats;
+  stats.recordTransactionOpened();
+  stats.recordTransactionOpened();
+  stats.recordTransactionClosed();
+  stats.recordTransactionsServed(3);
+  stats.recordSessionIdleTime(std::chrono::seconds(0));
+  stats.recordTTLBATracked();
+  stats.recordSessionPhaseTime(SessionPhase::WRITE,
+                               std::chrono::microseconds(5));
+  stats.recordPoolAllocations(PooledObject::MESSAGE, 2, 7);
+
+  auto snapshot = stats.getSnapshot();
+  EXPECT_EQ(snapshot.get(Stats::TRANSACTIONS_OPENED), 2);
+  EXPECT_EQ(snapshot.get(Stats::TRANSACTIONS_CLOSED), 1);
+  EXPECT_EQ(snapshot.get(Stats::SESSIONS_REUSED), 0);
+  EXPECT_EQ(snapshot.get(Stats::TTLBA_TRACKED), 1);
+  EXPECT_EQ(snapshot.getBucket(Stats::TRANSACTIONS_PER_SESSION, 2), 1);
+  EXPECT_EQ(snapshot.getBucket(Stats::SESSION_IDLE_SECONDS, 0), 1);
+  EXPECT_EQ(snapshot.getBucket(Stats::PHASE_WRITE_US, 3), 1);
+  EXPECT_EQ(snapshot.getBucket(Stats::PHASE_INGRESS_PARSE_US, 3), 0);
+  EXPECT_EQ(snapshot.get(Stats::POOL_MESSAGES_ALLOCATED), 2);
+  EXPECT_EQ(snapshot.get(Stats::POOL_MESSAGES_REUSED), 7);
+  EXPECT_EQ(snapshot.get(Stats::POOL_TRANSACTIONS_REUSED), 0);
+}
+
+TEST(ThreadLocalHTTPSessionStatsTest, percentiles) {
+  Stats stats;
+  EXPECT_EQ(stats.getSnapshot().getPercentile(Stats::TTLBA_MS, 99), 0);
+  for (size_t i = 0; i < 99; ++i) {
+    stats.recordTimeToFirstByte(std::chrono::milliseconds(10));
+  }
+  auto earlier = stats.getSnapshot();
+  stats.recordTimeToFirstByte(std::chrono::milliseconds(1000));
+  stats.recordTTLBALatency(std::chrono::milliseconds(3));
+
+  auto snapshot = stats.getSnapshot();
+  // 10 is in [8, 16), 1000 in [512, 1024)
+  EXPECT_EQ(snapshot.getPercentile(Stats::TIME_TO_FIRST_BYTE_MS, 50), 12);
+  EXPECT_EQ(snapshot.getPercentile(Stats::TIME_TO_FIRST_BYTE_MS, 99), 16);
+  EXPECT_EQ(snapshot.getPercentile(Stats::TIME_TO_FIRST_BYTE_MS, 100),
+            1024);
+  EXPECT_EQ(snapshot.getPercentile(Stats::TTLBA_MS, 50), 3);
+
+  auto delta = snapshot.since(earlier);
+  EXPECT_EQ(delta.getPercentile(Stats::TIME_TO_FIRST_BYTE_MS, 0), 512);
+  EXPECT_EQ(delta.getBucket(Stats::TIME_TO_FIRST_BYTE_MS, 4), 0);
+
+  std::map<std::string, uint64_t> exported;
+  snapshot.exportPercentiles(
+    {50, 99.9},
+    [&] (const std::string& name, uint64_t value) {
+      exported[name] = value;
+    });
+  EXPECT_EQ(exported.size(), 2 * Stats::NUM_HISTOGRAMS);
+  EXPECT_EQ(exported["time_to_first_byte_ms.p50"], 12);
+  EXPECT_EQ(exported["ttlba_ms.p99.9"], 3);
+  EXPECT_EQ(exported["write_buffer_kb.p50"], 0);
+}
+
+TEST(ThreadLocalHTTPSessionStatsTest, many_threads) {
+  // More threads than blocks, so some share the last one
+  const size_t kThreads = Stats::kMaxThreads + 8;
+  const size_t kOpened = 100;
+  Stats stats;
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < kThreads; ++i) {
+    threads.emplace_back([&stats] {
+        for (size_t j = 0; j < kOpened; ++j) {
+          stats.recordTransactionOpened();
+        }
+      });
+  }
+  for (auto& thread: threads) {
+    thread.join();
+  }
+  EXPECT_EQ(stats.getSnapshot().get(Stats::TRANSACTIONS_OPENED),
+            kThreads * kOpened);
+}
@@ -0,0 +1,139 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/Memory.h>
+#include <folly/io/async/EventBase.h>
+#include <gtest/gtest.h>
+#include <proxygen/lib/http/DNSResolver.h>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace folly;
+using namespace proxygen;
+
+using std::string;
+using std::vector;
+
+namespace {
+
+class InlineExecutor: public folly::Executor {
+ public:
+  void add(Func func) override {
+    func();
+  }
+};
+
+// Answers from a table instead of DNS, counting the lookups
+class TestResolver: public DNSResolver {
+ public:
+  TestResolver(Executor* executor, const Options& options)
+    : DNSResolver(executor, options) {}
+
+  vector<SocketAddress> lookup(const string& host) override {
+    lookups++;
+    if (host == "good.example.com") {
+      return {SocketAddress("10.0.0.1", 0), SocketAddress("::1", 0)};
+    }
+    throw std::runtime_error("no such host");
+  }
+
+  uint32_t lookups{0};
+};
+
+class ResolveCallback: public DNSResolver::Callback {
+ public:
+  void resolveSuccess(const vector<SocketAddress>& addrs) noexcept override {
+    results.push_back(addrs);
+  }
+  void resolveError(const AsyncSocketException& ex) noexcept override {
+    errors++;
+  }
+
+  vector<vector<SocketAddress>> results;
+  uint32_t errors{0};
+};
+
+}
+
+class DNSResolverTest: public testing::Test {
+ public:
+  DNSResolverTest() {
+    options_.ttl = std::chrono::milliseconds(50);
+    options_.negativeTtl = std::chrono::milliseconds(50);
+    options_.prefetchWindow = std::chrono::milliseconds(30);
+    resolver_ = folly::make_unique<TestResolver>(&executor_, options_);
+  }
+
+ protected:
+  EventBase eventBase_;
+  InlineExecutor executor_;
+  DNSResolver::Options options_;
+  std::unique_ptr<TestResolver> resolver_;
+  ResolveCallback callback_;
+};
+
+TEST_F(DNSResolverTest, CachesResults) {
+  resolver_->resolve(&eventBase_, "good.example.com", 443, &callback_);
+  // Lookups are answered in the thread of the caller
+  EXPECT_EQ(0, callback_.results.size());
+  eventBase_.loop();
+  ASSERT_EQ(1, callback_.results.size());
+  ASSERT_EQ(2, callback_.results[0].size());
+  EXPECT_EQ(SocketAddress("10.0.0.1", 443), callback_.results[0][0]);
+
+  // And hits right away, with the port asked for
+  resolver_->resolve(&eventBase_, "good.example.com", 80, &callback_);
+  ASSERT_EQ(2, callback_.results.size());
+  EXPECT_EQ(SocketAddress("10.0.0.1", 80), callback_.results[1][0]);
+  EXPECT_EQ(1, resolver_->lookups);
+}
+
+TEST_F(DNSResolverTest, CachesFailures) {
+  resolver_->resolve(&eventBase_, "bad.example.com", 80, &callback_);
+  eventBase_.loop();
+  resolver_->resolve(&eventBase_, "bad.example.com", 80, &callback_);
+  EXPECT_EQ(2, callback_.errors);
+  EXPECT_EQ(1, resolver_->lookups);
+
+  /* sleep override */
+  std::this_thread::sleep_for(options_.negativeTtl);
+  resolver_->resolve(&eventBase_, "bad.example.com", 80, &callback_);
+  eventBase_.loop();
+  EXPECT_EQ(3, callback_.errors);
+  EXPECT_EQ(2, resolver_->lookups);
+}
+
+TEST_F(DNSResolverTest, PrefetchesNearExpiry) {
+  resolver_->resolve(&eventBase_, "good.example.com", 80, &callback_);
+  eventBase_.loop();
+
+  // Within the prefetch window, the cached answer comes with a new lookup
+  /* sleep override */
+  std::this_thread::sleep_for(options_.ttl - options_.prefetchWindow / 2);
+  resolver_->resolve(&eventBase_, "good.example.com", 80, &callback_);
+  EXPECT_EQ(2, callback_.results.size());
+  EXPECT_EQ(2, resolver_->lookups);
+  eventBase_.loop();
+  EXPECT_EQ(2, callback_.results.size());
+}
+
+TEST_F(DNSResolverTest, CancelAndLiterals) {
+  auto request = resolver_->resolve(&eventBase_, "good.example.com", 80,
+                                    &callback_);
+  EXPECT_TRUE(request->isPending());
+  request->cancel();
+  eventBase_.loop();
+  EXPECT_EQ(0, callback_.results.size());
+
+  resolver_->resolve(&eventBase_, "127.0.0.1", 80, &callback_);
+  ASSERT_EQ(1, callback_.results.size());
+  EXPECT_EQ(SocketAddress("127.0.0.1", 80), callback_.results[0][0]);
+  EXPECT_EQ(1, resolver_->lookups);
+}
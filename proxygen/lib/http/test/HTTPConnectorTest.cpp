@@ -0,0 +1,129 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/io/async/AsyncServerSocket.h>
+#include <folly/io/async/EventBase.h>
+#include <gtest/gtest.h>
+#include <proxygen/lib/http/HTTPConnector.h>
+#include <proxygen/lib/http/session/HTTPUpstreamSession.h>
+#include <proxygen/lib/utils/TraceEventObserver.h>
+#include <vector>
+
+using namespace folly;
+using namespace proxygen;
+
+using std::vector;
+
+namespace {
+
+class ConnectCallback: public HTTPConnector::Callback {
+ public:
+  void connectSuccess(HTTPUpstreamSession* session) override {
+    sessions.push_back(session);
+  }
+  void connectError(const AsyncSocketException& ex) override {
+    errors++;
+  }
+
+  vector<HTTPUpstreamSession*> sessions;
+  uint32_t errors{0};
+};
+
+class TraceObserver: public TraceEventObserver {
+ public:
+  void traceEventAvailable(TraceEvent event) noexcept override {
+    events.push_back(std::move(event));
+  }
+
+  vector<TraceEvent> events;
+};
+
+// An address nothing listens on
+SocketAddress getClosedAddress() {
+  EventBase eventBase;
+  auto socket = AsyncServerSocket::newSocket(&eventBase);
+  socket->bind(SocketAddress("127.0.0.1", 0));
+  SocketAddress addr;
+  socket->getAddress(&addr);
+  return addr;
+}
+
+}
+
+class HTTPConnectorTest: public testing::Test {
+ public:
+  HTTPConnectorTest()
+      : transactionTimeouts_(
+          new AsyncTimeoutSet(&eventBase_,
+                              TimeoutManager::InternalEnum::INTERNAL,
+                              std::chrono::milliseconds(500))),
+        server_(AsyncServerSocket::newSocket(&eventBase_)) {
+    // Connects complete in the backlog, nothing needs to accept them
+    server_->bind(SocketAddress("127.0.0.1", 0));
+    server_->listen(10);
+    server_->getAddress(&serverAddr_);
+  }
+
+ protected:
+  EventBase eventBase_;
+  AsyncTimeoutSet::UniquePtr transactionTimeouts_;
+  AsyncServerSocket::UniquePtr server_;
+  SocketAddress serverAddr_;
+  ConnectCallback callback_;
+  TraceObserver observer_;
+};
+
+TEST_F(HTTPConnectorTest, MultiConnectSkipsFailedAddress) {
+  HTTPConnector connector(&callback_, transactionTimeouts_.get());
+  connector.setTraceEventContext(TraceEventContext(0, &observer_));
+  // The refused attempt doesn't hold up the next one
+  connector.connect(&eventBase_, {getClosedAddress(), serverAddr_},
+                    std::chrono::milliseconds(1000),
+                    std::chrono::milliseconds(10000));
+  eventBase_.loop();
+
+  ASSERT_EQ(1, callback_.sessions.size());
+  EXPECT_EQ(0, callback_.errors);
+  EXPECT_FALSE(connector.isBusy());
+  callback_.sessions[0]->dropConnection();
+
+  ASSERT_EQ(3, observer_.events.size());
+  EXPECT_EQ(TraceEventType::SingleConnector, observer_.events[0].getType());
+  EXPECT_TRUE(observer_.events[0].hasTraceField(TraceFieldType::Error));
+  EXPECT_EQ(TraceEventType::SingleConnector, observer_.events[1].getType());
+  EXPECT_FALSE(observer_.events[1].hasTraceField(TraceFieldType::Error));
+  EXPECT_EQ(TraceEventType::MultiConnector, observer_.events[2].getType());
+  EXPECT_EQ(2, observer_.events[2].getTraceFieldDataAs<int64_t>(
+              TraceFieldType::NumConnAttempts));
+  EXPECT_EQ(serverAddr_.describe(),
+            observer_.events[2].getTraceFieldDataAs<std::string>(
+              TraceFieldType::AttemptAddrs));
+}
+
+TEST_F(HTTPConnectorTest, MultiConnectAllFail) {
+  HTTPConnector connector(&callback_, transactionTimeouts_.get());
+  connector.connect(&eventBase_, {getClosedAddress(), getClosedAddress()});
+  eventBase_.loop();
+
+  EXPECT_EQ(0, callback_.sessions.size());
+  EXPECT_EQ(1, callback_.errors);
+  EXPECT_FALSE(connector.isBusy());
+}
+
+TEST_F(HTTPConnectorTest, MultiConnectCancel) {
+  HTTPConnector connector(&callback_, transactionTimeouts_.get());
+  connector.connect(&eventBase_, {serverAddr_, serverAddr_});
+  EXPECT_TRUE(connector.isBusy());
+  connector.reset();
+  EXPECT_FALSE(connector.isBusy());
+  eventBase_.loop();
+
+  EXPECT_EQ(0, callback_.sessions.size());
+  EXPECT_EQ(0, callback_.errors);
+}
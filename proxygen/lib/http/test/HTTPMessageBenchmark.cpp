@@ -0,0 +1,344 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <folly/Benchmark.h>
+#include <gflags/gflags.h>
+#include <new>
+#include <proxygen/lib/http/HTTPMessage.h>
+#include <proxygen/lib/http/codec/compress/test/HTTPArchive.h>
+#include <proxygen/lib/utils/AllocStats.h>
+#include <string>
+#include <vector>
+
+DEFINE_string(har, "", "HTTP archive to take the request and response "
+              "headers from, instead of the built-in ones");
+DEFINE_int32(report_ops, 100000, "Operations run per scenario for the "
+              "latency and allocation report, 0 to skip it");
+
+using namespace folly;
+using namespace proxygen;
+using std::string;
+using std::vector;
+
+// Allocations made by the process, to report them per operation. With
+// --enable-alloc-stats the library counts them already.
+#if PROXYGEN_ALLOC_STATS
+static uint64_t allocCount() {
+  return getThreadAllocCounts().allocations;
+}
+#else
+static uint64_t g_allocs = 0;
+
+static uint64_t allocCount() {
+  return g_allocs;
+}
+
+void* operator new(size_t size) {
+  ++g_allocs;
+  void* p = malloc(size);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+#endif
+
+namespace {
+
+// Work done around the measured code, kept out of the report
+struct Meter {
+  uint64_t untimedAllocs{0};
+  std::chrono::nanoseconds untimed{0};
+};
+
+Meter g_meter;
+
+template <typename F>
+void untimed(F&& f) {
+  BENCHMARK_SUSPEND {
+    auto allocs = allocCount();
+    auto start = std::chrono::steady_clock::now();
+    f();
+    g_meter.untimedAllocs += allocCount() - allocs;
+    g_meter.untimed += std::chrono::steady_clock::now() - start;
+  }
+}
+
+// Messages are prepared ahead in batches, for the operations that change
+// or lazily index the message they run on
+const unsigned kBatch = 256;
+
+typedef vector<vector<HPACKHeader>> HeaderCorpus;
+
+// A browser request as HTTP archives typically record them: about a
+// dozen headers, a few hundred bytes of cookies and a query string
+vector<HPACKHeader> builtinRequest(unsigned i) {
+  string cookie;
+  for (int c = 0; c < 12; c++) {
+    cookie += "c" + std::to_string(c) + "=AQHxY2Z0bWVzc2FnZXNfc2Vzc2lvbl9pZA; ";
+  }
+  cookie += "datr=" + std::to_string(i);
+  return {
+    {":path", "/ajax/pagelet/generic.php?fb_dtsg=AQHxY2Z0&__a=1&id=" +
+              std::to_string(i) + "&__req=" + std::to_string(i % 7)},
+    {"host", "www.facebook.com"},
+    {"connection", "keep-alive"},
+    {"user-agent", "Mozilla/5.0 (Macintosh; Intel Mac OS X 10_10_3) "
+                   "AppleWebKit/537.36 (KHTML, like Gecko) "
+                   "Chrome/43.0.2357.81 Safari/537.36"},
+    {"accept", "text/html,application/xhtml+xml,application/xml;q=0.9,"
+               "image/webp,*/*;q=0.8"},
+    {"accept-encoding", "gzip, deflate, sdch"},
+    {"accept-language", "en-US,en;q=0.8"},
+    {"referer", "https://www.facebook.com/"},
+    {"x-requested-with", "XMLHttpRequest"},
+    {"dnt", "1"},
+    {"cookie", cookie},
+  };
+}
+
+struct Corpus {
+  Corpus() {
+    if (!FLAGS_har.empty()) {
+      auto har = HTTPArchive::fromFile(FLAGS_har);
+      CHECK(har && !har->requests.empty())
+        << "No messages in " << FLAGS_har;
+      requests = std::move(har->requests);
+      return;
+    }
+    for (unsigned i = 0; i < 16; i++) {
+      requests.push_back(builtinRequest(i));
+    }
+  }
+
+  HeaderCorpus requests;
+};
+
+const HeaderCorpus& requestCorpus() {
+  static const Corpus corpus;
+  return corpus.requests;
+}
+
+HTTPMessage toRequest(const vector<HPACKHeader>& headers) {
+  HTTPMessage msg;
+  msg.setMethod(HTTPMethod::GET);
+  msg.setHTTPVersion(1, 1);
+  msg.setURL("/");
+  for (const auto& header: headers) {
+    if (header.name == ":path") {
+      msg.setURL(header.value);
+    } else if (!header.name.empty() && header.name[0] != ':') {
+      msg.getHeaders().add(header.name, header.value);
+    }
+  }
+  return msg;
+}
+
+const vector<HTTPMessage>& requests() {
+  static const vector<HTTPMessage> msgs = [] {
+    vector<HTTPMessage> out;
+    for (const auto& headers: requestCorpus()) {
+      out.push_back(toRequest(headers));
+    }
+    return out;
+  }();
+  return msgs;
+}
+
+// Copies of the requests, for the operations that change them
+vector<HTTPMessage> requestBatch(unsigned done, unsigned count) {
+  const auto& msgs = requests();
+  vector<HTTPMessage> out;
+  out.reserve(count);
+  for (unsigned i = 0; i < count; i++) {
+    out.push_back(msgs[(done + i) % msgs.size()]);
+  }
+  return out;
+}
+
+void addHeaders(unsigned iters) {
+  const auto& corpus = requestCorpus();
+  for (unsigned i = 0; i < iters; i++) {
+    HTTPHeaders headers;
+    for (const auto& header: corpus[i % corpus.size()]) {
+      headers.add(header.name, header.value);
+    }
+    doNotOptimizeAway(headers.size());
+  }
+}
+
+void existsHeader(unsigned iters) {
+  const auto& msgs = requests();
+  for (unsigned i = 0; i < iters; i++) {
+    const auto& headers = msgs[i % msgs.size()].getHeaders();
+    doNotOptimizeAway(headers.exists(HTTP_HEADER_ACCEPT_ENCODING));
+    doNotOptimizeAway(headers.exists("X-Requested-With"));
+    doNotOptimizeAway(headers.exists(HTTP_HEADER_AUTHORIZATION));
+  }
+}
+
+void getSingleOrEmpty(unsigned iters) {
+  const auto& msgs = requests();
+  for (unsigned i = 0; i < iters; i++) {
+    const auto& headers = msgs[i % msgs.size()].getHeaders();
+    doNotOptimizeAway(headers.getSingleOrEmpty(HTTP_HEADER_HOST).size());
+    doNotOptimizeAway(headers.getSingleOrEmpty("DNT").size());
+  }
+}
+
+void removeHeader(unsigned iters) {
+  vector<HTTPMessage> msgs;
+  for (unsigned done = 0; done < iters; done += kBatch) {
+    const unsigned count = std::min(kBatch, iters - done);
+    untimed([&] { msgs = requestBatch(done, count); });
+    for (auto& msg: msgs) {
+      doNotOptimizeAway(msg.getHeaders().remove(HTTP_HEADER_REFERER));
+    }
+  }
+}
+
+void forEachHeader(unsigned iters) {
+  const auto& msgs = requests();
+  for (unsigned i = 0; i < iters; i++) {
+    size_t len = 0;
+    msgs[i % msgs.size()].getHeaders().forEach(
+      [&] (const string& name, const string& value) {
+        len += name.size() + value.size();
+      });
+    doNotOptimizeAway(len);
+  }
+}
+
+void copyHeaders(unsigned iters) {
+  const auto& msgs = requests();
+  for (unsigned i = 0; i < iters; i++) {
+    HTTPHeaders headers(msgs[i % msgs.size()].getHeaders());
+    doNotOptimizeAway(headers.size());
+  }
+}
+
+void copyMessage(unsigned iters) {
+  const auto& msgs = requests();
+  for (unsigned i = 0; i < iters; i++) {
+    HTTPMessage msg(msgs[i % msgs.size()]);
+    doNotOptimizeAway(msg.getHeaders().size());
+  }
+}
+
+void stripPerHopHeaders(unsigned iters) {
+  vector<HTTPMessage> msgs;
+  for (unsigned done = 0; done < iters; done += kBatch) {
+    const unsigned count = std::min(kBatch, iters - done);
+    untimed([&] { msgs = requestBatch(done, count); });
+    for (auto& msg: msgs) {
+      msg.stripPerHopHeaders();
+    }
+  }
+}
+
+// The first lookup on each message indexes its cookies
+void getCookie(unsigned iters) {
+  vector<HTTPMessage> msgs;
+  for (unsigned done = 0; done < iters; done += kBatch) {
+    const unsigned count = std::min(kBatch, iters - done);
+    untimed([&] { msgs = requestBatch(done, count); });
+    for (const auto& msg: msgs) {
+      doNotOptimizeAway(msg.getCookie("datr").size());
+      doNotOptimizeAway(msg.getCookie("c7").size());
+    }
+  }
+}
+
+// The first lookup on each message indexes its query string
+void getQueryParam(unsigned iters) {
+  vector<HTTPMessage> msgs;
+  for (unsigned done = 0; done < iters; done += kBatch) {
+    const unsigned count = std::min(kBatch, iters - done);
+    untimed([&] { msgs = requestBatch(done, count); });
+    for (const auto& msg: msgs) {
+      doNotOptimizeAway(msg.getQueryParam("id").size());
+      doNotOptimizeAway(msg.getQueryParam("__a").size());
+    }
+  }
+}
+
+void setURL(unsigned iters) {
+  const auto& msgs = requests();
+  HTTPMessage msg;
+  for (unsigned i = 0; i < iters; i++) {
+    msg.setURL(msgs[i % msgs.size()].getURL());
+    doNotOptimizeAway(msg.getPath().size());
+  }
+}
+
+}
+
+BENCHMARK(headersAdd, iters) { addHeaders(iters); }
+BENCHMARK(headersExists, iters) { existsHeader(iters); }
+BENCHMARK(headersGetSingleOrEmpty, iters) { getSingleOrEmpty(iters); }
+BENCHMARK(headersRemove, iters) { removeHeader(iters); }
+BENCHMARK(headersForEach, iters) { forEachHeader(iters); }
+BENCHMARK(headersCopy, iters) { copyHeaders(iters); }
+BENCHMARK_DRAW_LINE();
+BENCHMARK(messageCopy, iters) { copyMessage(iters); }
+BENCHMARK(messageStripPerHopHeaders, iters) { stripPerHopHeaders(iters); }
+BENCHMARK(messageGetCookie, iters) { getCookie(iters); }
+BENCHMARK(messageGetQueryParam, iters) { getQueryParam(iters); }
+BENCHMARK(messageSetURL, iters) { setURL(iters); }
+
+namespace {
+
+void report(const char* name, void (*fn)(unsigned)) {
+  g_meter = Meter();
+  auto allocs = allocCount();
+  auto start = std::chrono::steady_clock::now();
+  fn(FLAGS_report_ops);
+  auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - start) - g_meter.untimed;
+  auto ops = double(FLAGS_report_ops);
+  printf("%-24s %10.1f ns/op %8.2f allocs/op\n", name,
+         elapsed.count() / ops,
+         (allocCount() - allocs - g_meter.untimedAllocs) / ops);
+}
+
+}
+
+int main(int argc, char* argv[]) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  folly::runBenchmarks();
+  if (FLAGS_report_ops <= 0) {
+    return 0;
+  }
+
+  const std::pair<const char*, void (*)(unsigned)> scenarios[] = {
+    {"addHeaders", addHeaders},
+    {"existsHeader", existsHeader},
+    {"getSingleOrEmpty", getSingleOrEmpty},
+    {"removeHeader", removeHeader},
+    {"forEachHeader", forEachHeader},
+    {"copyHeaders", copyHeaders},
+    {"copyMessage", copyMessage},
+    {"stripPerHopHeaders", stripPerHopHeaders},
+    {"getCookie", getCookie},
+    {"getQueryParam", getQueryParam},
+    {"setURL", setURL},
+  };
+  for (const auto& scenario: scenarios) {
+    report(scenario.first, scenario.second);
+  }
+  return 0;
+}
@@ -16,6 +16,7 @@
 #include <netinet/in.h>
 #include <proxygen/lib/http/HTTPMessage.h>
 #include <proxygen/lib/utils/TestUtils.h>
+#include <proxygen/lib/utils/ThreadLocalFreeList.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
@@ -86,6 +87,97 @@ TEST(HTTPMessage, TestParseQueryParamsSimple) {
   EXPECT_ANY_THROW(msg.getIntQueryParam("second"));
 }
 
+TEST(HTTPMessage, TestQueryParamPieces) {
+  HTTPMessage msg;
+  msg.setURL("/test?seq=123456&dup=1&dup=2&only_key&=empty");
+
+  // The first lookup scans, the next ones index
+  EXPECT_EQ(msg.getQueryParamPiece("dup"), "2");
+  EXPECT_EQ(msg.getQueryParamPiece("seq"), "123456");
+  EXPECT_EQ(msg.getQueryParamPiece(""), "empty");
+  EXPECT_EQ(msg.getQueryParamPiece("missing"), "");
+  EXPECT_TRUE(msg.hasQueryParam("only_key"));
+  EXPECT_FALSE(msg.hasQueryParam("missing"));
+  const char* query = msg.getQueryString().data();
+  auto seq = msg.getQueryParamPiece("seq");
+  EXPECT_TRUE(seq.begin() >= query &&
+              seq.end() <= query + msg.getQueryString().size());
+
+  // The copies agree with the views
+  EXPECT_EQ(msg.getQueryParam("dup"), "2");
+  EXPECT_EQ(msg.getQueryParams().size(), 4);
+  EXPECT_TRUE(msg.setQueryParam("dup", "3"));
+  EXPECT_EQ(msg.getQueryParamPiece("dup"), "3");
+  EXPECT_TRUE(msg.removeQueryParam("seq"));
+  EXPECT_FALSE(msg.hasQueryParam("seq"));
+  EXPECT_EQ(msg.getQueryParamPiece("seq"), "");
+
+  msg.setURL("/test?seq=7");
+  EXPECT_EQ(msg.getQueryParamPiece("seq"), "7");
+  EXPECT_EQ(msg.getQueryParamPiece("dup"), "");
+  EXPECT_EQ(msg.getIntQueryParam("seq"), 7);
+}
+
+TEST(HTTPMessage, TestCookiesAfterCopy) {
+  std::unique_ptr<HTTPMessage> msg(new HTTPMessage());
+  msg->getHeaders().add("Cookie", "id=1; data=2; id=3");
+  EXPECT_EQ(msg->getCookie("data"), "2");
+  EXPECT_EQ(msg->getCookie("id"), "1");
+
+  // Views into the original headers must not outlive them
+  HTTPMessage copied(*msg);
+  HTTPMessage assigned;
+  assigned = *msg;
+  msg.reset();
+  EXPECT_EQ(copied.getCookie("id"), "1");
+  EXPECT_EQ(copied.getCookie("data"), "2");
+  EXPECT_EQ(assigned.getCookie("data"), "2");
+  EXPECT_EQ(assigned.getCookie("id"), "1");
+  EXPECT_EQ(assigned.getCookie("missing"), "");
+}
+
+TEST(HTTPMessage, TestQueryParamsAfterCopy) {
+  std::unique_ptr<HTTPMessage> msg(new HTTPMessage());
+  msg->setURL("/test?seq=1&dup=1&dup=2");
+  msg->getHeaders().add(HTTP_HEADER_CONNECTION, "close");
+  msg->stripPerHopHeaders();
+  EXPECT_EQ(msg->getQueryParamPiece("seq"), "1");
+  EXPECT_EQ(msg->getQueryParamPiece("dup"), "2");
+  EXPECT_EQ(msg->getQueryParam("seq"), "1");
+
+  HTTPMessage copied(*msg);
+  EXPECT_TRUE(copied.setQueryParam("seq", "2"));
+  EXPECT_EQ(msg->getQueryParam("seq"), "1");
+  EXPECT_EQ(copied.getQueryParam("seq"), "2");
+  EXPECT_EQ(1, copied.getStrippedPerHopHeaders().size());
+  EXPECT_FALSE(copied.getHeaders().exists(HTTP_HEADER_CONNECTION));
+
+  // The views follow the copy of the query string
+  HTTPMessage assigned;
+  assigned = *msg;
+  msg.reset();
+  auto dup = assigned.getQueryParamPiece("dup");
+  EXPECT_EQ(dup, "2");
+  const auto& query = assigned.getQueryString();
+  EXPECT_TRUE(dup.begin() >= query.data() &&
+              dup.end() <= query.data() + query.size());
+  EXPECT_EQ(assigned.getQueryParam("seq"), "1");
+}
+
+TEST(HTTPMessage, TestSetURLViews) {
+  HTTPMessage msg;
+  string url("http://a.b:1/?x");
+  auto parsed = msg.setURL(std::move(url));
+  url.assign("overwritten");
+
+  // The result views the URL stored in the message
+  EXPECT_EQ(parsed.url().data(), msg.getURL().data());
+  EXPECT_EQ("a.b", parsed.host());
+  EXPECT_EQ("a.b:1", parsed.hostAndPort());
+  EXPECT_EQ("/", msg.getPath());
+  EXPECT_EQ("x", msg.getQueryString());
+}
+
 TEST(HTTPMessage, TestParseQueryParamsComplex) {
   HTTPMessage msg;
   std::vector<std::vector<std::string>> input = {
@@ -354,6 +446,29 @@ TEST(HTTPMessage, TestMethod) {
   EXPECT_EQ(HTTPMethod::CONNECT == msg.getMethod(), true);
 }
 
+TEST(HTTPMessage, TestDefaultStatusMessage) {
+  HTTPMessage msg;
+  msg.setStatusCode(404);
+  EXPECT_EQ("", msg.getStatusMessage());
+  msg.setDefaultStatusMessage();
+  EXPECT_EQ("Not Found", msg.getStatusMessage());
+
+  // Every message shares the one copy
+  HTTPMessage other;
+  other.setStatusCode(404);
+  other.setDefaultStatusMessage();
+  EXPECT_EQ(&msg.getStatusMessage(), &other.getStatusMessage());
+  HTTPMessage copied(msg);
+  EXPECT_EQ("Not Found", copied.getStatusMessage());
+
+  msg.setStatusMessage("Gone Fishing");
+  EXPECT_EQ("Gone Fishing", msg.getStatusMessage());
+  EXPECT_EQ("Not Found", copied.getStatusMessage());
+  msg.setStatusCode(1000);
+  msg.setDefaultStatusMessage();
+  EXPECT_EQ("-", msg.getStatusMessage());
+}
+
 void testPathAndQuery(const string& url,
                       const string& expectedPath,
                       const string& expectedQuery) {
@@ -383,6 +498,252 @@ TEST(HTTPHeaders, AddStringPiece) {
   EXPECT_EQ("value", headers.getSingleOrEmpty("name"));
 }
 
+TEST(HTTPHeaders, ManyOtherNames) {
+  // More custom names than fit in one block, through copies, moves,
+  // removal and stripping
+  HTTPHeaders headers;
+  for (int i = 0; i < 20; i++) {
+    headers.add(folly::to<string>("X-Custom-Header-", i),
+                folly::to<string>(i));
+  }
+  headers.add("Connection", "X-Custom-Header-3");
+  headers.remove("X-Custom-Header-7");
+
+  HTTPHeaders copied(headers);
+  headers.removeAll();
+  HTTPHeaders moved(std::move(copied));
+  EXPECT_EQ(0, copied.size());
+  HTTPHeaders assigned;
+  assigned.add("X-Other", "value");
+  assigned = moved;
+  moved = std::move(assigned);
+
+  HTTPHeaders stripped;
+  moved.stripPerHopHeaders(stripped);
+  EXPECT_EQ("3", stripped.getSingleOrEmpty("X-Custom-Header-3"));
+  EXPECT_EQ("19", moved.getSingleOrEmpty("X-Custom-Header-19"));
+  EXPECT_EQ(0, moved.getNumberOfValues("X-Custom-Header-7"));
+  EXPECT_EQ(18, moved.size());
+}
+
+TEST(HTTPHeaders, CodeLookups) {
+  // long enough for full vectors of codes and a tail, with the values of
+  // one header in both
+  HTTPHeaders headers;
+  for (int i = 0; i < 40; i++) {
+    if (i % 7 == 0) {
+      headers.add(HTTP_HEADER_VIA, folly::to<string>(i));
+    } else {
+      headers.add(folly::to<string>("X-Custom-", i), "value");
+    }
+  }
+  EXPECT_FALSE(headers.exists(HTTP_HEADER_HOST));
+  EXPECT_TRUE(headers.exists(HTTP_HEADER_VIA));
+  EXPECT_EQ(6, headers.getNumberOfValues(HTTP_HEADER_VIA));
+  EXPECT_EQ("0, 7, 14, 21, 28, 35", headers.combine(HTTP_HEADER_VIA));
+  EXPECT_EQ("value", headers.getSingleOrEmpty("X-Custom-39"));
+
+  // removed codes are still found absent
+  headers.add(HTTP_HEADER_HOST, "www.facebook.com");
+  EXPECT_TRUE(headers.remove(HTTP_HEADER_HOST));
+  EXPECT_FALSE(headers.exists(HTTP_HEADER_HOST));
+  EXPECT_FALSE(headers.remove(HTTP_HEADER_HOST));
+
+  headers.removeByPredicate(
+    [] (HTTPHeaderCode code, const string& name, const string&) {
+      return code == HTTP_HEADER_OTHER && name != "X-Custom-1";
+    });
+  HTTPHeaders copied;
+  headers.copyTo(copied);
+  EXPECT_EQ(7, copied.size());
+  EXPECT_EQ("value", copied.getSingleOrEmpty("X-Custom-1"));
+  EXPECT_EQ("0, 7, 14, 21, 28, 35", copied.combine(HTTP_HEADER_VIA));
+
+  headers.removeAll();
+  EXPECT_FALSE(headers.exists(HTTP_HEADER_VIA));
+}
+
+TEST(HTTPHeaders, CompactRemoved) {
+  HTTPHeaders headers;
+  headers.add(HTTP_HEADER_HOST, "www.facebook.com");
+  headers.add("X-Custom", "custom");
+  for (int i = 0; i < 1000; i++) {
+    headers.set(HTTP_HEADER_CONTENT_LENGTH, folly::to<string>(i));
+    headers.set("X-Counter", folly::to<string>(i));
+  }
+  // a value of the same headers survives being set again
+  headers.set(HTTP_HEADER_CONTENT_LENGTH,
+              headers.getSingleOrEmpty(HTTP_HEADER_CONTENT_LENGTH));
+  EXPECT_EQ(4, headers.size());
+
+  string order;
+  headers.forEach([&] (const string& name, const string& value) {
+    order.append(name).append("=").append(value).append(";");
+  });
+  EXPECT_EQ("Host=www.facebook.com;X-Custom=custom;X-Counter=999;"
+            "Content-Length=999;", order);
+  EXPECT_EQ("999", headers.getSingleOrEmpty("X-Counter"));
+}
+
+TEST(HTTPHeaders, AddFromCodecWithCode) {
+  HTTPHeaders headers;
+  headers.reserve(40);
+  for (int i = 0; i < 20; i++) {
+    headers.addFromCodec(HTTP_HEADER_OTHER, folly::to<string>("X-Name-", i),
+                         "other");
+    headers.addFromCodec(HTTP_HEADER_VIA, "via", folly::to<string>(i));
+  }
+  EXPECT_EQ(40, headers.size());
+  EXPECT_EQ("other", headers.getSingleOrEmpty("x-name-7"));
+  EXPECT_EQ(20, headers.getNumberOfValues(HTTP_HEADER_VIA));
+  // A known code stores the canonical name
+  headers.forEachWithCode([&] (HTTPHeaderCode code, const string& name,
+                               const string&) {
+    if (code == HTTP_HEADER_VIA) {
+      EXPECT_EQ("Via", name);
+    }
+  });
+}
+
+TEST(HTTPHeaders, Arena) {
+  HTTPHeaders headers;
+  headers.useArena(64);
+  EXPECT_TRUE(headers.usesArena());
+  headers.add(HTTP_HEADER_HOST, "www.facebook.com");
+  {
+    // Copied into the arena, not pointed to
+    string name("X-Name");
+    string value("0123456789");
+    for (int i = 0; i < 20; i++) {
+      headers.addFromCodec(HTTP_HEADER_OTHER, name, value);
+      headers.addFromCodec(HTTP_HEADER_VIA, "via", value);
+    }
+    name.assign("xxxxxx");
+    value.assign("xxxxxxxxxx");
+  }
+  EXPECT_EQ(41, headers.size());
+  EXPECT_TRUE(headers.exists("x-name"));
+  EXPECT_EQ(20, headers.getNumberOfValues("X-NAME"));
+  size_t pieces = 0;
+  headers.forEachPiece([&] (HTTPHeaderCode code, folly::StringPiece name,
+                            folly::StringPiece value) {
+    if (code == HTTP_HEADER_OTHER) {
+      EXPECT_EQ("X-Name", name);
+    } else if (code == HTTP_HEADER_VIA) {
+      EXPECT_EQ("Via", name);
+    }
+    if (code != HTTP_HEADER_HOST) {
+      EXPECT_EQ("0123456789", value);
+      ++pieces;
+    }
+  });
+  EXPECT_EQ(40, pieces);
+
+  // Copied out as strings when asked for as strings
+  EXPECT_EQ("0123456789", headers.combine(HTTP_HEADER_VIA, ""));
+  headers.forEach([&] (const string& name, const string& value) {
+    EXPECT_FALSE(name.empty());
+    EXPECT_FALSE(value.empty());
+  });
+  EXPECT_TRUE(headers.remove("X-Name"));
+  EXPECT_EQ(21, headers.size());
+  headers.addFromCodec(HTTP_HEADER_OTHER, "X-Last", "last");
+  EXPECT_EQ("last", headers.getSingleOrEmpty("x-last"));
+  EXPECT_EQ("www.facebook.com", headers.getSingleOrEmpty(HTTP_HEADER_HOST));
+
+  headers.removeAll();
+  EXPECT_TRUE(headers.usesArena());
+  headers.addFromCodec(HTTP_HEADER_OTHER, "X-Again", "again");
+  EXPECT_EQ("again", headers.getSingleOrEmpty("X-Again"));
+}
+
+TEST(HTTPHeaders, ArenaFirstHeader) {
+  // As a codec fills them in, with nothing added before
+  HTTPHeaders headers;
+  headers.useArena();
+  headers.addFromCodec(HTTP_HEADER_HOST, "Host", "www.facebook.com");
+  headers.addFromCodec(HTTP_HEADER_OTHER, "X-Name", "value");
+  EXPECT_EQ(2, headers.size());
+  EXPECT_EQ("www.facebook.com", headers.getSingleOrEmpty(HTTP_HEADER_HOST));
+  EXPECT_EQ("value", headers.getSingleOrEmpty("X-Name"));
+  std::vector<string> names;
+  headers.forEach([&] (const string& name, const string& value) {
+    names.push_back(name);
+  });
+  EXPECT_EQ((std::vector<string>{"Host", "X-Name"}), names);
+}
+
+TEST(HTTPHeaders, ArenaCopies) {
+  HTTPHeaders headers;
+  headers.useArena();
+  headers.addFromCodec(HTTP_HEADER_OTHER, "X-Shared", "shared");
+  headers.addFromCodec(HTTP_HEADER_CONNECTION, "connection", "Keep-Alive");
+  const char* sharedData = nullptr;
+  headers.forEachPiece([&] (HTTPHeaderCode code, folly::StringPiece,
+                            folly::StringPiece value) {
+    if (code == HTTP_HEADER_OTHER) {
+      sharedData = value.data();
+    }
+  });
+
+  // The copy shares the arena, so still points at the same bytes
+  HTTPHeaders copy(headers);
+  copy.forEachPiece([&] (HTTPHeaderCode code, folly::StringPiece,
+                         folly::StringPiece value) {
+    if (code == HTTP_HEADER_OTHER) {
+      EXPECT_EQ(sharedData, value.data());
+    }
+  });
+
+  // Neither adds to the shared block, so neither sees the other's headers
+  copy.addFromCodec(HTTP_HEADER_OTHER, "X-Copy", "copy");
+  headers.addFromCodec(HTTP_HEADER_OTHER, "X-Original", "original");
+  EXPECT_EQ("shared", copy.getSingleOrEmpty("X-Shared"));
+  EXPECT_EQ("copy", copy.getSingleOrEmpty("X-Copy"));
+  EXPECT_FALSE(copy.exists("X-Original"));
+  EXPECT_EQ("original", headers.getSingleOrEmpty("X-Original"));
+  EXPECT_FALSE(headers.exists("X-Copy"));
+
+  // Nor do these, which outlive the arena of the original
+  HTTPHeaders stripped;
+  HTTPHeaders moved(std::move(headers));
+  moved.stripPerHopHeaders(stripped);
+  headers.removeAll();
+  EXPECT_EQ("Keep-Alive", stripped.getSingleOrEmpty(HTTP_HEADER_CONNECTION));
+  HTTPHeaders assigned;
+  assigned = moved;
+  moved.removeAll();
+  EXPECT_EQ("shared", assigned.getSingleOrEmpty("x-shared"));
+  EXPECT_EQ("original", assigned.getSingleOrEmpty("x-original"));
+  EXPECT_FALSE(assigned.exists(HTTP_HEADER_CONNECTION));
+}
+
+TEST(HTTPHeaders, PooledVectors) {
+  HTTPHeaders::takeVectorPoolCounts();
+  {
+    HTTPHeaders headers;
+    headers.add("Host", "www.facebook.com");
+  }
+  auto counts = HTTPHeaders::takeVectorPoolCounts();
+  // The vectors of the first headers may or may not come from the pool
+  EXPECT_EQ(1, counts.allocated + counts.reused);
+
+  // The next ones reuse them, cleared
+  HTTPHeaders headers;
+  EXPECT_EQ(0, headers.size());
+  EXPECT_FALSE(headers.exists("Host"));
+  counts = HTTPHeaders::takeVectorPoolCounts();
+  EXPECT_EQ(0, counts.allocated);
+  EXPECT_EQ(1, counts.reused);
+
+  // As do messages, within the thread
+  ThreadLocalFreeList<HTTPMessage>::takeCounts();
+  delete new HTTPMessage();
+  std::unique_ptr<HTTPMessage> msg(new HTTPMessage());
+  EXPECT_EQ(1, ThreadLocalFreeList<HTTPMessage>::takeCounts().reused);
+  EXPECT_EQ(0, msg->getHeaders().size());
+}
+
 void testRemoveQueryParam(const string& url,
                           const string& queryParam,
                           const string& expectedUrl,
@@ -0,0 +1,242 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/io/async/EventBase.h>
+#include <folly/io/async/test/MockAsyncTransport.h>
+#include <gtest/gtest.h>
+#include <proxygen/lib/http/HTTPSessionPool.h>
+#include <proxygen/lib/http/HedgedRequest.h>
+#include <proxygen/lib/http/session/HTTPUpstreamSession.h>
+#include <proxygen/lib/http/session/test/HTTPSessionTest.h>
+#include <vector>
+
+using folly::test::MockAsyncTransport;
+
+using namespace folly;
+using namespace proxygen;
+using namespace testing;
+
+using std::unique_ptr;
+using std::vector;
+
+namespace {
+
+class SessionCallback: public HTTPSessionPool::Callback {
+ public:
+  void sessionAvailable(HTTPUpstreamSession* session) override {
+    sessions.push_back(session);
+  }
+  void sessionError(const AsyncSocketException& ex) override {
+    errors++;
+  }
+
+  vector<HTTPUpstreamSession*> sessions;
+  uint32_t errors{0};
+};
+
+class ResponseCallback: public HedgedRequest::Callback {
+ public:
+  void onHeadersComplete(unique_ptr<HTTPMessage> msg) noexcept override {
+    headers++;
+  }
+  void onBody(unique_ptr<IOBuf> chain) noexcept override {}
+  void onEOM() noexcept override {}
+  void onError(const HTTPException& error) noexcept override {
+    errors++;
+  }
+
+  uint32_t headers{0};
+  uint32_t errors{0};
+};
+
+}
+
+class HTTPSessionPoolTest: public testing::Test {
+ public:
+  HTTPSessionPoolTest()
+      : transactionTimeouts_(
+          new AsyncTimeoutSet(&eventBase_,
+                              TimeoutManager::InternalEnum::INTERNAL,
+                              std::chrono::milliseconds(500))),
+        key_(SocketAddress("127.0.0.1", 80)) {
+  }
+
+  void makePool(uint32_t maxIdle = 8) {
+    HTTPSessionPool::Options options;
+    options.maxIdleSessionsPerKey = maxIdle;
+    pool_.reset(new HTTPSessionPool(&eventBase_, transactionTimeouts_.get(),
+                                    options));
+  }
+
+  HTTPUpstreamSession* makeSession(unique_ptr<HTTPCodec> codec) {
+    auto transport = new NiceMock<MockAsyncTransport>();
+    // each transport stays good until it is closed
+    auto good = new bool(true);
+    goods_.emplace_back(good);
+    EXPECT_CALL(*transport, good())
+      .WillRepeatedly(ReturnPointee(good));
+    EXPECT_CALL(*transport, closeNow())
+      .WillRepeatedly(Assign(good, false));
+    EXPECT_CALL(*transport, closeWithReset())
+      .WillRepeatedly(Assign(good, false));
+    EXPECT_CALL(*transport, getEventBase())
+      .WillRepeatedly(Return(&eventBase_));
+    return new HTTPUpstreamSession(
+      transactionTimeouts_.get(),
+      AsyncTransportWrapper::UniquePtr(transport),
+      localAddr_, peerAddr_, std::move(codec),
+      folly::TransportInfo(), nullptr);
+  }
+
+  HTTPUpstreamSession* makeHTTP1xSession() {
+    return makeSession(makeClientCodec<HTTP1xCodec>(1));
+  }
+
+  HTTPUpstreamSession* makeSPDYSession() {
+    return makeSession(makeClientCodec<SPDYCodec>(SPDYVersion::SPDY3));
+  }
+
+  void TearDown() override {
+    pool_.reset();
+    eventBase_.loop();
+  }
+
+ protected:
+  EventBase eventBase_;
+  AsyncTimeoutSet::UniquePtr transactionTimeouts_;
+  SocketAddress localAddr_{"127.0.0.1", 12345};
+  SocketAddress peerAddr_{"127.0.0.1", 80};
+  HTTPSessionPool::Key key_;
+  unique_ptr<HTTPSessionPool> pool_;
+  vector<unique_ptr<bool>> goods_;
+};
+
+TEST_F(HTTPSessionPoolTest, reuse_idle_session) {
+  makePool();
+  auto session = makeHTTP1xSession();
+  pool_->addSession(key_, session);
+  EXPECT_EQ(pool_->getNumIdleSessions(key_), 1);
+
+  SessionCallback cb;
+  pool_->getSession(key_, &cb);
+  ASSERT_EQ(cb.sessions.size(), 1);
+  EXPECT_EQ(cb.sessions[0], session);
+  // handed out, until its transaction is done
+  EXPECT_EQ(pool_->getNumIdleSessions(key_), 0);
+  EXPECT_EQ(pool_->getNumSessions(), 1);
+  EXPECT_EQ(pool_->getNumPendingConnects(), 0);
+}
+
+TEST_F(HTTPSessionPoolTest, share_parallel_session) {
+  makePool();
+  auto session = makeSPDYSession();
+  pool_->addSession(key_, session);
+
+  SessionCallback cb;
+  pool_->getSession(key_, &cb);
+  pool_->getSession(key_, &cb);
+  pool_->getSession(key_, &cb);
+  ASSERT_EQ(cb.sessions.size(), 3);
+  for (auto s: cb.sessions) {
+    EXPECT_EQ(s, session);
+  }
+  EXPECT_EQ(pool_->getNumPendingConnects(), 0);
+}
+
+TEST_F(HTTPSessionPoolTest, separate_keys) {
+  makePool();
+  pool_->addSession(key_, makeHTTP1xSession());
+  HTTPSessionPool::Key spdyKey(key_.address, nullptr, "spdy/3");
+  pool_->addSession(spdyKey, makeSPDYSession());
+
+  EXPECT_EQ(pool_->getNumIdleSessions(key_), 1);
+  EXPECT_EQ(pool_->getNumIdleSessions(spdyKey), 1);
+  EXPECT_EQ(pool_->getNumIdleSessions(
+              HTTPSessionPool::Key(SocketAddress("127.0.0.1", 81))), 0);
+}
+
+TEST_F(HTTPSessionPoolTest, max_idle_sessions) {
+  makePool(2);
+  vector<HTTPUpstreamSession*> sessions;
+  for (int i = 0; i < 3; i++) {
+    sessions.push_back(makeHTTP1xSession());
+    pool_->addSession(key_, sessions.back());
+  }
+  eventBase_.loop();
+  // the least recently used one was closed
+  EXPECT_EQ(pool_->getNumIdleSessions(key_), 2);
+  EXPECT_EQ(pool_->getNumSessions(), 2);
+
+  SessionCallback cb;
+  pool_->getSession(key_, &cb);
+  ASSERT_EQ(cb.sessions.size(), 1);
+  EXPECT_EQ(cb.sessions[0], sessions[2]);
+}
+
+TEST_F(HTTPSessionPoolTest, closed_session_leaves_pool) {
+  makePool();
+  auto session = makeHTTP1xSession();
+  pool_->addSession(key_, session);
+  session->dropConnection();
+  eventBase_.loop();
+  EXPECT_EQ(pool_->getNumIdleSessions(key_), 0);
+  EXPECT_EQ(pool_->getNumSessions(), 0);
+}
+
+namespace {
+
+// Copies of the request in flight once the hedge delay has passed
+size_t hedgeRequest(EventBase* eventBase, HTTPSessionPool* pool,
+                    const HTTPMessage& request,
+                    const vector<HTTPSessionPool::Key>& targets) {
+  HedgePolicy::Options options;
+  options.initialDelay = std::chrono::milliseconds(1);
+  HedgePolicy policy(options);
+  ResponseCallback cb;
+  auto hedged = new HedgedRequest(eventBase, pool, &policy, &cb);
+  hedged->start(request, nullptr, targets);
+  size_t attempts = 0;
+  eventBase->runAfterDelay([&] {
+      attempts = hedged->getNumAttempts();
+      hedged->cancel();
+    }, 20);
+  eventBase->loop();
+  EXPECT_EQ(cb.headers, 0);
+  EXPECT_EQ(cb.errors, 0);
+  return attempts;
+}
+
+}
+
+TEST_F(HTTPSessionPoolTest, hedge_get) {
+  makePool();
+  HTTPSessionPool::Key other(SocketAddress("127.0.0.1", 81));
+  pool_->addSession(key_, makeHTTP1xSession());
+  pool_->addSession(other, makeHTTP1xSession());
+
+  HTTPMessage req;
+  req.setMethod(HTTPMethod::GET);
+  req.setURL("/");
+  EXPECT_EQ(hedgeRequest(&eventBase_, pool_.get(), req, {key_, other}), 2);
+  EXPECT_EQ(pool_->getNumIdleSessions(other), 0);
+}
+
+TEST_F(HTTPSessionPoolTest, hedge_post_sent_once) {
+  makePool();
+  HTTPSessionPool::Key other(SocketAddress("127.0.0.1", 81));
+  pool_->addSession(key_, makeHTTP1xSession());
+  pool_->addSession(other, makeHTTP1xSession());
+
+  HTTPMessage req;
+  req.setMethod(HTTPMethod::POST);
+  req.setURL("/");
+  EXPECT_EQ(hedgeRequest(&eventBase_, pool_.get(), req, {key_, other}), 1);
+  // the other session was never asked for
+  EXPECT_EQ(pool_->getNumIdleSessions(other), 1);
+}
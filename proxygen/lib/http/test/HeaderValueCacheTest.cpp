@@ -0,0 +1,73 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <gtest/gtest.h>
+#include <proxygen/lib/http/HeaderValueCache.h>
+
+using namespace proxygen;
+
+class HeaderValueCacheTest : public testing::Test {
+ public:
+  void SetUp() override {
+    HeaderValueCache::clear();
+  }
+
+  void TearDown() override {
+    HeaderValueCache::setMaxEntries(256);
+    HeaderValueCache::clear();
+  }
+};
+
+TEST_F(HeaderValueCacheTest, shares_entries) {
+  auto agent = HeaderValueCache::get(
+    HTTP_HEADER_USER_AGENT, "Mozilla/5.0 Chrome/42.0.2311.90 Safari/537.36");
+  EXPECT_EQ(42, agent->getChromeVersion());
+  EXPECT_EQ(agent, HeaderValueCache::get(
+    HTTP_HEADER_USER_AGENT, "Mozilla/5.0 Chrome/42.0.2311.90 Safari/537.36"));
+  EXPECT_EQ(1, HeaderValueCache::getNumEntries());
+
+  // The same value of another header is another entry
+  auto other = HeaderValueCache::get(
+    HTTP_HEADER_OTHER, "Mozilla/5.0 Chrome/42.0.2311.90 Safari/537.36");
+  EXPECT_NE(agent, other);
+  EXPECT_EQ(2, HeaderValueCache::getNumEntries());
+  EXPECT_EQ(-1, HeaderValueCache::get(HTTP_HEADER_USER_AGENT, "curl/7.35.0")
+            ->getChromeVersion());
+}
+
+TEST_F(HeaderValueCacheTest, qvalues) {
+  auto accept = HeaderValueCache::get(HTTP_HEADER_ACCEPT_ENCODING,
+                                      "gzip;q=0.5, br");
+  bool wellFormed = false;
+  auto& qvalues = accept->getQvalues(&wellFormed);
+  EXPECT_TRUE(wellFormed);
+  ASSERT_EQ(2, qvalues.size());
+  EXPECT_EQ("gzip", qvalues[0].first);
+  EXPECT_EQ(0.5, qvalues[0].second);
+  EXPECT_EQ("br", qvalues[1].first);
+  EXPECT_EQ(1.0, qvalues[1].second);
+  EXPECT_EQ(&qvalues, &accept->getQvalues());
+}
+
+TEST_F(HeaderValueCacheTest, evicts_least_recently_used) {
+  HeaderValueCache::setMaxEntries(2);
+  auto a = HeaderValueCache::get(HTTP_HEADER_ACCEPT, "a");
+  auto b = HeaderValueCache::get(HTTP_HEADER_ACCEPT, "b");
+  EXPECT_EQ(a, HeaderValueCache::get(HTTP_HEADER_ACCEPT, "a"));
+  HeaderValueCache::get(HTTP_HEADER_ACCEPT, "c");
+  EXPECT_EQ(2, HeaderValueCache::getNumEntries());
+  EXPECT_EQ(a, HeaderValueCache::get(HTTP_HEADER_ACCEPT, "a"));
+  // b was evicted, though it lives on for its holders
+  EXPECT_NE(b, HeaderValueCache::get(HTTP_HEADER_ACCEPT, "b"));
+  EXPECT_EQ("b", b->getValue());
+
+  HeaderValueCache::setMaxEntries(0);
+  auto d = HeaderValueCache::get(HTTP_HEADER_ACCEPT, "d");
+  EXPECT_NE(d, HeaderValueCache::get(HTTP_HEADER_ACCEPT, "d"));
+}
@@ -0,0 +1,60 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <gtest/gtest.h>
+#include <proxygen/lib/http/HedgedRequest.h>
+
+using namespace proxygen;
+
+using std::chrono::milliseconds;
+
+TEST(HedgePolicyTest, budget) {
+  HedgePolicy::Options options;
+  options.maxExtraLoad = 0.5;
+  options.maxBurst = 2;
+  HedgePolicy policy(options);
+
+  // starts out with a full burst
+  EXPECT_TRUE(policy.tryAcquire());
+  EXPECT_TRUE(policy.tryAcquire());
+  EXPECT_FALSE(policy.tryAcquire());
+
+  // two requests earn one hedge
+  policy.onRequest();
+  EXPECT_FALSE(policy.tryAcquire());
+  policy.onRequest();
+  EXPECT_TRUE(policy.tryAcquire());
+
+  // and the budget never grows past the burst
+  for (int i = 0; i < 100; i++) {
+    policy.onRequest();
+  }
+  EXPECT_EQ(2, policy.getBudget());
+}
+
+TEST(HedgePolicyTest, delay_percentile) {
+  HedgePolicy::Options options;
+  options.percentile = 90;
+  options.window = 160;
+  options.initialDelay = milliseconds(50);
+  options.maxDelay = milliseconds(500);
+  HedgePolicy policy(options);
+  EXPECT_EQ(milliseconds(50), policy.getDelay());
+
+  for (int i = 1; i <= 100; i++) {
+    policy.recordLatency(milliseconds(i));
+  }
+  EXPECT_EQ(milliseconds(91), policy.getDelay());
+
+  // newer latencies replace the oldest
+  for (int i = 0; i < 160; i++) {
+    policy.recordLatency(milliseconds(1600));
+  }
+  EXPECT_EQ(milliseconds(500), policy.getDelay());
+}
@@ -125,3 +125,34 @@ TEST(QvalueTest, invalids) {
   output.clear();
 
 }
+
+TEST(QvalueTest, streaming) {
+  std::vector<RFC2616::TokenQPair> output;
+  string test1("  gzip;q=0.5,, deflate, br; q=0");
+  EXPECT_TRUE(RFC2616::parseQvalues(test1, output));
+
+  // The same tokens, one at a time
+  size_t seen = 0;
+  EXPECT_TRUE(RFC2616::forEachQvalue(test1, [&] (folly::StringPiece token,
+                                                 double qvalue) {
+    EXPECT_EQ(output[seen].first, token);
+    EXPECT_DOUBLE_EQ(output[seen].second, qvalue);
+    seen++;
+    return false;
+  }));
+  EXPECT_EQ(3, seen);
+
+  // Stopping early skips checking the rest
+  seen = 0;
+  EXPECT_TRUE(RFC2616::forEachQvalue("gzip, deflate; q=garbage",
+                                     [&] (folly::StringPiece token,
+                                          double) {
+    seen++;
+    return token == "gzip";
+  }));
+  EXPECT_EQ(1, seen);
+  EXPECT_FALSE(RFC2616::forEachQvalue("gzip, deflate; q=garbage",
+                                      [] (folly::StringPiece, double) {
+    return false;
+  }));
+}
@@ -11,6 +11,7 @@
 
 #include <chrono>
 #include <fcntl.h>
+#include <folly/Executor.h>
 #include <folly/String.h>
 #include <folly/wangle/acceptor/ServerSocketConfig.h>
 #include <list>
@@ -42,23 +43,120 @@ struct AcceptorConfiguration : public folly::ServerSocketConfig {
    */
   std::chrono::milliseconds transactionIdleTimeout{600000};
 
+  /**
+   * If not 0, how long a request may take to send the rest of its headers
+   * once it starts, and to send more of its body, instead of
+   * transactionIdleTimeout. Unlike that, the header timeout is not reset
+   * by each read, so clients sending them a byte at a time are cut off too.
+   */
+  std::chrono::milliseconds headerReadTimeout{0};
+  std::chrono::milliseconds bodyReadTimeout{0};
+
   /**
    * The compression level to use for SPDY headers with responses from
    * this Acceptor.
    */
   int spdyCompressionLevel{Z_NO_COMPRESSION};
 
+  /**
+   * The size of the SPDY header compression context of each session, see
+   * GzipHeaderCodec. Smaller ones save memory on idle sessions.
+   */
+  int spdyCompressionWindowBits{11};
+  int spdyCompressionMemLevel{1};
+
   /**
    * The name of the protocol to use on non-TLS connections.
    */
   std::string plaintextProtocol;
 
+  /**
+   * Parse HTTP/1.x request heads with HTTP1xCodec's head scanner instead
+   * of http_parser, as long as the connection allows.
+   */
+  bool http1xHeadScanner{false};
+
+  /**
+   * If not 0, the HTTP/1.x and HTTP/2 codecs parse request headers into an
+   * arena of blocks of this many bytes. See HTTPHeaders::useArena().
+   */
+  size_t headerArenaBlockSize{0};
+
+  /**
+   * Let plaintext clients speak HTTP/2, either from the start (prior
+   * knowledge) or by upgrading their first request with Upgrade: h2c.
+   * Ignored when plaintextProtocol is set.
+   */
+  bool allowH2C{false};
+
+  /**
+   * Let plaintext clients speak SPDY, told from their first frame, along
+   * with HTTP/1.x and, if allowH2C, HTTP/2. Ignored when plaintextProtocol
+   * is set.
+   */
+  bool allowPlaintextSPDY{false};
+
+  /**
+   * Once the TLS handshake of a connection is done, move its encryption to
+   * the kernel where it supports the cipher, and run the session over a
+   * plain socket, see enableKernelTLS(). Writes are then encrypted by the
+   * kernel, without going through OpenSSL's buffers.
+   */
+  bool kernelTLS{false};
+
+  /**
+   * If set, the private key operations of TLS handshakes run in this
+   * executor, which must outlive the acceptor, while the event loop
+   * carries on with the other connections, see enableSSLKeyOffload().
+   * Only the default SSL context is offloaded.
+   */
+  folly::Executor* sslKeyOffloadExecutor{nullptr};
+
+  /**
+   * Answer unsafe requests sent as TLS early data with 425 Too Early, see
+   * HTTPSession::setRejectUnsafeEarlyData()
+   */
+  bool rejectUnsafeEarlyData{false};
+
   /**
    * The maximum number of transactions the remote could initiate
    * per connection on protocols that allow multiplexing.
    */
   uint32_t maxConcurrentIncomingStreams{0};
 
+  /**
+   * If not 0, small writes are held for up to egressCoalesceDelay while
+   * requests are pipelined behind, see HTTPSession::setEgressCoalescing()
+   */
+  uint32_t egressCoalesceBytes{0};
+  std::chrono::microseconds egressCoalesceDelay{200};
+
+  /**
+   * Pause the egress of each transaction that buffers more than its share
+   * of the session's egress buffer, see HTTPSession::setEgressQuotas()
+   */
+  bool egressQuotas{false};
+
+  /**
+   * Set up the handlers of the requests parsed from one read together,
+   * see HTTPSession::setBatchRequestDispatch()
+   */
+  bool batchRequestDispatch{false};
+
+  /**
+   * If not 0, the TCP_NOTSENT_LOWAT of every connection, which keeps the
+   * unsent egress in its kernel buffer down to about that many bytes, see
+   * HTTPSession::setNotSentLowWatermark()
+   */
+  uint32_t notSentLowWatermark{0};
+
+  /**
+   * If not 0, the SO_BUSY_POLL of every connection: how long, in
+   * microseconds, a read with nothing in its socket busy polls the device
+   * queue for more rather than waiting for an interrupt
+   */
+  uint32_t busyPollMicros{0};
+
   size_t initialReceiveWindow{65536};
   size_t receiveStreamWindowSize{65536};
   size_t receiveSessionWindowSize{65536};
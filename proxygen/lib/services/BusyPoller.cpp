@@ -0,0 +1,31 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/services/BusyPoller.h>
+
+namespace proxygen {
+
+BusyPoller::BusyPoller(folly::EventBase* eventBase,
+                       std::chrono::microseconds spinTime)
+    : eventBase_(eventBase),
+      spinTime_(spinTime) {}
+
+void BusyPoller::runLoopCallback() noexcept {
+  auto now = std::chrono::steady_clock::now();
+  if (active_) {
+    active_ = false;
+    spinUntil_ = now + spinTime_;
+  }
+  if (now < spinUntil_) {
+    // Runs on the next iteration, which polls without blocking for it
+    eventBase_->runInLoop(this);
+  }
+}
+
+}
@@ -0,0 +1,66 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <chrono>
+#include <folly/io/async/EventBase.h>
+
+namespace proxygen {
+
+/**
+ * Keeps an EventBase polling for events without blocking for up to
+ * spinTime after the last activity it is told of, then lets it block
+ * again. It is a loop callback that reschedules itself: the EventBase does
+ * not block while loop callbacks are pending.
+ *
+ * This adapts to the load of the thread: a busy one keeps spinning and
+ * picks up its events without the wakeup latency of a blocked epoll_wait,
+ * at the cost of a core, while an idle one blocks after spinTime.
+ *
+ * Only used from the thread of its EventBase.
+ */
+class BusyPoller : private folly::EventBase::LoopCallback {
+ public:
+  BusyPoller(folly::EventBase* eventBase,
+             std::chrono::microseconds spinTime);
+
+  ~BusyPoller() override {
+    cancelLoopCallback();
+  }
+
+  /**
+   * Something happened on the thread, such as a read or a new connection:
+   * spin for another spinTime.
+   */
+  void onActivity() {
+    active_ = true;
+    if (!isLoopCallbackScheduled()) {
+      eventBase_->runInLoop(this);
+    }
+  }
+
+  bool isSpinning() const {
+    return isLoopCallbackScheduled();
+  }
+
+  std::chrono::microseconds getSpinTime() const {
+    return spinTime_;
+  }
+
+ private:
+  void runLoopCallback() noexcept override;
+
+  folly::EventBase* eventBase_;
+  const std::chrono::microseconds spinTime_;
+  std::chrono::steady_clock::time_point spinUntil_;
+  bool active_{false};
+};
+
+}
@@ -0,0 +1,141 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/services/CPUAffinity.h>
+
+#include <ctype.h>
+#include <folly/Conv.h>
+#include <glog/logging.h>
+#include <stdexcept>
+#include <string.h>
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace proxygen {
+
+std::vector<int> parseCPUList(folly::StringPiece list) {
+  std::vector<int> cpus;
+  // As read from /sys, with a newline
+  while (!list.empty() && isspace(list.back())) {
+    list.subtract(1);
+  }
+  while (!list.empty()) {
+    auto range = list.split_step(',');
+    auto dash = range.find('-');
+    try {
+      if (dash == folly::StringPiece::npos) {
+        cpus.push_back(folly::to<int>(range));
+      } else {
+        auto first = folly::to<int>(range.subpiece(0, dash));
+        auto last = folly::to<int>(range.subpiece(dash + 1));
+        if (last < first) {
+          throw std::range_error("empty range");
+        }
+        for (int cpu = first; cpu <= last; ++cpu) {
+          cpus.push_back(cpu);
+        }
+      }
+    } catch (const std::range_error& ex) {
+      throw std::invalid_argument(
+        folly::to<std::string>("bad CPU list entry '", range, "': ",
+                               ex.what()));
+    }
+  }
+  return cpus;
+}
+
+#ifdef __linux__
+
+bool setThreadCPUAffinity(const std::vector<int>& cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (auto cpu: cpus) {
+    CPU_SET(cpu, &set);
+  }
+  int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (rc != 0) {
+    LOG(WARNING) << "Failed to set the CPU affinity: " << strerror(rc);
+    return false;
+  }
+  return true;
+}
+
+int getNumaNodeOfCPU(int cpu) {
+  // The node is a "nodeN" link in the directory of the CPU
+  auto path = folly::to<std::string>("/sys/devices/system/cpu/cpu", cpu);
+  auto dir = opendir(path.c_str());
+  if (!dir) {
+    return -1;
+  }
+  int node = -1;
+  while (auto entry = readdir(dir)) {
+    folly::StringPiece name(entry->d_name);
+    if (name.removePrefix("node")) {
+      try {
+        node = folly::to<int>(name);
+        break;
+      } catch (const std::range_error&) {
+      }
+    }
+  }
+  closedir(dir);
+  return node;
+}
+
+bool setThreadPreferredNumaNode(int node) {
+  // From <linux/mempolicy.h>, to not need libnuma
+  const int kMpolPreferred = 1;
+  if (node < 0 || node >= 64) {
+    return false;
+  }
+  unsigned long mask = 1UL << node;
+  if (syscall(SYS_set_mempolicy, kMpolPreferred, &mask, 64) != 0) {
+    PLOG(WARNING) << "Failed to prefer memory of NUMA node " << node;
+    return false;
+  }
+  return true;
+}
+
+bool setSocketIncomingCPU(int fd, int cpu) {
+#ifdef SO_INCOMING_CPU
+  if (setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) == 0) {
+    return true;
+  }
+  PLOG(WARNING) << "Failed to set SO_INCOMING_CPU to " << cpu;
+#endif
+  return false;
+}
+
+#else
+
+bool setThreadCPUAffinity(const std::vector<int>&) {
+  return false;
+}
+
+int getNumaNodeOfCPU(int) {
+  return -1;
+}
+
+bool setThreadPreferredNumaNode(int) {
+  return false;
+}
+
+bool setSocketIncomingCPU(int, int) {
+  return false;
+}
+
+#endif
+
+}
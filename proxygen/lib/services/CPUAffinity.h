@@ -0,0 +1,52 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/Range.h>
+#include <vector>
+
+namespace proxygen {
+
+/**
+ * Helpers to keep a thread and its memory on given CPUs. They do nothing
+ * but return false where that is not supported (everywhere but Linux).
+ */
+
+/**
+ * Parse a list of CPUs in the format of /sys, such as "0-3,8,10-11".
+ * Throws std::invalid_argument on a malformed list.
+ */
+std::vector<int> parseCPUList(folly::StringPiece list);
+
+/**
+ * Restrict the calling thread to the given CPUs
+ */
+bool setThreadCPUAffinity(const std::vector<int>& cpus);
+
+/**
+ * The NUMA node of the given CPU, or -1 if unknown
+ */
+int getNumaNodeOfCPU(int cpu);
+
+/**
+ * Make the calling thread allocate memory from the given NUMA node,
+ * whenever it has free memory
+ */
+bool setThreadPreferredNumaNode(int node);
+
+/**
+ * Have a socket of a SO_REUSEPORT group picked for connections whose
+ * packets the kernel receives on cpu, so they are accepted by the thread
+ * running there. Only meaningful once the NIC's RX queue interrupts are
+ * steered to the CPUs of the workers.
+ */
+bool setSocketIncomingCPU(int fd, int cpu);
+
+}
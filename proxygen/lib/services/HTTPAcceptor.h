@@ -36,12 +36,30 @@ class HTTPAcceptor : public folly::Acceptor {
     return transactionTimeouts_.get();
   }
 
+  /**
+   * The timeouts for the rest of a request's headers and for more of its
+   * body, if configured apart from the transaction idle timeout, or null.
+   */
+  AsyncTimeoutSet* getHeaderTimeoutSet() {
+    return headerTimeouts_.get();
+  }
+  AsyncTimeoutSet* getBodyTimeoutSet() {
+    return bodyTimeouts_.get();
+  }
+
   void init(folly::AsyncServerSocket* serverSocket,
             folly::EventBase* eventBase) override {
     Acceptor::init(serverSocket, eventBase);
     transactionTimeouts_.reset(new AsyncTimeoutSet(
                                  eventBase, accConfig_.transactionIdleTimeout));
-
+    if (accConfig_.headerReadTimeout.count() > 0) {
+      headerTimeouts_.reset(new AsyncTimeoutSet(
+                              eventBase, accConfig_.headerReadTimeout));
+    }
+    if (accConfig_.bodyReadTimeout.count() > 0) {
+      bodyTimeouts_.reset(new AsyncTimeoutSet(
+                            eventBase, accConfig_.bodyReadTimeout));
+    }
   }
 
   const AcceptorConfiguration& getConfig() const { return accConfig_; }
@@ -50,6 +68,8 @@ class HTTPAcceptor : public folly::Acceptor {
   AcceptorConfiguration accConfig_;
  private:
   AsyncTimeoutSet::UniquePtr transactionTimeouts_;
+  AsyncTimeoutSet::UniquePtr headerTimeouts_;
+  AsyncTimeoutSet::UniquePtr bodyTimeouts_;
   AsyncTimeoutSet::UniquePtr tcpEventsTimeouts_;
 };
 
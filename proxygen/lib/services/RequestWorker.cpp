@@ -16,12 +16,12 @@ namespace proxygen {
 
 RequestWorker::RequestWorker(FinishCallback& callback, uint8_t threadId)
     : WorkerThread(folly::EventBaseManager::get()),
-      nextRequestId_(static_cast<uint64_t>(threadId) << 56),
+      context_(threadId),
       callback_(callback) {
 }
 
 uint64_t RequestWorker::nextRequestId() {
-  return getRequestWorker()->nextRequestId_++;
+  return getRequestWorker()->context_.nextRequestId();
 }
 
 void RequestWorker::flushStats() {
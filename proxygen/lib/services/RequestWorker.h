@@ -11,6 +11,7 @@
 
 #include <cstdint>
 #include <map>
+#include <proxygen/lib/services/WorkerContext.h>
 #include <proxygen/lib/services/WorkerThread.h>
 
 namespace proxygen {
@@ -38,8 +39,17 @@ class RequestWorker : public WorkerThread {
    */
   RequestWorker(FinishCallback& callback, uint8_t threadId);
 
+  /**
+   * A request id from the worker running this thread, see
+   * WorkerContext::nextRequestId(). Code that has the WorkerContext should
+   * use it directly, rather than find the worker.
+   */
   static uint64_t nextRequestId();
 
+  WorkerContext& getContext() {
+    return context_;
+  }
+
   static RequestWorker* getRequestWorker() {
     RequestWorker* self = dynamic_cast<RequestWorker*>(
       WorkerThread::getCurrentWorkerThread());
@@ -75,9 +85,8 @@ class RequestWorker : public WorkerThread {
  private:
   void cleanup() override;
 
-  // The next request id within this thread. The id has its highest byte set to
-  // the thread id, so is unique across the process.
-  uint64_t nextRequestId_;
+  // The request ids and other state of this thread
+  WorkerContext context_;
 
   // The ServiceWorkers executing in this worker
   std::map<Service*, ServiceWorker*> serviceWorkers_;
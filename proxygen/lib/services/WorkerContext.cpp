@@ -0,0 +1,35 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/services/WorkerContext.h>
+
+#include <atomic>
+#include <folly/Memory.h>
+
+namespace proxygen {
+
+size_t WorkerContext::allocateSlot() {
+  static std::atomic<size_t> nextSlot{0};
+  size_t slot = nextSlot.fetch_add(1);
+  CHECK_LT(slot, kMaxSlots) << "Out of WorkerContext slots";
+  return slot;
+}
+
+WorkerContext* WorkerContextSet::get(folly::EventBase* eventBase) {
+  std::lock_guard<std::mutex> g(lock_);
+  auto& context = contexts_[eventBase];
+  if (!context) {
+    // Only the low byte goes in the request ids
+    context = folly::make_unique<WorkerContext>(
+      static_cast<uint8_t>(contexts_.size() - 1));
+  }
+  return context.get();
+}
+
+}
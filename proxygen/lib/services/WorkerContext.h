@@ -0,0 +1,89 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <cstdint>
+#include <folly/detail/CacheLocality.h>
+#include <glog/logging.h>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace folly {
+class EventBase;
+}
+
+namespace proxygen {
+
+/**
+ * The state of one worker thread that only that thread touches: its
+ * request ids, and slots where other features keep their per-worker
+ * state (stats, arenas, caches...) without any locking or sharing of
+ * cache lines with the other workers. The HTTPTransactions of its
+ * sessions get to it with HTTPTransaction::getWorkerContext().
+ *
+ * Only used from the thread of its worker.
+ */
+class WorkerContext {
+ public:
+  static const size_t kMaxSlots = 8;
+
+  explicit WorkerContext(uint8_t workerId)
+      : nextRequestId_(static_cast<uint64_t>(workerId) << 56),
+        workerId_(workerId) {}
+
+  uint8_t getWorkerId() const {
+    return workerId_;
+  }
+
+  /**
+   * A request id, unique across the process: the worker id is its
+   * highest byte.
+   */
+  uint64_t nextRequestId() {
+    return nextRequestId_++;
+  }
+
+  /**
+   * Reserve a slot in the WorkerContexts of all the workers, typically
+   * once at startup. There are kMaxSlots of them.
+   */
+  static size_t allocateSlot();
+
+  void* getSlot(size_t slot) const {
+    DCHECK_LT(slot, kMaxSlots);
+    return slots_[slot];
+  }
+
+  void setSlot(size_t slot, void* state) {
+    DCHECK_LT(slot, kMaxSlots);
+    slots_[slot] = state;
+  }
+
+ private:
+  uint64_t nextRequestId_;
+  void* slots_[kMaxSlots] = {};
+  const uint8_t workerId_;
+} FOLLY_ALIGN_TO_AVOID_FALSE_SHARING;
+
+/**
+ * The WorkerContexts of a set of workers, one per EventBase, numbered in
+ * the order the workers first ask for theirs. Can be used from any thread.
+ */
+class WorkerContextSet {
+ public:
+  WorkerContext* get(folly::EventBase* eventBase);
+
+ private:
+  std::mutex lock_;
+  std::map<folly::EventBase*, std::unique_ptr<WorkerContext>> contexts_;
+};
+
+}
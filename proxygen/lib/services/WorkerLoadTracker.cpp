@@ -0,0 +1,66 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/services/WorkerLoadTracker.h>
+
+#include <algorithm>
+#include <glog/logging.h>
+
+namespace proxygen {
+
+const uint64_t WorkerLoadTracker::kEgressBytesPerSession = 64 * 1024;
+const std::chrono::microseconds WorkerLoadTracker::kLoopTimePerSession{100};
+
+WorkerLoadTracker::WorkerLoadTracker(size_t numWorkers):
+    workers_(numWorkers) {
+  CHECK_GT(numWorkers, 0);
+}
+
+double WorkerLoadTracker::getLoad(size_t worker) const {
+  const auto& load = workers_[worker];
+  auto egressBytes = load.egressBytes.load(std::memory_order_relaxed);
+  // Updates from different sessions may be observed out of order
+  if (egressBytes < 0) {
+    egressBytes = 0;
+  }
+  auto loopTimeUs = load.loopTimeUs.load(std::memory_order_relaxed);
+  return double(load.sessions.load(std::memory_order_relaxed)) +
+    load.dispatched.load(std::memory_order_relaxed) +
+    double(egressBytes) / kEgressBytesPerSession +
+    double(loopTimeUs) / kLoopTimePerSession.count();
+}
+
+size_t WorkerLoadTracker::pickWorker() const {
+  size_t best = 0;
+  double bestLoad = getLoad(0);
+  for (size_t i = 1; i < workers_.size(); ++i) {
+    auto load = getLoad(i);
+    if (load < bestLoad) {
+      best = i;
+      bestLoad = load;
+    }
+  }
+  return best;
+}
+
+double WorkerLoadTracker::getImbalance() const {
+  double total = 0;
+  double max = 0;
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    auto load = getLoad(i);
+    total += load;
+    max = std::max(max, load);
+  }
+  if (total == 0) {
+    return 1;
+  }
+  return max * workers_.size() / total;
+}
+
+} // proxygen
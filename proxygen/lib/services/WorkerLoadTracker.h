@@ -0,0 +1,106 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <folly/detail/CacheLocality.h>
+#include <vector>
+
+namespace proxygen {
+
+/**
+ * Keeps track of how busy each of a fixed set of worker threads is, so
+ * that new connections can be handed to the least loaded one rather than
+ * round robin. Each worker updates its own entry from its own thread; the
+ * load of any worker can be read, and pickWorker() called, from any
+ * thread.
+ *
+ * The load of a worker combines the sessions it runs, the egress bytes
+ * those sessions buffer and the average time its event loop spends per
+ * iteration, see getLoad().
+ */
+class WorkerLoadTracker {
+ public:
+  // Buffered egress bytes that weigh as much as one more session
+  static const uint64_t kEgressBytesPerSession;
+  // Average loop time that weighs as much as one more session
+  static const std::chrono::microseconds kLoopTimePerSession;
+
+  explicit WorkerLoadTracker(size_t numWorkers);
+
+  size_t getNumWorkers() const {
+    return workers_.size();
+  }
+
+  void onSessionCreated(size_t worker) {
+    workers_[worker].sessions.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void onSessionDestroyed(size_t worker) {
+    workers_[worker].sessions.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  void onEgressBufferChanged(size_t worker, int64_t delta) {
+    workers_[worker].egressBytes.fetch_add(delta, std::memory_order_relaxed);
+  }
+
+  void setLoopTime(size_t worker, std::chrono::microseconds loopTime) {
+    workers_[worker].loopTimeUs.store(loopTime.count(),
+                                      std::memory_order_relaxed);
+  }
+
+  /**
+   * Connections handed to a worker that it has not picked up yet. They
+   * count as sessions, so a burst of accepts is spread out before the
+   * workers get to create their sessions.
+   */
+  void onConnectionDispatched(size_t worker) {
+    workers_[worker].dispatched.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void onConnectionReceived(size_t worker) {
+    workers_[worker].dispatched.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  uint32_t getNumSessions(size_t worker) const {
+    return workers_[worker].sessions.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * The load of a worker, in sessions: the number of sessions it runs (or
+   * was dispatched), plus one for every kEgressBytesPerSession egress
+   * bytes buffered and every kLoopTimePerSession of average loop time.
+   */
+  double getLoad(size_t worker) const;
+
+  /**
+   * Returns the index of the least loaded worker, the first one on ties.
+   */
+  size_t pickWorker() const;
+
+  /**
+   * The load of the most loaded worker over the mean load of all of
+   * them, or 1 if there is no load at all. 1 means perfectly balanced.
+   */
+  double getImbalance() const;
+
+ private:
+  struct WorkerLoad {
+    std::atomic<uint32_t> sessions{0};
+    std::atomic<uint32_t> dispatched{0};
+    std::atomic<int64_t> egressBytes{0};
+    std::atomic<int64_t> loopTimeUs{0};
+  } FOLLY_ALIGN_TO_AVOID_FALSE_SHARING;
+
+  std::vector<WorkerLoad> workers_;
+};
+
+} // proxygen
@@ -12,6 +12,7 @@
 #include <folly/String.h>
 #include <folly/io/async/EventBaseManager.h>
 #include <glog/logging.h>
+#include <proxygen/lib/services/CPUAffinity.h>
 #include <signal.h>
 
 namespace proxygen {
@@ -48,6 +49,13 @@ void WorkerThread::start() {
   // The server has been set up and is now in the loop implementation
 }
 
+void WorkerThread::setCPUAffinity(std::vector<int> cpus,
+                                  bool numaLocalMemory) {
+  CHECK(state_ == State::IDLE);
+  cpus_ = std::move(cpus);
+  numaLocalMemory_ = numaLocalMemory;
+}
+
 void WorkerThread::stopWhenIdle() {
   // Call runInEventBaseThread() to perform all of the work in the actual
   // worker thread.
@@ -108,6 +116,14 @@ void WorkerThread::setup() {
   sigaddset(&ss, SIGIO);
   PCHECK(pthread_sigmask(SIG_BLOCK, &ss, nullptr) == 0);
 
+  // Before the loop allocates anything, so it is all on the local node
+  if (!cpus_.empty()) {
+    setThreadCPUAffinity(cpus_);
+    if (numaLocalMemory_) {
+      setThreadPreferredNumaNode(getNumaNodeOfCPU(cpus_.front()));
+    }
+  }
+
   // Update the currentWorker_ thread-local pointer
   CHECK(nullptr == currentWorker_);
   currentWorker_ = this;
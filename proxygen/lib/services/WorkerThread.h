@@ -14,6 +14,7 @@
 #include <folly/io/async/EventBase.h>
 #include <mutex>
 #include <thread>
+#include <vector>
 
 namespace folly {
 class EventBaseManager;
@@ -37,6 +38,13 @@ class WorkerThread {
    */
   void start();
 
+  /**
+   * Run the worker thread on the given CPUs only and, if
+   * numaLocalMemory, have it allocate memory from the NUMA node of the
+   * first of them. Must be called before start().
+   */
+  void setCPUAffinity(std::vector<int> cpus, bool numaLocalMemory = false);
+
   /**
    * Request that the worker thread stop when there are no more events to
    * process.
@@ -118,6 +126,8 @@ class WorkerThread {
   std::mutex joinLock_;
   folly::EventBase eventBase_;
   folly::EventBaseManager* eventBaseManager_{nullptr};
+  std::vector<int> cpus_;
+  bool numaLocalMemory_{false};
 
   // A thread-local pointer to the current WorkerThread for this thread
   static __thread WorkerThread* currentWorker_;
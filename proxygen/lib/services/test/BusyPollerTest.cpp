@@ -0,0 +1,40 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <gtest/gtest.h>
+#include <proxygen/lib/services/BusyPoller.h>
+
+using namespace proxygen;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+
+TEST(BusyPollerTest, spins_after_activity) {
+  folly::EventBase evb;
+  BusyPoller poller(&evb, milliseconds(20));
+  EXPECT_FALSE(poller.isSpinning());
+
+  poller.onActivity();
+  EXPECT_TRUE(poller.isSpinning());
+  // Nothing else to wait for, the loop returns once the spinning stops
+  auto start = steady_clock::now();
+  evb.loop();
+  EXPECT_GE(steady_clock::now() - start, milliseconds(20));
+  EXPECT_FALSE(poller.isSpinning());
+}
+
+TEST(BusyPollerTest, activity_extends_spinning) {
+  folly::EventBase evb;
+  BusyPoller poller(&evb, milliseconds(20));
+  poller.onActivity();
+  auto start = steady_clock::now();
+  evb.runAfterDelay([&] { poller.onActivity(); }, 15);
+  evb.loop();
+  EXPECT_GE(steady_clock::now() - start, milliseconds(35));
+  EXPECT_FALSE(poller.isSpinning());
+}
@@ -0,0 +1,23 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <gtest/gtest.h>
+#include <proxygen/lib/services/CPUAffinity.h>
+
+using namespace proxygen;
+
+TEST(CPUAffinityTest, parse_cpu_list) {
+  EXPECT_EQ(parseCPUList(""), std::vector<int>());
+  EXPECT_EQ(parseCPUList("3"), std::vector<int>({3}));
+  EXPECT_EQ(parseCPUList("0-3,8,10-11\n"),
+            std::vector<int>({0, 1, 2, 3, 8, 10, 11}));
+  EXPECT_THROW(parseCPUList("0-"), std::invalid_argument);
+  EXPECT_THROW(parseCPUList("3-1"), std::invalid_argument);
+  EXPECT_THROW(parseCPUList("a"), std::invalid_argument);
+}
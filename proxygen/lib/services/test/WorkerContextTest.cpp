@@ -0,0 +1,40 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/io/async/EventBase.h>
+#include <gtest/gtest.h>
+#include <proxygen/lib/services/WorkerContext.h>
+
+using namespace proxygen;
+
+TEST(WorkerContextTest, request_ids) {
+  WorkerContext context(3);
+  EXPECT_EQ(3, context.getWorkerId());
+  EXPECT_EQ(3ULL << 56, context.nextRequestId());
+  EXPECT_EQ((3ULL << 56) + 1, context.nextRequestId());
+}
+
+TEST(WorkerContextTest, one_per_event_base) {
+  WorkerContextSet contexts;
+  folly::EventBase evb1;
+  folly::EventBase evb2;
+  auto context1 = contexts.get(&evb1);
+  auto context2 = contexts.get(&evb2);
+  EXPECT_NE(context1, context2);
+  EXPECT_EQ(context1, contexts.get(&evb1));
+  EXPECT_EQ(0, context1->getWorkerId());
+  EXPECT_EQ(1, context2->getWorkerId());
+
+  auto slot = WorkerContext::allocateSlot();
+  int state = 0;
+  EXPECT_EQ(nullptr, context1->getSlot(slot));
+  context1->setSlot(slot, &state);
+  EXPECT_EQ(&state, context1->getSlot(slot));
+  EXPECT_EQ(nullptr, context2->getSlot(slot));
+}
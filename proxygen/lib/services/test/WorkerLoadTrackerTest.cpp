@@ -0,0 +1,55 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <gtest/gtest.h>
+#include <proxygen/lib/services/WorkerLoadTracker.h>
+
+using namespace proxygen;
+
+TEST(WorkerLoadTrackerTest, picks_least_loaded) {
+  WorkerLoadTracker tracker(3);
+  EXPECT_EQ(tracker.pickWorker(), 0);
+  EXPECT_EQ(tracker.getImbalance(), 1);
+
+  tracker.onSessionCreated(0);
+  tracker.onSessionCreated(0);
+  tracker.onSessionCreated(2);
+  EXPECT_EQ(tracker.pickWorker(), 1);
+
+  // A connection handed over counts before its session exists
+  tracker.onConnectionDispatched(1);
+  tracker.onConnectionDispatched(1);
+  EXPECT_EQ(tracker.pickWorker(), 2);
+  tracker.onConnectionReceived(1);
+  tracker.onSessionCreated(1);
+  tracker.onConnectionReceived(1);
+  EXPECT_EQ(tracker.pickWorker(), 1);
+
+  tracker.onSessionDestroyed(0);
+  tracker.onSessionDestroyed(0);
+  EXPECT_EQ(tracker.pickWorker(), 0);
+}
+
+TEST(WorkerLoadTrackerTest, egress_and_loop_time) {
+  WorkerLoadTracker tracker(2);
+  tracker.onSessionCreated(0);
+  tracker.onSessionCreated(1);
+  const int64_t kBytes = WorkerLoadTracker::kEgressBytesPerSession;
+  tracker.onEgressBufferChanged(0, 2 * kBytes);
+  EXPECT_EQ(tracker.getLoad(0), 3);
+  EXPECT_EQ(tracker.pickWorker(), 1);
+
+  tracker.setLoopTime(1, WorkerLoadTracker::kLoopTimePerSession * 4);
+  EXPECT_EQ(tracker.getLoad(1), 5);
+  EXPECT_EQ(tracker.pickWorker(), 0);
+  EXPECT_DOUBLE_EQ(tracker.getImbalance(), 5.0 * 2 / 8);
+
+  tracker.onEgressBufferChanged(0, -2 * kBytes);
+  EXPECT_EQ(tracker.getLoad(0), 1);
+}
@@ -0,0 +1,191 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/ssl/KernelTLS.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <glog/logging.h>
+#include <openssl/crypto.h>
+#include <openssl/hmac.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/tls.h>)
+#define PROXYGEN_HAVE_KTLS 1
+#endif
+#endif
+
+#ifdef PROXYGEN_HAVE_KTLS
+#include <linux/tls.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#endif
+
+namespace proxygen {
+
+#ifdef PROXYGEN_HAVE_KTLS
+
+namespace {
+
+// The sizes of the implicit part of the GCM nonce and of sequence numbers
+const size_t kSaltLength = 4;
+const size_t kSequenceLength = 8;
+
+// P_hash of the TLS 1.2 PRF (RFC 5246, section 5)
+void prf(const EVP_MD* md, const unsigned char* secret, size_t secretLength,
+         const std::string& label, const std::string& seed,
+         unsigned char* out, size_t length) {
+  std::string labelSeed = label + seed;
+  unsigned char a[EVP_MAX_MD_SIZE];
+  unsigned int aLength = 0;
+  HMAC(md, secret, secretLength,
+       reinterpret_cast<const unsigned char*>(labelSeed.data()),
+       labelSeed.size(), a, &aLength);
+  while (length > 0) {
+    std::vector<unsigned char> input(a, a + aLength);
+    input.insert(input.end(), labelSeed.begin(), labelSeed.end());
+    unsigned char block[EVP_MAX_MD_SIZE];
+    unsigned int blockLength = 0;
+    HMAC(md, secret, secretLength, input.data(), input.size(),
+         block, &blockLength);
+    size_t n = std::min<size_t>(length, blockLength);
+    memcpy(out, block, n);
+    out += n;
+    length -= n;
+    unsigned char next[EVP_MAX_MD_SIZE];
+    HMAC(md, secret, secretLength, a, aLength, next, &aLength);
+    memcpy(a, next, aLength);
+    OPENSSL_cleanse(block, sizeof(block));
+  }
+  OPENSSL_cleanse(a, sizeof(a));
+}
+
+template <class CryptoInfo>
+bool setKeys(int fd, int direction, uint16_t cipherType,
+             const unsigned char* key, const unsigned char* salt,
+             const unsigned char* sequence) {
+  CryptoInfo info;
+  memset(&info, 0, sizeof(info));
+  info.info.version = TLS_1_2_VERSION;
+  info.info.cipher_type = cipherType;
+  memcpy(info.key, key, sizeof(info.key));
+  memcpy(info.salt, salt, sizeof(info.salt));
+  memcpy(info.rec_seq, sequence, sizeof(info.rec_seq));
+  // The explicit part of the nonce only needs to be unique for each
+  // record, the kernel counts from there
+  memcpy(info.iv, sequence, sizeof(info.iv));
+  int rc = setsockopt(fd, SOL_TLS, direction, &info, sizeof(info));
+  OPENSSL_cleanse(&info, sizeof(info));
+  return rc == 0;
+}
+
+bool setKeys(int fd, int direction, size_t keyLength,
+             const unsigned char* key, const unsigned char* salt,
+             const unsigned char* sequence) {
+  if (keyLength == TLS_CIPHER_AES_GCM_128_KEY_SIZE) {
+    return setKeys<tls12_crypto_info_aes_gcm_128>(
+      fd, direction, TLS_CIPHER_AES_GCM_128, key, salt, sequence);
+  }
+#ifdef TLS_CIPHER_AES_GCM_256
+  return setKeys<tls12_crypto_info_aes_gcm_256>(
+    fd, direction, TLS_CIPHER_AES_GCM_256, key, salt, sequence);
+#else
+  return false;
+#endif
+}
+
+}
+
+bool enableKernelTLS(const SSL* ssl, int fd) {
+  if (!SSL_is_init_finished(ssl) || SSL_version(ssl) != TLS1_2_VERSION) {
+    return false;
+  }
+  // Records already read past the handshake would be lost to the kernel
+  if (SSL_pending(ssl) > 0 || ssl->s3->rbuf.left > 0) {
+    VLOG(4) << "Can't move TLS to the kernel with buffered records";
+    return false;
+  }
+  auto cipher = SSL_get_current_cipher(ssl);
+  auto session = SSL_get_session(ssl);
+  if (!cipher || !session) {
+    return false;
+  }
+  std::string name(SSL_CIPHER_get_name(cipher));
+  size_t keyLength;
+  if (name.find("AES128-GCM") != std::string::npos) {
+    keyLength = 16;
+  } else if (name.find("AES256-GCM") != std::string::npos) {
+    keyLength = 32;
+  } else {
+    VLOG(4) << "No kernel TLS for cipher " << name;
+    return false;
+  }
+  const EVP_MD* md = EVP_sha256();
+  if (name.size() >= 6 && name.compare(name.size() - 6, 6, "SHA384") == 0) {
+    md = EVP_sha384();
+  }
+
+  // The key block of an AEAD cipher has no MAC keys: the client's then the
+  // server's key, and the client's then the server's salt
+  std::string seed(reinterpret_cast<const char*>(ssl->s3->server_random),
+                   SSL3_RANDOM_SIZE);
+  seed.append(reinterpret_cast<const char*>(ssl->s3->client_random),
+              SSL3_RANDOM_SIZE);
+  std::vector<unsigned char> keyBlock(2 * (keyLength + kSaltLength));
+  prf(md, session->master_key, session->master_key_length, "key expansion",
+      seed, keyBlock.data(), keyBlock.size());
+  const unsigned char* clientKey = keyBlock.data();
+  const unsigned char* serverKey = clientKey + keyLength;
+  const unsigned char* clientSalt = serverKey + keyLength;
+  const unsigned char* serverSalt = clientSalt + kSaltLength;
+  bool server = ssl->server;
+  static_assert(sizeof(ssl->s3->read_sequence) == kSequenceLength,
+                "unexpected TLS sequence number size");
+
+  bool enabled = false;
+  if (setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) != 0) {
+    VLOG(4) << "No kernel TLS: " << strerror(errno);
+  } else if (!setKeys(fd, TLS_RX, keyLength,
+                      server ? clientKey : serverKey,
+                      server ? clientSalt : serverSalt,
+                      ssl->s3->read_sequence)) {
+    // Without keys the socket still works as it did
+    VLOG(4) << "No kernel TLS receive: " << strerror(errno);
+  } else if (!setKeys(fd, TLS_TX, keyLength,
+                      server ? serverKey : clientKey,
+                      server ? serverSalt : clientSalt,
+                      ssl->s3->write_sequence)) {
+    LOG(ERROR) << "Failed to set kernel TLS send keys: " << strerror(errno);
+    shutdown(fd, SHUT_RDWR);
+  } else {
+    enabled = true;
+  }
+  OPENSSL_cleanse(keyBlock.data(), keyBlock.size());
+  return enabled;
+}
+
+#else
+
+bool enableKernelTLS(const SSL* ssl, int fd) {
+  return false;
+}
+
+#endif
+
+}
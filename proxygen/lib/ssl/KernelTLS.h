@@ -0,0 +1,34 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <openssl/ssl.h>
+
+namespace proxygen {
+
+/**
+ * Hand the record layer of an established TLS 1.2 connection over to the
+ * kernel (kTLS, the "tls" TCP ULP of Linux 4.17 and later), so that plain
+ * reads and writes on fd carry its application data: the kernel encrypts
+ * what is written, without a copy through OpenSSL, and decrypts what is
+ * read. ssl is not used on fd anymore after that.
+ *
+ * Only the AES-GCM ciphers are supported, and nothing past the handshake
+ * may have been read into ssl yet. Once in the kernel, records other than
+ * application data (eg. the peer's close_notify alert) fail the read.
+ *
+ * @return true if both directions are now in the kernel. When false the
+ *         connection is left as it was, unless the kernel failed to take
+ *         its send keys after its receive keys, in which case fd has been
+ *         shut down.
+ */
+bool enableKernelTLS(const SSL* ssl, int fd);
+
+}
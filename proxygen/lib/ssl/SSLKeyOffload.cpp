@@ -0,0 +1,310 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/ssl/SSLKeyOffload.h>
+
+#include <atomic>
+#include <glog/logging.h>
+#include <memory>
+#include <openssl/ec.h>
+#include <openssl/rsa.h>
+#include <string.h>
+#include <vector>
+
+// From OpenSSL 3.0 keys sign through providers, which do not use the RSA
+// and EC_KEY methods
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L && \
+  OPENSSL_VERSION_NUMBER < 0x30000000L && \
+  !defined(OPENSSL_NO_ASYNC) && !defined(OPENSSL_IS_BORINGSSL) && \
+  defined(__linux__)
+#define PROXYGEN_HAVE_SSL_ASYNC 1
+#endif
+
+#ifdef PROXYGEN_HAVE_SSL_ASYNC
+#include <openssl/async.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+namespace proxygen {
+
+#ifdef PROXYGEN_HAVE_SSL_ASYNC
+
+namespace {
+
+// The key of our fd in the wait contexts of async jobs
+const char kWaitKey = 0;
+
+typedef int (*RSAPrivateOp)(int, const unsigned char*, unsigned char*,
+                            RSA*, int);
+typedef int (*ECSign)(int, const unsigned char*, int, unsigned char*,
+                      unsigned int*, const BIGNUM*, const BIGNUM*, EC_KEY*);
+
+// Kept in the ex data of the key, with the operations it had before
+struct Offload {
+  folly::Executor* executor{nullptr};
+  RSA_METHOD* rsaMethod{nullptr};
+  RSAPrivateOp rsaPrivateEncrypt{nullptr};
+  RSAPrivateOp rsaPrivateDecrypt{nullptr};
+  EC_KEY_METHOD* ecMethod{nullptr};
+  ECSign ecSign{nullptr};
+};
+
+// An operation handed to the executor. It owns the eventfd the job waits
+// on, and the buffers the operation reads and writes, so the executor
+// thread can carry on even if the handshake went away meanwhile.
+struct Pending {
+  explicit Pending(int fd): fd(fd) {}
+  ~Pending() {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+
+  const int fd;
+  std::atomic<bool> done{false};
+  int result{-1};
+  std::vector<unsigned char> in;
+  std::vector<unsigned char> out;
+  unsigned int outLength{0};
+};
+
+typedef std::shared_ptr<Pending> PendingPtr;
+
+void releasePending(ASYNC_WAIT_CTX*, const void*, OSSL_ASYNC_FD, void* ptr) {
+  // Called if the job is freed while paused, its stack never unwinding
+  delete static_cast<PendingPtr*>(ptr);
+}
+
+/**
+ * Run op(pending) in executor while the current job is paused, or inline
+ * when there is no job. op reads pending.in and writes at most outSize
+ * bytes to pending.out; when done is called with what it did.
+ */
+template <class Op, class Done>
+int runOffloaded(folly::Executor* executor,
+                 const unsigned char* in, size_t inSize, size_t outSize,
+                 Op op, Done done) {
+  ASYNC_JOB* job = ASYNC_get_current_job();
+  int fd = job ? eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) : -1;
+  // The stack of a paused job may never unwind, so the reference of the
+  // job is owned by its wait context
+  auto pending = new PendingPtr(std::make_shared<Pending>(fd));
+  (*pending)->in.assign(in, in + inSize);
+  (*pending)->out.resize(outSize);
+  ASYNC_WAIT_CTX* waitCtx = job ? ASYNC_get_wait_ctx(job) : nullptr;
+  if (!job || fd < 0 ||
+      !ASYNC_WAIT_CTX_set_wait_fd(waitCtx, &kWaitKey, fd, pending,
+                                  releasePending)) {
+    // Not in a handshake, or one without SSL_MODE_ASYNC
+    int result = op(**pending);
+    done(**pending, result);
+    delete pending;
+    return result;
+  }
+  PendingPtr shared = *pending;
+  try {
+    executor->add([shared, op] {
+        shared->result = op(*shared);
+        shared->done.store(true, std::memory_order_release);
+        uint64_t one = 1;
+        if (write(shared->fd, &one, sizeof(one)) != sizeof(one)) {
+          PLOG(ERROR) << "Failed to signal an offloaded key operation";
+        }
+      });
+  } catch (const std::exception& ex) {
+    LOG(ERROR) << "Failed to offload a key operation: " << ex.what();
+    shared.reset();
+    ASYNC_WAIT_CTX_clear_fd(waitCtx, &kWaitKey);
+    int result = op(**pending);
+    done(**pending, result);
+    delete pending;
+    return result;
+  }
+  shared.reset();
+  // The handshake may be resumed by other events than ours
+  while (!(*pending)->done.load(std::memory_order_acquire)) {
+    ASYNC_pause_job();
+  }
+  int result = (*pending)->result;
+  done(**pending, result);
+  ASYNC_WAIT_CTX_clear_fd(waitCtx, &kWaitKey);
+  delete pending;
+  return result;
+}
+
+void freeOffload(void*, void* ptr, CRYPTO_EX_DATA*, int, long, void*) {
+  // The key's method has been finished by now
+  auto offload = static_cast<Offload*>(ptr);
+  if (offload) {
+    if (offload->rsaMethod) {
+      RSA_meth_free(offload->rsaMethod);
+    }
+    if (offload->ecMethod) {
+      EC_KEY_METHOD_free(offload->ecMethod);
+    }
+    delete offload;
+  }
+}
+
+int getRSAIndex() {
+  static int index = RSA_get_ex_new_index(0, nullptr, nullptr, nullptr,
+                                          freeOffload);
+  return index;
+}
+
+int getECIndex() {
+  static int index = EC_KEY_get_ex_new_index(0, nullptr, nullptr, nullptr,
+                                             freeOffload);
+  return index;
+}
+
+int offloadRSAPrivateOp(bool encrypt, int flen, const unsigned char* from,
+                        unsigned char* to, RSA* rsa, int padding) {
+  auto offload = static_cast<Offload*>(RSA_get_ex_data(rsa, getRSAIndex()));
+  auto op = encrypt ? offload->rsaPrivateEncrypt :
+    offload->rsaPrivateDecrypt;
+  return runOffloaded(
+    offload->executor, from, flen, RSA_size(rsa),
+    [op, rsa, padding] (Pending& pending) {
+      // The key outlives the handshake, not necessarily the operation
+      RSA_up_ref(rsa);
+      int result = op(pending.in.size(), pending.in.data(),
+                      pending.out.data(), rsa, padding);
+      RSA_free(rsa);
+      return result;
+    },
+    [to] (Pending& pending, int result) {
+      if (result > 0) {
+        memcpy(to, pending.out.data(), result);
+      }
+    });
+}
+
+int offloadRSAPrivateEncrypt(int flen, const unsigned char* from,
+                             unsigned char* to, RSA* rsa, int padding) {
+  return offloadRSAPrivateOp(true, flen, from, to, rsa, padding);
+}
+
+int offloadRSAPrivateDecrypt(int flen, const unsigned char* from,
+                             unsigned char* to, RSA* rsa, int padding) {
+  return offloadRSAPrivateOp(false, flen, from, to, rsa, padding);
+}
+
+int offloadECSign(int type, const unsigned char* dgst, int dlen,
+                  unsigned char* sig, unsigned int* siglen,
+                  const BIGNUM* kinv, const BIGNUM* r, EC_KEY* key) {
+  auto offload = static_cast<Offload*>(EC_KEY_get_ex_data(key, getECIndex()));
+  auto op = offload->ecSign;
+  if (kinv || r) {
+    // Precomputed by the caller, which we can't hand to another thread
+    return op(type, dgst, dlen, sig, siglen, kinv, r, key);
+  }
+  return runOffloaded(
+    offload->executor, dgst, dlen, ECDSA_size(key),
+    [op, type, key] (Pending& pending) {
+      EC_KEY_up_ref(key);
+      int result = op(type, pending.in.data(), pending.in.size(),
+                      pending.out.data(), &pending.outLength,
+                      nullptr, nullptr, key);
+      EC_KEY_free(key);
+      return result;
+    },
+    [sig, siglen] (Pending& pending, int result) {
+      if (result == 1) {
+        memcpy(sig, pending.out.data(), pending.outLength);
+        *siglen = pending.outLength;
+      }
+    });
+}
+
+bool offloadRSA(RSA* rsa, folly::Executor* executor) {
+  if (RSA_get_ex_data(rsa, getRSAIndex())) {
+    // Already offloaded, from another context with the same key
+    return true;
+  }
+  auto offload = new Offload;
+  offload->executor = executor;
+  offload->rsaMethod = RSA_meth_dup(RSA_get_method(rsa));
+  if (!offload->rsaMethod) {
+    delete offload;
+    return false;
+  }
+  offload->rsaPrivateEncrypt = RSA_meth_get_priv_enc(offload->rsaMethod);
+  offload->rsaPrivateDecrypt = RSA_meth_get_priv_dec(offload->rsaMethod);
+  RSA_meth_set_priv_enc(offload->rsaMethod, offloadRSAPrivateEncrypt);
+  RSA_meth_set_priv_dec(offload->rsaMethod, offloadRSAPrivateDecrypt);
+  // The key frees offload, and with it the method, once it is freed
+  RSA_set_ex_data(rsa, getRSAIndex(), offload);
+  RSA_set_method(rsa, offload->rsaMethod);
+  return true;
+}
+
+bool offloadEC(EC_KEY* key, folly::Executor* executor) {
+  if (EC_KEY_get_ex_data(key, getECIndex())) {
+    return true;
+  }
+  auto offload = new Offload;
+  offload->executor = executor;
+  offload->ecMethod = EC_KEY_METHOD_new(EC_KEY_get_method(key));
+  if (!offload->ecMethod) {
+    delete offload;
+    return false;
+  }
+  int (*signSetup)(EC_KEY*, BN_CTX*, BIGNUM**, BIGNUM**) = nullptr;
+  ECDSA_SIG* (*signSig)(const unsigned char*, int, const BIGNUM*,
+                        const BIGNUM*, EC_KEY*) = nullptr;
+  EC_KEY_METHOD_get_sign(offload->ecMethod, &offload->ecSign, &signSetup,
+                         &signSig);
+  EC_KEY_METHOD_set_sign(offload->ecMethod, offloadECSign, signSetup,
+                         signSig);
+  EC_KEY_set_ex_data(key, getECIndex(), offload);
+  EC_KEY_set_method(key, offload->ecMethod);
+  return true;
+}
+
+}
+
+bool enableSSLKeyOffload(SSL_CTX* ctx, folly::Executor* executor) {
+  CHECK(executor);
+  EVP_PKEY* pkey = SSL_CTX_get0_privatekey(ctx);
+  if (!pkey) {
+    return false;
+  }
+  bool offloaded = false;
+  switch (EVP_PKEY_base_id(pkey)) {
+    case EVP_PKEY_RSA: {
+      RSA* rsa = EVP_PKEY_get1_RSA(pkey);
+      offloaded = offloadRSA(rsa, executor);
+      RSA_free(rsa);
+      break;
+    }
+    case EVP_PKEY_EC: {
+      EC_KEY* key = EVP_PKEY_get1_EC_KEY(pkey);
+      offloaded = offloadEC(key, executor);
+      EC_KEY_free(key);
+      break;
+    }
+  }
+  if (offloaded) {
+    SSL_CTX_set_mode(ctx, SSL_MODE_ASYNC);
+  }
+  return offloaded;
+}
+
+#else
+
+bool enableSSLKeyOffload(SSL_CTX*, folly::Executor*) {
+  VLOG(2) << "OpenSSL has no async jobs, key operations stay inline";
+  return false;
+}
+
+#endif
+
+}
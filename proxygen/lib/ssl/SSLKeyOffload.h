@@ -0,0 +1,35 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/Executor.h>
+#include <openssl/ssl.h>
+
+namespace proxygen {
+
+/**
+ * Run the private key operations of the handshakes of ctx, the RSA
+ * signatures and decryptions or the ECDSA signatures its key makes, in
+ * executor rather than in the thread doing the handshake. The handshake
+ * is paused as an OpenSSL async job (SSL_MODE_ASYNC) meanwhile, so the
+ * event loop of that thread keeps serving its other connections, and
+ * AsyncSSLSocket resumes it once the operation is done. executor may as
+ * well hand the operation to a remote signer, blocking its own thread.
+ *
+ * Needs OpenSSL 1.1 with async jobs. The key of ctx is changed to use
+ * executor wherever it is used from an async job, so executor must
+ * outlive it.
+ *
+ * @return false if OpenSSL lacks async jobs or ctx has no RSA or EC key,
+ *         in which case ctx is left as it was
+ */
+bool enableSSLKeyOffload(SSL_CTX* ctx, folly::Executor* executor);
+
+}
@@ -0,0 +1,87 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/ssl/SSLSessionCache.h>
+
+#include <ctime>
+#include <glog/logging.h>
+
+namespace proxygen {
+
+SSLSessionCache::SSLSessionCache(size_t capacity)
+    : capacity_(capacity) {
+  CHECK_GT(capacity_, 0);
+}
+
+SSL_SESSION* SSLSessionCache::get(const std::string& key) {
+  std::string der;
+  {
+    std::lock_guard<std::mutex> g(lock_);
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+      return nullptr;
+    }
+    der = it->second->der;
+  }
+
+  // deserialize outside of the lock
+  auto p = reinterpret_cast<const unsigned char*>(der.data());
+  SSL_SESSION* session = d2i_SSL_SESSION(nullptr, &p, der.size());
+  if (!session) {
+    remove(key);
+    return nullptr;
+  }
+  if (SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session) <
+      time(nullptr)) {
+    VLOG(4) << "Expired TLS session for " << key;
+    SSL_SESSION_free(session);
+    remove(key);
+    return nullptr;
+  }
+  return session;
+}
+
+void SSLSessionCache::put(const std::string& key, SSL_SESSION* session) {
+  int len = i2d_SSL_SESSION(session, nullptr);
+  if (len <= 0) {
+    return;
+  }
+  std::string der(len, '\0');
+  auto p = reinterpret_cast<unsigned char*>(&der[0]);
+  i2d_SSL_SESSION(session, &p);
+
+  std::lock_guard<std::mutex> g(lock_);
+  removeLocked(key);
+  entries_.push_front(Entry{key, std::move(der)});
+  index_[key] = entries_.begin();
+  if (entries_.size() > capacity_) {
+    index_.erase(entries_.back().key);
+    entries_.pop_back();
+  }
+}
+
+void SSLSessionCache::remove(const std::string& key) {
+  std::lock_guard<std::mutex> g(lock_);
+  removeLocked(key);
+}
+
+size_t SSLSessionCache::size() const {
+  std::lock_guard<std::mutex> g(lock_);
+  return entries_.size();
+}
+
+void SSLSessionCache::removeLocked(const std::string& key) {
+  auto it = index_.find(key);
+  if (it != index_.end()) {
+    entries_.erase(it->second);
+    index_.erase(it);
+  }
+}
+
+}
@@ -0,0 +1,65 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <openssl/ssl.h>
+#include <string>
+#include <unordered_map>
+
+namespace proxygen {
+
+/**
+ * Client side cache of TLS sessions, so that connecting again to a server
+ * can resume the previous session (by session ID or ticket) and skip the
+ * full key exchange.
+ *
+ * Sessions are kept serialized, which lets any number of threads share one
+ * cache: each lookup gets its own SSL_SESSION, which can be handed to
+ * AsyncSSLSocket::setSSLSession() with ownership. When full, the least
+ * recently stored session is evicted.
+ */
+class SSLSessionCache {
+ public:
+  explicit SSLSessionCache(size_t capacity = 1024);
+
+  /**
+   * Returns a new SSL_SESSION for key, owned by the caller, or nullptr if
+   * there is none or it has expired.
+   */
+  SSL_SESSION* get(const std::string& key);
+
+  /**
+   * Store session under key, replacing any previous one. Does not take
+   * ownership of session.
+   */
+  void put(const std::string& key, SSL_SESSION* session);
+
+  void remove(const std::string& key);
+
+  size_t size() const;
+
+ private:
+  struct Entry {
+    std::string key;
+    std::string der;
+  };
+
+  void removeLocked(const std::string& key);
+
+  const size_t capacity_;
+  mutable std::mutex lock_;
+  // most recently stored first
+  std::list<Entry> entries_;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+};
+
+}
@@ -0,0 +1,168 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/Executor.h>
+#include <folly/io/async/EventBase.h>
+#include <gtest/gtest.h>
+#include <proxygen/lib/ssl/SSLKeyOffload.h>
+#include <proxygen/lib/ssl/test/TestUtils.h>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace proxygen;
+
+using folly::EventBase;
+
+namespace {
+
+// Keeps the operations it is given until the test runs them, the way a
+// crypto thread pool or remote signer would eventually
+class FakeExecutor : public folly::Executor {
+ public:
+  void add(folly::Func func) override {
+    if (reject) {
+      throw std::runtime_error("signer unavailable");
+    }
+    tasks.push_back(std::move(func));
+  }
+
+  // Run the operations given so far in another thread
+  size_t runAll() {
+    auto run = std::move(tasks);
+    tasks.clear();
+    std::thread([&run] {
+        for (auto& task: run) {
+          task();
+        }
+      }).join();
+    return run.size();
+  }
+
+  std::vector<folly::Func> tasks;
+  bool reject{false};
+};
+
+}
+
+class SSLKeyOffloadTest : public testing::TestWithParam<const char*> {
+ public:
+  void SetUp() override {
+    std::string key = GetParam();
+    serverContext_ = makeServerContext(
+      key == "rsa" ? "test_cert1.pem" : "test_ecdsa_cert1.pem",
+      key == "rsa" ? "test_cert1.key" : "test_ecdsa_key1.pem");
+    offloaded_ = enableSSLKeyOffload(serverContext_->getSSLCtx(),
+                                     &executor_);
+    if (!offloaded_) {
+      LOG(INFO) << "OpenSSL can't offload key operations, skipping";
+    }
+  }
+
+ protected:
+  // Loop until the handshake is waiting for the executor, or done
+  void loopUntilOffloaded(SSLSocketPair& pair) {
+    while (executor_.tasks.empty() && !pair.serverCallback.done()) {
+      evb_.loopOnce();
+    }
+  }
+
+  EventBase evb_;
+  FakeExecutor executor_;
+  std::shared_ptr<folly::SSLContext> serverContext_;
+  bool offloaded_{false};
+};
+
+TEST_P(SSLKeyOffloadTest, Handshake) {
+  if (!offloaded_) {
+    return;
+  }
+  SSLSocketPair pair(&evb_, serverContext_, makeClientContext());
+  loopUntilOffloaded(pair);
+  // The handshake waits for the signature, without holding up the loop
+  ASSERT_EQ(1, executor_.tasks.size());
+  EXPECT_FALSE(pair.serverCallback.done());
+  EXPECT_FALSE(pair.clientCallback.done());
+  evb_.loopOnce(EVLOOP_NONBLOCK);
+  EXPECT_FALSE(pair.serverCallback.done());
+
+  size_t operations = 0;
+  while (!pair.serverCallback.done() || !pair.clientCallback.done()) {
+    operations += executor_.runAll();
+    evb_.loopOnce();
+  }
+  EXPECT_GE(operations, 1);
+  EXPECT_TRUE(pair.serverCallback.succeeded) << pair.serverCallback.error;
+  EXPECT_TRUE(pair.clientCallback.succeeded) << pair.clientCallback.error;
+
+  // Handshakes that follow are offloaded as well
+  SSLSocketPair next(&evb_, serverContext_, makeClientContext());
+  loopUntilOffloaded(next);
+  EXPECT_EQ(1, executor_.tasks.size());
+  while (!next.serverCallback.done() || !next.clientCallback.done()) {
+    executor_.runAll();
+    evb_.loopOnce();
+  }
+  EXPECT_TRUE(next.serverCallback.succeeded) << next.serverCallback.error;
+}
+
+TEST_P(SSLKeyOffloadTest, ExecutorRejects) {
+  if (!offloaded_) {
+    return;
+  }
+  // A signer that refuses the operation has it made inline instead
+  executor_.reject = true;
+  SSLSocketPair pair(&evb_, serverContext_, makeClientContext());
+  evb_.loop();
+  EXPECT_TRUE(executor_.tasks.empty());
+  EXPECT_TRUE(pair.serverCallback.succeeded) << pair.serverCallback.error;
+  EXPECT_TRUE(pair.clientCallback.succeeded) << pair.clientCallback.error;
+}
+
+TEST_P(SSLKeyOffloadTest, SignerNeverAnswers) {
+  if (!offloaded_) {
+    return;
+  }
+  SSLSocketPair pair(&evb_, serverContext_, makeClientContext(), nullptr,
+                     100 /* timeoutMs */);
+  loopUntilOffloaded(pair);
+  ASSERT_EQ(1, executor_.tasks.size());
+  // The operation is lost, so the handshake times out
+  executor_.tasks.clear();
+  while (!pair.serverCallback.done()) {
+    evb_.loopOnce();
+  }
+  EXPECT_TRUE(pair.serverCallback.failed);
+  pair.server.reset();
+  evb_.loop();
+  EXPECT_TRUE(pair.clientCallback.failed);
+}
+
+TEST_P(SSLKeyOffloadTest, CloseWhilePending) {
+  if (!offloaded_) {
+    return;
+  }
+  SSLSocketPair pair(&evb_, serverContext_, makeClientContext());
+  loopUntilOffloaded(pair);
+  ASSERT_EQ(1, executor_.tasks.size());
+  // The connection goes away while the executor holds the operation
+  pair.server->closeNow();
+  EXPECT_TRUE(pair.serverCallback.failed);
+  pair.server.reset();
+  evb_.loop();
+  EXPECT_TRUE(pair.clientCallback.failed);
+
+  // Finishing it afterwards touches nothing of the connection
+  EXPECT_EQ(1, executor_.runAll());
+  evb_.loop();
+  EXPECT_FALSE(pair.serverCallback.succeeded);
+}
+
+INSTANTIATE_TEST_CASE_P(Keys, SSLKeyOffloadTest,
+                        ::testing::Values("rsa", "ecdsa"));
@@ -0,0 +1,146 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <ctime>
+#include <folly/Conv.h>
+#include <gtest/gtest.h>
+#include <proxygen/lib/ssl/SSLSessionCache.h>
+#include <proxygen/lib/ssl/test/TestUtils.h>
+#include <thread>
+#include <vector>
+
+using namespace proxygen;
+
+class SSLSessionCacheTest : public testing::Test {
+ public:
+  static void SetUpTestCase() {
+    session_ = makeSession();
+    ASSERT_NE(session_, nullptr);
+  }
+
+  static void TearDownTestCase() {
+    SSL_SESSION_free(session_);
+    session_ = nullptr;
+  }
+
+ protected:
+  // Store the session with the given creation time, which tells the
+  // copies the cache hands out apart
+  void put(SSLSessionCache& cache, const std::string& key, long created) {
+    SSL_SESSION_set_time(session_, created);
+    cache.put(key, session_);
+  }
+
+  // The creation time of the session under key, 0 if there is none
+  long get(SSLSessionCache& cache, const std::string& key) {
+    SSL_SESSION* session = cache.get(key);
+    if (!session) {
+      return 0;
+    }
+    EXPECT_NE(session, session_);
+    long created = SSL_SESSION_get_time(session);
+    SSL_SESSION_free(session);
+    return created;
+  }
+
+  static SSL_SESSION* session_;
+  const long now_ = time(nullptr);
+};
+
+SSL_SESSION* SSLSessionCacheTest::session_ = nullptr;
+
+TEST_F(SSLSessionCacheTest, StoresAndLooksUp) {
+  SSLSessionCache cache;
+  EXPECT_EQ(cache.get("a"), nullptr);
+  put(cache, "a", now_);
+  EXPECT_EQ(cache.size(), 1);
+  EXPECT_EQ(get(cache, "a"), now_);
+  // Every lookup gets a copy of its own
+  EXPECT_EQ(get(cache, "a"), now_);
+  EXPECT_EQ(get(cache, "b"), 0);
+
+  unsigned int idLength = 0;
+  unsigned int cachedIdLength = 0;
+  const unsigned char* id = SSL_SESSION_get_id(session_, &idLength);
+  SSL_SESSION* cached = cache.get("a");
+  ASSERT_NE(cached, nullptr);
+  const unsigned char* cachedId = SSL_SESSION_get_id(cached, &cachedIdLength);
+  EXPECT_EQ(std::string((const char*)id, idLength),
+            std::string((const char*)cachedId, cachedIdLength));
+  SSL_SESSION_free(cached);
+}
+
+TEST_F(SSLSessionCacheTest, ReplacesSession) {
+  SSLSessionCache cache;
+  put(cache, "a", now_ - 10);
+  put(cache, "a", now_);
+  EXPECT_EQ(cache.size(), 1);
+  EXPECT_EQ(get(cache, "a"), now_);
+}
+
+TEST_F(SSLSessionCacheTest, DropsExpiredSession) {
+  SSLSessionCache cache;
+  long timeout = SSL_SESSION_get_timeout(session_);
+  put(cache, "old", now_ - timeout - 10);
+  put(cache, "new", now_);
+  EXPECT_EQ(cache.size(), 2);
+  EXPECT_EQ(get(cache, "old"), 0);
+  // and forgets it
+  EXPECT_EQ(cache.size(), 1);
+  EXPECT_EQ(get(cache, "new"), now_);
+}
+
+TEST_F(SSLSessionCacheTest, EvictsLeastRecentlyStored) {
+  SSLSessionCache cache(2);
+  put(cache, "a", now_ - 1);
+  put(cache, "b", now_ - 2);
+  put(cache, "c", now_ - 3);
+  EXPECT_EQ(cache.size(), 2);
+  EXPECT_EQ(get(cache, "a"), 0);
+  EXPECT_EQ(get(cache, "b"), now_ - 2);
+  EXPECT_EQ(get(cache, "c"), now_ - 3);
+
+  // Storing b again makes c the oldest
+  put(cache, "b", now_ - 4);
+  put(cache, "d", now_ - 5);
+  EXPECT_EQ(cache.size(), 2);
+  EXPECT_EQ(get(cache, "c"), 0);
+  EXPECT_EQ(get(cache, "b"), now_ - 4);
+  EXPECT_EQ(get(cache, "d"), now_ - 5);
+}
+
+TEST_F(SSLSessionCacheTest, Remove) {
+  SSLSessionCache cache;
+  put(cache, "a", now_);
+  cache.remove("a");
+  cache.remove("b");
+  EXPECT_EQ(cache.size(), 0);
+  EXPECT_EQ(get(cache, "a"), 0);
+}
+
+TEST_F(SSLSessionCacheTest, SharedByThreads) {
+  SSLSessionCache cache(16);
+  put(cache, "shared", now_);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; i++) {
+    threads.emplace_back([&cache, i] {
+        SSL_SESSION* session = makeSession();
+        for (int j = 0; j < 100; j++) {
+          cache.put(folly::to<std::string>(i, "-", j), session);
+          SSL_SESSION_free(cache.get("shared"));
+        }
+        SSL_SESSION_free(session);
+      });
+  }
+  for (auto& thread: threads) {
+    thread.join();
+  }
+  EXPECT_EQ(cache.size(), 16);
+  EXPECT_EQ(get(cache, "shared"), 0);
+}
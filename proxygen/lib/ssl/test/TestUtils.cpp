@@ -0,0 +1,73 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/ssl/test/TestUtils.h>
+
+#include <gtest/gtest.h>
+#include <proxygen/lib/utils/TestUtils.h>
+#include <sys/socket.h>
+
+using folly::AsyncSSLSocket;
+using folly::EventBase;
+using folly::SSLContext;
+
+namespace {
+
+const std::string kTestDir = getContainingDirectory(__FILE__).str();
+
+void limitToTLS12(SSLContext* ctx) {
+#ifdef TLS1_3_VERSION
+  SSL_CTX_set_max_proto_version(ctx->getSSLCtx(), TLS1_2_VERSION);
+#endif
+}
+
+}
+
+namespace proxygen {
+
+std::shared_ptr<SSLContext> makeServerContext(const std::string& cert,
+                                              const std::string& key) {
+  auto ctx = std::make_shared<SSLContext>();
+  ctx->loadCertificate((kTestDir + cert).c_str());
+  ctx->loadPrivateKey((kTestDir + key).c_str());
+  limitToTLS12(ctx.get());
+  return ctx;
+}
+
+std::shared_ptr<SSLContext> makeClientContext() {
+  auto ctx = std::make_shared<SSLContext>();
+  limitToTLS12(ctx.get());
+  return ctx;
+}
+
+SSLSocketPair::SSLSocketPair(EventBase* evb,
+                             const std::shared_ptr<SSLContext>& serverContext,
+                             const std::shared_ptr<SSLContext>& clientContext,
+                             SSL_SESSION* session,
+                             uint32_t timeoutMs) {
+  int fds[2];
+  CHECK_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  server.reset(new AsyncSSLSocket(serverContext, evb, fds[0], true));
+  client.reset(new AsyncSSLSocket(clientContext, evb, fds[1], false));
+  if (session) {
+    client->setSSLSession(session, true /* take ownership */);
+  }
+  server->sslAccept(&serverCallback, timeoutMs);
+  client->sslConn(&clientCallback);
+}
+
+SSL_SESSION* makeSession() {
+  EventBase evb;
+  SSLSocketPair pair(&evb, makeServerContext(), makeClientContext());
+  evb.loop();
+  EXPECT_TRUE(pair.clientCallback.succeeded) << pair.clientCallback.error;
+  return pair.client->getSSLSession();
+}
+
+}
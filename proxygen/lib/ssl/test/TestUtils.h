@@ -0,0 +1,82 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/io/async/AsyncSSLSocket.h>
+#include <folly/io/async/EventBase.h>
+#include <folly/io/async/SSLContext.h>
+#include <memory>
+#include <string>
+
+namespace proxygen {
+
+/**
+ * Context of a TLS server with the test certificate and key of this
+ * directory. Handshakes stop at TLS 1.2, so the session of a connection
+ * is there as soon as its handshake is done.
+ */
+std::shared_ptr<folly::SSLContext> makeServerContext(
+  const std::string& cert = "test_cert1.pem",
+  const std::string& key = "test_cert1.key");
+
+std::shared_ptr<folly::SSLContext> makeClientContext();
+
+class HandshakeCallback : public folly::AsyncSSLSocket::HandshakeCB {
+ public:
+  void handshakeSuc(folly::AsyncSSLSocket*) noexcept override {
+    succeeded = true;
+  }
+
+  void handshakeErr(folly::AsyncSSLSocket*,
+                    const folly::AsyncSocketException& ex) noexcept override {
+    failed = true;
+    error = ex.what();
+  }
+
+  bool done() const {
+    return succeeded || failed;
+  }
+
+  bool succeeded{false};
+  bool failed{false};
+  std::string error;
+};
+
+/**
+ * The two ends of a local connection, with the TLS handshake started on
+ * both. They share evb, so looping it runs the handshake.
+ */
+class SSLSocketPair {
+ public:
+  /**
+   * @param session Optional session for the client to resume, owned by
+   *                the client from then on.
+   * @param timeoutMs Optional. If greater than zero, the server fails its
+   *                  handshake if it isn't done within this time.
+   */
+  SSLSocketPair(folly::EventBase* evb,
+                const std::shared_ptr<folly::SSLContext>& serverContext,
+                const std::shared_ptr<folly::SSLContext>& clientContext,
+                SSL_SESSION* session = nullptr,
+                uint32_t timeoutMs = 0);
+
+  folly::AsyncSSLSocket::UniquePtr server;
+  folly::AsyncSSLSocket::UniquePtr client;
+  HandshakeCallback serverCallback;
+  HandshakeCallback clientCallback;
+};
+
+/**
+ * Make a full handshake with a new server and return the session the
+ * client got, owned by the caller.
+ */
+SSL_SESSION* makeSession();
+
+}
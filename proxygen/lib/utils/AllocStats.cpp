@@ -0,0 +1,100 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/utils/AllocStats.h>
+
+#if PROXYGEN_ALLOC_STATS
+
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+// Plain data, so that operator new can use them before anything is
+// constructed, and after everything is destroyed
+thread_local proxygen::AllocCounts tTotals;
+thread_local proxygen::AllocCounts* tScope = nullptr;
+
+inline void countAllocation(size_t size) {
+  tTotals.allocations++;
+  tTotals.allocatedBytes += size;
+  if (tScope) {
+    tScope->allocations++;
+    tScope->allocatedBytes += size;
+  }
+}
+
+void* allocate(size_t size) {
+  countAllocation(size);
+  void* p = malloc(size ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+}
+
+void* operator new(size_t size) {
+  return allocate(size);
+}
+
+void* operator new[](size_t size) {
+  return allocate(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  countAllocation(size);
+  return malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  countAllocation(size);
+  return malloc(size ? size : 1);
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  free(p);
+}
+
+namespace proxygen {
+
+AllocStatsScope::AllocStatsScope(AllocCounts& counts): outer_(tScope) {
+  tScope = &counts;
+}
+
+AllocStatsScope::~AllocStatsScope() {
+  tScope = outer_;
+}
+
+const AllocCounts& getThreadAllocCounts() {
+  return tTotals;
+}
+
+void countIOBufClones(uint64_t n) {
+  tTotals.iobufClones += n;
+  if (tScope) {
+    tScope->iobufClones += n;
+  }
+}
+
+void countHeaderCopies(uint64_t n) {
+  tTotals.headerCopies += n;
+  if (tScope) {
+    tScope->headerCopies += n;
+  }
+}
+
+}
+
+#endif
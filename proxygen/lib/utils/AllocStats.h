@@ -0,0 +1,87 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <inttypes.h>
+#include <proxygen/proxygen-config.h>
+
+namespace proxygen {
+
+/**
+ * What a piece of work on the request path, e.g. a transaction, cost in
+ * memory allocations and copies. Only counted when proxygen is configured
+ * with --enable-alloc-stats; otherwise the counts stay zero, and counting
+ * compiles to nothing.
+ */
+struct AllocCounts {
+  // Calls to operator new, and the bytes they asked for
+  uint64_t allocations{0};
+  uint64_t allocatedBytes{0};
+  // IOBufs cloned to hand a part of a buffer on, e.g. ingress body
+  uint64_t iobufClones{0};
+  // Header names and values copied rather than moved
+  uint64_t headerCopies{0};
+
+  AllocCounts& operator+=(const AllocCounts& other) {
+    allocations += other.allocations;
+    allocatedBytes += other.allocatedBytes;
+    iobufClones += other.iobufClones;
+    headerCopies += other.headerCopies;
+    return *this;
+  }
+};
+
+#if PROXYGEN_ALLOC_STATS
+
+const bool kAllocStatsEnabled = true;
+
+/**
+ * Charges what the thread allocates and copies while the scope is alive
+ * to counts, on top of the thread's totals. Scopes nest: only the
+ * innermost one is charged.
+ */
+class AllocStatsScope {
+ public:
+  explicit AllocStatsScope(AllocCounts& counts);
+  ~AllocStatsScope();
+
+  AllocStatsScope(const AllocStatsScope&) = delete;
+  AllocStatsScope& operator=(const AllocStatsScope&) = delete;
+
+ private:
+  AllocCounts* outer_;
+};
+
+// Everything the calling thread allocated and copied so far
+const AllocCounts& getThreadAllocCounts();
+
+void countIOBufClones(uint64_t n = 1);
+void countHeaderCopies(uint64_t n = 1);
+
+#else
+
+const bool kAllocStatsEnabled = false;
+
+class AllocStatsScope {
+ public:
+  explicit AllocStatsScope(AllocCounts&) {}
+};
+
+inline const AllocCounts& getThreadAllocCounts() {
+  static const AllocCounts none;
+  return none;
+}
+
+inline void countIOBufClones(uint64_t = 1) {}
+inline void countHeaderCopies(uint64_t = 1) {}
+
+#endif
+
+}
@@ -9,7 +9,9 @@
  */
 #include <proxygen/lib/utils/AsyncTimeoutSet.h>
 
+#include <algorithm>
 #include <cassert>
+#include <folly/Bits.h>
 #include <folly/ScopeGuard.h>
 #include <folly/io/async/Request.h>
 
@@ -37,41 +39,33 @@ AsyncTimeoutSet::Callback::~Callback() {
 }
 
 void AsyncTimeoutSet::Callback::setScheduled(AsyncTimeoutSet* timeoutSet,
-                                             Callback* prev) {
+                                             milliseconds expiration) {
   assert(timeoutSet_ == nullptr);
   assert(prev_ == nullptr);
   assert(next_ == nullptr);
   assert(!timePointInitialized(expiration_));
 
   timeoutSet_ = timeoutSet;
-  prev_ = prev;
-  next_ = nullptr;
-  expiration_ = timeoutSet->timeoutClock_.millisecondsSinceEpoch() +
-    timeoutSet_->getInterval();
+  expiration_ = expiration;
+  deadline_ = expiration;
 }
 
 void AsyncTimeoutSet::Callback::cancelTimeoutImpl() {
-  if (next_ == nullptr) {
-    assert(timeoutSet_->tail_ == this);
-    timeoutSet_->tail_ = prev_;
-  } else {
-    assert(timeoutSet_->tail_ != this);
-    next_->prev_ = prev_;
-  }
-
-  if (prev_ == nullptr) {
-    assert(timeoutSet_->head_ == this);
-    timeoutSet_->head_ = next_;
-    timeoutSet_->headChanged();
-  } else {
-    assert(timeoutSet_->head_ != this);
-    prev_->next_ = next_;
-  }
+  AsyncTimeoutSet* timeoutSet = timeoutSet_;
+  timeoutSet->removeFromWheel(this);
+  timeoutSet->count_--;
 
   timeoutSet_ = nullptr;
-  prev_ = nullptr;
-  next_ = nullptr;
   expiration_ = {};
+  deadline_ = {};
+
+  if (timeoutSet->count_ == 0 && !timeoutSet->inTimeoutExpired_) {
+    // Nothing left to wake up for.  With timeouts still pending we leave the
+    // wakeup alone, even if it is now early: firing an empty slot is cheaper
+    // than re-arming on every cancel.
+    timeoutSet->folly::AsyncTimeout::cancelTimeout();
+    timeoutSet->wakeTick_ = std::numeric_limits<int64_t>::max();
+  }
 }
 
 AsyncTimeoutSet::AsyncTimeoutSet(folly::TimeoutManager* timeoutManager,
@@ -80,8 +74,6 @@ AsyncTimeoutSet::AsyncTimeoutSet(folly::TimeoutManager* timeoutManager,
                                  TimeoutClock* timeoutClock)
     : folly::AsyncTimeout(timeoutManager),
       timeoutClock_(timeoutClock ? *timeoutClock : getTimeoutClock()),
-      head_(nullptr),
-      tail_(nullptr),
       interval_(intervalMS),
       atMostEveryN_(atMostEveryN) {
 }
@@ -92,8 +84,6 @@ AsyncTimeoutSet::AsyncTimeoutSet(folly::TimeoutManager* timeoutManager,
                                  milliseconds atMostEveryN)
     : folly::AsyncTimeout(timeoutManager, internal),
       timeoutClock_(getTimeoutClock()),
-      head_(nullptr),
-      tail_(nullptr),
       interval_(intervalMS),
       atMostEveryN_(atMostEveryN) {
 }
@@ -103,11 +93,10 @@ AsyncTimeoutSet::~AsyncTimeoutSet() {
   // a call to timeoutExpired().
   assert(!inTimeoutExpired_);
 
-  // destroy() should have already cleared out the timeout list.
+  // destroy() should have already cleared out the wheels.
   // It's a bug if anyone tries to keep using the AsyncTimeoutSet after
   // calling destroy, so no new timeouts may have been scheduled since then.
-  assert(head_ == nullptr);
-  assert(tail_ == nullptr);
+  assert(count_ == 0);
 }
 
 void AsyncTimeoutSet::destroy() {
@@ -117,16 +106,34 @@ void AsyncTimeoutSet::destroy() {
   // Most users probably only want to destroy a AsyncTimeoutSet when it has no
   // callbacks remaining.  Otherwise they need to implement their own code to
   // take care of cleaning up the callbacks that will never be invoked.
-
-  // cancel from tail to head, to avoid extra calls to headChanged
-  while (tail_ != nullptr) {
-    tail_->cancelTimeout();
+  for (uint32_t wheel = 0; count_ > 0 && wheel < kNumWheels; wheel++) {
+    for (int slot = findOccupied(wheel, 0); slot >= 0;
+         slot = findOccupied(wheel, slot)) {
+      Slot& s = slots_[wheel * kWheelSize + slot];
+      while (s.head != nullptr) {
+        s.head->cancelTimeout();
+      }
+    }
   }
 
   DelayedDestruction::destroy();
 }
 
 void AsyncTimeoutSet::scheduleTimeout(Callback* callback) {
+  scheduleTimeout(callback, interval_);
+}
+
+void AsyncTimeoutSet::scheduleTimeout(Callback* callback,
+                                      milliseconds timeout) {
+  auto now = timeoutClock_.millisecondsSinceEpoch();
+  if (callback->lazyRefresh_ && callback->timeoutSet_ == this &&
+      now + timeout >= callback->expiration_) {
+    // Checked again when its expiration comes up
+    callback->deadline_ = now + timeout;
+    callback->context_ = folly::RequestContext::saveContext();
+    return;
+  }
+
   // Cancel the callback if it happens to be scheduled already.
   callback->cancelTimeout();
   assert(callback->prev_ == nullptr);
@@ -134,45 +141,173 @@ void AsyncTimeoutSet::scheduleTimeout(Callback* callback) {
 
   callback->context_ = folly::RequestContext::saveContext();
 
-  Callback* old_tail = tail_;
-  if (head_ == nullptr) {
-    // We don't have any timeouts scheduled already.  We have to schedule
-    // ourself.
-    assert(tail_ == nullptr);
-    assert(!isScheduled());
-    if (!inTimeoutExpired_) {
-      this->folly::AsyncTimeout::scheduleTimeout(interval_.count());
+  if (count_ == 0 && !inTimeoutExpired_) {
+    // Nothing is pending, so the wheels can jump straight to the present
+    // instead of being walked forward from the last time they fired.
+    curTick_ = now.count();
+  }
+  callback->setScheduled(this, now + timeout);
+  addToWheel(callback, false);
+  count_++;
+
+  if (!inTimeoutExpired_) {
+    // Any cascading due before then is caught up on when we fire, so only
+    // the new callback's own expiration can call for an earlier wakeup.
+    int64_t wakeTick = std::max(callback->expiration_.count(),
+                                earliestWakeTick_);
+    if (wakeTick < wakeTick_) {
+      scheduleWakeup(now, wakeTick);
     }
-    head_ = callback;
-    tail_ = callback;
-  } else {
-    assert(inTimeoutExpired_ || isScheduled());
-    assert(tail_->next_ == nullptr);
-    tail_->next_ = callback;
-    tail_ = callback;
   }
+}
 
-  // callback->prev_ = tail_;
-  callback->setScheduled(this, old_tail);
+const AsyncTimeoutSet::Callback* AsyncTimeoutSet::front() const {
+  // The first occupied slot of each wheel, in the order its slots come due,
+  // holds that wheel's earliest callbacks.  Outer wheels are checked first
+  // since on a tie their callbacks were scheduled earlier.
+  const Callback* first = nullptr;
+  for (int wheel = kNumWheels - 1; wheel >= 0; wheel--) {
+    uint32_t current = (curTick_ >> (kWheelBits * wheel)) & kWheelMask;
+    int slot = findOccupied(wheel, wheel == 0 ? current : current + 1);
+    if (slot < 0) {
+      slot = findOccupied(wheel, 0);
+    }
+    if (slot < 0) {
+      continue;
+    }
+    for (const Callback* cb = slots_[wheel * kWheelSize + slot].head;
+         cb != nullptr; cb = cb->next_) {
+      if (!first || cb->expiration_ < first->expiration_) {
+        first = cb;
+      }
+    }
+  }
+  return first;
 }
 
-void AsyncTimeoutSet::headChanged() {
-  if (inTimeoutExpired_) {
-    // timeoutExpired() will always update the scheduling correctly before it
-    // returns.  No need to change the state now, since we are just going to
-    // change it again later.
-    return;
+void AsyncTimeoutSet::addToWheel(Callback* callback, bool atFront) {
+  int64_t expiration = std::max(callback->expiration_.count(), curTick_);
+  uint64_t delta = expiration - curTick_;
+  uint32_t wheel = 0;
+  while (wheel < kNumWheels - 1 &&
+         delta >= (uint64_t(1) << (kWheelBits * (wheel + 1)))) {
+    wheel++;
+  }
+  const uint64_t kMaxDelta = (uint64_t(1) << (kWheelBits * kNumWheels)) - 1;
+  if (delta > kMaxDelta) {
+    // Park it as far out as the wheels reach; it is placed again each time
+    // it cascades until it comes within range.
+    expiration = curTick_ + kMaxDelta;
+  }
+  uint32_t slot = (expiration >> (kWheelBits * wheel)) & kWheelMask;
+
+  callback->slot_ = wheel * kWheelSize + slot;
+  Slot& s = slots_[callback->slot_];
+  if (s.head == nullptr) {
+    s.head = s.tail = callback;
+    occupied_[wheel][slot / 64] |= uint64_t(1) << (slot % 64);
+  } else if (atFront) {
+    callback->next_ = s.head;
+    s.head->prev_ = callback;
+    s.head = callback;
+  } else {
+    callback->prev_ = s.tail;
+    s.tail->next_ = callback;
+    s.tail = callback;
   }
+}
 
-  if (!head_) {
-    this->folly::AsyncTimeout::cancelTimeout();
+void AsyncTimeoutSet::removeFromWheel(Callback* callback) {
+  Slot& s = slots_[callback->slot_];
+  if (callback->prev_) {
+    callback->prev_->next_ = callback->next_;
+  } else {
+    assert(s.head == callback);
+    s.head = callback->next_;
+  }
+  if (callback->next_) {
+    callback->next_->prev_ = callback->prev_;
   } else {
-    milliseconds delta =
-      head_->getTimeRemaining(timeoutClock_.millisecondsSinceEpoch());
-    this->folly::AsyncTimeout::scheduleTimeout(delta.count());
+    assert(s.tail == callback);
+    s.tail = callback->prev_;
+  }
+  callback->prev_ = nullptr;
+  callback->next_ = nullptr;
+
+  if (s.head == nullptr) {
+    uint32_t wheel = callback->slot_ / kWheelSize;
+    uint32_t slot = callback->slot_ % kWheelSize;
+    occupied_[wheel][slot / 64] &= ~(uint64_t(1) << (slot % 64));
   }
 }
 
+void AsyncTimeoutSet::cascade() {
+  // Linux style: each time a wheel wraps, the next slot of the wheel
+  // outside it comes due.  Inner wheels go first, their callbacks having
+  // been scheduled after those of the outer wheels.
+  for (uint32_t wheel = 1; wheel < kNumWheels; wheel++) {
+    uint32_t slot = (curTick_ >> (kWheelBits * wheel)) & kWheelMask;
+    Slot& s = slots_[wheel * kWheelSize + slot];
+    Callback* cb = s.tail;
+    s.head = s.tail = nullptr;
+    occupied_[wheel][slot / 64] &= ~(uint64_t(1) << (slot % 64));
+    // Walk backwards, linking each at the front, to keep their order
+    while (cb != nullptr) {
+      Callback* prev = cb->prev_;
+      cb->prev_ = nullptr;
+      cb->next_ = nullptr;
+      // Take any lazy refresh into account while we are moving it anyway
+      cb->expiration_ = cb->deadline_;
+      addToWheel(cb, true);
+      cb = prev;
+    }
+    if (slot != 0) {
+      break;
+    }
+  }
+}
+
+int AsyncTimeoutSet::findOccupied(uint32_t wheel, uint32_t from) const {
+  for (uint32_t word = from / 64; word < kWheelSize / 64; word++) {
+    uint64_t bits = occupied_[wheel][word];
+    if (word == from / 64) {
+      bits &= ~uint64_t(0) << (from % 64);
+    }
+    auto bit = folly::findFirstSet(bits);
+    if (bit) {
+      return word * 64 + bit - 1;
+    }
+  }
+  return -1;
+}
+
+int64_t AsyncTimeoutSet::nextWakeTick() const {
+  int64_t wakeTick = std::numeric_limits<int64_t>::max();
+  for (uint32_t wheel = 0; wheel < kNumWheels; wheel++) {
+    uint32_t shift = kWheelBits * wheel;
+    int64_t current = curTick_ >> shift;
+    // Slots of the innermost wheel fire at their tick; the current slot of
+    // an outer wheel was cascaded when it came due, so only later ones
+    // count there.
+    int slot = findOccupied(wheel, (current & kWheelMask) + (wheel ? 1 : 0));
+    if (slot >= 0) {
+      wakeTick = std::min(wakeTick, (current - (current & kWheelMask) + slot)
+                                    << shift);
+    } else if ((slot = findOccupied(wheel, 0)) >= 0) {
+      // Only slots this wheel reaches on its next revolution
+      wakeTick = std::min(wakeTick, ((current | kWheelMask) + 1 + slot)
+                                    << shift);
+    }
+  }
+  return wakeTick;
+}
+
+void AsyncTimeoutSet::scheduleWakeup(milliseconds now, int64_t wakeTick) {
+  int64_t delta = std::max(wakeTick - now.count(), int64_t(0));
+  wakeTick_ = now.count() + delta;
+  this->folly::AsyncTimeout::scheduleTimeout(delta);
+}
+
 void AsyncTimeoutSet::timeoutExpired() noexcept {
   // If destroy() is called inside timeoutExpired(), delay actual destruction
   // until timeoutExpired() returns
@@ -203,25 +338,48 @@ void AsyncTimeoutSet::timeoutExpired() noexcept {
   // stale.  If we find that this becomes a problem in practice we could be
   // more smart about when we recompute the current time.
   auto now = timeoutClock_.millisecondsSinceEpoch();
+  wakeTick_ = std::numeric_limits<int64_t>::max();
+
+  while (count_ > 0 && curTick_ <= now.count()) {
+    uint32_t slot = curTick_ & kWheelMask;
+    if (slot == 0) {
+      cascade();
+    }
 
-  while (head_ != nullptr) {
-    milliseconds delta = head_->getTimeRemaining(now);
-    if (delta > milliseconds(0)) {
-      if (delta < atMostEveryN_) {
-        delta = atMostEveryN_;
+    // Callbacks rescheduled for this same tick land back in this slot and
+    // are fired too, as they would be if we had woken up a little later.
+    Slot& s = slots_[slot];
+    while (s.head != nullptr) {
+      Callback* cb = s.head;
+      if (cb->deadline_.count() > curTick_) {
+        // Refreshed lazily since it was placed, so not due yet
+        removeFromWheel(cb);
+        cb->expiration_ = cb->deadline_;
+        addToWheel(cb, false);
+        continue;
       }
-      this->folly::AsyncTimeout::scheduleTimeout(delta.count());
-      break;
+      cb->cancelTimeout();
+      auto old_ctx =
+        folly::RequestContext::setContext(cb->context_);
+      cb->timeoutExpired();
+      folly::RequestContext::setContext(old_ctx);
     }
 
-    // Remember the callback to invoke, since calling cancelTimeout()
-    // on it will modify head_.
-    Callback* cb = head_;
-    head_->cancelTimeout();
-    auto old_ctx =
-      folly::RequestContext::setContext(cb->context_);
-    cb->timeoutExpired();
-    folly::RequestContext::setContext(old_ctx);
+    // Skip ahead to the next occupied slot, or to the end of this
+    // revolution where the outer wheels cascade, but not past the present:
+    // anything scheduled from here on must still fit in front of curTick_.
+    int next = findOccupied(0, slot + 1);
+    if (next >= 0) {
+      curTick_ += next - slot;
+    } else {
+      curTick_ = (curTick_ | kWheelMask) + 1;
+    }
+    curTick_ = std::min(curTick_, now.count() + 1);
+  }
+
+  earliestWakeTick_ = now.count() + atMostEveryN_.count();
+  if (count_ > 0) {
+    scheduleWakeup(now, std::max(nextWakeTick(), earliestWakeTick_));
   }
 }
 
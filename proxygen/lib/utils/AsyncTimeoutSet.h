@@ -14,28 +14,33 @@
 #include <folly/io/async/AsyncTimeout.h>
 #include <folly/io/async/DelayedDestruction.h>
 #include <folly/io/async/TimeoutManager.h>
+#include <limits>
 #include <memory>
 #include <proxygen/lib/utils/Time.h>
 
 namespace proxygen {
 
 /**
- * AsyncTimeoutSet exists for efficiently managing a group of timeouts events
- * that always have the same timeout interval.
+ * AsyncTimeoutSet exists for efficiently managing a large group of timeout
+ * events with a single underlying AsyncTimeout.
  *
- * AsyncTimeoutSet takes advantage of the fact that the timeouts are always
- * scheduled in sorted order.  (Since each timeout has the same interval, when
- * a new timeout is scheduled it will always be the last timeout in the set.)
- * This avoids the need to perform any additional sorting of the timeouts
- * within a single AsyncTimeoutSet.
+ * Callbacks are kept in a hierarchical timing wheel: four wheels of 256
+ * slots each, with a 1ms tick on the innermost wheel, so a timeout up to
+ * about 49 days away is scheduled or cancelled in O(1) regardless of how
+ * many are pending or how many distinct intervals they use.  Timeouts due
+ * further out than the innermost wheel are cascaded down as their time
+ * approaches.  The underlying AsyncTimeout is only re-armed when a new
+ * timeout is due before the next wakeup, never on cancel, so refreshing the
+ * idle timeouts of many connections does not churn the event base.
  *
- * AsyncTimeoutSet is useful whenever you have a large group of objects that
- * each need their own timeout, but with the same interval for each object.
- * For example, managing idle timeouts for thousands of connection, or
- * scheduling health checks for a large group of servers.
+ * Each set has a default interval, used by scheduleTimeout(Callback*), but
+ * any callback may be scheduled with its own interval.  Callbacks that come
+ * due at the same millisecond fire in the order they were scheduled.
  *
- * Note, this class may not be needed given libevent's
- * event_base_init_common_timeout(). We should look into using that.
+ * AsyncTimeoutSet is useful whenever you have a large group of objects that
+ * each need their own timeout.  For example, managing idle timeouts for
+ * thousands of connection, or scheduling health checks for a large group of
+ * servers.
  */
 class AsyncTimeoutSet : private folly::AsyncTimeout,
                         public folly::DelayedDestruction {
@@ -82,25 +87,39 @@ class AsyncTimeoutSet : private folly::AsyncTimeout,
       return timeoutSet_ != nullptr;
     }
 
-   private:
-    // Get the time remaining until this timeout expires
-    std::chrono::milliseconds getTimeRemaining(
-      std::chrono::milliseconds now) const {
-      if (now >= expiration_) {
-        return std::chrono::milliseconds(0);
-      }
-      return expiration_ - now;
+    /**
+     * In lazy refresh mode, rescheduling this callback on the set it is
+     * already scheduled in, for no earlier than it is due, only records the
+     * new deadline.  The callback stays where it is in the wheels and is
+     * moved to its deadline when its old expiration comes up, so a callback
+     * refreshed on every read or write costs a compare and a store per
+     * refresh instead of an unlink and relink.
+     *
+     * Lazy callbacks due at the same time may fire out of scheduling order,
+     * and front() orders them by when they are next checked.
+     */
+    void setLazyRefresh(bool lazy) {
+      lazyRefresh_ = lazy;
     }
 
-    void setScheduled(AsyncTimeoutSet* timeoutSet, Callback* prev);
+   private:
+    void setScheduled(AsyncTimeoutSet* timeoutSet,
+                      std::chrono::milliseconds expiration);
     void cancelTimeoutImpl();
 
     std::shared_ptr<folly::RequestContext> context_;
 
     AsyncTimeoutSet* timeoutSet_{nullptr};
+    // Neighbours in the wheel slot this callback is linked into
     Callback* prev_{nullptr};
     Callback* next_{nullptr};
     std::chrono::milliseconds expiration_{0};
+    // When the callback is actually due; past expiration_ only when a lazy
+    // refresh pushed it back
+    std::chrono::milliseconds deadline_{0};
+    // Index of that slot in AsyncTimeoutSet::slots_
+    uint32_t slot_{0};
+    bool lazyRefresh_{false};
 
     // Give AsyncTimeoutSet direct access to our members so it can take care
     // of scheduling/cancelling.
@@ -173,6 +192,12 @@ class AsyncTimeoutSet : private folly::AsyncTimeout,
    */
   void scheduleTimeout(Callback* callback);
 
+  /**
+   * Schedule the specified Callback to be invoked after the given timeout
+   * rather than the AsyncTimeoutSet's default interval.
+   */
+  void scheduleTimeout(Callback* callback, std::chrono::milliseconds timeout);
+
   /**
    * Limit how frequently this AsyncTimeoutSet will fire.
    */
@@ -182,9 +207,22 @@ class AsyncTimeoutSet : private folly::AsyncTimeout,
 
   /**
    * Get a pointer to the next Callback scheduled to be invoked (may be null).
+   *
+   * This walks the wheels, so it is meant for tests and diagnostics rather
+   * than the fast path.
    */
-  Callback* front() { return head_; }
-  const Callback* front() const { return head_; }
+  Callback* front() {
+    return const_cast<Callback*>(
+      static_cast<const AsyncTimeoutSet*>(this)->front());
+  }
+  const Callback* front() const;
+
+  /**
+   * Get the number of callbacks currently scheduled.
+   */
+  uint64_t size() const {
+    return count_;
+  }
 
  protected:
   /**
@@ -200,18 +238,52 @@ class AsyncTimeoutSet : private folly::AsyncTimeout,
   AsyncTimeoutSet(AsyncTimeoutSet const &) = delete;
   AsyncTimeoutSet& operator=(AsyncTimeoutSet const &) = delete;
 
-  // Private methods to be invoked by AsyncTimeoutSet::Callback
-  void headChanged();
+  static const uint32_t kWheelBits = 8;
+  static const uint32_t kWheelSize = 1 << kWheelBits;
+  static const uint32_t kWheelMask = kWheelSize - 1;
+  static const uint32_t kNumWheels = 4;
+
+  struct Slot {
+    Callback* head{nullptr};
+    Callback* tail{nullptr};
+  };
+
+  // Link callback into the slot for its expiration relative to curTick_.
+  // Callbacks cascaded from an outer wheel were scheduled before any
+  // already in the destination slot with the same expiration, so they are
+  // linked at the front to keep firing in scheduling order.
+  void addToWheel(Callback* callback, bool atFront);
+  void removeFromWheel(Callback* callback);
+
+  // Redistribute the outer wheel slots that come due at curTick_
+  void cascade();
+
+  // First occupied slot of the wheel at or after 'from', or -1
+  int findOccupied(uint32_t wheel, uint32_t from) const;
+
+  // Earliest tick at which a slot must be fired or cascaded
+  int64_t nextWakeTick() const;
+
+  void scheduleWakeup(std::chrono::milliseconds now, int64_t wakeTick);
 
   // Methods inherited from TAsyncTimeout
   void timeoutExpired() noexcept override;
 
   TimeoutClock& timeoutClock_;
-  Callback* head_;
-  Callback* tail_;
   std::chrono::milliseconds interval_;
   std::chrono::milliseconds atMostEveryN_;
   bool inTimeoutExpired_{false};
+
+  // Every tick before curTick_ has been fired
+  int64_t curTick_{0};
+  // Tick the underlying AsyncTimeout is armed for, or max() if it is not
+  int64_t wakeTick_{std::numeric_limits<int64_t>::max()};
+  // atMostEveryN_ after the last time we fired
+  int64_t earliestWakeTick_{0};
+  uint64_t count_{0};
+  Slot slots_[kNumWheels * kWheelSize];
+  // One bit per non-empty slot
+  uint64_t occupied_[kNumWheels][kWheelSize / 64]{};
 };
 
 } // proxygen
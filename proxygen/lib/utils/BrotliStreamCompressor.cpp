@@ -0,0 +1,92 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/utils/BrotliStreamCompressor.h>
+
+#include <brotli/encode.h>
+#include <folly/io/Cursor.h>
+#include <glog/logging.h>
+
+using folly::IOBuf;
+using std::unique_ptr;
+
+namespace {
+
+// Leaves room for the IOBuf bookkeeping in a page, as ZlibStreamCompressor
+const size_t kOutputChunkSize = 4000;
+
+}
+
+namespace proxygen {
+
+BrotliStreamCompressor::BrotliStreamCompressor(int quality)
+    : state_(BrotliEncoderCreateInstance(nullptr, nullptr, nullptr)) {
+  if (!state_) {
+    LOG(ERROR) << "error creating brotli encoder";
+    error_ = true;
+    return;
+  }
+  BrotliEncoderSetParameter(state_, BROTLI_PARAM_QUALITY, quality);
+}
+
+BrotliStreamCompressor::~BrotliStreamCompressor() {
+  if (state_) {
+    BrotliEncoderDestroyInstance(state_);
+  }
+}
+
+unique_ptr<IOBuf> BrotliStreamCompressor::compress(const IOBuf* in,
+                                                   bool trailer) {
+  if (error_) {
+    return nullptr;
+  }
+
+  auto out = IOBuf::create(kOutputChunkSize);
+  folly::io::Appender appender(out.get(), kOutputChunkSize);
+
+  // Feed the encoder one buffer of the chain with op, and collect all the
+  // output that is ready
+  auto run = [&] (BrotliEncoderOperation op, const uint8_t* data,
+                  size_t length) {
+    do {
+      appender.ensure(kOutputChunkSize);
+      uint8_t* nextOut = appender.writableData();
+      size_t availOut = kOutputChunkSize;
+      if (!BrotliEncoderCompressStream(state_, op, &length, &data,
+                                       &availOut, &nextOut, nullptr)) {
+        return false;
+      }
+      appender.append(kOutputChunkSize - availOut);
+    } while (length > 0 || BrotliEncoderHasMoreOutput(state_) ||
+             (op == BROTLI_OPERATION_FINISH &&
+              !BrotliEncoderIsFinished(state_)));
+    return true;
+  };
+
+  const IOBuf* crtBuf = in;
+  do {
+    if (crtBuf->length() > 0 &&
+        !run(BROTLI_OPERATION_PROCESS, crtBuf->data(), crtBuf->length())) {
+      LOG(ERROR) << "error compressing buffer with brotli";
+      error_ = true;
+      return nullptr;
+    }
+    crtBuf = crtBuf->next();
+  } while (crtBuf != in);
+
+  if (!run(trailer ? BROTLI_OPERATION_FINISH : BROTLI_OPERATION_FLUSH,
+           nullptr, 0)) {
+    LOG(ERROR) << "error flushing brotli stream";
+    error_ = true;
+    return nullptr;
+  }
+  return out;
+}
+
+}
@@ -0,0 +1,40 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <proxygen/lib/utils/StreamCompressor.h>
+
+struct BrotliEncoderStateStruct;
+
+namespace proxygen {
+
+/**
+ * Brotli ("br") compression. Only built when proxygen is configured with
+ * libbrotlienc.
+ */
+class BrotliStreamCompressor : public StreamCompressor {
+ public:
+  // quality goes from 0 (fastest) to 11 (smallest output)
+  explicit BrotliStreamCompressor(int quality);
+
+  ~BrotliStreamCompressor() override;
+
+  // Each call but the last flushes the output, as ZlibStreamCompressor does
+  std::unique_ptr<folly::IOBuf> compress(const folly::IOBuf* in,
+                                         bool trailer = true) override;
+
+  bool hasError() override { return error_; }
+
+ private:
+  BrotliEncoderStateStruct* state_;
+  bool error_{false};
+};
+
+}
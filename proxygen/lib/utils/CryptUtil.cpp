@@ -9,68 +9,170 @@
  */
 #include <proxygen/lib/utils/CryptUtil.h>
 
-#include <iomanip>
-#include <openssl/bio.h>
-#include <openssl/buffer.h>
+#include <cstring>
 #include <openssl/evp.h>
-#include <openssl/md5.h>
-#include <sstream>
 
 namespace proxygen {
 
-// Base64 encode using openssl
-std::string base64Encode(folly::ByteRange text) {
+namespace {
+
+const char kBase64[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+const char kBase64Url[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+// Marks the bytes that are not in an alphabet
+const uint8_t kInvalid = 0xff;
+
+// Byte to 6 bit value, for decoding
+struct DecodeTable {
+  explicit DecodeTable(const char* alphabet) {
+    memset(values, kInvalid, sizeof(values));
+    for (uint8_t i = 0; i < 64; i++) {
+      values[uint8_t(alphabet[i])] = i;
+    }
+  }
+
+  uint8_t values[256];
+};
+
+const DecodeTable kBase64Decode(kBase64);
+const DecodeTable kBase64UrlDecode(kBase64Url);
+
+// Encodes three bytes at a time, straight into the result
+std::string encode(folly::ByteRange text, const char* alphabet, bool pad) {
   std::string result;
-  BIO *b64 = BIO_new(BIO_f_base64());
-  if (b64 == nullptr) {
-    return result;
+  size_t full = text.size() / 3;
+  size_t rest = text.size() % 3;
+  size_t length = full * 4;
+  if (rest) {
+    length += pad ? 4 : rest + 1;
   }
-  BIO *bmem = BIO_new(BIO_s_mem());
-  if (bmem == nullptr) {
-    BIO_free_all(b64);
-    return result;
+  result.resize(length);
+  char* out = &result[0];
+  const uint8_t* in = text.begin();
+  for (size_t i = 0; i < full; i++, in += 3) {
+    uint32_t bits = (uint32_t(in[0]) << 16) | (uint32_t(in[1]) << 8) | in[2];
+    out[0] = alphabet[bits >> 18];
+    out[1] = alphabet[(bits >> 12) & 0x3f];
+    out[2] = alphabet[(bits >> 6) & 0x3f];
+    out[3] = alphabet[bits & 0x3f];
+    out += 4;
   }
-  BUF_MEM *bptr;
-
-  // chain base64 filter with the memory buffer
-  // so that text will be encoded by base64 and flushed to buffer
-  BIO *chain = BIO_push(b64, bmem);
-  if (chain == nullptr) {
-    BIO_free_all(b64);
-    return result;
+  if (rest) {
+    uint32_t bits = uint32_t(in[0]) << 16;
+    if (rest == 2) {
+      bits |= uint32_t(in[1]) << 8;
+    }
+    *out++ = alphabet[bits >> 18];
+    *out++ = alphabet[(bits >> 12) & 0x3f];
+    if (rest == 2) {
+      *out++ = alphabet[(bits >> 6) & 0x3f];
+    } else if (pad) {
+      *out++ = '=';
+    }
+    if (pad) {
+      *out++ = '=';
+    }
   }
-  BIO_set_flags(chain, BIO_FLAGS_BASE64_NO_NL);
-  BIO_write(chain, text.begin(), text.size());
-  if (BIO_flush(chain) != 1) {
-    BIO_free_all(chain);
-    return result;
+  return result;
+}
+
+bool decode(folly::StringPiece text, const DecodeTable& table,
+            std::string& out) {
+  // Padding only completes the last quantum, it carries nothing
+  if (text.size() % 4 == 0 && text.endsWith('=')) {
+    text.pop_back();
+    if (text.endsWith('=')) {
+      text.pop_back();
+    }
+  }
+  size_t full = text.size() / 4;
+  size_t rest = text.size() % 4;
+  if (rest == 1) {
+    return false;
   }
+  out.resize(full * 3 + (rest ? rest - 1 : 0));
+  char* dst = out.empty() ? nullptr : &out[0];
+  const uint8_t* in = (const uint8_t*)text.begin();
+  const uint8_t* values = table.values;
+  for (size_t i = 0; i < full; i++, in += 4) {
+    uint32_t a = values[in[0]];
+    uint32_t b = values[in[1]];
+    uint32_t c = values[in[2]];
+    uint32_t d = values[in[3]];
+    if ((a | b | c | d) & 0xc0) {
+      return false;
+    }
+    uint32_t bits = (a << 18) | (b << 12) | (c << 6) | d;
+    dst[0] = char(bits >> 16);
+    dst[1] = char(bits >> 8);
+    dst[2] = char(bits);
+    dst += 3;
+  }
+  if (rest) {
+    uint32_t bits = 0;
+    for (size_t i = 0; i < rest; i++) {
+      uint32_t value = values[in[i]];
+      if (value & 0xc0) {
+        return false;
+      }
+      bits |= value << (18 - 6 * i);
+    }
+    *dst++ = char(bits >> 16);
+    if (rest == 3) {
+      *dst++ = char(bits >> 8);
+    }
+  }
+  return true;
+}
 
-  BIO_get_mem_ptr(chain, &bptr);
+const char kHexDigits[] = "0123456789abcdef";
 
-  if (bptr && bptr->length > 0) {
-    result = std::string((char *)bptr->data, bptr->length);
-  }
+}
 
-  // free the whole BIO chain (b64 and mem)
-  BIO_free_all(chain);
-  return result;
+std::string base64Encode(folly::ByteRange text) {
+  return encode(text, kBase64, true);
 }
 
-// MD5 encode using openssl
-std::string md5Encode(folly::ByteRange text) {
-  static_assert(MD5_DIGEST_LENGTH == 16, "");
+std::string base64UrlEncode(folly::ByteRange text) {
+  return encode(text, kBase64Url, false);
+}
+
+bool base64Decode(folly::StringPiece text, std::string& out) {
+  return decode(text, kBase64Decode, out);
+}
 
-  unsigned char digest[MD5_DIGEST_LENGTH];
-  MD5(text.begin(), text.size(), digest);
+bool base64UrlDecode(folly::StringPiece text, std::string& out) {
+  return decode(text, kBase64UrlDecode, out);
+}
+
+size_t digest(DigestType type, folly::ByteRange text, uint8_t* out) {
+  const EVP_MD* md = nullptr;
+  switch (type) {
+    case DigestType::MD5: md = EVP_md5(); break;
+    case DigestType::SHA1: md = EVP_sha1(); break;
+    case DigestType::SHA256: md = EVP_sha256(); break;
+  }
+  unsigned int length = 0;
+  if (EVP_Digest(text.begin(), text.size(), out, &length, md,
+                 nullptr) != 1) {
+    return 0;
+  }
+  return length;
+}
+
+std::string md5Encode(folly::ByteRange text) {
+  uint8_t md[kMaxDigestLength];
+  size_t length = digest(DigestType::MD5, text, md);
 
   // convert digest to hex string
-  std::ostringstream ss;
-  ss << std::hex << std::setfill('0');
-  for(int i = 0; i < MD5_DIGEST_LENGTH; i++) {
-    ss << std::setw(2) << (unsigned int)digest[i];
+  std::string result(length * 2, '\0');
+  for (size_t i = 0; i < length; i++) {
+    result[i * 2] = kHexDigits[md[i] >> 4];
+    result[i * 2 + 1] = kHexDigits[md[i] & 0xf];
   }
-  return ss.str();
+  return result;
 }
 
 }
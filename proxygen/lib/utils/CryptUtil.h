@@ -14,9 +14,32 @@
 
 namespace proxygen {
 
-// Base64 encode using openssl, may return empty string on allocation failure
+// Base64 encode, with padding
 std::string base64Encode(folly::ByteRange text);
 
-// MD5 encode using openssl
+// Base64 encode with the URL and filename safe alphabet, without padding
+std::string base64UrlEncode(folly::ByteRange text);
+
+// Base64 decode into out, padding optional. Returns false, leaving out
+// unspecified, if text is not base64.
+bool base64Decode(folly::StringPiece text, std::string& out);
+
+// Same as base64Decode(), for the URL and filename safe alphabet
+bool base64UrlDecode(folly::StringPiece text, std::string& out);
+
+enum class DigestType {
+  MD5,
+  SHA1,
+  SHA256,
+};
+
+// Enough room for the digest of any DigestType
+const size_t kMaxDigestLength = 32;
+
+// One-shot digest of text written to out, which has room for
+// kMaxDigestLength bytes. Returns the length of the digest, 0 on failure.
+size_t digest(DigestType type, folly::ByteRange text, uint8_t* out);
+
+// MD5 digest using openssl, as lowercase hex
 std::string md5Encode(folly::ByteRange text);
 }
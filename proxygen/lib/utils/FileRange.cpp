@@ -0,0 +1,91 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/utils/FileRange.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <folly/FileUtil.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace proxygen {
+
+namespace {
+
+// IOBufs hold 32 bit lengths, so larger ranges are mapped in pieces
+const size_t kMaxMappedPiece = size_t(1) << 30;
+
+void unmapFileRange(void* buf, void* userData) {
+  munmap(buf, reinterpret_cast<size_t>(userData));
+}
+
+std::unique_ptr<folly::IOBuf> readFileRange(int fd, off_t offset,
+                                            size_t length) {
+  auto buf = folly::IOBuf::create(length);
+  ssize_t n = folly::preadFull(fd, buf->writableData(), length, offset);
+  if (n < 0) {
+    return nullptr;
+  }
+  if (size_t(n) < length) {
+    errno = ENODATA;
+    return nullptr;
+  }
+  buf->append(length);
+  return buf;
+}
+
+}
+
+std::unique_ptr<folly::IOBuf> mapFileRange(int fd, off_t offset,
+                                           size_t length) {
+  if (length == 0) {
+    return folly::IOBuf::create(0);
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    return nullptr;
+  }
+  if (!S_ISREG(st.st_mode)) {
+    return readFileRange(fd, offset, length);
+  }
+  // Pages past the end of the file cannot be read through the mapping
+  if (offset < 0 || uint64_t(st.st_size) < uint64_t(offset) + length) {
+    errno = ENODATA;
+    return nullptr;
+  }
+
+  static const off_t pageSize = sysconf(_SC_PAGESIZE);
+  off_t mapOffset = offset - offset % pageSize;
+  size_t skip = offset - mapOffset;
+  size_t remaining = length + skip;
+  std::unique_ptr<folly::IOBuf> buf;
+  while (remaining > 0) {
+    size_t mapLength = std::min(remaining, kMaxMappedPiece);
+    void* addr = mmap(nullptr, mapLength, PROT_READ, MAP_SHARED, fd,
+                      mapOffset);
+    if (addr == MAP_FAILED) {
+      return readFileRange(fd, offset, length);
+    }
+    auto piece = folly::IOBuf::takeOwnership(
+      addr, mapLength, unmapFileRange, reinterpret_cast<void*>(mapLength));
+    if (buf) {
+      buf->prependChain(std::move(piece));
+    } else {
+      buf = std::move(piece);
+    }
+    mapOffset += mapLength;
+    remaining -= mapLength;
+  }
+  buf->trimStart(skip);
+  return buf;
+}
+
+}
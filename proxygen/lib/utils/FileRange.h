@@ -0,0 +1,31 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/io/IOBuf.h>
+#include <memory>
+#include <sys/types.h>
+
+namespace proxygen {
+
+/**
+ * Get length bytes of the file fd from offset as an IOBuf, without copying
+ * them: the IOBuf maps the file and unmaps it once freed. Files that cannot
+ * be mapped are read with pread() instead.
+ *
+ * The file must not be truncated while the IOBuf lives.
+ *
+ * @return The IOBuf, or nullptr if the file could not be mapped or read
+ *         that far, with errno set.
+ */
+std::unique_ptr<folly::IOBuf> mapFileRange(int fd, off_t offset,
+                                           size_t length);
+
+}
@@ -9,35 +9,239 @@
  */
 #include <proxygen/lib/utils/HTTPTime.h>
 
-#include <ctime>
+#include <cstring>
 #include <glog/logging.h>
 
 namespace proxygen {
 
-folly::Optional<int64_t> parseHTTPDateTime(const std::string& s) {
-  struct tm tm = {0};
+namespace {
 
+const char* const kWeekdays[] = {
+  "Sunday", "Monday", "Tuesday", "Wednesday", "Thursday", "Friday",
+  "Saturday"
+};
+
+const char* const kMonths[] = {
+  "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+  "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+/**
+ * A cursor over the date, with the conversions strptime() did: spaces in
+ * the format match any number of spaces, names are case-insensitive.
+ */
+class DateReader {
+ public:
+  explicit DateReader(folly::StringPiece s): p_(s.begin()), end_(s.end()) {}
+
+  bool done() const {
+    return p_ == end_;
+  }
+
+  bool skip(char c) {
+    if (p_ != end_ && *p_ == c) {
+      ++p_;
+      return true;
+    }
+    return false;
+  }
+
+  void skipSpaces() {
+    while (skip(' ')) {
+    }
+  }
+
+  bool number(size_t minDigits, size_t maxDigits, int& value) {
+    size_t digits = 0;
+    value = 0;
+    while (digits < maxDigits && p_ != end_ && *p_ >= '0' && *p_ <= '9') {
+      value = value * 10 + (*p_++ - '0');
+      ++digits;
+    }
+    return digits >= minDigits;
+  }
+
+  // a weekday, abbreviated to 3 letters or not
+  bool weekday() {
+    for (auto name: kWeekdays) {
+      if (prefix(name, 3)) {
+        // the rest of the long name is optional
+        size_t len = strlen(name);
+        if (size_t(end_ - p_) >= len - 3 &&
+            matches(name + 3, len - 3)) {
+          p_ += len - 3;
+        }
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool month(int& value) {
+    for (int i = 0; i < 12; i++) {
+      if (prefix(kMonths[i], 3)) {
+        value = i + 1;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // HH:MM:SS
+  bool time(int& hour, int& minute, int& second) {
+    return number(1, 2, hour) && hour < 24 && skip(':') &&
+      number(1, 2, minute) && minute < 60 && skip(':') &&
+      number(1, 2, second) && second <= 60;
+  }
+
+ private:
+  bool matches(const char* s, size_t len) const {
+    for (size_t i = 0; i < len; i++) {
+      if ((p_[i] | 0x20) != (s[i] | 0x20)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool prefix(const char* s, size_t len) {
+    if (size_t(end_ - p_) < len || !matches(s, len)) {
+      return false;
+    }
+    p_ += len;
+    return true;
+  }
+
+  const char* p_;
+  const char* end_;
+};
+
+// days since 1970-01-01 of a date of the proleptic Gregorian calendar
+int64_t daysFromCivil(int64_t year, int month, int day) {
+  year -= month <= 2;
+  const int64_t era = (year >= 0 ? year : year - 399) / 400;
+  const int64_t yoe = year - era * 400;
+  const int64_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  const int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+void civilFromDays(int64_t days, int64_t& year, int& month, int& day) {
+  days += 719468;
+  const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+  const int64_t doe = days - era * 146097;
+  const int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  const int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  const int64_t mp = (5 * doy + 2) / 153;
+  day = doy - (153 * mp + 2) / 5 + 1;
+  month = mp < 10 ? mp + 3 : mp - 9;
+  year = yoe + era * 400 + (month <= 2);
+}
+
+inline void writeTwoDigits(char* out, int value) {
+  out[0] = '0' + value / 10;
+  out[1] = '0' + value % 10;
+}
+
+}
+
+folly::Optional<int64_t> parseHTTPDateTime(folly::StringPiece s) {
   if (s.empty()) {
     return folly::Optional<int64_t>();
   }
 
-  // Sun, 06 Nov 1994 08:49:37 GMT  ; RFC 822, updated by RFC 1123
-  if (strptime(s.c_str(), "%a, %d %b %Y %H:%M:%S %Z", &tm) != nullptr) {
-    return folly::Optional<int64_t>(mktime(&tm));
+  DateReader r(s);
+  int year = 0;
+  int month = 0;
+  int day = 0;
+  int hour = 0;
+  int minute = 0;
+  int second = 0;
+  bool valid = false;
+  if (r.weekday()) {
+    if (r.skip(',')) {
+      r.skipSpaces();
+      if (!r.number(1, 2, day)) {
+        // not valid
+      } else if (r.skip('-')) {
+        // Sunday, 06-Nov-94 08:49:37 GMT ; RFC 850, obsoleted by RFC 1036
+        valid = r.month(month) && r.skip('-') && r.number(2, 4, year);
+        if (year < 100) {
+          // as strptime's %y
+          year += year < 69 ? 2000 : 1900;
+        }
+        r.skipSpaces();
+        valid = valid && r.time(hour, minute, second);
+      } else {
+        // Sun, 06 Nov 1994 08:49:37 GMT  ; RFC 822, updated by RFC 1123
+        r.skipSpaces();
+        valid = r.month(month);
+        r.skipSpaces();
+        valid = valid && r.number(4, 4, year);
+        r.skipSpaces();
+        valid = valid && r.time(hour, minute, second);
+      }
+      // the zone is always GMT, whatever follows is ignored
+    } else {
+      // Sun Nov  6 08:49:37 1994       ; ANSI C's asctime() format
+      r.skipSpaces();
+      valid = r.month(month);
+      r.skipSpaces();
+      valid = valid && r.number(1, 2, day);
+      r.skipSpaces();
+      valid = valid && r.time(hour, minute, second);
+      r.skipSpaces();
+      valid = valid && r.number(4, 4, year);
+    }
   }
 
-  // Sunday, 06-Nov-94 08:49:37 GMT ; RFC 850, obsoleted by RFC 1036
-  if (strptime(s.c_str(), "%a, %d-%b-%y %H:%M:%S %Z", &tm) != nullptr) {
-    return folly::Optional<int64_t>(mktime(&tm));
+  if (!valid || day < 1 || day > 31) {
+    LOG(INFO) << "Invalid http time: " << s;
+    return folly::Optional<int64_t>();
   }
+  return folly::Optional<int64_t>(
+    daysFromCivil(year, month, day) * 86400 +
+    hour * 3600 + minute * 60 + second);
+}
 
-  // Sun Nov  6 08:49:37 1994       ; ANSI C's asctime() format
-  if(strptime(s.c_str(), "%a %b %d %H:%M:%S %Y", &tm) != nullptr) {
-    return folly::Optional<int64_t>(mktime(&tm));
+void formatHTTPDateTime(int64_t time, char* out) {
+  int64_t days = time / 86400;
+  int64_t secs = time % 86400;
+  if (secs < 0) {
+    secs += 86400;
+    --days;
+  }
+  int64_t year;
+  int month;
+  int day;
+  civilFromDays(days, year, month, day);
+  // 1970-01-01 was a Thursday
+  int64_t weekday = (days + 4) % 7;
+  if (weekday < 0) {
+    weekday += 7;
   }
 
-  LOG(INFO) << "Invalid http time: " << s;
-  return folly::Optional<int64_t>();
+  memcpy(out, kWeekdays[weekday], 3);
+  memcpy(out + 3, ", ", 2);
+  writeTwoDigits(out + 5, day);
+  out[7] = ' ';
+  memcpy(out + 8, kMonths[month - 1], 3);
+  out[11] = ' ';
+  writeTwoDigits(out + 12, (year / 100) % 100);
+  writeTwoDigits(out + 14, year % 100);
+  out[16] = ' ';
+  writeTwoDigits(out + 17, secs / 3600);
+  out[19] = ':';
+  writeTwoDigits(out + 20, (secs / 60) % 60);
+  out[22] = ':';
+  writeTwoDigits(out + 23, secs % 60);
+  memcpy(out + 25, " GMT", 4);
+}
+
+std::string formatHTTPDateTime(int64_t time) {
+  std::string date(kHTTPDateTimeLength, '\0');
+  formatHTTPDateTime(time, &date[0]);
+  return date;
 }
 
 } // proxygen
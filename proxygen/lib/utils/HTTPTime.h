@@ -10,11 +10,29 @@
 #pragma once
 
 #include <folly/Optional.h>
+#include <folly/Range.h>
 #include <stddef.h>
 #include <string>
 
 namespace proxygen {
 
-folly::Optional<int64_t> parseHTTPDateTime(const std::string& s);
+/**
+ * Parses any of the three date formats of RFC 2616 section 3.3.1 into
+ * seconds since the epoch, as GMT. Month and weekday names are the English
+ * ones whatever the locale, and nothing is allocated.
+ */
+folly::Optional<int64_t> parseHTTPDateTime(folly::StringPiece s);
+
+// length of "Sun, 06 Nov 1994 08:49:37 GMT"
+const size_t kHTTPDateTimeLength = 29;
+
+/**
+ * Writes the RFC 1123 form of the given seconds since the epoch, for years
+ * 0 to 9999, into out, which needs room for kHTTPDateTimeLength chars. No
+ * terminating NUL is written.
+ */
+void formatHTTPDateTime(int64_t time, char* out);
+
+std::string formatHTTPDateTime(int64_t time);
 
 } // proxygen
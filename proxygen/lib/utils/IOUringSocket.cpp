@@ -0,0 +1,646 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/utils/IOUringSocket.h>
+
+#include <algorithm>
+#include <folly/String.h>
+#include <glog/logging.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using folly::AsyncSocketException;
+using folly::IOBuf;
+using folly::IOBufQueue;
+
+namespace proxygen {
+
+namespace {
+
+// the receive buffers are the only group of the ring
+const uint16_t kBufferGroup = 0;
+
+// iovecs in a sendmsg(); a longer chain takes several
+const size_t kMaxIov = 64;
+
+}
+
+std::shared_ptr<IOUringContext> IOUringContext::create(
+    folly::EventBase* evb,
+    const Options& options) {
+  std::shared_ptr<IOUringContext> context(new IOUringContext(evb, options));
+  if (!context->init()) {
+    return nullptr;
+  }
+  return context;
+}
+
+IOUringContext::IOUringContext(folly::EventBase* evb,
+                               const Options& options) :
+    folly::EventHandler(evb),
+    evb_(evb),
+    options_(options) {
+  // the buffer ring takes a power of 2 entries
+  CHECK(options_.recvBuffers > 0 &&
+        (options_.recvBuffers & (options_.recvBuffers - 1)) == 0);
+  CHECK_GT(options_.recvBufferSize, 0);
+}
+
+bool IOUringContext::init() {
+  int ret = io_uring_queue_init(options_.entries, &ring_, 0);
+  if (ret < 0) {
+    LOG(WARNING) << "io_uring is not available: " << folly::errnoStr(-ret);
+    return false;
+  }
+  ringInitialized_ = true;
+
+  bufRing_ = io_uring_setup_buf_ring(&ring_, options_.recvBuffers,
+                                     kBufferGroup, 0, &ret);
+  if (!bufRing_) {
+    LOG(WARNING) << "io_uring buffer rings are not available: "
+                 << folly::errnoStr(-ret);
+    return false;
+  }
+  buffers_.reset(
+    new char[size_t(options_.recvBuffers) * options_.recvBufferSize]);
+  for (unsigned i = 0; i < options_.recvBuffers; ++i) {
+    io_uring_buf_ring_add(bufRing_,
+                          buffers_.get() + size_t(i) * options_.recvBufferSize,
+                          options_.recvBufferSize, i,
+                          io_uring_buf_ring_mask(options_.recvBuffers), i);
+  }
+  io_uring_buf_ring_advance(bufRing_, options_.recvBuffers);
+
+  eventFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (eventFd_ < 0) {
+    PLOG(WARNING) << "eventfd() failed";
+    return false;
+  }
+  ret = io_uring_register_eventfd(&ring_, eventFd_);
+  if (ret < 0) {
+    LOG(WARNING) << "io_uring_register_eventfd() failed: "
+                 << folly::errnoStr(-ret);
+    return false;
+  }
+  changeHandlerFD(eventFd_);
+  registerHandler(folly::EventHandler::READ | folly::EventHandler::PERSIST);
+  return true;
+}
+
+IOUringContext::~IOUringContext() {
+  DCHECK(sockets_.empty());
+  if (eventFd_ >= 0) {
+    unregisterHandler();
+  }
+  if (ringInitialized_) {
+    // The kernel may still be reading the data of sends whose sockets
+    // are gone: cancel what's left and wait for it before freeing that
+    if (outstanding_ > 0) {
+      io_uring_submit(&ring_);
+      io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+      if (sqe) {
+        io_uring_prep_cancel64(sqe, 0, IORING_ASYNC_CANCEL_ANY);
+        io_uring_sqe_set_data64(sqe, userData(0, CANCEL));
+        ++outstanding_;
+        io_uring_submit(&ring_);
+      }
+      __kernel_timespec timeout{1, 0};
+      io_uring_cqe* cqe = nullptr;
+      while (outstanding_ > 0 &&
+             io_uring_wait_cqe_timeout(&ring_, &cqe, &timeout) == 0) {
+        const uint64_t data = cqe->user_data;
+        const int res = cqe->res;
+        const uint32_t flags = cqe->flags;
+        io_uring_cqe_seen(&ring_, cqe);
+        handleCompletion(data, res, flags);
+      }
+      LOG_IF(WARNING, outstanding_ > 0) << "Destroying an io_uring with "
+        << outstanding_ << " requests still in flight";
+    }
+    if (bufRing_) {
+      io_uring_free_buf_ring(&ring_, bufRing_, options_.recvBuffers,
+                             kBufferGroup);
+    }
+    io_uring_queue_exit(&ring_);
+  }
+  if (eventFd_ >= 0) {
+    ::close(eventFd_);
+  }
+}
+
+uint64_t IOUringContext::registerSocket(IOUringSocket* socket) {
+  const uint64_t id = nextSocketId_++;
+  sockets_[id] = socket;
+  return id;
+}
+
+void IOUringContext::unregisterSocket(uint64_t id) {
+  sockets_.erase(id);
+}
+
+io_uring_sqe* IOUringContext::getSqe() {
+  io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+  if (!sqe) {
+    io_uring_submit(&ring_);
+    sqe = io_uring_get_sqe(&ring_);
+    CHECK(sqe);
+  }
+  ++outstanding_;
+  if (!submitting_ && !isLoopCallbackScheduled()) {
+    evb_->runInLoop(this);
+  }
+  return sqe;
+}
+
+void IOUringContext::prepareRecv(uint64_t id, int fd) {
+  io_uring_sqe* sqe = getSqe();
+  io_uring_prep_recv_multishot(sqe, fd, nullptr, 0, 0);
+  sqe->flags |= IOSQE_BUFFER_SELECT;
+  sqe->buf_group = kBufferGroup;
+  io_uring_sqe_set_data64(sqe, userData(id, RECV));
+}
+
+void IOUringContext::prepareCancelRecv(uint64_t id) {
+  io_uring_sqe* sqe = getSqe();
+  io_uring_prep_cancel64(sqe, userData(id, RECV), 0);
+  io_uring_sqe_set_data64(sqe, userData(id, CANCEL));
+}
+
+void IOUringContext::prepareSend(uint64_t id, int fd, IOBufQueue& data) {
+  auto& send = sends_[id];
+  if (!send) {
+    send.reset(new Send);
+  }
+  send->data.append(data.move());
+  DCHECK(!send->data.empty());
+
+  send->iov.clear();
+  const IOBuf* head = send->data.front();
+  const IOBuf* buf = head;
+  do {
+    if (buf->length() > 0) {
+      send->iov.push_back({const_cast<uint8_t*>(buf->data()), buf->length()});
+    }
+    buf = buf->next();
+  } while (buf != head && send->iov.size() < kMaxIov);
+  memset(&send->msg, 0, sizeof(send->msg));
+  send->msg.msg_iov = send->iov.data();
+  send->msg.msg_iovlen = send->iov.size();
+
+  io_uring_sqe* sqe = getSqe();
+  io_uring_prep_sendmsg(sqe, fd, &send->msg, MSG_NOSIGNAL);
+  io_uring_sqe_set_data64(sqe, userData(id, SEND));
+}
+
+void IOUringContext::scheduleSend(uint64_t id) {
+  pendingSends_.push_back(id);
+  if (!isLoopCallbackScheduled()) {
+    evb_->runInLoop(this);
+  }
+}
+
+void IOUringContext::cancelNow(uint64_t id, int fd) {
+  io_uring_sqe* sqe = getSqe();
+  io_uring_prep_cancel_fd(sqe, fd, IORING_ASYNC_CANCEL_ALL);
+  io_uring_sqe_set_data64(sqe, userData(id, CANCEL));
+  int ret = io_uring_submit(&ring_);
+  LOG_IF(ERROR, ret < 0) << "io_uring_submit() failed: "
+                         << folly::errnoStr(-ret);
+}
+
+void IOUringContext::runLoopCallback() noexcept {
+  submitting_ = true;
+  std::vector<uint64_t> pending;
+  pending.swap(pendingSends_);
+  for (auto id: pending) {
+    auto it = sockets_.find(id);
+    if (it != sockets_.end()) {
+      it->second->startSend();
+    }
+  }
+  submitting_ = false;
+  int ret = io_uring_submit(&ring_);
+  LOG_IF(ERROR, ret < 0) << "io_uring_submit() failed: "
+                         << folly::errnoStr(-ret);
+}
+
+void IOUringContext::handlerReady(uint16_t events) noexcept {
+  uint64_t count;
+  // the eventfd is nonblocking, and only says there are completions
+  if (::read(eventFd_, &count, sizeof(count)) < 0) {
+    DCHECK_EQ(errno, EAGAIN);
+  }
+  // the last socket may go away with this
+  auto self = shared_from_this();
+  processCompletions();
+}
+
+void IOUringContext::processCompletions() {
+  io_uring_cqe* cqe = nullptr;
+  while (io_uring_peek_cqe(&ring_, &cqe) == 0) {
+    const uint64_t data = cqe->user_data;
+    const int res = cqe->res;
+    const uint32_t flags = cqe->flags;
+    io_uring_cqe_seen(&ring_, cqe);
+    handleCompletion(data, res, flags);
+  }
+}
+
+void IOUringContext::handleCompletion(uint64_t data, int res,
+                                      uint32_t flags) {
+  const uint64_t id = data >> kOpBits;
+  switch (Op(data & ((1 << kOpBits) - 1))) {
+    case RECV: {
+      const bool more = flags & IORING_CQE_F_MORE;
+      if (!more) {
+        --outstanding_;
+      }
+      int bid = -1;
+      const char* buf = nullptr;
+      if (flags & IORING_CQE_F_BUFFER) {
+        bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        buf = buffers_.get() + size_t(bid) * options_.recvBufferSize;
+      }
+      auto it = sockets_.find(id);
+      if (it != sockets_.end()) {
+        it->second->onRecv(res, buf, more);
+      }
+      if (bid >= 0) {
+        recycleBuffer(bid);
+      }
+      break;
+    }
+    case SEND: {
+      --outstanding_;
+      auto send = sends_.find(id);
+      DCHECK(send != sends_.end());
+      IOBufQueue& sendData = send->second->data;
+      if (res > 0) {
+        sendData.trimStart(std::min(size_t(res), sendData.chainLength()));
+      }
+      auto it = sockets_.find(id);
+      // the rest of a partial send goes with a socket that is gone
+      if (res < 0 || sendData.empty() || it == sockets_.end()) {
+        sends_.erase(send);
+      }
+      if (it != sockets_.end()) {
+        it->second->onSendComplete(res);
+      }
+      break;
+    }
+    case CANCEL:
+      --outstanding_;
+      break;
+  }
+}
+
+void IOUringContext::recycleBuffer(uint16_t bid) {
+  io_uring_buf_ring_add(bufRing_,
+                        buffers_.get() + size_t(bid) * options_.recvBufferSize,
+                        options_.recvBufferSize, bid,
+                        io_uring_buf_ring_mask(options_.recvBuffers), 0);
+  io_uring_buf_ring_advance(bufRing_, 1);
+}
+
+IOUringSocket::IOUringSocket(folly::EventBase* evb, int fd,
+                             std::shared_ptr<IOUringContext> context) :
+    AsyncSocket(evb, fd),
+    context_(std::move(context)),
+    id_(context_->registerSocket(this)),
+    writeTimeout_(this, evb) {
+  CHECK_EQ(evb, context_->getEventBase());
+}
+
+IOUringSocket::~IOUringSocket() {
+  // destroy() closed it
+  context_->unregisterSocket(id_);
+}
+
+void IOUringSocket::setReadCB(ReadCallback* callback) {
+  readCallback_ = callback;
+  if (!callback) {
+    // stop the receive, rather than buffer all that comes in meanwhile
+    if (recvArmed_ && !recvCancelling_) {
+      context_->prepareCancelRecv(id_);
+      recvCancelling_ = true;
+    }
+    return;
+  }
+  if (!pendingRead_.empty() || readEOF_) {
+    scheduleDeliverPending();
+  }
+  if (!readEOF_ && !closed_) {
+    armRecv();
+  }
+}
+
+AsyncSocket::ReadCallback* IOUringSocket::getReadCallback() const {
+  return readCallback_;
+}
+
+void IOUringSocket::armRecv() {
+  // a receive being cancelled is armed again once it is
+  if (!recvArmed_) {
+    context_->prepareRecv(id_, getFd());
+    recvArmed_ = true;
+  }
+}
+
+void IOUringSocket::scheduleDeliverPending() {
+  if (!deliverPendingCallback_.isLoopCallbackScheduled()) {
+    getEventBase()->runInLoop(&deliverPendingCallback_);
+  }
+}
+
+size_t IOUringSocket::deliver(const char* data, size_t len) {
+  size_t delivered = 0;
+  while (delivered < len && readCallback_ && !closed_) {
+    void* buf = nullptr;
+    size_t bufLen = 0;
+    readCallback_->getReadBuffer(&buf, &bufLen);
+    if (!buf || bufLen == 0) {
+      fail(AsyncSocketException(AsyncSocketException::BAD_ARGS,
+                                "ReadCallback::getReadBuffer() returned "
+                                "empty buffer"));
+      break;
+    }
+    const size_t n = std::min(bufLen, len - delivered);
+    memcpy(buf, data + delivered, n);
+    delivered += n;
+    readCallback_->readDataAvailable(n);
+  }
+  return delivered;
+}
+
+void IOUringSocket::deliverPending() {
+  DestructorGuard dg(this);
+  while (readCallback_ && !closed_ && !pendingRead_.empty()) {
+    const IOBuf* front = pendingRead_.front();
+    if (front->length() == 0) {
+      pendingRead_.pop_front();
+      continue;
+    }
+    pendingRead_.trimStart(
+      deliver(reinterpret_cast<const char*>(front->data()), front->length()));
+  }
+  if (readEOF_ && pendingRead_.empty() && readCallback_) {
+    auto callback = readCallback_;
+    readCallback_ = nullptr;
+    callback->readEOF();
+  }
+}
+
+void IOUringSocket::onRecv(int res, const char* data, bool more) {
+  DestructorGuard dg(this);
+  if (!more) {
+    recvArmed_ = false;
+    recvCancelling_ = false;
+  }
+  if (res > 0) {
+    // after what's still waiting for a read callback, if anything is
+    const size_t len = res;
+    const size_t delivered = pendingRead_.empty() ? deliver(data, len) : 0;
+    if (delivered < len && !closed_) {
+      pendingRead_.append(data + delivered, len - delivered);
+    }
+  } else if (res == 0) {
+    readEOF_ = true;
+    if (pendingRead_.empty() && readCallback_) {
+      auto callback = readCallback_;
+      readCallback_ = nullptr;
+      callback->readEOF();
+    }
+    return;
+  } else if (res != -ECANCELED && res != -ENOBUFS) {
+    fail(AsyncSocketException(AsyncSocketException::INTERNAL_ERROR,
+                              "recv failed", -res));
+    return;
+  }
+  // being paused or out of buffers just ends the multishot receive
+  if (closed_) {
+    return;
+  }
+  if (readCallback_) {
+    if (!pendingRead_.empty()) {
+      scheduleDeliverPending();
+    }
+    if (!recvArmed_ && !readEOF_) {
+      armRecv();
+    }
+  }
+}
+
+void IOUringSocket::write(WriteCallback* callback, const void* buf,
+                          size_t bytes, folly::WriteFlags flags) {
+  writeChain(callback, IOBuf::copyBuffer(buf, bytes), flags);
+}
+
+void IOUringSocket::writev(WriteCallback* callback, const iovec* vec,
+                           size_t count, folly::WriteFlags flags) {
+  IOBufQueue queue(IOBufQueue::cacheChainLength());
+  for (size_t i = 0; i < count; ++i) {
+    queue.append(vec[i].iov_base, vec[i].iov_len);
+  }
+  writeChain(callback, queue.move(), flags);
+}
+
+void IOUringSocket::writeChain(WriteCallback* callback,
+                               std::unique_ptr<IOBuf>&& buf,
+                               folly::WriteFlags flags) {
+  if (closed_ || error_ || writeShutdown_ || shutdownWriteAfterWrites_ ||
+      closeAfterWrites_) {
+    if (callback) {
+      callback->writeErr(0, AsyncSocketException(
+                           AsyncSocketException::NOT_OPEN,
+                           "write() on a closed or shut down socket"));
+    }
+    return;
+  }
+  const size_t len = buf ? buf->computeChainDataLength() : 0;
+  if (len == 0 && pendingWrites_.empty()) {
+    if (callback) {
+      callback->writeSuccess();
+    }
+    return;
+  }
+  pendingWrites_.push_back({callback, len, len});
+  writeQueue_.append(std::move(buf));
+  // all the writes of this loop, in one send at its end
+  if (!sendInFlight_ && !sendScheduled_) {
+    sendScheduled_ = true;
+    context_->scheduleSend(id_);
+  }
+}
+
+void IOUringSocket::startSend() {
+  sendScheduled_ = false;
+  if (sendInFlight_ || closed_ || (writeQueue_.empty() && sending_ == 0)) {
+    return;
+  }
+  sending_ += writeQueue_.chainLength();
+  context_->prepareSend(id_, getFd(), writeQueue_);
+  sendInFlight_ = true;
+  // like AsyncSocket's, restarted by every bit of progress
+  if (getSendTimeout() > 0) {
+    writeTimeout_.scheduleTimeout(getSendTimeout());
+  }
+}
+
+void IOUringSocket::onSendComplete(int res) {
+  DestructorGuard dg(this);
+  sendInFlight_ = false;
+  if (res < 0) {
+    fail(AsyncSocketException(AsyncSocketException::INTERNAL_ERROR,
+                              "sendmsg failed", -res));
+    return;
+  }
+  size_t sent = res;
+  bytesWritten_ += sent;
+  sending_ -= sent;
+  while (!pendingWrites_.empty() && !closed_) {
+    auto& front = pendingWrites_.front();
+    const size_t n = std::min(sent, front.remaining);
+    front.remaining -= n;
+    sent -= n;
+    if (front.remaining > 0) {
+      break;
+    }
+    auto callback = front.callback;
+    pendingWrites_.pop_front();
+    if (callback) {
+      callback->writeSuccess();
+    }
+  }
+  if (closed_ || error_) {
+    return;
+  }
+  if (sending_ > 0 || !writeQueue_.empty()) {
+    startSend();
+    return;
+  }
+  writeTimeout_.cancelTimeout();
+  if (closeAfterWrites_) {
+    closeNow();
+  } else if (shutdownWriteAfterWrites_) {
+    shutdownWriteNow();
+  }
+}
+
+void IOUringSocket::onWriteTimeout() {
+  fail(AsyncSocketException(AsyncSocketException::TIMED_OUT,
+                            "write timed out"));
+}
+
+void IOUringSocket::failWrites(const AsyncSocketException& ex) {
+  // what was handed to the kernel stays with the context until it's done
+  writeQueue_.move();
+  sending_ = 0;
+  writeTimeout_.cancelTimeout();
+  std::deque<PendingWrite> writes;
+  writes.swap(pendingWrites_);
+  for (auto& write: writes) {
+    if (write.callback) {
+      write.callback->writeErr(write.length - write.remaining, ex);
+    }
+  }
+}
+
+void IOUringSocket::fail(const AsyncSocketException& ex) {
+  if (closed_) {
+    return;
+  }
+  DestructorGuard dg(this);
+  error_ = true;
+  failWrites(ex);
+  if (readCallback_) {
+    auto callback = readCallback_;
+    readCallback_ = nullptr;
+    callback->readErr(ex);
+  }
+  closeNow();
+}
+
+void IOUringSocket::close() {
+  if (closed_) {
+    return;
+  }
+  if (pendingWrites_.empty()) {
+    closeNow();
+    return;
+  }
+  // like AsyncSocket, stops reading now, and closes once the writes are out
+  DestructorGuard dg(this);
+  closeAfterWrites_ = true;
+  readEOF_ = true;
+  if (readCallback_) {
+    auto callback = readCallback_;
+    setReadCB(nullptr);
+    callback->readEOF();
+  }
+}
+
+void IOUringSocket::closeNow() {
+  if (closed_) {
+    return;
+  }
+  DestructorGuard dg(this);
+  closed_ = true;
+  context_->unregisterSocket(id_);
+  if (recvArmed_ || sendInFlight_) {
+    context_->cancelNow(id_, getFd());
+  }
+  deliverPendingCallback_.cancelLoopCallback();
+  pendingRead_.move();
+  failWrites(AsyncSocketException(AsyncSocketException::END_OF_FILE,
+                                  "socket closed locally"));
+  if (readCallback_) {
+    auto callback = readCallback_;
+    readCallback_ = nullptr;
+    callback->readEOF();
+  }
+  AsyncSocket::closeNow();
+}
+
+void IOUringSocket::shutdownWrite() {
+  if (pendingWrites_.empty()) {
+    shutdownWriteNow();
+  } else {
+    shutdownWriteAfterWrites_ = true;
+  }
+}
+
+void IOUringSocket::shutdownWriteNow() {
+  if (closed_ || writeShutdown_) {
+    return;
+  }
+  DestructorGuard dg(this);
+  writeShutdown_ = true;
+  failWrites(AsyncSocketException(AsyncSocketException::END_OF_FILE,
+                                  "socket shut down for writes"));
+  if (readEOF_) {
+    closeNow();
+  } else {
+    ::shutdown(getFd(), SHUT_WR);
+  }
+}
+
+bool IOUringSocket::readable() const {
+  return !pendingRead_.empty() || AsyncSocket::readable();
+}
+
+bool IOUringSocket::good() const {
+  return !closed_ && !error_ && !writeShutdown_ && !readEOF_;
+}
+
+bool IOUringSocket::error() const {
+  return error_;
+}
+
+}
@@ -0,0 +1,263 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <deque>
+#include <folly/io/IOBufQueue.h>
+#include <folly/io/async/AsyncSocket.h>
+#include <folly/io/async/AsyncTimeout.h>
+#include <folly/io/async/EventBase.h>
+#include <folly/io/async/EventHandler.h>
+#include <liburing.h>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace proxygen {
+
+class IOUringSocket;
+
+/**
+ * The io_uring of one EventBase, shared by the IOUringSockets of its
+ * thread.
+ *
+ * Receives are multishot: one request per socket keeps returning data
+ * into a ring of buffers registered with the kernel, until the socket
+ * stops reading. Sends, and any other request queued during a loop, are
+ * submitted together once at the end of the loop, so the syscalls of all
+ * the sockets of a thread come down to one io_uring_enter() per loop. The
+ * EventBase only polls an eventfd the kernel signals on completions.
+ *
+ * Needs Linux 6.0 or later. Not thread safe: use it from the thread of
+ * its EventBase only.
+ */
+class IOUringContext :
+    public std::enable_shared_from_this<IOUringContext>,
+    private folly::EventBase::LoopCallback,
+    private folly::EventHandler {
+ public:
+  struct Options {
+    // submission queue entries; the queue is submitted early when full
+    unsigned entries{1024};
+    // receive buffers, shared by all the sockets, and their size
+    unsigned recvBuffers{256};
+    unsigned recvBufferSize{16384};
+  };
+
+  /**
+   * Returns nullptr (and logs why) if the kernel or its settings don't
+   * allow the ring, so callers can fall back to plain sockets.
+   */
+  static std::shared_ptr<IOUringContext> create(folly::EventBase* evb,
+                                                const Options& options);
+  static std::shared_ptr<IOUringContext> create(folly::EventBase* evb) {
+    return create(evb, Options());
+  }
+
+  ~IOUringContext() override;
+
+  folly::EventBase* getEventBase() const {
+    return evb_;
+  }
+
+ private:
+  friend class IOUringSocket;
+
+  // what each request is, in the low bits of its user_data
+  enum Op : uint64_t {
+    RECV = 0,
+    SEND = 1,
+    CANCEL = 2,
+  };
+  static const uint64_t kOpBits = 2;
+
+  // The data of a send stays alive until the kernel is done with it,
+  // even if its socket is closed in the meantime
+  struct Send {
+    folly::IOBufQueue data{folly::IOBufQueue::cacheChainLength()};
+    std::vector<iovec> iov;
+    msghdr msg;
+  };
+
+  IOUringContext(folly::EventBase* evb, const Options& options);
+  bool init();
+
+  uint64_t registerSocket(IOUringSocket* socket);
+  void unregisterSocket(uint64_t id);
+
+  // A submission queue entry, submitted at the end of the loop. Never
+  // null: a full queue is submitted first.
+  io_uring_sqe* getSqe();
+
+  static uint64_t userData(uint64_t id, Op op) {
+    return (id << kOpBits) | op;
+  }
+
+  void prepareRecv(uint64_t id, int fd);
+  void prepareCancelRecv(uint64_t id);
+  // Appends data, queued by the socket, to what it has yet to send, and
+  // sends as much of it as one sendmsg() takes
+  void prepareSend(uint64_t id, int fd, folly::IOBufQueue& data);
+  // Has the socket start its next send at the end of the loop
+  void scheduleSend(uint64_t id);
+  // Cancels the requests of a socket about to close fd. Submitted at
+  // once, before fd can be reused.
+  void cancelNow(uint64_t id, int fd);
+
+  void processCompletions();
+  void handleCompletion(uint64_t userData, int res, uint32_t flags);
+  void recycleBuffer(uint16_t bid);
+
+  // LoopCallback
+  void runLoopCallback() noexcept override;
+
+  // EventHandler, for the eventfd
+  void handlerReady(uint16_t events) noexcept override;
+
+  folly::EventBase* evb_;
+  Options options_;
+  io_uring ring_;
+  bool ringInitialized_{false};
+  io_uring_buf_ring* bufRing_{nullptr};
+  std::unique_ptr<char[]> buffers_;
+  int eventFd_{-1};
+  uint64_t nextSocketId_{1};
+  std::unordered_map<uint64_t, IOUringSocket*> sockets_;
+  // the sends in flight, by socket; at most one per socket
+  std::unordered_map<uint64_t, std::unique_ptr<Send>> sends_;
+  // the sockets waiting for loop end to start their next send
+  std::vector<uint64_t> pendingSends_;
+  bool submitting_{false};
+  // requests whose last completion is yet to come
+  size_t outstanding_{0};
+};
+
+/**
+ * An AsyncSocket driven through the IOUringContext of its EventBase
+ * rather than through epoll and read()/writev() of its own.
+ *
+ * Data received while no read callback is set is kept until one is.
+ * Writes queued in the same loop go out as one sendmsg(). The socket
+ * can't be detached from its EventBase, and doesn't connect: it is made
+ * from an accepted fd.
+ */
+class IOUringSocket : public folly::AsyncSocket {
+ public:
+  IOUringSocket(folly::EventBase* evb, int fd,
+                std::shared_ptr<IOUringContext> context);
+
+  // AsyncTransportWrapper
+  void setReadCB(ReadCallback* callback) override;
+  ReadCallback* getReadCallback() const override;
+  void write(WriteCallback* callback, const void* buf, size_t bytes,
+             folly::WriteFlags flags = folly::WriteFlags::NONE) override;
+  void writev(WriteCallback* callback, const iovec* vec, size_t count,
+              folly::WriteFlags flags = folly::WriteFlags::NONE) override;
+  void writeChain(WriteCallback* callback,
+                  std::unique_ptr<folly::IOBuf>&& buf,
+                  folly::WriteFlags flags = folly::WriteFlags::NONE) override;
+  void close() override;
+  void closeNow() override;
+  void shutdownWrite() override;
+  void shutdownWriteNow() override;
+  bool readable() const override;
+  bool good() const override;
+  bool error() const override;
+  bool isDetachable() const override {
+    return false;
+  }
+  size_t getAppBytesWritten() const override {
+    return bytesWritten_;
+  }
+  size_t getRawBytesWritten() const override {
+    return bytesWritten_;
+  }
+
+ protected:
+  ~IOUringSocket() override;
+
+ private:
+  friend class IOUringContext;
+
+  struct PendingWrite {
+    WriteCallback* callback;
+    size_t length;
+    // of those, the bytes not sent yet
+    size_t remaining;
+  };
+
+  class DeliverPendingCallback : public folly::EventBase::LoopCallback {
+   public:
+    explicit DeliverPendingCallback(IOUringSocket* socket)
+    : socket_(socket) {}
+
+    void runLoopCallback() noexcept override {
+      socket_->deliverPending();
+    }
+
+   private:
+    IOUringSocket* socket_;
+  };
+
+  class WriteTimeout : public folly::AsyncTimeout {
+   public:
+    WriteTimeout(IOUringSocket* socket, folly::EventBase* evb)
+    : folly::AsyncTimeout(evb), socket_(socket) {}
+
+    void timeoutExpired() noexcept override {
+      socket_->onWriteTimeout();
+    }
+
+   private:
+    IOUringSocket* socket_;
+  };
+
+  // From the context
+  void onRecv(int res, const char* data, bool more);
+  void onSendComplete(int res);
+  void startSend();
+
+  // Hands data to the read callback for as long as there is one
+  // @return The number of bytes it took
+  size_t deliver(const char* data, size_t len);
+  void deliverPending();
+  void scheduleDeliverPending();
+  void armRecv();
+  void failWrites(const folly::AsyncSocketException& ex);
+  void fail(const folly::AsyncSocketException& ex);
+  void onWriteTimeout();
+
+  std::shared_ptr<IOUringContext> context_;
+  uint64_t id_;
+  ReadCallback* readCallback_{nullptr};
+  // received while no read callback was set
+  folly::IOBufQueue pendingRead_{folly::IOBufQueue::cacheChainLength()};
+  DeliverPendingCallback deliverPendingCallback_{this};
+  // written and not yet handed to the kernel
+  folly::IOBufQueue writeQueue_{folly::IOBufQueue::cacheChainLength()};
+  std::deque<PendingWrite> pendingWrites_;
+  WriteTimeout writeTimeout_;
+  size_t bytesWritten_{0};
+  // handed to the context and not sent yet
+  size_t sending_{0};
+  bool recvArmed_{false};
+  bool recvCancelling_{false};
+  bool sendScheduled_{false};
+  bool sendInFlight_{false};
+  bool readEOF_{false};
+  bool closed_{false};
+  bool error_{false};
+  bool writeShutdown_{false};
+  // close() or shutdownWrite() waiting for the writes to be sent
+  bool closeAfterWrites_{false};
+  bool shutdownWriteAfterWrites_{false};
+};
+
+}
@@ -0,0 +1,137 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/utils/LatencyBalancer.h>
+
+#include <algorithm>
+#include <glog/logging.h>
+#include <limits>
+#include <math.h>
+
+using std::chrono::microseconds;
+
+namespace proxygen {
+
+size_t LatencyBalancer::insert(const std::string& key, uint64_t weight) {
+  hash_.insert(key, weight);
+  entries_.emplace_back();
+  return entries_.size() - 1;
+}
+
+size_t LatencyBalancer::select(uint64_t key, TimePoint now) {
+  CHECK(!entries_.empty());
+  const size_t kNone = std::numeric_limits<size_t>::max();
+  size_t first = kNone;
+  size_t second = kNone;
+  for (uint32_t i = 0; i < kMaxProbes && second == kNone; i++) {
+    size_t index = hash_.get(key + i).second;
+    if (index == first || isEjected(index, now)) {
+      continue;
+    }
+    if (first == kNone) {
+      first = index;
+    } else {
+      second = index;
+    }
+  }
+
+  if (first == kNone) {
+    // The draws only hit ejected entries: the cheapest of those that are
+    // in then, or of all of them if none is
+    bool anyIn = getNumEjected(now) < entries_.size();
+    for (size_t i = 0; i < entries_.size(); i++) {
+      if ((anyIn && isEjected(i, now)) ||
+          (first != kNone && getCost(i, now) >= getCost(first, now))) {
+        continue;
+      }
+      first = i;
+    }
+  }
+
+  size_t pick = first;
+  if (second != kNone && getCost(second, now) < getCost(first, now)) {
+    pick = second;
+  }
+  entries_[pick].outstanding++;
+  return pick;
+}
+
+void LatencyBalancer::onComplete(size_t index,
+                                 microseconds latency,
+                                 bool success,
+                                 TimePoint now) {
+  auto& entry = entries_[index];
+  if (entry.outstanding > 0) {
+    entry.outstanding--;
+  }
+
+  double sample = latency.count();
+  double decay = getDecay(entry, now);
+  if (!entry.hasLatency || sample > entry.latency * decay) {
+    entry.latency = sample;
+  } else {
+    entry.latency = entry.latency * decay + sample * (1 - decay);
+  }
+  entry.hasLatency = true;
+  entry.updated = now;
+
+  if (success) {
+    entry.failures = 0;
+    if (!isEjected(index, now)) {
+      entry.ejections = 0;
+    }
+    return;
+  }
+  if (++entry.failures < options_.ejectAfterFailures ||
+      isEjected(index, now) ||
+      getNumEjected(now) + 1 >
+        options_.maxEjectedFraction * entries_.size()) {
+    return;
+  }
+  auto duration = options_.ejectionTime * (1 << std::min(entry.ejections,
+                                                         16u));
+  entry.ejectedUntil = now + std::min(duration, options_.maxEjectionTime);
+  entry.ejections++;
+  entry.failures = 0;
+  VLOG(2) << "Ejected upstream " << index << " after "
+          << options_.ejectAfterFailures << " failures";
+}
+
+double LatencyBalancer::getLatency(size_t index, TimePoint now) const {
+  auto& entry = entries_[index];
+  if (!entry.hasLatency) {
+    return options_.initialLatency.count();
+  }
+  return entry.latency * getDecay(entry, now);
+}
+
+double LatencyBalancer::getDecay(const Entry& entry, TimePoint now) const {
+  auto elapsed = std::chrono::duration_cast<microseconds>(
+    now - entry.updated).count();
+  auto decayTime = std::chrono::duration_cast<microseconds>(
+    options_.decayTime).count();
+  if (elapsed <= 0 || decayTime <= 0) {
+    return 1;
+  }
+  return exp(-double(elapsed) / decayTime);
+}
+
+double LatencyBalancer::getCost(size_t index, TimePoint now) const {
+  return getLatency(index, now) * (entries_[index].outstanding + 1);
+}
+
+size_t LatencyBalancer::getNumEjected(TimePoint now) const {
+  size_t ejected = 0;
+  for (size_t i = 0; i < entries_.size(); i++) {
+    ejected += isEjected(i, now);
+  }
+  return ejected;
+}
+
+}
@@ -0,0 +1,118 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <chrono>
+#include <proxygen/lib/utils/RendezvousHash.h>
+#include <proxygen/lib/utils/Time.h>
+#include <string>
+#include <vector>
+
+namespace proxygen {
+
+/**
+ * Picks the upstream to send each request to, among weighted entries,
+ * by the power of two choices: two candidates are drawn by rendezvous
+ * hashing of the request's key, so a key keeps going to the same two
+ * entries, and the one with the lower cost wins. The cost is the peak
+ * EWMA of the latency of an entry times its outstanding requests plus
+ * one, so that a slow or overloaded entry loses its share to its peers
+ * rather than taking all of it (the first candidate is kept on a tie).
+ * The EWMA follows any latency above it right away, and otherwise decays
+ * with decayTime, also while the entry gets no requests, so that it is
+ * tried again.
+ *
+ * Outlier ejection: an entry failing ejectAfterFailures requests in a row
+ * is left out of the draws for ejectionTime, doubling each time it is
+ * ejected again before a success, up to maxEjectionTime. No more than
+ * maxEjectedFraction of the entries are out at once.
+ *
+ * Each pick from select() must be reported once it completes, with
+ * onComplete(), eg. from onEOM() (a success, unless 5xx) or onError() of
+ * the handler of its upstream HTTPTransaction. Not thread safe: use one
+ * per thread, or lock.
+ */
+class LatencyBalancer {
+ public:
+  struct Options {
+    std::chrono::milliseconds decayTime{10000};
+    // The latency taken for entries without any yet
+    std::chrono::microseconds initialLatency{1000};
+    uint32_t ejectAfterFailures{5};
+    std::chrono::milliseconds ejectionTime{30000};
+    std::chrono::milliseconds maxEjectionTime{300000};
+    double maxEjectedFraction{0.5};
+  };
+
+  // Rehashes of the key to find two candidates not ejected
+  static const uint32_t kMaxProbes = 8;
+
+  explicit LatencyBalancer(const Options& options = Options())
+      : options_(options) {}
+
+  // Adds an entry, returning its index
+  size_t insert(const std::string& key, uint64_t weight);
+
+  // See RendezvousHash::buildLookupTable(); again after any insert()
+  void buildLookupTable() {
+    hash_.buildLookupTable();
+  }
+
+  size_t size() const {
+    return entries_.size();
+  }
+
+  // The index of the entry for a request with key, counted outstanding
+  size_t select(uint64_t key, TimePoint now = getCurrentTime());
+
+  size_t select(const std::string& key, TimePoint now = getCurrentTime()) {
+    return select(hash_.computeHash(key), now);
+  }
+
+  // The request sent to the entry at index by select() is done
+  void onComplete(size_t index,
+                  std::chrono::microseconds latency,
+                  bool success,
+                  TimePoint now = getCurrentTime());
+
+  bool isEjected(size_t index, TimePoint now = getCurrentTime()) const {
+    return entries_[index].ejectedUntil > now;
+  }
+
+  // The EWMA of the latency of the entry at index, in microseconds
+  double getLatency(size_t index, TimePoint now = getCurrentTime()) const;
+
+  uint32_t getOutstanding(size_t index) const {
+    return entries_[index].outstanding;
+  }
+
+ private:
+  struct Entry {
+    double latency{0};
+    TimePoint updated;
+    TimePoint ejectedUntil;
+    uint32_t outstanding{0};
+    uint32_t failures{0};
+    // Ejections since the last success
+    uint32_t ejections{0};
+    bool hasLatency{false};
+  };
+
+  // The weight left to the latency of entry as of now, from 1 to 0
+  double getDecay(const Entry& entry, TimePoint now) const;
+  double getCost(size_t index, TimePoint now) const;
+  size_t getNumEjected(TimePoint now) const;
+
+  const Options options_;
+  RendezvousHash hash_;
+  std::vector<Entry> entries_;
+};
+
+}
@@ -11,8 +11,10 @@
 
 #include <algorithm>
 #include <arpa/inet.h>
-#include <proxygen/lib/http/codec/SPDYUtil.h>
 #include <proxygen/lib/utils/UtilInl.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "proxygen/external/http_parser/http_parser.h"
 
@@ -21,6 +23,61 @@ using std::string;
 
 namespace proxygen {
 
+namespace {
+
+struct Delimiters {
+  size_t path{std::string::npos};  // first '/'
+  size_t query{std::string::npos}; // first '?'
+  size_t hash{std::string::npos};  // first '#'
+};
+
+inline void firstOf(size_t& pos, size_t base, uint32_t mask) {
+  if (pos == std::string::npos && mask) {
+    pos = base + __builtin_ctz(mask);
+  }
+}
+
+/**
+ * Finds the first '/', '?' and '#' of the url in the same pass that checks
+ * it for the controls and spaces SPDYUtil::validateURL() rejects, 16 bytes
+ * at a time with SSE2
+ */
+bool scanURL(folly::StringPiece url, Delimiters& delims) {
+  const auto* data = reinterpret_cast<const uint8_t*>(url.data());
+  size_t i = 0;
+#if defined(__SSE2__)
+  const __m128i space = _mm_set1_epi8(0x20);
+  const __m128i del = _mm_set1_epi8(0x7f);
+  const __m128i slash = _mm_set1_epi8('/');
+  const __m128i question = _mm_set1_epi8('?');
+  const __m128i hash = _mm_set1_epi8('#');
+  for (; i + 16 <= url.size(); i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    // unsigned v <= 0x20 where min(v, 0x20) == v
+    __m128i bad = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(v, space), v),
+                               _mm_cmpeq_epi8(v, del));
+    if (_mm_movemask_epi8(bad)) {
+      return false;
+    }
+    firstOf(delims.path, i, _mm_movemask_epi8(_mm_cmpeq_epi8(v, slash)));
+    firstOf(delims.query, i, _mm_movemask_epi8(_mm_cmpeq_epi8(v, question)));
+    firstOf(delims.hash, i, _mm_movemask_epi8(_mm_cmpeq_epi8(v, hash)));
+  }
+#endif
+  for (; i < url.size(); i++) {
+    const uint8_t c = data[i];
+    if (c <= 0x20 || c == 0x7f) {
+      return false;
+    }
+    firstOf(delims.path, i, c == '/');
+    firstOf(delims.query, i, c == '?');
+    firstOf(delims.hash, i, c == '#');
+  }
+  return true;
+}
+
+}
+
 void ParseURL::parse() noexcept {
   if (caseInsensitiveEqual(url_.subpiece(0, 4), "http")) {
     struct http_parser_url u;
@@ -47,6 +104,14 @@ void ParseURL::parse() noexcept {
       }
 
       port_ = u.port;
+      if (port_) {
+        // host:port, as in the url
+        size_t start = host_.begin() - url_.begin();
+        authority_ = url_.subpiece(start, u.field_data[UF_PORT].off +
+                                   u.field_data[UF_PORT].len - start);
+      } else {
+        authority_ = host_;
+      }
 
       path_ = url_.subpiece(u.field_data[UF_PATH].off,
                             u.field_data[UF_PATH].len);
@@ -54,9 +119,6 @@ void ParseURL::parse() noexcept {
                              u.field_data[UF_QUERY].len);
       fragment_ = url_.subpiece(u.field_data[UF_FRAGMENT].off,
                                 u.field_data[UF_FRAGMENT].len);
-
-      authority_ = (port_) ? folly::to<std::string>(host_, ":", port_)
-                           : host_.str();
     }
   } else {
     parseNonFully();
@@ -70,20 +132,21 @@ void ParseURL::parseNonFully() noexcept {
   }
 
   // Check if the URL has only printable characters and no control character.
-  if (!SPDYUtil::validateURL(url_)) {
+  Delimiters delims;
+  if (!scanURL(url_, delims)) {
     valid_ = false;
     return;
   }
 
-  auto pathStart = url_.find('/');
-  auto queryStart = url_.find('?');
-  auto hashStart = url_.find('#');
+  auto pathStart = delims.path;
+  auto queryStart = delims.query;
+  auto hashStart = delims.hash;
 
   auto queryEnd = std::min(hashStart, std::string::npos);
   auto pathEnd = std::min(queryStart, hashStart);
   auto authorityEnd = std::min(pathStart, pathEnd);
 
-  authority_ = url_.subpiece(0, authorityEnd).str();
+  authority_ = url_.subpiece(0, authorityEnd);
 
   if (pathStart < pathEnd) {
     path_ = url_.subpiece(pathStart, pathEnd - pathStart);
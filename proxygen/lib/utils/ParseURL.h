@@ -16,7 +16,9 @@
 namespace proxygen {
 
 // ParseURL can handle non-fully-formed URLs. This class must not persist beyond
-// the lifetime of the buffer underlying the input StringPiece
+// the lifetime of the buffer underlying the input StringPiece. Every component,
+// the authority included, is a view into that buffer, so parsing does not
+// allocate and a copy of a ParseURL stays valid as long as the original.
 
 class ParseURL {
  public:
@@ -40,7 +42,7 @@ class ParseURL {
     return scheme_;
   }
 
-  std::string authority() const {
+  folly::StringPiece authority() const {
     return authority_;
   }
 
@@ -57,7 +59,9 @@ class ParseURL {
   }
 
   std::string hostAndPort() const {
-    std::string rc = host_.str();
+    std::string rc;
+    rc.reserve(host_.size() + 6); // up to 5 digits and the ':'
+    rc.append(host_.data(), host_.size());
     if (port_ != 0) {
       folly::toAppend(":", port_, &rc);
     }
@@ -98,7 +102,7 @@ class ParseURL {
 
   folly::StringPiece url_;
   folly::StringPiece scheme_;
-  std::string authority_;
+  folly::StringPiece authority_;
   folly::StringPiece host_;
   folly::StringPiece hostNoBrackets_;
   folly::StringPiece path_;
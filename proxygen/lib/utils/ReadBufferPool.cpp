@@ -0,0 +1,252 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/utils/ReadBufferPool.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <folly/ThreadLocal.h>
+#include <glog/logging.h>
+#include <mutex>
+#include <sys/mman.h>
+#include <vector>
+
+namespace proxygen {
+
+namespace {
+
+const size_t kSlabSize = 2 * 1024 * 1024;
+
+// Buffers in a slab start on a cache line
+const uint32_t kSlabAlignment = 64;
+
+std::atomic<uint32_t> s_bufferSize{16 * 1024};
+std::atomic<bool> s_useHugePages{false};
+std::atomic<size_t> s_maxIdle{64};
+
+struct Buffer {
+  void* data;
+  uint32_t size;
+  // carved from a slab, so never freed
+  bool slab;
+};
+
+// The free function of the IOBufs gets the size and origin of the buffer
+void* encodeBuffer(uint32_t size, bool slab) {
+  return reinterpret_cast<void*>((uintptr_t(size) << 1) | (slab ? 1 : 0));
+}
+
+Buffer decodeBuffer(void* buf, void* userData) {
+  auto bits = reinterpret_cast<uintptr_t>(userData);
+  return Buffer{buf, uint32_t(bits >> 1), (bits & 1) != 0};
+}
+
+/**
+ * The slab buffers not held by any thread, and the rest of the slab being
+ * carved
+ */
+class Slabs {
+ public:
+  // A slab buffer of at least size bytes, if there is memory for it
+  bool get(uint32_t size, Buffer& buffer) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    while (!free_.empty()) {
+      buffer = free_.back();
+      free_.pop_back();
+      if (buffer.size >= size) {
+        return true;
+      }
+      // from before the buffer size grew, too small to be used again
+    }
+    size = (size + kSlabAlignment - 1) & ~(kSlabAlignment - 1);
+    if (size_t(slabEnd_ - slabNext_) < size) {
+      if (!mapSlab()) {
+        return false;
+      }
+    }
+    buffer = Buffer{slabNext_, size, true};
+    slabNext_ += size;
+    return true;
+  }
+
+  void put(const Buffer& buffer) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    free_.push_back(buffer);
+  }
+
+ private:
+  bool mapSlab() {
+    void* slab = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    slab = mmap(nullptr, kSlabSize, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (slab == MAP_FAILED) {
+      // no huge pages reserved, ask for transparent ones
+      slab = mmap(nullptr, kSlabSize, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (slab == MAP_FAILED) {
+        LOG(ERROR) << "error mapping read buffer slab, errno=" << errno;
+        return false;
+      }
+#ifdef MADV_HUGEPAGE
+      madvise(slab, kSlabSize, MADV_HUGEPAGE);
+#endif
+    }
+    // the rest of the previous slab is left unused
+    slabNext_ = static_cast<char*>(slab);
+    slabEnd_ = slabNext_ + kSlabSize;
+    return true;
+  }
+
+  std::mutex mutex_;
+  std::vector<Buffer> free_;
+  char* slabNext_{nullptr};
+  char* slabEnd_{nullptr};
+};
+
+// Leaked, so that buffers can still be freed during static destruction
+Slabs& slabs() {
+  static auto slabs = new Slabs();
+  return *slabs;
+}
+
+void releaseBuffer(const Buffer& buffer) {
+  if (buffer.slab) {
+    slabs().put(buffer);
+  } else {
+    free(buffer.data);
+  }
+}
+
+class IdleBuffers {
+ public:
+  ~IdleBuffers() {
+    clear();
+  }
+
+  bool get(uint32_t size, Buffer& buffer) {
+    while (!buffers_.empty()) {
+      buffer = buffers_.back();
+      buffers_.pop_back();
+      if (buffer.size >= size) {
+        counts_.reused++;
+        return true;
+      }
+      releaseBuffer(buffer);
+    }
+    return false;
+  }
+
+  void put(const Buffer& buffer) {
+    if (buffers_.size() >= s_maxIdle) {
+      releaseBuffer(buffer);
+      return;
+    }
+    buffers_.push_back(buffer);
+  }
+
+  size_t size() const {
+    return buffers_.size();
+  }
+
+  PoolCounts& counts() {
+    return counts_;
+  }
+
+  void clear() {
+    for (const auto& buffer: buffers_) {
+      releaseBuffer(buffer);
+    }
+    buffers_.clear();
+  }
+
+ private:
+  std::vector<Buffer> buffers_;
+  PoolCounts counts_;
+};
+
+// Leaked, so that buffers can still be freed during static destruction
+folly::ThreadLocal<IdleBuffers>& idleBuffers() {
+  static auto idle = new folly::ThreadLocal<IdleBuffers>();
+  return *idle;
+}
+
+void freeBuffer(void* buf, void* userData) {
+  idleBuffers()->put(decodeBuffer(buf, userData));
+}
+
+}
+
+std::unique_ptr<folly::IOBuf> ReadBufferPool::get() {
+  uint32_t size = s_bufferSize;
+  Buffer buffer;
+  if (!idleBuffers()->get(size, buffer)) {
+    idleBuffers()->counts().allocated++;
+    if (!s_useHugePages || size > kSlabSize ||
+        !slabs().get(size, buffer)) {
+      buffer = Buffer{malloc(size), size, false};
+      if (!buffer.data) {
+        throw std::bad_alloc();
+      }
+    }
+  }
+  return folly::IOBuf::takeOwnership(buffer.data, buffer.size, 0,
+                                     freeBuffer,
+                                     encodeBuffer(buffer.size, buffer.slab));
+}
+
+void ReadBufferPool::setBufferSize(uint32_t size) {
+  s_bufferSize = size;
+}
+
+uint32_t ReadBufferPool::getBufferSize() {
+  return s_bufferSize;
+}
+
+void ReadBufferPool::setUseHugePages(bool use) {
+  s_useHugePages = use;
+}
+
+void ReadBufferPool::setMaxIdleBuffers(size_t maxIdle) {
+  s_maxIdle = maxIdle;
+}
+
+void ReadBufferPool::reserve(size_t n) {
+  auto& idle = *idleBuffers();
+  auto counts = idle.counts();
+  n = std::min(n, s_maxIdle.load());
+  // Held until all are taken, then back to the pool when freed
+  std::vector<std::unique_ptr<folly::IOBuf>> buffers;
+  while (idle.size() + buffers.size() < n) {
+    buffers.push_back(get());
+    memset(buffers.back()->writableData(), 0, buffers.back()->capacity());
+  }
+  idle.counts() = counts;
+}
+
+size_t ReadBufferPool::getNumIdleBuffers() {
+  return idleBuffers()->size();
+}
+
+PoolCounts ReadBufferPool::takeCounts() {
+  auto& counts = idleBuffers()->counts();
+  auto taken = counts;
+  counts = PoolCounts();
+  return taken;
+}
+
+void ReadBufferPool::clear() {
+  idleBuffers()->clear();
+}
+
+}
@@ -0,0 +1,68 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/io/IOBuf.h>
+#include <memory>
+#include <proxygen/lib/utils/ThreadLocalFreeList.h>
+
+namespace proxygen {
+
+/**
+ * Per-thread pools of fixed-size buffers for reading from sockets, so that
+ * a session reading small amounts at a time does not malloc() and free()
+ * a buffer for every read. Since a thread runs a single EventBase, this is
+ * also a pool per EventBase.
+ *
+ * A buffer comes back to the pool of the thread it is freed in when its
+ * IOBuf and every clone of it are destroyed. Up to getMaxIdleBuffers() are
+ * kept per thread, the rest are freed.
+ *
+ * With huge pages, buffers are carved from 2 MB slabs mapped with
+ * MAP_HUGETLB, or as transparent huge pages when none are reserved, to
+ * spare TLB misses with many connections. Slabs are never unmapped: their
+ * buffers are shared between the threads through a global free list
+ * instead of being freed.
+ */
+class ReadBufferPool {
+ public:
+  /**
+   * An empty buffer with at least getBufferSize() bytes of tailroom.
+   */
+  static std::unique_ptr<folly::IOBuf> get();
+
+  // Size of the buffers taken after the call, 16 KB by default
+  static void setBufferSize(uint32_t size);
+  static uint32_t getBufferSize();
+
+  // Whether the buffers taken after the call come from huge page slabs
+  static void setUseHugePages(bool use);
+
+  // Idle buffers kept per thread
+  static void setMaxIdleBuffers(size_t maxIdle);
+
+  /**
+   * Fill the pool of the current thread with up to n buffers (and no more
+   * than the idle maximum), their pages already faulted in. Not counted
+   * in takeCounts().
+   */
+  static void reserve(size_t n);
+
+  // The idle buffers in the pool of the current thread
+  static size_t getNumIdleBuffers();
+
+  // The counts of the current thread since the last call
+  static PoolCounts takeCounts();
+
+  // Free the idle buffers of the current thread
+  static void clear();
+};
+
+}
@@ -10,6 +10,8 @@
 #include <proxygen/lib/utils/RendezvousHash.h>
 #include <folly/Foreach.h>
 #include <folly/Hash.h>
+#include <algorithm>
+#include <functional>
 #include <glog/logging.h>
 #include <map>
 #include <vector>
@@ -19,6 +21,91 @@
 namespace proxygen {
 void RendezvousHash::insert(const std::string& key, uint64_t weight) {
   weights_.emplace_back(computeHash(key.c_str(), key.size()), weight);
+  lookupTable_.clear();
+  if (loads_) {
+    enableBoundedLoad(epsilon_);
+  }
+}
+
+namespace {
+
+bool isPrime(uint64_t n) {
+  if (n < 2) {
+    return false;
+  }
+  for (uint64_t d = 2; d * d <= n; d++) {
+    if (n % d == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}
+
+/*
+ * Maglev lookup table population:
+ * Each entry gets its own permutation of the table slots, derived from the
+ * hash of its name: slot(j) = (offset + j * skip) % tableSize, which visits
+ * every slot since tableSize is prime.  Entries then take turns claiming
+ * the next slot of their permutation that is still free, until the table
+ * is full.  For weights, every round an entry earns weight / maxWeight
+ * turns, so each ends up with slots in proportion to its weight.
+ *
+ * Since the permutations only depend on the entries' names, adding or
+ * removing an entry mostly just takes slots from or gives slots to it,
+ * and most slots keep their entry across rebuilds.
+ */
+void RendezvousHash::buildLookupTable(uint64_t tableSize) {
+  CHECK(isPrime(tableSize)) << "Lookup table size must be prime, got "
+                            << tableSize;
+  CHECK_LT(weights_.size(), std::numeric_limits<uint32_t>::max());
+  lookupTable_.clear();
+
+  uint64_t maxWeight = 0;
+  for (const auto& entry: weights_) {
+    maxWeight = std::max(maxWeight, entry.second);
+  }
+  if (maxWeight == 0) {
+    // nothing can take a slot, so keep scoring every entry
+    return;
+  }
+
+  const uint32_t kFree = std::numeric_limits<uint32_t>::max();
+  const size_t n = weights_.size();
+  std::vector<uint64_t> offset(n);
+  std::vector<uint64_t> skip(n);
+  std::vector<uint64_t> next(n, 0);
+  std::vector<double> turns(n, 0);
+  FOR_EACH_ENUMERATE(i, entry, weights_) {
+    offset[i] = computeHash(entry->first) % tableSize;
+    skip[i] = computeHash(~entry->first) % (tableSize - 1) + 1;
+  }
+
+  std::vector<uint32_t> table(tableSize, kFree);
+  uint64_t filled = 0;
+  while (filled < tableSize) {
+    for (size_t i = 0; i < n && filled < tableSize; i++) {
+      turns[i] += (double)weights_[i].second / maxWeight;
+      while (turns[i] >= 1 && filled < tableSize) {
+        turns[i] -= 1;
+        uint64_t slot;
+        do {
+          slot = (offset[i] + next[i] * skip[i]) % tableSize;
+          next[i]++;
+        } while (table[slot] != kFree);
+        table[slot] = i;
+        filled++;
+      }
+    }
+  }
+  lookupTable_ = std::move(table);
+}
+
+std::pair<uint64_t, size_t> RendezvousHash::getFromTable(
+    const uint64_t hash) const {
+  size_t index = lookupTable_[computeHash(hash) % lookupTable_.size()];
+  return std::make_pair(weights_[index].second, index);
 }
 
 /*
@@ -120,20 +207,14 @@ void RendezvousHash::insert(const std::string& key, uint64_t weight) {
  *
  */
 std::pair<uint64_t, size_t> RendezvousHash::get(const uint64_t hash) const {
+  if (!lookupTable_.empty()) {
+    return getFromTable(hash);
+  }
   double maxScaleWeight = 0;
   int maxIndex = 0;
   int maxWeight = 0;
-  // we use the formula to scale the weight:
-  // scaledWeight = pow(hash/max_int, 1/weight)
   FOR_EACH_ENUMERATE(i, entry, weights_) {
-    // combine the hash with the cluster together
-    double combinedHash = computeHash(entry->first + hash);
-    double scaledHash = (double)combinedHash /
-      std::numeric_limits<uint64_t>::max();
-    double scaledWeight = 0;
-    if (entry->second != 0) {
-      scaledWeight = pow(scaledHash, (double)1/entry->second);
-    }
+    double scaledWeight = getScore(i, hash);
     if (scaledWeight > maxScaleWeight) {
       maxScaleWeight = scaledWeight;
       maxIndex = i;
@@ -143,6 +224,86 @@ std::pair<uint64_t, size_t> RendezvousHash::get(const uint64_t hash) const {
   return std::make_pair(maxWeight, maxIndex);
 }
 
+double RendezvousHash::getScore(size_t index, const uint64_t hash) const {
+  const auto& entry = weights_[index];
+  // we use the formula to scale the weight:
+  // scaledWeight = pow(hash/max_int, 1/weight)
+  // combine the hash with the cluster together
+  double combinedHash = computeHash(entry.first + hash);
+  double scaledHash = (double)combinedHash /
+    std::numeric_limits<uint64_t>::max();
+  double scaledWeight = 0;
+  if (entry.second != 0) {
+    scaledWeight = pow(scaledHash, (double)1/entry.second);
+  }
+  return scaledWeight;
+}
+
+void RendezvousHash::enableBoundedLoad(double epsilon) {
+  CHECK_GE(epsilon, 0);
+  epsilon_ = epsilon;
+  const size_t n = weights_.size();
+  loads_.reset(new std::atomic<uint64_t>[n + 1]);
+  for (size_t i = 0; i <= n; i++) {
+    loads_[i].store(0, std::memory_order_relaxed);
+  }
+  totalWeight_ = 0;
+  for (const auto& entry: weights_) {
+    totalWeight_ += entry.second;
+  }
+}
+
+bool RendezvousHash::isUnderCap(size_t index) const {
+  // The cap counts the key being placed, so that there is room for it
+  const size_t n = weights_.size();
+  double total = loads_[n].load(std::memory_order_relaxed) + 1;
+  double cap = ceil((1 + epsilon_) * total * weights_[index].second /
+                    totalWeight_);
+  return loads_[index].load(std::memory_order_relaxed) + 1 <= cap;
+}
+
+/*
+ * The entries' caps add up to at least (1 + epsilon) times the keys
+ * given out plus the one being placed, so one of them always has room.
+ * The usual pick is tried first, and only when it is full are all
+ * entries ranked by score, the order get() would have preferred them
+ * in, so hot keys spill over to the same next entries every time.
+ */
+size_t RendezvousHash::getBounded(const uint64_t hash) {
+  CHECK(loads_) << "enableBoundedLoad() first";
+  const size_t n = weights_.size();
+  size_t index = get(hash).second;
+  if (totalWeight_ > 0 && !isUnderCap(index)) {
+    std::vector<std::pair<double, size_t>> ranked;
+    ranked.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+      ranked.emplace_back(getScore(i, hash), i);
+    }
+    std::sort(ranked.begin(), ranked.end(),
+              std::greater<std::pair<double, size_t>>());
+    for (const auto& entry: ranked) {
+      if (isUnderCap(entry.second)) {
+        index = entry.second;
+        break;
+      }
+    }
+  }
+  loads_[index].fetch_add(1, std::memory_order_relaxed);
+  loads_[n].fetch_add(1, std::memory_order_relaxed);
+  return index;
+}
+
+void RendezvousHash::release(size_t index) {
+  CHECK(loads_);
+  DCHECK_GT(loads_[index].load(std::memory_order_relaxed), 0);
+  loads_[index].fetch_sub(1, std::memory_order_relaxed);
+  loads_[weights_.size()].fetch_sub(1, std::memory_order_relaxed);
+}
+
+uint64_t RendezvousHash::getLoad(size_t index) const {
+  return loads_ ? loads_[index].load(std::memory_order_relaxed) : 0;
+}
+
 std::pair<uint64_t, size_t> RendezvousHash::get(const char* data,
     size_t len) const {
   const uint64_t hash = computeHash(data, len);
@@ -9,17 +9,52 @@
  */
 #pragma once
 
+#include <atomic>
+#include <memory>
 #include <string>
 #include <vector>
 
 namespace proxygen {
 
+/**
+ * Weighted rendezvous (highest random weight) hashing.
+ *
+ * By default get() scores every entry for each lookup, which is O(n) in
+ * the number of entries.  After buildLookupTable() lookups instead index a
+ * precomputed Maglev table (Eisenbud et al., NSDI 2016) and are O(1).  The
+ * table divides its slots among entries in proportion to their weights, and
+ * rebuilding it after a membership or weight change moves only a little
+ * more than the minimal share of slots, though unlike the scored lookups
+ * some keys may move between entries that did not change.
+ *
+ * With enableBoundedLoad(), getBounded() also keeps any entry from taking
+ * more than its share of the load, for hot keys (Mirrokni et al.,
+ * "Consistent Hashing with Bounded Loads").
+ */
 class RendezvousHash {
  public:
+  // A prime, large enough for ~1% load imbalance up to ~650 entries
+  static const uint64_t kDefaultLookupTableSize = 65537;
+
   explicit RendezvousHash() {}
 
+  /**
+   * Adds an entry. Drops the lookup table, if any, as it no longer matches
+   * the entries; call buildLookupTable() again once they are all in.
+   */
   void insert(const std::string& key, uint64_t weight);
 
+  /**
+   * Precompute the lookup table used by get() from the current entries.
+   * tableSize must be prime, and should be around 100 times the number of
+   * entries or more for an even spread.
+   */
+  void buildLookupTable(uint64_t tableSize = kDefaultLookupTableSize);
+
+  bool hasLookupTable() const {
+    return !lookupTable_.empty();
+  }
+
   std::pair<uint64_t, size_t> get(const uint64_t hash) const;
 
   std::pair<uint64_t, size_t> get(const char* data, size_t len) const;
@@ -36,8 +71,44 @@ class RendezvousHash {
 
   uint64_t computeHash(uint64_t i) const;
 
+  /**
+   * Count the keys given out by getBounded() until release(), and cap
+   * each entry at (1 + epsilon) times its weighted share of them. Call
+   * once all the entries are in; insert() starts the counts over.
+   */
+  void enableBoundedLoad(double epsilon);
+
+  /**
+   * The index of the entry for hash, as get() picks it, unless that one
+   * is at its cap: then the next highest scoring entry under its cap.
+   * Counted against the entry until release(). The counters are atomic,
+   * so this and release() can be called from any thread, though racing
+   * calls may take an entry a little past its cap.
+   */
+  size_t getBounded(const uint64_t hash);
+
+  size_t getBounded(const std::string& s) {
+    return getBounded(computeHash(s.data(), s.length()));
+  }
+
+  // Done with a key getBounded() gave the entry at index
+  void release(size_t index);
+
+  // The keys given out to the entry at index and not yet released
+  uint64_t getLoad(size_t index) const;
+
  private:
+  std::pair<uint64_t, size_t> getFromTable(const uint64_t hash) const;
+  double getScore(size_t index, const uint64_t hash) const;
+  bool isUnderCap(size_t index) const;
+
   std::vector<std::pair<uint64_t, uint64_t>> weights_;
+  // index into weights_ for each slot, empty until buildLookupTable()
+  std::vector<uint32_t> lookupTable_;
+  // Bounded loads: one counter per entry, then their total
+  std::unique_ptr<std::atomic<uint64_t>[]> loads_;
+  double epsilon_{0};
+  uint64_t totalWeight_{0};
 };
 
 } // proxygen
@@ -0,0 +1,230 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/utils/RingBufferTraceEventObserver.h>
+
+#include <algorithm>
+#include <cstring>
+#include <folly/FileUtil.h>
+#include <folly/Memory.h>
+#include <folly/json.h>
+#include <glog/logging.h>
+
+namespace proxygen {
+
+const folly::StringPiece kTraceFileMagic("PXTRACE1");
+
+namespace {
+
+const size_t kAlign = 8;
+
+size_t padding(size_t size) {
+  return (kAlign - size % kAlign) % kAlign;
+}
+
+int64_t toMicros(TimePoint t) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    t.time_since_epoch()).count();
+}
+
+}
+
+void appendTraceRecord(const TraceEvent& event, uint32_t tid,
+                       std::string& out) {
+  const size_t begin = out.size();
+  TraceRecordHeader header;
+  header.length = 0;
+  header.type = static_cast<uint32_t>(event.getType());
+  header.id = event.getID();
+  header.parentID = event.getParentID();
+  header.start = toMicros(event.getStartTime());
+  header.end = toMicros(event.getEndTime());
+  header.tid = tid;
+  header.numFields = event.getMetaData().size();
+  out.append(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  for (const auto& meta: event.getMetaData()) {
+    TraceRecordField field;
+    field.field = static_cast<uint16_t>(meta.first);
+    const auto& value = meta.second.value_;
+    if (const int64_t* intValue = boost::get<int64_t>(&value)) {
+      field.kind = TraceRecordField::INTEGER;
+      field.size = sizeof(*intValue);
+      out.append(reinterpret_cast<const char*>(&field), sizeof(field));
+      out.append(reinterpret_cast<const char*>(intValue), sizeof(*intValue));
+    } else {
+      const auto& strValue = boost::get<std::string>(value);
+      field.kind = TraceRecordField::STRING;
+      field.size = strValue.size();
+      out.append(reinterpret_cast<const char*>(&field), sizeof(field));
+      out.append(strValue);
+      out.append(padding(strValue.size()), '\0');
+    }
+  }
+
+  const uint32_t length = out.size() - begin;
+  memcpy(&out[begin], &length, sizeof(length));
+}
+
+bool traceRecordsToChromeJson(folly::ByteRange data, std::string& out) {
+  if (!data.startsWith(folly::ByteRange(kTraceFileMagic))) {
+    return false;
+  }
+  data.advance(kTraceFileMagic.size());
+
+  out.append("{\"traceEvents\":[");
+  bool first = true;
+  while (!data.empty()) {
+    TraceRecordHeader header;
+    if (data.size() < sizeof(header)) {
+      return false;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+    if (header.length < sizeof(header) || header.length > data.size()) {
+      return false;
+    }
+    auto record = data.subpiece(sizeof(header),
+                                header.length - sizeof(header));
+    data.advance(header.length);
+
+    folly::dynamic args = folly::dynamic::object;
+    for (uint32_t i = 0; i < header.numFields; ++i) {
+      TraceRecordField field;
+      if (record.size() < sizeof(field)) {
+        return false;
+      }
+      memcpy(&field, record.data(), sizeof(field));
+      record.advance(sizeof(field));
+      const size_t size = field.size + padding(field.size);
+      if (record.size() < size) {
+        return false;
+      }
+      const auto& name = getTraceFieldTypeString(
+        static_cast<TraceFieldType>(field.field));
+      if (field.kind == TraceRecordField::INTEGER) {
+        int64_t value;
+        if (field.size != sizeof(value)) {
+          return false;
+        }
+        memcpy(&value, record.data(), sizeof(value));
+        args[name] = value;
+      } else {
+        args[name] = std::string(
+          reinterpret_cast<const char*>(record.data()), field.size);
+      }
+      record.advance(size);
+    }
+
+    auto json = folly::toJson(
+      folly::dynamic::object
+        ("name", getTraceEventTypeString(
+           static_cast<TraceEventType>(header.type)))
+        ("cat", "proxygen")
+        ("ph", "X")
+        ("ts", header.start)
+        ("dur", std::max<int64_t>(header.end - header.start, 0))
+        ("pid", 0)
+        ("tid", int64_t(header.tid))
+        ("id", int64_t(header.id))
+        ("parentID", int64_t(header.parentID))
+        ("args", std::move(args)));
+    if (!first) {
+      out.push_back(',');
+    }
+    first = false;
+    out.append(json.data(), json.size());
+  }
+  out.append("]}");
+  return true;
+}
+
+RingBufferTraceEventObserver::RingBufferTraceEventObserver(
+    int fd,
+    uint32_t ringCapacity,
+    std::chrono::milliseconds drainInterval):
+  fd_(fd),
+  // One slot of a ProducerConsumerQueue is always empty
+  ringCapacity_(ringCapacity + 1),
+  drainInterval_(drainInterval) {
+  if (folly::writeFull(fd_, kTraceFileMagic.data(),
+                       kTraceFileMagic.size()) < 0) {
+    LOG(ERROR) << "Failed to start the trace file, errno=" << errno;
+  }
+  drainer_ = std::thread([this] { drainLoop(); });
+}
+
+RingBufferTraceEventObserver::~RingBufferTraceEventObserver() {
+  {
+    std::lock_guard<std::mutex> guard(stopMutex_);
+    stop_ = true;
+  }
+  stopCv_.notify_one();
+  drainer_.join();
+}
+
+RingBufferTraceEventObserver::LocalRing&
+RingBufferTraceEventObserver::getLocalRing() {
+  auto& local = *localRing_;
+  if (!local.ring) {
+    // Once per thread
+    std::lock_guard<std::mutex> guard(ringsMutex_);
+    local.tid = rings_.size();
+    rings_.emplace_back(folly::make_unique<Ring>(ringCapacity_), local.tid);
+    local.ring = rings_.back().first.get();
+  }
+  return local;
+}
+
+void RingBufferTraceEventObserver::traceEventAvailable(
+    TraceEvent event) noexcept {
+  if (!getLocalRing().ring->write(std::move(event))) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void RingBufferTraceEventObserver::flush() {
+  drain();
+}
+
+void RingBufferTraceEventObserver::drainLoop() {
+  std::unique_lock<std::mutex> lock(stopMutex_);
+  bool stopping = false;
+  while (!stopping) {
+    stopping = stopCv_.wait_for(lock, drainInterval_, [this] {
+        return stop_;
+      });
+    // Drain once more after being told to stop
+    lock.unlock();
+    drain();
+    lock.lock();
+  }
+}
+
+void RingBufferTraceEventObserver::drain() {
+  std::lock_guard<std::mutex> drainGuard(drainMutex_);
+  {
+    std::lock_guard<std::mutex> guard(ringsMutex_);
+    for (auto& ring: rings_) {
+      while (auto event = ring.first->frontPtr()) {
+        appendTraceRecord(*event, ring.second, drainBuf_);
+        ring.first->popFront();
+      }
+    }
+  }
+  if (drainBuf_.empty()) {
+    return;
+  }
+  if (folly::writeFull(fd_, drainBuf_.data(), drainBuf_.size()) < 0) {
+    LOG(ERROR) << "Failed to write " << drainBuf_.size()
+               << " bytes of trace events, errno=" << errno;
+  }
+  drainBuf_.clear();
+}
+
+}
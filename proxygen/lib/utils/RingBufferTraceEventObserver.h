@@ -0,0 +1,142 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <folly/ProducerConsumerQueue.h>
+#include <folly/Range.h>
+#include <folly/ThreadLocal.h>
+#include <memory>
+#include <mutex>
+#include <proxygen/lib/utils/TraceEventObserver.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace proxygen {
+
+/**
+ * TraceEventObserver that hands events to a thread of its own, which
+ * writes them to a file descriptor in a binary format. Each thread that
+ * reports events gets a single producer, single consumer ring, so
+ * reporting an event is a move into the ring, without locks or syscalls.
+ * When a ring is full the event is dropped and counted.
+ *
+ * The drainer writes what it finds every drain interval, and once more
+ * when the observer is destroyed. The fd is not closed. Rings are kept
+ * for the life of the observer, so use it from long lived threads.
+ *
+ * The format, all integers in host byte order, is kTraceFileMagic, then
+ * one record per event, each a multiple of 8 bytes long:
+ *
+ *   TraceRecordHeader
+ *   numFields x { TraceRecordField, payload padded to 8 bytes }
+ *
+ * An integer field has an 8 byte payload, a string field its bytes. See
+ * traceRecordsToChromeJson() to view them in chrome://tracing.
+ */
+class RingBufferTraceEventObserver : public TraceEventObserver {
+ public:
+  explicit RingBufferTraceEventObserver(
+      int fd,
+      uint32_t ringCapacity = 4096,
+      std::chrono::milliseconds drainInterval =
+        std::chrono::milliseconds(100));
+
+  ~RingBufferTraceEventObserver() override;
+
+  void traceEventAvailable(TraceEvent event) noexcept override;
+
+  /**
+   * Write the events reported so far now, from the calling thread.
+   */
+  void flush();
+
+  // Events dropped because their ring was full
+  uint64_t getDroppedEvents() const {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  typedef folly::ProducerConsumerQueue<TraceEvent> Ring;
+
+  struct LocalRing {
+    Ring* ring{nullptr};
+    uint32_t tid{0};
+  };
+
+  LocalRing& getLocalRing();
+  void drainLoop();
+  void drain();
+
+  const int fd_;
+  const uint32_t ringCapacity_;
+  const std::chrono::milliseconds drainInterval_;
+  std::atomic<uint64_t> dropped_{0};
+
+  folly::ThreadLocal<LocalRing> localRing_;
+  // Guards rings_ while a thread registers its ring
+  std::mutex ringsMutex_;
+  std::vector<std::pair<std::unique_ptr<Ring>, uint32_t>> rings_;
+
+  // Only one thread drains the rings at a time
+  std::mutex drainMutex_;
+  std::string drainBuf_;
+
+  std::mutex stopMutex_;
+  std::condition_variable stopCv_;
+  bool stop_{false};
+  std::thread drainer_;
+};
+
+// Starts a trace file
+extern const folly::StringPiece kTraceFileMagic;
+
+struct TraceRecordHeader {
+  // Of the whole record, with its fields
+  uint32_t length;
+  uint32_t type;
+  uint32_t id;
+  uint32_t parentID;
+  // Microseconds on the steady clock
+  int64_t start;
+  int64_t end;
+  uint32_t tid;
+  uint32_t numFields;
+};
+
+struct TraceRecordField {
+  enum Kind : uint16_t {
+    INTEGER = 0,
+    STRING = 1,
+  };
+
+  uint16_t field;
+  uint16_t kind;
+  // Of the payload, without padding
+  uint32_t size;
+};
+
+/**
+ * Append the record of event, reported from thread tid, to out.
+ */
+void appendTraceRecord(const TraceEvent& event, uint32_t tid,
+                       std::string& out);
+
+/**
+ * Convert a trace file to the JSON of the Chrome trace event format, one
+ * complete event per record, with its meta data as args. Returns false if
+ * data is not a trace file or ends in the middle of a record.
+ */
+bool traceRecordsToChromeJson(folly::ByteRange data, std::string& out);
+
+}
@@ -9,9 +9,12 @@
  */
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <glog/logging.h>
 #include <iostream>
 #include <tuple>
+#include <utility>
 
 template <typename T>
 class StateMachine {
@@ -29,10 +32,10 @@ class StateMachine {
 
     std::tie(newState, ok) = T::find(state, event);
     if (!ok) {
-      LOG(ERROR) << "Invalid transition tried: " << state << " " << event;
+      logInvalidTransition(state, event);
       return false;
     }
-    VLOG(6) << "Transitioning from " << state << " to " << newState;
+    DVLOG(6) << "Transitioning from " << state << " to " << newState;
     state = newState;
     return true;
   }
@@ -43,4 +46,83 @@ class StateMachine {
     std::tie(std::ignore, ok) = T::find(state, event);
     return ok;
   }
+
+ private:
+  __attribute__((__noinline__, __cold__))
+  static void logInvalidTransition(State state, Event event) {
+    LOG(ERROR) << "Invalid transition tried: " << state << " " << event;
+  }
+};
+
+template <typename State, typename Event>
+struct StateTransition {
+  State from;
+  Event event;
+  State to;
+};
+
+namespace state_machine_detail {
+
+template <size_t... I>
+struct IndexSequence {};
+
+template <size_t N, size_t... I>
+struct MakeIndexSequence : MakeIndexSequence<N - 1, N - 1, I...> {};
+
+template <size_t... I>
+struct MakeIndexSequence<0, I...> {
+  typedef IndexSequence<I...> type;
+};
+
+}
+
+/**
+ * A [State][Event] array of the transitions of a state machine, built at
+ * compile time from the list of its transitions, so that find() is one
+ * load. Use it as the find() of the StateMachine data:
+ *
+ *   constexpr StateTransition<State, Event> kTransitions[] = {...};
+ *   constexpr Table kTable = Table::make(kTransitions);
+ *
+ * The states and events must be enums numbered from 0 up to below
+ * NumStates and NumEvents.
+ */
+template <typename State, typename Event, size_t NumStates, size_t NumEvents>
+struct DenseTransitionTable {
+  typedef StateTransition<State, Event> Transition;
+  static constexpr size_t kSize = NumStates * NumEvents;
+
+  // The new state plus 1 of each transition, 0 for the invalid ones
+  uint8_t next[kSize];
+
+  template <size_t N>
+  static constexpr DenseTransitionTable make(const Transition (&list)[N]) {
+    return make(list, typename state_machine_detail::MakeIndexSequence<
+                  kSize>::type());
+  }
+
+  std::pair<State, bool> find(State s, Event e) const {
+    size_t i = size_t(s) * NumEvents + size_t(e);
+    if (i >= kSize || next[i] == 0) {
+      return std::make_pair(s, false);
+    }
+    return std::make_pair(State(next[i] - 1), true);
+  }
+
+ private:
+  template <size_t N, size_t... I>
+  static constexpr DenseTransitionTable make(
+      const Transition (&list)[N],
+      state_machine_detail::IndexSequence<I...>) {
+    return DenseTransitionTable{{entry(list, I / NumEvents, I % NumEvents,
+                                       0)...}};
+  }
+
+  template <size_t N>
+  static constexpr uint8_t entry(const Transition (&list)[N],
+                                 size_t s, size_t e, size_t i) {
+    return i == N ? 0 :
+      (size_t(list[i].from) == s && size_t(list[i].event) == e) ?
+      uint8_t(size_t(list[i].to) + 1) : entry(list, s, e, i + 1);
+  }
 };
@@ -0,0 +1,56 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/utils/StreamCompressor.h>
+
+#include <folly/Memory.h>
+#include <proxygen/lib/utils/ZlibStreamCompressor.h>
+#include <proxygen/proxygen-config.h>
+
+#if PROXYGEN_HAVE_LIBBROTLIENC
+#include <proxygen/lib/utils/BrotliStreamCompressor.h>
+#endif
+#if PROXYGEN_HAVE_LIBZSTD
+#include <proxygen/lib/utils/ZstdStreamCompressor.h>
+#endif
+
+namespace proxygen {
+
+bool isSupportedContentEncoding(folly::StringPiece encoding) {
+  return encoding == "gzip"
+#if PROXYGEN_HAVE_LIBBROTLIENC
+    || encoding == "br"
+#endif
+#if PROXYGEN_HAVE_LIBZSTD
+    || encoding == "zstd"
+#endif
+    ;
+}
+
+std::unique_ptr<StreamCompressor> makeStreamCompressor(
+    folly::StringPiece encoding, int level) {
+  if (encoding == "gzip") {
+    return folly::make_unique<ZlibStreamCompressor>(ZlibCompressionType::GZIP,
+                                                    level);
+  }
+#if PROXYGEN_HAVE_LIBBROTLIENC
+  if (encoding == "br") {
+    // quality 11 is meant for static content
+    return folly::make_unique<BrotliStreamCompressor>(level < 0 ? 5 : level);
+  }
+#endif
+#if PROXYGEN_HAVE_LIBZSTD
+  if (encoding == "zstd") {
+    return folly::make_unique<ZstdStreamCompressor>(level < 0 ? 3 : level);
+  }
+#endif
+  return nullptr;
+}
+
+}
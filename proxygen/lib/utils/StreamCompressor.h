@@ -0,0 +1,55 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/Range.h>
+#include <memory>
+
+namespace folly {
+class IOBuf;
+}
+
+namespace proxygen {
+
+/**
+ * Compresses one stream of data, such as a response body, that is fed in
+ * pieces. Whatever a piece compresses to is returned right away, so it can
+ * be sent on without waiting for the rest of the stream.
+ */
+class StreamCompressor {
+ public:
+  virtual ~StreamCompressor() {}
+
+  /**
+   * Compress in. trailer must be set on the final call, which ends the
+   * stream.
+   */
+  virtual std::unique_ptr<folly::IOBuf> compress(const folly::IOBuf* in,
+                                                 bool trailer = true) = 0;
+
+  virtual bool hasError() = 0;
+};
+
+/**
+ * Whether makeStreamCompressor() supports a content coding (the token of a
+ * Content-Encoding header). "gzip" always is; "br" and "zstd" are if
+ * proxygen was configured with libbrotlienc and libzstd.
+ */
+bool isSupportedContentEncoding(folly::StringPiece encoding);
+
+/**
+ * A compressor for a supported content coding, or nullptr. level is given
+ * to zlib (0 to 9), brotli (quality 0 to 11) or zstd (1 to 19) as is; -1
+ * picks a default suited to compressing on the fly.
+ */
+std::unique_ptr<StreamCompressor> makeStreamCompressor(
+  folly::StringPiece encoding, int level);
+
+}
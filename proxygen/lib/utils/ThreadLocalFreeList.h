@@ -0,0 +1,137 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/ThreadLocal.h>
+#include <algorithm>
+#include <cstring>
+#include <inttypes.h>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace proxygen {
+
+/**
+ * How many objects got their memory from the allocator, and how many
+ * reused memory from a pool
+ */
+struct PoolCounts {
+  uint64_t allocated{0};
+  uint64_t reused{0};
+};
+
+/**
+ * Per-thread free lists of memory for a T. Memory deallocated here is kept,
+ * up to getMaxIdle() blocks per thread, for the next T allocated in the same
+ * thread, instead of being freed. Memory may be deallocated in a thread
+ * other than the one it came from; it then joins that thread's list.
+ *
+ * Only the memory is pooled: objects are constructed and destroyed in it
+ * as usual.
+ */
+template <typename T>
+class ThreadLocalFreeList {
+ public:
+  static void* allocate() {
+    auto& local = *idle();
+    if (!local.blocks.empty()) {
+      auto block = local.blocks.back();
+      local.blocks.pop_back();
+      local.counts.reused++;
+      return block;
+    }
+    local.counts.allocated++;
+    return new Storage;
+  }
+
+  static void deallocate(void* block) {
+    auto& local = *idle();
+    if (local.blocks.size() >= maxIdle()) {
+      delete static_cast<Storage*>(block);
+      return;
+    }
+    local.blocks.push_back(static_cast<Storage*>(block));
+  }
+
+  // The counts of the current thread since the last call
+  static PoolCounts takeCounts() {
+    auto& local = *idle();
+    auto counts = local.counts;
+    local.counts = PoolCounts();
+    return counts;
+  }
+
+  // Blocks kept per thread
+  static void setMaxIdle(size_t max) {
+    maxIdle() = max;
+  }
+
+  static size_t getMaxIdle() {
+    return maxIdle();
+  }
+
+  /**
+   * Fill the list of the current thread with up to n blocks (and no more
+   * than getMaxIdle()), their pages already faulted in, so that the first
+   * objects allocated later do not have to.
+   */
+  static void reserve(size_t n) {
+    auto& local = *idle();
+    n = std::min(n, maxIdle());
+    while (local.blocks.size() < n) {
+      auto block = new Storage;
+      memset(block, 0, sizeof(Storage));
+      local.blocks.push_back(block);
+    }
+  }
+
+  // The blocks idle in the list of the current thread
+  static size_t getNumIdle() {
+    return idle()->blocks.size();
+  }
+
+  // Free the idle blocks of the current thread
+  static void clear() {
+    idle()->clear();
+  }
+
+ private:
+  typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Storage;
+
+  struct Idle {
+    ~Idle() {
+      clear();
+    }
+
+    void clear() {
+      for (auto block: blocks) {
+        delete block;
+      }
+      blocks.clear();
+    }
+
+    std::vector<Storage*> blocks;
+    PoolCounts counts;
+  };
+
+  // Leaked, so that objects can still be freed during static destruction
+  static folly::ThreadLocal<Idle>& idle() {
+    static auto idle = new folly::ThreadLocal<Idle>();
+    return *idle;
+  }
+
+  static size_t& maxIdle() {
+    static size_t max = 4096;
+    return max;
+  }
+};
+
+}
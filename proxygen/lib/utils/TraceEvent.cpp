@@ -10,6 +10,7 @@
 #include <proxygen/lib/utils/TraceEvent.h>
 #include <proxygen/lib/utils/UnionBasedStatic.h>
 
+#include <algorithm>
 #include <folly/ThreadLocal.h>
 #include <random>
 #include <sstream>
@@ -92,15 +93,47 @@ bool TraceEvent::readBoolMeta(TraceFieldType key, bool& dest) const {
 bool TraceEvent::readStrMeta(TraceFieldType key, std::string& dest) const {
   return readMeta(key, dest);
 }
+
+namespace {
+
+bool fieldLess(const std::pair<TraceFieldType, TraceEvent::MetaData>& pair,
+               TraceFieldType key) {
+  return pair.first < key;
+}
+
+}
+
+void TraceEvent::setMetaData(MetaDataMap&& input) {
+  metaData_ = std::move(input);
+  std::sort(metaData_.begin(), metaData_.end(),
+            [] (const MetaDataMap::value_type& a,
+                const MetaDataMap::value_type& b) {
+              return a.first < b.first;
+            });
+}
+
+TraceEvent::MetaDataMap::const_iterator
+TraceEvent::findMetaData(TraceFieldType key) const {
+  auto itr = std::lower_bound(metaData_.begin(), metaData_.end(), key,
+                              fieldLess);
+  if (itr != metaData_.end() && itr->first == key) {
+    return itr;
+  }
+  return metaData_.end();
+}
+
 bool TraceEvent::addMetaInternal(TraceFieldType key, MetaData&& value) {
-  auto rc = metaData_.emplace(key, value);
+  auto itr = std::lower_bound(metaData_.begin(), metaData_.end(), key,
+                              fieldLess);
 
   // replace if key already exist
-  if (!rc.second) {
-    rc.first->second = value;
+  if (itr != metaData_.end() && itr->first == key) {
+    itr->second = std::move(value);
+    return false;
   }
 
-  return rc.second;
+  metaData_.insert(itr, std::make_pair(key, std::move(value)));
+  return true;
 }
 
 std::string TraceEvent::toString() const {
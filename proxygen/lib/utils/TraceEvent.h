@@ -11,7 +11,7 @@
 
 #include <boost/variant.hpp>
 #include <folly/Conv.h>
-#include <map>
+#include <folly/small_vector.h>
 #include <proxygen/lib/utils/Time.h>
 #include <proxygen/lib/utils/TraceEventType.h>
 #include <proxygen/lib/utils/TraceFieldType.h>
@@ -68,7 +68,11 @@ class TraceEvent {
      MetaDataType value_;
   };
 
-  typedef std::map<TraceFieldType, MetaData> MetaDataMap;
+  // Field-value pairs sorted by field, one per field. Most events carry a
+  // handful, so they are kept inline and building or moving an event
+  // doesn't allocate.
+  typedef folly::small_vector<std::pair<TraceFieldType, MetaData>, 6>
+    MetaDataMap;
 
   class Iterator {
    public:
@@ -160,19 +164,21 @@ class TraceEvent {
   }
 
   bool hasTraceField(TraceFieldType field) const {
-    return metaData_.count(field);
+    return findMetaData(field) != metaData_.end();
   }
 
   template<typename T>
   T getTraceFieldDataAs(TraceFieldType field) const {
-    const auto itr = metaData_.find(field);
+    const auto itr = findMetaData(field);
     CHECK(itr != metaData_.end());
     return itr->second.getValueAs<T>();
   }
 
-  void setMetaData(MetaDataMap&& input) {
-    metaData_ = input;
-  }
+  /**
+   * Replaces the meta data with input, which need not be sorted, but must
+   * have one pair per field.
+   */
+  void setMetaData(MetaDataMap&& input);
 
   const MetaDataMap& getMetaData() const {
     return metaData_;
@@ -215,7 +221,7 @@ class TraceEvent {
  private:
   template<typename T>
   bool readMeta(TraceFieldType key, T& dest) const {
-    const auto itr = metaData_.find(key);
+    const auto itr = findMetaData(key);
     if (itr != metaData_.end()) {
       try {
         dest = itr->second.getValueAs<T>();
@@ -227,6 +233,8 @@ class TraceEvent {
     return false;
   }
 
+  MetaDataMap::const_iterator findMetaData(TraceFieldType key) const;
+
   bool addMetaInternal(TraceFieldType key, MetaData&& val);
 
   enum State {
@@ -14,9 +14,14 @@
 namespace proxygen {
 
 void TraceEventContext::traceEventAvailable(TraceEvent event) {
-  for (const auto observer : observers_) {
-    observer->traceEventAvailable(event);
+  if (observers_.empty()) {
+    return;
   }
+  // Only the observers before the last one need a copy
+  for (size_t i = 0; i + 1 < observers_.size(); ++i) {
+    observers_[i]->traceEventAvailable(event);
+  }
+  observers_.back()->traceEventAvailable(std::move(event));
 }
 
 }
@@ -14,7 +14,8 @@
 namespace proxygen {
 
 /*
- * Obersver interface to record trace events.
+ * Obersver interface to record trace events. The event is the observer's
+ * to keep, so move it rather than copy it to store it.
  */
 struct TraceEventObserver {
   virtual ~TraceEventObserver() {}
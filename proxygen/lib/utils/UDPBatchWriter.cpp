@@ -0,0 +1,183 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/utils/UDPBatchWriter.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+namespace proxygen {
+
+namespace {
+
+// Messages per sendmmsg(), segments per GSO message, and its payload,
+// which must fit an IP packet
+const size_t kMaxMessages = 64;
+const size_t kMaxSegments = 64;
+const size_t kMaxGSOBytes = 65000;
+const size_t kMaxIovecs = UIO_MAXIOV;
+
+union SegmentControl {
+  char buf[CMSG_SPACE(sizeof(uint16_t))];
+  struct cmsghdr align;
+};
+
+}
+
+UDPBatchWriter::UDPBatchWriter(int fd)
+    : fd_(fd),
+      useGSO_(isGSOSupported(fd)) {
+}
+
+bool UDPBatchWriter::isGSOSupported(int fd) {
+  int segmentSize = 0;
+  socklen_t len = sizeof(segmentSize);
+  return getsockopt(fd, SOL_UDP, UDP_SEGMENT, &segmentSize, &len) == 0;
+}
+
+void UDPBatchWriter::write(const folly::SocketAddress& peer,
+                           std::unique_ptr<folly::IOBuf> buf) {
+  size_t length = buf ? buf->computeChainDataLength() : 0;
+  if (length == 0) {
+    return;
+  }
+  pending_.push_back(Datagram{peer, std::move(buf), length});
+}
+
+ssize_t UDPBatchWriter::flush() {
+  size_t sent = 0;
+  size_t dropped = 0;
+  int err = 0;
+  while (sent + dropped < pending_.size()) {
+    ssize_t n = sendBatch(sent + dropped);
+    if (n > 0) {
+      sent += n;
+      continue;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+      err = errno;
+      break;
+    }
+    if (errno == EIO && useGSO_) {
+      // The device cannot checksum segmented datagrams
+      useGSO_ = false;
+      continue;
+    }
+    // Not sendable (too large, unreachable peer...): skip it, so that
+    // the following datagrams still go out
+    err = errno;
+    dropped++;
+  }
+  pending_.erase(pending_.begin(), pending_.begin() + sent + dropped);
+  if (sent == 0 && err != 0) {
+    errno = err;
+    return -1;
+  }
+  return sent;
+}
+
+ssize_t UDPBatchWriter::sendBatch(size_t begin) {
+  std::vector<struct mmsghdr> msgs;
+  std::vector<struct iovec> iovs;
+  std::vector<struct sockaddr_storage> addrs;
+  std::vector<SegmentControl> controls;
+  // First iovec and datagram of each message
+  std::vector<size_t> firstIov;
+  std::vector<size_t> counts;
+  msgs.reserve(kMaxMessages);
+  addrs.reserve(kMaxMessages);
+  controls.reserve(kMaxMessages);
+
+  size_t i = begin;
+  while (i < pending_.size() && msgs.size() < kMaxMessages) {
+    const Datagram& first = pending_[i];
+    struct mmsghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    addrs.emplace_back();
+    msg.msg_hdr.msg_namelen = first.peer.getAddress(&addrs.back());
+    firstIov.push_back(iovs.size());
+
+    // With GSO, every datagram but the last of the run must be of the
+    // size of the first, and the last no larger
+    size_t count = 0;
+    size_t bytes = 0;
+    do {
+      const Datagram& dgram = pending_[i];
+      if (count > 0 &&
+          (!useGSO_ || dgram.peer != first.peer ||
+           dgram.length > first.length ||
+           pending_[i - 1].length < first.length ||
+           count == kMaxSegments ||
+           bytes + dgram.length > kMaxGSOBytes ||
+           iovs.size() - firstIov.back() + dgram.buf->countChainElements() >
+             kMaxIovecs)) {
+        break;
+      }
+      for (auto range: *dgram.buf) {
+        if (!range.empty()) {
+          iovs.push_back({const_cast<uint8_t*>(range.data()), range.size()});
+        }
+      }
+      bytes += dgram.length;
+      count++;
+      i++;
+    } while (i < pending_.size());
+
+    msg.msg_hdr.msg_iovlen = iovs.size() - firstIov.back();
+    controls.emplace_back();
+    if (count > 1) {
+      msg.msg_hdr.msg_controllen = sizeof(controls.back().buf);
+    }
+    counts.push_back(count);
+    msgs.push_back(msg);
+  }
+
+  // The vectors are complete, point into them
+  for (size_t m = 0; m < msgs.size(); m++) {
+    auto& hdr = msgs[m].msg_hdr;
+    hdr.msg_name = &addrs[m];
+    hdr.msg_iov = &iovs[firstIov[m]];
+    if (hdr.msg_controllen > 0) {
+      hdr.msg_control = controls[m].buf;
+      struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+      cmsg->cmsg_level = SOL_UDP;
+      cmsg->cmsg_type = UDP_SEGMENT;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+      uint16_t segmentSize = pending_[begin].length;
+      memcpy(CMSG_DATA(cmsg), &segmentSize, sizeof(segmentSize));
+    }
+    begin += counts[m];
+  }
+
+  int n = sendmmsg(fd_, msgs.data(), msgs.size(), 0);
+  if (n < 0) {
+    return -1;
+  }
+  size_t sent = 0;
+  for (int m = 0; m < n; m++) {
+    sent += counts[m];
+  }
+  return sent;
+}
+
+}
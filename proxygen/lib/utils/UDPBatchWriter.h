@@ -0,0 +1,81 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/SocketAddress.h>
+#include <folly/io/IOBuf.h>
+#include <memory>
+#include <sys/types.h>
+#include <vector>
+
+namespace proxygen {
+
+/**
+ * Batches the datagrams written to a UDP socket, and sends them with as
+ * few system calls as it can: all of them at once with sendmmsg(), and
+ * runs of equally sized datagrams to the same peer as a single message
+ * with UDP generic segmentation offload (GSO), which the kernel or the
+ * NIC splits back into datagrams. This is the send path a datagram based
+ * transport (such as QUIC) needs to be as cheap per byte as TCP.
+ *
+ * Datagrams are sent in the order they are written. Not thread safe.
+ */
+class UDPBatchWriter {
+ public:
+  /**
+   * fd is a UDP socket, which the writer does not close. GSO is used
+   * if the socket supports it.
+   */
+  explicit UDPBatchWriter(int fd);
+
+  // Whether the kernel segments datagrams written to fd (Linux 4.18+)
+  static bool isGSOSupported(int fd);
+
+  void setUseGSO(bool use) { useGSO_ = use; }
+  bool getUseGSO() const { return useGSO_; }
+
+  /**
+   * Queue a datagram to peer. Empty datagrams are dropped.
+   */
+  void write(const folly::SocketAddress& peer,
+             std::unique_ptr<folly::IOBuf> buf);
+
+  size_t getNumPending() const { return pending_.size(); }
+
+  /**
+   * Send the pending datagrams.
+   *
+   * @return The number of datagrams sent, or -1 with errno set if none
+   *         could be (EAGAIN once the socket buffer is full). Datagrams
+   *         that were not sent stay pending; those rejected for another
+   *         reason than EAGAIN are dropped.
+   */
+  ssize_t flush();
+
+ private:
+  struct Datagram {
+    folly::SocketAddress peer;
+    std::unique_ptr<folly::IOBuf> buf;
+    size_t length;
+  };
+
+  /**
+   * Send the datagrams from pending_[begin], with one sendmmsg().
+   *
+   * @return The number of datagrams sent, or -1 with errno set
+   */
+  ssize_t sendBatch(size_t begin);
+
+  int fd_;
+  bool useGSO_;
+  std::vector<Datagram> pending_;
+};
+
+}
@@ -42,37 +42,26 @@ void ZlibStreamCompressor::init(ZlibCompressionType type, int32_t level) {
   level_ = level;
   status_ = Z_OK;
 
-  zlibStream_.zalloc = Z_NULL;
-  zlibStream_.zfree = Z_NULL;
-  zlibStream_.opaque = Z_NULL;
-  zlibStream_.total_in = 0;
-  zlibStream_.next_in = Z_NULL;
-  zlibStream_.avail_in = 0;
-  zlibStream_.avail_out = 0;
-  zlibStream_.next_out = Z_NULL;
-
   DCHECK(level_ >= Z_NO_COMPRESSION && level_ <= Z_BEST_COMPRESSION)
     << "Invalid Zlib compression level. level=" << level_;
 
   switch (type_) {
     case ZlibCompressionType::GZIP:
-      status_ = deflateInit2(&zlibStream_,
-                            level_,
-                            Z_DEFLATED,
-                            static_cast<int32_t>(type),
-                            MAX_MEM_LEVEL,
-                            Z_DEFAULT_STRATEGY);
+      zlibStream_ = ZlibStreamPool::getDeflater(level_,
+                                                static_cast<int32_t>(type),
+                                                MAX_MEM_LEVEL);
       break;
     case ZlibCompressionType::DEFLATE:
-      status_ = deflateInit(&zlibStream_, level);
+      // What deflateInit() uses
+      zlibStream_ = ZlibStreamPool::getDeflater(level_, MAX_WBITS, 8);
       break;
     default:
       DCHECK(false) << "Unsupported zlib compression type.";
       break;
   }
 
-  if (status_ != Z_OK) {
-      LOG(ERROR) << "error initializing zlib stream. r=" << status_ ;
+  if (!zlibStream_) {
+    status_ = Z_STREAM_ERROR;
   }
 }
 
@@ -81,12 +70,6 @@ ZlibStreamCompressor::ZlibStreamCompressor(ZlibCompressionType type, int level)
   init(type, level);
 }
 
-ZlibStreamCompressor::~ZlibStreamCompressor() {
-  if (type_ != ZlibCompressionType::NONE) {
-    status_ = deflateEnd(&zlibStream_);
-  }
-}
-
 // Compress an IOBuf chain. Compress can be called multiple times and the
 // Zlib stream will be synced after each call. trailer must be set to
 // true on the final compression call.
@@ -130,24 +113,24 @@ std::unique_ptr<IOBuf> ZlibStreamCompressor::compress(const IOBuf* in,
 
     const size_t origAvailIn = crtBuf->length() - offset;
 
-    zlibStream_.next_in = const_cast<uint8_t*>(crtBuf->data() + offset);
-    zlibStream_.avail_in = origAvailIn;
+    zlibStream_->next_in = const_cast<uint8_t*>(crtBuf->data() + offset);
+    zlibStream_->avail_in = origAvailIn;
     // Zlib may not write it's entire state on the first pass.
     do {
       appender.ensure(chunkSize);
 
-      zlibStream_.next_out = appender.writableData();
-      zlibStream_.avail_out = chunkSize;
-      status_ = deflate(&zlibStream_, flush);
+      zlibStream_->next_out = appender.writableData();
+      zlibStream_->avail_out = chunkSize;
+      status_ = deflate(zlibStream_.get(), flush);
 
       // Move output buffer ahead
-      auto outMove = chunkSize - zlibStream_.avail_out;
+      auto outMove = chunkSize - zlibStream_->avail_out;
       appender.append(outMove);
-    } while (zlibStream_.avail_out == 0);
-    DCHECK(zlibStream_.avail_in == 0);
+    } while (zlibStream_->avail_out == 0);
+    DCHECK(zlibStream_->avail_in == 0);
 
     // Adjust the input offset ahead
-    auto inConsumed = origAvailIn - zlibStream_.avail_in;
+    auto inConsumed = origAvailIn - zlibStream_->avail_in;
     offset += inConsumed;
 
   } while (flush != Z_FINISH && flush != Z_SYNC_FLUSH);
@@ -11,6 +11,8 @@
 
 #include <memory>
 #include <zlib.h>
+#include <proxygen/lib/utils/StreamCompressor.h>
+#include <proxygen/lib/utils/ZlibStreamPool.h>
 #include <proxygen/lib/utils/ZlibStreamDecompressor.h>
 
 namespace folly {
@@ -30,27 +32,27 @@ namespace proxygen {
   extern int64_t FLAGS_zlib_buffer_minsize;
 #endif
 
-class ZlibStreamCompressor {
+class ZlibStreamCompressor : public StreamCompressor {
  public:
   explicit ZlibStreamCompressor(ZlibCompressionType type, int level);
 
-  ~ZlibStreamCompressor();
-
   void init(ZlibCompressionType type, int level);
 
   std::unique_ptr<folly::IOBuf> compress(const folly::IOBuf* in,
-                                         bool trailer = true);
+                                         bool trailer = true) override;
 
   int getStatus() { return status_; }
 
-  bool hasError() { return status_ != Z_OK && status_ != Z_STREAM_END; }
+  bool hasError() override {
+    return status_ != Z_OK && status_ != Z_STREAM_END;
+  }
 
   bool finished() { return status_ == Z_STREAM_END; }
 
  private:
   ZlibCompressionType type_{ZlibCompressionType::NONE};
   int level_{Z_DEFAULT_COMPRESSION};
-  z_stream zlibStream_;
+  ZlibStreamPool::StreamPtr zlibStream_;
   int status_{-1};
 };
 }
@@ -37,17 +37,12 @@ void ZlibStreamDecompressor::init(ZlibCompressionType type) {
   DCHECK(type_ == ZlibCompressionType::NONE) << "Must be uninitialized";
   type_ = type;
   status_ = Z_OK;
-  zlibStream_.zalloc = Z_NULL;
-  zlibStream_.zfree = Z_NULL;
-  zlibStream_.opaque = Z_NULL;
-  zlibStream_.total_in = 0;
-  zlibStream_.next_in = Z_NULL;
-  zlibStream_.avail_in = 0;
-  zlibStream_.avail_out = 0;
-  zlibStream_.next_out = Z_NULL;
 
   DCHECK(type != ZlibCompressionType::NONE);
-  status_ = inflateInit2(&zlibStream_, static_cast<int>(type_));
+  zlibStream_ = ZlibStreamPool::getInflater(static_cast<int>(type_));
+  if (!zlibStream_) {
+    status_ = Z_STREAM_ERROR;
+  }
 }
 
 ZlibStreamDecompressor::ZlibStreamDecompressor(ZlibCompressionType type)
@@ -55,16 +50,12 @@ ZlibStreamDecompressor::ZlibStreamDecompressor(ZlibCompressionType type)
   init(type);
 }
 
-ZlibStreamDecompressor::~ZlibStreamDecompressor() {
-  if (type_ != ZlibCompressionType::NONE) {
-    status_ = inflateEnd(&zlibStream_);
-  }
-}
-
-std::unique_ptr<IOBuf> ZlibStreamDecompressor::decompress(const IOBuf* in) {
+std::unique_ptr<IOBuf> ZlibStreamDecompressor::decompress(const IOBuf* in,
+                                                          size_t maxLength) {
   auto out = IOBuf::create(FLAGS_zlib_buffer_growth);
   auto appender = folly::io::Appender(out.get(),
       FLAGS_zlib_buffer_growth);
+  size_t outLength = 0;
 
   const IOBuf* crtBuf = in;
   size_t offset = 0;
@@ -95,22 +86,30 @@ std::unique_ptr<IOBuf> ZlibStreamDecompressor::decompress(const IOBuf* in) {
     DCHECK_GT(appender.length(), 0);
 
     const size_t origAvailIn = crtBuf->length() - offset;
-    zlibStream_.next_in = const_cast<uint8_t*>(crtBuf->data() + offset);
-    zlibStream_.avail_in = origAvailIn;
-    zlibStream_.next_out = appender.writableData();
-    zlibStream_.avail_out = appender.length();
-    status_ = inflate(&zlibStream_, Z_PARTIAL_FLUSH);
+    zlibStream_->next_in = const_cast<uint8_t*>(crtBuf->data() + offset);
+    zlibStream_->avail_in = origAvailIn;
+    zlibStream_->next_out = appender.writableData();
+    zlibStream_->avail_out = appender.length();
+    status_ = inflate(zlibStream_.get(), Z_PARTIAL_FLUSH);
     if (status_ != Z_OK && status_ != Z_STREAM_END) {
       LOG(INFO) << "error uncompressing buffer: r=" << status_;
       return nullptr;
     }
 
     // Adjust the input offset ahead
-    auto inConsumed = origAvailIn - zlibStream_.avail_in;
+    auto inConsumed = origAvailIn - zlibStream_->avail_in;
     offset += inConsumed;
     // Move output buffer ahead
-    auto outMove = appender.length() - zlibStream_.avail_out;
+    auto outMove = appender.length() - zlibStream_->avail_out;
     appender.append(outMove);
+    // Each inflate() fills one buffer at most, so this stops soon enough
+    outLength += outMove;
+    if (outLength > maxLength) {
+      status_ = Z_BUF_ERROR;
+      LOG(INFO) << "error uncompressing buffer: more than " << maxLength
+                << " bytes";
+      return nullptr;
+    }
   }
 
   return out;
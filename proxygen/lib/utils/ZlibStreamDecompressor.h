@@ -9,7 +9,9 @@
  */
 #pragma once
 
+#include <limits>
 #include <memory>
+#include <proxygen/lib/utils/ZlibStreamPool.h>
 #include <zlib.h>
 
 namespace folly {
@@ -41,11 +43,16 @@ class ZlibStreamDecompressor {
 
   ZlibStreamDecompressor() { }
 
-  ~ZlibStreamDecompressor();
-
   void init(ZlibCompressionType type);
 
-  std::unique_ptr<folly::IOBuf> decompress(const folly::IOBuf* in);
+  /**
+   * The next part of the stream, from the whole of in. If that is more
+   * than maxLength bytes, such as from a zip bomb, gives up with status
+   * Z_BUF_ERROR and nullptr, having inflated little more than maxLength.
+   */
+  std::unique_ptr<folly::IOBuf> decompress(
+    const folly::IOBuf* in,
+    size_t maxLength = std::numeric_limits<size_t>::max());
 
   int getStatus() { return status_; }
 
@@ -55,7 +62,7 @@ class ZlibStreamDecompressor {
 
  private:
   ZlibCompressionType type_{ZlibCompressionType::NONE};
-  z_stream zlibStream_;
+  ZlibStreamPool::StreamPtr zlibStream_;
   int status_{-1};
 };
 
@@ -0,0 +1,292 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/utils/ZlibStreamPool.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <folly/ThreadLocal.h>
+#include <glog/logging.h>
+#include <map>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+namespace proxygen {
+
+namespace {
+
+struct StreamConfig {
+  bool operator<(const StreamConfig& other) const {
+    return std::tie(deflate, level, windowBits, memLevel, strategy, dict,
+                    dictSize) <
+      std::tie(other.deflate, other.level, other.windowBits, other.memLevel,
+               other.strategy, other.dict, other.dictSize);
+  }
+
+  bool deflate;
+  int level;
+  int windowBits;
+  int memLevel;
+  int strategy;
+  // preset dictionary of primed deflaters
+  const unsigned char* dict;
+  size_t dictSize;
+};
+
+struct PooledStream {
+  // First, so that the z_stream handed out is also the PooledStream
+  z_stream stream;
+  StreamConfig config;
+  // Allocated by zlib for this stream
+  size_t bytes;
+};
+
+static_assert(std::is_standard_layout<PooledStream>::value,
+              "PooledStream must be castable from its z_stream");
+
+// Keeps the blocks as aligned as malloc() does
+const size_t kAllocHeaderSize = 16;
+
+std::atomic<size_t> s_totalBytes{0};
+std::atomic<size_t> s_maxIdle{16};
+
+voidpf poolAlloc(voidpf opaque, uInt items, uInt size) {
+  size_t bytes = size_t(items) * size;
+  auto block = static_cast<char*>(malloc(bytes + kAllocHeaderSize));
+  if (!block) {
+    return Z_NULL;
+  }
+  *reinterpret_cast<size_t*>(block) = bytes;
+  static_cast<PooledStream*>(opaque)->bytes += bytes;
+  s_totalBytes += bytes;
+  return block + kAllocHeaderSize;
+}
+
+void poolFree(voidpf opaque, voidpf address) {
+  auto block = static_cast<char*>(address) - kAllocHeaderSize;
+  size_t bytes = *reinterpret_cast<size_t*>(block);
+  static_cast<PooledStream*>(opaque)->bytes -= bytes;
+  s_totalBytes -= bytes;
+  free(block);
+}
+
+void endStream(PooledStream* pooled) {
+  if (pooled->config.deflate) {
+    deflateEnd(&pooled->stream);
+  } else {
+    inflateEnd(&pooled->stream);
+  }
+  DCHECK_EQ(pooled->bytes, 0);
+  delete pooled;
+}
+
+class IdleStreams {
+ public:
+  ~IdleStreams() {
+    clear();
+  }
+
+  // The primed stream the streams of config are copied from
+  PooledStream*& primed(const StreamConfig& config) {
+    return primed_[config];
+  }
+
+  PooledStream* get(const StreamConfig& config) {
+    auto it = streams_.find(config);
+    if (it == streams_.end() || it->second.empty()) {
+      return nullptr;
+    }
+    auto pooled = it->second.back();
+    it->second.pop_back();
+    numIdle_--;
+    return pooled;
+  }
+
+  void put(PooledStream* pooled) {
+    auto& idle = streams_[pooled->config];
+    if (idle.size() >= s_maxIdle) {
+      endStream(pooled);
+      return;
+    }
+    idle.push_back(pooled);
+    numIdle_++;
+  }
+
+  size_t size() const {
+    return numIdle_;
+  }
+
+  void clear() {
+    for (auto& it: streams_) {
+      for (auto pooled: it.second) {
+        endStream(pooled);
+      }
+    }
+    streams_.clear();
+    numIdle_ = 0;
+    for (auto& it: primed_) {
+      if (it.second) {
+        endStream(it.second);
+      }
+    }
+    primed_.clear();
+  }
+
+ private:
+  std::map<StreamConfig, std::vector<PooledStream*>> streams_;
+  std::map<StreamConfig, PooledStream*> primed_;
+  size_t numIdle_{0};
+};
+
+// Leaked, so that streams can still be released during static destruction
+folly::ThreadLocal<IdleStreams>& idleStreams() {
+  static auto idle = new folly::ThreadLocal<IdleStreams>();
+  return *idle;
+}
+
+PooledStream* newStream(const StreamConfig& config) {
+  auto pooled = new PooledStream;
+  memset(&pooled->stream, 0, sizeof(pooled->stream));
+  pooled->stream.zalloc = poolAlloc;
+  pooled->stream.zfree = poolFree;
+  pooled->stream.opaque = pooled;
+  pooled->config = config;
+  pooled->bytes = 0;
+  return pooled;
+}
+
+PooledStream* initStream(const StreamConfig& config) {
+  auto pooled = newStream(config);
+  int r;
+  if (config.deflate) {
+    r = deflateInit2(&pooled->stream, config.level, Z_DEFLATED,
+                     config.windowBits, config.memLevel, config.strategy);
+    if (r == Z_OK && config.dict) {
+      r = deflateSetDictionary(&pooled->stream, config.dict, config.dictSize);
+      if (r != Z_OK) {
+        deflateEnd(&pooled->stream);
+      }
+    }
+  } else {
+    r = inflateInit2(&pooled->stream, config.windowBits);
+  }
+  if (r != Z_OK) {
+    LOG(ERROR) << "error initializing zlib stream. r=" << r;
+    delete pooled;
+    return nullptr;
+  }
+  return pooled;
+}
+
+PooledStream* copyPrimedStream(const StreamConfig& config) {
+  auto& primed = idleStreams()->primed(config);
+  if (!primed) {
+    primed = initStream(config);
+    if (!primed) {
+      return nullptr;
+    }
+  }
+  auto pooled = newStream(config);
+  // deflateCopy() copies the zalloc opaque of primed too, so the copy is
+  // counted there until it is handed over
+  size_t primedBytes = primed->bytes;
+  int r = deflateCopy(&pooled->stream, &primed->stream);
+  pooled->stream.opaque = pooled;
+  pooled->bytes = primed->bytes - primedBytes;
+  primed->bytes = primedBytes;
+  if (r != Z_OK) {
+    LOG(ERROR) << "error copying zlib stream. r=" << r;
+    DCHECK_EQ(pooled->bytes, 0);
+    delete pooled;
+    return nullptr;
+  }
+  return pooled;
+}
+
+ZlibStreamPool::StreamPtr getStream(const StreamConfig& config) {
+  auto pooled = idleStreams()->get(config);
+  if (!pooled) {
+    pooled = config.dict ? copyPrimedStream(config) : initStream(config);
+  }
+  if (!pooled) {
+    return nullptr;
+  }
+  return ZlibStreamPool::StreamPtr(&pooled->stream);
+}
+
+}
+
+void ZlibStreamPool::Release::operator()(z_stream* stream) const {
+  auto pooled = reinterpret_cast<PooledStream*>(stream);
+  if (pooled->config.dict) {
+    endStream(pooled);
+    return;
+  }
+  // inflateReset() would keep the window size the last stream's header
+  // set, where a window size of 0 is to take it from every stream's header
+  int r = pooled->config.deflate ?
+    deflateReset(stream) :
+    inflateReset2(stream, pooled->config.windowBits);
+  if (r != Z_OK) {
+    endStream(pooled);
+    return;
+  }
+  stream->next_in = Z_NULL;
+  stream->avail_in = 0;
+  stream->next_out = Z_NULL;
+  stream->avail_out = 0;
+  idleStreams()->put(pooled);
+}
+
+ZlibStreamPool::StreamPtr ZlibStreamPool::getDeflater(int level,
+                                                      int windowBits,
+                                                      int memLevel,
+                                                      int strategy) {
+  return getStream(StreamConfig{true, level, windowBits, memLevel, strategy,
+                                nullptr, 0});
+}
+
+ZlibStreamPool::StreamPtr ZlibStreamPool::getPrimedDeflater(
+    int level,
+    int windowBits,
+    int memLevel,
+    const unsigned char* dict,
+    size_t dictSize) {
+  CHECK(dict);
+  return getStream(StreamConfig{true, level, windowBits, memLevel,
+                                Z_DEFAULT_STRATEGY, dict, dictSize});
+}
+
+ZlibStreamPool::StreamPtr ZlibStreamPool::getInflater(int windowBits) {
+  return getStream(StreamConfig{false, 0, windowBits, 0, 0, nullptr, 0});
+}
+
+size_t ZlibStreamPool::getAllocatedBytes(const z_stream* stream) {
+  return reinterpret_cast<const PooledStream*>(stream)->bytes;
+}
+
+size_t ZlibStreamPool::getTotalAllocatedBytes() {
+  return s_totalBytes;
+}
+
+void ZlibStreamPool::setMaxIdleStreams(size_t maxIdle) {
+  s_maxIdle = maxIdle;
+}
+
+size_t ZlibStreamPool::getNumIdleStreams() {
+  return idleStreams()->size();
+}
+
+void ZlibStreamPool::clear() {
+  idleStreams()->clear();
+}
+
+}
@@ -0,0 +1,83 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <memory>
+#include <zlib.h>
+
+namespace proxygen {
+
+/**
+ * Per-thread pools of initialized zlib streams. Setting up a stream costs
+ * an allocation of its whole state (about 256 KB for a deflate stream with
+ * the default window and memLevel), so streams released here are reset and
+ * kept for the next user asking for the same parameters in the same
+ * thread, instead of being freed.
+ *
+ * Pooled streams allocate through zalloc/zfree hooks that account for the
+ * bytes each of them holds. A stream may be released in a thread other
+ * than the one it came from; it then joins that thread's pool.
+ *
+ * Deflaters primed with a preset dictionary are copies, by deflateCopy(),
+ * of a stream that ingested the dictionary once per thread. They are freed
+ * when released, since resetting them would drop the dictionary.
+ */
+class ZlibStreamPool {
+ public:
+  class Release {
+   public:
+    void operator()(z_stream* stream) const;
+  };
+
+  // Back to the pool of the current thread when destroyed
+  typedef std::unique_ptr<z_stream, Release> StreamPtr;
+
+  /**
+   * A deflate stream as if just set up by deflateInit2() with these
+   * parameters, or nullptr if that failed.
+   */
+  static StreamPtr getDeflater(int level,
+                               int windowBits,
+                               int memLevel,
+                               int strategy = Z_DEFAULT_STRATEGY);
+
+  /**
+   * Same as getDeflater(), followed by deflateSetDictionary() with dict,
+   * which has to stay valid for as long as the pool is used.
+   */
+  static StreamPtr getPrimedDeflater(int level,
+                                     int windowBits,
+                                     int memLevel,
+                                     const unsigned char* dict,
+                                     size_t dictSize);
+
+  /**
+   * An inflate stream as if just set up by inflateInit2(), or nullptr if
+   * that failed.
+   */
+  static StreamPtr getInflater(int windowBits);
+
+  // The bytes allocated by zlib for stream, which must come from the pool
+  static size_t getAllocatedBytes(const z_stream* stream);
+
+  // The bytes allocated by zlib by all the pooled streams, in use or idle
+  static size_t getTotalAllocatedBytes();
+
+  // Idle streams kept per thread for each set of parameters
+  static void setMaxIdleStreams(size_t maxIdle);
+
+  // The idle streams in the pool of the current thread
+  static size_t getNumIdleStreams();
+
+  // Free the idle and primed streams of the current thread
+  static void clear();
+};
+
+}
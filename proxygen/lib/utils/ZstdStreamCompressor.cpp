@@ -0,0 +1,94 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <proxygen/lib/utils/ZstdStreamCompressor.h>
+
+#include <folly/io/Cursor.h>
+#include <glog/logging.h>
+#include <zstd.h>
+
+using folly::IOBuf;
+using std::unique_ptr;
+
+namespace {
+
+// Leaves room for the IOBuf bookkeeping in a page, as ZlibStreamCompressor
+const size_t kOutputChunkSize = 4000;
+
+}
+
+namespace proxygen {
+
+ZstdStreamCompressor::ZstdStreamCompressor(int level)
+    : cctx_(ZSTD_createCCtx()) {
+  if (!cctx_) {
+    LOG(ERROR) << "error creating zstd context";
+    error_ = true;
+    return;
+  }
+  auto r = ZSTD_CCtx_setParameter(cctx_, ZSTD_c_compressionLevel, level);
+  if (ZSTD_isError(r)) {
+    LOG(ERROR) << "invalid zstd compression level " << level << ": "
+               << ZSTD_getErrorName(r);
+    error_ = true;
+  }
+}
+
+ZstdStreamCompressor::~ZstdStreamCompressor() {
+  ZSTD_freeCCtx(cctx_);
+}
+
+unique_ptr<IOBuf> ZstdStreamCompressor::compress(const IOBuf* in,
+                                                 bool trailer) {
+  if (error_) {
+    return nullptr;
+  }
+
+  auto out = IOBuf::create(kOutputChunkSize);
+  folly::io::Appender appender(out.get(), kOutputChunkSize);
+
+  // Feed the context one buffer of the chain with mode, and collect all
+  // the output that is ready
+  auto run = [&] (ZSTD_EndDirective mode, const uint8_t* data,
+                  size_t length) {
+    ZSTD_inBuffer input{data, length, 0};
+    size_t remaining;
+    do {
+      appender.ensure(kOutputChunkSize);
+      ZSTD_outBuffer output{appender.writableData(), kOutputChunkSize, 0};
+      remaining = ZSTD_compressStream2(cctx_, &output, &input, mode);
+      if (ZSTD_isError(remaining)) {
+        LOG(ERROR) << "error compressing buffer with zstd: "
+                   << ZSTD_getErrorName(remaining);
+        return false;
+      }
+      appender.append(output.pos);
+    } while (mode == ZSTD_e_continue ? input.pos < input.size
+                                     : remaining != 0);
+    return true;
+  };
+
+  const IOBuf* crtBuf = in;
+  do {
+    if (crtBuf->length() > 0 &&
+        !run(ZSTD_e_continue, crtBuf->data(), crtBuf->length())) {
+      error_ = true;
+      return nullptr;
+    }
+    crtBuf = crtBuf->next();
+  } while (crtBuf != in);
+
+  if (!run(trailer ? ZSTD_e_end : ZSTD_e_flush, nullptr, 0)) {
+    error_ = true;
+    return nullptr;
+  }
+  return out;
+}
+
+}
@@ -0,0 +1,40 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <proxygen/lib/utils/StreamCompressor.h>
+
+struct ZSTD_CCtx_s;
+
+namespace proxygen {
+
+/**
+ * Zstandard ("zstd") compression. Only built when proxygen is configured
+ * with libzstd.
+ */
+class ZstdStreamCompressor : public StreamCompressor {
+ public:
+  // level goes from 1 (fastest) to 19 (smallest output)
+  explicit ZstdStreamCompressor(int level);
+
+  ~ZstdStreamCompressor() override;
+
+  // Each call but the last flushes the output, as ZlibStreamCompressor does
+  std::unique_ptr<folly::IOBuf> compress(const folly::IOBuf* in,
+                                         bool trailer = true) override;
+
+  bool hasError() override { return error_; }
+
+ private:
+  ZSTD_CCtx_s* cctx_;
+  bool error_{false};
+};
+
+}
@@ -0,0 +1,86 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <gtest/gtest.h>
+#include <memory>
+#include <proxygen/lib/utils/AllocStats.h>
+
+using namespace proxygen;
+
+#if PROXYGEN_ALLOC_STATS
+
+TEST(AllocStatsTest, ScopeCharged) {
+  AllocCounts counts;
+  auto before = getThreadAllocCounts();
+  {
+    AllocStatsScope scope(counts);
+    std::unique_ptr<uint64_t> p(new uint64_t(1));
+    countIOBufClones();
+    countHeaderCopies(2);
+  }
+  EXPECT_EQ(counts.allocations, 1);
+  EXPECT_EQ(counts.allocatedBytes, sizeof(uint64_t));
+  EXPECT_EQ(counts.iobufClones, 1);
+  EXPECT_EQ(counts.headerCopies, 2);
+  // The thread totals count it too
+  EXPECT_EQ(getThreadAllocCounts().iobufClones - before.iobufClones, 1);
+  EXPECT_EQ(getThreadAllocCounts().headerCopies - before.headerCopies, 2);
+
+  // and only the scope's lifetime is charged to it
+  std::unique_ptr<uint64_t> p(new uint64_t(2));
+  EXPECT_EQ(counts.allocations, 1);
+}
+
+TEST(AllocStatsTest, Nested) {
+  AllocCounts outer;
+  AllocCounts inner;
+  {
+    AllocStatsScope outerScope(outer);
+    countIOBufClones();
+    {
+      AllocStatsScope innerScope(inner);
+      countIOBufClones(3);
+    }
+    countIOBufClones();
+  }
+  EXPECT_EQ(outer.iobufClones, 2);
+  EXPECT_EQ(inner.iobufClones, 3);
+}
+
+#else
+
+TEST(AllocStatsTest, Disabled) {
+  AllocCounts counts;
+  {
+    AllocStatsScope scope(counts);
+    std::unique_ptr<uint64_t> p(new uint64_t(1));
+    countIOBufClones();
+    countHeaderCopies();
+  }
+  EXPECT_EQ(counts.allocations, 0);
+  EXPECT_EQ(counts.iobufClones, 0);
+  EXPECT_EQ(counts.headerCopies, 0);
+  EXPECT_EQ(getThreadAllocCounts().allocations, 0);
+}
+
+#endif
+
+TEST(AllocStatsTest, Add) {
+  AllocCounts a;
+  a.allocations = 1;
+  a.headerCopies = 2;
+  AllocCounts b;
+  b.allocations = 3;
+  b.iobufClones = 4;
+  a += b;
+  EXPECT_EQ(a.allocations, 4);
+  EXPECT_EQ(a.allocatedBytes, 0);
+  EXPECT_EQ(a.iobufClones, 4);
+  EXPECT_EQ(a.headerCopies, 2);
+}
@@ -0,0 +1,202 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/Benchmark.h>
+#include <folly/io/async/EventBase.h>
+#include <proxygen/lib/utils/AsyncTimeoutSet.h>
+#include <proxygen/lib/utils/Time.h>
+#include <vector>
+
+using namespace folly;
+using namespace proxygen;
+using std::chrono::milliseconds;
+using std::vector;
+
+namespace {
+
+const uint32_t kNumIntervals = 64;
+
+/**
+ * The sorted list AsyncTimeoutSet used before the timing wheel, reduced to
+ * scheduling and cancelling: one list per interval, with the AsyncTimeout
+ * re-armed whenever the head of the list changes.
+ */
+class ListTimeoutSet : private AsyncTimeout {
+ public:
+  struct Callback {
+    ListTimeoutSet* set{nullptr};
+    Callback* prev{nullptr};
+    Callback* next{nullptr};
+    milliseconds expiration{0};
+  };
+
+  ListTimeoutSet(EventBase* evb, milliseconds interval)
+      : AsyncTimeout(evb),
+        interval_(interval) {}
+
+  void scheduleTimeout(Callback* cb) {
+    if (cb->set) {
+      cb->set->cancelTimeout(cb);
+    }
+    cb->set = this;
+    cb->expiration = millisecondsSinceEpoch() + interval_;
+    cb->prev = tail_;
+    if (tail_) {
+      tail_->next = cb;
+    } else {
+      head_ = cb;
+      AsyncTimeout::scheduleTimeout(interval_.count());
+    }
+    tail_ = cb;
+  }
+
+  void cancelTimeout(Callback* cb) {
+    if (cb->next) {
+      cb->next->prev = cb->prev;
+    } else {
+      tail_ = cb->prev;
+    }
+    if (cb->prev) {
+      cb->prev->next = cb->next;
+    } else {
+      head_ = cb->next;
+      headChanged();
+    }
+    cb->set = nullptr;
+    cb->prev = cb->next = nullptr;
+  }
+
+ private:
+  void headChanged() {
+    if (!head_) {
+      AsyncTimeout::cancelTimeout();
+    } else {
+      auto now = millisecondsSinceEpoch();
+      auto delta = head_->expiration > now ?
+        head_->expiration - now : milliseconds(0);
+      AsyncTimeout::scheduleTimeout(delta.count());
+    }
+  }
+
+  void timeoutExpired() noexcept override {}
+
+  milliseconds interval_;
+  Callback* head_{nullptr};
+  Callback* tail_{nullptr};
+};
+
+class NoopTimeout : public AsyncTimeoutSet::Callback {
+ public:
+  void timeoutExpired() noexcept override {}
+};
+
+/**
+ * Idle timeouts for many keepalive connections, each refreshed on activity.
+ * The least recently active connection is always the one refreshed, which
+ * is the head of the list every time.
+ */
+void listRefresh(unsigned iters, uint32_t numConns) {
+  EventBase evb;
+  ListTimeoutSet set(&evb, milliseconds(60000));
+  vector<ListTimeoutSet::Callback> conns(numConns);
+  BENCHMARK_SUSPEND {
+    for (auto& conn: conns) {
+      set.scheduleTimeout(&conn);
+    }
+  }
+  for (unsigned i = 0; i < iters; ++i) {
+    set.scheduleTimeout(&conns[i % numConns]);
+  }
+  BENCHMARK_SUSPEND {
+    for (auto& conn: conns) {
+      set.cancelTimeout(&conn);
+    }
+  }
+}
+
+void wheelRefresh(unsigned iters, uint32_t numConns) {
+  EventBase evb;
+  AsyncTimeoutSet::UniquePtr set(
+    new AsyncTimeoutSet(&evb, milliseconds(60000)));
+  vector<NoopTimeout> conns(numConns);
+  BENCHMARK_SUSPEND {
+    for (auto& conn: conns) {
+      set->scheduleTimeout(&conn);
+    }
+  }
+  for (unsigned i = 0; i < iters; ++i) {
+    set->scheduleTimeout(&conns[i % numConns]);
+  }
+  BENCHMARK_SUSPEND {
+    set.reset();
+  }
+}
+
+/**
+ * Timeouts spread over many distinct intervals: the list needs a set, and
+ * an AsyncTimeout, per interval, where the wheel takes them all in one.
+ */
+void listIntervals(unsigned iters, uint32_t numConns) {
+  EventBase evb;
+  vector<std::unique_ptr<ListTimeoutSet>> sets;
+  vector<ListTimeoutSet::Callback> conns(numConns);
+  BENCHMARK_SUSPEND {
+    for (uint32_t i = 0; i < kNumIntervals; i++) {
+      sets.emplace_back(new ListTimeoutSet(&evb, milliseconds(1000 * (i + 1))));
+    }
+    for (uint32_t i = 0; i < numConns; i++) {
+      sets[i % kNumIntervals]->scheduleTimeout(&conns[i]);
+    }
+  }
+  for (unsigned i = 0; i < iters; ++i) {
+    sets[i % kNumIntervals]->scheduleTimeout(&conns[i % numConns]);
+  }
+  BENCHMARK_SUSPEND {
+    for (auto& conn: conns) {
+      conn.set->cancelTimeout(&conn);
+    }
+  }
+}
+
+void wheelIntervals(unsigned iters, uint32_t numConns) {
+  EventBase evb;
+  AsyncTimeoutSet::UniquePtr set(
+    new AsyncTimeoutSet(&evb, milliseconds(1000)));
+  vector<NoopTimeout> conns(numConns);
+  BENCHMARK_SUSPEND {
+    for (uint32_t i = 0; i < numConns; i++) {
+      set->scheduleTimeout(&conns[i],
+                           milliseconds(1000 * (i % kNumIntervals + 1)));
+    }
+  }
+  for (unsigned i = 0; i < iters; ++i) {
+    set->scheduleTimeout(&conns[i % numConns],
+                         milliseconds(1000 * (i % kNumIntervals + 1)));
+  }
+  BENCHMARK_SUSPEND {
+    set.reset();
+  }
+}
+
+}
+
+BENCHMARK_PARAM(listRefresh, 10000)
+BENCHMARK_RELATIVE_PARAM(wheelRefresh, 10000)
+BENCHMARK_PARAM(listRefresh, 500000)
+BENCHMARK_RELATIVE_PARAM(wheelRefresh, 500000)
+BENCHMARK_DRAW_LINE();
+BENCHMARK_PARAM(listIntervals, 10000)
+BENCHMARK_RELATIVE_PARAM(wheelIntervals, 10000)
+BENCHMARK_PARAM(listIntervals, 500000)
+BENCHMARK_RELATIVE_PARAM(wheelIntervals, 500000)
+
+int main(int argc, char* argv[]) {
+  folly::runBenchmarks();
+  return 0;
+}
@@ -14,6 +14,7 @@
 #include <proxygen/lib/utils/AsyncTimeoutSet.h>
 #include <proxygen/lib/utils/test/MockTimeoutManager.h>
 #include <boost/container/flat_map.hpp>
+#include <random>
 #include <vector>
 
 
@@ -405,3 +406,179 @@ TEST_F(TimeoutTest, AtMostEveryN) {
   ASSERT_LE(timeoutClock_.millisecondsSinceEpoch(),
             milliseconds(numTimeouts) + interval + atMostEveryN);
 }
+
+/*
+ * Test timeouts far enough out to be kept in the outer wheels, scheduled
+ * with their own intervals on one set.
+ */
+TEST_F(TimeoutTest, Cascade) {
+  StackTimeoutSet ts10(&timeoutManager_, milliseconds(10), milliseconds(0),
+                       &timeoutClock_);
+
+  TestTimeout t10;
+  TestTimeout t300;
+  TestTimeout t70000;
+  ts10.scheduleTimeout(&t10);
+  ts10.scheduleTimeout(&t300, milliseconds(300));
+  ts10.scheduleTimeout(&t70000, milliseconds(70000));
+  ASSERT_EQ(ts10.size(), 3);
+  ASSERT_EQ(ts10.front(), &t10);
+
+  setClock(milliseconds(10));
+  ASSERT_EQ(t10.timestamps.size(), 1);
+  ASSERT_EQ(ts10.front(), &t300);
+
+  setClock(milliseconds(299));
+  ASSERT_EQ(t300.timestamps.size(), 0);
+  setClock(milliseconds(300));
+  ASSERT_EQ(t300.timestamps.size(), 1);
+  ASSERT_EQ(ts10.front(), &t70000);
+
+  setClock(milliseconds(69999));
+  ASSERT_EQ(t70000.timestamps.size(), 0);
+  setClock(milliseconds(70000));
+  ASSERT_EQ(t70000.timestamps.size(), 1);
+  ASSERT_EQ(ts10.size(), 0);
+
+  ASSERT_EQ(t10.timestamps[0], milliseconds(10));
+  ASSERT_EQ(t300.timestamps[0], milliseconds(300));
+  ASSERT_EQ(t70000.timestamps[0], milliseconds(70000));
+  ASSERT_TRUE(timeouts_.empty());
+}
+
+/*
+ * Test that timeouts due at the same time fire in the order they were
+ * scheduled, even when the earlier one is cascaded from an outer wheel
+ * after the later one went straight into the inner wheel.
+ */
+TEST_F(TimeoutTest, SameExpirationOrder) {
+  StackTimeoutSet ts(&timeoutManager_, milliseconds(10), milliseconds(0),
+                     &timeoutClock_);
+  std::vector<TestTimeout*> fired;
+
+  TestTimeout tA;
+  TestTimeout tB;
+  TestTimeout tC;
+  TestTimeout wakeup;
+  tA.fn = [&] { fired.push_back(&tA); };
+  tB.fn = [&] { fired.push_back(&tB); };
+  tC.fn = [&] { fired.push_back(&tC); };
+
+  ts.scheduleTimeout(&tA, milliseconds(1000));
+  // Bring the wheel up to 750ms so tB is due within the inner wheel
+  ts.scheduleTimeout(&wakeup, milliseconds(750));
+  setClock(milliseconds(750));
+  setClock(milliseconds(760));
+  ts.scheduleTimeout(&tB, milliseconds(240));
+  setClock(milliseconds(990));
+  ts.scheduleTimeout(&tC, milliseconds(10));
+
+  setClock(milliseconds(999));
+  ASSERT_TRUE(fired.empty());
+  setClock(milliseconds(1000));
+  ASSERT_EQ(fired, std::vector<TestTimeout*>({&tA, &tB, &tC}));
+}
+
+/*
+ * Test that refreshing a lazy callback only pushes back its deadline, and
+ * that it fires at that deadline, including after being cascaded.
+ */
+TEST_F(TimeoutTest, LazyRefresh) {
+  StackTimeoutSet ts10(&timeoutManager_, milliseconds(10), milliseconds(0),
+                       &timeoutClock_);
+
+  TestTimeout t1;
+  TestTimeout t2;
+  t1.setLazyRefresh(true);
+  t2.setLazyRefresh(true);
+  ts10.scheduleTimeout(&t1);
+  ts10.scheduleTimeout(&t2, milliseconds(300));
+
+  setClock(milliseconds(3));
+  ts10.scheduleTimeout(&t1);
+  setClock(milliseconds(8));
+  ts10.scheduleTimeout(&t1);
+  // Still armed for the original expiration
+  ASSERT_EQ(timeouts_.begin()->first, milliseconds(10));
+
+  setClock(milliseconds(10));
+  ASSERT_EQ(t1.timestamps.size(), 0);
+  ASSERT_EQ(ts10.size(), 2);
+  setClock(milliseconds(17));
+  ASSERT_EQ(t1.timestamps.size(), 0);
+  setClock(milliseconds(18));
+  ASSERT_EQ(t1.timestamps.size(), 1);
+  ASSERT_EQ(t1.timestamps[0], milliseconds(18));
+
+  // The latest refresh wins, even if it is sooner than the one before
+  setClock(milliseconds(200));
+  ts10.scheduleTimeout(&t2, milliseconds(400));
+  ts10.scheduleTimeout(&t2, milliseconds(300));
+  setClock(milliseconds(300));
+  ASSERT_EQ(t2.timestamps.size(), 0);
+  setClock(milliseconds(499));
+  ASSERT_EQ(t2.timestamps.size(), 0);
+  setClock(milliseconds(500));
+  ASSERT_EQ(t2.timestamps.size(), 1);
+  ASSERT_EQ(t2.timestamps[0], milliseconds(500));
+  ASSERT_EQ(ts10.size(), 0);
+
+  // Sooner than its expiration is a real reschedule
+  ts10.scheduleTimeout(&t1, milliseconds(100));
+  setClock(milliseconds(510));
+  ts10.scheduleTimeout(&t1, milliseconds(5));
+  ASSERT_EQ(timeouts_.begin()->first, milliseconds(515));
+  setClock(milliseconds(515));
+  ASSERT_EQ(t1.timestamps.size(), 2);
+  ASSERT_EQ(t1.timestamps[1], milliseconds(515));
+}
+
+/*
+ * Test many timeouts with random intervals, cancels and reschedules against
+ * a clock that moves in uneven steps.
+ */
+TEST_F(TimeoutTest, RandomIntervals) {
+  StackTimeoutSet ts(&timeoutManager_, milliseconds(10), milliseconds(0),
+                     &timeoutClock_);
+  std::mt19937 rng(1);
+  const uint32_t kNumTimeouts = 1000;
+  const uint32_t kMaxStep = 50;
+  std::vector<TestTimeout> timeouts(kNumTimeouts);
+  std::vector<milliseconds> expirations(kNumTimeouts);
+
+  auto schedule = [&] (uint32_t i) {
+    milliseconds interval(rng() % 200000);
+    expirations[i] = timeoutClock_.millisecondsSinceEpoch() + interval;
+    ts.scheduleTimeout(&timeouts[i], interval);
+  };
+  for (uint32_t i = 0; i < kNumTimeouts; i++) {
+    schedule(i);
+  }
+
+  milliseconds now(0);
+  while (ts.size() > 0) {
+    now += milliseconds(1 + rng() % kMaxStep);
+    setClock(now);
+    // Occasionally cancel or push back a pending timeout
+    uint32_t i = rng() % kNumTimeouts;
+    if (timeouts[i].isScheduled()) {
+      if (rng() % 2) {
+        timeouts[i].cancelTimeout();
+        expirations[i] = milliseconds(0);
+      } else {
+        schedule(i);
+      }
+    }
+  }
+
+  for (uint32_t i = 0; i < kNumTimeouts; i++) {
+    if (expirations[i] == milliseconds(0)) {
+      ASSERT_EQ(timeouts[i].timestamps.size(), 0);
+      continue;
+    }
+    ASSERT_EQ(timeouts[i].timestamps.size(), 1);
+    auto fired = timeouts[i].timestamps[0];
+    ASSERT_GE(fired, expirations[i]);
+    ASSERT_LT(fired, expirations[i] + milliseconds(kMaxStep));
+  }
+}
@@ -0,0 +1,118 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/Benchmark.h>
+#include <iomanip>
+#include <openssl/bio.h>
+#include <openssl/buffer.h>
+#include <openssl/evp.h>
+#include <openssl/md5.h>
+#include <proxygen/lib/utils/CryptUtil.h>
+#include <sstream>
+
+using namespace folly;
+using namespace proxygen;
+
+namespace {
+
+// About the size of a signed URL's signature input, or an ETag's
+const std::string kText(
+  "/static/images/f5c4a3b2d1e0.png?expires=1434626470&key=frontend");
+
+ByteRange text() {
+  return ByteRange((const unsigned char*)kText.data(), kText.size());
+}
+
+// What base64Encode() used to do
+std::string base64WithBIO(ByteRange text) {
+  std::string result;
+  BIO* b64 = BIO_new(BIO_f_base64());
+  BIO* bmem = BIO_new(BIO_s_mem());
+  BIO* chain = BIO_push(b64, bmem);
+  BIO_set_flags(chain, BIO_FLAGS_BASE64_NO_NL);
+  BIO_write(chain, text.begin(), text.size());
+  if (BIO_flush(chain) == 1) {
+    BUF_MEM* bptr;
+    BIO_get_mem_ptr(chain, &bptr);
+    result = std::string((char*)bptr->data, bptr->length);
+  }
+  BIO_free_all(chain);
+  return result;
+}
+
+// What md5Encode() used to do
+std::string md5WithStream(ByteRange text) {
+  unsigned char digest[MD5_DIGEST_LENGTH];
+  MD5(text.begin(), text.size(), digest);
+  std::ostringstream ss;
+  ss << std::hex << std::setfill('0');
+  for (int i = 0; i < MD5_DIGEST_LENGTH; i++) {
+    ss << std::setw(2) << (unsigned int)digest[i];
+  }
+  return ss.str();
+}
+
+}
+
+BENCHMARK(base64_bio, numIters) {
+  for (unsigned i = 0; i < numIters; ++i) {
+    doNotOptimizeAway(base64WithBIO(text()).size());
+  }
+}
+
+BENCHMARK_RELATIVE(base64_encode, numIters) {
+  for (unsigned i = 0; i < numIters; ++i) {
+    doNotOptimizeAway(base64Encode(text()).size());
+  }
+}
+
+BENCHMARK_RELATIVE(base64_url_encode, numIters) {
+  for (unsigned i = 0; i < numIters; ++i) {
+    doNotOptimizeAway(base64UrlEncode(text()).size());
+  }
+}
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK(base64_decode, numIters) {
+  std::string encoded;
+  std::string out;
+  BENCHMARK_SUSPEND {
+    encoded = base64Encode(text());
+  }
+  for (unsigned i = 0; i < numIters; ++i) {
+    doNotOptimizeAway(base64Decode(encoded, out));
+  }
+}
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK(md5_stream, numIters) {
+  for (unsigned i = 0; i < numIters; ++i) {
+    doNotOptimizeAway(md5WithStream(text()).size());
+  }
+}
+
+BENCHMARK_RELATIVE(md5_encode, numIters) {
+  for (unsigned i = 0; i < numIters; ++i) {
+    doNotOptimizeAway(md5Encode(text()).size());
+  }
+}
+
+BENCHMARK_RELATIVE(md5_digest, numIters) {
+  uint8_t out[kMaxDigestLength];
+  for (unsigned i = 0; i < numIters; ++i) {
+    doNotOptimizeAway(digest(DigestType::MD5, text(), out));
+  }
+}
+
+int main(int argc, char* argv[]) {
+  folly::runBenchmarks();
+  return 0;
+}
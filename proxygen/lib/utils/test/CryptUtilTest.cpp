@@ -46,3 +46,38 @@ TEST(CryptUtilTest, MD5EncodeTest) {
                 reinterpret_cast<const unsigned char*>("Aladdin:open sesame"),
                 19)));
 }
+
+TEST(CryptUtilTest, Base64UrlEncodeTest) {
+  const unsigned char bytes[] = {0xfb, 0xff, 0xbf, 0x3e};
+  ASSERT_EQ("-_-_Pg", base64UrlEncode(ByteRange(bytes, sizeof(bytes))));
+  ASSERT_EQ("+/+/Pg==", base64Encode(ByteRange(bytes, sizeof(bytes))));
+}
+
+TEST(CryptUtilTest, Base64DecodeTest) {
+  std::string out;
+  ASSERT_TRUE(base64Decode("", out));
+  ASSERT_EQ("", out);
+  ASSERT_TRUE(base64Decode("QWxhZGRpbjpvcGVuIHNlc2FtZQ==", out));
+  ASSERT_EQ("Aladdin:open sesame", out);
+  ASSERT_TRUE(base64Decode("QWxhZGRpbjpvcGVuIHNlc2FtZQ", out));
+  ASSERT_EQ("Aladdin:open sesame", out);
+  ASSERT_TRUE(base64UrlDecode("-_-_Pg", out));
+  ASSERT_EQ("\xfb\xff\xbf\x3e", out);
+
+  ASSERT_FALSE(base64Decode("Y", out));
+  ASSERT_FALSE(base64Decode("YQ=", out));
+  ASSERT_FALSE(base64Decode("Y*==", out));
+  ASSERT_FALSE(base64Decode("-_-_Pg", out));
+  ASSERT_FALSE(base64UrlDecode("+/+/Pg==", out));
+}
+
+TEST(CryptUtilTest, DigestTest) {
+  uint8_t out[kMaxDigestLength];
+  auto text = ByteRange(
+    reinterpret_cast<const unsigned char*>("Aladdin:open sesame"), 19);
+  ASSERT_EQ(16, digest(DigestType::MD5, text, out));
+  ASSERT_EQ(0xa7, out[0]);
+  ASSERT_EQ(0xc7, out[15]);
+  ASSERT_EQ(20, digest(DigestType::SHA1, text, out));
+  ASSERT_EQ(32, digest(DigestType::SHA256, text, out));
+}
@@ -0,0 +1,70 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <cstdlib>
+#include <folly/FileUtil.h>
+#include <gtest/gtest.h>
+#include <proxygen/lib/utils/FileRange.h>
+#include <string>
+#include <unistd.h>
+
+using namespace proxygen;
+
+namespace {
+
+std::string toString(const folly::IOBuf& buf) {
+  std::string str;
+  for (auto range: buf) {
+    str.append(reinterpret_cast<const char*>(range.data()), range.size());
+  }
+  return str;
+}
+
+}
+
+class FileRangeTest : public testing::Test {
+ public:
+  void SetUp() override {
+    char path[] = "/tmp/FileRangeTestXXXXXX";
+    fd_ = mkstemp(path);
+    ASSERT_GE(fd_, 0);
+    unlink(path);
+    // Over a page, so that ranges start within one
+    for (int i = 0; i < 10000; i++) {
+      content_.push_back('a' + i % 26);
+    }
+    ASSERT_EQ(content_.size(),
+              folly::writeFull(fd_, content_.data(), content_.size()));
+  }
+
+  void TearDown() override {
+    folly::closeNoInt(fd_);
+  }
+
+ protected:
+  int fd_{-1};
+  std::string content_;
+};
+
+TEST_F(FileRangeTest, maps_range) {
+  auto buf = mapFileRange(fd_, 5000, 3000);
+  ASSERT_TRUE(buf);
+  EXPECT_EQ(content_.substr(5000, 3000), toString(*buf));
+}
+
+TEST_F(FileRangeTest, maps_from_page_start) {
+  auto buf = mapFileRange(fd_, 0, content_.size());
+  ASSERT_TRUE(buf);
+  EXPECT_EQ(content_, toString(*buf));
+  EXPECT_EQ(0, mapFileRange(fd_, 100, 0)->computeChainDataLength());
+}
+
+TEST_F(FileRangeTest, past_end) {
+  EXPECT_FALSE(mapFileRange(fd_, 9000, 2000));
+}
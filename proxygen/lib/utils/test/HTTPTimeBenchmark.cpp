@@ -0,0 +1,72 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <ctime>
+#include <folly/Benchmark.h>
+#include <proxygen/lib/utils/HTTPTime.h>
+
+using namespace folly;
+using namespace proxygen;
+
+namespace {
+
+const std::string kDate("Sun, 06 Nov 1994 08:49:37 GMT");
+
+// What parseHTTPDateTime() used to do for the RFC 1123 format
+int64_t parseWithStrptime(const std::string& s) {
+  struct tm tm = {0};
+  if (strptime(s.c_str(), "%a, %d %b %Y %H:%M:%S %Z", &tm) != nullptr) {
+    return timegm(&tm);
+  }
+  return 0;
+}
+
+}
+
+BENCHMARK(parse_strptime, numIters) {
+  int64_t sum = 0;
+  for (unsigned i = 0; i < numIters; ++i) {
+    sum += parseWithStrptime(kDate);
+  }
+  doNotOptimizeAway(sum);
+}
+
+BENCHMARK_RELATIVE(parse_http_date_time, numIters) {
+  int64_t sum = 0;
+  for (unsigned i = 0; i < numIters; ++i) {
+    sum += parseHTTPDateTime(kDate).value();
+  }
+  doNotOptimizeAway(sum);
+}
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK(format_strftime, numIters) {
+  char buf[64];
+  for (unsigned i = 0; i < numIters; ++i) {
+    time_t t = 784111777 + i;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S %Z", &tm);
+    doNotOptimizeAway(buf[0]);
+  }
+}
+
+BENCHMARK_RELATIVE(format_http_date_time, numIters) {
+  char buf[kHTTPDateTimeLength];
+  for (unsigned i = 0; i < numIters; ++i) {
+    formatHTTPDateTime(784111777 + i, buf);
+    doNotOptimizeAway(buf[0]);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  folly::runBenchmarks();
+  return 0;
+}
@@ -50,3 +50,31 @@ TEST(HTTPTimeTests, ReallyOldTimeTest) {
   EXPECT_LT(a, c);
   EXPECT_LT(b, c);
 }
+
+TEST(HTTPTimeTests, GMTValueTest) {
+  // The same instant in the three formats, whatever the local time zone
+  EXPECT_EQ(784111777,
+            parseHTTPDateTime("Sun, 06 Nov 1994 08:49:37 GMT").value());
+  EXPECT_EQ(784111777,
+            parseHTTPDateTime("Sunday, 06-Nov-94 08:49:37 GMT").value());
+  EXPECT_EQ(784111777,
+            parseHTTPDateTime("sun nov  6 08:49:37 1994").value());
+  EXPECT_FALSE(parseHTTPDateTime("Sun, 06 Foo 1994 08:49:37 GMT").hasValue());
+  EXPECT_FALSE(parseHTTPDateTime("Sun, 06 Nov 1994 24:49:37 GMT").hasValue());
+  EXPECT_FALSE(parseHTTPDateTime("").hasValue());
+}
+
+TEST(HTTPTimeTests, FormatTest) {
+  EXPECT_EQ("Thu, 01 Jan 1970 00:00:00 GMT", proxygen::formatHTTPDateTime(0));
+  EXPECT_EQ("Sun, 06 Nov 1994 08:49:37 GMT",
+            proxygen::formatHTTPDateTime(784111777));
+  EXPECT_EQ("Wed, 31 Dec 1969 23:59:59 GMT", proxygen::formatHTTPDateTime(-1));
+  EXPECT_EQ("Tue, 29 Feb 2000 12:00:00 GMT",
+            proxygen::formatHTTPDateTime(951825600));
+
+  for (int64_t t = -86400 * 365; t < 86400LL * 365 * 100; t += 7777777) {
+    auto formatted = proxygen::formatHTTPDateTime(t);
+    EXPECT_EQ(proxygen::kHTTPDateTimeLength, formatted.size());
+    EXPECT_EQ(t, parseHTTPDateTime(formatted).value());
+  }
+}
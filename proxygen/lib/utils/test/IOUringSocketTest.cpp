@@ -0,0 +1,233 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <fcntl.h>
+#include <folly/FileUtil.h>
+#include <folly/io/IOBufQueue.h>
+#include <functional>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <proxygen/lib/utils/IOUringSocket.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+
+using namespace folly;
+using namespace proxygen;
+
+namespace {
+
+class ReadCallback : public AsyncTransportWrapper::ReadCallback {
+ public:
+  void getReadBuffer(void** buf, size_t* len) override {
+    *buf = buf_;
+    *len = sizeof(buf_);
+  }
+
+  void readDataAvailable(size_t len) noexcept override {
+    data.append(buf_, len);
+    if (onData) {
+      onData(len);
+    }
+  }
+
+  void readEOF() noexcept override {
+    eof = true;
+  }
+
+  void readErr(const AsyncSocketException& ex) noexcept override {
+    error = true;
+  }
+
+  std::string data;
+  std::function<void(size_t)> onData;
+  bool eof{false};
+  bool error{false};
+
+ private:
+  char buf_[1000];
+};
+
+class WriteCallback : public AsyncTransportWrapper::WriteCallback {
+ public:
+  void writeSuccess() noexcept override {
+    ++successes;
+  }
+
+  void writeErr(size_t, const AsyncSocketException&) noexcept override {
+    ++errors;
+  }
+
+  size_t successes{0};
+  size_t errors{0};
+};
+
+}
+
+class IOUringSocketTest : public testing::Test {
+ public:
+  void SetUp() override {
+    context_ = IOUringContext::create(&evb_);
+    if (!context_) {
+      // the kernel or a sandbox doesn't allow io_uring; nothing to test
+      return;
+    }
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_GE(listener, 0);
+    SocketAddress addr("127.0.0.1", 0);
+    sockaddr_storage storage;
+    socklen_t len = addr.getAddress(&storage);
+    ASSERT_EQ(0, bind(listener, reinterpret_cast<sockaddr*>(&storage), len));
+    ASSERT_EQ(0, listen(listener, 1));
+    addr.setFromLocalAddress(listener);
+    len = addr.getAddress(&storage);
+
+    client_ = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_GE(client_, 0);
+    ASSERT_EQ(0, connect(client_, reinterpret_cast<sockaddr*>(&storage),
+                         len));
+    int fd = accept(listener, nullptr, nullptr);
+    ASSERT_GE(fd, 0);
+    closeNoInt(listener);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    timeval timeout{5, 0};
+    setsockopt(client_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    sock_.reset(new IOUringSocket(&evb_, fd, context_));
+  }
+
+  void TearDown() override {
+    sock_.reset();
+    if (client_ >= 0) {
+      closeNoInt(client_);
+    }
+  }
+
+  // Runs the loop until done, for up to about 5 seconds
+  bool loopUntil(std::function<bool()> done) {
+    for (int i = 0; i < 500 && !done(); i++) {
+      evb_.runAfterDelay([] {}, 10);
+      evb_.loopOnce();
+    }
+    return done();
+  }
+
+  void clientSend(const std::string& data) {
+    ASSERT_EQ(data.size(), writeFull(client_, data.data(), data.size()));
+  }
+
+  std::string clientRecv(size_t len) {
+    std::string data(len, '\0');
+    EXPECT_EQ(len, readFull(client_, &data[0], len));
+    return data;
+  }
+
+ protected:
+  EventBase evb_;
+  std::shared_ptr<IOUringContext> context_;
+  int client_{-1};
+  AsyncSocket::UniquePtr sock_;
+};
+
+TEST_F(IOUringSocketTest, echo) {
+  if (!context_) {
+    return;
+  }
+  ReadCallback rcb;
+  WriteCallback wcb;
+  rcb.onData = [&] (size_t) {
+    if (rcb.data.size() == 11) {
+      sock_->write(&wcb, rcb.data.data(), 6);
+      sock_->writeChain(&wcb, IOBuf::copyBuffer(rcb.data.substr(6)));
+    }
+  };
+  sock_->setReadCB(&rcb);
+  clientSend("hello ");
+  clientSend("world");
+  ASSERT_TRUE(loopUntil([&] { return wcb.successes == 2; }));
+  EXPECT_EQ("hello world", rcb.data);
+  EXPECT_EQ("hello world", clientRecv(11));
+  EXPECT_EQ(11, sock_->getAppBytesWritten());
+
+  shutdown(client_, SHUT_WR);
+  ASSERT_TRUE(loopUntil([&] { return rcb.eof; }));
+  EXPECT_EQ(nullptr, sock_->getReadCallback());
+  EXPECT_FALSE(rcb.error);
+  EXPECT_EQ(0, wcb.errors);
+  sock_.reset();
+}
+
+TEST_F(IOUringSocketTest, large_writes) {
+  if (!context_) {
+    return;
+  }
+  // more than the socket buffers: partial sends pick up where they stopped
+  const size_t kChunk = 256 * 1024;
+  IOBufQueue chain;
+  for (char c = 'a'; c < 'e'; c++) {
+    chain.append(IOBuf::copyBuffer(std::string(kChunk, c)));
+  }
+  std::string received;
+  std::thread reader([&] { received = clientRecv(4 * kChunk + 3); });
+  WriteCallback wcb;
+  sock_->writeChain(&wcb, chain.move());
+  iovec iov[2] = {{(void*)"x", 1}, {(void*)"yz", 2}};
+  sock_->writev(&wcb, iov, 2);
+  ASSERT_TRUE(loopUntil([&] { return wcb.successes == 2; }));
+  reader.join();
+  ASSERT_EQ(4 * kChunk + 3, received.size());
+  EXPECT_EQ(std::string(kChunk, 'a'), received.substr(0, kChunk));
+  EXPECT_EQ(std::string(kChunk, 'd'), received.substr(3 * kChunk, kChunk));
+  EXPECT_EQ("xyz", received.substr(4 * kChunk));
+  EXPECT_EQ(0, wcb.errors);
+}
+
+TEST_F(IOUringSocketTest, pause_reads) {
+  if (!context_) {
+    return;
+  }
+  ReadCallback rcb;
+  sock_->setReadCB(&rcb);
+  clientSend("first");
+  ASSERT_TRUE(loopUntil([&] { return rcb.data == "first"; }));
+
+  // What comes in while paused is kept for the next read callback
+  sock_->setReadCB(nullptr);
+  clientSend("second");
+  loopUntil([] { return false; });
+  EXPECT_EQ("first", rcb.data);
+  EXPECT_TRUE(sock_->readable());
+  sock_->setReadCB(&rcb);
+  ASSERT_TRUE(loopUntil([&] { return rcb.data == "firstsecond"; }));
+
+  // and the receive was armed again
+  clientSend("third");
+  ASSERT_TRUE(loopUntil([&] { return rcb.data == "firstsecondthird"; }));
+}
+
+TEST_F(IOUringSocketTest, close) {
+  if (!context_) {
+    return;
+  }
+  ReadCallback rcb;
+  WriteCallback wcb;
+  sock_->setReadCB(&rcb);
+  sock_->write(&wcb, "last", 4);
+  // stops reading at once, and closes once the write is out
+  sock_->close();
+  EXPECT_TRUE(rcb.eof);
+  EXPECT_FALSE(sock_->good());
+  ASSERT_TRUE(loopUntil([&] { return wcb.successes == 1; }));
+  EXPECT_EQ("last", clientRecv(4));
+  char c;
+  EXPECT_EQ(0, recv(client_, &c, 1, 0));
+
+  // and fails later writes
+  sock_->write(&wcb, "more", 4);
+  EXPECT_EQ(1, wcb.errors);
+}
@@ -0,0 +1,128 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <cmath>
+#include <folly/Conv.h>
+#include <gtest/gtest.h>
+
+#include <proxygen/lib/utils/LatencyBalancer.h>
+
+using namespace proxygen;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+
+namespace {
+
+LatencyBalancer makeBalancer(int entries,
+                             const LatencyBalancer::Options& options =
+                               LatencyBalancer::Options()) {
+  LatencyBalancer balancer(options);
+  for (int i = 0; i < entries; i++) {
+    balancer.insert(folly::to<std::string>("upstream", i), 1);
+  }
+  return balancer;
+}
+
+}
+
+// With the same costs, a key keeps going to the same entry
+TEST(LatencyBalancer, Affinity) {
+  auto balancer = makeBalancer(10);
+  TimePoint now;
+  for (int i = 0; i < 100; i++) {
+    auto key = folly::to<std::string>("key", i);
+    auto index = balancer.select(key, now);
+    balancer.onComplete(index, microseconds(500), true, now);
+    for (int j = 0; j < 5; j++) {
+      EXPECT_EQ(index, balancer.select(key, now));
+      balancer.onComplete(index, microseconds(500), true, now);
+    }
+  }
+}
+
+TEST(LatencyBalancer, SlowEntryLosesShare) {
+  auto balancer = makeBalancer(2);
+  TimePoint now;
+  size_t slow = balancer.select("warmup", now);
+  balancer.onComplete(slow, microseconds(20000), true, now);
+
+  int slowPicks = 0;
+  for (int i = 0; i < 1000; i++) {
+    now += milliseconds(1);
+    auto index = balancer.select(folly::to<std::string>(i), now);
+    slowPicks += index == slow;
+    balancer.onComplete(index, microseconds(index == slow ? 20000 : 100),
+                        true, now);
+  }
+  EXPECT_LT(slowPicks, 100);
+  EXPECT_GT(balancer.getLatency(slow, now), balancer.getLatency(1 - slow, now));
+}
+
+// Requests still in flight count against an entry
+TEST(LatencyBalancer, Outstanding) {
+  auto balancer = makeBalancer(2);
+  TimePoint now;
+  std::vector<int> picks(2, 0);
+  for (int i = 0; i < 10; i++) {
+    picks[balancer.select("key", now)]++;
+  }
+  EXPECT_EQ(5, picks[0]);
+  EXPECT_EQ(5, picks[1]);
+  EXPECT_EQ(5, balancer.getOutstanding(0));
+}
+
+TEST(LatencyBalancer, Decay) {
+  LatencyBalancer::Options options;
+  options.decayTime = milliseconds(1000);
+  auto balancer = makeBalancer(1, options);
+  TimePoint now;
+  EXPECT_EQ(1000, balancer.getLatency(0, now));
+  balancer.select("key", now);
+  balancer.onComplete(0, microseconds(5000), true, now);
+  EXPECT_EQ(5000, balancer.getLatency(0, now));
+  EXPECT_NEAR(5000 * exp(-1), balancer.getLatency(0, now + options.decayTime),
+              1);
+}
+
+TEST(LatencyBalancer, Ejection) {
+  LatencyBalancer::Options options;
+  options.ejectAfterFailures = 2;
+  options.ejectionTime = milliseconds(100);
+  auto balancer = makeBalancer(4, options);
+  TimePoint now;
+
+  auto fail = [&] (size_t index) {
+    balancer.onComplete(index, microseconds(100), false, now);
+  };
+  fail(0);
+  EXPECT_FALSE(balancer.isEjected(0, now));
+  fail(0);
+  EXPECT_TRUE(balancer.isEjected(0, now));
+  for (int i = 0; i < 100; i++) {
+    auto index = balancer.select(folly::to<std::string>(i), now);
+    EXPECT_NE(0, index);
+    balancer.onComplete(index, microseconds(100), true, now);
+  }
+
+  // No more than half of them at once
+  fail(1);
+  fail(1);
+  EXPECT_TRUE(balancer.isEjected(1, now));
+  fail(2);
+  fail(2);
+  EXPECT_FALSE(balancer.isEjected(2, now));
+
+  // Back after ejectionTime, for twice as long the next time
+  now += options.ejectionTime;
+  EXPECT_FALSE(balancer.isEjected(0, now));
+  fail(0);
+  fail(0);
+  EXPECT_TRUE(balancer.isEjected(0, now + options.ejectionTime));
+  EXPECT_FALSE(balancer.isEjected(0, now + 2 * options.ejectionTime));
+}
@@ -8,6 +8,7 @@
  *
  */
 #include <gtest/gtest.h>
+#include <memory>
 #include <proxygen/lib/utils/ParseURL.h>
 
 using proxygen::ParseURL;
@@ -136,3 +137,23 @@ TEST(ParseURL, IsHostIPAddress) {
   testHostIsIpAddress("", false);
   testHostIsIpAddress("127.0.0.1:80/foo#bar?qqq", false);
 }
+
+TEST(ParseURL, ViewsOfTheURL) {
+  // A long URL with a delimiter past the first 16 bytes
+  string url("www.facebook.com:8080/somewhat/long/path?q=1#frag");
+  std::unique_ptr<ParseURL> parsed(new ParseURL(url));
+  ParseURL copied(*parsed);
+  parsed.reset();
+
+  EXPECT_TRUE(copied.valid());
+  EXPECT_EQ("www.facebook.com", copied.host());
+  EXPECT_EQ(8080, copied.port());
+  EXPECT_EQ("/somewhat/long/path", copied.path());
+  EXPECT_EQ("q=1", copied.query());
+  EXPECT_EQ("frag", copied.fragment());
+  EXPECT_EQ(url.data(), copied.authority().data());
+  EXPECT_EQ("www.facebook.com:8080", copied.hostAndPort());
+
+  testParseURL("www.facebook.com/somewhat/long/path\x01", "", "", "", 0,
+               "", false);
+}
@@ -0,0 +1,120 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <gtest/gtest.h>
+#include <proxygen/lib/utils/ReadBufferPool.h>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+using namespace folly;
+using namespace proxygen;
+
+TEST(ReadBufferPoolTest, reuse) {
+  ReadBufferPool::clear();
+  ReadBufferPool::takeCounts();
+  auto buf = ReadBufferPool::get();
+  EXPECT_EQ(buf->length(), 0);
+  EXPECT_GE(buf->tailroom(), ReadBufferPool::getBufferSize());
+  const uint8_t* data = buf->data();
+
+  // back to the pool only once every clone is gone
+  auto clone = buf->clone();
+  buf.reset();
+  EXPECT_EQ(ReadBufferPool::getNumIdleBuffers(), 0);
+  clone.reset();
+  EXPECT_EQ(ReadBufferPool::getNumIdleBuffers(), 1);
+
+  buf = ReadBufferPool::get();
+  EXPECT_EQ(buf->data(), data);
+  EXPECT_EQ(ReadBufferPool::getNumIdleBuffers(), 0);
+  auto counts = ReadBufferPool::takeCounts();
+  EXPECT_EQ(counts.allocated, 1);
+  EXPECT_EQ(counts.reused, 1);
+
+  buf.reset();
+  ReadBufferPool::clear();
+  EXPECT_EQ(ReadBufferPool::getNumIdleBuffers(), 0);
+}
+
+TEST(ReadBufferPoolTest, max_idle) {
+  ReadBufferPool::clear();
+  ReadBufferPool::setMaxIdleBuffers(1);
+  auto first = ReadBufferPool::get();
+  auto second = ReadBufferPool::get();
+  first.reset();
+  second.reset();
+  EXPECT_EQ(ReadBufferPool::getNumIdleBuffers(), 1);
+  ReadBufferPool::setMaxIdleBuffers(64);
+  ReadBufferPool::clear();
+}
+
+TEST(ReadBufferPoolTest, reserve) {
+  ReadBufferPool::clear();
+  ReadBufferPool::takeCounts();
+  ReadBufferPool::reserve(3);
+  EXPECT_EQ(ReadBufferPool::getNumIdleBuffers(), 3);
+  EXPECT_EQ(ReadBufferPool::takeCounts().allocated, 0);
+  ReadBufferPool::clear();
+  ReadBufferPool::setMaxIdleBuffers(2);
+  ReadBufferPool::reserve(3);
+  EXPECT_EQ(ReadBufferPool::getNumIdleBuffers(), 2);
+
+  auto buf = ReadBufferPool::get();
+  EXPECT_EQ(ReadBufferPool::takeCounts().reused, 1);
+  buf.reset();
+  ReadBufferPool::setMaxIdleBuffers(64);
+  ReadBufferPool::clear();
+}
+
+TEST(ReadBufferPoolTest, buffer_size) {
+  ReadBufferPool::clear();
+  auto size = ReadBufferPool::getBufferSize();
+  auto buf = ReadBufferPool::get();
+  buf.reset();
+  // the idle buffer is too small for the new size
+  ReadBufferPool::setBufferSize(size * 2);
+  buf = ReadBufferPool::get();
+  EXPECT_GE(buf->tailroom(), size * 2);
+  EXPECT_EQ(ReadBufferPool::getNumIdleBuffers(), 0);
+  buf.reset();
+  ReadBufferPool::setBufferSize(size);
+  ReadBufferPool::clear();
+}
+
+TEST(ReadBufferPoolTest, huge_pages) {
+  ReadBufferPool::clear();
+  ReadBufferPool::setUseHugePages(true);
+  auto first = ReadBufferPool::get();
+  auto second = ReadBufferPool::get();
+  EXPECT_GE(first->tailroom(), ReadBufferPool::getBufferSize());
+  // carved next to each other from the same slab
+  EXPECT_EQ(first->data() + first->capacity(), second->data());
+  memset(first->writableTail(), 'a', first->tailroom());
+  first->append(first->tailroom());
+
+  // a slab buffer freed in another thread can be taken by this one
+  const uint8_t* data = first->data();
+  std::thread([&first] {
+    first.reset();
+    ReadBufferPool::clear();
+  }).join();
+  second.reset();
+  ReadBufferPool::clear();
+  bool found = false;
+  std::vector<std::unique_ptr<IOBuf>> bufs;
+  for (int i = 0; i < 2; i++) {
+    bufs.push_back(ReadBufferPool::get());
+    found = found || bufs.back()->data() == data;
+  }
+  EXPECT_TRUE(found);
+  bufs.clear();
+  ReadBufferPool::setUseHugePages(false);
+  ReadBufferPool::clear();
+}
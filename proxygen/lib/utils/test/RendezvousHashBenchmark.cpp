@@ -0,0 +1,78 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/Benchmark.h>
+#include <folly/Conv.h>
+#include <proxygen/lib/utils/RendezvousHash.h>
+
+using namespace proxygen;
+
+namespace {
+
+// A prime around 100 entries per slot for the largest pool
+const uint64_t kTableSize = 200003;
+
+void buildHash(RendezvousHash& hash, uint32_t numEntries) {
+  for (uint32_t i = 0; i < numEntries; ++i) {
+    hash.insert(folly::to<std::string>("backend", i), 1 + i % 4);
+  }
+}
+
+/**
+ * Scoring every entry for each lookup, as get() does without a table
+ */
+void scoredLookup(unsigned iters, uint32_t numEntries) {
+  RendezvousHash hash;
+  BENCHMARK_SUSPEND {
+    buildHash(hash, numEntries);
+  }
+  size_t sum = 0;
+  for (unsigned i = 0; i < iters; ++i) {
+    sum += hash.get(i).second;
+  }
+  folly::doNotOptimizeAway(sum);
+}
+
+void tableLookup(unsigned iters, uint32_t numEntries) {
+  RendezvousHash hash;
+  BENCHMARK_SUSPEND {
+    buildHash(hash, numEntries);
+    hash.buildLookupTable(kTableSize);
+  }
+  size_t sum = 0;
+  for (unsigned i = 0; i < iters; ++i) {
+    sum += hash.get(i).second;
+  }
+  folly::doNotOptimizeAway(sum);
+}
+
+void tableBuild(unsigned iters, uint32_t numEntries) {
+  RendezvousHash hash;
+  BENCHMARK_SUSPEND {
+    buildHash(hash, numEntries);
+  }
+  for (unsigned i = 0; i < iters; ++i) {
+    hash.buildLookupTable(kTableSize);
+  }
+}
+
+}
+
+BENCHMARK_PARAM(scoredLookup, 20)
+BENCHMARK_RELATIVE_PARAM(tableLookup, 20)
+BENCHMARK_PARAM(scoredLookup, 2000)
+BENCHMARK_RELATIVE_PARAM(tableLookup, 2000)
+BENCHMARK_DRAW_LINE();
+BENCHMARK_PARAM(tableBuild, 20)
+BENCHMARK_PARAM(tableBuild, 2000)
+
+int main(int argc, char* argv[]) {
+  folly::runBenchmarks();
+  return 0;
+}
@@ -250,3 +250,153 @@ TEST(ConsistentHashRing, DistributionAccuracy) {
     EXPECT_LE(maxError, 1.0);
   }
 }
+
+TEST(RendezvousHash, LookupTableConsistency) {
+  RendezvousHash hashes;
+  for (int i = 0; i < 10; ++i) {
+    hashes.insert(folly::to<std::string>("key", i), 1);
+  }
+  hashes.buildLookupTable();
+  EXPECT_TRUE(hashes.hasLookupTable());
+
+  std::map<std::string, size_t> mapping;
+  for (int i = 0; i < 10000; ++i) {
+    std::string s = folly::to<std::string>(i);
+    mapping[s] = hashes.get(s).second;
+  }
+
+  // the table only depends on the entries, not on when it was built
+  RendezvousHash rebuilt;
+  for (int i = 0; i < 10; ++i) {
+    rebuilt.insert(folly::to<std::string>("key", i), 1);
+  }
+  rebuilt.buildLookupTable();
+  FOR_EACH_KV (key, expected, mapping) {
+    EXPECT_EQ(expected, hashes.get(key).second);
+    EXPECT_EQ(expected, rebuilt.get(key).second);
+  }
+
+  // inserting drops the table
+  hashes.insert("key10", 1);
+  EXPECT_FALSE(hashes.hasLookupTable());
+}
+
+TEST(RendezvousHash, LookupTableWithNewNode) {
+  RendezvousHash hashes;
+  int nodes = 100;
+  for (int i = 0; i < nodes; ++i) {
+    hashes.insert(folly::to<std::string>("key", i), 1);
+  }
+  hashes.buildLookupTable();
+
+  std::map<std::string, size_t> mapping;
+  for (int i = 0; i < 100000; ++i) {
+    std::string s = folly::to<std::string>(i);
+    mapping[s] = hashes.get(s).second;
+  }
+
+  hashes.insert(folly::to<std::string>("key", nodes), 1);
+  hashes.buildLookupTable();
+
+  // about 1/101 of the traffic should go to the new node, and very little
+  // should move between the old ones
+  size_t toNewNode = 0;
+  size_t moved = 0;
+  FOR_EACH_KV (key, expected, mapping) {
+    size_t id = hashes.get(key).second;
+    if (nodes == int(id)) {
+      toNewNode++;
+    } else if (expected != id) {
+      moved++;
+    }
+  }
+  EXPECT_NEAR(toNewNode, mapping.size() / (nodes + 1), mapping.size() / 1000);
+  EXPECT_LE(moved, mapping.size() / 100);
+}
+
+TEST(RendezvousHash, LookupTableDistribution) {
+  std::vector<std::string> keys = {"ash", "bsh", "csh", "dsh", "esh"};
+  std::vector<std::vector<uint64_t>> weights = {
+    {1, 1, 1, 1, 1},
+    {1, 2, 3, 4, 5},
+    {9, 0, 3, 1, 7},
+    {1, 0, 0, 0, 0},
+    {1000, 2, 30, 4, 500},
+  };
+
+  for (auto& weight: weights) {
+    RendezvousHash hash;
+
+    FOR_EACH_RANGE (i, 0, keys.size()) {
+      hash.insert(keys[i], weight[i]);
+    }
+    hash.buildLookupTable();
+
+    std::vector<uint64_t> distribution(keys.size());
+
+    for (uint64_t i = 0; i < 21000; ++i) {
+      distribution[hash.get(i).second]++;
+    }
+
+    uint64_t totalWeight = 0;
+
+    for (auto& w: weight) {
+      totalWeight += w;
+    }
+
+    double maxError = 0.0;
+    for (size_t i = 0; i < keys.size(); ++i) {
+      double expected = 100.0 * weight[i] / totalWeight;
+      double actual = 100.0 * distribution[i] / 21000;
+
+      maxError = std::max(maxError, fabs(expected - actual));
+    }
+    // make sure the error rate is less than 1.0%
+    EXPECT_LE(maxError, 1.0);
+  }
+}
+
+TEST(RendezvousHash, LookupTableZeroWeights) {
+  RendezvousHash hashes;
+  for (int i = 0; i < 5; ++i) {
+    hashes.insert(folly::to<std::string>("key", i), 0);
+  }
+  hashes.buildLookupTable();
+  // nothing could take a slot, so lookups keep scoring the entries
+  EXPECT_FALSE(hashes.hasLookupTable());
+  EXPECT_EQ(hashes.get(12345).second, hashes.get(12345).second);
+}
+
+TEST(RendezvousHash, BoundedLoad) {
+  RendezvousHash hashes;
+  for (int i = 0; i < 10; ++i) {
+    hashes.insert(folly::to<std::string>("key", i), 1);
+  }
+  hashes.enableBoundedLoad(0.25);
+
+  // A hot key takes its entry to the cap, then the next ones
+  const std::string hot("hot");
+  size_t first = hashes.get(hot).second;
+  std::vector<size_t> picks;
+  for (int i = 0; i < 100; ++i) {
+    picks.push_back(hashes.getBounded(hot));
+  }
+  EXPECT_EQ(first, picks[0]);
+  uint64_t total = 0;
+  for (size_t i = 0; i < 10; ++i) {
+    EXPECT_LE(hashes.getLoad(i), 13);
+    total += hashes.getLoad(i);
+  }
+  EXPECT_EQ(100, total);
+  // Caps are tight while the total is low
+  EXPECT_NE(first, picks[1]);
+  for (auto index: picks) {
+    hashes.release(index);
+  }
+  EXPECT_EQ(0, hashes.getLoad(first));
+  // The overflow goes to the same entries in the same order every time
+  EXPECT_EQ(first, hashes.getBounded(hot));
+  for (int i = 1; i < 100; ++i) {
+    EXPECT_EQ(picks[i], hashes.getBounded(hot));
+  }
+}
@@ -0,0 +1,101 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <cstdio>
+#include <folly/FileUtil.h>
+#include <folly/json.h>
+#include <gtest/gtest.h>
+#include <proxygen/lib/utils/RingBufferTraceEventObserver.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace proxygen;
+using namespace std;
+
+namespace {
+
+TraceEvent makeEvent(int status) {
+  TraceEvent event(TraceEventType::RequestExchange, 7);
+  event.start(getCurrentTime());
+  event.addMeta(TraceFieldType::HTTPStatus, status);
+  event.addMeta(TraceFieldType::Error, "an error of some length");
+  event.end(getCurrentTime());
+  return event;
+}
+
+string readAll(FILE* file) {
+  string data;
+  lseek(fileno(file), 0, SEEK_SET);
+  CHECK(folly::readFile(fileno(file), data));
+  return data;
+}
+
+bool toChromeJson(const string& data, string& json) {
+  return traceRecordsToChromeJson(folly::ByteRange(folly::StringPiece(data)),
+                                  json);
+}
+
+}
+
+TEST(RingBufferTraceEventObserver, WritesChromeTrace) {
+  auto file = tmpfile();
+  ASSERT_NE(file, nullptr);
+  {
+    RingBufferTraceEventObserver observer(fileno(file));
+    observer.traceEventAvailable(makeEvent(200));
+    std::thread([&observer] {
+        observer.traceEventAvailable(makeEvent(404));
+      }).join();
+    observer.flush();
+    observer.traceEventAvailable(makeEvent(500));
+    EXPECT_EQ(observer.getDroppedEvents(), 0u);
+  }
+
+  auto data = readAll(file);
+  fclose(file);
+  string json;
+  ASSERT_TRUE(toChromeJson(data, json));
+  auto trace = folly::parseJson(json);
+  const auto& events = trace["traceEvents"];
+  ASSERT_EQ(events.size(), 3u);
+
+  // All threads' events are written, the main thread's ring first
+  EXPECT_EQ(events[0]["name"], "HTTPRequestExchange");
+  EXPECT_EQ(events[0]["parentID"], 7);
+  EXPECT_EQ(events[0]["args"]["http_status"], 200);
+  EXPECT_EQ(events[0]["args"]["error_description"],
+            "an error of some length");
+  EXPECT_EQ(events[1]["args"]["http_status"], 404);
+  EXPECT_NE(events[1]["tid"], events[0]["tid"]);
+  EXPECT_EQ(events[2]["args"]["http_status"], 500);
+  EXPECT_EQ(events[2]["tid"], events[0]["tid"]);
+
+  // A truncated record is refused
+  data.resize(data.size() - 8);
+  EXPECT_FALSE(toChromeJson(data, json));
+}
+
+TEST(RingBufferTraceEventObserver, DropsWhenFull) {
+  auto file = tmpfile();
+  ASSERT_NE(file, nullptr);
+  {
+    RingBufferTraceEventObserver observer(fileno(file), 2,
+                                          std::chrono::hours(1));
+    for (int i = 0; i < 3; ++i) {
+      observer.traceEventAvailable(makeEvent(200));
+    }
+    EXPECT_EQ(observer.getDroppedEvents(), 1u);
+  }
+
+  auto data = readAll(file);
+  fclose(file);
+  string json;
+  ASSERT_TRUE(toChromeJson(data, json));
+  EXPECT_EQ(folly::parseJson(json)["traceEvents"].size(), 2u);
+}
@@ -0,0 +1,44 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <gtest/gtest.h>
+#include <proxygen/lib/utils/StateMachine.h>
+
+namespace {
+
+enum class State: uint8_t { Off, On, Broken };
+enum class Event: uint8_t { push, kick };
+
+typedef DenseTransitionTable<State, Event, 3, 2> Table;
+
+constexpr Table::Transition kTransitions[] = {
+  {State::Off, Event::push, State::On},
+  {State::On, Event::push, State::Off},
+  {State::On, Event::kick, State::Broken},
+};
+
+constexpr Table kTable = Table::make(kTransitions);
+
+// Built by the compiler
+static_assert(kTable.next[0] == uint8_t(State::On) + 1, "Off push");
+static_assert(kTable.next[1] == 0, "Off kick");
+static_assert(kTable.next[3] == uint8_t(State::Broken) + 1, "On kick");
+
+}
+
+TEST(StateMachineTest, dense_table) {
+  auto next = kTable.find(State::Off, Event::push);
+  EXPECT_TRUE(next.second);
+  EXPECT_EQ(State::On, next.first);
+  next = kTable.find(State::On, Event::kick);
+  EXPECT_TRUE(next.second);
+  EXPECT_EQ(State::Broken, next.first);
+  EXPECT_FALSE(kTable.find(State::Off, Event::kick).second);
+  EXPECT_FALSE(kTable.find(State::Broken, Event::push).second);
+}
@@ -0,0 +1,90 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <gtest/gtest.h>
+#include <proxygen/lib/utils/ThreadLocalFreeList.h>
+#include <thread>
+
+using namespace proxygen;
+
+namespace {
+
+struct Object {
+  char pad[100];
+};
+
+typedef ThreadLocalFreeList<Object> FreeList;
+
+}
+
+TEST(ThreadLocalFreeListTest, reuse) {
+  FreeList::clear();
+  FreeList::takeCounts();
+  void* first = FreeList::allocate();
+  void* second = FreeList::allocate();
+  EXPECT_NE(first, second);
+  FreeList::deallocate(first);
+  EXPECT_EQ(FreeList::getNumIdle(), 1);
+  EXPECT_EQ(FreeList::allocate(), first);
+  EXPECT_EQ(FreeList::getNumIdle(), 0);
+
+  auto counts = FreeList::takeCounts();
+  EXPECT_EQ(counts.allocated, 2);
+  EXPECT_EQ(counts.reused, 1);
+  counts = FreeList::takeCounts();
+  EXPECT_EQ(counts.allocated, 0);
+  EXPECT_EQ(counts.reused, 0);
+
+  FreeList::deallocate(first);
+  FreeList::deallocate(second);
+  FreeList::clear();
+  EXPECT_EQ(FreeList::getNumIdle(), 0);
+}
+
+TEST(ThreadLocalFreeListTest, max_idle) {
+  FreeList::clear();
+  auto max = FreeList::getMaxIdle();
+  FreeList::setMaxIdle(1);
+  void* first = FreeList::allocate();
+  void* second = FreeList::allocate();
+  FreeList::deallocate(first);
+  FreeList::deallocate(second);
+  EXPECT_EQ(FreeList::getNumIdle(), 1);
+  FreeList::setMaxIdle(max);
+  FreeList::clear();
+}
+
+TEST(ThreadLocalFreeListTest, reserve) {
+  FreeList::clear();
+  FreeList::takeCounts();
+  FreeList::reserve(3);
+  EXPECT_EQ(FreeList::getNumIdle(), 3);
+  FreeList::reserve(2);
+  EXPECT_EQ(FreeList::getNumIdle(), 3);
+  FreeList::deallocate(FreeList::allocate());
+  EXPECT_EQ(FreeList::takeCounts().allocated, 0);
+
+  auto max = FreeList::getMaxIdle();
+  FreeList::setMaxIdle(4);
+  FreeList::reserve(10);
+  EXPECT_EQ(FreeList::getNumIdle(), 4);
+  FreeList::setMaxIdle(max);
+  FreeList::clear();
+}
+
+TEST(ThreadLocalFreeListTest, per_thread) {
+  FreeList::clear();
+  void* block = FreeList::allocate();
+  // Freed in another thread, it joins that thread's list
+  std::thread([block] {
+      FreeList::deallocate(block);
+      EXPECT_EQ(FreeList::getNumIdle(), 1);
+    }).join();
+  EXPECT_EQ(FreeList::getNumIdle(), 0);
+}
@@ -0,0 +1,82 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <gtest/gtest.h>
+#include <proxygen/lib/utils/TraceEvent.h>
+#include <proxygen/lib/utils/TraceEventContext.h>
+#include <proxygen/lib/utils/TraceEventObserver.h>
+
+using namespace proxygen;
+using namespace std;
+
+TEST(TraceEvent, MetaData) {
+  TraceEvent event(TraceEventType::RequestExchange);
+  EXPECT_TRUE(event.addMeta(TraceFieldType::HTTPStatus, 200));
+  EXPECT_TRUE(event.addMeta(TraceFieldType::Error, "timeout"));
+  EXPECT_TRUE(event.addMeta(TraceFieldType::ErrorStage, string("read")));
+  // Replaces the value
+  EXPECT_FALSE(event.addMeta(TraceFieldType::HTTPStatus, 404));
+
+  EXPECT_TRUE(event.hasTraceField(TraceFieldType::HTTPStatus));
+  EXPECT_FALSE(event.hasTraceField(TraceFieldType::CodecError));
+  EXPECT_EQ(event.getMetaData().size(), 3u);
+
+  int status = 0;
+  EXPECT_TRUE(event.readIntMeta(TraceFieldType::HTTPStatus, status));
+  EXPECT_EQ(status, 404);
+  string error;
+  EXPECT_TRUE(event.readStrMeta(TraceFieldType::Error, error));
+  EXPECT_EQ(error, "timeout");
+  EXPECT_FALSE(event.readStrMeta(TraceFieldType::CodecError, error));
+
+  // Iterated in field order
+  auto itr = event.getMetaDataItr();
+  ASSERT_TRUE(itr.isValid());
+  EXPECT_EQ(itr.getKey(), TraceFieldType::ErrorStage);
+  EXPECT_EQ(itr.getValueAs<string>(), "read");
+  itr.next();
+  ASSERT_TRUE(itr.isValid());
+  EXPECT_EQ(itr.getKey(), TraceFieldType::Error);
+  itr.next();
+  ASSERT_TRUE(itr.isValid());
+  EXPECT_EQ(itr.getKey(), TraceFieldType::HTTPStatus);
+  EXPECT_EQ(itr.getValueAs<string>(), "404");
+  itr.next();
+  EXPECT_FALSE(itr.isValid());
+}
+
+namespace {
+
+struct CountingObserver : public TraceEventObserver {
+  void traceEventAvailable(TraceEvent event) noexcept override {
+    events.push_back(std::move(event));
+  }
+
+  vector<TraceEvent> events;
+};
+
+}
+
+TEST(TraceEvent, ContextDelivers) {
+  CountingObserver first;
+  CountingObserver second;
+  TraceEventContext context(0, {&first, &second});
+
+  TraceEvent event(TraceEventType::RequestExchange);
+  event.addMeta(TraceFieldType::HTTPStatus, 200);
+  auto id = event.getID();
+  context.traceEventAvailable(std::move(event));
+
+  for (auto observer : {&first, &second}) {
+    ASSERT_EQ(observer->events.size(), 1u);
+    EXPECT_EQ(observer->events[0].getID(), id);
+    EXPECT_EQ(observer->events[0].getTraceFieldDataAs<int>(
+                TraceFieldType::HTTPStatus), 200);
+  }
+}
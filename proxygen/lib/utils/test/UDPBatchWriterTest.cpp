@@ -0,0 +1,72 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/FileUtil.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <proxygen/lib/utils/UDPBatchWriter.h>
+#include <string>
+#include <sys/socket.h>
+#include <vector>
+
+using namespace proxygen;
+
+class UDPBatchWriterTest : public testing::TestWithParam<bool> {
+ public:
+  void SetUp() override {
+    rx_ = socket(AF_INET, SOCK_DGRAM, 0);
+    tx_ = socket(AF_INET, SOCK_DGRAM, 0);
+    ASSERT_GE(rx_, 0);
+    ASSERT_GE(tx_, 0);
+    peer_.setFromIpPort("127.0.0.1", 0);
+    sockaddr_storage addr;
+    socklen_t len = peer_.getAddress(&addr);
+    ASSERT_EQ(0, bind(rx_, reinterpret_cast<sockaddr*>(&addr), len));
+    peer_.setFromLocalAddress(rx_);
+  }
+
+  void TearDown() override {
+    folly::closeNoInt(rx_);
+    folly::closeNoInt(tx_);
+  }
+
+ protected:
+  int rx_{-1};
+  int tx_{-1};
+  folly::SocketAddress peer_;
+};
+
+TEST_P(UDPBatchWriterTest, sends_in_order) {
+  UDPBatchWriter writer(tx_);
+  if (GetParam() && !UDPBatchWriter::isGSOSupported(tx_)) {
+    return;
+  }
+  writer.setUseGSO(GetParam());
+  // Runs of equal sizes, ended by a shorter datagram or not
+  std::vector<size_t> sizes{1000, 1000, 1000, 500, 1000, 1000, 1200, 3};
+  for (size_t i = 0; i < sizes.size(); i++) {
+    auto buf = folly::IOBuf::copyBuffer(std::string(sizes[i] / 2, 'a' + i));
+    buf->prependChain(folly::IOBuf::copyBuffer(
+                        std::string(sizes[i] - sizes[i] / 2, 'z')));
+    writer.write(peer_, std::move(buf));
+  }
+  writer.write(peer_, folly::IOBuf::create(0));
+  EXPECT_EQ(sizes.size(), writer.getNumPending());
+
+  EXPECT_EQ(ssize_t(sizes.size()), writer.flush());
+  EXPECT_EQ(0, writer.getNumPending());
+  for (size_t i = 0; i < sizes.size(); i++) {
+    char buf[2048];
+    EXPECT_EQ(ssize_t(sizes[i]), recv(rx_, buf, sizeof(buf), 0));
+    EXPECT_EQ(char('a' + i), buf[0]);
+    EXPECT_EQ('z', buf[sizes[i] - 1]);
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(GSO, UDPBatchWriterTest, testing::Bool());
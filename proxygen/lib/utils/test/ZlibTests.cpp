@@ -14,6 +14,7 @@
 #include <gtest/gtest.h>
 #include <proxygen/lib/utils/ZlibStreamCompressor.h>
 #include <proxygen/lib/utils/ZlibStreamDecompressor.h>
+#include <proxygen/lib/utils/ZlibStreamPool.h>
 
 using namespace folly;
 using namespace proxygen;
@@ -99,3 +100,123 @@ TEST_F(ZlibTests, compress_decompress_empty) {
     compressThenDecompress(ZlibCompressionType::GZIP, 4, makeBuf(0));
   });
 }
+
+TEST_F(ZlibTests, pooled_streams_are_reused) {
+  ZlibStreamPool::clear();
+  size_t before = ZlibStreamPool::getTotalAllocatedBytes();
+  z_stream* first;
+  {
+    auto deflater = ZlibStreamPool::getDeflater(6, 31, MAX_MEM_LEVEL);
+    ASSERT_TRUE(deflater != nullptr);
+    first = deflater.get();
+    EXPECT_GT(ZlibStreamPool::getAllocatedBytes(first), 0);
+    EXPECT_EQ(ZlibStreamPool::getTotalAllocatedBytes() - before,
+              ZlibStreamPool::getAllocatedBytes(first));
+  }
+  EXPECT_EQ(1, ZlibStreamPool::getNumIdleStreams());
+
+  // Other parameters get another stream
+  auto other = ZlibStreamPool::getDeflater(4, 31, MAX_MEM_LEVEL);
+  EXPECT_NE(first, other.get());
+  EXPECT_EQ(1, ZlibStreamPool::getNumIdleStreams());
+
+  auto again = ZlibStreamPool::getDeflater(6, 31, MAX_MEM_LEVEL);
+  EXPECT_EQ(first, again.get());
+  EXPECT_EQ(0, ZlibStreamPool::getNumIdleStreams());
+
+  other.reset();
+  again.reset();
+  ZlibStreamPool::clear();
+  EXPECT_EQ(0, ZlibStreamPool::getNumIdleStreams());
+  EXPECT_EQ(before, ZlibStreamPool::getTotalAllocatedBytes());
+}
+
+// A stream reused after compressing (or failing to decompress) starts over
+TEST_F(ZlibTests, pooled_streams_are_reset) {
+  for (int i = 0; i < 3; i++) {
+    ASSERT_NO_FATAL_FAILURE({
+      compressThenDecompress(ZlibCompressionType::GZIP, 6, makeBuf(2000));
+    });
+    ZlibStreamDecompressor zd(ZlibCompressionType::GZIP);
+    zd.decompress(IOBuf::copyBuffer("not gzip").get());
+    EXPECT_TRUE(zd.hasError());
+  }
+}
+
+TEST_F(ZlibTests, pool_max_idle_streams) {
+  ZlibStreamPool::clear();
+  ZlibStreamPool::setMaxIdleStreams(1);
+  {
+    auto a = ZlibStreamPool::getInflater(15);
+    auto b = ZlibStreamPool::getInflater(15);
+  }
+  EXPECT_EQ(1, ZlibStreamPool::getNumIdleStreams());
+  ZlibStreamPool::setMaxIdleStreams(16);
+  ZlibStreamPool::clear();
+}
+
+namespace {
+
+string deflateAll(z_stream* deflater, const string& input) {
+  string out(deflateBound(deflater, input.size()) + 64, '\0');
+  deflater->next_in = (Bytef*)input.data();
+  deflater->avail_in = input.size();
+  deflater->next_out = (Bytef*)&out[0];
+  deflater->avail_out = out.size();
+  EXPECT_EQ(Z_STREAM_END, deflate(deflater, Z_FINISH));
+  out.resize(out.size() - deflater->avail_out);
+  return out;
+}
+
+}
+
+// An inflater that takes the window size from the zlib header takes a
+// larger one after it was reused
+TEST_F(ZlibTests, pooled_inflaters_take_any_window) {
+  ZlibStreamPool::clear();
+  const string input = "accept-encoding: gzip\ncontent-type: text/html";
+  for (int windowBits : {9, 15, 9}) {
+    auto deflater = ZlibStreamPool::getDeflater(6, windowBits, 8);
+    ASSERT_TRUE(deflater != nullptr);
+    string compressed = deflateAll(deflater.get(), input);
+
+    auto inflater = ZlibStreamPool::getInflater(0);
+    ASSERT_TRUE(inflater != nullptr);
+    string out(input.size(), '\0');
+    inflater->next_in = (Bytef*)compressed.data();
+    inflater->avail_in = compressed.size();
+    inflater->next_out = (Bytef*)&out[0];
+    inflater->avail_out = out.size();
+    EXPECT_EQ(Z_STREAM_END, inflate(inflater.get(), Z_FINISH));
+    EXPECT_EQ(input, out);
+  }
+  EXPECT_EQ(3, ZlibStreamPool::getNumIdleStreams());
+  ZlibStreamPool::clear();
+}
+
+// Copies of the primed stream compress the same as a stream that ingests
+// the dictionary itself
+TEST_F(ZlibTests, primed_deflaters) {
+  ZlibStreamPool::clear();
+  size_t before = ZlibStreamPool::getTotalAllocatedBytes();
+  const string dict = "content-type text/html gzip deflate accept-encoding";
+  const string input = "accept-encoding: gzip\ncontent-type: text/html";
+  auto expected = ZlibStreamPool::getDeflater(6, 11, 1);
+  ASSERT_TRUE(expected != nullptr);
+  EXPECT_EQ(Z_OK, deflateSetDictionary(expected.get(), (Bytef*)dict.data(),
+                                       dict.size()));
+  string expectedOut = deflateAll(expected.get(), input);
+  expected.reset();
+
+  for (int i = 0; i < 2; i++) {
+    auto primed = ZlibStreamPool::getPrimedDeflater(
+      6, 11, 1, (const unsigned char*)dict.data(), dict.size());
+    ASSERT_TRUE(primed != nullptr);
+    EXPECT_GT(ZlibStreamPool::getAllocatedBytes(primed.get()), 0);
+    EXPECT_EQ(expectedOut, deflateAll(primed.get(), input));
+  }
+  // one idle stream from getDeflater(), the primed ones are never idle
+  EXPECT_EQ(1, ZlibStreamPool::getNumIdleStreams());
+  ZlibStreamPool::clear();
+  EXPECT_EQ(before, ZlibStreamPool::getTotalAllocatedBytes());
+}